@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,6 +27,7 @@
 #include "ps/CStr.h"
 #include "ps/DllLoader.h"
 #include "ps/Filesystem.h"
+#include "ps/ThreadPool.h"
 
 namespace Collada
 {
@@ -52,6 +53,41 @@ namespace
 		WriteBuffer* writeBuffer = static_cast<WriteBuffer*>(cb_data);
 		writeBuffer->Append(data, (size_t)length);
 	}
+
+	bool LoadSource(const PIVFS& vfs, const VfsPath& daeFilename, CStr& daeData)
+	{
+		// We need to null-terminate the buffer, so do it (possibly inefficiently)
+		// by converting to a CStr
+		CVFSFile daeFile;
+		if (daeFile.Load(vfs, daeFilename) != PSRETURN_OK)
+			return false;
+		daeData = daeFile.GetAsString();
+		return true;
+	}
+
+	/**
+	 * Reads a list of .dae files, for CColladaManager::GetLoadablePaths.
+	 * The converter itself isn't reentrant, so only the file loading
+	 * can be done in parallel.
+	 */
+	class CLoadSourcesTask : public CThreadPool::ITask
+	{
+	public:
+		CLoadSourcesTask(const PIVFS& vfs, const std::vector<VfsPath>& daeFilenames)
+			: m_VFS(vfs), m_DaeFilenames(daeFilenames), m_DaeData(daeFilenames.size()), m_Loaded(daeFilenames.size())
+		{
+		}
+
+		virtual void Run(size_t index)
+		{
+			m_Loaded[index] = LoadSource(m_VFS, m_DaeFilenames[index], m_DaeData[index]);
+		}
+
+		PIVFS m_VFS;
+		const std::vector<VfsPath>& m_DaeFilenames;
+		std::vector<CStr> m_DaeData;
+		std::vector<u8> m_Loaded; // (not vector<bool>, so threads can write separate elements)
+	};
 }
 
 class CColladaManagerImpl
@@ -76,6 +112,15 @@ public:
 	}
 
 	bool Convert(const VfsPath& daeFilename, const VfsPath& pmdFilename, CColladaManager::FileType type)
+	{
+		CStr daeData;
+		if (!LoadSource(m_VFS, daeFilename, daeData))
+			return false;
+
+		return Convert(daeFilename, daeData, pmdFilename, type);
+	}
+
+	bool Convert(const VfsPath& daeFilename, const CStr& daeData, const VfsPath& pmdFilename, CColladaManager::FileType type)
 	{
 		// To avoid always loading the DLL when it's usually not going to be
 		// used (and to do the same on Linux where delay-loading won't help),
@@ -130,16 +175,6 @@ public:
 		// Set the filename for the logger to report
 		set_logger(ColladaLog, const_cast<void*>(static_cast<const void*>(&daeFilename)));
 
-		// We need to null-terminate the buffer, so do it (possibly inefficiently)
-		// by converting to a CStr
-		CStr daeData;
-		{
-			CVFSFile daeFile;
-			if (daeFile.Load(m_VFS, daeFilename) != PSRETURN_OK)
-				return false;
-			daeData = daeFile.GetAsString();
-		}
-
 		// Do the conversion into a memory buffer
 		// We need to check the result, as archive builder needs to know if the source dae
 		//	was sucessfully converted to .pmd/psa
@@ -209,14 +244,6 @@ void CColladaManager::PrepareCacheKey(MD5& hash, u32& version)
 
 VfsPath CColladaManager::GetLoadablePath(const VfsPath& pathnameNoExtension, FileType type)
 {
-	std::wstring extn;
-	switch (type)
-	{
-	case PMD: extn = L".pmd"; break;
-	case PSA: extn = L".psa"; break;
-		// no other alternatives
-	}
-
 	/*
 
 	Algorithm:
@@ -251,52 +278,100 @@ VfsPath CColladaManager::GetLoadablePath(const VfsPath& pathnameNoExtension, Fil
 
 	*/
 
+	std::vector<VfsPath> pathnames(1, pathnameNoExtension);
+	std::vector<VfsPath> loadablePaths;
+	GetLoadablePaths(pathnames, type, loadablePaths);
+	return loadablePaths[0];
+}
+
+void CColladaManager::GetLoadablePaths(const std::vector<VfsPath>& pathnamesNoExtension, FileType type, std::vector<VfsPath>& loadablePaths)
+{
+	std::wstring extn;
+	switch (type)
+	{
+	case PMD: extn = L".pmd"; break;
+	case PSA: extn = L".psa"; break;
+		// no other alternatives
+	}
+
 	// Now we're looking for cached files
 	CCacheLoader cacheLoader(m_VFS, extn);
 	MD5 hash;
 	u32 version;
 	PrepareCacheKey(hash, version);
 
-	VfsPath cachePath;
-	VfsPath sourcePath = pathnameNoExtension.ChangeExtension(L".dae");
-	Status ret = cacheLoader.TryLoadingCached(sourcePath, hash, version, cachePath);
-	if (ret == INFO::OK)
-	{
-		// Found a valid cached version
-		return cachePath;
-	}
-	else if (ret == INFO::SKIPPED)
-	{
-		// No valid cached version was found - but source .dae exists
-		// We'll try converting it
-	}
-	else
+	loadablePaths.resize(pathnamesNoExtension.size());
+
+	// Indexes of the files that need converting, and their source .daes
+	std::vector<size_t> toConvert;
+	std::vector<VfsPath> daeFilenames;
+
+	for (size_t i = 0; i < pathnamesNoExtension.size(); ++i)
 	{
-		// No valid cached version was found, and no source .dae exists
-		ENSURE(ret < 0);
-		
-		// Check if source (uncached) .pmd/psa exists
-		sourcePath = pathnameNoExtension.ChangeExtension(extn);
-		if (m_VFS->GetFileInfo(sourcePath, NULL) != INFO::OK)
+		VfsPath cachePath;
+		VfsPath sourcePath = pathnamesNoExtension[i].ChangeExtension(L".dae");
+		Status ret = cacheLoader.TryLoadingCached(sourcePath, hash, version, cachePath);
+		if (ret == INFO::OK)
+		{
+			// Found a valid cached version
+			loadablePaths[i] = cachePath;
+		}
+		else if (ret == INFO::SKIPPED)
 		{
-			// Broken reference, the caller will need to handle this
-			return L"";
+			// No valid cached version was found - but source .dae exists
+			// We'll try converting it
+			loadablePaths[i] = cachePath;
+			toConvert.push_back(i);
+			daeFilenames.push_back(sourcePath);
 		}
 		else
 		{
-			return sourcePath;
+			// No valid cached version was found, and no source .dae exists
+			ENSURE(ret < 0);
+
+			// Check if source (uncached) .pmd/psa exists
+			sourcePath = pathnamesNoExtension[i].ChangeExtension(extn);
+			if (m_VFS->GetFileInfo(sourcePath, NULL) != INFO::OK)
+			{
+				// Broken reference, the caller will need to handle this
+				loadablePaths[i] = L"";
+			}
+			else
+			{
+				loadablePaths[i] = sourcePath;
+			}
 		}
 	}
 
-	// We have a source .dae and invalid cached version, so regenerate cached version
-	if (! m->Convert(sourcePath, cachePath, type))
+	// We have source .daes and invalid cached versions, so regenerate the cached
+	// versions. The .daes are read in parallel, in small batches to limit the
+	// memory usage, but the converter is not reentrant so it has to run serially
+	const size_t batchSize = 16;
+	for (size_t first = 0; first < daeFilenames.size(); first += batchSize)
 	{
-		// The COLLADA converter failed for some reason, this will need to be handled
-		//	by the caller
-		return L"";
-	}
+		std::vector<VfsPath> batch(daeFilenames.begin() + first, daeFilenames.begin() + std::min(first + batchSize, daeFilenames.size()));
+		CLoadSourcesTask task(m_VFS, batch);
+		if (g_ThreadPool && batch.size() > 1)
+		{
+			g_ThreadPool->ParallelFor(task, batch.size());
+		}
+		else
+		{
+			for (size_t j = 0; j < batch.size(); ++j)
+				task.Run(j);
+		}
 
-	return cachePath;
+		for (size_t j = 0; j < batch.size(); ++j)
+		{
+			VfsPath& loadablePath = loadablePaths[toConvert[first + j]];
+			if (!task.m_Loaded[j] || !m->Convert(batch[j], task.m_DaeData[j], loadablePath, type))
+			{
+				// The COLLADA converter failed for some reason, this will need to be handled
+				//	by the caller
+				loadablePath = L"";
+			}
+		}
+	}
 }
 
 bool CColladaManager::GenerateCachedFile(const VfsPath& sourcePath, FileType type, VfsPath& archiveCachePath)
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -46,6 +46,20 @@ public:
 	 */
 	VfsPath GetLoadablePath(const VfsPath& pathnameNoExtension, FileType type);
 
+	/**
+	 * Equivalent to calling GetLoadablePath on each of the given paths, but
+	 * faster when several files need converting: the source files are read
+	 * in parallel on the engine thread pool (if there is one).
+	 * The conversions themselves still run one at a time on the calling thread,
+	 * since the COLLADA DLL is not reentrant.
+	 *
+	 * @param pathnamesNoExtension paths and names, minus extensions, of files to load.
+	 * @param type FileType, .pmd or .psa
+	 * @param[out] loadablePaths full VFS path of each file to load, in the same
+	 *		  order, or empty string for each file that could not be loaded.
+	 */
+	void GetLoadablePaths(const std::vector<VfsPath>& pathnamesNoExtension, FileType type, std::vector<VfsPath>& loadablePaths);
+
 	/**
 	 * Converts DAE to archive cached .pmd/psa and outputs the resulting path
 	 * (used by archive builder)
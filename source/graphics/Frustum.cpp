@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -30,6 +30,17 @@ portal rendering, where a portal may have 3 or more edges.
 #include "Frustum.h"
 #include "maths/BoundingBoxAligned.h"
 #include "maths/MathUtil.h"
+#include "maths/Vector3DSoA.h"
+
+#if HAVE_SSE2
+# include <emmintrin.h>
+
+//Returns the elements of a where mask is set, else those of b
+static inline __m128 Select(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#endif
 
 CFrustum::CFrustum ()
 {
@@ -185,4 +196,237 @@ bool CFrustum::IsBoxVisible (const CVector3D &position,const CBoundingBoxAligned
 	return true;
 }
 
+bool CFrustum::IsBoxFullyVisible (const CBoundingBoxAligned &bounds) const
+{
+	//the box is inside if, for every plane, the nearest point in the box
+	//to that plane (the opposite corner to IsBoxVisible's) is in front of it
+	for (size_t i=0; i<m_NumPlanes; i++)
+	{
+		const CPlane& plane = m_aPlanes[i];
+		CVector3D NearPoint(
+			(plane.m_Norm.X > 0.0f) ? bounds[0].X : bounds[1].X,
+			(plane.m_Norm.Y > 0.0f) ? bounds[0].Y : bounds[1].Y,
+			(plane.m_Norm.Z > 0.0f) ? bounds[0].Z : bounds[1].Z);
+
+		if (plane.DistanceToPlane(NearPoint) < 0.0f)
+			return false;
+	}
+
+	return true;
+}
+
+void CFrustum::AreBoxesVisible (const CBoundingBoxAligned* boxes, size_t count, bool* visible) const
+{
+	CFrustumSoA(*this).AreBoxesVisible(boxes, count, visible);
+}
+
+void CFrustum::AreSpheresVisible (const CVector3DSoA& centers, const float* radii, bool* visible) const
+{
+	CFrustumSoA(*this).AreSpheresVisible(centers, radii, visible);
+}
+
+//(This must match the threshold for PS_BACK in CPlane::ClassifyPoint)
+static const float PLANE_EPS = 0.001f;
+
+CFrustumSoA::CFrustumSoA (const CFrustum& frustum)
+{
+	m_NumPlanes = frustum.GetNumPlanes();
+	m_NumGroups = (m_NumPlanes + 3) / 4;
+
+	for (size_t i=0; i<m_NumPlanes; i++)
+	{
+		const CPlane& plane = frustum[i];
+		m_NormX[i] = plane.m_Norm.X;
+		m_NormY[i] = plane.m_Norm.Y;
+		m_NormZ[i] = plane.m_Norm.Z;
+		m_Dist[i] = plane.m_Dist;
+
+		//For each plane, the furthest corner of every box is picked by the
+		//signs of the plane's normal (as in IsBoxVisible), so each component
+		//of it is either taken from the box's min or its max
+		m_FarIndex[i][0] = (plane.m_Norm.X > 0.0f) ? 1 : 0;
+		m_FarIndex[i][1] = (plane.m_Norm.Y > 0.0f) ? 1 : 0;
+		m_FarIndex[i][2] = (plane.m_Norm.Z > 0.0f) ? 1 : 0;
+	}
+
+	//Pad the last group with planes that everything is in front of
+	for (size_t i=m_NumPlanes; i<m_NumGroups*4; i++)
+	{
+		m_NormX[i] = m_NormY[i] = m_NormZ[i] = m_Dist[i] = 0.0f;
+		m_FarIndex[i][0] = m_FarIndex[i][1] = m_FarIndex[i][2] = 0;
+	}
+}
+
+bool CFrustumSoA::IsBoxVisible (const CBoundingBoxAligned& bounds) const
+{
+	//Test the furthest corner against four planes at once
+#if HAVE_SSE2
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 negEps = _mm_set1_ps(-PLANE_EPS);
+	const __m128 minX = _mm_set1_ps(bounds[0].X), maxX = _mm_set1_ps(bounds[1].X);
+	const __m128 minY = _mm_set1_ps(bounds[0].Y), maxY = _mm_set1_ps(bounds[1].Y);
+	const __m128 minZ = _mm_set1_ps(bounds[0].Z), maxZ = _mm_set1_ps(bounds[1].Z);
+
+	for (size_t g=0; g<m_NumGroups; g++)
+	{
+		const __m128 nx = _mm_loadu_ps(&m_NormX[g*4]);
+		const __m128 ny = _mm_loadu_ps(&m_NormY[g*4]);
+		const __m128 nz = _mm_loadu_ps(&m_NormZ[g*4]);
+		const __m128 dist = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(nx, Select(_mm_cmpgt_ps(nx, zero), maxX, minX)),
+			_mm_mul_ps(ny, Select(_mm_cmpgt_ps(ny, zero), maxY, minY))),
+			_mm_mul_ps(nz, Select(_mm_cmpgt_ps(nz, zero), maxZ, minZ))),
+			_mm_loadu_ps(&m_Dist[g*4]));
+		if (_mm_movemask_ps(_mm_cmplt_ps(dist, negEps)))
+			return false;
+	}
+#else
+	for (size_t i=0; i<m_NumPlanes; i++)
+	{
+		float dist = m_NormX[i] * bounds[m_FarIndex[i][0]].X +
+			m_NormY[i] * bounds[m_FarIndex[i][1]].Y +
+			m_NormZ[i] * bounds[m_FarIndex[i][2]].Z +
+			m_Dist[i];
+		if (dist < -PLANE_EPS)
+			return false;
+	}
+#endif
+
+	return true;
+}
+
+bool CFrustumSoA::IsBoxFullyVisible (const CBoundingBoxAligned& bounds) const
+{
+	//Test the nearest corner against four planes at once
+#if HAVE_SSE2
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 minX = _mm_set1_ps(bounds[0].X), maxX = _mm_set1_ps(bounds[1].X);
+	const __m128 minY = _mm_set1_ps(bounds[0].Y), maxY = _mm_set1_ps(bounds[1].Y);
+	const __m128 minZ = _mm_set1_ps(bounds[0].Z), maxZ = _mm_set1_ps(bounds[1].Z);
+
+	for (size_t g=0; g<m_NumGroups; g++)
+	{
+		const __m128 nx = _mm_loadu_ps(&m_NormX[g*4]);
+		const __m128 ny = _mm_loadu_ps(&m_NormY[g*4]);
+		const __m128 nz = _mm_loadu_ps(&m_NormZ[g*4]);
+		const __m128 dist = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(nx, Select(_mm_cmpgt_ps(nx, zero), minX, maxX)),
+			_mm_mul_ps(ny, Select(_mm_cmpgt_ps(ny, zero), minY, maxY))),
+			_mm_mul_ps(nz, Select(_mm_cmpgt_ps(nz, zero), minZ, maxZ))),
+			_mm_loadu_ps(&m_Dist[g*4]));
+		if (_mm_movemask_ps(_mm_cmplt_ps(dist, zero)))
+			return false;
+	}
+#else
+	for (size_t i=0; i<m_NumPlanes; i++)
+	{
+		float dist = m_NormX[i] * bounds[1-m_FarIndex[i][0]].X +
+			m_NormY[i] * bounds[1-m_FarIndex[i][1]].Y +
+			m_NormZ[i] * bounds[1-m_FarIndex[i][2]].Z +
+			m_Dist[i];
+		if (dist < 0.0f)
+			return false;
+	}
+#endif
+
+	return true;
+}
+
+void CFrustumSoA::AreBoxesVisible (const CBoundingBoxAligned* boxes, size_t count, bool* visible) const
+{
+	size_t b = 0;
+
+#if HAVE_SSE2
+	//Test four boxes against one plane at a time
+	const __m128 negEps = _mm_set1_ps(-PLANE_EPS);
+	for (; b+4 <= count; b+=4)
+	{
+		const CBoundingBoxAligned* box = &boxes[b];
+
+		//Gather the coordinates of the four boxes' corners
+		__m128 corner[2][3];
+		for (int k=0; k<2; k++)
+		{
+			corner[k][0] = _mm_setr_ps(box[0][k].X, box[1][k].X, box[2][k].X, box[3][k].X);
+			corner[k][1] = _mm_setr_ps(box[0][k].Y, box[1][k].Y, box[2][k].Y, box[3][k].Y);
+			corner[k][2] = _mm_setr_ps(box[0][k].Z, box[1][k].Z, box[2][k].Z, box[3][k].Z);
+		}
+
+		int mask = 0;
+		for (size_t i=0; i<m_NumPlanes; i++)
+		{
+			__m128 dist = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(_mm_set1_ps(m_NormX[i]), corner[m_FarIndex[i][0]][0]),
+				_mm_mul_ps(_mm_set1_ps(m_NormY[i]), corner[m_FarIndex[i][1]][1])),
+				_mm_mul_ps(_mm_set1_ps(m_NormZ[i]), corner[m_FarIndex[i][2]][2])),
+				_mm_set1_ps(m_Dist[i]));
+			mask |= _mm_movemask_ps(_mm_cmplt_ps(dist, negEps));
+
+			//Stop early once all four are known to be outside
+			if (mask == 0xF)
+				break;
+		}
+
+		for (size_t k=0; k<4; k++)
+			visible[b+k] = !(mask & (1 << k));
+	}
+#endif
+
+	for (; b<count; b++)
+		visible[b] = IsBoxVisible(boxes[b]);
+}
+
+void CFrustumSoA::AreSpheresVisible (const CVector3DSoA& centers, const float* radii, bool* visible) const
+{
+	const size_t count = centers.GetSize();
+	const float* X = centers.GetX();
+	const float* Y = centers.GetY();
+	const float* Z = centers.GetZ();
+
+	size_t s = 0;
+
+#if HAVE_SSE2
+	//Test four spheres against one plane at a time
+	const __m128 zero = _mm_setzero_ps();
+	for (; s+4 <= count; s+=4)
+	{
+		//The component arrays are aligned, so four centers can be loaded directly
+		const __m128 x = _mm_load_ps(X + s);
+		const __m128 y = _mm_load_ps(Y + s);
+		const __m128 z = _mm_load_ps(Z + s);
+		const __m128 radius = _mm_loadu_ps(radii + s);
+
+		int mask = 0;
+		for (size_t i=0; i<m_NumPlanes; i++)
+		{
+			__m128 dist = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(_mm_set1_ps(m_NormX[i]), x),
+				_mm_mul_ps(_mm_set1_ps(m_NormY[i]), y)),
+				_mm_mul_ps(_mm_set1_ps(m_NormZ[i]), z)),
+				_mm_set1_ps(m_Dist[i]));
+			//(Same conditions as CFrustum::IsSphereVisible)
+			mask |= _mm_movemask_ps(_mm_and_ps(
+				_mm_cmplt_ps(dist, zero),
+				_mm_cmpgt_ps(_mm_sub_ps(zero, dist), radius)));
+
+			if (mask == 0xF)
+				break;
+		}
+
+		for (size_t k=0; k<4; k++)
+			visible[s+k] = !(mask & (1 << k));
+	}
+#endif
 
+	for (; s<count; s++)
+	{
+		bool vis = true;
+		for (size_t i=0; i<m_NumPlanes && vis; i++)
+		{
+			float dist = m_NormX[i] * X[s] + m_NormY[i] * Y[s] + m_NormZ[i] * Z[s] + m_Dist[i];
+			if (dist < 0 && -dist > radii[s])
+				vis = false;
+		}
+		visible[s] = vis;
+	}
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -34,6 +34,7 @@ portal rendering, where a portal may have 3 or more edges.
 #define MAX_NUM_FRUSTUM_PLANES		(10)
 
 class CBoundingBoxAligned;
+class CVector3DSoA;
 
 class CFrustum
 {
@@ -57,6 +58,19 @@ public:
 	bool IsSphereVisible (const CVector3D &center, float radius) const;
 	bool IsBoxVisible (const CVector3D &position,const CBoundingBoxAligned &bounds) const;
 
+	//Returns true if the whole box is inside the frustum (so anything inside
+	//the box is visible too)
+	bool IsBoxFullyVisible (const CBoundingBoxAligned &bounds) const;
+
+	//Tests many boxes at once, setting visible[i] to IsBoxVisible(0, boxes[i]).
+	//This avoids the per-box branching and uses SIMD where available
+	//(see CFrustumSoA)
+	void AreBoxesVisible (const CBoundingBoxAligned* boxes, size_t count, bool* visible) const;
+
+	//Tests many spheres at once, setting visible[i] to
+	//IsSphereVisible(centers.Get(i), radii[i]) for every element of centers
+	void AreSpheresVisible (const CVector3DSoA& centers, const float* radii, bool* visible) const;
+
 	CPlane& operator[](size_t idx) { return m_aPlanes[idx]; }
 	const CPlane& operator[](size_t idx) const { return m_aPlanes[idx]; }
 
@@ -68,4 +82,45 @@ private:
 	size_t m_NumPlanes;
 };
 
+/**
+ * A copy of a CFrustum's planes in structure-of-arrays layout (the components
+ * of the normals and the distances in separate arrays, padded to a multiple
+ * of 4 planes), for culling many objects against the same frustum.
+ * Single boxes are tested against four planes at a time, and batches against
+ * one plane at a time for four objects, stopping as soon as all four are
+ * known to be outside. The results are identical to CFrustum's.
+ *
+ * This is a snapshot of the planes, so it must be constructed again if the
+ * frustum changes.
+ */
+class CFrustumSoA
+{
+public:
+	CFrustumSoA (const CFrustum& frustum);
+
+	//Equivalent to CFrustum::IsBoxVisible(CVector3D(0, 0, 0), bounds)
+	bool IsBoxVisible (const CBoundingBoxAligned& bounds) const;
+
+	//Equivalent to CFrustum::IsBoxFullyVisible(bounds)
+	bool IsBoxFullyVisible (const CBoundingBoxAligned& bounds) const;
+
+	void AreBoxesVisible (const CBoundingBoxAligned* boxes, size_t count, bool* visible) const;
+	void AreSpheresVisible (const CVector3DSoA& centers, const float* radii, bool* visible) const;
+
+private:
+	enum { MAX_PADDED_PLANES = (MAX_NUM_FRUSTUM_PLANES + 3) & ~3 };
+
+	float m_NormX[MAX_PADDED_PLANES];
+	float m_NormY[MAX_PADDED_PLANES];
+	float m_NormZ[MAX_PADDED_PLANES];
+	float m_Dist[MAX_PADDED_PLANES];
+
+	//Which corner of a box (0 = min, 1 = max) is furthest along each plane's
+	//normal, for each axis
+	int m_FarIndex[MAX_PADDED_PLANES][3];
+
+	size_t m_NumPlanes;
+	size_t m_NumGroups; //groups of 4 planes, including the padding
+};
+
 #endif
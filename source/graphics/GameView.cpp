@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -514,19 +514,29 @@ void CGameView::EnumerateObjects(const CFrustum& frustum, SceneCollector* c)
 	CTerrain* pTerrain = m->Game->GetWorld()->GetTerrain();
 	const ssize_t patchesPerSide = pTerrain->GetPatchesPerSide();
 
-	// find out which patches will be drawn
+	// find out which patches will be drawn, testing all their bounds at once
+	std::vector<char> visible(patchesPerSide*patchesPerSide, 1);
+	if (m->Culling) {
+		std::vector<CBoundingBoxAligned> bounds(patchesPerSide*patchesPerSide);
+		const float waterHeight = g_Renderer.GetWaterManager()->m_WaterHeight + 0.001f;
+		for (ssize_t j=0; j<patchesPerSide; j++) {
+			for (ssize_t i=0; i<patchesPerSide; i++) {
+				// If the patch is underwater, calculate a bounding box that also contains the water plane
+				CBoundingBoxAligned& patchBounds = bounds[j*patchesPerSide + i];
+				patchBounds = pTerrain->GetPatch(i,j)->GetWorldBounds();	// can't fail
+				if(patchBounds[1].Y < waterHeight) {
+					patchBounds[1].Y = waterHeight;
+				}
+			}
+		}
+		frustum.AreBoxesVisible(&bounds[0], bounds.size(), (bool*)&visible[0]);
+	}
+
 	for (ssize_t j=0; j<patchesPerSide; j++) {
 		for (ssize_t i=0; i<patchesPerSide; i++) {
 			CPatch* patch=pTerrain->GetPatch(i,j);	// can't fail
 
-			// If the patch is underwater, calculate a bounding box that also contains the water plane
-			CBoundingBoxAligned bounds = patch->GetWorldBounds();
-			float waterHeight = g_Renderer.GetWaterManager()->m_WaterHeight + 0.001f;
-			if(bounds[1].Y < waterHeight) {
-				bounds[1].Y = waterHeight;
-			}
-
-			if (!m->Culling || frustum.IsBoxVisible (CVector3D(0,0,0), bounds)) {
+			if (visible[j*patchesPerSide + i]) {
 				//c->Submit(patch);
 
 				// set the renderstate for this patch
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -28,6 +28,10 @@
 
 #include <cmath>
 
+#if HAVE_SSE2
+# include <emmintrin.h>
+#endif
+
 CHeightMipmap::CHeightMipmap()
 {
 }
@@ -62,14 +66,30 @@ void CHeightMipmap::Update(const u16* ptr, size_t left, size_t bottom, size_t ri
 
 	for (size_t i = 0; i < m_Mipmap.size(); ++i)
 	{
-		// update window
-		left = clamp<size_t>((size_t)floorf((float)left / mapSize * m_Mipmap[i].m_MapSize), 0, m_Mipmap[i].m_MapSize - 1);
-		bottom = clamp<size_t>((size_t)floorf((float)bottom / mapSize * m_Mipmap[i].m_MapSize), 0, m_Mipmap[i].m_MapSize - 1);
-
-		right = clamp<size_t>((size_t)ceilf((float)right / mapSize * m_Mipmap[i].m_MapSize), 0, m_Mipmap[i].m_MapSize);
-		top = clamp<size_t>((size_t)ceilf((float)top / mapSize * m_Mipmap[i].m_MapSize), 0, m_Mipmap[i].m_MapSize);
-
-		// TODO: should verify that the bounds calculations are actually correct
+		// Find the window of this level that reads from the changed window of the previous one,
+		// so each level only does work proportional to the changed area
+		const size_t outSize = m_Mipmap[i].m_MapSize;
+		if (outSize * 2 == mapSize)
+		{
+			// each output cell (x, z) is the average of input cells (2x, 2z) to (2x+1, 2z+1)
+			left /= 2;
+			bottom /= 2;
+			right = (right + 1) / 2;
+			top = (top + 1) / 2;
+		}
+		else
+		{
+			// each output cell reads from input cells floor(x*mapSize/outSize) and the one after it
+			// (with some rounding error, so include an extra cell on each side)
+			left = (left > 1 ? (left - 2) * outSize / mapSize : 0);
+			bottom = (bottom > 1 ? (bottom - 2) * outSize / mapSize : 0);
+			right = right * outSize / mapSize + 2;
+			top = top * outSize / mapSize + 2;
+		}
+		left = std::min(left, outSize - 1);
+		bottom = std::min(bottom, outSize - 1);
+		right = clamp<size_t>(right, left + 1, outSize);
+		top = clamp<size_t>(top, bottom + 1, outSize);
 
 		// update mipmap
 		BilinearUpdate(m_Mipmap[i], mapSize, ptr, left, bottom, right, top);
@@ -154,19 +174,56 @@ void CHeightMipmap::HalfResizeUpdate(SMipmap &out_mipmap, size_t mapSize, const
 	ENSURE(right > left && right <= out_mipmap.m_MapSize);
 	ENSURE(top > bottom && top <= out_mipmap.m_MapSize);
 
+#if HAVE_SSE2
+	const __m128i lowMask = _mm_set1_epi32(0xFFFF);
+	const __m128i bias32 = _mm_set1_epi32(0x8000);
+	const __m128i bias16 = _mm_set1_epi16((short)0x8000);
+#endif
+
 	for (size_t dstZ = bottom; dstZ < top; ++dstZ)
 	{
-		for (size_t dstX = left; dstX < right; ++dstX)
+		const u16* row0 = ptr + (dstZ << 1) * mapSize;
+		const u16* row1 = row0 + mapSize;
+		u16* out = out_mipmap.m_Heightmap + dstZ * out_mipmap.m_MapSize;
+
+		size_t dstX = left;
+
+#if HAVE_SSE2
+		// 8 output texels at a time. Each 32-bit lane of a load holds a horizontal pair
+		// of input texels, which are summed as 32-bit values so they can't overflow
+		for (; dstX + 8 <= right; dstX += 8)
 		{
-			size_t srcX = dstX << 1;
-			size_t srcZ = dstZ << 1;
+			const size_t srcX = dstX << 1;
+			const __m128i a0 = _mm_loadu_si128((const __m128i*)(row0 + srcX));
+			const __m128i a1 = _mm_loadu_si128((const __m128i*)(row0 + srcX + 8));
+			const __m128i b0 = _mm_loadu_si128((const __m128i*)(row1 + srcX));
+			const __m128i b1 = _mm_loadu_si128((const __m128i*)(row1 + srcX + 8));
+
+			__m128i sum0 = _mm_add_epi32(
+				_mm_add_epi32(_mm_and_si128(a0, lowMask), _mm_srli_epi32(a0, 16)),
+				_mm_add_epi32(_mm_and_si128(b0, lowMask), _mm_srli_epi32(b0, 16)));
+			__m128i sum1 = _mm_add_epi32(
+				_mm_add_epi32(_mm_and_si128(a1, lowMask), _mm_srli_epi32(a1, 16)),
+				_mm_add_epi32(_mm_and_si128(b1, lowMask), _mm_srli_epi32(b1, 16)));
+
+			// packs_epi32 saturates to signed 16-bit, so shift the range down
+			// before packing and back up afterwards
+			sum0 = _mm_sub_epi32(_mm_srli_epi32(sum0, 2), bias32);
+			sum1 = _mm_sub_epi32(_mm_srli_epi32(sum1, 2), bias32);
+			_mm_storeu_si128((__m128i*)(out + dstX), _mm_xor_si128(_mm_packs_epi32(sum0, sum1), bias16));
+		}
+#endif
+
+		for (; dstX < right; ++dstX)
+		{
+			const size_t srcX = dstX << 1;
 
-			u16 h00 = ptr[srcX + 0 + srcZ * mapSize];
-			u16 h10 = ptr[srcX + 1 + srcZ * mapSize];
-			u16 h01 = ptr[srcX + 0 + (srcZ + 1) * mapSize];
-			u16 h11 = ptr[srcX + 1 + (srcZ + 1) * mapSize];
+			u16 h00 = row0[srcX + 0];
+			u16 h10 = row0[srcX + 1];
+			u16 h01 = row1[srcX + 0];
+			u16 h11 = row1[srcX + 1];
 
-			out_mipmap.m_Heightmap[dstX + dstZ * out_mipmap.m_MapSize] = (h00 + h10 + h01 + h11) / 4;
+			out[dstX] = (h00 + h10 + h01 + h11) / 4;
 		}
 	}
 }
@@ -191,25 +248,71 @@ void CHeightMipmap::BilinearUpdate(SMipmap &out_mipmap, size_t mapSize, const u1
 	}
 	else
 	{
+		// The source column and weight of each output column are the same for every row,
+		// so compute them once
+		std::vector<size_t> srcXs(right - left);
+		std::vector<float> fxs(right - left);
+		for (size_t dstX = left; dstX < right; ++dstX)
+		{
+			const float x = ((float)dstX / (float)out_mipmap.m_MapSize) * mapSize;
+			const size_t srcX = clamp<size_t>((size_t)x, 0, mapSize - 2);
+			srcXs[dstX - left] = srcX;
+			fxs[dstX - left] = clamp<float>(x - srcX, 0.0f, 1.0f);
+		}
+
 		for (size_t dstZ = bottom; dstZ < top; ++dstZ)
 		{
-			for (size_t dstX = left; dstX < right; ++dstX)
+			const float z = ((float)dstZ / (float)out_mipmap.m_MapSize) * mapSize;
+			const size_t srcZ = clamp<size_t>((size_t)z, 0, mapSize - 2);
+			const float fz = clamp<float>(z - srcZ, 0.0f, 1.0f);
+
+			const u16* row0 = ptr + srcZ * mapSize;
+			const u16* row1 = row0 + mapSize;
+			u16* out = out_mipmap.m_Heightmap + dstZ * out_mipmap.m_MapSize;
+
+			size_t dstX = left;
+
+#if HAVE_SSE2
+			// 4 output texels at a time, with the same operations in the same order
+			// as the scalar loop so the results are identical
+			const __m128 one = _mm_set1_ps(1.f);
+			const __m128 vfz = _mm_set1_ps(fz);
+			const __m128 vfz1 = _mm_sub_ps(one, vfz);
+			const __m128i bias32 = _mm_set1_epi32(0x8000);
+			const __m128i bias16 = _mm_set1_epi16((short)0x8000);
+			for (; dstX + 4 <= right; dstX += 4)
 			{
-				const float x = ((float)dstX / (float)out_mipmap.m_MapSize) * mapSize;
-				const float z = ((float)dstZ / (float)out_mipmap.m_MapSize) * mapSize;
-
-				const size_t srcX = clamp<size_t>((size_t)x, 0, mapSize - 2);
-				const size_t srcZ = clamp<size_t>((size_t)z, 0, mapSize - 2);
+				const size_t* sx = &srcXs[dstX - left];
+				const __m128 h00 = _mm_set_ps(row0[sx[3]], row0[sx[2]], row0[sx[1]], row0[sx[0]]);
+				const __m128 h10 = _mm_set_ps(row0[sx[3]+1], row0[sx[2]+1], row0[sx[1]+1], row0[sx[0]+1]);
+				const __m128 h01 = _mm_set_ps(row1[sx[3]], row1[sx[2]], row1[sx[1]], row1[sx[0]]);
+				const __m128 h11 = _mm_set_ps(row1[sx[3]+1], row1[sx[2]+1], row1[sx[1]+1], row1[sx[0]+1]);
+
+				const __m128 fx = _mm_loadu_ps(&fxs[dstX - left]);
+				const __m128 fx1 = _mm_sub_ps(one, fx);
+
+				__m128 h = _mm_mul_ps(_mm_mul_ps(fx1, vfz1), h00);
+				h = _mm_add_ps(h, _mm_mul_ps(_mm_mul_ps(fx, vfz1), h10));
+				h = _mm_add_ps(h, _mm_mul_ps(_mm_mul_ps(fx1, vfz), h01));
+				h = _mm_add_ps(h, _mm_mul_ps(_mm_mul_ps(fx, vfz), h11));
+
+				// (see HalfResizeUpdate for the packing)
+				const __m128i hi = _mm_sub_epi32(_mm_cvttps_epi32(h), bias32);
+				_mm_storel_epi64((__m128i*)(out + dstX), _mm_xor_si128(_mm_packs_epi32(hi, hi), bias16));
+			}
+#endif
 
-				const float fx = clamp<float>(x - srcX, 0.0f, 1.0f);
-				const float fz = clamp<float>(z - srcZ, 0.0f, 1.0f);
+			for (; dstX < right; ++dstX)
+			{
+				const size_t srcX = srcXs[dstX - left];
+				const float fx = fxs[dstX - left];
 
-				const float h00 = ptr[srcX + 0 + srcZ * mapSize];
-				const float h10 = ptr[srcX + 1 + srcZ * mapSize];
-				const float h01 = ptr[srcX + 0 + (srcZ + 1) * mapSize];
-				const float h11 = ptr[srcX + 1 + (srcZ + 1) * mapSize];
+				const float h00 = row0[srcX + 0];
+				const float h10 = row0[srcX + 1];
+				const float h01 = row1[srcX + 0];
+				const float h11 = row1[srcX + 1];
 
-				out_mipmap.m_Heightmap[dstX + dstZ * out_mipmap.m_MapSize] = (u16)
+				out[dstX] = (u16)
 					((1.f - fx) * (1.f - fz) * h00 +
 							fx  * (1.f - fz) * h10 +
 					 (1.f - fx) *        fz  * h01 +
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -31,6 +31,10 @@
 #include "simulation2/components/ICmpRangeManager.h"
 #include "simulation2/components/ICmpTerrain.h"
 
+#if HAVE_SSE2
+# include <emmintrin.h>
+#endif
+
 /*
 
 The LOS bitmap is computed with one value per map vertex, based on
@@ -44,14 +48,59 @@ then the blur shifts the image back into the corner.
 
 The blurred bitmap is then uploaded into a GL texture for use by the renderer.
 
+CCmpRangeManager tells us which blocks of vertexes have changed since the last
+update, so usually only the areas around them need to be regenerated and uploaded.
+
 */
 
 
 // Blur with a NxN filter, where N = g_BlurSize must be an odd number.
 static const size_t g_BlurSize = 7;
 
+/**
+ * Sets dst[i] to the 7-tap binomial blur of src[i + k*stride] (for k = 0..6),
+ * for 0 <= i < n. dst may be the same as src.
+ */
+static void BlurLine(const u8* src, size_t stride, u8* dst, size_t n)
+{
+	size_t i = 0;
+
+#if HAVE_SSE2
+	// (The maximum sum is 255*64, so this can be done in 16-bit lanes)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c6 = _mm_set1_epi16(6);
+	const __m128i c15 = _mm_set1_epi16(15);
+	const __m128i c20 = _mm_set1_epi16(20);
+	for (; i + 8 <= n; i += 8)
+	{
+#define LOAD(k) _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src + i + (k)*stride)), zero)
+		__m128i sum = _mm_add_epi16(LOAD(0), LOAD(6));
+		sum = _mm_add_epi16(sum, _mm_mullo_epi16(c6, _mm_add_epi16(LOAD(1), LOAD(5))));
+		sum = _mm_add_epi16(sum, _mm_mullo_epi16(c15, _mm_add_epi16(LOAD(2), LOAD(4))));
+		sum = _mm_add_epi16(sum, _mm_mullo_epi16(c20, LOAD(3)));
+#undef LOAD
+		sum = _mm_srli_epi16(sum, 6);
+		_mm_storel_epi64((__m128i*)(dst + i), _mm_packus_epi16(sum, sum));
+	}
+#endif
+
+	for (; i < n; ++i)
+	{
+		const u8* d = src + i;
+		dst[i] = (
+			1*d[0*stride] +
+			6*d[1*stride] +
+			15*d[2*stride] +
+			20*d[3*stride] +
+			15*d[4*stride] +
+			6*d[5*stride] +
+			1*d[6*stride]
+		) / 64;
+	}
+}
+
 CLOSTexture::CLOSTexture(CSimulation2& simulation) :
-	m_Simulation(simulation), m_Dirty(true), m_Texture(0), m_smoothFbo(0), m_MapSize(0), m_TextureSize(0), whichTex(true)
+	m_Simulation(simulation), m_Dirty(true), m_PlayerID(INVALID_PLAYER), m_Texture(0), m_smoothFbo(0), m_MapSize(0), m_TextureSize(0), whichTex(true)
 {
 	if (CRenderer::IsInitialised() && g_Renderer.m_Options.m_SmoothLOS)
 	{
@@ -78,11 +127,11 @@ CLOSTexture::~CLOSTexture()
 
 void CLOSTexture::DeleteTexture()
 {
-	glDeleteTextures(1, &m_Texture);
+	ogl_DeleteTextures(1, &m_Texture);
 	if (CRenderer::IsInitialised() && g_Renderer.m_Options.m_SmoothLOS)
 	{
-		glDeleteTextures(1, &m_TextureSmooth1);
-		glDeleteTextures(1, &m_TextureSmooth2);
+		ogl_DeleteTextures(1, &m_TextureSmooth1);
+		ogl_DeleteTextures(1, &m_TextureSmooth2);
 	}
 	m_Texture = 0;
 }
@@ -138,7 +187,7 @@ void CLOSTexture::InterpolateLOS()
 	m_smoothShader->BeginPass();
 	CShaderProgramPtr shader = m_smoothShader->GetShader();
 	
-	glDisable(GL_BLEND);
+	ogl_Disable(GL_BLEND);
 	
 	shader->Bind();
 	
@@ -286,14 +335,30 @@ void CLOSTexture::RecomputeTexture(int unit)
 
 	PROFILE("recompute LOS texture");
 
-	std::vector<u8> losData;
-	losData.resize(GetBitmapSize(m_MapSize, m_MapSize));
-
 	CmpPtr<ICmpRangeManager> cmpRangeManager(m_Simulation, SYSTEM_ENTITY);
 	if (!cmpRangeManager)
 		return;
 
-	ICmpRangeManager::CLosQuerier los(cmpRangeManager->GetLosQuerier(g_Game->GetPlayerID()));
+	const player_id_t player = g_Game->GetPlayerID();
+	ICmpRangeManager::CLosQuerier los(cmpRangeManager->GetLosQuerier(player));
+
+	std::vector<u8> dirtyBlocks;
+	cmpRangeManager->GetAndClearLosDirtyBlocks(dirtyBlocks);
+
+	// Only update the changed areas if there aren't too many of them
+	// (else a single upload of the whole texture is cheaper)
+	const size_t blocksPerSide = (m_MapSize + ICmpRangeManager::LOS_DIRTY_BLOCK_SIZE-1) / ICmpRangeManager::LOS_DIRTY_BLOCK_SIZE;
+	if (!recreated && player == m_PlayerID && dirtyBlocks.size() == blocksPerSide*blocksPerSide &&
+		(size_t)std::count(dirtyBlocks.begin(), dirtyBlocks.end(), 0) > dirtyBlocks.size()/2)
+	{
+		RecomputeDirtyBlocks(unit, los, dirtyBlocks, blocksPerSide);
+		return;
+	}
+
+	m_PlayerID = player;
+
+	std::vector<u8> losData;
+	losData.resize(GetBitmapSize(m_MapSize, m_MapSize));
 
 	GenerateBitmap(los, &losData[0], m_MapSize, m_MapSize);
 
@@ -309,30 +374,112 @@ void CLOSTexture::RecomputeTexture(int unit)
 	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_MapSize + g_BlurSize - 1, m_MapSize + g_BlurSize - 1, GL_ALPHA, GL_UNSIGNED_BYTE, &losData[0]);
 }
 
+void CLOSTexture::RecomputeDirtyBlocks(int unit, ICmpRangeManager::CLosQuerier los, const std::vector<u8>& dirtyBlocks, size_t blocksPerSide)
+{
+	const size_t blockSize = ICmpRangeManager::LOS_DIRTY_BLOCK_SIZE;
+	const size_t border = g_BlurSize/2; // the blur spreads changes this far
+
+	std::vector<u8> losData;
+	std::vector<u8> uploadData;
+
+	g_Renderer.BindTexture(unit, m_Texture);
+
+	for (size_t bj = 0; bj < blocksPerSide; ++bj)
+	{
+		for (size_t bi = 0; bi < blocksPerSide; ++bi)
+		{
+			if (!dirtyBlocks[bi + bj*blocksPerSide])
+				continue;
+
+			// Combine the horizontal run of dirty blocks into a single update
+			size_t bi1 = bi + 1;
+			while (bi1 < blocksPerSide && dirtyBlocks[bi1 + bj*blocksPerSide])
+				++bi1;
+
+			const size_t x0 = bi*blockSize < border ? 0 : bi*blockSize - border;
+			const size_t y0 = bj*blockSize < border ? 0 : bj*blockSize - border;
+			const size_t x1 = std::min(bi1*blockSize + border, (size_t)m_MapSize);
+			const size_t y1 = std::min((bj+1)*blockSize + border, (size_t)m_MapSize);
+			const size_t w = x1 - x0;
+			const size_t h = y1 - y0;
+
+			losData.resize(GetBitmapSize(w, h));
+			GenerateBitmap(los, &losData[0], w, h, x0, y0);
+
+			// (GLES doesn't support GL_UNPACK_ROW_LENGTH, so copy the
+			// result into a separate buffer)
+			uploadData.resize(w * h);
+			for (size_t j = 0; j < h; ++j)
+				memcpy(&uploadData[j*w], &losData[j*(w + g_BlurSize - 1)], w);
+
+			glTexSubImage2D(GL_TEXTURE_2D, 0, (GLint)x0, (GLint)y0, (GLsizei)w, (GLsizei)h, GL_ALPHA, GL_UNSIGNED_BYTE, &uploadData[0]);
+
+			bi = bi1;
+		}
+	}
+}
+
 size_t CLOSTexture::GetBitmapSize(size_t w, size_t h)
 {
 	return (w + g_BlurSize - 1) * (h + g_BlurSize - 1);
 }
 
-void CLOSTexture::GenerateBitmap(ICmpRangeManager::CLosQuerier los, u8* losData, size_t w, size_t h)
+void CLOSTexture::GenerateBitmap(ICmpRangeManager::CLosQuerier los, u8* losData, size_t w, size_t h, size_t x0, size_t y0)
 {
 	const size_t rowSize = w + g_BlurSize-1; // size of losData rows
+	const ssize_t border = g_BlurSize/2;
+	const ssize_t mapSize = los.m_VerticesPerSide;
 
-	u8 *dataPtr = losData;
+	// Fill in the visibility data for the region plus its padding, using 0 for
+	// vertexes outside the map
+	for (size_t row = 0; row < h + g_BlurSize-1; ++row)
+	{
+		u8* dataPtr = &losData[row*rowSize];
 
-	// Initialise the top padding
-	for (size_t j = 0; j < g_BlurSize/2; ++j)
-		for (size_t i = 0; i < rowSize; ++i)
-			*dataPtr++ = 0;
+		const ssize_t j = (ssize_t)(y0 + row) - border;
+		if (j < 0 || j >= mapSize)
+		{
+			memset(dataPtr, 0, rowSize);
+			continue;
+		}
 
-	for (size_t j = 0; j < h; ++j)
-	{
-		// Initialise the left padding
-		for (size_t i = 0; i < g_BlurSize/2; ++i)
-			*dataPtr++ = 0;
+		const ssize_t iStart = (ssize_t)x0 - border;
+		const ssize_t i0 = std::max(iStart, (ssize_t)0);
+		const ssize_t i1 = std::min(iStart + (ssize_t)rowSize, mapSize);
+		memset(dataPtr, 0, i0 - iStart);
+		memset(dataPtr + (i1 - iStart), 0, iStart + rowSize - i1);
+		dataPtr += i0 - iStart;
+
+		const u32* data = los.m_Data + j*mapSize;
+		ssize_t i = i0;
+
+#if HAVE_SSE2
+		// Classify 8 vertexes at once, with the same results as below
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i mask = _mm_set1_epi32((int)los.m_PlayerMask);
+		const __m128i visibleBits = _mm_set1_epi32((int)0xAAAAAAAAu);
+		const __m128i exploredBits = _mm_set1_epi32((int)0x55555555u);
+		const __m128i visibleValue = _mm_set1_epi32(255);
+		const __m128i exploredValue = _mm_set1_epi32(127);
+		for (; i + 8 <= i1; i += 8)
+		{
+			__m128i values[2];
+			for (size_t k = 0; k < 2; ++k)
+			{
+				__m128i state = _mm_and_si128(_mm_loadu_si128((const __m128i*)(data + i + 4*k)), mask);
+				__m128i notVisible = _mm_cmpeq_epi32(_mm_and_si128(state, visibleBits), zero);
+				__m128i notExplored = _mm_cmpeq_epi32(_mm_and_si128(state, exploredBits), zero);
+				values[k] = _mm_or_si128(
+					_mm_andnot_si128(notVisible, visibleValue),
+					_mm_and_si128(notVisible, _mm_andnot_si128(notExplored, exploredValue)));
+			}
+			__m128i packed = _mm_packs_epi32(values[0], values[1]);
+			_mm_storel_epi64((__m128i*)dataPtr, _mm_packus_epi16(packed, packed));
+			dataPtr += 8;
+		}
+#endif
 
-		// Fill in the visibility data
-		for (size_t i = 0; i < w; ++i)
+		for (; i < i1; ++i)
 		{
 			if (los.IsVisible_UncheckedRange(i, j))
 				*dataPtr++ = 255;
@@ -341,52 +488,15 @@ void CLOSTexture::GenerateBitmap(ICmpRangeManager::CLosQuerier los, u8* losData,
 			else
 				*dataPtr++ = 0;
 		}
-
-		// Initialise the right padding
-		for (size_t i = 0; i < g_BlurSize/2; ++i)
-			*dataPtr++ = 0;
 	}
 
-	// Initialise the bottom padding
-	for (size_t j = 0; j < g_BlurSize/2; ++j)
-		for (size_t i = 0; i < rowSize; ++i)
-			*dataPtr++ = 0;
-
 	// Horizontal blur:
 
-	for (size_t j = g_BlurSize/2; j < h + g_BlurSize/2; ++j)
-	{
-		for (size_t i = 0; i < w; ++i)
-		{
-			u8* d = &losData[i+j*rowSize];
-			*d = (
-				1*d[0] +
-				6*d[1] +
-				15*d[2] +
-				20*d[3] +
-				15*d[4] +
-				6*d[5] +
-				1*d[6]
-			) / 64;
-		}
-	}
+	for (size_t j = 0; j < h + g_BlurSize-1; ++j)
+		BlurLine(&losData[j*rowSize], 1, &losData[j*rowSize], w);
 
 	// Vertical blur:
 
 	for (size_t j = 0; j < h; ++j)
-	{
-		for (size_t i = 0; i < w; ++i)
-		{
-			u8* d = &losData[i+j*rowSize];
-			*d = (
-				1*d[0*rowSize] +
-				6*d[1*rowSize] +
-				15*d[2*rowSize] +
-				20*d[3*rowSize] +
-				15*d[4*rowSize] +
-				6*d[5*rowSize] +
-				1*d[6*rowSize]
-			) / 64;
-		}
-	}
+		BlurLine(&losData[j*rowSize], rowSize, &losData[j*rowSize], w);
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -82,12 +82,27 @@ private:
 	void RecomputeTexture(int unit);
 
 	size_t GetBitmapSize(size_t w, size_t h);
-	void GenerateBitmap(ICmpRangeManager::CLosQuerier los, u8* losData, size_t w, size_t h);
+
+	/**
+	 * Computes the blurred LOS bitmap for the w*h vertexes starting at (x0, y0).
+	 * @p losData must have GetBitmapSize(w, h) bytes; the result is stored in its
+	 * top-left w*h corner, in rows of (w + g_BlurSize - 1) bytes.
+	 */
+	void GenerateBitmap(ICmpRangeManager::CLosQuerier los, u8* losData, size_t w, size_t h, size_t x0 = 0, size_t y0 = 0);
+
+	/**
+	 * Recomputes and uploads the parts of the texture around the given blocks
+	 * (from ICmpRangeManager::GetAndClearLosDirtyBlocks).
+	 */
+	void RecomputeDirtyBlocks(int unit, ICmpRangeManager::CLosQuerier los, const std::vector<u8>& dirtyBlocks, size_t blocksPerSide);
 
 	CSimulation2& m_Simulation;
 
 	bool m_Dirty;
 
+	// player whose LOS is in the texture
+	player_id_t m_PlayerID;
+
 	GLuint m_Texture;
 	GLuint m_TextureSmooth1, m_TextureSmooth2;
 	
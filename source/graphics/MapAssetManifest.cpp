@@ -0,0 +1,146 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "MapAssetManifest.h"
+
+#include "lib/allocators/shared_ptr.h"
+#include "ps/CLogger.h"
+#include "ps/CStr.h"
+#include "ps/Filesystem.h"
+
+#include <boost/algorithm/string/predicate.hpp>
+
+// Read one manifest into a list of entries
+static void ReadManifest(const VfsPath& manifestPath, std::vector<TraceEntry>& entries)
+{
+	CVFSFile file;
+	if (!VfsFileExists(manifestPath) || file.Load(g_VFS, manifestPath) != PSRETURN_OK)
+		return;
+
+	std::stringstream list(file.DecodeUTF8());
+	std::string line;
+	while (std::getline(list, line))
+	{
+		// TraceEntry asserts if the line isn't in the right format, so check
+		// the basic structure (time: L "path" size) first
+		const size_t quote = line.find(": L \"");
+		if (quote == std::string::npos || line.find('"', quote + 5) == std::string::npos)
+			continue;
+
+		entries.push_back(TraceEntry(CStr(line).FromUTF8() + L"\n"));
+	}
+}
+
+CMapAssetRecorder::CMapAssetRecorder(const VfsPath& mapPathname) :
+	m_MapPathname(mapPathname), m_Trace(CreateTrace(16*MiB))
+{
+	g_VFS->SetSessionTrace(m_Trace);
+}
+
+CMapAssetRecorder::~CMapAssetRecorder()
+{
+	g_VFS->SetSessionTrace(PITrace());
+
+	const VfsPath manifestPath = MapAssetManifestPath(m_MapPathname);
+
+	// Files loaded in this session, in the order they were first loaded,
+	// followed by the ones only loaded in earlier sessions
+	std::vector<TraceEntry> earlier;
+	ReadManifest(manifestPath, earlier);
+
+	std::set<VfsPath> seen;
+	std::stringstream list;
+	size_t numFiles = 0;
+
+	const TraceEntry* entries = m_Trace->Entries();
+	for (size_t i = 0; i < m_Trace->NumEntries(); ++i)
+	{
+		if (entries[i].Action() != TraceEntry::Load || !IsMapAsset(entries[i].Pathname()))
+			continue;
+		if (!seen.insert(entries[i].Pathname()).second)
+			continue;
+		list << CStrW(entries[i].EncodeAsText()).ToUTF8();
+		++numFiles;
+	}
+
+	for (size_t i = 0; i < earlier.size(); ++i)
+	{
+		if (!seen.insert(earlier[i].Pathname()).second)
+			continue;
+		list << CStrW(earlier[i].EncodeAsText()).ToUTF8();
+		++numFiles;
+	}
+
+	if (numFiles == 0)
+		return;
+
+	std::string data = list.str();
+	shared_ptr<u8> buf;
+	AllocateAligned(buf, data.size(), maxSectorSize);
+	memcpy(buf.get(), data.data(), data.size());
+	if (g_VFS->CreateFile(manifestPath, buf, data.size()) == INFO::OK)
+		LOGMESSAGE(L"Saved asset manifest %ls (%lu files)", manifestPath.string().c_str(), (unsigned long)numFiles);
+	else
+		LOGERROR(L"Failed to save asset manifest %ls", manifestPath.string().c_str());
+}
+
+VfsPath MapAssetManifestPath(const VfsPath& mapPathname)
+{
+	return mapPathname.ChangeExtension(L".assets");
+}
+
+bool IsMapAsset(const VfsPath& pathname)
+{
+	std::wstring str = pathname.string();
+
+	// Converted files are in cache/ (unless they're archived), but are under
+	// the same directories as their sources
+	if (boost::algorithm::starts_with(str, L"cache/"))
+		str = str.substr(6);
+
+	return boost::algorithm::starts_with(str, L"art/") || boost::algorithm::starts_with(str, L"audio/");
+}
+
+void LoadMapAssetManifest(const VfsPath& mapPathname, VfsPaths& pathnames)
+{
+	std::vector<TraceEntry> entries;
+	ReadManifest(MapAssetManifestPath(mapPathname), entries);
+
+	pathnames.reserve(pathnames.size() + entries.size());
+	for (size_t i = 0; i < entries.size(); ++i)
+		pathnames.push_back(entries[i].Pathname());
+}
+
+size_t PrefetchMapAssets(const VfsPaths& pathnames, size_t maxBytes)
+{
+	size_t total = 0;
+	for (size_t i = 0; i < pathnames.size() && total < maxBytes; ++i)
+	{
+		// (The manifest might list files that have since been deleted, or loose
+		// cache files from a different machine, which aren't an error)
+		if (!VfsFileExists(pathnames[i]))
+			continue;
+
+		shared_ptr<u8> buf;
+		size_t size;
+		if (g_VFS->LoadFile(pathnames[i], buf, size) == INFO::OK)
+			total += size;
+	}
+	return total;
+}
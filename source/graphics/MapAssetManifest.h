@@ -0,0 +1,86 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Per-map asset manifests: lists of the asset files (textures, meshes,
+ * animations, actors, sounds) that were loaded while a map was being played.
+ * CMapReader reads the files listed for a map into the VFS file cache during
+ * the loading screen, so they don't have to be read one by one (causing
+ * hitches) as entities are created and first rendered.
+ *
+ * The manifest is stored next to the map (e.g. maps/scenarios/Foo.assets for
+ * maps/scenarios/Foo.pmp), as VFS trace entries (see lib/file/common/trace.h)
+ * in the order the files were first loaded. Loose cache files (converted
+ * textures etc) have machine-specific names, so a manifest is most useful on
+ * the machine that recorded it, or with archived mods.
+ */
+
+#ifndef INCLUDED_MAPASSETMANIFEST
+#define INCLUDED_MAPASSETMANIFEST
+
+#include "lib/file/vfs/vfs_path.h"
+#include "lib/file/common/trace.h"
+
+/**
+ * Records the assets that are loaded while it exists, and saves them into
+ * the map's manifest when it's destroyed (adding any files that an earlier
+ * manifest listed but weren't loaded this time, since which assets are used
+ * depends on the players' civs etc).
+ * CWorld creates one for each game if the "mapassets.record" config setting
+ * is enabled.
+ */
+class CMapAssetRecorder
+{
+	NONCOPYABLE(CMapAssetRecorder);
+public:
+	CMapAssetRecorder(const VfsPath& mapPathname);
+	~CMapAssetRecorder();
+
+private:
+	VfsPath m_MapPathname;
+	PITrace m_Trace;
+};
+
+/**
+ * Returns the pathname of the manifest for the given map (.pmp file or
+ * random map script).
+ */
+VfsPath MapAssetManifestPath(const VfsPath& mapPathname);
+
+/**
+ * Returns whether the file is the kind of thing that should be listed in
+ * an asset manifest (i.e. it's under art/ or audio/, or the cached
+ * version of something that is).
+ */
+bool IsMapAsset(const VfsPath& pathname);
+
+/**
+ * Reads the manifest for the given map, if there is one, into @p pathnames
+ * (in the order they were first loaded).
+ */
+void LoadMapAssetManifest(const VfsPath& mapPathname, VfsPaths& pathnames);
+
+/**
+ * Loads the given files into the VFS file cache, skipping any that don't
+ * exist, and stopping once they add up to more than @p maxBytes (since
+ * the cache would start evicting the earlier ones).
+ * Thread-safe, so it can be used from a background loading task.
+ * @return number of bytes loaded
+ */
+size_t PrefetchMapAssets(const VfsPaths& pathnames, size_t maxBytes);
+
+#endif // INCLUDED_MAPASSETMANIFEST
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,8 +19,10 @@
 
 #include "MapGenerator.h"
 
+#include "graphics/MapGeneratorHelpers.h"
 #include "lib/timer.h"
 #include "ps/CLogger.h"
+#include "scriptinterface/ScriptExtraHeaders.h" // for typed arrays
 
 
 // TODO: what's a good default? perhaps based on map size
@@ -44,6 +46,9 @@ CMapGeneratorWorker::~CMapGeneratorWorker()
 
 	// Cleanup ScriptInterface
 	delete m_ScriptInterface;
+
+	for (size_t i = 0; i < m_TileClasses.size(); ++i)
+		delete m_TileClasses[i];
 }
 
 void CMapGeneratorWorker::Initialize(const VfsPath& scriptFile, const std::string& settings)
@@ -98,6 +103,15 @@ bool CMapGeneratorWorker::Run()
 	m_ScriptInterface->RegisterFunction<void, CMapGeneratorWorker::MaybeGC>("MaybeGC");
 	m_ScriptInterface->RegisterFunction<std::vector<std::string>, CMapGeneratorWorker::GetCivData>("GetCivData");
 
+	// Native helpers for rmgen
+	m_ScriptInterface->RegisterFunction<int, int, CMapGeneratorWorker::TileClassCreate>("NativeTileClassCreate");
+	m_ScriptInterface->RegisterFunction<void, int, int, int, CMapGeneratorWorker::TileClassAdd>("NativeTileClassAdd");
+	m_ScriptInterface->RegisterFunction<void, int, int, int, CMapGeneratorWorker::TileClassRemove>("NativeTileClassRemove");
+	m_ScriptInterface->RegisterFunction<void, int, std::vector<int>, CMapGeneratorWorker::TileClassAddPoints>("NativeTileClassAddPoints");
+	m_ScriptInterface->RegisterFunction<bool, int, int, int, CMapGeneratorWorker::TileClassHas>("NativeTileClassHas");
+	m_ScriptInterface->RegisterFunction<u32, int, double, double, double, bool, CMapGeneratorWorker::TileClassCountInRadius>("NativeTileClassCountInRadius");
+	m_ScriptInterface->RegisterFunction<std::vector<double>, std::vector<double>, int, double, CMapGeneratorWorker::SmoothHeightmap>("NativeSmoothHeightmap");
+
 	// Parse settings
 	CScriptValRooted settingsVal = m_ScriptInterface->ParseJSON(m_Settings);
 	if (settingsVal.undefined())
@@ -153,10 +167,47 @@ bool CMapGeneratorWorker::LoadLibrary(void* cbdata, std::wstring name)
 	return self->LoadScripts(name);
 }
 
+/**
+ * Replace the plain array obj[name] (if there is one) with a typed array of
+ * the given type. Typed arrays are cloned as a single block of memory and
+ * CMapReader can copy them straight into its buffers, which is much faster
+ * than handling every element of the large terrain arrays separately.
+ */
+static void ConvertToTypedArray(ScriptInterface& scriptInterface, jsval obj, const char* name, int type)
+{
+	JSContext* cx = scriptInterface.GetContext();
+
+	CScriptValRooted array;
+	if (!scriptInterface.GetProperty(obj, name, array) || !JSVAL_IS_OBJECT(array.get()) || JSVAL_IS_NULL(array.get()))
+		return;
+	if (!JS_IsArrayObject(cx, JSVAL_TO_OBJECT(array.get())))
+		return;
+
+	JSObject* typedArray = js_CreateTypedArrayWithArray(cx, type, JSVAL_TO_OBJECT(array.get()));
+	if (!typedArray)
+	{
+		// Leave the original array, which will still be converted correctly
+		JS_ClearPendingException(cx);
+		return;
+	}
+	scriptInterface.SetProperty(obj, name, CScriptValRooted(cx, OBJECT_TO_JSVAL(typedArray)));
+}
+
 void CMapGeneratorWorker::ExportMap(void* cbdata, CScriptValRooted data)
 {
 	CMapGeneratorWorker* self = static_cast<CMapGeneratorWorker*>(cbdata);
 
+	// Convert the terrain data to typed arrays here on the generator thread,
+	// so the main thread only has to copy it. (These conversions give the same
+	// u16 values as CMapReader's conversions of the plain arrays.)
+	ConvertToTypedArray(*self->m_ScriptInterface, data.get(), "height", js::TypedArray::TYPE_UINT16);
+	CScriptValRooted tileData;
+	if (self->m_ScriptInterface->GetProperty(data.get(), "tileData", tileData) && JSVAL_IS_OBJECT(tileData.get()) && !JSVAL_IS_NULL(tileData.get()))
+	{
+		ConvertToTypedArray(*self->m_ScriptInterface, tileData.get(), "index", js::TypedArray::TYPE_UINT16);
+		ConvertToTypedArray(*self->m_ScriptInterface, tileData.get(), "priority", js::TypedArray::TYPE_UINT16);
+	}
+
 	// Copy results
 	CScopeLock lock(self->m_WorkerMutex);
 	self->m_MapData = self->m_ScriptInterface->WriteStructuredClone(data.get());
@@ -178,6 +229,87 @@ void CMapGeneratorWorker::MaybeGC(void* cbdata)
 	self->m_ScriptInterface->MaybeGC();
 }
 
+CMapGenTileClass* CMapGeneratorWorker::GetTileClass(int id)
+{
+	if (id < 0 || id >= (int)m_TileClasses.size())
+	{
+		LOGERROR(L"CMapGeneratorWorker: Invalid tile class %d", id);
+		return NULL;
+	}
+	return m_TileClasses[id];
+}
+
+int CMapGeneratorWorker::TileClassCreate(void* cbdata, int size)
+{
+	CMapGeneratorWorker* self = static_cast<CMapGeneratorWorker*>(cbdata);
+
+	if (size <= 0 || size > 4096)
+	{
+		LOGERROR(L"CMapGeneratorWorker::TileClassCreate: Invalid map size %d", size);
+		return -1;
+	}
+
+	self->m_TileClasses.push_back(new CMapGenTileClass((size_t)size));
+	return (int)self->m_TileClasses.size() - 1;
+}
+
+void CMapGeneratorWorker::TileClassAdd(void* cbdata, int id, int x, int z)
+{
+	CMapGeneratorWorker* self = static_cast<CMapGeneratorWorker*>(cbdata);
+
+	if (CMapGenTileClass* tileClass = self->GetTileClass(id))
+		tileClass->Add(x, z);
+}
+
+void CMapGeneratorWorker::TileClassRemove(void* cbdata, int id, int x, int z)
+{
+	CMapGeneratorWorker* self = static_cast<CMapGeneratorWorker*>(cbdata);
+
+	if (CMapGenTileClass* tileClass = self->GetTileClass(id))
+		tileClass->Remove(x, z);
+}
+
+void CMapGeneratorWorker::TileClassAddPoints(void* cbdata, int id, std::vector<int> points)
+{
+	CMapGeneratorWorker* self = static_cast<CMapGeneratorWorker*>(cbdata);
+
+	// points is a flat list of x,z pairs, so a whole area can be painted
+	// with a single call
+	if (CMapGenTileClass* tileClass = self->GetTileClass(id))
+		for (size_t i = 0; i + 1 < points.size(); i += 2)
+			tileClass->Add(points[i], points[i+1]);
+}
+
+bool CMapGeneratorWorker::TileClassHas(void* cbdata, int id, int x, int z)
+{
+	CMapGeneratorWorker* self = static_cast<CMapGeneratorWorker*>(cbdata);
+
+	CMapGenTileClass* tileClass = self->GetTileClass(id);
+	return tileClass && tileClass->Has(x, z);
+}
+
+u32 CMapGeneratorWorker::TileClassCountInRadius(void* cbdata, int id, double cx, double cz, double radius, bool members)
+{
+	CMapGeneratorWorker* self = static_cast<CMapGeneratorWorker*>(cbdata);
+
+	CMapGenTileClass* tileClass = self->GetTileClass(id);
+	if (!tileClass)
+		return 0;
+	return (u32)tileClass->CountInRadius(cx, cz, radius, members);
+}
+
+std::vector<double> CMapGeneratorWorker::SmoothHeightmap(void* UNUSED(cbdata), std::vector<double> heights, int verticesPerSide, double strength)
+{
+	if (verticesPerSide < 0 || heights.size() != (size_t)verticesPerSide*verticesPerSide)
+	{
+		LOGERROR(L"CMapGeneratorWorker::SmoothHeightmap: Heightmap must have %d*%d elements", verticesPerSide, verticesPerSide);
+		return heights;
+	}
+
+	MapGenSmoothHeightmap(heights, (size_t)verticesPerSide, strength);
+	return heights;
+}
+
 std::vector<std::string> CMapGeneratorWorker::GetCivData(void* UNUSED(cbdata))
 {
 	VfsPath path(L"civs/");
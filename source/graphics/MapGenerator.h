@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,6 +27,7 @@
 #include <set>
 
 class CMapGeneratorWorker;
+class CMapGenTileClass;
 
 /**
  * Random map generator interface. Initialized by CMapReader and then checked
@@ -125,6 +126,20 @@ private:
 	static void MaybeGC(void* cbdata);
 	static std::vector<std::string> GetCivData(void* cbdata);
 
+	// native versions of performance-critical rmgen library code
+	// (see MapGeneratorHelpers.h)
+	static int TileClassCreate(void* cbdata, int size);
+	static void TileClassAdd(void* cbdata, int id, int x, int z);
+	static void TileClassRemove(void* cbdata, int id, int x, int z);
+	static void TileClassAddPoints(void* cbdata, int id, std::vector<int> points);
+	static bool TileClassHas(void* cbdata, int id, int x, int z);
+	static u32 TileClassCountInRadius(void* cbdata, int id, double cx, double cz, double radius, bool members);
+	static std::vector<double> SmoothHeightmap(void* cbdata, std::vector<double> heights, int verticesPerSide, double strength);
+
+	CMapGenTileClass* GetTileClass(int id);
+
+	std::vector<CMapGenTileClass*> m_TileClasses;
+
 	std::set<std::wstring> m_LoadedLibraries;
 	shared_ptr<ScriptInterface::StructuredClone> m_MapData;
 	boost::rand48 m_MapGenRNG;
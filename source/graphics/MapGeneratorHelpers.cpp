@@ -0,0 +1,145 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "MapGeneratorHelpers.h"
+
+#include <cmath>
+
+CMapGenTileClass::CMapGenTileClass(size_t size) :
+	m_Size(size), m_Inclusion(size*size, 0), m_RowTrees(size*size, 0)
+{
+}
+
+void CMapGenTileClass::Add(int x, int z)
+{
+	if (x < 0 || z < 0 || x >= (int)m_Size || z >= (int)m_Size)
+		return;
+
+	u16& inclusion = m_Inclusion[z*m_Size + x];
+	if (inclusion == std::numeric_limits<u16>::max())
+		return;
+
+	if (inclusion++ == 0)
+	{
+		u32* tree = &m_RowTrees[z*m_Size];
+		for (size_t i = x + 1; i <= m_Size; i += (i & -i))
+			++tree[i - 1];
+	}
+}
+
+void CMapGenTileClass::Remove(int x, int z)
+{
+	if (x < 0 || z < 0 || x >= (int)m_Size || z >= (int)m_Size)
+		return;
+
+	u16& inclusion = m_Inclusion[z*m_Size + x];
+	if (inclusion == 0)
+		return;
+
+	if (--inclusion == 0)
+	{
+		u32* tree = &m_RowTrees[z*m_Size];
+		for (size_t i = x + 1; i <= m_Size; i += (i & -i))
+			--tree[i - 1];
+	}
+}
+
+bool CMapGenTileClass::Has(int x, int z) const
+{
+	if (x < 0 || z < 0 || x >= (int)m_Size || z >= (int)m_Size)
+		return false;
+
+	return m_Inclusion[z*m_Size + x] != 0;
+}
+
+size_t CMapGenTileClass::CountInRowPrefix(int z, int end) const
+{
+	const u32* tree = &m_RowTrees[z*m_Size];
+	size_t count = 0;
+	for (size_t i = end; i > 0; i -= (i & -i))
+		count += tree[i - 1];
+	return count;
+}
+
+size_t CMapGenTileClass::CountInRow(int z, int minX, int maxX) const
+{
+	return CountInRowPrefix(z, maxX) - CountInRowPrefix(z, minX);
+}
+
+size_t CMapGenTileClass::CountInRadius(double cx, double cz, double radius, bool members) const
+{
+	size_t numMembers = 0;
+	size_t numNonMembers = 0;
+	const int size = (int)m_Size;
+
+	// This must match the script version exactly, including the rounding
+	const double zMax = cz + radius;
+	for (double z = cz - radius; z <= zMax; z++)
+	{
+		const int iz = (int)floor(z);
+		if (iz < 0 || iz >= size)
+			continue;
+
+		const double dz = z - cz;
+		const double dx = sqrt(radius*radius - dz*dz);
+		// (If rounding makes dz slightly larger than radius, dx is NaN and
+		// the whole row gets counted, like in the script version)
+		const double lowerX = floor(cx - dx);
+		const double upperX = floor(cx + dx);
+		const int minX = (lowerX > 0 ? (int)lowerX : 0);
+		const int maxX = (upperX < size ? (int)upperX + 1 : size);
+		if (maxX <= minX)
+			continue;
+
+		const size_t count = CountInRow(iz, minX, maxX);
+		numMembers += count;
+		numNonMembers += (maxX - minX) - count;
+	}
+
+	return members ? numMembers : numNonMembers;
+}
+
+void MapGenSmoothHeightmap(std::vector<double>& heights, size_t verticesPerSide, double strength)
+{
+	ENSURE(heights.size() == verticesPerSide*verticesPerSide);
+
+	const std::vector<double> original(heights);
+	const ssize_t n = (ssize_t)verticesPerSide;
+
+	for (ssize_t z = 0; z < n; ++z)
+	{
+		const ssize_t z0 = std::max(z - 1, (ssize_t)0);
+		const ssize_t z1 = std::min(z + 1, n - 1);
+		for (ssize_t x = 0; x < n; ++x)
+		{
+			const ssize_t x0 = std::max(x - 1, (ssize_t)0);
+			const ssize_t x1 = std::min(x + 1, n - 1);
+
+			// Sum in a fixed order, so the result doesn't depend on the compiler
+			double sum = 0.0;
+			for (ssize_t j = z0; j <= z1; ++j)
+				for (ssize_t i = x0; i <= x1; ++i)
+					sum += original[j*n + i];
+			const double mean = sum / (double)((z1 - z0 + 1) * (x1 - x0 + 1));
+
+			const double h = original[z*n + x];
+			heights[z*n + x] = h + strength * (mean - h);
+		}
+	}
+}
@@ -0,0 +1,96 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Native implementations of some of the most expensive parts of the random
+ * map scripts' library, exposed to scripts by CMapGeneratorWorker.
+ *
+ * Random maps must come out identically on every machine (all players in a
+ * multiplayer game generate the map themselves), so these are written to give
+ * exactly the same results as the equivalent script code: they use the same
+ * double-precision operations in the same order, and integers everywhere else.
+ */
+
+#ifndef INCLUDED_MAPGENERATORHELPERS
+#define INCLUDED_MAPGENERATORHELPERS
+
+#include <vector>
+
+/**
+ * A set of tiles on a square map, equivalent to rmgen's TileClass.
+ * Tiles can be added several times, and are only removed once they've been
+ * removed as many times as they were added.
+ * Counting the members in a circle (the basis of most placement constraints)
+ * is O(radius * log(size)), using one Fenwick tree per row of tiles.
+ */
+class CMapGenTileClass
+{
+public:
+	CMapGenTileClass(size_t size);
+
+	size_t GetSize() const { return m_Size; }
+
+	/**
+	 * Add tile (x, z) to the class. Tiles outside the map are ignored.
+	 */
+	void Add(int x, int z);
+
+	/**
+	 * Undo one Add of tile (x, z). Tiles that aren't members are ignored.
+	 */
+	void Remove(int x, int z);
+
+	bool Has(int x, int z) const;
+
+	/**
+	 * Returns the number of member tiles (if @p members) or non-member tiles
+	 * (if not) inside the circle, sampled row by row in the same way as
+	 * TileClass.countInRadius: for each row y = cz - radius, cz - radius + 1, ...
+	 * up to cz + radius, the tiles from floor(cx - dx) to floor(cx + dx) inclusive,
+	 * where dx = sqrt(radius^2 - (y - cz)^2).
+	 */
+	size_t CountInRadius(double cx, double cz, double radius, bool members) const;
+
+private:
+	// Number of members in row z with minX <= x < maxX
+	size_t CountInRow(int z, int minX, int maxX) const;
+
+	// Number of members in row z with x < end
+	size_t CountInRowPrefix(int z, int end) const;
+
+	size_t m_Size;
+
+	// Number of times each tile has been added, indexed by z*m_Size + x
+	std::vector<u16> m_Inclusion;
+
+	// Fenwick tree of member counts for each row, indexed by z*m_Size + (i-1)
+	// for the tree's 1-based node i
+	std::vector<u32> m_RowTrees;
+};
+
+/**
+ * Smooths a square heightmap, by moving each vertex the fraction @p strength
+ * of the way towards the mean height of itself and its up to 8 neighbours.
+ * All vertices are computed from the original heights, not the partially
+ * smoothed ones.
+ *
+ * @param heights heights indexed by z*verticesPerSide + x; replaced with the
+ *   smoothed heights.
+ */
+void MapGenSmoothHeightmap(std::vector<double>& heights, size_t verticesPerSide, double strength);
+
+#endif // INCLUDED_MAPGENERATORHELPERS
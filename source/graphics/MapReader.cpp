@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,7 +23,9 @@
 #include "graphics/CinemaTrack.h"
 #include "graphics/Entity.h"
 #include "graphics/GameView.h"
+#include "graphics/MapAssetManifest.h"
 #include "graphics/MapGenerator.h"
+#include "graphics/ObjectManager.h"
 #include "graphics/Patch.h"
 #include "graphics/Terrain.h"
 #include "graphics/TerrainTextureEntry.h"
@@ -45,8 +47,10 @@
 #include "simulation2/components/ICmpPlayer.h"
 #include "simulation2/components/ICmpPlayerManager.h"
 #include "simulation2/components/ICmpPosition.h"
+#include "simulation2/components/ICmpTemplateManager.h"
 #include "simulation2/components/ICmpTerrain.h"
 #include "simulation2/components/ICmpWaterManager.h"
+#include "simulation2/system/ParamNode.h"
 
 #include <boost/algorithm/string/predicate.hpp>
 
@@ -94,18 +98,9 @@ void CMapReader::LoadMap(const VfsPath& pathname, CTerrain *pTerrain_,
 		only_xml = true;
 	}
 
+	filename_pmp = pathname;
 	file_format_version = CMapIO::FILE_VERSION; // default if there's no .pmp
-
-	if (!only_xml)
-	{
-		// [25ms]
-		unpacker.Read(pathname, "PSMP");
-		file_format_version = unpacker.GetVersion();
-	}
-
-	// check oldest supported version
-	if (file_format_version < FILE_READ_VERSION)
-		throw PSERROR_File_InvalidVersion();
+	m_ReadPMPError = m_ReadXMLError = PSRETURN_OK;
 
 	// delete all existing entities
 	if (pSimulation2)
@@ -115,15 +110,31 @@ void CMapReader::LoadMap(const VfsPath& pathname, CTerrain *pTerrain_,
 	if (pPostproc)
 		pPostproc->SetPostEffect(L"default");
 
+	// read the files on other threads, so they don't block the loading screen
+	// and the .xml can be parsed while the .pmp is being read
+	size_t readPMP = 0;
+	if (!only_xml)
+		readPMP = RegMemFunBackground(this, &CMapReader::ReadPMPFile, L"CMapReader::ReadPMPFile", 25);
+	size_t readXML = RegMemFunBackground(this, &CMapReader::ReadXMLFile, L"CMapReader::ReadXMLFile", 100);
+
+	// and the assets the map used last time, so they don't have to be read
+	// one at a time while creating entities and rendering the first frames
+	size_t prefetchAssets = 0;
+	const bool hasPrefetchAssets = RegisterPrefetchAssets(pathname, prefetchAssets);
+
 	// load map settings script
 	RegMemFun(this, &CMapReader::LoadScriptSettings, L"CMapReader::LoadScriptSettings", 50);
+	LDR_AddDependency(readXML);
 
 	// load player settings script (must be done before reading map)
 	RegMemFun(this, &CMapReader::LoadPlayerSettings, L"CMapReader::LoadPlayerSettings", 50);
 
 	// unpack the data
 	if (!only_xml)
+	{
 		RegMemFun(this, &CMapReader::UnpackMap, L"CMapReader::UnpackMap", 1200);
+		LDR_AddDependency(readPMP);
+	}
 
 	// read the corresponding XML file
 	RegMemFun(this, &CMapReader::ReadXML, L"CMapReader::ReadXML", 5800);
@@ -135,6 +146,8 @@ void CMapReader::LoadMap(const VfsPath& pathname, CTerrain *pTerrain_,
 	RegMemFun(this, &CMapReader::LoadMapSettings, L"CMapReader::LoadMapSettings", 5);
 
 	RegMemFun(this, &CMapReader::DelayLoadFinished, L"CMapReader::DelayLoadFinished", 5);
+	if (hasPrefetchAssets)
+		LDR_AddDependency(prefetchAssets);
 }
 
 
@@ -167,6 +180,10 @@ void CMapReader::LoadRandomMap(const CStrW& scriptFile, const CScriptValRooted&
 
 	only_xml = false;
 
+	// read the assets the map used last time in the background
+	size_t prefetchAssets = 0;
+	const bool hasPrefetchAssets = !m_ScriptFile.empty() && RegisterPrefetchAssets(L"maps/random/" + m_ScriptFile, prefetchAssets);
+
 	// copy random map settings (before entity creation)
 	RegMemFun(this, &CMapReader::LoadRMSettings, L"CMapReader::LoadRMSettings", 50);
 
@@ -195,11 +212,37 @@ void CMapReader::LoadRandomMap(const CStrW& scriptFile, const CScriptValRooted&
 	RegMemFun(this, &CMapReader::LoadMapSettings, L"CMapReader::LoadMapSettings", 5);
 
 	RegMemFun(this, &CMapReader::DelayLoadFinished, L"CMapReader::DelayLoadFinished", 5);
+	if (hasPrefetchAssets)
+		LDR_AddDependency(prefetchAssets);
+}
+
+// ReadPMPFile: load the .pmp file into the unpacker (runs in the background,
+// so errors are reported by UnpackMap)
+int CMapReader::ReadPMPFile()
+{
+	try
+	{
+		// [25ms]
+		unpacker.Read(filename_pmp, "PSMP");
+	}
+	catch (PSERROR_File& err)
+	{
+		m_ReadPMPError = err.getCode();
+	}
+	return 0;
 }
 
 // UnpackMap: unpack the given data from the raw data stream into local variables
 int CMapReader::UnpackMap()
 {
+	if (m_ReadPMPError != PSRETURN_OK)
+		ThrowError(m_ReadPMPError);
+
+	// check oldest supported version
+	file_format_version = unpacker.GetVersion();
+	if (file_format_version < FILE_READ_VERSION)
+		throw PSERROR_File_InvalidVersion();
+
 	// now unpack everything into local data
 	int ret = UnpackTerrain();
 	if (ret != 0)	// failed or timed out
@@ -935,6 +978,20 @@ int CXMLReader::ReadEntities(XMBElement parent, double end_time)
 	CSimulation2& sim = *m_MapReader.pSimulation2;
 	CmpPtr<ICmpPlayerManager> cmpPlayerManager(sim, SYSTEM_ENTITY);
 
+	if (entity_idx == 0)
+	{
+		std::set<CStrW> templateNames;
+		XERO_ITER_EL(parent, entity)
+		{
+			XERO_ITER_EL(entity, setting)
+			{
+				if (setting.GetNodeName() == el_template)
+					templateNames.insert(setting.GetText().FromUTF8());
+			}
+		}
+		m_MapReader.PrefetchActors(templateNames);
+	}
+
 	while (entity_idx < entities.Count)
 	{
 		// all new state at this scope and below doesn't need to be
@@ -1043,6 +1100,8 @@ int CXMLReader::ReadEntities(XMBElement parent, double end_time)
 		LDR_CHECK_TIMEOUT(completed_jobs, total_jobs);
 	}
 
+	m_MapReader.ReleasePrefetchedActors();
+
 	return 0;
 }
 
@@ -1113,9 +1172,54 @@ int CXMLReader::ProgressiveRead()
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
+// ReadXMLFile: load the .xml file (runs in the background, so errors are
+// reported by LoadScriptSettings)
+int CMapReader::ReadXMLFile()
+{
+	try
+	{
+		xml_reader = new CXMLReader(filename_xml, *this);
+	}
+	catch (PSERROR_File& err)
+	{
+		m_ReadXMLError = err.getCode();
+	}
+	return 0;
+}
+
+// Limit on the total size of the prefetched assets, since the VFS file cache
+// would start evicting the earliest ones (which are needed first) to make room
+static const size_t PREFETCH_ASSETS_MAX_BYTES = 64*MiB;
+
+bool CMapReader::RegisterPrefetchAssets(const VfsPath& mapPathname, size_t& task)
+{
+	// Most assets are only used for rendering
+	if (!pGameView)
+		return false;
+
+	m_PrefetchAssets.clear();
+	LoadMapAssetManifest(mapPathname, m_PrefetchAssets);
+	if (m_PrefetchAssets.empty())
+		return false;
+
+	task = RegMemFunBackground(this, &CMapReader::PrefetchAssets, L"CMapReader::PrefetchAssets", 200);
+	return true;
+}
+
+// PrefetchAssets: load the files in the map's asset manifest into the file
+// cache (runs in the background; failures are just ignored)
+int CMapReader::PrefetchAssets()
+{
+	PrefetchMapAssets(m_PrefetchAssets, PREFETCH_ASSETS_MAX_BYTES);
+	return 0;
+}
+
 // load script settings from map
 int CMapReader::LoadScriptSettings()
 {
+	if (m_ReadXMLError != PSRETURN_OK)
+		ThrowError(m_ReadXMLError);
+
 	if (!xml_reader)
 		xml_reader = new CXMLReader(filename_xml, *this);
 
@@ -1158,6 +1262,39 @@ int CMapReader::ReadXML()
 	return ret;
 }
 
+void CMapReader::PrefetchActors(const std::set<CStrW>& templateNames)
+{
+	// Actors are only loaded when there's something to render them
+	if (!pGameView || !pSimulation2)
+		return;
+
+	TIMER(L"PrefetchActors");
+
+	CmpPtr<ICmpTemplateManager> cmpTemplateManager(*pSimulation2, SYSTEM_ENTITY);
+	if (!cmpTemplateManager)
+		return;
+
+	std::set<CStrW> actorNames;
+	for (std::set<CStrW>::const_iterator it = templateNames.begin(); it != templateNames.end(); ++it)
+	{
+		const CParamNode* tmpl = cmpTemplateManager->GetTemplateWithoutValidation(CStrW(*it).ToUTF8());
+		if (!tmpl)
+			continue;
+
+		const std::wstring& actorName = tmpl->GetChild("VisualActor").GetChild("Actor").ToString();
+		if (!actorName.empty())
+			actorNames.insert(actorName);
+	}
+
+	pGameView->GetObjectManager().PrefetchObjects(actorNames);
+}
+
+void CMapReader::ReleasePrefetchedActors()
+{
+	if (pGameView)
+		pGameView->GetObjectManager().ReleasePrefetchedObjects();
+}
+
 int CMapReader::DelayLoadFinished()
 {
 	// we were dynamically allocated by CWorld::Initialize
@@ -1325,6 +1462,11 @@ int CMapReader::ParseEntities()
 
 	size_t entity_idx = 0;
 	size_t num_entities = entities.size();
+
+	std::set<CStrW> templateNames;
+	for (size_t i = 0; i < num_entities; ++i)
+		templateNames.insert(entities[i].templateName);
+	PrefetchActors(templateNames);
 	
 	Entity currEnt;
 
@@ -1370,6 +1512,8 @@ int CMapReader::ParseEntities()
 		entity_idx++;
 	}
 
+	ReleasePrefetchedActors();
+
 	return 0;
 }
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -77,6 +77,16 @@ private:
 	// UnpackMap: unpack the given data from the raw data stream into local variables
 	int UnpackMap();
 
+	// Read the .pmp and .xml files (on background threads)
+	int ReadPMPFile();
+	int ReadXMLFile();
+
+	// Read the map's asset manifest, and register a background task to load
+	// the files it lists into the VFS cache. Returns false if there's nothing
+	// to load, else sets @p task for LDR_AddDependency
+	bool RegisterPrefetchAssets(const VfsPath& mapPathname, size_t& task);
+	int PrefetchAssets();
+
 	// ApplyData: take all the input data, and rebuild the scene from it
 	int ApplyData();
 
@@ -104,6 +114,13 @@ private:
 	// Parse script data into camera
 	int ParseCamera();
 
+	// Load the actors used by the given entity templates (and their meshes and
+	// animations) in one batch, before the entities are created
+	void PrefetchActors(const std::set<CStrW>& templateNames);
+
+	// Let go of any prefetched data that the new entities didn't use
+	void ReleasePrefetchedActors();
+
 
 	// size of map 
 	ssize_t m_PatchesPerSide;
@@ -139,11 +156,15 @@ private:
 	const CSimContext* pSimContext;
 	int m_PlayerID;
 	bool m_SkipEntities;
+	VfsPath filename_pmp;
 	VfsPath filename_xml;
 	bool only_xml;
 	u32 file_format_version;
+	PSRETURN m_ReadPMPError;
+	PSRETURN m_ReadXMLError;
 	entity_id_t m_StartingCameraTarget;
 	CVector3D m_StartingCamera;
+	VfsPaths m_PrefetchAssets;
 
 	// UnpackTerrain generator state
 	size_t cur_terrain_tex;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -50,7 +50,7 @@ void CMaterial::AddStaticUniform(const char* key, const CVector4D& value)
 void CMaterial::AddSampler(const TextureSampler& texture)
 {
 	m_Samplers.push_back(texture);
-	if (texture.Name == CStrIntern("baseTex"))
+	if (texture.Name == str_baseTex)
 		m_DiffuseTexture = texture.Sampler;
 }
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,11 +24,41 @@
 #include "ps/CLogger.h"
 #include "ps/FileIo.h" // to get access to its CError
 #include "ps/Profile.h"
+#include "ps/ThreadPool.h"
 
 // TODO: should this cache models while they're not actively in the game?
 // (Currently they'll probably be deleted when the reference count drops to 0,
 // even if it's quite possible that they'll get reloaded very soon.)
 
+namespace
+{
+
+/**
+ * Reads and parses a list of PMD files, for CMeshManager::PrefetchMeshes.
+ * Must not log or touch anything else that's restricted to the main thread.
+ */
+class CLoadMeshesTask : public CThreadPool::ITask
+{
+public:
+	std::vector<VfsPath> m_Names;
+	std::vector<VfsPath> m_Filenames;
+	std::vector<CModelDef*> m_Models; // NULL if loading failed
+
+	virtual void Run(size_t index)
+	{
+		try
+		{
+			m_Models[index] = CModelDef::Load(m_Filenames[index], m_Names[index]);
+		}
+		catch (PSERROR_File&)
+		{
+			m_Models[index] = NULL;
+		}
+	}
+};
+
+} // anonymous namespace
+
 CMeshManager::CMeshManager(CColladaManager& colladaManager)
 : m_ColladaManager(colladaManager)
 {
@@ -69,3 +99,68 @@ CModelDefPtr CMeshManager::GetMesh(const VfsPath& pathname)
 		return CModelDefPtr();
 	}
 }
+
+void CMeshManager::PrefetchMeshes(const std::set<VfsPath>& pathnames)
+{
+	PROFILE("prefetch meshes");
+
+	std::vector<VfsPath> names;
+	for (std::set<VfsPath>::const_iterator it = pathnames.begin(); it != pathnames.end(); ++it)
+	{
+		const VfsPath name = it->ChangeExtension(L"");
+		mesh_map::iterator iter = m_MeshMap.find(name);
+		if (iter == m_MeshMap.end() || iter->second.expired())
+			names.push_back(name);
+	}
+
+	std::vector<VfsPath> pmdFilenames;
+	m_ColladaManager.GetLoadablePaths(names, CColladaManager::PMD, pmdFilenames);
+
+	CLoadMeshesTask task;
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		if (pmdFilenames[i].empty())
+			continue;
+
+		task.m_Names.push_back(names[i]);
+		task.m_Filenames.push_back(pmdFilenames[i]);
+	}
+	task.m_Models.resize(task.m_Names.size());
+
+	if (g_ThreadPool && task.m_Names.size() > 1)
+	{
+		g_ThreadPool->ParallelFor(task, task.m_Names.size());
+	}
+	else
+	{
+		for (size_t i = 0; i < task.m_Names.size(); ++i)
+			task.Run(i);
+	}
+
+	for (size_t i = 0; i < task.m_Names.size(); ++i)
+	{
+		if (!task.m_Models[i])
+			continue;
+
+		CModelDefPtr model(task.m_Models[i]);
+		m_MeshMap[task.m_Names[i]] = model;
+		m_PrefetchedMeshes.push_back(model);
+	}
+}
+
+void CMeshManager::ReleasePrefetchedMeshes()
+{
+	m_PrefetchedMeshes.clear();
+}
+
+size_t CMeshManager::GetMemoryUsage() const
+{
+	size_t bytes = 0;
+	for (mesh_map::const_iterator it = m_MeshMap.begin(); it != m_MeshMap.end(); ++it)
+	{
+		CModelDefPtr mesh = it->second.lock();
+		if (mesh)
+			bytes += mesh->GetMemoryUsage();
+	}
+	return bytes;
+}
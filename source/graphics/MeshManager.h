@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,6 +24,8 @@
 #include <boost/unordered_map.hpp>
 #include <boost/weak_ptr.hpp>
 
+#include <set>
+
 class CModelDef;
 typedef boost::shared_ptr<CModelDef> CModelDefPtr;
 
@@ -38,9 +40,32 @@ public:
 
 	CModelDefPtr GetMesh(const VfsPath& pathname);
 
+	/**
+	 * Loads all the given meshes that aren't already loaded, reading and
+	 * parsing the files in parallel on the engine thread pool (if there is one).
+	 * (See CColladaManager::GetLoadablePaths for how conversions from COLLADA
+	 * are handled.) Meshes that fail to load are skipped, so the errors
+	 * will be reported by the following GetMesh.
+	 * The loaded meshes are kept alive until ReleasePrefetchedMeshes, so they
+	 * aren't deleted before anything has had a chance to use them.
+	 */
+	void PrefetchMeshes(const std::set<VfsPath>& pathnames);
+
+	/**
+	 * Drops the references held by PrefetchMeshes, so meshes that nobody
+	 * ended up using can be deleted.
+	 */
+	void ReleasePrefetchedMeshes();
+
+	/**
+	 * @return approximate number of bytes of memory used by all the loaded meshes
+	 */
+	size_t GetMemoryUsage() const;
+
 private:
 	typedef boost::unordered_map<VfsPath, boost::weak_ptr<CModelDef> > mesh_map;
 	mesh_map m_MeshMap;
+	std::vector<CModelDefPtr> m_PrefetchedMeshes;
 	CColladaManager& m_ColladaManager;
 };
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -30,6 +30,7 @@
 #include "SkeletonAnimManager.h"
 #include "MeshManager.h"
 #include "ObjectEntry.h"
+#include "lib/ogl.h"
 #include "lib/res/graphics/ogl_tex.h"
 #include "lib/res/h_mgr.h"
 #include "lib/sysdep/rtl.h"
@@ -52,6 +53,11 @@ CModel::CModel(CSkeletonAnimManager& skeletonAnimManager)
 CModel::~CModel()
 {
 	ReleaseData();
+
+#if !CONFIG2_GLES
+	if (m_OcclusionState.m_Query)
+		pglDeleteQueriesARB(1, &m_OcclusionState.m_Query);
+#endif
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -119,6 +119,22 @@ public:
 	// add object flags, recursively through props
 	void AddFlagsRec(int flags);
 
+	/**
+	 * Graphics-only state for the renderer's occlusion culling
+	 * (see CRenderer::RenderOcclusionQueries).
+	 */
+	struct OcclusionState
+	{
+		OcclusionState() : m_Query(0), m_Frame(0), m_Pending(false), m_Occluded(false) {}
+
+		u32 m_Query; ///< GL query object, or 0 if not created yet
+		u32 m_Frame; ///< renderer frame in which the query was last issued
+		bool m_Pending; ///< whether the query's result hasn't been read back yet
+		bool m_Occluded; ///< whether the last result found the bounds completely hidden
+	};
+
+	OcclusionState& GetOcclusionState() { return m_OcclusionState; }
+
 	// recurse down tree setting dirty bits
 	virtual void SetDirtyRec(int dirtyflags) {
 		SetDirty(dirtyflags);
@@ -289,6 +305,8 @@ private:
 
 	// manager object which can load animations for us
 	CSkeletonAnimManager& m_SkeletonAnimManager;
+
+	OcclusionState m_OcclusionState;
 };
 
 #endif
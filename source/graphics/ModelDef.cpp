@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,6 +24,7 @@
 #include "ModelDef.h"
 #include "graphics/SkeletonAnimDef.h"
 #include "ps/FileIo.h"
+#include "maths/BoundingBoxAligned.h"
 #include "maths/Vector4D.h"
 
 #if ARCH_X86_X64
@@ -246,6 +247,22 @@ CModelDef::~CModelDef()
 	delete[] m_pBlendIndices;
 }
 
+size_t CModelDef::GetMemoryUsage() const
+{
+	size_t bytes = sizeof(*this);
+	// (each vertex's m_UVs is a separate allocation)
+	bytes += m_NumVertices * (sizeof(SModelVertex) + m_NumUVsPerVertex * 2 * sizeof(float));
+	bytes += m_NumFaces * sizeof(SModelFace);
+	bytes += m_NumBones * (sizeof(CBoneState) + sizeof(CMatrix3D));
+	bytes += m_NumBlends * sizeof(SVertexBlend);
+	if (m_pBlendIndices)
+		bytes += m_NumVertices * sizeof(size_t);
+	bytes += m_PropPoints.capacity() * sizeof(SPropPoint);
+	bytes += m_LODs.capacity() * sizeof(SLOD);
+	bytes += m_LODFaces.capacity() * sizeof(SModelFace);
+	return bytes;
+}
+
 // FindPropPoint: find and return pointer to prop point matching given name; 
 // return null if no match (case insensitive search)
 const SPropPoint* CModelDef::FindPropPoint(const char* name) const
@@ -416,9 +433,112 @@ CModelDef* CModelDef::Load(const VfsPath& filename, const VfsPath& name)
 		mdef->m_InverseBindBoneMatrices[i].Rotate(defpose[i].m_Rotation.GetInverse());
 	}
 
+	mdef->BuildLODs();
+
 	return mdef.release();
 }
 
+// Meshes with fewer faces than this aren't worth simplifying
+static const size_t LOD_MIN_FACES = 64;
+
+// Number of grid cells along the largest dimension of the mesh, into which
+// vertices are merged for the first simplified level (each further level
+// halves it)
+static const size_t LOD_GRID_RESOLUTION = 32;
+
+// Number of simplified levels to generate (at most)
+static const size_t LOD_MAX_LEVELS = 2;
+
+// Each level must have at most this fraction of the previous level's faces,
+// else it's not worth using
+static const float LOD_MIN_REDUCTION = 0.8f;
+
+// Distance from the camera (as a multiple of the mesh's radius) beyond which
+// the first simplified level is used. At that distance a grid cell covers
+// only a pixel or so at typical resolutions and fields of view, and each
+// further level doubles the distance along with the cell size.
+static const float LOD_DISTANCE_FACTOR = 60.f;
+
+void CModelDef::BuildLODs()
+{
+	m_LODs.clear();
+	m_LODFaces.clear();
+
+	if (m_NumFaces < LOD_MIN_FACES)
+		return;
+
+	CBoundingBoxAligned bounds;
+	for (size_t i = 0; i < m_NumVertices; ++i)
+		bounds += m_pVertices[i].m_Coords;
+
+	const CVector3D size = bounds[1] - bounds[0];
+	const float extent = std::max(std::max(size.X, size.Y), size.Z);
+	if (!(extent > 0.f))
+		return;
+	const float radius = size.Length() / 2.f;
+
+	std::vector<u16> remap(m_NumVertices);
+	size_t prevNumFaces = m_NumFaces;
+
+	for (size_t level = 0; level < LOD_MAX_LEVELS; ++level)
+	{
+		const size_t resolution = LOD_GRID_RESOLUTION >> level;
+		const float cellSize = extent / resolution;
+
+		// Merge each vertex into the first one found in its cell. Vertices are
+		// only merged if their (first set of) UVs and their main bone are
+		// similar too, so texture seams and joints don't get stretched.
+		std::map<u64, u16> cells;
+		for (size_t i = 0; i < m_NumVertices; ++i)
+		{
+			const SModelVertex& vtx = m_pVertices[i];
+			u64 cx = (u64)std::min((size_t)((vtx.m_Coords.X - bounds[0].X) / cellSize), resolution);
+			u64 cy = (u64)std::min((size_t)((vtx.m_Coords.Y - bounds[0].Y) / cellSize), resolution);
+			u64 cz = (u64)std::min((size_t)((vtx.m_Coords.Z - bounds[0].Z) / cellSize), resolution);
+			u64 cu = 0, cv = 0;
+			if (m_NumUVsPerVertex > 0)
+			{
+				cu = (u64)(u8)(i32)floor(vtx.m_UVs[0] * 8.f);
+				cv = (u64)(u8)(i32)floor(vtx.m_UVs[1] * 8.f);
+			}
+			u64 key = cx | (cy << 8) | (cz << 16) | (cu << 24) | (cv << 32) | ((u64)vtx.m_Blend.m_Bone[0] << 40);
+
+			std::map<u64, u16>::iterator it = cells.find(key);
+			if (it == cells.end())
+				it = cells.insert(std::make_pair(key, (u16)i)).first;
+			remap[i] = it->second;
+		}
+
+		// Keep the faces that haven't collapsed
+		const size_t firstFace = m_LODFaces.size();
+		for (size_t i = 0; i < m_NumFaces; ++i)
+		{
+			SModelFace face;
+			for (size_t k = 0; k < 3; ++k)
+				face.m_Verts[k] = remap[m_pFaces[i].m_Verts[k]];
+
+			if (face.m_Verts[0] != face.m_Verts[1] && face.m_Verts[1] != face.m_Verts[2] && face.m_Verts[2] != face.m_Verts[0])
+				m_LODFaces.push_back(face);
+		}
+		const size_t numFaces = m_LODFaces.size() - firstFace;
+
+		if (numFaces == 0 || numFaces > prevNumFaces * LOD_MIN_REDUCTION)
+		{
+			m_LODFaces.resize(firstFace);
+			if (numFaces == 0)
+				break;
+			continue;
+		}
+
+		SLOD lod;
+		lod.m_FirstFace = firstFace;
+		lod.m_NumFaces = numFaces;
+		lod.m_MinDistance = radius * LOD_DISTANCE_FACTOR * (1 << level);
+		m_LODs.push_back(lod);
+		prevNumFaces = numFaces;
+	}
+}
+
 // Save: write the given CModelDef to the given file
 void CModelDef::Save(const VfsPath& filename, const CModelDef* mdef)
 {
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -173,6 +173,62 @@ public:
 	size_t GetNumFaces() const { return m_NumFaces; }
 	SModelFace* GetFaces() const { return m_pFaces; }
 
+	/**
+	 * A simplified version of the mesh, for drawing it when it's far away.
+	 * It uses a subset of the full mesh's vertices, so it can share their data.
+	 */
+	struct SLOD
+	{
+		// range of this level's faces within GetLODFaces()
+		size_t m_FirstFace;
+		size_t m_NumFaces;
+		// distance from the camera beyond which this level should be used
+		float m_MinDistance;
+	};
+
+	// accessor: get level of detail data
+	size_t GetNumLODs() const { return m_LODs.size(); }
+	const SLOD& GetLOD(size_t i) const { return m_LODs[i]; }
+	const std::vector<SModelFace>& GetLODFaces() const { return m_LODFaces; }
+
+	/**
+	 * Returns the level of detail to draw at the given distance from the camera:
+	 * 0 for the full mesh, or i+1 for GetLOD(i).
+	 */
+	size_t ChooseLOD(float distance) const
+	{
+		size_t lod = 0;
+		while (lod < m_LODs.size() && distance > m_LODs[lod].m_MinDistance)
+			++lod;
+		return lod;
+	}
+
+	/**
+	 * Returns the faces to draw for level of detail @p lod (as returned by
+	 * ChooseLOD), as a range in the list made of GetFaces() followed by
+	 * GetLODFaces(). Renderers should use that list for their index buffers.
+	 */
+	void GetLODFaceRange(size_t lod, size_t& firstFace, size_t& numFaces) const
+	{
+		if (lod == 0)
+		{
+			firstFace = 0;
+			numFaces = m_NumFaces;
+		}
+		else
+		{
+			firstFace = m_NumFaces + m_LODs[lod-1].m_FirstFace;
+			numFaces = m_LODs[lod-1].m_NumFaces;
+		}
+	}
+
+	/**
+	 * Generate the simplified levels of detail from the full mesh, by merging
+	 * nearby vertices and removing the faces that become degenerate.
+	 * (This is called automatically by Load.)
+	 */
+	void BuildLODs();
+
 	// accessor: get bone data
 	size_t GetNumBones() const { return m_NumBones; }
 	CBoneState* GetBones() const { return m_Bones; }
@@ -256,6 +312,12 @@ public:
 	// accessor: get model name (for debugging)
 	const VfsPath& GetName() const { return m_Name; }
 
+	/**
+	 * @return approximate number of bytes of system memory used by this mesh's
+	 * data (not including its render data, which is mostly in vertex buffers)
+	 */
+	size_t GetMemoryUsage() const;
+
 public:
 	// vertex data
 	size_t m_NumVertices;
@@ -274,6 +336,9 @@ public:
 	size_t* m_pBlendIndices;
 	// prop point data
 	std::vector<SPropPoint> m_PropPoints;
+	// level of detail data
+	std::vector<SLOD> m_LODs;
+	std::vector<SModelFace> m_LODFaces;
 
 private:
 	VfsPath m_Name;	// filename
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -669,3 +669,25 @@ std::vector<std::vector<CStr> > CObjectBase::GetVariantGroups() const
 
 	return groups;
 }
+
+void CObjectBase::GetReferencedFiles(std::set<VfsPath>& meshes, std::set<VfsPath>& anims, std::set<CStrW>& props) const
+{
+	for (size_t i = 0; i < m_VariantGroups.size(); ++i)
+	{
+		for (size_t j = 0; j < m_VariantGroups[i].size(); ++j)
+		{
+			const Variant& var = m_VariantGroups[i][j];
+
+			if (!var.m_ModelFilename.empty())
+				meshes.insert(var.m_ModelFilename);
+
+			for (size_t k = 0; k < var.m_Anims.size(); ++k)
+				if (!var.m_Anims[k].m_FileName.empty())
+					anims.insert(var.m_Anims[k].m_FileName);
+
+			for (size_t k = 0; k < var.m_Props.size(); ++k)
+				if (!var.m_Props[k].m_ModelName.empty())
+					props.insert(var.m_Props[k].m_ModelName);
+		}
+	}
+}
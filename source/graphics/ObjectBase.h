@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -134,6 +134,11 @@ public:
 	// variant names.
 	std::vector<std::vector<CStr> > GetVariantGroups() const;
 
+	// Add the mesh and animation files used by any variant of this object
+	// (not including props) to the given sets, plus the names of all
+	// possible props.
+	void GetReferencedFiles(std::set<VfsPath>& meshes, std::set<VfsPath>& anims, std::set<CStrW>& props) const;
+
 	/**
 	 * Initialise this object by loading from the given file.
 	 * Returns false on error.
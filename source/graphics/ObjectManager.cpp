@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,7 +20,9 @@
 #include "ObjectManager.h"
 
 #include "graphics/ObjectBase.h"
+#include "graphics/MeshManager.h"
 #include "graphics/ObjectEntry.h"
+#include "graphics/SkeletonAnimManager.h"
 #include "ps/CLogger.h"
 #include "ps/Game.h"
 #include "ps/Profile.h"
@@ -156,6 +158,42 @@ CObjectEntry* CObjectManager::FindObjectVariation(CObjectBase* base, const std::
 	return obj;
 }
 
+void CObjectManager::PrefetchObjects(const std::set<CStrW>& objnames)
+{
+	PROFILE("prefetch objects");
+
+	std::set<VfsPath> meshes;
+	std::set<VfsPath> anims;
+
+	// Actor XML files are loaded on this thread (parsing them isn't thread-safe),
+	// following props recursively
+	std::set<CStrW> done;
+	std::vector<CStrW> queue(objnames.begin(), objnames.end());
+	while (!queue.empty())
+	{
+		CStrW name = queue.back();
+		queue.pop_back();
+		if (name.empty() || !done.insert(name).second)
+			continue;
+
+		CObjectBase* base = FindObjectBase(name);
+		if (!base)
+			continue;
+
+		std::set<CStrW> props;
+		base->GetReferencedFiles(meshes, anims, props);
+		queue.insert(queue.end(), props.begin(), props.end());
+	}
+
+	m_MeshManager.PrefetchMeshes(meshes);
+	m_SkeletonAnimManager.PrefetchAnimations(anims);
+}
+
+void CObjectManager::ReleasePrefetchedObjects()
+{
+	m_MeshManager.ReleasePrefetchedMeshes();
+}
+
 CTerrain* CObjectManager::GetTerrain()
 {
 	CmpPtr<ICmpTerrain> cmpTerrain(m_Simulation, SYSTEM_ENTITY);
@@ -211,7 +249,10 @@ Status CObjectManager::ReloadChangedFile(const VfsPath& path)
 			// to do the reloading itself
 			const CSimulation2::InterfaceListUnordered& cmps = m_Simulation.GetEntitiesWithInterfaceUnordered(IID_Visual);
 			for (CSimulation2::InterfaceListUnordered::const_iterator eit = cmps.begin(); eit != cmps.end(); ++eit)
+			{
+				eit->second->MarkStateHashDirty();
 				static_cast<ICmpVisual*>(eit->second)->Hotload(it->first);
+			}
 		}
 	}
 
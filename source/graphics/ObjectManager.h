@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -73,6 +73,20 @@ public:
 	CObjectEntry* FindObjectVariation(const CStrW& objname, const std::vector<std::set<CStr> >& selections);
 	CObjectEntry* FindObjectVariation(CObjectBase* base, const std::vector<std::set<CStr> >& selections);
 
+	/**
+	 * Load the given actors (and all their possible props), plus every mesh and
+	 * animation that any of their variants might use, so that creating lots of
+	 * units later (e.g. during map loading) doesn't have to load them one by one.
+	 * The mesh and animation files are loaded in parallel, on the engine thread pool.
+	 * Call ReleasePrefetchedObjects afterwards, once the units have been created.
+	 */
+	void PrefetchObjects(const std::set<CStrW>& objnames);
+
+	/**
+	 * Allow any prefetched meshes that weren't used to be unloaded.
+	 */
+	void ReleasePrefetchedObjects();
+
 	/**
 	 * Get the terrain object that actors managed by this manager should be linked
 	 * with (primarily for the purpose of decals)
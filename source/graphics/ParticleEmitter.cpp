@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,20 +27,11 @@
 #include "renderer/Renderer.h"
 
 CParticleEmitter::CParticleEmitter(const CParticleEmitterTypePtr& type) :
-	m_Type(type), m_Active(true), m_NextParticleIdx(0), m_EmissionRoundingError(0.f),
-	m_LastUpdateTime(type->m_Manager.GetCurrentTime()),
+	m_Type(type),
 	m_IndexArray(GL_DYNAMIC_DRAW),
-	m_VertexArray(GL_DYNAMIC_DRAW)
+	m_VertexArray(GL_STREAM_DRAW)
 {
-	// If we should start with particles fully emitted, pretend that we
-	// were created in the past so the first update will produce lots of
-	// particles.
-	// TODO: instead of this, maybe it would make more sense to do a full
-	// lifetime-length update of all emitters when the game first starts
-	// (so that e.g. buildings constructed later on won't have fully-started
-	// emitters, but those at the start will)?
-	if (m_Type->m_StartFull)
-		m_LastUpdateTime -= m_Type->m_MaxLifetime;
+	Reset();
 
 	m_Particles.reserve(m_Type->m_MaxParticles);
 
@@ -63,6 +54,25 @@ CParticleEmitter::CParticleEmitter(const CParticleEmitterTypePtr& type) :
 	m_VertexArray.SetNumVertices(m_Type->m_MaxParticles * 4);
 	m_VertexArray.Layout();
 
+	// The texture coordinates are the same for every particle, so they're
+	// only written once and never touched by UpdateArrayData
+	VertexArrayIterator<float[2]> attrUV = m_AttributeUV.GetIterator<float[2]>();
+	for (size_t i = 0; i < m_Type->m_MaxParticles; ++i)
+	{
+		(*attrUV)[0] = 1;
+		(*attrUV)[1] = 0;
+		++attrUV;
+		(*attrUV)[0] = 0;
+		(*attrUV)[1] = 0;
+		++attrUV;
+		(*attrUV)[0] = 0;
+		(*attrUV)[1] = 1;
+		++attrUV;
+		(*attrUV)[0] = 1;
+		(*attrUV)[1] = 1;
+		++attrUV;
+	}
+
 	m_IndexArray.SetNumVertices(m_Type->m_MaxParticles * 6);
 	m_IndexArray.Layout();
 	VertexArrayIterator<u16> index = m_IndexArray.GetIterator();
@@ -79,21 +89,44 @@ CParticleEmitter::CParticleEmitter(const CParticleEmitterTypePtr& type) :
 	m_IndexArray.FreeBackingStore();
 }
 
-void CParticleEmitter::UpdateArrayData()
+void CParticleEmitter::Reset()
 {
-	// Update m_Particles
-	m_Type->UpdateEmitter(*this, m_Type->m_Manager.GetCurrentTime() - m_LastUpdateTime);
+	m_Active = true;
+	m_Pos = CVector3D();
+	m_EntityVariables.clear();
+	m_Particles.clear();
+	m_NextParticleIdx = 0;
+	m_EmissionRoundingError = 0.f;
+	m_ParticleBounds.SetEmpty();
 	m_LastUpdateTime = m_Type->m_Manager.GetCurrentTime();
 
-	// Regenerate the vertex array data:
+	// If we should start with particles fully emitted, pretend that we
+	// were created in the past so the first update will produce lots of
+	// particles.
+	// TODO: instead of this, maybe it would make more sense to do a full
+	// lifetime-length update of all emitters when the game first starts
+	// (so that e.g. buildings constructed later on won't have fully-started
+	// emitters, but those at the start will)?
+	if (m_Type->m_StartFull)
+		m_LastUpdateTime -= m_Type->m_MaxLifetime;
+}
+
+void CParticleEmitter::UpdateParticles()
+{
+	m_Type->UpdateEmitter(*this, m_Type->m_Manager.GetCurrentTime() - m_LastUpdateTime);
+	m_LastUpdateTime = m_Type->m_Manager.GetCurrentTime();
+}
 
+void CParticleEmitter::UpdateArrayData()
+{
 	VertexArrayIterator<CVector3D> attrPos = m_AttributePos.GetIterator<CVector3D>();
 	VertexArrayIterator<float[2]> attrAxis = m_AttributeAxis.GetIterator<float[2]>();
-	VertexArrayIterator<float[2]> attrUV = m_AttributeUV.GetIterator<float[2]>();
 	VertexArrayIterator<SColor4ub> attrColor = m_AttributeColor.GetIterator<SColor4ub>();
 
 	ENSURE(m_Particles.size() <= m_Type->m_MaxParticles);
 
+	const bool premultiply = (m_Type->m_BlendFuncDst == GL_ONE_MINUS_SRC_COLOR);
+
 	CBoundingBoxAligned bounds;
 
 	for (size_t i = 0; i < m_Particles.size(); ++i)
@@ -128,24 +161,11 @@ void CParticleEmitter::UpdateArrayData()
 		(*attrAxis)[1] = c;
 		++attrAxis;
 
-		(*attrUV)[0] = 1;
-		(*attrUV)[1] = 0;
-		++attrUV;
-		(*attrUV)[0] = 0;
-		(*attrUV)[1] = 0;
-		++attrUV;
-		(*attrUV)[0] = 0;
-		(*attrUV)[1] = 1;
-		++attrUV;
-		(*attrUV)[0] = 1;
-		(*attrUV)[1] = 1;
-		++attrUV;
-
 		SColor4ub color = m_Particles[i].color;
 
 		// Special case: If the blending depends on the source colour, not the source alpha,
 		// then pre-multiply by the alpha. (This is kind of a hack.)
-		if (m_Type->m_BlendFuncDst == GL_ONE_MINUS_SRC_COLOR)
+		if (premultiply)
 		{
 			color.R = (color.R * color.A) / 255;
 			color.G = (color.G * color.A) / 255;
@@ -159,8 +179,12 @@ void CParticleEmitter::UpdateArrayData()
 	}
 
 	m_ParticleBounds = bounds;
+}
 
-	m_VertexArray.Upload();
+void CParticleEmitter::UploadArrayData()
+{
+	// Only the live particles are drawn, so don't bother uploading the rest
+	m_VertexArray.Upload(m_Particles.size() * 4);
 }
 
 void CParticleEmitter::Bind(const CShaderProgramPtr& shader)
@@ -169,7 +193,7 @@ void CParticleEmitter::Bind(const CShaderProgramPtr& shader)
 	shader->Uniform("fogColor", g_Renderer.GetLightEnv().m_FogColor);
 	shader->Uniform("fogParams", g_Renderer.GetLightEnv().m_FogFactor, g_Renderer.GetLightEnv().m_FogMax, 0.f, 0.f);
 	pglBlendEquationEXT(m_Type->m_BlendEquation);
-	glBlendFunc(m_Type->m_BlendFuncSrc, m_Type->m_BlendFuncDst);
+	ogl_BlendFunc(m_Type->m_BlendFuncSrc, m_Type->m_BlendFuncDst);
 }
 
 void CParticleEmitter::RenderArray(const CShaderProgramPtr& shader)
@@ -226,7 +250,7 @@ void CParticleEmitter::SetEntityVariable(const std::string& name, float value)
 CModelParticleEmitter::CModelParticleEmitter(const CParticleEmitterTypePtr& type) :
 	m_Type(type)
 {
-	m_Emitter = CParticleEmitterPtr(new CParticleEmitter(m_Type));
+	m_Emitter = m_Type->m_Manager.CreateEmitter(m_Type);
 }
 
 CModelParticleEmitter::~CModelParticleEmitter()
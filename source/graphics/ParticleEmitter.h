@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -67,6 +67,12 @@ class CParticleEmitter
 public:
 	CParticleEmitter(const CParticleEmitterTypePtr& type);
 
+	/**
+	 * Return to the state of a newly-constructed emitter (with no particles),
+	 * so the emitter and its vertex buffers can be reused.
+	 */
+	void Reset();
+
 	/**
 	 * Set the position to be used for emission of new particles.
 	 */
@@ -91,10 +97,25 @@ public:
 	void AddParticle(const SParticle& particle);
 
 	/**
-	 * Update particle and vertex array data. Must be called before RenderArray.
+	 * Update particle states (spawning new particles and moving the old ones).
+	 * This uses the particle manager's shared RNG, so it must not be called
+	 * concurrently with other emitters.
+	 */
+	void UpdateParticles();
+
+	/**
+	 * Regenerate the vertex array data from the particle states. This only
+	 * touches the emitter's own data, so different emitters can be updated
+	 * concurrently (but not from the main thread's GL calls).
 	 */
 	void UpdateArrayData();
 
+	/**
+	 * Upload the vertex array data. Must be called (after UpdateParticles and
+	 * UpdateArrayData) before RenderArray.
+	 */
+	void UploadArrayData();
+
 	/**
 	 * Bind rendering state (textures and blend modes).
 	 */
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -277,9 +277,9 @@ CParticleEmitterType::CParticleEmitterType(const VfsPath& path, CParticleManager
 	// => max(p) = max(p0, p0 + v0*tmax + 1/2 a*tmax, p0 - 1/2 v0^2/a)
 
 	// Compute combined acceleration (assume constant)
-	CVector3D accel;
 	for (size_t i = 0; i < m_Effectors.size(); ++i)
-		accel += m_Effectors[i]->Max();
+		m_Acceleration += m_Effectors[i]->Max();
+	const CVector3D& accel = m_Acceleration;
 
 	CVector3D vmin(m_Variables[VAR_VELOCITY_X]->Min(*this), m_Variables[VAR_VELOCITY_Y]->Min(*this), m_Variables[VAR_VELOCITY_Z]->Min(*this));
 	CVector3D vmax(m_Variables[VAR_VELOCITY_X]->Max(*this), m_Variables[VAR_VELOCITY_Y]->Max(*this), m_Variables[VAR_VELOCITY_Z]->Max(*this));
@@ -484,9 +484,8 @@ bool CParticleEmitterType::LoadXML(const VfsPath& path)
 
 void CParticleEmitterType::UpdateEmitter(CParticleEmitter& emitter, float dt)
 {
-	// If dt is very large, we should do the update in multiple small
-	// steps to prevent all the particles getting clumped together at
-	// low framerates
+	// If dt is very large, the new particles must be spread over the whole
+	// period to prevent them all getting clumped together at low framerates
 
 	const float maxStepLength = 0.2f;
 
@@ -494,13 +493,106 @@ void CParticleEmitterType::UpdateEmitter(CParticleEmitter& emitter, float dt)
 	// period of the particles
 	dt = std::min(dt, m_MaxLifetime);
 
-	while (dt > maxStepLength)
+	// Emitters are only updated while they're being rendered, so a long dt
+	// usually means it was off-screen and is just waking up. Rather than
+	// simulating all the steps we missed, compute the result directly
+	if (dt > maxStepLength)
+		FastForwardEmitter(emitter, dt);
+	else
+		UpdateEmitterStep(emitter, dt);
+}
+
+/**
+ * Make alpha fade in/out nicely over the particle's lifetime.
+ */
+static void UpdateParticleAlpha(SParticle& p)
+{
+	// TODO: this should probably be done as a variable or something,
+	// instead of hardcoding
+	float ageFrac = p.age / p.maxAge;
+	float a = std::min(1.f-ageFrac, 5.f*ageFrac);
+	p.color.A = clamp((int)(a*255.f), 0, 255);
+}
+
+void CParticleEmitterType::InitParticle(CParticleEmitter& emitter, SParticle& particle)
+{
+	particle.pos.X = m_Variables[VAR_POSITION_X]->Evaluate(emitter);
+	particle.pos.Y = m_Variables[VAR_POSITION_Y]->Evaluate(emitter);
+	particle.pos.Z = m_Variables[VAR_POSITION_Z]->Evaluate(emitter);
+	particle.pos += emitter.m_Pos;
+
+	particle.velocity.X = m_Variables[VAR_VELOCITY_X]->Evaluate(emitter);
+	particle.velocity.Y = m_Variables[VAR_VELOCITY_Y]->Evaluate(emitter);
+	particle.velocity.Z = m_Variables[VAR_VELOCITY_Z]->Evaluate(emitter);
+
+	particle.angle = m_Variables[VAR_ANGLE]->Evaluate(emitter);
+	particle.angleSpeed = m_Variables[VAR_VELOCITY_ANGLE]->Evaluate(emitter);
+
+	particle.size = m_Variables[VAR_SIZE]->Evaluate(emitter);
+
+	RGBColor color;
+	color.X = m_Variables[VAR_COLOR_R]->Evaluate(emitter);
+	color.Y = m_Variables[VAR_COLOR_G]->Evaluate(emitter);
+	color.Z = m_Variables[VAR_COLOR_B]->Evaluate(emitter);
+	particle.color = ConvertRGBColorTo4ub(color);
+
+	particle.age = 0.f;
+	particle.maxAge = m_Variables[VAR_LIFETIME]->Evaluate(emitter);
+}
+
+void CParticleEmitterType::FastForwardEmitter(CParticleEmitter& emitter, float dt)
+{
+	ENSURE(emitter.m_Type.get() == this);
+
+	// With constant acceleration, p(t) = p0 + v0*t + 1/2 a*t^2
+	// so existing particles can be moved to their final positions in one go
+	const CVector3D halfAccelDt2 = m_Acceleration * (0.5f*dt*dt);
+	const CVector3D accelDt = m_Acceleration * dt;
+
+	for (size_t i = 0; i < emitter.m_Particles.size(); ++i)
 	{
-		UpdateEmitterStep(emitter, maxStepLength);
-		dt -= maxStepLength;
+		SParticle& p = emitter.m_Particles[i];
+
+		if (p.age > p.maxAge)
+			continue;
+
+		p.pos += p.velocity * dt + halfAccelDt2;
+		p.velocity += accelDt;
+		p.angle += p.angleSpeed * dt;
+		p.age += dt;
+		UpdateParticleAlpha(p);
 	}
 
-	UpdateEmitterStep(emitter, dt);
+	if (!emitter.m_Active)
+		return;
+
+	float emissionRate = m_Variables[VAR_EMISSIONRATE]->Evaluate(emitter);
+
+	// Particle k (counting from 1) would have been emitted once the accumulated
+	// emission reached k, i.e. at time (k - roundingError)/emissionRate after
+	// the start of this update
+	float roundingError = emitter.m_EmissionRoundingError;
+	int newParticles = floor(roundingError + dt*emissionRate);
+	emitter.m_EmissionRoundingError += dt*emissionRate - newParticles;
+
+	// Any older ones would be overwritten by the newer ones in the ring
+	// buffer, so don't bother computing them
+	int firstParticle = std::max(1, newParticles - (int)m_MaxParticles + 1);
+
+	for (int k = firstParticle; k <= newParticles; ++k)
+	{
+		SParticle particle;
+		InitParticle(emitter, particle);
+
+		float age = std::max(0.f, dt - (k - roundingError) / emissionRate);
+		particle.pos += particle.velocity * age + m_Acceleration * (0.5f*age*age);
+		particle.velocity += m_Acceleration * age;
+		particle.angle += particle.angleSpeed * age;
+		particle.age = age;
+		UpdateParticleAlpha(particle);
+
+		emitter.AddParticle(particle);
+	}
 }
 
 void CParticleEmitterType::UpdateEmitterStep(CParticleEmitter& emitter, float dt)
@@ -524,30 +616,7 @@ void CParticleEmitterType::UpdateEmitterStep(CParticleEmitter& emitter, float dt
 		{
 			// Compute new particle state based on variables
 			SParticle particle;
-
-			particle.pos.X = m_Variables[VAR_POSITION_X]->Evaluate(emitter);
-			particle.pos.Y = m_Variables[VAR_POSITION_Y]->Evaluate(emitter);
-			particle.pos.Z = m_Variables[VAR_POSITION_Z]->Evaluate(emitter);
-			particle.pos += emitter.m_Pos;
-
-			particle.velocity.X = m_Variables[VAR_VELOCITY_X]->Evaluate(emitter);
-			particle.velocity.Y = m_Variables[VAR_VELOCITY_Y]->Evaluate(emitter);
-			particle.velocity.Z = m_Variables[VAR_VELOCITY_Z]->Evaluate(emitter);
-
-			particle.angle = m_Variables[VAR_ANGLE]->Evaluate(emitter);
-			particle.angleSpeed = m_Variables[VAR_VELOCITY_ANGLE]->Evaluate(emitter);
-
-			particle.size = m_Variables[VAR_SIZE]->Evaluate(emitter);
-
-			RGBColor color;
-			color.X = m_Variables[VAR_COLOR_R]->Evaluate(emitter);
-			color.Y = m_Variables[VAR_COLOR_G]->Evaluate(emitter);
-			color.Z = m_Variables[VAR_COLOR_B]->Evaluate(emitter);
-			particle.color = ConvertRGBColorTo4ub(color);
-
-			particle.age = 0.f;
-			particle.maxAge = m_Variables[VAR_LIFETIME]->Evaluate(emitter);
-
+			InitParticle(emitter, particle);
 			emitter.AddParticle(particle);
 		}
 	}
@@ -565,12 +634,7 @@ void CParticleEmitterType::UpdateEmitterStep(CParticleEmitter& emitter, float dt
 		p.angle += p.angleSpeed * dt;
 		p.age += dt;
 
-		// Make alpha fade in/out nicely
-		// TODO: this should probably be done as a variable or something,
-		// instead of hardcoding
-		float ageFrac = p.age / p.maxAge;
-		float a = std::min(1.f-ageFrac, 5.f*ageFrac);
-		p.color.A = clamp((int)(a*255.f), 0, 255);
+		UpdateParticleAlpha(p);
 	}
 
 	for (size_t i = 0; i < m_Effectors.size(); ++i)
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -22,12 +22,13 @@
 #include "lib/ogl.h"
 #include "lib/file/vfs/vfs_path.h"
 #include "maths/BoundingBoxAligned.h"
+#include "maths/Vector3D.h"
 
-class CVector3D;
 class CParticleEmitter;
 class CParticleManager;
 class IParticleVar;
 class IParticleEffector;
+struct SParticle;
 
 /**
  * Particle emitter type - stores the common state data for all emitters of that
@@ -49,6 +50,7 @@ public:
 private:
 	friend class CModelParticleEmitter;
 	friend class CParticleEmitter;
+	friend class CParticleManager;
 	friend class CParticleVarConstant;
 	friend class CParticleVarUniform;
 	friend class CParticleVarCopy;
@@ -88,6 +90,18 @@ private:
 	 */
 	void UpdateEmitterStep(CParticleEmitter& emitter, float dt);
 
+	/**
+	 * Update the state of an emitter's particles by a long time @p dt (e.g. after it
+	 * has been off-screen for a while), by computing where the particles will be
+	 * directly instead of simulating many small steps.
+	 */
+	void FastForwardEmitter(CParticleEmitter& emitter, float dt);
+
+	/**
+	 * Compute the initial state of a newly-emitted particle.
+	 */
+	void InitParticle(CParticleEmitter& emitter, SParticle& particle);
+
 	CBoundingBoxAligned CalculateBounds(CVector3D emitterPos, CBoundingBoxAligned emittedBounds);
 
 	CTexturePtr m_Texture;
@@ -101,6 +115,9 @@ private:
 	size_t m_MaxParticles;
 	CBoundingBoxAligned m_MaxBounds;
 
+	/// Combined acceleration of all the effectors (which are assumed to be constant)
+	CVector3D m_Acceleration;
+
 	typedef shared_ptr<IParticleVar> IParticleVarPtr;
 	std::vector<IParticleVarPtr> m_Variables;
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,10 +19,14 @@
 
 #include "ParticleManager.h"
 
+#include "graphics/Frustum.h"
 #include "ps/Filesystem.h"
 #include "ps/Profile.h"
 #include "renderer/Scene.h"
 
+// Maximum number of dead emitters of each type to keep around for reuse
+static const size_t MAX_POOLED_EMITTERS = 16;
+
 static Status ReloadChangedFileCB(void* param, const VfsPath& path)
 {
 	return static_cast<CParticleManager*>(param)->ReloadChangedFile(path);
@@ -50,6 +54,18 @@ CParticleEmitterTypePtr CParticleManager::LoadEmitterType(const VfsPath& path)
 	return emitterType;
 }
 
+CParticleEmitterPtr CParticleManager::CreateEmitter(const CParticleEmitterTypePtr& type)
+{
+	boost::unordered_map<CParticleEmitterType*, std::vector<CParticleEmitterPtr> >::iterator it = m_EmitterPool.find(type.get());
+	if (it == m_EmitterPool.end() || it->second.empty())
+		return CParticleEmitterPtr(new CParticleEmitter(type));
+
+	CParticleEmitterPtr emitter = it->second.back();
+	it->second.pop_back();
+	emitter->Reset();
+	return emitter;
+}
+
 void CParticleManager::AddUnattachedEmitter(const CParticleEmitterPtr& emitter)
 {
 	m_UnattachedEmitters.push_back(emitter);
@@ -80,21 +96,42 @@ struct EmitterHasNoParticles
 	}
 };
 
-void CParticleManager::RenderSubmit(SceneCollector& collector, const CFrustum& UNUSED(frustum))
+void CParticleManager::RenderSubmit(SceneCollector& collector, const CFrustum& frustum)
 {
 	PROFILE("submit unattached particles");
 
-	// Delete any unattached emitters that have no particles left
-	m_UnattachedEmitters.remove_if(EmitterHasNoParticles());
+	std::list<CParticleEmitterPtr>::iterator it = m_UnattachedEmitters.begin();
+	while (it != m_UnattachedEmitters.end())
+	{
+		CParticleEmitter* emitter = it->get();
+
+		// Remove any unattached emitters that have no particles left,
+		// and keep some of them for reuse. (They don't emit anything new, so
+		// once the longest lifetime has passed all the particles must be
+		// dead, even if the emitter has been off-screen and hasn't updated them)
+		if (m_CurrentTime - emitter->m_LastUpdateTime >= emitter->m_Type->m_MaxLifetime ||
+			EmitterHasNoParticles()(*it))
+		{
+			std::vector<CParticleEmitterPtr>& pool = m_EmitterPool[emitter->m_Type.get()];
+			if (it->unique() && pool.size() < MAX_POOLED_EMITTERS)
+				pool.push_back(*it);
+			it = m_UnattachedEmitters.erase(it);
+			continue;
+		}
 
-	// TODO: should do some frustum culling
+		// Off-screen emitters are left asleep
+		CBoundingBoxAligned bounds = emitter->m_Type->CalculateBounds(emitter->GetPosition(), emitter->GetParticleBounds());
+		if (frustum.IsBoxVisible(CVector3D(0, 0, 0), bounds))
+			collector.Submit(emitter);
 
-	for (std::list<CParticleEmitterPtr>::iterator it = m_UnattachedEmitters.begin(); it != m_UnattachedEmitters.end(); ++it)
-		collector.Submit(it->get());
+		++it;
+	}
 }
 
 Status CParticleManager::ReloadChangedFile(const VfsPath& path)
 {
 	m_EmitterTypes.erase(path);
+	// (The pooled emitters may use the old type, so just discard them all)
+	m_EmitterPool.clear();
 	return INFO::OK;
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -34,6 +34,13 @@ public:
 
 	CParticleEmitterTypePtr LoadEmitterType(const VfsPath& path);
 
+	/**
+	 * Returns a new emitter of the given type. Emitters whose particles have all
+	 * died are kept in a pool and reused, to avoid reallocating their particle
+	 * arrays and vertex buffers.
+	 */
+	CParticleEmitterPtr CreateEmitter(const CParticleEmitterTypePtr& type);
+
 	/**
 	 * Tell the manager to handle rendering of an emitter that is no longer
 	 * attached to a unit.
@@ -45,6 +52,11 @@ public:
 	 */
 	void ClearUnattachedEmitters();
 
+	/**
+	 * Submit the unattached emitters that are inside @p frustum. The others
+	 * aren't updated until they're visible again, at which point they'll
+	 * fast-forward to the current time.
+	 */
 	void RenderSubmit(SceneCollector& collector, const CFrustum& frustum);
 
 	void Interpolate(const float simFrameLength);
@@ -61,6 +73,9 @@ private:
 
 	std::list<CParticleEmitterPtr> m_UnattachedEmitters;
 
+	/// Dead emitters available for reuse, indexed by their type
+	boost::unordered_map<CParticleEmitterType*, std::vector<CParticleEmitterPtr> > m_EmitterPool;
+
 	boost::unordered_map<VfsPath, CParticleEmitterTypePtr> m_EmitterTypes;
 };
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,11 +24,14 @@
 #include "Patch.h"
 #include "Terrain.h"
 
+#include "maths/MathUtil.h"
+
 
 ///////////////////////////////////////////////////////////////////////////////
 // CPatch constructor
 CPatch::CPatch()
-: m_Parent(0), m_bWillBeDrawn(false)
+: m_Parent(0), m_bWillBeDrawn(false),
+  m_DirtyTexturesI0(0), m_DirtyTexturesJ0(0), m_DirtyTexturesI1(0), m_DirtyTexturesJ1(0)
 {
 }
 
@@ -88,3 +91,41 @@ int CPatch::GetSideFlags()
 		flags |= CPATCH_SIDE_POSZ;
 	return flags;
 }
+
+void CPatch::MakeTexturesDirty(ssize_t i0, ssize_t j0, ssize_t i1, ssize_t j1)
+{
+	i0 = clamp(i0, (ssize_t)0, PATCH_SIZE);
+	j0 = clamp(j0, (ssize_t)0, PATCH_SIZE);
+	i1 = clamp(i1, (ssize_t)0, PATCH_SIZE);
+	j1 = clamp(j1, (ssize_t)0, PATCH_SIZE);
+	if (i0 >= i1 || j0 >= j1)
+		return;
+
+	if (m_DirtyTexturesI0 >= m_DirtyTexturesI1)
+	{
+		m_DirtyTexturesI0 = i0;
+		m_DirtyTexturesJ0 = j0;
+		m_DirtyTexturesI1 = i1;
+		m_DirtyTexturesJ1 = j1;
+	}
+	else
+	{
+		m_DirtyTexturesI0 = std::min(m_DirtyTexturesI0, i0);
+		m_DirtyTexturesJ0 = std::min(m_DirtyTexturesJ0, j0);
+		m_DirtyTexturesI1 = std::max(m_DirtyTexturesI1, i1);
+		m_DirtyTexturesJ1 = std::max(m_DirtyTexturesJ1, j1);
+	}
+}
+
+bool CPatch::GetAndClearDirtyTextures(ssize_t& i0, ssize_t& j0, ssize_t& i1, ssize_t& j1)
+{
+	if (m_DirtyTexturesI0 >= m_DirtyTexturesI1)
+		return false;
+
+	i0 = m_DirtyTexturesI0;
+	j0 = m_DirtyTexturesJ0;
+	i1 = m_DirtyTexturesI1;
+	j1 = m_DirtyTexturesJ1;
+	m_DirtyTexturesI0 = m_DirtyTexturesJ0 = m_DirtyTexturesI1 = m_DirtyTexturesJ1 = 0;
+	return true;
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -74,6 +74,21 @@ public:
 	bool getDrawState() { return m_bWillBeDrawn; };
 
 	int GetSideFlags();
+
+	/**
+	 * Records that the textures of tiles that affect the blends of the patch's
+	 * tiles i0 <= i < i1, j0 <= j < j1 (relative to the patch) have changed.
+	 */
+	void MakeTexturesDirty(ssize_t i0, ssize_t j0, ssize_t i1, ssize_t j1);
+
+	/**
+	 * Returns the bounds of all the tiles passed to MakeTexturesDirty since
+	 * the last call, and forgets them. Returns false if there were none.
+	 */
+	bool GetAndClearDirtyTextures(ssize_t& i0, ssize_t& j0, ssize_t& i1, ssize_t& j1);
+
+private:
+	ssize_t m_DirtyTexturesI0, m_DirtyTexturesJ0, m_DirtyTexturesI1, m_DirtyTexturesJ1;
 };
 
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -110,9 +110,29 @@ CShaderParams<value_t>::CShaderParams()
 	m_Items = GetInterned(items);
 }
 
+template<typename value_t>
+size_t CShaderParams<value_t>::SetCacheKeyHash::operator()(const SetCacheKey& key) const
+{
+	size_t hash = 0;
+	boost::hash_combine(hash, key.items);
+	boost::hash_combine(hash, key.name.GetHash());
+	boost::hash_combine(hash, key.value);
+	return hash;
+}
+
 template<typename value_t>
 void CShaderParams<value_t>::Set(CStrIntern name, const value_t& value)
 {
+	ENSURE(ThreadUtil::IsMainThread()); // s_SetCache is not thread-safe
+
+	SetCacheKey key = { m_Items, name, value };
+	typename SetCache_t::iterator cached = s_SetCache.find(key);
+	if (cached != s_SetCache.end())
+	{
+		m_Items = cached->second;
+		return;
+	}
+
 	SItems items = *m_Items;
 
 	typename SItems::Item addedItem = std::make_pair(name, value);
@@ -134,6 +154,7 @@ void CShaderParams<value_t>::Set(CStrIntern name, const value_t& value)
 
 	items.RecalcHash();
 	m_Items = GetInterned(items);
+	s_SetCache[key] = m_Items;
 }
 
 template<typename value_t>
@@ -250,7 +271,7 @@ void CShaderRenderQueries::Add(const char* name)
 	}
 }
 
-size_t CShaderRenderQueries::GetSize()
+size_t CShaderRenderQueries::GetSize() const
 {
 	return m_Items.size();
 }
@@ -271,12 +292,12 @@ void CShaderConditionalDefines::Add(const char* defname, const char* defvalue, i
 	m_Defines.push_back(cd);
 }
 
-size_t CShaderConditionalDefines::GetSize()
+size_t CShaderConditionalDefines::GetSize() const
 {
 	return m_Defines.size();
 }
 
-CShaderConditionalDefines::CondDefine& CShaderConditionalDefines::GetItem(size_t i)
+const CShaderConditionalDefines::CondDefine& CShaderConditionalDefines::GetItem(size_t i) const
 {
 	return m_Defines[i];
 }
@@ -286,6 +307,8 @@ CShaderConditionalDefines::CondDefine& CShaderConditionalDefines::GetItem(size_t
 
 template<> CShaderParams<CStrIntern>::InternedItems_t CShaderParams<CStrIntern>::s_InternedItems = CShaderParams<CStrIntern>::InternedItems_t();
 template<> CShaderParams<CVector4D>::InternedItems_t CShaderParams<CVector4D>::s_InternedItems = CShaderParams<CVector4D>::InternedItems_t();
+template<> CShaderParams<CStrIntern>::SetCache_t CShaderParams<CStrIntern>::s_SetCache = CShaderParams<CStrIntern>::SetCache_t();
+template<> CShaderParams<CVector4D>::SetCache_t CShaderParams<CVector4D>::s_SetCache = CShaderParams<CVector4D>::SetCache_t();
 
 template class CShaderParams<CStrIntern>;
 template class CShaderParams<CVector4D>;
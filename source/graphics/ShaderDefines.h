@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -118,6 +118,32 @@ private:
 	 * for any subsequent requests for an equal items list.
 	 */
 	static SItems* GetInterned(const SItems& items);
+
+	/**
+	 * Key for memoizing Set(): the original interned items plus the added item.
+	 */
+	struct SetCacheKey
+	{
+		SItems* items;
+		CStrIntern name;
+		value_t value;
+
+		bool operator==(const SetCacheKey& b) const
+		{
+			return items == b.items && name == b.name && value == b.value;
+		}
+	};
+
+	struct SetCacheKeyHash
+	{
+		size_t operator()(const SetCacheKey& key) const;
+	};
+
+	// The renderer repeatedly adds the same defines onto the same sets
+	// (e.g. per-model conditional defines), so remember the interned result
+	// of each Set() to avoid rebuilding and rehashing the items list
+	typedef boost::unordered_map<SetCacheKey, SItems*, SetCacheKeyHash> SetCache_t;
+	static SetCache_t s_SetCache;
 };
 
 /**
@@ -186,8 +212,14 @@ public:
 	typedef std::pair<int, CStrIntern> RenderQuery;
 	
 	void Add(const char* name);
-	size_t GetSize();
+	size_t GetSize() const;
 	RenderQuery GetItem(size_t i);
+
+	bool operator==(const CShaderRenderQueries& b) const
+	{
+		return m_Items == b.m_Items;
+	}
+
 private:
 	std::vector<RenderQuery> m_Items;
 };
@@ -210,8 +242,8 @@ public:
 	};
 	
 	void Add(const char* defname, const char* defvalue, int type, std::vector<float> &args);
-	size_t GetSize();
-	CondDefine& GetItem(size_t i);
+	size_t GetSize() const;
+	const CondDefine& GetItem(size_t i) const;
 	
 private:
 	std::vector<CondDefine> m_Defines;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,6 +20,7 @@
 #include "ShaderManager.h"
 
 #include "graphics/ShaderTechnique.h"
+#include "lib/allocators/shared_ptr.h"
 #include "lib/timer.h"
 #include "lib/utf8.h"
 #include "ps/CLogger.h"
@@ -31,6 +32,8 @@
 #include "ps/XML/XMLWriter.h"
 #include "renderer/Renderer.h"
 
+#include <boost/algorithm/string.hpp>
+
 TIMER_ADD_CLIENT(tc_ShaderValidation);
 
 struct revcompare2nd
@@ -64,12 +67,83 @@ CShaderManager::CShaderManager()
 CShaderManager::~CShaderManager()
 {
 	UnregisterFileReloadFunc(ReloadChangedFileCB, this);
+
+	SaveProgramList();
+}
+
+// File that lists the programs loaded in the previous session, one per line,
+// as the program name followed by tab-separated NAME=VALUE defines
+static const wchar_t* PROGRAM_LIST_PATH = L"cache/shaders/programs.txt";
+
+void CShaderManager::SaveProgramList()
+{
+	if (!g_VFS || m_ProgramCache.empty())
+		return;
+
+	std::stringstream list;
+	for (ProgramCacheMap::iterator it = m_ProgramCache.begin(); it != m_ProgramCache.end(); ++it)
+	{
+		// Don't bother remembering programs that failed to load
+		if (!it->second)
+			continue;
+
+		std::stringstream line;
+		line << it->first.name.string();
+
+		bool valid = (it->first.name.string().find_first_of("\t\n=") == std::string::npos);
+		std::map<CStrIntern, CStrIntern> defines = it->first.defines.GetMap();
+		for (std::map<CStrIntern, CStrIntern>::iterator d = defines.begin(); d != defines.end(); ++d)
+		{
+			if (d->first.string().find_first_of("\t\n=") != std::string::npos ||
+				d->second.string().find_first_of("\t\n") != std::string::npos)
+				valid = false;
+			line << "\t" << d->first.string() << "=" << d->second.string();
+		}
+
+		if (valid)
+			list << line.str() << "\n";
+	}
+
+	std::string data = list.str();
+	shared_ptr<u8> buf;
+	AllocateAligned(buf, data.size(), maxSectorSize);
+	memcpy(buf.get(), data.data(), data.size());
+	g_VFS->CreateFile(PROGRAM_LIST_PATH, buf, data.size());
+}
+
+void CShaderManager::PrecompilePrograms()
+{
+	PROFILE2("precompile shaders");
+
+	CVFSFile file;
+	if (!VfsFileExists(PROGRAM_LIST_PATH) || file.Load(g_VFS, PROGRAM_LIST_PATH) != PSRETURN_OK)
+		return;
+
+	std::stringstream list(file.DecodeUTF8());
+	std::string line;
+	while (std::getline(list, line))
+	{
+		std::vector<std::string> fields;
+		boost::algorithm::split(fields, line, boost::algorithm::is_any_of("\t"));
+		if (fields.empty() || fields[0].empty())
+			continue;
+
+		CShaderDefines defines;
+		for (size_t i = 1; i < fields.size(); ++i)
+		{
+			size_t eq = fields[i].find('=');
+			if (eq != std::string::npos)
+				defines.Add(fields[i].substr(0, eq).c_str(), fields[i].substr(eq + 1).c_str());
+		}
+
+		LoadProgram(fields[0].c_str(), defines);
+	}
 }
 
 CShaderProgramPtr CShaderManager::LoadProgram(const char* name, const CShaderDefines& defines)
 {
-	CacheKey key = { name, defines };
-	std::map<CacheKey, CShaderProgramPtr>::iterator it = m_ProgramCache.find(key);
+	CacheKey key = { CStrIntern(name), defines };
+	ProgramCacheMap::iterator it = m_ProgramCache.find(key);
 	if (it != m_ProgramCache.end())
 		return it->second;
 
@@ -333,6 +407,14 @@ static GLenum ParseBlendFunc(const CStr& str)
 	return GL_ZERO;
 }
 
+size_t CShaderManager::CacheKeyHash::operator()(const CacheKey& key) const
+{
+	size_t hash = 0;
+	boost::hash_combine(hash, key.name.GetHash());
+	boost::hash_combine(hash, key.defines.GetHash());
+	return hash;
+}
+
 size_t CShaderManager::EffectCacheKeyHash::operator()(const EffectCacheKey& key) const
 {
 	size_t hash = 0;
@@ -412,6 +494,7 @@ bool CShaderManager::NewEffect(const char* name, const CShaderDefines& baseDefin
 	EL(require);
 	EL(sort_by_distance);
 	AT(context);
+	AT(downscale);
 	AT(dst);
 	AT(func);
 	AT(ref);
@@ -542,6 +625,16 @@ bool CShaderManager::NewEffect(const char* name, const CShaderDefines& baseDefin
 			// Load the shader program after we've read all the possibly-relevant <define>s
 			pass.SetShader(LoadProgram(Child.GetAttributes().GetNamedItem(at_shader).c_str(), passDefines));
 
+			CStr downscale = Child.GetAttributes().GetNamedItem(at_downscale);
+			if (!downscale.empty())
+			{
+				int factor = downscale.ToInt();
+				if (factor == 1 || factor == 2 || factor == 4)
+					pass.SetDownscale(factor);
+				else
+					LOGERROR(L"Invalid pass downscale '%hs' in effect '%hs'", downscale.c_str(), name);
+			}
+
 			tech->AddPass(pass);
 		}
 	}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -72,26 +72,37 @@ public:
 	 */
 	size_t GetNumEffectsLoaded();
 
+	/**
+	 * Load all the shader programs that were loaded in the previous session
+	 * (which are recorded when the shader manager is destroyed), so they don't
+	 * have to be compiled during the game when they're first used.
+	 */
+	void PrecompilePrograms();
+
 private:
 
 	struct CacheKey
 	{
-		std::string name;
+		CStrIntern name;
 		CShaderDefines defines;
 
-		bool operator<(const CacheKey& k) const
+		bool operator==(const CacheKey& k) const
 		{
-			if (name < k.name) return true;
-			if (k.name < name) return false;
-			return defines < k.defines;
+			return name == k.name && defines == k.defines;
 		}
 	};
 
+	struct CacheKeyHash
+	{
+		size_t operator()(const CacheKey& key) const;
+	};
+
 	// A CShaderProgram contains expensive GL state, so we ought to cache it.
 	// The compiled state depends solely on the filename and list of defines,
 	// so we store that in CacheKey.
 	// TODO: is this cache useful when we already have an effect cache?
-	std::map<CacheKey, CShaderProgramPtr> m_ProgramCache;
+	typedef boost::unordered_map<CacheKey, CShaderProgramPtr, CacheKeyHash> ProgramCacheMap;
+	ProgramCacheMap m_ProgramCache;
 
 	/**
 	 * Key for effect cache lookups.
@@ -126,6 +137,11 @@ private:
 #endif
 
 	bool NewProgram(const char* name, const CShaderDefines& defines, CShaderProgramPtr& program);
+
+	/**
+	 * Save the names and defines of all the loaded programs, for PrecompilePrograms.
+	 */
+	void SaveProgramList();
 	bool NewEffect(const char* name, const CShaderDefines& defines, CShaderTechniquePtr& tech);
 
 	static Status ReloadChangedFileCB(void* param, const VfsPath& path);
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,13 +21,17 @@
 
 #include "graphics/ShaderManager.h"
 #include "graphics/TextureManager.h"
+#include "lib/allocators/shared_ptr.h"
 #include "lib/res/graphics/ogl_tex.h"
+#include "maths/MD5.h"
 #include "maths/Matrix3D.h"
 #include "maths/Vector3D.h"
+#include "ps/CacheLoader.h"
 #include "ps/CLogger.h"
 #include "ps/Filesystem.h"
 #include "ps/Overlay.h"
 #include "ps/PreprocessorWrapper.h"
+#include "renderer/Renderer.h"
 
 #if !CONFIG2_GLES
 
@@ -51,15 +55,15 @@ public:
 	{
 		Unload();
 
-		pglDeleteProgramsARB(1, &m_VertexProgram);
-		pglDeleteProgramsARB(1, &m_FragmentProgram);
+		ogl_DeletePrograms(1, &m_VertexProgram);
+		ogl_DeletePrograms(1, &m_FragmentProgram);
 	}
 
 	bool Compile(GLuint target, const char* targetName, GLuint program, const VfsPath& file, const CStr& code)
 	{
 		ogl_WarnIfError();
 
-		pglBindProgramARB(target, program);
+		ogl_BindProgram(target, program);
 
 		ogl_WarnIfError();
 
@@ -75,7 +79,7 @@ public:
 			return false;
 		}
 
-		pglBindProgramARB(target, 0);
+		ogl_BindProgram(target, 0);
 
 		ogl_WarnIfError();
 
@@ -121,8 +125,8 @@ public:
 	{
 		glEnable(GL_VERTEX_PROGRAM_ARB);
 		glEnable(GL_FRAGMENT_PROGRAM_ARB);
-		pglBindProgramARB(GL_VERTEX_PROGRAM_ARB, m_VertexProgram);
-		pglBindProgramARB(GL_FRAGMENT_PROGRAM_ARB, m_FragmentProgram);
+		ogl_BindProgram(GL_VERTEX_PROGRAM_ARB, m_VertexProgram);
+		ogl_BindProgram(GL_FRAGMENT_PROGRAM_ARB, m_FragmentProgram);
 
 		BindClientStates();
 	}
@@ -131,8 +135,8 @@ public:
 	{
 		glDisable(GL_VERTEX_PROGRAM_ARB);
 		glDisable(GL_FRAGMENT_PROGRAM_ARB);
-		pglBindProgramARB(GL_VERTEX_PROGRAM_ARB, 0);
-		pglBindProgramARB(GL_FRAGMENT_PROGRAM_ARB, 0);
+		ogl_BindProgram(GL_VERTEX_PROGRAM_ARB, 0);
+		ogl_BindProgram(GL_FRAGMENT_PROGRAM_ARB, 0);
 
 		UnbindClientStates();
 
@@ -173,8 +177,8 @@ public:
 		{
 			GLuint h;
 			ogl_tex_get_texture_id(tex, &h);
-			pglActiveTextureARB(GL_TEXTURE0+index);
-			glBindTexture(fPair.second, h);
+			ogl_ActiveTexture(GL_TEXTURE0+index);
+			ogl_BindTexture(fPair.second, h);
 		}
 	}
 
@@ -184,8 +188,8 @@ public:
 		int index = fPair.first;
 		if (index != -1)
 		{
-			pglActiveTextureARB(GL_TEXTURE0+index);
-			glBindTexture(fPair.second, tex);
+			ogl_ActiveTexture(GL_TEXTURE0+index);
+			ogl_BindTexture(fPair.second, tex);
 		}
 	}
 
@@ -346,6 +350,11 @@ public:
 		for (std::map<CStrIntern, int>::iterator it = m_VertexAttribs.begin(); it != m_VertexAttribs.end(); ++it)
 			pglBindAttribLocationARB(m_Program, it->second, it->first.c_str());
 
+#if !CONFIG2_GLES
+		if (UseBinaryCache())
+			pglProgramParameteri(m_Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+#endif
+
 		pglLinkProgramARB(m_Program);
 
 		GLint ok = 0;
@@ -375,6 +384,17 @@ public:
 		if (!ok)
 			return false;
 
+		SetupUniforms();
+
+		return true;
+	}
+
+	/**
+	 * Finds the uniforms of the linked program, and assigns texture units to
+	 * the samplers.
+	 */
+	void SetupUniforms()
+	{
 		m_Uniforms.clear();
 		m_Samplers.clear();
 
@@ -420,8 +440,115 @@ public:
 		Unbind();
 
 		ogl_WarnIfError();
+	}
+
+	/**
+	 * Whether linked programs should be saved to (and loaded from) the
+	 * program binary cache.
+	 */
+	static bool UseBinaryCache()
+	{
+#if CONFIG2_GLES
+		return false;
+#else
+		return g_Renderer.m_Options.m_ShaderCache && ogl_HaveExtension("GL_ARB_get_program_binary");
+#endif
+	}
+
+	/**
+	 * Returns a hash of everything that affects the compiled program: the
+	 * preprocessed source code, the attribute bindings, and the driver (since
+	 * program binaries can't be used with a different driver).
+	 */
+	MD5 ComputeBinaryCacheHash(const CStr& vertexCode, const CStr& fragmentCode)
+	{
+		MD5 hash;
+		hash.Update((const u8*)vertexCode.c_str(), vertexCode.length() + 1);
+		hash.Update((const u8*)fragmentCode.c_str(), fragmentCode.length() + 1);
+
+		for (std::map<CStrIntern, int>::iterator it = m_VertexAttribs.begin(); it != m_VertexAttribs.end(); ++it)
+		{
+			hash.Update((const u8*)it->first.c_str(), it->first.length() + 1);
+			hash.Update((const u8*)&it->second, sizeof(it->second));
+		}
 
+		const GLenum driverStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		for (size_t i = 0; i < ARRAY_SIZE(driverStrings); ++i)
+		{
+			const char* str = (const char*)glGetString(driverStrings[i]);
+			if (str)
+				hash.Update((const u8*)str, strlen(str) + 1);
+		}
+
+		return hash;
+	}
+
+	/**
+	 * Tries to create the program from a cached binary. Returns false if the
+	 * file can't be loaded or the driver rejects it.
+	 */
+	bool LoadBinary(const VfsPath& path)
+	{
+#if CONFIG2_GLES
+		UNUSED2(path);
+		return false;
+#else
+		shared_ptr<u8> data;
+		size_t size;
+		if (g_VFS->LoadFile(path, data, size) < 0 || size <= sizeof(u32))
+			return false;
+
+		// The file contains the binary format enum followed by the binary
+		u32 format;
+		memcpy(&format, data.get(), sizeof(format));
+
+		ENSURE(!m_Program);
+		m_Program = pglCreateProgramObjectARB();
+
+		// (Unsupported formats are reported as GL_INVALID_ENUM, which is fine
+		// since we'll just link the program normally instead)
+		pglProgramBinary(m_Program, (GLenum)format, data.get() + sizeof(format), (GLsizei)(size - sizeof(format)));
+		ogl_SquelchError(GL_INVALID_ENUM);
+
+		GLint ok = 0;
+		pglGetProgramiv(m_Program, GL_LINK_STATUS, &ok);
+		if (!ok)
+		{
+			pglDeleteProgram(m_Program);
+			m_Program = 0;
+			return false;
+		}
+
+		SetupUniforms();
 		return true;
+#endif
+	}
+
+	/**
+	 * Saves the linked program's binary to the cache.
+	 */
+	void SaveBinary(const VfsPath& path)
+	{
+#if CONFIG2_GLES
+		UNUSED2(path);
+#else
+		GLint length = 0;
+		pglGetProgramiv(m_Program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return;
+
+		shared_ptr<u8> data(new u8[sizeof(u32) + length], ArrayDeleter());
+		GLsizei written = 0;
+		GLenum format = 0;
+		pglGetProgramBinary(m_Program, length, &written, &format, data.get() + sizeof(u32));
+		ogl_WarnIfError();
+		if (written <= 0)
+			return;
+
+		u32 format32 = (u32)format;
+		memcpy(data.get(), &format32, sizeof(format32));
+		g_VFS->CreateFile(path, data, sizeof(u32) + written);
+#endif
 	}
 
 	virtual void Reload()
@@ -462,6 +589,27 @@ public:
 		fragmentCode.Replace("#version 120\r\n", "#version 100\nprecision mediump float;\n");
 #endif
 
+		// Look for a previously-saved binary of this program, since that's
+		// much faster than compiling it again
+		VfsPath binaryPath;
+		bool useBinaryCache = UseBinaryCache();
+		if (useBinaryCache)
+		{
+			// Arbitrary version number - change this if we update the code and
+			// need to invalidate old users' caches
+			u32 version = 1;
+
+			CCacheLoader cacheLoader(g_VFS, L".glslbin");
+			Status ret = cacheLoader.TryLoadingCached(m_VertexFile, ComputeBinaryCacheHash(vertexCode, fragmentCode), version, binaryPath);
+			if (ret == INFO::OK && LoadBinary(binaryPath))
+			{
+				m_IsValid = true;
+				return;
+			}
+			if (ret < 0)
+				useBinaryCache = false;
+		}
+
 		if (!Compile(m_VertexShader, m_VertexFile, vertexCode))
 			return;
 
@@ -471,6 +619,9 @@ public:
 		if (!Link())
 			return;
 
+		if (useBinaryCache)
+			SaveBinary(binaryPath);
+
 		m_IsValid = true;
 	}
 
@@ -487,7 +638,7 @@ public:
 
 	virtual void Bind()
 	{
-		pglUseProgramObjectARB(m_Program);
+		ogl_UseProgram(m_Program);
 
 		for (std::map<CStrIntern, int>::iterator it = m_VertexAttribs.begin(); it != m_VertexAttribs.end(); ++it)
 			pglEnableVertexAttribArrayARB(it->second);
@@ -495,7 +646,7 @@ public:
 
 	virtual void Unbind()
 	{
-		pglUseProgramObjectARB(0);
+		ogl_UseProgram(0);
 
 		for (std::map<CStrIntern, int>::iterator it = m_VertexAttribs.begin(); it != m_VertexAttribs.end(); ++it)
 			pglDisableVertexAttribArrayARB(it->second);
@@ -520,8 +671,8 @@ public:
 
 		GLuint h;
 		ogl_tex_get_texture_id(tex, &h);
-		pglActiveTextureARB(GL_TEXTURE0 + it->second.second);
-		glBindTexture(it->second.first, h);
+		ogl_ActiveTexture(GL_TEXTURE0 + it->second.second);
+		ogl_BindTexture(it->second.first, h);
 	}
 
 	virtual void BindTexture(texture_id_t id, GLuint tex)
@@ -530,8 +681,8 @@ public:
 		if (it == m_Samplers.end())
 			return;
 
-		pglActiveTextureARB(GL_TEXTURE0 + it->second.second);
-		glBindTexture(it->second.first, tex);
+		ogl_ActiveTexture(GL_TEXTURE0 + it->second.second);
+		ogl_BindTexture(it->second.first, tex);
 	}
 
 	virtual void BindTexture(Binding id, Handle tex)
@@ -541,8 +692,8 @@ public:
 
 		GLuint h;
 		ogl_tex_get_texture_id(tex, &h);
-		pglActiveTextureARB(GL_TEXTURE0 + id.second);
-		glBindTexture(id.first, h);
+		ogl_ActiveTexture(GL_TEXTURE0 + id.second);
+		ogl_BindTexture(id.first, h);
 	}
 
 	virtual Binding GetUniformBinding(uniform_id_t id)
@@ -651,6 +802,24 @@ public:
 		}
 	}
 
+	virtual bool HasVertexAttrib(const char* id)
+	{
+		return m_VertexAttribs.find(CStrIntern(id)) != m_VertexAttribs.end();
+	}
+
+	virtual void VertexAttribDivisor(const char* id, GLuint divisor)
+	{
+		std::map<CStrIntern, int>::iterator it = m_VertexAttribs.find(CStrIntern(id));
+		if (it != m_VertexAttribs.end())
+		{
+#if CONFIG2_GLES
+			debug_warn(L"glVertexAttribDivisor not supported on GLES");
+#else
+			pglVertexAttribDivisorARB(it->second, divisor);
+#endif
+		}
+	}
+
 private:
 	VfsPath m_VertexFile;
 	VfsPath m_FragmentFile;
@@ -796,6 +965,16 @@ void CShaderProgram::VertexAttribIPointer(const char* UNUSED(id), GLint UNUSED(s
 	debug_warn("Shader type doesn't support VertexAttribIPointer");
 }
 
+bool CShaderProgram::HasVertexAttrib(const char* UNUSED(id))
+{
+	return false;
+}
+
+void CShaderProgram::VertexAttribDivisor(const char* UNUSED(id), GLuint UNUSED(divisor))
+{
+	debug_warn("Shader type doesn't support VertexAttribDivisor");
+}
+
 #if CONFIG2_GLES
 
 // These should all be overridden by CShaderProgramGLSL
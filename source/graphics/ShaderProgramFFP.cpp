@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -85,8 +85,8 @@ public:
 		int index = GetUniformIndex(CStrIntern(id));
 		if (index != -1)
 		{
-			pglActiveTextureARB((int)(GL_TEXTURE0+index));
-			glBindTexture(GL_TEXTURE_2D, tex);
+			ogl_ActiveTexture((int)(GL_TEXTURE0+index));
+			ogl_BindTexture(GL_TEXTURE_2D, tex);
 		}
 	}
 
@@ -199,7 +199,7 @@ public:
 	{
 		if (id.second == ID_losTransform)
 		{
-			pglActiveTextureARB(GL_TEXTURE2);
+			ogl_ActiveTexture(GL_TEXTURE2);
 			GLfloat texgenS1[4] = { v0, 0, 0, v1 };
 			GLfloat texgenT1[4] = { 0, 0, v0, v1 };
 			glTexGenfv(GL_S, GL_OBJECT_PLANE, texgenS1);
@@ -208,7 +208,7 @@ public:
 		else if (id.second == ID_objectColor)
 		{
 			float c[] = { v0, v1, v2, v3 };
-			pglActiveTextureARB(GL_TEXTURE1);
+			ogl_ActiveTexture(GL_TEXTURE1);
 			glTexEnvfv(GL_TEXTURE_ENV, GL_TEXTURE_ENV_COLOR, c);
 		}
 		else
@@ -233,7 +233,7 @@ public:
 		//   Unit 1: Multiply by objectColor
 		//   Unit 2: Pass through
 
-		pglActiveTextureARB(GL_TEXTURE0);
+		ogl_ActiveTexture(GL_TEXTURE0);
 		glEnable(GL_TEXTURE_2D);
 		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
 
@@ -249,7 +249,7 @@ public:
 
 		// -----------------------------------------------------------------------------
 
-		pglActiveTextureARB(GL_TEXTURE1);
+		ogl_ActiveTexture(GL_TEXTURE1);
 		glEnable(GL_TEXTURE_2D);
 		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
 
@@ -274,7 +274,7 @@ public:
 
 		// -----------------------------------------------------------------------------
 
-		pglActiveTextureARB(GL_TEXTURE2);
+		ogl_ActiveTexture(GL_TEXTURE2);
 		glEnable(GL_TEXTURE_2D);
 		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
 
@@ -314,16 +314,16 @@ public:
 	{
 		UnbindClientStates();
 
-		pglActiveTextureARB(GL_TEXTURE2);
+		ogl_ActiveTexture(GL_TEXTURE2);
 		glDisable(GL_TEXTURE_2D);
 
 		glDisable(GL_TEXTURE_GEN_S);
 		glDisable(GL_TEXTURE_GEN_T);
 
-		pglActiveTextureARB(GL_TEXTURE1);
+		ogl_ActiveTexture(GL_TEXTURE1);
 		glDisable(GL_TEXTURE_2D);
 
-		pglActiveTextureARB(GL_TEXTURE0);
+		ogl_ActiveTexture(GL_TEXTURE0);
 		glDisable(GL_TEXTURE_2D);
 	}
 };
@@ -336,7 +336,8 @@ class CShaderProgramFFP_GuiText : public CShaderProgramFFP
 	enum
 	{
 		ID_transform,
-		ID_colorMul
+		ID_colorMul,
+		ID_sdfSmoothing
 	};
 
 public:
@@ -345,6 +346,7 @@ public:
 	{
 		SetUniformIndex("transform", ID_transform);
 		SetUniformIndex("colorMul", ID_colorMul);
+		SetUniformIndex("sdfSmoothing", ID_sdfSmoothing);
 
 		// Texture units:
 		SetUniformIndex("tex", 0);
@@ -354,6 +356,20 @@ public:
 	{
 		if (id.second == ID_colorMul)
 			glColor4f(v0, v1, v2, v3);
+		else if (id.second == ID_sdfSmoothing)
+		{
+			// Can't do smooth edges in FFP, so just alpha-test
+			// distance field fonts at the glyph edge
+			if (v0 > 0.f)
+			{
+				glEnable(GL_ALPHA_TEST);
+				glAlphaFunc(GL_GEQUAL, 0.5f);
+			}
+			else
+			{
+				glDisable(GL_ALPHA_TEST);
+			}
+		}
 	}
 
 	virtual void Uniform(Binding id, const CMatrix3D& v)
@@ -370,7 +386,7 @@ public:
 		glMatrixMode(GL_MODELVIEW);
 		glPushMatrix();
 
-		pglActiveTextureARB(GL_TEXTURE0);
+		ogl_ActiveTexture(GL_TEXTURE0);
 		glEnable(GL_TEXTURE_2D);
 		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
 
@@ -381,7 +397,9 @@ public:
 	{
 		UnbindClientStates();
 
-		pglActiveTextureARB(GL_TEXTURE0);
+		glDisable(GL_ALPHA_TEST);
+
+		ogl_ActiveTexture(GL_TEXTURE0);
 		glDisable(GL_TEXTURE_2D);
 
 		glMatrixMode(GL_PROJECTION);
@@ -454,14 +472,14 @@ public:
 	{
 		CShaderProgramFFP_Gui_Base::Bind();
 
-		pglActiveTextureARB(GL_TEXTURE0);
+		ogl_ActiveTexture(GL_TEXTURE0);
 		glEnable(GL_TEXTURE_2D);
 		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 	}
 
 	virtual void Unbind()
 	{
-		pglActiveTextureARB(GL_TEXTURE0);
+		ogl_ActiveTexture(GL_TEXTURE0);
 		glDisable(GL_TEXTURE_2D);
 
 		CShaderProgramFFP_Gui_Base::Unbind();
@@ -486,7 +504,7 @@ public:
 	{
 		CShaderProgramFFP_Gui_Base::Bind();
 
-		pglActiveTextureARB(GL_TEXTURE0);
+		ogl_ActiveTexture(GL_TEXTURE0);
 		glEnable(GL_TEXTURE_2D);
 
 		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
@@ -509,7 +527,7 @@ public:
 	{
 		glColor4f(1.f, 1.f, 1.f, 1.f);
 
-		pglActiveTextureARB(GL_TEXTURE0);
+		ogl_ActiveTexture(GL_TEXTURE0);
 		glDisable(GL_TEXTURE_2D);
 
 		CShaderProgramFFP_Gui_Base::Unbind();
@@ -569,7 +587,7 @@ public:
 		static const float GreyscaleInterpColor0[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
 		static const float GreyscaleInterpColor1[4] = { 0.5f, 0.5f, 0.5f, 1.0f };
 
-		pglActiveTextureARB(GL_TEXTURE0);
+		ogl_ActiveTexture(GL_TEXTURE0);
 		glEnable(GL_TEXTURE_2D);
 
 		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
@@ -592,7 +610,7 @@ public:
 
 		glColor4fv(GreyscaleInterpColor1);
 
-		pglActiveTextureARB(GL_TEXTURE1);
+		ogl_ActiveTexture(GL_TEXTURE1);
 		glEnable(GL_TEXTURE_2D);
 
 		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
@@ -629,10 +647,10 @@ public:
 	{
 		glColor4f(1.f, 1.f, 1.f, 1.f);
 
-		pglActiveTextureARB(GL_TEXTURE1);
+		ogl_ActiveTexture(GL_TEXTURE1);
 		glDisable(GL_TEXTURE_2D);
 
-		pglActiveTextureARB(GL_TEXTURE0);
+		ogl_ActiveTexture(GL_TEXTURE0);
 		glDisable(GL_TEXTURE_2D);
 
 		CShaderProgramFFP_Gui_Base::Unbind();
@@ -657,7 +675,7 @@ public:
 	{
 		CShaderProgramFFP_Gui_Base::Bind();
 
-		pglActiveTextureARB(GL_TEXTURE0);
+		ogl_ActiveTexture(GL_TEXTURE0);
 		glDisable(GL_TEXTURE_2D);
 	}
 };
@@ -711,7 +729,7 @@ public:
 	{
 		if (id.second == ID_losTransform)
 		{
-			pglActiveTextureARB(GL_TEXTURE3);
+			ogl_ActiveTexture(GL_TEXTURE3);
 			GLfloat texgenS1[4] = { v0, 0, 0, v1 };
 			GLfloat texgenT1[4] = { 0, 0, v0, v1 };
 			glTexGenfv(GL_S, GL_OBJECT_PLANE, texgenS1);
@@ -729,7 +747,7 @@ public:
 		
 		// -----------------------------------------------------------------------------
 		
-		pglActiveTextureARB(GL_TEXTURE3);
+		ogl_ActiveTexture(GL_TEXTURE3);
 		glEnable(GL_TEXTURE_2D);
 		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
 
@@ -770,13 +788,13 @@ public:
 	{
 		UnbindClientStates();
 		
-		pglActiveTextureARB(GL_TEXTURE3);
+		ogl_ActiveTexture(GL_TEXTURE3);
 		glDisable(GL_TEXTURE_2D);
 
 		glDisable(GL_TEXTURE_GEN_S);
 		glDisable(GL_TEXTURE_GEN_T);
 		
-		pglActiveTextureARB(GL_TEXTURE0);
+		ogl_ActiveTexture(GL_TEXTURE0);
 
 		glMatrixMode(GL_PROJECTION);
 		glPopMatrix();
@@ -799,7 +817,7 @@ public:
 	virtual void Bind()
 	{
 		// Set up texture environment for base pass - modulate texture and vertex color
-		pglActiveTextureARB(GL_TEXTURE0);
+		ogl_ActiveTexture(GL_TEXTURE0);
 		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
 		glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_RGB, GL_MODULATE);
 		glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE0_RGB, GL_TEXTURE);
@@ -825,7 +843,7 @@ public:
 	{
 		CShaderProgramFFP_Model_Base::Unbind();
 
-		pglActiveTextureARB(GL_TEXTURE0);
+		ogl_ActiveTexture(GL_TEXTURE0);
 
 		// Revert the scaling to default
 		float scale1[] = { 1.0f, 1.0f, 1.0f };
@@ -865,7 +883,7 @@ public:
 		// Result = (1 - ((1 - PlayerColor) * (1 - Texture.a)))*Texture*Color
 
 		// TexEnv #0
-		pglActiveTextureARB(GL_TEXTURE0);
+		ogl_ActiveTexture(GL_TEXTURE0);
 		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
 		glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_RGB, GL_MODULATE);
 		glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE0_RGB, GL_TEXTURE);
@@ -879,7 +897,7 @@ public:
 		glTexEnvi(GL_TEXTURE_ENV, GL_OPERAND0_ALPHA, GL_SRC_ALPHA);
 
 		// TexEnv #1
-		pglActiveTextureARB(GL_TEXTURE1);
+		ogl_ActiveTexture(GL_TEXTURE1);
 		glEnable(GL_TEXTURE_2D);
 		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
 		glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_RGB, GL_MODULATE);
@@ -894,7 +912,7 @@ public:
 		glTexEnvi(GL_TEXTURE_ENV, GL_OPERAND0_ALPHA, GL_SRC_ALPHA);
 
 		// TexEnv #2
-		pglActiveTextureARB(GL_TEXTURE2);
+		ogl_ActiveTexture(GL_TEXTURE2);
 		glEnable(GL_TEXTURE_2D);
 		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
 		glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_RGB, GL_MODULATE);
@@ -927,16 +945,16 @@ public:
 	{
 		CShaderProgramFFP_Model_Base::Unbind();
 
-		pglActiveTextureARB(GL_TEXTURE2);
+		ogl_ActiveTexture(GL_TEXTURE2);
 		glDisable(GL_TEXTURE_2D);
 
 		float scale[] = { 1.0f, 1.0f, 1.0f };
 		glTexEnvfv(GL_TEXTURE_ENV, GL_RGB_SCALE, scale);
 
-		pglActiveTextureARB(GL_TEXTURE1);
+		ogl_ActiveTexture(GL_TEXTURE1);
 		glDisable(GL_TEXTURE_2D);
 
-		pglActiveTextureARB(GL_TEXTURE0);
+		ogl_ActiveTexture(GL_TEXTURE0);
 	}
 };
 
@@ -965,7 +983,7 @@ public:
 		float color[] = { 1.0f, 1.0f, 1.0f, 1.0f };
 		glTexEnvfv(GL_TEXTURE_ENV, GL_TEXTURE_ENV_COLOR, color);
 
-		pglActiveTextureARB(GL_TEXTURE0);
+		ogl_ActiveTexture(GL_TEXTURE0);
 		glEnable(GL_TEXTURE_2D);
 		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
 		glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_RGB, GL_REPLACE);
@@ -992,7 +1010,7 @@ public:
 
 	virtual void Bind()
 	{
-		pglActiveTextureARB(GL_TEXTURE0);
+		ogl_ActiveTexture(GL_TEXTURE0);
 		glEnable(GL_TEXTURE_2D);
 		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 
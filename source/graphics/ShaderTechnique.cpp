@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,7 +20,8 @@
 #include "ShaderTechnique.h"
 
 CShaderPass::CShaderPass() :
-	m_HasAlpha(false), m_HasBlend(false), m_HasColorMask(false), m_HasDepthMask(false), m_HasDepthFunc(false)
+	m_HasAlpha(false), m_HasBlend(false), m_HasColorMask(false), m_HasDepthMask(false), m_HasDepthFunc(false),
+	m_Downscale(1)
 {
 }
 
@@ -40,18 +41,18 @@ void CShaderPass::Bind()
 
 	if (m_HasBlend)
 	{
-		glEnable(GL_BLEND);
-		glBlendFunc(m_BlendSrc, m_BlendDst);
+		ogl_Enable(GL_BLEND);
+		ogl_BlendFunc(m_BlendSrc, m_BlendDst);
 	}
 
 	if (m_HasColorMask)
 		glColorMask(m_ColorMaskR, m_ColorMaskG, m_ColorMaskB, m_ColorMaskA);
 
 	if (m_HasDepthMask)
-		glDepthMask(m_DepthMask);
+		ogl_DepthMask(m_DepthMask);
 
 	if (m_HasDepthFunc)
-		glDepthFunc(m_DepthFunc);
+		ogl_DepthFunc(m_DepthFunc);
 }
 
 void CShaderPass::Unbind()
@@ -64,16 +65,16 @@ void CShaderPass::Unbind()
 #endif
 
 	if (m_HasBlend)
-		glDisable(GL_BLEND);
+		ogl_Disable(GL_BLEND);
 
 	if (m_HasColorMask)
 		glColorMask(1, 1, 1, 1);
 
 	if (m_HasDepthMask)
-		glDepthMask(1);
+		ogl_DepthMask(1);
 
 	if (m_HasDepthFunc)
-		glDepthFunc(GL_LEQUAL);
+		ogl_DepthFunc(GL_LEQUAL);
 }
 
 void CShaderPass::AlphaFunc(GLenum func, GLclampf ref)
@@ -145,6 +146,12 @@ const CShaderProgramPtr& CShaderTechnique::GetShader(int pass) const
 	return m_Passes[pass].GetShader();
 }
 
+int CShaderTechnique::GetDownscale(int pass) const
+{
+	ENSURE(0 <= pass && pass < (int)m_Passes.size());
+	return m_Passes[pass].GetDownscale();
+}
+
 bool CShaderTechnique::GetSortByDistance() const
 {
 	return m_SortByDistance;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -41,6 +41,14 @@ public:
 	void DepthMask(GLboolean mask);
 	void DepthFunc(GLenum func);
 
+	/**
+	 * Set the factor by which the render target of this pass is smaller than
+	 * the screen (1, 2 or 4). Only used by postprocessing effects; other
+	 * renderers ignore it.
+	 */
+	void SetDownscale(int downscale) { m_Downscale = downscale; }
+	int GetDownscale() const { return m_Downscale; }
+
 	/**
 	 * Set up all the GL state that was previously specified on this pass.
 	 */
@@ -75,6 +83,8 @@ private:
 
 	bool m_HasDepthFunc;
 	GLenum m_DepthFunc;
+
+	int m_Downscale;
 };
 
 /**
@@ -92,6 +102,7 @@ public:
 	void BeginPass(int pass = 0);
 	void EndPass(int pass = 0);
 	const CShaderProgramPtr& GetShader(int pass = 0) const;
+	int GetDownscale(int pass = 0) const;
 
 	/**
 	 * Whether this technique uses alpha blending that requires objects to be
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -74,6 +74,9 @@ public:
 	// return number of frames in animation
 	size_t GetNumFrames() const { return (size_t)m_NumFrames; }
 
+	// return approximate number of bytes of memory used by this animation
+	size_t GetMemoryUsage() const { return sizeof(*this) + m_NumKeys*m_NumFrames*sizeof(Key); }
+
 	// build matrices for all bones at the given time (in MS) in this animation
 	void BuildBoneMatrices(float time, CMatrix3D* matrices, bool loop) const;
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -28,6 +28,36 @@
 #include "graphics/SkeletonAnimDef.h"
 #include "ps/CLogger.h"
 #include "ps/FileIo.h"
+#include "ps/Profile.h"
+#include "ps/ThreadPool.h"
+
+namespace
+{
+
+/**
+ * Reads and parses a list of PSA files, for CSkeletonAnimManager::PrefetchAnimations.
+ * Must not log or touch anything else that's restricted to the main thread.
+ */
+class CLoadAnimationsTask : public CThreadPool::ITask
+{
+public:
+	std::vector<VfsPath> m_Filenames;
+	std::vector<CSkeletonAnimDef*> m_Anims; // NULL if loading failed
+
+	virtual void Run(size_t index)
+	{
+		try
+		{
+			m_Anims[index] = CSkeletonAnimDef::Load(m_Filenames[index]);
+		}
+		catch (PSERROR_File&)
+		{
+			m_Anims[index] = NULL;
+		}
+	}
+};
+
+} // anonymous namespace
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -89,3 +119,62 @@ CSkeletonAnimDef* CSkeletonAnimManager::GetAnimation(const VfsPath& pathname)
 	m_Animations[name] = def; // NULL if failed to load - we won't try loading it again
 	return def;
 }
+
+///////////////////////////////////////////////////////////////////////////////
+// PrefetchAnimations: load a batch of animations in parallel, ahead of the
+// GetAnimation calls that will use them
+void CSkeletonAnimManager::PrefetchAnimations(const std::set<VfsPath>& pathnames)
+{
+	PROFILE("prefetch animations");
+
+	std::vector<VfsPath> unloaded;
+	for (std::set<VfsPath>::const_iterator it = pathnames.begin(); it != pathnames.end(); ++it)
+	{
+		VfsPath name = it->ChangeExtension(L"");
+		if (m_Animations.find(name) == m_Animations.end())
+			unloaded.push_back(name);
+	}
+
+	std::vector<VfsPath> psaFilenames;
+	m_ColladaManager.GetLoadablePaths(unloaded, CColladaManager::PSA, psaFilenames);
+
+	std::vector<VfsPath> names;
+	CLoadAnimationsTask task;
+	for (size_t i = 0; i < unloaded.size(); ++i)
+	{
+		if (psaFilenames[i].empty())
+			continue;
+
+		names.push_back(unloaded[i]);
+		task.m_Filenames.push_back(psaFilenames[i]);
+	}
+	task.m_Anims.resize(names.size());
+
+	if (g_ThreadPool && names.size() > 1)
+	{
+		g_ThreadPool->ParallelFor(task, names.size());
+	}
+	else
+	{
+		for (size_t i = 0; i < names.size(); ++i)
+			task.Run(i);
+	}
+
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		if (task.m_Anims[i])
+			m_Animations[names[i]] = task.m_Anims[i];
+	}
+}
+
+size_t CSkeletonAnimManager::GetMemoryUsage() const
+{
+	size_t bytes = 0;
+	typedef boost::unordered_map<VfsPath,CSkeletonAnimDef*>::const_iterator Iter;
+	for (Iter i = m_Animations.begin(); i != m_Animations.end(); ++i)
+	{
+		if (i->second)
+			bytes += i->second->GetMemoryUsage();
+	}
+	return bytes;
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -46,6 +46,14 @@ public:
 	// refer to valid animation file
 	CSkeletonAnimDef* GetAnimation(const VfsPath& pathname);
 
+	// load all the given animations that aren't already loaded, reading the
+	// files in parallel on the engine thread pool (if there is one). Animations
+	// that fail to load are skipped, so GetAnimation will report the error
+	void PrefetchAnimations(const std::set<VfsPath>& pathnames);
+
+	// return approximate number of bytes of memory used by all the loaded animations
+	size_t GetMemoryUsage() const;
+
 private:
 	// map of all known animations. Value is NULL if it failed to load.
 	boost::unordered_map<VfsPath, CSkeletonAnimDef*> m_Animations;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -37,11 +37,16 @@
 #include "maths/MathUtil.h"
 #include "ps/CLogger.h"
 
+#if HAVE_SSE2
+# include <emmintrin.h>
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////
 // CTerrain constructor
 CTerrain::CTerrain()
 : m_Heightmap(0), m_Patches(0), m_MapSize(0), m_MapSizePatches(0),
-m_BaseColour(255, 255, 255, 255)
+m_BaseColour(255, 255, 255, 255),
+m_DirtyI0(0), m_DirtyJ0(0), m_DirtyI1(0), m_DirtyJ1(0)
 {
 }
 
@@ -97,6 +102,9 @@ bool CTerrain::Initialize(ssize_t patchesPerSide, const u16* data)
 	// initialise mipmap
 	m_HeightMipmap.Initialize(m_MapSize, m_Heightmap);
 
+	m_DirtyI0 = m_DirtyJ0 = 0;
+	m_DirtyI1 = m_DirtyJ1 = m_MapSize-1;
+
 	return true;
 }
 
@@ -394,6 +402,103 @@ float CTerrain::GetExactGroundLevel(float x, float z) const
 	}
 }
 
+void CTerrain::GetExactGroundLevels(const float* coords, size_t n, float* heights, CVector3D* normals) const
+{
+	size_t k = 0;
+
+#if HAVE_SSE2
+	// Interpolate 4 points at a time. This uses the same triangles and arithmetic as
+	// GetExactGroundLevel, but only the heightmap reads are done one point at a time.
+	const __m128 invTileSize = _mm_set1_ps(1.f / TERRAIN_TILE_SIZE);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 maxTile = _mm_set1_ps((float)(m_MapSize-2));
+	const __m128 heightScale = _mm_set1_ps(HEIGHT_SCALE);
+
+	for (; k + 4 <= n; k += 4)
+	{
+		__m128 a = _mm_loadu_ps(coords + k*2);
+		__m128 b = _mm_loadu_ps(coords + k*2 + 4);
+		__m128 x = _mm_mul_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), invTileSize);
+		__m128 z = _mm_mul_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)), invTileSize);
+
+		// Clamp to size-2 so we can use the tiles (xi,zi)-(xi+1,zi+1)
+		// (the clamped values are non-negative, so truncating is the same as floor)
+		__m128i xi = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(x, zero), maxTile));
+		__m128i zi = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(z, zero), maxTile));
+
+		__m128 xf = _mm_min_ps(_mm_max_ps(_mm_sub_ps(x, _mm_cvtepi32_ps(xi)), zero), one);
+		__m128 zf = _mm_min_ps(_mm_max_ps(_mm_sub_ps(z, _mm_cvtepi32_ps(zi)), zero), one);
+
+		i32 xis[4], zis[4];
+		_mm_storeu_si128((__m128i*)xis, xi);
+		_mm_storeu_si128((__m128i*)zis, zi);
+
+		float h[4][4];
+		for (size_t l = 0; l < 4; ++l)
+		{
+			const u16* p = &m_Heightmap[zis[l]*m_MapSize + xis[l]];
+			h[0][l] = p[0];
+			h[1][l] = p[m_MapSize];
+			h[2][l] = p[1];
+			h[3][l] = p[m_MapSize + 1];
+		}
+		__m128 h00 = _mm_loadu_ps(h[0]);
+		__m128 h01 = _mm_loadu_ps(h[1]);
+		__m128 h10 = _mm_loadu_ps(h[2]);
+		__m128 h11 = _mm_loadu_ps(h[3]);
+
+		// Determine which terrain triangle each point is on (as in GetTriangulationDir;
+		// the sums of integer heights are exact in floats)
+		__m128 dir = _mm_cmplt_ps(_mm_add_ps(h00, h11), _mm_add_ps(h01, h10));
+		__m128 lowerLeft = _mm_cmple_ps(_mm_add_ps(xf, zf), one);
+		__m128 upperLeft = _mm_cmple_ps(xf, zf);
+
+		__m128 ll = _mm_and_ps(dir, lowerLeft);
+		__m128 ur = _mm_andnot_ps(lowerLeft, dir);
+		__m128 ul = _mm_andnot_ps(dir, upperLeft);
+		__m128 lr = _mm_andnot_ps(dir, _mm_andnot_ps(upperLeft, _mm_castsi128_ps(_mm_set1_epi32(-1))));
+
+		// Height differences along the triangle's edges in the x and z directions
+		__m128 useH10H00 = _mm_or_ps(ll, lr);
+		__m128 dx = _mm_or_ps(_mm_and_ps(useH10H00, _mm_sub_ps(h10, h00)), _mm_andnot_ps(useH10H00, _mm_sub_ps(h11, h01)));
+		__m128 useH01H00 = _mm_or_ps(ll, ul);
+		__m128 dz = _mm_or_ps(_mm_and_ps(useH01H00, _mm_sub_ps(h01, h00)), _mm_andnot_ps(useH01H00, _mm_sub_ps(h11, h10)));
+
+		// The upper-right triangle is interpolated from h11, the others from h00
+		__m128 hFrom00 = _mm_add_ps(_mm_add_ps(h00, _mm_mul_ps(dx, xf)), _mm_mul_ps(dz, zf));
+		__m128 hFrom11 = _mm_add_ps(_mm_add_ps(h11, _mm_mul_ps(_mm_sub_ps(h01, h11), _mm_sub_ps(one, xf))), _mm_mul_ps(_mm_sub_ps(h10, h11), _mm_sub_ps(one, zf)));
+		__m128 height = _mm_or_ps(_mm_and_ps(ur, hFrom11), _mm_andnot_ps(ur, hFrom00));
+		_mm_storeu_ps(heights + k, _mm_mul_ps(heightScale, height));
+
+		if (normals)
+		{
+			// The normal of the plane through (0, 0, 0), (TILE_SIZE, dx, 0) and (0, dz, TILE_SIZE)
+			// (as computed by CalcExactNormal)
+			const __m128 tileSize = _mm_set1_ps((float)TERRAIN_TILE_SIZE);
+			__m128 nx = _mm_mul_ps(_mm_mul_ps(dx, heightScale), _mm_sub_ps(zero, tileSize));
+			__m128 ny = _mm_mul_ps(tileSize, tileSize);
+			__m128 nz = _mm_mul_ps(_mm_mul_ps(dz, heightScale), _mm_sub_ps(zero, tileSize));
+			__m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz))));
+
+			float out[3][4];
+			_mm_storeu_ps(out[0], _mm_mul_ps(nx, invLength));
+			_mm_storeu_ps(out[1], _mm_mul_ps(ny, invLength));
+			_mm_storeu_ps(out[2], _mm_mul_ps(nz, invLength));
+			for (size_t l = 0; l < 4; ++l)
+				normals[k + l] = CVector3D(out[0][l], out[1][l], out[2][l]);
+		}
+	}
+#endif
+
+	for (; k < n; ++k)
+	{
+		heights[k] = GetExactGroundLevel(coords[k*2], coords[k*2 + 1]);
+		if (normals)
+			normals[k] = CalcExactNormal(coords[k*2], coords[k*2 + 1]);
+	}
+}
+
 fixed CTerrain::GetExactGroundLevelFixed(fixed x, fixed z) const
 {
 	// Clamp to size-2 so we can use the tiles (xi,zi)-(xi+1,zi+1)
@@ -552,6 +657,9 @@ void CTerrain::Resize(ssize_t size)
 
 	// initialise mipmap
 	m_HeightMipmap.Initialize(m_MapSize,m_Heightmap);
+
+	m_DirtyI0 = m_DirtyJ0 = 0;
+	m_DirtyI1 = m_DirtyJ1 = m_MapSize-1;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -613,7 +721,29 @@ void CTerrain::MakeDirty(ssize_t i0, ssize_t j0, ssize_t i1, ssize_t j1, int dir
 		}
 	}
 
-	if (m_Heightmap)
+	if (dirtyFlags & RENDERDATA_UPDATE_INDICES)
+	{
+		// Tiles' blends depend on their neighbours' textures too, so texture
+		// changes affect the blends of tiles (and patches) one tile further out
+		ssize_t ti0 = i0 - 1, tj0 = j0 - 1, ti1 = i1 + 1, tj1 = j1 + 1;
+		ssize_t tpi0 = clamp( ti0   /PATCH_SIZE, (ssize_t)0, m_MapSizePatches-1);
+		ssize_t tpi1 = clamp((ti1-1)/PATCH_SIZE, (ssize_t)0, m_MapSizePatches-1);
+		ssize_t tpj0 = clamp( tj0   /PATCH_SIZE, (ssize_t)0, m_MapSizePatches-1);
+		ssize_t tpj1 = clamp((tj1-1)/PATCH_SIZE, (ssize_t)0, m_MapSizePatches-1);
+
+		for (ssize_t j = tpj0; j <= tpj1; j++)
+		{
+			for (ssize_t i = tpi0; i <= tpi1; i++)
+			{
+				CPatch* patch = GetPatch(i, j);	// can't fail (i,j were clamped)
+				patch->MakeTexturesDirty(ti0 - i*PATCH_SIZE, tj0 - j*PATCH_SIZE, ti1 - i*PATCH_SIZE, tj1 - j*PATCH_SIZE);
+				patch->SetDirty(RENDERDATA_UPDATE_INDICES);
+			}
+		}
+	}
+
+	// only height changes affect the mipmap (texture and colour changes don't need it)
+	if (m_Heightmap && (dirtyFlags & RENDERDATA_UPDATE_VERTICES))
 	{
 		m_HeightMipmap.Update(m_Heightmap,
 			clamp(i0, (ssize_t)0, m_MapSize-1),
@@ -622,6 +752,31 @@ void CTerrain::MakeDirty(ssize_t i0, ssize_t j0, ssize_t i1, ssize_t j1, int dir
 			clamp(j1, (ssize_t)1, m_MapSize)
 		);
 	}
+
+	if (dirtyFlags & (RENDERDATA_UPDATE_VERTICES | RENDERDATA_UPDATE_INDICES))
+	{
+		i0 = clamp(i0, (ssize_t)0, m_MapSize-1);
+		j0 = clamp(j0, (ssize_t)0, m_MapSize-1);
+		i1 = clamp(i1, (ssize_t)0, m_MapSize-1);
+		j1 = clamp(j1, (ssize_t)0, m_MapSize-1);
+		if (i0 < i1 && j0 < j1)
+		{
+			if (m_DirtyI0 >= m_DirtyI1)
+			{
+				m_DirtyI0 = i0;
+				m_DirtyJ0 = j0;
+				m_DirtyI1 = i1;
+				m_DirtyJ1 = j1;
+			}
+			else
+			{
+				m_DirtyI0 = std::min(m_DirtyI0, i0);
+				m_DirtyJ0 = std::min(m_DirtyJ0, j0);
+				m_DirtyI1 = std::max(m_DirtyI1, i1);
+				m_DirtyJ1 = std::max(m_DirtyJ1, j1);
+			}
+		}
+	}
 }
 
 void CTerrain::MakeDirty(int dirtyFlags)
@@ -633,12 +788,33 @@ void CTerrain::MakeDirty(int dirtyFlags)
 			CPatch* patch = GetPatch(i, j);	// can't fail
 			if (dirtyFlags & RENDERDATA_UPDATE_VERTICES)
 				patch->CalcBounds();
+			if (dirtyFlags & RENDERDATA_UPDATE_INDICES)
+				patch->MakeTexturesDirty(0, 0, PATCH_SIZE, PATCH_SIZE);
 			patch->SetDirty(dirtyFlags);
 		}
 	}
 
-	if (m_Heightmap)
+	if (m_Heightmap && (dirtyFlags & RENDERDATA_UPDATE_VERTICES))
 		m_HeightMipmap.Update(m_Heightmap);
+
+	if (dirtyFlags & (RENDERDATA_UPDATE_VERTICES | RENDERDATA_UPDATE_INDICES))
+	{
+		m_DirtyI0 = m_DirtyJ0 = 0;
+		m_DirtyI1 = m_DirtyJ1 = m_MapSize-1;
+	}
+}
+
+bool CTerrain::GetAndClearDirtyTiles(ssize_t& i0, ssize_t& j0, ssize_t& i1, ssize_t& j1)
+{
+	if (m_DirtyI0 >= m_DirtyI1 || m_DirtyJ0 >= m_DirtyJ1)
+		return false;
+
+	i0 = m_DirtyI0;
+	j0 = m_DirtyJ0;
+	i1 = m_DirtyI1;
+	j1 = m_DirtyJ1;
+	m_DirtyI0 = m_DirtyJ0 = m_DirtyI1 = m_DirtyJ1 = 0;
+	return true;
 }
 
 CBoundingBoxAligned CTerrain::GetVertexesBound(ssize_t i0, ssize_t j0, ssize_t i1, ssize_t j1)
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -85,6 +85,15 @@ public:
 	fixed GetVertexGroundLevelFixed(ssize_t i, ssize_t j) const;
 	float GetExactGroundLevel(float x, float z) const;
 	fixed GetExactGroundLevelFixed(fixed x, fixed z) const;
+
+	/**
+	 * Computes GetExactGroundLevel (and optionally CalcExactNormal) for @p n points,
+	 * given as consecutive (x, z) pairs in @p coords. This is faster than querying
+	 * each point separately, since several points are interpolated at once.
+	 * @param heights receives the @p n ground levels
+	 * @param normals if not NULL, receives the @p n terrain normals
+	 */
+	void GetExactGroundLevels(const float* coords, size_t n, float* heights, CVector3D* normals = NULL) const;
 	float GetFilteredGroundLevel(float x, float z, float radius) const;
 
 	// get the approximate slope (0 = horizontal, 0.5 = 30 degrees, 1.0 = 45 degrees, etc)
@@ -142,6 +151,15 @@ public:
 	// mark the entire map as dirty
 	void MakeDirty(int dirtyFlags);
 
+	/**
+	 * Returns (in i0, j0, i1, j1) the smallest range of tiles (inclusive lower
+	 * bound, exclusive upper bound) containing all the tiles whose vertices or
+	 * textures were made dirty since the last call, and forgets them.
+	 * Returns false if nothing has changed.
+	 * (This is used by the minimap, to only update the parts that changed.)
+	 */
+	bool GetAndClearDirtyTiles(ssize_t& i0, ssize_t& j0, ssize_t& i1, ssize_t& j1);
+
 	/**
 	 * Returns a 3D bounding box encompassing the given vertex range (inclusive)
 	 */
@@ -173,6 +191,8 @@ private:
 	SColor4ub m_BaseColour;
 	// heightmap mipmap
 	CHeightMipmap m_HeightMipmap;
+	// tiles changed since the last GetAndClearDirtyTiles (empty if i0 >= i1)
+	ssize_t m_DirtyI0, m_DirtyJ0, m_DirtyI1, m_DirtyJ1;
 };
 
 #endif
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -45,7 +45,7 @@ CTerritoryTexture::~CTerritoryTexture()
 
 void CTerritoryTexture::DeleteTexture()
 {
-	glDeleteTextures(1, &m_Texture);
+	ogl_DeleteTextures(1, &m_Texture);
 	m_Texture = 0;
 }
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -25,6 +25,38 @@
 
 extern int g_xres, g_yres;
 
+// Maximum number of glyph runs to keep cached. Text that changes every frame
+// (e.g. the profiler's numbers) keeps adding new runs, so the cache is emptied
+// whenever it grows beyond this.
+static const size_t MAX_CACHED_GLYPH_RUNS = 2048;
+
+// Maximum number of glyphs to draw in a single call, so that the
+// vertex indexes fit in u16
+static const size_t MAX_BATCH_GLYPHS = 65536 / 4;
+
+struct t2f_v2i
+{
+	t2f_v2i() : u(0), v(0), x(0), y(0) { }
+	float u, v;
+	i16 x, y;
+};
+
+struct t2f_v2f
+{
+	float u, v;
+	float x, y;
+};
+
+struct CTextRenderer::SGlyphRun
+{
+	// The font's glyph data that this was computed from, so that it can be
+	// recomputed if the font is reloaded
+	const std::map<u16, UnifontGlyphData>* glyphs;
+
+	std::vector<t2f_v2i> vertexes; // 4 per glyph
+	int advance;
+};
+
 CTextRenderer::CTextRenderer(const CShaderProgramPtr& shader) :
 	m_Shader(shader)
 {
@@ -42,23 +74,25 @@ void CTextRenderer::ResetTransform()
 	CMatrix3D proj;
 	proj.SetOrtho(0.f, (float)g_xres, 0.f, (float)g_yres, -1.f, 1000.f);
 	m_Transform = proj * m_Transform;
+	m_Translation = CVector3D(0.0f, 0.0f, 0.0f);
 }
 
 CMatrix3D CTextRenderer::GetTransform()
 {
-	return m_Transform;
+	CMatrix3D m;
+	m.SetTranslation(m_Translation);
+	return m_Transform * m;
 }
 
 void CTextRenderer::SetTransform(const CMatrix3D& transform)
 {
 	m_Transform = transform;
+	m_Translation = CVector3D(0.0f, 0.0f, 0.0f);
 }
 
 void CTextRenderer::Translate(float x, float y, float z)
 {
-	CMatrix3D m;
-	m.SetTranslation(x, y, z);
-	m_Transform = m_Transform * m;
+	m_Translation += CVector3D(x, y, z);
 }
 
 void CTextRenderer::Color(const CColor& color)
@@ -77,6 +111,7 @@ void CTextRenderer::Font(const CStrW& font)
 		m_Fonts[font] = shared_ptr<CFont>(new CFont(font));
 
 	m_Font = m_Fonts[font];
+	m_FontName = font;
 }
 
 void CTextRenderer::PrintfAdvance(const wchar_t* fmt, ...)
@@ -114,9 +149,7 @@ void CTextRenderer::PutAdvance(const wchar_t* buf)
 {
 	Put(0.0f, 0.0f, buf);
 
-	int w, h;
-	m_Font->CalculateStringSize(buf, w, h);
-	Translate((float)w, 0.0f, 0.0f);
+	Translate((float)GetGlyphRun(buf)->advance, 0.0f, 0.0f);
 }
 
 void CTextRenderer::Put(float x, float y, const wchar_t* buf)
@@ -124,41 +157,107 @@ void CTextRenderer::Put(float x, float y, const wchar_t* buf)
 	if (buf[0] == 0)
 		return; // empty string; don't bother storing
 
-	CMatrix3D translate;
-	translate.SetTranslation(x, y, 0.0f);
-
 	SBatch batch;
-	batch.transform = m_Transform * translate;
+	batch.transform = m_Transform;
+	batch.translation = m_Translation + CVector3D(x, y, 0.0f);
 	batch.color = m_Color;
 	batch.font = m_Font;
-	batch.text = buf;
+	batch.run = GetGlyphRun(buf);
 	m_Batches.push_back(batch);
 }
 
-struct t2f_v2i
+shared_ptr<const CTextRenderer::SGlyphRun> CTextRenderer::GetGlyphRun(const wchar_t* buf)
 {
-	t2f_v2i() : u(0), v(0), x(0), y(0) { }
-	float u, v;
-	i16 x, y;
-};
+	// Most text is printed with the same font every frame, so cache the
+	// vertex data instead of looking up every glyph again
+	typedef std::map<std::pair<CStrW, std::wstring>, shared_ptr<SGlyphRun> > GlyphRunCache;
+	static GlyphRunCache cache;
+
+	const std::map<u16, UnifontGlyphData>& glyphs = m_Font->GetGlyphs();
+
+	shared_ptr<SGlyphRun>& cached = cache[std::make_pair(m_FontName, std::wstring(buf))];
+	if (cached && cached->glyphs == &glyphs)
+		return cached;
+
+	shared_ptr<SGlyphRun> run(new SGlyphRun);
+	run->glyphs = &glyphs;
+
+	const size_t len = wcslen(buf);
+	run->vertexes.reserve(len*4);
+
+	i16 x = 0;
+	for (size_t i = 0; i < len; ++i)
+	{
+		std::map<u16, UnifontGlyphData>::const_iterator it = glyphs.find(buf[i]);
+
+		if (it == glyphs.end())
+			it = glyphs.find(0xFFFD); // Use the missing glyph symbol
+
+		if (it == glyphs.end()) // Missing the missing glyph symbol - give up
+			continue;
+
+		const UnifontGlyphData& g = it->second;
+
+		t2f_v2i v;
+
+		v.u = g.u1;
+		v.v = g.v0;
+		v.x = g.x1 + x;
+		v.y = g.y0;
+		run->vertexes.push_back(v);
+
+		v.u = g.u0;
+		v.v = g.v0;
+		v.x = g.x0 + x;
+		v.y = g.y0;
+		run->vertexes.push_back(v);
+
+		v.u = g.u0;
+		v.v = g.v1;
+		v.x = g.x0 + x;
+		v.y = g.y1;
+		run->vertexes.push_back(v);
+
+		v.u = g.u1;
+		v.v = g.v1;
+		v.x = g.x1 + x;
+		v.y = g.y1;
+		run->vertexes.push_back(v);
+
+		x += g.xadvance;
+	}
+
+	run->advance = x;
+
+	// (Batches keep their own references to the runs, so it's safe to
+	// discard the cache at any time)
+	if (cache.size() > MAX_CACHED_GLYPH_RUNS)
+	{
+		cache.clear();
+		cache[std::make_pair(m_FontName, std::wstring(buf))] = run;
+	}
+	else
+	{
+		cached = run;
+	}
+
+	return run;
+}
 
 void CTextRenderer::Render()
 {
 	std::vector<u16> indexes;
-	std::vector<t2f_v2i> vertexes;
+	std::vector<t2f_v2f> vertexes;
 
-	for (size_t i = 0; i < m_Batches.size(); ++i)
+	for (size_t i = 0; i < m_Batches.size(); )
 	{
 		SBatch& batch = m_Batches[i];
 
-		if (batch.text.empty()) // avoid zero-length arrays
-			continue;
-
-		const std::map<u16, UnifontGlyphData>& glyphs = batch.font->GetGlyphs();
-
 		m_Shader->BindTexture("tex", batch.font->GetTexture());
 
-		m_Shader->Uniform("transform", batch.transform);
+		CMatrix3D translate;
+		translate.SetTranslation(0.0f, 0.0f, batch.translation.Z);
+		m_Shader->Uniform("transform", batch.transform * translate);
 
 		// ALPHA-only textures will have .rgb sampled as 0, so we need to
 		// replace it with white (but not affect RGBA textures)
@@ -169,59 +268,56 @@ void CTextRenderer::Render()
 
 		m_Shader->Uniform("colorMul", batch.color);
 
-		vertexes.clear();
-		vertexes.resize(batch.text.size()*4);
+		// Distance field fonts need to be thresholded to find the glyph edges
+		m_Shader->Uniform("sdfSmoothing", batch.font->GetSDFSmoothing());
 
-		indexes.clear();
-		indexes.resize(batch.text.size()*6);
+		vertexes.clear();
 
-		i16 x = 0;
-		for (size_t i = 0; i < batch.text.size(); ++i)
+		// Combine all the following batches that can be drawn with the same
+		// state, with their (x,y) translations applied to the vertexes
+		for (; i < m_Batches.size(); ++i)
 		{
-			std::map<u16, UnifontGlyphData>::const_iterator it = glyphs.find(batch.text[i]);
-
-			if (it == glyphs.end())
-				it = glyphs.find(0xFFFD); // Use the missing glyph symbol
-
-			if (it == glyphs.end()) // Missing the missing glyph symbol - give up
-				continue;
-
-			const UnifontGlyphData& g = it->second;
-
-			vertexes[i*4].u = g.u1;
-			vertexes[i*4].v = g.v0;
-			vertexes[i*4].x = g.x1 + x;
-			vertexes[i*4].y = g.y0;
-
-			vertexes[i*4+1].u = g.u0;
-			vertexes[i*4+1].v = g.v0;
-			vertexes[i*4+1].x = g.x0 + x;
-			vertexes[i*4+1].y = g.y0;
-
-			vertexes[i*4+2].u = g.u0;
-			vertexes[i*4+2].v = g.v1;
-			vertexes[i*4+2].x = g.x0 + x;
-			vertexes[i*4+2].y = g.y1;
-
-			vertexes[i*4+3].u = g.u1;
-			vertexes[i*4+3].v = g.v1;
-			vertexes[i*4+3].x = g.x1 + x;
-			vertexes[i*4+3].y = g.y1;
+			const SBatch& b = m_Batches[i];
+			if (b.font != batch.font || b.color != batch.color ||
+				b.translation.Z != batch.translation.Z || b.transform != batch.transform)
+				break;
+
+			if (!vertexes.empty() && vertexes.size() + b.run->vertexes.size() > MAX_BATCH_GLYPHS*4)
+				break;
+
+			for (size_t j = 0; j < b.run->vertexes.size(); ++j)
+			{
+				const t2f_v2i& src = b.run->vertexes[j];
+				t2f_v2f v;
+				v.u = src.u;
+				v.v = src.v;
+				v.x = src.x + b.translation.X;
+				v.y = src.y + b.translation.Y;
+				vertexes.push_back(v);
+			}
+		}
 
-			indexes[i*6+0] = i*4+0;
-			indexes[i*6+1] = i*4+1;
-			indexes[i*6+2] = i*4+2;
-			indexes[i*6+3] = i*4+2;
-			indexes[i*6+4] = i*4+3;
-			indexes[i*6+5] = i*4+0;
+		if (vertexes.empty()) // avoid zero-length arrays
+			continue;
 
-			x += g.xadvance;
+		const size_t numGlyphs = vertexes.size() / 4;
+		if (indexes.size() < numGlyphs*6)
+		{
+			for (size_t j = indexes.size() / 6; j < numGlyphs; ++j)
+			{
+				indexes.push_back(j*4+0);
+				indexes.push_back(j*4+1);
+				indexes.push_back(j*4+2);
+				indexes.push_back(j*4+2);
+				indexes.push_back(j*4+3);
+				indexes.push_back(j*4+0);
+			}
 		}
 
-		m_Shader->VertexPointer(2, GL_SHORT, sizeof(t2f_v2i), &vertexes[0].x);
-		m_Shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, sizeof(t2f_v2i), &vertexes[0].u);
+		m_Shader->VertexPointer(2, GL_FLOAT, sizeof(t2f_v2f), &vertexes[0].x);
+		m_Shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, sizeof(t2f_v2f), &vertexes[0].u);
 
-		glDrawElements(GL_TRIANGLES, indexes.size(), GL_UNSIGNED_SHORT, &indexes[0]);
+		glDrawElements(GL_TRIANGLES, numGlyphs*6, GL_UNSIGNED_SHORT, &indexes[0]);
 	}
 
 	m_Batches.clear();
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,6 +20,7 @@
 
 #include "graphics/ShaderProgram.h"
 #include "maths/Matrix3D.h"
+#include "maths/Vector3D.h"
 #include "ps/CStr.h"
 #include "ps/Overlay.h"
 
@@ -82,24 +83,44 @@ public:
 
 	/**
 	 * Render all of the previously printed text calls.
+	 * Consecutive calls with the same font and color, which differ only by
+	 * a translation in the (x,y) plane, are drawn with a single draw call.
 	 */
 	void Render();
 
 private:
+	/**
+	 * Precomputed vertex data for a string in a particular font
+	 * (see GetGlyphRun).
+	 */
+	struct SGlyphRun;
+
 	struct SBatch
 	{
-		CMatrix3D transform;
+		CMatrix3D transform; // m_Transform when printed
+		CVector3D translation; // m_Translation (plus the print position) when printed
 		CColor color;
 		shared_ptr<CFont> font;
-		std::wstring text;
+		shared_ptr<const SGlyphRun> run;
 	};
 
+	/**
+	 * Returns the vertex data for @p buf in the current font, from the cache
+	 * that is shared between all text renderers.
+	 */
+	shared_ptr<const SGlyphRun> GetGlyphRun(const wchar_t* buf);
+
 	CShaderProgramPtr m_Shader;
 
+	// The current transform is m_Transform * translate(m_Translation).
+	// (The translation is kept separate so that text printed at different
+	// positions can be combined into a single batch.)
 	CMatrix3D m_Transform;
+	CVector3D m_Translation;
 
 	CColor m_Color;
 	shared_ptr<CFont> m_Font;
+	CStrW m_FontName;
 
 	std::map<CStrW, shared_ptr<CFont> > m_Fonts;
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -272,7 +272,7 @@ CTextureConverter::Settings CTextureConverter::ComputeSettings(const std::wstrin
 	return settings;
 }
 
-CTextureConverter::CTextureConverter(PIVFS vfs, bool highQuality) :
+CTextureConverter::CTextureConverter(PIVFS vfs, bool highQuality, size_t numThreads) :
 	m_VFS(vfs), m_HighQuality(highQuality), m_Shutdown(false)
 {
 	// Verify that we are running with at least the version we were compiled with,
@@ -281,7 +281,7 @@ CTextureConverter::CTextureConverter(PIVFS vfs, bool highQuality) :
 	ENSURE(nvtt::version() >= NVTT_VERSION);
 #endif
 
-	// Set up the worker thread:
+	// Set up the worker threads:
 
 	int ret;
 
@@ -292,32 +292,38 @@ CTextureConverter::CTextureConverter(PIVFS vfs, bool highQuality) :
 	ret = pthread_mutex_init(&m_WorkerMutex, NULL);
 	ENSURE(ret == 0);
 
-	ret = pthread_create(&m_WorkerThread, NULL, &RunThread, this);
-	ENSURE(ret == 0);
+	m_WorkerThreads.resize(std::max(numThreads, (size_t)1));
+	for (size_t i = 0; i < m_WorkerThreads.size(); ++i)
+	{
+		ret = pthread_create(&m_WorkerThreads[i], NULL, &RunThread, this);
+		ENSURE(ret == 0);
+	}
 
 	// Maybe we should share some centralised pool of worker threads?
-	// For now we'll just stick with a single thread for this specific use.
+	// For now we'll just stick with our own threads for this specific use.
 }
 
 CTextureConverter::~CTextureConverter()
 {
-	// Tell the thread to shut down
+	// Tell the threads to shut down
 	pthread_mutex_lock(&m_WorkerMutex);
 	m_Shutdown = true;
 	pthread_mutex_unlock(&m_WorkerMutex);
 
-	// Wake it up so it sees the notification
-	SDL_SemPost(m_WorkerSem);
+	// Wake them all up so they see the notification
+	for (size_t i = 0; i < m_WorkerThreads.size(); ++i)
+		SDL_SemPost(m_WorkerSem);
 
-	// Wait for it to shut down cleanly
-	pthread_join(m_WorkerThread, NULL);
+	// Wait for them to shut down cleanly
+	for (size_t i = 0; i < m_WorkerThreads.size(); ++i)
+		pthread_join(m_WorkerThreads[i], NULL);
 
 	// Clean up resources
 	SDL_DestroySemaphore(m_WorkerSem);
 	pthread_mutex_destroy(&m_WorkerMutex);
 }
 
-bool CTextureConverter::ConvertTexture(const CTexturePtr& texture, const VfsPath& src, const VfsPath& dest, const Settings& settings)
+bool CTextureConverter::ConvertTexture(const CTexturePtr& texture, const VfsPath& src, const VfsPath& dest, const Settings& settings, bool highPriority)
 {
 	shared_ptr<u8> file;
 	size_t fileSize;
@@ -437,7 +443,10 @@ bool CTextureConverter::ConvertTexture(const CTexturePtr& texture, const VfsPath
 	tex_free(&tex);
 
 	pthread_mutex_lock(&m_WorkerMutex);
-	m_RequestQueue.push_back(request);
+	if (highPriority)
+		m_HighRequestQueue.push_back(request);
+	else
+		m_RequestQueue.push_back(request);
 	pthread_mutex_unlock(&m_WorkerMutex);
 
 	// Wake up the worker thread
@@ -471,6 +480,9 @@ bool CTextureConverter::Poll(CTexturePtr& texture, VfsPath& dest, bool& ok)
 		return false;
 	}
 
+	texture = result->texture;
+	dest = result->dest;
+
 	if (!result->ret)
 	{
 		// conversion had failed
@@ -491,8 +503,6 @@ bool CTextureConverter::Poll(CTexturePtr& texture, VfsPath& dest, bool& ok)
 	}
 
 	// Succeeded in converting texture
-	texture = result->texture;
-	dest = result->dest;
 	ok = true;
 	return true;
 
@@ -501,15 +511,43 @@ bool CTextureConverter::Poll(CTexturePtr& texture, VfsPath& dest, bool& ok)
 #endif
 }
 
+void CTextureConverter::Prioritize(const CTexturePtr& texture)
+{
+#if CONFIG2_NVTT
+	pthread_mutex_lock(&m_WorkerMutex);
+	for (std::deque<shared_ptr<ConversionRequest> >::iterator it = m_RequestQueue.begin(); it != m_RequestQueue.end(); ++it)
+	{
+		if ((*it)->texture == texture)
+		{
+			m_HighRequestQueue.push_back(*it);
+			m_RequestQueue.erase(it);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&m_WorkerMutex);
+#else // #if CONFIG2_NVTT
+	UNUSED2(texture);
+#endif
+}
+
 bool CTextureConverter::IsBusy()
 {
 	pthread_mutex_lock(&m_WorkerMutex);
-	bool busy = !m_RequestQueue.empty();
+	bool busy = !m_RequestQueue.empty() || !m_HighRequestQueue.empty();
 	pthread_mutex_unlock(&m_WorkerMutex);
 
 	return busy;
 }
 
+size_t CTextureConverter::GetNumQueued()
+{
+	pthread_mutex_lock(&m_WorkerMutex);
+	size_t num = m_RequestQueue.size() + m_HighRequestQueue.size();
+	pthread_mutex_unlock(&m_WorkerMutex);
+
+	return num;
+}
+
 void* CTextureConverter::RunThread(void* data)
 {
 	debug_SetThreadName("TextureConverter");
@@ -532,9 +570,13 @@ void* CTextureConverter::RunThread(void* data)
 			break;
 		}
 		// If we weren't woken up for shutdown, we must have been woken up for
-		// a new request, so grab it from the queue
-		shared_ptr<ConversionRequest> request = textureConverter->m_RequestQueue.front();
-		textureConverter->m_RequestQueue.pop_front();
+		// a new request, so grab it from the queue (the semaphore is posted
+		// once per request, so each thread that wakes up gets a different one),
+		// taking the high-priority ones first
+		std::deque<shared_ptr<ConversionRequest> >& queue = textureConverter->m_HighRequestQueue.empty() ?
+			textureConverter->m_RequestQueue : textureConverter->m_HighRequestQueue;
+		shared_ptr<ConversionRequest> request = queue.front();
+		queue.pop_front();
 		pthread_mutex_unlock(&textureConverter->m_WorkerMutex);
 
 		// Set up the result object
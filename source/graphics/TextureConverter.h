@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -148,12 +148,15 @@ public:
 
 	/**
 	 * Construct texture converter, for use with files in the given vfs.
+	 * numThreads worker threads will be used for compression, so that many
+	 * requests can be processed concurrently (e.g. when batch-converting files
+	 * for an archive). The game only needs one.
 	 */
-	CTextureConverter(PIVFS vfs, bool highQuality);
+	CTextureConverter(PIVFS vfs, bool highQuality, size_t numThreads = 1);
 
 	/**
-	 * Destroy texture converter and wait to shut down worker thread.
-	 * This might take a long time (maybe seconds) if the worker is busy
+	 * Destroy texture converter and wait to shut down worker threads.
+	 * This might take a long time (maybe seconds) if a worker is busy
 	 * processing a texture.
 	 */
 	~CTextureConverter();
@@ -177,17 +180,24 @@ public:
 	 * Otherwise it will return true and start an asynchronous conversion request,
 	 * whose result will be returned from Poll() (with the texture and dest passed
 	 * into this function).
+	 * High-priority requests (for textures that are needed right now) are started
+	 * before any queued normal-priority ones.
 	 */
-	bool ConvertTexture(const CTexturePtr& texture, const VfsPath& src, const VfsPath& dest, const Settings& settings);
+	bool ConvertTexture(const CTexturePtr& texture, const VfsPath& src, const VfsPath& dest, const Settings& settings, bool highPriority = false);
+
+	/**
+	 * If a request for the given texture is queued and hasn't been started yet,
+	 * make it high-priority.
+	 */
+	void Prioritize(const CTexturePtr& texture);
 
 	/**
 	 * Returns the result of a successful ConvertTexture call.
 	 * If no result is available yet, returns false.
-	 * Otherwise, if the conversion succeeded, it sets ok to true and sets
-	 * texture and dest to the corresponding values passed into ConvertTexture(),
-	 * then returns true.
-	 * If the conversion failed, it sets ok to false and doesn't touch the other arguments,
-	 * then returns true.
+	 * Otherwise, it sets texture and dest to the corresponding values passed into
+	 * ConvertTexture(), and sets ok to whether the conversion succeeded, then returns true.
+	 * With multiple worker threads, results may be returned in a different order
+	 * to the requests.
 	 */
 	bool Poll(CTexturePtr& texture, VfsPath& dest, bool& ok);
 
@@ -197,13 +207,23 @@ public:
 	 */
 	bool IsBusy();
 
+	/**
+	 * Returns the number of queued requests that haven't been started yet.
+	 */
+	size_t GetNumQueued();
+
+	size_t GetNumThreads() const
+	{
+		return m_WorkerThreads.size();
+	}
+
 private:
 	static void* RunThread(void* data);
 
 	PIVFS m_VFS;
 	bool m_HighQuality;
 
-	pthread_t m_WorkerThread;
+	std::vector<pthread_t> m_WorkerThreads;
 	pthread_mutex_t m_WorkerMutex;
 	SDL_sem* m_WorkerSem;
 
@@ -211,6 +231,7 @@ private:
 	struct ConversionResult;
 
 	std::deque<shared_ptr<ConversionRequest> > m_RequestQueue; // protected by m_WorkerMutex
+	std::deque<shared_ptr<ConversionRequest> > m_HighRequestQueue; // protected by m_WorkerMutex
 	std::deque<shared_ptr<ConversionResult> > m_ResultQueue; // protected by m_WorkerMutex
 	bool m_Shutdown; // protected by m_WorkerMutex
 };
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -28,10 +28,13 @@
 #include "maths/MD5.h"
 #include "ps/CacheLoader.h"
 #include "ps/CLogger.h"
+#include "ps/ConfigDB.h"
 #include "ps/Filesystem.h"
 #include "ps/Profile.h"
+#include "ps/ThreadPool.h"
 
 #include <iomanip>
+#include <deque>
 #include <boost/unordered_map.hpp>
 #include <boost/unordered_set.hpp>
 #include <boost/functional/hash.hpp>
@@ -77,10 +80,32 @@ class CTextureManagerImpl
 {
 	friend class CTexture;
 public:
-	CTextureManagerImpl(PIVFS vfs, bool highQuality, bool disableGL) :
-		m_VFS(vfs), m_CacheLoader(vfs, L".dds"), m_DisableGL(disableGL), m_TextureConverter(vfs, highQuality),
-		m_DefaultHandle(0), m_ErrorHandle(0)
+	CTextureManagerImpl(PIVFS vfs, bool highQuality, bool disableGL, size_t numConverterThreads) :
+		m_VFS(vfs), m_CacheLoader(vfs, L".dds"), m_DisableGL(disableGL), m_TextureConverter(vfs, highQuality, numConverterThreads),
+		m_DefaultHandle(0), m_ErrorHandle(0), m_UploadBudget(4*MiB), m_UploadedBytes(0),
+		m_Frame(0), m_MemoryBudget(0), m_EvictFrames(300), m_BytesUploaded(0)
 	{
+		// Limit the amount of prefetched texture data uploaded per frame,
+		// so streaming in a new area doesn't stall the renderer
+		if (CConfigDB::IsInitialised())
+		{
+			int budgetKiB = 0;
+			CFG_GET_USER_VAL("textures.uploadbudget", Int, budgetKiB);
+			if (budgetKiB > 0)
+				m_UploadBudget = (size_t)budgetKiB * KiB;
+
+			// Limit on video memory used by textures (0 for no limit)
+			int budgetMiB = 0;
+			CFG_GET_USER_VAL("textures.budget", Int, budgetMiB);
+			if (budgetMiB > 0)
+				m_MemoryBudget = (size_t)budgetMiB * MiB;
+
+			int evictFrames = 0;
+			CFG_GET_USER_VAL("textures.evictframes", Int, evictFrames);
+			if (evictFrames > 0)
+				m_EvictFrames = (u32)evictFrames;
+		}
+
 		// Initialise some textures that will always be available,
 		// without needing to load any files
 
@@ -132,6 +157,15 @@ public:
 	{
 		UnregisterFileReloadFunc(ReloadChangedFileCB, this);
 
+		// Make sure no callbacks will refer to us after we're gone
+		for (TextureCache::iterator it = m_TextureCache.begin(); it != m_TextureCache.end(); ++it)
+			CancelAsyncLoad(**it);
+
+		// Release any handles that no texture has taken ownership of yet
+		for (size_t i = 0; i < m_UploadQueue.size(); ++i)
+			if (!m_UploadQueue[i].owned)
+				(void)ogl_tex_free(m_UploadQueue[i].handle);
+
 		(void)ogl_tex_free(m_DefaultHandle);
 		(void)ogl_tex_free(m_ErrorHandle);
 	}
@@ -184,6 +218,70 @@ public:
 			return;
 		}
 
+		SetupTexture(texture, h);
+	}
+
+	/**
+	 * Like LoadTexture, but decodes file contents that have already been loaded.
+	 */
+	void LoadTextureFromMemory(const CTexturePtr& texture, const VfsPath& path, const shared_ptr<u8>& fileContents, size_t size)
+	{
+		if (m_DisableGL)
+			return;
+
+		PROFILE2("load texture");
+		PROFILE2_ATTR("name: %ls", path.string().c_str());
+
+		Tex t;
+		Handle h = -1;
+		if (tex_decode(fileContents, size, &t) >= 0)
+		{
+			h = ogl_tex_wrap(&t, m_VFS, path, RES_UNIQUE);
+			if (h <= 0)
+				tex_free(&t);
+		}
+		if (h <= 0)
+		{
+			LOGERROR(L"Texture failed to load; \"%ls\"", texture->m_Properties.m_Path.string().c_str());
+
+			// Replace with error texture to make it obvious
+			texture->SetHandle(m_ErrorHandle);
+			return;
+		}
+
+		SetupTexture(texture, h);
+	}
+
+	/**
+	 * Set up the GL properties of a newly loaded texture handle, and upload it.
+	 * The texture object takes ownership of the handle.
+	 */
+	void SetupTexture(const CTexturePtr& texture, Handle h)
+	{
+		SetTextureProperties(texture, h);
+
+		// Upload to GL
+		if (!m_DisableGL && ogl_tex_upload(h, 0, texture->m_Reduced ? OGL_TEX_HALF_RES : 0) < 0)
+		{
+			LOGERROR(L"Texture failed to upload: \"%ls\"", texture->m_Properties.m_Path.string().c_str());
+
+			ogl_tex_free(h);
+
+			// Replace with error texture to make it obvious
+			texture->SetHandle(m_ErrorHandle);
+			return;
+		}
+
+		// Let the texture object take ownership of this handle
+		texture->SetHandle(h, true);
+	}
+
+	/**
+	 * Set the GL upload properties of a newly loaded texture handle,
+	 * and initialise the texture's base colour from it.
+	 */
+	void SetTextureProperties(const CTexturePtr& texture, Handle h)
+	{
 		// Get some flags for later use
 		size_t flags = 0;
 		(void)ogl_tex_get_format(h, &flags, NULL);
@@ -213,21 +311,6 @@ public:
 			}
 		}
 		(void)ogl_tex_set_filter(h, filter);
-
-		// Upload to GL
-		if (!m_DisableGL && ogl_tex_upload(h) < 0)
-		{
-			LOGERROR(L"Texture failed to upload: \"%ls\"", texture->m_Properties.m_Path.string().c_str());
-
-			ogl_tex_free(h);
-
-			// Replace with error texture to make it obvious
-			texture->SetHandle(m_ErrorHandle);
-			return;
-		}
-
-		// Let the texture object take ownership of this handle
-		texture->SetHandle(h, true);
 	}
 
 	/**
@@ -250,7 +333,7 @@ public:
 	 * If the texture is loaded (or there was an error), returns true.
 	 * Otherwise, returns false to indicate the caller should generate the cached version.
 	 */
-	bool TryLoadingCached(const CTexturePtr& texture)
+	bool TryLoadingCached(const CTexturePtr& texture, bool async = false)
 	{
 		MD5 hash;
 		u32 version;
@@ -262,7 +345,10 @@ public:
 		if (ret == INFO::OK)
 		{
 			// Found a cached texture - load it
-			LoadTexture(texture, loadPath);
+			if (async && !m_DisableGL)
+				StartAsyncLoad(texture, loadPath);
+			else
+				LoadTexture(texture, loadPath);
 			return true;
 		}
 		else if (ret == INFO::SKIPPED)
@@ -282,11 +368,246 @@ public:
 		}
 	}
 
+	/**
+	 * See CTextureManager::LoadTextureData
+	 */
+	bool LoadTextureData(const CTexturePtr& texture, Tex& tex)
+	{
+		MD5 hash;
+		u32 version;
+		PrepareCacheKey(texture, hash, version);
+
+		VfsPath loadPath;
+		if (m_CacheLoader.TryLoadingCached(texture->m_Properties.m_Path, hash, version, loadPath) != INFO::OK)
+			return false;
+
+		shared_ptr<u8> fileContents;
+		size_t size;
+		if (m_VFS->LoadFile(loadPath, fileContents, size) < 0)
+			return false;
+
+		return tex_decode(fileContents, size, &tex) >= 0;
+	}
+
+	/**
+	 * Starts loading the given (cached) file in the background.
+	 * The texture will be finished by OnAsyncLoad once the file has been read.
+	 */
+	void StartAsyncLoad(const CTexturePtr& texture, const VfsPath& path)
+	{
+		// Prefetched files are loaded in the order they're on disk, ahead of
+		// any other (lower-priority) background loads
+		const int priority = 1;
+
+		texture->m_State = CTexture::PREFETCH_IS_LOADING;
+		texture->m_AsyncLoad = m_VFS->LoadFileAsync(path, priority, AsyncLoadCB, (uintptr_t)texture.get());
+	}
+
+	static void AsyncLoadCB(const VfsPath& path, Status ret, const shared_ptr<u8>& fileContents, size_t size, uintptr_t cbData)
+	{
+		CTexture* texture = (CTexture*)cbData;
+		texture->m_TextureManager->OnAsyncLoad(*texture, path, ret, fileContents, size);
+	}
+
+	void OnAsyncLoad(CTexture& texture, const VfsPath& path, Status ret, const shared_ptr<u8>& fileContents, size_t size)
+	{
+		texture.m_AsyncLoad = 0;
+
+		CTexturePtr self = texture.m_Self.lock();
+		if (!self)
+			return;
+
+		if (ret == INFO::OK)
+		{
+			// Decode it later (in parallel with any other textures that
+			// finished loading at the same time)
+			PendingDecode item;
+			item.texture = self;
+			item.path = path;
+			item.fileContents = fileContents;
+			item.size = size;
+			item.ret = INFO::OK;
+			m_DecodeQueue.push_back(item);
+			texture.m_State = CTexture::PREFETCH_IS_DECODING;
+			return;
+		}
+
+		LOGERROR(L"Texture failed to load; \"%ls\"", texture.m_Properties.m_Path.string().c_str());
+		texture.SetHandle(m_ErrorHandle);
+		texture.m_State = CTexture::LOADED;
+	}
+
+	/**
+	 * Stops the texture's asynchronous load, decoding and upload (if any),
+	 * e.g. because it's now needed immediately or its file has changed.
+	 * The caller must update the texture's state.
+	 */
+	void CancelAsyncLoad(CTexture& texture)
+	{
+		if (texture.m_AsyncLoad)
+		{
+			m_VFS->CancelLoad(texture.m_AsyncLoad);
+			texture.m_AsyncLoad = 0;
+		}
+
+		if (texture.m_State == CTexture::PREFETCH_IS_DECODING)
+		{
+			for (size_t i = 0; i < m_DecodeQueue.size(); ++i)
+			{
+				if (m_DecodeQueue[i].texture.lock().get() == &texture)
+				{
+					m_DecodeQueue.erase(m_DecodeQueue.begin() + i);
+					break;
+				}
+			}
+		}
+		else if (texture.m_State == CTexture::PREFETCH_IS_UPLOADING)
+		{
+			for (size_t i = 0; i < m_UploadQueue.size(); ++i)
+			{
+				if (m_UploadQueue[i].texture.lock().get() == &texture)
+				{
+					if (!m_UploadQueue[i].owned)
+						(void)ogl_tex_free(m_UploadQueue[i].handle);
+					m_UploadQueue.erase(m_UploadQueue.begin() + i);
+					break;
+				}
+			}
+		}
+	}
+
+	/**
+	 * Decodes all the loaded prefetched files, and queues them to be uploaded.
+	 */
+	void DecodeTextures()
+	{
+		PROFILE2("decode textures");
+		PROFILE2_ATTR("count: %d", (int)m_DecodeQueue.size());
+
+		DecodeTask task(m_DecodeQueue);
+		if (g_ThreadPool && m_DecodeQueue.size() > 1)
+			g_ThreadPool->ParallelFor(task, m_DecodeQueue.size());
+		else
+			for (size_t i = 0; i < m_DecodeQueue.size(); ++i)
+				task.Run(i);
+
+		for (size_t i = 0; i < m_DecodeQueue.size(); ++i)
+		{
+			PendingDecode& item = m_DecodeQueue[i];
+			CTexturePtr texture = item.texture.lock();
+			if (!texture || texture->m_State != CTexture::PREFETCH_IS_DECODING)
+			{
+				if (item.ret >= 0)
+					tex_free(&item.tex);
+				continue;
+			}
+
+			Handle h = -1;
+			if (item.ret >= 0)
+			{
+				h = ogl_tex_wrap(&item.tex, m_VFS, item.path, RES_UNIQUE);
+				if (h <= 0)
+					tex_free(&item.tex);
+			}
+			if (h <= 0)
+			{
+				LOGERROR(L"Texture failed to load; \"%ls\"", texture->m_Properties.m_Path.string().c_str());
+
+				// Replace with error texture to make it obvious
+				texture->SetHandle(m_ErrorHandle);
+				texture->m_State = CTexture::LOADED;
+				continue;
+			}
+
+			SetTextureProperties(texture, h);
+
+			PendingUpload upload;
+			upload.texture = texture;
+			upload.handle = h;
+			upload.owned = false;
+			m_UploadQueue.push_back(upload);
+			texture->m_State = CTexture::PREFETCH_IS_UPLOADING;
+		}
+
+		m_DecodeQueue.clear();
+	}
+
+	/**
+	 * Uploads the next few mipmap levels of the first texture in m_UploadQueue,
+	 * within what's left of this frame's upload budget.
+	 */
+	void UploadTexture()
+	{
+		PendingUpload& upload = m_UploadQueue.front();
+		CTexturePtr texture = upload.texture.lock();
+		if (!texture)
+		{
+			if (!upload.owned)
+				(void)ogl_tex_free(upload.handle);
+			m_UploadQueue.pop_front();
+			return;
+		}
+
+		PROFILE2("upload texture");
+		PROFILE2_ATTR("name: %ls", texture->m_Properties.m_Path.string().c_str());
+
+		size_t uploadedBytes = 0;
+		Status ret;
+		if (texture->m_Reduced)
+		{
+			// (this is a quarter of the full size, so just upload it all at once)
+			ret = ogl_tex_upload(upload.handle, 0, OGL_TEX_HALF_RES);
+			if (ret >= 0)
+			{
+				(void)ogl_tex_get_uploaded_size(upload.handle, &uploadedBytes);
+				ret = INFO::ALL_COMPLETE;
+			}
+		}
+		else
+		{
+			ret = ogl_tex_upload_partial(upload.handle, m_UploadBudget - m_UploadedBytes, &uploadedBytes);
+		}
+		m_UploadedBytes += uploadedBytes;
+
+		if (ret < 0)
+		{
+			LOGERROR(L"Texture failed to upload: \"%ls\"", texture->m_Properties.m_Path.string().c_str());
+
+			if (!upload.owned)
+				(void)ogl_tex_free(upload.handle);
+
+			// Replace with error texture to make it obvious
+			texture->SetHandle(m_ErrorHandle);
+			texture->m_State = CTexture::LOADED;
+			m_UploadQueue.pop_front();
+			return;
+		}
+
+		// Start using the texture as soon as its smallest levels are available
+		// (unless this is replacing an older copy of the texture, which can
+		// still be used until the new one is complete)
+		if (upload.owned)
+		{
+			UpdateUploadedSize(*texture);
+		}
+		else if (texture->m_UploadedSize == 0 || ret == INFO::ALL_COMPLETE)
+		{
+			texture->SetHandle(upload.handle, true);
+			upload.owned = true;
+		}
+
+		if (ret == INFO::ALL_COMPLETE)
+		{
+			texture->m_State = CTexture::LOADED;
+			m_UploadQueue.pop_front();
+		}
+	}
+
 	/**
 	 * Initiates an asynchronous conversion process, from the texture's
 	 * source file to the corresponding loose cache file.
 	 */
-	void ConvertTexture(const CTexturePtr& texture)
+	void ConvertTexture(const CTexturePtr& texture, bool highPriority)
 	{
 		VfsPath sourcePath = texture->m_Properties.m_Path;
 
@@ -302,35 +623,88 @@ public:
 
 		CTextureConverter::Settings settings = GetConverterSettings(texture);
 
-		m_TextureConverter.ConvertTexture(texture, sourcePath, looseCachePath, settings);
+		m_TextureConverter.ConvertTexture(texture, sourcePath, looseCachePath, settings, highPriority);
 	}
 
-	bool GenerateCachedTexture(const VfsPath& sourcePath, VfsPath& archiveCachePath)
+	/**
+	 * Makes the texture's queued prefetch conversion high-priority, since it's needed now.
+	 */
+	void PrioritizeConversion(const CTexturePtr& texture)
 	{
-		archiveCachePath = m_CacheLoader.ArchiveCachePath(sourcePath);
+		m_TextureConverter.Prioritize(texture);
+	}
 
-		CTextureProperties textureProps(sourcePath);
-		CTexturePtr texture = CreateTexture(textureProps);
-		CTextureConverter::Settings settings = GetConverterSettings(texture);
+	bool GenerateCachedTextures(const std::vector<VfsPath>& sourcePaths, std::vector<VfsPath>& archiveCachePaths)
+	{
+		archiveCachePaths.resize(sourcePaths.size());
 
-		if (!m_TextureConverter.ConvertTexture(texture, sourcePath, VfsPath("cache") / archiveCachePath, settings))
-			return false;
+		// Keep enough requests queued to keep all the converter threads busy,
+		// but don't load every source texture into memory at once
+		const size_t maxQueued = 2 * m_TextureConverter.GetNumThreads();
 
-		while (true)
+		bool allOk = true;
+		size_t next = 0;
+		size_t numQueued = 0;
+		while (next < sourcePaths.size() || numQueued > 0)
 		{
+			if (next < sourcePaths.size() && numQueued < maxQueued)
+			{
+				const VfsPath& sourcePath = sourcePaths[next];
+				archiveCachePaths[next] = m_CacheLoader.ArchiveCachePath(sourcePath);
+
+				CTextureProperties textureProps(sourcePath);
+				CTexturePtr texture = CreateTexture(textureProps);
+				CTextureConverter::Settings settings = GetConverterSettings(texture);
+
+				if (m_TextureConverter.ConvertTexture(texture, sourcePath, VfsPath("cache") / archiveCachePaths[next], settings))
+					++numQueued;
+				else
+					allOk = false;
+
+				++next;
+				continue;
+			}
+
 			CTexturePtr textureOut;
 			VfsPath dest;
 			bool ok;
 			if (m_TextureConverter.Poll(textureOut, dest, ok))
-				return ok;
+			{
+				--numQueued;
+				if (!ok)
+				{
+					LOGERROR(L"Texture failed to convert: \"%ls\"", textureOut->m_Properties.m_Path.string().c_str());
+					allOk = false;
+				}
+				continue;
+			}
 
 			// Spin-loop is dumb but it works okay for now
-			SDL_Delay(0);
+			SDL_Delay(1);
 		}
+
+		return allOk;
 	}
 
 	bool MakeProgress()
 	{
+		// Finish loading any prefetched textures whose files have been read
+		// (this also runs any other completed asynchronous VFS loads)
+		if (m_VFS->PollAsyncLoads())
+			return true;
+
+		if (!m_DecodeQueue.empty())
+		{
+			DecodeTextures();
+			return true;
+		}
+
+		if (!m_UploadQueue.empty() && m_UploadedBytes < m_UploadBudget)
+		{
+			UploadTexture();
+			return true;
+		}
+
 		// Process any completed conversion tasks
 		{
 			CTexturePtr texture;
@@ -352,8 +726,10 @@ public:
 			}
 		}
 
-		// We'll only push new conversion requests if it's not already busy
-		bool converterBusy = m_TextureConverter.IsBusy();
+		// We'll only push new conversion requests if there aren't already enough
+		// queued to keep all the converter threads busy (so that a texture that's
+		// needed later won't be stuck behind lots of prefetched ones)
+		bool converterBusy = (m_TextureConverter.GetNumQueued() >= m_TextureConverter.GetNumThreads());
 
 		if (!converterBusy)
 		{
@@ -367,28 +743,33 @@ public:
 				{
 					// Start converting this texture
 					(*it)->m_State = CTexture::HIGH_IS_CONVERTING;
-					ConvertTexture(*it);
+					ConvertTexture(*it, true);
 					return true;
 				}
 			}
 		}
 
-		// Try loading prefetched textures from their cache
+		// Start loading all prefetched textures from their cache. (Issuing them
+		// together lets the VFS read them in the order they're stored on disk.)
+		bool startedLoading = false;
 		for (TextureCache::iterator it = m_TextureCache.begin(); it != m_TextureCache.end(); ++it)
 		{
 			if ((*it)->m_State == CTexture::PREFETCH_NEEDS_LOADING)
 			{
-				if (TryLoadingCached(*it))
+				if (TryLoadingCached(*it, true))
 				{
-					(*it)->m_State = CTexture::LOADED;
+					if ((*it)->m_State != CTexture::PREFETCH_IS_LOADING)
+						(*it)->m_State = CTexture::LOADED;
 				}
 				else
 				{
 					(*it)->m_State = CTexture::PREFETCH_NEEDS_CONVERTING;
 				}
-				return true;
+				startedLoading = true;
 			}
 		}
+		if (startedLoading)
+			return true;
 
 		// If we've got nothing better to do, then start converting prefetched textures.
 		if (!converterBusy)
@@ -398,15 +779,114 @@ public:
 				if ((*it)->m_State == CTexture::PREFETCH_NEEDS_CONVERTING)
 				{
 					(*it)->m_State = CTexture::PREFETCH_IS_CONVERTING;
-					ConvertTexture(*it);
+					ConvertTexture(*it, false);
 					return true;
 				}
 			}
 		}
 
+		// Nothing more to do this frame, so the next frame can
+		// upload more textures
+		m_UploadedBytes = 0;
+
 		return false;
 	}
 
+	/**
+	 * Update the record of the video memory used by the texture, after its
+	 * handle or uploaded levels have changed.
+	 */
+	void UpdateUploadedSize(CTexture& texture)
+	{
+		size_t size = 0;
+		if (!m_DisableGL && texture.m_Handle > 0 && texture.m_Handle != m_DefaultHandle && texture.m_Handle != m_ErrorHandle)
+			(void)ogl_tex_get_uploaded_size(texture.m_Handle, &size);
+
+		m_BytesUploaded = m_BytesUploaded - texture.m_UploadedSize + size;
+		texture.m_UploadedSize = size;
+	}
+
+	void BeginFrame()
+	{
+		++m_Frame;
+
+		// (Don't bother checking every frame, since it takes a while for
+		// reduced textures to be reloaded anyway)
+		if (m_MemoryBudget && m_BytesUploaded > m_MemoryBudget && m_Frame % 32 == 0)
+			ReduceTextures();
+	}
+
+	/**
+	 * Drop the top mipmap level of the least recently used textures, until
+	 * the uploaded textures are expected to fit within the budget.
+	 */
+	void ReduceTextures()
+	{
+		PROFILE2("reduce textures");
+
+		// The reduced textures are loaded in the background, and the current
+		// ones are used until then, so allow for any that are still on their way
+		// (dropping the top level saves about 3/4 of the memory)
+		size_t expectedBytes = m_BytesUploaded;
+
+		std::vector<std::pair<u32, CTexture*> > candidates;
+		for (TextureCache::iterator it = m_TextureCache.begin(); it != m_TextureCache.end(); ++it)
+		{
+			CTexture& texture = **it;
+			if (texture.m_UploadedSize == 0)
+				continue;
+
+			if (texture.m_Reduced)
+			{
+				if (texture.m_State != CTexture::LOADED)
+					expectedBytes -= texture.m_UploadedSize * 3 / 4;
+				continue;
+			}
+
+			if (texture.m_State != CTexture::LOADED || m_Frame - texture.m_LastUsedFrame < m_EvictFrames)
+				continue;
+
+			// Only textures with mipmaps can drop their top level
+			size_t flags = 0;
+			(void)ogl_tex_get_format(texture.m_Handle, &flags, NULL);
+			if (!(flags & TEX_MIPMAPS))
+				continue;
+
+			candidates.push_back(std::make_pair(texture.m_LastUsedFrame, &texture));
+		}
+
+		std::sort(candidates.begin(), candidates.end());
+
+		for (size_t i = 0; i < candidates.size() && expectedBytes > m_MemoryBudget; ++i)
+		{
+			CTexture& texture = *candidates[i].second;
+			expectedBytes -= texture.m_UploadedSize * 3 / 4;
+
+			// Load it again at half resolution
+			texture.m_Reduced = true;
+			texture.m_State = CTexture::PREFETCH_NEEDS_LOADING;
+		}
+	}
+
+	size_t GetBytesUploaded() const
+	{
+		return m_BytesUploaded;
+	}
+
+	size_t GetMemoryBudget() const
+	{
+		return m_MemoryBudget;
+	}
+
+	size_t GetNumReducedTextures() const
+	{
+		size_t count = 0;
+		for (TextureCache::const_iterator it = m_TextureCache.begin(); it != m_TextureCache.end(); ++it)
+			if ((*it)->m_Reduced)
+				++count;
+		return count;
+	}
+
 	/**
 	 * Compute the conversion settings that apply to a given texture, by combining
 	 * the textures.xml files from its directory and all parent directories
@@ -472,7 +952,9 @@ public:
 			{
 				if (shared_ptr<CTexture> texture = it->lock())
 				{
+					CancelAsyncLoad(*texture);
 					texture->m_State = CTexture::UNLOADED;
+					texture->m_Reduced = false;
 					texture->SetHandle(m_DefaultHandle);
 				}
 			}
@@ -491,6 +973,60 @@ private:
 	Handle m_ErrorHandle;
 	CTexturePtr m_ErrorTexture;
 
+	// Prefetched files that have been loaded and are waiting to be decoded
+	struct PendingDecode
+	{
+		boost::weak_ptr<CTexture> texture;
+		VfsPath path;
+		shared_ptr<u8> fileContents;
+		size_t size;
+		Tex tex;
+		Status ret;
+	};
+	std::vector<PendingDecode> m_DecodeQueue;
+
+	// Decodes the files in m_DecodeQueue (they're independent, so they can
+	// be done in parallel)
+	class DecodeTask : public CThreadPool::ITask
+	{
+	public:
+		DecodeTask(std::vector<PendingDecode>& items) : m_Items(items) { }
+
+		virtual void Run(size_t index)
+		{
+			PendingDecode& item = m_Items[index];
+			item.ret = tex_decode(item.fileContents, item.size, &item.tex);
+		}
+
+	private:
+		std::vector<PendingDecode>& m_Items;
+	};
+
+	// Decoded prefetched textures that are being uploaded to GL, a few levels
+	// at a time. The handle is owned by the queue until its first levels have
+	// been uploaded, and by the texture after that.
+	struct PendingUpload
+	{
+		boost::weak_ptr<CTexture> texture;
+		Handle handle;
+		bool owned; // whether the texture has taken ownership of the handle
+	};
+	std::deque<PendingUpload> m_UploadQueue;
+
+	// Maximum number of bytes of prefetched textures to upload per frame
+	size_t m_UploadBudget;
+	// Number uploaded so far this frame (reset once MakeProgress runs out of work)
+	size_t m_UploadedBytes;
+
+	// Number of BeginFrame calls so far
+	u32 m_Frame;
+	// Maximum video memory to use for textures before reducing them (0 for no limit)
+	size_t m_MemoryBudget;
+	// Number of frames a texture must be unused for before it can be reduced
+	u32 m_EvictFrames;
+	// Total video memory used by all the textures' handles
+	size_t m_BytesUploaded;
+
 	// Cache of all loaded textures
 	typedef boost::unordered_set<CTexturePtr, TPhash, TPequal_to > TextureCache;
 	TextureCache m_TextureCache;
@@ -507,7 +1043,8 @@ private:
 };
 
 CTexture::CTexture(Handle handle, const CTextureProperties& props, CTextureManagerImpl* textureManager) :
-	m_Handle(handle), m_BaseColour(0), m_State(UNLOADED), m_Properties(props), m_TextureManager(textureManager)
+	m_Handle(handle), m_BaseColour(0), m_LastUsedFrame(0), m_UploadedSize(0), m_Reduced(false),
+	m_State(UNLOADED), m_Properties(props), m_TextureManager(textureManager), m_AsyncLoad(0)
 {
 	// Add a reference to the handle (it might be shared by multiple CTextures
 	// so we can't take ownership of it)
@@ -532,6 +1069,16 @@ Handle CTexture::GetHandle()
 	// on texture unit 0, regardless of 'unit', which callers might
 	// not be expecting. Ideally that wouldn't happen.
 
+	m_LastUsedFrame = m_TextureManager->m_Frame;
+
+	// If it was reduced to save memory, stream it back in at full resolution
+	if (m_Reduced)
+	{
+		m_Reduced = false;
+		if (m_State == LOADED)
+			m_State = PREFETCH_NEEDS_LOADING;
+	}
+
 	TryLoad();
 
 	return m_Handle;
@@ -541,16 +1088,31 @@ bool CTexture::TryLoad()
 {
 	// If we haven't started loading, then try loading, and if that fails then request conversion.
 	// If we have already tried prefetch loading, and it failed, bump the conversion request to HIGH priority.
-	if (m_State == UNLOADED || m_State == PREFETCH_NEEDS_LOADING || m_State == PREFETCH_NEEDS_CONVERTING)
+	// If we're already loading the prefetched file in the background, stop and load it now instead.
+	// (Once it's loaded, it's left to finish decoding and uploading in the background.)
+	// If we're just reloading it at a different resolution, keep using the old one until then.
+	if ((m_State == UNLOADED || m_State == PREFETCH_NEEDS_LOADING || m_State == PREFETCH_IS_LOADING || m_State == PREFETCH_NEEDS_CONVERTING)
+		&& m_UploadedSize == 0)
 	{
 		if (shared_ptr<CTexture> self = m_Self.lock())
 		{
+			m_TextureManager->CancelAsyncLoad(*this);
+
 			if (m_State != PREFETCH_NEEDS_CONVERTING && m_TextureManager->TryLoadingCached(self))
 				m_State = LOADED;
 			else
 				m_State = HIGH_NEEDS_CONVERTING;
 		}
 	}
+	// If its prefetch conversion hasn't been started yet, do it before the other prefetched ones
+	else if (m_State == PREFETCH_IS_CONVERTING)
+	{
+		if (shared_ptr<CTexture> self = m_Self.lock())
+		{
+			m_TextureManager->PrioritizeConversion(self);
+			m_State = HIGH_IS_CONVERTING;
+		}
+	}
 
 	return (m_State == LOADED);
 }
@@ -581,6 +1143,8 @@ void CTexture::SetHandle(Handle handle, bool takeOwnership)
 
 	ogl_tex_free(m_Handle);
 	m_Handle = handle;
+
+	m_TextureManager->UpdateUploadedSize(*this);
 }
 
 size_t CTexture::GetWidth() const
@@ -612,8 +1176,8 @@ u32 CTexture::GetBaseColour() const
 
 // CTextureManager: forward all calls to impl:
 
-CTextureManager::CTextureManager(PIVFS vfs, bool highQuality, bool disableGL) :
-	m(new CTextureManagerImpl(vfs, highQuality, disableGL))
+CTextureManager::CTextureManager(PIVFS vfs, bool highQuality, bool disableGL, size_t numConverterThreads) :
+	m(new CTextureManagerImpl(vfs, highQuality, disableGL, numConverterThreads))
 {
 }
 
@@ -637,7 +1201,40 @@ bool CTextureManager::MakeProgress()
 	return m->MakeProgress();
 }
 
+void CTextureManager::BeginFrame()
+{
+	m->BeginFrame();
+}
+
+size_t CTextureManager::GetBytesUploaded() const
+{
+	return m->GetBytesUploaded();
+}
+
+size_t CTextureManager::GetBytesBudget() const
+{
+	return m->GetMemoryBudget();
+}
+
+size_t CTextureManager::GetNumReducedTextures() const
+{
+	return m->GetNumReducedTextures();
+}
+
+bool CTextureManager::LoadTextureData(const CTexturePtr& texture, Tex& tex)
+{
+	return m->LoadTextureData(texture, tex);
+}
+
 bool CTextureManager::GenerateCachedTexture(const VfsPath& path, VfsPath& outputPath)
 {
-	return m->GenerateCachedTexture(path, outputPath);
+	std::vector<VfsPath> outputPaths;
+	bool ok = m->GenerateCachedTextures(std::vector<VfsPath>(1, path), outputPaths);
+	outputPath = outputPaths[0];
+	return ok;
+}
+
+bool CTextureManager::GenerateCachedTextures(const std::vector<VfsPath>& paths, std::vector<VfsPath>& outputPaths)
+{
+	return m->GenerateCachedTextures(paths, outputPaths);
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -28,6 +28,7 @@
 
 class CTextureProperties;
 class CTextureManagerImpl;
+struct Tex;
 
 /**
  * Texture manager with asynchronous loading and automatic DDS conversion/compression.
@@ -76,8 +77,10 @@ public:
 	 * loaded from this object.
 	 * highQuality is slower and intended for batch-conversion modes.
 	 * disableGL is intended for tests, and will disable all GL uploads.
+	 * numConverterThreads is the number of threads used for texture conversion
+	 * (more are only useful with GenerateCachedTextures).
 	 */
-	CTextureManager(PIVFS vfs, bool highQuality, bool disableGL);
+	CTextureManager(PIVFS vfs, bool highQuality, bool disableGL, size_t numConverterThreads = 1);
 
 	~CTextureManager();
 
@@ -98,9 +101,46 @@ public:
 	 * Returns true if it did any work.
 	 * The caller should typically loop this per frame until it returns
 	 * false or exceeds the allocated time for this frame.
+	 * Prefetched textures are decoded on the thread pool and uploaded a few
+	 * mipmap levels at a time (smallest first), limited to "textures.uploadbudget"
+	 * KiB per frame.
 	 */
 	bool MakeProgress();
 
+	/**
+	 * Call once at the start of each frame. If the video memory used by textures
+	 * exceeds the "textures.budget" config setting (in MiB), this reduces the
+	 * resolution of the textures that have been unused for longest (and for at
+	 * least "textures.evictframes" frames) by dropping their top mipmap level.
+	 * They're streamed back in at full resolution when they are next used.
+	 */
+	void BeginFrame();
+
+	/**
+	 * Returns the (approximate) number of bytes of video memory used by textures.
+	 */
+	size_t GetBytesUploaded() const;
+
+	/**
+	 * Returns the texture memory budget in bytes, or 0 if there is no budget.
+	 */
+	size_t GetBytesBudget() const;
+
+	/**
+	 * Returns the number of textures whose resolution has been reduced
+	 * to fit within the budget.
+	 */
+	size_t GetNumReducedTextures() const;
+
+	/**
+	 * Synchronously loads and decodes the texture's converted file into @p tex,
+	 * without uploading it, for callers that want to process the data themselves.
+	 * Returns false if there's no up-to-date converted file yet (it'll be
+	 * created when the texture is loaded normally) or it failed to load.
+	 * The caller must tex_free the data.
+	 */
+	bool LoadTextureData(const CTexturePtr& texture, Tex& tex);
+
 	/**
 	 * Synchronously converts and compresses and saves the texture,
 	 * and returns the output path (minus a "cache/" prefix). This
@@ -109,6 +149,14 @@ public:
 	 */
 	bool GenerateCachedTexture(const VfsPath& path, VfsPath& outputPath);
 
+	/**
+	 * Like GenerateCachedTexture, but for a batch of textures, which will be
+	 * converted concurrently on all the converter threads.
+	 * outputPaths[i] is set to the output path of paths[i].
+	 * @return true if all the textures were converted successfully
+	 */
+	bool GenerateCachedTextures(const std::vector<VfsPath>& paths, std::vector<VfsPath>& outputPaths);
+
 private:
 	CTextureManagerImpl* m;
 };
@@ -269,9 +317,22 @@ private:
 	Handle m_Handle;
 	u32 m_BaseColour;
 
+	// Frame number when GetHandle was last called (i.e. the texture was last used)
+	u32 m_LastUsedFrame;
+
+	// Video memory used by m_Handle (0 if it's the default or error texture)
+	size_t m_UploadedSize;
+
+	// Whether the texture is (or is being reloaded as) half resolution
+	// to save memory
+	bool m_Reduced;
+
 	enum {
 		UNLOADED, // loading has not started
 		PREFETCH_NEEDS_LOADING, // was prefetched; currently waiting to try loading from cache
+		PREFETCH_IS_LOADING, // was prefetched; cached file is currently being loaded asynchronously
+		PREFETCH_IS_DECODING, // was prefetched; cached file has been loaded and is waiting to be decoded
+		PREFETCH_IS_UPLOADING, // was prefetched; mipmap levels are being uploaded over several frames
 		PREFETCH_NEEDS_CONVERTING, // was prefetched; currently waiting to be sent to the texture converter
 		PREFETCH_IS_CONVERTING, // was prefetched; currently being processed by the texture converter
 		HIGH_NEEDS_CONVERTING, // high-priority; currently waiting to be sent to the texture converter
@@ -281,6 +342,9 @@ private:
 
 	CTextureManagerImpl* m_TextureManager;
 
+	// ID of the pending asynchronous VFS load (if PREFETCH_IS_LOADING), else 0
+	u32 m_AsyncLoad;
+
 	// Self-reference to let us recover the CTexturePtr for this object.
 	// (weak pointer to avoid cycles)
 	boost::weak_ptr<CTexture> m_Self;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,11 +27,18 @@
 #include "lib/rand.h"
 #include "ps/CStr.h"
 #include "ps/Game.h"
+#include "renderer/Renderer.h"
 #include "simulation2/Simulation2.h"
 #include "simulation2/components/ICmpSoundManager.h"
 
 // Randomly modify the speed, so that units won't stay perfectly
 // synchronised if they're playing animations of the same length
+// Distances from the camera beyond which animations are only updated every
+// second and every fourth frame. Rebuilding the bone matrices and skinned
+// vertices is expensive, and the lower rate is hard to notice at that distance.
+static const float ANIM_LOD_DISTANCE_2 = 150.f;
+static const float ANIM_LOD_DISTANCE_4 = 250.f;
+
 static float DesyncSpeed(float speed, float desync)
 {
 	if (desync == 0.0f)
@@ -42,7 +49,8 @@ static float DesyncSpeed(float speed, float desync)
 
 CUnitAnimation::CUnitAnimation(entity_id_t ent, CModel* model, CObjectEntry* object)
 	: m_Entity(ent), m_State("idle"), m_Looping(true),
-	  m_Speed(1.f), m_SyncRepeatTime(0.f), m_OriginalSpeed(1.f), m_Desync(0.f)
+	  m_Speed(1.f), m_SyncRepeatTime(0.f), m_OriginalSpeed(1.f), m_Desync(0.f),
+	  m_LODFrame(0), m_LODTime(0.f)
 {
 	ReloadUnit(model, object);
 }
@@ -89,6 +97,9 @@ void CUnitAnimation::ReloadUnit(CModel* model, const CObjectEntry* object)
 
 	m_AnimStates.clear();
 	AddModel(m_Model, m_Object);
+
+	// Skipped time doesn't apply to the new animations
+	m_LODTime = 0.f;
 }
 
 void CUnitAnimation::SetAnimationState(const CStr& name, bool once, float speed, float desync, const CStrW& actionSound)
@@ -144,8 +155,39 @@ void CUnitAnimation::SetAnimationSyncOffset(float actionTime)
 	}
 }
 
+bool CUnitAnimation::IsStatic() const
+{
+	for (std::vector<SModelAnimState>::const_iterator it = m_AnimStates.begin(); it != m_AnimStates.end(); ++it)
+		if (it->anims[it->animIdx]->m_AnimDef)
+			return false;
+	return true;
+}
+
+u32 CUnitAnimation::GetLODInterval() const
+{
+	CVector3D cameraPos = g_Renderer.GetViewCamera().GetOrientation().GetTranslation();
+	float distSquared = (m_Model->GetTransform().GetTranslation() - cameraPos).LengthSquared();
+
+	if (distSquared > ANIM_LOD_DISTANCE_4*ANIM_LOD_DISTANCE_4)
+		return 4;
+	if (distSquared > ANIM_LOD_DISTANCE_2*ANIM_LOD_DISTANCE_2)
+		return 2;
+	return 1;
+}
+
 void CUnitAnimation::Update(float time)
 {
+	// Skip this update if the unit is far away, accumulating the time so
+	// the animation will still play at the right speed. (Units are updated on
+	// different frames, based on their entity IDs, to spread out the cost.)
+	m_LODTime += time;
+	++m_LODFrame;
+	if ((m_LODFrame + m_Entity) % GetLODInterval() != 0)
+		return;
+
+	time = m_LODTime;
+	m_LODTime = 0.f;
+
 	// Advance all of the prop models independently
 	for (std::vector<SModelAnimState>::iterator it = m_AnimStates.begin(); it != m_AnimStates.end(); ++it)
 	{
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -81,10 +81,18 @@ public:
 
 	/**
 	 * Advance the animation state.
+	 * Units far from the camera are only updated every few calls, with the
+	 * time accumulated in between (see GetLODInterval).
 	 * @param time advance time in msec
 	 */
 	void Update(float time);
 
+	/**
+	 * Returns whether none of the unit's models are currently animated (i.e. they
+	 * all have static animations), so Update won't change anything.
+	 */
+	bool IsStatic() const;
+
 	/**
 	 * Regenerate internal animation state from the models in the current unit.
 	 * This should be called whenever the unit is changed externally, to keep this in sync.
@@ -106,6 +114,12 @@ private:
 
 	void AddModel(CModel* model, const CObjectEntry* object);
 
+	/**
+	 * Returns how often (in calls to Update) the animation should be updated,
+	 * based on the unit's distance from the camera.
+	 */
+	u32 GetLODInterval() const;
+
 	entity_id_t m_Entity;
 	CModel* m_Model;
 	const CObjectEntry* m_Object;
@@ -116,6 +130,11 @@ private:
 	float m_SyncRepeatTime;
 	float m_Desync;
 	CStrW m_ActionSound;
+
+	// Animation LOD state: number of Update calls so far, and the time that
+	// has been skipped since the animation was last advanced
+	u32 m_LODFrame;
+	float m_LODTime;
 };
 
 #endif // INCLUDED_UNITANIMATION
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -65,6 +65,7 @@ void CUnitManager::RemoveUnit(CUnit* unit)
 	if (i!=m_Units.end()) {
 		m_Units.erase(i);
 	}
+	m_Quadtree.Remove(unit);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -83,6 +84,7 @@ void CUnitManager::DeleteAll()
 		delete m_Units[i];
 	}
 	m_Units.clear();
+	m_Quadtree.Clear();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -25,6 +25,8 @@
 #include <vector>
 #include <set>
 
+#include "graphics/UnitQuadtree.h"
+
 class CUnit;
 class CVector3D;
 class CObjectManager;
@@ -54,12 +56,18 @@ public:
 
 	// return the units
 	const std::vector<CUnit*>& GetUnits() const { return m_Units; }
+
+	// return the spatial index of the units to be rendered (units are
+	// automatically removed from it when they're removed from the world)
+	CUnitQuadtree& GetQuadtree() { return m_Quadtree; }
 	
 	void SetObjectManager(CObjectManager& objectManager) { m_ObjectManager = &objectManager; }
 
 private:
 	// list of all known units
 	std::vector<CUnit*> m_Units;
+	// units that should be rendered, in a form that's quick to cull
+	CUnitQuadtree m_Quadtree;
 	// graphical object manager; may be NULL if not set up
 	CObjectManager* m_ObjectManager;
 };
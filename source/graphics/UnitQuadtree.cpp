@@ -0,0 +1,256 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "UnitQuadtree.h"
+
+#include "graphics/Frustum.h"
+#include "graphics/Patch.h"
+#include "graphics/Terrain.h"
+#include "graphics/Unit.h"
+#include "maths/MathUtil.h"
+#include "renderer/Scene.h"
+
+#include <algorithm>
+
+// Size of each cell in world-space units
+static const float CELL_SIZE = PATCH_SIZE * TERRAIN_TILE_SIZE;
+
+// Limit on the size of the grid, so units with absurd positions don't make it
+// huge (they just get clamped into the edge cells)
+static const size_t MAX_CELLS_PER_SIDE = 1024;
+
+CUnitQuadtree::CUnitQuadtree() :
+	m_CellsPerSide(0)
+{
+}
+
+void CUnitQuadtree::Clear()
+{
+	m_Units.clear();
+	m_Cells.clear();
+	m_NodeBounds.clear();
+	m_NodeDirty.clear();
+	m_DirtyNodes.clear();
+	m_CellsPerSide = 0;
+}
+
+size_t CUnitQuadtree::GetCell(const CBoundingBoxAligned& bounds) const
+{
+	CVector3D centre;
+	bounds.GetCentre(centre);
+	ssize_t i = clamp((ssize_t)(centre.X / CELL_SIZE), (ssize_t)0, (ssize_t)m_CellsPerSide - 1);
+	ssize_t j = clamp((ssize_t)(centre.Z / CELL_SIZE), (ssize_t)0, (ssize_t)m_CellsPerSide - 1);
+	return j*m_CellsPerSide + i;
+}
+
+void CUnitQuadtree::AddToCell(SUnit* entry)
+{
+	m_Cells[entry->cell].push_back(entry);
+	MarkDirty(0, entry->cell);
+}
+
+void CUnitQuadtree::RemoveFromCell(SUnit* entry)
+{
+	std::vector<SUnit*>& units = m_Cells[entry->cell];
+	std::vector<SUnit*>::iterator it = std::find(units.begin(), units.end(), entry);
+	ENSURE(it != units.end());
+	*it = units.back();
+	units.pop_back();
+	MarkDirty(0, entry->cell);
+}
+
+void CUnitQuadtree::MarkDirty(size_t level, size_t index)
+{
+	if (!m_NodeDirty[level][index])
+	{
+		m_NodeDirty[level][index] = 1;
+		m_DirtyNodes[level].push_back(index);
+	}
+}
+
+void CUnitQuadtree::Resize(size_t cellsPerSide)
+{
+	m_CellsPerSide = cellsPerSide;
+	m_Cells.clear();
+	m_Cells.resize(cellsPerSide*cellsPerSide);
+
+	m_NodeBounds.clear();
+	m_NodeDirty.clear();
+	m_DirtyNodes.clear();
+	for (size_t n = cellsPerSide; n > 0; n /= 2)
+	{
+		m_NodeBounds.push_back(std::vector<CBoundingBoxAligned>(n*n));
+		m_NodeDirty.push_back(std::vector<char>(n*n, 0));
+		m_DirtyNodes.push_back(std::vector<size_t>());
+	}
+
+	// Put the existing units into the new cells
+	for (std::map<CUnit*, SUnit>::iterator it = m_Units.begin(); it != m_Units.end(); ++it)
+	{
+		it->second.cell = GetCell(it->second.bounds);
+		AddToCell(&it->second);
+	}
+}
+
+void CUnitQuadtree::Update(CUnit* unit, const CBoundingBoxAligned& bounds)
+{
+	// Grow the grid if the unit is beyond its edge
+	CVector3D centre;
+	bounds.GetCentre(centre);
+	float extent = std::max(centre.X, centre.Z) / CELL_SIZE;
+	if (m_CellsPerSide == 0 || (extent >= m_CellsPerSide && m_CellsPerSide < MAX_CELLS_PER_SIDE))
+	{
+		size_t cellsPerSide = std::max(m_CellsPerSide, (size_t)1);
+		while (extent >= cellsPerSide && cellsPerSide < MAX_CELLS_PER_SIDE)
+			cellsPerSide *= 2;
+		Resize(cellsPerSide);
+	}
+
+	std::map<CUnit*, SUnit>::iterator it = m_Units.find(unit);
+	if (it == m_Units.end())
+	{
+		SUnit& entry = m_Units[unit];
+		entry.unit = unit;
+		entry.bounds = bounds;
+		entry.cell = GetCell(bounds);
+		AddToCell(&entry);
+		return;
+	}
+
+	// Most units don't move in most frames, so avoid recomputing their nodes
+	SUnit& entry = it->second;
+	if (entry.bounds[0] == bounds[0] && entry.bounds[1] == bounds[1])
+		return;
+
+	entry.bounds = bounds;
+	size_t cell = GetCell(bounds);
+	if (cell != entry.cell)
+	{
+		RemoveFromCell(&entry);
+		entry.cell = cell;
+		AddToCell(&entry);
+	}
+	else
+	{
+		MarkDirty(0, cell);
+	}
+}
+
+void CUnitQuadtree::Remove(CUnit* unit)
+{
+	std::map<CUnit*, SUnit>::iterator it = m_Units.find(unit);
+	if (it == m_Units.end())
+		return;
+
+	RemoveFromCell(&it->second);
+	m_Units.erase(it);
+}
+
+void CUnitQuadtree::UpdateBounds()
+{
+	for (size_t level = 0; level < m_NodeBounds.size(); ++level)
+	{
+		const size_t n = m_CellsPerSide >> level;
+		std::vector<size_t>& dirty = m_DirtyNodes[level];
+		for (size_t d = 0; d < dirty.size(); ++d)
+		{
+			const size_t index = dirty[d];
+			CBoundingBoxAligned& nodeBounds = m_NodeBounds[level][index];
+			nodeBounds.SetEmpty();
+
+			if (level == 0)
+			{
+				const std::vector<SUnit*>& units = m_Cells[index];
+				for (size_t k = 0; k < units.size(); ++k)
+					nodeBounds += units[k]->bounds;
+			}
+			else
+			{
+				// Combine the four children in the level below
+				const size_t i = index % n, j = index / n;
+				const std::vector<CBoundingBoxAligned>& children = m_NodeBounds[level-1];
+				for (size_t cj = 0; cj < 2; ++cj)
+					for (size_t ci = 0; ci < 2; ++ci)
+					{
+						const CBoundingBoxAligned& child = children[(j*2 + cj)*n*2 + i*2 + ci];
+						if (!child.IsEmpty())
+							nodeBounds += child;
+					}
+			}
+
+			m_NodeDirty[level][index] = 0;
+			if (level + 1 < m_NodeBounds.size())
+				MarkDirty(level + 1, (index / n / 2)*(n / 2) + (index % n) / 2);
+		}
+		dirty.clear();
+	}
+}
+
+void CUnitQuadtree::RenderSubmit(SceneCollector& collector, const CFrustum& frustum, bool culling)
+{
+	if (!culling)
+	{
+		for (std::map<CUnit*, SUnit>::iterator it = m_Units.begin(); it != m_Units.end(); ++it)
+			collector.SubmitRecursive(&it->first->GetModel());
+		return;
+	}
+
+	if (m_NodeBounds.empty())
+		return;
+
+	UpdateBounds();
+
+	// The nodes are all tested against the same planes, so copy them into the
+	// SIMD-friendly layout once
+	const CFrustumSoA planes(frustum);
+	SubmitNode(collector, frustum, planes, m_NodeBounds.size() - 1, 0, 0, false);
+}
+
+void CUnitQuadtree::SubmitNode(SceneCollector& collector, const CFrustum& frustum, const CFrustumSoA& planes, size_t level, size_t i, size_t j, bool inside)
+{
+	const size_t n = m_CellsPerSide >> level;
+	const CBoundingBoxAligned& bounds = m_NodeBounds[level][j*n + i];
+	if (bounds.IsEmpty())
+		return;
+
+	// Once a node is entirely inside the frustum, so is everything beneath it
+	if (!inside)
+	{
+		if (!planes.IsBoxVisible(bounds))
+			return;
+		inside = planes.IsBoxFullyVisible(bounds);
+	}
+
+	if (level > 0)
+	{
+		for (size_t cj = 0; cj < 2; ++cj)
+			for (size_t ci = 0; ci < 2; ++ci)
+				SubmitNode(collector, frustum, planes, level - 1, i*2 + ci, j*2 + cj, inside);
+		return;
+	}
+
+	const std::vector<SUnit*>& units = m_Cells[j*n + i];
+	for (size_t k = 0; k < units.size(); ++k)
+	{
+		if (inside)
+			collector.SubmitRecursive(&units[k]->unit->GetModel());
+		else
+			collector.SubmitRecursiveCulled(&units[k]->unit->GetModel(), units[k]->bounds, frustum);
+	}
+}
@@ -0,0 +1,106 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_UNITQUADTREE
+#define INCLUDED_UNITQUADTREE
+
+#include "maths/BoundingBoxAligned.h"
+
+#include <map>
+#include <vector>
+
+class CFrustum;
+class CFrustumSoA;
+class CUnit;
+class SceneCollector;
+
+/**
+ * Spatial index of the units that should be rendered, so they can be culled
+ * against the view frustum without testing each one individually.
+ *
+ * The world is split into a grid of cells the size of a terrain patch, and each
+ * unit is stored in the cell containing the centre of its bounds. The cells
+ * are the leaves of a quadtree, where each node's bounds are the union of its
+ * units' bounds (so units don't have to fit inside their cell). Nodes that are
+ * entirely outside the frustum are skipped, and units in nodes that are entirely
+ * inside it are submitted without being tested.
+ *
+ * Units are updated incrementally as they move: only the nodes containing
+ * changed units have their bounds recomputed.
+ */
+class CUnitQuadtree
+{
+	NONCOPYABLE(CUnitQuadtree);
+public:
+	CUnitQuadtree();
+
+	/**
+	 * Add @p unit to the tree, or move it if it's already there.
+	 * @param bounds world-space bounds of the unit's model, including props
+	 */
+	void Update(CUnit* unit, const CBoundingBoxAligned& bounds);
+
+	/**
+	 * Remove @p unit from the tree, if it's there.
+	 */
+	void Remove(CUnit* unit);
+
+	/**
+	 * Remove all units.
+	 */
+	void Clear();
+
+	/**
+	 * Submit the models of all the units that are visible in @p frustum
+	 * (or of all units, if @p culling is false).
+	 */
+	void RenderSubmit(SceneCollector& collector, const CFrustum& frustum, bool culling);
+
+private:
+	struct SUnit
+	{
+		CUnit* unit;
+		CBoundingBoxAligned bounds;
+		size_t cell;
+	};
+
+	size_t GetCell(const CBoundingBoxAligned& bounds) const;
+	void AddToCell(SUnit* entry);
+	void RemoveFromCell(SUnit* entry);
+	void MarkDirty(size_t level, size_t index);
+	void Resize(size_t cellsPerSide);
+	void UpdateBounds();
+	void SubmitNode(SceneCollector& collector, const CFrustum& frustum, const CFrustumSoA& planes, size_t level, size_t i, size_t j, bool inside);
+
+	std::map<CUnit*, SUnit> m_Units;
+
+	// Number of cells along each side of the grid (a power of two)
+	size_t m_CellsPerSide;
+
+	// Units in each cell (pointing into m_Units), indexed by j*m_CellsPerSide + i
+	std::vector<std::vector<SUnit*> > m_Cells;
+
+	// Bounds of the nodes at each level of the tree, where level 0 is the cells
+	// and each level has half as many nodes along each side as the one below
+	std::vector<std::vector<CBoundingBoxAligned> > m_NodeBounds;
+
+	// Nodes at each level whose bounds need to be recomputed
+	std::vector<std::vector<char> > m_NodeDirty;
+	std::vector<std::vector<size_t> > m_DirtyNodes;
+};
+
+#endif // INCLUDED_UNITQUADTREE
@@ -0,0 +1,164 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "graphics/Frustum.h"
+#include "maths/BoundingBoxAligned.h"
+#include "maths/Vector3DSoA.h"
+
+class TestFrustum : public CxxTest::TestSuite
+{
+	// A unit cube frustum, plus an arbitrary diagonal plane
+	void SetupFrustum(CFrustum& frustum)
+	{
+		frustum.AddPlane(CPlane(CVector4D(1, 0, 0, 0)));
+		frustum.AddPlane(CPlane(CVector4D(-1, 0, 0, 1)));
+		frustum.AddPlane(CPlane(CVector4D(0, 1, 0, 0)));
+		frustum.AddPlane(CPlane(CVector4D(0, -1, 0, 1)));
+		frustum.AddPlane(CPlane(CVector4D(0, 0, 1, 0)));
+		frustum.AddPlane(CPlane(CVector4D(0, 0, -1, 1)));
+		frustum.AddPlane(CPlane(CVector4D(-0.6f, 0.8f, 0, 0.5f)));
+	}
+
+public:
+	void test_box_fully_visible()
+	{
+		CFrustum frustum;
+		SetupFrustum(frustum);
+
+		CBoundingBoxAligned inside(CVector3D(0.1f, 0.1f, 0.1f), CVector3D(0.5f, 0.5f, 0.9f));
+		TS_ASSERT(frustum.IsBoxFullyVisible(inside));
+		TS_ASSERT(frustum.IsBoxVisible(CVector3D(0, 0, 0), inside));
+
+		CBoundingBoxAligned crossing(CVector3D(0.5f, 0.5f, 0.5f), CVector3D(1.5f, 0.6f, 0.6f));
+		TS_ASSERT(!frustum.IsBoxFullyVisible(crossing));
+		TS_ASSERT(frustum.IsBoxVisible(CVector3D(0, 0, 0), crossing));
+
+		// Inside the cube but behind the diagonal plane
+		CBoundingBoxAligned corner(CVector3D(0.95f, 0.0f, 0.1f), CVector3D(1.0f, 0.02f, 0.2f));
+		TS_ASSERT(!frustum.IsBoxFullyVisible(corner));
+		TS_ASSERT(!frustum.IsBoxVisible(CVector3D(0, 0, 0), corner));
+	}
+
+	void test_boxes_visible()
+	{
+		CFrustum frustum;
+		SetupFrustum(frustum);
+
+		// Boxes of various sizes on a grid around the frustum (including some
+		// that just touch its planes), with a count that isn't a multiple of 4
+		std::vector<CBoundingBoxAligned> boxes;
+		for (int i = -4; i <= 8; ++i)
+			for (int j = -4; j <= 8; ++j)
+				for (int k = -1; k <= 1; ++k)
+				{
+					CVector3D min(i * 0.25f, j * 0.25f, k * 0.75f);
+					float size = 0.05f + ((i + j + k) & 3) * 0.2f;
+					boxes.push_back(CBoundingBoxAligned(min, min + CVector3D(size, size * 0.5f, size)));
+				}
+		boxes.push_back(CBoundingBoxAligned(CVector3D(-10, -10, -10), CVector3D(10, 10, 10)));
+
+		std::vector<char> visible(boxes.size());
+		frustum.AreBoxesVisible(&boxes[0], boxes.size(), (bool*)&visible[0]);
+
+		size_t numVisible = 0;
+		for (size_t i = 0; i < boxes.size(); ++i)
+		{
+			TS_ASSERT_EQUALS(visible[i] != 0, frustum.IsBoxVisible(CVector3D(0, 0, 0), boxes[i]));
+			if (visible[i])
+				++numVisible;
+		}
+
+		// Make sure the test actually covers both cases
+		TS_ASSERT(numVisible > 0);
+		TS_ASSERT(numVisible < boxes.size());
+	}
+
+	void test_soa_planes()
+	{
+		// Try frusta with a multiple of 4 planes and without (so some are padding)
+		for (size_t numPlanes = 4; numPlanes <= 7; numPlanes += 3)
+		{
+			CFrustum full;
+			SetupFrustum(full);
+			CFrustum frustum;
+			for (size_t i = 0; i < numPlanes; ++i)
+				frustum.AddPlane(full[full.GetNumPlanes() - 1 - i]);
+
+			const CFrustumSoA planes(frustum);
+
+			size_t numVisible = 0, numFullyVisible = 0, count = 0;
+			for (int i = -4; i <= 8; ++i)
+				for (int j = -4; j <= 8; ++j)
+					for (int k = -4; k <= 8; ++k)
+					{
+						CVector3D min(i * 0.25f, j * 0.25f, k * 0.25f);
+						float size = 0.05f + ((i + j + k) & 3) * 0.1f;
+						CBoundingBoxAligned box(min, min + CVector3D(size, size * 0.5f, size));
+
+						bool visible = planes.IsBoxVisible(box);
+						TS_ASSERT_EQUALS(visible, frustum.IsBoxVisible(CVector3D(0, 0, 0), box));
+						bool fullyVisible = planes.IsBoxFullyVisible(box);
+						TS_ASSERT_EQUALS(fullyVisible, frustum.IsBoxFullyVisible(box));
+
+						numVisible += visible;
+						numFullyVisible += fullyVisible;
+						++count;
+					}
+
+			TS_ASSERT(numFullyVisible > 0);
+			TS_ASSERT(numFullyVisible < numVisible);
+			TS_ASSERT(numVisible < count);
+		}
+	}
+
+	void test_spheres_visible()
+	{
+		CFrustum frustum;
+		SetupFrustum(frustum);
+
+		// Spheres on a grid around the frustum, with a count that isn't a
+		// multiple of 4
+		CVector3DSoA centers;
+		std::vector<float> radii;
+		for (int i = -4; i <= 8; ++i)
+			for (int j = -4; j <= 8; ++j)
+				for (int k = -1; k <= 1; ++k)
+				{
+					centers.Resize(centers.GetSize() + 1);
+					centers.Set(centers.GetSize() - 1, CVector3D(i * 0.25f, j * 0.25f, k * 0.75f));
+					radii.push_back(0.05f + ((i + j + k) & 3) * 0.1f);
+				}
+		TS_ASSERT_EQUALS(centers.GetSize() % 4, (size_t)3);
+		TS_ASSERT_EQUALS(centers.GetPaddedSize(), centers.GetSize() + 1);
+
+		std::vector<char> visible(centers.GetSize());
+		frustum.AreSpheresVisible(centers, &radii[0], (bool*)&visible[0]);
+
+		size_t numVisible = 0;
+		for (size_t i = 0; i < centers.GetSize(); ++i)
+		{
+			TS_ASSERT_EQUALS(visible[i] != 0, frustum.IsSphereVisible(centers.Get(i), radii[i]));
+			if (visible[i])
+				++numVisible;
+		}
+
+		TS_ASSERT(numVisible > 0);
+		TS_ASSERT(numVisible < centers.GetSize());
+	}
+};
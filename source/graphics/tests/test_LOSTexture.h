@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -58,6 +58,31 @@ public:
 		TS_ASSERT_EQUALS(losData[0], 104);
 	}
 
+	void test_region()
+	{
+		CSimulation2 sim(NULL, NULL);
+		CLOSTexture tex(sim);
+
+		const ssize_t size = 37;
+		std::vector<u32> inputDataVec(size*size);
+		for (ssize_t i = 0; i < size*size; ++i)
+			inputDataVec[i] = (i*7 % 11 == 0 ? 2 : 0) | (i*5 % 3 == 0 ? 1 : 0);
+
+		ICmpRangeManager::CLosQuerier los(ICmpRangeManager::LOS_MASK, inputDataVec, size);
+
+		std::vector<u8> fullData(tex.GetBitmapSize(size, size));
+		tex.GenerateBitmap(los, &fullData[0], size, size);
+
+		// Regenerating part of the map must give the same results as the whole map
+		const size_t x0 = 5, y0 = 17, w = 23, h = 20;
+		std::vector<u8> regionData(tex.GetBitmapSize(w, h));
+		tex.GenerateBitmap(los, &regionData[0], w, h, x0, y0);
+
+		for (size_t j = 0; j < h; ++j)
+			for (size_t i = 0; i < w; ++i)
+				TS_ASSERT_EQUALS(regionData[i + j*(w+6)], fullData[x0+i + (y0+j)*(size+6)]);
+	}
+
 	void test_perf_DISABLED()
 	{
 		CSimulation2 sim(NULL, NULL);
@@ -0,0 +1,135 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "lib/file/file_system.h"
+#include "lib/file/vfs/vfs.h"
+#include "lib/allocators/shared_ptr.h"
+
+#include "graphics/MapAssetManifest.h"
+
+static OsPath MOD_PATH(DataDir()/"mods"/"_test.assets");
+
+extern PIVFS g_VFS;
+
+class TestMapAssetManifest : public CxxTest::TestSuite
+{
+	void writeFile(const VfsPath& path, const std::string& text)
+	{
+		shared_ptr<u8> buf;
+		AllocateAligned(buf, text.size(), maxSectorSize);
+		memcpy(buf.get(), text.data(), text.size());
+		TS_ASSERT_OK(g_VFS->CreateFile(path, buf, text.size()));
+	}
+
+	void loadFile(const VfsPath& path)
+	{
+		shared_ptr<u8> buf;
+		size_t size;
+		TS_ASSERT_OK(g_VFS->LoadFile(path, buf, size));
+	}
+
+public:
+	void setUp()
+	{
+		if (DirectoryExists(MOD_PATH))
+			DeleteDirectory(MOD_PATH);
+
+		g_VFS = CreateVfs(20*MiB);
+		TS_ASSERT_OK(g_VFS->Mount(L"", MOD_PATH));
+
+		writeFile(L"art/textures/a.png", "aaaa");
+		writeFile(L"audio/b.ogg", "bbbbbbbb");
+		writeFile(L"cache/art/meshes/c.pmd", "cc");
+		writeFile(L"maps/scenarios/Test.xml", "<Scenario/>");
+	}
+
+	void tearDown()
+	{
+		g_VFS.reset();
+		DeleteDirectory(MOD_PATH);
+	}
+
+	void test_paths()
+	{
+		TS_ASSERT_EQUALS(MapAssetManifestPath(L"maps/scenarios/Test.pmp"), VfsPath(L"maps/scenarios/Test.assets"));
+		TS_ASSERT_EQUALS(MapAssetManifestPath(L"maps/random/test.js"), VfsPath(L"maps/random/test.assets"));
+
+		TS_ASSERT(IsMapAsset(L"art/textures/a.png"));
+		TS_ASSERT(IsMapAsset(L"audio/b.ogg"));
+		TS_ASSERT(IsMapAsset(L"cache/art/meshes/c.pmd"));
+		TS_ASSERT(!IsMapAsset(L"maps/scenarios/Test.xml"));
+		TS_ASSERT(!IsMapAsset(L"cache/shaders/programs.txt"));
+	}
+
+	void test_record()
+	{
+		{
+			CMapAssetRecorder recorder(L"maps/scenarios/Test.pmp");
+			loadFile(L"audio/b.ogg");
+			loadFile(L"maps/scenarios/Test.xml");
+			loadFile(L"art/textures/a.png");
+			loadFile(L"audio/b.ogg");
+		}
+
+		VfsPaths pathnames;
+		LoadMapAssetManifest(L"maps/scenarios/Test.pmp", pathnames);
+		TS_ASSERT_EQUALS(pathnames.size(), (size_t)2);
+		if (pathnames.size() == 2)
+		{
+			TS_ASSERT_EQUALS(pathnames[0], VfsPath(L"audio/b.ogg"));
+			TS_ASSERT_EQUALS(pathnames[1], VfsPath(L"art/textures/a.png"));
+		}
+
+		// Files from earlier sessions are kept, after this session's
+		{
+			CMapAssetRecorder recorder(L"maps/scenarios/Test.pmp");
+			loadFile(L"cache/art/meshes/c.pmd");
+			loadFile(L"art/textures/a.png");
+		}
+
+		pathnames.clear();
+		LoadMapAssetManifest(L"maps/scenarios/Test.pmp", pathnames);
+		TS_ASSERT_EQUALS(pathnames.size(), (size_t)3);
+		if (pathnames.size() == 3)
+		{
+			TS_ASSERT_EQUALS(pathnames[0], VfsPath(L"cache/art/meshes/c.pmd"));
+			TS_ASSERT_EQUALS(pathnames[1], VfsPath(L"art/textures/a.png"));
+			TS_ASSERT_EQUALS(pathnames[2], VfsPath(L"audio/b.ogg"));
+		}
+
+		// Nothing is recorded after the recorder is destroyed
+		loadFile(L"art/textures/a.png");
+		pathnames.clear();
+		LoadMapAssetManifest(L"maps/random/test.js", pathnames);
+		TS_ASSERT(pathnames.empty());
+	}
+
+	void test_prefetch()
+	{
+		VfsPaths pathnames;
+		pathnames.push_back(L"art/textures/a.png");
+		pathnames.push_back(L"art/textures/missing.png");
+		pathnames.push_back(L"audio/b.ogg");
+
+		TS_ASSERT_EQUALS(PrefetchMapAssets(pathnames, 100), (size_t)12);
+
+		// Stops once the limit is reached
+		TS_ASSERT_EQUALS(PrefetchMapAssets(pathnames, 4), (size_t)4);
+	}
+};
@@ -0,0 +1,108 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "graphics/MapGeneratorHelpers.h"
+
+#include <boost/random/linear_congruential.hpp>
+
+class TestMapGeneratorHelpers : public CxxTest::TestSuite
+{
+	// Straightforward version of TileClass.countInRadius, tile by tile
+	// (including the way it handles rounding errors at the top and bottom)
+	size_t CountInRadiusSlow(const CMapGenTileClass& tileClass, double cx, double cz, double radius, bool members)
+	{
+		const int size = (int)tileClass.GetSize();
+		size_t count = 0;
+		for (double z = cz - radius; z <= cz + radius; z++)
+		{
+			const int iz = (int)floor(z);
+			if (iz < 0 || iz >= size)
+				continue;
+			const double dx = sqrt(radius*radius - (z - cz)*(z - cz));
+			const int minX = (dx == dx ? std::max((int)floor(cx - dx), 0) : 0);
+			const int maxX = (dx == dx ? std::min((int)floor(cx + dx), size - 1) : size - 1);
+			for (int x = minX; x <= maxX; ++x)
+				if (tileClass.Has(x, iz) == members)
+					++count;
+		}
+		return count;
+	}
+
+public:
+	void test_tileclass_basic()
+	{
+		CMapGenTileClass tileClass(16);
+		TS_ASSERT(!tileClass.Has(3, 4));
+
+		tileClass.Add(3, 4);
+		tileClass.Add(3, 4);
+		TS_ASSERT(tileClass.Has(3, 4));
+		tileClass.Remove(3, 4);
+		TS_ASSERT(tileClass.Has(3, 4));
+		tileClass.Remove(3, 4);
+		TS_ASSERT(!tileClass.Has(3, 4));
+
+		// Off-map tiles are ignored
+		tileClass.Add(-1, 0);
+		tileClass.Add(0, 16);
+		TS_ASSERT(!tileClass.Has(-1, 0));
+		TS_ASSERT_EQUALS(tileClass.CountInRadius(8, 8, 100, true), (size_t)0);
+		TS_ASSERT_EQUALS(tileClass.CountInRadius(8, 8, 100, false), (size_t)16*16);
+
+		tileClass.Add(8, 8);
+		TS_ASSERT_EQUALS(tileClass.CountInRadius(8, 8, 0, true), (size_t)1);
+		TS_ASSERT_EQUALS(tileClass.CountInRadius(8.5, 8.5, 1, true), (size_t)1);
+		TS_ASSERT_EQUALS(tileClass.CountInRadius(12, 12, 2, true), (size_t)0);
+	}
+
+	void test_tileclass_random()
+	{
+		boost::rand48 rng(1234);
+		CMapGenTileClass tileClass(64);
+		for (int i = 0; i < 1000; ++i)
+			tileClass.Add(rng() % 64, rng() % 64);
+		for (int i = 0; i < 300; ++i)
+			tileClass.Remove(rng() % 64, rng() % 64);
+
+		for (int i = 0; i < 200; ++i)
+		{
+			double cx = (rng() % 8000) / 100.0 - 8.0;
+			double cz = (rng() % 8000) / 100.0 - 8.0;
+			double radius = (rng() % 2000) / 100.0;
+			TS_ASSERT_EQUALS(tileClass.CountInRadius(cx, cz, radius, true), CountInRadiusSlow(tileClass, cx, cz, radius, true));
+			TS_ASSERT_EQUALS(tileClass.CountInRadius(cx, cz, radius, false), CountInRadiusSlow(tileClass, cx, cz, radius, false));
+		}
+	}
+
+	void test_smooth_heightmap()
+	{
+		std::vector<double> heights(3*3, 0.0);
+		heights[4] = 9.0;
+
+		// No strength means no change
+		std::vector<double> unchanged(heights);
+		MapGenSmoothHeightmap(unchanged, 3, 0.0);
+		TS_ASSERT_EQUALS(unchanged[4], 9.0);
+
+		MapGenSmoothHeightmap(heights, 3, 1.0);
+		TS_ASSERT_DELTA(heights[4], 1.0, 1e-12); // mean of all 9
+		TS_ASSERT_DELTA(heights[0], 9.0/4.0, 1e-12); // corner: mean of 4
+		TS_ASSERT_DELTA(heights[1], 9.0/6.0, 1e-12); // edge: mean of 6
+	}
+};
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -178,6 +178,42 @@ public:
 		// to check that
 	}
 
+	void test_load_dae_batch()
+	{
+		copyFile(srcDAE, testDAE);
+		copyFile(srcPMD, L"art/skeletons/test2.pmd");
+		copyFile(srcSkeletonDefs, testSkeletonDefs);
+
+		std::vector<VfsPath> names;
+		names.push_back(testBase);
+		names.push_back(L"art/skeletons/test2");
+		names.push_back(L"art/skeletons/nonexistent");
+		std::vector<VfsPath> paths;
+		colladaManager->GetLoadablePaths(names, CColladaManager::PMD, paths);
+		TS_ASSERT_EQUALS(paths.size(), (size_t)3);
+		TS_ASSERT_PATH_EQUALS(paths[0], colladaManager->GetLoadablePath(testBase, CColladaManager::PMD));
+		TS_ASSERT_PATH_EQUALS(paths[1], L"art/skeletons/test2.pmd");
+		TS_ASSERT(paths[2].empty());
+	}
+
+	void test_prefetch()
+	{
+		copyFile(srcDAE, testDAE);
+		copyFile(srcSkeletonDefs, testSkeletonDefs);
+
+		std::set<VfsPath> names;
+		names.insert(testDAE);
+		meshManager->PrefetchMeshes(names);
+
+		CModelDefPtr modeldef1 = meshManager->GetMesh(testDAE);
+		CModelDefPtr modeldef2 = meshManager->GetMesh(testBase);
+		TS_ASSERT(modeldef1);
+		TS_ASSERT_EQUALS(modeldef1.get(), modeldef2.get());
+
+		meshManager->ReleasePrefetchedMeshes();
+		TS_ASSERT_EQUALS(meshManager->GetMesh(testDAE).get(), modeldef1.get());
+	}
+
 	void test_invalid_skeletons()
 	{
 		TestLogger logger;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -93,6 +93,75 @@ public:
 		TS_ASSERT_DELTA(ground, 100.f/HEIGHT_UNITS_PER_METRE+20.f*TERRAIN_TILE_SIZE, 0.01f);
 	}
 
+	void test_GetExactGroundLevels()
+	{
+		CTerrain terrain;
+		terrain.Initialize(4, NULL);
+		Set45Slope(terrain);
+		SetHighPlateau(terrain, 20);
+		SetVertex(terrain, 7, 3, 3000);
+		SetVertex(terrain, 8, 2, 900);
+
+		// Points spread over the tiles with different triangulations, including some
+		// outside the map, and a count that's not a multiple of the SIMD width
+		std::vector<float> coords;
+		for (float z = -3.f; z < 12.f*TERRAIN_TILE_SIZE; z += 1.3f)
+		{
+			for (float x = -5.f; x < 80.f*TERRAIN_TILE_SIZE; x += 2.9f)
+			{
+				coords.push_back(x);
+				coords.push_back(z);
+			}
+		}
+		coords.push_back(1.5f*TERRAIN_TILE_SIZE);
+		coords.push_back(7.25f*TERRAIN_TILE_SIZE);
+		size_t n = coords.size() / 2;
+
+		std::vector<float> heights(n);
+		std::vector<CVector3D> normals(n);
+		terrain.GetExactGroundLevels(&coords[0], n, &heights[0], &normals[0]);
+
+		for (size_t i = 0; i < n; ++i)
+		{
+			TS_ASSERT_DELTA(heights[i], terrain.GetExactGroundLevel(coords[i*2], coords[i*2+1]), 0.001f);
+			CVector3D normal = terrain.CalcExactNormal(coords[i*2], coords[i*2+1]);
+			TS_ASSERT_DELTA(normals[i].X, normal.X, 0.0001f);
+			TS_ASSERT_DELTA(normals[i].Y, normal.Y, 0.0001f);
+			TS_ASSERT_DELTA(normals[i].Z, normal.Z, 0.0001f);
+		}
+	}
+
+	void test_GetFilteredGroundLevel_partial_update()
+	{
+		// Compare a terrain whose mipmap is only updated in the changed areas
+		// against one that recomputes the whole mipmap
+		CTerrain partial, full;
+		partial.Initialize(4, NULL);
+		full.Initialize(4, NULL);
+		ssize_t verts = partial.GetVerticesPerSide();
+
+		u32 seed = 1;
+		const ssize_t rects[][4] = { { 0, 0, 3, 2 }, { 17, 5, 30, 9 }, { 60, 61, 65, 65 }, { 31, 0, 33, 65 }, { 20, 40, 21, 41 } };
+		for (size_t r = 0; r < ARRAY_SIZE(rects); ++r)
+		{
+			for (ssize_t j = rects[r][1]; j < rects[r][3]; ++j)
+			{
+				for (ssize_t i = rects[r][0]; i < rects[r][2]; ++i)
+				{
+					seed = seed * 1103515245 + 12345;
+					partial.GetHeightMap()[j*verts + i] = full.GetHeightMap()[j*verts + i] = (u16)(seed >> 16);
+				}
+			}
+			partial.MakeDirty(rects[r][0], rects[r][1], rects[r][2], rects[r][3], RENDERDATA_UPDATE_VERTICES);
+			full.MakeDirty(RENDERDATA_UPDATE_VERTICES);
+
+			for (float z = 0.f; z < verts*TERRAIN_TILE_SIZE; z += 2.3f)
+				for (float x = 0.f; x < verts*TERRAIN_TILE_SIZE; x += 3.1f)
+					for (float radius = 1.f; radius < 500.f; radius *= 3.f)
+						TS_ASSERT_EQUALS(partial.GetFilteredGroundLevel(x, z, radius), full.GetFilteredGroundLevel(x, z, radius));
+		}
+	}
+
 	void test_GetExactGroundLevelFixed()
 	{
 		CTerrain terrain;
@@ -192,4 +261,44 @@ public:
 		TS_ASSERT_EQUALS(vec.Y.ToFloat(), 1.f);
 		TS_ASSERT_EQUALS(vec.Z.ToFloat(), 0.f);
 	}
+
+	void test_MakeDirty_textures()
+	{
+		CTerrain terrain;
+		terrain.Initialize(4, NULL); // 4x4 patches
+		ssize_t i0, j0, i1, j1;
+
+		// Drain the initial state
+		for (ssize_t pj = 0; pj < 4; ++pj)
+			for (ssize_t pi = 0; pi < 4; ++pi)
+				terrain.GetPatch(pi, pj)->GetAndClearDirtyTextures(i0, j0, i1, j1);
+
+		// Tiles 16..17 of patch (1,1), which also affect its neighbours' edge tiles
+		terrain.MakeDirty(PATCH_SIZE, PATCH_SIZE+2, PATCH_SIZE+2, PATCH_SIZE+3, RENDERDATA_UPDATE_INDICES);
+
+		TS_ASSERT(terrain.GetPatch(1, 1)->GetAndClearDirtyTextures(i0, j0, i1, j1));
+		TS_ASSERT_EQUALS(i0, (ssize_t)0);
+		TS_ASSERT_EQUALS(j0, (ssize_t)1);
+		TS_ASSERT_EQUALS(i1, (ssize_t)3);
+		TS_ASSERT_EQUALS(j1, (ssize_t)4);
+		TS_ASSERT(!terrain.GetPatch(1, 1)->GetAndClearDirtyTextures(i0, j0, i1, j1));
+
+		TS_ASSERT(terrain.GetPatch(0, 1)->GetAndClearDirtyTextures(i0, j0, i1, j1));
+		TS_ASSERT_EQUALS(i0, PATCH_SIZE-1);
+		TS_ASSERT_EQUALS(i1, PATCH_SIZE);
+		TS_ASSERT_EQUALS(j0, (ssize_t)1);
+		TS_ASSERT_EQUALS(j1, (ssize_t)4);
+
+		TS_ASSERT(!terrain.GetPatch(1, 0)->GetAndClearDirtyTextures(i0, j0, i1, j1));
+		TS_ASSERT(!terrain.GetPatch(2, 1)->GetAndClearDirtyTextures(i0, j0, i1, j1));
+
+		// Height changes don't affect textures
+		terrain.MakeDirty(0, 0, 4, 4, RENDERDATA_UPDATE_VERTICES);
+		TS_ASSERT(!terrain.GetPatch(0, 0)->GetAndClearDirtyTextures(i0, j0, i1, j1));
+
+		terrain.MakeDirty(RENDERDATA_UPDATE_INDICES);
+		TS_ASSERT(terrain.GetPatch(3, 3)->GetAndClearDirtyTextures(i0, j0, i1, j1));
+		TS_ASSERT_EQUALS(i0, (ssize_t)0);
+		TS_ASSERT_EQUALS(j1, PATCH_SIZE);
+	}
 };
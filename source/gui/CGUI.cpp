@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -74,6 +74,8 @@ InReaction CGUI::HandleEvent(const SDL_Event_* ev)
 {
 	InReaction ret = IN_PASS;
 
+	UpdateDirtySizes();
+
 	if (ev->ev.type == SDL_HOTKEYDOWN)
 	{
 		const char* hotkey = static_cast<const char*>(ev->ev.user.data1);
@@ -295,9 +297,11 @@ InReaction CGUI::HandleEvent(const SDL_Event_* ev)
 
 void CGUI::TickObjects()
 {
-	CStr action = "tick";
-	GUI<CStr>::RecurseObject(0, m_BaseObject, 
-							&IGUIObject::ScriptEvent, action);
+	SendEventToHandlers("tick");
+
+	// Sizes might have been changed by the previous frame's input and events,
+	// or by the tick handlers
+	UpdateDirtySizes();
 
 	// Also update tooltips:
 	m_Tooltip.Update(FindObjectUnderMouse(), m_MousePos, this);
@@ -312,8 +316,28 @@ void CGUI::SendEventToAll(const CStr& EventName)
 	// (sending events here) wasn't converting to lower case,
 	// leading to a similar problem.
 	// now fixed; case is irrelevant since all are converted to lower.
-	GUI<CStr>::RecurseObject(0, m_BaseObject, 
-		&IGUIObject::ScriptEvent, EventName.LowerCase());
+	SendEventToHandlers(EventName.LowerCase());
+}
+
+void CGUI::SendEventToHandlers(const CStr& EventName)
+{
+	if (m_EventObjectsDirty)
+	{
+		m_EventObjects.clear();
+		GUI<std::map<CStr, vector_pObjects> >::RecurseObject(0, m_BaseObject,
+			&IGUIObject::AddToEventObjects, m_EventObjects);
+		m_EventObjectsDirty = false;
+	}
+
+	std::map<CStr, vector_pObjects>::iterator it = m_EventObjects.find(EventName);
+	if (it == m_EventObjects.end())
+		return;
+
+	// Copy the list, since the handlers might add new handlers
+	// (which will make m_EventObjects get rebuilt)
+	vector_pObjects objects = it->second;
+	for (size_t i = 0; i < objects.size(); ++i)
+		objects[i]->ScriptEvent(EventName);
 }
 
 //-------------------------------------------------------------------
@@ -389,7 +413,7 @@ static JSClass page_global_class = {
 	NULL, NULL, NULL, NULL
 };
 
-CGUI::CGUI() : m_MouseButtons(0), m_FocusedObject(NULL), m_InternalNameNumber(0)
+CGUI::CGUI() : m_MouseButtons(0), m_FocusedObject(NULL), m_InternalNameNumber(0), m_EventObjectsDirty(true)
 {
 	m_BaseObject = new CGUIDummyObject;
 	m_BaseObject->SetGUI(this);
@@ -452,6 +476,8 @@ void CGUI::Draw()
 	// drawn on top of everything else
 	glClear(GL_DEPTH_BUFFER_BIT);
 
+	UpdateDirtySizes();
+
 	try
 	{
 		// Recurse IGUIObject::Draw() with restriction: hidden
@@ -462,6 +488,8 @@ void CGUI::Draw()
 	{
 		LOGERROR(L"GUI draw error: %hs", e.what());
 	}
+
+	GUIRenderer::Flush();
 }
 
 void CGUI::DrawSprite(const CGUISpriteInstance& Sprite,
@@ -506,6 +534,9 @@ void CGUI::Destroy()
 
 	// Clear all
 	m_pAllObjects.clear();
+	m_EventObjects.clear();
+	m_EventObjectsDirty = true;
+	m_ChildSizesDirty.clear();
 	m_Sprites.clear();
 	m_Icons.clear();
 }
@@ -514,6 +545,41 @@ void CGUI::UpdateResolution()
 {
 	// Update ALL cached
 	GUI<>::RecurseObject(0, m_BaseObject, &IGUIObject::UpdateCachedSize );
+	m_ChildSizesDirty.clear();
+}
+
+void CGUI::SetChildSizesDirty(IGUIObject* pObject)
+{
+	m_ChildSizesDirty.insert(pObject);
+}
+
+void CGUI::UpdateDirtySizes()
+{
+	if (m_ChildSizesDirty.empty())
+		return;
+
+	boost::unordered_set<IGUIObject*> dirty;
+	dirty.swap(m_ChildSizesDirty);
+
+	for (boost::unordered_set<IGUIObject*>::iterator it = dirty.begin(); it != dirty.end(); ++it)
+	{
+		// If an ancestor is dirty too, its update will include this object's
+		// descendants (after this object itself), so don't do them twice
+		bool ancestorDirty = false;
+		for (IGUIObject* parent = (*it)->m_pParent; parent; parent = parent->m_pParent)
+		{
+			if (dirty.count(parent))
+			{
+				ancestorDirty = true;
+				break;
+			}
+		}
+		if (ancestorDirty)
+			continue;
+
+		for (vector_pObjects::iterator child = (*it)->ChildrenItBegin(); child != (*it)->ChildrenItEnd(); ++child)
+			GUI<>::RecurseObject(0, *child, &IGUIObject::UpdateCachedSize);
+	}
 }
 
 void CGUI::AddObject(IGUIObject* pObject)
@@ -526,6 +592,8 @@ void CGUI::AddObject(IGUIObject* pObject)
 		// Add child to base object
 		m_BaseObject->AddChild(pObject); // can throw
 
+		m_EventObjectsDirty = true;
+
 		// Cache tree
 		GUI<>::RecurseObject(0, pObject, &IGUIObject::UpdateCachedSize);
 
@@ -910,6 +978,9 @@ SGUIText CGUI::GenerateText(const CGUIString &string,
 void CGUI::DrawText(SGUIText &Text, const CColor &DefaultColor, 
 					const CPos &pos, const float &z, const CRect &clipping)
 {
+	// Finish drawing any sprites behind the text
+	GUIRenderer::Flush();
+
 	CShaderTechniquePtr tech = g_Renderer.GetShaderManager().LoadEffect("gui_text");
 
 	tech->BeginPass();
@@ -947,6 +1018,9 @@ void CGUI::DrawText(SGUIText &Text, const CColor &DefaultColor,
 		DrawSprite(it->m_Sprite, it->m_CellID, z, it->m_Area + pos);
 	}
 
+	// (they must be drawn inside the clipping area)
+	GUIRenderer::Flush();
+
 	if (clipping != CRect())
 		glDisable(GL_SCISSOR_TEST);
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -131,6 +131,12 @@ public:
 	 */
 	void SendEventToAll(const CStr& EventName);
 
+	/**
+	 * Called when a script handler has been added or replaced, so the list
+	 * of objects that handle each event gets rebuilt.
+	 */
+	void SetEventObjectsDirty() { m_EventObjectsDirty = true; }
+
 	/**
 	 * Displays the whole GUI
 	 */
@@ -237,6 +243,21 @@ public:
 	 */
 	void UpdateResolution();
 
+	/**
+	 * Marks the descendants of @p pObject as needing their cached sizes
+	 * updated, after the object's own size has changed. They get updated
+	 * by UpdateDirtySizes, so changing lots of sizes within a frame doesn't
+	 * keep re-caching the same subtrees.
+	 */
+	void SetChildSizesDirty(IGUIObject* pObject);
+
+	/**
+	 * Updates the cached sizes of everything marked by SetChildSizesDirty.
+	 * This is called once per frame (and before handling input and drawing),
+	 * and must also be called before anything else depends on those sizes.
+	 */
+	void UpdateDirtySizes();
+
 	/**
 	 * Generate a SGUIText object from the inputted string.
 	 * The function will break down the string and its
@@ -303,6 +324,12 @@ private:
 	 */
 	void AddObject(IGUIObject* pObject);
 
+	/**
+	 * Sends a (lowercase) script event to every object that has a
+	 * handler for it, in the order they appear in the object tree.
+	 */
+	void SendEventToHandlers(const CStr& EventName);
+
 	/**
 	 * You input the name of the object type, and let's
 	 * say you input "button", then it will construct a
@@ -662,6 +689,19 @@ private:
 	 */
 	std::map<CStr, std::vector<IGUIObject*> > m_HotkeyObjects;
 
+	/**
+	 * Map from (lowercase) event names to the objects that have a script
+	 * handler for the event, in tree order. Rebuilt when m_EventObjectsDirty
+	 * is set, so sending "tick" etc doesn't have to visit every object.
+	 */
+	std::map<CStr, vector_pObjects> m_EventObjects;
+	bool m_EventObjectsDirty;
+
+	/**
+	 * Objects whose descendants need their cached sizes updated.
+	 */
+	boost::unordered_set<IGUIObject*> m_ChildSizesDirty;
+
 	//--------------------------------------------------------
 	//	Databases
 	//--------------------------------------------------------
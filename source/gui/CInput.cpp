@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -1054,6 +1054,9 @@ void CInput::Draw()
 				cliparea.left = GetScrollBar(0).GetOuterRect().right;
 		}
 
+		// Finish drawing the sprites outside the clipping area
+		GUIRenderer::Flush();
+
 		if (cliparea != CRect())
 		{
 			glEnable(GL_SCISSOR_TEST);
@@ -1245,6 +1248,9 @@ void CInput::Draw()
 		// Setup initial color (then it might change and change back, when drawing selected area)
 		textRenderer.Color(color);
 
+		// Finish drawing the selection areas behind the text
+		GUIRenderer::Flush();
+
 		tech->BeginPass();
 
 		bool using_selected_color = false;
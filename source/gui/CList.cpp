@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -32,7 +32,7 @@ CList
 //  Constructor / Destructor
 //-------------------------------------------------------------------
 CList::CList() :
-	m_Modified(false)
+	m_Modified(false), m_ItemWidth(0.f), m_ItemBufferZone(0.f)
 {
 	// Add sprite_disabled! TODO
 
@@ -44,6 +44,7 @@ CList::CList() :
 	AddSetting(GUIST_CGUISpriteInstance,	"sprite");
 	AddSetting(GUIST_CGUISpriteInstance,	"sprite_selectarea");
 	AddSetting(GUIST_int,					"cell_id");
+	AddSetting(GUIST_float,					"item_height"); // If > 0, every item has this height, and only visible items' texts are generated
 	AddSetting(GUIST_EAlign,				"text_align");
 	AddSetting(GUIST_CColor,				"textcolor");
 	AddSetting(GUIST_CColor,				"textcolor_selected");
@@ -113,20 +114,43 @@ void CList::SetupText()
 	float buffer_zone=0.f;
 	GUI<float>::GetSetting(this, "buffer_zone", buffer_zone);
 
+	m_ItemFont = font;
+	m_ItemWidth = width;
+	m_ItemBufferZone = buffer_zone;
+
+	float item_height = 0.f;
+	GUI<float>::GetSetting(this, "item_height", item_height);
+
 	// Generate texts
 	float buffered_y = 0.f;
-	
-	for (int i=0; i<(int)pList->m_Items.size(); ++i)
+
+	if (item_height > 0.f)
+	{
+		// All the items have the same height, so they can be positioned
+		// without knowing their texts, and the texts can be generated
+		// by SetupItemText once they're visible. This makes lists with
+		// thousands of items quick to fill.
+		m_GeneratedTexts.resize(pList->m_Items.size(), NULL);
+		for (int i=0; i<(int)pList->m_Items.size(); ++i)
+		{
+			m_ItemsYPositions[i] = buffered_y;
+			buffered_y += item_height;
+		}
+	}
+	else
 	{
-		// Create a new SGUIText. Later on, input it using AddText()
-		SGUIText *text = new SGUIText();
+		for (int i=0; i<(int)pList->m_Items.size(); ++i)
+		{
+			// Create a new SGUIText. Later on, input it using AddText()
+			SGUIText *text = new SGUIText();
 
-		*text = GetGUI()->GenerateText(pList->m_Items[i], font, width, buffer_zone, this);
+			*text = GetGUI()->GenerateText(pList->m_Items[i], font, width, buffer_zone, this);
 
-		m_ItemsYPositions[i] = buffered_y;
-		buffered_y += text->m_Size.cy;
+			m_ItemsYPositions[i] = buffered_y;
+			buffered_y += text->m_Size.cy;
 
-		AddText(text);
+			AddText(text);
+		}
 	}
 
 	m_ItemsYPositions[pList->m_Items.size()] = buffered_y;
@@ -171,7 +195,7 @@ void CList::HandleMessage(SGUIMessage &Message)
 			ScriptEvent("selectionchange"); 
 		}
 
-		if (Message.value == "scrollbar")
+		if (Message.value == "scrollbar" || Message.value == "item_height")
 		{
 			SetupText();
 		}
@@ -384,7 +408,25 @@ void CList::DrawList(const int &selected,
 		CColor color;
 		GUI<CColor>::GetSetting(this, _textcolor, color);
 
-		for (int i=0; i<(int)pList->m_Items.size(); ++i)
+		float item_height = 0.f;
+		GUI<float>::GetSetting(this, "item_height", item_height);
+
+		// With fixed-height items, we can go straight to the visible ones
+		int first = 0;
+		int last = (int)pList->m_Items.size();
+		if (item_height > 0.f)
+		{
+			first = std::max(0, (int)(scroll / item_height));
+			last = std::min(last, (int)((scroll + rect.GetHeight()) / item_height) + 1);
+
+			// Generate the texts just outside the visible area too, so they're
+			// ready when scrolling
+			const int margin = 4;
+			for (int i = std::max(0, first - margin); i < std::min((int)pList->m_Items.size(), last + margin); ++i)
+				SetupItemText(i);
+		}
+
+		for (int i=first; i<last; ++i)
 		{
 			if (m_ItemsYPositions[i+1] - scroll < 0 ||
 				m_ItemsYPositions[i] - scroll > rect.GetHeight())
@@ -404,11 +446,43 @@ void CList::DrawList(const int &selected,
 					cliparea.left = GetScrollBar(0).GetOuterRect().right;
 			}
 
+			if (item_height > 0.f)
+			{
+				// Don't let long texts spill into the next items
+				cliparea.top = std::max(cliparea.top, rect.top + m_ItemsYPositions[i] - scroll);
+				cliparea.bottom = std::min(cliparea.bottom, rect.top + m_ItemsYPositions[i+1] - scroll);
+			}
+
+			SetupItemText(i);
 			DrawText(i, color, rect.TopLeft() - CPos(0.f, scroll - m_ItemsYPositions[i]), bz+0.1f, cliparea);
 		}
 	}
 }
 
+void CList::SetupItemText(int index)
+{
+	if (!GetGUI())
+		return;
+
+	if (!m_GeneratedTextsValid)
+	{
+		SetupText();
+		m_GeneratedTextsValid = true;
+	}
+
+	if (index < 0 || index >= (int)m_GeneratedTexts.size() || m_GeneratedTexts[index])
+		return;
+
+	CGUIList *pList;
+	GUI<CGUIList>::GetSettingPointer(this, "list", pList);
+	if (index >= (int)pList->m_Items.size())
+		return;
+
+	SGUIText *text = new SGUIText();
+	*text = GetGUI()->GenerateText(pList->m_Items[index], m_ItemFont, m_ItemWidth, m_ItemBufferZone, this);
+	m_GeneratedTexts[index] = text;
+}
+
 void CList::AddItem(const CStrW& str, const CStrW& data)
 {
 	CGUIList *pList, *pListData;
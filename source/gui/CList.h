@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -132,6 +132,14 @@ protected:
 	// (and thus whether list items have possibly changed).
 	virtual bool GetModified() const { return m_Modified; }
 
+	/**
+	 * Makes sure the text of item @p index has been generated, so it can be
+	 * drawn. If the "item_height" setting is used, SetupText doesn't
+	 * generate any texts, and they're generated by this when they first
+	 * come into view instead.
+	 */
+	void SetupItemText(int index);
+
 	// List of items.
 	//CGUIList m_List;
 
@@ -146,6 +154,11 @@ protected:
 private:
 	// Whether the list's items have been modified since last handling a message.
 	bool m_Modified;
+
+	// Settings used by SetupText, saved for SetupItemText
+	CStrW m_ItemFont;
+	float m_ItemWidth;
+	float m_ItemBufferZone;
 };
 
 #endif
@@ -0,0 +1,192 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "GUIAtlas.h"
+
+#include "graphics/TextureManager.h"
+#include "lib/allocators/shared_ptr.h"
+#include "lib/ogl.h"
+#include "lib/res/h_mgr.h"
+#include "lib/res/graphics/ogl_tex.h"
+#include "lib/tex/tex.h"
+#include "ps/Filesystem.h"
+#include "ps/Profile.h"
+#include "renderer/Renderer.h"
+
+// Size of each atlas page, in texels
+static const size_t PAGE_SIZE = 1024;
+
+// Largest texture (in each dimension) that will be added to the atlas.
+// Larger ones wouldn't save many draw calls, and would waste space.
+static const size_t MAX_TEXTURE_SIZE = 256;
+
+// Maximum number of pages, to limit the memory usage if a GUI uses
+// a huge number of different textures
+static const size_t MAX_PAGES = 4;
+
+CGUIAtlas::CGUIAtlas() :
+	m_Generation(0)
+{
+}
+
+CGUIAtlas::~CGUIAtlas()
+{
+	Clear();
+}
+
+void CGUIAtlas::Clear()
+{
+	for (size_t i = 0; i < m_Pages.size(); ++i)
+		(void)ogl_tex_free(m_Pages[i].m_Handle);
+	m_Pages.clear();
+	m_Entries.clear();
+	++m_Generation;
+}
+
+const CGUIAtlas::SEntry* CGUIAtlas::GetEntry(const VfsPath& path, const CTexturePtr& texture)
+{
+	std::map<VfsPath, SEntry>::iterator it = m_Entries.find(path);
+	if (it != m_Entries.end())
+		return it->second.m_Page ? &it->second : NULL;
+
+	Tex t;
+	if (!g_Renderer.GetTextureManager().LoadTextureData(texture, t))
+		return NULL; // (try again later, once it's been converted)
+
+	PROFILE2("add to GUI atlas");
+	PROFILE2_ATTR("name: %ls", path.string().c_str());
+
+	SEntry entry;
+	entry.m_Page = 0;
+	entry.m_Width = t.w;
+	entry.m_Height = t.h;
+	entry.m_HasAlpha = (t.flags & TEX_ALPHA) != 0;
+
+	// Convert to uncompressed RGBA without mipmaps (greyscale textures can't be
+	// converted, so they're just drawn separately)
+	if (t.w <= MAX_TEXTURE_SIZE && t.h <= MAX_TEXTURE_SIZE && !(t.flags & TEX_GREY) &&
+		tex_transform_to(&t, (t.flags & TEX_ORIENTATION) | TEX_ALPHA) >= 0 && t.bpp == 32)
+	{
+		// Allow for a one-texel border around the texture
+		const size_t w = t.w + 2;
+		const size_t h = t.h + 2;
+
+		size_t x = 0, y = 0;
+		size_t page = 0;
+		while (page < m_Pages.size() && !Allocate(m_Pages[page], w, h, x, y))
+			++page;
+		if (page == m_Pages.size() && AddPage() && !Allocate(m_Pages[page], w, h, x, y))
+			page = m_Pages.size(); // (can't happen, since the texture isn't larger than a page)
+
+		if (page < m_Pages.size())
+		{
+			// Copy the texture into the middle of the block, and extend its
+			// edges into the border
+			std::vector<u32> data(w * h);
+			const u32* src = (const u32*)tex_get_data(&t);
+			for (size_t j = 0; j < h; ++j)
+			{
+				const size_t srcJ = std::min(std::max(j, (size_t)1) - 1, t.h - 1);
+				for (size_t i = 0; i < w; ++i)
+				{
+					const size_t srcI = std::min(std::max(i, (size_t)1) - 1, t.w - 1);
+					data[j*w + i] = src[srcJ*t.w + srcI];
+				}
+			}
+
+			(void)ogl_tex_bind(m_Pages[page].m_Handle);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, (GLint)x, (GLint)y, (GLsizei)w, (GLsizei)h, GL_RGBA, GL_UNSIGNED_BYTE, &data[0]);
+			(void)ogl_tex_bind(0);
+
+			entry.m_Page = m_Pages[page].m_Handle;
+			entry.m_TexCoords = CRect(
+				(float)(x + 1) / PAGE_SIZE, (float)(y + 1) / PAGE_SIZE,
+				(float)(x + 1 + t.w) / PAGE_SIZE, (float)(y + 1 + t.h) / PAGE_SIZE);
+		}
+	}
+
+	tex_free(&t);
+
+	SEntry& stored = m_Entries[path];
+	stored = entry;
+	return stored.m_Page ? &stored : NULL;
+}
+
+bool CGUIAtlas::Allocate(SPage& page, size_t w, size_t h, size_t& x, size_t& y)
+{
+	size_t shelfX = page.m_ShelfX;
+	size_t shelfY = page.m_ShelfY;
+	size_t shelfHeight = page.m_ShelfHeight;
+
+	// Start a new shelf if this one is full
+	if (shelfX + w > PAGE_SIZE)
+	{
+		shelfX = 0;
+		shelfY += shelfHeight;
+		shelfHeight = 0;
+	}
+
+	if (shelfY + h > PAGE_SIZE)
+		return false;
+
+	x = shelfX;
+	y = shelfY;
+	page.m_ShelfX = shelfX + w;
+	page.m_ShelfY = shelfY;
+	page.m_ShelfHeight = std::max(shelfHeight, h);
+	return true;
+}
+
+bool CGUIAtlas::AddPage()
+{
+	if (m_Pages.size() >= MAX_PAGES)
+		return false;
+
+	// Construct a transparent page
+	const size_t size = PAGE_SIZE * PAGE_SIZE * 4;
+	shared_ptr<u8> data(new u8[size], ArrayDeleter());
+	memset(data.get(), 0, size);
+	Tex t;
+	if (tex_wrap(PAGE_SIZE, PAGE_SIZE, 32, TEX_ALPHA, data, 0, &t) < 0)
+		return false;
+
+	Handle h = ogl_tex_wrap(&t, g_VFS, L"(GUI atlas page)", RES_UNIQUE);
+	if (h <= 0)
+		return false;
+
+	(void)ogl_tex_set_filter(h, GL_LINEAR);
+	(void)ogl_tex_set_wrap(h, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+	if (ogl_tex_upload(h) < 0)
+	{
+		(void)ogl_tex_free(h);
+		return false;
+	}
+
+	SPage page;
+	page.m_Handle = h;
+	page.m_ShelfX = page.m_ShelfY = page.m_ShelfHeight = 0;
+	m_Pages.push_back(page);
+	return true;
+}
+
+void CGUIAtlas::ReloadChangedFile(const VfsPath& path)
+{
+	if (m_Entries.find(path) != m_Entries.end())
+		Clear();
+}
@@ -0,0 +1,101 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_GUIATLAS
+#define INCLUDED_GUIATLAS
+
+#include "graphics/Texture.h"
+#include "lib/file/vfs/vfs_path.h"
+#include "lib/res/handle.h"
+#include "ps/Overlay.h"
+
+#include <map>
+
+/**
+ * Packs small GUI textures into shared atlas pages at runtime, so that
+ * GUIRenderer can draw many different sprite images with a single texture
+ * bind and draw call.
+ *
+ * Textures are added the first time a sprite using them is drawn, if their
+ * converted data is already available. Each one is surrounded by a copy of its
+ * edge texels, so filtering doesn't bleed between neighbours (this behaves like
+ * GL_CLAMP_TO_EDGE, so the atlas should only be used for images whose texture
+ * coordinates don't go outside the [0, 1] range).
+ */
+class CGUIAtlas
+{
+	NONCOPYABLE(CGUIAtlas);
+public:
+	struct SEntry
+	{
+		Handle m_Page; // ogl_tex handle of the atlas page
+		CRect m_TexCoords; // area of the page containing the texture
+		size_t m_Width, m_Height; // size of the original texture
+		bool m_HasAlpha;
+	};
+
+	CGUIAtlas();
+	~CGUIAtlas();
+
+	/**
+	 * Returns the atlas entry for the given texture (loaded from @p path),
+	 * adding the texture to the atlas if necessary. Returns NULL if it can't
+	 * be added (e.g. if it's too large or hasn't been converted yet), in which
+	 * case the texture should be drawn by itself.
+	 * The returned entry is valid until the generation number changes.
+	 */
+	const SEntry* GetEntry(const VfsPath& path, const CTexturePtr& texture);
+
+	/**
+	 * Incremented whenever existing entries are discarded.
+	 */
+	u32 GetGeneration() const { return m_Generation; }
+
+	/**
+	 * Discards the whole atlas if @p path is one of its textures, so the new
+	 * version will be loaded.
+	 */
+	void ReloadChangedFile(const VfsPath& path);
+
+private:
+	struct SPage
+	{
+		Handle m_Handle;
+		// Textures are packed into rows ("shelves") from top to bottom
+		size_t m_ShelfX, m_ShelfY, m_ShelfHeight;
+	};
+
+	/**
+	 * Finds space for a w*h block in the given page, and returns false
+	 * if there's not enough.
+	 */
+	bool Allocate(SPage& page, size_t w, size_t h, size_t& x, size_t& y);
+
+	bool AddPage();
+
+	void Clear();
+
+	std::vector<SPage> m_Pages;
+
+	// Entries indexed by source texture path. Textures that can never be
+	// added (e.g. because they're too large) are stored with m_Page == 0.
+	std::map<VfsPath, SEntry> m_Entries;
+
+	u32 m_Generation;
+};
+
+#endif // INCLUDED_GUIATLAS
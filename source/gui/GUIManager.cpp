@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -171,6 +171,8 @@ void CGUIManager::LoadPage(SGUIPage& page)
 
 Status CGUIManager::ReloadChangedFiles(const VfsPath& path)
 {
+	m_Atlas.ReloadChangedFile(path);
+
 	for (PageStackType::iterator it = m_PageStack.begin(); it != m_PageStack.end(); ++it)
 	{
 		if (it->inputs.count(path))
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,6 +20,7 @@
 
 #include <boost/unordered_set.hpp>
 
+#include "gui/GUIAtlas.h"
 #include "lib/input.h"
 #include "lib/file/vfs/vfs_path.h"
 #include "ps/CStr.h"
@@ -139,6 +140,11 @@ public:
 	 */
 	CScriptVal GetSavedGameData();
 
+	/**
+	 * Returns the texture atlas shared by the sprites of all pages.
+	 */
+	CGUIAtlas& GetAtlas() { return m_Atlas; }
+
 private:
 	struct SGUIPage
 	{
@@ -161,6 +167,8 @@ private:
 	shared_ptr<CGUI> m_CurrentGUI; // used to latch state during TickObjects/LoadPage (this is kind of ugly)
 
 	ScriptInterface& m_ScriptInterface;
+
+	CGUIAtlas m_Atlas;
 };
 
 extern CGUIManager* g_GUI;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,6 +21,8 @@
 
 #include "graphics/ShaderManager.h"
 #include "graphics/TextureManager.h"
+#include "gui/GUIAtlas.h"
+#include "gui/GUIManager.h"
 #include "gui/GUIutil.h"
 #include "lib/ogl.h"
 #include "lib/utf8.h"
@@ -203,7 +205,6 @@ void GUIRenderer::UpdateDrawCallCache(DrawCalls &Calls, const CStr& SpriteName,
 			CTextureProperties textureProps(cit->m_TextureName);
 			textureProps.SetWrap(cit->m_WrapMode);
 			CTexturePtr texture = g_Renderer.GetTextureManager().CreateTexture(textureProps);
-			texture->Prefetch();
 			Call.m_HasTexture = true;
 			Call.m_Texture = texture;
 
@@ -211,6 +212,33 @@ void GUIRenderer::UpdateDrawCallCache(DrawCalls &Calls, const CStr& SpriteName,
 
 			Call.m_ObjectSize = ObjectSize;
 			Call.m_CellID = CellID;
+
+			// Small textures are drawn from the atlas, if the image doesn't
+			// need them to repeat
+			if (g_GUI)
+			{
+				CGUIAtlas& atlas = g_GUI->GetAtlas();
+				const CGUIAtlas::SEntry* entry = atlas.GetEntry(cit->m_TextureName, texture);
+				if (entry)
+				{
+					CRect TexCoords = Call.ComputeTexCoords(entry->m_Width, entry->m_Height);
+					const float epsilon = 0.001f;
+					if (std::min(TexCoords.left, TexCoords.right) > -epsilon && std::max(TexCoords.left, TexCoords.right) < 1.f + epsilon &&
+						std::min(TexCoords.top, TexCoords.bottom) > -epsilon && std::max(TexCoords.top, TexCoords.bottom) < 1.f + epsilon)
+					{
+						const CRect& area = entry->m_TexCoords;
+						Call.m_AtlasPage = entry->m_Page;
+						Call.m_AtlasTexCoords = CRect(
+							area.left + TexCoords.left * area.GetWidth(), area.top + TexCoords.top * area.GetHeight(),
+							area.left + TexCoords.right * area.GetWidth(), area.top + TexCoords.bottom * area.GetHeight());
+						Call.m_AtlasGeneration = atlas.GetGeneration();
+						Call.m_AtlasHasAlpha = entry->m_HasAlpha;
+					}
+				}
+			}
+
+			if (!Call.m_AtlasPage)
+				texture->Prefetch();
 		}
 		else
 		{
@@ -258,9 +286,11 @@ void GUIRenderer::UpdateDrawCallCache(DrawCalls &Calls, const CStr& SpriteName,
 
 CRect SDrawCall::ComputeTexCoords() const
 {
-	float TexWidth = m_Texture->GetWidth();
-	float TexHeight = m_Texture->GetHeight();
+	return ComputeTexCoords(m_Texture->GetWidth(), m_Texture->GetHeight());
+}
 
+CRect SDrawCall::ComputeTexCoords(float TexWidth, float TexHeight) const
+{
 	if (!TexWidth || !TexHeight)
 	{
 		return CRect(0, 0, 1, 1);
@@ -328,15 +358,34 @@ CRect SDrawCall::ComputeTexCoords() const
 	return TexCoords;
 }
 
-void GUIRenderer::Draw(DrawCalls &Calls, float Z)
+namespace
 {
-	// Called every frame, to draw the object (based on cached calculations)
+	/**
+	 * Images that are waiting to be drawn by GUIRenderer::Flush.
+	 */
+	struct SBatch
+	{
+		SBatch() : m_HasTexture(false), m_AtlasPage(0), m_EnableBlending(false) {}
 
-	// TODO: batching by shader/texture/etc would be nice
+		CShaderTechniquePtr m_Shader;
+		bool m_HasTexture;
+		CTexturePtr m_Texture; // if m_HasTexture and m_AtlasPage == 0
+		Handle m_AtlasPage;
+		CColor m_ColorParameter;
+		bool m_EnableBlending;
 
-	CMatrix3D matrix = GetDefaultGuiMatrix();
+		std::vector<float> m_Vertices; // (u, v, x, y, z) for each vertex
+	};
+
+	SBatch g_Batch;
+}
 
-	glDisable(GL_BLEND);
+void GUIRenderer::Flush()
+{
+	if (g_Batch.m_Vertices.empty())
+		return;
+
+	CMatrix3D matrix = GetDefaultGuiMatrix();
 
 	// Set LOD bias so mipmapped textures are prettier
 #if CONFIG2_GLES
@@ -345,108 +394,189 @@ void GUIRenderer::Draw(DrawCalls &Calls, float Z)
 	glTexEnvf(GL_TEXTURE_FILTER_CONTROL, GL_TEXTURE_LOD_BIAS, -1.f);
 #endif
 
-	// Iterate through each DrawCall, and execute whatever drawing code is being called
-	for (DrawCalls::const_iterator cit = Calls.begin(); cit != Calls.end(); ++cit)
+	g_Batch.m_Shader->BeginPass();
+	CShaderProgramPtr shader = g_Batch.m_Shader->GetShader();
+	shader->Uniform("transform", matrix);
+	shader->Uniform("color", g_Batch.m_ColorParameter);
+
+	bool enableBlending = g_Batch.m_EnableBlending;
+	if (g_Batch.m_AtlasPage)
+	{
+		shader->BindTexture("tex", g_Batch.m_AtlasPage);
+	}
+	else if (g_Batch.m_HasTexture)
+	{
+		shader->BindTexture("tex", g_Batch.m_Texture);
+		enableBlending = enableBlending || g_Batch.m_Texture->HasAlpha(); // (shouldn't call HasAlpha before BindTexture)
+	}
+
+	if (enableBlending)
 	{
-		cit->m_Shader->BeginPass();
-		CShaderProgramPtr shader = cit->m_Shader->GetShader();
-		shader->Uniform("transform", matrix);
+		ogl_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		ogl_Enable(GL_BLEND);
+	}
+
+	if (g_Batch.m_HasTexture)
+		shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, 5*sizeof(float), &g_Batch.m_Vertices[0]);
+	shader->VertexPointer(3, GL_FLOAT, 5*sizeof(float), &g_Batch.m_Vertices[2]);
+	glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(g_Batch.m_Vertices.size() / 5));
+	g_Renderer.GetStats().m_DrawCalls++;
+
+	g_Batch.m_Shader->EndPass();
+
+	ogl_Disable(GL_BLEND);
+
+#if CONFIG2_GLES
+#warning TODO: implement GUI LOD bias for GLES
+#else
+	glTexEnvf(GL_TEXTURE_FILTER_CONTROL, GL_TEXTURE_LOD_BIAS, 0.f);
+#endif
+
+	// Don't keep the resources alive after they're needed
+	g_Batch.m_Vertices.clear();
+	g_Batch.m_Shader.reset();
+	g_Batch.m_Texture.reset();
+	g_Batch.m_AtlasPage = 0;
+}
+
+/**
+ * Computes the quad's vertex data (u, v, x, y, z) for the given texture
+ * coordinates, with the correct winding order.
+ */
+static void ComputeVertices(std::vector<float>& data, CRect Verts, CRect TexCoords, float Z)
+{
+	if (Verts.right < Verts.left)
+	{
+		std::swap(Verts.right, Verts.left);
+		std::swap(TexCoords.right, TexCoords.left);
+	}
+	if (Verts.bottom < Verts.top)
+	{
+		std::swap(Verts.bottom, Verts.top);
+		std::swap(TexCoords.bottom, TexCoords.top);
+	}
+
+	data.clear();
+#define ADD(u, v, x, y, z) STMT(data.push_back(u); data.push_back(v); data.push_back(x); data.push_back(y); data.push_back(z))
+	ADD(TexCoords.left, TexCoords.bottom, Verts.left, Verts.bottom, Z);
+	ADD(TexCoords.right, TexCoords.bottom, Verts.right, Verts.bottom, Z);
+	ADD(TexCoords.right, TexCoords.top, Verts.right, Verts.top, Z);
+
+	ADD(TexCoords.right, TexCoords.top, Verts.right, Verts.top, Z);
+	ADD(TexCoords.left, TexCoords.top, Verts.left, Verts.top, Z);
+	ADD(TexCoords.left, TexCoords.bottom, Verts.left, Verts.bottom, Z);
+#undef ADD
+}
+
+void GUIRenderer::Draw(DrawCalls &Calls, float Z)
+{
+	// Called every frame, to draw the object (based on cached calculations)
+
+	for (DrawCalls::iterator cit = Calls.begin(); cit != Calls.end(); ++cit)
+	{
+		Handle atlasPage = 0;
+		CTexturePtr texture;
+		bool enableBlending = cit->m_EnableBlending;
+		CColor colorParameter = cit->m_BackColor;
+		float texWidth = 0.f, texHeight = 0.f;
 
 		if (cit->m_HasTexture)
 		{
-			shader->Uniform("color", cit->m_ShaderColorParameter);
-			shader->BindTexture("tex", cit->m_Texture);
-
-			if (cit->m_EnableBlending || cit->m_Texture->HasAlpha()) // (shouldn't call HasAlpha before BindTexture)
+			// If the atlas has been rebuilt since the draw call was cached,
+			// just draw the texture by itself
+			if (cit->m_AtlasPage && cit->m_AtlasGeneration != g_GUI->GetAtlas().GetGeneration())
 			{
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-				glEnable(GL_BLEND);
+				cit->m_AtlasPage = 0;
+				cit->m_Texture->Prefetch();
+				cit->m_CachedVertices.clear();
 			}
 
-			CRect TexCoords = cit->ComputeTexCoords();
-
-			// Ensure the quad has the correct winding order, and update texcoords to match
-			CRect Verts = cit->m_Vertices;
-			if (Verts.right < Verts.left)
+			atlasPage = cit->m_AtlasPage;
+			if (atlasPage)
 			{
-				std::swap(Verts.right, Verts.left);
-				std::swap(TexCoords.right, TexCoords.left);
+				enableBlending = enableBlending || cit->m_AtlasHasAlpha;
 			}
-			if (Verts.bottom < Verts.top)
+			else
 			{
-				std::swap(Verts.bottom, Verts.top);
-				std::swap(TexCoords.bottom, TexCoords.top);
+				texture = cit->m_Texture;
+				// (the texture coordinates depend on the size, which changes once it's loaded)
+				texWidth = texture->GetWidth();
+				texHeight = texture->GetHeight();
 			}
+			colorParameter = cit->m_ShaderColorParameter;
+		}
 
-			std::vector<float> data;
-#define ADD(u, v, x, y, z) STMT(data.push_back(u); data.push_back(v); data.push_back(x); data.push_back(y); data.push_back(z))
-			ADD(TexCoords.left, TexCoords.bottom, Verts.left, Verts.bottom, Z + cit->m_DeltaZ);
-			ADD(TexCoords.right, TexCoords.bottom, Verts.right, Verts.bottom, Z + cit->m_DeltaZ);
-			ADD(TexCoords.right, TexCoords.top, Verts.right, Verts.top, Z + cit->m_DeltaZ);
-
-			ADD(TexCoords.right, TexCoords.top, Verts.right, Verts.top, Z + cit->m_DeltaZ);
-			ADD(TexCoords.left, TexCoords.top, Verts.left, Verts.top, Z + cit->m_DeltaZ);
-			ADD(TexCoords.left, TexCoords.bottom, Verts.left, Verts.bottom, Z + cit->m_DeltaZ);
-#undef ADD
-
-			shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, 5*sizeof(float), &data[0]);
-			shader->VertexPointer(3, GL_FLOAT, 5*sizeof(float), &data[2]);
-			glDrawArrays(GL_TRIANGLES, 0, 6);
+		// The vertex data only needs to be recomputed if the image has moved
+		// in depth or its texture has been loaded since last time
+		if (cit->m_CachedVertices.empty() || cit->m_CachedZ != Z ||
+			cit->m_CachedTexWidth != texWidth || cit->m_CachedTexHeight != texHeight)
+		{
+			CRect TexCoords;
+			if (atlasPage)
+				TexCoords = cit->m_AtlasTexCoords;
+			else if (cit->m_HasTexture)
+				TexCoords = cit->ComputeTexCoords(texWidth, texHeight);
+
+			ComputeVertices(cit->m_CachedVertices, cit->m_Vertices, TexCoords, Z + cit->m_DeltaZ);
+			cit->m_CachedZ = Z;
+			cit->m_CachedTexWidth = texWidth;
+			cit->m_CachedTexHeight = texHeight;
 		}
-		else
+
+		// Start a new batch unless this can be drawn with the same state as the current one
+		if (g_Batch.m_Vertices.empty() || g_Batch.m_Shader != cit->m_Shader ||
+			g_Batch.m_HasTexture != cit->m_HasTexture ||
+			g_Batch.m_AtlasPage != atlasPage || g_Batch.m_Texture != texture ||
+			g_Batch.m_ColorParameter != colorParameter ||
+			g_Batch.m_EnableBlending != enableBlending)
 		{
-			shader->Uniform("color", cit->m_BackColor);
+			Flush();
+			g_Batch.m_Shader = cit->m_Shader;
+			g_Batch.m_HasTexture = cit->m_HasTexture;
+			g_Batch.m_AtlasPage = atlasPage;
+			g_Batch.m_Texture = texture;
+			g_Batch.m_ColorParameter = colorParameter;
+			g_Batch.m_EnableBlending = enableBlending;
+		}
 
-			if (cit->m_EnableBlending)
-			{
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-				glEnable(GL_BLEND);
-			}
+		g_Batch.m_Vertices.insert(g_Batch.m_Vertices.end(), cit->m_CachedVertices.begin(), cit->m_CachedVertices.end());
+
+		// Borders aren't batched, and must be drawn over the image
+		if (!cit->m_HasTexture && cit->m_BorderColor != CColor())
+		{
+			Flush();
 
-			// Ensure the quad has the correct winding order
 			CRect Verts = cit->m_Vertices;
 			if (Verts.right < Verts.left)
 				std::swap(Verts.right, Verts.left);
 			if (Verts.bottom < Verts.top)
 				std::swap(Verts.bottom, Verts.top);
 
+			cit->m_Shader->BeginPass();
+			CShaderProgramPtr shader = cit->m_Shader->GetShader();
+			shader->Uniform("transform", GetDefaultGuiMatrix());
+			shader->Uniform("color", cit->m_BorderColor);
+
+			if (cit->m_EnableBlending)
+			{
+				ogl_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+				ogl_Enable(GL_BLEND);
+			}
+
 			std::vector<float> data;
 #define ADD(x, y, z) STMT(data.push_back(x); data.push_back(y); data.push_back(z))
-			ADD(Verts.left, Verts.bottom, Z + cit->m_DeltaZ);
-			ADD(Verts.right, Verts.bottom, Z + cit->m_DeltaZ);
-			ADD(Verts.right, Verts.top, Z + cit->m_DeltaZ);
-
-			ADD(Verts.right, Verts.top, Z + cit->m_DeltaZ);
-			ADD(Verts.left, Verts.top, Z + cit->m_DeltaZ);
-			ADD(Verts.left, Verts.bottom, Z + cit->m_DeltaZ);
+			ADD(Verts.left + 0.5f, Verts.top + 0.5f, Z + cit->m_DeltaZ);
+			ADD(Verts.right - 0.5f, Verts.top + 0.5f, Z + cit->m_DeltaZ);
+			ADD(Verts.right - 0.5f, Verts.bottom - 0.5f, Z + cit->m_DeltaZ);
+			ADD(Verts.left + 0.5f, Verts.bottom - 0.5f, Z + cit->m_DeltaZ);
+#undef ADD
 
 			shader->VertexPointer(3, GL_FLOAT, 3*sizeof(float), &data[0]);
-			glDrawArrays(GL_TRIANGLES, 0, 6);
+			glDrawArrays(GL_LINE_LOOP, 0, 4);
 
-			if (cit->m_BorderColor != CColor())
-			{
-				shader->Uniform("color", cit->m_BorderColor);
-
-				data.clear();
-				ADD(Verts.left + 0.5f, Verts.top + 0.5f, Z + cit->m_DeltaZ);
-				ADD(Verts.right - 0.5f, Verts.top + 0.5f, Z + cit->m_DeltaZ);
-				ADD(Verts.right - 0.5f, Verts.bottom - 0.5f, Z + cit->m_DeltaZ);
-				ADD(Verts.left + 0.5f, Verts.bottom - 0.5f, Z + cit->m_DeltaZ);
+			cit->m_Shader->EndPass();
 
-				shader->VertexPointer(3, GL_FLOAT, 3*sizeof(float), &data[0]);
-				glDrawArrays(GL_LINE_LOOP, 0, 4);
-			}
-#undef ADD
+			ogl_Disable(GL_BLEND);
 		}
-		
-		cit->m_Shader->EndPass();
-
-		glDisable(GL_BLEND);
 	}
-
-#if CONFIG2_GLES
-#warning TODO: implement GUI LOD bias for GLES
-#else
-	glTexEnvf(GL_TEXTURE_FILTER_CONTROL, GL_TEXTURE_LOD_BIAS, 0.f);
-#endif
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -40,14 +40,22 @@ namespace GUIRenderer
 
 	struct SDrawCall
 	{
-		SDrawCall(const SGUIImage* image) : m_Image(image) {}
+		SDrawCall(const SGUIImage* image) : m_Image(image), m_AtlasPage(0) {}
 		CRect ComputeTexCoords() const;
+		CRect ComputeTexCoords(float TexWidth, float TexHeight) const;
 
 		const SGUIImage* m_Image;
 
 		bool m_HasTexture;
 		CTexturePtr m_Texture;
 
+		// If the texture is drawn from the GUI atlas: the atlas page (else 0),
+		// and the (fixed) texture coordinates within it
+		Handle m_AtlasPage;
+		CRect m_AtlasTexCoords;
+		u32 m_AtlasGeneration;
+		bool m_AtlasHasAlpha;
+
 		CRect m_ObjectSize;
 		int m_CellID;
 
@@ -61,6 +69,12 @@ namespace GUIRenderer
 
 		CColor m_BorderColor; // == CColor() for no border
 		CColor m_BackColor;
+
+		// Vertex data (u, v, x, y, z) computed by the last Draw, which
+		// is reused until the Z or texture size changes
+		std::vector<float> m_CachedVertices;
+		float m_CachedZ;
+		float m_CachedTexWidth, m_CachedTexHeight;
 	};
 
 	class DrawCalls : public std::vector<SDrawCall>
@@ -79,7 +93,21 @@ namespace GUIRenderer
 {
 	void UpdateDrawCallCache(DrawCalls &Calls, const CStr& SpriteName, const CRect& Size, int CellID, std::map<CStr, CGUISprite> &Sprites);
 
+	/**
+	 * Draws the sprite. Consecutive images that use the same shader, texture
+	 * (or atlas page), colour and blending are batched together, so they might
+	 * not be drawn until the next call to Flush.
+	 * Each image's vertex data is computed once and kept in @p Calls, until
+	 * its position or texture changes.
+	 */
 	void Draw(DrawCalls &Calls, float Z);
+
+	/**
+	 * Draws any batched images. This must be called before doing any other
+	 * rendering (or changing the GL state, e.g. the scissor rectangle), so that
+	 * everything is drawn in the right order.
+	 */
+	void Flush();
 }
 
 #endif // GUIRenderer_h
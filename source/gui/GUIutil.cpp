@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -387,10 +387,18 @@ PSRETURN GUI<T>::SetSetting(IGUIObject *pObject, const CStr& Setting,
 	//	Some settings needs special attention at change
 	//
 
-	// If setting was "size", we need to re-cache itself and all children
+	// If setting was "size", we need to re-cache itself and all children.
+	// The children can wait until the GUI's next UpdateDirtySizes, so that
+	// setting lots of sizes doesn't repeat the work.
 	if (Setting == "size")
 	{
-		RecurseObject(0, pObject, &IGUIObject::UpdateCachedSize);
+		if (pObject->GetGUI())
+		{
+			pObject->UpdateCachedSize();
+			pObject->GetGUI()->SetChildSizesDirty(pObject);
+		}
+		else
+			RecurseObject(0, pObject, &IGUIObject::UpdateCachedSize);
 	}
 	else
 	if (Setting == "hidden")
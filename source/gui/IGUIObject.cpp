@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -461,6 +461,16 @@ void IGUIObject::SetScriptHandler(const CStr& Action, JSObject* Function)
 		delete m_ScriptHandlers[Action];
 	}
 	m_ScriptHandlers[Action] = obj;
+
+	// (If we're not in a GUI yet, CGUI::AddObject will do this)
+	if (m_pGUI)
+		m_pGUI->SetEventObjectsDirty();
+}
+
+void IGUIObject::AddToEventObjects(std::map<CStr, vector_pObjects> &EventObjects)
+{
+	for (std::map<CStr, JSObject**>::iterator it = m_ScriptHandlers.begin(); it != m_ScriptHandlers.end(); ++it)
+		EventObjects[it->first].push_back(this);
 }
 
 InReaction IGUIObject::SendEvent(EGUIMessageType type, const CStr& EventName)
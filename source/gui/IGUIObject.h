@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -198,6 +198,12 @@ public:
 	 */
 	void AddToPointersMap(map_pObjects &ObjectMap);
 
+	/**
+	 * Adds this object to the list of each event that it has a
+	 * script handler for.
+	 */
+	void AddToEventObjects(std::map<CStr, vector_pObjects> &EventObjects);
+
 	/**
 	 * Notice nothing will be returned or thrown if the child hasn't 
 	 * been inputted into the GUI yet. This is because that's were 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -55,7 +55,9 @@ void IGUITextOwner::HandleMessage(SGUIMessage &Message)
 		//  these. Although that is not certain, but one will have to manually
 		//  change it and disregard this function.
 		// TODO Gee: (2004-09-07) Make sure this is all options that can affect the text.
-		if (Message.value == "size" || Message.value == "z" ||
+		// ("size" is handled by UpdateCachedSize, which knows whether the
+		// size really changed.)
+		if (Message.value == "z" ||
 			Message.value == "absolute" || Message.value == "caption" ||
 			Message.value == "font" || Message.value == "textcolor" ||
 			Message.value == "buffer_zone")
@@ -74,8 +76,10 @@ void IGUITextOwner::UpdateCachedSize()
 	// If an ancestor's size changed, this will let us intercept the change and
 	// update our text positions
 
+	CRect oldSize = m_CachedActualSize;
 	IGUIObject::UpdateCachedSize();
-	m_GeneratedTextsValid = false;
+	if (m_CachedActualSize != oldSize)
+		m_GeneratedTextsValid = false;
 }
 
 void IGUITextOwner::DrawText(int index, const CColor& color, const CPos& pos, float z, const CRect& clipping)
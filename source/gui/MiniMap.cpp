@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -32,6 +32,7 @@
 #include "lib/external_libraries/libsdl.h"
 #include "lib/bits.h"
 #include "lib/timer.h"
+#include "maths/MathUtil.h"
 #include "ps/Game.h"
 #include "ps/Profile.h"
 #include "ps/World.h"
@@ -53,7 +54,9 @@ static unsigned int ScaleColor(unsigned int color, float x)
 }
 
 CMiniMap::CMiniMap() :
-	m_TerrainTexture(0), m_TerrainData(0), m_MapSize(0), m_Terrain(0), m_TerrainDirty(true), m_MapScale(1.f)
+	m_TerrainTexture(0), m_TerrainData(0), m_MapSize(0), m_Terrain(0), m_TerrainDirty(true), m_MapScale(1.f),
+	m_WaterHeight(0.f), m_TextureMapSize(0), m_LastUpdateTime(0.0),
+	m_UnitVertices(GL_DYNAMIC_DRAW), m_NumUnitVertices(0)
 {
 	AddSetting(GUIST_CColor,	"fov_wedge_color");
 	AddSetting(GUIST_CStrW,		"tooltip");
@@ -69,6 +72,14 @@ CMiniMap::CMiniMap() :
 		m_ShallowPassageHeight = pathingSettings.GetChild("default").GetChild("MaxWaterDepth").ToFloat();
 	else
 		m_ShallowPassageHeight = 0.0f;
+
+	m_AttributePos.type = GL_FLOAT;
+	m_AttributePos.elems = 2;
+	m_UnitVertices.AddAttribute(&m_AttributePos);
+
+	m_AttributeColor.type = GL_UNSIGNED_BYTE;
+	m_AttributeColor.elems = 4;
+	m_UnitVertices.AddAttribute(&m_AttributeColor);
 }
 
 CMiniMap::~CMiniMap()
@@ -250,12 +261,6 @@ void CMiniMap::DrawViewRect()
 	glLineWidth(1.0f);
 }
 
-struct MinimapUnitVertex
-{
-	u8 r, g, b, a;
-	float x, y;
-};
-
 void CMiniMap::DrawTexture(float coordMax, float angle, float x, float y, float x2, float y2, float z)
 {
 	// Rotate the texture coordinates (0,0)-(coordMax,coordMax) around their center point (m,m)
@@ -280,6 +285,9 @@ void CMiniMap::Draw()
 {
 	PROFILE3("render minimap");
 
+	// Finish drawing any sprites behind the minimap
+	GUIRenderer::Flush();
+
 	// The terrain isn't actually initialized until the map is loaded, which
 	// happens when the game is started, so abort until then.
 	if(!(GetGUI() && g_Game && g_Game->IsGameStarted()))
@@ -298,21 +306,31 @@ void CMiniMap::Draw()
 	m_TextureSize = (GLsizei)round_up_to_pow2((size_t)m_MapSize);
 	m_MapScale = (cmpRangeManager->GetLosCircular() ? 1.f : 1.414f);
 
-	if(!m_TerrainTexture || g_GameRestarted)
+	if(!m_TerrainTexture || g_GameRestarted || m_TextureMapSize != m_MapSize)
 		CreateTextures();
 
+	float sx = (float)m_Width / ((m_MapSize - 1) * TERRAIN_TILE_SIZE);
+	float sy = (float)m_Height / ((m_MapSize - 1) * TERRAIN_TILE_SIZE);
 
 	// only update 2x / second
 	// (note: since units only move a few pixels per second on the minimap,
 	// we can get away with infrequent updates; this is slow)
-	static double last_time;
 	const double cur_time = timer_Time();
-	if(cur_time - last_time > 0.5)
+	if(cur_time - m_LastUpdateTime > 0.5)
 	{
-		last_time = cur_time;
-
-		if(m_TerrainDirty)
-			RebuildTerrainTexture();
+		m_LastUpdateTime = cur_time;
+
+		// Only the tiles that have changed since the last update need to be
+		// regenerated, unless the water or some terrain textures have changed
+		ssize_t i0, j0, i1, j1;
+		bool changed = m_Terrain->GetAndClearDirtyTiles(i0, j0, i1, j1);
+		if(m_TerrainDirty || m_WaterHeight != g_Renderer.GetWaterManager()->m_WaterHeight)
+			RebuildTerrainTexture(0, 0, m_MapSize - 1, m_MapSize - 1);
+		else if(changed)
+			// (the colour of each tile depends on the heights of its corner vertexes)
+			RebuildTerrainTexture(i0 - 1, j0 - 1, i1 + 1, j1 + 1);
+
+		RebuildUnitVertices(sx, sy);
 	}
 
 	glMatrixMode(GL_PROJECTION);
@@ -325,7 +343,7 @@ void CMiniMap::Draw()
 
 	// Disable depth updates to prevent apparent z-fighting-related issues
 	// with some drivers causing units to get drawn behind the texture
-	glDepthMask(0);
+	ogl_DepthMask(0);
 	
 	CShaderProgramPtr shader;
 	CShaderTechniquePtr tech;
@@ -334,7 +352,7 @@ void CMiniMap::Draw()
 	{
 		CShaderDefines defines;
 		defines.Add("MINIMAP_BASE", "1");
-		tech = g_Renderer.GetShaderManager().LoadEffect(CStrIntern("minimap"), g_Renderer.GetSystemShaderDefines(), defines);
+		tech = g_Renderer.GetShaderManager().LoadEffect(str_minimap, g_Renderer.GetSystemShaderDefines(), defines);
 		tech->BeginPass();
 		shader = tech->GetShader();
 	}
@@ -365,7 +383,7 @@ void CMiniMap::Draw()
 	else
 		territoryTexture.BindTexture(0);
 	
-	glEnable(GL_BLEND);
+	ogl_Enable(GL_BLEND);
 	glMatrixMode(GL_TEXTURE);
 	glLoadMatrixf(territoryTexture.GetMinimapTextureMatrix());
 	glMatrixMode(GL_MODELVIEW);
@@ -375,7 +393,7 @@ void CMiniMap::Draw()
 	glMatrixMode(GL_TEXTURE);
 	glLoadIdentity();
 	glMatrixMode(GL_MODELVIEW);
-	glDisable(GL_BLEND);
+	ogl_Disable(GL_BLEND);
 
 
 	// Draw the LOS quad in black, using alpha values from the LOS texture
@@ -387,7 +405,7 @@ void CMiniMap::Draw()
 
 		CShaderDefines defines;
 		defines.Add("MINIMAP_LOS", "1");
-		tech = g_Renderer.GetShaderManager().LoadEffect(CStrIntern("minimap"), g_Renderer.GetSystemShaderDefines(), defines);
+		tech = g_Renderer.GetShaderManager().LoadEffect(str_minimap, g_Renderer.GetSystemShaderDefines(), defines);
 		tech->BeginPass();
 		shader = tech->GetShader();
 		shader->BindTexture("baseTex", losTexture.GetTexture());
@@ -404,8 +422,8 @@ void CMiniMap::Draw()
 	glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_ALPHA_ARB, GL_REPLACE);
 	glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE0_ALPHA_ARB, GL_TEXTURE);
 	glTexEnvi(GL_TEXTURE_ENV, GL_OPERAND0_ALPHA_ARB, GL_ONE_MINUS_SRC_ALPHA);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	ogl_Enable(GL_BLEND);
+	ogl_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glColor3f(0.0f, 0.0f, 0.0f);
 
 	glMatrixMode(GL_TEXTURE);
@@ -418,7 +436,7 @@ void CMiniMap::Draw()
 	glLoadIdentity();
 	glMatrixMode(GL_MODELVIEW);
 
-	glDisable(GL_BLEND);
+	ogl_Disable(GL_BLEND);
 	
 	if (g_Renderer.GetRenderPath() == CRenderer::RP_SHADER)
 	{
@@ -426,7 +444,7 @@ void CMiniMap::Draw()
 
 		CShaderDefines defines;
 		defines.Add("MINIMAP_POINT", "1");
-		tech = g_Renderer.GetShaderManager().LoadEffect(CStrIntern("minimap"), g_Renderer.GetSystemShaderDefines(), defines);
+		tech = g_Renderer.GetShaderManager().LoadEffect(str_minimap, g_Renderer.GetSystemShaderDefines(), defines);
 		tech->BeginPass();
 		shader = tech->GetShader();
 	}
@@ -448,49 +466,29 @@ void CMiniMap::Draw()
 	// (~70msec/frame on a GF4 rendering a thousand points)
 	glPointSize(3.f);
 
-	float sx = (float)m_Width / ((m_MapSize - 1) * TERRAIN_TILE_SIZE);
-	float sy = (float)m_Height / ((m_MapSize - 1) * TERRAIN_TILE_SIZE);
-
-	CSimulation2::InterfaceList ents = sim->GetEntitiesWithInterface(IID_Minimap);
-
-	std::vector<MinimapUnitVertex> vertexArray;
-	vertexArray.reserve(ents.size());
-
-	for (CSimulation2::InterfaceList::const_iterator it = ents.begin(); it != ents.end(); ++it)
-	{
-		MinimapUnitVertex v;
-		ICmpMinimap* cmpMinimap = static_cast<ICmpMinimap*>(it->second);
-		entity_pos_t posX, posZ;
-		if (cmpMinimap->GetRenderData(v.r, v.g, v.b, posX, posZ))
-		{
-			ICmpRangeManager::ELosVisibility vis = cmpRangeManager->GetLosVisibility(it->first, g_Game->GetPlayerID());
-			if (vis != ICmpRangeManager::VIS_HIDDEN)
-			{
-				v.a = 255;
-				v.x = posX.ToFloat()*sx;
-				v.y = -posZ.ToFloat()*sy;
-				vertexArray.push_back(v);
-			}
-		}
-	}
-
-	if (!vertexArray.empty())
+	if (m_NumUnitVertices > 0)
 	{
 		glEnableClientState(GL_VERTEX_ARRAY);
 		glEnableClientState(GL_COLOR_ARRAY);
-		
+
+		u8* base = m_UnitVertices.Bind();
+		const GLsizei stride = (GLsizei)m_UnitVertices.GetStride();
+
 		if (g_Renderer.GetRenderPath() == CRenderer::RP_SHADER)
 		{
-			shader->VertexPointer(2, GL_FLOAT, sizeof(MinimapUnitVertex), &vertexArray[0].x);
-			shader->ColorPointer(4, GL_UNSIGNED_BYTE, sizeof(MinimapUnitVertex), &vertexArray[0].r);
+			shader->VertexPointer(2, GL_FLOAT, stride, base + m_AttributePos.offset);
+			shader->ColorPointer(4, GL_UNSIGNED_BYTE, stride, base + m_AttributeColor.offset);
 		}
 		else
 		{
-			glVertexPointer(2, GL_FLOAT, sizeof(MinimapUnitVertex), &vertexArray[0].x);
-			glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(MinimapUnitVertex), &vertexArray[0].r);
+			glVertexPointer(2, GL_FLOAT, stride, base + m_AttributePos.offset);
+			glColorPointer(4, GL_UNSIGNED_BYTE, stride, base + m_AttributeColor.offset);
 		}
 
-		glDrawArrays(GL_POINTS, 0, (GLsizei)vertexArray.size());
+		glDrawArrays(GL_POINTS, 0, (GLsizei)m_NumUnitVertices);
+
+		// (the rest of the GUI uses client-side vertex arrays)
+		CVertexBuffer::Unbind();
 
 		glDisableClientState(GL_COLOR_ARRAY);
 		glDisableClientState(GL_VERTEX_ARRAY);
@@ -504,7 +502,7 @@ void CMiniMap::Draw()
 
 		CShaderDefines defines;
 		defines.Add("MINIMAP_LINE", "1");
-		tech = g_Renderer.GetShaderManager().LoadEffect(CStrIntern("minimap"), g_Renderer.GetSystemShaderDefines(), defines);
+		tech = g_Renderer.GetShaderManager().LoadEffect(str_minimap, g_Renderer.GetSystemShaderDefines(), defines);
 		tech->BeginPass();
 		shader = tech->GetShader();
 	}
@@ -526,7 +524,7 @@ void CMiniMap::Draw()
 	// Reset everything back to normal
 	glPointSize(1.0f);
 	glEnable(GL_TEXTURE_2D);
-	glDepthMask(1);
+	ogl_DepthMask(1);
 }
 
 #endif // CONFIG2_GLES
@@ -548,35 +546,49 @@ void CMiniMap::CreateTextures()
 	delete[] texData;
 
 	m_TerrainData = new u32[(m_MapSize - 1) * (m_MapSize - 1)];
+	m_TextureMapSize = m_MapSize;
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
 	// Rebuild and upload both of them
-	RebuildTerrainTexture();
+	ssize_t i0, j0, i1, j1;
+	(void)m_Terrain->GetAndClearDirtyTiles(i0, j0, i1, j1);
+	RebuildTerrainTexture(0, 0, m_MapSize - 1, m_MapSize - 1);
+
+	// Make sure the units are updated in the next Draw
+	m_LastUpdateTime = 0.0;
 }
 
 
-void CMiniMap::RebuildTerrainTexture()
+void CMiniMap::RebuildTerrainTexture(ssize_t i0, ssize_t j0, ssize_t i1, ssize_t j1)
 {
-	u32 x = 0;
-	u32 y = 0;
-	u32 w = m_MapSize - 1;
-	u32 h = m_MapSize - 1;
+	i0 = clamp(i0, (ssize_t)0, m_MapSize - 1);
+	j0 = clamp(j0, (ssize_t)0, m_MapSize - 1);
+	i1 = clamp(i1, (ssize_t)0, m_MapSize - 1);
+	j1 = clamp(j1, (ssize_t)0, m_MapSize - 1);
+	if(i0 >= i1 || j0 >= j1)
+		return;
+
+	u32 x = (u32)i0;
+	u32 y = (u32)j0;
+	u32 w = (u32)(i1 - i0);
+	u32 h = (u32)(j1 - j0);
 	float waterHeight = g_Renderer.GetWaterManager()->m_WaterHeight;
 
 	m_TerrainDirty = false;
+	m_WaterHeight = waterHeight;
 
 	for(u32 j = 0; j < h; j++)
 	{
 		u32 *dataPtr = m_TerrainData + ((y + j) * (m_MapSize - 1)) + x;
 		for(u32 i = 0; i < w; i++)
 		{
-			float avgHeight = ( m_Terrain->GetVertexGroundLevel((int)i, (int)j)
-					+ m_Terrain->GetVertexGroundLevel((int)i+1, (int)j)
-					+ m_Terrain->GetVertexGroundLevel((int)i, (int)j+1)
-					+ m_Terrain->GetVertexGroundLevel((int)i+1, (int)j+1)
+			float avgHeight = ( m_Terrain->GetVertexGroundLevel((int)(x + i), (int)(y + j))
+					+ m_Terrain->GetVertexGroundLevel((int)(x + i)+1, (int)(y + j))
+					+ m_Terrain->GetVertexGroundLevel((int)(x + i), (int)(y + j)+1)
+					+ m_Terrain->GetVertexGroundLevel((int)(x + i)+1, (int)(y + j)+1)
 				) / 4.0f;
 
 			if(avgHeight < waterHeight && avgHeight > waterHeight - m_ShallowPassageHeight)
@@ -615,16 +627,74 @@ void CMiniMap::RebuildTerrainTexture()
 		}
 	}
 
-	// Upload the texture
+	// Upload the changed part of the texture
 	g_Renderer.BindTexture(0, m_TerrainTexture);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_MapSize - 1, m_MapSize - 1, GL_BGRA_EXT, GL_UNSIGNED_BYTE, m_TerrainData);
+	if((ssize_t)w == m_MapSize - 1)
+	{
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, w, h, GL_BGRA_EXT, GL_UNSIGNED_BYTE, m_TerrainData + y * (m_MapSize - 1));
+	}
+	else
+	{
+		// (GLES doesn't support GL_UNPACK_ROW_LENGTH, so copy the rows into a
+		// separate buffer)
+		std::vector<u32> data(w * h);
+		for(u32 j = 0; j < h; j++)
+			memcpy(&data[j * w], m_TerrainData + ((y + j) * (m_MapSize - 1)) + x, w * sizeof(u32));
+		glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_BGRA_EXT, GL_UNSIGNED_BYTE, &data[0]);
+	}
+}
+
+void CMiniMap::RebuildUnitVertices(float sx, float sy)
+{
+	PROFILE("minimap unit vertices");
+
+	CSimulation2* sim = g_Game->GetSimulation2();
+	CmpPtr<ICmpRangeManager> cmpRangeManager(*sim, SYSTEM_ENTITY);
+	ENSURE(cmpRangeManager);
+
+	const CSimulation2::InterfaceList& ents = sim->GetEntitiesWithInterfaceSorted(IID_Minimap);
+
+	// Grow the buffer in large steps, to avoid reallocating it whenever
+	// a few new entities are created
+	if(ents.size() > m_UnitVertices.GetNumVertices())
+	{
+		m_UnitVertices.SetNumVertices(std::max(ents.size() + 256, m_UnitVertices.GetNumVertices() * 2));
+		m_UnitVertices.Layout();
+	}
+
+	VertexArrayIterator<float[2]> attrPos = m_AttributePos.GetIterator<float[2]>();
+	VertexArrayIterator<SColor4ub> attrColor = m_AttributeColor.GetIterator<SColor4ub>();
+
+	m_NumUnitVertices = 0;
+	for (CSimulation2::InterfaceList::const_iterator it = ents.begin(); it != ents.end(); ++it)
+	{
+		ICmpMinimap* cmpMinimap = static_cast<ICmpMinimap*>(it->second);
+		u8 r, g, b;
+		entity_pos_t posX, posZ;
+		if (cmpMinimap->GetRenderData(r, g, b, posX, posZ))
+		{
+			ICmpRangeManager::ELosVisibility vis = cmpRangeManager->GetLosVisibility(it->first, g_Game->GetPlayerID());
+			if (vis != ICmpRangeManager::VIS_HIDDEN)
+			{
+				(*attrPos)[0] = posX.ToFloat()*sx;
+				(*attrPos)[1] = -posZ.ToFloat()*sy;
+				*attrColor = SColor4ub(r, g, b, 255);
+				++attrPos;
+				++attrColor;
+				++m_NumUnitVertices;
+			}
+		}
+	}
+
+	if (m_NumUnitVertices > 0)
+		m_UnitVertices.Upload();
 }
 
 void CMiniMap::Destroy()
 {
 	if(m_TerrainTexture)
 	{
-		glDeleteTextures(1, &m_TerrainTexture);
+		ogl_DeleteTextures(1, &m_TerrainTexture);
 		m_TerrainTexture = 0;
 	}
 
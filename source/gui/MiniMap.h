@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,6 +19,7 @@
 #define INCLUDED_MINIMAP
 
 #include "gui/GUI.h"
+#include "renderer/VertexArray.h"
 
 class CCamera;
 class CTerrain;
@@ -40,8 +41,12 @@ protected:
 	// create the minimap textures
 	void CreateTextures();
 
-	// rebuild the terrain texture map
-	void RebuildTerrainTexture();
+	// rebuild the terrain texture map, for the given range of tiles
+	// (inclusive lower bound, exclusive upper bound)
+	void RebuildTerrainTexture(ssize_t i0, ssize_t j0, ssize_t i1, ssize_t j1);
+
+	// rebuild the vertex buffer of unit dots
+	void RebuildUnitVertices(float sx, float sy);
 
 	// destroy and free any memory and textures
 	void Destroy();
@@ -51,7 +56,7 @@ protected:
 	void FireWorldClickEvent(int button, int clicks);
 
 	// the terrain we are mini-mapping
-	const CTerrain* m_Terrain;
+	CTerrain* m_Terrain;
 
 	const CCamera* m_Camera;
 
@@ -64,9 +69,24 @@ protected:
 	// texture data
 	u32* m_TerrainData;
 
-	// whether we need to regenerate the terrain texture
+	// whether we need to regenerate the whole terrain texture
 	bool m_TerrainDirty;
 
+	// water height that the terrain texture was generated with
+	float m_WaterHeight;
+
+	// map size that the terrain texture was created for
+	ssize_t m_TextureMapSize;
+
+	// time of the last update of the terrain texture and unit dots
+	double m_LastUpdateTime;
+
+	// unit dots (updated along with the terrain texture)
+	VertexArray m_UnitVertices;
+	VertexArray::Attribute m_AttributePos;
+	VertexArray::Attribute m_AttributeColor;
+	size_t m_NumUnitVertices;
+
 	ssize_t m_Width, m_Height;
 
 	// map size
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -658,6 +658,10 @@ JSBool JSI_IGUIObject::getComputedSize(JSContext* cx, uintN argc, jsval* vp)
 	if (!e)
 		return JS_FALSE;
 
+	// (Make sure any changes to ancestors' sizes have been applied first)
+	if (e->GetGUI())
+		e->GetGUI()->UpdateDirtySizes();
+
 	e->UpdateCachedSize();
 	CRect size = e->m_CachedActualSize;
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -88,6 +88,31 @@ void PopGuiPage(void* UNUSED(cbdata))
 	g_GUI->PopPage();
 }
 
+// GuiInterface functions that only read the simulation state, so the results of
+// calling them with the same arguments can be reused until the state changes.
+// (The session GUI calls these for the selection and the player every frame,
+// which is much slower than copying a saved result.)
+const wchar_t* const g_ReadOnlyGuiInterfaceCalls[] = {
+	L"CheckTechnologyRequirements",
+	L"GetEntityState",
+	L"GetFormationRequirements",
+	L"GetIncomingAttacks",
+	L"GetNeededResources",
+	L"GetSimulationState",
+	L"GetStartedResearch",
+	L"GetTechnologyData",
+	L"GetTemplateData",
+	L"IsTechnologyResearched",
+};
+
+bool IsReadOnlyGuiInterfaceCall(const std::wstring& name)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(g_ReadOnlyGuiInterfaceCalls); ++i)
+		if (name == g_ReadOnlyGuiInterfaceCalls[i])
+			return true;
+	return false;
+}
+
 CScriptVal GuiInterfaceCall(void* cbdata, std::wstring name, CScriptVal data)
 {
 	CGUIManager* guiManager = static_cast<CGUIManager*> (cbdata);
@@ -105,9 +130,37 @@ CScriptVal GuiInterfaceCall(void* cbdata, std::wstring name, CScriptVal data)
 	if (g_Game)
 		player = g_Game->GetPlayerID();
 
-	CScriptValRooted arg (sim->GetScriptInterface().GetContext(), sim->GetScriptInterface().CloneValueFromOtherContext(guiManager->GetScriptInterface(), data.get()));
-	CScriptVal ret (cmpGuiInterface->ScriptCall(player, name, arg.get()));
-	return guiManager->GetScriptInterface().CloneValueFromOtherContext(sim->GetScriptInterface(), ret.get());
+	ScriptInterface& simInterface = sim->GetScriptInterface();
+	ScriptInterface& guiInterface = guiManager->GetScriptInterface();
+
+	CScriptValRooted arg (simInterface.GetContext(), simInterface.CloneValueFromOtherContext(guiInterface, data.get()));
+
+	if (!IsReadOnlyGuiInterfaceCall(name))
+	{
+		// This might change what the read-only calls return (e.g. it might add
+		// a placement preview entity), so forget their saved results
+		sim->GetGuiQueryCache().clear();
+
+		CScriptVal ret (cmpGuiInterface->ScriptCall(player, name, arg.get()));
+		return guiInterface.CloneValueFromOtherContext(simInterface, ret.get());
+	}
+
+	std::stringstream key;
+	key << player << " " << utf8_from_wstring(name) << " " << simInterface.StringifyJSON(arg.get(), false);
+
+	CSimulation2::GuiQueryCache& cache = sim->GetGuiQueryCache();
+	CSimulation2::GuiQueryCache::iterator it = cache.find(key.str());
+	if (it == cache.end())
+	{
+		CScriptValRooted ret (simInterface.GetContext(), cmpGuiInterface->ScriptCall(player, name, arg.get()));
+		shared_ptr<ScriptInterface::StructuredClone> clone = simInterface.WriteStructuredClone(ret.get());
+		if (!clone)
+			return guiInterface.CloneValueFromOtherContext(simInterface, ret.get());
+		it = cache.insert(std::make_pair(key.str(), clone)).first;
+	}
+
+	// Each call gets its own copy, so the GUI can't modify the saved result
+	return guiInterface.ReadStructuredClone(it->second);
 }
 
 void PostNetworkCommand(void* cbdata, CScriptVal cmd)
@@ -0,0 +1,431 @@
+/* Copyright (c) 2013 Wildfire Games
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * small-object allocator with thread-local caches
+ */
+
+#include "precompiled.h"
+#include "lib/allocators/small_object.h"
+
+#include "lib/alignment.h"
+#include "lib/module_init.h"
+#include "lib/sysdep/cpu.h"
+#include "lib/sysdep/vm.h"
+
+#include <new>
+
+static const size_t objectSizes[] = { 16, 32, 48, 64, 96, 128, 192, 256 };
+static const size_t numSizeClasses = ARRAY_SIZE(objectSizes);
+
+// each chunk holds objects of a single size class
+static const size_t chunkSize = 64*KiB;
+
+// (much of this will never be committed; it only has to be large enough
+// for the peak usage, after which we fall back to malloc)
+static const size_t regionSize = size_t(1) << (sizeof(void*) == 8 ? 32 : 28);
+static const size_t numChunks = regionSize / chunkSize;
+
+// freed blocks are linked through their first word
+static inline void*& NextBlock(void* block)
+{
+	return *(void**)block;
+}
+
+// number of blocks moved between the thread and global freelists at once
+static inline size_t BatchLength(size_t sizeClass)
+{
+	return chunkSize / objectSizes[sizeClass] / 16;
+}
+
+struct ThreadCache
+{
+	void* freelists[numSizeClasses];
+	size_t lengths[numSizeClasses];
+	u64 allocations[numSizeClasses];
+	u64 deallocations[numSizeClasses];
+	ThreadCache* next;	// (list of all threads' caches, for the statistics)
+};
+
+struct SizeClass
+{
+	pthread_mutex_t mutex;
+	void* freelist;
+	size_t length;
+	uintptr_t chunkPos;	// unused part of the current chunk
+	uintptr_t chunkEnd;
+	size_t chunks;
+	u64 retiredAllocations;	// of threads that have exited
+	u64 retiredDeallocations;
+};
+
+static uintptr_t regionBase;	// 0 until initialized
+static volatile intptr_t nextChunk;
+static u8 sizeClassFromChunk[numChunks];
+static u8 sizeClassFromSize[small_object_maxSize/16 + 1];	// indexed by ceil(size/16)
+static SizeClass sizeClasses[numSizeClasses];
+
+static pthread_key_t cacheKey;
+static pthread_mutex_t cachesMutex = PTHREAD_MUTEX_INITIALIZER;
+static ThreadCache* caches;
+
+static ModuleInitState initState;
+static volatile bool initializing;
+
+
+//-----------------------------------------------------------------------------
+// global freelists
+
+// move up to @p count blocks from the global freelist (or new chunks) to
+// the front of @p freelist.
+// @return number of blocks moved
+static size_t TakeBlocks(size_t sizeClass, void*& freelist, size_t count)
+{
+	SizeClass& sc = sizeClasses[sizeClass];
+	const size_t objectSize = objectSizes[sizeClass];
+
+	size_t taken = 0;
+	pthread_mutex_lock(&sc.mutex);
+
+	while(taken < count && sc.freelist)
+	{
+		void* block = sc.freelist;
+		sc.freelist = NextBlock(block);
+		sc.length--;
+		NextBlock(block) = freelist;
+		freelist = block;
+		taken++;
+	}
+
+	while(taken < count)
+	{
+		if(sc.chunkPos + objectSize > sc.chunkEnd)
+		{
+			const intptr_t chunk = cpu_AtomicAdd(&nextChunk, 1);
+			if(chunk >= (intptr_t)numChunks)
+				break;	// region exhausted
+			const uintptr_t address = regionBase + chunk*chunkSize;
+			if(!vm::Commit(address, chunkSize, vm::kSmall))
+				break;
+			sizeClassFromChunk[chunk] = (u8)sizeClass;
+			sc.chunkPos = address;
+			sc.chunkEnd = address + chunkSize;
+			sc.chunks++;
+		}
+
+		void* block = (void*)sc.chunkPos;
+		sc.chunkPos += objectSize;
+		NextBlock(block) = freelist;
+		freelist = block;
+		taken++;
+	}
+
+	pthread_mutex_unlock(&sc.mutex);
+	return taken;
+}
+
+// move the list of @p count blocks starting at @p blocks to the global freelist.
+static void GiveBlocks(size_t sizeClass, void* blocks, size_t count)
+{
+	if(count == 0)
+		return;
+
+	void* last = blocks;
+	for(size_t i = 1; i < count; i++)
+		last = NextBlock(last);
+
+	SizeClass& sc = sizeClasses[sizeClass];
+	pthread_mutex_lock(&sc.mutex);
+	NextBlock(last) = sc.freelist;
+	sc.freelist = blocks;
+	sc.length += count;
+	pthread_mutex_unlock(&sc.mutex);
+}
+
+
+//-----------------------------------------------------------------------------
+// thread caches
+
+static void ReleaseThreadCache(void* data)
+{
+	ThreadCache* cache = (ThreadCache*)data;
+
+	for(size_t sizeClass = 0; sizeClass < numSizeClasses; sizeClass++)
+	{
+		GiveBlocks(sizeClass, cache->freelists[sizeClass], cache->lengths[sizeClass]);
+
+		SizeClass& sc = sizeClasses[sizeClass];
+		pthread_mutex_lock(&sc.mutex);
+		sc.retiredAllocations += cache->allocations[sizeClass];
+		sc.retiredDeallocations += cache->deallocations[sizeClass];
+		pthread_mutex_unlock(&sc.mutex);
+	}
+
+	pthread_mutex_lock(&cachesMutex);
+	for(ThreadCache** pos = &caches; *pos; pos = &(*pos)->next)
+	{
+		if(*pos == cache)
+		{
+			*pos = cache->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&cachesMutex);
+
+	free(cache);
+}
+
+static ThreadCache* GetThreadCache()
+{
+	ThreadCache* cache = (ThreadCache*)pthread_getspecific(cacheKey);
+	if(cache)
+		return cache;
+
+	// (allocated with malloc since we're probably inside operator new)
+	cache = (ThreadCache*)malloc(sizeof(ThreadCache));
+	if(!cache)
+		return 0;
+	memset(cache, 0, sizeof(ThreadCache));
+
+	pthread_mutex_lock(&cachesMutex);
+	cache->next = caches;
+	caches = cache;
+	pthread_mutex_unlock(&cachesMutex);
+
+	WARN_IF_ERR(pthread_setspecific(cacheKey, cache));
+	return cache;
+}
+
+
+//-----------------------------------------------------------------------------
+
+static Status Init()
+{
+	initializing = true;
+
+	for(size_t sizeClass = 0, size = 0; size <= small_object_maxSize; size += 16)
+	{
+		while(objectSizes[sizeClass] < size)
+			sizeClass++;
+		sizeClassFromSize[size/16] = (u8)sizeClass;
+	}
+
+	for(size_t sizeClass = 0; sizeClass < numSizeClasses; sizeClass++)
+		pthread_mutex_init(&sizeClasses[sizeClass].mutex, 0);
+
+	int ret = pthread_key_create(&cacheKey, ReleaseThreadCache);
+	if(ret != 0)
+	{
+		initializing = false;
+		return ERR::FAIL;
+	}
+
+	void* region = vm::ReserveAddressSpace(regionSize, chunkSize, vm::kSmall);
+	initializing = false;
+	if(!region)
+		return ERR::NO_MEM;
+
+	COMPILER_FENCE;
+	regionBase = (uintptr_t)region;
+	return INFO::OK;
+}
+
+void* small_object_Allocate(size_t size)
+{
+	if(size > small_object_maxSize)
+		return 0;
+
+	if(!regionBase)
+	{
+		// (the OS functions used by Init might allocate; they'll get malloc)
+		if(initializing)
+			return 0;
+		(void)ModuleInit(&initState, Init);
+		if(!regionBase)
+			return 0;
+	}
+
+	const size_t sizeClass = sizeClassFromSize[(size+15)/16];
+
+	ThreadCache* cache = GetThreadCache();
+	if(!cache)
+		return 0;
+
+	void*& freelist = cache->freelists[sizeClass];
+	if(!freelist)
+	{
+		cache->lengths[sizeClass] += TakeBlocks(sizeClass, freelist, BatchLength(sizeClass));
+		if(!freelist)
+			return 0;
+	}
+
+	void* block = freelist;
+	freelist = NextBlock(block);
+	cache->lengths[sizeClass]--;
+	cache->allocations[sizeClass]++;
+	return block;
+}
+
+bool small_object_Deallocate(void* p)
+{
+	if(!small_object_Contains(p))
+		return false;
+
+	const size_t sizeClass = sizeClassFromChunk[(uintptr_t(p) - regionBase) / chunkSize];
+
+	ThreadCache* cache = GetThreadCache();
+	if(!cache)
+	{
+		GiveBlocks(sizeClass, p, 1);
+		return true;
+	}
+
+	void*& freelist = cache->freelists[sizeClass];
+	NextBlock(p) = freelist;
+	freelist = p;
+	cache->deallocations[sizeClass]++;
+
+	// don't let one thread hoard memory that's freed by it but allocated
+	// by others (e.g. a worker destroying the main thread's objects).
+	// the most recently freed blocks are kept, since they're probably
+	// still in the CPU cache.
+	const size_t batchLength = BatchLength(sizeClass);
+	if(++cache->lengths[sizeClass] > 2*batchLength)
+	{
+		void* last = freelist;
+		for(size_t i = 1; i < batchLength; i++)
+			last = NextBlock(last);
+		void* rest = NextBlock(last);
+		NextBlock(last) = 0;
+		GiveBlocks(sizeClass, rest, cache->lengths[sizeClass] - batchLength);
+		cache->lengths[sizeClass] = batchLength;
+	}
+
+	return true;
+}
+
+bool small_object_Contains(const void* p)
+{
+	return regionBase && (uintptr_t(p) - regionBase) < regionSize;
+}
+
+size_t small_object_NumSizeClasses()
+{
+	return numSizeClasses;
+}
+
+void small_object_GetStatistics(size_t sizeClass, SmallObjectStatistics& statistics)
+{
+	ENSURE(sizeClass < numSizeClasses);
+	statistics.objectSize = objectSizes[sizeClass];
+	statistics.allocations = 0;
+	statistics.deallocations = 0;
+	statistics.chunks = 0;
+	if(!regionBase)
+		return;
+
+	SizeClass& sc = sizeClasses[sizeClass];
+	pthread_mutex_lock(&sc.mutex);
+	statistics.allocations = sc.retiredAllocations;
+	statistics.deallocations = sc.retiredDeallocations;
+	statistics.chunks = sc.chunks;
+	pthread_mutex_unlock(&sc.mutex);
+
+	pthread_mutex_lock(&cachesMutex);
+	for(ThreadCache* cache = caches; cache; cache = cache->next)
+	{
+		statistics.allocations += cache->allocations[sizeClass];
+		statistics.deallocations += cache->deallocations[sizeClass];
+	}
+	pthread_mutex_unlock(&cachesMutex);
+}
+
+void small_object_DumpStatistics()
+{
+	debug_printf(L"small object allocator:\n");
+	for(size_t sizeClass = 0; sizeClass < numSizeClasses; sizeClass++)
+	{
+		SmallObjectStatistics statistics;
+		small_object_GetStatistics(sizeClass, statistics);
+		debug_printf(L"  %3d bytes: %llu allocations, %llu live, %d KiB committed\n",
+			(int)statistics.objectSize, (unsigned long long)statistics.allocations,
+			(unsigned long long)(statistics.allocations - statistics.deallocations),
+			(int)(statistics.chunks*chunkSize/KiB));
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// global operator new/delete
+
+#if CONFIG2_SMALL_OBJECT_ALLOCATOR
+
+void* operator new(size_t size) throw(std::bad_alloc)
+{
+	void* p = small_object_Allocate(size);
+	if(!p)
+	{
+		p = malloc(size? size : 1);
+		if(!p)
+			throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new[](size_t size) throw(std::bad_alloc)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) throw()
+{
+	void* p = small_object_Allocate(size);
+	return p? p : malloc(size? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& nothrow) throw()
+{
+	return operator new(size, nothrow);
+}
+
+void operator delete(void* p) throw()
+{
+	if(p && !small_object_Deallocate(p))
+		free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+	operator delete(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) throw()
+{
+	operator delete(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) throw()
+{
+	operator delete(p);
+}
+
+#endif	// CONFIG2_SMALL_OBJECT_ALLOCATOR
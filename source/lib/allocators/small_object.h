@@ -0,0 +1,94 @@
+/* Copyright (c) 2013 Wildfire Games
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * small-object allocator with thread-local caches
+ */
+
+#ifndef INCLUDED_ALLOCATORS_SMALL_OBJECT
+#define INCLUDED_ALLOCATORS_SMALL_OBJECT
+
+/**
+ * allocator design parameters:
+ * - O(1) allocation and deallocation, usually without any locking;
+ * - variable-size blocks of up to small_object_maxSize bytes, rounded up to
+ *   one of a few size classes;
+ * - no headers: the size class is looked up from the block's address;
+ * - objects are aligned to 16 bytes.
+ *
+ * mechanism:
+ * - one reserved region of address space, committed in chunks that each
+ *   hold objects of a single size class;
+ * - each thread has a freelist per size class. blocks freed by any thread
+ *   go into that thread's freelist; longer lists are returned in batches to
+ *   a global (locked) freelist, which is also where empty thread freelists
+ *   are refilled from.
+ *
+ * if CONFIG2_SMALL_OBJECT_ALLOCATOR is enabled, the global operator new
+ * and delete use this allocator for small sizes (and malloc otherwise).
+ **/
+
+static const size_t small_object_maxSize = 256;
+
+/**
+ * @return a block of at least @p size bytes, or 0 if size is larger than
+ * small_object_maxSize or the reserved region is exhausted.
+ * may be called by any thread.
+ **/
+LIB_API void* small_object_Allocate(size_t size);
+
+/**
+ * free a block, if it was returned by small_object_Allocate.
+ * may be called by any thread, not only the one that allocated it.
+ *
+ * @return false (and leave it untouched) if @p p wasn't allocated here.
+ **/
+LIB_API bool small_object_Deallocate(void* p);
+
+/**
+ * @return whether @p p lies within memory that's managed by this allocator.
+ **/
+LIB_API bool small_object_Contains(const void* p);
+
+struct SmallObjectStatistics
+{
+	size_t objectSize;
+	u64 allocations;
+	u64 deallocations;
+	size_t chunks;	// number of chunks committed for this size class
+};
+
+LIB_API size_t small_object_NumSizeClasses();
+
+/**
+ * get the number of allocations etc. so far of one size class.
+ * the counts of other threads are read without locking, so they may be
+ * slightly out of date.
+ **/
+LIB_API void small_object_GetStatistics(size_t sizeClass, SmallObjectStatistics& statistics);
+
+/**
+ * print the statistics of every size class to the debug output.
+ **/
+LIB_API void small_object_DumpStatistics();
+
+#endif	// #ifndef INCLUDED_ALLOCATORS_SMALL_OBJECT
@@ -0,0 +1,117 @@
+/* Copyright (c) 2013 Wildfire Games
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "lib/self_test.h"
+
+#include "lib/allocators/small_object.h"
+
+#include <set>
+
+class TestSmallObject : public CxxTest::TestSuite
+{
+	static void* FreeOnThread(void* p)
+	{
+		TS_ASSERT(small_object_Deallocate(p));
+		return 0;
+	}
+
+public:
+	void test_Basic()
+	{
+		void* p1 = small_object_Allocate(1);
+		void* p2 = small_object_Allocate(100);
+		void* p3 = small_object_Allocate(small_object_maxSize);
+		TS_ASSERT(p1 && p2 && p3);
+		TS_ASSERT_EQUALS(uintptr_t(p1) % 16, uintptr_t(0));
+		TS_ASSERT_EQUALS(uintptr_t(p2) % 16, uintptr_t(0));
+		TS_ASSERT_EQUALS(uintptr_t(p3) % 16, uintptr_t(0));
+		TS_ASSERT(small_object_Contains(p1));
+
+		memset(p3, 0xFF, small_object_maxSize);
+
+		// too large
+		TS_ASSERT_EQUALS(small_object_Allocate(small_object_maxSize+1), (void*)0);
+
+		TS_ASSERT(small_object_Deallocate(p1));
+		TS_ASSERT(small_object_Deallocate(p2));
+		TS_ASSERT(small_object_Deallocate(p3));
+
+		// not ours
+		int local;
+		TS_ASSERT(!small_object_Contains(&local));
+		TS_ASSERT(!small_object_Deallocate(&local));
+	}
+
+	void test_Reuse()
+	{
+		// a freed block is the next one of its size class to be allocated
+		void* p1 = small_object_Allocate(40);
+		TS_ASSERT(small_object_Deallocate(p1));
+		void* p2 = small_object_Allocate(48);
+		TS_ASSERT_EQUALS(p1, p2);
+		TS_ASSERT(small_object_Deallocate(p2));
+	}
+
+	void test_Many()
+	{
+		// enough to need several batches and chunks
+		std::vector<void*> blocks;
+		std::set<void*> unique;
+		for(size_t i = 0; i < 20000; i++)
+		{
+			void* p = small_object_Allocate(i % small_object_maxSize);
+			TS_ASSERT(p);
+			blocks.push_back(p);
+			unique.insert(p);
+		}
+		TS_ASSERT_EQUALS(unique.size(), blocks.size());
+
+		for(size_t i = 0; i < blocks.size(); i++)
+			TS_ASSERT(small_object_Deallocate(blocks[i]));
+	}
+
+	void test_OtherThread()
+	{
+		void* p = small_object_Allocate(64);
+		pthread_t thread;
+		TS_ASSERT_EQUALS(pthread_create(&thread, 0, FreeOnThread, p), 0);
+		pthread_join(thread, 0);
+	}
+
+	void test_Statistics()
+	{
+		TS_ASSERT_EQUALS(small_object_NumSizeClasses(), (size_t)8);
+
+		SmallObjectStatistics before;
+		small_object_GetStatistics(2, before);
+		TS_ASSERT_EQUALS(before.objectSize, (size_t)48);
+
+		void* p = small_object_Allocate(33);
+		TS_ASSERT(small_object_Deallocate(p));
+
+		SmallObjectStatistics after;
+		small_object_GetStatistics(2, after);
+		TS_ASSERT_EQUALS(after.allocations, before.allocations+1);
+		TS_ASSERT_EQUALS(after.deallocations, before.deallocations+1);
+		TS_ASSERT_LESS_THAN_EQUALS((size_t)1, after.chunks);
+	}
+};
@@ -111,4 +111,11 @@
 # define CONFIG2_NVTT 1
 #endif
 
+// replace the global operator new and delete with the small-object
+// allocator (see lib/allocators/small_object.h), which avoids the system
+// heap's locking for small blocks.
+#ifndef CONFIG2_SMALL_OBJECT_ALLOCATOR
+# define CONFIG2_SMALL_OBJECT_ALLOCATOR 0
+#endif
+
 #endif	// #ifndef INCLUDED_CONFIG2
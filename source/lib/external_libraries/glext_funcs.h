@@ -1,4 +1,4 @@
-/* Copyright (c) 2011 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -129,6 +129,9 @@ typedef GLuint GLhandleARB;
 // GL_EXT_draw_range_elements / GL1.2:
 FUNC2(void, glDrawRangeElementsEXT, glDrawRangeElements, "1.2", (GLenum, GLuint, GLuint, GLsizei, GLenum, GLvoid*))
 
+// GL_EXT_multi_draw_arrays / GL1.4:
+FUNC2(void, glMultiDrawElementsEXT, glMultiDrawElements, "1.4", (GLenum, const GLsizei*, GLenum, const GLvoid**, GLsizei))
+
 // GL_ARB_multitexture / GL1.3:
 FUNC2(void, glMultiTexCoord2fARB, glMultiTexCoord2f, "1.3", (int, float, float))
 FUNC2(void, glMultiTexCoord3fARB, glMultiTexCoord3f, "1.3", (int, float, float, float))
@@ -339,6 +342,12 @@ FUNC2(void, glGetUniformuivEXT, glGetUniformuiv, "3.0", (GLuint program, GLint l
 FUNC2(void, glBindFragDataLocationEXT, glBindFragDataLocation, "3.0", (GLuint program, GLuint colorNumber, const char *name))
 FUNC2(GLint, glGetFragDataLocationEXT, glGetFragDataLocation, "3.0", (GLuint program, const char *name))
 
+// GL_ARB_draw_instanced / GL3.1:
+FUNC2(void, glDrawElementsInstancedARB, glDrawElementsInstanced, "3.1", (GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLsizei primcount))
+
+// GL_ARB_instanced_arrays / GL3.3:
+FUNC2(void, glVertexAttribDivisorARB, glVertexAttribDivisor, "3.3", (GLuint index, GLuint divisor))
+
 // GL_ARB_occlusion_query / GL1.5:
 FUNC2(void, glGenQueriesARB, glGenQueries, "1.5", (GLsizei n, GLuint *ids))
 FUNC2(void, glDeleteQueriesARB, glDeleteQueries, "1.5", (GLsizei n, const GLuint *ids))
@@ -361,6 +370,11 @@ FUNC2(void, glQueryCounter, glQueryCounter, "3.3", (GLuint id, GLenum target))
 FUNC2(void, glGetQueryObjecti64v, glGetQueryObjecti64v, "3.3", (GLuint id, GLenum pname, GLint64 *params))
 FUNC2(void, glGetQueryObjectui64v, glGetQueryObjectui64v, "3.3", (GLuint id, GLenum pname, GLuint64 *params))
 
+// GL_ARB_get_program_binary / GL4.1:
+FUNC2(void, glGetProgramBinary, glGetProgramBinary, "4.1", (GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, GLvoid *binary))
+FUNC2(void, glProgramBinary, glProgramBinary, "4.1", (GLuint program, GLenum binaryFormat, const GLvoid *binary, GLsizei length))
+FUNC2(void, glProgramParameteri, glProgramParameteri, "4.1", (GLuint program, GLenum pname, GLint value))
+
 // GL_GREMEDY_string_marker (from gDEBugger)
 FUNC(int, glStringMarkerGREMEDY, (GLsizei len, const GLvoid *string))
 
@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -27,12 +27,46 @@
 #include "precompiled.h"
 #include "lib/file/archive/archive.h"
 
+#include "lib/byte_order.h"
+
 static const StatusDefinition archiveStatusDefinitions[] = {
 	{ ERR::ARCHIVE_UNKNOWN_FORMAT, L"Unknown archive format" },
 	{ ERR::ARCHIVE_UNKNOWN_METHOD, L"Unknown compression method" }
 };
 STATUS_ADD_DEFINITIONS(archiveStatusDefinitions);
 
+bool IsArchiveEntryIncompressible(const Path& pathname, const u8* data, size_t size)
+{
+	const Path extension = pathname.Extension();
+
+	// file extensions that we don't want to compress
+	static const wchar_t* incompressibleExtensions[] =
+	{
+		L".zip", L".rar",
+		L".jpg", L".jpeg", L".png",
+		L".ogg", L".mp3"
+	};
+
+	for(size_t i = 0; i < ARRAY_SIZE(incompressibleExtensions); i++)
+	{
+		if(extension == incompressibleExtensions[i])
+			return true;
+	}
+
+	// DXT-compressed textures only shrink by a few percent, whereas
+	// uncompressed ones are worth compressing. (the pixel format's flags
+	// and FOURCC follow the "DDS " magic and the first 72 bytes of the header.)
+	if(extension == L".dds" && data && size >= 88 && !memcmp(data, "DDS ", 4))
+	{
+		const u32 DDPF_FOURCC = 0x4;
+		const u32 flags = read_le32(data+80);
+		if((flags & DDPF_FOURCC) && !memcmp(data+84, "DXT", 3))
+			return true;
+	}
+
+	return false;
+}
+
 IArchiveReader::~IArchiveReader()
 {
 }
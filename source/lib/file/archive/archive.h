@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -61,6 +61,18 @@ struct IArchiveReader
 
 typedef shared_ptr<IArchiveReader> PIArchiveReader;
 
+/**
+ * @return whether a file is unlikely to get any smaller when compressed,
+ * because it is already in a compressed format. this is decided by its
+ * extension and (if data is given) its contents, e.g. DDS textures are
+ * only incompressible if they use DXT compression.
+ *
+ * @param pathname of the file (only the extension is used)
+ * @param data the file contents, or 0 if unknown
+ * @param size the length of data
+ **/
+LIB_API bool IsArchiveEntryIncompressible(const Path& pathname, const u8* data, size_t size);
+
 // note: when creating an archive, any existing file with the given pathname
 // will be overwritten.
 
@@ -102,6 +114,31 @@ struct IArchiveWriter
 	 * @param pathnameInArchive the name to store in the archive
 	 **/
 	virtual Status AddMemory(const u8* data, size_t size, time_t mtime, const OsPath& pathnameInArchive) = 0;
+
+	/**
+	 * add a file to the archive without compressing it, when it is already
+	 * in memory. (this lets callers that have already decided the file
+	 * isn't worth compressing avoid wasting time on trying.)
+	 *
+	 * @param data the file contents to add
+	 * @param size the length of data
+	 * @param mtime the last-modified-time to be stored in the archive
+	 * @param pathnameInArchive the name to store in the archive
+	 **/
+	virtual Status AddStoredMemory(const u8* data, size_t size, time_t mtime, const OsPath& pathnameInArchive) = 0;
+
+	/**
+	 * add a file to the archive, when it has already been compressed
+	 * (in the raw deflate format, as produced by CreateCompressor_ZLibDeflate).
+	 *
+	 * @param cdata the compressed file contents
+	 * @param csize the length of cdata
+	 * @param usize the length of the uncompressed file
+	 * @param checksum CRC32 of the uncompressed file
+	 * @param mtime the last-modified-time to be stored in the archive
+	 * @param pathnameInArchive the name to store in the archive
+	 **/
+	virtual Status AddCompressedMemory(const u8* cdata, size_t csize, size_t usize, u32 checksum, time_t mtime, const OsPath& pathnameInArchive) = 0;
 };
 
 typedef shared_ptr<IArchiveWriter> PIArchiveWriter;
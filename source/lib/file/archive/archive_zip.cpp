@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -34,6 +34,7 @@
 #include "lib/bits.h"
 #include "lib/byte_order.h"
 #include "lib/allocators/pool.h"
+#include "lib/posix/posix_mman.h"
 #include "lib/sysdep/filesystem.h"
 #include "lib/file/archive/archive.h"
 #include "lib/file/archive/codec_zlib.h"
@@ -292,10 +293,10 @@ cassert(sizeof(ECDR) == 22);
 class ArchiveFile_Zip : public IArchiveFile
 {
 public:
-	ArchiveFile_Zip(const PFile& file, off_t ofs, off_t csize, u32 checksum, ZipMethod method)
-		: m_file(file), m_ofs(ofs)
+	ArchiveFile_Zip(const PFile& file, const shared_ptr<u8>& mapping, off_t mappingSize, off_t ofs, off_t csize, u32 checksum, ZipMethod method)
+		: m_file(file), m_mapping(mapping), m_mappingSize(mappingSize), m_ofs(ofs)
 		, m_csize(csize), m_checksum(checksum), m_method((u16)method)
-		, m_flags(NeedsFixup)
+		, m_dataOfs(0)
 	{
 	}
 
@@ -316,7 +317,9 @@ public:
 
 	virtual Status Load(const OsPath& UNUSED(name), const shared_ptr<u8>& buf, size_t size) const
 	{
-		AdjustOffset();
+		const off_t dataOfs = DataOffset();
+		if(dataOfs == 0)
+			WARN_RETURN(ERR::CORRUPTED);
 
 		PICodec codec;
 		switch(m_method)
@@ -333,9 +336,20 @@ public:
 
 		Stream stream(codec);
 		stream.SetOutputBuffer(buf.get(), size);
-		io::Operation op(*m_file.get(), 0, m_csize, m_ofs);
-		StreamFeeder streamFeeder(stream);
-		RETURN_STATUS_IF_ERR(io::Run(op, io::Parameters(), streamFeeder));
+		// (if the archive is mapped, the cdata can be decompressed straight
+		// from the mapping into buf, without reading it into blocks first)
+		if(m_mapping)
+		{
+			if(dataOfs + m_csize > m_mappingSize)
+				WARN_RETURN(ERR::CORRUPTED);
+			RETURN_STATUS_IF_ERR(stream.Feed(m_mapping.get() + dataOfs, (size_t)m_csize));
+		}
+		else
+		{
+			io::Operation op(*m_file.get(), 0, m_csize, dataOfs);
+			StreamFeeder streamFeeder(stream);
+			RETURN_STATUS_IF_ERR(io::Run(op, io::Parameters(), streamFeeder));
+		}
 		RETURN_STATUS_IF_ERR(stream.Finish());
 #if CODEC_COMPUTE_CHECKSUM
 		ENSURE(m_checksum == stream.Checksum());
@@ -344,22 +358,27 @@ public:
 		return INFO::OK;
 	}
 
-private:
-	enum Flags
-	{
-		// indicates m_ofs points to a "local file header" instead of
-		// the file data. a fixup routine is called when reading the file;
-		// it skips past the LFH and clears this flag.
-		// this is somewhat of a hack, but vital to archive open performance.
-		// without it, we'd have to scan through the entire archive file,
-		// which can take *seconds*.
-		// (we cannot use the information in CDFH, because its 'extra' field
-		// has been observed to differ from that of the LFH)
-		// since we read the LFH right before the rest of the file, the block
-		// cache will absorb the IO cost.
-		NeedsFixup = 1
-	};
+	virtual Status Map(const OsPath& UNUSED(name), shared_ptr<u8>& buf, size_t size) const
+	{
+		// (compressed entries have to be decompressed into a new buffer anyway)
+		if(!m_mapping || m_method != ZIP_METHOD_NONE)
+			return INFO::SKIPPED;
 
+		const off_t dataOfs = DataOffset();
+		if(dataOfs == 0 || dataOfs + off_t(size) > m_mappingSize)
+			WARN_RETURN(ERR::CORRUPTED);
+
+		// (aliases the mapping, which therefore stays alive as long as buf)
+		buf = shared_ptr<u8>(m_mapping, m_mapping.get() + dataOfs);
+		return INFO::OK;
+	}
+
+	virtual off_t Position(const OsPath& UNUSED(name)) const
+	{
+		return m_ofs;
+	}
+
+private:
 	struct LFH_Copier
 	{
 		LFH_Copier(u8* lfh_dst, size_t lfh_bytes_remaining)
@@ -389,7 +408,11 @@ private:
 	};
 
 	/**
-	 * fix up m_ofs (adjust it to point to cdata instead of the LFH).
+	 * determine the offset of the cdata, i.e. skip past the LFH at m_ofs.
+	 *
+	 * this is somewhat of a hack, but vital to archive open performance.
+	 * without it, we'd have to scan through the entire archive file,
+	 * which can take *seconds*.
 	 *
 	 * note: we cannot use CDFH filename and extra field lengths to skip
 	 * past LFH since that may not mirror CDFH (has happened).
@@ -397,30 +420,57 @@ private:
 	 * this is called at file-open time instead of while mounting to
 	 * reduce seeks: since reading the file will typically follow, the
 	 * block cache entirely absorbs the IO cost.
+	 *
+	 * @return offset, or 0 if the LFH couldn't be read.
 	 **/
-	void AdjustOffset() const
+	off_t DataOffset() const
 	{
-		if(!(m_flags & NeedsFixup))
-			return;
-		m_flags &= ~NeedsFixup;
+		// (files may be loaded by several threads at once. they all
+		// compute the same value, so it doesn't matter who stores it.)
+		if(m_dataOfs != 0)
+			return (off_t)m_dataOfs;
 
-		// performance note: this ends up reading one file block, which is
-		// only in the block cache if the file starts in the same block as a
-		// previously read file (i.e. both are small).
-		LFH lfh;
-		io::Operation op(*m_file.get(), 0, sizeof(LFH), m_ofs);
-		if(io::Run(op, io::Parameters(), LFH_Copier((u8*)&lfh, sizeof(LFH))) == INFO::OK)
-			m_ofs += (off_t)lfh.Size();
+		off_t lfhSize;
+		// (the LFH is directly accessible if the archive is mapped)
+		if(m_mapping)
+		{
+			if(m_ofs + off_t(sizeof(LFH)) > m_mappingSize)
+				return 0;
+			const LFH* lfh = (const LFH*)(m_mapping.get() + m_ofs);
+			lfhSize = (off_t)lfh->Size();
+		}
+		else
+		{
+			// performance note: this ends up reading one file block, which is
+			// only in the block cache if the file starts in the same block as a
+			// previously read file (i.e. both are small).
+			LFH lfh;
+			io::Operation op(*m_file.get(), 0, sizeof(LFH), m_ofs);
+			if(io::Run(op, io::Parameters(), LFH_Copier((u8*)&lfh, sizeof(LFH))) != INFO::OK)
+				return 0;
+			lfhSize = (off_t)lfh.Size();
+		}
+
+		m_dataOfs = m_ofs + lfhSize;
+		return (off_t)m_dataOfs;
 	}
 
 	PFile m_file;
 
+	// the entire archive, if it was memory-mapped (otherwise null)
+	shared_ptr<u8> m_mapping;
+	off_t m_mappingSize;
+
 	// all relevant LFH/CDFH fields not covered by FileInfo
-	mutable off_t m_ofs;
+	off_t m_ofs;	// of the LFH
 	off_t m_csize;
 	u32 m_checksum;
 	u16 m_method;
-	mutable u16 m_flags;
+
+	// offset of the cdata, or 0 if not yet known (see DataOffset).
+	// (Zip offsets are 32-bit, so even if this isn't written atomically,
+	// readers only ever see 0 or the final value.)
+	mutable volatile i64 m_dataOfs;
 };
 
 
@@ -431,7 +481,7 @@ private:
 class ArchiveReader_Zip : public IArchiveReader
 {
 public:
-	ArchiveReader_Zip(const OsPath& pathname)
+	ArchiveReader_Zip(const OsPath& pathname, bool mapFile)
 		: m_file(new File(pathname, O_RDONLY))
 	{
 		FileInfo fileInfo;
@@ -439,6 +489,9 @@ public:
 		m_fileSize = fileInfo.Size();
 		const size_t minFileSize = sizeof(LFH)+sizeof(CDFH)+sizeof(ECDR);
 		ENSURE(m_fileSize >= off_t(minFileSize));
+
+		if(mapFile)
+			MapFile();
 	}
 
 	virtual Status ReadEntries(ArchiveEntryCallback cb, uintptr_t cbData)
@@ -467,7 +520,7 @@ public:
 			{
 				const OsPath name = relativePathname.Filename();
 				FileInfo fileInfo(name, cdfh->USize(), cdfh->MTime());
-				shared_ptr<ArchiveFile_Zip> archiveFile(new ArchiveFile_Zip(m_file, cdfh->HeaderOffset(), cdfh->CSize(), cdfh->Checksum(), cdfh->Method()));
+				shared_ptr<ArchiveFile_Zip> archiveFile(new ArchiveFile_Zip(m_file, m_mapping, m_fileSize, cdfh->HeaderOffset(), cdfh->CSize(), cdfh->Checksum(), cdfh->Method()));
 				cb(relativePathname, fileInfo, archiveFile, cbData);
 			}
 
@@ -562,15 +615,48 @@ private:
 			WARN_RETURN(ERR::ARCHIVE_UNKNOWN_FORMAT);
 	}
 
+	struct MappingDeleter
+	{
+		MappingDeleter(size_t size)
+			: size(size)
+		{
+		}
+
+		void operator()(u8* p) const
+		{
+			(void)munmap(p, size);
+		}
+
+		size_t size;
+	};
+
+	/**
+	 * map the entire archive into memory (copy-on-write, so the loaded
+	 * file contents can still be modified by their users).
+	 * the mapping is shared by all entries and released when none of them
+	 * (and none of the buffers returned by Map) remain.
+	 * failure isn't an error - the entries are then just read normally.
+	 **/
+	void MapFile()
+	{
+		if(off_t(size_t(m_fileSize)) != m_fileSize)	// too large for the address space
+			return;
+		void* p = mmap(0, (size_t)m_fileSize, PROT_READ|PROT_WRITE, MAP_PRIVATE, m_file->Descriptor(), 0);
+		if(p == MAP_FAILED)
+			return;
+		m_mapping = shared_ptr<u8>((u8*)p, MappingDeleter((size_t)m_fileSize));
+	}
+
 	PFile m_file;
 	off_t m_fileSize;
+	shared_ptr<u8> m_mapping;
 };
 
-PIArchiveReader CreateArchiveReader_Zip(const OsPath& archivePathname)
+PIArchiveReader CreateArchiveReader_Zip(const OsPath& archivePathname, bool mapFile)
 {
 	try
 	{
-		return PIArchiveReader(new ArchiveReader_Zip(archivePathname));
+		return PIArchiveReader(new ArchiveReader_Zip(archivePathname, mapFile));
 	}
 	catch(Status)
 	{
@@ -618,17 +704,24 @@ public:
 		PFile file(new File);
 		RETURN_STATUS_IF_ERR(file->Open(pathname, O_RDONLY));
 
-		return AddFileOrMemory(fileInfo, pathnameInArchive, file, NULL);
+		return AddFileOrMemory(fileInfo, pathnameInArchive, file, NULL, false);
 	}
 
 	Status AddMemory(const u8* data, size_t size, time_t mtime, const OsPath& pathnameInArchive)
 	{
 		FileInfo fileInfo(pathnameInArchive, size, mtime);
 
-		return AddFileOrMemory(fileInfo, pathnameInArchive, PFile(), data);
+		return AddFileOrMemory(fileInfo, pathnameInArchive, PFile(), data, false);
 	}
 
-	Status AddFileOrMemory(const FileInfo& fileInfo, const OsPath& pathnameInArchive, const PFile& file, const u8* data)
+	Status AddStoredMemory(const u8* data, size_t size, time_t mtime, const OsPath& pathnameInArchive)
+	{
+		FileInfo fileInfo(pathnameInArchive, size, mtime);
+
+		return AddFileOrMemory(fileInfo, pathnameInArchive, PFile(), data, true);
+	}
+
+	Status AddFileOrMemory(const FileInfo& fileInfo, const OsPath& pathnameInArchive, const PFile& file, const u8* data, bool store)
 	{
 		ENSURE((file && !data) || (data && !file));
 
@@ -649,7 +742,9 @@ public:
 		// choose method and the corresponding codec
 		ZipMethod method;
 		PICodec codec;
-		if(m_noDeflate || IsFileTypeIncompressible(pathnameInArchive))
+		// (the contents of files aren't known until they're read, so
+		// those are only checked by extension)
+		if(store || m_noDeflate || IsArchiveEntryIncompressible(pathnameInArchive, data, size_t(usize)))
 		{
 			method = ZIP_METHOD_NONE;
 			codec = CreateCodec_ZLibNone();
@@ -691,16 +786,7 @@ public:
 			lfh->Init(fileInfo, (off_t)csize, method, checksum, pathnameInArchive);
 		}
 
-		// append a CDFH to the central directory (in memory)
-		const off_t ofs = m_fileSize;
-		const size_t prev_pos = m_cdfhPool.da.pos;	// (required to determine padding size)
-		const size_t cdfhSize = sizeof(CDFH) + pathnameLength;
-		CDFH* cdfh = (CDFH*)pool_alloc(&m_cdfhPool, cdfhSize);
-		if(!cdfh)
-			WARN_RETURN(ERR::NO_MEM);
-		const size_t slack = m_cdfhPool.da.pos - prev_pos - cdfhSize;
-		cdfh->Init(fileInfo, ofs, (off_t)csize, method, checksum, pathnameInArchive, slack);
-		m_numEntries++;
+		RETURN_STATUS_IF_ERR(AddCDFH(fileInfo, (off_t)csize, method, checksum, pathnameInArchive));
 
 		// write LFH, pathname and cdata to file
 		const size_t packageSize = sizeof(LFH) + pathnameLength + csize;
@@ -711,26 +797,51 @@ public:
 		return INFO::OK;
 	}
 
-private:
-	static bool IsFileTypeIncompressible(const OsPath& pathname)
+	Status AddCompressedMemory(const u8* cdata, size_t csize, size_t usize, u32 checksum, time_t mtime, const OsPath& pathnameInArchive)
 	{
-		const OsPath extension = pathname.Extension();
+		FileInfo fileInfo(pathnameInArchive, usize, mtime);
 
-		// file extensions that we don't want to compress
-		static const wchar_t* incompressibleExtensions[] =
-		{
-			L".zip", L".rar",
-			L".jpg", L".jpeg", L".png", 
-			L".ogg", L".mp3"
-		};
+		// (see rationale in AddFileOrMemory)
+		if(!usize)
+			return INFO::SKIPPED;
+
+		const size_t pathnameLength = pathnameInArchive.string().length();
 
-		for(size_t i = 0; i < ARRAY_SIZE(incompressibleExtensions); i++)
+		// build LFH (the data is written directly from cdata,
+		// to avoid copying what might be a large buffer)
+		UniqueRange buf(RVALUE(io::Allocate(sizeof(LFH) + pathnameLength)));
 		{
-			if(extension == incompressibleExtensions[i])
-				return true;
+			LFH* lfh = (LFH*)buf.get();
+			lfh->Init(fileInfo, (off_t)csize, ZIP_METHOD_DEFLATE, checksum, pathnameInArchive);
 		}
 
-		return false;
+		RETURN_STATUS_IF_ERR(AddCDFH(fileInfo, (off_t)csize, ZIP_METHOD_DEFLATE, checksum, pathnameInArchive));
+
+		// write LFH, pathname and cdata to file
+		if(write(m_file->Descriptor(), buf.get(), sizeof(LFH) + pathnameLength) < 0)
+			WARN_RETURN(ERR::IO);
+		if(write(m_file->Descriptor(), cdata, csize) < 0)
+			WARN_RETURN(ERR::IO);
+		m_fileSize += (off_t)(sizeof(LFH) + pathnameLength + csize);
+
+		return INFO::OK;
+	}
+
+private:
+	// append a CDFH for the entry that is about to be written to the central directory (in memory)
+	Status AddCDFH(const FileInfo& fileInfo, off_t csize, ZipMethod method, u32 checksum, const OsPath& pathnameInArchive)
+	{
+		const size_t pathnameLength = pathnameInArchive.string().length();
+		const off_t ofs = m_fileSize;
+		const size_t prev_pos = m_cdfhPool.da.pos;	// (required to determine padding size)
+		const size_t cdfhSize = sizeof(CDFH) + pathnameLength;
+		CDFH* cdfh = (CDFH*)pool_alloc(&m_cdfhPool, cdfhSize);
+		if(!cdfh)
+			WARN_RETURN(ERR::NO_MEM);
+		const size_t slack = m_cdfhPool.da.pos - prev_pos - cdfhSize;
+		cdfh->Init(fileInfo, ofs, csize, method, checksum, pathnameInArchive, slack);
+		m_numEntries++;
+		return INFO::OK;
 	}
 
 	PFile m_file;
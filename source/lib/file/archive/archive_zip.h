@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -30,9 +30,12 @@
 #include "lib/file/archive/archive.h"
 
 /**
+ * @param mapFile memory-map the archive, so that its uncompressed entries
+ * can be accessed via IFileLoader::Map without copying. (falls back to
+ * regular reads if the mapping fails.)
  * @return 0 if opening the archive failed (e.g. because an external program is holding on to it)
  **/
-LIB_API PIArchiveReader CreateArchiveReader_Zip(const OsPath& archivePathname);
+LIB_API PIArchiveReader CreateArchiveReader_Zip(const OsPath& archivePathname, bool mapFile = false);
 
 /**
  * @return 0 if opening the archive failed (e.g. because an external program is holding on to it)
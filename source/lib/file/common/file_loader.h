@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -34,6 +34,24 @@ struct IFileLoader
 	virtual OsPath Path() const = 0;
 
 	virtual Status Load(const OsPath& name, const shared_ptr<u8>& buf, size_t size) const = 0;
+
+	/**
+	 * provide the file contents without copying them into a new buffer
+	 * (e.g. by referencing a memory-mapped archive).
+	 *
+	 * the memory is copy-on-write, so callers may modify it.
+	 *
+	 * @return INFO::SKIPPED if that isn't possible; callers should then
+	 * fall back to Load.
+	 **/
+	virtual Status Map(const OsPath& name, shared_ptr<u8>& buf, size_t size) const = 0;
+
+	/**
+	 * @return approximate offset of the file's data within Path(), which
+	 * is used to order reads such that fewer seeks are needed
+	 * (0 if unknown).
+	 **/
+	virtual off_t Position(const OsPath& name) const = 0;
 };
 
 typedef shared_ptr<IFileLoader> PIFileLoader;
@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -52,6 +52,21 @@ RealDirectory::RealDirectory(const OsPath& path, size_t priority, size_t flags)
 }
 
 
+/*virtual*/ Status RealDirectory::Map(const OsPath& UNUSED(name), shared_ptr<u8>& UNUSED(buf), size_t UNUSED(size)) const
+{
+	// (loose files are usually small and modified during development,
+	// so they are always read)
+	return INFO::SKIPPED;
+}
+
+
+/*virtual*/ off_t RealDirectory::Position(const OsPath& UNUSED(name)) const
+{
+	// (the location of loose files on disk isn't known)
+	return 0;
+}
+
+
 Status RealDirectory::Store(const OsPath& name, const shared_ptr<u8>& fileContents, size_t size)
 {
 	return io::Store(m_path / name, fileContents.get(), size);
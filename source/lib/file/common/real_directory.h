@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -50,6 +50,8 @@ public:
 		return m_path;
 	}
 	virtual Status Load(const OsPath& name, const shared_ptr<u8>& buf, size_t size) const;
+	virtual Status Map(const OsPath& name, shared_ptr<u8>& buf, size_t size) const;
+	virtual off_t Position(const OsPath& name) const;
 
 	Status Store(const OsPath& name, const shared_ptr<u8>& fileContents, size_t size);
 
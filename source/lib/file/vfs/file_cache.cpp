@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -32,11 +32,13 @@
 #include "lib/file/common/file_stats.h"
 #include "lib/adts/cache_adt.h"
 #include "lib/bits.h"                   // round_up
+#include "lib/fnv_hash.h"
 #include "lib/allocators/allocator_checker.h"
 #include "lib/allocators/shared_ptr.h"
 #include "lib/allocators/headerless.h"
 #include "lib/sysdep/os_cpu.h"	// os_cpu_PageSize
 #include "lib/posix/posix_mman.h"	// mprotect
+#include "lib/posix/posix_pthread.h"
 
 
 //-----------------------------------------------------------------------------
@@ -87,19 +89,40 @@ private:
 };
 
 
-// adds statistics and AllocatorChecker to a HeaderlessAllocator
+class FileCacheLock
+{
+	NONCOPYABLE(FileCacheLock);
+public:
+	FileCacheLock(pthread_mutex_t& mutex) : m_mutex(mutex) { pthread_mutex_lock(&m_mutex); }
+	~FileCacheLock() { pthread_mutex_unlock(&m_mutex); }
+
+private:
+	pthread_mutex_t& m_mutex;
+};
+
+
+// adds statistics, AllocatorChecker and a lock to a HeaderlessAllocator.
+// (buffers may be freed by whichever thread releases the last reference,
+// so this needs its own lock rather than relying on its cache shard's.)
 class Allocator
 {
 public:
 	Allocator(size_t maxSize)
-		: m_allocator(maxSize)
+		: m_allocator(maxSize), m_allocatedBytes(0)
 	{
+		pthread_mutex_init(&m_mutex, 0);
+	}
+
+	~Allocator()
+	{
+		pthread_mutex_destroy(&m_mutex);
 	}
 
 	shared_ptr<u8> Allocate(size_t size, const PAllocator& pthis)
 	{
 		const size_t alignedSize = Align<maxSectorSize>(size);
 
+		FileCacheLock lock(m_mutex);
 		u8* mem = (u8*)m_allocator.Allocate(alignedSize);
 		if(!mem)
 			return DummySharedPtr<u8>(0);	// (prevent FileCacheDeleter from seeing a null pointer)
@@ -108,6 +131,7 @@ public:
 		m_checker.OnAllocate(mem, alignedSize);
 #endif
 
+		m_allocatedBytes += alignedSize;
 		stats_buf_alloc(size, alignedSize);
 		return shared_ptr<u8>(mem, FileCacheDeleter(size, pthis));
 	}
@@ -121,16 +145,27 @@ public:
 		// HeaderlessAllocator needs to affix boundary tags.
 		(void)mprotect(mem, size, PROT_READ|PROT_WRITE);
 
+		FileCacheLock lock(m_mutex);
 #ifndef NDEBUG
 		m_checker.OnDeallocate(mem, alignedSize);
 #endif
 		m_allocator.Deallocate(mem, alignedSize);
+		m_allocatedBytes -= alignedSize;
 
 		stats_buf_free();
 	}
 
+	size_t GetAllocatedBytes()
+	{
+		FileCacheLock lock(m_mutex);
+		return m_allocatedBytes;
+	}
+
 private:
+	pthread_mutex_t m_mutex;
+
 	HeaderlessAllocator m_allocator;
+	size_t m_allocatedBytes;	// including buffers evicted from the cache but still referenced
 
 #ifndef NDEBUG
 	AllocatorChecker m_checker;
@@ -145,7 +180,7 @@ void FileCacheDeleter::operator()(u8* mem) const
 
 
 //-----------------------------------------------------------------------------
-// FileCache::Impl
+// FileCacheShard
 //-----------------------------------------------------------------------------
 
 // since users are strongly encouraged to only load/process one file at a
@@ -154,12 +189,20 @@ void FileCacheDeleter::operator()(u8* mem) const
 // hash map should be fast enough and this way is less work than maintaining
 // (possibly disjunct) cached and extant lists.
 
-class FileCache::Impl
+// one independently locked part of the cache, with its own memory region.
+class FileCacheShard
 {
+	NONCOPYABLE(FileCacheShard);
 public:
-	Impl(size_t maxSize)
-		: m_allocator(new Allocator(maxSize))
+	FileCacheShard(size_t maxSize)
+		: m_maxSize(maxSize), m_allocator(new Allocator(maxSize))
 	{
+		pthread_mutex_init(&m_mutex, 0);
+	}
+
+	~FileCacheShard()
+	{
+		pthread_mutex_destroy(&m_mutex);
 	}
 
 	shared_ptr<u8> Reserve(size_t size)
@@ -167,6 +210,11 @@ public:
 		// (should never happen because the VFS ensures size != 0.)
 		ENSURE(size != 0);
 
+		if(size >= m_maxSize/2)	// (avoid evicting lots of previous data)
+			return shared_ptr<u8>();
+
+		FileCacheLock lock(m_mutex);
+
 		// (300 iterations have been observed when reserving several MB
 		// of space in a full cache)
 		for(;;)
@@ -193,6 +241,14 @@ public:
 
 	void Add(const VfsPath& pathname, const shared_ptr<u8>& data, size_t size, size_t cost)
 	{
+		FileCacheLock lock(m_mutex);
+
+		// another thread may have loaded and added the same file meanwhile;
+		// keep its copy (ours is freed when the caller is done with it).
+		shared_ptr<u8> existingData;
+		if(m_cache.peek(pathname, existingData))
+			return;
+
 		// zero-copy cache => all users share the contents => must not
 		// allow changes. this will be reverted when deallocating.
 		(void)mprotect((void*)data.get(), size, PROT_READ);
@@ -206,18 +262,29 @@ public:
 		// in case of a cache miss; doing so is left to the caller.)
 		stats_buf_ref();
 
+		FileCacheLock lock(m_mutex);
 		return m_cache.retrieve(pathname, data, &size);
 	}
 
 	void Remove(const VfsPath& pathname)
 	{
+		FileCacheLock lock(m_mutex);
 		m_cache.remove(pathname);
 
 		// note: we could check if someone is still holding a reference
 		// to the contents, but that currently doesn't matter.
 	}
 
+	size_t GetAllocatedBytes() const
+	{
+		return m_allocator->GetAllocatedBytes();
+	}
+
 private:
+	pthread_mutex_t m_mutex;
+
+	size_t m_maxSize;
+
 	typedef Cache<VfsPath, shared_ptr<u8> > CacheType;
 	CacheType m_cache;
 
@@ -225,6 +292,50 @@ private:
 };
 
 
+//-----------------------------------------------------------------------------
+// FileCache::Impl
+//-----------------------------------------------------------------------------
+
+// files are distributed among several shards by pathname, so that threads
+// loading different files rarely contend for the same lock. each shard
+// manages its own part of the memory; this is a compromise between
+// contention and the largest file that can be cached.
+class FileCache::Impl
+{
+public:
+	Impl(size_t maxSize)
+	{
+		for(size_t i = 0; i < numShards; i++)
+			m_shards[i] = new FileCacheShard(maxSize/numShards);
+	}
+
+	~Impl()
+	{
+		for(size_t i = 0; i < numShards; i++)
+			delete m_shards[i];
+	}
+
+	FileCacheShard& Shard(const VfsPath& pathname)
+	{
+		const VfsPath::String& string = pathname.string();
+		const u32 hash = fnv_hash(string.c_str(), string.length()*sizeof(string[0]));
+		return *m_shards[hash % numShards];
+	}
+
+	size_t GetAllocatedBytes() const
+	{
+		size_t bytes = 0;
+		for(size_t i = 0; i < numShards; i++)
+			bytes += m_shards[i]->GetAllocatedBytes();
+		return bytes;
+	}
+
+private:
+	static const size_t numShards = 4;
+	FileCacheShard* m_shards[numShards];
+};
+
+
 //-----------------------------------------------------------------------------
 
 FileCache::FileCache(size_t size)
@@ -232,22 +343,27 @@ FileCache::FileCache(size_t size)
 {
 }
 
-shared_ptr<u8> FileCache::Reserve(size_t size)
+shared_ptr<u8> FileCache::Reserve(const VfsPath& pathname, size_t size)
 {
-	return impl->Reserve(size);
+	return impl->Shard(pathname).Reserve(size);
 }
 
 void FileCache::Add(const VfsPath& pathname, const shared_ptr<u8>& data, size_t size, size_t cost)
 {
-	impl->Add(pathname, data, size, cost);
+	impl->Shard(pathname).Add(pathname, data, size, cost);
 }
 
 void FileCache::Remove(const VfsPath& pathname)
 {
-	impl->Remove(pathname);
+	impl->Shard(pathname).Remove(pathname);
 }
 
 bool FileCache::Retrieve(const VfsPath& pathname, shared_ptr<u8>& data, size_t& size)
 {
-	return impl->Retrieve(pathname, data, size);
+	return impl->Shard(pathname).Retrieve(pathname, data, size);
+}
+
+size_t FileCache::GetAllocatedBytes() const
+{
+	return impl->GetAllocatedBytes();
 }
@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -41,6 +41,11 @@
  * reference should be active at a time. in other words, read a file,
  * process it, and only then start reading the next file.
  *
+ * all member functions are thread-safe. the cache is split into several
+ * independently locked shards (each with their own part of the memory),
+ * chosen by pathname, so concurrent loads of different files rarely block
+ * each other.
+ *
  * rationale: this is rather similar to BlockCache; however, the differences
  * (Reserve's size parameter, eviction policies) are enough to warrant
  * separate implementations.
@@ -57,13 +62,17 @@ public:
 	/**
 	 * Reserve a chunk of the cache's memory region.
 	 *
+	 * @param pathname of the file that will be stored here (determines
+	 * which shard of the cache is used).
 	 * @param size required number of bytes (more may be allocated due to
 	 * alignment and/or internal fragmentation)
-	 * @return memory suitably aligned for IO; never fails.
+	 * @return memory suitably aligned for IO, or 0 if the file is too
+	 * large for the cache or the cache is full of referenced data.
 	 *
-	 * it is expected that this data will be Add()-ed once its IO completes.
+	 * it is expected that this data will be Add()-ed with the same
+	 * pathname once its IO completes.
 	 **/
-	shared_ptr<u8> Reserve(size_t size);
+	shared_ptr<u8> Reserve(const VfsPath& pathname, size_t size);
 
 	/**
 	 * Add a file's contents to the cache.
@@ -72,6 +81,8 @@ public:
 	 * returning this data; if CONFIG2_CACHE_READ_ONLY, the buffer is made
 	 * read-only. If need be and no references are currently attached to it,
 	 * the memory can also be commandeered by Reserve().
+	 * if another thread has already added the same file, its contents
+	 * are kept instead.
 	 *
 	 * @param data
 	 * @param size
@@ -100,6 +111,13 @@ public:
 	 **/
 	bool Retrieve(const VfsPath& pathname, shared_ptr<u8>& data, size_t& size);
 
+	/**
+	 * @return total size [bytes] of the buffers currently allocated from
+	 * the cache's memory (including any that have been evicted but are
+	 * still referenced).
+	 **/
+	size_t GetAllocatedBytes() const;
+
 private:
 	class Impl;
 	shared_ptr<Impl> impl;
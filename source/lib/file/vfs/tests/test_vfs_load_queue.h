@@ -0,0 +1,124 @@
+/* Copyright (c) 2013 Wildfire Games
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "lib/self_test.h"
+
+#include "lib/external_libraries/libsdl.h"
+#include "lib/file/vfs/vfs.h"
+
+class TestVfsLoadQueue : public CxxTest::TestSuite
+{
+	PIVFS m_VFS;
+
+	struct Result
+	{
+		Result() : numCalls(0), ret(INFO::OK), size(0) { }
+
+		size_t numCalls;
+		Status ret;
+		shared_ptr<u8> fileContents;
+		size_t size;
+	};
+
+	static void LoadCallback(const VfsPath& UNUSED(pathname), Status ret, const shared_ptr<u8>& fileContents, size_t size, uintptr_t cbData)
+	{
+		Result* result = (Result*)cbData;
+		result->numCalls++;
+		result->ret = ret;
+		result->fileContents = fileContents;
+		result->size = size;
+	}
+
+	void WaitForLoads(size_t count)
+	{
+		size_t numCompleted = 0;
+		for(size_t i = 0; i < 500 && numCompleted < count; ++i)
+		{
+			numCompleted += m_VFS->PollAsyncLoads();
+			if(numCompleted < count)
+				SDL_Delay(10);
+		}
+		TS_ASSERT_EQUALS(numCompleted, count);
+	}
+
+public:
+	void setUp()
+	{
+		m_VFS = CreateVfs(20*MiB);
+		TS_ASSERT_OK(m_VFS->Mount(L"", DataDir()/"mods"/"_test.tex", VFS_MOUNT_MUST_EXIST));
+	}
+
+	void tearDown()
+	{
+		m_VFS.reset();
+	}
+
+	void test_load()
+	{
+		const VfsPath pathname(L"art/textures/a/demo.png");
+
+		Result result;
+		u32 id = m_VFS->LoadFileAsync(pathname, 0, LoadCallback, (uintptr_t)&result);
+		TS_ASSERT_DIFFERS(id, (u32)0);
+		TS_ASSERT_EQUALS(result.numCalls, (size_t)0);	// (callbacks only run in PollAsyncLoads)
+		WaitForLoads(1);
+		TS_ASSERT_EQUALS(result.numCalls, (size_t)1);
+		TS_ASSERT_OK(result.ret);
+
+		shared_ptr<u8> fileContents; size_t size;
+		TS_ASSERT_OK(m_VFS->LoadFile(pathname, fileContents, size));
+		TS_ASSERT_EQUALS(result.size, size);
+		TS_ASSERT_SAME_DATA(result.fileContents.get(), fileContents.get(), size);
+
+		// (cancelling a finished request does nothing)
+		m_VFS->CancelLoad(id);
+		TS_ASSERT_EQUALS(m_VFS->PollAsyncLoads(), (size_t)0);
+	}
+
+	void test_missing_file()
+	{
+		Result result;
+		m_VFS->LoadFileAsync(L"art/textures/a/nonexistent.png", 0, LoadCallback, (uintptr_t)&result);
+		WaitForLoads(1);
+		TS_ASSERT_EQUALS(result.numCalls, (size_t)1);
+		TS_ASSERT_EQUALS(result.ret, ERR::VFS_FILE_NOT_FOUND);
+	}
+
+	void test_cancel()
+	{
+		Result results[3];
+		m_VFS->LoadFileAsync(L"art/textures/a/demo.png", 0, LoadCallback, (uintptr_t)&results[0]);
+		u32 cancelled = m_VFS->LoadFileAsync(L"art/textures/a/demo.tga", 0, LoadCallback, (uintptr_t)&results[1]);
+		m_VFS->LoadFileAsync(L"art/textures/a/demo-dxt1.dds", 1, LoadCallback, (uintptr_t)&results[2]);
+		m_VFS->CancelLoad(cancelled);
+
+		WaitForLoads(2);
+		SDL_Delay(50);
+		TS_ASSERT_EQUALS(m_VFS->PollAsyncLoads(), (size_t)0);
+
+		TS_ASSERT_EQUALS(results[0].numCalls, (size_t)1);
+		TS_ASSERT_EQUALS(results[1].numCalls, (size_t)0);
+		TS_ASSERT_EQUALS(results[2].numCalls, (size_t)1);
+		TS_ASSERT_OK(results[0].ret);
+		TS_ASSERT_OK(results[2].ret);
+	}
+};
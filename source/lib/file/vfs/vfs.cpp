@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -34,6 +34,7 @@
 #include "lib/file/vfs/vfs_lookup.h"
 #include "lib/file/vfs/vfs_populate.h"
 #include "lib/file/vfs/file_cache.h"
+#include "lib/file/vfs/vfs_load_queue.h"
 
 static const StatusDefinition vfsStatusDefinitions[] = {
 	{ ERR::VFS_DIR_NOT_FOUND, L"VFS directory not found" },
@@ -52,9 +53,9 @@ struct ScopedLock
 class VFS : public IVFS
 {
 public:
-	VFS(size_t cacheSize)
+	VFS(size_t cacheSize, bool recordTrace)
 		: m_cacheSize(cacheSize), m_fileCache(m_cacheSize)
-		, m_trace(CreateDummyTrace(8*MiB))
+		, m_trace(recordTrace? CreateTrace(8*MiB) : CreateDummyTrace(8*MiB)), m_loadQueue(*this)
 	{
 	}
 
@@ -151,42 +152,92 @@ public:
 
 	virtual Status LoadFile(const VfsPath& pathname, shared_ptr<u8>& fileContents, size_t& size)
 	{
-		ScopedLock s;
+		// (the file cache does its own locking, and the IO happens without
+		// holding the lock, so that several threads can load files at once.)
 		const bool isCacheHit = m_fileCache.Retrieve(pathname, fileContents, size);
 		if(!isCacheHit)
 		{
-			VfsDirectory* directory; VfsFile* file;
-			// per 2010-05-01 meeting, this shouldn't raise 'scary error
-			// dialogs', which might fail to display the culprit pathname
-			// instead, callers should log the error, including pathname.
-			RETURN_STATUS_IF_ERR(vfs_Lookup(pathname, &m_rootDirectory, directory, &file));
+			PIFileLoader loader;
+			VfsPath name;
+			{
+				ScopedLock s;
+				VfsDirectory* directory; VfsFile* file;
+				// per 2010-05-01 meeting, this shouldn't raise 'scary error
+				// dialogs', which might fail to display the culprit pathname
+				// instead, callers should log the error, including pathname.
+				RETURN_STATUS_IF_ERR(vfs_Lookup(pathname, &m_rootDirectory, directory, &file));
+				loader = file->Loader();
+				name = file->Name();
+				size = file->Size();
+			}
 
 			fileContents = DummySharedPtr((u8*)0);
-			size = file->Size();
 			if(size != 0)	// (the file cache can't handle zero-length allocations)
 			{
-				if(size < m_cacheSize/2)	// (avoid evicting lots of previous data)
-					fileContents = m_fileCache.Reserve(size);
-				if(fileContents)
+				// (mapped contents aren't cached - they're already in memory)
+				const Status mapRet = loader->Map(name, fileContents, size);
+				if(mapRet == INFO::SKIPPED)
 				{
-					RETURN_STATUS_IF_ERR(file->Loader()->Load(file->Name(), fileContents, file->Size()));
-					m_fileCache.Add(pathname, fileContents, size);
+					if(size < m_cacheSize/2)	// (avoid evicting lots of previous data)
+						fileContents = m_fileCache.Reserve(pathname, size);
+					if(fileContents)
+					{
+						RETURN_STATUS_IF_ERR(loader->Load(name, fileContents, size));
+						m_fileCache.Add(pathname, fileContents, size);
+					}
+					else
+					{
+						RETURN_STATUS_IF_ERR(AllocateAligned(fileContents, size, maxSectorSize));
+						RETURN_STATUS_IF_ERR(loader->Load(name, fileContents, size));
+					}
 				}
 				else
-				{
-					RETURN_STATUS_IF_ERR(AllocateAligned(fileContents, size, maxSectorSize));
-					RETURN_STATUS_IF_ERR(file->Loader()->Load(file->Name(), fileContents, file->Size()));
-				}
+					RETURN_STATUS_IF_ERR(mapRet);
 			}
 		}
 
+		ScopedLock s;
 		stats_io_user_request(size);
 		stats_cache(isCacheHit? CR_HIT : CR_MISS, size);
 		m_trace->NotifyLoad(pathname, size);
+		if(m_sessionTrace)
+			m_sessionTrace->NotifyLoad(pathname, size);
 
 		return INFO::OK;
 	}
 
+	virtual u32 LoadFileAsync(const VfsPath& pathname, int priority, LoadFileCallback cb, uintptr_t cbData)
+	{
+		PIFileLoader loader;
+		VfsPath name;
+		{
+			ScopedLock s;
+			VfsDirectory* directory; VfsFile* file;
+			const Status ret = vfs_Lookup(pathname, &m_rootDirectory, directory, &file);
+			if(ret != INFO::OK)
+				return m_loadQueue.AddFailed(pathname, ret, cb, cbData);
+			loader = file->Loader();
+			name = file->Name();
+		}
+
+		return m_loadQueue.Add(pathname, priority, loader->Path(), loader->Position(name), cb, cbData);
+	}
+
+	virtual void CancelLoad(u32 id)
+	{
+		m_loadQueue.Cancel(id);
+	}
+
+	virtual size_t PollAsyncLoads()
+	{
+		return m_loadQueue.Poll();
+	}
+
+	virtual size_t GetCacheSize() const
+	{
+		return m_fileCache.GetAllocatedBytes();
+	}
+
 	virtual std::wstring TextRepresentation() const
 	{
 		ScopedLock s;
@@ -253,6 +304,18 @@ public:
 		m_rootDirectory.Clear();
 	}
 
+	virtual Status StoreTrace(const OsPath& pathname) const
+	{
+		ScopedLock s;
+		return m_trace->Store(pathname);
+	}
+
+	virtual void SetSessionTrace(const PITrace& trace)
+	{
+		ScopedLock s;
+		m_sessionTrace = trace;
+	}
+
 private:
 	Status FindRealPathR(const OsPath& realPath, const VfsDirectory& directory, const VfsPath& curPath, VfsPath& path)
 	{
@@ -279,12 +342,17 @@ private:
 	size_t m_cacheSize;
 	FileCache m_fileCache;
 	PITrace m_trace;
+	PITrace m_sessionTrace;
 	mutable VfsDirectory m_rootDirectory;
+
+	// (must come last, so that its thread is stopped before the rest
+	// of the VFS is destroyed)
+	VfsLoadQueue m_loadQueue;
 };
 
 //-----------------------------------------------------------------------------
 
-PIVFS CreateVfs(size_t cacheSize)
+PIVFS CreateVfs(size_t cacheSize, bool recordTrace)
 {
-	return PIVFS(new VFS(cacheSize));
+	return PIVFS(new VFS(cacheSize, recordTrace));
 }
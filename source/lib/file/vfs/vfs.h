@@ -1,4 +1,4 @@
-/* Copyright (c) 2012 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -29,6 +29,7 @@
 #define INCLUDED_VFS
 
 #include "lib/file/file_system.h"	// FileInfo
+#include "lib/file/common/trace.h"
 #include "lib/file/vfs/vfs_path.h"
 
 namespace ERR
@@ -65,11 +66,20 @@ enum VfsMountFlags
 	 * ".DELETED" suffix will still apply.
 	 * (the default behavior is to hide both the suffixed and unsuffixed files)
 	 **/
-	VFS_MOUNT_KEEP_DELETED = 8
+	VFS_MOUNT_KEEP_DELETED = 8,
+
+	/**
+	 * memory-map archives found in the mounted directories, so that
+	 * uncompressed entries can be loaded without any copying.
+	 * (this requires enough address space for the entire archive, so
+	 * it is only worthwhile on 64-bit systems.)
+	 **/
+	VFS_MOUNT_MAP_ARCHIVES = 16
 };
 
 // (member functions are thread-safe after the instance has been
-// constructed - each acquires a pthread mutex.)
+// constructed - each acquires a pthread mutex. LoadFile only holds it
+// while looking up the file, so loads can proceed in parallel.)
 struct IVFS
 {
 	virtual ~IVFS() {}
@@ -151,6 +161,49 @@ struct IVFS
 	 **/
 	virtual Status LoadFile(const VfsPath& pathname, shared_ptr<u8>& fileContents, size_t& size) = 0;
 
+	/**
+	 * called by PollAsyncLoads when an asynchronous load has finished.
+	 *
+	 * @param ret Status of the load; fileContents and size are only
+	 *		  valid if it is INFO::OK. (the same CAVEAT as for LoadFile
+	 *		  applies to fileContents.)
+	 **/
+	typedef void (*LoadFileCallback)(const VfsPath& pathname, Status ret, const shared_ptr<u8>& fileContents, size_t size, uintptr_t cbData);
+
+	/**
+	 * start reading an entire file into memory on a background thread.
+	 *
+	 * pending loads are served in order of decreasing priority, and
+	 * loads with the same priority in the order of their position on
+	 * disk (e.g. within an archive) to reduce seeking.
+	 *
+	 * @param priority higher values are loaded first.
+	 * @param cb is called by PollAsyncLoads once the load has finished
+	 *		  (or failed, e.g. because the file doesn't exist).
+	 * @return ID of the request (never 0), for use with CancelLoad.
+	 **/
+	virtual u32 LoadFileAsync(const VfsPath& pathname, int priority, LoadFileCallback cb, uintptr_t cbData) = 0;
+
+	/**
+	 * cancel an asynchronous load whose results are no longer needed.
+	 * its callback will not be called. (has no effect if the callback
+	 * has already been called.)
+	 **/
+	virtual void CancelLoad(u32 id) = 0;
+
+	/**
+	 * call the callbacks of all finished asynchronous loads on the
+	 * current thread (which would typically be the main thread).
+	 *
+	 * @return number of callbacks that were called.
+	 **/
+	virtual size_t PollAsyncLoads() = 0;
+
+	/**
+	 * @return number of bytes of memory currently used by the file cache.
+	 **/
+	virtual size_t GetCacheSize() const = 0;
+
 	/**
 	 * @return a string representation of all files and directories.
 	 **/
@@ -201,6 +254,22 @@ struct IVFS
 	 * NB: open files are not affected.
 	 **/
 	virtual void Clear() = 0;
+
+	/**
+	 * append the trace of all file loads and stores so far to a file
+	 * (see ITrace). this does nothing unless the VFS was created with
+	 * recordTrace.
+	 *
+	 * @param pathname (native, absolute)
+	 **/
+	virtual Status StoreTrace(const OsPath& pathname) const = 0;
+
+	/**
+	 * additionally record all file loads into the given trace (regardless
+	 * of recordTrace), e.g. to find out which files one part of the game
+	 * uses. pass an empty pointer to stop.
+	 **/
+	virtual void SetSessionTrace(const PITrace& trace) = 0;
 };
 
 typedef shared_ptr<IVFS> PIVFS;
@@ -212,9 +281,12 @@ typedef shared_ptr<IVFS> PIVFS;
  * or zero to disable it. if small enough to fit, file contents are
  * stored here until no references remain and they are evicted.
  *
+ * @param recordTrace whether to record all file accesses, so that they
+ * can be saved with StoreTrace (e.g. to optimise the layout of archives).
+ *
  * note: there is no limitation to a single instance, it may make sense
  * to create and destroy VFS instances during each unit test.
  **/
-LIB_API PIVFS CreateVfs(size_t cacheSize);
+LIB_API PIVFS CreateVfs(size_t cacheSize, bool recordTrace = false);
 
 #endif	// #ifndef INCLUDED_VFS
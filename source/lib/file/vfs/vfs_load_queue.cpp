@@ -0,0 +1,258 @@
+/* Copyright (c) 2013 Wildfire Games
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * queue of asynchronous VFS file loads
+ */
+
+#include "precompiled.h"
+#include "lib/file/vfs/vfs_load_queue.h"
+
+class LoadQueueLock
+{
+	NONCOPYABLE(LoadQueueLock);
+public:
+	LoadQueueLock(pthread_mutex_t& mutex) : m_mutex(mutex) { pthread_mutex_lock(&m_mutex); }
+	~LoadQueueLock() { pthread_mutex_unlock(&m_mutex); }
+
+private:
+	pthread_mutex_t& m_mutex;
+};
+
+
+VfsLoadQueue::VfsLoadQueue(IVFS& vfs)
+	: m_vfs(vfs), m_currentRequest(0), m_currentCancelled(false)
+	, m_sweepPosition(0), m_nextId(1)
+	, m_hasThread(false), m_threadRunning(false), m_shutdown(false)
+{
+	pthread_mutex_init(&m_mutex, 0);
+}
+
+VfsLoadQueue::~VfsLoadQueue()
+{
+	{
+		LoadQueueLock lock(m_mutex);
+		m_shutdown = true;
+		m_pending.clear();
+		m_completed.clear();
+	}
+
+	// (the thread finishes its current load and then sees m_shutdown)
+	if(m_hasThread)
+		pthread_join(m_thread, 0);
+
+	pthread_mutex_destroy(&m_mutex);
+}
+
+
+u32 VfsLoadQueue::Add(const VfsPath& pathname, int priority, const OsPath& location, off_t position, IVFS::LoadFileCallback cb, uintptr_t cbData)
+{
+	LoadQueueLock lock(m_mutex);
+
+	Request request;
+	request.id = m_nextId++;
+	if(m_nextId == 0)	// (0 is reserved for "no request")
+		m_nextId = 1;
+	request.pathname = pathname;
+	request.priority = priority;
+	request.location = location;
+	request.position = position;
+	request.cb = cb;
+	request.cbData = cbData;
+	request.ret = INFO::OK;
+	request.size = 0;
+	m_pending.push_back(request);
+
+	StartThread();
+	return request.id;
+}
+
+
+u32 VfsLoadQueue::AddFailed(const VfsPath& pathname, Status ret, IVFS::LoadFileCallback cb, uintptr_t cbData)
+{
+	LoadQueueLock lock(m_mutex);
+
+	Request request;
+	request.id = m_nextId++;
+	if(m_nextId == 0)
+		m_nextId = 1;
+	request.pathname = pathname;
+	request.priority = 0;
+	request.position = 0;
+	request.cb = cb;
+	request.cbData = cbData;
+	request.ret = ret;
+	request.size = 0;
+	m_completed.push_back(request);
+
+	return request.id;
+}
+
+
+void VfsLoadQueue::Cancel(u32 id)
+{
+	Requests discarded;	// (destroyed after releasing the lock)
+	LoadQueueLock lock(m_mutex);
+
+	if(m_currentRequest == id)
+	{
+		m_currentCancelled = true;
+		return;
+	}
+
+	for(Requests::iterator it = m_pending.begin(); it != m_pending.end(); ++it)
+	{
+		if(it->id == id)
+		{
+			m_pending.erase(it);
+			return;
+		}
+	}
+
+	for(Requests::iterator it = m_completed.begin(); it != m_completed.end(); ++it)
+	{
+		if(it->id == id)
+		{
+			// (don't free the contents while holding the lock)
+			discarded.splice(discarded.end(), m_completed, it);
+			return;
+		}
+	}
+}
+
+
+size_t VfsLoadQueue::Poll()
+{
+	size_t numCompleted = 0;
+
+	// (take one request at a time, since callbacks may cancel or add others)
+	for(;;)
+	{
+		Requests completed;
+		{
+			LoadQueueLock lock(m_mutex);
+			if(m_completed.empty())
+			{
+				// retry if the thread couldn't be started earlier
+				if(!m_pending.empty())
+					StartThread();
+				break;
+			}
+			completed.splice(completed.end(), m_completed, m_completed.begin());
+		}
+
+		const Request& request = completed.front();
+		request.cb(request.pathname, request.ret, request.fileContents, request.size, request.cbData);
+		numCompleted++;
+	}
+
+	return numCompleted;
+}
+
+
+void VfsLoadQueue::StartThread()
+{
+	if(m_threadRunning || m_shutdown)
+		return;
+
+	// the previous thread has already decided to exit, so this won't block
+	if(m_hasThread)
+	{
+		pthread_join(m_thread, 0);
+		m_hasThread = false;
+	}
+
+	if(pthread_create(&m_thread, 0, RunThread, this) == 0)
+	{
+		m_hasThread = true;
+		m_threadRunning = true;
+	}
+}
+
+
+VfsLoadQueue::Requests::iterator VfsLoadQueue::NextRequest()
+{
+	ENSURE(!m_pending.empty());
+
+	int priority = m_pending.front().priority;
+	for(Requests::iterator it = m_pending.begin(); it != m_pending.end(); ++it)
+		priority = std::max(priority, it->priority);
+
+	// continue the sweep with the closest request after the previous one;
+	// if there is none, start again from the lowest position.
+	Requests::iterator next = m_pending.end();
+	Requests::iterator lowest = m_pending.end();
+	for(Requests::iterator it = m_pending.begin(); it != m_pending.end(); ++it)
+	{
+		if(it->priority != priority)
+			continue;
+
+		if(lowest == m_pending.end() || it->location < lowest->location || (it->location == lowest->location && it->position < lowest->position))
+			lowest = it;
+
+		const bool isAhead = (m_sweepLocation < it->location) || (it->location == m_sweepLocation && it->position >= m_sweepPosition);
+		if(isAhead && (next == m_pending.end() || it->location < next->location || (it->location == next->location && it->position < next->position)))
+			next = it;
+	}
+
+	return (next != m_pending.end())? next : lowest;
+}
+
+
+/*static*/ void* VfsLoadQueue::RunThread(void* data)
+{
+	debug_SetThreadName("VFS load queue");
+	static_cast<VfsLoadQueue*>(data)->Run();
+	return 0;
+}
+
+
+void VfsLoadQueue::Run()
+{
+	for(;;)
+	{
+		Requests current;
+		{
+			LoadQueueLock lock(m_mutex);
+			if(m_shutdown || m_pending.empty())
+			{
+				m_threadRunning = false;
+				return;
+			}
+			current.splice(current.end(), m_pending, NextRequest());
+			m_currentRequest = current.front().id;
+			m_currentCancelled = false;
+			m_sweepLocation = current.front().location;
+			m_sweepPosition = current.front().position;
+		}
+
+		Request& request = current.front();
+		request.ret = m_vfs.LoadFile(request.pathname, request.fileContents, request.size);
+
+		LoadQueueLock lock(m_mutex);
+		m_currentRequest = 0;
+		if(!m_currentCancelled && !m_shutdown)
+			m_completed.splice(m_completed.end(), current);
+		// (otherwise, the contents are freed when current goes out of scope -
+		// after the lock has been released, since it was declared first)
+	}
+}
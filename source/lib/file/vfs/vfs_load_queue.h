@@ -0,0 +1,130 @@
+/* Copyright (c) 2013 Wildfire Games
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * queue of asynchronous VFS file loads
+ */
+
+#ifndef INCLUDED_VFS_LOAD_QUEUE
+#define INCLUDED_VFS_LOAD_QUEUE
+
+#include "lib/file/vfs/vfs.h"
+#include "lib/posix/posix_pthread.h"
+
+#include <list>
+
+/**
+ * loads files on a background thread on behalf of IVFS::LoadFileAsync.
+ *
+ * pending requests are served in order of decreasing priority. requests
+ * with the same priority are sorted by their location (archive or
+ * directory) and position within it, and are issued in a single sweep
+ * across the disk (restarting from the beginning when the end is reached),
+ * which avoids most of the seeks a random order would cause.
+ *
+ * the thread is only started while there are pending requests, so an idle
+ * queue costs nothing. completion callbacks are run by Poll, i.e. on
+ * whichever thread calls it (typically the main thread).
+ **/
+class VfsLoadQueue
+{
+	NONCOPYABLE(VfsLoadQueue);
+public:
+	/**
+	 * @param vfs is used to load the files; it must outlive this object.
+	 **/
+	VfsLoadQueue(IVFS& vfs);
+	~VfsLoadQueue();
+
+	/**
+	 * @param location real path of the file's archive or directory.
+	 * @param position of the file's data within location.
+	 * @return ID of the request (never 0).
+	 **/
+	u32 Add(const VfsPath& pathname, int priority, const OsPath& location, off_t position, IVFS::LoadFileCallback cb, uintptr_t cbData);
+
+	/**
+	 * report a request that failed before it could be queued (e.g.
+	 * because the file doesn't exist). this still goes through Poll, so
+	 * that callbacks are never run from within LoadFileAsync.
+	 **/
+	u32 AddFailed(const VfsPath& pathname, Status ret, IVFS::LoadFileCallback cb, uintptr_t cbData);
+
+	void Cancel(u32 id);
+
+	/**
+	 * run the callbacks of all completed requests.
+	 * @return number of callbacks that were run.
+	 **/
+	size_t Poll();
+
+private:
+	struct Request
+	{
+		u32 id;
+		VfsPath pathname;
+		int priority;
+		OsPath location;
+		off_t position;
+		IVFS::LoadFileCallback cb;
+		uintptr_t cbData;
+
+		// results
+		Status ret;
+		shared_ptr<u8> fileContents;
+		size_t size;
+	};
+
+	typedef std::list<Request> Requests;
+
+	static void* RunThread(void* data);
+	void Run();
+
+	// (these require m_mutex to be held)
+	void StartThread();
+	Requests::iterator NextRequest();
+
+	IVFS& m_vfs;
+
+	pthread_mutex_t m_mutex;
+
+	Requests m_pending;
+	Requests m_completed;
+
+	// request currently being loaded by the thread (0 if none), and
+	// whether it has been cancelled meanwhile.
+	u32 m_currentRequest;
+	bool m_currentCancelled;
+
+	// end of the last read, i.e. where the sweep continues.
+	OsPath m_sweepLocation;
+	off_t m_sweepPosition;
+
+	u32 m_nextId;
+
+	pthread_t m_thread;
+	bool m_hasThread;	// (whether m_thread must be joined)
+	bool m_threadRunning;
+	bool m_shutdown;
+};
+
+#endif	// #ifndef INCLUDED_VFS_LOAD_QUEUE
@@ -1,4 +1,4 @@
-/* Copyright (c) 2012 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -31,6 +31,7 @@
 #include "lib/file/vfs/vfs_tree.h"
 #include "lib/file/vfs/vfs_lookup.h"
 #include "lib/file/vfs/vfs.h"	// error codes
+#include "lib/sysdep/os_cpu.h"
 
 
 #define ENABLE_ARCHIVE_STATS 0
@@ -47,6 +48,108 @@ struct CompareFileInfoByName
 	}
 };
 
+// archive contents are collected (possibly on another thread) before
+// being added to the VFS tree, which is not thread-safe.
+struct ArchiveEntry
+{
+	ArchiveEntry(const VfsPath& pathname, const FileInfo& fileInfo, const PIArchiveFile& archiveFile)
+		: pathname(pathname), fileInfo(fileInfo), archiveFile(archiveFile)
+	{
+	}
+
+	VfsPath pathname;
+	FileInfo fileInfo;
+	PIArchiveFile archiveFile;
+};
+
+struct ArchiveScan
+{
+	ArchiveScan(const OsPath& pathname, bool mapFile)
+		: pathname(pathname), mapFile(mapFile), ret(INFO::OK)
+	{
+	}
+
+	OsPath pathname;
+	bool mapFile;
+	std::vector<ArchiveEntry> entries;
+	Status ret;
+};
+
+typedef std::vector<ArchiveScan> ArchiveScans;
+
+static void CollectArchiveEntry(const VfsPath& pathname, const FileInfo& fileInfo, PIArchiveFile archiveFile, uintptr_t cbData)
+{
+	std::vector<ArchiveEntry>* entries = (std::vector<ArchiveEntry>*)cbData;
+	entries->push_back(ArchiveEntry(pathname, fileInfo, archiveFile));
+}
+
+static void ScanArchive(ArchiveScan& scan)
+{
+	PIArchiveReader archiveReader = CreateArchiveReader_Zip(scan.pathname, scan.mapFile);
+	// archiveReader == nullptr if file could not be opened (e.g. because
+	// archive is currently open in another program)
+	if(archiveReader)
+		scan.ret = archiveReader->ReadEntries(CollectArchiveEntry, (uintptr_t)&scan.entries);
+}
+
+struct ArchiveScanThreadData
+{
+	ArchiveScans* scans;
+	size_t first;
+	size_t stride;
+};
+
+static void ScanArchivesInterleaved(const ArchiveScanThreadData& data)
+{
+	for(size_t i = data.first; i < data.scans->size(); i += data.stride)
+		ScanArchive((*data.scans)[i]);
+}
+
+static void* ArchiveScanThread(void* arg)
+{
+	debug_SetThreadName("VFS populate");
+	ScanArchivesInterleaved(*(ArchiveScanThreadData*)arg);
+	return NULL;
+}
+
+// (reading a central directory is mostly waiting for the disk, so a few
+// threads suffice)
+static const size_t MAX_ARCHIVE_SCAN_THREADS = 4;
+
+static void ScanArchives(ArchiveScans& scans)
+{
+	const size_t numThreads = std::min(std::min(scans.size(), os_cpu_NumProcessors()), MAX_ARCHIVE_SCAN_THREADS);
+	if(numThreads <= 1)
+	{
+		for(size_t i = 0; i < scans.size(); i++)
+			ScanArchive(scans[i]);
+		return;
+	}
+
+	// the calling thread handles the first share of the archives
+	ArchiveScanThreadData data[MAX_ARCHIVE_SCAN_THREADS];
+	pthread_t threads[MAX_ARCHIVE_SCAN_THREADS];
+	bool started[MAX_ARCHIVE_SCAN_THREADS] = { false };
+	for(size_t t = 0; t < numThreads; t++)
+	{
+		data[t].scans = &scans;
+		data[t].first = t;
+		data[t].stride = numThreads;
+		if(t != 0)
+			started[t] = (pthread_create(&threads[t], NULL, ArchiveScanThread, &data[t]) == 0);
+	}
+
+	ScanArchivesInterleaved(data[0]);
+
+	for(size_t t = 1; t < numThreads; t++)
+	{
+		if(started[t])
+			pthread_join(threads[t], NULL);
+		else	// couldn't start the thread, so do its share here
+			ScanArchivesInterleaved(data[t]);
+	}
+}
+
 // helper class that allows breaking up the logic into sub-functions without
 // always having to pass directory/realDirectory as parameters.
 class PopulateHelper
@@ -108,25 +211,31 @@ private:
 #endif
 	}
 
-	static void AddArchiveFile(const VfsPath& pathname, const FileInfo& fileInfo, PIArchiveFile archiveFile, uintptr_t cbData)
+	void AddArchiveFile(const ArchiveEntry& entry, VfsPath& lastDirectoryPath, VfsDirectory*& lastDirectory) const
 	{
-		PopulateHelper* this_ = (PopulateHelper*)cbData;
-
+		// archives list their files grouped by directory, so remember the
+		// last directory to avoid looking up the same path for each file.
 		// (we have to create missing subdirectoryNames because archivers
 		// don't always place directory entries before their files)
-		const size_t flags = VFS_LOOKUP_ADD|VFS_LOOKUP_SKIP_POPULATE;
-		VfsDirectory* directory;
-		WARN_IF_ERR(vfs_Lookup(pathname, this_->m_directory, directory, 0, flags));
+		VfsDirectory* directory = lastDirectory;
+		const VfsPath directoryPath = entry.pathname.Parent();
+		if(!directory || directoryPath != lastDirectoryPath)
+		{
+			const size_t flags = VFS_LOOKUP_ADD|VFS_LOOKUP_SKIP_POPULATE;
+			WARN_IF_ERR(vfs_Lookup(entry.pathname, m_directory, directory, 0, flags));
+			lastDirectoryPath = directoryPath;
+			lastDirectory = directory;
+		}
 
-		const VfsPath name = fileInfo.Name();
+		const VfsPath name = entry.fileInfo.Name();
 		if(name.Extension() == L".DELETED")
 		{
 			directory->RemoveFile(name.Basename());
-			if(!(this_->m_realDirectory->Flags() & VFS_MOUNT_KEEP_DELETED))
+			if(!(m_realDirectory->Flags() & VFS_MOUNT_KEEP_DELETED))
 				return;
 		}
 
-		const VfsFile file(name, (size_t)fileInfo.Size(), fileInfo.MTime(), this_->m_realDirectory->Priority(), archiveFile);
+		const VfsFile file(name, (size_t)entry.fileInfo.Size(), entry.fileInfo.MTime(), m_realDirectory->Priority(), entry.archiveFile);
 		directory->AddFile(file);
 #if ENABLE_ARCHIVE_STATS
 		s_numArchivedFiles++;
@@ -137,16 +246,31 @@ private:
 	{
 		const OsPath path(m_realDirectory->Path());
 
+		// read the central directories of all archives first (concurrently,
+		// since mods may contain several large archives), then add their
+		// contents in the same sorted order as loose files.
+		ArchiveScans scans;
+		const bool mapArchives = (m_realDirectory->Flags() & VFS_MOUNT_MAP_ARCHIVES) != 0;
+		for(size_t i = 0; i < files.size(); i++)
+		{
+			const OsPath pathname = path / files[i].Name();
+			if(pathname.Extension() == L".zip")
+				scans.push_back(ArchiveScan(pathname, mapArchives));
+		}
+		ScanArchives(scans);
+
+		size_t nextScan = 0;
 		for(size_t i = 0; i < files.size(); i++)
 		{
 			const OsPath pathname = path / files[i].Name();
 			if(pathname.Extension() == L".zip")
 			{
-				PIArchiveReader archiveReader = CreateArchiveReader_Zip(pathname);
-				// archiveReader == nullptr if file could not be opened (e.g. because
-				// archive is currently open in another program)
-				if(archiveReader)
-					RETURN_STATUS_IF_ERR(archiveReader->ReadEntries(AddArchiveFile, (uintptr_t)this));
+				const ArchiveScan& scan = scans[nextScan++];
+				VfsPath lastDirectoryPath;
+				VfsDirectory* lastDirectory = 0;
+				for(size_t j = 0; j < scan.entries.size(); j++)
+					AddArchiveFile(scan.entries[j], lastDirectoryPath, lastDirectory);
+				RETURN_STATUS_IF_ERR(scan.ret);
 			}
 			else	// regular (non-archive) file
 				AddFile(files[i]);
@@ -92,6 +92,20 @@ Status ForEachFile(const PIVFS& fs, const VfsPath& startPath, FileCallback cb, u
 }
 
 
+static Status PrefetchFile(const VfsPath& pathname, const FileInfo& UNUSED(fileInfo), const uintptr_t cbData)
+{
+	const PIVFS& fs = *(const PIVFS*)cbData;
+	shared_ptr<u8> buf; size_t size;
+	(void)fs->LoadFile(pathname, buf, size);
+	return INFO::OK;
+}
+
+Status PrefetchFiles(const PIVFS& fs, const VfsPath& path, const wchar_t* pattern, size_t flags)
+{
+	return ForEachFile(fs, path, PrefetchFile, (uintptr_t)&fs, pattern, flags);
+}
+
+
 void NextNumberedFilename(const PIVFS& fs, const VfsPath& pathnameFormat, size_t& nextNumber, VfsPath& nextPathname)
 {
 	// (first call only:) scan directory and set nextNumber according to
@@ -67,6 +67,19 @@ enum DirFlags
  **/
 extern Status ForEachFile(const PIVFS& fs, const VfsPath& path, FileCallback cb, uintptr_t cbData, const wchar_t* pattern = 0, size_t flags = 0);
 
+/**
+ * load each file in a directory tree, so that subsequent loads can be
+ * satisfied from the file cache (if it's large enough). useful for
+ * reading files on a background thread before they're needed.
+ *
+ * @param fs
+ * @param path
+ * @param pattern see ForEachFile
+ * @param flags @ref DirFlags
+ * @return Status
+ **/
+extern Status PrefetchFiles(const PIVFS& fs, const VfsPath& path, const wchar_t* pattern = 0, size_t flags = 0);
+
 
 /**
  * Determine the next available pathname with a given format.
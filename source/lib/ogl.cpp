@@ -304,6 +304,12 @@ static void GL_CALL_CONV dummy_glDrawRangeElementsEXT(GLenum mode, GLuint, GLuin
 	glDrawElements(mode, count, type, indices);
 }
 
+static void GL_CALL_CONV dummy_glMultiDrawElementsEXT(GLenum mode, const GLsizei* count, GLenum type, const GLvoid** indices, GLsizei primcount)
+{
+	for(GLsizei i = 0; i < primcount; ++i)
+		glDrawElements(mode, count[i], type, indices[i]);
+}
+
 static void GL_CALL_CONV dummy_glActiveTextureARB(int)
 {
 }
@@ -331,6 +337,11 @@ static void enableDummyFunctions()
 		pglDrawRangeElementsEXT = &dummy_glDrawRangeElementsEXT;
 	}
 
+	if(!ogl_HaveExtension("GL_EXT_multi_draw_arrays"))
+	{
+		pglMultiDrawElementsEXT = &dummy_glMultiDrawElementsEXT;
+	}
+
 	if(!ogl_HaveExtension("GL_ARB_multitexture"))
 	{
 		pglActiveTextureARB = &dummy_glActiveTextureARB;
@@ -458,6 +469,258 @@ bool ogl_SquelchError(GLenum err_to_ignore)
 }
 
 
+//----------------------------------------------------------------------------
+// redundant state filtering
+//----------------------------------------------------------------------------
+
+static size_t state_changes;
+static size_t state_filtered;
+
+// a piece of GL state whose value may be unknown (e.g. after a reset)
+template<typename T>
+struct CachedState
+{
+	T value;
+	bool known;
+
+	// record that the state will be set to v; returns whether it differs
+	// from the current value (i.e. whether the GL call is needed)
+	bool Change(T v)
+	{
+		if(known && value == v)
+		{
+			state_filtered++;
+			return false;
+		}
+		value = v;
+		known = true;
+		state_changes++;
+		return true;
+	}
+};
+
+static const size_t MAX_CACHED_TEX_UNITS = 16;
+
+enum CachedTexTarget
+{
+	TEX_TARGET_2D,
+	TEX_TARGET_CUBE_MAP,
+	NUM_TEX_TARGETS
+};
+
+static struct StateCache
+{
+	CachedState<GLenum> active_texture;
+	CachedState<GLuint> textures[MAX_CACHED_TEX_UNITS][NUM_TEX_TARGETS];
+	CachedState<GLuint> array_buffer;
+	CachedState<GLuint> element_array_buffer;
+	CachedState<GLhandleARB> program;
+	CachedState<GLuint> vertex_program;
+	CachedState<GLuint> fragment_program;
+	CachedState<bool> blend;
+	CachedState<bool> depth_test;
+	CachedState<std::pair<GLenum, GLenum> > blend_func;
+	CachedState<GLboolean> depth_mask;
+	CachedState<GLenum> depth_func;
+}
+state_cache;
+
+// if the multitexture extension is missing, ogl_ActiveTexture is
+// silently ignored, so the per-unit texture bindings can't be trusted
+static bool state_cache_textures = true;
+
+void ogl_ResetStateCache()
+{
+	memset(&state_cache, 0, sizeof(state_cache));
+}
+
+void ogl_GetStateCacheStats(size_t& changes, size_t& filtered)
+{
+	changes = state_changes;
+	filtered = state_filtered;
+}
+
+// returns the cached binding for the given target of the active
+// texture unit, or NULL if it's not cached
+static CachedState<GLuint>* cached_texture(GLenum target)
+{
+	if(!state_cache_textures || !state_cache.active_texture.known)
+		return NULL;
+
+	const size_t unit = state_cache.active_texture.value - GL_TEXTURE0;
+	if(unit >= MAX_CACHED_TEX_UNITS)
+		return NULL;
+
+	switch(target)
+	{
+	case GL_TEXTURE_2D:
+		return &state_cache.textures[unit][TEX_TARGET_2D];
+	case GL_TEXTURE_CUBE_MAP:
+		return &state_cache.textures[unit][TEX_TARGET_CUBE_MAP];
+	default:
+		return NULL;
+	}
+}
+
+static CachedState<GLuint>* cached_buffer(GLenum target)
+{
+	switch(target)
+	{
+	case GL_ARRAY_BUFFER:
+		return &state_cache.array_buffer;
+	case GL_ELEMENT_ARRAY_BUFFER:
+		return &state_cache.element_array_buffer;
+	default:
+		return NULL;
+	}
+}
+
+static CachedState<bool>* cached_capability(GLenum cap)
+{
+	switch(cap)
+	{
+	case GL_BLEND:
+		return &state_cache.blend;
+	case GL_DEPTH_TEST:
+		return &state_cache.depth_test;
+	default:
+		return NULL;
+	}
+}
+
+// deleting a bound object reverts its binding to 0
+static void forget_deleted(CachedState<GLuint>& state, GLsizei n, const GLuint* names)
+{
+	if(!state.known)
+		return;
+	for(GLsizei i = 0; i < n; ++i)
+	{
+		if(names[i] == state.value)
+			state.value = 0;
+	}
+}
+
+void ogl_ActiveTexture(GLenum texture)
+{
+	if(state_cache.active_texture.Change(texture))
+		pglActiveTextureARB(texture);
+}
+
+void ogl_BindTexture(GLenum target, GLuint texture)
+{
+	CachedState<GLuint>* state = cached_texture(target);
+	if(state)
+	{
+		if(state->Change(texture))
+			glBindTexture(target, texture);
+		return;
+	}
+
+	state_changes++;
+	glBindTexture(target, texture);
+
+	// we don't know which unit this was bound on, so the cached bindings
+	// of every unit may be wrong now
+	if(!state_cache.active_texture.known)
+		memset(state_cache.textures, 0, sizeof(state_cache.textures));
+}
+
+void ogl_DeleteTextures(GLsizei n, const GLuint* textures)
+{
+	for(size_t unit = 0; unit < MAX_CACHED_TEX_UNITS; ++unit)
+	{
+		for(size_t target = 0; target < NUM_TEX_TARGETS; ++target)
+			forget_deleted(state_cache.textures[unit][target], n, textures);
+	}
+	glDeleteTextures(n, textures);
+}
+
+void ogl_BindBuffer(GLenum target, GLuint buffer)
+{
+	CachedState<GLuint>* state = cached_buffer(target);
+	if(!state)
+		state_changes++;
+	if(!state || state->Change(buffer))
+		pglBindBufferARB(target, buffer);
+}
+
+void ogl_DeleteBuffers(GLsizei n, const GLuint* buffers)
+{
+	forget_deleted(state_cache.array_buffer, n, buffers);
+	forget_deleted(state_cache.element_array_buffer, n, buffers);
+	pglDeleteBuffersARB(n, buffers);
+}
+
+void ogl_UseProgram(GLhandleARB program)
+{
+	// (deleting the current program doesn't unbind it, so there's no
+	// equivalent of forget_deleted needed here)
+	if(state_cache.program.Change(program))
+		pglUseProgramObjectARB(program);
+}
+
+#if !CONFIG2_GLES
+
+void ogl_BindProgram(GLenum target, GLuint program)
+{
+	CachedState<GLuint>* state = NULL;
+	if(target == GL_VERTEX_PROGRAM_ARB)
+		state = &state_cache.vertex_program;
+	else if(target == GL_FRAGMENT_PROGRAM_ARB)
+		state = &state_cache.fragment_program;
+
+	if(!state)
+		state_changes++;
+	if(!state || state->Change(program))
+		pglBindProgramARB(target, program);
+}
+
+void ogl_DeletePrograms(GLsizei n, const GLuint* programs)
+{
+	forget_deleted(state_cache.vertex_program, n, programs);
+	forget_deleted(state_cache.fragment_program, n, programs);
+	pglDeleteProgramsARB(n, programs);
+}
+
+#endif
+
+void ogl_Enable(GLenum cap)
+{
+	CachedState<bool>* state = cached_capability(cap);
+	if(!state)
+		state_changes++;
+	if(!state || state->Change(true))
+		glEnable(cap);
+}
+
+void ogl_Disable(GLenum cap)
+{
+	CachedState<bool>* state = cached_capability(cap);
+	if(!state)
+		state_changes++;
+	if(!state || state->Change(false))
+		glDisable(cap);
+}
+
+void ogl_BlendFunc(GLenum sfactor, GLenum dfactor)
+{
+	if(state_cache.blend_func.Change(std::make_pair(sfactor, dfactor)))
+		glBlendFunc(sfactor, dfactor);
+}
+
+void ogl_DepthMask(GLboolean flag)
+{
+	if(state_cache.depth_mask.Change(flag ? GL_TRUE : GL_FALSE))
+		glDepthMask(flag);
+}
+
+void ogl_DepthFunc(GLenum func)
+{
+	if(state_cache.depth_func.Change(func))
+		glDepthFunc(func);
+}
+
+
 //----------------------------------------------------------------------------
 // feature and limit detect
 //----------------------------------------------------------------------------
@@ -484,6 +747,11 @@ void ogl_Init()
 
 	importExtensionFunctions();
 
+#if !CONFIG2_GLES
+	state_cache_textures = ogl_HaveExtension("GL_ARB_multitexture");
+#endif
+	ogl_ResetStateCache();
+
 	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &ogl_max_tex_size);
 #if !CONFIG2_GLES
 	glGetIntegerv(GL_MAX_TEXTURE_UNITS, &ogl_max_tex_units);
@@ -173,6 +173,55 @@ extern void ogl_WarnIfError();
 extern bool ogl_SquelchError(GLenum err_to_ignore);
 
 
+//-----------------------------------------------------------------------------
+// redundant state filtering
+
+/**
+ * the following wrap the GL functions of the same name, but remember the
+ * current state and skip calls that wouldn't change it.
+ *
+ * this only works when all code uses these instead of the raw GL functions
+ * (for the texture targets, buffer targets and capabilities that are cached;
+ * others are passed straight through). if anything else might have changed
+ * the state (e.g. third-party code), call ogl_ResetStateCache afterwards.
+ *
+ * cached: the GL_TEXTURE_2D and GL_TEXTURE_CUBE_MAP bindings of the first
+ * few texture units, the GL_ARRAY_BUFFER and GL_ELEMENT_ARRAY_BUFFER bindings,
+ * the current GLSL program and ARB vertex/fragment programs, GL_BLEND and
+ * GL_DEPTH_TEST, the blend func, depth mask and depth func.
+ **/
+extern void ogl_ActiveTexture(GLenum texture);
+extern void ogl_BindTexture(GLenum target, GLuint texture);
+extern void ogl_DeleteTextures(GLsizei n, const GLuint* textures);
+extern void ogl_BindBuffer(GLenum target, GLuint buffer);
+extern void ogl_DeleteBuffers(GLsizei n, const GLuint* buffers);
+extern void ogl_UseProgram(GLhandleARB program);
+#if !CONFIG2_GLES
+extern void ogl_BindProgram(GLenum target, GLuint program);
+extern void ogl_DeletePrograms(GLsizei n, const GLuint* programs);
+#endif
+extern void ogl_Enable(GLenum cap);
+extern void ogl_Disable(GLenum cap);
+extern void ogl_BlendFunc(GLenum sfactor, GLenum dfactor);
+extern void ogl_DepthMask(GLboolean flag);
+extern void ogl_DepthFunc(GLenum func);
+
+/**
+ * forget all cached state, so the next call of each of the above functions
+ * will be passed to GL.
+ * called by ogl_Init, and should be called at the start of each frame
+ * to limit the damage if the cache gets out of sync.
+ **/
+extern void ogl_ResetStateCache();
+
+/**
+ * retrieve the running totals of state changes passed to GL and of
+ * redundant ones that were skipped. (callers should subtract an earlier
+ * pair of values to measure some period of rendering.)
+ **/
+extern void ogl_GetStateCacheStats(size_t& changes, size_t& filtered);
+
+
 //-----------------------------------------------------------------------------
 // implementation limits / feature detect
 
@@ -119,9 +119,9 @@ public:
 		(void)ogl_tex_bind(ht);
 		glEnable(GL_TEXTURE_2D);
 		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		glEnable(GL_BLEND);
-		glDisable(GL_DEPTH_TEST);
+		ogl_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		ogl_Enable(GL_BLEND);
+		ogl_Disable(GL_DEPTH_TEST);
 		glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
 
 		glBegin(GL_QUADS);
@@ -131,8 +131,8 @@ public:
 		glTexCoord2i(1, 1); glVertex2i( x-hotspotx+w, y+hotspoty-h );
 		glEnd();
 
-		glDisable(GL_BLEND);
-		glEnable(GL_DEPTH_TEST);
+		ogl_Disable(GL_BLEND);
+		ogl_Enable(GL_DEPTH_TEST);
 #endif
 	}
 
@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -382,7 +382,7 @@ static void state_latch(OglTexState* ots)
 // reuse of active objects (this would break the index lookup code, since
 // multiple instances may then exist).
 
-// note: make sure these values fit inside OglTex.flags (only 16 bits)
+// note: make sure these values fit inside OglTex.flags (only 8 bits)
 enum OglTexFlags
 {
 	// "the texture is currently uploaded"; reset in dtor.
@@ -397,8 +397,12 @@ enum OglTexFlags
 	// it had been uploaded before the reload); never reset.
 	OT_NEED_AUTO_UPLOAD = 4,
 
+	// "ogl_tex_upload_partial has uploaded some but not all mipmap levels";
+	// reset in dtor and once the upload is complete.
+	OT_IS_STREAMING = 8,
+
 	// (used for validating flags)
-	OT_ALL_FLAGS = OT_IS_UPLOADED|OT_TEX_VALID|OT_NEED_AUTO_UPLOAD
+	OT_ALL_FLAGS = OT_IS_UPLOADED|OT_TEX_VALID|OT_NEED_AUTO_UPLOAD|OT_IS_STREAMING
 };
 
 struct OglTex
@@ -423,7 +427,11 @@ struct OglTex
 	// to which Texture Mapping Unit was this bound?
 	u8 tmu;
 
-	u16 flags;
+	u8 flags;
+
+	// if OT_IS_STREAMING: the lowest mipmap level uploaded so far
+	// (all the smaller ones have been uploaded too).
+	u8 stream_level;
 };
 
 H_TYPE_DEFINE(OglTex);
@@ -453,9 +461,9 @@ static void OglTex_dtor(OglTex* ot)
 
 	// note: do not check if OT_IS_UPLOADED is set, because we allocate
 	// OglTex.id without necessarily having done an upload.
-	glDeleteTextures(1, &ot->id);
+	ogl_DeleteTextures(1, &ot->id);
 	ot->id = 0;
-	ot->flags &= ~OT_IS_UPLOADED;
+	ot->flags &= ~(OT_IS_UPLOADED|OT_IS_STREAMING);
 }
 
 static Status OglTex_reload(OglTex* ot, const PIVFS& vfs, const VfsPath& pathname, Handle h)
@@ -705,6 +713,7 @@ Status ogl_tex_set_anisotropy(Handle ht, GLfloat anisotropy)
 static int have_auto_mipmap_gen = -1;
 static int have_s3tc = -1;
 static int have_anistropy = -1;
+static int have_pbo = -1;
 
 // override the default decision and force/disallow use of the
 // given feature. should be called from ah_override_gl_upload_caps.
@@ -761,6 +770,14 @@ static void detect_gl_upload_caps()
 	{
 		have_anistropy = ogl_HaveExtension("GL_EXT_texture_filter_anisotropic");
 	}
+	if(have_pbo == -1)
+	{
+#if CONFIG2_GLES
+		have_pbo = 0;
+#else
+		have_pbo = ogl_HaveExtension("GL_ARB_pixel_buffer_object");
+#endif
+	}
 
 	// allow app hook to make ogl_tex_override calls
 	if(AH_IS_DEFINED(override_gl_upload_caps))
@@ -900,6 +917,24 @@ static void upload_impl(Tex* t, GLenum fmt, GLint int_fmt, int levels_to_skip)
 }
 
 
+// mark the texture as uploaded, and free its texel data if possible.
+static void finish_upload(Handle ht, OglTex* ot)
+{
+	ot->flags |= OT_IS_UPLOADED;
+
+	// see rationale for <refs> at declaration of OglTex.
+	// note: tex_free is safe even if this OglTex was wrapped -
+	//       the Tex contains a mem handle.
+	intptr_t refs = h_get_refcnt(ht);
+	if(refs == 1)
+	{
+		// note: callers verify that OT_TEX_VALID is set
+		tex_free(&ot->t);
+		ot->flags &= ~OT_TEX_VALID;
+	}
+}
+
+
 // upload the texture to OpenGL.
 // if not 0, parameters override the following:
 //   fmt_ovr     : OpenGL format (e.g. GL_RGB) decided from bpp / Tex flags;
@@ -950,21 +985,19 @@ Status ogl_tex_upload(const Handle ht, GLenum fmt_ovr, int q_flags_ovr, GLint in
 			// otherwise, replays all state changes)
 			state_latch(&ot->state);
 			upload_impl(t, ot->fmt, ot->int_fmt, levels_to_skip);
+#if !CONFIG2_GLES
+			// (this may finish off an ogl_tex_upload_partial; all the
+			// levels are there now)
+			if(ot->flags & OT_IS_STREAMING)
+			{
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+				ot->flags &= ~OT_IS_STREAMING;
+			}
+#endif
 		}
 		ogl_WarnIfError();
 
-		ot->flags |= OT_IS_UPLOADED;
-
-		// see rationale for <refs> at declaration of OglTex.
-		// note: tex_free is safe even if this OglTex was wrapped -
-		//       the Tex contains a mem handle.
-		intptr_t refs = h_get_refcnt(ht);
-		if(refs == 1)
-		{
-			// note: we verify above that OT_TEX_VALID is set
-			tex_free(t);
-			ot->flags &= ~OT_TEX_VALID;
-		}
+		finish_upload(ht, ot);
 	}
 
 	ot->flags |= OT_NEED_AUTO_UPLOAD;
@@ -973,6 +1006,134 @@ Status ogl_tex_upload(const Handle ht, GLenum fmt_ovr, int q_flags_ovr, GLint in
 }
 
 
+// tex_util_foreach_mipmap callback: remember where each level is,
+// so that they can be uploaded in reverse order.
+
+struct MipLevel
+{
+	size_t level;
+	size_t w, h;
+	const u8* data;
+	size_t size;
+};
+
+static void collect_level(size_t level, size_t level_w, size_t level_h, const u8* RESTRICT level_data, size_t level_data_size, void* RESTRICT cbData)
+{
+	std::vector<MipLevel>* levels = (std::vector<MipLevel>*)cbData;
+	const MipLevel ml = { level, level_w, level_h, level_data, level_data_size };
+	levels->push_back(ml);
+}
+
+// buffer object through which streamed levels are uploaded (if have_pbo)
+static GLuint stream_pbo;
+
+static void stream_level(const MipLevel& ml, bool is_s3tc, const UploadParams& up)
+{
+	const u8* data = ml.data;
+#if !CONFIG2_GLES
+	if(have_pbo)
+	{
+		// copy the level into a buffer object, so that the driver can
+		// transfer it to the texture asynchronously rather than stalling
+		// (specifying the data again orphans the previous contents,
+		// which might still be in use)
+		if(!stream_pbo)
+			pglGenBuffersARB(1, &stream_pbo);
+		ogl_BindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, stream_pbo);
+		pglBufferDataARB(GL_PIXEL_UNPACK_BUFFER_ARB, (GLsizeiptrARB)ml.size, data, GL_STREAM_DRAW_ARB);
+		data = 0;	// i.e. offset 0 in the buffer
+	}
+#endif
+
+	if(is_s3tc)
+		upload_compressed_level(ml.level, ml.w, ml.h, data, ml.size, (void*)&up);
+	else
+		upload_level(ml.level, ml.w, ml.h, data, ml.size, (void*)&up);
+
+#if !CONFIG2_GLES
+	if(have_pbo)
+		ogl_BindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+#endif
+}
+
+// upload some of the texture's mipmap levels to OpenGL, smallest first.
+Status ogl_tex_upload_partial(const Handle ht, size_t max_bytes, size_t* uploaded_bytes)
+{
+	ONCE(detect_gl_upload_caps());
+
+	H_DEREF(ht, OglTex, ot);
+	Tex* t = &ot->t;
+	*uploaded_bytes = 0;
+
+	if(ot->flags & OT_IS_UPLOADED)
+		return INFO::ALL_COMPLETE;
+
+	// streaming only makes sense if the image already contains the
+	// mipmaps that will be used (otherwise there is only one level, or
+	// they're generated during the upload), and requires
+	// GL_TEXTURE_BASE_LEVEL (not in GLES) to hide the missing levels.
+	bool can_stream = (ot->flags & OT_TEX_VALID) && (t->flags & TEX_MIPMAPS) &&
+		are_mipmaps_needed(t->w, t->h, ot->state.filter) &&
+		(!(t->flags & TEX_DXT) || have_s3tc);
+#if CONFIG2_GLES
+	can_stream = false;
+#endif
+	if(!can_stream)
+	{
+		const size_t size = (ot->flags & OT_TEX_VALID)? t->dataSize : 0;
+		RETURN_STATUS_IF_ERR(ogl_tex_upload(ht));
+		*uploaded_bytes = size;
+		return INFO::ALL_COMPLETE;
+	}
+
+	ogl_WarnIfError();
+	RETURN_STATUS_IF_ERR(ogl_tex_bind(ht, ot->tmu));
+
+	// (this has no side effects, since t contains mipmaps)
+	int levels_to_skip;
+	RETURN_STATUS_IF_ERR(get_mipmaps(t, ot->state.filter, ot->q_flags, &levels_to_skip));
+
+	std::vector<MipLevel> levels;
+	const bool is_s3tc = (t->flags & TEX_DXT) != 0;
+	tex_util_foreach_mipmap(t->w, t->h, t->bpp, (const u8*)tex_get_data(t), levels_to_skip, is_s3tc? 4 : 1, collect_level, &levels);
+
+	// levels [next, levels.size()) have been uploaded
+	size_t next;
+	if(ot->flags & OT_IS_STREAMING)
+		next = ot->stream_level;
+	else
+	{
+		ot->fmt = choose_fmt(t->bpp, t->flags);
+		ot->int_fmt = choose_int_fmt(ot->fmt, ot->q_flags);
+		state_latch(&ot->state);
+		ot->flags |= OT_IS_STREAMING;
+		next = levels.size();
+	}
+
+	// upload at least one level, and as many more as fit in max_bytes
+	const UploadParams up = { ot->fmt, ot->int_fmt };
+	while(next > 0 && (*uploaded_bytes == 0 || *uploaded_bytes + levels[next-1].size <= max_bytes))
+	{
+		next--;
+		stream_level(levels[next], is_s3tc, up);
+		*uploaded_bytes += levels[next].size;
+	}
+	ot->stream_level = (u8)next;
+
+	// only sample from the levels that have been uploaded so far
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, (GLint)next);
+	ogl_WarnIfError();
+
+	if(next > 0)
+		return INFO::OK;
+
+	ot->flags &= ~OT_IS_STREAMING;
+	finish_upload(ht, ot);
+	ot->flags |= OT_NEED_AUTO_UPLOAD;
+	return INFO::ALL_COMPLETE;
+}
+
+
 //----------------------------------------------------------------------------
 // getters
 //----------------------------------------------------------------------------
@@ -1011,6 +1172,57 @@ Status ogl_tex_get_format(Handle ht, size_t* flags, GLenum* fmt)
 }
 
 
+// retrieve the amount of video memory used by the uploaded levels.
+Status ogl_tex_get_uploaded_size(Handle ht, size_t* size)
+{
+	H_DEREF(ht, OglTex, ot);
+	const Tex* t = &ot->t;
+	*size = 0;
+
+	if(!(ot->flags & (OT_IS_UPLOADED|OT_IS_STREAMING)))
+		return INFO::OK;
+
+	// determine which levels were uploaded, as in get_mipmaps
+	// (minus its side effects)
+	const bool mipmapped = are_mipmaps_needed(t->w, t->h, ot->state.filter);
+	size_t levels_to_skip = 0;
+	if(mipmapped && (t->flags & TEX_MIPMAPS))
+	{
+		size_t w = t->w, h = t->h;
+		while((GLint)w > ogl_max_tex_size || (GLint)h > ogl_max_tex_size)
+		{
+			levels_to_skip++;
+			w /= 2; h /= 2;
+		}
+		if(ot->q_flags & OGL_TEX_HALF_RES)
+			levels_to_skip++;
+		// (levels are uploaded smallest first)
+		if(ot->flags & OT_IS_STREAMING)
+			levels_to_skip += ot->stream_level;
+	}
+
+	const bool is_s3tc = (t->flags & TEX_DXT) != 0;
+	size_t level_w = t->w, level_h = t->h;
+	for(size_t level = 0; ; level++)
+	{
+		if(level >= levels_to_skip)
+		{
+			// (S3TC stores whole 4x4 blocks)
+			const size_t w = is_s3tc? round_up(level_w, size_t(4)) : level_w;
+			const size_t h = is_s3tc? round_up(level_h, size_t(4)) : level_h;
+			*size += w * h * t->bpp / 8;
+		}
+
+		if(!mipmapped || (level_w == 1 && level_h == 1))
+			break;
+		level_w = std::max(level_w/2, size_t(1));
+		level_h = std::max(level_h/2, size_t(1));
+	}
+
+	return INFO::OK;
+}
+
+
 // retrieve pointer to texel data.
 //
 // note: this memory is freed after a successful ogl_tex_upload for
@@ -1055,7 +1267,7 @@ Status ogl_tex_bind(Handle ht, size_t unit)
 {
 	// note: there are many call sites of glActiveTextureARB, so caching
 	// those and ignoring redundant sets isn't feasible.
-	pglActiveTextureARB((int)(GL_TEXTURE0+unit));
+	ogl_ActiveTexture((int)(GL_TEXTURE0+unit));
 
 	// special case: disable texturing
 	if(ht == 0)
@@ -1078,7 +1290,7 @@ Status ogl_tex_bind(Handle ht, size_t unit)
 #if !CONFIG2_GLES
 	glEnable(GL_TEXTURE_2D);
 #endif
-	glBindTexture(GL_TEXTURE_2D, ot->id);
+	ogl_BindTexture(GL_TEXTURE_2D, ot->id);
 	return INFO::OK;
 }
 
@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -354,6 +354,31 @@ extern void ogl_tex_override(OglTexOverrides what, OglTexAllow allow);
 */
 extern Status ogl_tex_upload(const Handle ht, GLenum fmt_ovr = 0, int q_flags_ovr = 0, GLint int_fmt_ovr = 0);
 
+/**
+* Upload part of a texture to OpenGL, so that large textures can be
+* streamed in over several frames. Mipmap levels are sent from the
+* smallest upwards, and GL_TEXTURE_BASE_LEVEL is set to the lowest one
+* uploaded so far, so the texture can already be used (with less
+* detail) after the first call. Levels are copied through a pixel buffer
+* object if supported, so the driver needn't stall while transferring.
+*
+* Textures that can't be streamed (e.g. without mipmaps, or on GLES)
+* are uploaded completely by the first call, as with ogl_tex_upload.
+* The texture's parameters must not be changed once this has been called.
+*
+* @param ht Texture handle
+* @param max_bytes stop once uploading another level would exceed this
+*        (at least one level is always uploaded)
+* @param uploaded_bytes receives the amount of texel data uploaded
+* @return INFO::ALL_COMPLETE once the whole texture has been uploaded
+*         (afterwards it behaves as if ogl_tex_upload had been called),
+*         INFO::OK if there are more levels to upload, or a negative
+*         error code.
+*
+* Side Effects: as with ogl_tex_upload.
+*/
+extern Status ogl_tex_upload_partial(const Handle ht, size_t max_bytes, size_t* uploaded_bytes);
+
 
 //
 // return information about the texture
@@ -381,6 +406,20 @@ extern Status ogl_tex_get_size(Handle ht, size_t* w, size_t* h, size_t* bpp);
 */
 extern Status ogl_tex_get_format(Handle ht, size_t* flags, GLenum* fmt);
 
+/**
+* Retrieve the amount of video memory used by the uploaded mipmap levels.
+*
+* @param ht Texture handle
+* @param size will be filled with the size in bytes
+*        (0 if the texture hasn't been uploaded yet)
+* @return Status
+*
+* This is computed from the texture's format and the levels that were
+* uploaded (allowing for OGL_TEX_HALF_RES, the GL size limit and
+* ogl_tex_upload_partial); the driver may use more than this.
+*/
+extern Status ogl_tex_get_uploaded_size(Handle ht, size_t* size);
+
 /**
 * Retrieve pixel data of the texture.
 *
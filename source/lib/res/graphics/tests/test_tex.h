@@ -144,6 +144,27 @@ public:
 		TS_ASSERT_SAME_DATA(out_img+12, mipmap, 3);
 	}
 
+	// same for a 32bpp image, wide enough to cover the vectorised filter
+	void test_mipmap_create_rgba()
+	{
+		const size_t w = 8, h = 2;
+		static u8 imgData[w*h*4];
+		for(size_t i = 0; i < ARRAY_SIZE(imgData); i++)
+			imgData[i] = (u8)(i*37 + 11);
+		shared_ptr<u8> img = DummySharedPtr(imgData);
+		u8 mipmap[w/2*4];
+		for(size_t x = 0; x < w/2; x++)
+			for(size_t i = 0; i < 4; i++)
+				mipmap[x*4+i] = (u8)((imgData[x*8+i] + imgData[x*8+4+i] + imgData[w*4+x*8+i] + imgData[w*4+x*8+4+i] + 2)/4);
+		Tex t;
+		TS_ASSERT_OK(tex_wrap(w, h, 32, TEX_ALPHA, img, 0, &t));
+		TS_ASSERT_OK(tex_transform_to(&t, TEX_ALPHA|TEX_MIPMAPS));
+		const u8* const out_img = tex_get_data(&t);
+		TS_ASSERT_EQUALS((int)tex_img_size(&t), (w*h + w/2 + w/4 + w/8)*4);
+		TS_ASSERT_SAME_DATA(out_img, imgData, w*h*4);
+		TS_ASSERT_SAME_DATA(out_img+w*h*4, mipmap, w/2*4);
+	}
+
 	void test_img_size()
 	{
 		shared_ptr<u8> img(new u8[100*100*4], ArrayDeleter());
@@ -189,4 +210,32 @@ public:
 
 		tex_codec_unregister_all();
 	}
+
+	void test_s3tc_decode_dxt5()
+	{
+		tex_codec_register_all();
+
+		const size_t w = 4, h = 4, bpp = 8;
+		const size_t size = w*h;
+		shared_ptr<u8> img(new u8[size], ArrayDeleter());
+		// alpha from 0xFF (index 0) to 0x00 (index 1), one row per index 0, 2, 7, 1;
+		// color as in test_s3tc_decode
+		memcpy(img.get(), "\xFF\x00\x00\x20\x49\xFF\x9F\x24" "\xFF\xFF\x00\x00\x00\xAA\xFF\x55", 16);
+		const u8 expected[] =
+			"\xFF\xFF\xFF\xFF" "\xFF\xFF\xFF\xFF" "\xFF\xFF\xFF\xFF" "\xFF\xFF\xFF\xFF"
+			"\xAA\xAA\xAA\xDB" "\xAA\xAA\xAA\xDB" "\xAA\xAA\xAA\xDB" "\xAA\xAA\xAA\xDB"
+			"\x55\x55\x55\x24" "\x55\x55\x55\x24" "\x55\x55\x55\x24" "\x55\x55\x55\x24"
+			"\x00\x00\x00\x00" "\x00\x00\x00\x00" "\x00\x00\x00\x00" "\x00\x00\x00\x00";
+
+		const size_t flags = (TEX_DXT&5)|TEX_ALPHA;
+
+		Tex t;
+		TS_ASSERT_OK(tex_wrap(w, h, bpp, flags, img, 0, &t));
+		TS_ASSERT_OK(tex_transform_to(&t, TEX_ALPHA));
+		TS_ASSERT_SAME_DATA(tex_get_data(&t), expected, 64);
+
+		tex_free(&t);
+
+		tex_codec_unregister_all();
+	}
 };
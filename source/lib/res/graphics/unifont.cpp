@@ -1,4 +1,4 @@
-/* Copyright (c) 2012 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -43,6 +43,10 @@ struct UniFont
 
 	bool HasRGB; // true if RGBA, false if ALPHA
 
+	// Change in the distance field's value over one pixel at this font's
+	// size, or 0 if the texture isn't a signed distance field
+	float SDFSmoothing;
+
 	glyphmap* glyphs;
 
 	int LineSpacing;
@@ -51,8 +55,9 @@ struct UniFont
 
 H_TYPE_DEFINE(UniFont);
 
-static void UniFont_init(UniFont* UNUSED(f), va_list UNUSED(args))
+static void UniFont_init(UniFont* f, va_list UNUSED(args))
 {
+	f->SDFSmoothing = 0.0f;
 }
 
 static void UniFont_dtor(UniFont* f)
@@ -63,7 +68,10 @@ static void UniFont_dtor(UniFont* f)
 	SAFE_DELETE(f->glyphs);
 }
 
-// basename is e.g. "console"; the files are "fonts/console.fnt" and "fonts/console.png"
+// basename is e.g. "console"; the files are "fonts/console.fnt" and "fonts/console.png".
+// If there's no such font and the name ends with a size (e.g. "sans-14"), the
+// signed distance field font for the rest of the name ("fonts/sans.fnt") is
+// used instead, scaled to that size.
 // [10..70ms]
 static Status UniFont_reload(UniFont* f, const PIVFS& vfs, const VfsPath& basename, Handle UNUSED(h))
 {
@@ -75,20 +83,37 @@ static Status UniFont_reload(UniFont* f, const PIVFS& vfs, const VfsPath& basena
 
 	const VfsPath path(L"fonts/");
 
+	VfsPath fontName(basename);
+	int RequestedSize = 0;
+	if (vfs->GetFileInfo(path / basename.ChangeExtension(L".fnt"), 0) < 0)
+	{
+		const std::wstring name = basename.string();
+		const size_t dash = name.find_last_of(L'-');
+		if (dash != std::wstring::npos && dash+1 < name.length() &&
+			name.find_first_not_of(L"0123456789", dash+1) == std::wstring::npos)
+		{
+			fontName = VfsPath(name.substr(0, dash));
+			RequestedSize = wcstol(name.c_str() + dash+1, NULL, 10);
+		}
+	}
+
 	// Read font definition file into a stringstream
 	shared_ptr<u8> buf; size_t size;
-	const VfsPath fntName(basename.ChangeExtension(L".fnt"));
+	const VfsPath fntName(fontName.ChangeExtension(L".fnt"));
 	RETURN_STATUS_IF_ERR(vfs->LoadFile(path / fntName, buf, size));	// [cumulative for 12: 36ms]
 	std::istringstream FNTStream(std::string((const char*)buf.get(), size));
 
 	int Version;
 	FNTStream >> Version;
-	if (Version < 100 || Version > 101) // Make sure this is from a recent version of the font builder
+	if (Version < 100 || Version > 102) // Make sure this is from a recent version of the font builder
 		WARN_RETURN(ERR::FAIL);
 
 	int TextureWidth, TextureHeight;
 	FNTStream >> TextureWidth >> TextureHeight;
 
+	// Scale from the font's glyph metrics to the requested size
+	float Scale = 1.0f;
+
 	if (Version >= 101)
 	{
 		std::string Format;
@@ -97,17 +122,39 @@ static Status UniFont_reload(UniFont* f, const PIVFS& vfs, const VfsPath& basena
 			f->HasRGB = true;
 		else if (Format == "a")
 			f->HasRGB = false;
+		else if (Format == "sdf" && Version >= 102)
+		{
+			// Alpha texture containing the distance to the nearest glyph edge,
+			// mapped from [-Spread, +Spread] texels of the font's own size to [0, 1]
+			int FontSize, Spread;
+			FNTStream >> FontSize >> Spread;
+			if (FontSize <= 0 || Spread <= 0)
+				WARN_RETURN(ERR::CORRUPTED);
+
+			f->HasRGB = false;
+			if (RequestedSize > 0)
+				Scale = (float)RequestedSize / (float)FontSize;
+			f->SDFSmoothing = 0.5f / (Spread * Scale);
+		}
 		else
 			debug_warn(L"Invalid .fnt format string");
 	}
 
+	// Only distance field fonts can be drawn at other sizes
+	if (RequestedSize > 0 && f->SDFSmoothing == 0.0f)
+		WARN_RETURN(ERR::FAIL);
+
 	int NumGlyphs;
 	FNTStream >> NumGlyphs;
 
 	FNTStream >> f->LineSpacing;
+	f->LineSpacing = (int)floor(f->LineSpacing * Scale + 0.5f);
 
 	if (Version >= 101)
+	{
 		FNTStream >> f->Height;
+		f->Height = (int)floor(f->Height * Scale + 0.5f);
+	}
 	else
 		f->Height = 0;
 
@@ -133,7 +180,9 @@ static Status UniFont_reload(UniFont* f, const PIVFS& vfs, const VfsPath& basena
 		GLfloat w = (GLfloat)Width  / (GLfloat)TextureWidth;
 		GLfloat h = (GLfloat)Height / (GLfloat)TextureHeight;
 
-		UnifontGlyphData g = { u, -v, u+w, -v+h, (i16)OffsetX, (i16)-OffsetY, (i16)(OffsetX+Width), (i16)(-OffsetY+Height), (i16)Advance };
+#define SCALE(x) (i16)floor((x) * Scale + 0.5f)
+		UnifontGlyphData g = { u, -v, u+w, -v+h, SCALE(OffsetX), SCALE(-OffsetY), SCALE(OffsetX+Width), SCALE(-OffsetY+Height), SCALE(Advance) };
+#undef SCALE
 		(*f->glyphs)[(u16)Codepoint] = g;
 	}
 
@@ -141,10 +190,12 @@ static Status UniFont_reload(UniFont* f, const PIVFS& vfs, const VfsPath& basena
 
 	// Load glyph texture
 	// [cumulative for 12: 20ms]
-	const VfsPath imgName(basename.ChangeExtension(L".png"));
+	// (All sizes of a distance field font share the same texture)
+	const VfsPath imgName(fontName.ChangeExtension(L".png"));
 	Handle ht = ogl_tex_load(vfs, path / imgName);
 	RETURN_STATUS_IF_ERR(ht);
-	(void)ogl_tex_set_filter(ht, GL_NEAREST);
+	// (Distance fields must be interpolated to get smooth edges)
+	(void)ogl_tex_set_filter(ht, f->SDFSmoothing != 0.0f ? GL_LINEAR : GL_NEAREST);
 
 	Status err;
 	if (f->HasRGB)
@@ -234,6 +285,15 @@ bool unifont_has_rgb(const Handle h)
 }
 
 
+float unifont_sdf_smoothing(const Handle h)
+{
+	UniFont* const f = H_USER_DATA(h, UniFont);
+	if(!f)
+		return 0.0f;
+	return f->SDFSmoothing;
+}
+
+
 int unifont_character_width(const Handle h, wchar_t c)
 {
 	H_DEREF(h, UniFont, f);
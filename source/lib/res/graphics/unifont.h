@@ -1,4 +1,4 @@
-/* Copyright (c) 2012 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -67,6 +67,16 @@ Status unifont_stringsize(const Handle h, const wchar_t* text, int& width, int&
  **/
 bool unifont_has_rgb(const Handle h);
 
+/**
+ * @return the change in value of a signed distance field font's texture over
+ * one pixel (when drawn at the font's size), for antialiasing its edges;
+ * or 0 if the font is a normal bitmap font.
+ *
+ * Distance field fonts (.fnt version 102, format "sdf") can be loaded at any
+ * size, by appending "-<size>" to their name.
+ **/
+float unifont_sdf_smoothing(const Handle h);
+
 /**
  * @return height [pixels] of the font.
  **/
@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -35,10 +35,10 @@
 #include <new>		// std::bad_alloc
 
 #include "lib/fnv_hash.h"
-#include "lib/allocators/overrun_protector.h"
 #include "lib/allocators/pool.h"
 #include "lib/module_init.h"
 #include "lib/posix/posix_pthread.h"
+#include "lib/sysdep/cpu.h"	// cpu_CAS64
 
 
 namespace ERR {
@@ -72,6 +72,12 @@ STATUS_ADD_DEFINITIONS(hStatusDefinitions);
 // we need a central list of resources for freeing at exit, checking if a
 // resource has already been loaded (for caching), and when reloading.
 // may as well keep them in an array, rather than add a list and index.
+//
+// why no global lock?
+// resources may be loaded by several threads at once, and loading can be
+// slow. handle slots are therefore allocated under a lock of their own,
+// and everything else is serialized per key (see KeyStripe below).
+// resources are loaded and destroyed without holding any of these locks.
 
 
 
@@ -158,6 +164,9 @@ struct HDATA
 	//    which the index can't currently handle)
 	u32 unique : 1;
 	u32 disallow_reload : 1;
+	// .. whether it has been added to the h_find lookup index
+	//    (only happens after it has been loaded successfully)
+	u32 indexed : 1;
 
 	H_Type type;
 
@@ -178,8 +187,17 @@ static const ssize_t hdata_cap = (1ul << IDX_BITS)/4;
 
 // pool of fixed-size elements allows O(1) alloc and free;
 // there is a simple mapping between HDATA address and index.
+// (its storage is reserved up front, so HDATA can be accessed
+// without locking; only allocations need hpool_mutex.)
 static Pool hpool;
 
+static pthread_mutex_t hpool_mutex;
+struct H_PoolLock
+{
+	H_PoolLock() { pthread_mutex_lock(&hpool_mutex); }
+	~H_PoolLock() { pthread_mutex_unlock(&hpool_mutex); }
+};
+
 
 // error checking strategy:
 // all handles passed in go through h_data(Handle, Type)
@@ -284,15 +302,44 @@ static Status h_data_tag_type(const Handle h, const H_Type type, HDATA*& hd)
 
 typedef boost::unordered_multimap<uintptr_t, ssize_t> Key2Idx;
 typedef Key2Idx::iterator It;
-static OverrunProtector<Key2Idx> key2idx_wrapper;
+
+// the index is split into stripes (selected by key, which is already a
+// hash), each with its own lock, so that threads dealing with different
+// resources rarely contend. the stripe's lock also protects the reference
+// count and tag of all handles with its keys, and must be held when
+// calling key_* and h_release_hd.
+//
+// the lock is recursive because h_reload holds it while reloading,
+// which may free or allocate other handles (e.g. fonts load textures).
+// that is the only place a stripe lock is held while taking another, and
+// there must not be several h_reload calls at once (it only happens
+// when hotloading, on the main thread), so there is no risk of deadlock.
+struct KeyStripe
+{
+	pthread_mutex_t mutex;
+	Key2Idx key2idx;
+};
+
+static const size_t NUM_KEY_STRIPES = 16;
+static KeyStripe keyStripes[NUM_KEY_STRIPES];
+
+static KeyStripe& key_stripe(uintptr_t key)
+{
+	return keyStripes[key % NUM_KEY_STRIPES];
+}
+
+struct H_KeyLock
+{
+	H_KeyLock(uintptr_t key) : mutex(&key_stripe(key).mutex) { pthread_mutex_lock(mutex); }
+	~H_KeyLock() { pthread_mutex_unlock(mutex); }
+	pthread_mutex_t* mutex;
+};
 
 enum KeyRemoveFlag { KEY_NOREMOVE, KEY_REMOVE };
 
 static Handle key_find(uintptr_t key, H_Type type, KeyRemoveFlag remove_option = KEY_NOREMOVE)
 {
-	Key2Idx* key2idx = key2idx_wrapper.get();
-	if(!key2idx)
-		WARN_RETURN(ERR::NO_MEM);
+	Key2Idx& key2idx = key_stripe(key).key2idx;
 
 	// initial return value: "not found at all, or it's of the
 	// wrong type". the latter happens when called by h_alloc to
@@ -300,7 +347,7 @@ static Handle key_find(uintptr_t key, H_Type type, KeyRemoveFlag remove_option =
 	// only the corresponding VFile exists.
 	Handle ret = -1;
 
-	std::pair<It, It> range = key2idx->equal_range(key);
+	std::pair<It, It> range = key2idx.equal_range(key);
 	for(It it = range.first; it != range.second; ++it)
 	{
 		ssize_t idx = it->second;
@@ -312,28 +359,21 @@ static Handle key_find(uintptr_t key, H_Type type, KeyRemoveFlag remove_option =
 
 		// found a match
 		if(remove_option == KEY_REMOVE)
-			key2idx->erase(it);
+			key2idx.erase(it);
 		ret = hd->h;
 		break;
 	}
 
-	key2idx_wrapper.lock();
 	return ret;
 }
 
 
 static void key_add(uintptr_t key, Handle h)
 {
-	Key2Idx* key2idx = key2idx_wrapper.get();
-	if(!key2idx)
-		return;
-
 	const ssize_t idx = h_idx(h);
 	// note: MSDN documentation of stdext::hash_multimap is incorrect;
 	// there is no overload of insert() that returns pair<iterator, bool>.
-	(void)key2idx->insert(std::make_pair(key, idx));
-
-	key2idx_wrapper.lock();
+	(void)key_stripe(key).key2idx.insert(std::make_pair(key, idx));
 }
 
 
@@ -388,22 +428,30 @@ static Status type_validate(H_Type type)
 
 static Tag gen_tag()
 {
-	static Tag tag;
-	tag += (1ull << IDX_BITS);
+	static volatile i64 tag;
+	// (several threads may be allocating handles at once)
+	for(;;)
+	{
+		const i64 prev = tag;
+		const i64 next = prev + (1ll << IDX_BITS);
+		if(cpu_CAS64(&tag, prev, next))
+			return next;
+	}
 	// it's not easy to detect overflow, because compilers
 	// are allowed to assume it'll never happen. however,
 	// pow(2, 64-IDX_BITS) is "enough" anyway.
-	return tag;
 }
 
 
+// add a reference to the existing (key, type) handle, if there is one.
+// the caller must hold the key's stripe lock.
 static Handle reuse_existing_handle(uintptr_t key, H_Type type, size_t flags)
 {
 	if(flags & RES_NO_CACHE)
 		return 0;
 
 	// object of specified key and type doesn't exist yet
-	Handle h = h_find(type, key);
+	Handle h = key_find(key, type);
 	if(h <= 0)
 		return 0;
 
@@ -459,12 +507,16 @@ static Status call_init_and_reload(Handle h, H_Type type, HDATA* hd, const PIVFS
 
 static Handle alloc_new_handle(H_Type type, const PIVFS& vfs, const VfsPath& pathname, uintptr_t key, size_t flags, va_list* init_args)
 {
-	HDATA* hd = (HDATA*)pool_alloc(&hpool, 0);
-	if(!hd)
-		WARN_RETURN(ERR::NO_MEM);
+	HDATA* hd;
+	ssize_t idx;
+	{
+		H_PoolLock lock;
+		hd = (HDATA*)pool_alloc(&hpool, 0);
+		if(!hd)
+			WARN_RETURN(ERR::NO_MEM);
+		idx = h_idx_from_data(hd);
+	}
 	new(&hd->pathname) VfsPath;
-
-	ssize_t idx = h_idx_from_data(hd);
 	RETURN_STATUS_IF_ERR(idx);
 
 	// (don't want to do this before the add-reference exit,
@@ -483,57 +535,66 @@ static Handle alloc_new_handle(H_Type type, const PIVFS& vfs, const VfsPath& pat
 	hd->unique = (flags & RES_UNIQUE) != 0;
 	hd->pathname = pathname;
 
-	if(key && !hd->unique)
-		key_add(key, h);
-
+	// load the resource without holding any locks, so that other threads
+	// can carry on using (and loading) other resources meanwhile.
+	// it isn't in the index yet, so nobody else can find it.
 	Status err = call_init_and_reload(h, type, hd, vfs, pathname, init_args);
 	if(err < 0)
-		goto fail;
-
-	return h;
+	{
+		// reload failed; free the handle
+		hd->keep_open = 0;	// disallow caching (since contents are invalid)
+		(void)h_free(h, type);	// (h_free already does WARN_IF_ERR)
 
-fail:
-	// reload failed; free the handle
-	hd->keep_open = 0;	// disallow caching (since contents are invalid)
-	(void)h_free(h, type);	// (h_free already does WARN_IF_ERR)
+		// note: since some uses will always fail (e.g. loading sounds if
+		// g_Quickstart), do not complain here.
+		return (Handle)err;
+	}
 
-	// note: since some uses will always fail (e.g. loading sounds if
-	// g_Quickstart), do not complain here.
-	return (Handle)err;
-}
+	if(key && !hd->unique)
+	{
+		Handle existing;
+		{
+			H_KeyLock lock(key);
+			existing = reuse_existing_handle(key, type, flags);
+			if(existing == 0)
+			{
+				key_add(key, h);
+				hd->indexed = 1;
+				return h;
+			}
+		}
 
+		// another thread loaded the same resource meanwhile.
+		// that's rare, so we just discard our copy.
+		hd->keep_open = 0;
+		(void)h_free(h, type);
+		return existing;
+	}
 
-static pthread_mutex_t h_mutex;
-// (the same class is defined in vfs.cpp, but it is easier to
-// just duplicate it to avoid having to specify the mutex.
-// such a class exists in ps/ThreadUtil.h, but we can't
-// take a dependency on that module here.)
-struct H_ScopedLock
-{
-	H_ScopedLock() { pthread_mutex_lock(&h_mutex); }
-	~H_ScopedLock() { pthread_mutex_unlock(&h_mutex); }
-};
+	return h;
+}
 
 
 // any further params are passed to type's init routine
 Handle h_alloc(H_Type type, const PIVFS& vfs, const VfsPath& pathname, size_t flags, ...)
 {
-	H_ScopedLock s;
-
 	RETURN_STATUS_IF_ERR(type_validate(type));
 
 	const uintptr_t key = fnv_hash(pathname.string().c_str(), pathname.string().length()*sizeof(pathname.string()[0]));
 
 	// see if we can reuse an existing handle
-	Handle h = reuse_existing_handle(key, type, flags);
-	RETURN_STATUS_IF_ERR(h);
-	// .. successfully reused the handle; refcount increased
-	if(h > 0)
-		return h;
+	{
+		H_KeyLock lock(key);
+		Handle h = reuse_existing_handle(key, type, flags);
+		RETURN_STATUS_IF_ERR(h);
+		// .. successfully reused the handle; refcount increased
+		if(h > 0)
+			return h;
+	}
 	// .. need to allocate a new one:
 	va_list args;
 	va_start(args, flags);
-	h = alloc_new_handle(type, vfs, pathname, key, flags, &args);
+	Handle h = alloc_new_handle(type, vfs, pathname, key, flags, &args);
 	va_end(args);
 	return h;	// alloc_new_handle already does WARN_RETURN_STATUS_IF_ERR
 }
@@ -541,17 +602,33 @@ Handle h_alloc(H_Type type, const PIVFS& vfs, const VfsPath& pathname, size_t fl
 
 //-----------------------------------------------------------------------------
 
-static void h_free_hd(HDATA* hd)
+// drop a reference, and remove the handle from the index if it is to be
+// released. the caller must hold the key's stripe lock.
+// returns whether the caller should now call h_destroy_hd (which can
+// be done after releasing the lock, since nobody else can reach it).
+static bool h_release_hd(HDATA* hd)
 {
 	if(hd->refs > 0)
 		hd->refs--;
 
 	// still references open or caching requests it stays - do not release.
 	if(hd->refs > 0 || hd->keep_open)
-		return;
+		return false;
 
-	// actually release the resource (call dtor, free control block).
+	if(hd->indexed)
+	{
+		key_remove(hd->key, hd->type);
+		hd->indexed = 0;
+	}
 
+	// make sure stale handles can't free it again before it is destroyed
+	hd->h = 0;
+	return true;
+}
+
+// actually release the resource (call dtor, free control block).
+static void h_destroy_hd(HDATA* hd)
+{
 	// h_alloc makes sure type != 0; if we get here, it still is
 	H_VTbl* vtbl = hd->type;
 
@@ -560,9 +637,6 @@ static void h_free_hd(HDATA* hd)
 	if(vtbl->dtor)
 		vtbl->dtor(hd->user);
 
-	if(hd->key && !hd->unique)
-		key_remove(hd->key, hd->type);
-
 #ifndef NDEBUG
 	// to_string is slow for some handles, so avoid calling it if unnecessary
 	if(debug_filter_allows(L"H_MGR|"))
@@ -576,14 +650,25 @@ static void h_free_hd(HDATA* hd)
 
 	hd->pathname.~VfsPath();	// FIXME: ugly hack, but necessary to reclaim memory
 	memset(hd, 0, sizeof(*hd));
+
+	H_PoolLock lock;
 	pool_free(&hpool, hd);
 }
 
+static void h_free_hd(HDATA* hd)
+{
+	bool destroy;
+	{
+		H_KeyLock lock(hd->key);
+		destroy = h_release_hd(hd);
+	}
+	if(destroy)
+		h_destroy_hd(hd);
+}
+
 
 Status h_free(Handle& h, H_Type type)
 {
-	H_ScopedLock s;
-
 	// 0-initialized or an error code; don't complain because this
 	// happens often and is harmless.
 	if(h <= 0)
@@ -596,7 +681,15 @@ Status h_free(Handle& h, H_Type type)
 	HDATA* hd;
 	RETURN_STATUS_IF_ERR(h_data_tag_type(h_copy, type, hd));
 
-	h_free_hd(hd);
+	bool destroy;
+	{
+		H_KeyLock lock(hd->key);
+		// check again, now that nobody else can change the tag
+		RETURN_STATUS_IF_ERR(h_data_tag_type(h_copy, type, hd));
+		destroy = h_release_hd(hd);
+	}
+	if(destroy)
+		h_destroy_hd(hd);
 	return INFO::OK;
 }
 
@@ -636,17 +729,21 @@ VfsPath h_filename(const Handle h)
 // TODO: what if iterating through all handles is too slow?
 Status h_reload(const PIVFS& vfs, const VfsPath& pathname)
 {
-	H_ScopedLock s;
-
 	const u32 key = fnv_hash(pathname.string().c_str(), pathname.string().length()*sizeof(pathname.string()[0]));
 
+	// (see rationale at KeyStripe)
+	H_KeyLock lock(key);
+
 	// destroy (note: not free!) all handles backed by this file.
 	// do this before reloading any of them, because we don't specify reload
 	// order (the parent resource may be reloaded first, and load the child,
 	// whose original data would leak).
+	//
+	// skip handles that are still being loaded by h_alloc (not yet indexed,
+	// although they will be); their contents are up to date anyway.
 	for(HDATA* hd = (HDATA*)hpool.da.base; hd < (HDATA*)(hpool.da.base + hpool.da.pos); hd = (HDATA*)(uintptr_t(hd)+hpool.el_size))
 	{
-		if(hd->key == 0 || hd->key != key || hd->disallow_reload)
+		if(hd->key == 0 || hd->key != key || hd->disallow_reload || (!hd->indexed && !hd->unique))
 			continue;
 		hd->type->dtor(hd->user);
 	}
@@ -657,7 +754,7 @@ Status h_reload(const PIVFS& vfs, const VfsPath& pathname)
 	size_t i = 0;
 	for(HDATA* hd = (HDATA*)hpool.da.base; hd < (HDATA*)(hpool.da.base + hpool.da.pos); hd = (HDATA*)(uintptr_t(hd)+hpool.el_size), i++)
 	{
-		if(hd->key == 0 || hd->key != key || hd->disallow_reload)
+		if(hd->key == 0 || hd->key != key || hd->disallow_reload || (!hd->indexed && !hd->unique))
 			continue;
 
 		Status err = hd->type->reload(hd->user, vfs, hd->pathname, hd->h);
@@ -678,7 +775,7 @@ Status h_reload(const PIVFS& vfs, const VfsPath& pathname)
 
 Handle h_find(H_Type type, uintptr_t key)
 {
-	H_ScopedLock s;
+	H_KeyLock lock(key);
 	return key_find(key, type);
 }
 
@@ -692,16 +789,21 @@ Handle h_find(H_Type type, uintptr_t key)
 // at that point, all (cached) OpenAL resources must be freed.
 Status h_force_free(Handle h, H_Type type)
 {
-	H_ScopedLock s;
-
 	// require valid index; ignore tag; type checked below.
 	HDATA* hd;
 	RETURN_STATUS_IF_ERR(h_data_no_tag(h, hd));
 	if(hd->type != type)
 		WARN_RETURN(ERR::H_TYPE_MISMATCH);
-	hd->keep_open = 0;
-	hd->refs = 0;
-	h_free_hd(hd);
+
+	bool destroy;
+	{
+		H_KeyLock lock(hd->key);
+		hd->keep_open = 0;
+		hd->refs = 0;
+		destroy = h_release_hd(hd);
+	}
+	if(destroy)
+		h_destroy_hd(hd);
 	return INFO::OK;
 }
 
@@ -718,6 +820,7 @@ void h_add_ref(Handle h)
 	if(h_data_tag(h, hd) != INFO::OK)
 		return;
 
+	H_KeyLock lock(hd->key);
 	ENSURE(hd->refs);	// if there are no refs, how did the caller manage to keep a Handle?!
 	hd->refs++;
 }
@@ -743,18 +846,24 @@ static ModuleInitState initState;
 
 static Status Init()
 {
-	// lock must be recursive (e.g. h_alloc calls h_find)
+	// stripe locks must be recursive (see rationale at KeyStripe)
 	pthread_mutexattr_t attr;
 	int err;
 	err = pthread_mutexattr_init(&attr);
 	ENSURE(err == 0);
 	err = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
 	ENSURE(err == 0);
-	err = pthread_mutex_init(&h_mutex, &attr);
-	ENSURE(err == 0);
+	for(size_t i = 0; i < NUM_KEY_STRIPES; i++)
+	{
+		err = pthread_mutex_init(&keyStripes[i].mutex, &attr);
+		ENSURE(err == 0);
+	}
 	err = pthread_mutexattr_destroy(&attr);
 	ENSURE(err == 0);
 
+	err = pthread_mutex_init(&hpool_mutex, NULL);
+	ENSURE(err == 0);
+
 	RETURN_STATUS_IF_ERR(pool_create(&hpool, hdata_cap*sizeof(HDATA), sizeof(HDATA)));
 	return INFO::OK;
 }
@@ -767,7 +876,8 @@ static void Shutdown()
 	// raise a double-free warning unless we ignore it. (#860, #915, #920)
 	ignoreDoubleFree = true;
 
-	H_ScopedLock s;
+	// (nothing else may be using handles at this point, so only
+	// h_free_hd's locking is needed)
 
 	// forcibly close all open handles
 	for(HDATA* hd = (HDATA*)hpool.da.base; hd < (HDATA*)(hpool.da.base + hpool.da.pos); hd = (HDATA*)(uintptr_t(hd)+hpool.el_size))
@@ -791,7 +901,8 @@ void h_mgr_free_type(const H_Type type)
 {
 	ignoreDoubleFree = true;
 
-	H_ScopedLock s;
+	// (like Shutdown, this is only called while nothing else is
+	// using handles of this type)
 
 	// forcibly close all open handles of the specified type
 	for(HDATA* hd = (HDATA*)hpool.da.base; hd < (HDATA*)(hpool.da.base + hpool.da.pos); hd = (HDATA*)(uintptr_t(hd)+hpool.el_size))
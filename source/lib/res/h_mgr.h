@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -380,6 +380,9 @@ const size_t H_STRING_LEN = 256;
 //// user_size is checked to make sure the user data fits in the handle data space.
 // dtor is associated with type and called when the object is freed.
 // handle data is initialized to 0; optionally, a pointer to it is returned.
+// may be called from several threads at once; the resource is loaded
+// without blocking other threads' h_alloc/h_free calls. (if two threads
+// load the same resource at once, one of the copies is discarded.)
 extern Handle h_alloc(H_Type type, const PIVFS& vfs, const VfsPath& pathname, size_t flags = 0, ...);
 extern Status h_free(Handle& h, H_Type type);
 
@@ -389,7 +392,7 @@ void h_mgr_free_type(const H_Type type);
 
 
 // find and return a handle by key (typically filename hash)
-// currently O(log n).
+// O(1) (hash lookup).
 //
 // HACK: currently can't find RES_UNIQUE handles, because there
 // may be multiple instances of them, breaking the lookup data structure.
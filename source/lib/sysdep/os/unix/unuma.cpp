@@ -24,28 +24,123 @@
 #include "lib/sysdep/numa.h"
 
 #include "lib/bits.h"
+#include "lib/module_init.h"
 #include "lib/sysdep/os_cpu.h"
 
+#include <cstdio>
+#include <unistd.h>	// access
+
+// Linux describes the nodes in sysfs; elsewhere (or if that's unavailable)
+// everything is treated as a single node.
+
+static const size_t maxNodes = 64;
+
+static size_t numNodes = 1;
+static size_t nodeFromProcessor[sizeof(uintptr_t)*CHAR_BIT];
+static uintptr_t processorMaskFromNode[maxNodes];
+
+static Status DetectNodes()
+{
+	const size_t numProcessors = std::min(os_cpu_NumProcessors(), sizeof(uintptr_t)*CHAR_BIT);
+	processorMaskFromNode[0] = bit_mask<uintptr_t>(numProcessors);
+
+#if OS_LINUX
+	size_t detectedNodes = 0;
+	uintptr_t detectedMasks[maxNodes] = { 0 };
+	for (size_t node = 0; node < maxNodes; ++node)
+	{
+		bool exists = false;
+		for (size_t processor = 0; processor < numProcessors; ++processor)
+		{
+			char path[100];
+			sprintf_s(path, ARRAY_SIZE(path), "/sys/devices/system/node/node%d/cpu%d", (int)node, (int)processor);
+			if (access(path, F_OK) == 0)
+			{
+				exists = true;
+				detectedMasks[node] |= (uintptr_t)1 << processor;
+			}
+		}
+		if (!exists)
+			break;
+		detectedNodes = node + 1;
+	}
+
+	// Only trust it if every processor is in exactly one node
+	uintptr_t allProcessors = 0;
+	for (size_t node = 0; node < detectedNodes; ++node)
+	{
+		if (allProcessors & detectedMasks[node])
+			return INFO::OK;
+		allProcessors |= detectedMasks[node];
+	}
+	if (detectedNodes == 0 || allProcessors != processorMaskFromNode[0])
+		return INFO::OK;
+
+	numNodes = detectedNodes;
+	for (size_t node = 0; node < numNodes; ++node)
+	{
+		processorMaskFromNode[node] = detectedMasks[node];
+		for (size_t processor = 0; processor < numProcessors; ++processor)
+			if (detectedMasks[node] & ((uintptr_t)1 << processor))
+				nodeFromProcessor[processor] = node;
+	}
+#endif
+
+	return INFO::OK;
+}
+
+static ModuleInitState initState;
+
 size_t numa_NumNodes()
 {
-	return 1;
+	(void)ModuleInit(&initState, DetectNodes);
+	return numNodes;
 }
 
-size_t numa_NodeFromProcessor(size_t UNUSED(processor))
+size_t numa_NodeFromProcessor(size_t processor)
 {
-	return 0;
+	(void)ModuleInit(&initState, DetectNodes);
+	if (processor >= ARRAY_SIZE(nodeFromProcessor))
+		return 0;
+	return nodeFromProcessor[processor];
 }
 
 uintptr_t numa_ProcessorMaskFromNode(size_t node)
 {
-	ENSURE(node == 0);
-	return bit_mask<uintptr_t>(os_cpu_NumProcessors());
+	(void)ModuleInit(&initState, DetectNodes);
+	ENSURE(node < numNodes);
+	return processorMaskFromNode[node];
 }
 
 size_t numa_AvailableMemory(size_t node)
 {
-	ENSURE(node == 0);
-	return os_cpu_MemoryAvailable();
+	(void)ModuleInit(&initState, DetectNodes);
+	ENSURE(node < numNodes);
+	if (numNodes == 1)
+		return os_cpu_MemoryAvailable();
+
+#if OS_LINUX
+	// (in MiB, like os_cpu_MemoryAvailable)
+	char path[100];
+	sprintf_s(path, ARRAY_SIZE(path), "/sys/devices/system/node/node%d/meminfo", (int)node);
+	if (FILE* f = fopen(path, "r"))
+	{
+		char line[200];
+		while (fgets(line, ARRAY_SIZE(line), f))
+		{
+			int lineNode;
+			unsigned long kib;
+			if (sscanf(line, "Node %d MemFree: %lu kB", &lineNode, &kib) == 2)
+			{
+				fclose(f);
+				return (size_t)(kib / 1024);
+			}
+		}
+		fclose(f);
+	}
+#endif
+
+	return os_cpu_MemoryAvailable() / numNodes;
 }
 
 double numa_Factor()
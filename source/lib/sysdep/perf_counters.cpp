@@ -0,0 +1,123 @@
+/* Copyright (c) 2013 Wildfire Games
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * hardware performance counters.
+ */
+
+#include "precompiled.h"
+#include "lib/sysdep/perf_counters.h"
+
+#if OS_LINUX
+# include <linux/perf_event.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
+
+#if OS_LINUX
+
+struct PerfCounters
+{
+	int instructionsFd;	// group leader
+	int cacheMissesFd;
+};
+
+static int OpenCounter(u64 config, int groupFd)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;	// read all counters with one syscall
+
+	// (pid 0 and cpu -1 measure the calling thread on any CPU.
+	// glibc has no wrapper for this syscall.)
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+PerfCounters* perf_counters_Create()
+{
+	int instructionsFd = OpenCounter(PERF_COUNT_HW_INSTRUCTIONS, -1);
+	if(instructionsFd < 0)
+	{
+		debug_printf(L"perf_counters: perf_event_open failed (errno %d)\n", errno);
+		return 0;
+	}
+
+	int cacheMissesFd = OpenCounter(PERF_COUNT_HW_CACHE_MISSES, instructionsFd);
+	if(cacheMissesFd < 0)
+	{
+		debug_printf(L"perf_counters: perf_event_open failed (errno %d)\n", errno);
+		close(instructionsFd);
+		return 0;
+	}
+
+	PerfCounters* counters = new PerfCounters;
+	counters->instructionsFd = instructionsFd;
+	counters->cacheMissesFd = cacheMissesFd;
+	return counters;
+}
+
+void perf_counters_Destroy(PerfCounters* counters)
+{
+	if(!counters)
+		return;
+	close(counters->cacheMissesFd);
+	close(counters->instructionsFd);
+	delete counters;
+}
+
+bool perf_counters_Read(PerfCounters* counters, PerfCounterValues& values)
+{
+	if(!counters)
+		return false;
+
+	// PERF_FORMAT_GROUP layout: number of counters, then their values
+	u64 data[3];
+	if(read(counters->instructionsFd, data, sizeof(data)) != (ssize_t)sizeof(data) || data[0] != 2)
+		return false;
+
+	values.instructions = data[1];
+	values.cacheMisses = data[2];
+	return true;
+}
+
+#else
+
+PerfCounters* perf_counters_Create()
+{
+	return 0;
+}
+
+void perf_counters_Destroy(PerfCounters* UNUSED(counters))
+{
+}
+
+bool perf_counters_Read(PerfCounters* UNUSED(counters), PerfCounterValues& UNUSED(values))
+{
+	return false;
+}
+
+#endif
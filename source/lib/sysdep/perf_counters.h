@@ -0,0 +1,63 @@
+/* Copyright (c) 2013 Wildfire Games
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * hardware performance counters.
+ */
+
+#ifndef INCLUDED_PERF_COUNTERS
+#define INCLUDED_PERF_COUNTERS
+
+/**
+ * values of the counters measuring the current thread, since they were created.
+ **/
+struct PerfCounterValues
+{
+	u64 instructions;
+	u64 cacheMisses;
+};
+
+struct PerfCounters;
+
+/**
+ * create a set of counters measuring the calling thread's user-mode
+ * instructions and last-level cache misses.
+ *
+ * currently only implemented on Linux (via perf_event_open); may also fail
+ * there if the kernel or its security settings don't allow it.
+ *
+ * @return counters (to be passed to perf_counters_Destroy when no longer
+ * needed), or 0 if they're not supported.
+ **/
+LIB_API PerfCounters* perf_counters_Create();
+
+LIB_API void perf_counters_Destroy(PerfCounters* counters);
+
+/**
+ * read the counters' current values. must be called by the thread that
+ * created them.
+ *
+ * @return false if the values couldn't be read.
+ **/
+LIB_API bool perf_counters_Read(PerfCounters* counters, PerfCounterValues& values);
+
+#endif	// #ifndef INCLUDED_PERF_COUNTERS
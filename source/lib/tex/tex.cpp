@@ -38,6 +38,10 @@
 
 #include "tex_codec.h"
 
+#if HAVE_SSE2
+# include <emmintrin.h>
+#endif
+
 
 static const StatusDefinition texStatusDefinitions[] = {
 	{ ERR::TEX_FMT_INVALID, L"Invalid/unsupported texture format" },
@@ -182,6 +186,31 @@ struct CreateLevelData
 	size_t prev_level_dataSize;
 };
 
+#if HAVE_SSE2
+// 2x2 box filter of the 32bpp pixels in the two rows, 4 source pixels at a time.
+// returns how many of the rows' src_w pixels were processed.
+static size_t filter_rows_rgba_sse2(const u8* RESTRICT row0, const u8* RESTRICT row1, size_t src_w, u8*& dst)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16(2);
+	size_t x = 0;
+	for(; x+4 <= src_w; x += 4)
+	{
+		const __m128i a = _mm_loadu_si128((const __m128i*)(row0 + x*4));
+		const __m128i b = _mm_loadu_si128((const __m128i*)(row1 + x*4));
+		// vertical sums of pixels 0,1 and 2,3 as 16-bit components
+		const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+		const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+		// add horizontally adjacent pixels, then (sum+2)/4
+		__m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+		sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+		_mm_storel_epi64((__m128i*)dst, _mm_packus_epi16(sum, sum));
+		dst += 8;
+	}
+	return x;
+}
+#endif
+
 // uses 2x2 box filter
 static void create_level(size_t level, size_t level_w, size_t level_h, const u8* RESTRICT level_data, size_t level_dataSize, void* RESTRICT cbData)
 {
@@ -224,19 +253,21 @@ static void create_level(size_t level, size_t level_w, size_t level_h, const u8*
 		{
 			for(size_t y = 0; y < src_h; y += 2)
 			{
-				for(size_t x = 0; x < src_w; x += 2)
+				const u8* row = src + y*dy;
+				size_t x = 0;
+#if HAVE_SSE2
+				if(num_components == 4)
+					x = filter_rows_rgba_sse2(row, row+dy, src_w, dst);
+#endif
+				for(; x < src_w; x += 2)
 				{
+					const u8* p = row + x*dx;
 					for(size_t i = 0; i < num_components; i++)
-					{
-						*dst++ = (src[0]+src[dx]+src[dy]+src[dx+dy]+2)/4;
-						src += 1;
-					}
-
-					src += dx;	// skip to next pixel (since box is 2x2)
+						*dst++ = (p[i]+p[dx+i]+p[dy+i]+p[dx+dy+i]+2)/4;
 				}
-
-				src += dy;	// skip to next row (since box is 2x2)
 			}
+
+			src += src_h*dy;
 		}
 
 		ENSURE(dst == level_data + level_dataSize);
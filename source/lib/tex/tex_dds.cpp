@@ -40,9 +40,10 @@
 // S3TC decompression
 //-----------------------------------------------------------------------------
 
-// note: this code may not be terribly efficient. it's only used to
-// emulate hardware S3TC support - if that isn't available, performance
-// will suffer anyway due to increased video memory usage.
+// note: this is only used to emulate hardware S3TC support and to read
+// textures back on the CPU, but it still matters for load times, so
+// each block's colors are precalculated once and its 16 pixels written
+// with table lookups only.
 
 
 // for efficiency, we precalculate as much as possible about a block
@@ -61,36 +62,32 @@ public:
 		PrecalculateColor(dxt, c_block);
 	}
 
-	void WritePixel(size_t pixel_idx, u8* RESTRICT out) const
+	// write the block's 4x4 pixels (RGBA) into out, in row-major order
+	void Decode(u8 (&out)[16][4]) const
 	{
-		ENSURE(pixel_idx < 16);
-
 		// pixel index -> color selector (2 bit) -> color
-		const size_t c_selector = access_bit_tbl(c_selectors, pixel_idx, 2);
-		for(int i = 0; i < 3; i++)
-			out[i] = (u8)c[c_selector][i];
-
-		// if no alpha, done
-		if(dxt == 1)
-			return;
+		u32 selectors = c_selectors;
+		for(size_t pixel_idx = 0; pixel_idx < 16; pixel_idx++, selectors >>= 2)
+			memcpy(out[pixel_idx], palette[selectors & 3], 4);
 
-		size_t a;
+		// (the palette already has the DXT1 and DXT1a alpha)
 		if(dxt == 3)
 		{
 			// table of 4-bit alpha entries
-			a = access_bit_tbl(a_bits, pixel_idx, 4);
-			a |= a << 4; // expand to 8 bits (replicate high into low!)
+			u64 bits = a_bits;
+			for(size_t pixel_idx = 0; pixel_idx < 16; pixel_idx++, bits >>= 4)
+			{
+				const u8 a = (u8)(bits & 0xF);
+				out[pixel_idx][A] = (u8)(a | (a << 4)); // expand to 8 bits (replicate high into low!)
+			}
 		}
 		else if(dxt == 5)
 		{
 			// pixel index -> alpha selector (3 bit) -> alpha
-			const size_t a_selector = access_bit_tbl(a_bits, pixel_idx, 3);
-			a = dxt5_a_tbl[a_selector];
+			u64 bits = a_bits;
+			for(size_t pixel_idx = 0; pixel_idx < 16; pixel_idx++, bits >>= 3)
+				out[pixel_idx][A] = dxt5_a_tbl[bits & 7];
 		}
-		// (dxt == DXT1A)
-		else
-			a = c[c_selector][A];
-		out[A] = (u8)(a & 0xFF);
 	}
 
 private:
@@ -109,13 +106,6 @@ private:
 		for(int i = 0; i < 3; i++) dst[i] = (c0[i]+c1[i])/2;
 	}
 
-	template<typename T>
-	static inline size_t access_bit_tbl(T tbl, size_t idx, size_t bit_width)
-	{
-		size_t val = (tbl >> (idx*bit_width)) & bit_mask<T>(bit_width);
-		return val;
-	}
-
 	// extract a range of bits and expand to 8 bits (by replicating
 	// MS bits - see http://www.mindcontrol.org/~hplus/graphics/expand-bits.html ;
 	// this is also the algorithm used by graphics cards when decompressing S3TC).
@@ -189,6 +179,8 @@ private:
 		}
 
 		// c2 and c3 are combinations of c0 and c1:
+		for(int i = 0; i < 4; i++)
+			c[i][A] = 255;
 		if(is_dxt1_special_combination)
 		{
 			mix_avg(c[2], c[0], c[1]);			// c2 = (c0+c1)/2
@@ -200,11 +192,18 @@ private:
 			mix_2_3(c[2], c[0], c[1]);			// c2 = 2/3*c0 + 1/3*c1
 			mix_2_3(c[3], c[1], c[0]);			// c3 = 1/3*c0 + 2/3*c1
 		}
+
+		for(int i = 0; i < 4; i++)
+			for(int j = 0; j < 4; j++)
+				palette[i][j] = (u8)c[i][j];
 	}
 
 	// the 4 color choices for each pixel (RGBA)
 	size_t c[4][4];	// c[i][RGBA_component]
 
+	// the same, as the bytes that are written
+	u8 palette[4][4];
+
 	// (DXT5 only) the 8 alpha choices
 	u8 dxt5_a_tbl[8];
 
@@ -248,17 +247,20 @@ static void s3tc_decompress_level(size_t UNUSED(level), size_t level_w, size_t l
 			S3tcBlock block(dxt, s3tc_data);
 			s3tc_data += s3tc_block_size;
 
-			size_t pixel_idx = 0;
+			u8 pixels[16][4];
+			block.Decode(pixels);
+
 			for(int y = 0; y < 4; y++)
 			{
 				// this is ugly, but advancing after x, y and block_y loops
 				// is no better.
 				u8* out = (u8*)di->out + ((block_y*4+y)*blocks_w*4 + block_x*4) * di->out_Bpp;
-				for(int x = 0; x < 4; x++)
+				if(di->out_Bpp == 4)
+					memcpy(out, pixels[y*4], 16);
+				else
 				{
-					block.WritePixel(pixel_idx, out);
-					out += di->out_Bpp;
-					pixel_idx++;
+					for(int x = 0; x < 4; x++)
+						memcpy(out + x*3, pixels[y*4+x], 3);
 				}
 			}
 		}
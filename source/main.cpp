@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -48,9 +48,12 @@ that of Atlas depending on commandline parameters.
 #include "ps/Globals.h"
 #include "ps/Hotkey.h"
 #include "ps/Loader.h"
+#include "ps/MemoryStats.h"
 #include "ps/Profile.h"
 #include "ps/Profiler2.h"
+#include "ps/Profiler2Capture.h"
 #include "ps/Pyrogenesis.h"
+#include "ps/RenderBenchmark.h"
 #include "ps/Replay.h"
 #include "ps/TouchInput.h"
 #include "ps/UserReport.h"
@@ -90,6 +93,9 @@ void kill_mainloop();
 static int g_ResizedW;
 static int g_ResizedH;
 
+// longest time (in seconds) that the game will be advanced by in a single frame
+static const double MAX_GAME_FRAME_TIME = 0.5;
+
 // main app message handler
 static InReaction MainInputHandler(const SDL_Event_* ev)
 {
@@ -289,6 +295,8 @@ static void RendererIncrementalLoad()
 
 static bool quit = false;	// break out of main loop
 
+static CRenderBenchmark* g_RenderBenchmark = NULL;
+
 static void Frame()
 {
 	g_Profiler2.RecordFrameStart();
@@ -311,10 +319,22 @@ static void Frame()
 
 	// .. new method - filtered and more smooth, but errors may accumulate
 #else
-	const float realTimeSinceLastFrame = 1.0 / g_frequencyFilter->SmoothedFrequency();
+	float realTimeSinceLastFrame = 1.0 / g_frequencyFilter->SmoothedFrequency();
 #endif
 	ENSURE(realTimeSinceLastFrame > 0.0f);
 
+	// The game's timeline follows the actual time since the last frame, so that frames
+	// stalled by an expensive simulation turn don't make the game fall behind real time
+	// (they just make the interpolated positions move further in the next frame).
+	// It's limited so that a long pause (e.g. in a debugger) doesn't cause a burst of turns.
+	static double lastFrameTime = time;
+	float gameTimeSinceLastFrame = (float)std::min(time - lastFrameTime, MAX_GAME_FRAME_TIME);
+	lastFrameTime = time;
+
+	// The benchmark must render the same frames every time, however fast they are
+	if (g_RenderBenchmark)
+		realTimeSinceLastFrame = gameTimeSinceLastFrame = CRenderBenchmark::FRAME_STEP;
+
 	// decide if update/render is necessary
 	bool need_render = !g_app_minimized;
 	bool need_update = true;
@@ -374,7 +394,7 @@ static void Frame()
 
 	if (g_Game && g_Game->IsGameStarted() && need_update)
 	{
-		g_Game->Update(realTimeSinceLastFrame);
+		g_Game->Update(gameTimeSinceLastFrame);
 
 		g_Game->GetView()->Update(float(realTimeSinceLastFrame));
 	}
@@ -403,6 +423,12 @@ static void Frame()
 
 	g_Profiler.Frame();
 
+	if (g_MemoryStatsTable)
+		g_MemoryStatsTable->Update();
+
+	if (g_RenderBenchmark && !g_RenderBenchmark->Frame())
+		kill_mainloop();
+
 	g_GameRestarted = false;
 }
 
@@ -457,6 +483,30 @@ static void RunGameOrAtlas(int argc, const char* argv[])
 	if(ran_atlas)
 		return;
 
+	// convert a replay log between the text and binary formats if requested
+	if (args.Has("replay-convert"))
+	{
+		std::string input = args.Get("replay-convert");
+		std::string output = args.Has("replay-output") ? std::string(args.Get("replay-output")) : input + ".converted";
+		if (!ConvertReplay(input, output))
+			debug_printf(L"Failed to convert replay %hs\n", input.c_str());
+
+		CXeromyces::Terminate();
+		return;
+	}
+
+	// convert a profiler capture into the Chrome trace format if requested
+	if (args.Has("profile2-convert"))
+	{
+		std::string input = args.Get("profile2-convert");
+		std::string output = args.Has("profile2-output") ? std::string(args.Get("profile2-output")) : input + ".json";
+		if (!ConvertProfile2Capture(input, output))
+			debug_printf(L"Failed to convert profiler capture %hs\n", input.c_str());
+
+		CXeromyces::Terminate();
+		return;
+	}
+
 	// run non-visual simulation replay if requested
 	if (args.Has("replay"))
 	{
@@ -468,6 +518,12 @@ static void RunGameOrAtlas(int argc, const char* argv[])
 		{
 			CReplayPlayer replay;
 			replay.Load(args.Get("replay"));
+			if (args.Has("replay-stats"))
+				replay.SetStatsOutput(args.Get("replay-stats"));
+			if (args.Has("replay-checkpoints"))
+				replay.SetCheckpointInterval(args.Get("replay-checkpoints").ToUInt());
+			if (args.Has("replay-seek"))
+				replay.SetSeekTurn(args.Get("replay-seek").ToUInt());
 			replay.Replay();
 		}
 
@@ -490,6 +546,12 @@ static void RunGameOrAtlas(int argc, const char* argv[])
 			zip = mod.Filename().ChangeExtension(L".zip");
 
 		CArchiveBuilder builder(mod, paths.Cache());
+
+		// Optionally lay out the archive in the order files are loaded by the game
+		std::vector<CStr> traces = args.GetMultiple("archivebuild-trace");
+		for (size_t i = 0; i < traces.size(); ++i)
+			builder.AddAccessTrace(traces[i]);
+
 		builder.Build(zip, args.Has("archivebuild-compress"));
 
 		CXeromyces::Terminate();
@@ -499,12 +561,19 @@ static void RunGameOrAtlas(int argc, const char* argv[])
 	const double res = timer_Resolution();
 	g_frequencyFilter = CreateFrequencyFilter(res, 30.0);
 
+	// play a cinematic path and save the frame times if requested
+	// (with -autostart, and a map that contains the path)
+	if (args.Has("benchmark"))
+		g_RenderBenchmark = new CRenderBenchmark(args.Get("benchmark").FromUTF8(),
+			args.Has("benchmark-output") ? OsPath(args.Get("benchmark-output")) : OsPath());
+
 	// run the game
 	Init(args, 0);
 	InitGraphics(args, 0);
 	MainControllerInit();
 	while(!quit)
 		Frame();
+	SAFE_DELETE(g_RenderBenchmark);
 	Shutdown(0);
 	ScriptingHost::FinalShutdown(); // this can't go in Shutdown() because that could be called multiple times per process, so stick it here instead
 	MainControllerShutdown();
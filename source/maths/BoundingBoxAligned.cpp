@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,6 +27,10 @@
 
 #include <float.h>
 
+#if HAVE_SSE
+# include <xmmintrin.h>
+#endif
+
 #include "graphics/Frustum.h"
 #include "maths/BoundingBoxOriented.h"
 #include "maths/Brush.h"
@@ -142,25 +146,72 @@ void CBoundingBoxAligned::Transform(const CMatrix3D& m, CBoundingBoxAligned& res
 {
 	ENSURE(this!=&result);
 
-	for (int i=0;i<3;++i) {
-		// handle translation
-		result[0][i]=result[1][i]=m(i,3);
-
-		// Now find the extreme points by considering the product of the
-		// min and max with each component of matrix
-		for(int j=0;j<3;j++) {
-			float a=m(i,j)*m_Data[0][j];
-			float b=m(i,j)*m_Data[1][j];
-
-			if (a<b) {
-				result[0][i]+=a;
-				result[1][i]+=b;
-			} else {
-				result[0][i]+=b;
-				result[1][i]+=a;
+	Transform(m, this, &result, 1);
+}
+
+void CBoundingBoxAligned::Transform(const CMatrix3D& m, const CBoundingBoxAligned* boxes, CBoundingBoxAligned* results, size_t count)
+{
+#if HAVE_SSE
+	// Each column of the matrix is a (padded) 4-vector, so the extreme points
+	// can be computed for all three axes at once
+	const __m128 cols[3] = {
+		_mm_loadu_ps(m._data),
+		_mm_loadu_ps(m._data + 4),
+		_mm_loadu_ps(m._data + 8)
+	};
+	const __m128 col3 = _mm_loadu_ps(m._data + 12);
+
+	for (size_t b = 0; b < count; ++b)
+	{
+		const CBoundingBoxAligned& box = boxes[b];
+		__m128 lo = col3;
+		__m128 hi = col3;
+
+		for (int j = 0; j < 3; ++j)
+		{
+			__m128 a = _mm_mul_ps(cols[j], _mm_load1_ps(&box.m_Data[0][j]));
+			__m128 c = _mm_mul_ps(cols[j], _mm_load1_ps(&box.m_Data[1][j]));
+			// (The argument order makes NaNs and signed zeros come out
+			// the same as in the scalar version)
+			lo = _mm_add_ps(lo, _mm_min_ps(a, c));
+			hi = _mm_add_ps(hi, _mm_max_ps(c, a));
+		}
+
+		// Store only X,Y,Z of each corner
+		float* dst = &results[b].m_Data[0].X;
+		_mm_storel_pi((__m64*)dst, lo);
+		_mm_store_ss(dst + 2, _mm_movehl_ps(lo, lo));
+		dst = &results[b].m_Data[1].X;
+		_mm_storel_pi((__m64*)dst, hi);
+		_mm_store_ss(dst + 2, _mm_movehl_ps(hi, hi));
+	}
+#else
+	for (size_t b = 0; b < count; ++b)
+	{
+		const CBoundingBoxAligned& box = boxes[b];
+		CBoundingBoxAligned& result = results[b];
+
+		for (int i=0;i<3;++i) {
+			// handle translation
+			result[0][i]=result[1][i]=m(i,3);
+
+			// Now find the extreme points by considering the product of the
+			// min and max with each component of matrix
+			for(int j=0;j<3;j++) {
+				float a=m(i,j)*box.m_Data[0][j];
+				float c=m(i,j)*box.m_Data[1][j];
+
+				if (a<c) {
+					result[0][i]+=a;
+					result[1][i]+=c;
+				} else {
+					result[0][i]+=c;
+					result[1][i]+=a;
+				}
 			}
 		}
 	}
+#endif
 }
 
 void CBoundingBoxAligned::Transform(const CMatrix3D& transform, CBoundingBoxOriented& result) const
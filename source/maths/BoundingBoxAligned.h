@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -48,6 +48,12 @@ public:
 	 */
 	void Transform(const CMatrix3D& m, CBoundingBoxAligned& result) const;
 
+	/**
+	 * Equivalent to boxes[i].Transform(m, results[i]) for each of the @p count boxes,
+	 * but faster (using SSE where available). @p boxes and @p results must not overlap.
+	 */
+	static void Transform(const CMatrix3D& m, const CBoundingBoxAligned* boxes, CBoundingBoxAligned* results, size_t count);
+
 	/**
 	 * Transform these bounds using the matrix @p transform, and write out the result as an oriented (i.e. non-axis-aligned) box.
 	 * The difference with @ref Transform(const CMatrix3D&, CBoundingBoxAligned&) is that that method is equivalent to first 
@@ -0,0 +1,146 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "FixedVector2D.h"
+
+#if HAVE_SSE2
+# include <emmintrin.h>
+
+// SSE2 only has unsigned 32x32->64-bit multiplication, and no 64-bit
+// comparisons or arithmetic shifts, so these emulate the i64 operations that
+// the scalar code uses (with identical results, including wrapping).
+
+// Returns the i64 products of the signed 32-bit values in elements 0 and 2
+static inline __m128i MulSigned(__m128i a, __m128i b)
+{
+	__m128i product = _mm_mul_epu32(a, b);
+	// a*b = ua*ub - 2^32*((a < 0 ? ub : 0) + (b < 0 ? ua : 0)) (mod 2^64)
+	__m128i correction = _mm_add_epi32(
+		_mm_and_si128(_mm_srai_epi32(a, 31), b),
+		_mm_and_si128(_mm_srai_epi32(b, 31), a));
+	return _mm_sub_epi64(product, _mm_slli_epi64(correction, 32));
+}
+
+// Arithmetic shift right of each i64 by fixed::fract_bits
+static inline __m128i ShiftRightFract(__m128i v)
+{
+	__m128i sign = _mm_shuffle_epi32(_mm_srai_epi32(v, 31), _MM_SHUFFLE(3, 3, 1, 1));
+	return _mm_or_si128(_mm_srli_epi64(v, fixed::fract_bits), _mm_slli_epi64(sign, 64 - fixed::fract_bits));
+}
+
+// Returns all ones in each 64-bit element where a > b (as u64s), else zero
+static inline __m128i CompareGreaterUnsigned(__m128i a, __m128i b)
+{
+	const __m128i bias = _mm_set1_epi32((int)0x80000000);
+	__m128i gt = _mm_cmpgt_epi32(_mm_xor_si128(a, bias), _mm_xor_si128(b, bias));
+	__m128i eq = _mm_cmpeq_epi32(a, b);
+	__m128i gtHigh = _mm_shuffle_epi32(gt, _MM_SHUFFLE(3, 3, 1, 1));
+	__m128i gtLow = _mm_shuffle_epi32(gt, _MM_SHUFFLE(2, 2, 0, 0));
+	__m128i eqHigh = _mm_shuffle_epi32(eq, _MM_SHUFFLE(3, 3, 1, 1));
+	return _mm_or_si128(gtHigh, _mm_and_si128(eqHigh, gtLow));
+}
+
+// Returns the squared lengths (as u64s) of the two vectors stored as
+// [x0, y0, x1, y1]. abs(i32) always fits in a u32, so unsigned
+// multiplication of the absolute values gives the correct squares.
+static inline __m128i LengthSquared(__m128i v)
+{
+	__m128i sign = _mm_srai_epi32(v, 31);
+	__m128i abs = _mm_sub_epi32(_mm_xor_si128(v, sign), sign);
+	__m128i xx = _mm_mul_epu32(abs, abs);
+	__m128i y = _mm_srli_epi64(abs, 32);
+	__m128i yy = _mm_mul_epu32(y, y);
+	return _mm_add_epi64(xx, yy);
+}
+
+#endif // HAVE_SSE2
+
+void CFixedVector2D::CompareLengths(const CFixedVector2D* vectors, size_t count, fixed cmp, int* results)
+{
+	size_t i = 0;
+
+#if HAVE_SSE2
+	i64 c = (i64)cmp.GetInternalValue();
+	u64 cc = (u64)(c * c);
+	const __m128i c2 = _mm_set_epi32((int)(cc >> 32), (int)cc, (int)(cc >> 32), (int)cc);
+
+	for (; i+2 <= count; i += 2)
+	{
+		__m128i d2 = LengthSquared(_mm_loadu_si128((const __m128i*)&vectors[i]));
+
+		// (gt ? -1 : 0) - (lt ? -1 : 0) gives -1, 0, +1 in the low half of each element
+		__m128i result = _mm_sub_epi32(CompareGreaterUnsigned(c2, d2), CompareGreaterUnsigned(d2, c2));
+		results[i] = _mm_cvtsi128_si32(result);
+		results[i+1] = _mm_cvtsi128_si32(_mm_shuffle_epi32(result, _MM_SHUFFLE(2, 2, 2, 2)));
+	}
+#endif
+
+	for (; i < count; ++i)
+		results[i] = vectors[i].CompareLength(cmp);
+}
+
+void CFixedVector2D::Dots(const CFixedVector2D* a, const CFixedVector2D* b, size_t count, fixed* results)
+{
+	size_t i = 0;
+
+#if HAVE_SSE2 && !defined(USE_FIXED_OVERFLOW_CHECKS)
+	for (; i+2 <= count; i += 2)
+	{
+		__m128i va = _mm_loadu_si128((const __m128i*)&a[i]);
+		__m128i vb = _mm_loadu_si128((const __m128i*)&b[i]);
+		__m128i xx = MulSigned(va, vb);
+		__m128i yy = MulSigned(_mm_srli_epi64(va, 32), _mm_srli_epi64(vb, 32));
+		__m128i sum = ShiftRightFract(_mm_add_epi64(xx, yy));
+
+		// Truncate to i32
+		results[i].SetInternalValue(_mm_cvtsi128_si32(sum));
+		results[i+1].SetInternalValue(_mm_cvtsi128_si32(_mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 2, 2, 2))));
+	}
+#endif
+
+	for (; i < count; ++i)
+		results[i] = a[i].Dot(b[i]);
+}
+
+void CFixedVector2D::Lerps(const CFixedVector2D* from, const CFixedVector2D* to, size_t count, fixed t, CFixedVector2D* results)
+{
+	size_t i = 0;
+
+#if HAVE_SSE2 && !defined(USE_FIXED_OVERFLOW_CHECKS)
+	const __m128i vt = _mm_set1_epi32(t.GetInternalValue());
+	const __m128i lowMask = _mm_set_epi32(0, -1, 0, -1);
+
+	for (; i+2 <= count; i += 2)
+	{
+		__m128i vfrom = _mm_loadu_si128((const __m128i*)&from[i]);
+		__m128i delta = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)&to[i]), vfrom);
+
+		// Multiply the X components (elements 0, 2) and Y components (1, 3)
+		// separately, then put the truncated i32 results back together
+		__m128i x = ShiftRightFract(MulSigned(delta, vt));
+		__m128i y = ShiftRightFract(MulSigned(_mm_srli_epi64(delta, 32), vt));
+		__m128i product = _mm_or_si128(_mm_and_si128(x, lowMask), _mm_slli_epi64(y, 32));
+
+		_mm_storeu_si128((__m128i*)&results[i], _mm_add_epi32(vfrom, product));
+	}
+#endif
+
+	for (; i < count; ++i)
+		results[i] = from[i].Lerp(to[i], t);
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -192,7 +192,7 @@ public:
 	/**
 	 * Compute the dot product of this vector with another.
 	 */
-	fixed Dot(const CFixedVector2D& v)
+	fixed Dot(const CFixedVector2D& v) const
 	{
 		i64 x = (i64)X.GetInternalValue() * (i64)v.X.GetInternalValue();
 		i64 y = (i64)Y.GetInternalValue() * (i64)v.Y.GetInternalValue();
@@ -206,6 +206,14 @@ public:
 		return ret;
 	}
 
+	/**
+	 * Linear interpolation: returns this + (to - this)*t.
+	 */
+	CFixedVector2D Lerp(const CFixedVector2D& to, fixed t) const
+	{
+		return *this + (to - *this).Multiply(t);
+	}
+
 	CFixedVector2D Perpendicular()
 	{
 		return CFixedVector2D(Y, -X);
@@ -220,6 +228,18 @@ public:
 		sincos_approx(angle, s, c);
 		return CFixedVector2D(X.Multiply(c) + Y.Multiply(s), Y.Multiply(c) - X.Multiply(s));
 	}
+
+	/**
+	 * Batch versions of CompareLength, Dot and Lerp, for @p count vectors at
+	 * once. They use SSE2 where available, but always give exactly the same
+	 * results as calling the single-vector functions on each element in turn
+	 * (so they're safe to use in the simulation).
+	 * When the overflow checks are enabled, Dots and Lerps just call the
+	 * single-vector functions, so the checks still apply.
+	 */
+	static void CompareLengths(const CFixedVector2D* vectors, size_t count, fixed cmp, int* results);
+	static void Dots(const CFixedVector2D* a, const CFixedVector2D* b, size_t count, fixed* results);
+	static void Lerps(const CFixedVector2D* from, const CFixedVector2D* to, size_t count, fixed t, CFixedVector2D* results);
 };
 
 #endif // INCLUDED_FIXED_VECTOR2D
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -26,6 +26,10 @@
 #include "Quaternion.h"
 #include "Vector4D.h"
 
+#if HAVE_SSE
+# include <xmmintrin.h>
+#endif
+
 //Sets the identity matrix
 void CMatrix3D::SetIdentity ()
 {
@@ -274,6 +278,78 @@ void CMatrix3D::RotateTransposed(const CVector3D& vector,CVector3D& result) cons
 }
 
 
+// Computes out = cols[0]*in.X + cols[1]*in.Y + cols[2]*in.Z + cols[3] for each
+// vector (in the same order as Transform etc, so the results are identical)
+static void TransformVectors(const float cols[4][4], const CVector3D* in, size_t inStride, CVector3D* out, size_t outStride, size_t count)
+{
+	const char* inData = (const char*)in;
+	char* outData = (char*)out;
+
+#if HAVE_SSE
+	const __m128 col0 = _mm_loadu_ps(cols[0]);
+	const __m128 col1 = _mm_loadu_ps(cols[1]);
+	const __m128 col2 = _mm_loadu_ps(cols[2]);
+	const __m128 col3 = _mm_loadu_ps(cols[3]);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		const CVector3D& v = *(const CVector3D*)(inData + i*inStride);
+		__m128 r = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(col0, _mm_load1_ps(&v.X)),
+			_mm_mul_ps(col1, _mm_load1_ps(&v.Y))),
+			_mm_mul_ps(col2, _mm_load1_ps(&v.Z))),
+			col3);
+
+		// Store only X,Y,Z, since the output might not be padded
+		float* dst = (float*)(outData + i*outStride);
+		_mm_storel_pi((__m64*)dst, r);
+		_mm_store_ss(dst + 2, _mm_movehl_ps(r, r));
+	}
+#else
+	for (size_t i = 0; i < count; ++i)
+	{
+		const CVector3D v = *(const CVector3D*)(inData + i*inStride);
+		CVector3D& r = *(CVector3D*)(outData + i*outStride);
+		r.X = cols[0][0]*v.X + cols[1][0]*v.Y + cols[2][0]*v.Z + cols[3][0];
+		r.Y = cols[0][1]*v.X + cols[1][1]*v.Y + cols[2][1]*v.Z + cols[3][1];
+		r.Z = cols[0][2]*v.X + cols[1][2]*v.Y + cols[2][2]*v.Z + cols[3][2];
+	}
+#endif
+}
+
+void CMatrix3D::TransformPoints(const CVector3D* in, size_t inStride, CVector3D* out, size_t outStride, size_t count) const
+{
+	const float cols[4][4] = {
+		{ _11, _21, _31, 0.0f },
+		{ _12, _22, _32, 0.0f },
+		{ _13, _23, _33, 0.0f },
+		{ _14, _24, _34, 0.0f }
+	};
+	TransformVectors(cols, in, inStride, out, outStride, count);
+}
+
+void CMatrix3D::RotateVectors(const CVector3D* in, size_t inStride, CVector3D* out, size_t outStride, size_t count) const
+{
+	const float cols[4][4] = {
+		{ _11, _21, _31, 0.0f },
+		{ _12, _22, _32, 0.0f },
+		{ _13, _23, _33, 0.0f },
+		{ 0.0f, 0.0f, 0.0f, 0.0f }
+	};
+	TransformVectors(cols, in, inStride, out, outStride, count);
+}
+
+void CMatrix3D::RotateTransposedVectors(const CVector3D* in, size_t inStride, CVector3D* out, size_t outStride, size_t count) const
+{
+	const float cols[4][4] = {
+		{ _11, _12, _13, 0.0f },
+		{ _21, _22, _23, 0.0f },
+		{ _31, _32, _33, 0.0f },
+		{ 0.0f, 0.0f, 0.0f, 0.0f }
+	};
+	TransformVectors(cols, in, inStride, out, outStride, count);
+}
+
 void CMatrix3D::GetInverse(CMatrix3D& dst) const
 {
 	float tmp[12];	// temp array for pairs 
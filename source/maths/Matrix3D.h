@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -317,6 +317,19 @@ public:
 	// rotate a vector by the transpose of this matrix
 	void RotateTransposed(const CVector3D& vector,CVector3D& result) const;
 	CVector3D RotateTransposed(const CVector3D& vector) const;
+
+	// batch versions of Transform, Rotate and RotateTransposed, for count vectors
+	// at once (using SSE where available). The strides are the distances in bytes
+	// between consecutive vectors, so they can work directly on interleaved
+	// vertex arrays; the input and output may be the same array.
+	void TransformPoints(const CVector3D* in, size_t inStride, CVector3D* out, size_t outStride, size_t count) const;
+	void RotateVectors(const CVector3D* in, size_t inStride, CVector3D* out, size_t outStride, size_t count) const;
+	void RotateTransposedVectors(const CVector3D* in, size_t inStride, CVector3D* out, size_t outStride, size_t count) const;
+
+	void TransformPoints(const CVector3D* in, CVector3D* out, size_t count) const
+	{
+		TransformPoints(in, sizeof(CVector3D), out, sizeof(CVector3D), count);
+	}
 };
 
 #endif
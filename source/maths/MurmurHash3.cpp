@@ -0,0 +1,156 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+// Based on MurmurHash3.cpp by Austin Appleby:
+//   "MurmurHash3 was written by Austin Appleby, and is placed in the public
+//   domain. The author hereby disclaims copyright to this source code."
+
+#include "MurmurHash3.h"
+
+// Use macro rather than inline function for significantly better debug-mode performance
+#define ROTL64(x, y) (((x) << (y)) | ((x) >> (64 - (y))))
+
+static const u64 C1 = 0x87c37b91114253d5ull;
+static const u64 C2 = 0x4cf5ad432745937full;
+
+static inline u64 fmix64(u64 k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdull;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ull;
+	k ^= k >> 33;
+	return k;
+}
+
+MurmurHash3::MurmurHash3()
+{
+	InitState();
+}
+
+void MurmurHash3::InitState()
+{
+	m_H1 = 0;
+	m_H2 = 0;
+	m_BufLen = 0;
+	m_InputLen = 0;
+	memset(m_Buf, 0xcc, sizeof(m_Buf));
+}
+
+void MurmurHash3::UpdateRest(const u8* data, size_t len)
+{
+	const size_t CHUNK_SIZE = sizeof(m_Buf);
+
+	// Add as much data as possible to the buffer
+	size_t n = CHUNK_SIZE - m_BufLen;
+	memcpy(m_Buf + m_BufLen, data, n);
+	data += n;
+	len -= n;
+
+	// Flush the (now full) buffer
+	Transform(m_Buf, CHUNK_SIZE / 16);
+
+	// Process whole chunks of the input
+	if (len >= CHUNK_SIZE)
+	{
+		size_t numBlocks = (len / CHUNK_SIZE) * (CHUNK_SIZE / 16);
+		Transform(data, numBlocks);
+		data += numBlocks * 16;
+		len -= numBlocks * 16;
+	}
+
+	// Add the remainder to the buffer
+	memcpy(m_Buf, data, len);
+	m_BufLen = len;
+}
+
+void MurmurHash3::Transform(const u8* in, size_t numBlocks)
+{
+	u64 h1 = m_H1;
+	u64 h2 = m_H2;
+
+	for (size_t i = 0; i < numBlocks; ++i)
+	{
+		u64 k1, k2;
+		memcpy(&k1, in + i*16, 8); // assumes little-endian; ignores alignment
+		memcpy(&k2, in + i*16 + 8, 8);
+
+		k1 *= C1; k1 = ROTL64(k1, 31); k1 *= C2; h1 ^= k1;
+
+		h1 = ROTL64(h1, 27); h1 += h2; h1 = h1*5 + 0x52dce729;
+
+		k2 *= C2; k2 = ROTL64(k2, 33); k2 *= C1; h2 ^= k2;
+
+		h2 = ROTL64(h2, 31); h2 += h1; h2 = h2*5 + 0x38495ab5;
+	}
+
+	m_H1 = h1;
+	m_H2 = h2;
+}
+
+void MurmurHash3::Final(u8* digest)
+{
+	// Process any remaining whole blocks
+	size_t numBlocks = m_BufLen / 16;
+	Transform(m_Buf, numBlocks);
+
+	// Mix in the tail of the input
+	const u8* tail = m_Buf + numBlocks*16;
+	size_t tailLen = m_BufLen % 16;
+
+	u64 h1 = m_H1;
+	u64 h2 = m_H2;
+
+	u64 k1 = 0;
+	u64 k2 = 0;
+
+	for (size_t i = tailLen; i > 8; --i)
+		k2 ^= (u64)tail[i-1] << (8*(i-9));
+	if (tailLen > 8)
+	{
+		k2 *= C2; k2 = ROTL64(k2, 33); k2 *= C1; h2 ^= k2;
+	}
+
+	for (size_t i = std::min(tailLen, (size_t)8); i > 0; --i)
+		k1 ^= (u64)tail[i-1] << (8*(i-1));
+	if (tailLen > 0)
+	{
+		k1 *= C1; k1 = ROTL64(k1, 31); k1 *= C2; h1 ^= k1;
+	}
+
+	// Finalization
+	h1 ^= m_InputLen;
+	h2 ^= m_InputLen;
+
+	h1 += h2;
+	h2 += h1;
+
+	h1 = fmix64(h1);
+	h2 = fmix64(h2);
+
+	h1 += h2;
+	h2 += h1;
+
+	// Return the digest (assumes little-endian)
+	memcpy(digest, &h1, 8);
+	memcpy(digest + 8, &h2, 8);
+
+	// Reset
+	InitState();
+}
@@ -0,0 +1,68 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_MURMURHASH3
+#define INCLUDED_MURMURHASH3
+
+#include <cstring>
+
+/**
+ * MurmurHash3 (the x64 128-bit variant, with seed 0). This is a fast non-cryptographic
+ * hash, so it must not be used for anything that requires security, but it gives
+ * a good distribution and detects accidental changes as well as MD5 does.
+ * The data can be given in pieces, with the same result as hashing it all at once.
+ */
+class MurmurHash3
+{
+public:
+	static const size_t DIGESTSIZE = 16;
+
+	MurmurHash3();
+
+	void Update(const u8* data, size_t len)
+	{
+		// (Defined inline for efficiency in the common fixed-length fits-in-buffer case)
+
+		const size_t CHUNK_SIZE = sizeof(m_Buf);
+
+		m_InputLen += len;
+
+		// If we have enough space in m_Buf and won't flush, simply append the input
+		if (m_BufLen + len < CHUNK_SIZE)
+		{
+			memcpy(m_Buf + m_BufLen, data, len);
+			m_BufLen += len;
+			return;
+		}
+
+		// Fall back to non-inline function if we have to do more work
+		UpdateRest(data, len);
+	}
+
+	void Final(u8* digest);
+
+private:
+	void InitState();
+	void UpdateRest(const u8* data, size_t len);
+	void Transform(const u8* in, size_t numBlocks);
+	u64 m_H1, m_H2; // internal state
+	u8 m_Buf[64]; // buffered input bytes (a whole number of 16-byte blocks)
+	size_t m_BufLen; // bytes in m_Buf that are valid
+	u64 m_InputLen; // bytes
+};
+
+#endif // INCLUDED_MURMURHASH3
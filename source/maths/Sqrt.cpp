@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,30 +19,24 @@
 
 #include "Sqrt.h"
 
-// Based on http://freaknet.org/martin/tape/gos/misc/personal/msc/sqrt/sqrt.html
+#include <cmath>
+
 u32 isqrt64(u64 n)
 {
-	u64 op = n;
-	u64 res = 0;
-	u64 one = (u64)1 << 62; // highest power of four <= than the argument
+	// Start with the hardware floating-point square root, which is much faster
+	// than computing it bit by bit. Converting n to double loses precision (and
+	// sqrt might not be correctly rounded with some compilers/settings), so the
+	// estimate may be slightly off; the integer corrections afterwards make
+	// the result exact, and therefore identical on every platform.
+	u64 r = (u64)sqrt((double)n);
+	const u64 max = 0xFFFFFFFFu;
+	if (r > max)
+		r = max;
 
-	while (one > op)
-		one >>= 2;
+	while (r*r > n)
+		--r;
+	while (r < max && (r+1)*(r+1) <= n)
+		++r;
 
-	while (one != 0)
-	{
-		if (op >= res + one)
-		{
-			op -= (res + one);
-			res += (one << 1);
-		}
-		res >>= 1;
-		one >>= 2;
-	}
-	return (u32)res;
+	return (u32)r;
 }
-
-// TODO: This should be equivalent to (u32)sqrt((double)n), and in practice
-// that seems to be true for all input, so do we actually need this integer-only
-// implementation? i.e. are there any platforms / compiler settings where
-// sqrt(double) won't give the correct answer? and is sqrt(double) faster?
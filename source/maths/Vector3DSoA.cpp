@@ -0,0 +1,72 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "Vector3DSoA.h"
+
+#include "lib/sysdep/rtl.h"
+
+CVector3DSoA::CVector3DSoA() :
+	m_X(NULL), m_Y(NULL), m_Z(NULL), m_Size(0), m_Capacity(0)
+{
+}
+
+CVector3DSoA::~CVector3DSoA()
+{
+	rtl_FreeAligned(m_X);
+}
+
+void CVector3DSoA::Resize(size_t size)
+{
+	const size_t oldPadded = GetPaddedSize();
+	const size_t padded = (size + 3) & ~(size_t)3;
+
+	if (padded > m_Capacity)
+	{
+		// Grow geometrically, so repeated Resizes are amortised O(1)
+		const size_t capacity = std::max(padded, m_Capacity*2);
+
+		// All three components go in one allocation
+		float* data = (float*)rtl_AllocateAligned(3*capacity*sizeof(float), 16);
+		if (!data)
+			throw std::bad_alloc();
+
+		if (m_X)
+		{
+			memcpy(data, m_X, oldPadded*sizeof(float));
+			memcpy(data + capacity, m_Y, oldPadded*sizeof(float));
+			memcpy(data + 2*capacity, m_Z, oldPadded*sizeof(float));
+			rtl_FreeAligned(m_X);
+		}
+
+		m_X = data;
+		m_Y = data + capacity;
+		m_Z = data + 2*capacity;
+		m_Capacity = capacity;
+	}
+
+	// Zero the new elements, and the padding after the last one (which might
+	// hold old values if the array was shrunk)
+	const size_t keep = std::min(m_Size, size);
+	const size_t end = std::max(padded, oldPadded);
+	memset(m_X + keep, 0, (end - keep)*sizeof(float));
+	memset(m_Y + keep, 0, (end - keep)*sizeof(float));
+	memset(m_Z + keep, 0, (end - keep)*sizeof(float));
+
+	m_Size = size;
+}
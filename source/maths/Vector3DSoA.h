@@ -0,0 +1,78 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_VECTOR3DSOA
+#define INCLUDED_VECTOR3DSOA
+
+#include "maths/Vector3D.h"
+
+/**
+ * An array of 3D vectors stored as separate arrays of X, Y and Z components
+ * ("structure of arrays"), so batch operations can process four vectors per
+ * SSE instruction.
+ * Each component array is 16-byte aligned and padded with zeros up to a
+ * multiple of 4 elements, so the last group of four can be loaded in full.
+ */
+class CVector3DSoA
+{
+	NONCOPYABLE(CVector3DSoA);
+public:
+	CVector3DSoA();
+	~CVector3DSoA();
+
+	/**
+	 * Changes the number of vectors. Existing vectors (up to the new size)
+	 * are kept; new ones are zero.
+	 */
+	void Resize(size_t size);
+
+	size_t GetSize() const { return m_Size; }
+
+	/**
+	 * Returns the size rounded up to a multiple of 4, i.e. the number of
+	 * elements that can be read from each component array.
+	 */
+	size_t GetPaddedSize() const { return (m_Size + 3) & ~(size_t)3; }
+
+	float* GetX() { return m_X; }
+	float* GetY() { return m_Y; }
+	float* GetZ() { return m_Z; }
+	const float* GetX() const { return m_X; }
+	const float* GetY() const { return m_Y; }
+	const float* GetZ() const { return m_Z; }
+
+	void Set(size_t i, const CVector3D& v)
+	{
+		m_X[i] = v.X;
+		m_Y[i] = v.Y;
+		m_Z[i] = v.Z;
+	}
+
+	CVector3D Get(size_t i) const
+	{
+		return CVector3D(m_X[i], m_Y[i], m_Z[i]);
+	}
+
+private:
+	float* m_X;
+	float* m_Y;
+	float* m_Z;
+	size_t m_Size;
+	size_t m_Capacity; // elements allocated per component, a multiple of 4
+};
+
+#endif // INCLUDED_VECTOR3DSOA
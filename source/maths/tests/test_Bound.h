@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -208,4 +208,55 @@ public:
 		TS_ASSERT(!isnan(result.m_Basis[2].X) && !isnan(result.m_Basis[2].Y) && !isnan(result.m_Basis[2].Z));
 	}
 
+	void test_aabb_transform()
+	{
+		// rotate a 4x3x3 AABB centered at (5,0,0) 90 degrees CCW around the Z axis, then translate it
+		CBoundingBoxAligned aabb(CVector3D(3, -1.5f, -1.5f), CVector3D(7, 1.5f, 1.5f));
+
+		CMatrix3D transform;
+		transform.SetZRotation(float(M_PI)/2.f);
+		transform.Translate(CVector3D(1, 2, 3));
+
+		CBoundingBoxAligned result;
+		aabb.Transform(transform, result);
+
+		TS_ASSERT_VEC_DELTA(result[0], -0.5f, 5.f, 1.5f, 1e-6f);
+		TS_ASSERT_VEC_DELTA(result[1],  2.5f, 9.f, 4.5f, 1e-6f);
+	}
+
+	void test_aabb_transform_batch()
+	{
+		CMatrix3D transform;
+		transform.SetYRotation(0.7f);
+		transform.Scale(1.f, 2.f, -3.f);
+		transform.Translate(CVector3D(10, -20, 30));
+
+		std::vector<CBoundingBoxAligned> boxes;
+		for (int i = 0; i < 9; ++i)
+			boxes.push_back(CBoundingBoxAligned(CVector3D(i-4.f, -i*0.5f, 1.f), CVector3D(i+1.f, i*0.25f, 2.f+i)));
+
+		std::vector<CBoundingBoxAligned> results(boxes.size());
+		CBoundingBoxAligned::Transform(transform, &boxes[0], &results[0], boxes.size());
+
+		// Must give exactly the same results as the straightforward scalar version
+		for (size_t i = 0; i < boxes.size(); ++i)
+		{
+			for (int k = 0; k < 2; ++k)
+			{
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					float lo = transform(axis, 3), hi = transform(axis, 3);
+					for (int j = 0; j < 3; ++j)
+					{
+						float a = transform(axis, j) * boxes[i][0][j];
+						float b = transform(axis, j) * boxes[i][1][j];
+						lo += (a < b ? a : b);
+						hi += (a < b ? b : a);
+					}
+					TS_ASSERT_EQUALS(results[i][k][axis], k == 0 ? lo : hi);
+				}
+			}
+		}
+	}
+
 };
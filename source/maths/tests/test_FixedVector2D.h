@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,6 +19,8 @@
 
 #include "maths/FixedVector2D.h"
 
+#include <boost/random/mersenne_twister.hpp>
+
 #define TS_ASSERT_VEC_EQUALS(v, x, y) \
 	TS_ASSERT_EQUALS(v.X.ToDouble(), x); \
 	TS_ASSERT_EQUALS(v.Y.ToDouble(), y);
@@ -29,6 +31,19 @@
 
 class TestFixedVector2D : public CxxTest::TestSuite
 {
+	static fixed F(i32 v)
+	{
+		fixed f;
+		f.SetInternalValue(v);
+		return f;
+	}
+
+	// Random value in [-range, range]
+	static i32 RandomValue(boost::mt19937& rng, i32 range)
+	{
+		return (i32)(rng() % ((u32)range*2 + 1)) - range;
+	}
+
 public:
 	void test_basic()
 	{
@@ -140,4 +155,109 @@ public:
 		CFixedVector2D v2 (fixed::FromInt(8), fixed::FromInt(-9));
 		TS_ASSERT_EQUALS(v1.Dot(v2).ToDouble(), 5*8 + 6*-9);
 	}
+
+	void test_Lerp()
+	{
+		CFixedVector2D v1 (fixed::FromInt(2), fixed::FromInt(-4));
+		CFixedVector2D v2 (fixed::FromInt(6), fixed::FromInt(8));
+		TS_ASSERT_VEC_EQUALS(v1.Lerp(v2, fixed::Zero()), 2, -4);
+		TS_ASSERT_VEC_EQUALS(v1.Lerp(v2, fixed::FromInt(1)), 6, 8);
+		TS_ASSERT_VEC_EQUALS(v1.Lerp(v2, fixed::FromInt(1)/4), 3, -1);
+	}
+
+	// The batch functions must give exactly the same results as the scalar
+	// ones, so check every combination of a set of edge cases, and lots of
+	// random values (with an odd count so the non-SIMD tail is covered too)
+
+	void test_CompareLengths()
+	{
+		const i32 edges[] = {
+			(i32)0x80000000, (i32)0x80000001, -0x10000, -0xb505, -0xb504, -2, -1,
+			0, 1, 2, 0xb504, 0xb505, 0xffff, 0x10000, 0x10001, 0x7ffffffe, 0x7fffffff
+		};
+		const size_t numEdges = ARRAY_SIZE(edges);
+
+		std::vector<CFixedVector2D> vectors;
+		for (size_t x = 0; x < numEdges; ++x)
+			for (size_t y = 0; y < numEdges; ++y)
+				vectors.push_back(CFixedVector2D(F(edges[x]), F(edges[y])));
+
+		boost::mt19937 rng;
+		for (size_t i = 0; i < 10001; ++i)
+			vectors.push_back(CFixedVector2D(F((i32)rng()), F((i32)rng())));
+
+		// (The edge cases include vectors whose lengths are exactly equal to
+		// those values)
+		std::vector<fixed> cmps;
+		for (size_t i = 0; i < numEdges; ++i)
+			cmps.push_back(F(edges[i]));
+		for (size_t i = 0; i < 64; ++i)
+			cmps.push_back(F((i32)rng()));
+
+		std::vector<int> results(vectors.size());
+		for (size_t c = 0; c < cmps.size(); ++c)
+		{
+			CFixedVector2D::CompareLengths(&vectors[0], vectors.size(), cmps[c], &results[0]);
+			for (size_t i = 0; i < vectors.size(); ++i)
+				TS_ASSERT_EQUALS(results[i], vectors[i].CompareLength(cmps[c]));
+		}
+	}
+
+	void test_Dots()
+	{
+		// (Limited to values whose dot products don't overflow)
+		const i32 edges[] = { -0x400000, -0x10001, -0x10000, -0xffff, -1, 0, 1, 0xffff, 0x10000, 0x10001, 0x400000 };
+		const size_t numEdges = ARRAY_SIZE(edges);
+
+		std::vector<CFixedVector2D> a, b;
+		for (size_t i = 0; i < numEdges*numEdges; ++i)
+			for (size_t j = 0; j < numEdges*numEdges; ++j)
+			{
+				a.push_back(CFixedVector2D(F(edges[i / numEdges]), F(edges[i % numEdges])));
+				b.push_back(CFixedVector2D(F(edges[j / numEdges]), F(edges[j % numEdges])));
+			}
+
+		boost::mt19937 rng;
+		for (size_t i = 0; i < 10001; ++i)
+		{
+			a.push_back(CFixedVector2D(F(RandomValue(rng, 0x400000)), F(RandomValue(rng, 0x400000))));
+			b.push_back(CFixedVector2D(F(RandomValue(rng, 0x400000)), F(RandomValue(rng, 0x400000))));
+		}
+
+		std::vector<fixed> results(a.size());
+		CFixedVector2D::Dots(&a[0], &b[0], a.size(), &results[0]);
+		for (size_t i = 0; i < a.size(); ++i)
+			TS_ASSERT_EQUALS(results[i], a[i].Dot(b[i]));
+	}
+
+	void test_Lerps()
+	{
+		// (Limited to values whose interpolations don't overflow)
+		const i32 edges[] = { -0x20000000, -0x10001, -0x10000, -0xffff, -1, 0, 1, 0xffff, 0x10000, 0x10001, 0x20000000 };
+		const size_t numEdges = ARRAY_SIZE(edges);
+
+		std::vector<CFixedVector2D> from, to;
+		for (size_t i = 0; i < numEdges*numEdges; ++i)
+			for (size_t j = 0; j < numEdges*numEdges; ++j)
+			{
+				from.push_back(CFixedVector2D(F(edges[i / numEdges]), F(edges[i % numEdges])));
+				to.push_back(CFixedVector2D(F(edges[j / numEdges]), F(edges[j % numEdges])));
+			}
+
+		boost::mt19937 rng;
+		for (size_t i = 0; i < 10001; ++i)
+		{
+			from.push_back(CFixedVector2D(F(RandomValue(rng, 0x20000000)), F(RandomValue(rng, 0x20000000))));
+			to.push_back(CFixedVector2D(F(RandomValue(rng, 0x20000000)), F(RandomValue(rng, 0x20000000))));
+		}
+
+		const i32 ts[] = { -0x10000, -0x8001, -1, 0, 1, 0x5555, 0x8000, 0xffff, 0x10000 };
+		std::vector<CFixedVector2D> results(from.size());
+		for (size_t t = 0; t < ARRAY_SIZE(ts); ++t)
+		{
+			CFixedVector2D::Lerps(&from[0], &to[0], from.size(), F(ts[t]), &results[0]);
+			for (size_t i = 0; i < from.size(); ++i)
+				TS_ASSERT_EQUALS(results[i], from[i].Lerp(to[i], F(ts[t])));
+		}
+	}
 };
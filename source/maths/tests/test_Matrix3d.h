@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -161,4 +161,47 @@ public:
 			for (int y = 0; y < 4; ++y)
 				TS_ASSERT_DELTA(a(x,y), b(x,y), 0.0002f);
 	}
+
+	void test_batch_transform()
+	{
+		CMatrix3D m;
+		srand(0);
+
+		for (int j = 0; j < 16; ++j)
+			m._data[j] = -1.0f + 2.0f*(rand()/(float)RAND_MAX);
+
+		// Interleaved with another value, like in a vertex array, to check the
+		// strides are respected and nothing next to the vectors is overwritten
+		struct Vertex { CVector3D v; float pad; };
+		const size_t count = 7;
+		Vertex in[count], out[count];
+		for (size_t i = 0; i < count; ++i)
+		{
+			in[i].v = CVector3D(rand()/(float)RAND_MAX, rand()/(float)RAND_MAX, -rand()/(float)RAND_MAX);
+			in[i].pad = out[i].pad = 123.0f;
+		}
+
+		m.TransformPoints(&in[0].v, sizeof(Vertex), &out[0].v, sizeof(Vertex), count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			TS_ASSERT_EQUALS(out[i].v, m.Transform(in[i].v));
+			TS_ASSERT_EQUALS(out[i].pad, 123.0f);
+		}
+
+		m.RotateVectors(&in[0].v, sizeof(Vertex), &out[0].v, sizeof(Vertex), count);
+		for (size_t i = 0; i < count; ++i)
+			TS_ASSERT_EQUALS(out[i].v, m.Rotate(in[i].v));
+
+		m.RotateTransposedVectors(&in[0].v, sizeof(Vertex), &out[0].v, sizeof(Vertex), count);
+		for (size_t i = 0; i < count; ++i)
+			TS_ASSERT_EQUALS(out[i].v, m.RotateTransposed(in[i].v));
+
+		// In-place, with packed vectors
+		CVector3D packed[count];
+		for (size_t i = 0; i < count; ++i)
+			packed[i] = in[i].v;
+		m.TransformPoints(packed, packed, count);
+		for (size_t i = 0; i < count; ++i)
+			TS_ASSERT_EQUALS(packed[i], m.Transform(in[i].v));
+	}
 };
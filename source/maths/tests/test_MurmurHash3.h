@@ -0,0 +1,75 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "maths/MurmurHash3.h"
+
+class TestMurmurHash3 : public CxxTest::TestSuite
+{
+public:
+	std::string decode(u8* digest)
+	{
+		char digeststr[MurmurHash3::DIGESTSIZE*2+1];
+		for (size_t i = 0; i < MurmurHash3::DIGESTSIZE; ++i)
+			sprintf_s(digeststr+2*i, 3, "%02x", (unsigned int)digest[i]);
+		return digeststr;
+	}
+
+	// Hashes the input in pieces of pieceLen bytes
+	void compare(const char* input, const char* expected, size_t pieceLen = 1000)
+	{
+		u8 digest[MurmurHash3::DIGESTSIZE];
+
+		MurmurHash3 m;
+		size_t len = strlen(input);
+		for (size_t i = 0; i < len; i += pieceLen)
+			m.Update((const u8*)input + i, std::min(pieceLen, len - i));
+		m.Final(digest);
+
+		TSM_ASSERT_STR_EQUALS(input, decode(digest), expected);
+	}
+
+	void test_reference()
+	{
+		compare("", "00000000000000000000000000000000");
+		compare("a", "897859f6655555855a890e51483ab5e6");
+		compare("The quick brown fox jumps over the lazy dog", "6c1b07bc7bbc4be347939ac4a93c437a");
+	}
+
+	void test_pieces()
+	{
+		// The result mustn't depend on how the input is split up
+		std::string a(1000, 'a');
+		compare(a.c_str(), "018fc53f1639e8989afcadb41c8f065c");
+		compare(a.c_str(), "018fc53f1639e8989afcadb41c8f065c", 1);
+		compare(a.c_str(), "018fc53f1639e8989afcadb41c8f065c", 13);
+		compare(a.c_str(), "018fc53f1639e8989afcadb41c8f065c", 64);
+	}
+
+	void test_reset()
+	{
+		// Final should reset the state, so the object can be reused
+		u8 digest[MurmurHash3::DIGESTSIZE];
+		MurmurHash3 m;
+		m.Update((const u8*)"abc", 3);
+		m.Final(digest);
+		m.Update((const u8*)"a", 1);
+		m.Final(digest);
+		TS_ASSERT_STR_EQUALS(decode(digest), "897859f6655555855a890e51483ab5e6");
+	}
+};
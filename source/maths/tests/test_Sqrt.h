@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -25,6 +25,30 @@
 
 class TestSqrt : public CxxTest::TestSuite
 {
+	// The original bit-by-bit implementation, which isqrt64 must always agree with
+	// (based on http://freaknet.org/martin/tape/gos/misc/personal/msc/sqrt/sqrt.html)
+	static u32 isqrt64_reference(u64 n)
+	{
+		u64 op = n;
+		u64 res = 0;
+		u64 one = (u64)1 << 62; // highest power of four <= than the argument
+
+		while (one > op)
+			one >>= 2;
+
+		while (one != 0)
+		{
+			if (op >= res + one)
+			{
+				op -= (res + one);
+				res += (one << 1);
+			}
+			res >>= 1;
+			one >>= 2;
+		}
+		return (u32)res;
+	}
+
 public:
 	void t(u32 n)
 	{
@@ -83,6 +107,26 @@ public:
 		{
 			u64 n = gen();
 			s(n, (u64)sqrt((double)n));
+			s(n, isqrt64_reference(n));
 		}
 	}
+
+	void test_exhaustive()
+	{
+		// Every small input
+		for (u64 n = 0; n < (1 << 20); ++n)
+			if (isqrt64(n) != isqrt64_reference(n))
+				TS_FAIL("mismatch with small n");
+
+		// Either side of every perfect square near the top of the range,
+		// and of squares spread over the whole range, where the estimate from
+		// sqrt(double) is most likely to be rounded the wrong way
+		for (u64 r = 1; r <= 0xFFFFFFFFu; r += (r < 0xFFFF0000u ? 65521 : 1))
+		{
+			u64 sq = r*r;
+			if (isqrt64(sq) != r || isqrt64(sq - 1) != r - 1 || (r < 0xFFFFFFFFu && isqrt64(sq + 2*r) != r))
+				TS_FAIL("mismatch near square");
+		}
+		s((u64)-1, 4294967295u);
+	}
 };
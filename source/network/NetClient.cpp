@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,6 +20,7 @@
 #include "NetClient.h"
 
 #include "NetMessage.h"
+#include "NetServer.h"
 #include "NetSession.h"
 #include "NetTurnManager.h"
 
@@ -28,6 +29,7 @@
 #include "ps/CConsole.h"
 #include "ps/CLogger.h"
 #include "ps/Compress.h"
+#include "ps/ConfigDB.h"
 #include "ps/CStr.h"
 #include "ps/Game.h"
 #include "ps/Loader.h"
@@ -264,21 +266,10 @@ bool CNetClient::HandleMessage(CNetMessage* message)
 		// TODO: we should support different transfer request types, instead of assuming
 		// it's always requesting the simulation state
 
-		std::stringstream stream;
-
-		LOGMESSAGERENDER(L"Serializing game at turn %u for rejoining player", m_ClientTurnManager->GetCurrentTurn());
-		u32 turn = to_le32(m_ClientTurnManager->GetCurrentTurn());
-		stream.write((char*)&turn, sizeof(turn));
-
-		bool ok = m_Game->GetSimulation2()->SerializeState(stream);
-		ENSURE(ok);
-
-		// Compress the content with zlib to save bandwidth
-		// (TODO: if this is still too large, compressing with e.g. LZMA works much better)
-		std::string compressed;
-		CompressZLib(stream.str(), compressed, true);
+		std::string state;
+		m_ClientTurnManager->GetRejoinState(state);
 
-		m_Session->GetFileTransferer().StartResponse(reqMessage->m_RequestID, compressed);
+		m_Session->GetFileTransferer().StartResponse(reqMessage->m_RequestID, state);
 
 		return true;
 	}
@@ -364,6 +355,16 @@ bool CNetClient::OnHandshakeResponse(void* context, CFsmEvent* event)
 
 	CNetClient* client = (CNetClient*)context;
 
+	CSrvHandshakeResponseMessage* message = (CSrvHandshakeResponseMessage*)event->GetParamRef();
+
+	// Hash the state the same way as all the other clients, so the server can compare them
+	if (message->m_Flags & PS_NETWORK_FLAG_FAST_STATE_HASH)
+		client->m_Game->GetSimulation2()->SetStateHashType(STATE_HASH_MURMUR3);
+	else
+		client->m_Game->GetSimulation2()->SetStateHashType(STATE_HASH_MD5);
+
+	client->m_Session->SetCompression((message->m_Flags & PS_NETWORK_FLAG_COMPRESSION) != 0);
+
 	CAuthenticateMessage authenticate;
 	authenticate.m_GUID = client->m_GUID;
 	authenticate.m_Name = client->m_UserName;
@@ -470,6 +471,17 @@ bool CNetClient::OnGameStart(void* context, CFsmEvent* event)
 	client->m_ClientTurnManager = new CNetClientTurnManager(
 			*client->m_Game->GetSimulation2(), *client, client->m_HostID, client->m_Game->GetReplayLogger());
 
+	// The server asks the first session (normally the host's own client) for the
+	// state when a player rejoins, so optionally keep a recent copy ready
+	if (g_NetServer)
+	{
+		int rejoinCheckpointInterval = 0;
+		if (CConfigDB::IsInitialised())
+			CFG_GET_USER_VAL("network.rejoincheckpointinterval", Int, rejoinCheckpointInterval);
+		if (rejoinCheckpointInterval > 0)
+			client->m_ClientTurnManager->EnableRejoinCheckpoints(rejoinCheckpointInterval);
+	}
+
 	client->m_Game->SetPlayerID(player);
 	client->m_Game->StartGame(client->m_GameAttributes, "");
 
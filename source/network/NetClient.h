@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -75,6 +75,12 @@ public:
 	 */
 	void SetUserName(const CStrW& username);
 
+	/**
+	 * Returns the GUID that identifies this client to the server
+	 * (e.g. for CNetServer::AssignPlayer).
+	 */
+	const CStr& GetGUID() const { return m_GUID; }
+
 	/**
 	 * Set up a connection to the remote networked server.
 	 * @param server IP address or host name to connect to
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,17 +20,29 @@
 #include "NetHost.h"
 
 #include "lib/external_libraries/enet.h"
+#include "lib/external_libraries/zlib.h"
 #include "network/NetMessage.h"
+#include "network/NetStats.h"
 #include "ps/CLogger.h"
 
-bool CNetHost::SendMessage(const CNetMessage* message, ENetPeer* peer, const char* peerName)
+// Size of the header of NMT_COMPRESSED messages (type, original type, original length)
+static const size_t COMPRESSED_HEADER_SIZE = 6;
+
+bool CNetHost::SendMessage(const CNetMessage* message, ENetPeer* peer, const char* peerName, bool compress)
 {
-	ENetPacket* packet = CreatePacket(message);
+	ENetPacket* packet = CreatePacket(message, compress);
 	if (!packet)
 		return false;
 
 	LOGMESSAGE(L"Net: Sending message %hs of size %lu to %hs", message->ToString().c_str(), (unsigned long)packet->dataLength, peerName);
 
+	bool ok = SendPacket(packet, peer);
+	ReleasePacket(packet);
+	return ok;
+}
+
+bool CNetHost::SendPacket(ENetPacket* packet, ENetPeer* peer)
+{
 	// Let ENet send the message to peer
 	if (enet_peer_send(peer, DEFAULT_CHANNEL, packet) < 0)
 	{
@@ -38,6 +50,18 @@ bool CNetHost::SendMessage(const CNetMessage* message, ENetPeer* peer, const cha
 		return false;
 	}
 
+	// Count the message against its original type, if it was compressed
+	const u8* data = packet->data;
+	int type;
+	Deserialize_int_1(data, type);
+	size_t uncompressedSize = packet->dataLength;
+	if (type == NMT_COMPRESSED && packet->dataLength >= COMPRESSED_HEADER_SIZE)
+	{
+		Deserialize_int_1(data, type);
+		Deserialize_int_4(data, uncompressedSize);
+	}
+	CNetMessageStatsTable::RecordSent(type, packet->dataLength, uncompressedSize);
+
 	// Don't call enet_host_flush now - let it queue up all the packets
 	// and send them during the next frame
 	//
@@ -46,23 +70,63 @@ bool CNetHost::SendMessage(const CNetMessage* message, ENetPeer* peer, const cha
 	return true;
 }
 
-ENetPacket* CNetHost::CreatePacket(const CNetMessage* message)
+void CNetHost::ReleasePacket(ENetPacket* packet)
+{
+	// ENet frees the packet once every peer it was queued for has sent it,
+	// so we only need to free it if it was never queued
+	if (packet->referenceCount == 0)
+		enet_packet_destroy(packet);
+}
+
+ENetPacket* CNetHost::CreatePacket(const CNetMessage* message, bool compress)
 {
 	size_t size = message->GetSerializedLength();
 
 	ENSURE(size); // else we'll fail when accessing the 0th element
 
-	// Adjust buffer for message
-	std::vector<u8> buffer;
-	buffer.resize(size);
-
-	// Save message to internal buffer
-	message->Serialize(&buffer[0]);
+	if (compress && size >= COMPRESSION_THRESHOLD)
+	{
+		std::vector<u8> buffer(size);
+		u8* end = message->Serialize(&buffer[0]);
+		ENSURE(end == &buffer[0] + size);
+
+		uLongf compressedSize = compressBound(size);
+		ENetPacket* packet = enet_packet_create(NULL, COMPRESSED_HEADER_SIZE + compressedSize, ENET_PACKET_FLAG_RELIABLE);
+		if (!packet)
+		{
+			LOGERROR(L"Net: Failed to construct packet");
+			return NULL;
+		}
+
+		u8* pos = packet->data;
+		Serialize_int_1(pos, NMT_COMPRESSED);
+		Serialize_int_1(pos, message->GetType());
+		Serialize_int_4(pos, size);
+		int ret = compress2(pos, &compressedSize, &buffer[0], size, Z_BEST_SPEED);
+		if (ret == Z_OK && COMPRESSED_HEADER_SIZE + compressedSize < size)
+		{
+			enet_packet_resize(packet, COMPRESSED_HEADER_SIZE + compressedSize);
+			return packet;
+		}
+
+		// Compression didn't help, so send the original message instead
+		// (the packet is already at least as large as that)
+		enet_packet_resize(packet, size);
+		memcpy(packet->data, &buffer[0], size);
+		return packet;
+	}
 
-	// Create a reliable packet
-	ENetPacket* packet = enet_packet_create(&buffer[0], size, ENET_PACKET_FLAG_RELIABLE);
+	// Create a reliable packet with uninitialised data, and serialize
+	// the message directly into it
+	ENetPacket* packet = enet_packet_create(NULL, size, ENET_PACKET_FLAG_RELIABLE);
 	if (!packet)
+	{
 		LOGERROR(L"Net: Failed to construct packet");
+		return NULL;
+	}
+
+	u8* end = message->Serialize(packet->data);
+	ENSURE(end == packet->data + size);
 
 	return packet;
 }
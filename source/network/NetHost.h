@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -67,20 +67,50 @@ class CNetHost
 public:
 	static const int DEFAULT_CHANNEL = 0;
 
+	/**
+	 * When compression is enabled, messages at least this large (when serialized)
+	 * are compressed, if that makes them smaller.
+	 */
+	static const size_t COMPRESSION_THRESHOLD = 256;
+
 	/**
 	 * Transmit a message to the given peer.
 	 * @param message message to send
 	 * @param peer peer to send to
 	 * @param peerName name of peer for debug logs
+	 * @param compress whether the message may be compressed (see CreatePacket)
+	 * @return true on success, false on failure
+	 */
+	static bool SendMessage(const CNetMessage* message, ENetPeer* peer, const char* peerName, bool compress = false);
+
+	/**
+	 * Transmit a packet (from CreatePacket) to the given peer.
+	 * The same packet can be sent to any number of peers without being copied.
+	 * Call ReleasePacket once it has been sent to all of them.
 	 * @return true on success, false on failure
 	 */
-	static bool SendMessage(const CNetMessage* message, ENetPeer* peer, const char* peerName);
+	static bool SendPacket(ENetPacket* packet, ENetPeer* peer);
+
+	/**
+	 * Free the packet if it hasn't been successfully sent to any peer
+	 * (else ENet will free it once it has finished sending).
+	 */
+	static void ReleasePacket(ENetPacket* packet);
 
 	/**
-	 * Construct an ENet packet by serialising the given message.
+	 * Construct an ENet packet by serialising the given message
+	 * (directly into the packet's data, without an intermediate copy).
+	 *
+	 * If @p compress, and the message is at least COMPRESSION_THRESHOLD bytes,
+	 * the packet will instead contain an NMT_COMPRESSED message: a u8 NMT_COMPRESSED,
+	 * the u8 type and u32 length of the original message, then the zlib-compressed
+	 * original message. (CNetMessageFactory::CreateMessage decompresses these.)
+	 * This must only be used once the peer has agreed to accept compressed packets
+	 * (see PS_NETWORK_FLAG_COMPRESSION).
+	 *
 	 * @return NULL on failure
 	 */
-	static ENetPacket* CreatePacket(const CNetMessage* message);
+	static ENetPacket* CreatePacket(const CNetMessage* message, bool compress = false);
 
 	/**
 	 * Initialize ENet.
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,6 +18,9 @@
 #include "precompiled.h"
 #include "NetMessage.h"
 
+#include "NetStats.h"
+
+#include "lib/external_libraries/zlib.h"
 #include "ps/CLogger.h"
 
 #include "ps/Game.h"
@@ -94,6 +97,52 @@ CStr CNetMessage::ToString() const
 CNetMessage* CNetMessageFactory::CreateMessage(const void* pData,
 											   size_t dataSize,
 											   ScriptInterface& scriptInterface)
+{
+	const u8* data = (const u8*)pData;
+	if (dataSize >= 1 && data[0] == NMT_COMPRESSED)
+	{
+		// Decompress the original message (see CNetHost::CreatePacket) and use that
+		// instead. Its header has a 16-bit size, so it can't be larger than that
+		if (dataSize < 6)
+		{
+			LOGERROR(L"CNetMessageFactory::CreateMessage(): Corrupt compressed packet (smaller than header)");
+			return NULL;
+		}
+
+		const u8* pos = data + 1;
+		int type;
+		size_t size;
+		Deserialize_int_1(pos, type);
+		Deserialize_int_4(pos, size);
+		if (size < 3 || size > 0xFFFF)
+		{
+			LOGERROR(L"CNetMessageFactory::CreateMessage(): Corrupt compressed packet (invalid size %lu)", (unsigned long)size);
+			return NULL;
+		}
+
+		std::vector<u8> buffer(size);
+		uLongf destLen = size;
+		int ret = uncompress(&buffer[0], &destLen, pos, dataSize - 6);
+		if (ret != Z_OK || destLen != size || buffer[0] != type)
+		{
+			LOGERROR(L"CNetMessageFactory::CreateMessage(): Failed to decompress packet (%d)", ret);
+			return NULL;
+		}
+
+		CNetMessageStatsTable::RecordReceived(type, dataSize);
+
+		return CreateMessageUncompressed(&buffer[0], size, scriptInterface);
+	}
+
+	if (dataSize >= 1)
+		CNetMessageStatsTable::RecordReceived(data[0], dataSize);
+
+	return CreateMessageUncompressed(pData, dataSize, scriptInterface);
+}
+
+CNetMessage* CNetMessageFactory::CreateMessageUncompressed(const void* pData,
+											   size_t dataSize,
+											   ScriptInterface& scriptInterface)
 {
 	CNetMessage* pNewMessage = NULL;
 	CNetMessage header;
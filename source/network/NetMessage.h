@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -104,6 +104,9 @@ public:
 	 * @return							The new message created
 	 */
 	static CNetMessage* CreateMessage(const void* pData, size_t dataSize, ScriptInterface& scriptInterface);
+
+private:
+	static CNetMessage* CreateMessageUncompressed(const void* pData, size_t dataSize, ScriptInterface& scriptInterface);
 };
 
 /**
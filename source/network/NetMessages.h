@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -28,9 +28,13 @@
 
 #define PS_PROTOCOL_MAGIC				0x5073013f		// 'P', 's', 0x01, '?'
 #define PS_PROTOCOL_MAGIC_RESPONSE		0x50630121		// 'P', 'c', 0x01, '!'
-#define PS_PROTOCOL_VERSION				0x01010005		// Arbitrary protocol
+#define PS_PROTOCOL_VERSION				0x01010009		// Arbitrary protocol
 #define PS_DEFAULT_PORT					0x5073			// 'P', 's'
 
+// Flags for CSrvHandshakeResponseMessage::m_Flags
+#define PS_NETWORK_FLAG_FAST_STATE_HASH	0x1		// clients compute state hashes with STATE_HASH_MURMUR3 instead of STATE_HASH_MD5
+#define PS_NETWORK_FLAG_COMPRESSION		0x2		// the server sends and accepts NMT_COMPRESSED packets (see CNetHost::CreatePacket)
+
 // Defines the list of message types. The order of the list must not change.
 // The message types having a negative value are used internally and not sent
 // over the network. The message types used for network communication have 
@@ -62,6 +66,7 @@ enum NetMessageType
 	NMT_SYNC_CHECK,	// OOS-detection hash checking
 	NMT_SYNC_ERROR,	// OOS-detection error
 	NMT_SIMULATION_COMMAND,
+	NMT_COMPRESSED,	// Wrapper for another message, compressed with zlib
 	NMT_LAST				// Last message in the list
 };
 
@@ -163,6 +168,7 @@ END_NMT_CLASS()
 START_NMT_CLASS_(SyncCheck, NMT_SYNC_CHECK)
 	NMT_FIELD_INT(m_Turn, u32, 4)
 	NMT_FIELD(CStr, m_Hash)
+	NMT_FIELD_INT(m_SimTime, u32, 2) // msecs spent simulating the turn, for adaptive turn lengths
 END_NMT_CLASS()
 
 START_NMT_CLASS_(SyncError, NMT_SYNC_ERROR)
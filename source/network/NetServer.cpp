@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -26,7 +26,10 @@
 #include "NetTurnManager.h"
 
 #include "lib/external_libraries/enet.h"
+#include "lib/timer.h"
+#include "maths/MathUtil.h"
 #include "ps/CLogger.h"
+#include "ps/ConfigDB.h"
 #include "scriptinterface/ScriptInterface.h"
 #include "simulation2/Simulation2.h"
 
@@ -36,6 +39,13 @@
 
 static const int CHANNEL_COUNT = 1;
 
+// Maximum number of connections in addition to MAX_CLIENTS, for observers
+static const int DEFAULT_MAX_OBSERVERS = 0;
+
+// Bounds for adaptive turn lengths, in msecs
+static const int DEFAULT_MIN_TURN_LENGTH = 100;
+static const int DEFAULT_MAX_TURN_LENGTH = 1000;
+
 /**
  * enet_host_service timeout (msecs).
  * Smaller numbers may hurt performance; larger numbers will
@@ -112,7 +122,7 @@ CNetServerWorker::CNetServerWorker(int autostartPlayers) :
 	m_AutostartPlayers(autostartPlayers),
 	m_Shutdown(false),
 	m_ScriptInterface(NULL),
-	m_NextHostID(1), m_Host(NULL), m_Stats(NULL)
+	m_NextHostID(1), m_Host(NULL), m_Stats(NULL), m_ServiceWaitTime(0.0)
 {
 	m_State = SERVER_STATE_UNCONNECTED;
 
@@ -120,6 +130,38 @@ CNetServerWorker::CNetServerWorker(int autostartPlayers) :
 
 	m_ServerName = DEFAULT_SERVER_NAME;
 	m_WelcomeMessage = DEFAULT_WELCOME_MESSAGE;
+
+	// All the clients must hash their state the same way for the out-of-sync checks,
+	// so the server chooses and tells them in the handshake
+	m_FastStateHash = false;
+	if (CConfigDB::IsInitialised())
+		CFG_GET_USER_VAL("network.faststatehash", Bool, m_FastStateHash);
+
+	m_Compression = true;
+	if (CConfigDB::IsInitialised())
+		CFG_GET_USER_VAL("network.compression", Bool, m_Compression);
+
+	m_AdaptiveTurnLength = false;
+	m_MinTurnLength = DEFAULT_MIN_TURN_LENGTH;
+	m_MaxTurnLength = DEFAULT_MAX_TURN_LENGTH;
+	if (CConfigDB::IsInitialised())
+	{
+		CFG_GET_USER_VAL("network.adaptiveturnlength", Bool, m_AdaptiveTurnLength);
+		CFG_GET_USER_VAL("network.minturnlength", Int, m_MinTurnLength);
+		CFG_GET_USER_VAL("network.maxturnlength", Int, m_MaxTurnLength);
+	}
+	// (The turn length is sent as a 16-bit value)
+	m_MinTurnLength = clamp(m_MinTurnLength, 1, 65535);
+	m_MaxTurnLength = clamp(m_MaxTurnLength, m_MinTurnLength, 65535);
+
+	int observerDelay = 0;
+	if (CConfigDB::IsInitialised())
+		CFG_GET_USER_VAL("network.observerdelay", Int, observerDelay);
+	m_ObserverDelay = (u32)std::max(observerDelay, 0);
+
+	m_MaxObservers = DEFAULT_MAX_OBSERVERS;
+	if (CConfigDB::IsInitialised())
+		CFG_GET_USER_VAL("network.maxobservers", Int, m_MaxObservers);
 }
 
 CNetServerWorker::~CNetServerWorker()
@@ -146,6 +188,9 @@ CNetServerWorker::~CNetServerWorker()
 		delete m_Sessions[i];
 	}
 
+	for (size_t i = 0; i < m_ObserverQueue.size(); ++i)
+		CNetHost::ReleasePacket(m_ObserverQueue[i].second);
+
 	if (m_Host)
 	{
 		enet_host_destroy(m_Host);
@@ -165,7 +210,7 @@ bool CNetServerWorker::SetupConnection()
 	addr.port = PS_DEFAULT_PORT;
 
 	// Create ENet server
-	m_Host = enet_host_create(&addr, MAX_CLIENTS, CHANNEL_COUNT, 0, 0);
+	m_Host = enet_host_create(&addr, MAX_CLIENTS + std::max(m_MaxObservers, 0), CHANNEL_COUNT, 0, 0);
 	if (!m_Host)
 	{
 		LOGERROR(L"Net server: enet_host_create failed");
@@ -191,7 +236,7 @@ bool CNetServerWorker::SendMessage(ENetPeer* peer, const CNetMessage* message)
 
 	CNetServerSession* session = static_cast<CNetServerSession*>(peer->data);
 
-	return CNetHost::SendMessage(message, peer, DebugName(session).c_str());
+	return CNetHost::SendMessage(message, peer, DebugName(session).c_str(), m_Compression);
 }
 
 bool CNetServerWorker::Broadcast(const CNetMessage* message)
@@ -200,22 +245,83 @@ bool CNetServerWorker::Broadcast(const CNetMessage* message)
 
 	bool ok = true;
 
+	// Observers may need to receive the turns later than the players
+	bool delayObservers = (m_ObserverDelay > 0 &&
+		(message->GetType() == NMT_SIMULATION_COMMAND || message->GetType() == NMT_END_COMMAND_BATCH));
+	bool hasDelayedObservers = false;
+
+	// Serialize the message once, and share the packet between all the recipients
+	// (it's created lazily since there may not be any)
+	ENetPacket* packet = NULL;
+
 	// Send to all sessions that are active and has finished authentication
 	for (size_t i = 0; i < m_Sessions.size(); ++i)
 	{
 		if (m_Sessions[i]->GetCurrState() == NSS_PREGAME || m_Sessions[i]->GetCurrState() == NSS_INGAME)
 		{
-			if (!m_Sessions[i]->SendMessage(message))
-				ok = false;
+			if (delayObservers && m_Sessions[i]->IsObserver())
+			{
+				hasDelayedObservers = true;
+				continue;
+			}
+
+			if (!packet)
+			{
+				packet = CNetHost::CreatePacket(message, m_Compression);
+				if (!packet)
+					return false;
 
-			// TODO: this does lots of repeated message serialisation if we have lots
-			// of remote peers; could do it more efficiently if that's a real problem
+				LOGMESSAGE(L"Net server: Broadcasting message %hs of size %lu", message->ToString().c_str(), (unsigned long)packet->dataLength);
+			}
+
+			if (!m_Sessions[i]->SendPacket(packet))
+				ok = false;
 		}
 	}
 
+	if (hasDelayedObservers)
+	{
+		// ENet will free the shared packet once it's been sent to the players,
+		// so the observers need their own copy
+		ENetPacket* observerPacket;
+		if (packet)
+			observerPacket = enet_packet_create(packet->data, packet->dataLength, ENET_PACKET_FLAG_RELIABLE);
+		else
+			observerPacket = CNetHost::CreatePacket(message, m_Compression);
+
+		if (observerPacket)
+			m_ObserverQueue.push_back(std::make_pair(m_ServerTurnManager->GetReadyTurn(), observerPacket));
+		else
+			ok = false;
+	}
+
+	if (packet)
+		CNetHost::ReleasePacket(packet);
+
 	return ok;
 }
 
+void CNetServerWorker::SendDelayedObserverMessages()
+{
+	if (!m_ServerTurnManager)
+		return;
+
+	u32 readyTurn = m_ServerTurnManager->GetReadyTurn();
+	while (!m_ObserverQueue.empty() && m_ObserverQueue.front().first + m_ObserverDelay <= readyTurn)
+	{
+		ENetPacket* packet = m_ObserverQueue.front().second;
+		m_ObserverQueue.pop_front();
+
+		for (size_t i = 0; i < m_Sessions.size(); ++i)
+		{
+			if (m_Sessions[i]->IsObserver() && m_Sessions[i]->GetCurrState() == NSS_INGAME)
+				m_Sessions[i]->SendPacket(packet);
+		}
+
+		CNetHost::ReleasePacket(packet);
+	}
+}
+
 void* CNetServerWorker::RunThread(void* data)
 {
 	debug_SetThreadName("NetServer");
@@ -233,6 +339,8 @@ void CNetServerWorker::Run()
 
 	while (true)
 	{
+		double stepStartTime = timer_Time();
+
 		if (!RunStep())
 			break;
 
@@ -242,6 +350,17 @@ void CNetServerWorker::Run()
 
 		// Update profiler stats
 		m_Stats->LatchHostState(m_Host);
+
+		{
+			CScopeLock lock(m_WorkerMutex);
+			m_LoadStats.busyTime += std::max(timer_Time() - stepStartTime - m_ServiceWaitTime, 0.0);
+			m_LoadStats.bytesSent += m_Host->totalSentData;
+			m_LoadStats.bytesReceived += m_Host->totalReceivedData;
+		}
+
+		// (ENet leaves it to us to reset these before they overflow)
+		m_Host->totalSentData = 0;
+		m_Host->totalReceivedData = 0;
 	}
 
 	// Clear roots before deleting their context
@@ -291,10 +410,21 @@ bool CNetServerWorker::RunStep()
 	for (size_t i = 0; i < m_Sessions.size(); ++i)
 		m_Sessions[i]->GetFileTransferer().Poll();
 
+	SendDelayedObserverMessages();
+
+	// Report the latest latencies, for adaptive turn lengths
+	if (m_ServerTurnManager)
+	{
+		for (size_t i = 0; i < m_Sessions.size(); ++i)
+			m_ServerTurnManager->SetClientRTT(m_Sessions[i]->GetHostID(), m_Sessions[i]->GetMeanRTT());
+	}
+
 	// Process network events:
 
 	ENetEvent event;
+	double serviceStartTime = timer_Time();
 	int status = enet_host_service(m_Host, &event, HOST_SERVICE_TIMEOUT);
+	m_ServiceWaitTime = timer_Time() - serviceStartTime;
 	if (status < 0)
 	{
 		LOGERROR(L"CNetServerWorker: enet_host_service failed (%d)", status);
@@ -471,8 +601,8 @@ void CNetServerWorker::OnUserLeave(CNetServerSession* session)
 {
 	RemovePlayer(session->GetGUID());
 
-	if (m_ServerTurnManager)
-		m_ServerTurnManager->UninitialiseClient(session->GetHostID()); // TODO: only for non-observers
+	if (m_ServerTurnManager && !session->IsObserver())
+		m_ServerTurnManager->UninitialiseClient(session->GetHostID());
 
 	// TODO: ought to switch the player controlled by that client
 	// back to AI control, or something?
@@ -613,6 +743,10 @@ bool CNetServerWorker::OnClientHandshake(void* context, CFsmEvent* event)
 	handshakeResponse.m_UseProtocolVersion = PS_PROTOCOL_VERSION;
 	handshakeResponse.m_Message = server.m_WelcomeMessage;
 	handshakeResponse.m_Flags = 0;
+	if (server.m_FastStateHash)
+		handshakeResponse.m_Flags |= PS_NETWORK_FLAG_FAST_STATE_HASH;
+	if (server.m_Compression)
+		handshakeResponse.m_Flags |= PS_NETWORK_FLAG_COMPRESSION;
 	session->SendMessage(&handshakeResponse);
 
 	return true;
@@ -697,6 +831,12 @@ bool CNetServerWorker::OnInGame(void* context, CFsmEvent* event)
 	CNetServerWorker& server = session->GetServer();
 
 	CNetMessage* message = (CNetMessage*)event->GetParamRef();
+
+	// Observers can't affect the game, and the turn manager isn't tracking them
+	if (session->IsObserver() &&
+		(message->GetType() == (uint)NMT_SIMULATION_COMMAND || message->GetType() == (uint)NMT_SYNC_CHECK || message->GetType() == (uint)NMT_END_COMMAND_BATCH))
+		return true;
+
 	if (message->GetType() == (uint)NMT_SIMULATION_COMMAND)
 	{
 		CSimulationMessage* simMessage = static_cast<CSimulationMessage*> (message);
@@ -716,7 +856,7 @@ bool CNetServerWorker::OnInGame(void* context, CFsmEvent* event)
 	else if (message->GetType() == (uint)NMT_SYNC_CHECK)
 	{
 		CSyncCheckMessage* syncMessage = static_cast<CSyncCheckMessage*> (message);
-		server.m_ServerTurnManager->NotifyFinishedClientUpdate(session->GetHostID(), syncMessage->m_Turn, syncMessage->m_Hash);
+		server.m_ServerTurnManager->NotifyFinishedClientUpdate(session->GetHostID(), syncMessage->m_Turn, syncMessage->m_Hash, syncMessage->m_SimTime);
 	}
 	else if (message->GetType() == (uint)NMT_END_COMMAND_BATCH)
 	{
@@ -839,9 +979,19 @@ void CNetServerWorker::CheckGameLoadStatus(CNetServerSession* changedSession)
 void CNetServerWorker::StartGame()
 {
 	m_ServerTurnManager = new CNetServerTurnManager(*this);
+	if (m_AdaptiveTurnLength)
+		m_ServerTurnManager->EnableAdaptiveTurnLength(m_MinTurnLength, m_MaxTurnLength);
 
 	for (size_t i = 0; i < m_Sessions.size(); ++i)
-		m_ServerTurnManager->InitialiseClient(m_Sessions[i]->GetHostID(), 0); // TODO: only for non-observers
+	{
+		// The turn manager doesn't need to wait for observers
+		// (if they've been assigned a player ID they can control it, so we have to)
+		PlayerAssignmentMap::iterator it = m_PlayerAssignments.find(m_Sessions[i]->GetGUID());
+		if (it != m_PlayerAssignments.end() && it->second.m_PlayerID == -1)
+			m_Sessions[i]->SetObserver(true);
+		else
+			m_ServerTurnManager->InitialiseClient(m_Sessions[i]->GetHostID(), 0);
+	}
 
 	m_State = SERVER_STATE_LOADING;
 
@@ -957,3 +1107,16 @@ void CNetServer::SetTurnLength(u32 msecs)
 	CScopeLock lock(m_Worker->m_WorkerMutex);
 	m_Worker->m_TurnLengthQueue.push_back(msecs);
 }
+
+void CNetServer::SetMaxObservers(int maxObservers)
+{
+	// (The worker thread hasn't started yet, so this doesn't need the lock)
+	ENSURE(!m_Worker->m_Host);
+	m_Worker->m_MaxObservers = maxObservers;
+}
+
+CNetServer::SLoadStats CNetServer::GetLoadStats()
+{
+	CScopeLock lock(m_Worker->m_WorkerMutex);
+	return m_Worker->m_LoadStats;
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,6 +24,7 @@
 #include "ps/ThreadUtil.h"
 #include "scriptinterface/ScriptVal.h"
 
+#include <deque>
 #include <vector>
 
 class CNetServerSession;
@@ -136,11 +137,40 @@ public:
 	void UpdateGameAttributes(const CScriptVal& attrs, ScriptInterface& scriptInterface);
 
 	/**
-	 * Set the turn length to a fixed value.
-	 * TODO: we should replace this with some adapative lag-dependent computation.
+	 * Set the turn length. If the "network.adaptiveturnlength" config setting is
+	 * enabled, this is only the initial value, and it will be adjusted automatically
+	 * during the game.
 	 */
 	void SetTurnLength(u32 msecs);
 
+	/**
+	 * Set the number of connections accepted in addition to MAX_CLIENTS (for observers),
+	 * overriding the "network.maxobservers" config setting.
+	 * This must be called before SetupConnection.
+	 */
+	void SetMaxObservers(int maxObservers);
+
+	/**
+	 * Measurements of the server's load, for benchmarking.
+	 */
+	struct SLoadStats
+	{
+		SLoadStats() : busyTime(0.0), bytesSent(0), bytesReceived(0) { }
+
+		/// Real time (in seconds) the server thread has spent working, i.e. not blocked
+		/// waiting for network events
+		double busyTime;
+
+		/// Total data sent to and received from all peers, in bytes
+		u64 bytesSent;
+		u64 bytesReceived;
+	};
+
+	/**
+	 * Returns the server's load since SetupConnection.
+	 */
+	SLoadStats GetLoadStats();
+
 private:
 	CNetServerWorker* m_Worker;
 };
@@ -172,6 +202,8 @@ public:
 	/**
 	 * Send a message to all clients who have completed the full connection process
 	 * (i.e. are in the pre-game or in-game states).
+	 * Simulation commands and end-of-turn messages are sent to observers after
+	 * the observer delay, if there is one.
 	 */
 	bool Broadcast(const CNetMessage* message);
 
@@ -225,8 +257,7 @@ private:
 	ScriptInterface& GetScriptInterface();
 
 	/**
-	 * Set the turn length to a fixed value.
-	 * TODO: we should replace this with some adaptive lag-dependent computation.
+	 * Set the current turn length (see CNetServer::SetTurnLength).
 	 */
 	void SetTurnLength(u32 msecs);
 
@@ -274,9 +305,17 @@ private:
 
 	CNetStatsTable* m_Stats;
 
+	int m_MaxObservers;
+
 	NetServerState m_State;
 
 	CStrW m_ServerName;
+	bool m_FastStateHash; // whether clients should use STATE_HASH_MURMUR3 (see PS_NETWORK_FLAG_FAST_STATE_HASH)
+	bool m_Compression; // whether large messages are compressed (see PS_NETWORK_FLAG_COMPRESSION)
+
+	bool m_AdaptiveTurnLength; // whether the turn length is adjusted to the network latency (see CNetServerTurnManager::EnableAdaptiveTurnLength)
+	int m_MinTurnLength;
+	int m_MaxTurnLength;
 	CStrW m_WelcomeMessage;
 
 	u32 m_NextHostID;
@@ -296,6 +335,23 @@ private:
 	 */
 	std::string m_JoinSyncFile;
 
+	/**
+	 * Number of turns to delay the turn messages sent to observers by
+	 * (to stop them passing information to players during the game).
+	 */
+	u32 m_ObserverDelay;
+
+	/**
+	 * Turn messages waiting to be sent to observers, in the order they were
+	 * broadcast to players, with the server's ready turn at the time.
+	 */
+	std::deque<std::pair<u32, ENetPacket*> > m_ObserverQueue;
+
+	/**
+	 * Sends the messages in m_ObserverQueue that have been delayed long enough.
+	 */
+	void SendDelayedObserverMessages();
+
 private:
 	// Thread-related stuff:
 
@@ -313,6 +369,11 @@ private:
 	std::vector<bool> m_StartGameQueue; // protected by m_WorkerMutex
 	std::vector<std::string> m_GameAttributesQueue; // protected by m_WorkerMutex
 	std::vector<u32> m_TurnLengthQueue; // protected by m_WorkerMutex
+
+	CNetServer::SLoadStats m_LoadStats; // protected by m_WorkerMutex
+
+	// Time spent blocked in enet_host_service by the latest RunStep
+	double m_ServiceWaitTime;
 };
 
 /// Global network server for the standard game
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,13 +27,20 @@
 
 static const int CHANNEL_COUNT = 1;
 
+// Maximum time (in msecs) for the client network thread to wait for events,
+// which is also the maximum delay before it sends a queued message
+static const int CLIENT_SERVICE_TIMEOUT = 10;
+
 CNetClientSession::CNetClientSession(CNetClient& client) :
-	m_Client(client), m_FileTransferer(this), m_Host(NULL), m_Server(NULL), m_Stats(NULL)
+	m_Client(client), m_FileTransferer(this), m_Host(NULL), m_Server(NULL), m_Stats(NULL), m_Compression(false),
+	m_ThreadRunning(false), m_Shutdown(false)
 {
 }
 
 CNetClientSession::~CNetClientSession()
 {
+	StopThread();
+
 	delete m_Stats;
 
 	if (m_Host && m_Server)
@@ -71,17 +78,51 @@ bool CNetClientSession::Connect(u16 port, const CStr& server)
 	m_Host = host;
 	m_Server = peer;
 
-	m_Stats = new CNetStatsTable(m_Server);
+	m_Stats = new CNetStatsTable();
 	if (CProfileViewer::IsInitialised())
 		g_ProfileViewer.AddRootTable(m_Stats);
 
+	// Launch the network thread
+	m_Shutdown = false;
+	int ret = pthread_create(&m_WorkerThread, NULL, &RunThread, this);
+	ENSURE(ret == 0);
+	m_ThreadRunning = true;
+
 	return true;
 }
 
+void CNetClientSession::StopThread()
+{
+	if (!m_ThreadRunning)
+		return;
+
+	// Tell the thread to shut down
+	{
+		CScopeLock lock(m_WorkerMutex);
+		m_Shutdown = true;
+	}
+
+	// Wait for it to shut down cleanly
+	pthread_join(m_WorkerThread, NULL);
+	m_ThreadRunning = false;
+
+	// Discard anything it didn't get around to sending or we didn't handle
+	for (size_t i = 0; i < m_OutgoingQueue.size(); ++i)
+		enet_packet_destroy(m_OutgoingQueue[i]);
+	m_OutgoingQueue.clear();
+
+	for (size_t i = 0; i < m_IncomingQueue.size(); ++i)
+		if (m_IncomingQueue[i].type == IncomingEvent::RECEIVE)
+			enet_packet_destroy(m_IncomingQueue[i].packet);
+	m_IncomingQueue.clear();
+}
+
 void CNetClientSession::Disconnect(u32 reason)
 {
 	ENSURE(m_Host && m_Server);
 
+	StopThread();
+
 	// TODO: ought to do reliable async disconnects, probably
 	enet_peer_disconnect_now(m_Server, reason);
 	enet_host_destroy(m_Host);
@@ -92,6 +133,112 @@ void CNetClientSession::Disconnect(u32 reason)
 	SAFE_DELETE(m_Stats);
 }
 
+void* CNetClientSession::RunThread(void* data)
+{
+	debug_SetThreadName("NetClient");
+
+	static_cast<CNetClientSession*>(data)->Run();
+
+	return NULL;
+}
+
+void CNetClientSession::Run()
+{
+	while (true)
+	{
+		if (!RunStep())
+			break;
+
+		// Update profiler stats
+		m_Stats->LatchHostState(m_Host);
+	}
+}
+
+bool CNetClientSession::RunStep()
+{
+	// Send any messages from the main thread.
+	// (Do as little work as possible while the mutex is held open,
+	// to avoid blocking the main thread.)
+
+	std::vector<ENetPacket*> outgoing;
+	{
+		CScopeLock lock(m_WorkerMutex);
+
+		if (m_Shutdown)
+			return false;
+
+		outgoing.swap(m_OutgoingQueue);
+	}
+
+	for (size_t i = 0; i < outgoing.size(); ++i)
+	{
+		CNetHost::SendPacket(outgoing[i], m_Server);
+		CNetHost::ReleasePacket(outgoing[i]);
+	}
+
+	// Process network events (this also sends the queued packets):
+
+	ENetEvent event;
+	int status = enet_host_service(m_Host, &event, CLIENT_SERVICE_TIMEOUT);
+	if (status < 0)
+	{
+		LOGERROR(L"Net client: enet_host_service failed (%d)", status);
+		return false;
+	}
+
+	if (status == 0)
+	{
+		// Reached timeout with no events - try again
+		return true;
+	}
+
+	IncomingEvent incoming;
+	incoming.reason = 0;
+	incoming.packet = NULL;
+
+	switch (event.type)
+	{
+	case ENET_EVENT_TYPE_CONNECT:
+	{
+		ENSURE(event.peer == m_Server);
+
+		// Report the server address
+		char hostname[256] = "(error)";
+		enet_address_get_host_ip(&event.peer->address, hostname, ARRAY_SIZE(hostname));
+		LOGMESSAGE(L"Net client: Connected to %hs:%u", hostname, (unsigned int)event.peer->address.port);
+
+		incoming.type = IncomingEvent::CONNECT;
+		break;
+	}
+
+	case ENET_EVENT_TYPE_DISCONNECT:
+	{
+		ENSURE(event.peer == m_Server);
+
+		LOGMESSAGE(L"Net client: Disconnected");
+		incoming.type = IncomingEvent::DISCONNECT;
+		incoming.reason = event.data;
+		break;
+	}
+
+	case ENET_EVENT_TYPE_RECEIVE:
+		incoming.type = IncomingEvent::RECEIVE;
+		incoming.packet = event.packet;
+		break;
+
+	case ENET_EVENT_TYPE_NONE:
+		return true;
+	}
+
+	{
+		CScopeLock lock(m_WorkerMutex);
+		m_IncomingQueue.push_back(incoming);
+	}
+
+	// There's nothing more to do once we've been disconnected
+	return incoming.type != IncomingEvent::DISCONNECT;
+}
+
 void CNetClientSession::Poll()
 {
 	PROFILE3("net client poll");
@@ -100,37 +247,32 @@ void CNetClientSession::Poll()
 
 	m_FileTransferer.Poll();
 
-	ENetEvent event;
-	while (enet_host_service(m_Host, &event, 0) > 0)
+	std::vector<IncomingEvent> incoming;
 	{
-		switch (event.type)
-		{
-		case ENET_EVENT_TYPE_CONNECT:
-		{
-			ENSURE(event.peer == m_Server);
-
-			// Report the server address
-			char hostname[256] = "(error)";
-			enet_address_get_host_ip(&event.peer->address, hostname, ARRAY_SIZE(hostname));
-			LOGMESSAGE(L"Net client: Connected to %hs:%u", hostname, (unsigned int)event.peer->address.port);
+		CScopeLock lock(m_WorkerMutex);
+		incoming.swap(m_IncomingQueue);
+	}
 
+	for (size_t i = 0; i < incoming.size(); ++i)
+	{
+		switch (incoming[i].type)
+		{
+		case IncomingEvent::CONNECT:
 			m_Client.HandleConnect();
-
 			break;
-		}
-
-		case ENET_EVENT_TYPE_DISCONNECT:
-		{
-			ENSURE(event.peer == m_Server);
 
-			LOGMESSAGE(L"Net client: Disconnected");
-			m_Client.HandleDisconnect(event.data);
+		case IncomingEvent::DISCONNECT:
+			// (This will delete the session, so discard the remaining events first)
+			for (size_t j = i+1; j < incoming.size(); ++j)
+				if (incoming[j].type == IncomingEvent::RECEIVE)
+					enet_packet_destroy(incoming[j].packet);
+			m_Client.HandleDisconnect(incoming[i].reason);
 			return;
-		}
 
-		case ENET_EVENT_TYPE_RECEIVE:
+		case IncomingEvent::RECEIVE:
 		{
-			CNetMessage* msg = CNetMessageFactory::CreateMessage(event.packet->data, event.packet->dataLength, m_Client.GetScriptInterface());
+			ENetPacket* packet = incoming[i].packet;
+			CNetMessage* msg = CNetMessageFactory::CreateMessage(packet->data, packet->dataLength, m_Client.GetScriptInterface());
 			if (msg)
 			{
 				LOGMESSAGE(L"Net client: Received message %hs of size %lu from server", msg->ToString().c_str(), (unsigned long)msg->GetSerializedLength());
@@ -140,38 +282,40 @@ void CNetClientSession::Poll()
 				delete msg;
 			}
 
-			enet_packet_destroy(event.packet);
+			enet_packet_destroy(packet);
 
 			break;
 		}
-
-		case ENET_EVENT_TYPE_NONE:
-			break;
 		}
 	}
-
 }
 
 void CNetClientSession::Flush()
 {
-	PROFILE3("net client flush");
-
 	ENSURE(m_Host && m_Server);
-
-	enet_host_flush(m_Host);
 }
 
 bool CNetClientSession::SendMessage(const CNetMessage* message)
 {
 	ENSURE(m_Host && m_Server);
 
-	return CNetHost::SendMessage(message, m_Server, "server");
+	// Serialize the message in this thread (it may contain script values),
+	// and let the network thread send it
+	ENetPacket* packet = CNetHost::CreatePacket(message, m_Compression);
+	if (!packet)
+		return false;
+
+	LOGMESSAGE(L"Net client: Sending message %hs of size %lu to server", message->ToString().c_str(), (unsigned long)packet->dataLength);
+
+	CScopeLock lock(m_WorkerMutex);
+	m_OutgoingQueue.push_back(packet);
+	return true;
 }
 
 
 
 CNetServerSession::CNetServerSession(CNetServerWorker& server, ENetPeer* peer) :
-	m_Server(server), m_FileTransferer(this), m_Peer(peer)
+	m_Server(server), m_FileTransferer(this), m_Peer(peer), m_IsObserver(false)
 {
 }
 
@@ -187,7 +331,17 @@ void CNetServerSession::DisconnectNow(u32 reason)
 	enet_peer_disconnect_now(m_Peer, reason);
 }
 
+u32 CNetServerSession::GetMeanRTT() const
+{
+	return m_Peer->roundTripTime;
+}
+
 bool CNetServerSession::SendMessage(const CNetMessage* message)
 {
 	return m_Server.SendMessage(m_Peer, message);
 }
+
+bool CNetServerSession::SendPacket(ENetPacket* packet)
+{
+	return CNetHost::SendPacket(packet, m_Peer);
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -22,6 +22,7 @@
 #include "network/NetFileTransfer.h"
 #include "network/NetHost.h"
 #include "ps/CStr.h"
+#include "ps/ThreadUtil.h"
 #include "scriptinterface/ScriptVal.h"
 
 class CNetClient;
@@ -51,6 +52,14 @@ public:
 /**
  * The client end of a network session.
  * Provides an abstraction of the network interface, allowing communication with the server.
+ *
+ * Thread-safety:
+ * - Public functions must be called from the main thread.
+ * - Once connected, the ENet host is serviced by a separate network thread (so
+ *   that receiving, acknowledging and sending packets is not delayed by the
+ *   framerate). It passes events to the main thread through queues protected
+ *   by m_WorkerMutex, and Poll handles them there - messages are deserialized
+ *   on the main thread since they may contain script values.
  */
 class CNetClientSession : public INetSession
 {
@@ -69,6 +78,7 @@ public:
 
 	/**
 	 * Flush queued outgoing network messages.
+	 * (The network thread sends messages as soon as it can, so this does nothing.)
 	 */
 	void Flush();
 
@@ -83,16 +93,44 @@ public:
 	 */
 	virtual bool SendMessage(const CNetMessage* message);
 
+	/**
+	 * Set whether large messages sent to the server should be compressed.
+	 * (This must only be enabled if the server supports it; see PS_NETWORK_FLAG_COMPRESSION.)
+	 */
+	void SetCompression(bool enabled) { m_Compression = enabled; }
+
 	CNetFileTransferer& GetFileTransferer() { return m_FileTransferer; }
 
 private:
+	struct IncomingEvent
+	{
+		enum Type { CONNECT, DISCONNECT, RECEIVE } type;
+		u32 reason; // for DISCONNECT
+		ENetPacket* packet; // for RECEIVE
+	};
+
+	void StopThread();
+
+	static void* RunThread(void* data);
+	void Run();
+	bool RunStep();
+
 	CNetClient& m_Client;
 
 	CNetFileTransferer m_FileTransferer;
 
-	ENetHost* m_Host;
-	ENetPeer* m_Server;
+	ENetHost* m_Host; // only used by the network thread while it is running
+	ENetPeer* m_Server; // only used by the network thread while it is running
 	CNetStatsTable* m_Stats;
+
+	bool m_Compression;
+
+	bool m_ThreadRunning;
+	pthread_t m_WorkerThread;
+	CMutex m_WorkerMutex;
+	bool m_Shutdown; // protected by m_WorkerMutex
+	std::vector<ENetPacket*> m_OutgoingQueue; // protected by m_WorkerMutex
+	std::vector<IncomingEvent> m_IncomingQueue; // protected by m_WorkerMutex
 };
 
 
@@ -122,6 +160,18 @@ public:
 	u32 GetHostID() const { return m_HostID; }
 	void SetHostID(u32 id) { m_HostID = id; }
 
+	/**
+	 * Observers don't control a player, so the turn manager doesn't wait for them
+	 * and they may receive the turns after a delay (see "network.observerdelay").
+	 */
+	bool IsObserver() const { return m_IsObserver; }
+	void SetObserver(bool observer) { m_IsObserver = observer; }
+
+	/**
+	 * Returns ENet's smoothed estimate of the round-trip time to the client, in msecs.
+	 */
+	u32 GetMeanRTT() const;
+
 	/**
 	 * Sends a disconnection notification to the client,
 	 * and sends a NMT_CONNECTION_LOST message to the session FSM.
@@ -142,6 +192,11 @@ public:
 	 */
 	virtual bool SendMessage(const CNetMessage* message);
 
+	/**
+	 * Send an already-serialized message to the client (see CNetHost::SendPacket).
+	 */
+	bool SendPacket(ENetPacket* packet);
+
 	CNetFileTransferer& GetFileTransferer() { return m_FileTransferer; }
 
 private:
@@ -154,6 +209,7 @@ private:
 	CStr m_GUID;
 	CStrW m_UserName;
 	u32 m_HostID;
+	bool m_IsObserver;
 };
 
 #endif	// NETSESSION_H
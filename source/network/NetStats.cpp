@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,7 +19,10 @@
 
 #include "NetStats.h"
 
+#include "NetMessage.h"
+
 #include "lib/external_libraries/enet.h"
+#include "lib/sysdep/cpu.h"
 
 enum
 {
@@ -150,3 +153,124 @@ void CNetStatsTable::LatchHostState(const ENetHost* host)
 	}
 #undef ROW
 }
+
+CNetMessageStatsTable* g_NetMessageStatsTable = NULL;
+
+namespace
+{
+
+struct SMessageTypeStats
+{
+	volatile intptr_t sentPackets;
+	volatile intptr_t sentBytes;
+	volatile intptr_t sentUncompressedBytes;
+	volatile intptr_t receivedPackets;
+	volatile intptr_t receivedBytes;
+};
+
+SMessageTypeStats g_MessageTypeStats[NMT_LAST];
+
+struct SMessageTypeName
+{
+	NetMessageType type;
+	const char* name;
+};
+
+// (NMT_COMPRESSED isn't listed, since compressed messages are counted as their original type)
+const SMessageTypeName g_MessageTypeNames[] = {
+	{ NMT_SERVER_HANDSHAKE, "server handshake" },
+	{ NMT_CLIENT_HANDSHAKE, "client handshake" },
+	{ NMT_SERVER_HANDSHAKE_RESPONSE, "server handshake response" },
+	{ NMT_AUTHENTICATE, "authenticate" },
+	{ NMT_AUTHENTICATE_RESULT, "authenticate result" },
+	{ NMT_CHAT, "chat" },
+	{ NMT_GAME_SETUP, "game setup" },
+	{ NMT_PLAYER_ASSIGNMENT, "player assignment" },
+	{ NMT_FILE_TRANSFER_REQUEST, "file transfer request" },
+	{ NMT_FILE_TRANSFER_RESPONSE, "file transfer response" },
+	{ NMT_FILE_TRANSFER_DATA, "file transfer data" },
+	{ NMT_FILE_TRANSFER_ACK, "file transfer ack" },
+	{ NMT_JOIN_SYNC_START, "join sync start" },
+	{ NMT_LOADED_GAME, "loaded game" },
+	{ NMT_GAME_START, "game start" },
+	{ NMT_END_COMMAND_BATCH, "end command batch" },
+	{ NMT_SYNC_CHECK, "sync check" },
+	{ NMT_SYNC_ERROR, "sync error" },
+	{ NMT_SIMULATION_COMMAND, "simulation command" },
+};
+
+} // namespace
+
+CNetMessageStatsTable::CNetMessageStatsTable()
+{
+	m_ColumnDescriptions.push_back(ProfileColumn("Message type", 200));
+	m_ColumnDescriptions.push_back(ProfileColumn("sent", 70));
+	m_ColumnDescriptions.push_back(ProfileColumn("sent bytes", 90));
+	m_ColumnDescriptions.push_back(ProfileColumn("bytes saved", 90));
+	m_ColumnDescriptions.push_back(ProfileColumn("received", 70));
+	m_ColumnDescriptions.push_back(ProfileColumn("received bytes", 100));
+}
+
+void CNetMessageStatsTable::RecordSent(int type, size_t bytes, size_t uncompressedBytes)
+{
+	if (type <= NMT_INVALID || type >= NMT_LAST)
+		return;
+
+	SMessageTypeStats& stats = g_MessageTypeStats[type];
+	cpu_AtomicAdd(&stats.sentPackets, 1);
+	cpu_AtomicAdd(&stats.sentBytes, (intptr_t)bytes);
+	cpu_AtomicAdd(&stats.sentUncompressedBytes, (intptr_t)uncompressedBytes);
+}
+
+void CNetMessageStatsTable::RecordReceived(int type, size_t bytes)
+{
+	if (type <= NMT_INVALID || type >= NMT_LAST)
+		return;
+
+	SMessageTypeStats& stats = g_MessageTypeStats[type];
+	cpu_AtomicAdd(&stats.receivedPackets, 1);
+	cpu_AtomicAdd(&stats.receivedBytes, (intptr_t)bytes);
+}
+
+CStr CNetMessageStatsTable::GetName()
+{
+	return "netmessages";
+}
+
+CStr CNetMessageStatsTable::GetTitle()
+{
+	return "Network message statistics";
+}
+
+size_t CNetMessageStatsTable::GetNumberRows()
+{
+	return ARRAY_SIZE(g_MessageTypeNames);
+}
+
+const std::vector<ProfileColumn>& CNetMessageStatsTable::GetColumns()
+{
+	return m_ColumnDescriptions;
+}
+
+CStr CNetMessageStatsTable::GetCellText(size_t row, size_t col)
+{
+	if (row >= ARRAY_SIZE(g_MessageTypeNames))
+		return "???";
+
+	const SMessageTypeStats& stats = g_MessageTypeStats[g_MessageTypeNames[row].type];
+	switch (col)
+	{
+	case 0: return g_MessageTypeNames[row].name;
+	case 1: return CStr::FromInt64(stats.sentPackets);
+	case 2: return CStr::FromInt64(stats.sentBytes);
+	case 3: return CStr::FromInt64(stats.sentUncompressedBytes - stats.sentBytes);
+	case 4: return CStr::FromInt64(stats.receivedPackets);
+	case 5: return CStr::FromInt64(stats.receivedBytes);
+	default: return "???";
+	}
+}
+
+AbstractProfileTable* CNetMessageStatsTable::GetChild(size_t UNUSED(row))
+{
+	return 0;
+}
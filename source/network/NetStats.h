@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -57,4 +57,46 @@ private:
 	std::vector<std::vector<CStr> > m_LatchedData; // protected by m_Mutex
 };
 
+/**
+ * Profiler table showing the number of packets and bytes of each network message
+ * type sent and received by this process (including both the server and the local
+ * client, when hosting a game), and the bytes saved by compressing them.
+ *
+ * The counts are recorded by CNetHost and CNetMessageFactory, in any thread,
+ * whether or not the table exists.
+ */
+class CNetMessageStatsTable : public AbstractProfileTable
+{
+	NONCOPYABLE(CNetMessageStatsTable);
+public:
+	CNetMessageStatsTable();
+
+	/**
+	 * Count a packet sent to one peer.
+	 * @param type type of the message (before compression)
+	 * @param bytes size of the packet
+	 * @param uncompressedBytes size of the message before compression
+	 */
+	static void RecordSent(int type, size_t bytes, size_t uncompressedBytes);
+
+	/**
+	 * Count a packet received from a peer.
+	 * @param type type of the message (before compression)
+	 * @param bytes size of the packet
+	 */
+	static void RecordReceived(int type, size_t bytes);
+
+	virtual CStr GetName();
+	virtual CStr GetTitle();
+	virtual size_t GetNumberRows();
+	virtual const std::vector<ProfileColumn>& GetColumns();
+	virtual CStr GetCellText(size_t row, size_t col);
+	virtual AbstractProfileTable* GetChild(size_t row);
+
+private:
+	std::vector<ProfileColumn> m_ColumnDescriptions;
+};
+
+extern CNetMessageStatsTable* g_NetMessageStatsTable;
+
 #endif // INCLUDED_NETSTATS
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,8 +24,12 @@
 #include "network/NetMessage.h"
 
 #include "gui/GUIManager.h"
+#include "lib/byte_order.h"
+#include "lib/timer.h"
 #include "maths/MathUtil.h"
 #include "ps/CLogger.h"
+#include "ps/Compress.h"
+#include "ps/ConfigDB.h"
 #include "ps/Profile.h"
 #include "ps/Pyrogenesis.h"
 #include "ps/Replay.h"
@@ -42,6 +46,15 @@ static const int DEFAULT_TURN_LENGTH_SP = 200;
 
 static const int COMMAND_DELAY = 2;
 
+// Adaptive turn lengths (see CNetServerTurnManager::UpdateAdaptiveTurnLength)
+static const float TURN_LENGTH_HEADROOM = 1.25f; // allowance for jitter in the RTT and simulation times
+static const float TURN_LENGTH_INCREASE_RATE = 0.5f; // lengthen quickly to avoid stalls
+static const float TURN_LENGTH_DECREASE_RATE = 0.1f; // but shorten slowly, in case the lag returns
+static const u32 TURN_LENGTH_GRANULARITY = 10; // msecs (so the length doesn't change every turn)
+static const float SIM_TIME_SMOOTHING = 0.2f; // weight of each new sample in the moving average
+
+static const int DEFAULT_TIME_WARP_MEMORY_LIMIT = 256; // MiB
+
 #if 0
 #define NETTURN_LOG(args) debug_printf args
 #else
@@ -58,9 +71,9 @@ static std::wstring Hexify(const std::string& s)
 }
 
 CNetTurnManager::CNetTurnManager(CSimulation2& simulation, u32 defaultTurnLength, int clientId, IReplayLogger& replay) :
-	m_Simulation2(simulation), m_CurrentTurn(0), m_ReadyTurn(1), m_TurnLength(defaultTurnLength), m_DeltaSimTime(0),
+	m_Simulation2(simulation), m_CurrentTurn(0), m_ReadyTurn(1), m_TurnLength(defaultTurnLength), m_DeltaSimTime(0), m_LastUpdateTime(0),
 	m_PlayerId(-1), m_ClientId(clientId), m_HasSyncError(false), m_Replay(replay),
-	m_TimeWarpNumTurns(0)
+	m_TimeWarpNumTurns(0), m_TimeWarpStates(DEFAULT_TIME_WARP_MEMORY_LIMIT*MiB)
 {
 	// When we are on turn n, we schedule new commands for n+2.
 	// We know that all other clients have finished scheduling commands for n (else we couldn't have got here).
@@ -103,9 +116,12 @@ bool CNetTurnManager::Update(float simFrameLength, size_t maxTurns)
 {
 	m_DeltaSimTime += simFrameLength;
 
-	// If we haven't reached the next turn yet, do nothing
+	// If we haven't reached the next turn yet, just use the spare time
 	if (m_DeltaSimTime < 0)
+	{
+		m_Simulation2.IdleUpdate();
 		return false;
+	}
 
 	NETTURN_LOG((L"Update current=%d ready=%d\n", m_CurrentTurn, m_ReadyTurn));
 
@@ -122,6 +138,7 @@ bool CNetTurnManager::Update(float simFrameLength, size_t maxTurns)
 		// TODO: we should do clever rate adjustment instead of just pausing like this.
 		m_DeltaSimTime = 0;
 
+		m_Simulation2.IdleUpdate();
 		return false;
 	}
 
@@ -152,7 +169,7 @@ bool CNetTurnManager::Update(float simFrameLength, size_t maxTurns)
 			PROFILE3("time warp serialization");
 			std::stringstream stream;
 			m_Simulation2.SerializeState(stream);
-			m_TimeWarpStates.push_back(stream.str());
+			m_TimeWarpStates.PushBack(stream.str());
 		}
 
 		// Put all the client commands into a single list, in a globally consistent order
@@ -168,7 +185,9 @@ bool CNetTurnManager::Update(float simFrameLength, size_t maxTurns)
 
 		NETTURN_LOG((L"Running %d cmds\n", commands.size()));
 
+		double updateStartTime = timer_Time();
 		m_Simulation2.Update(m_TurnLength, commands);
+		m_LastUpdateTime = timer_Time() - updateStartTime;
 
 		NotifyFinishedUpdate(m_CurrentTurn);
 
@@ -176,6 +195,14 @@ bool CNetTurnManager::Update(float simFrameLength, size_t maxTurns)
 		m_DeltaSimTime -= m_TurnLength / 1000.f;
 	}
 
+	// If a turn took a long time to compute, wait at least that long before starting
+	// the next one, instead of catching up by running it in the very next frame (which
+	// would stall frames back-to-back). That way rendering always gets at least as much
+	// time as the simulation, and the game just runs slower when the simulation can't
+	// keep up. (Fast-forwarding deliberately runs several turns per frame, so isn't paced.)
+	if (maxTurns == 1)
+		m_DeltaSimTime = std::min(m_DeltaSimTime, -(float)m_LastUpdateTime);
+
 	return true;
 }
 
@@ -272,6 +299,49 @@ void CNetTurnManager::AddCommand(int client, int player, CScriptValRooted data,
 	m_QueuedCommands[turn - (m_CurrentTurn+1)][client].push_back(cmd);
 }
 
+/**
+ * If @p cmd is a command that a later one can supersede (see CNetTurnManager::CommandSupersedes),
+ * returns true and its type and entities.
+ */
+static bool GetSupersedableCommand(ScriptInterface& scriptInterface, jsval cmd, std::string& type, std::vector<u32>& entities)
+{
+	if (!JSVAL_IS_OBJECT(cmd) || JSVAL_IS_NULL(cmd))
+		return false;
+
+	CScriptVal typeVal;
+	if (!scriptInterface.GetProperty(cmd, "type", typeVal) || !JSVAL_IS_STRING(typeVal.get()))
+		return false;
+	if (!ScriptInterface::FromJSVal(scriptInterface.GetContext(), typeVal.get(), type))
+		return false;
+	if (type != "walk" && type != "set-rally-point")
+		return false;
+
+	// Queued orders add to the previous ones instead of replacing them
+	CScriptVal queued;
+	if (!scriptInterface.GetProperty(cmd, "queued", queued))
+		return false;
+	if (!JSVAL_IS_VOID(queued.get()) && queued.get() != JSVAL_FALSE)
+		return false;
+
+	CScriptVal entitiesVal;
+	if (!scriptInterface.GetProperty(cmd, "entities", entitiesVal) || !JSVAL_IS_OBJECT(entitiesVal.get()) || JSVAL_IS_NULL(entitiesVal.get()))
+		return false;
+	return ScriptInterface::FromJSVal(scriptInterface.GetContext(), entitiesVal.get(), entities);
+}
+
+bool CNetTurnManager::CommandSupersedes(const CScriptValRooted& later, const CScriptValRooted& earlier)
+{
+	ScriptInterface& scriptInterface = m_Simulation2.GetScriptInterface();
+
+	std::string laterType, earlierType;
+	std::vector<u32> laterEntities, earlierEntities;
+	if (!GetSupersedableCommand(scriptInterface, later.get(), laterType, laterEntities) ||
+		!GetSupersedableCommand(scriptInterface, earlier.get(), earlierType, earlierEntities))
+		return false;
+
+	return laterType == earlierType && laterEntities == earlierEntities;
+}
+
 void CNetTurnManager::FinishedAllCommands(u32 turn, u32 turnLength)
 {
 	NETTURN_LOG((L"FinishedAllCommands(%d, %d)\n", turn, turnLength));
@@ -299,18 +369,23 @@ bool CNetTurnManager::TurnNeedsFullHash(u32 turn)
 
 void CNetTurnManager::EnableTimeWarpRecording(size_t numTurns)
 {
-	m_TimeWarpStates.clear();
+	int memoryLimit = DEFAULT_TIME_WARP_MEMORY_LIMIT;
+	if (CConfigDB::IsInitialised())
+		CFG_GET_USER_VAL("timewarp.memorylimit", Int, memoryLimit);
+
+	m_TimeWarpStates.Clear();
+	m_TimeWarpStates.SetMemoryLimit((size_t)std::max(memoryLimit, 1)*MiB);
 	m_TimeWarpNumTurns = numTurns;
 }
 
 void CNetTurnManager::RewindTimeWarp()
 {
-	if (m_TimeWarpStates.empty())
+	std::string state;
+	if (!m_TimeWarpStates.PopBack(state))
 		return;
 
-	std::stringstream stream(m_TimeWarpStates.back());
+	std::stringstream stream(state);
 	m_Simulation2.DeserializeState(stream);
-	m_TimeWarpStates.pop_back();
 
 	// Reset the turn manager state, so we won't execute stray commands and
 	// won't do the next snapshot until the appropriate time.
@@ -371,7 +446,8 @@ void CNetTurnManager::QuickLoad()
 
 
 CNetClientTurnManager::CNetClientTurnManager(CSimulation2& simulation, CNetClient& client, int clientId, IReplayLogger& replay) :
-	CNetTurnManager(simulation, DEFAULT_TURN_LENGTH_MP, clientId, replay), m_NetClient(client)
+	CNetTurnManager(simulation, DEFAULT_TURN_LENGTH_MP, clientId, replay), m_NetClient(client),
+	m_RejoinCheckpointInterval(0), m_RejoinCheckpointTurn(0)
 {
 }
 
@@ -379,9 +455,13 @@ void CNetClientTurnManager::PostCommand(CScriptValRooted data)
 {
 	NETTURN_LOG((L"PostCommand()\n"));
 
-	// Transmit command to server
-	CSimulationMessage msg(m_Simulation2.GetScriptInterface(), m_ClientId, m_PlayerId, m_CurrentTurn + COMMAND_DELAY, data.get());
-	m_NetClient.SendMessage(&msg);
+	// Hold on to the command until the end of the turn (it won't be executed
+	// any sooner by being sent now), and forget the previous one if this
+	// makes it redundant
+	if (!m_PendingCommands.empty() && CommandSupersedes(data, m_PendingCommands.back()))
+		m_PendingCommands.back() = data;
+	else
+		m_PendingCommands.push_back(data);
 
 	// Add to our local queue
 	//AddCommand(m_ClientId, m_PlayerId, data, m_CurrentTurn + COMMAND_DELAY);
@@ -392,6 +472,14 @@ void CNetClientTurnManager::NotifyFinishedOwnCommands(u32 turn)
 {
 	NETTURN_LOG((L"NotifyFinishedOwnCommands(%d)\n", turn));
 
+	// Transmit our commands to the server
+	for (size_t i = 0; i < m_PendingCommands.size(); ++i)
+	{
+		CSimulationMessage msg(m_Simulation2.GetScriptInterface(), m_ClientId, m_PlayerId, turn, m_PendingCommands[i].get());
+		m_NetClient.SendMessage(&msg);
+	}
+	m_PendingCommands.clear();
+
 	// Send message to the server
 	CEndCommandBatchMessage msg;
 	msg.m_TurnLength = DEFAULT_TURN_LENGTH_MP; // TODO: why do we send this?
@@ -417,7 +505,49 @@ void CNetClientTurnManager::NotifyFinishedUpdate(u32 turn)
 	CSyncCheckMessage msg;
 	msg.m_Turn = turn;
 	msg.m_Hash = hash;
+	msg.m_SimTime = (u32)std::min(m_LastUpdateTime * 1000.0, 65535.0);
 	m_NetClient.SendMessage(&msg);
+
+	if (m_RejoinCheckpointInterval && turn % m_RejoinCheckpointInterval == 0)
+	{
+		PROFILE3("rejoin checkpoint");
+		SerializeRejoinState(m_RejoinCheckpoint);
+		m_RejoinCheckpointTurn = turn;
+	}
+}
+
+void CNetClientTurnManager::EnableRejoinCheckpoints(u32 numTurns)
+{
+	m_RejoinCheckpointInterval = numTurns;
+	m_RejoinCheckpoint.clear();
+}
+
+void CNetClientTurnManager::GetRejoinState(std::string& out)
+{
+	if (!m_RejoinCheckpoint.empty())
+	{
+		LOGMESSAGE(L"Sending game checkpoint from turn %u for rejoining player", m_RejoinCheckpointTurn);
+		out = m_RejoinCheckpoint;
+		return;
+	}
+
+	LOGMESSAGERENDER(L"Serializing game at turn %u for rejoining player", m_CurrentTurn);
+	SerializeRejoinState(out);
+}
+
+void CNetClientTurnManager::SerializeRejoinState(std::string& out)
+{
+	std::stringstream stream;
+
+	u32 turn = to_le32(m_CurrentTurn);
+	stream.write((char*)&turn, sizeof(turn));
+
+	bool ok = m_Simulation2.SerializeState(stream);
+	ENSURE(ok);
+
+	// Compress the content with zlib to save bandwidth
+	// (TODO: if this is still too large, compressing with e.g. LZMA works much better)
+	CompressZLib(stream.str(), out, true);
 }
 
 void CNetClientTurnManager::OnSimulationMessage(CSimulationMessage* msg)
@@ -434,6 +564,11 @@ CNetLocalTurnManager::CNetLocalTurnManager(CSimulation2& simulation, IReplayLogg
 
 void CNetLocalTurnManager::PostCommand(CScriptValRooted data)
 {
+	// Drop the previous command if this makes it redundant
+	std::vector<SimulationCommand>& queued = m_QueuedCommands[0][m_ClientId];
+	if (!queued.empty() && queued.back().player == m_PlayerId && CommandSupersedes(data, queued.back().data))
+		queued.pop_back();
+
 	// Add directly to the next turn, ignoring COMMAND_DELAY,
 	// because we don't need to compensate for network latency
 	AddCommand(m_ClientId, m_PlayerId, data, m_CurrentTurn + 1);
@@ -466,7 +601,8 @@ void CNetLocalTurnManager::OnSimulationMessage(CSimulationMessage* UNUSED(msg))
 
 
 CNetServerTurnManager::CNetServerTurnManager(CNetServerWorker& server) :
-	m_NetServer(server), m_ReadyTurn(1), m_TurnLength(DEFAULT_TURN_LENGTH_MP)
+	m_NetServer(server), m_ReadyTurn(1), m_TurnLength(DEFAULT_TURN_LENGTH_MP),
+	m_AdaptiveTurnLength(false), m_MinTurnLength(0), m_MaxTurnLength(0), m_SmoothedTurnLength(DEFAULT_TURN_LENGTH_MP)
 {
 	// The first turn we will actually execute is number 2,
 	// so store dummy values into the saved lengths list
@@ -502,6 +638,9 @@ void CNetServerTurnManager::CheckClientsReady()
 	// Advance the turn
 	++m_ReadyTurn;
 
+	if (m_AdaptiveTurnLength)
+		UpdateAdaptiveTurnLength();
+
 	NETTURN_LOG((L"CheckClientsReady: ready for turn %d\n", m_ReadyTurn));
 
 	// Tell all clients that the next turn is ready
@@ -515,12 +654,18 @@ void CNetServerTurnManager::CheckClientsReady()
 	m_SavedTurnLengths.push_back(m_TurnLength);
 }
 
-void CNetServerTurnManager::NotifyFinishedClientUpdate(int client, u32 turn, const std::string& hash)
+void CNetServerTurnManager::NotifyFinishedClientUpdate(int client, u32 turn, const std::string& hash, u32 simTime)
 {
 	// Clients must advance one turn at a time
 	ENSURE(turn == m_ClientsSimulated[client] + 1);
 	m_ClientsSimulated[client] = turn;
 
+	std::map<int, float>::iterator simTimeIt = m_ClientSimTimes.find(client);
+	if (simTimeIt == m_ClientSimTimes.end())
+		m_ClientSimTimes[client] = (float)simTime;
+	else
+		simTimeIt->second += ((float)simTime - simTimeIt->second) * SIM_TIME_SMOOTHING;
+
 	m_ClientStateHashes[turn][client] = hash;
 
 	// Find the newest turn which we know all clients have simulated
@@ -578,15 +723,67 @@ void CNetServerTurnManager::UninitialiseClient(int client)
 	ENSURE(m_ClientsReady.find(client) != m_ClientsReady.end());
 	m_ClientsReady.erase(client);
 	m_ClientsSimulated.erase(client);
+	m_ClientRTTs.erase(client);
+	m_ClientSimTimes.erase(client);
 
 	// Check whether we're ready for the next turn now that we're not
 	// waiting for this client any more
 	CheckClientsReady();
 }
 
+void CNetServerTurnManager::SetClientRTT(int client, u32 rtt)
+{
+	// Ignore observers and clients that haven't joined the game yet
+	if (m_ClientsReady.find(client) == m_ClientsReady.end())
+		return;
+
+	m_ClientRTTs[client] = rtt;
+}
+
 void CNetServerTurnManager::SetTurnLength(u32 msecs)
 {
 	m_TurnLength = msecs;
+	m_SmoothedTurnLength = (float)msecs;
+}
+
+void CNetServerTurnManager::EnableAdaptiveTurnLength(u32 minLength, u32 maxLength)
+{
+	ENSURE(0 < minLength && minLength <= maxLength);
+	m_AdaptiveTurnLength = true;
+	m_MinTurnLength = minLength;
+	m_MaxTurnLength = maxLength;
+}
+
+void CNetServerTurnManager::UpdateAdaptiveTurnLength()
+{
+	// Wait until we've heard from the clients, else we'd shrink to the minimum
+	// length at the start of every game
+	if (m_ClientRTTs.empty() || m_ClientSimTimes.empty())
+		return;
+
+	u32 maxRTT = 0;
+	for (std::map<int, u32>::iterator it = m_ClientRTTs.begin(); it != m_ClientRTTs.end(); ++it)
+		maxRTT = std::max(maxRTT, it->second);
+
+	float maxSimTime = 0.f;
+	for (std::map<int, float>::iterator it = m_ClientSimTimes.begin(); it != m_ClientSimTimes.end(); ++it)
+		maxSimTime = std::max(maxSimTime, it->second);
+
+	// Clients send their commands for turn n+COMMAND_DELAY when they start turn n,
+	// and can't start turn n+COMMAND_DELAY until the server has heard from every
+	// client and told them it's ready, so the slowest client's round trip must fit
+	// into COMMAND_DELAY-1 turns. Turns must also be long enough for the slowest
+	// client to keep up with the simulation.
+	float target = std::max((float)maxRTT / (COMMAND_DELAY - 1), maxSimTime) * TURN_LENGTH_HEADROOM;
+	target = clamp(target, (float)m_MinTurnLength, (float)m_MaxTurnLength);
+
+	float rate = (target > m_SmoothedTurnLength ? TURN_LENGTH_INCREASE_RATE : TURN_LENGTH_DECREASE_RATE);
+	m_SmoothedTurnLength += (target - m_SmoothedTurnLength) * rate;
+
+	u32 turnLength = (u32)(m_SmoothedTurnLength / TURN_LENGTH_GRANULARITY + 0.5f) * TURN_LENGTH_GRANULARITY;
+	m_TurnLength = clamp(turnLength, m_MinTurnLength, m_MaxTurnLength);
+
+	NETTURN_LOG((L"UpdateAdaptiveTurnLength: rtt=%u sim=%f target=%f length=%u\n", maxRTT, maxSimTime, target, m_TurnLength));
 }
 
 u32 CNetServerTurnManager::GetSavedTurnLength(u32 turn)
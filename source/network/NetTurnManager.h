@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,9 +18,9 @@
 #ifndef INCLUDED_NETTURNMANAGER
 #define INCLUDED_NETTURNMANAGER
 
+#include "network/TimeWarpBuffer.h"
 #include "simulation2/helpers/SimulationCommand.h"
 
-#include <list>
 #include <map>
 
 class CNetServerWorker;
@@ -122,6 +122,8 @@ public:
 	 * Enables the recording of state snapshots every @p numTurns,
 	 * which can be jumped back to via RewindTimeWarp().
 	 * If @p numTurns is 0 then recording is disabled.
+	 * The oldest snapshots are discarded once they use more than the
+	 * "timewarp.memorylimit" config setting (in MiB).
 	 */
 	void EnableTimeWarpRecording(size_t numTurns);
 
@@ -153,10 +155,19 @@ protected:
 
 	/**
 	 * Returns whether we should compute a complete state hash for the given turn,
-	 * instead of a quick less-complete hash.
+	 * instead of a quick hash that relies on the incrementally-updated component hashes.
 	 */
 	bool TurnNeedsFullHash(u32 turn);
 
+	/**
+	 * Returns whether executing the command @p later straight after @p earlier
+	 * (from the same player, in the same turn) has the same effect as executing
+	 * only @p later, so @p earlier needn't be sent or executed at all.
+	 * That's true for non-queued "walk" and "set-rally-point" orders for
+	 * exactly the same entities, which players tend to spam.
+	 */
+	bool CommandSupersedes(const CScriptValRooted& later, const CScriptValRooted& earlier);
+
 	CSimulation2& m_Simulation2;
 
 	/// The turn that we have most recently executed
@@ -178,13 +189,16 @@ protected:
 	/// add elapsed time increments to until we reach 0).
 	float m_DeltaSimTime;
 
+	/// Real time (in seconds) taken by the most recent simulation update
+	double m_LastUpdateTime;
+
 	bool m_HasSyncError;
 
 	IReplayLogger& m_Replay;
 
 private:
 	size_t m_TimeWarpNumTurns; // 0 if disabled
-	std::list<std::string> m_TimeWarpStates;
+	CTimeWarpBuffer m_TimeWarpStates;
 	std::string m_QuickSaveState; // TODO: should implement a proper disk-based quicksave system
 	std::string m_QuickSaveMetadata;
 };
@@ -201,12 +215,37 @@ public:
 
 	virtual void PostCommand(CScriptValRooted data);
 
+	/**
+	 * Enables keeping a compressed copy of the state every @p numTurns turns,
+	 * which GetRejoinState will return instead of serializing the current state.
+	 * The rejoining client then catches up by simulating the turns since the
+	 * checkpoint, instead of us pausing to serialize when it asks.
+	 * If @p numTurns is 0 then this is disabled.
+	 */
+	void EnableRejoinCheckpoints(u32 numTurns);
+
+	/**
+	 * Returns the zlib-compressed game state to send to a rejoining client
+	 * (prefixed with its little-endian u32 turn number, before compression).
+	 */
+	void GetRejoinState(std::string& out);
+
 protected:
 	virtual void NotifyFinishedOwnCommands(u32 turn);
 
 	virtual void NotifyFinishedUpdate(u32 turn);
 
+	void SerializeRejoinState(std::string& out);
+
 	CNetClient& m_NetClient;
+
+	/// Commands posted for the next turn we'll send commands for. They're only
+	/// sent at the end of the turn, so superseded ones can be dropped first.
+	std::vector<CScriptValRooted> m_PendingCommands;
+
+	u32 m_RejoinCheckpointInterval; // 0 if disabled
+	u32 m_RejoinCheckpointTurn;
+	std::string m_RejoinCheckpoint; // empty if none has been saved yet
 };
 
 /**
@@ -244,7 +283,15 @@ public:
 
 	void NotifyFinishedClientCommands(int client, u32 turn);
 
-	void NotifyFinishedClientUpdate(int client, u32 turn, const std::string& hash);
+	/**
+	 * @param simTime time (in msecs) the client took to simulate the turn
+	 */
+	void NotifyFinishedClientUpdate(int client, u32 turn, const std::string& hash, u32 simTime);
+
+	/**
+	 * Update the latest measured round-trip time (in msecs) between the server and the client.
+	 */
+	void SetClientRTT(int client, u32 rtt);
 
 	/**
 	 * Inform the turn manager of a new client who will be sending commands.
@@ -259,6 +306,14 @@ public:
 
 	void SetTurnLength(u32 msecs);
 
+	/**
+	 * Automatically adjust the turn length between @p minLength and @p maxLength
+	 * msecs, based on the clients' round-trip times and simulation times: it gets
+	 * shorter on fast networks to reduce the input latency, and longer when
+	 * the network or a client is too slow to keep up (to avoid stalling).
+	 */
+	void EnableAdaptiveTurnLength(u32 minLength, u32 maxLength);
+
 	/**
 	 * Returns the latest turn for which all clients are ready;
 	 * they will have already been told to execute this turn.
@@ -274,6 +329,11 @@ public:
 protected:
 	void CheckClientsReady();
 
+	/**
+	 * Moves m_TurnLength towards the length the clients currently need.
+	 */
+	void UpdateAdaptiveTurnLength();
+
 	/// The latest turn for which we have received all commands from all clients
 	u32 m_ReadyTurn;
 
@@ -290,6 +350,18 @@ protected:
 	// Current turn length
 	u32 m_TurnLength;
 
+	// Adaptive turn length settings (only used if m_AdaptiveTurnLength)
+	bool m_AdaptiveTurnLength;
+	u32 m_MinTurnLength;
+	u32 m_MaxTurnLength;
+	float m_SmoothedTurnLength; // unrounded value of m_TurnLength
+
+	// Client ID -> latest round-trip time (msecs)
+	std::map<int, u32> m_ClientRTTs;
+
+	// Client ID -> smoothed time taken to simulate a turn (msecs)
+	std::map<int, float> m_ClientSimTimes;
+
 	// Turn lengths for all previously executed turns
 	std::vector<u32> m_SavedTurnLengths;
 
@@ -0,0 +1,161 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "precompiled.h"
+
+#include "TimeWarpBuffer.h"
+
+#include "ps/Compress.h"
+
+// XORs the bytes of b into a (ignoring any bytes beyond the end of a)
+static void XorInto(std::string& a, const std::string& b)
+{
+	size_t len = std::min(a.size(), b.size());
+	for (size_t i = 0; i < len; ++i)
+		a[i] ^= b[i];
+}
+
+CTimeWarpBuffer::CTimeWarpBuffer(size_t memoryLimit) :
+	m_MemoryLimit(memoryLimit), m_MemoryUsed(0)
+{
+}
+
+void CTimeWarpBuffer::SetMemoryLimit(size_t memoryLimit)
+{
+	m_MemoryLimit = memoryLimit;
+	Trim();
+}
+
+void CTimeWarpBuffer::Clear()
+{
+	m_Snapshots.clear();
+	m_Keyframe.clear();
+	m_MemoryUsed = 0;
+}
+
+size_t CTimeWarpBuffer::GetMemoryUsage() const
+{
+	return m_MemoryUsed + m_Keyframe.size();
+}
+
+void CTimeWarpBuffer::PushBack(const std::string& state)
+{
+	if (m_Snapshots.empty())
+	{
+		PushKeyframe(state);
+		return;
+	}
+
+	// (The delta has the same length as the new state, so it's recorded
+	// in the length header)
+	std::string delta = state;
+	XorInto(delta, m_Keyframe);
+
+	Snapshot snapshot;
+	snapshot.keyframe = false;
+	CompressZLib(delta, snapshot.data, true);
+
+	// Once the state has diverged too far from the keyframe, start a new one
+	// (that's cheaper to store and quicker to rewind to)
+	size_t keyframeSize = 0;
+	for (std::deque<Snapshot>::reverse_iterator it = m_Snapshots.rbegin(); it != m_Snapshots.rend(); ++it)
+	{
+		if (it->keyframe)
+		{
+			keyframeSize = it->data.size();
+			break;
+		}
+	}
+	if (snapshot.data.size() > keyframeSize / 2)
+	{
+		PushKeyframe(state);
+		return;
+	}
+
+	m_MemoryUsed += snapshot.data.size();
+	m_Snapshots.push_back(snapshot);
+	Trim();
+}
+
+void CTimeWarpBuffer::PushKeyframe(const std::string& state)
+{
+	Snapshot snapshot;
+	snapshot.keyframe = true;
+	CompressZLib(state, snapshot.data, true);
+
+	m_Keyframe = state;
+	m_MemoryUsed += snapshot.data.size();
+	m_Snapshots.push_back(snapshot);
+	Trim();
+}
+
+bool CTimeWarpBuffer::PopBack(std::string& state)
+{
+	if (m_Snapshots.empty())
+		return false;
+
+	bool keyframe = m_Snapshots.back().keyframe;
+	if (keyframe)
+	{
+		state = m_Keyframe;
+	}
+	else
+	{
+		DecompressZLib(m_Snapshots.back().data, state, true);
+		XorInto(state, m_Keyframe);
+	}
+
+	m_MemoryUsed -= m_Snapshots.back().data.size();
+	m_Snapshots.pop_back();
+
+	// If we've removed the newest keyframe, restore the previous one
+	// (which the remaining deltas are relative to)
+	if (keyframe)
+	{
+		m_Keyframe.clear();
+		for (std::deque<Snapshot>::reverse_iterator it = m_Snapshots.rbegin(); it != m_Snapshots.rend(); ++it)
+		{
+			if (it->keyframe)
+			{
+				DecompressZLib(it->data, m_Keyframe, true);
+				break;
+			}
+		}
+	}
+
+	return true;
+}
+
+void CTimeWarpBuffer::Trim()
+{
+	// Discard the oldest keyframe and its deltas until we're within the
+	// limit, but always keep the group containing the newest snapshot
+	while (GetMemoryUsage() > m_MemoryLimit)
+	{
+		size_t groupSize = 1;
+		while (groupSize < m_Snapshots.size() && !m_Snapshots[groupSize].keyframe)
+			++groupSize;
+
+		if (groupSize == m_Snapshots.size())
+			break;
+
+		for (size_t i = 0; i < groupSize; ++i)
+		{
+			m_MemoryUsed -= m_Snapshots.front().data.size();
+			m_Snapshots.pop_front();
+		}
+	}
+}
@@ -0,0 +1,86 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef INCLUDED_TIMEWARPBUFFER
+#define INCLUDED_TIMEWARPBUFFER
+
+#include <deque>
+
+/**
+ * Stores a sequence of serialized simulation states for time warp (rewinding),
+ * within a fixed memory budget.
+ *
+ * Most snapshots are stored as a compressed delta (XOR) against the most recent
+ * keyframe, since consecutive states tend to have mostly identical bytes at the
+ * same offsets. A new keyframe is started whenever the delta would no longer
+ * be much smaller than a keyframe. When the budget is exceeded, the oldest
+ * keyframe and its deltas are discarded.
+ */
+class CTimeWarpBuffer
+{
+	NONCOPYABLE(CTimeWarpBuffer);
+
+public:
+	/**
+	 * @param memoryLimit maximum total size (in bytes) of the stored snapshots.
+	 * (The newest snapshot is always kept, even if it's larger than this.)
+	 */
+	CTimeWarpBuffer(size_t memoryLimit);
+
+	void SetMemoryLimit(size_t memoryLimit);
+
+	void Clear();
+
+	bool Empty() const { return m_Snapshots.empty(); }
+	size_t GetNumSnapshots() const { return m_Snapshots.size(); }
+
+	/**
+	 * Returns the number of bytes used by the stored snapshots.
+	 */
+	size_t GetMemoryUsage() const;
+
+	/**
+	 * Adds a new snapshot, discarding old ones if necessary.
+	 */
+	void PushBack(const std::string& state);
+
+	/**
+	 * Removes the newest snapshot and stores it in @p state.
+	 * Returns false if there were no snapshots.
+	 */
+	bool PopBack(std::string& state);
+
+private:
+	struct Snapshot
+	{
+		bool keyframe;
+		std::string data; // compressed, with a length header
+	};
+
+	void Trim();
+	void PushKeyframe(const std::string& state);
+
+	size_t m_MemoryLimit;
+	size_t m_MemoryUsed; // total size of m_Snapshots's data
+
+	// The oldest snapshot is always a keyframe
+	std::deque<Snapshot> m_Snapshots;
+
+	// Uncompressed copy of the newest keyframe, for computing deltas
+	std::string m_Keyframe;
+};
+
+#endif // INCLUDED_TIMEWARPBUFFER
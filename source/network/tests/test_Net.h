@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -28,9 +28,11 @@
 #include "ps/Game.h"
 #include "ps/Filesystem.h"
 #include "ps/Loader.h"
+#include "ps/Replay.h"
 #include "ps/XML/Xeromyces.h"
 #include "scriptinterface/ScriptInterface.h"
 #include "simulation2/Simulation2.h"
+#include "simulation2/helpers/SimulationCommand.h"
 
 class TestNetComms : public CxxTest::TestSuite
 {
@@ -131,6 +133,183 @@ public:
 		}
 	}
 
+	static double percentile(const std::vector<double>& sorted, double fraction)
+	{
+		if (sorted.empty())
+			return 0.0;
+		return sorted[std::min((size_t)(fraction * sorted.size()), sorted.size() - 1)];
+	}
+
+	/**
+	 * Plays a game for @p duration seconds, between a server and the given numbers of
+	 * player and observer clients connected over loopback, and prints the distribution
+	 * of the real time between each client's turns, plus the server's bandwidth and
+	 * the fraction of the time its thread was busy.
+	 * If @p replayTurns isn't empty, each player posts the commands of the same player
+	 * from the replay; otherwise each player posts @p commandsPerTurn dummy commands
+	 * with @p commandSize bytes of padding every turn.
+	 * (All the clients run their simulations in this thread, so with lots of clients
+	 * the turn intervals include the time taken by the other clients' turns.)
+	 */
+	void run_stress(ScriptInterface& scriptInterface, const CScriptValRooted& attrs,
+		const std::vector<std::vector<SimulationCommand> >& replayTurns,
+		size_t numPlayers, size_t numObservers, u32 turnLength, double duration,
+		size_t commandsPerTurn, size_t commandSize)
+	{
+		// Commands are executed this many turns after they're posted
+		// (this must match COMMAND_DELAY in NetTurnManager.cpp)
+		const u32 commandDelay = 2;
+
+		std::vector<CGame*> games;
+		std::vector<CNetClient*> clients;
+
+		CNetServer server;
+		server.SetMaxObservers((int)numObservers);
+		server.UpdateGameAttributes(attrs.get(), scriptInterface);
+		server.SetTurnLength(turnLength);
+
+		for (size_t j = 0; j < numPlayers + numObservers; ++j)
+		{
+			games.push_back(new CGame(true));
+			clients.push_back(new CNetClient(games.back()));
+			clients.back()->SetUserName(L"client" + CStrW::FromUInt((unsigned int)j));
+		}
+
+		connect(server, clients);
+
+		for (size_t j = numPlayers; j < clients.size(); ++j)
+			server.AssignPlayer(-1, clients[j]->GetGUID());
+		wait(clients, 500);
+
+		server.StartGame();
+		SDL_Delay(100);
+		for (size_t j = 0; j < clients.size(); ++j)
+		{
+			clients[j]->Poll();
+			TS_ASSERT_OK(LDR_NonprogressiveLoad());
+			clients[j]->LoadFinished();
+		}
+
+		const CNetServer::SLoadStats startStats = server.GetLoadStats();
+		const double startTime = timer_Time();
+
+		std::vector<double> lastTurnTime(clients.size(), 0.0);
+		std::vector<double> intervals;
+		double lastFrameTime = startTime;
+
+		while (lastFrameTime - startTime < duration)
+		{
+			const double now = timer_Time();
+			const float frameLength = (float)(now - lastFrameTime);
+			lastFrameTime = now;
+
+			for (size_t j = 0; j < clients.size(); ++j)
+			{
+				clients[j]->Poll();
+
+				CNetTurnManager* turnManager = games[j]->GetTurnManager();
+				if (!turnManager->Update(frameLength, 1))
+					continue;
+
+				// (The first turn's interval would include the loading time)
+				const double turnTime = timer_Time();
+				if (lastTurnTime[j] != 0.0)
+					intervals.push_back(turnTime - lastTurnTime[j]);
+				lastTurnTime[j] = turnTime;
+
+				if (j >= numPlayers)
+					continue;
+
+				ScriptInterface& clientInterface = clients[j]->GetScriptInterface();
+
+				if (!replayTurns.empty())
+				{
+					// Post the commands that ran in the same turn in the replay
+					const u32 turn = turnManager->GetCurrentTurn() + commandDelay;
+					if (turn >= replayTurns.size())
+						continue;
+					for (size_t i = 0; i < replayTurns[turn].size(); ++i)
+					{
+						if (replayTurns[turn][i].player != games[j]->GetPlayerID())
+							continue;
+						CScriptValRooted cmd(clientInterface.GetContext(),
+							clientInterface.CloneValueFromOtherContext(scriptInterface, replayTurns[turn][i].data.get()));
+						turnManager->PostCommand(cmd);
+					}
+				}
+				else
+				{
+					for (size_t i = 0; i < commandsPerTurn; ++i)
+					{
+						CScriptValRooted cmd;
+						clientInterface.Eval("({type:'debug-print', message:''})", cmd);
+						clientInterface.SetProperty(cmd.get(), "padding", std::string(commandSize, 'x'));
+						turnManager->PostCommand(cmd);
+					}
+				}
+			}
+
+			SDL_Delay(1);
+		}
+
+		const double elapsed = timer_Time() - startTime;
+		const CNetServer::SLoadStats endStats = server.GetLoadStats();
+
+		std::sort(intervals.begin(), intervals.end());
+
+		debug_printf(L"players=%lu observers=%lu turn=%ums: %lu turns, interval ms p50=%.1f p90=%.1f p99=%.1f max=%.1f; "
+			L"server sent %.1f KB/s (%.1f KB/s per client), received %.1f KB/s, busy %.1f%%\n",
+			(unsigned long)numPlayers, (unsigned long)numObservers, turnLength, (unsigned long)intervals.size(),
+			percentile(intervals, 0.5)*1000.0, percentile(intervals, 0.9)*1000.0, percentile(intervals, 0.99)*1000.0,
+			(intervals.empty() ? 0.0 : intervals.back()*1000.0),
+			(endStats.bytesSent - startStats.bytesSent) / 1024.0 / elapsed,
+			(endStats.bytesSent - startStats.bytesSent) / 1024.0 / elapsed / clients.size(),
+			(endStats.bytesReceived - startStats.bytesReceived) / 1024.0 / elapsed,
+			(endStats.busyTime - startStats.busyTime) / elapsed * 100.0);
+
+		for (size_t j = 0; j < clients.size(); ++j)
+		{
+			delete clients[j];
+			delete games[j];
+		}
+	}
+
+	void test_stress_DISABLED()
+	{
+		// Measures the server's capacity, over a range of game sizes.
+		// (Set replayPath to a replay's commands.txt to replay its map and
+		// commands instead of sending dummy commands on the default map.)
+
+		const char* replayPath = "";
+		const double duration = 10.0;
+		const size_t commandsPerTurn = 4;
+		const size_t commandSize = 100;
+
+		const size_t playerCounts[] = { 2, 4, 8 };
+		const size_t observerCounts[] = { 0, 8 };
+		const u32 turnLengths[] = { 200, 500 };
+
+		ScriptInterface scriptInterface("Engine", "Test", ScriptInterface::CreateRuntime());
+		TestLogger logger;
+
+		CScriptValRooted attrs;
+		std::vector<std::vector<SimulationCommand> > replayTurns;
+		if (replayPath[0])
+		{
+			TS_ASSERT(ReadReplayCommands(replayPath, scriptInterface, attrs, replayTurns));
+		}
+		else
+		{
+			scriptInterface.Eval("({mapType:'scenario',map:'_default'})", attrs);
+		}
+
+		for (size_t p = 0; p < ARRAY_SIZE(playerCounts); ++p)
+			for (size_t o = 0; o < ARRAY_SIZE(observerCounts); ++o)
+				for (size_t t = 0; t < ARRAY_SIZE(turnLengths); ++t)
+					run_stress(scriptInterface, attrs, replayTurns, playerCounts[p], observerCounts[o],
+						turnLengths[t], duration, commandsPerTurn, commandSize);
+	}
+
 	void test_basic_DISABLED()
 	{
 		// This doesn't actually test much, it just runs a very quick multiplayer game
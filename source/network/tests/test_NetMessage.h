@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -17,7 +17,10 @@
 
 #include "lib/self_test.h"
 
+#include "lib/external_libraries/enet.h"
+#include "network/NetHost.h"
 #include "network/NetMessage.h"
+#include "ps/CLogger.h"
 
 #include "scriptinterface/ScriptInterface.h"
 
@@ -44,4 +47,45 @@ public:
 		delete msg2;
 		delete[] buf;
 	}
+
+	void test_compressed()
+	{
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+
+		CChatMessage msg;
+		msg.m_GUID = "guid";
+		msg.m_Message = std::wstring(1000, L'x');
+
+		// Small or uncompressed messages are sent as they are
+		ENetPacket* packet = CNetHost::CreatePacket(&msg, false);
+		TS_ASSERT_EQUALS(packet->dataLength, msg.GetSerializedLength());
+		TS_ASSERT_EQUALS(packet->data[0], NMT_CHAT);
+		enet_packet_destroy(packet);
+
+		CChatMessage small;
+		small.m_Message = L"hello";
+		packet = CNetHost::CreatePacket(&small, true);
+		TS_ASSERT_EQUALS(packet->data[0], NMT_CHAT);
+		enet_packet_destroy(packet);
+
+		packet = CNetHost::CreatePacket(&msg, true);
+		TS_ASSERT_EQUALS(packet->data[0], NMT_COMPRESSED);
+		TS_ASSERT_LESS_THAN(packet->dataLength, msg.GetSerializedLength());
+
+		CNetMessage* msg2 = CNetMessageFactory::CreateMessage(packet->data, packet->dataLength, script);
+		TS_ASSERT(msg2);
+		TS_ASSERT_EQUALS(msg2->GetType(), NMT_CHAT);
+		TS_ASSERT_STR_EQUALS(msg2->ToString(), msg.ToString());
+		delete msg2;
+
+		// Corrupt data is rejected
+		{
+			TestLogger logger;
+			packet->data[packet->dataLength - 1] ^= 0xFF;
+			TS_ASSERT(!CNetMessageFactory::CreateMessage(packet->data, packet->dataLength, script));
+			TS_ASSERT(!CNetMessageFactory::CreateMessage(packet->data, 4, script));
+		}
+
+		enet_packet_destroy(packet);
+	}
 };
@@ -0,0 +1,103 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "lib/self_test.h"
+
+#include "network/TimeWarpBuffer.h"
+
+class TestTimeWarpBuffer : public CxxTest::TestSuite
+{
+	// Pseudo-random state, where each version differs slightly from the previous
+	static std::string MakeState(size_t version, size_t size)
+	{
+		std::string state(size, '\0');
+		for (size_t i = 0; i < size; ++i)
+			state[i] = (char)((i * 7919) % 251);
+		for (size_t v = 0; v < version; ++v)
+			state[(v * 7727) % size] += 1;
+		state.resize(size + version % 3); // vary the length a bit too
+		return state;
+	}
+
+public:
+	void test_push_pop()
+	{
+		CTimeWarpBuffer buffer(64*MiB);
+		TS_ASSERT(buffer.Empty());
+
+		for (size_t v = 0; v < 10; ++v)
+			buffer.PushBack(MakeState(v, 10000));
+		TS_ASSERT_EQUALS(buffer.GetNumSnapshots(), (size_t)10);
+
+		std::string state;
+		for (size_t v = 10; v > 0; --v)
+		{
+			TS_ASSERT(buffer.PopBack(state));
+			TS_ASSERT(state == MakeState(v-1, 10000));
+		}
+		TS_ASSERT(buffer.Empty());
+		TS_ASSERT(!buffer.PopBack(state));
+	}
+
+	void test_keyframes()
+	{
+		CTimeWarpBuffer buffer(64*MiB);
+
+		// Interleave unrelated states, which can't be stored as deltas
+		buffer.PushBack(MakeState(0, 10000));
+		buffer.PushBack(MakeState(1, 10000));
+		buffer.PushBack(std::string(5000, 'x'));
+		buffer.PushBack(std::string(5000, 'y'));
+		buffer.PushBack(MakeState(2, 10000));
+
+		std::string state;
+		TS_ASSERT(buffer.PopBack(state));
+		TS_ASSERT(state == MakeState(2, 10000));
+		TS_ASSERT(buffer.PopBack(state));
+		TS_ASSERT(state == std::string(5000, 'y'));
+		buffer.PushBack(MakeState(3, 10000));
+		TS_ASSERT(buffer.PopBack(state));
+		TS_ASSERT(state == MakeState(3, 10000));
+		TS_ASSERT(buffer.PopBack(state));
+		TS_ASSERT(state == std::string(5000, 'x'));
+		TS_ASSERT(buffer.PopBack(state));
+		TS_ASSERT(state == MakeState(1, 10000));
+		TS_ASSERT(buffer.PopBack(state));
+		TS_ASSERT(state == MakeState(0, 10000));
+		TS_ASSERT(buffer.Empty());
+	}
+
+	void test_memory_limit()
+	{
+		CTimeWarpBuffer buffer(100*KiB);
+
+		// Incompressible-ish states that can't share a keyframe
+		for (size_t v = 0; v < 100; ++v)
+		{
+			std::string state(20000, '\0');
+			for (size_t i = 0; i < state.size(); ++i)
+				state[i] = (char)((i * (v + 3) * 2654435761u) >> 13);
+			buffer.PushBack(state);
+			TS_ASSERT_LESS_THAN_EQUALS(buffer.GetMemoryUsage(), (size_t)100*KiB);
+		}
+		TS_ASSERT_LESS_THAN(buffer.GetNumSnapshots(), (size_t)100);
+		TS_ASSERT(!buffer.Empty());
+
+		// The newest state is always kept, even if it's over the limit
+		buffer.SetMemoryLimit(1);
+		TS_ASSERT_EQUALS(buffer.GetNumSnapshots(), (size_t)1);
+	}
+};
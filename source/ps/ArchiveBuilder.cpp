@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,7 +23,12 @@
 #include "graphics/ColladaManager.h"
 #include "lib/tex/tex_codec.h"
 #include "lib/file/archive/archive_zip.h"
+#include "lib/file/archive/codec_zlib.h"
+#include "lib/file/archive/stream.h"
+#include "lib/file/common/trace.h"
 #include "lib/file/vfs/vfs_util.h"
+#include "lib/sysdep/os_cpu.h"
+#include "ps/ThreadPool.h"
 #include "ps/XML/Xeromyces.h"
 
 // Disable "'boost::algorithm::detail::is_classifiedF' : assignment operator could not be generated"
@@ -64,6 +69,77 @@ void CArchiveBuilder::AddBaseMod(const OsPath& mod)
 	m_VFS->Mount(L"", mod/"", VFS_MOUNT_MUST_EXIST);
 }
 
+void CArchiveBuilder::AddAccessTrace(const OsPath& tracePath)
+{
+	PITrace trace = CreateTrace(64*MiB);
+	if (trace->Load(tracePath) != INFO::OK)
+	{
+		debug_printf(L"Failed to load trace %ls\n", tracePath.string().c_str());
+		return;
+	}
+
+	const TraceEntry* entries = trace->Entries();
+	for (size_t i = 0; i < trace->NumEntries(); ++i)
+	{
+		if (entries[i].Action() != TraceEntry::Load)
+			continue;
+
+		// Keep the first access if the file is loaded several times (or was
+		// in an earlier trace)
+		const VfsPath sourcePath = GetSourcePath(entries[i].Pathname());
+		m_AccessOrder.insert(std::make_pair(sourcePath, m_AccessOrder.size()));
+	}
+}
+
+VfsPath CArchiveBuilder::GetSourcePath(const VfsPath& path)
+{
+	std::wstring str = path.string();
+
+	// Loose cache files are in cache/, archived ones aren't
+	if (boost::algorithm::starts_with(str, L"cache/"))
+		str = str.substr(6);
+
+	// Cached files are named like "foo.png.cached.dds" (in archives, see
+	// CCacheLoader::ArchiveCachePath) or "foo.png.0123456789abcdef.dds" (loose,
+	// see CCacheLoader::LooseCachePath), so strip the last two extensions
+	// if the second-last is either of those forms
+	const size_t lastDot = str.find_last_of(L'.');
+	if (lastDot == std::wstring::npos || lastDot == 0)
+		return str;
+	const size_t secondDot = str.find_last_of(L'.', lastDot - 1);
+	if (secondDot == std::wstring::npos || str.find_first_of(L'/', secondDot) != std::wstring::npos)
+		return str;
+
+	const std::wstring tag = str.substr(secondDot + 1, lastDot - secondDot - 1);
+	const bool isHash = (tag.length() == 16 && tag.find_first_not_of(L"0123456789abcdef") == std::wstring::npos);
+	if (tag == L"cached" || isHash)
+		return str.substr(0, secondDot);
+
+	return str;
+}
+
+void CArchiveBuilder::SortFilesByAccessOrder()
+{
+	if (m_AccessOrder.empty())
+		return;
+
+	// Traced files first, in order of access, then all the others in their original order
+	std::vector<std::pair<size_t, VfsPath> > files;
+	files.reserve(m_Files.size());
+	for (size_t i = 0; i < m_Files.size(); ++i)
+	{
+		std::map<VfsPath, size_t>::const_iterator it = m_AccessOrder.find(m_Files[i]);
+		if (it != m_AccessOrder.end())
+			files.push_back(std::make_pair(it->second, m_Files[i]));
+		else
+			files.push_back(std::make_pair(m_AccessOrder.size() + i, m_Files[i]));
+	}
+	std::sort(files.begin(), files.end());
+
+	for (size_t i = 0; i < files.size(); ++i)
+		m_Files[i] = files[i].second;
+}
+
 void CArchiveBuilder::Build(const OsPath& archive, bool compress)
 {
 	// By default we disable zip compression because it significantly hurts download
@@ -75,22 +151,29 @@ void CArchiveBuilder::Build(const OsPath& archive, bool compress)
 
 	PIArchiveWriter writer = CreateArchiveWriter_Zip(archive, noDeflate);
 
+	// Texture conversion and compression are by far the slowest parts,
+	// so spread them over all the processors
+	const size_t numProcessors = std::max(os_cpu_NumProcessors(), (size_t)1);
+
 	// Use CTextureManager instead of CTextureConverter directly,
 	// so it can deal with all the loading of settings.xml files
-	CTextureManager textureManager(m_VFS, true, true);
+	CTextureManager textureManager(m_VFS, true, true, numProcessors);
 
 	CColladaManager colladaManager(m_VFS);
 
-	CXeromyces xero;
+	SortFilesByAccessOrder();
 
+	// Work out what to store (in the order of m_Files), and do the conversions
+	// that must run on this thread. Textures and XML files are converted afterwards,
+	// all together
+	std::vector<Entry> entries;
+	std::vector<VfsPath> textures;
+	std::vector<size_t> textureEntries; // index in entries of each texture
+	std::vector<VfsPath> xmlFiles;
+	std::vector<size_t> xmlEntries; // index in entries of each XMB
 	for (size_t i = 0; i < m_Files.size(); ++i)
 	{
-		Status ret;
-
 		const VfsPath path = m_Files[i];
-		OsPath realPath;
-		ret = m_VFS->GetRealPath(path, realPath);
-		ENSURE(ret == INFO::OK);
 
 		// Compress textures and store the new cached version instead of the original
 		if (boost::algorithm::starts_with(path.string(), L"art/textures/") &&
@@ -100,16 +183,9 @@ void CArchiveBuilder::Build(const OsPath& archive, bool compress)
 			!boost::algorithm::starts_with(path.string(), L"art/textures/terrain/alphamaps/")
 		)
 		{
-			VfsPath cachedPath;
-			debug_printf(L"Converting texture %ls\n", realPath.string().c_str());
-			bool ok = textureManager.GenerateCachedTexture(path, cachedPath);
-			ENSURE(ok);
-
-			OsPath cachedRealPath;
-			ret = m_VFS->GetRealPath(VfsPath("cache")/cachedPath, cachedRealPath);
-			ENSURE(ret == INFO::OK);
-
-			writer->AddFile(cachedRealPath, cachedPath);
+			textureEntries.push_back(entries.size());
+			textures.push_back(path);
+			entries.push_back(Entry()); // filled in once it's been converted
 
 			// We don't want to store the original file too (since it's a
 			// large waste of space), so skip to the next file
@@ -128,48 +204,190 @@ void CArchiveBuilder::Build(const OsPath& archive, bool compress)
 			else
 			{
 				// Unknown type of DAE, just add to archive and continue
-				writer->AddFile(realPath, path);
+				entries.push_back(Entry(path, path));
 				continue;
 			}
 			
 			VfsPath cachedPath;
-			debug_printf(L"Converting model %ls\n", realPath.string().c_str());
+			debug_printf(L"Converting model %ls\n", path.string().c_str());
 			bool ok = colladaManager.GenerateCachedFile(path, type, cachedPath);
 			
 			// The DAE might fail to convert for whatever reason, and in that case
 			//	it can't be used in the game, so we just exclude it
 			//  (alternatively we could throw release blocking errors on useless files)
 			if (ok)
-			{
-				OsPath cachedRealPath;
-				ret = m_VFS->GetRealPath(VfsPath("cache")/cachedPath, cachedRealPath);
-				ENSURE(ret == INFO::OK);
-
-				writer->AddFile(cachedRealPath, cachedPath);
-			}
+				entries.push_back(Entry(VfsPath("cache")/cachedPath, cachedPath));
 
 			// We don't want to store the original file too (since it's a
 			// large waste of space), so skip to the next file
 			continue;
 		}
 
-		debug_printf(L"Adding %ls\n", realPath.string().c_str());
-		writer->AddFile(realPath, path);
+		entries.push_back(Entry(path, path));
 
 		// Also cache XMB versions of all XML files
 		if (path.Extension() == L".xml")
 		{
-			VfsPath cachedPath;
-			debug_printf(L"Converting XML file %ls\n", realPath.string().c_str());
-			bool ok = xero.GenerateCachedXMB(m_VFS, path, cachedPath);
-			ENSURE(ok);
+			xmlEntries.push_back(entries.size());
+			xmlFiles.push_back(path);
+			entries.push_back(Entry()); // filled in once it's been converted
+		}
+	}
+
+	debug_printf(L"Converting %lu XML files\n", (unsigned long)xmlFiles.size());
+	std::vector<VfsPath> cachedXMBs;
+	{
+		CThreadPool threadPool(numProcessors - 1);
+		bool ok = CXeromyces::GenerateCachedXMBs(m_VFS, xmlFiles, cachedXMBs, &threadPool);
+		ENSURE(ok);
+	}
+	for (size_t i = 0; i < xmlFiles.size(); ++i)
+		entries[xmlEntries[i]] = Entry(VfsPath("cache")/cachedXMBs[i], cachedXMBs[i]);
+
+	debug_printf(L"Converting %lu textures\n", (unsigned long)textures.size());
+	std::vector<VfsPath> cachedTextures;
+	bool ok = textureManager.GenerateCachedTextures(textures, cachedTextures);
+	ENSURE(ok);
+	for (size_t i = 0; i < textures.size(); ++i)
+		entries[textureEntries[i]] = Entry(VfsPath("cache")/cachedTextures[i], cachedTextures[i]);
+
+	WriteEntries(writer, entries, noDeflate, numProcessors);
+}
 
-			OsPath cachedRealPath;
-			ret = m_VFS->GetRealPath(VfsPath("cache")/cachedPath, cachedRealPath);
+/**
+ * Loads a batch of files and compresses them, so that this can be done
+ * concurrently while the results are written to the archive in order.
+ */
+class CArchiveBuilder::CompressTask : public CThreadPool::ITask
+{
+public:
+	struct Result
+	{
+		Status ret;
+		shared_ptr<u8> data;
+		size_t size;
+		bool store; // whether to store data uncompressed, instead of cdata
+		std::vector<u8> cdata;
+		size_t csize;
+		u32 checksum;
+	};
+
+	CompressTask(const PIVFS& vfs, const std::vector<Entry>& entries, size_t first, size_t count) :
+		m_VFS(vfs), m_Entries(entries), m_First(first), m_Results(count)
+	{
+	}
+
+	virtual void Run(size_t index)
+	{
+		const Entry& entry = m_Entries[m_First + index];
+		Result& result = m_Results[index];
+
+		result.ret = m_VFS->LoadFile(entry.loadPath, result.data, result.size);
+		if (result.ret != INFO::OK)
+			return;
+
+		// Don't waste time trying to compress files that won't get any smaller
+		result.store = IsArchiveEntryIncompressible(entry.archivePath, result.data.get(), result.size);
+		if (result.store)
+			return;
+
+		PICodec codec = CreateCompressor_ZLibDeflate();
+		result.cdata.resize(codec->MaxOutputSize(result.size));
+		Stream stream(codec);
+		stream.SetOutputBuffer(&result.cdata[0], result.cdata.size());
+		result.ret = stream.Feed(result.data.get(), result.size);
+		if (result.ret == INFO::OK)
+			result.ret = stream.Finish();
+		result.csize = stream.OutSize();
+		result.checksum = stream.Checksum();
+
+		// Fall back to storing the original, if compression didn't help
+		if (result.csize >= result.size)
+		{
+			result.store = true;
+			std::vector<u8>().swap(result.cdata);
+		}
+		else
+		{
+			// The uncompressed data isn't needed any more
+			result.data.reset();
+		}
+	}
+
+	Result& GetResult(size_t index)
+	{
+		return m_Results[index];
+	}
+
+private:
+	PIVFS m_VFS;
+	const std::vector<Entry>& m_Entries;
+	size_t m_First;
+	std::vector<Result> m_Results;
+};
+
+void CArchiveBuilder::WriteEntries(const PIArchiveWriter& writer, const std::vector<Entry>& entries, bool noDeflate, size_t numThreads)
+{
+	if (noDeflate)
+	{
+		// Nothing to compress, so just copy the files
+		for (size_t i = 0; i < entries.size(); ++i)
+		{
+			OsPath realPath;
+			Status ret = m_VFS->GetRealPath(entries[i].loadPath, realPath);
 			ENSURE(ret == INFO::OK);
 
-			writer->AddFile(cachedRealPath, cachedPath);
+			debug_printf(L"Adding %ls\n", realPath.string().c_str());
+			writer->AddFile(realPath, entries[i].archivePath);
+		}
+		return;
+	}
+
+	// Compress batches of files in parallel (the calling thread helps too),
+	// then write each batch in order so the archive doesn't depend on the
+	// scheduling. Batches are limited in total size, to bound memory usage
+	const size_t maxBatchSize = 64*MiB;
+	const size_t maxBatchFiles = 256;
+
+	CThreadPool threadPool(numThreads - 1);
+
+	size_t first = 0;
+	while (first < entries.size())
+	{
+		std::vector<time_t> mtimes;
+		size_t batchSize = 0;
+		size_t count = 0;
+		while (first + count < entries.size() && count < maxBatchFiles && (count == 0 || batchSize < maxBatchSize))
+		{
+			FileInfo fileInfo;
+			Status ret = m_VFS->GetFileInfo(entries[first + count].loadPath, &fileInfo);
+			ENSURE(ret == INFO::OK);
+			batchSize += fileInfo.Size();
+			mtimes.push_back(fileInfo.MTime());
+			++count;
 		}
+
+		CompressTask task(m_VFS, entries, first, count);
+		threadPool.ParallelFor(task, count);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const Entry& entry = entries[first + i];
+			CompressTask::Result& result = task.GetResult(i);
+			if (result.ret != INFO::OK)
+			{
+				debug_printf(L"Failed to compress %ls\n", entry.loadPath.string().c_str());
+				continue;
+			}
+
+			debug_printf(L"Adding %ls\n", entry.loadPath.string().c_str());
+			if (result.store)
+				writer->AddStoredMemory(result.data.get(), result.size, mtimes[i], entry.archivePath);
+			else
+				writer->AddCompressedMemory(&result.cdata[0], result.csize, result.size, result.checksum, mtimes[i], entry.archivePath);
+		}
+
+		first += count;
 	}
 }
 
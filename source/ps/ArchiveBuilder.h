@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,6 +18,7 @@
 #ifndef INCLUDED_ARCHIVEBUILDER
 #define INCLUDED_ARCHIVEBUILDER
 
+#include "lib/file/archive/archive.h"
 #include "lib/file/vfs/vfs.h"
 #include "ps/CStr.h"
 
@@ -49,6 +50,17 @@ public:
 	 */
 	void AddBaseMod(const OsPath& mod);
 
+	/**
+	 * Order the files in the archive by when they were first accessed in
+	 * the given trace (as recorded by running the game with -vfstrace),
+	 * so that loading them later becomes a mostly sequential read.
+	 * Files that aren't in the trace are stored after all the others.
+	 * Can be called several times to combine traces (e.g. of startup and
+	 * of loading a map); earlier traces take precedence.
+	 * @param trace path of the trace file
+	 */
+	void AddAccessTrace(const OsPath& trace);
+
 	/**
 	 * Do all the processing and packing of files into the archive.
 	 * @param archive path of .zip file to generate (will be overwritten if it exists)
@@ -57,10 +69,46 @@ public:
 	void Build(const OsPath& archive, bool compress);
 
 private:
+	/**
+	 * A file to be stored in the archive.
+	 */
+	struct Entry
+	{
+		Entry() { }
+		Entry(const VfsPath& loadPath, const VfsPath& archivePath) :
+			loadPath(loadPath), archivePath(archivePath)
+		{
+		}
+
+		VfsPath loadPath; // where to load it from (in m_VFS)
+		VfsPath archivePath; // its name in the archive
+	};
+
+	class CompressTask;
+
+	/**
+	 * Adds the given files to the archive, in order, compressing them
+	 * (unless noDeflate) on numThreads threads.
+	 */
+	void WriteEntries(const PIArchiveWriter& writer, const std::vector<Entry>& entries, bool noDeflate, size_t numThreads);
+
 	static Status CollectFileCB(const VfsPath& pathname, const FileInfo& fileInfo, const uintptr_t cbData);
 
+	/**
+	 * Returns the path of the source file that the given path (as loaded by
+	 * the game) was generated from, i.e. without the "cache/" prefix and
+	 * cache extensions, or the path itself if it's not a cached file.
+	 */
+	static VfsPath GetSourcePath(const VfsPath& path);
+
+	/**
+	 * Sorts m_Files by m_AccessOrder (if any traces were added).
+	 */
+	void SortFilesByAccessOrder();
+
 	PIVFS m_VFS;
 	std::vector<VfsPath> m_Files;
+	std::map<VfsPath, size_t> m_AccessOrder; // source file path -> index of first access
 	OsPath m_TempDir;
 };
 
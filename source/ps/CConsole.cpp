@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -178,8 +178,8 @@ void CConsole::Render()
 
 	PROFILE3_GPU("console");
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	ogl_Enable(GL_BLEND);
+	ogl_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	CShaderTechniquePtr solidTech = g_Renderer.GetShaderManager().LoadEffect("gui_solid");
 	solidTech->BeginPass();
@@ -209,7 +209,7 @@ void CConsole::Render()
 
 	textTech->EndPass();
 
-	glDisable(GL_BLEND);
+	ogl_Disable(GL_BLEND);
 }
 
 
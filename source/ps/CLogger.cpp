@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -25,6 +25,8 @@
 #include "lib/ogl.h"
 #include "lib/timer.h"
 #include "lib/utf8.h"
+#include "lib/external_libraries/libsdl.h"
+#include "lib/sysdep/cpu.h"
 #include "lib/sysdep/sysdep.h"
 #include "ps/Font.h"
 #include "ps/Profile.h"
@@ -48,6 +50,10 @@ static const size_t RENDER_LIMIT = 20; // maximum messages on screen at once
 
 static const size_t BUFFER_SIZE = 1024;
 
+// Number of times a message can be repeated in a row before the repeats
+// are only counted instead of being output
+static const int MAX_REPEATED_MESSAGES = 5;
+
 extern int g_xres, g_yres;
 
 // Set up a default logger that throws everything away, because that's
@@ -75,6 +81,13 @@ const char* html_header0 =
 
 const char* html_header1 = "</h2>\n";
 
+struct CLogger::QueuedLine
+{
+	QueuedLine* next;
+	std::string html;
+	bool interesting;
+};
+
 CLogger::CLogger()
 {
 	OsPath mainlogPath(psLogDir()/"mainlog.html");
@@ -87,6 +100,11 @@ CLogger::CLogger()
 	m_UseDebugPrintf = true;
 
 	Init();
+
+	// Only the real log files are written in the background, so tests can
+	// check the output immediately
+	m_WriterSem = SDL_CreateSemaphore(0);
+	m_HasWriterThread = (m_WriterSem && pthread_create(&m_WriterThread, NULL, &RunWriterThread, this) == 0);
 }
 
 CLogger::CLogger(std::ostream* mainLog, std::ostream* interestingLog, bool takeOwnership, bool useDebugPrintf)
@@ -108,6 +126,15 @@ void CLogger::Init()
 	m_NumberOfMessages = 0;
 	m_NumberOfErrors = 0;
 	m_NumberOfWarnings = 0;
+
+	m_LastMethod = Normal;
+	m_LastMessageRepeats = 0;
+	m_SkippedRepeats = 0;
+
+	m_QueueHead = NULL;
+	m_HasWriterThread = false;
+	m_WriterSem = NULL;
+	m_StopWriterThread = false;
 	
 	//Write Headers for the HTML documents
 	*m_MainLog << html_header0 << "Main log" << html_header1;
@@ -118,6 +145,23 @@ void CLogger::Init()
 
 CLogger::~CLogger()
 {
+	{
+		CScopeLock lock(m_Mutex);
+		QueueSkippedRepeatsNote();
+	}
+
+	if (m_HasWriterThread)
+	{
+		m_StopWriterThread = true;
+		SDL_SemPost(m_WriterSem);
+		pthread_join(m_WriterThread, NULL);
+	}
+	if (m_WriterSem)
+		SDL_DestroySemaphore(m_WriterSem);
+
+	// Write anything the thread didn't
+	Flush();
+
 	char buffer[128];
 	sprintf_s(buffer, ARRAY_SIZE(buffer), " with %d message(s), %d error(s) and %d warning(s).", m_NumberOfMessages,m_NumberOfErrors,m_NumberOfWarnings);
 
@@ -152,6 +196,110 @@ static std::string ToHTML(const wchar_t* message)
 	return cmessage;
 }
 
+void* CLogger::RunWriterThread(void* data)
+{
+	debug_SetThreadName("logger");
+
+	CLogger* logger = static_cast<CLogger*>(data);
+
+	// Each wakeup writes everything that's been queued so far, so a burst
+	// of messages costs one flush rather than one per message
+	while (SDL_SemWait(logger->m_WriterSem) == 0 && !logger->m_StopWriterThread)
+		logger->Flush();
+
+	return NULL;
+}
+
+void CLogger::Flush()
+{
+	CScopeLock lock(m_StreamMutex);
+	WriteQueuedLines();
+}
+
+void CLogger::WriteQueuedLines()
+{
+	// Take the whole queue at once
+	QueuedLine* head;
+	do
+		head = m_QueueHead;
+	while (!cpu_CAS(&m_QueueHead, head, (QueuedLine*)NULL));
+
+	if (!head)
+		return;
+
+	// Reverse it into the order the lines were queued in
+	QueuedLine* first = NULL;
+	while (head)
+	{
+		QueuedLine* next = head->next;
+		head->next = first;
+		first = head;
+		head = next;
+	}
+
+	bool interesting = false;
+	while (first)
+	{
+		*m_MainLog << first->html;
+		if (first->interesting)
+		{
+			*m_InterestingLog << first->html;
+			interesting = true;
+		}
+
+		QueuedLine* next = first->next;
+		delete first;
+		first = next;
+	}
+
+	m_MainLog->flush();
+	if (interesting)
+		m_InterestingLog->flush();
+}
+
+void CLogger::QueueLine(const std::string& html, bool interesting)
+{
+	QueuedLine* line = new QueuedLine;
+	line->html = html;
+	line->interesting = interesting;
+	do
+		line->next = m_QueueHead;
+	while (!cpu_CAS(&m_QueueHead, line->next, line));
+
+	if (m_HasWriterThread)
+		SDL_SemPost(m_WriterSem);
+	else
+		Flush();
+}
+
+bool CLogger::IsRepeated(ELogMethod method, const wchar_t* message)
+{
+	if (method == m_LastMethod && m_LastMessage == message)
+	{
+		if (++m_LastMessageRepeats <= MAX_REPEATED_MESSAGES)
+			return false;
+		++m_SkippedRepeats;
+		return true;
+	}
+
+	QueueSkippedRepeatsNote();
+	m_LastMethod = method;
+	m_LastMessage = message;
+	m_LastMessageRepeats = 0;
+	return false;
+}
+
+void CLogger::QueueSkippedRepeatsNote()
+{
+	if (m_SkippedRepeats == 0)
+		return;
+
+	char buffer[64];
+	sprintf_s(buffer, ARRAY_SIZE(buffer), "<p>(previous message repeated %d more time(s))</p>\n", m_SkippedRepeats);
+	QueueLine(buffer, m_LastMethod != Normal);
+	m_SkippedRepeats = 0;
+}
+
 void CLogger::WriteMessage(const wchar_t* message, bool doRender = false)
 {
 	std::string cmessage = ToHTML(message);
@@ -159,11 +307,13 @@ void CLogger::WriteMessage(const wchar_t* message, bool doRender = false)
 	CScopeLock lock(m_Mutex);
 
 	++m_NumberOfMessages;
+	if (IsRepeated(Normal, message))
+		return;
+
 //	if (m_UseDebugPrintf)
 //		debug_printf(L"MESSAGE: %ls\n", message);
 
-	*m_MainLog << "<p>" << cmessage << "</p>\n";
-	m_MainLog->flush();
+	QueueLine("<p>" + cmessage + "</p>\n", false);
 	
 	if (doRender)
 	{
@@ -180,15 +330,14 @@ void CLogger::WriteError(const wchar_t* message)
 	CScopeLock lock(m_Mutex);
 
 	++m_NumberOfErrors;
+	if (IsRepeated(Error, message))
+		return;
+
 	if (m_UseDebugPrintf)
 		debug_printf(L"ERROR: %ls\n", message);
 
 	if (g_Console) g_Console->InsertMessage(L"ERROR: %ls", message);
-	*m_InterestingLog << "<p class=\"error\">ERROR: " << cmessage << "</p>\n";
-	m_InterestingLog->flush();
-
-	*m_MainLog << "<p class=\"error\">ERROR: " << cmessage << "</p>\n";
-	m_MainLog->flush();
+	QueueLine("<p class=\"error\">ERROR: " + cmessage + "</p>\n", true);
 
 	PushRenderMessage(Error, message);
 }
@@ -200,15 +349,14 @@ void CLogger::WriteWarning(const wchar_t* message)
 	CScopeLock lock(m_Mutex);
 
 	++m_NumberOfWarnings;
+	if (IsRepeated(Warning, message))
+		return;
+
 	if (m_UseDebugPrintf)
 		debug_printf(L"WARNING: %ls\n", message);
 
 	if (g_Console) g_Console->InsertMessage(L"WARNING: %ls", message);
-	*m_InterestingLog << "<p class=\"warning\">WARNING: " << cmessage << "</p>\n";
-	m_InterestingLog->flush();
-
-	*m_MainLog << "<p class=\"warning\">WARNING: " << cmessage << "</p>\n";
-	m_MainLog->flush();
+	QueueLine("<p class=\"warning\">WARNING: " + cmessage + "</p>\n", true);
 
 	PushRenderMessage(Warning, message);
 }
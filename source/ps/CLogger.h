@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -25,6 +25,8 @@
 
 #include "ps/ThreadUtil.h"
 
+struct SDL_semaphore;
+
 class CLogger;
 extern CLogger* g_Logger;
 
@@ -41,6 +43,14 @@ extern CLogger* g_Logger;
  * - Expected to be constructed/destructed in the main thread.
  * - The message logging functions may be called from any thread
  *   while the object is alive.
+ *
+ * When writing to the normal log files, the logging functions just queue
+ * the HTML text, and a background thread writes and flushes it to the files,
+ * so a burst of messages doesn't stall the thread that logs them. (Loggers
+ * with other streams, e.g. for tests, write synchronously.)
+ * Long runs of identical messages are rate-limited: after a few repeats
+ * they're only counted, and the number of skipped repeats is logged before
+ * the next different message.
  */
 class CLogger
 {
@@ -76,10 +86,32 @@ public:
 
 	// Render recent log messages onto the screen
 	void Render();
+
+	// Write all queued messages to the log files now, instead of waiting for
+	// the background thread (e.g. before displaying an error dialog, in
+	// case the game is about to crash). May be called from any thread.
+	void Flush();
 	
 private:
 	void Init();
 
+	// Returns true if this message has been repeated too many times in a row,
+	// so it should only be counted and not output. Must be called with m_Mutex held.
+	bool IsRepeated(ELogMethod method, const wchar_t* message);
+
+	// Queues a note of how many repeats of the last message were skipped, if any.
+	// Must be called with m_Mutex held.
+	void QueueSkippedRepeatsNote();
+
+	// Writes a line of HTML to the main log (and to the interesting log too,
+	// if @p interesting), or queues it for the writer thread if there is one.
+	void QueueLine(const std::string& html, bool interesting);
+
+	// Writes all the lines from m_QueueHead. Must be called with m_StreamMutex held.
+	void WriteQueuedLines();
+
+	static void* RunWriterThread(void* data);
+
 	void PushRenderMessage(ELogMethod method, const wchar_t* message);
 
 	// Delete old timed-out entries from the list of text to render
@@ -109,8 +141,28 @@ private:
 	std::deque<RenderedMessage> m_RenderMessages;
 	double m_RenderLastEraseTime;
 
+	// The last message, how many times in a row it's been repeated, and
+	// how many of those repeats weren't output
+	ELogMethod m_LastMethod;
+	std::wstring m_LastMessage;
+	int m_LastMessageRepeats;
+	int m_SkippedRepeats;
+
 	// Lock for all state modified by logging commands
 	CMutex m_Mutex;
+
+	// Lines waiting to be written, as a lock-free stack (newest first) so
+	// loggers and the writer thread never block each other
+	struct QueuedLine;
+	QueuedLine* volatile m_QueueHead;
+
+	// Lock for writing to m_MainLog and m_InterestingLog
+	CMutex m_StreamMutex;
+
+	bool m_HasWriterThread;
+	pthread_t m_WriterThread;
+	SDL_semaphore* m_WriterSem; // posted when lines are queued or the thread should stop
+	volatile bool m_StopWriterThread;
 };
 
 /**
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,14 +21,15 @@
 
 #include "lib/fnv_hash.h"
 #include "ps/CLogger.h"
+#include "ps/ThreadUtil.h"
 
 #include <boost/unordered_map.hpp>
 
 class CStrInternInternals
 {
 public:
-	CStrInternInternals(const char* str, size_t len)
-		: data(str, str+len), hash(fnv_hash(str, len))
+	CStrInternInternals(const char* str, size_t len, u32 hash)
+		: data(str, str+len), hash(hash)
 	{
 // 		LOGWARNING(L"New interned string '%hs'", data.c_str());
 	}
@@ -66,13 +67,14 @@ struct StringsKeyProxy
 {
 	const char* str;
 	size_t len;
+	u32 hash; // fnv_hash of str, so it's only computed once per lookup
 };
 
 struct StringsKeyProxyHash
 {
 	size_t operator()(const StringsKeyProxy& key) const
 	{
-		return fnv_hash(key.str, key.len);
+		return key.hash;
 	}
 };
 
@@ -84,31 +86,40 @@ struct StringsKeyProxyEq
 	}
 };
 
-static boost::unordered_map<StringsKey, shared_ptr<CStrInternInternals>, StringsKeyHash> g_Strings;
+typedef boost::unordered_map<StringsKey, shared_ptr<CStrInternInternals>, StringsKeyHash> StringsMap;
 
+// To let several threads intern strings at once, the table is split into
+// shards (selected by the string's hash), each with its own lock
+static const size_t NUM_STRINGS_SHARDS = 16;
+
+struct StringsShard
+{
+	CMutex mutex;
+	StringsMap strings; // protected by mutex
+};
+
+static StringsShard g_StringsShards[NUM_STRINGS_SHARDS];
 
 static CStrInternInternals* GetString(const char* str, size_t len)
 {
-	// g_Strings is not thread-safe, so complain if anyone is using this
-	// type in non-main threads. (If that's desired, g_Strings should be changed
-	// to be thread-safe, preferably without sacrificing performance.)
-	ENSURE(ThreadUtil::IsMainThread());
+	const u32 hash = fnv_hash(str, len);
+	StringsShard& shard = g_StringsShards[hash % NUM_STRINGS_SHARDS];
+
+	CScopeLock lock(shard.mutex);
 
 #if BOOST_VERSION >= 104200
-	StringsKeyProxy proxy = { str, len };
-	boost::unordered_map<StringsKey, shared_ptr<CStrInternInternals> >::iterator it =
-		g_Strings.find(proxy, StringsKeyProxyHash(), StringsKeyProxyEq());
+	StringsKeyProxy proxy = { str, len, hash };
+	StringsMap::iterator it = shard.strings.find(proxy, StringsKeyProxyHash(), StringsKeyProxyEq());
 #else
 	// Boost <= 1.41 doesn't support the new find(), so do a slightly less efficient lookup
-	boost::unordered_map<StringsKey, shared_ptr<CStrInternInternals> >::iterator it =
-		g_Strings.find(str);
+	StringsMap::iterator it = shard.strings.find(StringsKey(str, len));
 #endif
 
-	if (it != g_Strings.end())
+	if (it != shard.strings.end())
 		return it->second.get();
 
-	shared_ptr<CStrInternInternals> internals(new CStrInternInternals(str, len));
-	g_Strings.insert(std::make_pair(internals->data, internals));
+	shared_ptr<CStrInternInternals> internals(new CStrInternInternals(str, len, hash));
+	shard.strings.insert(std::make_pair(internals->data, internals));
 	return internals.get();
 }
 
@@ -122,6 +133,11 @@ CStrIntern::CStrIntern(const char* str)
 	m = GetString(str, strlen(str));
 }
 
+CStrIntern::CStrIntern(const char* str, size_t len)
+{
+	m = GetString(str, len);
+}
+
 CStrIntern::CStrIntern(const std::string& str)
 {
 	m = GetString(str.c_str(), str.length());
@@ -146,3 +162,9 @@ const std::string& CStrIntern::string() const
 {
 	return m->data;
 }
+
+// Define the global interned strings. (This must come after the definition
+// of g_StringsShards, so that's constructed first.)
+#define X(id) CStrIntern str_##id(#id);
+#include "ps/CStrInternStatic.h"
+#undef X
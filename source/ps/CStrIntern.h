@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -32,13 +32,17 @@ class CStrInternInternals;
  * unbounded numbers of strings (e.g. text rendered by gameplay scripts) -
  * it's intended for a small number of short frequently-used strings.
  * 
- * Not thread-safe - only allocate these strings from the main thread.
+ * Strings can be interned from any thread. Constructing a CStrIntern never
+ * allocates memory unless the string hasn't been interned before, but it does
+ * need a hash table lookup, so frequently-used fixed strings should be added
+ * to CStrInternStatic.h instead.
  */
 class CStrIntern
 {
 public:
 	CStrIntern();
 	explicit CStrIntern(const char* str);
+	CStrIntern(const char* str, size_t len);
 	explicit CStrIntern(const std::string& str);
 
 	/**
@@ -83,4 +87,8 @@ private:
 	CStrInternInternals* m;
 };
 
+#define X(id) extern CStrIntern str_##id;
+#include "ps/CStrInternStatic.h"
+#undef X
+
 #endif // INCLUDED_CSTRINTERN
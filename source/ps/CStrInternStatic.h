@@ -0,0 +1,32 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// This file defines global CStrIntern variables, to avoid the cost of
+// interning the same fixed strings every time they're used at runtime.
+//
+// A line like
+//   X(foo)
+// defines a variable str_foo with the value "foo".
+//
+// (There's no include guard; CStrIntern.h/.cpp include this with different
+// definitions of X.)
+
+X(baseTex)
+X(bloom)
+X(minimap)
+X(particle)
+X(particle_solid)
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,7 +20,9 @@
 #include "Compress.h"
 
 #include "lib/byte_order.h"
+#include "lib/external_libraries/libsdl.h"
 #include "lib/external_libraries/zlib.h"
+#include "ps/Profiler2.h"
 
 void CompressZLib(const std::string& data, std::string& out, bool includeLengthHeader)
 {
@@ -61,3 +63,145 @@ void DecompressZLib(const std::string& data, std::string& out, bool includeLengt
 
 	// TODO: better error reporting might be nice
 }
+
+CDeflateStreamBuf::CDeflateStreamBuf(size_t bufferSize) :
+	m_CurrentBuffer(0), m_JobData(NULL), m_JobSize(0), m_JobFinish(false), m_JobPending(false),
+	m_Finished(false), m_UncompressedSize(0), m_Checksum(crc32(0, NULL, 0))
+{
+	m_Buffers[0].resize(bufferSize);
+	m_Buffers[1].resize(bufferSize);
+	setp(&m_Buffers[0][0], &m_Buffers[0][0] + bufferSize);
+
+	m_ZStream = new z_stream;
+	memset(m_ZStream, 0, sizeof(*m_ZStream));
+	// Same settings as CreateCompressor_ZLibDeflate, so the output can be stored in zip files
+	int ret = deflateInit2(m_ZStream, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS, 9, Z_DEFAULT_STRATEGY);
+	ENSURE(ret == Z_OK);
+
+	// Use SDL semaphores since OS X doesn't implement sem_init
+	m_StartSem = SDL_CreateSemaphore(0);
+	ENSURE(m_StartSem);
+	m_DoneSem = SDL_CreateSemaphore(0);
+	ENSURE(m_DoneSem);
+
+	ret = pthread_create(&m_Thread, NULL, &RunThread, this);
+	ENSURE(ret == 0);
+}
+
+CDeflateStreamBuf::~CDeflateStreamBuf()
+{
+	// Make sure the thread has exited (if aborting early, the output is just discarded)
+	Finish();
+	pthread_join(m_Thread, NULL);
+
+	SDL_DestroySemaphore(m_DoneSem);
+	SDL_DestroySemaphore(m_StartSem);
+
+	deflateEnd(m_ZStream);
+	delete m_ZStream;
+}
+
+void CDeflateStreamBuf::Finish()
+{
+	if (m_Finished)
+		return;
+
+	SubmitBuffer(true);
+
+	SDL_SemWait(m_DoneSem);
+	m_JobPending = false;
+	m_Finished = true;
+
+	setp(NULL, NULL);
+}
+
+CDeflateStreamBuf::int_type CDeflateStreamBuf::overflow(int_type c)
+{
+	if (m_Finished)
+		return traits_type::eof();
+
+	SubmitBuffer(false);
+
+	if (!traits_type::eq_int_type(c, traits_type::eof()))
+	{
+		*pptr() = traits_type::to_char_type(c);
+		pbump(1);
+	}
+
+	return traits_type::not_eof(c);
+}
+
+void CDeflateStreamBuf::SubmitBuffer(bool finish)
+{
+	// Wait until the other buffer is free again
+	if (m_JobPending)
+	{
+		PROFILE2("wait for compression");
+		SDL_SemWait(m_DoneSem);
+	}
+
+	// (The semaphores act as memory barriers, so the thread will see
+	// the job and we'll see its output)
+	m_JobData = pbase();
+	m_JobSize = pptr() - pbase();
+	m_JobFinish = finish;
+	m_JobPending = true;
+	SDL_SemPost(m_StartSem);
+
+	m_CurrentBuffer = 1 - m_CurrentBuffer;
+	std::vector<char>& buffer = m_Buffers[m_CurrentBuffer];
+	setp(&buffer[0], &buffer[0] + buffer.size());
+}
+
+void* CDeflateStreamBuf::RunThread(void* data)
+{
+	debug_SetThreadName("deflate");
+	g_Profiler2.RegisterCurrentThread("deflate");
+
+	CDeflateStreamBuf* buf = static_cast<CDeflateStreamBuf*>(data);
+
+	while (SDL_SemWait(buf->m_StartSem) == 0)
+	{
+		bool finish = buf->m_JobFinish;
+
+		{
+			PROFILE2("compress");
+			buf->Compress(buf->m_JobData, buf->m_JobSize, finish);
+		}
+
+		SDL_SemPost(buf->m_DoneSem);
+
+		if (finish)
+			break;
+	}
+
+	return NULL;
+}
+
+void CDeflateStreamBuf::Compress(const char* data, size_t size, bool finish)
+{
+	m_UncompressedSize += size;
+	m_Checksum = (u32)crc32(m_Checksum, (const Bytef*)data, (uInt)size);
+
+	m_ZStream->next_in = (Bytef*)data;
+	m_ZStream->avail_in = (uInt)size;
+
+	int flush = finish ? Z_FINISH : Z_NO_FLUSH;
+	while (true)
+	{
+		// Make room for at least as much output as the worst case for the input
+		size_t used = m_Output.size();
+		size_t space = std::max((size_t)deflateBound(m_ZStream, m_ZStream->avail_in), (size_t)64*KiB);
+		m_Output.resize(used + space);
+		m_ZStream->next_out = (Bytef*)&m_Output[used];
+		m_ZStream->avail_out = (uInt)space;
+
+		int ret = deflate(m_ZStream, flush);
+		ENSURE(ret == Z_OK || ret == Z_STREAM_END || ret == Z_BUF_ERROR);
+
+		m_Output.resize(used + space - m_ZStream->avail_out);
+
+		if (finish ? (ret == Z_STREAM_END) : (m_ZStream->avail_in == 0 && m_ZStream->avail_out != 0))
+			break;
+	}
+}
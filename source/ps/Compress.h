@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,13 +18,93 @@
 #ifndef INCLUDED_COMPRESS
 #define INCLUDED_COMPRESS
 
+#include "ps/ThreadUtil.h"
+
+#include <streambuf>
+
+struct SDL_semaphore;
+struct z_stream_s;
+
 /**
  * @file
- * Simple (non-streaming) compression functions.
+ * Simple (non-streaming) compression functions, and a streaming compressor.
  */
 
 void CompressZLib(const std::string& data, std::string& out, bool includeLengthHeader);
 
 void DecompressZLib(const std::string& data, std::string& out, bool includeLengthHeader);
 
+/**
+ * Output stream buffer that compresses everything written to it, in the raw
+ * deflate format used by zip archives (see IArchiveWriter::AddCompressedMemory).
+ *
+ * The compression runs on a background thread. Data is written into one buffer
+ * while the previously filled one is being compressed, so the writer only has to
+ * wait when it produces data faster than it can be compressed.
+ *
+ * Usage:
+ * @code
+ * CDeflateStreamBuf buf;
+ * std::ostream stream(&buf);
+ * stream << ...;
+ * buf.Finish();
+ * // use buf.GetCompressed() etc
+ * @endcode
+ */
+class CDeflateStreamBuf : public std::streambuf
+{
+	NONCOPYABLE(CDeflateStreamBuf);
+
+public:
+	CDeflateStreamBuf(size_t bufferSize = 1*MiB);
+	~CDeflateStreamBuf();
+
+	/**
+	 * Compresses any remaining data, and waits for the background thread to finish.
+	 * Nothing must be written to the stream afterwards.
+	 */
+	void Finish();
+
+	// These are only valid after Finish:
+
+	const std::string& GetCompressed() const { return m_Output; }
+	size_t GetUncompressedSize() const { return m_UncompressedSize; }
+	u32 GetChecksum() const { return m_Checksum; } ///< CRC32 of the uncompressed data
+
+protected:
+	virtual int_type overflow(int_type c);
+
+private:
+	static void* RunThread(void* data);
+
+	/**
+	 * Waits for the previous job to finish, then passes the current buffer
+	 * to the background thread and starts filling the other one.
+	 */
+	void SubmitBuffer(bool finish);
+
+	void Compress(const char* data, size_t size, bool finish);
+
+	std::vector<char> m_Buffers[2];
+	size_t m_CurrentBuffer; // index of the buffer being written into
+
+	// Current job (only modified while the background thread is idle)
+	const char* m_JobData;
+	size_t m_JobSize;
+	bool m_JobFinish;
+	bool m_JobPending;
+
+	bool m_Finished;
+
+	// Only accessed by the background thread until Finish has returned
+	z_stream_s* m_ZStream;
+	std::string m_Output;
+	size_t m_UncompressedSize;
+	u32 m_Checksum;
+
+	pthread_t m_Thread;
+	SDL_semaphore* m_StartSem;
+	SDL_semaphore* m_DoneSem;
+};
+
 #endif // INCLUDED_COMPRESS
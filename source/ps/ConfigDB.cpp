@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -32,6 +32,7 @@
 typedef std::map <CStr, CConfigValueSet> TConfigMap;
 TConfigMap CConfigDB::m_Map[CFG_LAST];
 VfsPath CConfigDB::m_ConfigFile[CFG_LAST];
+u32 CConfigDB::m_Generation = 1;
 
 #define GET_NS_PRIVATE(cx, obj) (EConfigNamespace)((intptr_t)JS_GetPrivate(cx, obj) >> 1)
 
@@ -300,6 +301,8 @@ CConfigValue *CConfigDB::CreateValue(EConfigNamespace ns, const CStr& name)
 		return NULL;
 	}
 	
+	++m_Generation;
+
 	CConfigValue *ret=GetValue(ns, name);
 	if (ret) return ret;
 	
@@ -399,6 +402,7 @@ bool CConfigDB::Reload(EConfigNamespace ns)
 	while (next < filebufend);
 	
 	m_Map[ns].swap(newMap);
+	++m_Generation;
 
 	return true;
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -78,6 +78,7 @@ class CConfigDB: public Singleton<CConfigDB>
 {
 	static std::map <CStr, CConfigValueSet> m_Map[];
 	static VfsPath m_ConfigFile[];
+	static u32 m_Generation;
 
 public:
 	// NOTE: Construct the Singleton Object *after* JavaScript init, so that
@@ -121,8 +122,17 @@ public:
 	 *
 	 * Returns a pointer to the value of the newly created config variable, or
 	 * that of the already existing config variable.
+	 * (The caller is expected to modify the value, so this counts as a change
+	 * for GetGeneration.)
 	 */
 	CConfigValue *CreateValue(EConfigNamespace ns, const CStr& name);
+
+	/**
+	 * Returns a number that's incremented whenever any value might have changed
+	 * (by CreateValue or Reload), so cached copies of values can cheaply tell
+	 * when they need to be updated.
+	 */
+	static u32 GetGeneration() { return m_Generation; }
 	
 	/**
 	 * Set the path to the config file used to populate the specified namespace
@@ -181,5 +191,75 @@ STMT(\
 		val->Get##type(destination);\
 )
 
+inline bool GetConfigValueAs(CConfigValue& val, bool& ret) { return val.GetBool(ret); }
+inline bool GetConfigValueAs(CConfigValue& val, int& ret) { return val.GetInt(ret); }
+inline bool GetConfigValueAs(CConfigValue& val, float& ret) { return val.GetFloat(ret); }
+inline bool GetConfigValueAs(CConfigValue& val, CStr& ret) { return val.GetString(ret); }
+
+/**
+ * A config variable that's parsed once and then cached, for code that
+ * reads the same setting frequently (e.g. every frame).
+ * The value is re-read from CConfigDB only when something in the database
+ * has changed, so Get() normally costs just one integer comparison.
+ * T can be bool, int, float or CStr.
+ *
+ * Like the rest of CConfigDB, this must only be used from the main thread.
+ */
+template<typename T>
+class CConfigVar
+{
+public:
+	CConfigVar(EConfigNamespace ns, const CStr& name, const T& defaultValue) :
+		m_Namespace(ns), m_Name(name), m_Default(defaultValue), m_Value(defaultValue), m_Generation(0)
+	{
+	}
+
+	/**
+	 * Returns the current value, or the default if the variable isn't
+	 * defined or can't be parsed.
+	 */
+	const T& Get()
+	{
+		Update();
+		return m_Value;
+	}
+
+	/**
+	 * Re-reads the value if the database might have changed.
+	 * Returns true if the value changed since the previous call (and on the
+	 * first call), so callers can update any state derived from it.
+	 */
+	bool Update()
+	{
+		const u32 generation = CConfigDB::GetGeneration();
+		if (generation == m_Generation)
+			return false;
+
+		const bool first = (m_Generation == 0);
+		m_Generation = generation;
+
+		T value = m_Default;
+		if (CConfigDB::IsInitialised())
+		{
+			CConfigValue* val = g_ConfigDB.GetValue(m_Namespace, m_Name);
+			if (val && !GetConfigValueAs(*val, value))
+				value = m_Default;
+		}
+
+		if (!first && value == m_Value)
+			return false;
+
+		m_Value = value;
+		return true;
+	}
+
+private:
+	EConfigNamespace m_Namespace;
+	CStr m_Name;
+	T m_Default;
+	T m_Value;
+	u32 m_Generation; // CConfigDB generation that m_Value was read in, or 0 if never read
+};
+
 
 #endif
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,6 +24,7 @@
 
 #include "lib/res/h_mgr.h"	// h_reload
 #include "lib/sysdep/dir_watch.h"
+#include "lib/timer.h"
 #include "lib/utf8.h"
 
 
@@ -31,6 +32,24 @@ PIVFS g_VFS;
 
 static std::vector<std::pair<FileReloadFunc, void*> > g_ReloadFuncs;
 
+// Changed files are only reloaded once no more changes have been reported for
+// this long, so that e.g. a VCS update touching thousands of files (or an editor
+// saving a file in several steps) results in a single reload of each file
+static const double HOTLOAD_SETTLE_TIME = 0.25; // seconds
+
+// Maximum time spent on reloading files per call to ReloadChangedFiles;
+// the rest is left for the following calls
+static const double HOTLOAD_TIME_BUDGET = 0.02; // seconds
+
+// Files that have changed but whose changes haven't settled yet (each only once)
+static std::vector<VfsPath> g_ChangedFiles;
+static std::set<VfsPath> g_ChangedFilesSet;
+static double g_LastChangeTime = 0.0;
+
+// Files whose changes have settled and been applied to the VFS,
+// waiting to be reloaded by each hotloadable system
+static std::deque<VfsPath> g_FilesToReload;
+
 bool VfsFileExists(const VfsPath& pathname)
 {
 	return g_VFS->GetFileInfo(pathname, 0) == INFO::OK;
@@ -71,6 +90,8 @@ Status ReloadChangedFiles()
 {
 	PROFILE3("hotload");
 
+	const double time = timer_Time();
+
 	std::vector<DirWatchNotification> notifications;
 	RETURN_STATUS_IF_ERR(dir_watch_Poll(notifications));
 	for(size_t i = 0; i < notifications.size(); i++)
@@ -79,19 +100,50 @@ Status ReloadChangedFiles()
 		{
 			VfsPath pathname;
 			RETURN_STATUS_IF_ERR(g_VFS->GetVirtualPath(notifications[i].Pathname(), pathname));
-			RETURN_STATUS_IF_ERR(g_VFS->RemoveFile(pathname));
-			RETURN_STATUS_IF_ERR(g_VFS->RepopulateDirectory(pathname.Parent()/""));
+			if(g_ChangedFilesSet.insert(pathname).second)
+				g_ChangedFiles.push_back(pathname);
+			g_LastChangeTime = time;
+		}
+	}
+
+	// Once the changes have settled, update the VFS with all of them
+	// before reloading anything (since reloading one file may read others)
+	if(!g_ChangedFiles.empty() && time - g_LastChangeTime >= HOTLOAD_SETTLE_TIME)
+	{
+		std::set<VfsPath> directories;
+		for(size_t i = 0; i < g_ChangedFiles.size(); i++)
+		{
+			RETURN_STATUS_IF_ERR(g_VFS->RemoveFile(g_ChangedFiles[i]));
+			directories.insert(g_ChangedFiles[i].Parent()/"");
+		}
+		for(std::set<VfsPath>::iterator it = directories.begin(); it != directories.end(); ++it)
+			RETURN_STATUS_IF_ERR(g_VFS->RepopulateDirectory(*it));
 
-			// Tell each hotloadable system about this file change:
+		g_FilesToReload.insert(g_FilesToReload.end(), g_ChangedFiles.begin(), g_ChangedFiles.end());
+		g_ChangedFiles.clear();
+		g_ChangedFilesSet.clear();
+	}
 
-			RETURN_STATUS_IF_ERR(g_GUI->ReloadChangedFiles(pathname));
+	// Reload as many files as fit in this call's time budget
+	// (but always at least one, so it keeps making progress)
+	while(!g_FilesToReload.empty())
+	{
+		const VfsPath pathname = g_FilesToReload.front();
+		g_FilesToReload.pop_front();
 
-			for (size_t j = 0; j < g_ReloadFuncs.size(); ++j)
-				g_ReloadFuncs[j].first(g_ReloadFuncs[j].second, pathname);
+		// Tell each hotloadable system about this file change:
 
-			RETURN_STATUS_IF_ERR(h_reload(g_VFS, pathname));
-		}
+		RETURN_STATUS_IF_ERR(g_GUI->ReloadChangedFiles(pathname));
+
+		for (size_t j = 0; j < g_ReloadFuncs.size(); ++j)
+			g_ReloadFuncs[j].first(g_ReloadFuncs[j].second, pathname);
+
+		RETURN_STATUS_IF_ERR(h_reload(g_VFS, pathname));
+
+		if(timer_Time() - time >= HOTLOAD_TIME_BUDGET)
+			break;
 	}
+
 	return INFO::OK;
 }
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -50,6 +50,9 @@ void UnregisterFileReloadFunc(FileReloadFunc func, void* obj);
  * poll for directory change notifications and reload all affected files.
  * must be called regularly (e.g. once a frame), else notifications
  * may be lost.
+ * changes are collected until no more have arrived for a short time, and
+ * each changed file is then reloaded once, spread over several calls if
+ * there are many of them.
  * note: polling is much simpler than asynchronous notifications.
  **/
 extern Status ReloadChangedFiles();
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -53,6 +53,11 @@ bool CFont::HasRGB()
 	return unifont_has_rgb(h);
 }
 
+float CFont::GetSDFSmoothing()
+{
+	return unifont_sdf_smoothing(h);
+}
+
 int CFont::GetLineSpacing()
 {
 	return unifont_linespacing(h);
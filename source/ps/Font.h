@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -32,6 +32,7 @@ public:
 	~CFont();
 
 	bool HasRGB();
+	float GetSDFSmoothing();
 	int GetLineSpacing();
 	int GetHeight();
 	int GetCharacterWidth(wchar_t c);
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -32,8 +32,10 @@
 #include "ps/CConsole.h"
 #include "ps/CLogger.h"
 #include "ps/CStr.h"
+#include "ps/ConfigDB.h"
 #include "ps/Loader.h"
 #include "ps/LoaderThunks.h"
+#include "ps/MemoryStats.h"
 #include "ps/Overlay.h"
 #include "ps/Profile.h"
 #include "ps/Replay.h"
@@ -79,6 +81,21 @@ CGame::CGame(bool disableGraphics):
 
 	m_TurnManager = new CNetLocalTurnManager(*m_Simulation2, GetReplayLogger()); // this will get replaced if we're a net server/client
 
+	// Optionally record the cost of each component's message handlers, for the profiler
+	bool messageStats = false;
+	if (CConfigDB::IsInitialised())
+		CFG_GET_USER_VAL("profiler.messagestats", Bool, messageStats);
+	if (messageStats)
+		m_Simulation2->EnableMessageStats();
+
+	// Optionally let the simulation's script heap grow more (or less) between
+	// GCs than SpiderMonkey's default, trading memory for fewer pauses
+	int gcTriggerFactor = 0;
+	if (CConfigDB::IsInitialised())
+		CFG_GET_USER_VAL("gc.simulation.triggerfactor", Int, gcTriggerFactor);
+	if (gcTriggerFactor >= 100)
+		m_Simulation2->GetScriptInterface().SetGCTriggerFactor(gcTriggerFactor);
+
 	m_Simulation2->LoadDefaultScripts();
 }
 
@@ -126,6 +143,13 @@ void CGame::RegisterInit(const CScriptValRooted& attribs, const std::string& sav
 	std::string mapType;
 	m_Simulation2->GetScriptInterface().GetProperty(attribs.get(), "mapType", mapType);
 
+	if (g_MemoryStatsTable)
+	{
+		std::string mapName;
+		m_Simulation2->GetScriptInterface().GetProperty(attribs.get(), mapType == "random" ? "script" : "map", mapName);
+		g_MemoryStatsTable->ResetPeaks(mapName);
+	}
+
 	LDR_BeginRegistering();
 
 	RegMemFun(m_Simulation2, &CSimulation2::ProgressiveLoad, L"Simulation init", 1000);
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -103,7 +103,10 @@ static void LoadGlobals()
 	CFG_GET_USER_VAL("particles", Bool, g_Particles);
 	CFG_GET_USER_VAL("silhouettes", Bool, g_Silhouettes);
 	CFG_GET_USER_VAL("showsky", Bool, g_ShowSky);
+}
 
+void CONFIG_ApplySoundSettings()
+{
 #if CONFIG2_AUDIO
 	float gain = 0.5f;
 	float musicGain = 0.5f;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -90,4 +90,11 @@ extern CStrW g_CursorName;
 class CmdLineArgs;
 extern void CONFIG_Init(const CmdLineArgs& args);
 
+/**
+ * Applies the config settings to g_SoundManager (if it exists).
+ * (This is separate from CONFIG_Init since the sound manager is created
+ * in the background after loading the config.)
+ */
+extern void CONFIG_ApplySoundSettings();
+
 #endif // INCLUDED_PS_GAMESETUP_CONFIG
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -50,6 +50,7 @@
 #include "maths/scripting/JSInterface_Vector3D.h"
 #include "network/NetServer.h"
 #include "network/NetClient.h"
+#include "network/NetStats.h"
 
 #include "ps/CConsole.h"
 #include "ps/CLogger.h"
@@ -67,17 +68,21 @@
 #include "ps/Hotkey.h"
 #include "ps/Joystick.h"
 #include "ps/Loader.h"
+#include "ps/MemoryStats.h"
 #include "ps/Overlay.h"
 #include "ps/Profile.h"
 #include "ps/ProfileViewer.h"
 #include "ps/Profiler2.h"
+#include "ps/Profiler2Table.h"
 #include "ps/Pyrogenesis.h"	// psSetLogDir
 #include "ps/scripting/JSInterface_Console.h"
+#include "ps/ThreadPool.h"
 #include "ps/TouchInput.h"
 #include "ps/UserReport.h"
 #include "ps/Util.h"
 #include "ps/VideoMode.h"
 #include "ps/World.h"
+#include "ps/XML/Xeromyces.h"
 
 #include "renderer/Renderer.h"
 #include "renderer/VertexBufferManager.h"
@@ -201,11 +206,16 @@ void Render()
 
 	ogl_WarnIfError();
 
-	CStr skystring = "255 0 255";
-	CFG_GET_USER_VAL("skycolor", String, skystring);
-	CColor skycol;
-	GUI<CColor>::ParseString(skystring.FromUTF8(), skycol);
-	g_Renderer.SetClearColor(skycol.AsSColor4ub());
+	// (Only parse the colour when the setting changes, since this is every frame)
+	static CConfigVar<CStr> skyColorVar(CFG_USER, "skycolor", "255 0 255");
+	static SColor4ub skyColor;
+	if (skyColorVar.Update())
+	{
+		CColor skycol;
+		GUI<CColor>::ParseString(skyColorVar.Get().FromUTF8(), skycol);
+		skyColor = skycol.AsSColor4ub();
+	}
+	g_Renderer.SetClearColor(skyColor);
 
 	// prepare before starting the renderer frame
 	if (g_Game && g_Game->IsGameStarted())
@@ -227,7 +237,10 @@ void Render()
 	g_Renderer.RenderTextOverlays();
 
 	if (g_DoRenderGui)
+	{
+		CRenderPassCounter counter(CRenderer::STATE_PASS_GUI);
 		g_GUI->Draw();
+	}
 
 	ogl_WarnIfError();
 
@@ -240,7 +253,7 @@ void Render()
 
 	// Text:
 
- 	glDisable(GL_DEPTH_TEST);
+ 	ogl_Disable(GL_DEPTH_TEST);
 
 	g_Console->Render();
 
@@ -268,8 +281,8 @@ void Render()
 		}
 		else
 		{
-			bool forceGL = false;
-			CFG_GET_USER_VAL("nohwcursor", Bool, forceGL);
+			static CConfigVar<bool> forceGLVar(CFG_USER, "nohwcursor", false);
+			const bool forceGL = forceGLVar.Get();
 
 #if CONFIG2_GLES
 #warning TODO: implement cursors for GLES
@@ -301,7 +314,7 @@ void Render()
 		}
 	}
 
-	glEnable(GL_DEPTH_TEST);
+	ogl_Enable(GL_DEPTH_TEST);
 
 	g_Renderer.EndFrame();
 
@@ -312,6 +325,11 @@ void Render()
 	PROFILE2_ATTR("overlay tris: %d", (int)g_Renderer.GetStats().m_OverlayTris);
 	PROFILE2_ATTR("blend splats: %d", (int)g_Renderer.GetStats().m_BlendSplats);
 	PROFILE2_ATTR("particles: %d", (int)g_Renderer.GetStats().m_Particles);
+	for (int pass = 0; pass < CRenderer::NUM_STATE_PASSES; ++pass)
+	{
+		PROFILE2_ATTR("%s: %d draw calls, %d tris", CRenderer::GetStatePassName((CRenderer::StatePass)pass),
+			(int)g_Renderer.GetStats().m_PassDrawCalls[pass], (int)g_Renderer.GetStats().m_PassTris[pass]);
+	}
 
 	ogl_WarnIfError();
 
@@ -348,6 +366,7 @@ static void RegisterJavascriptInterfaces()
 static void InitScripting()
 {
 	TIMER(L"InitScripting");
+	PROFILE2("init scripting");
 
 	// Create the scripting host.  This needs to be done before the GUI is created.
 	// [7ms]
@@ -408,6 +427,9 @@ static size_t ChooseCacheSize()
 
 ErrorReactionInternal psDisplayError(const wchar_t* UNUSED(text), size_t UNUSED(flags))
 {
+	// Make sure everything's been written to the logs, in case we're about to crash
+	g_Logger->Flush();
+
 	// If we're fullscreen, then sometimes (at least on some particular drivers on Linux)
 	// displaying the error dialog hangs the desktop since the dialog box is behind the
 	// fullscreen window. So we just force the game to windowed mode before displaying the dialog.
@@ -427,9 +449,13 @@ ErrorReactionInternal psDisplayError(const wchar_t* UNUSED(text), size_t UNUSED(
 	return ERI_NOT_IMPLEMENTED;
 }
 
+// If set, file accesses are recorded and saved here on shutdown (-vfstrace=PATH)
+static OsPath g_VfsTracePath;
+
 static void InitVfs(const CmdLineArgs& args)
 {
 	TIMER(L"InitVfs");
+	PROFILE2("init vfs");
 
 	const Paths paths(args);
 
@@ -445,8 +471,12 @@ static void InitVfs(const CmdLineArgs& args)
 	hooks.display_error = psDisplayError;
 	app_hooks_update(&hooks);
 
+	// (the trace can be used to optimise the layout of archives; see CArchiveBuilder)
+	if (args.Has("vfstrace"))
+		g_VfsTracePath = args.Get("vfstrace");
+
 	const size_t cacheSize = ChooseCacheSize();
-	g_VFS = CreateVfs(cacheSize);
+	g_VFS = CreateVfs(cacheSize, !g_VfsTracePath.empty());
 
 	g_VFS->Mount(L"screenshots/", paths.UserData()/"screenshots"/"");
 	g_VFS->Mount(L"saves/", paths.UserData()/"saves"/"", VFS_MOUNT_WATCH);
@@ -467,6 +497,10 @@ static void InitVfs(const CmdLineArgs& args)
 	{
 		size_t priority = i+1;	// mods are higher priority than regular mountings, which default to priority 0
 		size_t flags = VFS_MOUNT_WATCH|VFS_MOUNT_ARCHIVABLE|VFS_MOUNT_MUST_EXIST;
+#if ARCH_AMD64
+		// (there's only enough address space to map the large archives on 64-bit)
+		flags |= VFS_MOUNT_MAP_ARCHIVES;
+#endif
 		OsPath modName(mods[i]);
 		g_VFS->Mount(L"", modLoosePath / modName/"", flags, priority);
 		g_VFS->Mount(L"", modArchivePath / modName/"", flags, priority);
@@ -479,9 +513,12 @@ static void InitVfs(const CmdLineArgs& args)
 
 static void InitPs(bool setup_gui, const CStrW& gui_page, CScriptVal initData)
 {
+	PROFILE2("init ps");
+
 	{
 		// console
 		TIMER(L"ps_console");
+		PROFILE2("init console");
 
 		g_Console->UpdateScreenSize(g_xres, g_yres);
 
@@ -497,6 +534,7 @@ static void InitPs(bool setup_gui, const CStrW& gui_page, CScriptVal initData)
 	// hotkeys
 	{
 		TIMER(L"ps_lang_hotkeys");
+		PROFILE2("init hotkeys");
 		LoadHotkeys();
 	}
 
@@ -509,7 +547,10 @@ static void InitPs(bool setup_gui, const CStrW& gui_page, CScriptVal initData)
 	}
 
 	// GUI uses VFS, so this must come after VFS init.
-	g_GUI->SwitchPage(gui_page, initData);
+	{
+		PROFILE2("init gui page");
+		g_GUI->SwitchPage(gui_page, initData);
+	}
 }
 
 
@@ -562,6 +603,7 @@ static void ShutdownPs()
 static void InitRenderer()
 {
 	TIMER(L"InitRenderer");
+	PROFILE2("init renderer");
 
 	if(g_NoGLS3TC)
 		ogl_tex_override(OGL_TEX_S3TC, OGL_TEX_DISABLE);
@@ -653,8 +695,72 @@ void EndGame()
 }
 
 
+// Parts of the startup that don't depend on anything else that the main
+// thread does are run on a separate thread (once the config is loaded), to
+// shorten the time to the main menu:
+//  - creating the sound manager (opening the OpenAL device can be slow)
+//  - reading the fonts into the file cache, for the console and the GUI
+// (Most of the GUI's XML is already converted in parallel by PrewarmXMB, and
+// hardware detection and shader loading need the main thread's GL context.)
+static pthread_t g_BackgroundInitThread;
+static bool g_BackgroundInitRunning = false;
+static bool g_BackgroundInitSound = false;
+
+static void* BackgroundInitThread(void* UNUSED(data))
+{
+	debug_SetThreadName("background init");
+	g_Profiler2.RegisterCurrentThread("background init");
+
+#if CONFIG2_AUDIO
+	if (g_BackgroundInitSound)
+	{
+		PROFILE2("init sound");
+		CSoundManager::CreateSoundManager();
+	}
+#endif
+
+	{
+		PROFILE2("prefetch fonts");
+		(void)vfs::PrefetchFiles(g_VFS, L"fonts/", 0, vfs::DIR_RECURSIVE);
+	}
+
+	return NULL;
+}
+
+static void StartBackgroundInit()
+{
+	ENSURE(!g_BackgroundInitRunning);
+
+	// (If sound is disabled on the command line, don't bother initialising it
+	// at all; hardware detection may still disable it later)
+	g_BackgroundInitSound = !g_DisableAudio;
+
+	if (pthread_create(&g_BackgroundInitThread, NULL, &BackgroundInitThread, NULL) == 0)
+		g_BackgroundInitRunning = true;
+	else
+		BackgroundInitThread(NULL);
+}
+
+/**
+ * Waits for StartBackgroundInit's work to finish (if it's running), so the
+ * main thread can use the things it initialised.
+ */
+static void FinishBackgroundInit()
+{
+	if (!g_BackgroundInitRunning)
+		return;
+
+	PROFILE2("wait for background init");
+	pthread_join(g_BackgroundInitThread, NULL);
+	g_BackgroundInitRunning = false;
+
+	CONFIG_ApplySoundSettings();
+}
+
 void Shutdown(int UNUSED(flags))
 {
+	FinishBackgroundInit();
+
 	EndGame();
 
 	ShutdownPs(); // Must delete g_GUI before g_ScriptingHost
@@ -704,6 +810,8 @@ void Shutdown(int UNUSED(flags))
 			delete g_SoundManager;
 #endif
 
+		if (!g_VfsTracePath.empty())
+			g_VFS->StoreTrace(g_VfsTracePath);
 		g_VFS.reset();
 
 		// this forcibly frees all open handles (thus preventing real leaks),
@@ -719,7 +827,13 @@ void Shutdown(int UNUSED(flags))
 
 		CNetHost::Deinitialize();
 
+		SAFE_DELETE(g_ThreadPool);
+
 		SAFE_DELETE(g_ScriptStatsTable);
+		SAFE_DELETE(g_Profiler2Table);
+		SAFE_DELETE(g_NetMessageStatsTable);
+		g_Profiler2.SetMemoryStatsTable(NULL);
+		SAFE_DELETE(g_MemoryStatsTable);
 
 		// should be last, since the above use them
 		SAFE_DELETE(g_Logger);
@@ -836,6 +950,8 @@ bool Autostart(const CmdLineArgs& args);
 
 void Init(const CmdLineArgs& args, int UNUSED(flags))
 {
+	PROFILE2("init");
+
 	h_mgr_init();
 
 	// Do this as soon as possible, because it chdirs
@@ -879,15 +995,26 @@ void Init(const CmdLineArgs& args, int UNUSED(flags))
 	g_ScriptStatsTable = new CScriptStatsTable;
 	g_ProfileViewer.AddRootTable(g_ScriptStatsTable);
 
+	g_Profiler2Table = new CProfiler2Table;
+	g_ProfileViewer.AddRootTable(g_Profiler2Table);
 
-#if CONFIG2_AUDIO
-	CSoundManager::CreateSoundManager();
-#endif
+	g_NetMessageStatsTable = new CNetMessageStatsTable;
+	g_ProfileViewer.AddRootTable(g_NetMessageStatsTable);
+
+	g_MemoryStatsTable = new CMemoryStatsTable;
+	g_ProfileViewer.AddRootTable(g_MemoryStatsTable);
+	g_Profiler2.SetMemoryStatsTable(g_MemoryStatsTable);
 
 	InitScripting();	// before GUI
 
 	// g_ConfigDB, command line args, globals
-	CONFIG_Init(args);
+	{
+		PROFILE2("init config");
+		CONFIG_Init(args);
+	}
+
+	// (Sound is initialised here, and finished off in InitGraphics)
+	StartBackgroundInit();
 
 	// Optionally start profiler HTTP output automatically
 	// (By default it's only enabled by a hotkey, for security/performance)
@@ -896,6 +1023,67 @@ void Init(const CmdLineArgs& args, int UNUSED(flags))
 	if (profilerHTTPEnable)
 		g_Profiler2.EnableHTTP();
 
+	// Optionally save all the profiler data to disk, to analyse long games
+	// (convert it with -profile2-convert=logs/profile2.trace)
+	bool profilerCaptureEnable = false;
+	CFG_GET_USER_VAL("profiler2.capture.enable", Bool, profilerCaptureEnable);
+	if (profilerCaptureEnable)
+		g_Profiler2.EnableCapture();
+
+	// Optionally save the profiler data whenever there's a slow frame or
+	// simulation turn (thresholds in msecs, 0 to disable)
+	float hitchFrameThreshold = 0.0f;
+	float hitchTurnThreshold = 0.0f;
+	CFG_GET_USER_VAL("profiler2.hitch.frame", Float, hitchFrameThreshold);
+	CFG_GET_USER_VAL("profiler2.hitch.turn", Float, hitchTurnThreshold);
+	g_Profiler2.EnableHitchDetection(hitchFrameThreshold / 1000.0, hitchTurnThreshold / 1000.0);
+
+	// Optionally record allocation and hardware counters in some regions
+	bool profilerCountersEnable = false;
+	CFG_GET_USER_VAL("profiler2.counters.enable", Bool, profilerCountersEnable);
+	if (profilerCountersEnable)
+		g_Profiler2.EnableCounters();
+
+	// Optionally record per-function script timings for the profiler
+	// (off by default, since it disables the JIT)
+	bool profilerScriptEnable = false;
+	CFG_GET_USER_VAL("profiler2.script.enable", Bool, profilerScriptEnable);
+	ScriptInterface::SetFunctionProfiling(profilerScriptEnable);
+
+	// Set up worker threads for parallelisable work. By default use one thread
+	// per additional physical core, since the main thread will help run the
+	// tasks too, and pin each to its own core so they don't get moved around
+	int numWorkers = (int)CThreadPool::GetDefaultNumWorkers();
+	CFG_GET_USER_VAL("threadpool.workers", Int, numWorkers);
+	numWorkers = Clamp(numWorkers, 0, 32);
+	bool pinWorkers = true;
+	CFG_GET_USER_VAL("threadpool.affinity", Bool, pinWorkers);
+	std::vector<size_t> workerProcessors;
+	if (pinWorkers)
+		workerProcessors = CThreadPool::ChooseProcessors(numWorkers);
+	g_ThreadPool = new CThreadPool(numWorkers, workerProcessors);
+
+	// Optionally run all the parallel work on the main thread instead, e.g. to
+	// compare OOS logs against a normal run
+	bool serialThreadPool = false;
+	CFG_GET_USER_VAL("threadpool.serial", Bool, serialThreadPool);
+	g_ThreadPool->SetSerial(serialThreadPool);
+
+	// Convert the XML files that are always loaded in bulk, all at once across
+	// the thread pool, so the first run after they've changed doesn't have to
+	// convert them one at a time. This only has to check timestamps when the
+	// cache is already up to date
+	bool prewarmXMB = true;
+	CFG_GET_USER_VAL("xmb.prewarm", Bool, prewarmXMB);
+	if (prewarmXMB)
+	{
+		TIMER(L"PrewarmXMB");
+		PROFILE2("prewarm xmb");
+		const wchar_t* prewarmDirectories[] = { L"gui/", L"simulation/templates/", L"art/actors/" };
+		for (size_t i = 0; i < ARRAY_SIZE(prewarmDirectories); ++i)
+			CXeromyces::PrewarmCache(g_VFS, prewarmDirectories[i], g_ThreadPool);
+	}
+
 	if (!g_Quickstart)
 		g_UserReporter.Initialize(); // after config
 
@@ -904,10 +1092,13 @@ void Init(const CmdLineArgs& args, int UNUSED(flags))
 
 void InitGraphics(const CmdLineArgs& args, int flags)
 {
+	PROFILE2("init graphics");
+
 	const bool setup_vmode = (flags & INIT_HAVE_VMODE) == 0;
 
 	if(setup_vmode)
 	{
+		PROFILE2("init video mode");
 		InitSDL();
 
 		if (!g_VideoMode.InitSDL())
@@ -941,6 +1132,9 @@ void InitGraphics(const CmdLineArgs& args, int flags)
 		// file output and very rarely needed.
 	}
 
+	// (Must come before anything uses g_SoundManager)
+	FinishBackgroundInit();
+
 	if(g_DisableAudio)
 	{
 		// speed up startup by disabling all sound
@@ -1016,6 +1210,12 @@ void InitGraphics(const CmdLineArgs& args, int flags)
 		//	(delete game data, switch GUI page, show error, etc.)
 		CancelLoad(CStr(e.what()).FromUTF8());
 	}
+
+	// (timer_Time counts from EarlyInit's timer_LatchStartTime)
+	const double startupTime = timer_Time();
+	PROFILE2_EVENT("startup finished");
+	PROFILE2_ATTR("time since startup: %.3f s", startupTime);
+	LOGMESSAGE(L"Startup took %.3f seconds", startupTime);
 }
 
 void RenderGui(bool RenderingState)
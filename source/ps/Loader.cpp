@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,9 +24,12 @@
 #include <numeric>
 
 #include "lib/timer.h"
+#include "lib/external_libraries/libsdl.h"
 #include "CStr.h"
 #include "Loader.h"
 #include "LoaderThunks.h"
+#include "ps/Profiler2.h"
+#include "ps/ThreadUtil.h"
 
 
 // set by LDR_EndRegistering; may be 0 during development when
@@ -72,10 +75,17 @@ struct LoadRequest
 
 	int estimated_duration_ms;
 
+	// index in background_tasks if this was registered with
+	// LDR_RegisterBackground, else -1.
+	ssize_t background_task;
+
+	// background tasks that must complete before this one is started.
+	std::vector<size_t> dependencies;
+
 	// LDR_Register gets these as parameters; pack everything together.
-	LoadRequest(LoadFunc func_, void* param_, const wchar_t* desc_, int ms_)
+	LoadRequest(LoadFunc func_, void* param_, const wchar_t* desc_, int ms_, ssize_t background_task_)
 		: func(func_), param(param_), description(desc_),
-		  estimated_duration_ms(ms_)
+		  estimated_duration_ms(ms_), background_task(background_task_)
 	{
 	}
 };
@@ -83,6 +93,92 @@ struct LoadRequest
 typedef std::deque<LoadRequest> LoadRequests;
 static LoadRequests load_requests;
 
+
+// state of a task registered with LDR_RegisterBackground. these are only
+// deleted once their threads have been joined.
+struct BackgroundTask
+{
+	LoadFunc func;
+	void* param;
+	CStrW description;
+	int estimated_duration_ms;
+
+	bool started;
+	bool joined;
+	pthread_t thread;
+	SDL_sem* done;	// posted by the thread when func has finished
+	int status;	// return value of func; only valid once done
+	double elapsed_time;
+};
+
+static std::vector<BackgroundTask*> background_tasks;
+
+static void* RunBackgroundTask(void* data)
+{
+	debug_SetThreadName("Loader");
+	g_Profiler2.RegisterCurrentThread("loader");
+
+	BackgroundTask* task = (BackgroundTask*)data;
+	PROFILE2("background load task");
+
+	const double t0 = timer_Time();
+	int status;
+	do
+	{
+		// there's nothing else for this thread to do, so don't bother
+		// splitting the task into timeslices
+		status = task->func(task->param, 100.0);
+	}
+	while(ldr_was_interrupted(status));
+	task->status = status;
+	task->elapsed_time = timer_Time() - t0;
+
+	SDL_SemPost(task->done);
+	return NULL;
+}
+
+static void StartBackgroundTask(BackgroundTask* task)
+{
+	ENSURE(!task->started);
+	task->started = true;
+	task->done = SDL_CreateSemaphore(0);
+	ENSURE(task->done);
+	int ret = pthread_create(&task->thread, NULL, &RunBackgroundTask, task);
+	ENSURE(ret == 0);
+}
+
+// wait up to <timeout> [s] for the task to finish, or forever if <timeout>
+// is negative. returns whether it has finished.
+static bool WaitForBackgroundTask(BackgroundTask* task, double timeout)
+{
+	if(task->joined)
+		return true;
+
+	if(timeout < 0.0)
+		SDL_SemWait(task->done);
+	else if(SDL_SemWaitTimeout(task->done, (Uint32)(timeout*1e3)) != 0)
+		return false;
+
+	pthread_join(task->thread, NULL);
+	SDL_DestroySemaphore(task->done);
+	task->joined = true;
+
+	debug_printf(L"LOADER| completed background %ls in %g ms; estimate was %g ms\n", task->description.c_str(), task->elapsed_time*1e3, task->estimated_duration_ms*1.0);
+	return true;
+}
+
+// wait for any running background tasks, and forget about all of them.
+static void JoinBackgroundTasks()
+{
+	for(size_t i = 0; i < background_tasks.size(); ++i)
+	{
+		if(background_tasks[i]->started)
+			WaitForBackgroundTask(background_tasks[i], -1.0);
+		delete background_tasks[i];
+	}
+	background_tasks.clear();
+}
+
 // std::accumulate binary op; used by LDR_EndRegistering to sum up all
 // estimated durations (for % progress calculation)
 struct DurationAdder: public std::binary_function<double, const LoadRequest&, double>
@@ -104,6 +200,7 @@ void LDR_BeginRegistering()
 
 	state = REGISTERING;
 	load_requests.clear();
+	JoinBackgroundTasks();
 }
 
 
@@ -120,11 +217,49 @@ void LDR_Register(LoadFunc func, void* param, const wchar_t* description,
 {
 	ENSURE(state == REGISTERING);	// must be called between LDR_(Begin|End)Register
 
-	const LoadRequest lr(func, param, description, estimated_duration_ms);
+	const LoadRequest lr(func, param, description, estimated_duration_ms, -1);
 	load_requests.push_back(lr);
 }
 
 
+// register a task that runs on its own thread (later started in FIFO order).
+// see LDR_Register for parameters.
+size_t LDR_RegisterBackground(LoadFunc func, void* param, const wchar_t* description,
+	int estimated_duration_ms)
+{
+	ENSURE(state == REGISTERING);	// must be called between LDR_(Begin|End)Register
+
+	BackgroundTask* task = new BackgroundTask();
+	task->func = func;
+	task->param = param;
+	task->description = description;
+	task->estimated_duration_ms = estimated_duration_ms;
+	task->started = false;
+	task->joined = false;
+	task->status = 0;
+	task->elapsed_time = 0.0;
+	const size_t id = background_tasks.size();
+	background_tasks.push_back(task);
+
+	const LoadRequest lr(func, param, description, estimated_duration_ms, (ssize_t)id);
+	load_requests.push_back(lr);
+	return id;
+}
+
+
+// make the most recently registered task wait for a background task.
+void LDR_AddDependency(size_t background_task)
+{
+	ENSURE(state == REGISTERING);
+	ENSURE(!load_requests.empty());
+	ENSURE(background_task < background_tasks.size());
+	// (tasks can only depend on earlier ones, so there are no cycles)
+	ENSURE(load_requests.back().background_task != (ssize_t)background_task);
+
+	load_requests.back().dependencies.push_back(background_task);
+}
+
+
 // call when finished registering tasks; subsequent calls to
 // LDR_ProgressiveLoad will then work off the queued entries.
 void LDR_EndRegistering()
@@ -148,6 +283,32 @@ void LDR_Cancel()
 	// next LDR_StartRegistering. for now, it is sufficient to set the
 	// state, so that LDR_ProgressiveLoad is a no-op.
 	state = IDLE;
+
+	// background tasks might be using data that the caller is about to
+	// destroy, so they must finish now.
+	JoinBackgroundTasks();
+}
+
+// helper routine for LDR_ProgressiveLoad.
+// waits (for no longer than <time_left>) until all the given background
+// tasks have completed. returns ERR::TIMED_OUT if they haven't, the status of
+// the first one that failed, or 0 on success.
+static Status WaitForBackgroundTasks(const std::vector<size_t>& tasks, double& time_left)
+{
+	for(size_t i = 0; i < tasks.size(); ++i)
+	{
+		BackgroundTask* task = background_tasks[tasks[i]];
+		ENSURE(task->started);
+
+		const double t0 = timer_Time();
+		bool finished = WaitForBackgroundTask(task, std::max(time_left, 0.0));
+		time_left -= timer_Time() - t0;
+		if(!finished)
+			return ERR::TIMED_OUT;
+		if(task->status < 0)
+			return (Status)task->status;
+	}
+	return 0;
 }
 
 // helper routine for LDR_ProgressiveLoad.
@@ -212,11 +373,33 @@ Status LDR_ProgressiveLoad(double time_budget, wchar_t* description, size_t max_
 	if(state != LOADING)
 		return INFO::OK;
 
+	// (in case we have to wait for a background task before anything else
+	// has completed)
+	if(total_estimated_duration != 0.0)
+		progress = estimated_duration_tally / total_estimated_duration;
+
 	while(!load_requests.empty())
 	{
 		// get next task; abort if there's not enough time left for it.
 		const LoadRequest& lr = load_requests.front();
 		const double estimated_duration = lr.estimated_duration_ms*1e-3;
+
+		// the background tasks that it depends on must finish first
+		ret = WaitForBackgroundTasks(lr.dependencies, time_left);
+		if(ret != 0)
+			goto done;
+
+		// start background tasks and move straight on to the next.
+		// (their estimated duration is billed immediately, since there's
+		// no way to tell how far through they are)
+		if(lr.background_task >= 0)
+		{
+			StartBackgroundTask(background_tasks[lr.background_task]);
+			estimated_duration_tally += estimated_duration;
+			load_requests.pop_front();
+			continue;
+		}
+
 		if(!HaveTimeForNextTask(time_left, time_budget, lr.estimated_duration_ms))
 		{
 			ret = ERR::TIMED_OUT;
@@ -280,7 +463,17 @@ Status LDR_ProgressiveLoad(double time_budget, wchar_t* description, size_t max_
 		// .. succeeded; continue and process next queued task.
 	}
 
-	// queue is empty, we just finished.
+	// queue is empty; make sure nothing is still running in the background.
+	{
+		std::vector<size_t> all_tasks;
+		for(size_t i = 0; i < background_tasks.size(); ++i)
+			all_tasks.push_back(i);
+		ret = WaitForBackgroundTasks(all_tasks, time_left);
+		if(ret != 0)
+			goto done;
+	}
+
+	// we just finished.
 	state = IDLE;
 	ret = INFO::ALL_COMPLETE;
 
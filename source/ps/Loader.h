@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -57,6 +57,12 @@ After that, progress is updated: an estimated duration for each task
 As long as task lengths only differ by a constant factor between machines,
 this timing is exact; even if not, only smoothness of update suffers.
 
+Some tasks (e.g. reading and parsing files) don't need anything from the
+main thread. These can be registered with LDR_RegisterBackground, to run on
+their own threads while the main thread carries on with later tasks; tasks
+that need their results declare it with LDR_AddDependency, and wait for
+them (one timeslice at a time) before they're started.
+
 
 Interrupting Lengthy Tasks
 --------------------------
@@ -130,6 +136,24 @@ extern void LDR_Register(LoadFunc func, void* param, const wchar_t* description,
 	int estimated_duration_ms);
 
 
+// register a task that runs on its own thread, so that the following tasks
+// (and the loading screen) don't have to wait for it.
+// it is started when the queue reaches it, and called repeatedly until it
+// has finished (see LoadFunc). it must not use anything that is restricted
+// to the main thread (OpenGL, scripts, the simulation, CStrIntern, the
+// legacy profiler, ...), nor any data that the main thread might be
+// modifying at the same time.
+// other parameters are as for LDR_Register.
+// returns an identifier for LDR_AddDependency.
+extern size_t LDR_RegisterBackground(LoadFunc func, void* param, const wchar_t* description,
+	int estimated_duration_ms);
+
+// make the most recently registered task wait until the given background
+// task has completed (and fail if that failed). loading doesn't complete
+// until all background tasks have completed.
+extern void LDR_AddDependency(size_t background_task);
+
+
 // call when finished registering tasks; subsequent calls to
 // LDR_ProgressiveLoad will then work off the queued entries.
 extern void LDR_EndRegistering();
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -71,6 +71,13 @@ template<class T> void RegMemFun(T* this_, int(T::*func)(void),
 	LDR_Register(MemFunThunk<T>, param, description, estimated_duration_ms);
 }
 
+template<class T> size_t RegMemFunBackground(T* this_, int(T::*func)(void),
+	const wchar_t* description, int estimated_duration_ms)
+{
+	void* param = new MemFun_t<T>(this_, func);
+	return LDR_RegisterBackground(MemFunThunk<T>, param, description, estimated_duration_ms);
+}
+
 
 ////////////////////////////////////////////////////////
 
@@ -0,0 +1,182 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "MemoryStats.h"
+
+#include "graphics/GameView.h"
+#include "graphics/MeshManager.h"
+#include "graphics/ObjectManager.h"
+#include "graphics/SkeletonAnimManager.h"
+#include "graphics/TextureManager.h"
+#include "lib/file/vfs/vfs.h"
+#include "ps/Filesystem.h"
+#include "ps/Game.h"
+#include "ps/Profile.h"
+#include "renderer/Renderer.h"
+#include "renderer/VertexBufferManager.h"
+#include "scriptinterface/ScriptStats.h"
+#include "simulation2/system/ComponentPool.h"
+#include "soundmanager/SoundManager.h"
+
+CMemoryStatsTable* g_MemoryStatsTable = NULL;
+
+CMemoryStatsTable::CMemoryStatsTable()
+{
+	m_Total.name = "total";
+	m_Total.bytes = 0;
+	m_Total.peakBytes = 0;
+
+	m_ColumnDescriptions.push_back(ProfileColumn("Category", 230));
+	m_ColumnDescriptions.push_back(ProfileColumn("KiB", 80));
+	m_ColumnDescriptions.push_back(ProfileColumn("peak KiB", 80));
+}
+
+void CMemoryStatsTable::SetRow(const std::string& name, size_t bytes)
+{
+	m_Total.bytes += bytes;
+
+	for (size_t i = 0; i < m_Rows.size(); ++i)
+	{
+		if (m_Rows[i].name == name)
+		{
+			m_Rows[i].bytes += bytes;
+			m_Rows[i].peakBytes = std::max(m_Rows[i].peakBytes, m_Rows[i].bytes);
+			return;
+		}
+	}
+
+	SRow row = { name, bytes, bytes };
+	m_Rows.push_back(row);
+}
+
+void CMemoryStatsTable::Update()
+{
+	PROFILE3("memory stats");
+
+	CScopeLock lock(m_Mutex);
+
+	// (Subsystems that weren't measured this time, e.g. because the game has
+	// ended, are left with 0 bytes and their old peak)
+	for (size_t i = 0; i < m_Rows.size(); ++i)
+		m_Rows[i].bytes = 0;
+	m_Total.bytes = 0;
+
+	SetRow("simulation: native components", ComponentPoolTotalBytes());
+
+	if (g_ScriptStatsTable)
+	{
+		std::vector<std::pair<std::string, size_t> > runtimes;
+		g_ScriptStatsTable->GetRuntimeBytes(runtimes);
+		for (size_t i = 0; i < runtimes.size(); ++i)
+			SetRow("scripts: " + runtimes[i].first, runtimes[i].second);
+	}
+
+	if (g_VFS)
+		SetRow("file cache", g_VFS->GetCacheSize());
+
+	if (CRenderer::IsInitialised())
+		SetRow("textures (video memory)", g_Renderer.GetTextureManager().GetBytesUploaded());
+
+	SetRow("vertex buffers (video memory)", g_VBMan.GetBytesReserved());
+
+	if (g_Game && g_Game->GetView())
+	{
+		CObjectManager& objectManager = g_Game->GetView()->GetObjectManager();
+		SetRow("meshes", objectManager.GetMeshManager().GetMemoryUsage());
+		SetRow("animations", objectManager.GetSkeletonAnimManager().GetMemoryUsage());
+	}
+
+#if CONFIG2_AUDIO
+	if (g_SoundManager)
+		SetRow("sounds", g_SoundManager->GetMemoryUsage());
+#endif
+
+	m_Total.peakBytes = std::max(m_Total.peakBytes, m_Total.bytes);
+}
+
+void CMemoryStatsTable::ResetPeaks(const std::string& label)
+{
+	CScopeLock lock(m_Mutex);
+
+	m_PeakLabel = label;
+
+	for (size_t i = 0; i < m_Rows.size(); ++i)
+		m_Rows[i].peakBytes = m_Rows[i].bytes;
+	m_Total.peakBytes = m_Total.bytes;
+}
+
+void CMemoryStatsTable::ConstructJSON(std::ostream& stream)
+{
+	CScopeLock lock(m_Mutex);
+
+	stream << "{\"peak_label\":\"" << CStr(m_PeakLabel).EscapeToPrintableASCII() << "\",\n";
+	stream << "\"categories\":[\n";
+	for (size_t i = 0; i <= m_Rows.size(); ++i)
+	{
+		const SRow& row = (i < m_Rows.size() ? m_Rows[i] : m_Total);
+		if (i != 0)
+			stream << ",\n";
+		stream << "{\"name\":\"" << CStr(row.name).EscapeToPrintableASCII() << "\"";
+		stream << ",\"bytes\":" << (u64)row.bytes;
+		stream << ",\"peak_bytes\":" << (u64)row.peakBytes << "}";
+	}
+	stream << "\n]}";
+}
+
+CStr CMemoryStatsTable::GetName()
+{
+	return "memory";
+}
+
+CStr CMemoryStatsTable::GetTitle()
+{
+	if (m_PeakLabel.empty())
+		return "Memory usage";
+	return "Memory usage (peaks since loading " + m_PeakLabel + ")";
+}
+
+size_t CMemoryStatsTable::GetNumberRows()
+{
+	return m_Rows.size() + 1;
+}
+
+const std::vector<ProfileColumn>& CMemoryStatsTable::GetColumns()
+{
+	return m_ColumnDescriptions;
+}
+
+CStr CMemoryStatsTable::GetCellText(size_t row, size_t col)
+{
+	if (row > m_Rows.size())
+		return "???";
+
+	const SRow& r = (row < m_Rows.size() ? m_Rows[row] : m_Total);
+	switch (col)
+	{
+	case 0: return r.name;
+	case 1: return CStr::FromUInt((unsigned)(r.bytes / KiB));
+	case 2: return CStr::FromUInt((unsigned)(r.peakBytes / KiB));
+	default: return "???";
+	}
+}
+
+AbstractProfileTable* CMemoryStatsTable::GetChild(size_t UNUSED(row))
+{
+	return 0;
+}
@@ -0,0 +1,85 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_MEMORYSTATS
+#define INCLUDED_MEMORYSTATS
+
+#include "ps/ProfileViewer.h"
+#include "ps/ThreadUtil.h"
+
+/**
+ * Profiler table of the memory used by the main subsystems (native simulation
+ * components, each JS runtime, the file cache, textures, vertex buffers, meshes,
+ * animations and sounds), with the peak of each since the current map started
+ * loading.
+ *
+ * The subsystems aren't thread-safe, so they're measured by Update on the main
+ * thread once per frame; the peaks are therefore sampled rather than exact.
+ * The numbers are estimates of the subsystems' main data, not of every allocation
+ * (textures and vertex buffers count the video memory they're expected to use).
+ */
+class CMemoryStatsTable : public AbstractProfileTable
+{
+	NONCOPYABLE(CMemoryStatsTable);
+public:
+	CMemoryStatsTable();
+
+	/**
+	 * Measures the current memory usage and updates the peaks.
+	 * Must be called on the main thread.
+	 */
+	void Update();
+
+	/**
+	 * Starts recording new peaks, e.g. when loading a new map.
+	 * @param label the name of the map (reported alongside the peaks)
+	 */
+	void ResetPeaks(const std::string& label);
+
+	/**
+	 * Writes the latest measurements as a JSON object. Can be called from any thread.
+	 */
+	void ConstructJSON(std::ostream& stream);
+
+	virtual CStr GetName();
+	virtual CStr GetTitle();
+	virtual size_t GetNumberRows();
+	virtual const std::vector<ProfileColumn>& GetColumns();
+	virtual CStr GetCellText(size_t row, size_t col);
+	virtual AbstractProfileTable* GetChild(size_t row);
+
+private:
+	struct SRow
+	{
+		std::string name;
+		size_t bytes;
+		size_t peakBytes;
+	};
+
+	void SetRow(const std::string& name, size_t bytes);
+
+	CMutex m_Mutex; // protects everything below, for ConstructJSON
+	std::vector<SRow> m_Rows; // in the order they were first measured
+	SRow m_Total; // (its peak is the peak of the total, not the total of the peaks)
+	std::string m_PeakLabel;
+
+	std::vector<ProfileColumn> m_ColumnDescriptions;
+};
+
+extern CMemoryStatsTable* g_MemoryStatsTable;
+
+#endif // INCLUDED_MEMORYSTATS
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -490,6 +490,10 @@ static long get_memory_alloc_count()
 
 static intptr_t alloc_count = 0;
 
+// Per-thread counts, for profile_GetThreadAllocations
+static __thread u64 alloc_thread_count = 0;
+static __thread u64 alloc_thread_bytes = 0;
+
 // We override the malloc/realloc/calloc/free functions and then use dlsym to
 // defer the actual allocation to the real libc implementation.
 // The dlsym call will (in glibc 2.9/2.10) call calloc once (to allocate an error
@@ -507,6 +511,8 @@ static bool alloc_has_called_dlsym = false;
 void* malloc(size_t sz)
 {
 	cpu_AtomicAdd(&alloc_count, 1);
+	++alloc_thread_count;
+	alloc_thread_bytes += sz;
 
 	static void *(*libc_malloc)(size_t);
 	if (libc_malloc == NULL)
@@ -524,6 +530,8 @@ void* malloc(size_t sz)
 void* realloc(void* ptr, size_t sz)
 {
 	cpu_AtomicAdd(&alloc_count, 1);
+	++alloc_thread_count;
+	alloc_thread_bytes += sz;
 
 	static void *(*libc_realloc)(void*, size_t);
 	if (libc_realloc == NULL)
@@ -541,6 +549,8 @@ void* realloc(void* ptr, size_t sz)
 void* calloc(size_t nm, size_t sz)
 {
 	cpu_AtomicAdd(&alloc_count, 1);
+	++alloc_thread_count;
+	alloc_thread_bytes += nm*sz;
 
 	static void *(*libc_calloc)(size_t, size_t);
 	if (libc_calloc == NULL)
@@ -601,6 +611,20 @@ static long get_memory_alloc_count()
 }
 #endif
 
+#if defined(USE_GLIBC_MALLOC_OVERRIDE)
+bool profile_GetThreadAllocations(u64& count, u64& bytes)
+{
+	count = alloc_thread_count;
+	bytes = alloc_thread_bytes;
+	return true;
+}
+#else
+bool profile_GetThreadAllocations(u64& UNUSED(count), u64& UNUSED(bytes))
+{
+	return false;
+}
+#endif
+
 void CProfileNode::Call()
 {
 	calls_frame_current++;
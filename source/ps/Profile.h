@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -188,6 +188,14 @@ public:
 	}
 };
 
+/**
+ * Get the number of allocations (malloc/calloc/realloc calls) made by the
+ * calling thread so far, and the total number of bytes they requested.
+ * Returns false if allocations aren't being counted (which is currently the
+ * case except in debug builds using glibc).
+ */
+bool profile_GetThreadAllocations(u64& count, u64& bytes);
+
 // Put a PROFILE("xyz") block at the start of all code to be profiled.
 // Profile blocks last until the end of the containing scope.
 #define PROFILE(name) CProfileSample __profile(name)
@@ -201,4 +209,7 @@ public:
 // Also do GPU
 #define PROFILE3_GPU(name) PROFILE(name); PROFILE2(name); PROFILE2_GPU(name)
 
+// Also record allocation and hardware counters, if enabled
+#define PROFILE3_COUNTERS(name) PROFILE(name); PROFILE2_COUNTERS(name)
+
 #endif // INCLUDED_PROFILE
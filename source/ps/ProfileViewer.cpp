@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -163,8 +163,8 @@ void CProfileViewer::RenderProfile()
 
 	PROFILE3_GPU("profile viewer");
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	ogl_Enable(GL_BLEND);
+	ogl_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	AbstractProfileTable* table = m->path[m->path.size() - 1];
 	const std::vector<ProfileColumn>& columns = table->GetColumns();
@@ -314,9 +314,9 @@ void CProfileViewer::RenderProfile()
 	textRenderer.Render();
 	textTech->EndPass();
 
-	glDisable(GL_BLEND);
+	ogl_Disable(GL_BLEND);
 
-	glEnable(GL_DEPTH_TEST);
+	ogl_Enable(GL_DEPTH_TEST);
 }
 
 
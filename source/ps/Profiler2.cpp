@@ -26,20 +26,41 @@
 
 #include "lib/allocators/shared_ptr.h"
 #include "ps/CLogger.h"
+#include "lib/sysdep/perf_counters.h"
 #include "ps/CStr.h"
+#include "ps/MemoryStats.h"
+#include "ps/Profile.h"
+#include "ps/Profiler2Capture.h"
 #include "ps/Profiler2GPU.h"
 #include "third_party/mongoose/mongoose.h"
 
+#include <ctime>
 #include <iomanip>
 
 CProfiler2 g_Profiler2;
 
+// Number of frames to wait after a hitch before saving the snapshot, so it
+// includes the end of the slow frame's regions and its GPU timings (which
+// are only available a few frames later)
+static const int HITCH_SNAPSHOT_DELAY_FRAMES = 4;
+
+// Minimum time between hitch snapshots, and maximum number per session, so a
+// slow computer doesn't fill the disk with them
+static const double HITCH_SNAPSHOT_INTERVAL = 30.0;
+static const int MAX_HITCH_SNAPSHOTS = 10;
+
 // A human-recognisable pattern (for debugging) followed by random bytes (for uniqueness)
 const u8 CProfiler2::RESYNC_MAGIC[8] = {0x11, 0x22, 0x33, 0x44, 0xf4, 0x93, 0xbe, 0x15};
 
 CProfiler2::CProfiler2() :
-	m_Initialised(false), m_FrameNumber(0), m_MgContext(NULL), m_GPU(NULL)
+	m_Initialised(false), m_FrameNumber(0), m_MgContext(NULL), m_GPU(NULL), m_Capture(NULL), m_MemoryStatsTable(NULL),
+	m_HitchDetection(false), m_HitchFrameThreshold(0.0), m_HitchTurnThreshold(0.0),
+	m_LastFrameStartTime(-1.0), m_RecentFramesPos(0), m_HitchSnapshotDelay(0),
+	m_LastHitchTime(-HITCH_SNAPSHOT_INTERVAL), m_NumHitchSnapshots(0), m_HasHitchThread(false),
+	m_CountersEnabled(false)
 {
+	for (size_t i = 0; i < NUM_RECENT_FRAMES; ++i)
+		m_RecentFrameTimes[i] = 0.0f;
 }
 
 CProfiler2::~CProfiler2()
@@ -84,7 +105,16 @@ static void* MgCallback(mg_event event, struct mg_connection *conn, const struct
 		{
 			profiler->ConstructJSONOverview(stream);
 		}
-		else if (uri == "/query")
+		else if (uri == "/memory")
+		{
+			const char* err = profiler->ConstructJSONMemory(stream);
+			if (err)
+			{
+				mg_printf(conn, "%s (%s)", header400, err);
+				return handled;
+			}
+		}
+		else if (uri == "/query" || uri == "/scriptprofile")
 		{
 			if (!request_info->query_string)
 			{
@@ -102,7 +132,11 @@ static void* MgCallback(mg_event event, struct mg_connection *conn, const struct
 			}
 			std::string thread(buf);
 
-			const char* err = profiler->ConstructJSONResponse(stream, thread);
+			const char* err;
+			if (uri == "/query")
+				err = profiler->ConstructJSONResponse(stream, thread);
+			else
+				err = profiler->ConstructJSONScriptProfile(stream, thread);
 			if (err)
 			{
 				mg_printf(conn, "%s (%s)", header400, err);
@@ -183,6 +217,31 @@ void CProfiler2::ShutdownGPU()
 	SAFE_DELETE(m_GPU);
 }
 
+void CProfiler2::SetMemoryStatsTable(CMemoryStatsTable* table)
+{
+	CScopeLock lock(m_Mutex);
+	m_MemoryStatsTable = table;
+}
+
+void CProfiler2::EnableCapture()
+{
+	ENSURE(m_Initialised);
+
+	CScopeLock lock(m_Mutex);
+
+	// Ignore multiple enablings
+	if (m_Capture)
+		return;
+
+	CProfiler2Capture* capture = new CProfiler2Capture(*this);
+	if (!capture->Start(psLogDir()/"profile2.trace"))
+	{
+		delete capture;
+		return;
+	}
+	m_Capture = capture;
+}
+
 void CProfiler2::Shutdown()
 {
 	ENSURE(m_Initialised);
@@ -195,6 +254,26 @@ void CProfiler2::Shutdown()
 		m_MgContext = NULL;
 	}
 
+	if (m_HasHitchThread)
+	{
+		pthread_join(m_HitchThread, NULL);
+		m_HasHitchThread = false;
+	}
+	m_HitchDetection = false;
+
+	// Stop the capture thread, and save whatever it hadn't saved yet
+	CProfiler2Capture* capture;
+	{
+		CScopeLock lock(m_Mutex);
+		capture = m_Capture;
+		m_Capture = NULL;
+	}
+	if (capture)
+	{
+		capture->Stop();
+		delete capture;
+	}
+
 	// TODO: free non-NULL keys, instead of leaking them
 
 	int err = pthread_key_delete(m_TLS);
@@ -202,6 +281,167 @@ void CProfiler2::Shutdown()
 	m_Initialised = false;
 }
 
+void CProfiler2::EnableHitchDetection(double frameThreshold, double turnThreshold)
+{
+	ENSURE(m_Initialised);
+	ENSURE(ThreadUtil::IsMainThread());
+
+	m_HitchFrameThreshold = frameThreshold;
+	m_HitchTurnThreshold = turnThreshold;
+	m_HitchDetection = (frameThreshold > 0.0 || turnThreshold > 0.0);
+}
+
+void CProfiler2::EnableCounters()
+{
+	ENSURE(m_Initialised);
+	ENSURE(ThreadUtil::IsMainThread());
+
+	m_CountersEnabled = true;
+}
+
+void CProfiler2::RecordCounterAttributes(const SCounters& start)
+{
+	SCounters end;
+	ReadCounters(end);
+
+	ThreadStorage& storage = GetThreadStorage();
+
+	if (end.hasAllocations && start.hasAllocations)
+		storage.RecordAttributePrintf("allocations: %llu (%llu bytes)",
+			(unsigned long long)(end.allocations - start.allocations),
+			(unsigned long long)(end.allocatedBytes - start.allocatedBytes));
+
+	if (end.hasHardware && start.hasHardware)
+	{
+		u64 instructions = end.instructions - start.instructions;
+		u64 cacheMisses = end.cacheMisses - start.cacheMisses;
+		storage.RecordAttributePrintf("instructions: %llu", (unsigned long long)instructions);
+		storage.RecordAttributePrintf("cache misses: %llu (%.2f per 1000 instructions)",
+			(unsigned long long)cacheMisses, instructions ? cacheMisses * 1000.0 / instructions : 0.0);
+	}
+}
+
+void CProfiler2::CheckFrameHitch(double frameStartTime)
+{
+	if (m_LastFrameStartTime >= 0.0)
+	{
+		double frameTime = frameStartTime - m_LastFrameStartTime;
+		m_RecentFrameTimes[m_RecentFramesPos] = (float)frameTime;
+		m_RecentFramesPos = (m_RecentFramesPos + 1) % NUM_RECENT_FRAMES;
+
+		if (m_HitchFrameThreshold > 0.0 && frameTime > m_HitchFrameThreshold)
+			ReportHitch("frame", frameTime);
+	}
+	m_LastFrameStartTime = frameStartTime;
+
+	if (m_HitchSnapshotDelay > 0 && --m_HitchSnapshotDelay == 0)
+		SaveHitchSnapshot();
+}
+
+void CProfiler2::ReportHitch(const char* type, double duration)
+{
+	ENSURE(ThreadUtil::IsMainThread());
+
+	// Ignore it if there's already a snapshot pending (e.g. a slow turn
+	// will usually cause a slow frame too), or we've had too many already
+	double now = GetTime();
+	if (m_HitchSnapshotDelay > 0 || m_NumHitchSnapshots >= MAX_HITCH_SNAPSHOTS
+		|| now < m_LastHitchTime + HITCH_SNAPSHOT_INTERVAL)
+		return;
+
+	m_LastHitchTime = now;
+	m_HitchSnapshotDelay = HITCH_SNAPSHOT_DELAY_FRAMES;
+
+	std::stringstream description;
+	description << std::fixed << std::setprecision(6);
+	description << "{\"type\":\"" << type << "\",\"duration\":" << duration;
+	description << ",\"time\":" << now << ",\"frame\":" << m_FrameNumber;
+	description << ",\"threshold\":" << (strcmp(type, "turn") == 0 ? m_HitchTurnThreshold : m_HitchFrameThreshold);
+	description << ",\"recentFrameTimes\":[";
+	for (size_t i = 0; i < NUM_RECENT_FRAMES; ++i)
+	{
+		if (i != 0)
+			description << ",";
+		description << m_RecentFrameTimes[(m_RecentFramesPos + i) % NUM_RECENT_FRAMES];
+	}
+	description << "]}";
+	m_HitchDescription = description.str();
+}
+
+struct SHitchSnapshot
+{
+	OsPath path;
+	std::string description;
+	std::vector<std::pair<std::string, std::string> > buffers; // thread name, buffer
+};
+
+void CProfiler2::SaveHitchSnapshot()
+{
+	PROFILE2("save hitch snapshot");
+
+	// The rate limiting means the previous snapshot should have been saved long ago
+	if (m_HasHitchThread)
+	{
+		pthread_join(m_HitchThread, NULL);
+		m_HasHitchThread = false;
+	}
+
+	time_t t = time(NULL);
+	struct tm* now = localtime(&t);
+	char filename[64];
+	sprintf_s(filename, ARRAY_SIZE(filename), "hitch-%04d-%02d-%02d_%02d%02d%02d.jsonp",
+		1900+now->tm_year, 1+now->tm_mon, now->tm_mday, now->tm_hour, now->tm_min, now->tm_sec);
+
+	SHitchSnapshot* snapshot = new SHitchSnapshot;
+	snapshot->path = psLogDir()/filename;
+	snapshot->description = m_HitchDescription;
+
+	// Just copy the buffers here, and leave the slow conversion to JSON
+	// to another thread so we don't cause another hitch
+	{
+		CScopeLock lock(m_Mutex);
+		for (size_t i = 0; i < m_Threads.size(); ++i)
+			snapshot->buffers.push_back(std::make_pair(m_Threads[i]->GetName(), m_Threads[i]->GetBuffer()));
+	}
+
+	LOGMESSAGE(L"Saving profiler hitch snapshot to \"%ls\"", snapshot->path.string().c_str());
+
+	if (pthread_create(&m_HitchThread, NULL, &RunHitchSnapshotThread, snapshot) != 0)
+	{
+		delete snapshot;
+		return;
+	}
+	m_HasHitchThread = true;
+	++m_NumHitchSnapshots;
+}
+
+void* CProfiler2::RunHitchSnapshotThread(void* data)
+{
+	debug_SetThreadName("profiler2 hitch");
+
+	SHitchSnapshot* snapshot = static_cast<SHitchSnapshot*>(data);
+
+	std::ofstream stream(OsString(snapshot->path).c_str(), std::ofstream::out | std::ofstream::trunc);
+	if (stream.good())
+	{
+		stream << "profileDataCB({\"hitch\": " << snapshot->description << ",\n";
+		stream << "\"threads\": [\n";
+		for (size_t i = 0; i < snapshot->buffers.size(); ++i)
+		{
+			if (i != 0)
+				stream << ",\n";
+			stream << "{\"name\":\"" << CStr(snapshot->buffers[i].first).EscapeToPrintableASCII() << "\",\n";
+			stream << "\"data\": ";
+			ConstructJSONBuffer(stream, snapshot->buffers[i].second);
+			stream << "\n}";
+		}
+		stream << "\n]});\n";
+	}
+
+	delete snapshot;
+	return NULL;
+}
+
 void CProfiler2::RecordGPUFrameStart()
 {
 	if (m_GPU)
@@ -258,16 +498,21 @@ void CProfiler2::AddThreadStorage(ThreadStorage* storage)
 {
 	CScopeLock lock(m_Mutex);
 	m_Threads.push_back(storage);
+	if (m_Capture)
+		m_Capture->AddThread(*storage);
 }
 
 void CProfiler2::RemoveThreadStorage(ThreadStorage* storage)
 {
 	CScopeLock lock(m_Mutex);
 	m_Threads.erase(std::find(m_Threads.begin(), m_Threads.end(), storage));
+	if (m_Capture)
+		m_Capture->RemoveThread(*storage);
 }
 
 CProfiler2::ThreadStorage::ThreadStorage(CProfiler2& profiler, const std::string& name) :
-	m_Profiler(profiler), m_Name(name), m_BufferPos0(0), m_BufferPos1(0), m_LastTime(timer_Time())
+	m_Profiler(profiler), m_Name(name), m_BufferPos0(0), m_BufferPos1(0), m_BufferWraps(0), m_LastTime(timer_Time()),
+	m_PerfCounters(NULL), m_PerfCountersOpened(false)
 {
 	m_Buffer = new u8[BUFFER_SIZE];
 	memset(m_Buffer, ITEM_NOP, BUFFER_SIZE);
@@ -275,9 +520,29 @@ CProfiler2::ThreadStorage::ThreadStorage(CProfiler2& profiler, const std::string
 
 CProfiler2::ThreadStorage::~ThreadStorage()
 {
+	perf_counters_Destroy(m_PerfCounters);
 	delete[] m_Buffer;
 }
 
+void CProfiler2::ThreadStorage::ReadCounters(SCounters& counters)
+{
+	counters.allocations = counters.allocatedBytes = 0;
+	counters.hasAllocations = profile_GetThreadAllocations(counters.allocations, counters.allocatedBytes);
+
+	// The hardware counters measure the thread that opens them, so we have
+	// to wait until we're called from this storage's thread
+	if (!m_PerfCountersOpened)
+	{
+		m_PerfCounters = perf_counters_Create();
+		m_PerfCountersOpened = true;
+	}
+
+	PerfCounterValues values;
+	counters.hasHardware = perf_counters_Read(m_PerfCounters, values);
+	counters.instructions = counters.hasHardware ? values.instructions : 0;
+	counters.cacheMisses = counters.hasHardware ? values.cacheMisses : 0;
+}
+
 std::string CProfiler2::ThreadStorage::GetBuffer()
 {
 	// Called from an arbitrary thread (not the one writing to the buffer).
@@ -302,6 +567,73 @@ std::string CProfiler2::ThreadStorage::GetBuffer()
 		return std::string(buffer.get()+pos0, buffer.get()+pos1);
 }
 
+u64 CProfiler2::ThreadStorage::GetBufferEnd()
+{
+	// Called from an arbitrary thread (not the one writing to the buffer).
+	// m_BufferWraps is odd while Write is wrapping around, and m_BufferPos1
+	// is only consistent with it if it was the same before and after reading
+
+	u32 wraps, pos1;
+	do
+	{
+		wraps = m_BufferWraps;
+		COMPILER_FENCE;
+		pos1 = m_BufferPos1;
+		COMPILER_FENCE;
+	}
+	while ((wraps & 1) || wraps != m_BufferWraps);
+
+	return (u64)(wraps / 2) * BUFFER_SIZE + pos1;
+}
+
+bool CProfiler2::ThreadStorage::GetNewData(u64& pos, std::string& data)
+{
+	// Called from an arbitrary thread (not the one writing to the buffer).
+
+	data.clear();
+
+	u64 end = GetBufferEnd();
+	bool intact = true;
+	if (end - pos > BUFFER_SIZE)
+	{
+		pos = end - BUFFER_SIZE;
+		intact = false;
+	}
+
+	// Copy [pos, end) out of the ring buffer
+	u32 start = (u32)(pos % BUFFER_SIZE);
+	u32 length = (u32)(end - pos);
+	if (start + length <= BUFFER_SIZE)
+	{
+		data.assign(m_Buffer + start, m_Buffer + start + length);
+	}
+	else
+	{
+		data.assign(m_Buffer + start, m_Buffer + BUFFER_SIZE);
+		data.append(m_Buffer, m_Buffer + (start + length - BUFFER_SIZE));
+	}
+
+	COMPILER_FENCE; // must read m_BufferPos0 after m_Buffer
+	u32 pos0 = m_BufferPos0;
+	COMPILER_FENCE;
+	u32 wraps = m_BufferWraps;
+
+	// Find the furthest point the writer might have reached while we were
+	// copying. (If it's wrapping, m_BufferPos0 may or may not be in the new
+	// lap, so assume it is.) Anything less than a lap behind that might have
+	// been overwritten, so discard it
+	u64 written = (u64)((wraps + 1) / 2) * BUFFER_SIZE + pos0;
+	if (written > pos + BUFFER_SIZE)
+	{
+		u64 lost = std::min(written - BUFFER_SIZE - pos, (u64)data.size());
+		data.erase(0, (size_t)lost);
+		intact = false;
+	}
+
+	pos = end;
+	return intact;
+}
+
 void CProfiler2::ThreadStorage::RecordAttribute(const char* fmt, va_list argp)
 {
 	char buffer[MAX_ATTRIBUTE_LENGTH + 4] = {0}; // first 4 bytes are used for storing length
@@ -321,6 +653,61 @@ void CProfiler2::ThreadStorage::RecordAttribute(const char* fmt, va_list argp)
 	Write(ITEM_ATTRIBUTE, buffer, 4 + len);
 }
 
+void CProfiler2::ThreadStorage::RecordScriptFunction(const std::string& name, u32 calls, double inclusive, double self)
+{
+	CScopeLock lock(m_ScriptStatsMutex);
+
+	std::map<std::string, SScriptFunctionStats>::iterator it = m_ScriptStats.find(name);
+	if (it == m_ScriptStats.end())
+	{
+		SScriptFunctionStats stats = { 0, 0.0, 0.0 };
+		it = m_ScriptStats.insert(std::make_pair(name, stats)).first;
+	}
+
+	it->second.calls += calls;
+	it->second.inclusive += inclusive;
+	it->second.self += self;
+}
+
+bool CProfiler2::ThreadStorage::CompareScriptFunctionSelfTime(const ScriptStatsEntry& a, const ScriptStatsEntry& b)
+{
+	return a.second.self > b.second.self;
+}
+
+void CProfiler2::ThreadStorage::ConstructJSONScriptProfile(std::ostream& stream)
+{
+	// Copy the stats so we don't block the recording thread while sorting
+	// and formatting
+	std::vector<ScriptStatsEntry> entries;
+	{
+		CScopeLock lock(m_ScriptStatsMutex);
+		entries.assign(m_ScriptStats.begin(), m_ScriptStats.end());
+	}
+
+	std::sort(entries.begin(), entries.end(), CompareScriptFunctionSelfTime);
+
+	stream << "{\"functions\":[\n";
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		if (i != 0)
+			stream << ",\n";
+		stream << "{\"name\":\"" << CStr(entries[i].first).EscapeToPrintableASCII() << "\"";
+		stream << ",\"calls\":" << entries[i].second.calls;
+		stream << std::fixed << std::setprecision(9);
+		stream << ",\"inclusive\":" << entries[i].second.inclusive;
+		stream << ",\"self\":" << entries[i].second.self << "}";
+	}
+	stream << "\n]}";
+}
+
+void CProfiler2::RecordScriptFunction(const std::string& name, u32 calls, double inclusive, double self)
+{
+	if (!IsCurrentThreadRegistered())
+		return;
+
+	GetThreadStorage().RecordScriptFunction(name, calls, inclusive, self);
+}
+
 
 void CProfiler2::ConstructJSONOverview(std::ostream& stream)
 {
@@ -338,6 +725,17 @@ void CProfiler2::ConstructJSONOverview(std::ostream& stream)
 	stream << "]}";
 }
 
+const char* CProfiler2::ConstructJSONMemory(std::ostream& stream)
+{
+	CScopeLock lock(m_Mutex);
+
+	if (!m_MemoryStatsTable)
+		return "memory statistics not available";
+
+	m_MemoryStatsTable->ConstructJSON(stream);
+	return NULL;
+}
+
 /**
  * Given a buffer and a visitor class (with functions OnEvent, OnEnter, OnLeave, OnAttribute),
  * calls the visitor for every item in the buffer.
@@ -345,8 +743,6 @@ void CProfiler2::ConstructJSONOverview(std::ostream& stream)
 template<typename V>
 void RunBufferVisitor(const std::string& buffer, V& visitor)
 {
-	TIMER(L"profile2 visitor");
-
 	// The buffer doesn't necessarily start at the beginning of an item
 	// (we just grabbed it from some arbitrary point in the middle),
 	// so scan forwards until we find a sync marker.
@@ -523,18 +919,230 @@ const char* CProfiler2::ConstructJSONResponse(std::ostream& stream, const std::s
 		if (!storage)
 			return "cannot find named thread";
 
-		stream << "{\"events\":[\n";
-
-		stream << "[\n";
 		buffer = storage->GetBuffer();
 	}
 
+	ConstructJSONBuffer(stream, buffer);
+
+	return NULL;
+}
+
+void CProfiler2::ConstructJSONBuffer(std::ostream& stream, const std::string& buffer)
+{
+	TIMER(L"profile2 visitor");
+
+	stream << "{\"events\":[\n";
+	stream << "[\n";
+
 	BufferVisitor_Dump visitor(stream);
 	RunBufferVisitor(buffer, visitor);
 
 	stream << "null]\n]}";
+}
 
-	return NULL;
+/**
+ * Visitor class that sums the time spent in each region, for ComputeRegionStats.
+ */
+struct BufferVisitor_Stats
+{
+	NONCOPYABLE(BufferVisitor_Stats);
+public:
+	BufferVisitor_Stats(CProfiler2::SThreadStats& stats, double start) :
+		m_Stats(stats), m_Start(start), m_FirstSync(-1.0)
+	{
+		CProfiler2::SRegionStats root = { NULL, 0, 0, 0.0 };
+		m_Stats.regions.push_back(root);
+		m_Stats.frames = 0;
+	}
+
+	void OnSync(double time)
+	{
+		if (m_FirstSync < 0.0)
+			m_FirstSync = time;
+	}
+
+	void OnEvent(double time, const char* id)
+	{
+		if (time >= m_Start && strcmp(id, "__framestart") == 0)
+			++m_Stats.frames;
+	}
+
+	void OnEnter(double time, const char* id)
+	{
+		size_t parent = m_Stack.empty() ? 0 : m_Stack.back().first;
+
+		std::pair<size_t, const char*> key(parent, id);
+		std::map<std::pair<size_t, const char*>, size_t>::iterator it = m_Indexes.find(key);
+		size_t index;
+		if (it != m_Indexes.end())
+		{
+			index = it->second;
+		}
+		else
+		{
+			index = m_Stats.regions.size();
+			CProfiler2::SRegionStats region = { id, parent, 0, 0.0 };
+			m_Stats.regions.push_back(region);
+			m_Indexes[key] = index;
+		}
+
+		m_Stack.push_back(std::make_pair(index, time));
+	}
+
+	void OnLeave(double time, const char* UNUSED(id))
+	{
+		// Ignore the ends of regions that were entered before the start of the buffer
+		if (m_Stack.empty())
+			return;
+
+		CProfiler2::SRegionStats& region = m_Stats.regions[m_Stack.back().first];
+		double enter = m_Stack.back().second;
+		m_Stack.pop_back();
+
+		if (time < m_Start)
+			return;
+
+		if (enter >= m_Start)
+			++region.calls;
+		region.time += time - std::max(enter, m_Start);
+	}
+
+	void OnAttribute(const std::string& UNUSED(attr))
+	{
+	}
+
+	// Returns the time the stats start from
+	double GetStart()
+	{
+		return std::max(m_Start, m_FirstSync);
+	}
+
+private:
+	CProfiler2::SThreadStats& m_Stats;
+	double m_Start;
+	double m_FirstSync;
+	std::vector<std::pair<size_t, double> > m_Stack; // open regions: index and enter time
+	std::map<std::pair<size_t, const char*>, size_t> m_Indexes; // (parent, name) -> index
+};
+
+void CProfiler2::ComputeRegionStats(double duration, std::vector<SThreadStats>& threads)
+{
+	std::vector<std::pair<std::string, std::string> > buffers;
+
+	{
+		CScopeLock lock(m_Mutex); // lock against changes to m_Threads or deletions of ThreadStorage
+		for (size_t i = 0; i < m_Threads.size(); ++i)
+			buffers.push_back(std::make_pair(m_Threads[i]->GetName(), m_Threads[i]->GetBuffer()));
+	}
+
+	double now = GetTime();
+
+	threads.resize(buffers.size());
+	for (size_t i = 0; i < buffers.size(); ++i)
+	{
+		SThreadStats& stats = threads[i];
+		stats.name = buffers[i].first;
+		stats.regions.clear();
+
+		BufferVisitor_Stats visitor(stats, now - duration);
+		RunBufferVisitor(buffers[i].second, visitor);
+		stats.duration = now - visitor.GetStart();
+	}
+}
+
+/**
+ * Visitor class that finds the durations of top-level regions, for ComputeRegionDurations.
+ */
+struct BufferVisitor_Durations
+{
+	NONCOPYABLE(BufferVisitor_Durations);
+public:
+	BufferVisitor_Durations(const char* region, double since, std::vector<double>& durations) :
+		m_Region(region), m_Since(since), m_Latest(since), m_Durations(durations), m_Depth(0), m_Enter(-1.0)
+	{
+	}
+
+	void OnSync(double UNUSED(time))
+	{
+	}
+
+	void OnEvent(double UNUSED(time), const char* UNUSED(id))
+	{
+	}
+
+	void OnEnter(double time, const char* id)
+	{
+		if (m_Depth++ == 0 && strcmp(id, m_Region) == 0 && time > m_Since)
+			m_Enter = time;
+	}
+
+	void OnLeave(double time, const char* UNUSED(id))
+	{
+		// Ignore the ends of regions that were entered before the start of the buffer
+		if (m_Depth == 0)
+			return;
+
+		if (--m_Depth == 0 && m_Enter >= 0.0)
+		{
+			m_Durations.push_back(time - m_Enter);
+			m_Latest = m_Enter;
+			m_Enter = -1.0;
+		}
+	}
+
+	void OnAttribute(const std::string& UNUSED(attr))
+	{
+	}
+
+	double GetLatest()
+	{
+		return m_Latest;
+	}
+
+private:
+	const char* m_Region;
+	double m_Since;
+	double m_Latest;
+	std::vector<double>& m_Durations;
+	size_t m_Depth;
+	double m_Enter;
+};
+
+void CProfiler2::ComputeRegionDurations(const std::string& threadPrefix, const char* region, double& since, std::vector<double>& durations)
+{
+	std::vector<std::string> buffers;
+
+	{
+		CScopeLock lock(m_Mutex); // lock against changes to m_Threads or deletions of ThreadStorage
+		for (size_t i = 0; i < m_Threads.size(); ++i)
+			if (m_Threads[i]->GetName().compare(0, threadPrefix.length(), threadPrefix) == 0)
+				buffers.push_back(m_Threads[i]->GetBuffer());
+	}
+
+	double latest = since;
+	for (size_t i = 0; i < buffers.size(); ++i)
+	{
+		BufferVisitor_Durations visitor(region, since, durations);
+		RunBufferVisitor(buffers[i], visitor);
+		latest = std::max(latest, visitor.GetLatest());
+	}
+	since = latest;
+}
+
+const char* CProfiler2::ConstructJSONScriptProfile(std::ostream& stream, const std::string& thread)
+{
+	CScopeLock lock(m_Mutex); // lock against changes to m_Threads or deletions of ThreadStorage
+
+	for (size_t i = 0; i < m_Threads.size(); ++i)
+	{
+		if (m_Threads[i]->GetName() == thread)
+		{
+			m_Threads[i]->ConstructJSONScriptProfile(stream);
+			return NULL;
+		}
+	}
+
+	return "cannot find named thread";
 }
 
 void CProfiler2::SaveToFile()
@@ -63,9 +63,31 @@
  * a copy of a thread's buffer, then parse the items and return them in JSON
  * format. The profiler2.html requests and processes and visualises this data.
  * 
+ * Script runtimes can also record per-function statistics (call counts and
+ * self/inclusive times, accumulated over the thread's lifetime instead of
+ * stored in the ring buffer) with RecordScriptFunction, when enabled by
+ * ScriptInterface::SetFunctionProfiling. These are returned in JSON format by
+ * the HTTP server's /scriptprofile?thread=... request.
+ * 
  * The RecordSyncMarker calls are necessary to correct for time drift and to
  * let the buffer parser accurately detect the start of an item in the byte stream.
  * 
+ * The ring buffers only hold the last few seconds of data. To record a whole
+ * game, EnableCapture starts a background thread that continually copies
+ * every thread's new items into a compact binary file (see CProfiler2Capture),
+ * which can be converted into the Chrome trace viewer's JSON format afterwards
+ * (with the -profile2-convert command-line option).
+ * 
+ * EnableHitchDetection makes the profiler save a snapshot of all the buffers
+ * (in the same format as SaveToFile) whenever a frame or simulation turn is
+ * unusually slow, so rare stalls can be analysed after they've happened.
+ * 
+ * EnableCounters makes PROFILE2_COUNTERS regions also record attributes
+ * with the number of allocations made inside the region and (where the OS
+ * allows it) hardware counters for instructions and cache misses. These are
+ * read only at the start and end of each such region, so they cost nothing
+ * when disabled and very little otherwise.
+ * 
  * This design aims to minimise the performance overhead of recording data,
  * and to simplify the visualisation of the data by doing it externally in an
  * environment with better UI tools (i.e. HTML) instead of within the game engine.
@@ -82,15 +104,19 @@
 #include "ps/ThreadUtil.h"
 
 struct mg_context;
+struct PerfCounters;
 
 // Note: Lots of functions are defined inline, to hypothetically
 // minimise performance overhead.
 
 class CProfiler2GPU;
+class CProfiler2Capture;
+class CMemoryStatsTable;
 
 class CProfiler2
 {
 	friend class CProfiler2GPU_base;
+	friend class CProfiler2Capture;
 
 public:
 	// Items stored in the buffers:
@@ -125,6 +151,46 @@ private:
 	// TODO: different threads might want different sizes
 	static const size_t BUFFER_SIZE = 1024*1024;
 
+public:
+	/**
+	 * Values of the calling thread's counters, as used by PROFILE2_COUNTERS.
+	 * Counters that aren't available are left as 0.
+	 */
+	struct SCounters
+	{
+		u64 allocations;
+		u64 allocatedBytes;
+		u64 instructions;
+		u64 cacheMisses;
+		bool hasAllocations;
+		bool hasHardware;
+	};
+
+	/**
+	 * Timings of a region (summed over every time it was entered from the
+	 * same parent region), as computed by ComputeRegionStats.
+	 */
+	struct SRegionStats
+	{
+		const char* name;
+		size_t parent; // index of the parent region; the root (index 0) has no name or parent
+		u32 calls; // number of times the region was entered
+		double time; // total seconds spent in the region
+	};
+
+	/**
+	 * A thread's region timings over a recent period, as computed by ComputeRegionStats.
+	 */
+	struct SThreadStats
+	{
+		std::string name;
+		double duration; // length of the period, in seconds
+		u32 frames; // number of frame starts recorded in the period
+		std::vector<SRegionStats> regions; // parents always come before their children
+	};
+
+private:
+
 	/**
 	 * Class instantiated in every registered thread.
 	 */
@@ -189,6 +255,41 @@ private:
 		 */
 		std::string GetBuffer();
 
+		/**
+		 * Returns the number of bytes written into the buffer so far
+		 * (counting the padding skipped at the end of each lap).
+		 * May be called by any thread.
+		 */
+		u64 GetBufferEnd();
+
+		/**
+		 * Copies everything written after position @p pos (as counted by
+		 * GetBufferEnd) into @p data, and sets @p pos to the end of it.
+		 * Returns false if some of that data had already been overwritten,
+		 * in which case @p data only contains the intact part at the end
+		 * (which probably doesn't start on an item boundary).
+		 * May be called by any thread.
+		 */
+		bool GetNewData(u64& pos, std::string& data);
+
+		/**
+		 * Reads this thread's counters (opening the hardware counters
+		 * on first use). Must be called by the thread that owns this storage.
+		 */
+		void ReadCounters(SCounters& counters);
+
+		/**
+		 * Adds to the accumulated statistics for the named script function.
+		 */
+		void RecordScriptFunction(const std::string& name, u32 calls, double inclusive, double self);
+
+		/**
+		 * Writes the accumulated script function statistics as JSON, sorted
+		 * by decreasing self time.
+		 * May be called by any thread.
+		 */
+		void ConstructJSONScriptProfile(std::ostream& stream);
+
 	private:
 		/**
 		 * Store an item into the buffer.
@@ -199,12 +300,17 @@ private:
 
 			u32 size = 1 + itemSize;
 			u32 start = m_BufferPos0;
+			bool wrapped = false;
 			if (start + size > BUFFER_SIZE)
 			{
 				// The remainder of the buffer is too small - fill the rest
 				// with NOPs then start from offset 0, so we don't have to
 				// bother splitting the real item across the end of the buffer
 
+				wrapped = true;
+				++m_BufferWraps; // odd while wrapping
+				COMPILER_FENCE; // must write m_BufferWraps before m_BufferPos0
+
 				m_BufferPos0 = size;
 				COMPILER_FENCE; // must write m_BufferPos0 before m_Buffer
 
@@ -222,6 +328,12 @@ private:
 			
 			COMPILER_FENCE; // must write m_BufferPos1 after m_Buffer
 			m_BufferPos1 = start + size;
+
+			if (wrapped)
+			{
+				COMPILER_FENCE; // must write m_BufferWraps after m_BufferPos1
+				++m_BufferWraps;
+			}
 		}
 
 		CProfiler2& m_Profiler;
@@ -244,6 +356,26 @@ private:
 		// actually work in practice?
 		u32 m_BufferPos0;
 		u32 m_BufferPos1;
+
+		// Incremented before and after each wrap from the end to the start of the
+		// buffer, so GetBufferEnd can tell which lap m_BufferPos1 is in.
+		u32 m_BufferWraps;
+
+		PerfCounters* m_PerfCounters; // hardware counters for this thread, or NULL
+		bool m_PerfCountersOpened; // whether we've tried to open m_PerfCounters
+
+		struct SScriptFunctionStats
+		{
+			u32 calls;
+			double inclusive;
+			double self;
+		};
+
+		typedef std::pair<std::string, SScriptFunctionStats> ScriptStatsEntry;
+		static bool CompareScriptFunctionSelfTime(const ScriptStatsEntry& a, const ScriptStatsEntry& b);
+
+		CMutex m_ScriptStatsMutex;
+		std::map<std::string, SScriptFunctionStats> m_ScriptStats; // protected by m_ScriptStatsMutex
 	};
 
 public:
@@ -263,6 +395,13 @@ public:
 	 */
 	void EnableHTTP();
 
+	/**
+	 * Call in main thread to set the memory statistics reported by the
+	 * HTTP server's /memory request (or NULL to stop reporting them,
+	 * before deleting @p table).
+	 */
+	void SetMemoryStatsTable(CMemoryStatsTable* table);
+
 	/**
 	 * Call in main thread to enable the GPU profiling support,
 	 * after OpenGL has been initialised.
@@ -275,6 +414,46 @@ public:
 	 */
 	void ShutdownGPU();
 
+	/**
+	 * Call in main thread to start continuously saving all threads'
+	 * profiler data to a file named profile2.trace in the logs directory.
+	 */
+	void EnableCapture();
+
+	/**
+	 * Call in main thread to save a snapshot of all threads' buffers (to a
+	 * file named hitch-<date>.jsonp in the logs directory) shortly after any
+	 * frame takes longer than @p frameThreshold seconds, or any simulation
+	 * turn takes longer than @p turnThreshold seconds. Either threshold can
+	 * be 0 to disable it.
+	 */
+	void EnableHitchDetection(double frameThreshold, double turnThreshold);
+
+	/**
+	 * Call in main thread to make PROFILE2_COUNTERS regions record the
+	 * allocation and hardware counters.
+	 */
+	void EnableCounters();
+
+	bool AreCountersEnabled()
+	{
+		return m_CountersEnabled;
+	}
+
+	/**
+	 * Call in any registered thread to read its current counters.
+	 */
+	void ReadCounters(SCounters& counters)
+	{
+		GetThreadStorage().ReadCounters(counters);
+	}
+
+	/**
+	 * Call in any registered thread to record attributes (for the
+	 * currently-active region) with the change in the counters since @p start.
+	 */
+	void RecordCounterAttributes(const SCounters& start);
+
 	/**
 	 * Call in main thread to shut everything down.
 	 * All other profiled threads should have been terminated already.
@@ -288,6 +467,15 @@ public:
 	 */
 	void RegisterCurrentThread(const std::string& name);
 
+	/**
+	 * Returns whether the current thread can use the Record functions
+	 * (i.e. the profiler is initialised and the thread was registered).
+	 */
+	bool IsCurrentThreadRegistered()
+	{
+		return m_Initialised && pthread_getspecific(m_TLS) != NULL;
+	}
+
 	/**
 	 * Non-main threads should call this occasionally,
 	 * especially if it's been a long time since their last call to the profiler,
@@ -304,7 +492,20 @@ public:
 	void RecordFrameStart()
 	{
 		ENSURE(ThreadUtil::IsMainThread());
-		GetThreadStorage().RecordFrameStart(GetTime());
+		double t = GetTime();
+		GetThreadStorage().RecordFrameStart(t);
+		if (m_HitchDetection)
+			CheckFrameHitch(t);
+	}
+
+	/**
+	 * Call in main thread after each simulation turn, with the time
+	 * it took to compute (for the hitch detection).
+	 */
+	void RecordTurnTime(double duration)
+	{
+		if (m_HitchDetection && m_HitchTurnThreshold > 0.0 && duration > m_HitchTurnThreshold)
+			ReportHitch("turn", duration);
 	}
 
 	void RecordEvent(const char* id)
@@ -322,6 +523,13 @@ public:
 		GetThreadStorage().Record(ITEM_LEAVE, GetTime(), id);
 	}
 
+	/**
+	 * Call in any thread to add to that thread's statistics for a script
+	 * function, with @p calls more calls taking the given total times (in
+	 * seconds). Ignored if the profiler or thread hasn't been initialised.
+	 */
+	void RecordScriptFunction(const std::string& name, u32 calls, double inclusive, double self);
+
 	void RecordAttribute(const char* fmt, ...) PRINTF_ARGS(2)
 	{
 		va_list argp;
@@ -348,6 +556,38 @@ public:
 	 */
 	const char* ConstructJSONResponse(std::ostream& stream, const std::string& thread);
 
+	/**
+	 * Call in any thread to produce a JSON representation of the script
+	 * function statistics for a given thread.
+	 * Returns NULL on success, or an error string.
+	 */
+	const char* ConstructJSONScriptProfile(std::ostream& stream, const std::string& thread);
+
+	/**
+	 * Call in any thread to produce a JSON representation of the memory
+	 * statistics (see SetMemoryStatsTable).
+	 * Returns NULL on success, or an error string.
+	 */
+	const char* ConstructJSONMemory(std::ostream& stream);
+
+	/**
+	 * Call in any thread to compute the region timings of every thread, over
+	 * the last @p duration seconds (or less, if a thread's buffer doesn't go
+	 * back that far). Regions that started before that period are counted
+	 * as being entered at its start.
+	 */
+	void ComputeRegionStats(double duration, std::vector<SThreadStats>& threads);
+
+	/**
+	 * Call in any thread to get the durations (in seconds) of the top-level
+	 * regions named @p region that were entered after time @p since, in every
+	 * thread whose name starts with @p threadPrefix (e.g. "gpu" for the GPU's
+	 * "frame" regions). Appends them to @p durations in order, and updates
+	 * @p since to the latest one's start time, so it can be called repeatedly
+	 * to collect more regions than fit in the buffers.
+	 */
+	void ComputeRegionDurations(const std::string& threadPrefix, const char* region, double& since, std::vector<double>& durations);
+
 	/**
 	 * Call in any thread to save a JSONP representation of the buffers
 	 * for all threads, to a file named profile2.jsonp in the logs directory.
@@ -377,6 +617,16 @@ private:
 
 	static void TLSDtor(void* data);
 
+	/**
+	 * Writes the JSON representation of a buffer returned by ThreadStorage::GetBuffer.
+	 */
+	static void ConstructJSONBuffer(std::ostream& stream, const std::string& buffer);
+
+	void CheckFrameHitch(double frameStartTime);
+	void ReportHitch(const char* type, double duration);
+	void SaveHitchSnapshot();
+	static void* RunHitchSnapshotThread(void* data);
+
 	ThreadStorage& GetThreadStorage()
 	{
 		ThreadStorage* storage = (ThreadStorage*)pthread_getspecific(m_TLS);
@@ -394,6 +644,27 @@ private:
 
 	CProfiler2GPU* m_GPU;
 
+	CProfiler2Capture* m_Capture; // protected by m_Mutex
+
+	CMemoryStatsTable* m_MemoryStatsTable; // protected by m_Mutex
+
+	// Hitch detection state (only used in the main thread)
+	bool m_HitchDetection;
+	double m_HitchFrameThreshold;
+	double m_HitchTurnThreshold;
+	double m_LastFrameStartTime;
+	static const size_t NUM_RECENT_FRAMES = 64;
+	float m_RecentFrameTimes[NUM_RECENT_FRAMES]; // circular buffer of frame durations
+	size_t m_RecentFramesPos;
+	int m_HitchSnapshotDelay; // number of frames until the pending snapshot is saved, or 0 if none
+	std::string m_HitchDescription; // JSON description of the pending snapshot's hitch
+	double m_LastHitchTime;
+	int m_NumHitchSnapshots;
+	bool m_HasHitchThread;
+	pthread_t m_HitchThread; // saves the latest snapshot
+
+	bool m_CountersEnabled;
+
 	CMutex m_Mutex;
 	std::vector<ThreadStorage*> m_Threads; // thread-safe; protected by m_Mutex
 };
@@ -436,6 +707,32 @@ private:
 	const char* m_Name;
 };
 
+/**
+ * Scope-based enter/leave helper that also records the change in the
+ * counters over the region, if they're enabled.
+ */
+class CProfile2CountersRegion
+{
+public:
+	CProfile2CountersRegion(const char* name) : m_Name(name)
+	{
+		g_Profiler2.RecordRegionEnter(m_Name);
+		m_Enabled = g_Profiler2.AreCountersEnabled();
+		if (m_Enabled)
+			g_Profiler2.ReadCounters(m_Start);
+	}
+	~CProfile2CountersRegion()
+	{
+		if (m_Enabled)
+			g_Profiler2.RecordCounterAttributes(m_Start);
+		g_Profiler2.RecordRegionLeave(m_Name);
+	}
+private:
+	const char* m_Name;
+	bool m_Enabled;
+	CProfiler2::SCounters m_Start;
+};
+
 /**
  * Starts timing from now until the end of the current scope.
  * @p region is the name to associate with this region (should be
@@ -447,6 +744,13 @@ private:
 
 #define PROFILE2_GPU(region) CProfile2GPURegion profile2gpu__(region)
 
+/**
+ * Like PROFILE2, but also records the allocation and hardware counters
+ * (see CProfiler2::EnableCounters). Best used for fairly coarse regions,
+ * since reading the hardware counters needs a system call.
+ */
+#define PROFILE2_COUNTERS(region) CProfile2CountersRegion profile2counters__(region)
+
 /**
  * Record the named event at the current time.
  */
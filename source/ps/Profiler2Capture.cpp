@@ -0,0 +1,602 @@
+/* Copyright (c) 2013 Wildfire Games
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "precompiled.h"
+
+#include "Profiler2Capture.h"
+
+#include "lib/external_libraries/libsdl.h"
+#include "ps/CLogger.h"
+#include "ps/CStr.h"
+
+#include <iomanip>
+
+static const char FILE_MAGIC[] = "PS2TRACE";
+static const size_t FILE_MAGIC_LENGTH = 8;
+
+// How often the capture thread saves new data. (Each thread's ring buffer
+// must not fill up in less than this time)
+static const u32 CAPTURE_INTERVAL_MS = 250;
+
+template<typename T>
+static void AppendValue(std::string& out, const T& value)
+{
+	out.append((const char*)&value, sizeof(value));
+}
+
+template<typename T>
+static void WriteValue(std::ostream& stream, const T& value)
+{
+	stream.write((const char*)&value, sizeof(value));
+}
+
+/**
+ * Returns the offset of the next sync marker in @p data at or after @p start,
+ * or std::string::npos if there isn't one.
+ */
+static size_t FindSyncMarker(const std::string& data, size_t start)
+{
+	for (size_t pos = start; pos + 1 + sizeof(CProfiler2::RESYNC_MAGIC) <= data.length(); ++pos)
+	{
+		if (data[pos] == CProfiler2::ITEM_SYNC
+			&& memcmp(data.c_str() + pos + 1, &CProfiler2::RESYNC_MAGIC, sizeof(CProfiler2::RESYNC_MAGIC)) == 0)
+			return pos;
+	}
+	return std::string::npos;
+}
+
+CProfiler2Capture::CProfiler2Capture(CProfiler2& profiler) :
+	m_Profiler(profiler), m_NextThreadID(0), m_HasThread(false), m_Shutdown(false)
+{
+}
+
+CProfiler2Capture::~CProfiler2Capture()
+{
+	ENSURE(!m_HasThread); // must have been stopped
+}
+
+bool CProfiler2Capture::Start(const OsPath& path)
+{
+	m_File.open(OsString(path).c_str(), std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+	if (!m_File.good())
+	{
+		LOGERROR(L"Failed to open profiler capture file \"%ls\"", path.string().c_str());
+		return false;
+	}
+
+	m_File.write(FILE_MAGIC, FILE_MAGIC_LENGTH);
+	WriteValue(m_File, FILE_VERSION);
+
+	for (size_t i = 0; i < m_Profiler.m_Threads.size(); ++i)
+		AddThread(*m_Profiler.m_Threads[i]);
+
+	if (pthread_create(&m_Thread, NULL, &RunThread, this) != 0)
+	{
+		LOGERROR(L"Failed to start profiler capture thread");
+		return false;
+	}
+	m_HasThread = true;
+
+	LOGMESSAGE(L"Saving profiler data to \"%ls\"", path.string().c_str());
+	return true;
+}
+
+void CProfiler2Capture::Stop()
+{
+	if (!m_HasThread)
+		return;
+
+	m_Shutdown = true;
+	pthread_join(m_Thread, NULL);
+	m_HasThread = false;
+
+	CScopeLock lock(m_Profiler.m_Mutex);
+	CaptureAll();
+	m_File.flush();
+}
+
+void* CProfiler2Capture::RunThread(void* data)
+{
+	debug_SetThreadName("profiler2 capture");
+
+	CProfiler2Capture* capture = static_cast<CProfiler2Capture*>(data);
+
+	while (!capture->m_Shutdown)
+	{
+		SDL_Delay(CAPTURE_INTERVAL_MS);
+
+		CScopeLock lock(capture->m_Profiler.m_Mutex);
+		capture->CaptureAll();
+
+		// Flush every time, so the file is still useful if the game crashes
+		capture->m_File.flush();
+	}
+
+	return NULL;
+}
+
+void CProfiler2Capture::AddThread(CProfiler2::ThreadStorage& storage)
+{
+	// Start from the currently-written position, and wait for the next sync
+	// marker to tell us the absolute time
+	SThreadState state;
+	state.id = m_NextThreadID++;
+	state.pos = storage.GetBufferEnd();
+	state.resync = true;
+	m_Threads[&storage] = state;
+
+	WriteString(REC_THREAD, state.id, storage.GetName());
+}
+
+void CProfiler2Capture::RemoveThread(CProfiler2::ThreadStorage& storage)
+{
+	std::map<CProfiler2::ThreadStorage*, SThreadState>::iterator it = m_Threads.find(&storage);
+	if (it == m_Threads.end())
+		return;
+
+	Capture(storage, it->second);
+	m_Threads.erase(it);
+}
+
+void CProfiler2Capture::CaptureAll()
+{
+	for (std::map<CProfiler2::ThreadStorage*, SThreadState>::iterator it = m_Threads.begin(); it != m_Threads.end(); ++it)
+		Capture(*it->first, it->second);
+}
+
+void CProfiler2Capture::Capture(CProfiler2::ThreadStorage& storage, SThreadState& state)
+{
+	std::string data;
+	if (!storage.GetNewData(state.pos, data))
+	{
+		m_File.put((char)REC_GAP);
+		WriteValue(m_File, state.id);
+		state.resync = true;
+	}
+
+	size_t offset = 0;
+	while (offset < data.size())
+	{
+		m_Items.clear();
+		bool valid = EncodeItems(data, offset, state);
+
+		if (!m_Items.empty())
+		{
+			m_File.put((char)REC_ITEMS);
+			WriteValue(m_File, state.id);
+			WriteValue(m_File, (u32)m_Items.size());
+			m_File.write(m_Items.data(), m_Items.size());
+		}
+
+		if (!valid)
+		{
+			m_File.put((char)REC_GAP);
+			WriteValue(m_File, state.id);
+		}
+	}
+}
+
+bool CProfiler2Capture::EncodeItems(const std::string& data, size_t& offset, SThreadState& state)
+{
+	size_t pos = offset;
+
+	while (pos < data.size())
+	{
+		if (state.resync)
+		{
+			pos = FindSyncMarker(data, pos);
+			if (pos == std::string::npos)
+			{
+				offset = data.size();
+				return true;
+			}
+			state.resync = false;
+		}
+
+		size_t size = EncodeItem(data.c_str() + pos, data.size() - pos);
+		if (size == 0)
+		{
+			// The data is corrupted (probably it was being overwritten while
+			// we copied it), so skip to the next sync marker
+			state.resync = true;
+			offset = pos + 1;
+			return false;
+		}
+		pos += size;
+	}
+
+	offset = pos;
+	return true;
+}
+
+size_t CProfiler2Capture::EncodeItem(const char* buffer, size_t length)
+{
+	const u8 type = buffer[0];
+	const char* item = buffer + 1;
+	const size_t itemLength = length - 1;
+
+	switch (type)
+	{
+	case CProfiler2::ITEM_NOP:
+	{
+		return 1;
+	}
+	case CProfiler2::ITEM_SYNC:
+	{
+		double t;
+		if (itemLength < sizeof(CProfiler2::RESYNC_MAGIC) + sizeof(t)
+			|| memcmp(item, &CProfiler2::RESYNC_MAGIC, sizeof(CProfiler2::RESYNC_MAGIC)) != 0)
+			return 0;
+		memcpy(&t, item + sizeof(CProfiler2::RESYNC_MAGIC), sizeof(t));
+
+		m_Items.push_back((char)type);
+		AppendValue(m_Items, t);
+		return 1 + sizeof(CProfiler2::RESYNC_MAGIC) + sizeof(t);
+	}
+	case CProfiler2::ITEM_EVENT:
+	case CProfiler2::ITEM_ENTER:
+	case CProfiler2::ITEM_LEAVE:
+	{
+		CProfiler2::SItem_dt_id dtid;
+		if (itemLength < sizeof(dtid))
+			return 0;
+		memcpy(&dtid, item, sizeof(dtid));
+
+		m_Items.push_back((char)type);
+		AppendValue(m_Items, dtid.dt);
+		AppendValue(m_Items, GetStringID(dtid.id));
+		return 1 + sizeof(dtid);
+	}
+	case CProfiler2::ITEM_ATTRIBUTE:
+	{
+		u32 len;
+		if (itemLength < sizeof(len))
+			return 0;
+		memcpy(&len, item, sizeof(len));
+		if (len > CProfiler2::MAX_ATTRIBUTE_LENGTH || itemLength < sizeof(len) + len)
+			return 0;
+
+		m_Items.push_back((char)type);
+		AppendValue(m_Items, (u16)len);
+		m_Items.append(item + sizeof(len), len);
+		return 1 + sizeof(len) + len;
+	}
+	default:
+		return 0;
+	}
+}
+
+u32 CProfiler2Capture::GetStringID(const char* str)
+{
+	std::map<const char*, u32>::iterator it = m_StringIDs.find(str);
+	if (it != m_StringIDs.end())
+		return it->second;
+
+	u32 id = (u32)m_StringIDs.size();
+	m_StringIDs[str] = id;
+	WriteString(REC_STRING, id, str);
+	return id;
+}
+
+void CProfiler2Capture::WriteString(ERecord type, u32 id, const std::string& str)
+{
+	u16 len = (u16)std::min(str.length(), (size_t)0xFFFF);
+	m_File.put((char)type);
+	WriteValue(m_File, id);
+	WriteValue(m_File, len);
+	m_File.write(str.c_str(), len);
+}
+
+/**
+ * Helper for ConvertProfile2Capture: reads values from the capture file,
+ * and remembers if it's tried to read beyond the end.
+ */
+class CCaptureReader
+{
+public:
+	CCaptureReader(const std::string& data) : m_Data(data), m_Pos(0), m_Error(false)
+	{
+	}
+
+	bool AtEnd() const { return m_Error || m_Pos >= m_Data.size(); }
+	bool Error() const { return m_Error; }
+	size_t GetPos() const { return m_Pos; }
+
+	template<typename T>
+	T Read()
+	{
+		T value = T();
+		if (m_Pos + sizeof(value) > m_Data.size())
+		{
+			m_Error = true;
+			return value;
+		}
+		memcpy(&value, m_Data.c_str() + m_Pos, sizeof(value));
+		m_Pos += sizeof(value);
+		return value;
+	}
+
+	std::string ReadString(size_t len)
+	{
+		if (m_Pos + len > m_Data.size())
+		{
+			m_Error = true;
+			return std::string();
+		}
+		std::string str = m_Data.substr(m_Pos, len);
+		m_Pos += len;
+		return str;
+	}
+
+private:
+	const std::string& m_Data;
+	size_t m_Pos;
+	bool m_Error;
+};
+
+/**
+ * Helper for ConvertProfile2Capture: writes the Chrome trace events.
+ */
+class CTraceWriter
+{
+public:
+	CTraceWriter(std::ostream& stream) : m_Stream(stream), m_First(true)
+	{
+		m_Stream << "{\"traceEvents\":[\n";
+	}
+
+	~CTraceWriter()
+	{
+		m_Stream << "\n]}\n";
+	}
+
+	void ThreadName(u32 tid, const std::string& name)
+	{
+		Begin();
+		m_Stream << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid;
+		m_Stream << ",\"args\":{\"name\":\"" << CStr(name).EscapeToPrintableASCII() << "\"}}";
+	}
+
+	void Event(const char* ph, double time, u32 tid, const std::string& name, const std::vector<std::string>& attributes)
+	{
+		Begin();
+		m_Stream << "{\"name\":\"" << CStr(name).EscapeToPrintableASCII() << "\",\"ph\":\"" << ph << "\"";
+		if (ph[0] == 'i')
+			m_Stream << ",\"s\":\"t\"";
+		m_Stream << ",\"ts\":" << std::fixed << std::setprecision(3) << time * 1e6;
+		m_Stream << ",\"pid\":1,\"tid\":" << tid;
+		if (!attributes.empty())
+		{
+			// Attributes are normally of the form "key: value", so split them
+			// into the separately-displayed args
+			m_Stream << ",\"args\":{";
+			for (size_t i = 0; i < attributes.size(); ++i)
+			{
+				CStr key = "attribute";
+				CStr value = attributes[i];
+				size_t colon = attributes[i].find(": ");
+				if (colon != std::string::npos)
+				{
+					key = attributes[i].substr(0, colon);
+					value = attributes[i].substr(colon + 2);
+				}
+				if (i != 0)
+					m_Stream << ",";
+				m_Stream << "\"" << key.EscapeToPrintableASCII() << "\":\"" << value.EscapeToPrintableASCII() << "\"";
+			}
+			m_Stream << "}";
+		}
+		m_Stream << "}";
+	}
+
+private:
+	void Begin()
+	{
+		if (!m_First)
+			m_Stream << ",\n";
+		m_First = false;
+	}
+
+	std::ostream& m_Stream;
+	bool m_First;
+};
+
+/**
+ * Helper for ConvertProfile2Capture: the state of each captured thread.
+ */
+struct SCaptureThread
+{
+	SCaptureThread() : lastTime(-1.0), lastWasEvent(false), hasPendingEvent(false), pendingEventName(0) { }
+
+	double lastTime; // negative until we've seen a sync marker
+
+	// Attributes of the currently open regions
+	std::vector<std::vector<std::string> > regions;
+
+	// The latest event (which isn't output until we know all its attributes)
+	bool lastWasEvent;
+	bool hasPendingEvent;
+	double pendingEventTime;
+	u32 pendingEventName;
+	std::vector<std::string> pendingEventAttributes;
+
+	void FlushEvent(CTraceWriter& writer, u32 tid, const std::map<u32, std::string>& strings)
+	{
+		if (!hasPendingEvent)
+			return;
+
+		std::map<u32, std::string>::const_iterator it = strings.find(pendingEventName);
+		writer.Event("i", pendingEventTime, tid, it == strings.end() ? "?" : it->second, pendingEventAttributes);
+		hasPendingEvent = false;
+		pendingEventAttributes.clear();
+	}
+
+	void CloseRegions(CTraceWriter& writer, u32 tid)
+	{
+		// (Chrome matches each "E" with the latest "B", so they don't need names)
+		while (!regions.empty())
+		{
+			writer.Event("E", lastTime, tid, "", regions.back());
+			regions.pop_back();
+		}
+	}
+};
+
+bool ConvertProfile2Capture(const std::string& inputPath, const std::string& outputPath)
+{
+	std::ifstream input(inputPath.c_str(), std::ifstream::in | std::ifstream::binary);
+	if (!input.good())
+	{
+		debug_printf(L"Failed to open profiler capture %hs\n", inputPath.c_str());
+		return false;
+	}
+	std::string data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+
+	CCaptureReader reader(data);
+	if (reader.ReadString(FILE_MAGIC_LENGTH) != std::string(FILE_MAGIC, FILE_MAGIC_LENGTH)
+		|| reader.Read<u32>() != CProfiler2Capture::FILE_VERSION)
+	{
+		debug_printf(L"%hs is not a supported profiler capture file\n", inputPath.c_str());
+		return false;
+	}
+
+	std::ofstream output(outputPath.c_str(), std::ofstream::out | std::ofstream::trunc);
+	if (!output.good())
+	{
+		debug_printf(L"Failed to open %hs for writing\n", outputPath.c_str());
+		return false;
+	}
+
+	std::map<u32, std::string> strings;
+	std::map<u32, SCaptureThread> threads;
+
+	{
+		CTraceWriter writer(output);
+
+		while (!reader.AtEnd())
+		{
+			u8 record = reader.Read<u8>();
+			switch (record)
+			{
+			case CProfiler2Capture::REC_STRING:
+			case CProfiler2Capture::REC_THREAD:
+			{
+				u32 id = reader.Read<u32>();
+				u16 len = reader.Read<u16>();
+				std::string str = reader.ReadString(len);
+				if (record == CProfiler2Capture::REC_STRING)
+					strings[id] = str;
+				else
+					writer.ThreadName(id, str);
+				break;
+			}
+			case CProfiler2Capture::REC_GAP:
+			{
+				u32 tid = reader.Read<u32>();
+				SCaptureThread& thread = threads[tid];
+				thread.FlushEvent(writer, tid, strings);
+				thread.CloseRegions(writer, tid);
+				thread.lastTime = -1.0;
+				thread.lastWasEvent = false;
+				break;
+			}
+			case CProfiler2Capture::REC_ITEMS:
+			{
+				u32 tid = reader.Read<u32>();
+				u32 len = reader.Read<u32>();
+				size_t end = reader.GetPos() + len;
+				SCaptureThread& thread = threads[tid];
+
+				while (!reader.AtEnd() && reader.GetPos() < end)
+				{
+					u8 type = reader.Read<u8>();
+					if (type == CProfiler2::ITEM_SYNC)
+					{
+						thread.lastTime = reader.Read<double>();
+					}
+					else if (type == CProfiler2::ITEM_EVENT || type == CProfiler2::ITEM_ENTER || type == CProfiler2::ITEM_LEAVE)
+					{
+						float dt = reader.Read<float>();
+						u32 name = reader.Read<u32>();
+
+						thread.FlushEvent(writer, tid, strings);
+						thread.lastWasEvent = false;
+						if (thread.lastTime < 0)
+							continue;
+						thread.lastTime += (double)dt;
+
+						if (type == CProfiler2::ITEM_EVENT)
+						{
+							thread.hasPendingEvent = true;
+							thread.pendingEventTime = thread.lastTime;
+							thread.pendingEventName = name;
+							thread.lastWasEvent = true;
+						}
+						else if (type == CProfiler2::ITEM_ENTER)
+						{
+							writer.Event("B", thread.lastTime, tid, strings[name], std::vector<std::string>());
+							thread.regions.push_back(std::vector<std::string>());
+						}
+						else if (!thread.regions.empty()) // (ignore leaves from before the capture started)
+						{
+							writer.Event("E", thread.lastTime, tid, strings[name], thread.regions.back());
+							thread.regions.pop_back();
+						}
+					}
+					else if (type == CProfiler2::ITEM_ATTRIBUTE)
+					{
+						u16 attrLen = reader.Read<u16>();
+						std::string attribute = reader.ReadString(attrLen);
+
+						// Attributes belong to the latest event if it was the
+						// previous item, else to the current region
+						if (thread.lastWasEvent)
+							thread.pendingEventAttributes.push_back(attribute);
+						else if (!thread.regions.empty())
+							thread.regions.back().push_back(attribute);
+					}
+					else
+					{
+						debug_printf(L"Invalid item type %d in profiler capture\n", (int)type);
+						return false;
+					}
+				}
+				break;
+			}
+			default:
+				debug_printf(L"Invalid record type %d in profiler capture\n", (int)record);
+				return false;
+			}
+		}
+
+		if (reader.Error())
+			debug_printf(L"Profiler capture %hs is truncated\n", inputPath.c_str());
+
+		for (std::map<u32, SCaptureThread>::iterator it = threads.begin(); it != threads.end(); ++it)
+		{
+			it->second.FlushEvent(writer, it->first, strings);
+			it->second.CloseRegions(writer, it->first);
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,144 @@
+/* Copyright (c) 2013 Wildfire Games
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef INCLUDED_PROFILER2CAPTURE
+#define INCLUDED_PROFILER2CAPTURE
+
+#include "ps/Profiler2.h"
+
+#include <fstream>
+
+/**
+ * Used by CProfiler2 to continuously save the profiler data to a file.
+ *
+ * A background thread wakes up a few times per second, copies the items each
+ * thread has recorded since its last visit out of the thread's ring buffer,
+ * and appends them to the file. If a thread records so much that its buffer
+ * wraps around before the copy, the lost part is marked as a gap in the file.
+ *
+ * The file contains a header ("PS2TRACE" then a u32 version number), then a
+ * sequence of records, each starting with a u8 record type:
+ *  - REC_STRING: u32 id, u16 length, chars: the name of a region or event
+ *  - REC_THREAD: u32 id, u16 length, chars: the name of a thread
+ *  - REC_ITEMS: u32 thread id, u32 length, items: consecutive items from a thread
+ *  - REC_GAP: u32 thread id: some of the thread's items were lost
+ * Each item is a u8 CProfiler2::EItem, followed by:
+ *  - ITEM_SYNC: f64 time
+ *  - ITEM_EVENT, ITEM_ENTER, ITEM_LEAVE: f32 time since the previous item, u32 string id
+ *  - ITEM_ATTRIBUTE: u16 length, chars
+ * All numbers are stored in the native (little-endian) byte order.
+ * Each thread's items start with ITEM_SYNC, and again after each REC_GAP.
+ */
+class CProfiler2Capture
+{
+	NONCOPYABLE(CProfiler2Capture);
+
+public:
+	enum ERecord
+	{
+		REC_STRING = 1,
+		REC_THREAD = 2,
+		REC_ITEMS = 3,
+		REC_GAP = 4
+	};
+
+	static const u32 FILE_VERSION = 1;
+
+	CProfiler2Capture(CProfiler2& profiler);
+	~CProfiler2Capture();
+
+	/**
+	 * Opens the file and starts capturing all the profiler's current threads.
+	 * Must be called with the profiler's m_Mutex held.
+	 * Returns false on failure.
+	 */
+	bool Start(const OsPath& path);
+
+	/**
+	 * Stops the background thread, and saves everything it hadn't saved yet.
+	 * Must be called without the profiler's m_Mutex held.
+	 */
+	void Stop();
+
+	/**
+	 * Called by CProfiler2 (with its m_Mutex held) when threads are
+	 * registered and unregistered, so no data is lost at either end.
+	 */
+	void AddThread(CProfiler2::ThreadStorage& storage);
+	void RemoveThread(CProfiler2::ThreadStorage& storage);
+
+private:
+	struct SThreadState
+	{
+		u32 id;
+		u64 pos; // position in the thread's buffer that's been saved up to
+		bool resync; // whether the next item must be searched for (at the next sync marker)
+	};
+
+	static void* RunThread(void* data);
+
+	// Saves all threads' new data. Must be called with the profiler's m_Mutex held.
+	void CaptureAll();
+
+	// Saves one thread's new data. Must be called with the profiler's m_Mutex held.
+	void Capture(CProfiler2::ThreadStorage& storage, SThreadState& state);
+
+	// Converts items from the buffer, starting at @p offset, into the file's
+	// format, appending them to m_Items. If an invalid item is found, returns
+	// false with @p offset set to where to continue from.
+	bool EncodeItems(const std::string& data, size_t& offset, SThreadState& state);
+
+	// Converts the item at the start of @p buffer, returning its length,
+	// or 0 if it's invalid or truncated
+	size_t EncodeItem(const char* buffer, size_t length);
+
+	u32 GetStringID(const char* str);
+
+	void WriteString(ERecord type, u32 id, const std::string& str);
+
+	CProfiler2& m_Profiler;
+
+	std::ofstream m_File;
+
+	std::map<CProfiler2::ThreadStorage*, SThreadState> m_Threads;
+	u32 m_NextThreadID;
+
+	// IDs of the region and event names, which are always string literals
+	// (so the pointers are unique and remain valid)
+	std::map<const char*, u32> m_StringIDs;
+
+	std::string m_Items; // temporary buffer used by Capture
+
+	bool m_HasThread;
+	pthread_t m_Thread;
+	volatile bool m_Shutdown;
+};
+
+/**
+ * Converts the capture file at @p inputPath (as saved by CProfiler2::EnableCapture)
+ * into the Chrome trace viewer's JSON format (for chrome://tracing), and
+ * writes it into @p outputPath.
+ * Returns false on failure.
+ */
+bool ConvertProfile2Capture(const std::string& inputPath, const std::string& outputPath);
+
+#endif // INCLUDED_PROFILER2CAPTURE
@@ -0,0 +1,357 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "precompiled.h"
+
+#include "Profiler2Table.h"
+
+#include "ps/Profiler2.h"
+
+CProfiler2Table* g_Profiler2Table;
+
+// Length of the period the timings are averaged over, in seconds
+static const double STATS_DURATION = 2.0;
+
+// Minimum time between recomputing the timings, in seconds
+static const double REFRESH_INTERVAL = 1.0;
+
+/**
+ * Table for a region (or the whole of a thread), listing its child regions.
+ * Tables are never deleted until the root table is, since the profile viewer
+ * may still be displaying them; regions that weren't seen in the last refresh
+ * are just hidden from their parent.
+ */
+class CProfiler2RegionTable : public AbstractProfileTable
+{
+	NONCOPYABLE(CProfiler2RegionTable);
+public:
+	CProfiler2RegionTable(CProfiler2Table& root, CProfiler2RegionTable* thread, const std::string& name) :
+		m_Root(root), m_Thread(thread ? thread : this), m_Name(name),
+		m_Calls(0), m_Time(0.0), m_Duration(0.0)
+	{
+	}
+
+	~CProfiler2RegionTable()
+	{
+		for (size_t i = 0; i < m_Children.size(); ++i)
+			delete m_Children[i];
+	}
+
+	virtual CStr GetName()
+	{
+		return m_Name;
+	}
+
+	virtual CStr GetTitle()
+	{
+		char buf[512];
+		if (m_Thread == this)
+			sprintf_s(buf, ARRAY_SIZE(buf), "Profiler2 timings for thread: %s", m_Name.c_str());
+		else
+			sprintf_s(buf, ARRAY_SIZE(buf), "Profiler2 timings for: %s (%s)", m_Name.c_str(), FormatTime(m_Time).c_str());
+		return buf;
+	}
+
+	virtual size_t GetNumberRows()
+	{
+		m_Root.Refresh();
+		return m_Visible.size();
+	}
+
+	virtual const std::vector<ProfileColumn>& GetColumns()
+	{
+		return columnDescription.columns;
+	}
+
+	virtual CStr GetCellText(size_t row, size_t col)
+	{
+		if (row >= m_Visible.size())
+			return "!bad row!";
+
+		CProfiler2RegionTable* child = m_Visible[row];
+		char buf[256] = "?";
+
+		switch (col)
+		{
+		case 0:
+			return child->m_Name;
+		case 1:
+		{
+			double frameTime = m_Root.GetFrameTime();
+			if (frameTime == 0.0 || m_Thread->m_Duration == 0.0)
+				return "-";
+			sprintf_s(buf, ARRAY_SIZE(buf), "%.1f", child->m_Calls * frameTime / m_Thread->m_Duration);
+			break;
+		}
+		case 2:
+			return child->FormatTime(child->m_Time);
+		case 3:
+			return child->FormatPercent(child->m_Time);
+		}
+
+		return CStr(buf);
+	}
+
+	virtual AbstractProfileTable* GetChild(size_t row)
+	{
+		if (row >= m_Visible.size() || m_Visible[row]->m_Children.empty())
+			return NULL;
+		return m_Visible[row];
+	}
+
+	/**
+	 * Replaces this thread's timings with @p stats.
+	 */
+	void SetStats(const CProfiler2::SThreadStats& stats)
+	{
+		Reset();
+		m_Duration = stats.duration;
+
+		// Find the table for each region (creating them as necessary),
+		// relying on parents coming before their children
+		std::vector<CProfiler2RegionTable*> tables(stats.regions.size());
+		tables[0] = this;
+		for (size_t i = 1; i < stats.regions.size(); ++i)
+		{
+			const CProfiler2::SRegionStats& region = stats.regions[i];
+			CProfiler2RegionTable* table = tables[region.parent]->GetOrCreateChild(region.name);
+			table->m_Calls += region.calls;
+			table->m_Time += region.time;
+			tables[i] = table;
+		}
+
+		UpdateVisible();
+	}
+
+	/**
+	 * Returns the total time spent in this table's child regions.
+	 */
+	double GetChildrenTime()
+	{
+		double time = 0.0;
+		for (size_t i = 0; i < m_Visible.size(); ++i)
+			time += m_Visible[i]->m_Time;
+		return time;
+	}
+
+	/**
+	 * Returns the average number of msecs per frame that @p time
+	 * (in seconds, over this table's thread's whole period) represents,
+	 * as a string.
+	 */
+	std::string FormatTime(double time)
+	{
+		double frameTime = m_Root.GetFrameTime();
+		if (frameTime == 0.0 || m_Thread->m_Duration == 0.0)
+			return "-";
+		char buf[64];
+		sprintf_s(buf, ARRAY_SIZE(buf), "%.3f", time * 1000.0 * frameTime / m_Thread->m_Duration);
+		return buf;
+	}
+
+	/**
+	 * Returns the percentage of this table's thread's period that @p time
+	 * represents, as a string.
+	 */
+	std::string FormatPercent(double time)
+	{
+		if (m_Thread->m_Duration == 0.0)
+			return "-";
+		char buf[64];
+		sprintf_s(buf, ARRAY_SIZE(buf), "%.1f", time * 100.0 / m_Thread->m_Duration);
+		return buf;
+	}
+
+private:
+	CProfiler2RegionTable* GetOrCreateChild(const char* name)
+	{
+		// Different string literals might have the same name, so compare the strings
+		for (size_t i = 0; i < m_Children.size(); ++i)
+			if (m_Children[i]->m_Name == name)
+				return m_Children[i];
+
+		m_Children.push_back(new CProfiler2RegionTable(m_Root, m_Thread, name));
+		return m_Children.back();
+	}
+
+	void Reset()
+	{
+		m_Calls = 0;
+		m_Time = 0.0;
+		for (size_t i = 0; i < m_Children.size(); ++i)
+			m_Children[i]->Reset();
+	}
+
+	void UpdateVisible()
+	{
+		m_Visible.clear();
+		for (size_t i = 0; i < m_Children.size(); ++i)
+		{
+			if (m_Children[i]->m_Time > 0.0 || m_Children[i]->m_Calls)
+			{
+				m_Children[i]->UpdateVisible();
+				m_Visible.push_back(m_Children[i]);
+			}
+		}
+	}
+
+	struct ColumnDescription
+	{
+		std::vector<ProfileColumn> columns;
+
+		ColumnDescription()
+		{
+			columns.push_back(ProfileColumn("Name", 230));
+			columns.push_back(ProfileColumn("calls/frame", 80));
+			columns.push_back(ProfileColumn("msec/frame", 80));
+			columns.push_back(ProfileColumn("% of thread", 80));
+		}
+	};
+
+	static ColumnDescription columnDescription;
+
+	CProfiler2Table& m_Root;
+	CProfiler2RegionTable* m_Thread; // the table for the whole thread (might be this)
+	std::string m_Name;
+
+	u32 m_Calls;
+	double m_Time;
+	double m_Duration; // only used by thread tables
+
+	std::vector<CProfiler2RegionTable*> m_Children; // owned by this
+	std::vector<CProfiler2RegionTable*> m_Visible; // subset of m_Children that were seen in the last refresh
+};
+
+CProfiler2RegionTable::ColumnDescription CProfiler2RegionTable::columnDescription;
+
+
+CProfiler2Table::CProfiler2Table() :
+	m_LastRefresh(-REFRESH_INTERVAL), m_FrameTime(0.0)
+{
+	m_ColumnDescriptions.push_back(ProfileColumn("Thread", 230));
+	m_ColumnDescriptions.push_back(ProfileColumn("msec/frame", 80));
+	m_ColumnDescriptions.push_back(ProfileColumn("% busy", 80));
+}
+
+CProfiler2Table::~CProfiler2Table()
+{
+	for (size_t i = 0; i < m_Threads.size(); ++i)
+		delete m_Threads[i].table;
+}
+
+CStr CProfiler2Table::GetName()
+{
+	return "threads";
+}
+
+CStr CProfiler2Table::GetTitle()
+{
+	return "Profiler2 timings for all threads";
+}
+
+size_t CProfiler2Table::GetNumberRows()
+{
+	Refresh();
+	return m_ActiveThreads.size();
+}
+
+const std::vector<ProfileColumn>& CProfiler2Table::GetColumns()
+{
+	return m_ColumnDescriptions;
+}
+
+CStr CProfiler2Table::GetCellText(size_t row, size_t col)
+{
+	if (row >= m_ActiveThreads.size())
+		return "!bad row!";
+
+	const SThread& thread = m_Threads[m_ActiveThreads[row]];
+	switch (col)
+	{
+	case 0:
+		return thread.name;
+	case 1:
+		return thread.table->FormatTime(thread.table->GetChildrenTime());
+	case 2:
+		return thread.table->FormatPercent(thread.table->GetChildrenTime());
+	default:
+		return "?";
+	}
+}
+
+AbstractProfileTable* CProfiler2Table::GetChild(size_t row)
+{
+	if (row >= m_ActiveThreads.size())
+		return NULL;
+	return m_Threads[m_ActiveThreads[row]].table;
+}
+
+void CProfiler2Table::Refresh()
+{
+	double now = g_Profiler2.GetTime();
+	if (now < m_LastRefresh + REFRESH_INTERVAL)
+		return;
+	m_LastRefresh = now;
+
+	std::vector<CProfiler2::SThreadStats> stats;
+	g_Profiler2.ComputeRegionStats(STATS_DURATION, stats);
+
+	for (size_t i = 0; i < m_Threads.size(); ++i)
+		m_Threads[i].active = false;
+	m_ActiveThreads.clear();
+
+	// Use the frame rate of whichever thread records frames (normally the main thread)
+	m_FrameTime = 0.0;
+	u32 maxFrames = 0;
+	for (size_t i = 0; i < stats.size(); ++i)
+	{
+		if (stats[i].frames > maxFrames)
+		{
+			maxFrames = stats[i].frames;
+			m_FrameTime = stats[i].duration / stats[i].frames;
+		}
+	}
+
+	for (size_t i = 0; i < stats.size(); ++i)
+	{
+		// Several threads (e.g. the thread pool's workers) can have the same
+		// name, so number the later ones
+		std::string name = stats[i].name;
+		size_t number = 1;
+		for (size_t j = 0; j < i; ++j)
+			if (stats[j].name == stats[i].name)
+				++number;
+		if (number > 1)
+			name += " (" + CStr::FromUInt((unsigned int)number) + ")";
+
+		size_t index = 0;
+		while (index < m_Threads.size() && m_Threads[index].name != name)
+			++index;
+		if (index == m_Threads.size())
+		{
+			SThread thread;
+			thread.name = name;
+			thread.table = new CProfiler2RegionTable(*this, NULL, name);
+			m_Threads.push_back(thread);
+		}
+
+		m_Threads[index].table->SetStats(stats[i]);
+		m_Threads[index].active = true;
+		m_ActiveThreads.push_back(index);
+	}
+}
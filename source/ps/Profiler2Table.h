@@ -0,0 +1,84 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * In-game profile tables showing the timings recorded by Profiler2,
+ * for every registered thread.
+ */
+
+#ifndef INCLUDED_PROFILER2TABLE
+#define INCLUDED_PROFILER2TABLE
+
+#include "ps/ProfileViewer.h"
+
+class CProfiler2RegionTable;
+
+/**
+ * Root table listing every thread registered with g_Profiler2. Each row's
+ * child table shows that thread's regions, in the same tree structure (and
+ * with the same per-frame averages) as the old profiler's tables, so threads
+ * that can't use the old profiler are visible in-game too.
+ *
+ * The timings are computed from the threads' Profiler2 buffers, over the last
+ * couple of seconds, and only recomputed every second while a table is being
+ * displayed, so they're free when the profiler display is hidden.
+ */
+class CProfiler2Table : public AbstractProfileTable
+{
+	NONCOPYABLE(CProfiler2Table);
+public:
+	CProfiler2Table();
+	~CProfiler2Table();
+
+	virtual CStr GetName();
+	virtual CStr GetTitle();
+	virtual size_t GetNumberRows();
+	virtual const std::vector<ProfileColumn>& GetColumns();
+	virtual CStr GetCellText(size_t row, size_t col);
+	virtual AbstractProfileTable* GetChild(size_t row);
+
+	/**
+	 * Recomputes the timings, if they haven't been recomputed recently.
+	 */
+	void Refresh();
+
+	/**
+	 * Returns the average length of a frame, in seconds, or 0 if unknown.
+	 */
+	double GetFrameTime() const { return m_FrameTime; }
+
+private:
+	struct SThread
+	{
+		std::string name; // name used for display (made unique if several threads share a name)
+		CProfiler2RegionTable* table; // owned by this
+		bool active; // whether the thread still existed at the last refresh
+	};
+
+	std::vector<SThread> m_Threads;
+	std::vector<size_t> m_ActiveThreads; // indexes into m_Threads
+
+	double m_LastRefresh;
+	double m_FrameTime;
+
+	std::vector<ProfileColumn> m_ColumnDescriptions;
+};
+
+extern CProfiler2Table* g_Profiler2Table;
+
+#endif // INCLUDED_PROFILER2TABLE
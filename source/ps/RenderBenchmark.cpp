@@ -0,0 +1,221 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "precompiled.h"
+
+#include "RenderBenchmark.h"
+
+#include "graphics/CinemaTrack.h"
+#include "graphics/GameView.h"
+#include "lib/timer.h"
+#include "ps/CLogger.h"
+#include "ps/Game.h"
+#include "ps/Profiler2.h"
+#include "ps/Pyrogenesis.h"
+
+#include <fstream>
+#include <iomanip>
+
+const float CRenderBenchmark::FRAME_STEP = 1.f / 60.f;
+
+// Number of frames to render before starting the path
+static const int WARMUP_FRAMES = 60;
+
+// Number of frames to wait after the path, for the GPU timer queries to finish
+static const int DRAIN_FRAMES = 10;
+
+// How often to copy the GPU times out of the profiler's buffer, in frames
+static const int GPU_COLLECT_INTERVAL = 60;
+
+CRenderBenchmark::CRenderBenchmark(const CStrW& pathName, const OsPath& outputPath) :
+	m_State(WAITING), m_StateFrames(0), m_PathName(pathName), m_OutputPath(outputPath),
+	m_LastFrameTime(0.0), m_GPUSince(0.0)
+{
+	for (size_t i = 0; i < CRenderer::NUM_STATE_PASSES; ++i)
+		m_PassDrawCalls[i] = m_PassTris[i] = 0;
+}
+
+bool CRenderBenchmark::Frame()
+{
+	double now = timer_Time();
+	double frameTime = now - m_LastFrameTime;
+	m_LastFrameTime = now;
+	++m_StateFrames;
+
+	switch (m_State)
+	{
+	case WAITING:
+		if (g_Game && g_Game->IsGameStarted() && g_Game->GetView())
+		{
+			m_State = WARMING_UP;
+			m_StateFrames = 0;
+		}
+		break;
+
+	case WARMING_UP:
+		if (m_StateFrames >= WARMUP_FRAMES)
+		{
+			if (!Start())
+				return false;
+			m_State = RUNNING;
+			m_StateFrames = 0;
+		}
+		break;
+
+	case RUNNING:
+	{
+		m_FrameTimes.push_back(frameTime);
+
+		const CRenderer::Stats& stats = g_Renderer.GetStats();
+		m_DrawCalls.push_back(stats.m_DrawCalls);
+		m_Tris.push_back(stats.GetTotalTris());
+		for (size_t i = 0; i < CRenderer::NUM_STATE_PASSES; ++i)
+		{
+			m_PassDrawCalls[i] += stats.m_PassDrawCalls[i];
+			m_PassTris[i] += stats.m_PassTris[i];
+		}
+
+		if (m_StateFrames % GPU_COLLECT_INTERVAL == 0)
+			CollectGPUFrames();
+
+		if (!g_Game->GetView()->GetCinema()->IsPlaying())
+		{
+			m_State = DRAINING;
+			m_StateFrames = 0;
+		}
+		break;
+	}
+
+	case DRAINING:
+		if (m_StateFrames >= DRAIN_FRAMES)
+		{
+			Finish();
+			return false;
+		}
+		break;
+	}
+
+	return true;
+}
+
+bool CRenderBenchmark::Start()
+{
+	CCinemaManager* cinema = g_Game->GetView()->GetCinema();
+	if (!cinema->HasTrack(m_PathName))
+	{
+		LOGERROR(L"Benchmark: map has no cinematic path named \"%ls\"", m_PathName.c_str());
+		return false;
+	}
+
+	LOGMESSAGE(L"Benchmark: playing cinematic path \"%ls\"", m_PathName.c_str());
+
+	cinema->OverridePath(m_PathName);
+	cinema->SetActive(true);
+
+	// Only count GPU frames from now on
+	m_GPUSince = g_Profiler2.GetTime();
+	return true;
+}
+
+void CRenderBenchmark::CollectGPUFrames()
+{
+	// Only the frames that were rendered before the path finished
+	// (plus maybe a couple more from the draining period)
+	if (m_GPUFrameTimes.size() < m_FrameTimes.size())
+		g_Profiler2.ComputeRegionDurations("gpu", "frame", m_GPUSince, m_GPUFrameTimes);
+	if (m_GPUFrameTimes.size() > m_FrameTimes.size())
+		m_GPUFrameTimes.resize(m_FrameTimes.size());
+}
+
+double CRenderBenchmark::Percentile(const std::vector<double>& sorted, double fraction)
+{
+	if (sorted.empty())
+		return 0.0;
+	size_t index = (size_t)ceil(fraction * sorted.size());
+	return sorted[std::min(std::max(index, (size_t)1), sorted.size()) - 1];
+}
+
+void CRenderBenchmark::WriteTimes(std::ostream& stream, const char* name, std::vector<double> times)
+{
+	std::sort(times.begin(), times.end());
+
+	double total = 0.0;
+	for (size_t i = 0; i < times.size(); ++i)
+		total += times[i];
+
+	// (all in msecs)
+	stream << "\"" << name << "\":{";
+	stream << "\"frames\":" << times.size();
+	stream << ",\"mean\":" << (times.empty() ? 0.0 : total * 1000.0 / times.size());
+	stream << ",\"p50\":" << Percentile(times, 0.50) * 1000.0;
+	stream << ",\"p95\":" << Percentile(times, 0.95) * 1000.0;
+	stream << ",\"p99\":" << Percentile(times, 0.99) * 1000.0;
+	stream << ",\"max\":" << (times.empty() ? 0.0 : times.back() * 1000.0);
+	stream << "}";
+}
+
+void CRenderBenchmark::Finish()
+{
+	CollectGPUFrames();
+
+	OsPath path = m_OutputPath.empty() ? psLogDir()/"benchmark.json" : m_OutputPath;
+	std::ofstream stream(OsString(path).c_str(), std::ofstream::out | std::ofstream::trunc);
+	if (!stream.good())
+	{
+		LOGERROR(L"Benchmark: failed to open \"%ls\"", path.string().c_str());
+		return;
+	}
+
+	size_t frames = m_FrameTimes.size();
+	u64 drawCalls = 0;
+	u64 tris = 0;
+	for (size_t i = 0; i < frames; ++i)
+	{
+		drawCalls += m_DrawCalls[i];
+		tris += m_Tris[i];
+	}
+
+	stream << std::fixed << std::setprecision(3);
+	stream << "{\"path\":\"" << CStr(m_PathName.ToUTF8()).EscapeToPrintableASCII() << "\",\n";
+	stream << "\"renderpath\":\"" << CRenderer::GetRenderPathName(g_Renderer.GetRenderPath()) << "\",\n";
+	stream << "\"shadows\":" << (g_Renderer.GetOptionBool(CRenderer::OPT_SHADOWS) ? "true" : "false") << ",\n";
+	stream << "\"shadowpcf\":" << (g_Renderer.GetOptionBool(CRenderer::OPT_SHADOWPCF) ? "true" : "false") << ",\n";
+	stream << "\"waterreflection\":" << (g_Renderer.GetOptionBool(CRenderer::OPT_WATERREFLECTION) ? "true" : "false") << ",\n";
+	stream << "\"waterrefraction\":" << (g_Renderer.GetOptionBool(CRenderer::OPT_WATERREFRACTION) ? "true" : "false") << ",\n";
+	stream << "\"particles\":" << (g_Renderer.GetOptionBool(CRenderer::OPT_PARTICLES) ? "true" : "false") << ",\n";
+	stream << "\"width\":" << g_Renderer.GetWidth() << ",\"height\":" << g_Renderer.GetHeight() << ",\n";
+	WriteTimes(stream, "cpu", m_FrameTimes);
+	stream << ",\n";
+	WriteTimes(stream, "gpu", m_GPUFrameTimes);
+	stream << ",\n";
+	stream << "\"drawcalls\":" << (frames ? (double)drawCalls / frames : 0.0) << ",\n";
+	stream << "\"tris\":" << (frames ? (double)tris / frames : 0.0) << ",\n";
+	stream << "\"passes\":{";
+	for (size_t i = 0; i < CRenderer::NUM_STATE_PASSES; ++i)
+	{
+		if (i != 0)
+			stream << ",";
+		stream << "\n\"" << CRenderer::GetStatePassName((CRenderer::StatePass)i) << "\":{";
+		stream << "\"drawcalls\":" << (frames ? (double)m_PassDrawCalls[i] / frames : 0.0);
+		stream << ",\"tris\":" << (frames ? (double)m_PassTris[i] / frames : 0.0);
+		stream << "}";
+	}
+	stream << "\n}}\n";
+
+	LOGMESSAGE(L"Benchmark: saved results for %lu frames to \"%ls\"", (unsigned long)frames, path.string().c_str());
+}
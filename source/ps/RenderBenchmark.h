@@ -0,0 +1,94 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef INCLUDED_RENDERBENCHMARK
+#define INCLUDED_RENDERBENCHMARK
+
+#include "lib/os_path.h"
+#include "renderer/Renderer.h"
+
+/**
+ * Renderer benchmark mode (enabled with the -benchmark command-line option,
+ * together with -autostart).
+ *
+ * Once the game has started, it plays one of the map's cinematic camera paths,
+ * with the main loop advancing by a fixed time step every frame (instead of
+ * real time) so every run renders exactly the same frames. It records each
+ * frame's CPU time, GPU time (from Profiler2GPU, if available), draw calls and
+ * triangles, and when the path finishes it writes the frame time percentiles
+ * and per-pass averages to a JSON file, then quits the game.
+ *
+ * Run it with different renderer settings (via -conf) to compare them.
+ */
+class CRenderBenchmark
+{
+	NONCOPYABLE(CRenderBenchmark);
+public:
+	/**
+	 * @param pathName name of the cinematic path to play
+	 * @param outputPath file to write the results to (or empty for
+	 *   benchmark.json in the logs directory)
+	 */
+	CRenderBenchmark(const CStrW& pathName, const OsPath& outputPath);
+
+	/**
+	 * Length of time (in seconds) the main loop should advance by every frame.
+	 */
+	static const float FRAME_STEP;
+
+	/**
+	 * Call at the end of every frame, after rendering it.
+	 * Returns false when the benchmark has finished and the game should quit.
+	 */
+	bool Frame();
+
+private:
+	bool Start();
+	void Finish();
+	void CollectGPUFrames();
+
+	static double Percentile(const std::vector<double>& sorted, double fraction);
+	static void WriteTimes(std::ostream& stream, const char* name, std::vector<double> times);
+
+	enum EState
+	{
+		WAITING, // game hasn't started yet
+		WARMING_UP, // rendering a few frames before the path starts, to load things
+		RUNNING, // playing the path
+		DRAINING // waiting for the last GPU results
+	};
+
+	EState m_State;
+	int m_StateFrames; // number of frames since entering the current state
+
+	CStrW m_PathName;
+	OsPath m_OutputPath;
+
+	double m_LastFrameTime;
+
+	std::vector<double> m_FrameTimes; // CPU time of each frame, in seconds
+	std::vector<double> m_GPUFrameTimes; // GPU time of each frame, in seconds
+	double m_GPUSince; // start time of the latest frame in m_GPUFrameTimes
+
+	std::vector<size_t> m_DrawCalls; // per frame
+	std::vector<size_t> m_Tris; // per frame
+	u64 m_PassDrawCalls[CRenderer::NUM_STATE_PASSES]; // summed over all frames
+	u64 m_PassTris[CRenderer::NUM_STATE_PASSES]; // summed over all frames
+};
+
+#endif // INCLUDED_RENDERBENCHMARK
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,6 +24,9 @@
 #include "lib/file/file_system.h"
 #include "lib/res/h_mgr.h"
 #include "lib/tex/tex.h"
+#include "network/NetMessage.h"
+#include "network/Serialization.h"
+#include "ps/ConfigDB.h"
 #include "ps/Game.h"
 #include "ps/Loader.h"
 #include "ps/Profile.h"
@@ -32,6 +35,8 @@
 #include "scriptinterface/ScriptStats.h"
 #include "simulation2/Simulation2.h"
 #include "simulation2/helpers/SimulationCommand.h"
+#include "simulation2/system/ComponentManager.h"
+#include "simulation2/system/SimContext.h"
 
 #include <sstream>
 #include <fstream>
@@ -42,6 +47,10 @@
 #define getpid _getpid // use the non-deprecated function name
 #endif
 
+#if OS_UNIX
+#include <sys/resource.h>
+#endif
+
 static std::string Hexify(const std::string& s)
 {
 	std::stringstream str;
@@ -51,8 +60,379 @@ static std::string Hexify(const std::string& s)
 	return str.str();
 }
 
+static std::string Unhexify(const std::string& s)
+{
+	std::string ret;
+	for (size_t i = 0; i + 1 < s.size(); i += 2)
+	{
+		int c;
+		std::stringstream str(s.substr(i, 2));
+		str >> std::hex >> c;
+		ret += (char)c;
+	}
+	return ret;
+}
+
+/**
+ * Returns the peak resident memory usage of the process in KiB, or 0 if unknown.
+ */
+static size_t GetPeakMemoryUsage()
+{
+#if OS_UNIX
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+	{
+#if OS_MACOSX
+		return (size_t)usage.ru_maxrss / KiB; // (OS X reports bytes instead of KiB)
+#else
+		return (size_t)usage.ru_maxrss;
+#endif
+	}
+#endif
+	return 0;
+}
+
+/**
+ * A single entry in a replay log, independent of the log's format.
+ */
+struct ReplayRecord
+{
+	enum Type { START, TURN, COMMAND, END, HASH, HASH_QUICK };
+
+	Type type;
+	u32 turn; // TURN, COMMAND
+	u32 turnLength; // TURN
+	i32 player; // COMMAND
+	CScriptValRooted data; // game attributes for START, command data for COMMAND
+	std::string hash; // raw hash for HASH, HASH_QUICK
+};
+
+/*
+ * Binary replay logs start with BINARY_REPLAY_MAGIC, followed by records of
+ * a type byte and a payload:
+ *   START, COMMAND: u32 length, serialized CGameSetupMessage/CSimulationMessage
+ *   START_JSON, COMMAND_JSON: (for data too large for a network message)
+ *     COMMAND_JSON only: u32 player; then u32 length, JSON string
+ *   TURN: u32 turn, u32 turn length
+ *   END: nothing
+ *   HASH, HASH_QUICK: u8 length, raw hash
+ * Integers are big-endian, like the network messages.
+ */
+
+static const char BINARY_REPLAY_MAGIC[] = "0ADRPLY1";
+static const size_t BINARY_REPLAY_MAGIC_LENGTH = 8;
+
+enum BinaryReplayRecordType
+{
+	BINARY_START = 1,
+	BINARY_TURN,
+	BINARY_COMMAND,
+	BINARY_END,
+	BINARY_HASH,
+	BINARY_HASH_QUICK,
+	BINARY_START_JSON,
+	BINARY_COMMAND_JSON
+};
+
+// The network message header stores the size in 16 bits
+static const size_t MAX_NET_MESSAGE_SIZE = 0xFFFF;
+
+static void WriteU32(std::ostream& stream, u32 value)
+{
+	u8 buf[4];
+	u8* pos = buf;
+	Serialize_int_4(pos, value);
+	stream.write((const char*)buf, sizeof(buf));
+}
+
+static bool ReadU32(std::istream& stream, u32& value)
+{
+	u8 buf[4];
+	if (!stream.read((char*)buf, sizeof(buf)))
+		return false;
+	const u8* pos = buf;
+	Deserialize_int_4(pos, value);
+	return true;
+}
+
+static void WriteBlock(std::ostream& stream, const u8* data, size_t length)
+{
+	WriteU32(stream, (u32)length);
+	stream.write((const char*)data, length);
+}
+
+static bool ReadBlock(std::istream& stream, std::vector<u8>& data)
+{
+	u32 length;
+	if (!ReadU32(stream, length))
+		return false;
+	data.resize(length);
+	return length == 0 || stream.read((char*)&data[0], length);
+}
+
+static void WriteNetMessage(std::ostream& stream, const CNetMessage& message)
+{
+	std::vector<u8> buf(message.GetSerializedLength());
+	message.Serialize(&buf[0]);
+	WriteBlock(stream, &buf[0], buf.size());
+}
+
+static void WriteJSON(std::ostream& stream, ScriptInterface& scriptInterface, const CScriptValRooted& data)
+{
+	std::string json = scriptInterface.StringifyJSON(data.get(), false);
+	WriteBlock(stream, (const u8*)json.data(), json.size());
+}
+
+static bool ReadJSON(std::istream& stream, ScriptInterface& scriptInterface, CScriptValRooted& data)
+{
+	std::vector<u8> buf;
+	if (!ReadBlock(stream, buf))
+		return false;
+	data = scriptInterface.ParseJSON(std::string(buf.begin(), buf.end()));
+	return true;
+}
+
+static void WriteBinaryRecord(std::ostream& stream, ScriptInterface& scriptInterface, const ReplayRecord& record)
+{
+	switch (record.type)
+	{
+	case ReplayRecord::START:
+	{
+		CGameSetupMessage message(scriptInterface, record.data.get());
+		if (message.GetSerializedLength() > MAX_NET_MESSAGE_SIZE)
+		{
+			stream.put(BINARY_START_JSON);
+			WriteJSON(stream, scriptInterface, record.data);
+		}
+		else
+		{
+			stream.put(BINARY_START);
+			WriteNetMessage(stream, message);
+		}
+		break;
+	}
+	case ReplayRecord::TURN:
+		stream.put(BINARY_TURN);
+		WriteU32(stream, record.turn);
+		WriteU32(stream, record.turnLength);
+		break;
+	case ReplayRecord::COMMAND:
+	{
+		CSimulationMessage message(scriptInterface, 0, record.player, record.turn, record.data.get());
+		if (message.GetSerializedLength() > MAX_NET_MESSAGE_SIZE)
+		{
+			stream.put(BINARY_COMMAND_JSON);
+			WriteU32(stream, (u32)record.player);
+			WriteJSON(stream, scriptInterface, record.data);
+		}
+		else
+		{
+			stream.put(BINARY_COMMAND);
+			WriteNetMessage(stream, message);
+		}
+		break;
+	}
+	case ReplayRecord::END:
+		stream.put(BINARY_END);
+		break;
+	case ReplayRecord::HASH:
+	case ReplayRecord::HASH_QUICK:
+		ENSURE(record.hash.size() <= 255);
+		stream.put(record.type == ReplayRecord::HASH ? BINARY_HASH : BINARY_HASH_QUICK);
+		stream.put((char)record.hash.size());
+		stream.write(record.hash.data(), record.hash.size());
+		break;
+	}
+}
+
+/**
+ * Reads the next record from a binary replay log.
+ * Returns false at the end of the log, or if it is corrupt.
+ */
+static bool ReadBinaryRecord(std::istream& stream, ScriptInterface& scriptInterface, ReplayRecord& record)
+{
+	int type = stream.get();
+	if (type == EOF)
+		return false;
+
+	switch (type)
+	{
+	case BINARY_START:
+	{
+		std::vector<u8> buf;
+		CGameSetupMessage message(scriptInterface);
+		if (!ReadBlock(stream, buf) || buf.empty() || !message.Deserialize(&buf[0], &buf[0] + buf.size()))
+			break;
+		record.type = ReplayRecord::START;
+		record.data = message.m_Data;
+		return true;
+	}
+	case BINARY_START_JSON:
+		if (!ReadJSON(stream, scriptInterface, record.data))
+			break;
+		record.type = ReplayRecord::START;
+		return true;
+	case BINARY_TURN:
+		if (!ReadU32(stream, record.turn) || !ReadU32(stream, record.turnLength))
+			break;
+		record.type = ReplayRecord::TURN;
+		return true;
+	case BINARY_COMMAND:
+	{
+		std::vector<u8> buf;
+		CSimulationMessage message(scriptInterface);
+		if (!ReadBlock(stream, buf) || buf.empty() || !message.Deserialize(&buf[0], &buf[0] + buf.size()))
+			break;
+		record.type = ReplayRecord::COMMAND;
+		record.turn = message.m_Turn;
+		record.player = message.m_Player;
+		record.data = message.m_Data;
+		return true;
+	}
+	case BINARY_COMMAND_JSON:
+	{
+		u32 player;
+		if (!ReadU32(stream, player) || !ReadJSON(stream, scriptInterface, record.data))
+			break;
+		record.type = ReplayRecord::COMMAND;
+		record.player = (i32)player;
+		return true;
+	}
+	case BINARY_END:
+		record.type = ReplayRecord::END;
+		return true;
+	case BINARY_HASH:
+	case BINARY_HASH_QUICK:
+	{
+		int length = stream.get();
+		if (length == EOF)
+			break;
+		record.hash.resize(length);
+		if (length && !stream.read(&record.hash[0], length))
+			break;
+		record.type = (type == BINARY_HASH ? ReplayRecord::HASH : ReplayRecord::HASH_QUICK);
+		return true;
+	}
+	default:
+		debug_printf(L"Unrecognised binary replay record type %d\n", type);
+		return false;
+	}
+
+	debug_printf(L"Truncated or corrupt binary replay record (type %d)\n", type);
+	return false;
+}
+
+static void WriteTextRecord(std::ostream& stream, ScriptInterface& scriptInterface, const ReplayRecord& record)
+{
+	switch (record.type)
+	{
+	case ReplayRecord::START:
+		stream << "start " << scriptInterface.StringifyJSON(record.data.get(), false) << "\n";
+		break;
+	case ReplayRecord::TURN:
+		stream << "turn " << record.turn << " " << record.turnLength << "\n";
+		break;
+	case ReplayRecord::COMMAND:
+		stream << "cmd " << record.player << " " << scriptInterface.StringifyJSON(record.data.get(), false) << "\n";
+		break;
+	case ReplayRecord::END:
+		stream << "end\n";
+		break;
+	case ReplayRecord::HASH:
+		stream << "hash " << Hexify(record.hash) << "\n";
+		break;
+	case ReplayRecord::HASH_QUICK:
+		stream << "hash-quick " << Hexify(record.hash) << "\n";
+		break;
+	}
+}
+
+/**
+ * Reads the next record from a text replay log, skipping unrecognised ones.
+ * Returns false at the end of the log.
+ */
+static bool ReadTextRecord(std::istream& stream, ScriptInterface& scriptInterface, ReplayRecord& record)
+{
+	std::string type;
+	while ((stream >> type).good())
+	{
+		if (type == "start")
+		{
+			std::string line;
+			std::getline(stream, line);
+			record.type = ReplayRecord::START;
+			record.data = scriptInterface.ParseJSON(line);
+			return true;
+		}
+		else if (type == "turn")
+		{
+			stream >> record.turn >> record.turnLength;
+			record.type = ReplayRecord::TURN;
+			return true;
+		}
+		else if (type == "cmd")
+		{
+			stream >> record.player;
+			std::string line;
+			std::getline(stream, line);
+			record.type = ReplayRecord::COMMAND;
+			record.data = scriptInterface.ParseJSON(line);
+			return true;
+		}
+		else if (type == "hash" || type == "hash-quick")
+		{
+			std::string hexHash;
+			stream >> hexHash;
+			record.type = (type == "hash" ? ReplayRecord::HASH : ReplayRecord::HASH_QUICK);
+			record.hash = Unhexify(hexHash);
+			return true;
+		}
+		else if (type == "end")
+		{
+			record.type = ReplayRecord::END;
+			return true;
+		}
+		else
+		{
+			debug_printf(L"Unrecognised replay token %hs\n", type.c_str());
+		}
+	}
+	return false;
+}
+
+static void WriteRecord(std::ostream& stream, ScriptInterface& scriptInterface, bool binary, const ReplayRecord& record)
+{
+	if (binary)
+		WriteBinaryRecord(stream, scriptInterface, record);
+	else
+		WriteTextRecord(stream, scriptInterface, record);
+}
+
+static bool ReadRecord(std::istream& stream, ScriptInterface& scriptInterface, bool binary, ReplayRecord& record)
+{
+	if (binary)
+		return ReadBinaryRecord(stream, scriptInterface, record);
+	else
+		return ReadTextRecord(stream, scriptInterface, record);
+}
+
+/**
+ * Returns whether the stream contains a binary replay log, leaving it positioned
+ * at the first record.
+ */
+static bool ReadBinaryReplayMagic(std::istream& stream)
+{
+	char magic[BINARY_REPLAY_MAGIC_LENGTH];
+	if (stream.read(magic, sizeof(magic)) && memcmp(magic, BINARY_REPLAY_MAGIC, sizeof(magic)) == 0)
+		return true;
+
+	stream.clear();
+	stream.seekg(0);
+	return false;
+}
+
 CReplayLogger::CReplayLogger(ScriptInterface& scriptInterface) :
-	m_ScriptInterface(scriptInterface)
+	m_ScriptInterface(scriptInterface), m_Binary(false)
 {
 	// Construct the directory name based on the PID, to be relatively unique.
 	// Append "-1", "-2" etc if we run multiple matches in a single session,
@@ -65,44 +445,71 @@ CReplayLogger::CReplayLogger(ScriptInterface& scriptInterface) :
 	if (++run)
 		name << "-" << run;
 
-	OsPath path = psLogDir() / L"sim_log" / name.str() / L"commands.txt";
+	if (CConfigDB::IsInitialised())
+		CFG_GET_USER_VAL("replay.binary", Bool, m_Binary);
+
+	OsPath path = psLogDir() / L"sim_log" / name.str() / (m_Binary ? L"commands.bin" : L"commands.txt");
 	CreateDirectories(path.Parent(), 0700);
-	m_Stream = new std::ofstream(OsString(path).c_str(), std::ofstream::out | std::ofstream::trunc);
+	std::ios_base::openmode mode = std::ofstream::out | std::ofstream::trunc;
+	if (m_Binary)
+		mode |= std::ofstream::binary;
+	m_Stream = new std::ofstream(OsString(path).c_str(), mode);
+	m_IndexStream = new std::ofstream((OsString(path) + ".index").c_str(), std::ofstream::out | std::ofstream::trunc);
+
+	if (m_Binary)
+		m_Stream->write(BINARY_REPLAY_MAGIC, BINARY_REPLAY_MAGIC_LENGTH);
 }
 
 CReplayLogger::~CReplayLogger()
 {
+	delete m_IndexStream;
 	delete m_Stream;
 }
 
 void CReplayLogger::StartGame(const CScriptValRooted& attribs)
 {
-	*m_Stream << "start " << m_ScriptInterface.StringifyJSON(attribs.get(), false) << "\n";
+	ReplayRecord record;
+	record.type = ReplayRecord::START;
+	record.data = attribs;
+	WriteRecord(*m_Stream, m_ScriptInterface, m_Binary, record);
 }
 
 void CReplayLogger::Turn(u32 n, u32 turnLength, const std::vector<SimulationCommand>& commands)
 {
-	*m_Stream << "turn " << n << " " << turnLength << "\n";
+	*m_IndexStream << "turn " << n << " " << (i64)m_Stream->tellp() << "\n";
+	m_IndexStream->flush();
+
+	ReplayRecord record;
+	record.type = ReplayRecord::TURN;
+	record.turn = n;
+	record.turnLength = turnLength;
+	WriteRecord(*m_Stream, m_ScriptInterface, m_Binary, record);
+
+	record.type = ReplayRecord::COMMAND;
 	for (size_t i = 0; i < commands.size(); ++i)
 	{
-		*m_Stream << "cmd " << commands[i].player << " " << m_ScriptInterface.StringifyJSON(commands[i].data.get(), false) << "\n";
+		record.player = commands[i].player;
+		record.data = commands[i].data;
+		WriteRecord(*m_Stream, m_ScriptInterface, m_Binary, record);
 	}
-	*m_Stream << "end\n";
+
+	record.type = ReplayRecord::END;
+	WriteRecord(*m_Stream, m_ScriptInterface, m_Binary, record);
 	m_Stream->flush();
 }
 
 void CReplayLogger::Hash(const std::string& hash, bool quick)
 {
-	if (quick)
-		*m_Stream << "hash-quick " << Hexify(hash) << "\n";
-	else
-		*m_Stream << "hash " << Hexify(hash) << "\n";
+	ReplayRecord record;
+	record.type = (quick ? ReplayRecord::HASH_QUICK : ReplayRecord::HASH);
+	record.hash = hash;
+	WriteRecord(*m_Stream, m_ScriptInterface, m_Binary, record);
 }
 
 ////////////////////////////////////////////////////////////////
 
 CReplayPlayer::CReplayPlayer() :
-	m_Stream(NULL)
+	m_Stream(NULL), m_Binary(false), m_CheckpointInterval(0), m_SeekTurn(0)
 {
 }
 
@@ -115,8 +522,92 @@ void CReplayPlayer::Load(const std::string& path)
 {
 	ENSURE(!m_Stream);
 
-	m_Stream = new std::ifstream(path.c_str());
+	m_Stream = new std::ifstream(path.c_str(), std::ifstream::in | std::ifstream::binary);
 	ENSURE(m_Stream->good());
+	m_Binary = ReadBinaryReplayMagic(*m_Stream);
+	m_Path = path;
+}
+
+void CReplayPlayer::SetStatsOutput(const std::string& path)
+{
+	m_StatsPath = path;
+}
+
+void CReplayPlayer::SetCheckpointInterval(u32 numTurns)
+{
+	m_CheckpointInterval = numTurns;
+}
+
+void CReplayPlayer::SetSeekTurn(u32 turn)
+{
+	m_SeekTurn = turn;
+}
+
+std::string CReplayPlayer::GetCheckpointPath(u32 turn) const
+{
+	std::stringstream path;
+	path << m_Path << ".checkpoint-" << turn;
+	return path.str();
+}
+
+u32 CReplayPlayer::SeekToCheckpoint(CSimulation2& simulation)
+{
+	std::ifstream indexStream((m_Path + ".index").c_str());
+	if (!indexStream.good())
+	{
+		debug_printf(L"No replay index found - replaying from the start\n");
+		return 0;
+	}
+
+	std::map<u32, i64> turnOffsets;
+	u32 checkpointTurn = 0;
+	bool foundCheckpoint = false;
+
+	std::string type;
+	while ((indexStream >> type).good())
+	{
+		u32 turn;
+		if (type == "turn")
+		{
+			i64 offset;
+			indexStream >> turn >> offset;
+			turnOffsets[turn] = offset;
+		}
+		else if (type == "checkpoint")
+		{
+			indexStream >> turn;
+			if (turn <= m_SeekTurn && turn >= checkpointTurn)
+			{
+				checkpointTurn = turn;
+				foundCheckpoint = true;
+			}
+		}
+		else
+		{
+			debug_printf(L"Unrecognised replay index token %hs\n", type.c_str());
+			std::getline(indexStream, type);
+		}
+	}
+
+	// We need to continue from the turn after the checkpoint
+	std::map<u32, i64>::iterator next = turnOffsets.find(checkpointTurn + 1);
+	if (!foundCheckpoint || next == turnOffsets.end())
+	{
+		debug_printf(L"No replay checkpoint found before turn %u - replaying from the start\n", m_SeekTurn);
+		return 0;
+	}
+
+	std::string checkpointPath = GetCheckpointPath(checkpointTurn);
+	std::ifstream checkpointStream(checkpointPath.c_str(), std::ifstream::in | std::ifstream::binary);
+	if (!checkpointStream.good() || !simulation.DeserializeState(checkpointStream))
+	{
+		debug_printf(L"Failed to load replay checkpoint %hs - replaying from the start\n", checkpointPath.c_str());
+		return 0;
+	}
+
+	m_Stream->seekg((std::streamoff)next->second);
+	debug_printf(L"Loaded checkpoint at turn %u\n", checkpointTurn);
+	return checkpointTurn;
 }
 
 void CReplayPlayer::Replay()
@@ -144,48 +635,69 @@ void CReplayPlayer::Replay()
 	u32 turn = 0;
 	u32 turnLength = 0;
 
-	std::string type;
-	while ((*m_Stream >> type).good())
+	std::ofstream statsStream;
+	u32 jsHeapHighWater = 0;
+	if (!m_StatsPath.empty())
+	{
+		statsStream.open(m_StatsPath.c_str(), std::ofstream::out | std::ofstream::trunc);
+		ENSURE(statsStream.good());
+		statsStream << "turn,turn_length,sim_time_ms,js_heap_bytes,js_heap_peak_bytes,peak_memory_kib\n";
+		game.GetSimulation2()->EnableMessageStats();
+	}
+
+	// When saving checkpoints, we write a new index containing them
+	// (which would need to be merged with the old one if we didn't start from
+	// the beginning, so that's not supported)
+	if (m_CheckpointInterval && m_SeekTurn)
+	{
+		debug_printf(L"Can't save replay checkpoints when seeking - ignoring checkpoints\n");
+		m_CheckpointInterval = 0;
+	}
+
+	std::ofstream indexStream;
+	if (m_CheckpointInterval)
+	{
+		indexStream.open((m_Path + ".index").c_str(), std::ofstream::out | std::ofstream::trunc);
+		ENSURE(indexStream.good());
+	}
+
+	ScriptInterface& scriptInterface = game.GetSimulation2()->GetScriptInterface();
+	ReplayRecord record;
+	std::streamoff offset = m_Stream->tellg(); // start of the current record
+	while (ReadRecord(*m_Stream, scriptInterface, m_Binary, record))
 	{
 //		if (turn >= 1400) break;
 
-		if (type == "start")
+		if (record.type == ReplayRecord::START)
 		{
-			std::string line;
-			std::getline(*m_Stream, line);
-			CScriptValRooted attribs = game.GetSimulation2()->GetScriptInterface().ParseJSON(line);
-
-			game.StartGame(attribs, "");
+			game.StartGame(record.data, "");
 
 			// TODO: Non progressive load can fail - need a decent way to handle this
 			LDR_NonprogressiveLoad();
 
 			PSRETURN ret = game.ReallyStartGame();
 			ENSURE(ret == PSRETURN_OK);
+
+			if (m_SeekTurn)
+				turn = SeekToCheckpoint(*game.GetSimulation2());
 		}
-		else if (type == "turn")
+		else if (record.type == ReplayRecord::TURN)
 		{
-			*m_Stream >> turn >> turnLength;
+			turn = record.turn;
+			turnLength = record.turnLength;
 			debug_printf(L"Turn %u (%u)... ", turn, turnLength);
+
+			if (indexStream.is_open())
+				indexStream << "turn " << turn << " " << (i64)offset << "\n";
 		}
-		else if (type == "cmd")
+		else if (record.type == ReplayRecord::COMMAND)
 		{
-			u32 player;
-			*m_Stream >> player;
-
-			std::string line;
-			std::getline(*m_Stream, line);
-			CScriptValRooted data = game.GetSimulation2()->GetScriptInterface().ParseJSON(line);
-
-			SimulationCommand cmd = { player, data };
+			SimulationCommand cmd = { record.player, record.data };
 			commands.push_back(cmd);
 		}
-		else if (type == "hash" || type == "hash-quick")
+		else if (record.type == ReplayRecord::HASH || record.type == ReplayRecord::HASH_QUICK)
 		{
-			std::string replayHash;
-			*m_Stream >> replayHash;
-
-			bool quick = (type == "hash-quick");
+			bool quick = (record.type == ReplayRecord::HASH_QUICK);
 
 //			if (turn >= 1300)
 //			if (turn >= 0)
@@ -194,14 +706,13 @@ void CReplayPlayer::Replay()
 				std::string hash;
 				bool ok = game.GetSimulation2()->ComputeStateHash(hash, quick);
 				ENSURE(ok);
-				std::string hexHash = Hexify(hash);
-				if (hexHash == replayHash)
-					debug_printf(L"hash ok (%hs)", hexHash.c_str());
+				if (hash == record.hash)
+					debug_printf(L"hash ok (%hs)", Hexify(hash).c_str());
 				else
-					debug_printf(L"HASH MISMATCH (%hs != %hs)", hexHash.c_str(), replayHash.c_str());
+					debug_printf(L"HASH MISMATCH (%hs != %hs)", Hexify(hash).c_str(), Hexify(record.hash).c_str());
 			}
 		}
-		else if (type == "end")
+		else if (record.type == ReplayRecord::END)
 		{
 			{
 				g_Profiler2.RecordFrameStart();
@@ -209,8 +720,18 @@ void CReplayPlayer::Replay()
 				g_Profiler2.IncrementFrameNumber();
 				PROFILE2_ATTR("%d", g_Profiler2.GetFrameNumber());
 
+				double startTime = timer_Time();
 				game.GetSimulation2()->Update(turnLength, commands);
+				double simTime = timer_Time() - startTime;
 				commands.clear();
+
+				if (statsStream.is_open())
+				{
+					u32 jsHeap = JS_GetGCParameter(game.GetSimulation2()->GetScriptInterface().GetRuntime(), JSGC_BYTES);
+					jsHeapHighWater = std::max(jsHeapHighWater, jsHeap);
+					statsStream << turn << "," << turnLength << "," << simTime*1000.0 << ","
+						<< jsHeap << "," << jsHeapHighWater << "," << GetPeakMemoryUsage() << "\n";
+				}
 			}
 
 //			std::string hash;
@@ -227,15 +748,27 @@ void CReplayPlayer::Replay()
 
 			if (turn % 20 == 0)
 				g_ProfileViewer.SaveToFile();
+
+			if (m_CheckpointInterval && turn % m_CheckpointInterval == 0)
+			{
+				std::ofstream checkpointStream(GetCheckpointPath(turn).c_str(), std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+				bool ok = game.GetSimulation2()->SerializeState(checkpointStream);
+				ENSURE(ok && checkpointStream.good());
+				indexStream << "checkpoint " << turn << "\n";
+			}
 		}
-		else
-		{
-			debug_printf(L"Unrecognised replay token %hs\n", type.c_str());
-		}
+
+		offset = m_Stream->tellg();
 	}
 
 	g_Profiler2.SaveToFile();
 
+	if (statsStream.is_open())
+	{
+		statsStream.close();
+		SaveMessageStats(m_StatsPath + ".messages.csv", *game.GetSimulation2());
+	}
+
 	std::string hash;
 	bool ok = game.GetSimulation2()->ComputeStateHash(hash, false);
 	ENSURE(ok);
@@ -250,3 +783,110 @@ void CReplayPlayer::Replay()
 	delete &g_Profiler;
 	delete &g_ProfileViewer;
 }
+
+void CReplayPlayer::SaveMessageStats(const std::string& path, CSimulation2& simulation)
+{
+	std::ofstream stream(path.c_str(), std::ofstream::out | std::ofstream::trunc);
+	ENSURE(stream.good());
+
+	const CComponentManager& componentManager = simulation.GetSimContext().GetComponentManager();
+	const CComponentManager::MessageStatsMap& stats = componentManager.GetMessageStats();
+
+	stream << "component,message,calls,total_ms\n";
+	for (CComponentManager::MessageStatsMap::const_iterator it = stats.begin(); it != stats.end(); ++it)
+	{
+		stream << componentManager.LookupComponentTypeName(it->first.second) << ","
+			<< componentManager.LookupMessageTypeName(it->first.first) << ","
+			<< it->second.calls << "," << it->second.seconds*1000.0 << "\n";
+	}
+}
+
+bool ConvertReplay(const std::string& inputPath, const std::string& outputPath)
+{
+	std::ifstream input(inputPath.c_str(), std::ifstream::in | std::ifstream::binary);
+	if (!input.good())
+	{
+		debug_printf(L"Failed to open replay %hs\n", inputPath.c_str());
+		return false;
+	}
+
+	bool binary = ReadBinaryReplayMagic(input);
+
+	std::ofstream output(outputPath.c_str(), std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+	std::ofstream indexStream((outputPath + ".index").c_str(), std::ofstream::out | std::ofstream::trunc);
+	if (!output.good() || !indexStream.good())
+	{
+		debug_printf(L"Failed to open %hs for writing\n", outputPath.c_str());
+		return false;
+	}
+
+	if (!binary)
+		output.write(BINARY_REPLAY_MAGIC, BINARY_REPLAY_MAGIC_LENGTH);
+
+	ScriptInterface scriptInterface("Engine", "Replay", ScriptInterface::CreateRuntime());
+
+	ReplayRecord record;
+	u32 turn = 0;
+	while (ReadRecord(input, scriptInterface, binary, record))
+	{
+		if (record.type == ReplayRecord::TURN)
+		{
+			turn = record.turn;
+			indexStream << "turn " << turn << " " << (i64)output.tellp() << "\n";
+		}
+		else if (record.type == ReplayRecord::COMMAND)
+		{
+			// (Text logs don't store the turn of each command)
+			record.turn = turn;
+		}
+
+		WriteRecord(output, scriptInterface, !binary, record);
+	}
+
+	return output.good() && indexStream.good();
+}
+
+bool ReadReplayCommands(const std::string& inputPath, ScriptInterface& scriptInterface,
+	CScriptValRooted& attribs, std::vector<std::vector<SimulationCommand> >& turns)
+{
+	std::ifstream input(inputPath.c_str(), std::ifstream::in | std::ifstream::binary);
+	if (!input.good())
+	{
+		debug_printf(L"Failed to open replay %hs\n", inputPath.c_str());
+		return false;
+	}
+
+	bool binary = ReadBinaryReplayMagic(input);
+
+	turns.clear();
+
+	ReplayRecord record;
+	u32 turn = 0;
+	while (ReadRecord(input, scriptInterface, binary, record))
+	{
+		switch (record.type)
+		{
+		case ReplayRecord::START:
+			attribs = record.data;
+			break;
+		case ReplayRecord::TURN:
+			turn = record.turn;
+			if (turns.size() <= turn)
+				turns.resize(turn + 1);
+			break;
+		case ReplayRecord::COMMAND:
+		{
+			// (Commands are always logged after the turn they were executed in)
+			if (turns.size() <= turn)
+				turns.resize(turn + 1);
+			SimulationCommand command = { record.player, record.data };
+			turns[turn].push_back(command);
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	return !attribs.undefined();
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,6 +19,7 @@
 #define INCLUDED_REPLAY
 
 class CScriptValRooted;
+class CSimulation2;
 struct SimulationCommand;
 class ScriptInterface;
 
@@ -61,6 +62,14 @@ public:
 
 /**
  * Implementation of IReplayLogger that saves data to a file in the logs directory.
+ * If the "replay.binary" config setting is enabled, the log is written in a more
+ * compact binary format (using the network's message serialization) instead of
+ * JSON text.
+ *
+ * It also writes a sidecar index file (with the same name plus ".index"), containing
+ * lines of "turn <n> <offset>" giving the byte offset in the log of the start of each turn.
+ * CReplayPlayer adds "checkpoint <n>" lines when it saves state checkpoints,
+ * and uses the index to seek to them.
  */
 class CReplayLogger : public IReplayLogger
 {
@@ -75,11 +84,14 @@ public:
 
 private:
 	ScriptInterface& m_ScriptInterface;
+	bool m_Binary;
 	std::ostream* m_Stream;
+	std::ostream* m_IndexStream;
 };
 
 /**
  * Replay log replayer. Runs the log with no graphics and dumps some info to stdout.
+ * Text and binary logs are both supported.
  */
 class CReplayPlayer
 {
@@ -88,10 +100,63 @@ public:
 	~CReplayPlayer();
 
 	void Load(const std::string& path);
+
+	/**
+	 * Record benchmark statistics while replaying: the simulation time and memory
+	 * usage of each turn are written as CSV to @p path, and the total time spent in
+	 * each component's message handlers is written to @p path + ".messages.csv".
+	 */
+	void SetStatsOutput(const std::string& path);
+
+	/**
+	 * Save the serialized simulation state every @p numTurns turns while replaying,
+	 * and rewrite the replay's index file to refer to them.
+	 */
+	void SetCheckpointInterval(u32 numTurns);
+
+	/**
+	 * Start replaying from the latest checkpoint at or before @p turn (as listed
+	 * in the index file), instead of simulating from the start of the game.
+	 * (This can't be combined with SetCheckpointInterval.)
+	 */
+	void SetSeekTurn(u32 turn);
+
 	void Replay();
 
 private:
+	void SaveMessageStats(const std::string& path, CSimulation2& simulation);
+
+	std::string GetCheckpointPath(u32 turn) const;
+
+	/**
+	 * Loads the checkpoint to start from and moves the stream to the following turn.
+	 * Returns the turn number of the checkpoint, or 0 if there is no usable checkpoint.
+	 */
+	u32 SeekToCheckpoint(CSimulation2& simulation);
+
 	std::istream* m_Stream;
+	bool m_Binary;
+	std::string m_Path;
+	std::string m_StatsPath;
+	u32 m_CheckpointInterval;
+	u32 m_SeekTurn;
 };
 
+/**
+ * Converts the replay log at @p inputPath from text to binary or from binary to
+ * text, and writes it (plus a new index file) to @p outputPath.
+ * Returns false on failure.
+ */
+bool ConvertReplay(const std::string& inputPath, const std::string& outputPath);
+
+/**
+ * Reads the replay log at @p inputPath (text or binary) into memory, without running it.
+ * @param attribs set to the game attributes the game was started with
+ * @param turns set to the commands executed in each turn, indexed by turn number
+ * The script values are created in @p scriptInterface's context.
+ * Returns false on failure.
+ */
+bool ReadReplayCommands(const std::string& inputPath, ScriptInterface& scriptInterface,
+	CScriptValRooted& attribs, std::vector<std::vector<SimulationCommand> >& turns);
+
 #endif // INCLUDED_REPLAY
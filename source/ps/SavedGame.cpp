@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,6 +23,7 @@
 #include "lib/allocators/shared_ptr.h"
 #include "lib/file/archive/archive_zip.h"
 #include "ps/CLogger.h"
+#include "ps/Compress.h"
 #include "ps/Filesystem.h"
 #include "scriptinterface/ScriptInterface.h"
 #include "simulation2/Simulation2.h"
@@ -56,11 +57,17 @@ Status SavedGames::Save(const std::wstring& prefix, CSimulation2& simulation, CG
 
 	time_t now = time(NULL);
 
-	// Construct the serialized state to be saved
+	// Construct the serialized state to be saved.
+	// This can be tens of megabytes in large games, so it's compressed on a
+	// background thread while it's being serialized, instead of afterwards
 
-	std::stringstream simStateStream;
-	if (!simulation.SerializeState(simStateStream))
-		WARN_RETURN(ERR::FAIL);
+	CDeflateStreamBuf simStateBuf;
+	{
+		std::ostream simStateStream(&simStateBuf);
+		if (!simulation.SerializeState(simStateStream))
+			WARN_RETURN(ERR::FAIL);
+	}
+	simStateBuf.Finish();
 
 	CScriptValRooted metadata;
 	simulation.GetScriptInterface().Eval("({})", metadata);
@@ -83,7 +90,8 @@ Status SavedGames::Save(const std::wstring& prefix, CSimulation2& simulation, CG
 		WARN_RETURN(ERR::FAIL);
 
 	WARN_RETURN_STATUS_IF_ERR(archiveWriter->AddMemory((const u8*)metadataString.c_str(), metadataString.length(), now, "metadata.json"));
-	WARN_RETURN_STATUS_IF_ERR(archiveWriter->AddMemory((const u8*)simStateStream.str().c_str(), simStateStream.str().length(), now, "simulation.dat"));
+	const std::string& simStateCompressed = simStateBuf.GetCompressed();
+	WARN_RETURN_STATUS_IF_ERR(archiveWriter->AddCompressedMemory((const u8*)simStateCompressed.data(), simStateCompressed.length(), simStateBuf.GetUncompressedSize(), simStateBuf.GetChecksum(), now, "simulation.dat"));
 	archiveWriter.reset(); // close the file
 
 	WriteBuffer buffer;
@@ -0,0 +1,135 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "precompiled.h"
+
+#include "TaskGraph.h"
+
+#include "lib/bits.h"
+
+CTaskScratch::CTaskScratch(size_t maxSize) :
+	m_Arena(maxSize)
+{
+}
+
+void* CTaskScratch::Allocate(size_t size)
+{
+	// (The storage is page-aligned, so rounding every size keeps every block aligned)
+	void* p = m_Arena.allocate(round_up(std::max(size, (size_t)1), (size_t)16));
+	ENSURE(p); // out of scratch memory
+	return p;
+}
+
+void CTaskScratch::Reset()
+{
+	m_Arena.DeallocateAll();
+}
+
+size_t CTaskGraph::AddTask(ITask& task)
+{
+	m_Tasks.push_back(&task);
+	m_Stages.push_back(0);
+	return m_Tasks.size() - 1;
+}
+
+void CTaskGraph::AddDependency(size_t id, size_t prerequisite)
+{
+	ENSURE(prerequisite < id && id < m_Tasks.size());
+	m_Stages[id] = std::max(m_Stages[id], m_Stages[prerequisite] + 1);
+}
+
+void CTaskGraph::Clear()
+{
+	m_Tasks.clear();
+	m_Stages.clear();
+}
+
+class CTaskRunner::GraphStageAdapter : public CThreadPool::ITask
+{
+public:
+	GraphStageAdapter(CTaskRunner& runner, const std::vector<CTaskGraph::ITask*>& tasks) :
+		m_Runner(runner), m_Tasks(tasks)
+	{
+	}
+
+	virtual void Run(size_t index)
+	{
+		m_Tasks[index]->Run(m_Runner.GetScratch());
+	}
+
+private:
+	CTaskRunner& m_Runner;
+	const std::vector<CTaskGraph::ITask*>& m_Tasks;
+};
+
+CTaskRunner::CTaskRunner(CThreadPool* pool, size_t scratchSize) :
+	m_Pool(pool), m_ScratchSize(scratchSize)
+{
+	m_Scratch.resize(pool ? pool->GetNumWorkers() + 1 : 1, NULL);
+}
+
+CTaskRunner::~CTaskRunner()
+{
+	for (size_t i = 0; i < m_Scratch.size(); ++i)
+		delete m_Scratch[i];
+}
+
+CTaskScratch& CTaskRunner::GetScratch()
+{
+	size_t index = m_Pool ? m_Pool->GetCurrentThreadIndex() : 0;
+	// (No locking needed, since no other thread uses this index during the job)
+	if (!m_Scratch[index])
+		m_Scratch[index] = new CTaskScratch(m_ScratchSize);
+	return *m_Scratch[index];
+}
+
+void CTaskRunner::Run(CThreadPool::ITask& task, size_t count)
+{
+	if (m_Pool)
+	{
+		m_Pool->ParallelFor(task, count);
+	}
+	else
+	{
+		for (size_t i = 0; i < count; ++i)
+			task.Run(i);
+	}
+
+	for (size_t i = 0; i < m_Scratch.size(); ++i)
+		if (m_Scratch[i])
+			m_Scratch[i]->Reset();
+}
+
+void CTaskRunner::RunGraph(CTaskGraph& graph)
+{
+	size_t numStages = 0;
+	for (size_t i = 0; i < graph.m_Stages.size(); ++i)
+		numStages = std::max(numStages, graph.m_Stages[i] + 1);
+
+	std::vector<CTaskGraph::ITask*> stageTasks;
+	for (size_t stage = 0; stage < numStages; ++stage)
+	{
+		stageTasks.clear();
+		for (size_t i = 0; i < graph.m_Tasks.size(); ++i)
+			if (graph.m_Stages[i] == stage)
+				stageTasks.push_back(graph.m_Tasks[i]);
+
+		GraphStageAdapter adapter(*this, stageTasks);
+		Run(adapter, stageTasks.size());
+	}
+}
@@ -0,0 +1,206 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef INCLUDED_TASKGRAPH
+#define INCLUDED_TASKGRAPH
+
+#include "lib/allocators/arena.h"
+#include "ps/ThreadPool.h"
+
+/*
+ * Jobs built on CThreadPool for code (like the simulation) whose results
+ * mustn't depend on how the work was scheduled: reductions are split into
+ * chunks that don't depend on the number of threads and are merged in a fixed
+ * order, and dependent tasks run in a fixed sequence of stages.
+ *
+ * Everything runs on the calling thread if there's no pool, or if the pool is
+ * in serial mode (see CThreadPool::SetSerial), which must give identical
+ * results.
+ */
+
+/**
+ * Scratch memory for a task, freed all at once when the job has finished.
+ * Each thread has its own, so allocating doesn't need any locking.
+ */
+class CTaskScratch
+{
+	NONCOPYABLE(CTaskScratch);
+
+public:
+	CTaskScratch(size_t maxSize);
+
+	/**
+	 * Returns @p size bytes, aligned to 16 bytes.
+	 */
+	void* Allocate(size_t size);
+
+	template<typename T>
+	T* Allocate(size_t count)
+	{
+		return static_cast<T*>(Allocate(count * sizeof(T)));
+	}
+
+	void Reset();
+
+private:
+	Allocators::Arena<Allocators::Storage_Commit<> > m_Arena;
+};
+
+/**
+ * A set of tasks with dependencies, to be run by CTaskRunner::RunGraph.
+ * Tasks can only depend on tasks that were added before them (so there are
+ * no cycles), and run in stages: each task runs in the stage after the last
+ * of its prerequisites, in parallel with the rest of its stage.
+ */
+class CTaskGraph
+{
+public:
+	class ITask
+	{
+	public:
+		virtual ~ITask() { }
+		virtual void Run(CTaskScratch& scratch) = 0;
+	};
+
+	/**
+	 * Adds @p task (which isn't owned by the graph), returning its ID.
+	 */
+	size_t AddTask(ITask& task);
+
+	/**
+	 * Makes task @p id wait for @p prerequisite, which must have been added
+	 * before it.
+	 */
+	void AddDependency(size_t id, size_t prerequisite);
+
+	void Clear();
+
+	size_t GetNumTasks() const
+	{
+		return m_Tasks.size();
+	}
+
+private:
+	friend class CTaskRunner;
+
+	std::vector<ITask*> m_Tasks;
+	std::vector<size_t> m_Stages; // stage index of each task
+};
+
+/**
+ * Runs jobs on a thread pool, giving each task scratch memory.
+ * Only one job can run at once.
+ */
+class CTaskRunner
+{
+	NONCOPYABLE(CTaskRunner);
+
+public:
+	/**
+	 * Interface for a reduction over items [0, count), split into chunks of
+	 * items that run in parallel.
+	 */
+	template<typename Result>
+	class IReduceTask
+	{
+	public:
+		virtual ~IReduceTask() { }
+
+		/**
+		 * Computes the result for items [begin, end) into @p result (which
+		 * starts default-constructed). May be called concurrently from several
+		 * threads (with different chunks).
+		 */
+		virtual void Run(size_t begin, size_t end, Result& result, CTaskScratch& scratch) = 0;
+
+		/**
+		 * Combines a chunk's result into the total. Called on the calling
+		 * thread once all chunks have finished, in order of the chunks.
+		 */
+		virtual void Merge(Result& total, const Result& chunk) = 0;
+	};
+
+	/**
+	 * @param pool pool to run the tasks on, or NULL to run on the calling thread
+	 * @param scratchSize maximum scratch memory per thread
+	 */
+	CTaskRunner(CThreadPool* pool, size_t scratchSize = 16*MiB);
+	~CTaskRunner();
+
+	/**
+	 * Runs a reduction over [0, count) in chunks of @p chunkSize items
+	 * (which is independent of the number of threads, so the results are too),
+	 * merging each chunk's result into @p total in order.
+	 */
+	template<typename Result>
+	void ParallelReduce(IReduceTask<Result>& task, size_t count, size_t chunkSize, Result& total)
+	{
+		ENSURE(chunkSize > 0);
+		std::vector<Result> results((count + chunkSize - 1) / chunkSize);
+		ReduceAdapter<Result> adapter(*this, task, count, chunkSize, results);
+		Run(adapter, results.size());
+		for (size_t i = 0; i < results.size(); ++i)
+			task.Merge(total, results[i]);
+	}
+
+	/**
+	 * Runs every task of @p graph, returning once they've all finished.
+	 */
+	void RunGraph(CTaskGraph& graph);
+
+	/**
+	 * Returns the current thread's scratch memory. Only valid inside a task.
+	 */
+	CTaskScratch& GetScratch();
+
+private:
+	template<typename Result>
+	class ReduceAdapter : public CThreadPool::ITask
+	{
+	public:
+		ReduceAdapter(CTaskRunner& runner, IReduceTask<Result>& task, size_t count, size_t chunkSize, std::vector<Result>& results) :
+			m_Runner(runner), m_Task(task), m_Count(count), m_ChunkSize(chunkSize), m_Results(results)
+		{
+		}
+
+		virtual void Run(size_t index)
+		{
+			size_t begin = index * m_ChunkSize;
+			size_t end = std::min(begin + m_ChunkSize, m_Count);
+			m_Task.Run(begin, end, m_Results[index], m_Runner.GetScratch());
+		}
+
+	private:
+		CTaskRunner& m_Runner;
+		IReduceTask<Result>& m_Task;
+		size_t m_Count;
+		size_t m_ChunkSize;
+		std::vector<Result>& m_Results;
+	};
+
+	class GraphStageAdapter;
+
+	// Runs @p task over [0, count), then frees the scratch memory
+	void Run(CThreadPool::ITask& task, size_t count);
+
+	CThreadPool* m_Pool;
+	size_t m_ScratchSize;
+	std::vector<CTaskScratch*> m_Scratch; // one per thread index, created when first needed
+};
+
+#endif // INCLUDED_TASKGRAPH
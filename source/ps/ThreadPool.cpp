@@ -0,0 +1,302 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "ThreadPool.h"
+
+#include "lib/external_libraries/libsdl.h"
+#include "lib/sysdep/cpu.h"
+#include "lib/sysdep/numa.h"
+#include "lib/sysdep/os_cpu.h"
+#if ARCH_X86_X64
+#include "lib/sysdep/arch/x86_x64/apic.h"
+#include "lib/sysdep/arch/x86_x64/topology.h"
+#endif
+#include "ps/Profiler2.h"
+
+#include <algorithm>
+
+CThreadPool* g_ThreadPool = NULL;
+
+static i64 PackRange(size_t begin, size_t end)
+{
+	return (i64)(((u64)end << 32) | (u64)begin);
+}
+
+static void UnpackRange(i64 range, size_t& begin, size_t& end)
+{
+	begin = (size_t)((u64)range & 0xFFFFFFFF);
+	end = (size_t)((u64)range >> 32);
+}
+
+// Plain 64-bit reads aren't atomic on 32-bit x86, so confirm the value with a CAS
+static i64 LoadRange(volatile i64* range)
+{
+	while (true)
+	{
+		i64 value = *range;
+		if (cpu_CAS64(range, value, value))
+			return value;
+	}
+}
+
+static void StoreRange(volatile i64* range, i64 newValue)
+{
+	while (!cpu_CAS64(range, LoadRange(range), newValue))
+	{
+	}
+}
+
+CThreadPool::CThreadPool(size_t numWorkers, const std::vector<size_t>& processors) :
+	m_Task(NULL), m_NumParticipants(0), m_NextSlot(0), m_Serial(false), m_Shutdown(false)
+{
+	int err = pthread_key_create(&m_ThreadIndexKey, NULL);
+	ENSURE(err == 0);
+
+	// Use SDL semaphores since OS X doesn't implement sem_init
+	m_StartSem = SDL_CreateSemaphore(0);
+	ENSURE(m_StartSem);
+	m_DoneSem = SDL_CreateSemaphore(0);
+	ENSURE(m_DoneSem);
+
+	m_Ranges.resize(numWorkers + 1);
+	for (size_t i = 0; i < m_Ranges.size(); ++i)
+		m_Ranges[i].items = 0;
+
+	for (size_t i = 0; i < numWorkers; ++i)
+	{
+		SWorker* worker = new SWorker;
+		worker->pool = this;
+		worker->pinned = (i < processors.size());
+		worker->processor = worker->pinned ? processors[i] : 0;
+		int ret = pthread_create(&worker->thread, NULL, &RunThread, worker);
+		ENSURE(ret == 0);
+		m_Workers.push_back(worker);
+	}
+}
+
+CThreadPool::~CThreadPool()
+{
+	m_Shutdown = true;
+
+	for (size_t i = 0; i < m_Workers.size(); ++i)
+		SDL_SemPost(m_StartSem);
+
+	for (size_t i = 0; i < m_Workers.size(); ++i)
+	{
+		pthread_join(m_Workers[i]->thread, NULL);
+		delete m_Workers[i];
+	}
+
+	SDL_DestroySemaphore(m_DoneSem);
+	SDL_DestroySemaphore(m_StartSem);
+
+	pthread_key_delete(m_ThreadIndexKey);
+}
+
+size_t CThreadPool::GetCurrentThreadIndex() const
+{
+	return (size_t)(uintptr_t)pthread_getspecific(m_ThreadIndexKey);
+}
+
+size_t CThreadPool::GetDefaultNumWorkers()
+{
+	size_t numCores = os_cpu_NumProcessors();
+#if ARCH_X86_X64
+	numCores = std::min(numCores, topology::NumPackages() * topology::CoresPerPackage());
+#endif
+	return numCores > 1 ? numCores - 1 : 0;
+}
+
+namespace
+{
+struct SProcessorOrder
+{
+	size_t logical; // index of the hyperthread within its core
+	size_t rank; // index of the core within its NUMA node
+	size_t node;
+	size_t processor;
+
+	bool operator<(const SProcessorOrder& other) const
+	{
+		if (logical != other.logical)
+			return logical < other.logical;
+		if (rank != other.rank)
+			return rank < other.rank;
+		if (node != other.node)
+			return node < other.node;
+		return processor < other.processor;
+	}
+};
+}
+
+std::vector<size_t> CThreadPool::ChooseProcessors(size_t numWorkers)
+{
+	const uintptr_t processorMask = os_cpu_ProcessorMask();
+	const size_t maxProcessors = std::min(os_cpu_NumProcessors(), sizeof(uintptr_t)*CHAR_BIT);
+
+	std::vector<SProcessorOrder> order;
+	std::map<std::pair<size_t, size_t>, size_t> coresPerNode; // (node, logical) => count so far
+	for (size_t processor = 0; processor < maxProcessors; ++processor)
+	{
+		if (!(processorMask & ((uintptr_t)1 << processor)))
+			continue;
+
+		SProcessorOrder entry;
+		entry.processor = processor;
+		entry.node = numa_NodeFromProcessor(processor);
+#if ARCH_X86_X64
+		entry.logical = topology::LogicalFromApicId(ApicIdFromProcessor(processor));
+#else
+		entry.logical = 0;
+#endif
+		entry.rank = coresPerNode[std::make_pair(entry.node, entry.logical)]++;
+		order.push_back(entry);
+	}
+	std::sort(order.begin(), order.end());
+
+	std::vector<size_t> processors;
+	if (order.empty())
+		return processors;
+
+	// order[0] is left for the main thread
+	for (size_t i = 0; i < numWorkers; ++i)
+		processors.push_back(order[(i + 1) % order.size()].processor);
+	return processors;
+}
+
+void CThreadPool::ParallelFor(ITask& task, size_t count)
+{
+	if (count == 0)
+		return;
+
+	// Don't bother waking the workers for a single item (or in serial mode)
+	if (m_Workers.empty() || count == 1 || m_Serial)
+	{
+		for (size_t i = 0; i < count; ++i)
+			task.Run(i);
+		return;
+	}
+
+	ENSURE(count <= 0xFFFFFFFF);
+
+	m_Task = &task;
+	m_NumParticipants = std::min(m_Workers.size() + 1, count);
+	m_NextSlot = 1;
+
+	// Give each participant an equal share to start with
+	for (size_t i = 0; i < m_NumParticipants; ++i)
+		m_Ranges[i].items = PackRange(count * i / m_NumParticipants, count * (i + 1) / m_NumParticipants);
+
+	// (The semaphores act as memory barriers, so the workers will see the
+	// job fields and we'll see their outputs)
+
+	size_t numWorkers = m_NumParticipants - 1;
+	for (size_t i = 0; i < numWorkers; ++i)
+		SDL_SemPost(m_StartSem);
+
+	RunItems(0);
+
+	for (size_t i = 0; i < numWorkers; ++i)
+		SDL_SemWait(m_DoneSem);
+
+	m_Task = NULL;
+}
+
+bool CThreadPool::PopItem(size_t slot, size_t& item)
+{
+	volatile i64* range = &m_Ranges[slot].items;
+	while (true)
+	{
+		i64 value = LoadRange(range);
+		size_t begin, end;
+		UnpackRange(value, begin, end);
+		if (begin >= end)
+			return false;
+		if (cpu_CAS64(range, value, PackRange(begin + 1, end)))
+		{
+			item = begin;
+			return true;
+		}
+	}
+}
+
+bool CThreadPool::StealItem(size_t slot, size_t& item)
+{
+	for (size_t i = 1; i < m_NumParticipants; ++i)
+	{
+		volatile i64* victim = &m_Ranges[(slot + i) % m_NumParticipants].items;
+		while (true)
+		{
+			i64 value = LoadRange(victim);
+			size_t begin, end;
+			UnpackRange(value, begin, end);
+			if (begin >= end)
+				break;
+
+			// Take the upper half (the victim is working upwards from begin),
+			// keeping the first item of it to run straight away
+			size_t mid = begin + (end - begin) / 2;
+			if (cpu_CAS64(victim, value, PackRange(begin, mid)))
+			{
+				item = mid;
+				StoreRange(&m_Ranges[slot].items, PackRange(mid + 1, end));
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void CThreadPool::RunItems(size_t slot)
+{
+	// Once neither our own range nor any other has items left, every item
+	// has been claimed (though some may still be running on other threads)
+	size_t item;
+	while (PopItem(slot, item) || StealItem(slot, item))
+		m_Task->Run(item);
+}
+
+void* CThreadPool::RunThread(void* data)
+{
+	debug_SetThreadName("ThreadPool");
+	g_Profiler2.RegisterCurrentThread("worker");
+
+	SWorker* worker = static_cast<SWorker*>(data);
+	CThreadPool* pool = worker->pool;
+
+	if (worker->pinned)
+		os_cpu_SetThreadAffinityMask((uintptr_t)1 << worker->processor);
+
+	while (SDL_SemWait(pool->m_StartSem) == 0)
+	{
+		if (pool->m_Shutdown)
+			break;
+
+		{
+			PROFILE2("thread pool job");
+			size_t slot = (size_t)cpu_AtomicAdd(&pool->m_NextSlot, 1);
+			pthread_setspecific(pool->m_ThreadIndexKey, (void*)(uintptr_t)slot);
+			pool->RunItems(slot);
+		}
+
+		SDL_SemPost(pool->m_DoneSem);
+	}
+
+	return NULL;
+}
@@ -0,0 +1,176 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_THREADPOOL
+#define INCLUDED_THREADPOOL
+
+#include "ps/ThreadUtil.h"
+
+struct SDL_semaphore;
+
+/**
+ * A fixed-size pool of worker threads, for splitting CPU-heavy work into
+ * independent pieces that can run on multiple cores.
+ *
+ * The only operation is a blocking "parallel for": the calling thread runs
+ * pieces too, and only returns once every piece has completed. Callers
+ * therefore don't need any other synchronisation, provided each piece only
+ * reads shared data and only writes to its own outputs.
+ *
+ * Each participating thread starts with a contiguous range of the items
+ * (so neighbouring items, which often share data, run on the same core), and
+ * threads that run out steal half of the remaining range of another one.
+ *
+ * Tasks run on arbitrary threads, so they must not use SpiderMonkey,
+ * OpenGL, the legacy (non-Profiler2) profiler, or anything else that is
+ * restricted to the main thread.
+ */
+class CThreadPool
+{
+	NONCOPYABLE(CThreadPool);
+
+public:
+	/**
+	 * Interface for a piece of work that can be split into a number of
+	 * independent items.
+	 */
+	class ITask
+	{
+	public:
+		virtual ~ITask() { }
+
+		/**
+		 * Process item @p index. May be called concurrently from several threads
+		 * (with different indexes).
+		 */
+		virtual void Run(size_t index) = 0;
+	};
+
+	/**
+	 * @param numWorkers number of threads to create in addition to the
+	 * calling thread. If 0, tasks will just run on the calling thread.
+	 * @param processors if not empty, worker i will only run on processor
+	 * processors[i] (as numbered by os_cpu).
+	 */
+	CThreadPool(size_t numWorkers, const std::vector<size_t>& processors = std::vector<size_t>());
+	~CThreadPool();
+
+	/**
+	 * Returns the number of workers that keeps every physical core busy
+	 * (together with the calling thread), without sharing cores between
+	 * hyperthreads.
+	 */
+	static size_t GetDefaultNumWorkers();
+
+	/**
+	 * Chooses a processor for each of @p numWorkers workers: one hyperthread
+	 * of each core first, used in turn from each NUMA node, leaving the first
+	 * core for the main thread. Only starts sharing cores (or the main thread's
+	 * core) once every core has a worker.
+	 */
+	static std::vector<size_t> ChooseProcessors(size_t numWorkers);
+
+	size_t GetNumWorkers() const
+	{
+		return m_Workers.size();
+	}
+
+	/**
+	 * In serial mode, ParallelFor runs every item on the calling thread, in
+	 * order. Useful for checking that parallel code gives the same results
+	 * however it's scheduled.
+	 * Must not be called while a ParallelFor is running.
+	 */
+	void SetSerial(bool serial)
+	{
+		m_Serial = serial;
+	}
+
+	bool IsSerial() const
+	{
+		return m_Serial;
+	}
+
+	/**
+	 * Returns a number in [0, GetNumWorkers()] identifying the thread that's
+	 * running the current item, which is different for every thread working
+	 * on the same job (so it can be used to pick per-thread data without
+	 * locking). The calling thread of ParallelFor is always 0.
+	 */
+	size_t GetCurrentThreadIndex() const;
+
+	/**
+	 * Calls task.Run(i) once for every i in [0, count), in an unspecified order
+	 * across the worker threads and the calling thread, and returns once all
+	 * the calls have finished.
+	 * Must not be called by more than one thread at once, nor from inside a task.
+	 */
+	void ParallelFor(ITask& task, size_t count);
+
+private:
+	struct SWorker
+	{
+		CThreadPool* pool;
+		pthread_t thread;
+		bool pinned;
+		size_t processor;
+	};
+
+	// Remaining items of one participant in the current job, packed as
+	// begin | (end << 32). Padded so each participant's range is on its own
+	// cache line.
+	struct SRange
+	{
+		volatile i64 items;
+		u8 padding[64 - sizeof(i64)];
+	};
+
+	static void* RunThread(void* data);
+
+	// Runs items (starting with the range in m_Ranges[slot]) until there are
+	// none left to run or steal
+	void RunItems(size_t slot);
+
+	bool PopItem(size_t slot, size_t& item);
+	bool StealItem(size_t slot, size_t& item);
+
+	std::vector<SWorker*> m_Workers;
+
+	// Posted once per worker to start a job (or to shut down)
+	SDL_semaphore* m_StartSem;
+	// Posted by each worker when it has finished its part of a job
+	SDL_semaphore* m_DoneSem;
+
+	// Current job (only modified by the calling thread while the workers are idle)
+	ITask* m_Task;
+	size_t m_NumParticipants;
+	volatile intptr_t m_NextSlot; // next entry of m_Ranges for a worker to claim
+	std::vector<SRange> m_Ranges; // one per participant (the caller's is 0)
+	bool m_Serial;
+	bool m_Shutdown;
+
+	// Holds each worker's GetCurrentThreadIndex (NULL means 0)
+	pthread_key_t m_ThreadIndexKey;
+};
+
+/**
+ * Engine-wide thread pool. May be NULL (e.g. in tests and tools), in which
+ * case callers should just do their work serially.
+ */
+extern CThreadPool* g_ThreadPool;
+
+#endif // INCLUDED_THREADPOOL
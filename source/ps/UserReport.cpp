@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,14 +23,17 @@
 #include "lib/utf8.h"
 #include "lib/external_libraries/curl.h"
 #include "lib/external_libraries/libsdl.h"
-#include "lib/external_libraries/zlib.h"
-#include "lib/file/archive/stream.h"
+#include "lib/file/file_system.h"
+#include "lib/sysdep/filesystem.h"
 #include "lib/sysdep/sysdep.h"
+#include "ps/Compress.h"
 #include "ps/ConfigDB.h"
 #include "ps/Filesystem.h"
 #include "ps/Profiler2.h"
 #include "ps/ThreadUtil.h"
 
+#include <fstream>
+
 #define DEBUG_UPLOADS 0
 
 /*
@@ -44,6 +47,13 @@
  * and polls for the current status (typically to display in the GUI);
  * the worker thread does all of the uploading.
  *
+ * Reports are only kept in memory up to a fixed total size, so the queue can't
+ * grow without limit while reporting is disabled or the server is unreachable
+ * (the oldest reports are dropped first).
+ * When the game shuts down, the reports that haven't been sent yet are
+ * compressed and saved into a spool directory (also of bounded size), and
+ * the next run sends them before any new ones.
+ *
  * It'd be nice to extend this in the future to handle things like crash reports.
  * The game should store the crashlogs (suitably anonymised) in a directory, and
  * we should detect those files and upload them when we're restarted and online.
@@ -70,6 +80,17 @@ static const double TIMER_CHECK_INTERVAL = 10.0;
  */
 static const double RECONNECT_INVERVAL = 60.0;
 
+/**
+ * Maximum total size (bytes) of the report data waiting in memory to be sent.
+ */
+static const size_t MAX_QUEUED_BYTES = 4*MiB;
+
+/**
+ * Maximum total size (bytes) of the compressed reports saved in the spool
+ * directory for sending by a later run of the game.
+ */
+static const size_t MAX_SPOOLED_BYTES = 16*MiB;
+
 CUserReporter g_UserReporter;
 
 struct CUserReport
@@ -83,9 +104,10 @@ struct CUserReport
 class CUserReporterWorker
 {
 public:
-	CUserReporterWorker(const std::string& userID, const std::string& url) :
-		m_URL(url), m_UserID(userID), m_Enabled(false), m_Shutdown(false), m_Status("disabled"),
-		m_PauseUntilTime(timer_Time()), m_LastUpdateTime(timer_Time())
+	CUserReporterWorker(const std::string& userID, const std::string& url, const OsPath& spoolPath) :
+		m_URL(url), m_UserID(userID), m_SpoolPath(spoolPath),
+		m_QueuedBytes(0), m_Enabled(false), m_Shutdown(false), m_ServerGone(false), m_Status("disabled"),
+		m_PauseUntilTime(timer_Time()), m_SpoolBytes(0), m_NextSpoolIndex(0), m_LastUpdateTime(timer_Time())
 	{
 		// Set up libcurl:
 
@@ -204,7 +226,17 @@ public:
 	{
 		{
 			CScopeLock lock(m_WorkerMutex);
+
+			const size_t size = report->m_Data.size();
+			if (size > MAX_QUEUED_BYTES)
+				return;
+
+			// Make room by discarding the oldest reports
+			while (m_QueuedBytes + size > MAX_QUEUED_BYTES)
+				PopReport();
+
 			m_ReportQueue.push_back(report);
+			m_QueuedBytes += size;
 		}
 
 		// Wake up the worker thread
@@ -251,8 +283,20 @@ private:
 				curl_easy_setopt(m_Curl, CURLOPT_PROXY, utf8_from_wstring(proxy).c_str());
 		}
 
+		LoadSpoolList();
+
 		SetStatus("waiting");
 
+		RunLoop();
+
+		// Keep whatever we didn't manage to send, if the user still wants it
+		// to be sent
+		if (GetEnabled() && !m_ServerGone)
+			SpoolQueuedReports();
+	}
+
+	void RunLoop()
+	{
 		/*
 		 * We use a semaphore to let the thread be woken up when it has
 		 * work to do. Various actions from the main thread can wake it:
@@ -294,7 +338,8 @@ private:
 				continue;
 
 			// We're enabled, so process as many reports as possible
-			while (ProcessReport())
+			// (oldest first)
+			while (m_SpoolFiles.empty() ? ProcessReport() : ProcessSpooledReport())
 			{
 				// Handle shutdowns while we were sending the report
 				if (GetShutdown())
@@ -326,6 +371,15 @@ private:
 #endif
 	}
 
+	// Removes the oldest report from the queue. Must be called with m_WorkerMutex held.
+	shared_ptr<CUserReport> PopReport()
+	{
+		shared_ptr<CUserReport> report = m_ReportQueue.front();
+		m_ReportQueue.pop_front();
+		m_QueuedBytes -= report->m_Data.size();
+		return report;
+	}
+
 	bool ProcessReport()
 	{
 		PROFILE2("process report");
@@ -336,11 +390,57 @@ private:
 			CScopeLock lock(m_WorkerMutex);
 			if (m_ReportQueue.empty())
 				return false;
-			report = m_ReportQueue.front();
-			m_ReportQueue.pop_front();
+			report = PopReport();
 		}
 
 		ConstructRequestData(*report);
+
+		if (SendRequest())
+			return true;
+
+		// We got an unhandled return code or a connection failure;
+		// push this report back onto the queue (unless new reports
+		// have filled it up in the meantime) and try again later
+
+		{
+			CScopeLock lock(m_WorkerMutex);
+			if (m_QueuedBytes + report->m_Data.size() <= MAX_QUEUED_BYTES)
+			{
+				m_ReportQueue.push_front(report);
+				m_QueuedBytes += report->m_Data.size();
+			}
+		}
+
+		return false;
+	}
+
+	bool ProcessSpooledReport()
+	{
+		PROFILE2("process spooled report");
+
+		const SpoolFile& file = m_SpoolFiles.front();
+		std::ifstream stream(OsString(file.path).c_str(), std::ifstream::in | std::ifstream::binary);
+		m_RequestData.resize(file.size);
+		if (file.size)
+			stream.read(&m_RequestData[0], file.size);
+
+		// Unreadable files are just deleted, since they'd never get sent
+		if (stream && !SendRequest())
+			return false;
+
+		wunlink(file.path);
+		m_SpoolBytes -= file.size;
+		m_SpoolFiles.pop_front();
+		return true;
+	}
+
+	/**
+	 * Uploads m_RequestData. Returns true on success. Otherwise
+	 * pauses the uploading for a while (or shuts it down, if the server
+	 * doesn't want any more reports), and returns false.
+	 */
+	bool SendRequest()
+	{
 		m_RequestDataOffset = 0;
 		m_ResponseData.clear();
 
@@ -375,6 +475,7 @@ private:
 			{
 				CScopeLock lock(m_WorkerMutex);
 				m_Shutdown = true;
+				m_ServerGone = true;
 				return false;
 			}
 		}
@@ -383,17 +484,85 @@ private:
 			SetStatus("failed:" + CStr::FromInt(err) + ":" + m_ErrorBuffer);
 		}
 
-		// We got an unhandled return code or a connection failure;
-		// push this report back onto the queue and try again after
-		// a long interval
+		// Try again after a long interval
+		m_PauseUntilTime = timer_Time() + RECONNECT_INVERVAL;
+		return false;
+	}
+
+	/**
+	 * Finds the reports that previous runs saved for us to send.
+	 */
+	void LoadSpoolList()
+	{
+		FileInfos files;
+		if (m_SpoolPath.empty() || GetDirectoryEntries(m_SpoolPath, &files, NULL) != INFO::OK)
+			return;
+
+		// The names start with the time the reports were saved, so this puts
+		// the oldest first
+		std::sort(files.begin(), files.end(), CompareFileInfoNames);
+
+		for (size_t i = 0; i < files.size(); ++i)
+		{
+			if (files[i].Name().Extension() != L".report")
+				continue;
+
+			SpoolFile file;
+			file.path = m_SpoolPath / files[i].Name();
+			file.size = (size_t)files[i].Size();
+			m_SpoolFiles.push_back(file);
+			m_SpoolBytes += file.size;
+		}
 
+		// Discard the oldest reports if there are too many
+		while (m_SpoolBytes > MAX_SPOOLED_BYTES)
+		{
+			wunlink(m_SpoolFiles.front().path);
+			m_SpoolBytes -= m_SpoolFiles.front().size;
+			m_SpoolFiles.pop_front();
+		}
+	}
+
+	static bool CompareFileInfoNames(const FileInfo& a, const FileInfo& b)
+	{
+		return a.Name() < b.Name();
+	}
+
+	/**
+	 * Saves the compressed request data for every report still in the queue,
+	 * as far as the spool directory's size limit allows.
+	 */
+	void SpoolQueuedReports()
+	{
+		if (m_SpoolPath.empty())
+			return;
+
+		std::deque<shared_ptr<CUserReport> > reports;
 		{
 			CScopeLock lock(m_WorkerMutex);
-			m_ReportQueue.push_front(report);
+			reports.swap(m_ReportQueue);
+			m_QueuedBytes = 0;
 		}
 
-		m_PauseUntilTime = timer_Time() + RECONNECT_INVERVAL;
-		return false;
+		if (reports.empty() || CreateDirectories(m_SpoolPath, 0700) != INFO::OK)
+			return;
+
+		const u64 now = (u64)time(NULL);
+		for (size_t i = 0; i < reports.size(); ++i)
+		{
+			ConstructRequestData(*reports[i]);
+			if (m_SpoolBytes + m_RequestData.size() > MAX_SPOOLED_BYTES)
+				break;
+
+			char name[64];
+			sprintf_s(name, ARRAY_SIZE(name), "%016llx-%04x.report", (unsigned long long)now, (unsigned int)m_NextSpoolIndex++);
+			std::ofstream stream(OsString(m_SpoolPath / name).c_str(), std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+			stream.write(m_RequestData.data(), m_RequestData.size());
+			if (!stream)
+				break;
+
+			m_SpoolBytes += m_RequestData.size();
+		}
 	}
 
 	void ConstructRequestData(const CUserReport& report)
@@ -419,14 +588,7 @@ private:
 		// (Note that we send a request with unlabelled compressed data instead
 		// of using Content-Encoding, because Content-Encoding is a mess and causes
 		// problems with servers and breaks Content-Length and this is much easier.)
-		std::string compressed;
-		compressed.resize(compressBound(r.size()));
-		uLongf destLen = compressed.size();
-		int ok = compress((Bytef*)compressed.c_str(), &destLen, (const Bytef*)r.c_str(), r.size());
-		ENSURE(ok == Z_OK);
-		compressed.resize(destLen);
-
-		m_RequestData.swap(compressed);
+		CompressZLib(r, m_RequestData, false);
 	}
 
 	void AppendEscaped(std::string& buffer, const std::string& str)
@@ -482,18 +644,29 @@ private:
 	// Shared by main thread and worker thread:
 	// These variables are all protected by m_WorkerMutex
 	std::deque<shared_ptr<CUserReport> > m_ReportQueue;
+	size_t m_QueuedBytes; // total size of the m_Data of the reports in m_ReportQueue
 	bool m_Enabled;
 	bool m_Shutdown;
+	bool m_ServerGone; // the server has asked us not to send any more reports
 	std::string m_Status;
 
 	// Initialised in constructor by main thread; otherwise used only by worker thread:
 	std::string m_URL;
 	std::string m_UserID;
+	OsPath m_SpoolPath; // empty if reports can't be spooled
 	CURL* m_Curl;
 	curl_slist* m_Headers;
 	double m_PauseUntilTime;
 
 	// Only used by worker thread:
+	struct SpoolFile
+	{
+		OsPath path;
+		size_t size;
+	};
+	std::deque<SpoolFile> m_SpoolFiles; // oldest first
+	size_t m_SpoolBytes; // total size of m_SpoolFiles (and of any files spooled by this run)
+	size_t m_NextSpoolIndex;
 	std::string m_ResponseData;
 	std::string m_RequestData;
 	size_t m_RequestDataOffset;
@@ -582,7 +755,14 @@ void CUserReporter::Initialize()
 	// system already inits those)
 	curl_global_init(CURL_GLOBAL_ALL & ~CURL_GLOBAL_WIN32);
 
-	m_Worker = new CUserReporterWorker(userID, url);
+	// Unsent reports are saved in the cache directory
+	OsPath spoolPath;
+	if (g_VFS && g_VFS->GetDirectoryRealPath(L"cache/", spoolPath) == INFO::OK)
+		spoolPath = spoolPath / "userreport";
+	else
+		spoolPath = OsPath();
+
+	m_Worker = new CUserReporterWorker(userID, url, spoolPath);
 
 	m_Worker->SetEnabled(IsReportingEnabled());
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -25,6 +25,7 @@
 
 #include "graphics/GameView.h"
 #include "graphics/LightEnv.h"
+#include "graphics/MapAssetManifest.h"
 #include "graphics/MapReader.h"
 #include "graphics/MapWriter.h"
 #include "graphics/Terrain.h"
@@ -33,6 +34,7 @@
 #include "lib/timer.h"
 #include "ps/CLogger.h"
 #include "ps/CStr.h"
+#include "ps/ConfigDB.h"
 #include "ps/Errors.h"
 #include "ps/Game.h"
 #include "ps/Loader.h"
@@ -58,10 +60,19 @@ CWorld::CWorld(CGame *pGame):
 	m_pGame(pGame),
 	m_Terrain(new CTerrain()),
 	m_UnitManager(new CUnitManager()),
-	m_TerritoryManager(NULL)
+	m_TerritoryManager(NULL),
+	m_AssetRecorder(NULL)
 {
 }
 
+void CWorld::StartRecordingAssets(const VfsPath& mapPathname)
+{
+	bool record = false;
+	CFG_GET_USER_VAL("mapassets.record", Bool, record);
+	if (record && !m_AssetRecorder)
+		m_AssetRecorder = new CMapAssetRecorder(mapPathname);
+}
+
 /**
  * Initializes the game world with the attributes provided.
  **/
@@ -73,6 +84,8 @@ void CWorld::RegisterInit(const CStrW& mapFile, int playerID)
 		VfsPath mapfilename(VfsPath("maps/scenarios") / (mapFile + L".pmp"));
 		CMapReader* reader = 0;
 
+		StartRecordingAssets(mapfilename);
+
 		try
 		{
 			reader = new CMapReader;
@@ -100,6 +113,9 @@ void CWorld::RegisterInitRMS(const CStrW& scriptFile, const CScriptValRooted& se
 	// If scriptFile is empty, a blank map will be generated using settings (no RMS run)
 	CMapReader* reader = 0;
 
+	if (!scriptFile.empty())
+		StartRecordingAssets(L"maps/random/" + scriptFile);
+
 	reader = new CMapReader;
 	CTriggerManager* pTriggerManager = NULL;
 	reader->LoadRandomMap(scriptFile, settings, m_Terrain,
@@ -119,6 +135,7 @@ void CWorld::RegisterInitRMS(const CStrW& scriptFile, const CScriptValRooted& se
  **/
 CWorld::~CWorld()
 {
+	delete m_AssetRecorder;
 	delete m_Terrain;
 	delete m_UnitManager;
 }
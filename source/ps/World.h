@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -35,6 +35,7 @@ ERROR_SUBGROUP(Game, World);
 ERROR_TYPE(Game_World, MapLoadFailed);
 
 class CGame;
+class CMapAssetRecorder;
 class CUnitManager;
 class CTerritoryManager;
 class CTerrain;
@@ -66,6 +67,13 @@ class CWorld
 	 **/
 	CTerritoryManager *m_TerritoryManager;
 
+	/**
+	 * records the assets used while playing the map, if enabled (else NULL).
+	 **/
+	CMapAssetRecorder *m_AssetRecorder;
+
+	void StartRecordingAssets(const VfsPath& mapPathname);
+
 public:
 	CWorld(CGame *pGame);
 	~CWorld();
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,13 +23,17 @@
 #include "ps/utf16string.h"
 
 // external linkage (also used by Xeromyces.cpp)
-const char* HeaderMagicStr = "XMB0";
+const char* HeaderMagicStr = "XMB1";
 const char* UnfinishedHeaderMagicStr = "XMBu";
 
+// Previous version of the format, without the name tables
+static const char* HeaderMagicStrV0 = "XMB0";
+
 // Warning: May contain traces of pointer abuse
 
 bool XMBFile::Initialise(const char* FileData)
 {
+	m_FileData = FileData;
 	m_Pointer = FileData;
 	char Header[5] = { 0 };
 	strncpy_s(Header, 5, m_Pointer, 4);
@@ -37,7 +41,8 @@ bool XMBFile::Initialise(const char* FileData)
 	// (c.f. @return documentation of this function)
 	if(!strcmp(Header, UnfinishedHeaderMagicStr))
 		return false;
-	ENSURE(!strcmp(Header, HeaderMagicStr) && "Invalid XMB header!");
+	const bool hasNameTables = (strcmp(Header, HeaderMagicStrV0) != 0);
+	ENSURE((!hasNameTables || !strcmp(Header, HeaderMagicStr)) && "Invalid XMB header!");
 
 	int i;
 
@@ -46,18 +51,7 @@ bool XMBFile::Initialise(const char* FileData)
 	// access, but it might crash on an invalid file, reading a couple of
 	// billion random element names from RAM)
 
-#ifdef XERO_USEMAP
-	// Build a std::map of all the names->ids
-	u32 ElementNameCount = *(u32*)m_Pointer; m_Pointer += 4;
-	for (i = 0; i < ElementNameCount; ++i)
-		m_ElementNames[ReadZStrA()] = i;
-
-	u32 AttributeNameCount = *(u32*)m_Pointer; m_Pointer += 4;
-	for (i = 0; i < AttributeNameCount; ++i)
-		m_AttributeNames[ReadZStrA()] = i;
-#else
-	// Ignore all the names for now, and skip over them
-	// (remembering the position of the first)
+	// Skip over the names (remembering the position of the first)
 	m_ElementNameCount = *(int*)m_Pointer; m_Pointer += 4;
 	m_ElementPointer = m_Pointer;
 	for (i = 0; i < m_ElementNameCount; ++i)
@@ -67,18 +61,24 @@ bool XMBFile::Initialise(const char* FileData)
 	m_AttributePointer = m_Pointer;
 	for (i = 0; i < m_AttributeNameCount; ++i)
 		m_Pointer += 4 + *(int*)m_Pointer; // skip over the string
-#endif
 
-	return true;	// success
-}
+	if (hasNameTables)
+	{
+		m_ElementTable = m_Pointer;
+		m_Pointer += 4*m_ElementNameCount;
+		m_Pointer += 4 + 8 * *(int*)m_Pointer; // skip over the slots
 
-std::string XMBFile::ReadZStrA()
-{
-	int Length = *(int*)m_Pointer;
-	m_Pointer += 4;
-	std::string String (m_Pointer); // reads up until the first NULL
-	m_Pointer += Length;
-	return String;
+		m_AttributeTable = m_Pointer;
+		m_Pointer += 4*m_AttributeNameCount;
+		m_Pointer += 4 + 8 * *(int*)m_Pointer;
+	}
+	else
+	{
+		m_ElementTable = NULL;
+		m_AttributeTable = NULL;
+	}
+
+	return true;	// success
 }
 
 XMBElement XMBFile::GetRoot() const
@@ -86,29 +86,56 @@ XMBElement XMBFile::GetRoot() const
 	return XMBElement(m_Pointer);
 }
 
-
-#ifdef XERO_USEMAP
-
-int XMBFile::GetElementID(const char* Name) const
+u32 XMBFile::HashName(const char* Name)
 {
-	return m_ElementNames[Name];
+	// FNV-1a, of the name converted to lowercase (since lookups are case-insensitive)
+	u32 h = 0x811C9DC5u;
+	for (; *Name; ++Name)
+	{
+		u8 c = (u8)*Name;
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		h ^= c;
+		h *= 0x01000193u;
+	}
+	return h;
 }
 
-int XMBFile::GetAttributeID(const char* Name) const
+int XMBFile::FindName(const char* Table, const char* Names, int Count, const char* Name) const
 {
-	return m_AttributeNames[Name];
-}
-
-#else // #ifdef XERO_USEMAP
+	int len = (int)strlen(Name)+1; // count bytes, including null terminator
 
-int XMBFile::GetElementID(const char* Name) const
-{
-	const char* Pos = m_ElementPointer;
+	if (Table)
+	{
+		const int SlotCount = *(int*)(Table + 4*Count);
+		if (SlotCount == 0)
+			return -1;
+		const char* Slots = Table + 4*Count + 4;
+
+		// Probe from the name's hash until we find it or reach an empty slot.
+		// Names were inserted in ID order, so if several match case-insensitively
+		// we find the lowest ID first, same as the linear search
+		const u32 hash = HashName(Name);
+		const u32 mask = (u32)SlotCount - 1;
+		for (u32 slot = hash & mask; ; slot = (slot + 1) & mask)
+		{
+			const char* Slot = Slots + 8*slot;
+			const int ID = *(int*)(Slot + 4);
+			if (ID == -1)
+				return -1;
+			if (*(u32*)Slot == hash)
+			{
+				const char* Pos = m_FileData + *(int*)(Table + 4*ID);
+				if (*(int*)Pos == len && strncasecmp(Pos+4, Name, len) == 0)
+					return ID;
+			}
+		}
+	}
 
-	int len = (int)strlen(Name)+1; // count bytes, including null terminator
+	const char* Pos = Names;
 
 	// Loop through each string to find a match
-	for (int i = 0; i < m_ElementNameCount; ++i)
+	for (int i = 0; i < Count; ++i)
 	{
 		// See if this could be the right string, checking its
 		// length and then its contents
@@ -121,44 +148,39 @@ int XMBFile::GetElementID(const char* Name) const
 	return -1;
 }
 
-int XMBFile::GetAttributeID(const char* Name) const
+const char* XMBFile::GetName(const char* Table, const char* Names, int Count, int ID) const
 {
-	const char* Pos = m_AttributePointer;
+	if (ID < 0 || ID >= Count)
+		return "";
 
-	int len = (int)strlen(Name)+1; // count bytes, including null terminator
+	if (Table)
+		return m_FileData + *(int*)(Table + 4*ID) + 4;
 
-	// Loop through each string to find a match
-	for (int i = 0; i < m_AttributeNameCount; ++i)
-	{
-		// See if this could be the right string, checking its
-		// length and then its contents
-		if (*(int*)Pos == len && strncasecmp(Pos+4, Name, len) == 0)
-			return i;
-		// If not, jump to the next string
+	// Relatively inefficient, but old files don't have the offsets
+	const char* Pos = Names;
+	for (int i = 0; i < ID; ++i)
 		Pos += 4 + *(int*)Pos;
-	}
-	// Failed
-	return -1;
+	return Pos+4;
+}
+
+int XMBFile::GetElementID(const char* Name) const
+{
+	return FindName(m_ElementTable, m_ElementPointer, m_ElementNameCount, Name);
 }
-#endif // #ifdef XERO_USEMAP / #else
 
+int XMBFile::GetAttributeID(const char* Name) const
+{
+	return FindName(m_AttributeTable, m_AttributePointer, m_AttributeNameCount, Name);
+}
 
-// Relatively inefficient, so only use when
-// laziness overcomes the need for speed
 std::string XMBFile::GetElementString(const int ID) const
 {
-	const char* Pos = m_ElementPointer;
-	for (int i = 0; i < ID; ++i)
-		Pos += 4 + *(int*)Pos;
-	return std::string(Pos+4);
+	return std::string(GetName(m_ElementTable, m_ElementPointer, m_ElementNameCount, ID));
 }
 
 std::string XMBFile::GetAttributeString(const int ID) const
 {
-	const char* Pos = m_AttributePointer;
-	for (int i = 0; i < ID; ++i)
-		Pos += 4 + *(int*)Pos;
-	return std::string(Pos+4);
+	return std::string(GetName(m_AttributeTable, m_AttributePointer, m_AttributeNameCount, ID));
 }
 
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -44,7 +44,7 @@ Main limitations:
 Theoretical file structure:
 
 XMB_File {
-	char Header[4]; // because everyone has one; currently "XMB0"
+	char Header[4]; // because everyone has one; currently "XMB1"
 
 	int ElementNameCount;
 	ZStrA ElementNames[];
@@ -52,9 +52,23 @@ XMB_File {
 	int AttributeNameCount;
 	ZStrA AttributeNames[];
 
+	XMB_NameTable ElementNameTable;
+	XMB_NameTable AttributeNameTable;
+
 	XMB_Node Root;
 }
 
+XMB_NameTable {
+	int NameOffsets[NameCount]; // of each ZStrA, from the start of the file
+	int SlotCount; // a power of two greater than NameCount, or 0 if NameCount is 0
+	XMB_NameSlot Slots[SlotCount]; // open-addressed hash table, with linear probing
+}
+
+XMB_NameSlot {
+	u32 Hash; // XMBFile::HashName of the name
+	int ID; // -1 if the slot is empty
+}
+
 XMB_Node {
 0)	int Length; // of entire struct, so it can be skipped over
 
@@ -92,6 +106,10 @@ XMB_Text {
 28)	char16* Text; // null-terminated UTF16
 }
 
+The name tables let names be looked up in constant time, without building
+any data structure when loading the file. (Old "XMB0" files, which don't have
+them, are still supported with a linear search.)
+
 TODO: since the API was changed to return UTF-8 CStrs,
 it'd make much more sense to store UTF-8 on disk too
 (plus it'd save space).
@@ -101,16 +119,8 @@ it'd make much more sense to store UTF-8 on disk too
 #ifndef INCLUDED_XEROXMB
 #define INCLUDED_XEROXMB
 
-// Define to use a std::map for name lookups rather than a linear search.
-// (The map is usually slower.)
-//#define XERO_USEMAP 
-
 #include <string>
 
-#ifdef XERO_USEMAP
-# include <map>
-#endif
-
 #include "ps/CStr.h"
 
 // File headers, to make sure it doesn't try loading anything other than an XMB
@@ -126,7 +136,7 @@ class XMBFile
 {
 public:
 
-	XMBFile() : m_Pointer(NULL) {}
+	XMBFile() : m_Pointer(NULL), m_ElementTable(NULL), m_AttributeTable(NULL) {}
 
 	// Initialise from the contents of an XMB file.
 	// FileData must remain allocated and unchanged while
@@ -140,30 +150,33 @@ public:
 	XMBElement GetRoot() const;
 
 	
-	// Returns internal ID for a given ASCII element/attribute string.
+	// Returns internal ID for a given ASCII element/attribute string
+	// (case-insensitively), or -1 if it's not used in the file.
 	int GetElementID(const char* Name) const;
 	int GetAttributeID(const char* Name) const;
 
-	// For lazy people (e.g. me) when speed isn't vital:
-
 	// Returns element/attribute string for a given internal ID
 	std::string GetElementString(const int ID) const;
 	std::string GetAttributeString(const int ID) const;
 
+	// Hash function used for the name tables (case-insensitive)
+	static u32 HashName(const char* Name);
+
 private:
+	int FindName(const char* Table, const char* Names, int Count, const char* Name) const;
+	const char* GetName(const char* Table, const char* Names, int Count, int ID) const;
+
+	const char* m_FileData;
 	const char* m_Pointer;
 
-#ifdef XERO_USEMAP
-	std::map<std::string, int> m_ElementNames;
-	std::map<std::string, int> m_AttributeNames;
-#else
 	int m_ElementNameCount;
 	int m_AttributeNameCount;
 	const char* m_ElementPointer;
 	const char* m_AttributePointer;
-#endif
 
-	std::string ReadZStrA();
+	// XMB_NameTables, or NULL if the file doesn't have them
+	const char* m_ElementTable;
+	const char* m_AttributeTable;
 };
 
 class XMBElement
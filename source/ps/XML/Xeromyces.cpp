@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,6 +27,7 @@
 #include "ps/CacheLoader.h"
 #include "ps/CLogger.h"
 #include "ps/Filesystem.h"
+#include "ps/ThreadPool.h"
 #include "Xeromyces.h"
 
 #include <libxml/parser.h>
@@ -62,18 +63,18 @@ void CXeromyces::Terminate()
 	g_XeromycesStarted = false;
 }
 
+// Arbitrary version number - change this if we update the code and
+// need to invalidate old users' caches
+static const u32 XMB_CACHE_VERSION = 2;
+
 PSRETURN CXeromyces::Load(const PIVFS& vfs, const VfsPath& filename)
 {
 	ENSURE(g_XeromycesStarted);
 
 	CCacheLoader cacheLoader(vfs, L".xmb");
 
-	// Arbitrary version number - change this if we update the code and
-	// need to invalidate old users' caches
-	u32 version = 1;
-
 	VfsPath xmbPath;
-	Status ret = cacheLoader.TryLoadingCached(filename, MD5(), version, xmbPath);
+	Status ret = cacheLoader.TryLoadingCached(filename, MD5(), XMB_CACHE_VERSION, xmbPath);
 
 	if (ret == INFO::OK)
 	{
@@ -110,6 +111,119 @@ bool CXeromyces::GenerateCachedXMB(const PIVFS& vfs, const VfsPath& sourcePath,
 	return (ConvertFile(vfs, sourcePath, VfsPath("cache") / archiveCachePath) == PSRETURN_OK);
 }
 
+/**
+ * Converts a batch of XML files to XMB, on any thread.
+ *
+ * libxml2 itself is thread-safe once xmlInitParser has been called (by Startup),
+ * but its error handler is per-thread state, so it's set up again on each worker.
+ * Everything else used by the conversion is either local or (like the VFS and
+ * the logger) has its own locking.
+ */
+class CXeromyces::ConvertTask : public CThreadPool::ITask
+{
+public:
+	/**
+	 * If @p skipCached, files that already have a valid cached XMB are skipped,
+	 * and the others are written to their loose cache path.
+	 * Otherwise all files are written to their archive cache path.
+	 */
+	ConvertTask(const PIVFS& vfs, const VfsPaths& sourcePaths, bool skipCached) :
+		m_VFS(vfs), m_SourcePaths(sourcePaths), m_SkipCached(skipCached),
+		m_CachePaths(sourcePaths.size()), m_Results(sourcePaths.size(), PSRETURN_OK), m_Converted(sourcePaths.size(), 0)
+	{
+	}
+
+	virtual void Run(size_t index)
+	{
+		xmlSetStructuredErrorFunc(NULL, &errorHandler);
+
+		CCacheLoader cacheLoader(m_VFS, L".xmb");
+		const VfsPath& sourcePath = m_SourcePaths[index];
+		VfsPath xmbPath;
+		if (m_SkipCached)
+		{
+			Status ret = cacheLoader.TryLoadingCached(sourcePath, MD5(), XMB_CACHE_VERSION, xmbPath);
+			if (ret != INFO::SKIPPED)
+				return; // already cached, or there's nothing to convert
+		}
+		else
+		{
+			m_CachePaths[index] = cacheLoader.ArchiveCachePath(sourcePath);
+			xmbPath = VfsPath("cache") / m_CachePaths[index];
+		}
+
+		CXeromyces xero;
+		m_Results[index] = xero.ConvertFile(m_VFS, sourcePath, xmbPath);
+		m_Converted[index] = (m_Results[index] == PSRETURN_OK) ? 1 : 0;
+	}
+
+	void Process(CThreadPool* threadPool)
+	{
+		if (threadPool && m_SourcePaths.size() > 1)
+		{
+			threadPool->ParallelFor(*this, m_SourcePaths.size());
+		}
+		else
+		{
+			for (size_t i = 0; i < m_SourcePaths.size(); ++i)
+				Run(i);
+		}
+	}
+
+	const VfsPaths& GetCachePaths() const { return m_CachePaths; }
+	bool Succeeded(size_t index) const { return m_Results[index] == PSRETURN_OK; }
+	bool Converted(size_t index) const { return m_Converted[index] != 0; }
+
+private:
+	PIVFS m_VFS;
+	const VfsPaths& m_SourcePaths;
+	bool m_SkipCached;
+	VfsPaths m_CachePaths;
+	std::vector<PSRETURN> m_Results;
+	std::vector<u8> m_Converted; // (not vector<bool>, since threads write to different elements)
+};
+
+bool CXeromyces::GenerateCachedXMBs(const PIVFS& vfs, const VfsPaths& sourcePaths, VfsPaths& archiveCachePaths, CThreadPool* threadPool)
+{
+	ENSURE(g_XeromycesStarted);
+
+	ConvertTask task(vfs, sourcePaths, false);
+	task.Process(threadPool);
+
+	archiveCachePaths = task.GetCachePaths();
+
+	bool ok = true;
+	for (size_t i = 0; i < sourcePaths.size(); ++i)
+		if (!task.Succeeded(i))
+			ok = false;
+	return ok;
+}
+
+static Status AddToPathnames(const VfsPath& pathname, const FileInfo& UNUSED(fileInfo), const uintptr_t cbData)
+{
+	VfsPaths* pathnames = (VfsPaths*)cbData;
+	pathnames->push_back(pathname);
+	return INFO::OK;
+}
+
+size_t CXeromyces::PrewarmCache(const PIVFS& vfs, const VfsPath& directory, CThreadPool* threadPool)
+{
+	ENSURE(g_XeromycesStarted);
+
+	VfsPaths sourcePaths;
+	if (vfs::ForEachFile(vfs, directory, AddToPathnames, (uintptr_t)&sourcePaths, L"*.xml", vfs::DIR_RECURSIVE) < 0)
+		return 0;
+
+	ConvertTask task(vfs, sourcePaths, true);
+	task.Process(threadPool);
+
+	size_t converted = 0;
+	for (size_t i = 0; i < sourcePaths.size(); ++i)
+		if (task.Converted(i))
+			++converted;
+	return converted;
+}
+
 PSRETURN CXeromyces::ConvertFile(const PIVFS& vfs, const VfsPath& filename, const VfsPath& xmbPath)
 {
 	CVFSFile input;
@@ -119,6 +233,10 @@ PSRETURN CXeromyces::ConvertFile(const PIVFS& vfs, const VfsPath& filename, cons
 		return PSRETURN_Xeromyces_XMLOpenFailed;
 	}
 
+	// The error handler is per-thread state, so set it here in case we're
+	// not on the thread that called Startup
+	xmlSetStructuredErrorFunc(NULL, &errorHandler);
+
 	CStr8 filename8(CStrW(filename.string()).ToUTF8());
 	xmlDocPtr doc = xmlReadMemory((const char*)input.GetBuffer(), (int)input.GetBufferSize(),
 		filename8.c_str(), NULL, XML_PARSE_NONET|XML_PARSE_NOCDATA);
@@ -311,6 +429,42 @@ static void OutputElement(const xmlNodePtr node, WriteBuffer& writeBuffer,
 	writeBuffer.Overwrite(&length, 4, posLength);
 }
 
+/**
+ * Outputs an XMB_NameTable (see XeroXMB.h) for the given names, whose IDs are
+ * their indexes in @p names, and whose ZStrAs are at @p offsets in the file.
+ */
+static void OutputNameTable(WriteBuffer& writeBuffer, const std::vector<std::string>& names, const std::vector<u32>& offsets)
+{
+	for (size_t i = 0; i < offsets.size(); ++i)
+		writeBuffer.Append(&offsets[i], 4);
+
+	// Keep the table at most half full, so probe sequences stay short
+	u32 slotCount = 0;
+	if (!names.empty())
+	{
+		slotCount = 1;
+		while (slotCount < 2*names.size())
+			slotCount *= 2;
+	}
+	writeBuffer.Append(&slotCount, 4);
+
+	std::vector<std::pair<u32, i32> > slots(slotCount, std::make_pair(0u, -1));
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		u32 hash = XMBFile::HashName(names[i].c_str());
+		u32 slot = hash & (slotCount - 1);
+		while (slots[slot].second != -1)
+			slot = (slot + 1) & (slotCount - 1);
+		slots[slot] = std::make_pair(hash, (i32)i);
+	}
+
+	for (size_t i = 0; i < slots.size(); ++i)
+	{
+		writeBuffer.Append(&slots[i].first, 4);
+		writeBuffer.Append(&slots[i].second, 4);
+	}
+}
+
 PSRETURN CXeromyces::CreateXMB(const xmlDocPtr doc, WriteBuffer& writeBuffer)
 {
 	// Header
@@ -326,6 +480,8 @@ PSRETURN CXeromyces::CreateXMB(const xmlDocPtr doc, WriteBuffer& writeBuffer)
 
 	std::map<std::string, u32> elementIDs;
 	std::map<std::string, u32> attributeIDs;
+	std::vector<u32> elementOffsets;
+	std::vector<u32> attributeOffsets;
 
 	// Output element names
 	i = 0;
@@ -333,6 +489,7 @@ PSRETURN CXeromyces::CreateXMB(const xmlDocPtr doc, WriteBuffer& writeBuffer)
 	writeBuffer.Append(&elementCount, 4);
 	for (it = elementNames.begin(); it != elementNames.end(); ++it)
 	{
+		elementOffsets.push_back((u32)writeBuffer.Size());
 		u32 textLen = (u32)it->length()+1;
 		writeBuffer.Append(&textLen, 4);
 		writeBuffer.Append((void*)it->c_str(), textLen);
@@ -345,12 +502,17 @@ PSRETURN CXeromyces::CreateXMB(const xmlDocPtr doc, WriteBuffer& writeBuffer)
 	writeBuffer.Append(&attributeCount, 4);
 	for (it = attributeNames.begin(); it != attributeNames.end(); ++it)
 	{
+		attributeOffsets.push_back((u32)writeBuffer.Size());
 		u32 textLen = (u32)it->length()+1;
 		writeBuffer.Append(&textLen, 4);
 		writeBuffer.Append((void*)it->c_str(), textLen);
 		attributeIDs[*it] = i++;
 	}
 
+	// Output the name lookup tables
+	OutputNameTable(writeBuffer, std::vector<std::string>(elementNames.begin(), elementNames.end()), elementOffsets);
+	OutputNameTable(writeBuffer, std::vector<std::string>(attributeNames.begin(), attributeNames.end()), attributeOffsets);
+
 	OutputElement(xmlDocGetRootElement(doc), writeBuffer, elementIDs, attributeIDs);
 
 	// file is now valid, so insert correct magic string
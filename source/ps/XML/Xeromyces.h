@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -35,6 +35,7 @@ ERROR_TYPE(Xeromyces, XMLParseError);
 
 class WriteBuffer;
 class MD5;
+class CThreadPool;
 
 typedef struct _xmlDoc xmlDoc;
 typedef xmlDoc* xmlDocPtr;
@@ -45,6 +46,7 @@ class CXeromyces : public XMBFile
 public:
 	/**
 	 * Load from an XML file (with invisible XMB caching).
+	 * This may be called from any thread (after Startup).
 	 */
 	PSRETURN Load(const PIVFS& vfs, const VfsPath& filename);
 
@@ -60,6 +62,22 @@ public:
 	 */
 	bool GenerateCachedXMB(const PIVFS& vfs, const VfsPath& sourcePath, VfsPath& archiveCachePath);
 
+	/**
+	 * Like GenerateCachedXMB, but converts a batch of files concurrently on the
+	 * threads of @p threadPool (which may be NULL, to convert them serially).
+	 * Returns the XMB path of each file in @p archiveCachePaths.
+	 * Returns false if any file failed to convert.
+	 */
+	static bool GenerateCachedXMBs(const PIVFS& vfs, const VfsPaths& sourcePaths, VfsPaths& archiveCachePaths, CThreadPool* threadPool);
+
+	/**
+	 * Converts every XML file in @p directory (recursively) that doesn't have an
+	 * up-to-date cached XMB, concurrently on the threads of @p threadPool
+	 * (which may be NULL), so that later calls to Load don't have to.
+	 * Returns the number of files that were converted.
+	 */
+	static size_t PrewarmCache(const PIVFS& vfs, const VfsPath& directory, CThreadPool* threadPool);
+
 	/**
 	 * Call once when initialising the program, to load libxml2.
 	 * This should be run in the main thread, before any thread uses libxml2.
@@ -72,6 +90,8 @@ public:
 	static void Terminate();
 
 private:
+	class ConvertTask;
+
 	PSRETURN ConvertFile(const PIVFS& vfs, const VfsPath& filename, const VfsPath& xmbPath);
 
 	bool ReadXMBFile(const PIVFS& vfs, const VfsPath& filename);
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -110,6 +110,41 @@ public:
 		TS_ASSERT_EQUALS(w.GetAttributes().Count, 0);
 	}
 
+	void test_name_lookup()
+	{
+		std::string doc = "<root>";
+		for (int i = 0; i < 100; ++i)
+			doc += "<el" + CStr::FromInt(i) + " at" + CStr::FromInt(i) + "='x'/>";
+		doc += "<Mixed/></root>";
+
+		XMBFile xmb (parse(doc.c_str()));
+
+		for (int i = 0; i < 100; ++i)
+		{
+			std::string el = "el" + CStr::FromInt(i);
+			std::string at = "at" + CStr::FromInt(i);
+			TS_ASSERT_DIFFERS(xmb.GetElementID(el.c_str()), -1);
+			TS_ASSERT_DIFFERS(xmb.GetAttributeID(at.c_str()), -1);
+			TS_ASSERT_EQUALS(xmb.GetElementString(xmb.GetElementID(el.c_str())), el);
+			TS_ASSERT_EQUALS(xmb.GetAttributeString(xmb.GetAttributeID(at.c_str())), at);
+		}
+		TS_ASSERT_EQUALS(xmb.GetElementID("el100"), -1);
+		TS_ASSERT_EQUALS(xmb.GetElementID("at0"), -1);
+		TS_ASSERT_EQUALS(xmb.GetAttributeID("el0"), -1);
+		TS_ASSERT_EQUALS(xmb.GetAttributeID(""), -1);
+
+		// Lookups are case-insensitive
+		TS_ASSERT_DIFFERS(xmb.GetElementID("mixed"), -1);
+		TS_ASSERT_EQUALS(xmb.GetElementID("mixed"), xmb.GetElementID("MIXED"));
+		TS_ASSERT_EQUALS(xmb.GetElementString(xmb.GetElementID("mixed")), "Mixed");
+
+		TS_ASSERT_EQUALS(xmb.GetElementString(-1), "");
+
+		XMBElement el5 = xmb.GetRoot().GetChildNodes().Item(5);
+		TS_ASSERT_EQUALS(xmb.GetElementString(el5.GetNodeName()), "el5");
+		TS_ASSERT_EQUALS(xmb.GetAttributeString(el5.GetAttributes().Item(0).Name), "at5");
+	}
+
 	void test_doctype_ignored()
 	{
 		XMBFile xmb (parse("<!DOCTYPE foo SYSTEM \"file:///dev/urandom\"><foo/>"));
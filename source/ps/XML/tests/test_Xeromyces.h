@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,6 +18,8 @@
 #include "lib/self_test.h"
 
 #include "ps/CLogger.h"
+#include "ps/Filesystem.h"
+#include "ps/ThreadPool.h"
 #include "ps/XML/Xeromyces.h"
 #include "lib/file/vfs/vfs.h"
 
@@ -50,4 +52,30 @@ public:
 		CXeromyces xero;
 		TS_ASSERT_EQUALS(xero.LoadString("<test>"), PSRETURN_Xeromyces_XMLParseError);
 	}
+
+	void test_PrewarmCache()
+	{
+		PIVFS vfs = CreateVfs(20 * MiB);
+		TS_ASSERT_OK(vfs->Mount(L"", DataDir()/"mods"/"_test.sim", VFS_MOUNT_MUST_EXIST));
+		TS_ASSERT_OK(vfs->Mount(L"cache", DataDir()/"_testcache"));
+
+		{
+			// (Some of the test templates are deliberately ill-formed)
+			TestLogger logger;
+			CThreadPool threadPool(3);
+
+			size_t converted = CXeromyces::PrewarmCache(vfs, L"simulation/templates/", &threadPool);
+			TS_ASSERT(converted > 0);
+
+			// Everything that could be converted should be cached now
+			TS_ASSERT_EQUALS(CXeromyces::PrewarmCache(vfs, L"simulation/templates/", &threadPool), (size_t)0);
+		}
+
+		CXeromyces xero;
+		TS_ASSERT_EQUALS(xero.Load(vfs, L"simulation/templates/basic.xml"), PSRETURN_OK);
+		TS_ASSERT_STR_EQUALS(xero.GetElementString(xero.GetRoot().GetNodeName()), "Entity");
+
+		vfs.reset();
+		DeleteDirectory(DataDir()/"_testcache");
+	}
 };
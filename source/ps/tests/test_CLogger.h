@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -110,6 +110,28 @@ public:
 		TS_ASSERT_EQUALS(lines[0], "Test&lt;a&amp;b>c&lt;d&amp;e>");
 	}
 
+	void test_repeated()
+	{
+		for (int i = 0; i < 20; ++i)
+			logger->LogWarning(L"Repeated");
+		logger->LogWarning(L"Different");
+		for (int i = 0; i < 7; ++i)
+			logger->LogWarning(L"Repeated");
+		logger->LogMessage(L"Different");
+
+		ParseOutput();
+
+		// Only the first few repeats are written, then the rest are counted
+		TS_ASSERT_EQUALS((int)lines.size(), 6+1+1 + 6+1+1);
+		TS_ASSERT_EQUALS(lines[0], "WARNING: Repeated");
+		TS_ASSERT_EQUALS(lines[5], "WARNING: Repeated");
+		TS_ASSERT_EQUALS(lines[6], "(previous message repeated 14 more time(s))");
+		TS_ASSERT_EQUALS(lines[7], "WARNING: Different");
+		TS_ASSERT_EQUALS(lines[13], "WARNING: Repeated");
+		TS_ASSERT_EQUALS(lines[14], "(previous message repeated 1 more time(s))");
+		TS_ASSERT_EQUALS(lines[15], "Different");
+	}
+
 	//////////////////////////////////////////////////////////////////////////
 
 	CLogger* logger;
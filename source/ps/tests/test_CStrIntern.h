@@ -0,0 +1,91 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "ps/CStrIntern.h"
+
+#include <sstream>
+
+class TestCStrIntern : public CxxTest::TestSuite
+{
+	struct InternArgs
+	{
+		int thread;
+		std::vector<CStrIntern> strings;
+	};
+
+	static void* InternThread(void* data)
+	{
+		InternArgs* args = static_cast<InternArgs*>(data);
+		for (int i = 0; i < 1000; ++i)
+		{
+			// Mostly strings that the other threads are interning too
+			std::stringstream str;
+			str << "test_CStrIntern " << (i % 100 == 0 ? args->thread : 0) << " " << i;
+			args->strings.push_back(CStrIntern(str.str()));
+		}
+		return NULL;
+	}
+
+public:
+	void test_basic()
+	{
+		CStrIntern a("foo");
+		CStrIntern b(std::string("foo"));
+		CStrIntern c("foobar", 3);
+		CStrIntern d("bar");
+		TS_ASSERT(a == b);
+		TS_ASSERT(a == c);
+		TS_ASSERT(!(a == d));
+		TS_ASSERT_EQUALS(c.length(), (size_t)3);
+		TS_ASSERT_STR_EQUALS(c.c_str(), "foo");
+		TS_ASSERT_EQUALS(c.GetHash(), CStrIntern("foo").GetHash());
+
+		TS_ASSERT(CStrIntern() == CStrIntern(""));
+	}
+
+	void test_static()
+	{
+		TS_ASSERT(str_baseTex == CStrIntern("baseTex"));
+		TS_ASSERT_STR_EQUALS(str_particle_solid.string(), "particle_solid");
+	}
+
+	void test_threads()
+	{
+		const int numThreads = 4;
+		pthread_t threads[numThreads];
+		InternArgs args[numThreads];
+		for (int i = 0; i < numThreads; ++i)
+		{
+			args[i].thread = i + 1;
+			TS_ASSERT_EQUALS(pthread_create(&threads[i], NULL, InternThread, &args[i]), 0);
+		}
+		for (int i = 0; i < numThreads; ++i)
+			pthread_join(threads[i], NULL);
+
+		// Every thread must have got the same interned strings as the main thread
+		for (int i = 0; i < numThreads; ++i)
+		{
+			TS_ASSERT_EQUALS(args[i].strings.size(), (size_t)1000);
+			for (size_t j = 0; j < args[i].strings.size(); ++j)
+				TS_ASSERT(args[i].strings[j] == CStrIntern(args[i].strings[j].string()));
+		}
+		TS_ASSERT(args[0].strings[1] == args[1].strings[1]);
+		TS_ASSERT(!(args[0].strings[0] == args[1].strings[0]));
+	}
+};
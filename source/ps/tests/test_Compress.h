@@ -0,0 +1,90 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "lib/self_test.h"
+
+#include "ps/Compress.h"
+
+#include "lib/external_libraries/zlib.h"
+
+class TestCompress : public CxxTest::TestSuite
+{
+	// Decompresses raw deflate data (as stored in zip files)
+	static std::string Inflate(const std::string& data, size_t size)
+	{
+		z_stream zs;
+		memset(&zs, 0, sizeof(zs));
+		TS_ASSERT_EQUALS(inflateInit2(&zs, -MAX_WBITS), Z_OK);
+
+		// (allocate an extra byte, to check there's no more output than expected)
+		std::string out(size + 1, '\0');
+		zs.next_in = (Bytef*)data.data();
+		zs.avail_in = (uInt)data.size();
+		zs.next_out = (Bytef*)&out[0];
+		zs.avail_out = (uInt)out.size();
+		TS_ASSERT_EQUALS(inflate(&zs, Z_FINISH), Z_STREAM_END);
+		TS_ASSERT_EQUALS(zs.avail_in, 0u);
+		TS_ASSERT_EQUALS(zs.avail_out, 1u);
+		inflateEnd(&zs);
+		out.resize(size);
+		return out;
+	}
+
+	void check(const std::string& data, size_t bufferSize)
+	{
+		CDeflateStreamBuf buf(bufferSize);
+		{
+			std::ostream stream(&buf);
+			// Write in uneven pieces, to test the buffer swapping
+			for (size_t i = 0; i < data.size(); i += 7)
+				stream.write(data.data() + i, std::min((size_t)7, data.size() - i));
+			TS_ASSERT(stream.good());
+		}
+		buf.Finish();
+
+		TS_ASSERT_EQUALS(buf.GetUncompressedSize(), data.size());
+		TS_ASSERT_EQUALS(buf.GetChecksum(), (u32)crc32(crc32(0, NULL, 0), (const Bytef*)data.data(), (uInt)data.size()));
+		TS_ASSERT(Inflate(buf.GetCompressed(), data.size()) == data);
+	}
+
+public:
+	void test_deflate_empty()
+	{
+		check("", 16);
+	}
+
+	void test_deflate_small()
+	{
+		check("Hello world", 1024);
+	}
+
+	void test_deflate_large()
+	{
+		std::string data;
+		for (size_t i = 0; i < 100000; ++i)
+			data += (char)(i * i % 251);
+		check(data, 1000);
+		check(data, 1*MiB);
+	}
+
+	void test_deflate_abort()
+	{
+		// Destroying without finishing must not hang
+		CDeflateStreamBuf buf(16);
+		std::ostream stream(&buf);
+		stream << "0123456789012345678901234567890123456789";
+	}
+};
@@ -0,0 +1,106 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "ps/Loader.h"
+#include "ps/LoaderThunks.h"
+
+class TestLoader : public CxxTest::TestSuite
+{
+	class Stages
+	{
+	public:
+		Stages() : m_Background(0), m_SeenBackground(-1), m_Calls(0) { }
+
+		int Background()
+		{
+			m_Background = 42;
+			return 0;
+		}
+
+		int Dependent()
+		{
+			m_SeenBackground = m_Background;
+			return 0;
+		}
+
+		int Progressive()
+		{
+			// Pretend to time out a few times before finishing
+			return (++m_Calls < 3) ? 50 : 0;
+		}
+
+		int Failing()
+		{
+			return (int)ERR::FAIL;
+		}
+
+		int m_Background;
+		int m_SeenBackground;
+		int m_Calls;
+	};
+
+public:
+	void test_background()
+	{
+		Stages stages;
+		LDR_BeginRegistering();
+		size_t task = RegMemFunBackground(&stages, &Stages::Background, L"Background", 10);
+		RegMemFun(&stages, &Stages::Dependent, L"Dependent", 10);
+		LDR_AddDependency(task);
+		LDR_EndRegistering();
+		TS_ASSERT_OK(LDR_NonprogressiveLoad());
+
+		// The dependent task must have seen the background task's results
+		TS_ASSERT_EQUALS(stages.m_SeenBackground, 42);
+	}
+
+	void test_background_progressive()
+	{
+		Stages stages;
+		LDR_BeginRegistering();
+		RegMemFunBackground(&stages, &Stages::Progressive, L"Progressive", 10);
+		LDR_EndRegistering();
+		TS_ASSERT_OK(LDR_NonprogressiveLoad());
+
+		// Loading can't complete until the background task has
+		TS_ASSERT_EQUALS(stages.m_Calls, 3);
+	}
+
+	void test_background_failure()
+	{
+		Stages stages;
+		LDR_BeginRegistering();
+		size_t task = RegMemFunBackground(&stages, &Stages::Failing, L"Failing", 10);
+		RegMemFun(&stages, &Stages::Dependent, L"Dependent", 10);
+		LDR_AddDependency(task);
+		LDR_EndRegistering();
+
+		wchar_t description[100];
+		int progress;
+		Status ret;
+		do
+			ret = LDR_ProgressiveLoad(1.0, description, ARRAY_SIZE(description), &progress);
+		while (ret == ERR::TIMED_OUT);
+		TS_ASSERT_EQUALS(ret, ERR::FAIL);
+
+		// The dependent task mustn't have been run
+		TS_ASSERT_EQUALS(stages.m_SeenBackground, -1);
+		LDR_Cancel();
+	}
+};
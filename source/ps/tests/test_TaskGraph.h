@@ -0,0 +1,124 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "lib/self_test.h"
+
+#include "lib/sysdep/cpu.h"
+#include "ps/TaskGraph.h"
+
+class TestTaskGraph : public CxxTest::TestSuite
+{
+	// Sums 1/(i+1) in chunks, so the floating-point rounding depends on the
+	// order of the additions
+	class SumTask : public CTaskRunner::IReduceTask<double>
+	{
+	public:
+		virtual void Run(size_t begin, size_t end, double& result, CTaskScratch& scratch)
+		{
+			double* terms = scratch.Allocate<double>(end - begin);
+			TS_ASSERT_EQUALS((uintptr_t)terms % 16, (uintptr_t)0);
+			for (size_t i = begin; i < end; ++i)
+				terms[i - begin] = 1.0 / (double)(i + 1);
+			for (size_t i = begin; i < end; ++i)
+				result += terms[i - begin];
+		}
+
+		virtual void Merge(double& total, const double& chunk)
+		{
+			total += chunk;
+		}
+	};
+
+	double Sum(CThreadPool* pool, size_t count, size_t chunkSize)
+	{
+		CTaskRunner runner(pool);
+		SumTask task;
+		double total = 0.0;
+		runner.ParallelReduce(task, count, chunkSize, total);
+		return total;
+	}
+
+	// Records the order that tasks finished in
+	class OrderTask : public CTaskGraph::ITask
+	{
+	public:
+		OrderTask(volatile intptr_t& counter) : m_Counter(counter), m_Order(-1) { }
+
+		virtual void Run(CTaskScratch& UNUSED(scratch))
+		{
+			m_Order = cpu_AtomicAdd(&m_Counter, 1);
+		}
+
+		volatile intptr_t& m_Counter;
+		intptr_t m_Order;
+	};
+
+public:
+	void test_reduce()
+	{
+		const double serial = Sum(NULL, 100000, 1000);
+		TS_ASSERT_DELTA(serial, 12.0901, 0.0001);
+
+		CThreadPool pool(4);
+		for (int repeat = 0; repeat < 5; ++repeat)
+			TS_ASSERT_EQUALS(Sum(&pool, 100000, 1000), serial);
+
+		pool.SetSerial(true);
+		TS_ASSERT_EQUALS(Sum(&pool, 100000, 1000), serial);
+
+		TS_ASSERT_EQUALS(Sum(&pool, 0, 1000), 0.0);
+		TS_ASSERT_EQUALS(Sum(&pool, 1, 1000), 1.0);
+	}
+
+	void test_graph()
+	{
+		CThreadPool pool(4);
+		CTaskRunner runner(&pool);
+
+		volatile intptr_t counter = 0;
+		std::vector<OrderTask*> tasks;
+		CTaskGraph graph;
+		for (size_t i = 0; i < 20; ++i)
+		{
+			tasks.push_back(new OrderTask(counter));
+			graph.AddTask(*tasks.back());
+		}
+
+		// 0..9 are independent; 10..19 each depend on two of those; 19 also on 18
+		for (size_t i = 10; i < 20; ++i)
+		{
+			graph.AddDependency(i, i - 10);
+			graph.AddDependency(i, (i - 9) % 10);
+		}
+		graph.AddDependency(19, 18);
+
+		runner.RunGraph(graph);
+
+		for (size_t i = 0; i < 20; ++i)
+			TS_ASSERT_DIFFERS(tasks[i]->m_Order, -1);
+		for (size_t i = 10; i < 20; ++i)
+		{
+			TS_ASSERT_LESS_THAN(tasks[i - 10]->m_Order, tasks[i]->m_Order);
+			TS_ASSERT_LESS_THAN(tasks[(i - 9) % 10]->m_Order, tasks[i]->m_Order);
+		}
+		TS_ASSERT_LESS_THAN(tasks[18]->m_Order, tasks[19]->m_Order);
+
+		for (size_t i = 0; i < tasks.size(); ++i)
+			delete tasks[i];
+	}
+};
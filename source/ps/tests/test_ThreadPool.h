@@ -0,0 +1,80 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "lib/sysdep/os_cpu.h"
+#include "ps/ThreadPool.h"
+
+class TestThreadPool : public CxxTest::TestSuite
+{
+	class SquareTask : public CThreadPool::ITask
+	{
+	public:
+		SquareTask(std::vector<int>& out) : m_Out(out) { }
+
+		virtual void Run(size_t index)
+		{
+			m_Out[index] += (int)(index * index);
+		}
+
+		std::vector<int>& m_Out;
+	};
+
+	void check(size_t numWorkers, const std::vector<size_t>& processors = std::vector<size_t>())
+	{
+		CThreadPool pool(numWorkers, processors);
+		TS_ASSERT_EQUALS(pool.GetNumWorkers(), numWorkers);
+
+		const size_t counts[] = { 0, 1, 2, 3, 100, 10000 };
+		for (size_t c = 0; c < ARRAY_SIZE(counts); ++c)
+		{
+			// Run each job a few times to check the pool can be reused
+			for (int repeat = 0; repeat < 3; ++repeat)
+			{
+				std::vector<int> out(counts[c], 0);
+				SquareTask task(out);
+				pool.ParallelFor(task, out.size());
+
+				// Every item must have been run exactly once
+				for (size_t i = 0; i < out.size(); ++i)
+					TS_ASSERT_EQUALS(out[i], (int)(i*i));
+			}
+		}
+	}
+
+public:
+	void test_serial()
+	{
+		check(0);
+	}
+
+	void test_parallel()
+	{
+		check(1);
+		check(4);
+	}
+
+	void test_pinned()
+	{
+		std::vector<size_t> processors = CThreadPool::ChooseProcessors(4);
+		TS_ASSERT_EQUALS(processors.size(), (size_t)4);
+		for (size_t i = 0; i < processors.size(); ++i)
+			TS_ASSERT_LESS_THAN(processors[i], os_cpu_NumProcessors());
+		check(4, processors);
+	}
+};
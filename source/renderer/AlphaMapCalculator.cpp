@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -315,4 +315,30 @@ int Calculate(BlendShape8 shape,unsigned int& flags)
 	return 13;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// LookupTable: the results of Calculate for every possible shape
+struct LookupTable {
+	LookupTable() {
+		for (int s=0;s<256;s++) {
+			BlendShape8 shape;
+			for (int i=0;i<8;i++) {
+				shape[i]=(s>>i)&1;
+			}
+			unsigned int flags;
+			m_AlphaMap[s]=(i8)Calculate(shape,flags);
+			m_Flags[s]=(u8)flags;
+		}
+	}
+
+	i8 m_AlphaMap[256];
+	u8 m_Flags[256];
+};
+
+int Calculate(u8 shape,unsigned int& flags)
+{
+	static const LookupTable table;
+	flags=table.m_Flags[shape];
+	return table.m_AlphaMap[shape];
+}
+
 } // end of namespace
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -39,6 +39,10 @@ namespace CAlphaMapCalculator {
 	// Calculate: return the index of the blend map that fits the given shape,
 	// and the set of flip/rotation flags to get the shape correctly oriented
 	int Calculate(BlendShape8 shape,unsigned int& flags);
+
+	// Calculate: same as above, but with the shape given as a bitmask (bit n
+	// set if shape[n] is set), using a precomputed table of all 256 shapes
+	int Calculate(u8 shape,unsigned int& flags);
 }
 
 #endif
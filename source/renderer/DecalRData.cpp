@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -33,31 +33,83 @@
 #include "simulation2/Simulation2.h"
 #include "simulation2/components/ICmpWaterManager.h"
 
-// TODO: Currently each decal is a separate CDecalRData. We might want to use
-// lots of decals for special effects like shadows, footprints, etc, in which
-// case we should probably redesign this to batch them all together for more
-// efficient rendering.
+// Arbitrary total order over the parts of a material that affect how decals
+// using it are drawn
+static bool MaterialLess(const CMaterial& a, const CMaterial& b)
+{
+	if (!(a.GetShaderEffect() == b.GetShaderEffect()))
+		return a.GetShaderEffect() < b.GetShaderEffect();
+	if (a.GetShaderDefines() != b.GetShaderDefines())
+		return a.GetShaderDefines() < b.GetShaderDefines();
+	if (a.GetStaticUniforms() != b.GetStaticUniforms())
+		return a.GetStaticUniforms() < b.GetStaticUniforms();
+
+	const CMaterial::SamplersVector& sa = a.GetSamplers();
+	const CMaterial::SamplersVector& sb = b.GetSamplers();
+	if (sa.size() != sb.size())
+		return sa.size() < sb.size();
+	for (size_t i = 0; i < sa.size(); ++i)
+	{
+		if (!(sa[i].Name == sb[i].Name))
+			return sa[i].Name < sb[i].Name;
+		if (sa[i].Sampler != sb[i].Sampler)
+			return sa[i].Sampler < sb[i].Sampler;
+	}
+	return false;
+}
 
-CDecalRData::CDecalRData(CModelDecal* decal, CSimulation2* simulation)
-	: m_Decal(decal), m_IndexArray(GL_STATIC_DRAW), m_Array(GL_STATIC_DRAW), m_Simulation(simulation)
+static bool ColorLess(const CColor& a, const CColor& b)
 {
-	m_Position.type = GL_FLOAT;
-	m_Position.elems = 3;
-	m_Array.AddAttribute(&m_Position);
+	if (a.r != b.r) return a.r < b.r;
+	if (a.g != b.g) return a.g < b.g;
+	if (a.b != b.b) return a.b < b.b;
+	return a.a < b.a;
+}
 
-	m_DiffuseColor.type = GL_UNSIGNED_BYTE;
-	m_DiffuseColor.elems = 4;
-	m_Array.AddAttribute(&m_DiffuseColor);
+// Orders decals by material, then shading color, then buffers, so that
+// each batch is a contiguous range
+struct CDecalRData::BatchCompare
+{
+	// Returns whether a and b can't be drawn in the same batch
+	static bool DifferentBatch(const CDecalRData* a, const CDecalRData* b)
+	{
+		return MaterialLess(a->m_Decal->m_Decal.m_Material, b->m_Decal->m_Decal.m_Material) ||
+			MaterialLess(b->m_Decal->m_Decal.m_Material, a->m_Decal->m_Decal.m_Material) ||
+			a->m_Decal->GetShadingColor() != b->m_Decal->GetShadingColor();
+	}
 
-	m_UV.type = GL_FLOAT;
-	m_UV.elems = 2;
-	m_Array.AddAttribute(&m_UV);
+	bool operator()(const CDecalRData* a, const CDecalRData* b) const
+	{
+		const CMaterial& ma = a->m_Decal->m_Decal.m_Material;
+		const CMaterial& mb = b->m_Decal->m_Decal.m_Material;
+		if (MaterialLess(ma, mb))
+			return true;
+		if (MaterialLess(mb, ma))
+			return false;
+
+		const CColor ca = a->m_Decal->GetShadingColor();
+		const CColor cb = b->m_Decal->GetShadingColor();
+		if (ca != cb)
+			return ColorLess(ca, cb);
+
+		if (a->m_VBDecals->m_Owner != b->m_VBDecals->m_Owner)
+			return a->m_VBDecals->m_Owner < b->m_VBDecals->m_Owner;
+		if (a->m_VBDecalsIndices->m_Owner != b->m_VBDecalsIndices->m_Owner)
+			return a->m_VBDecalsIndices->m_Owner < b->m_VBDecalsIndices->m_Owner;
+		return a->m_VBDecalsIndices->m_Index < b->m_VBDecalsIndices->m_Index;
+	}
+};
 
+CDecalRData::CDecalRData(CModelDecal* decal, CSimulation2* simulation)
+	: m_Decal(decal), m_VBDecals(0), m_VBDecalsIndices(0), m_Simulation(simulation)
+{
 	BuildArrays();
 }
 
 CDecalRData::~CDecalRData()
 {
+	if (m_VBDecals) g_VBMan.Release(m_VBDecals);
+	if (m_VBDecalsIndices) g_VBMan.Release(m_VBDecalsIndices);
 }
 
 void CDecalRData::Update(CSimulation2* simulation)
@@ -76,15 +128,30 @@ void CDecalRData::RenderDecals(std::vector<CDecalRData*>& decals, const CShaderD
 	CShaderDefines contextDecal = context;
 	contextDecal.Add("DECAL", "1");
 
+	// Sort the decals into batches (keeping the original order between decals
+	// in the same batch, in case they overlap)
+	std::vector<CDecalRData*> sorted;
+	sorted.reserve(decals.size());
 	for (size_t i = 0; i < decals.size(); ++i)
 	{
-		CDecalRData *decal = decals[i];
-		
-		CMaterial &material = decal->m_Decal->m_Decal.m_Material;
+		if (decals[i]->m_VBDecals && decals[i]->m_VBDecalsIndices)
+			sorted.push_back(decals[i]);
+	}
+	std::stable_sort(sorted.begin(), sorted.end(), BatchCompare());
+
+	for (size_t batchStart = 0; batchStart < sorted.size(); )
+	{
+		size_t batchEnd = batchStart + 1;
+		while (batchEnd < sorted.size() && !BatchCompare::DifferentBatch(sorted[batchStart], sorted[batchEnd]))
+			++batchEnd;
+
+		CModelDecal* firstDecal = sorted[batchStart]->m_Decal;
+		CMaterial &material = firstDecal->m_Decal.m_Material;
 		
 		if (material.GetShaderEffect().length() == 0)
 		{
 			LOGERROR(L"Terrain renderer failed to load shader effect.\n");
+			batchStart = batchEnd;
 			continue;
 		}
 		
@@ -100,6 +167,7 @@ void CDecalRData::RenderDecals(std::vector<CDecalRData*>& decals, const CShaderD
 			{
 				LOGERROR(L"Terrain renderer failed to load shader effect (%hs)\n", 			
 						material.GetShaderEffect().string().c_str());
+				batchStart = batchEnd;
 				continue;
 			}
 			
@@ -113,20 +181,20 @@ void CDecalRData::RenderDecals(std::vector<CDecalRData*>& decals, const CShaderD
 				techBase->BeginPass(pass);
 				TerrainRenderer::PrepareShader(techBase->GetShader(), shadow);
 				
-				glEnable(GL_BLEND);
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+				ogl_Enable(GL_BLEND);
+				ogl_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 			}
 			
 			const CShaderProgramPtr& shader = isDummyShader ? dummy : techBase->GetShader(pass);
 				
 			if (material.GetSamplers().size() != 0)
 			{
-				CMaterial::SamplersVector samplers = material.GetSamplers();
+				const CMaterial::SamplersVector& samplers = material.GetSamplers();
 				size_t samplersNum = samplers.size();
 				
 				for (size_t s = 0; s < samplersNum; ++s)
 				{
-					CMaterial::TextureSampler &samp = samplers[s];
+					const CMaterial::TextureSampler &samp = samplers[s];
 					shader->BindTexture(samp.Name.c_str(), samp.Sampler);
 				}
 				
@@ -139,51 +207,67 @@ void CDecalRData::RenderDecals(std::vector<CDecalRData*>& decals, const CShaderD
 				// TerrainRenderer.
 				// Also, need to mark the decals as dirty when water height changes.
 
-				//	glDisable(GL_TEXTURE_2D);
-				//	m_Decal->GetBounds().Render();
-				//	glEnable(GL_TEXTURE_2D);
-
-				u8* base = decal->m_Array.Bind();
-				GLsizei stride = (GLsizei)decal->m_Array.GetStride();
-
-				u8* indexBase = decal->m_IndexArray.Bind();
-
 #if !CONFIG2_GLES
 				if (isDummyShader)
 				{
-					glColor3fv(decal->m_Decal->GetShadingColor().FloatArray());
+					glColor3fv(firstDecal->GetShadingColor().FloatArray());
 				}
 				else
 #endif
 				{
 					
-					shader->Uniform("shadingColor", decal->m_Decal->GetShadingColor());
+					shader->Uniform("shadingColor", firstDecal->GetShadingColor());
 				}
 
-				shader->VertexPointer(3, GL_FLOAT, stride, base + decal->m_Position.offset);
-				shader->ColorPointer(4, GL_UNSIGNED_BYTE, stride, base + decal->m_DiffuseColor.offset);
-				shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, stride, base + decal->m_UV.offset);
-
-				shader->AssertPointersBound();
-
-				if (!g_Renderer.m_SkipSubmit)
+				for (size_t i = batchStart; i < batchEnd; )
 				{
-					glDrawElements(GL_TRIANGLES, (GLsizei)decal->m_IndexArray.GetNumVertices(), GL_UNSIGNED_SHORT, indexBase);
+					CVertexBuffer* vertices = sorted[i]->m_VBDecals->m_Owner;
+					SDecalVertex* base = (SDecalVertex*)vertices->Bind();
+					GLsizei stride = sizeof(SDecalVertex);
+
+					shader->VertexPointer(3, GL_FLOAT, stride, &base->m_Position);
+					shader->ColorPointer(4, GL_UNSIGNED_BYTE, stride, &base->m_DiffuseColor);
+					shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, stride, &base->m_UV[0]);
+
+					shader->AssertPointersBound();
+
+					for (; i < batchEnd && sorted[i]->m_VBDecals->m_Owner == vertices; )
+					{
+						CVertexBuffer* indices = sorted[i]->m_VBDecalsIndices->m_Owner;
+						u8* indexBase = indices->Bind();
+
+						// Join up decals whose indices were allocated consecutively
+						for (; i < batchEnd && sorted[i]->m_VBDecals->m_Owner == vertices && sorted[i]->m_VBDecalsIndices->m_Owner == indices; )
+						{
+							size_t start = sorted[i]->m_VBDecalsIndices->m_Index;
+							size_t count = sorted[i]->m_VBDecalsIndices->m_Count;
+							for (++i; i < batchEnd && sorted[i]->m_VBDecals->m_Owner == vertices && sorted[i]->m_VBDecalsIndices->m_Owner == indices &&
+								sorted[i]->m_VBDecalsIndices->m_Index == start + count; ++i)
+								count += sorted[i]->m_VBDecalsIndices->m_Count;
+
+							if (!g_Renderer.m_SkipSubmit)
+							{
+								glDrawElements(GL_TRIANGLES, (GLsizei)count, GL_UNSIGNED_SHORT, indexBase + sizeof(u16)*start);
+							}
+
+							// bump stats
+							g_Renderer.m_Stats.m_DrawCalls++;
+							g_Renderer.m_Stats.m_TerrainTris += count / 3;
+						}
+					}
 				}
 
-				// bump stats
-				g_Renderer.m_Stats.m_DrawCalls++;
-				g_Renderer.m_Stats.m_TerrainTris += decal->m_IndexArray.GetNumVertices() / 3;
-
 				CVertexBuffer::Unbind();
 			}
 			
 			if (!isDummyShader)
 			{
-				glDisable(GL_BLEND);
+				ogl_Disable(GL_BLEND);
 				techBase->EndPass();
 			}
 		}
+
+		batchStart = batchEnd;
 	}
 }
 
@@ -204,11 +288,8 @@ void CDecalRData::BuildArrays()
 
 	CmpPtr<ICmpWaterManager> cmpWaterManager(*m_Simulation, SYSTEM_ENTITY);
 
-	m_Array.SetNumVertices((i1-i0+1)*(j1-j0+1));
-	m_Array.Layout();
-	VertexArrayIterator<CVector3D> Position = m_Position.GetIterator<CVector3D>();
-	VertexArrayIterator<SColor4ub> DiffuseColor = m_DiffuseColor.GetIterator<SColor4ub>();
-	VertexArrayIterator<float[2]> UV = m_UV.GetIterator<float[2]>();
+	std::vector<SDecalVertex> vertices((i1-i0+1)*(j1-j0+1));
+	std::vector<SDecalVertex>::iterator vertex = vertices.begin();
 
 	const CLightEnv& lightEnv = g_Renderer.GetLightEnv();
 	bool cpuLighting = (g_Renderer.GetRenderPath() == CRenderer::RP_FIXED);
@@ -223,32 +304,60 @@ void CDecalRData::BuildArrays()
 			if (decal.m_Floating && cmpWaterManager)
 				pos.Y = std::max(pos.Y, cmpWaterManager->GetExactWaterLevel(pos.X, pos.Z));
 
-			*Position = pos;
-			++Position;
+			vertex->m_Position = pos;
 
 			CVector3D normal;
 			m_Decal->m_Terrain->CalcNormal(i, j, normal);
-			*DiffuseColor = cpuLighting ? lightEnv.EvaluateTerrainDiffuseScaled(normal) : lightEnv.EvaluateTerrainDiffuseFactor(normal);
-			++DiffuseColor;
+			vertex->m_DiffuseColor = cpuLighting ? lightEnv.EvaluateTerrainDiffuseScaled(normal) : lightEnv.EvaluateTerrainDiffuseFactor(normal);
 
 			// Map from world space back into decal texture space
 			CVector3D inv = m_Decal->GetInvTransform().Transform(pos);
-			(*UV)[0] = 0.5f + (inv.X - decal.m_OffsetX) / decal.m_SizeX;
-			(*UV)[1] = 0.5f - (inv.Z - decal.m_OffsetZ) / decal.m_SizeZ; // flip V to match our texture convention
-			++UV;
+			vertex->m_UV[0] = 0.5f + (inv.X - decal.m_OffsetX) / decal.m_SizeX;
+			vertex->m_UV[1] = 0.5f - (inv.Z - decal.m_OffsetZ) / decal.m_SizeZ; // flip V to match our texture convention
+			++vertex;
 		}
 	}
 
-	m_Array.Upload();
-	m_Array.FreeBackingStore();
+	// Reuse the existing chunks if the decal still covers the same number of
+	// tiles (e.g. when only the terrain underneath it has changed)
+	if (m_VBDecals && m_VBDecals->m_Count != vertices.size())
+	{
+		g_VBMan.Release(m_VBDecals);
+		m_VBDecals = 0;
+	}
+	if (m_VBDecalsIndices && m_VBDecalsIndices->m_Count != (size_t)((i1-i0)*(j1-j0)*6))
+	{
+		g_VBMan.Release(m_VBDecalsIndices);
+		m_VBDecalsIndices = 0;
+	}
+
+	// Decals that don't cover any tiles (e.g. off the edge of the map) aren't drawn
+	if (i1 <= i0 || j1 <= j0)
+	{
+		if (m_VBDecals)
+		{
+			g_VBMan.Release(m_VBDecals);
+			m_VBDecals = 0;
+		}
+		return;
+	}
+
+	if (!m_VBDecals)
+		m_VBDecals = g_VBMan.Allocate(sizeof(SDecalVertex), vertices.size(), GL_STATIC_DRAW, GL_ARRAY_BUFFER);
+	if (!m_VBDecals)
+	{
+		LOGERROR(L"Failed to allocate vertex buffer for decal");
+		return;
+	}
+	m_VBDecals->m_Owner->UpdateChunkVertices(m_VBDecals, &vertices[0]);
 
 	// Construct index arrays for each terrain tile
 
-	m_IndexArray.SetNumVertices((i1-i0)*(j1-j0)*6);
-	m_IndexArray.Layout();
-	VertexArrayIterator<u16> Index = m_IndexArray.GetIterator();
+	std::vector<u16> indices((i1-i0)*(j1-j0)*6);
+	std::vector<u16>::iterator Index = indices.begin();
 
-	u16 base = 0;
+	size_t base = m_VBDecals->m_Index;
+	ENSURE(base + vertices.size() <= 65536); // mustn't overflow u16 indexes
 	ssize_t w = i1-i0+1;
 	for (ssize_t dj = 0; dj < j1-j0; ++dj)
 	{
@@ -278,6 +387,12 @@ void CDecalRData::BuildArrays()
 		}
 	}
 
-	m_IndexArray.Upload();
-	m_IndexArray.FreeBackingStore();
+	if (!m_VBDecalsIndices)
+		m_VBDecalsIndices = g_VBMan.Allocate(sizeof(u16), indices.size(), GL_STATIC_DRAW, GL_ELEMENT_ARRAY_BUFFER);
+	if (!m_VBDecalsIndices)
+	{
+		LOGERROR(L"Failed to allocate index buffer for decal");
+		return;
+	}
+	m_VBDecalsIndices->m_Owner->UpdateChunkVertices(m_VBDecalsIndices, &indices[0]);
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,9 +20,11 @@
 
 #include "graphics/Camera.h"
 #include "graphics/RenderableObject.h"
+#include "graphics/SColor.h"
 #include "graphics/ShaderProgram.h"
+#include "maths/Vector3D.h"
 #include "renderer/ShadowMap.h"
-#include "renderer/VertexArray.h"
+#include "renderer/VertexBufferManager.h"
 
 class CModelDecal;
 class CSimulation2;
@@ -35,20 +37,32 @@ public:
 
 	void Update(CSimulation2* simulation);
 
+	/**
+	 * Render the given decals. Decals with the same material and shading color
+	 * are drawn together, with one draw call per vertex/index buffer pair where possible.
+	 */
 	static void RenderDecals(std::vector<CDecalRData*>& decals, const CShaderDefines& context, 
 			       ShadowMap* shadow, bool isDummyShader=false, const CShaderProgramPtr& dummy=CShaderProgramPtr());
 
 	CModelDecal* GetDecal() { return m_Decal; }
 
 private:
-	void BuildArrays();
+	struct SDecalVertex
+	{
+		CVector3D m_Position;
+		SColor4ub m_DiffuseColor;
+		float m_UV[2];
+	};
+	cassert(sizeof(SDecalVertex) == 24);
+
+	struct BatchCompare;
 
-	VertexIndexArray m_IndexArray;
+	void BuildArrays();
 
-	VertexArray m_Array;
-	VertexArray::Attribute m_Position;
-	VertexArray::Attribute m_DiffuseColor;
-	VertexArray::Attribute m_UV;
+	// Chunks of the shared vertex buffers (so that decals can be drawn as batches);
+	// the indices are relative to the start of the vertex buffer, not of the chunk
+	CVertexBuffer::VBChunk* m_VBDecals;
+	CVertexBuffer::VBChunk* m_VBDecalsIndices;
 
 	CModelDecal* m_Decal;
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -17,7 +17,6 @@
 
 #include "precompiled.h"
 
-#include "lib/bits.h"
 #include "lib/ogl.h"
 #include "lib/sysdep/rtl.h"
 #include "maths/Vector3D.h"
@@ -67,7 +66,7 @@ ShaderModelDef::ShaderModelDef(const CModelDefPtr& mdef)
 	m_Array.Upload();
 	m_Array.FreeBackingStore();
 
-	m_IndexArray.SetNumVertices(mdef->GetNumFaces()*3);
+	m_IndexArray.SetNumVertices(ModelRenderer::GetNumIndices(mdef));
 	m_IndexArray.Layout();
 	ModelRenderer::BuildIndices(mdef, m_IndexArray.GetIterator());
 	m_IndexArray.Upload();
@@ -85,7 +84,7 @@ struct ShaderModel : public CModelRData
 	VertexArray::Attribute m_Normal; // valid iff cpuLighting == false
 	VertexArray::Attribute m_Color; // valid iff cpuLighting == true
 
-	ShaderModel(const void* key) : CModelRData(key), m_Array(GL_DYNAMIC_DRAW) { }
+	ShaderModel(const void* key) : CModelRData(key), m_Array(GL_STREAM_DRAW) { }
 };
 
 
@@ -93,15 +92,6 @@ struct ShaderModelRendererInternals
 {
 	bool cpuLighting;
 
-	/**
-	 * Scratch space for normal vector calculation.
-	 * Only used if cpuLighting == true.
-	 * Space is reserved so we don't have to do frequent reallocations.
-	 * Allocated with rtl_AllocateAligned(normalsNumVertices*16, 16) for SSE writes.
-	 */
-	char* normals;
-	size_t normalsNumVertices;
-
 	/// Previously prepared modeldef
 	ShaderModelDef* shadermodeldef;
 };
@@ -112,15 +102,11 @@ ShaderModelVertexRenderer::ShaderModelVertexRenderer(bool cpuLighting)
 {
 	m = new ShaderModelRendererInternals;
 	m->cpuLighting = cpuLighting;
-	m->normals = NULL;
-	m->normalsNumVertices = 0;
 	m->shadermodeldef = NULL;
 }
 
 ShaderModelVertexRenderer::~ShaderModelVertexRenderer()
 {
-	rtl_FreeAligned(m->normals);
-
 	delete m;
 }
 
@@ -181,7 +167,7 @@ CModelRData* ShaderModelVertexRenderer::CreateModelData(const void* key, CModel*
 }
 
 
-// Fill in and upload dynamic vertex array
+// Fill in dynamic vertex array
 void ShaderModelVertexRenderer::UpdateModelData(CModel* model, CModelRData* data, int updateflags)
 {
 	ShaderModel* shadermodel = static_cast<ShaderModel*>(data);
@@ -193,9 +179,6 @@ void ShaderModelVertexRenderer::UpdateModelData(CModel* model, CModelRData* data
 		VertexArrayIterator<CVector3D> Normal = shadermodel->m_Normal.GetIterator<CVector3D>();
 
 		ModelRenderer::BuildPositionAndNormals(model, Position, Normal);
-
-		// upload everything to vertex buffer
-		shadermodel->m_Array.Upload();
 	}
 
 	if (m->cpuLighting && (updateflags & (RENDERDATA_UPDATE_VERTICES|RENDERDATA_UPDATE_COLOR)))
@@ -203,18 +186,12 @@ void ShaderModelVertexRenderer::UpdateModelData(CModel* model, CModelRData* data
 		CModelDefPtr mdef = model->GetModelDef();
 		size_t numVertices = mdef->GetNumVertices();
 
-		// allocate working space for computing normals
-		if (numVertices > m->normalsNumVertices)
-		{
-			rtl_FreeAligned(m->normals);
-
-			size_t newSize = round_up_to_pow2(numVertices);
-			m->normals = (char*)rtl_AllocateAligned(newSize*16, 16);
-			m->normalsNumVertices = newSize;
-		}
+		// allocate working space for computing normals (this is per call, not
+		// shared, since models may be updated concurrently; aligned for SSE writes)
+		char* normals = (char*)rtl_AllocateAligned(std::max(numVertices, (size_t)1)*16, 16);
 
 		VertexArrayIterator<CVector3D> Position = shadermodel->m_Position.GetIterator<CVector3D>();
-		VertexArrayIterator<CVector3D> Normal = VertexArrayIterator<CVector3D>(m->normals, 16);
+		VertexArrayIterator<CVector3D> Normal = VertexArrayIterator<CVector3D>(normals, 16);
 
 		ModelRenderer::BuildPositionAndNormals(model, Position, Normal);
 
@@ -222,11 +199,20 @@ void ShaderModelVertexRenderer::UpdateModelData(CModel* model, CModelRData* data
 
 		ModelRenderer::BuildColor4ub(model, Normal, Color);
 
-		// upload everything to vertex buffer
-		shadermodel->m_Array.Upload();
+		rtl_FreeAligned(normals);
 	}
 }
 
+// Upload dynamic vertex array
+void ShaderModelVertexRenderer::UploadModelData(CModel* UNUSED(model), CModelRData* data, int updateflags)
+{
+	ShaderModel* shadermodel = static_cast<ShaderModel*>(data);
+
+	int uploadflags = m->cpuLighting ? (RENDERDATA_UPDATE_VERTICES|RENDERDATA_UPDATE_COLOR) : RENDERDATA_UPDATE_VERTICES;
+	if (updateflags & uploadflags)
+		shadermodel->m_Array.Upload();
+}
+
 
 // Setup one rendering pass
 void ShaderModelVertexRenderer::BeginPass(int streamflags)
@@ -283,8 +269,10 @@ void ShaderModelVertexRenderer::RenderModel(const CShaderProgramPtr& shader, int
 
 	shader->AssertPointersBound();
 
-	// render the lot
-	size_t numFaces = mdldef->GetNumFaces();
+	// render the lot, at the appropriate level of detail
+	size_t firstFace, numFaces;
+	mdldef->GetLODFaceRange(ModelRenderer::ChooseLOD(model), firstFace, numFaces);
+	indexBase += firstFace*3*sizeof(u16);
 
 	if (!g_Renderer.m_SkipSubmit)
 	{
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -41,6 +41,7 @@ public:
 	// Implementations
 	CModelRData* CreateModelData(const void* key, CModel* model);
 	void UpdateModelData(CModel* model, CModelRData* data, int updateflags);
+	void UploadModelData(CModel* model, CModelRData* data, int updateflags);
 
 	void BeginPass(int streamflags);
 	void EndPass(int streamflags);
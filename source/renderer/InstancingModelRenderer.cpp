@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -22,10 +22,15 @@
 #include "precompiled.h"
 
 #include "lib/ogl.h"
+#include "lib/file/io/write_buffer.h"
+#include "maths/MD5.h"
 #include "maths/Vector3D.h"
 #include "maths/Vector4D.h"
 
 #include "ps/CLogger.h"
+#include "ps/Filesystem.h"
+#include "ps/Game.h"
+#include "ps/Profile.h"
 
 #include "graphics/Color.h"
 #include "graphics/LightEnv.h"
@@ -39,6 +44,133 @@
 
 #include "third_party/mikktspace/weldmesh.h"
 
+#include <iomanip>
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+// Tangent cache
+
+// Generating and welding the tangents is slow for big meshes (and happens for
+// every mesh when they're loaded), so the results are saved as loose cache
+// files, keyed by a hash of all the mesh data they depend on.
+// (We don't use CCacheLoader's source file timestamps, since the .pmd is
+// often a loose cache file itself.)
+
+static const u32 TANGENT_CACHE_VERSION = 1;
+static const char TANGENT_CACHE_MAGIC[4] = { 'P', 'S', 'T', 'G' };
+
+static VfsPath TangentCachePath(const CModelDefPtr& mdef, bool gpuSkinning)
+{
+	MD5 hash;
+	hash.Update((const u8*)&TANGENT_CACHE_VERSION, sizeof(TANGENT_CACHE_VERSION));
+	u8 skinning = gpuSkinning ? 1 : 0;
+	hash.Update(&skinning, sizeof(skinning));
+	u32 numUVs = (u32)mdef->GetNumUVsPerVertex();
+	hash.Update((const u8*)&numUVs, sizeof(numUVs));
+
+	const SModelVertex* vertices = mdef->GetVertices();
+	for (size_t i = 0; i < mdef->GetNumVertices(); ++i)
+	{
+		hash.Update((const u8*)&vertices[i].m_Coords.X, 3*sizeof(float));
+		hash.Update((const u8*)&vertices[i].m_Norm.X, 3*sizeof(float));
+		if (numUVs)
+			hash.Update((const u8*)&vertices[i].m_UVs[0], 2*numUVs*sizeof(float));
+		if (gpuSkinning)
+		{
+			hash.Update(vertices[i].m_Blend.m_Bone, sizeof(vertices[i].m_Blend.m_Bone));
+			hash.Update((const u8*)vertices[i].m_Blend.m_Weight, sizeof(vertices[i].m_Blend.m_Weight));
+		}
+	}
+	hash.Update((const u8*)mdef->GetFaces(), mdef->GetNumFaces()*sizeof(SModelFace));
+
+	u8 digest[MD5::DIGESTSIZE];
+	hash.Final(digest);
+	std::wstringstream digestPrefix;
+	digestPrefix << std::hex;
+	for (size_t i = 0; i < 8; ++i)
+		digestPrefix << std::setfill(L'0') << std::setw(2) << (int)digest[i];
+
+	return VfsPath("cache") / (mdef->GetName().string() + L"." + digestPrefix.str() + L".tangents");
+}
+
+/**
+ * Loads the welded vertex data and remapping table that a previous
+ * SaveCachedTangents stored at @p path. Returns false (with nothing loaded)
+ * if there's no valid cache file.
+ */
+static bool LoadCachedTangents(const VfsPath& path, const CModelDefPtr& mdef, size_t numVertexAttrs,
+	std::vector<int>& remapTable, std::vector<float>& vertexData)
+{
+	if (g_VFS->GetFileInfo(path, NULL) < 0)
+		return false;
+
+	shared_ptr<u8> file;
+	size_t size;
+	if (g_VFS->LoadFile(path, file, size) < 0)
+		return false;
+
+	u32 header[4]; // version, numVertexAttrs, numVertices, remapTable.size()
+	if (size < sizeof(TANGENT_CACHE_MAGIC) + sizeof(header) ||
+		memcmp(file.get(), TANGENT_CACHE_MAGIC, sizeof(TANGENT_CACHE_MAGIC)) != 0)
+		return false;
+	memcpy(header, file.get() + sizeof(TANGENT_CACHE_MAGIC), sizeof(header));
+
+	const size_t numVertices = header[2];
+	const size_t numRemap = header[3];
+	if (header[0] != TANGENT_CACHE_VERSION || header[1] != numVertexAttrs ||
+		numRemap != mdef->GetNumFaces() * 3 ||
+		size != sizeof(TANGENT_CACHE_MAGIC) + sizeof(header) + (numVertices * numVertexAttrs + numRemap) * 4)
+		return false;
+
+	const u8* data = file.get() + sizeof(TANGENT_CACHE_MAGIC) + sizeof(header);
+	vertexData.resize(numVertices * numVertexAttrs);
+	if (!vertexData.empty())
+		memcpy(&vertexData[0], data, vertexData.size() * sizeof(float));
+	data += vertexData.size() * sizeof(float);
+
+	remapTable.resize(numRemap);
+	for (size_t i = 0; i < numRemap; ++i)
+	{
+		u32 index;
+		memcpy(&index, data + i * sizeof(u32), sizeof(u32));
+		if (index >= numVertices)
+		{
+			remapTable.clear();
+			vertexData.clear();
+			return false;
+		}
+		remapTable[i] = (int)index;
+	}
+
+	return true;
+}
+
+static void SaveCachedTangents(const VfsPath& path, size_t numVertexAttrs,
+	const std::vector<int>& remapTable, const std::vector<float>& vertexData)
+{
+	u32 header[4] = {
+		TANGENT_CACHE_VERSION,
+		(u32)numVertexAttrs,
+		(u32)(vertexData.size() / numVertexAttrs),
+		(u32)remapTable.size()
+	};
+
+	WriteBuffer buffer;
+	buffer.Append(TANGENT_CACHE_MAGIC, sizeof(TANGENT_CACHE_MAGIC));
+	buffer.Append(header, sizeof(header));
+	if (!vertexData.empty())
+		buffer.Append(&vertexData[0], vertexData.size() * sizeof(float));
+	for (size_t i = 0; i < remapTable.size(); ++i)
+	{
+		u32 index = (u32)remapTable[i];
+		buffer.Append(&index, sizeof(index));
+	}
+
+	// The cache is only an optimisation, so failing to write it isn't an error
+	if (g_VFS->CreateFile(path, buffer.Data(), buffer.Size()) < 0)
+		LOGWARNING(L"Failed to save tangent cache file '%ls'", path.string().c_str());
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////////////////////
 // InstancingModelRenderer implementation
@@ -112,23 +244,37 @@ IModelDef::IModelDef(const CModelDefPtr& mdef, bool gpuSkinning, bool calculateT
 			numVertexAttrs += 8;
 		}
 		
-		// the tangent generation can increase the number of vertices temporarily
-		// so reserve a bit more memory to avoid reallocations in GenTangents (in most cases)
-		std::vector<float> newVertices;
-		newVertices.reserve(numVertexAttrs * numVertices * 2);
-		
-		// Generate the tangents
-		ModelRenderer::GenTangents(mdef, newVertices, gpuSkinning);
-		
-		// how many vertices do we have after generating tangents?
-		int newNumVert = newVertices.size() / numVertexAttrs;
-		
-		std::vector<int> remapTable(newNumVert);
-		std::vector<float> vertexDataOut(newNumVert * numVertexAttrs);
+		std::vector<int> remapTable;
+		std::vector<float> vertexDataOut;
+
+		const VfsPath cachePath = TangentCachePath(mdef, gpuSkinning);
+		if (!LoadCachedTangents(cachePath, mdef, numVertexAttrs, remapTable, vertexDataOut))
+		{
+			PROFILE("generate tangents");
+
+			// the tangent generation can increase the number of vertices temporarily
+			// so reserve a bit more memory to avoid reallocations in GenTangents (in most cases)
+			std::vector<float> newVertices;
+			newVertices.reserve(numVertexAttrs * numVertices * 2);
+
+			// Generate the tangents
+			ModelRenderer::GenTangents(mdef, newVertices, gpuSkinning);
+
+			// how many vertices do we have after generating tangents?
+			int newNumVert = newVertices.size() / numVertexAttrs;
+
+			remapTable.resize(newNumVert);
+			vertexDataOut.resize(newNumVert * numVertexAttrs);
 
-		// re-weld the mesh to remove duplicated vertices
-		int numVertices2 = WeldMesh(&remapTable[0], &vertexDataOut[0],
-					&newVertices[0], newNumVert, numVertexAttrs);
+			// re-weld the mesh to remove duplicated vertices
+			int numWelded = WeldMesh(&remapTable[0], &vertexDataOut[0],
+						&newVertices[0], newNumVert, numVertexAttrs);
+			vertexDataOut.resize(numWelded * numVertexAttrs);
+
+			SaveCachedTangents(cachePath, numVertexAttrs, remapTable, vertexDataOut);
+		}
+
+		int numVertices2 = vertexDataOut.size() / numVertexAttrs;
 
 		// Copy the model data to graphics memory:-
 		
@@ -184,7 +330,7 @@ IModelDef::IModelDef(const CModelDefPtr& mdef, bool gpuSkinning, bool calculateT
 		m_Array.Upload();
 		m_Array.FreeBackingStore();
 
-		m_IndexArray.SetNumVertices(mdef->GetNumFaces() * 3);
+		m_IndexArray.SetNumVertices(ModelRenderer::GetNumIndices(mdef));
 		m_IndexArray.Layout();
 		
 		VertexArrayIterator<u16> Indices = m_IndexArray.GetIterator();
@@ -198,6 +344,24 @@ IModelDef::IModelDef(const CModelDefPtr& mdef, bool gpuSkinning, bool calculateT
 			Indices[idxidx++] = remapTable[j * 3 + 1];
 			Indices[idxidx++] = remapTable[j * 3 + 2];
 		}
+
+		// The simplified levels of detail refer to the original vertices, so
+		// map each of those to one of the new vertices that was generated from it
+		const std::vector<SModelFace>& lodFaces = mdef->GetLODFaces();
+		if (!lodFaces.empty())
+		{
+			std::vector<int> vertexRemap(numVertices);
+			for (size_t j = 0; j < mdef->GetNumFaces(); ++j)
+				for (size_t k = 0; k < 3; ++k)
+					vertexRemap[mdef->GetFaces()[j].m_Verts[k]] = remapTable[j * 3 + k];
+
+			for (size_t j = 0; j < lodFaces.size(); ++j)
+			{
+				Indices[idxidx++] = vertexRemap[lodFaces[j].m_Verts[0]];
+				Indices[idxidx++] = vertexRemap[lodFaces[j].m_Verts[1]];
+				Indices[idxidx++] = vertexRemap[lodFaces[j].m_Verts[2]];
+			}
+		}
 		
 		m_IndexArray.Upload();
 		m_IndexArray.FreeBackingStore();
@@ -238,7 +402,7 @@ IModelDef::IModelDef(const CModelDefPtr& mdef, bool gpuSkinning, bool calculateT
 		m_Array.Upload();
 		m_Array.FreeBackingStore();
 
-		m_IndexArray.SetNumVertices(mdef->GetNumFaces()*3);
+		m_IndexArray.SetNumVertices(ModelRenderer::GetNumIndices(mdef));
 		m_IndexArray.Layout();
 		ModelRenderer::BuildIndices(mdef, m_IndexArray.GetIterator());
 		m_IndexArray.Upload();
@@ -247,8 +411,25 @@ IModelDef::IModelDef(const CModelDefPtr& mdef, bool gpuSkinning, bool calculateT
 }
 
 
+// Maximum number of models drawn by each instanced draw call
+static const size_t MAX_INSTANCES_PER_DRAW = 256;
+
+// Names of the per-instance shader attributes
+static const char* const INSTANCE_TRANSFORM_ATTRIBS[3] = {
+	"a_instanceTransform0", "a_instanceTransform1", "a_instanceTransform2"
+};
+static const char* const INSTANCE_SHADING_COLOR_ATTRIB = "a_instanceShadingColor";
+static const char* const INSTANCE_PLAYER_COLOR_ATTRIB = "a_instancePlayerColor";
+static const char* const INSTANCE_BONE_ROW_ATTRIB = "a_instanceBoneRow";
+
+// Names of the bone matrix texture and its associated uniform
+static const char* const BONE_TEXTURE = "skinBoneTex";
+static const char* const BONE_TEXTURE_INV_WIDTH = "skinBoneTexInvWidth";
+
 struct InstancingModelRendererInternals
 {
+	InstancingModelRendererInternals() : instanceArray(GL_STREAM_DRAW), boneTexture(0), boneTextureWidth(0) { }
+
 	bool gpuSkinning;
 	
 	bool calculateTangents;
@@ -258,8 +439,87 @@ struct InstancingModelRendererInternals
 
 	/// Index base for imodeldef
 	u8* imodeldefIndexBase;
+
+	/// Per-instance data for instanced draws (laid out on first use)
+	VertexArray instanceArray;
+	VertexArray::Attribute instanceTransform[3];
+	VertexArray::Attribute instanceShadingColor;
+	VertexArray::Attribute instancePlayerColor;
+	VertexArray::Attribute instanceBoneRow; // only used with gpuSkinning
+
+	/// Bone matrices for instanced draws with gpuSkinning: one row of texels
+	/// per instance, three texels per bone (created on first use, and widened
+	/// for models with more bones)
+	GLuint boneTexture;
+	GLsizei boneTextureWidth;
+	std::vector<float> boneData;
+
+	// Uploads the bone matrices of the given models into boneTexture.
+	// Returns false if they don't fit.
+	bool UploadBoneMatrices(CModel** models, size_t count);
 };
 
+bool InstancingModelRendererInternals::UploadBoneMatrices(CModel** models, size_t count)
+{
+#if CONFIG2_GLES
+	UNUSED2(models);
+	UNUSED2(count);
+	return false;
+#else
+	// (Plus one for the root bone)
+	const GLsizei width = (GLsizei)(3 * (models[0]->GetModelDef()->GetNumBones() + 1));
+	if (width > ogl_max_tex_size)
+	{
+		LOGERROR(L"Model '%ls' has too many bones for GPU skinning", models[0]->GetModelDef()->GetName().string().c_str());
+		return false;
+	}
+
+	// Don't disturb the texture bound for the shader on the current unit
+	GLint prevTexture = 0;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &prevTexture);
+
+	if (width > boneTextureWidth)
+	{
+		if (!boneTexture)
+			glGenTextures(1, &boneTexture);
+		glBindTexture(GL_TEXTURE_2D, boneTexture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F_ARB, width, (GLsizei)MAX_INSTANCES_PER_DRAW, 0, GL_RGBA, GL_FLOAT, NULL);
+		boneTextureWidth = width;
+	}
+	else
+	{
+		glBindTexture(GL_TEXTURE_2D, boneTexture);
+	}
+
+	// The rows are packed tightly, so only the used part of the texture is updated
+	boneData.resize(count * width * 4);
+	float* out = &boneData[0];
+	for (size_t i = 0; i < count; ++i)
+	{
+		const CMatrix3D* bones = models[i]->GetAnimatedBoneMatrices();
+		for (GLsizei b = 0; b < width / 3; ++b)
+		{
+			const CMatrix3D& mat = bones[b];
+			const float rows[12] = {
+				mat._11, mat._12, mat._13, mat._14,
+				mat._21, mat._22, mat._23, mat._24,
+				mat._31, mat._32, mat._33, mat._34
+			};
+			memcpy(out, rows, sizeof(rows));
+			out += 12;
+		}
+	}
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, (GLsizei)count, GL_RGBA, GL_FLOAT, &boneData[0]);
+
+	glBindTexture(GL_TEXTURE_2D, (GLuint)prevTexture);
+	return true;
+#endif
+}
+
 
 // Construction and Destruction
 InstancingModelRenderer::InstancingModelRenderer(bool gpuSkinning, bool calculateTangents)
@@ -272,6 +532,8 @@ InstancingModelRenderer::InstancingModelRenderer(bool gpuSkinning, bool calculat
 
 InstancingModelRenderer::~InstancingModelRenderer()
 {
+	if (m->boneTexture)
+		glDeleteTextures(1, &m->boneTexture);
 	delete m;
 }
 
@@ -302,6 +564,11 @@ void InstancingModelRenderer::UpdateModelData(CModel* UNUSED(model), CModelRData
 	// We have no per-CModel data
 }
 
+void InstancingModelRenderer::UploadModelData(CModel* UNUSED(model), CModelRData* UNUSED(data), int UNUSED(updateflags))
+{
+	// We have no per-CModel data
+}
+
 
 // Setup one rendering pass.
 void InstancingModelRenderer::BeginPass(int streamflags)
@@ -370,17 +637,19 @@ void InstancingModelRenderer::RenderModel(const CShaderProgramPtr& shader, int U
 		shader->Uniform("skinBlendMatrices", mdldef->GetNumBones() + 1, model->GetAnimatedBoneMatrices());
 	}
 
-	// render the lot
-	size_t numFaces = mdldef->GetNumFaces();
+	// render the lot, at the appropriate level of detail
+	size_t firstFace, numFaces;
+	mdldef->GetLODFaceRange(ModelRenderer::ChooseLOD(model), firstFace, numFaces);
+	u8* indexBase = m->imodeldefIndexBase + firstFace*3*sizeof(u16);
 
 	if (!g_Renderer.m_SkipSubmit)
 	{
 		// Draw with DrawRangeElements where available, since it might be more efficient
 #if CONFIG2_GLES
-		glDrawElements(GL_TRIANGLES, (GLsizei)numFaces*3, GL_UNSIGNED_SHORT, m->imodeldefIndexBase);
+		glDrawElements(GL_TRIANGLES, (GLsizei)numFaces*3, GL_UNSIGNED_SHORT, indexBase);
 #else
 		pglDrawRangeElementsEXT(GL_TRIANGLES, 0, (GLuint)mdldef->GetNumVertices()-1,
-				(GLsizei)numFaces*3, GL_UNSIGNED_SHORT, m->imodeldefIndexBase);
+				(GLsizei)numFaces*3, GL_UNSIGNED_SHORT, indexBase);
 #endif
 	}
 
@@ -389,3 +658,135 @@ void InstancingModelRenderer::RenderModel(const CShaderProgramPtr& shader, int U
 	g_Renderer.m_Stats.m_ModelTris += numFaces;
 
 }
+
+
+bool InstancingModelRenderer::SupportsInstancing(const CShaderProgramPtr& shader)
+{
+	if (!g_Renderer.GetCapabilities().m_Instancing || !shader->HasVertexAttrib(INSTANCE_TRANSFORM_ATTRIBS[0]))
+		return false;
+
+	// Skinned models each need their own bone matrices, so they can only be
+	// instanced by shaders that read them from the bone texture
+	if (m->gpuSkinning)
+		return g_Renderer.GetCapabilities().m_BoneTextures && shader->HasVertexAttrib(INSTANCE_BONE_ROW_ATTRIB);
+
+	return true;
+}
+
+
+// Render a group of models with the same modeldef and material
+void InstancingModelRenderer::RenderModelsInstanced(const CShaderProgramPtr& shader, int UNUSED(streamflags), CModel** models, size_t numModels)
+{
+#if CONFIG2_GLES
+	UNUSED2(shader);
+	UNUSED2(models);
+	UNUSED2(numModels);
+	debug_warn(L"Instanced drawing not supported on GLES");
+#else
+	if (!m->instanceArray.GetNumVertices())
+	{
+		for (size_t r = 0; r < 3; ++r)
+		{
+			m->instanceTransform[r].type = GL_FLOAT;
+			m->instanceTransform[r].elems = 4;
+			m->instanceArray.AddAttribute(&m->instanceTransform[r]);
+		}
+
+		m->instanceShadingColor.type = GL_FLOAT;
+		m->instanceShadingColor.elems = 4;
+		m->instanceArray.AddAttribute(&m->instanceShadingColor);
+
+		m->instancePlayerColor.type = GL_FLOAT;
+		m->instancePlayerColor.elems = 4;
+		m->instanceArray.AddAttribute(&m->instancePlayerColor);
+
+		if (m->gpuSkinning)
+		{
+			m->instanceBoneRow.type = GL_FLOAT;
+			m->instanceBoneRow.elems = 1;
+			m->instanceArray.AddAttribute(&m->instanceBoneRow);
+		}
+
+		m->instanceArray.SetNumVertices(MAX_INSTANCES_PER_DRAW);
+		m->instanceArray.Layout();
+	}
+
+	// (The models are all drawn at the same level of detail)
+	CModelDefPtr mdldef = models[0]->GetModelDef();
+	size_t firstFace, numFaces;
+	mdldef->GetLODFaceRange(ModelRenderer::ChooseLOD(models[0]), firstFace, numFaces);
+	u8* indexBase = m->imodeldefIndexBase + firstFace*3*sizeof(u16);
+
+	for (size_t start = 0; start < numModels; start += MAX_INSTANCES_PER_DRAW)
+	{
+		size_t count = std::min(numModels - start, MAX_INSTANCES_PER_DRAW);
+
+		if (m->gpuSkinning && !m->UploadBoneMatrices(models + start, count))
+			break;
+
+		VertexArrayIterator<CVector4D> transform[3];
+		for (size_t r = 0; r < 3; ++r)
+			transform[r] = m->instanceTransform[r].GetIterator<CVector4D>();
+		VertexArrayIterator<CVector4D> shadingColor = m->instanceShadingColor.GetIterator<CVector4D>();
+		VertexArrayIterator<CVector4D> playerColor = m->instancePlayerColor.GetIterator<CVector4D>();
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			CModel* model = models[start + i];
+
+			const CMatrix3D& mat = model->GetTransform();
+			transform[0][i] = CVector4D(mat._11, mat._12, mat._13, mat._14);
+			transform[1][i] = CVector4D(mat._21, mat._22, mat._23, mat._24);
+			transform[2][i] = CVector4D(mat._31, mat._32, mat._33, mat._34);
+
+			CColor shading = model->GetShadingColor();
+			shadingColor[i] = CVector4D(shading.r, shading.g, shading.b, shading.a);
+
+			CColor player = g_Game->GetPlayerColour(model->GetPlayerID());
+			playerColor[i] = CVector4D(player.r, player.g, player.b, player.a);
+
+			// (The texture coordinate of the model's row of bone matrices)
+			if (m->gpuSkinning)
+				m->instanceBoneRow.GetIterator<float>()[i] = (i + 0.5f) / MAX_INSTANCES_PER_DRAW;
+		}
+
+		m->instanceArray.Upload();
+		u8* base = m->instanceArray.Bind();
+		GLsizei stride = (GLsizei)m->instanceArray.GetStride();
+
+		for (size_t r = 0; r < 3; ++r)
+		{
+			shader->VertexAttribPointer(INSTANCE_TRANSFORM_ATTRIBS[r], 4, GL_FLOAT, GL_FALSE, stride, base + m->instanceTransform[r].offset);
+			shader->VertexAttribDivisor(INSTANCE_TRANSFORM_ATTRIBS[r], 1);
+		}
+		shader->VertexAttribPointer(INSTANCE_SHADING_COLOR_ATTRIB, 4, GL_FLOAT, GL_FALSE, stride, base + m->instanceShadingColor.offset);
+		shader->VertexAttribDivisor(INSTANCE_SHADING_COLOR_ATTRIB, 1);
+		shader->VertexAttribPointer(INSTANCE_PLAYER_COLOR_ATTRIB, 4, GL_FLOAT, GL_FALSE, stride, base + m->instancePlayerColor.offset);
+		shader->VertexAttribDivisor(INSTANCE_PLAYER_COLOR_ATTRIB, 1);
+
+		if (m->gpuSkinning)
+		{
+			shader->VertexAttribPointer(INSTANCE_BONE_ROW_ATTRIB, 1, GL_FLOAT, GL_FALSE, stride, base + m->instanceBoneRow.offset);
+			shader->VertexAttribDivisor(INSTANCE_BONE_ROW_ATTRIB, 1);
+			shader->BindTexture(BONE_TEXTURE, m->boneTexture);
+			shader->Uniform(BONE_TEXTURE_INV_WIDTH, 1.0f / m->boneTextureWidth);
+		}
+
+		if (!g_Renderer.m_SkipSubmit)
+			pglDrawElementsInstancedARB(GL_TRIANGLES, (GLsizei)numFaces*3, GL_UNSIGNED_SHORT, indexBase, (GLsizei)count);
+
+		// bump stats
+		g_Renderer.m_Stats.m_DrawCalls++;
+		g_Renderer.m_Stats.m_ModelTris += numFaces * count;
+	}
+
+	// Reset the divisors, since the attribute indexes might be used by
+	// non-instanced attributes in other shaders
+	for (size_t r = 0; r < 3; ++r)
+		shader->VertexAttribDivisor(INSTANCE_TRANSFORM_ATTRIBS[r], 0);
+	shader->VertexAttribDivisor(INSTANCE_SHADING_COLOR_ATTRIB, 0);
+	shader->VertexAttribDivisor(INSTANCE_PLAYER_COLOR_ATTRIB, 0);
+	if (m->gpuSkinning)
+		shader->VertexAttribDivisor(INSTANCE_BONE_ROW_ATTRIB, 0);
+#endif
+}
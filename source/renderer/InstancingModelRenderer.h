@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -16,8 +16,10 @@
  */
 
 /*
- * Special ModelVertexRender that only works for non-animated models,
- * but is very fast for instanced models.
+ * Special ModelVertexRender that shares one static vertex buffer between
+ * all the models with the same CModelDef, so it only works for non-animated
+ * models (or animated ones with GPU skinning), but is very fast for
+ * instanced models.
  */
 
 #ifndef INCLUDED_INSTANCINGMODELRENDERER
@@ -28,9 +30,26 @@
 struct InstancingModelRendererInternals;
 
 /**
- * Render non-animated (but potentially moving) models using a ShaderRenderModifier.
+ * Render non-animated (but potentially moving) models, or models that are
+ * skinned by the vertex shader, using a ShaderRenderModifier.
  * This computes and binds per-vertex data; the modifier is responsible
  * for setting any shader uniforms etc (including the instancing transform).
+ *
+ * If the GL supports instanced arrays, and the shader has an "a_instanceTransform0"
+ * vertex attribute, models can instead be drawn with hardware instancing. The shader
+ * then gets each model's transform as the vec4 attributes a_instanceTransform0..2
+ * (the first three rows of the matrix), plus a_instanceShadingColor and
+ * a_instancePlayerColor, in place of the corresponding uniforms.
+ *
+ * With GPU skinning, models normally get their bone matrices in the uniform
+ * array skinBlendMatrices, which limits the number of bones. If the GL supports
+ * float textures in vertex shaders (CRenderer::Caps::m_BoneTextures), and the
+ * shader has an "a_instanceBoneRow" attribute, skinned models are drawn with
+ * instancing too, and their matrices are streamed through the texture
+ * skinBoneTex instead: bone b's matrix (including the root bone at b = 0)
+ * is in the three RGBA texels (3b + r, row) for its first three rows r = 0..2,
+ * at texture coordinates u = (3b + r + 0.5) * skinBoneTexInvWidth and
+ * v = a_instanceBoneRow. (The shader technique gets USE_BONE_TEXTURE defined.)
  */
 class InstancingModelRenderer : public ModelVertexRenderer
 {
@@ -41,11 +60,14 @@ public:
 	// Implementations
 	CModelRData* CreateModelData(const void* key, CModel* model);
 	void UpdateModelData(CModel* model, CModelRData* data, int updateflags);
+	void UploadModelData(CModel* model, CModelRData* data, int updateflags);
 
 	void BeginPass(int streamflags);
 	void EndPass(int streamflags);
 	void PrepareModelDef(const CShaderProgramPtr& shader, int streamflags, const CModelDef& def);
 	void RenderModel(const CShaderProgramPtr& shader, int streamflags, CModel* model, CModelRData* data);
+	bool SupportsInstancing(const CShaderProgramPtr& shader);
+	void RenderModelsInstanced(const CShaderProgramPtr& shader, int streamflags, CModel** models, size_t numModels);
 
 protected:
 	InstancingModelRendererInternals* m;
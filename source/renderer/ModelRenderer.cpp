@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,6 +23,7 @@
 
 #include "ps/CLogger.h"
 #include "ps/Profile.h"
+#include "ps/ThreadPool.h"
 
 #include "graphics/Color.h"
 #include "graphics/LightEnv.h"
@@ -42,6 +43,8 @@
 
 #include <boost/weak_ptr.hpp>
 
+#include <map>
+
 #if ARCH_X86_X64
 # include "lib/sysdep/arch/x86_x64/x86_x64.h"
 #endif
@@ -112,15 +115,13 @@ void ModelRenderer::BuildPositionAndNormals(
 	}
 	else
 	{
-		PROFILE( "software transform" );
 		// just copy regular positions, transform normals to world space
 		const CMatrix3D& transform = model->GetTransform();
 		const CMatrix3D& invtransform = model->GetInvTransform();
-		for (size_t j=0; j<numVertices; j++)
-		{
-			transform.Transform(vertices[j].m_Coords,Position[j]);
-			invtransform.RotateTransposed(vertices[j].m_Norm,Normal[j]);
-		}
+		transform.TransformPoints(&vertices->m_Coords, sizeof(SModelVertex),
+			(CVector3D*)Position.GetData(), Position.GetStride(), numVertices);
+		invtransform.RotateTransposedVectors(&vertices->m_Norm, sizeof(SModelVertex),
+			(CVector3D*)Normal.GetData(), Normal.GetStride(), numVertices);
 	}
 }
 
@@ -131,8 +132,6 @@ void ModelRenderer::BuildColor4ub(
 		const VertexArrayIterator<CVector3D>& Normal,
 		const VertexArrayIterator<SColor4ub>& Color)
 {
-	PROFILE( "lighting vertices" );
-
 	CModelDefPtr mdef = model->GetModelDef();
 	size_t numVertices = mdef->GetNumVertices();
 	const CLightEnv& lightEnv = g_Renderer.GetLightEnv();
@@ -188,6 +187,29 @@ void ModelRenderer::BuildIndices(
 		Indices[idxidx++]=face.m_Verts[1];
 		Indices[idxidx++]=face.m_Verts[2];
 	}
+
+	const std::vector<SModelFace>& lodFaces = mdef->GetLODFaces();
+	for (size_t j = 0; j < lodFaces.size(); ++j) {
+		const SModelFace& face=lodFaces[j];
+		Indices[idxidx++]=face.m_Verts[0];
+		Indices[idxidx++]=face.m_Verts[1];
+		Indices[idxidx++]=face.m_Verts[2];
+	}
+}
+
+size_t ModelRenderer::GetNumIndices(const CModelDefPtr& mdef)
+{
+	return (mdef->GetNumFaces() + mdef->GetLODFaces().size()) * 3;
+}
+
+size_t ModelRenderer::ChooseLOD(CModel* model)
+{
+	const CModelDefPtr& mdef = model->GetModelDef();
+	if (!mdef->GetNumLODs())
+		return 0;
+
+	CVector3D cameraPos = g_Renderer.GetViewCamera().GetOrientation().GetTranslation();
+	return mdef->ChooseLOD((model->GetTransform().GetTranslation() - cameraPos).Length());
 }
 
 
@@ -202,6 +224,16 @@ void ModelRenderer::BuildIndices(
  * Separated into the source file to increase implementation hiding (and to
  * avoid some causes of recompiles).
  */
+/**
+ * Item in ShaderModelRenderer's render queue.
+ */
+struct SMRQueueItem
+{
+	u64 key; // sort key (see ShaderModelRenderer::Render)
+	CModel* model;
+	size_t techIdx;
+};
+
 struct ShaderModelRendererInternals
 {
 	ShaderModelRendererInternals(ShaderModelRenderer* r) : m_Renderer(r) { }
@@ -214,6 +246,11 @@ struct ShaderModelRendererInternals
 
 	/// List of submitted models for rendering in this frame
 	std::vector<CModel*> submissions;
+
+	/// Render queue for the current Render call, and scratch space for sorting
+	/// it (kept between calls so they don't need to be reallocated)
+	std::vector<SMRQueueItem> queue;
+	std::vector<SMRQueueItem> queueScratch;
 };
 
 
@@ -248,9 +285,35 @@ void ShaderModelRenderer::Submit(CModel* model)
 }
 
 
+// Computes the per-model vertex data (mostly CPU skinning), which is
+// independent for each model
+class PrepareModelsTask : public CThreadPool::ITask
+{
+public:
+	PrepareModelsTask(ModelVertexRenderer& vertexRenderer, const std::vector<CModel*>& models) :
+		m_VertexRenderer(vertexRenderer), m_Models(models)
+	{
+	}
+
+	virtual void Run(size_t index)
+	{
+		CModel* model = m_Models[index];
+		CModelRData* rdata = static_cast<CModelRData*>(model->GetRenderData());
+		m_VertexRenderer.UpdateModelData(model, rdata, rdata->m_UpdateFlags);
+	}
+
+private:
+	ModelVertexRenderer& m_VertexRenderer;
+	const std::vector<CModel*>& m_Models;
+
+	NONCOPYABLE(PrepareModelsTask);
+};
+
 // Call update for all submitted models and enter the rendering phase
 void ShaderModelRenderer::PrepareModels()
 {
+	// Only the models that have changed need any work
+	std::vector<CModel*> updated;
 	for (size_t i = 0; i < m->submissions.size(); ++i)
 	{
 		CModel* model = m->submissions[i];
@@ -258,7 +321,22 @@ void ShaderModelRenderer::PrepareModels()
  		CModelRData* rdata = static_cast<CModelRData*>(model->GetRenderData());
  		ENSURE(rdata->GetKey() == m->vertexRenderer.get());
 
-		m->vertexRenderer->UpdateModelData(model, rdata, rdata->m_UpdateFlags);
+		if (rdata->m_UpdateFlags)
+			updated.push_back(model);
+	}
+
+	PrepareModelsTask task(*m->vertexRenderer, updated);
+	if (g_ThreadPool && updated.size() > 1)
+		g_ThreadPool->ParallelFor(task, updated.size());
+	else
+		for (size_t i = 0; i < updated.size(); ++i)
+			task.Run(i);
+
+	// Only the main thread can upload the results to GL
+	for (size_t i = 0; i < updated.size(); ++i)
+	{
+		CModelRData* rdata = static_cast<CModelRData*>(updated[i]->GetRenderData());
+		m->vertexRenderer->UploadModelData(updated[i], rdata, rdata->m_UpdateFlags);
 		rdata->m_UpdateFlags = 0;
 	}
 }
@@ -273,42 +351,33 @@ void ShaderModelRenderer::EndFrame()
 
 // Helper structs for ShaderModelRenderer::Render():
 
-struct SMRSortByDistItem
-{
-	size_t techIdx;
-	CModel* model;
-	float dist;
-};
-
-struct SMRBatchModel
+/**
+ * Returns whether two models can be drawn with the same render state
+ * (in a single instanced draw call), assuming they use the same technique.
+ */
+static bool SMRSameRenderState(CModel* a, CModel* b)
 {
-	bool operator()(CModel* a, CModel* b)
-	{
-		if (a->GetModelDef() < b->GetModelDef())
-			return true;
-		if (b->GetModelDef() < a->GetModelDef())
+	if (a->GetModelDef() != b->GetModelDef())
+		return false;
+
+	// Instances are drawn with a single index range
+	if (ModelRenderer::ChooseLOD(a) != ModelRenderer::ChooseLOD(b))
+		return false;
+
+	const CMaterial& matA = a->GetMaterial();
+	const CMaterial& matB = b->GetMaterial();
+
+	const CMaterial::SamplersVector& samplersA = matA.GetSamplers();
+	const CMaterial::SamplersVector& samplersB = matB.GetSamplers();
+	if (samplersA.size() != samplersB.size())
+		return false;
+	for (size_t s = 0; s < samplersA.size(); ++s)
+		if (!(samplersA[s].Name == samplersB[s].Name) || samplersA[s].Sampler != samplersB[s].Sampler)
 			return false;
 
-		if (a->GetMaterial().GetDiffuseTexture() < b->GetMaterial().GetDiffuseTexture())
-			return true;
-		if (b->GetMaterial().GetDiffuseTexture() < a->GetMaterial().GetDiffuseTexture())
-			return false;
-
-		return a->GetMaterial().GetStaticUniforms() < b->GetMaterial().GetStaticUniforms();
-	}
-};
-
-struct SMRCompareSortByDistItem
-{
-	bool operator()(const SMRSortByDistItem& a, const SMRSortByDistItem& b)
-	{
-		// Prefer items with greater distance, so we draw back-to-front
-		return (a.dist > b.dist);
-
-		// (Distances will almost always be distinct, so we don't need to bother
-		// tie-breaking on modeldef/texture/etc)
-	}
-};
+	return matA.GetStaticUniforms() == matB.GetStaticUniforms() &&
+		matA.GetRenderQueries() == matB.GetRenderQueries();
+}
 
 struct SMRMaterialBucketKey
 {
@@ -318,43 +387,87 @@ struct SMRMaterialBucketKey
 	CStrIntern effect;
 	CShaderDefines defines;
 
-	bool operator==(const SMRMaterialBucketKey& b) const
+	bool operator<(const SMRMaterialBucketKey& b) const
 	{
-		return (effect == b.effect && defines == b.defines);
+		if (effect < b.effect)
+			return true;
+		if (b.effect < effect)
+			return false;
+		return defines < b.defines;
 	}
 
 private:
 	SMRMaterialBucketKey& operator=(const SMRMaterialBucketKey&);
 };
 
-struct SMRMaterialBucketKeyHash
+// Reduces a pointer or hash to a 16-bit field of a sort key. Collisions only
+// make the batching slightly worse, since models with equal keys stay in
+// submission order.
+static inline u64 SMRKeyField(size_t value)
 {
-	size_t operator()(const SMRMaterialBucketKey& key) const
-	{
-		size_t hash = 0;
-		boost::hash_combine(hash, key.effect.GetHash());
-		boost::hash_combine(hash, key.defines.GetHash());
-		return hash;
-	}
-};
+	value ^= value >> 16;
+	value ^= value >> 32 >> 16; // (split so it's still valid for 32-bit size_t)
+	return (u64)(value & 0xFFFF);
+}
 
-struct SMRTechBucket
+// Maps a float onto a u32 with the same ordering
+static inline u32 SMRSortableFloat(float f)
 {
-	CShaderTechniquePtr tech;
-	CModel** models;
-	size_t numModels;
+	u32 bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
 
-	// Model list is stored as pointers, not as a std::vector,
-	// so that sorting lists of this struct is fast
-};
+static const u64 SMR_KEY_SORT_BY_DISTANCE = (u64)1 << 63;
 
-struct SMRCompareTechBucket
+/**
+ * Stable least-significant-digit radix sort of the render queue by its keys,
+ * using @p scratch as temporary storage.
+ * Passes over bytes that are equal in every key are skipped, which is typical
+ * for the unused bits of the key.
+ */
+static void SMRRadixSort(std::vector<SMRQueueItem>& items, std::vector<SMRQueueItem>& scratch)
 {
-	bool operator()(const SMRTechBucket& a, const SMRTechBucket& b)
+	const size_t n = items.size();
+	if (n < 2)
+		return;
+
+	size_t counts[8][256];
+	memset(counts, 0, sizeof(counts));
+	for (size_t i = 0; i < n; ++i)
 	{
-		return a.tech < b.tech;
+		u64 key = items[i].key;
+		for (size_t b = 0; b < 8; ++b)
+			++counts[b][(key >> (b*8)) & 0xFF];
 	}
-};
+
+	scratch.resize(n);
+	SMRQueueItem* src = &items[0];
+	SMRQueueItem* dst = &scratch[0];
+
+	for (size_t b = 0; b < 8; ++b)
+	{
+		size_t* count = counts[b];
+		if (count[(src[0].key >> (b*8)) & 0xFF] == n)
+			continue;
+
+		size_t offsets[256];
+		size_t total = 0;
+		for (size_t d = 0; d < 256; ++d)
+		{
+			offsets[d] = total;
+			total += count[d];
+		}
+
+		for (size_t i = 0; i < n; ++i)
+			dst[offsets[(src[i].key >> (b*8)) & 0xFF]++] = src[i];
+
+		std::swap(src, dst);
+	}
+
+	if (src != &items[0])
+		items.swap(scratch);
+}
 
 void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShaderDefines& context, int flags)
 {
@@ -379,14 +492,6 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 	 * For efficient rendering, we need to batch the draw calls to minimise state changes.
 	 * (Uniform and texture changes are assumed to be cheaper than binding new mesh data,
 	 * and shader changes are assumed to be most expensive.)
-	 * First, group all models that share a technique to render them together.
-	 * Within those groups, sub-group by CModelDef.
-	 * Within those sub-groups, sub-sub-group by CTexture.
-	 * Within those sub-sub-groups, sub-sub-sub-group by CShaderUniforms.
-	 * 
-	 * Alpha-blended models have to be sorted by distance from camera,
-	 * then we can batch as long as the order is preserved.
-	 * Non-alpha-blended models can be arbitrarily reordered to maximise batching.
 	 * 
 	 * For each model, the CShaderTechnique is derived from:
 	 *  - The current global 'context' defines
@@ -394,45 +499,59 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 	 *  - The CModel's material's shader effect name
 	 * 
 	 * There are a smallish number of materials, and a smaller number of techniques.
+	 * To minimise technique lookups, each distinct material is looked up once
+	 * (in 'materialTechs'), giving an index into the list of techniques used
+	 * by this call.
 	 * 
-	 * To minimise technique lookups, we first group models by material,
-	 * in 'materialBuckets' (a hash table).
+	 * Each model is then added to the render queue with a 64-bit sort key:
+	 *  - For most techniques, the key is the technique index followed by
+	 *    (hashed) fields for the CModelDef, the diffuse texture and the uniforms,
+	 *    so sorting the queue groups models to minimise the state changes.
+	 *  - Alpha-blended models have to be drawn back-to-front, so if the technique
+	 *    requires sort-by-distance, the key has its top bit set (so those models
+	 *    are drawn after all the others) followed by the inverted distance from
+	 *    the camera and then the technique index.
 	 * 
-	 * For each material bucket we then look up the appropriate shader technique.
-	 * If the technique requires sort-by-distance, the model is added to the
-	 * 'sortByDistItems' list with its computed distance.
-	 * Otherwise, the bucket's list of models is sorted by modeldef+texture+uniforms,
-	 * then the technique and model list is added to 'techBuckets'.
+	 * The queue is sorted with a radix sort, which is linear in the number of
+	 * models and doesn't need any comparison callbacks. The queue and the
+	 * sorting space are kept between calls, and the material lookup table is
+	 * allocated from an arena, so this doesn't need to allocate much memory
+	 * every frame.
 	 * 
-	 * 'techBuckets' is then sorted by technique, to improve batching when multiple
-	 * materials map onto the same technique.
-	 * 
-	 * (Note that this isn't perfect batching: we don't sort across models in
-	 * multiple buckets that share a technique. In practice that shouldn't reduce
-	 * batching much (we rarely have one mesh used with multiple materials),
-	 * and it saves on copying and lets us sort smaller lists.)
-	 * 
-	 * Extra tech buckets are added for the sorted-by-distance models without reordering.
-	 * Finally we render by looping over each tech bucket, then looping over the model
-	 * list in each, rebinding the GL state whenever it changes.
+	 * Finally we render by looping over each run of the queue that shares
+	 * a technique, rebinding the GL state whenever it changes.
 	 */
 
- 	typedef boost::unordered_map<SMRMaterialBucketKey, std::vector<CModel*>, SMRMaterialBucketKeyHash> MaterialBuckets_t;
-	MaterialBuckets_t materialBuckets;
+	// The material lookup table is only needed during this call, so use
+	// the renderer's frame arena for it
+	typedef std::map<SMRMaterialBucketKey, size_t, std::less<SMRMaterialBucketKey>,
+		ProxyAllocator<std::pair<SMRMaterialBucketKey const, size_t>, Allocators::Arena<> > > MaterialTechs_t;
+	CFrameArenaScope arenaScope(256*KiB);
+	MaterialTechs_t materialTechs((MaterialTechs_t::key_compare()), (MaterialTechs_t::allocator_type(arenaScope.Get())));
+
+	// Techniques used by this call, indexed by the queue items' techIdx
+	std::vector<CShaderTechniquePtr> techs;
+
+	// Value stored in materialTechs for materials with invalid techniques
+	// (e.g. from data file errors), which are skipped
+	const size_t invalidTech = ~(size_t)0;
+
+	std::vector<SMRQueueItem>& queue = m->queue;
+	queue.clear();
 
 	{
-		PROFILE3("bucketing by material");
+		PROFILE3("building render queue");
 
 		for (size_t i = 0; i < m->submissions.size(); ++i)
 		{
 			CModel* model = m->submissions[i];
 			
 			CShaderDefines defs = model->GetMaterial().GetShaderDefines();
-			CShaderConditionalDefines condefs = model->GetMaterial().GetConditionalDefines();
+			const CShaderConditionalDefines& condefs = model->GetMaterial().GetConditionalDefines();
 			
 			for (size_t j = 0; j < condefs.GetSize(); ++j)
 			{
-				CShaderConditionalDefines::CondDefine &item = condefs.GetItem(j);
+				const CShaderConditionalDefines::CondDefine& item = condefs.GetItem(j);
 				int type = item.m_CondType;
 				switch (type)
 				{
@@ -445,131 +564,71 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 						float dmax = item.m_CondArgs[1];
 						
 						if ((dmin < 0 || dist >= dmin) && (dmax < 0 || dist < dmax))
-							defs.Add(item.m_DefName.c_str(), item.m_DefValue.c_str());
+							defs.Set(item.m_DefName, item.m_DefValue);
 						
 						break;
 					}
 				}
 			}
 
-			SMRMaterialBucketKey key(model->GetMaterial().GetShaderEffect(), defs);
-			std::vector<CModel*>& bucketItems = materialBuckets[key];
-			bucketItems.push_back(model);
-		}
-	}
-
-	std::vector<SMRSortByDistItem> sortByDistItems;
-
-	std::vector<CShaderTechniquePtr> sortByDistTechs;
-		// indexed by sortByDistItems[i].techIdx
-		// (which stores indexes instead of CShaderTechniquePtr directly
-		// to avoid the shared_ptr copy cost when sorting; maybe it'd be better
-		// if we just stored raw CShaderTechnique* and assumed the shader manager
-		// will keep it alive long enough)
-
-	std::vector<SMRTechBucket> techBuckets;
-
-	{
-		PROFILE3("processing material buckets");
-		for (MaterialBuckets_t::iterator it = materialBuckets.begin(); it != materialBuckets.end(); ++it)
-		{
-			CShaderTechniquePtr tech = g_Renderer.GetShaderManager().LoadEffect(it->first.effect, context, it->first.defines);
-
-			// Skip invalid techniques (e.g. from data file errors)
-			if (!tech)
-				continue;
-
-			if (tech->GetSortByDistance())
+			SMRMaterialBucketKey materialKey(model->GetMaterial().GetShaderEffect(), defs);
+			MaterialTechs_t::iterator it = materialTechs.find(materialKey);
+			if (it == materialTechs.end())
 			{
-				// Add the tech into a vector so we can index it
-				// (There might be duplicates in this list, but that doesn't really matter)
-				if (sortByDistTechs.empty() || sortByDistTechs.back() != tech)
-					sortByDistTechs.push_back(tech);
-				size_t techIdx = sortByDistTechs.size()-1;
-
-				// Add each model into sortByDistItems
-				for (size_t i = 0; i < it->second.size(); ++i)
+				size_t techIdx = invalidTech;
+				CShaderTechniquePtr tech = g_Renderer.GetShaderManager().LoadEffect(materialKey.effect, context, materialKey.defines);
+				if (tech)
 				{
-					SMRSortByDistItem itemWithDist;
-					itemWithDist.techIdx = techIdx;
+					// Multiple materials often map onto the same technique,
+					// so share its index for better batching
+					techIdx = std::find(techs.begin(), techs.end(), tech) - techs.begin();
+					if (techIdx == techs.size())
+						techs.push_back(tech);
+				}
+				it = materialTechs.insert(std::make_pair(materialKey, techIdx)).first;
+			}
 
-					CModel* model = it->second[i];
-					itemWithDist.model = model;
+			size_t techIdx = it->second;
+			if (techIdx == invalidTech)
+				continue;
 
-					CVector3D modelpos = model->GetTransform().GetTranslation();
-					itemWithDist.dist = worldToCam.Transform(modelpos).Z;
+			SMRQueueItem item;
+			item.model = model;
+			item.techIdx = techIdx;
 
-					sortByDistItems.push_back(itemWithDist);
-				}
+			if (techs[techIdx]->GetSortByDistance())
+			{
+				CVector3D modelpos = model->GetTransform().GetTranslation();
+				float dist = worldToCam.Transform(modelpos).Z;
+
+				// Prefer items with greater distance, so we draw back-to-front
+				item.key = SMR_KEY_SORT_BY_DISTANCE |
+					((u64)~SMRSortableFloat(dist) << 16) |
+					(u64)techIdx;
 			}
 			else
 			{
-				// Sort model list by modeldef+texture, for batching
 				// TODO: This only sorts by base texture. While this is an OK approximation
 				// for most cases (as related samplers are usually used together), it would be better
 				// to take all the samplers into account when sorting here.
-				std::sort(it->second.begin(), it->second.end(), SMRBatchModel());
-
-				// Add a tech bucket pointing at this model list
-				SMRTechBucket techBucket = { tech, &it->second[0], it->second.size() };
-				techBuckets.push_back(techBucket);
+				const CMaterial& material = model->GetMaterial();
+				item.key = ((u64)techIdx << 48) |
+					(SMRKeyField((size_t)model->GetModelDef().get()) << 32) |
+					(SMRKeyField((size_t)material.GetDiffuseTexture().get()) << 16) |
+					SMRKeyField(material.GetStaticUniforms().GetHash());
 			}
-		}
-	}
 
-	{
-		PROFILE3("sorting tech buckets");
-		// Sort by technique, for better batching
-		std::sort(techBuckets.begin(), techBuckets.end(), SMRCompareTechBucket());
+			queue.push_back(item);
+		}
 	}
 
-	// List of models corresponding to sortByDistItems[i].model
-	// (This exists primarily because techBuckets wants a CModel**;
-	// we could avoid the cost of copying into this list by adding
-	// a stride length into techBuckets and not requiring contiguous CModel*s)
-	std::vector<CModel*> sortByDistModels;
-
-	if (!sortByDistItems.empty())
 	{
-		{
-			PROFILE3("sorting items by dist");
-			std::sort(sortByDistItems.begin(), sortByDistItems.end(), SMRCompareSortByDistItem());
-		}
-
-		{
-			PROFILE3("batching dist-sorted items");
-
-			sortByDistModels.reserve(sortByDistItems.size());
-
-			// Find runs of distance-sorted models that share a technique,
-			// and create a new tech bucket for each run
-
-			size_t start = 0; // start of current run
-			size_t currentTechIdx = sortByDistItems[start].techIdx;
-
-			for (size_t end = 0; end < sortByDistItems.size(); ++end)
-			{
-				sortByDistModels.push_back(sortByDistItems[end].model);
-
-				size_t techIdx = sortByDistItems[end].techIdx;
-				if (techIdx != currentTechIdx)
-				{
-					// Start of a new run - push the old run into a new tech bucket
-					SMRTechBucket techBucket = { sortByDistTechs[currentTechIdx], &sortByDistModels[start], end-start };
-					techBuckets.push_back(techBucket);
-					start = end;
-					currentTechIdx = techIdx;
-				}
-			}
-
-			// Add the tech bucket for the final run
-			SMRTechBucket techBucket = { sortByDistTechs[currentTechIdx], &sortByDistModels[start], sortByDistItems.size()-start };
-			techBuckets.push_back(techBucket);
-		}
+		PROFILE3("sorting render queue");
+		SMRRadixSort(queue, m->queueScratch);
 	}
 
 	{
-		PROFILE3("rendering bucketed submissions");
+		PROFILE3("rendering render queue");
 
 		size_t idxTechStart = 0;
 		
@@ -587,15 +646,19 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 		std::vector<CStrIntern> texBindingNames;
 		texBindingNames.reserve(64);
 
-		while (idxTechStart < techBuckets.size())
+		// Models to be drawn by a single instanced draw call
+		std::vector<CModel*> instancedModels;
+
+		while (idxTechStart < queue.size())
 		{
-			CShaderTechniquePtr currentTech = techBuckets[idxTechStart].tech;
+			size_t currentTechIdx = queue[idxTechStart].techIdx;
+			const CShaderTechniquePtr& currentTech = techs[currentTechIdx];
 
-			// Find runs [idxTechStart, idxTechEnd) in techBuckets of the same technique
+			// Find runs [idxTechStart, idxTechEnd) in the queue of the same technique
 			size_t idxTechEnd;
-			for (idxTechEnd = idxTechStart + 1; idxTechEnd < techBuckets.size(); ++idxTechEnd)
+			for (idxTechEnd = idxTechStart + 1; idxTechEnd < queue.size(); ++idxTechEnd)
 			{
-				if (techBuckets[idxTechEnd].tech != currentTech)
+				if (queue[idxTechEnd].techIdx != currentTechIdx)
 					break;
 			}
 
@@ -606,6 +669,7 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 
 				const CShaderProgramPtr& shader = currentTech->GetShader(pass);
 				int streamflags = shader->GetStreamFlags();
+				bool instancing = m->vertexRenderer->SupportsInstancing(shader);
 
 				modifier->BeginPass(shader);
 
@@ -621,115 +685,135 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 				CModelDef* currentModeldef = NULL;
 				CShaderUniforms currentStaticUniforms;
 
-				for (size_t idx = idxTechStart; idx < idxTechEnd; ++idx)
+				for (size_t i = idxTechStart; i < idxTechEnd; ++i)
 				{
-					CModel** models = techBuckets[idx].models;
-					size_t numModels = techBuckets[idx].numModels;
-					for (size_t i = 0; i < numModels; ++i)
-					{
-						CModel* model = models[i];
+					CModel* model = queue[i].model;
 
-						if (flags && !(model->GetFlags() & flags))
-							continue;
+					if (flags && !(model->GetFlags() & flags))
+						continue;
 
-						CMaterial::SamplersVector samplers = model->GetMaterial().GetSamplers();
-						size_t samplersNum = samplers.size();
+					CMaterial::SamplersVector samplers = model->GetMaterial().GetSamplers();
+					size_t samplersNum = samplers.size();
+					
+					// make sure the vectors are the right virtual sizes, and also
+					// reallocate if there are more samplers than expected.
+					if (currentTexs.size() != samplersNum)
+					{
+						currentTexs.resize(samplersNum, NULL);
+						texBindings.resize(samplersNum, CShaderProgram::Binding());
+						texBindingNames.resize(samplersNum, CStrIntern());
 						
-						// make sure the vectors are the right virtual sizes, and also
-						// reallocate if there are more samplers than expected.
-						if (currentTexs.size() != samplersNum)
-						{
-							currentTexs.resize(samplersNum, NULL);
-							texBindings.resize(samplersNum, CShaderProgram::Binding());
-							texBindingNames.resize(samplersNum, CStrIntern());
-							
-							// ensure they are definitely empty
-							std::fill(texBindings.begin(), texBindings.end(), CShaderProgram::Binding());
-							std::fill(currentTexs.begin(), currentTexs.end(), (CTexture*)NULL);
-							std::fill(texBindingNames.begin(), texBindingNames.end(), CStrIntern());
-						}
+						// ensure they are definitely empty
+						std::fill(texBindings.begin(), texBindings.end(), CShaderProgram::Binding());
+						std::fill(currentTexs.begin(), currentTexs.end(), (CTexture*)NULL);
+						std::fill(texBindingNames.begin(), texBindingNames.end(), CStrIntern());
+					}
+					
+					// bind the samplers to the shader
+					for (size_t s = 0; s < samplersNum; ++s)
+					{
+						CMaterial::TextureSampler &samp = samplers[s];
 						
-						// bind the samplers to the shader
-						for (size_t s = 0; s < samplersNum; ++s)
+						CShaderProgram::Binding bind = texBindings[s];
+						// check that the handles are current
+						// and reevaluate them if necessary
+						if (texBindingNames[s] == samp.Name && bind.Active())
 						{
-							CMaterial::TextureSampler &samp = samplers[s];
-							
-							CShaderProgram::Binding bind = texBindings[s];
-							// check that the handles are current
-							// and reevaluate them if necessary
-							if (texBindingNames[s] == samp.Name && bind.Active())
-							{
-								bind = texBindings[s];
-							}
-							else
-							{
-								bind = shader->GetTextureBinding(samp.Name.c_str());		
-								texBindings[s] = bind;
-								texBindingNames[s] = samp.Name;
-							}
-
-							// same with the actual sampler bindings
-							CTexture* newTex = samp.Sampler.get();
-							if (bind.Active() && newTex != currentTexs[s])
-							{
-								shader->BindTexture(bind, samp.Sampler->GetHandle());
-								currentTexs[s] = newTex;
-							}
+							bind = texBindings[s];
 						}
-						
-						// Bind modeldef when it changes
-						CModelDef* newModeldef = model->GetModelDef().get();
-						if (newModeldef != currentModeldef)
+						else
 						{
-							currentModeldef = newModeldef;
-							m->vertexRenderer->PrepareModelDef(shader, streamflags, *currentModeldef);
+							bind = shader->GetTextureBinding(samp.Name.c_str());		
+							texBindings[s] = bind;
+							texBindingNames[s] = samp.Name;
 						}
 
-						// Bind all uniforms when any change
-						CShaderUniforms newStaticUniforms = model->GetMaterial().GetStaticUniforms();
-						if (newStaticUniforms != currentStaticUniforms)
+						// same with the actual sampler bindings
+						CTexture* newTex = samp.Sampler.get();
+						if (bind.Active() && newTex != currentTexs[s])
 						{
-							currentStaticUniforms = newStaticUniforms;
-							currentStaticUniforms.BindUniforms(shader);
+							shader->BindTexture(bind, samp.Sampler->GetHandle());
+							currentTexs[s] = newTex;
 						}
-						
-						CShaderRenderQueries renderQueries = model->GetMaterial().GetRenderQueries();
-						
-						for (size_t q = 0; q < renderQueries.GetSize(); q++)
+					}
+					
+					// Bind modeldef when it changes
+					CModelDef* newModeldef = model->GetModelDef().get();
+					if (newModeldef != currentModeldef)
+					{
+						currentModeldef = newModeldef;
+						m->vertexRenderer->PrepareModelDef(shader, streamflags, *currentModeldef);
+					}
+
+					// Bind all uniforms when any change
+					CShaderUniforms newStaticUniforms = model->GetMaterial().GetStaticUniforms();
+					if (newStaticUniforms != currentStaticUniforms)
+					{
+						currentStaticUniforms = newStaticUniforms;
+						currentStaticUniforms.BindUniforms(shader);
+					}
+					
+					CShaderRenderQueries renderQueries = model->GetMaterial().GetRenderQueries();
+					
+					for (size_t q = 0; q < renderQueries.GetSize(); q++)
+					{
+						CShaderRenderQueries::RenderQuery rq = renderQueries.GetItem(q);
+						if (rq.first == RQUERY_TIME)
 						{
-							CShaderRenderQueries::RenderQuery rq = renderQueries.GetItem(q);
-							if (rq.first == RQUERY_TIME)
-							{
-								CShaderProgram::Binding binding = shader->GetUniformBinding(rq.second);
-								if (binding.Active())
-								{
-									double time = g_Renderer.GetTimeManager().GetGlobalTime();
-									shader->Uniform(binding, time, 0,0,0);
-								}
-							}
-							else if (rq.first == RQUERY_WATER_TEX)
+							CShaderProgram::Binding binding = shader->GetUniformBinding(rq.second);
+							if (binding.Active())
 							{
-								WaterManager* WaterMgr = g_Renderer.GetWaterManager();
-								double time = WaterMgr->m_WaterTexTimer;
-								double period = 1.6;
-								int curTex = (int)(time*60/period) % 60;
-								
-								if (WaterMgr->m_RenderWater && WaterMgr->WillRenderFancyWater())
-									shader->BindTexture("waterTex", WaterMgr->m_NormalMap[curTex]);
-								else
-									shader->BindTexture("waterTex", g_Renderer.GetTextureManager().GetErrorTexture());
-							}
-							else if (rq.first == RQUERY_SKY_CUBE)
-							{
-								shader->BindTexture("skyCube", g_Renderer.GetSkyManager()->GetSkyCube());
+								double time = g_Renderer.GetTimeManager().GetGlobalTime();
+								shader->Uniform(binding, time, 0,0,0);
 							}
 						}
+						else if (rq.first == RQUERY_WATER_TEX)
+						{
+							WaterManager* WaterMgr = g_Renderer.GetWaterManager();
+							double time = WaterMgr->m_WaterTexTimer;
+							double period = 1.6;
+							int curTex = (int)(time*60/period) % 60;
+							
+							if (WaterMgr->m_RenderWater && WaterMgr->WillRenderFancyWater())
+								shader->BindTexture("waterTex", WaterMgr->m_NormalMap[curTex]);
+							else
+								shader->BindTexture("waterTex", g_Renderer.GetTextureManager().GetErrorTexture());
+						}
+						else if (rq.first == RQUERY_SKY_CUBE)
+						{
+							shader->BindTexture("skyCube", g_Renderer.GetSkyManager()->GetSkyCube());
+						}
+					}
+
+					modifier->PrepareModel(shader, model);
 
-						modifier->PrepareModel(shader, model);
+					CModelRData* rdata = static_cast<CModelRData*>(model->GetRenderData());
+					ENSURE(rdata->GetKey() == m->vertexRenderer.get());
 
-						CModelRData* rdata = static_cast<CModelRData*>(model->GetRenderData());
-						ENSURE(rdata->GetKey() == m->vertexRenderer.get());
+					if (instancing)
+					{
+						// Draw this model together with all the following ones
+						// that share its render state (the queue is sorted by
+						// modeldef and texture, so these will usually be adjacent)
+						instancedModels.clear();
+						instancedModels.push_back(model);
+						size_t j;
+						for (j = i + 1; j < idxTechEnd; ++j)
+						{
+							CModel* next = queue[j].model;
+							if (flags && !(next->GetFlags() & flags))
+								continue;
+							if (!SMRSameRenderState(model, next))
+								break;
+							ENSURE(static_cast<CModelRData*>(next->GetRenderData())->GetKey() == m->vertexRenderer.get());
+							instancedModels.push_back(next);
+						}
+						i = j - 1;
 
+						m->vertexRenderer->RenderModelsInstanced(shader, streamflags, &instancedModels[0], instancedModels.size());
+					}
+					else
+					{
 						m->vertexRenderer->RenderModel(shader, streamflags, model, rdata);
 					}
 				}
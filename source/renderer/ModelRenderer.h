@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -245,15 +245,29 @@ public:
 			int UVset);
 
 	/**
-	 * BuildIndices: Create the indices array for the given CModelDef.
+	 * BuildIndices: Create the indices array for the given CModelDef,
+	 * containing all its levels of detail (see CModelDef::GetLODFaceRange).
 	 *
 	 * @param mdef The model definition object.
 	 * @param Indices The index array, must be able to hold
-	 * mdef->GetNumFaces()*3 elements.
+	 * GetNumIndices(mdef) elements.
 	 */
 	static void BuildIndices(
 			const CModelDefPtr& mdef,
 			const VertexArrayIterator<u16>& Indices);
+
+	/**
+	 * GetNumIndices: Return the number of indices written by BuildIndices.
+	 */
+	static size_t GetNumIndices(const CModelDefPtr& mdef);
+
+	/**
+	 * ChooseLOD: Pick the level of detail of the model's mesh to draw,
+	 * based on its distance from the view camera.
+	 *
+	 * @return the level, as used by CModelDef::GetLODFaceRange.
+	 */
+	static size_t ChooseLOD(CModel* model);
 	
 	/**
 	 * GenTangents: Generate tangents for the given CModelDef.
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -67,15 +67,20 @@ public:
 	 * UpdateModelData: Calculate per-model data for each frame.
 	 *
 	 * ModelRenderer implementations must call this once per frame for
-	 * every model that is to be rendered in this frame, even if the
-	 * value of updateflags will be zero.
-	 * This implies that this function will also be called at least once
+	 * every model that is to be rendered in this frame and whose
+	 * updateflags are non-zero. Models are marked fully dirty when their
+	 * data is created, so this function will also be called at least once
 	 * between a call to CreateModelData and a call to RenderModel.
 	 *
 	 * ModelVertexRenderer implementations should use this function to
 	 * perform software vertex transforms and potentially other per-frame
 	 * calculations.
 	 *
+	 * This may be called concurrently from several threads (for different
+	 * models), so implementations must not make any OpenGL calls or modify
+	 * data shared between models here. The results should be sent to OpenGL
+	 * in UploadModelData instead.
+	 *
 	 * @param model The model.
 	 * @param data Private data as returned by CreateModelData.
 	 * @param updateflags Flags indicating which data has changed during
@@ -85,6 +90,19 @@ public:
 	virtual void UpdateModelData(CModel* model, CModelRData* data, int updateflags) = 0;
 
 
+	/**
+	 * UploadModelData: Upload the per-model data calculated by UpdateModelData.
+	 *
+	 * ModelRenderer implementations must call this on the main thread,
+	 * with the same updateflags, once UpdateModelData has finished.
+	 *
+	 * @param model The model.
+	 * @param data Private data as returned by CreateModelData.
+	 * @param updateflags Flags as passed to UpdateModelData.
+	 */
+	virtual void UploadModelData(CModel* model, CModelRData* data, int updateflags) = 0;
+
+
 	/**
 	 * BeginPass: Setup global OpenGL state for this ModelVertexRenderer.
 	 *
@@ -154,6 +172,29 @@ public:
 	 * succeed.
 	 */
 	virtual void RenderModel(const CShaderProgramPtr& shader, int streamflags, CModel* model, CModelRData* data) = 0;
+
+	/**
+	 * SupportsInstancing: Returns whether RenderModelsInstanced can be used
+	 * with the given shader. If so, ModelRenderer implementations must use it
+	 * instead of RenderModel (since the shader's per-instance attributes
+	 * would otherwise be left undefined).
+	 */
+	virtual bool SupportsInstancing(const CShaderProgramPtr& UNUSED(shader)) { return false; }
+
+	/**
+	 * RenderModelsInstanced: Invoke the rendering commands for several models
+	 * at once, with per-model transforms and colors passed as instanced vertex
+	 * attributes.
+	 *
+	 * preconditions  : SupportsInstancing(shader) is true. The models all use
+	 * the CModelDef of the most recent call to PrepareModelDef, and have
+	 * identical materials.
+	 *
+	 * @param models Array of the models that should be rendered.
+	 * @param numModels Number of models in the array.
+	 */
+	virtual void RenderModelsInstanced(const CShaderProgramPtr& UNUSED(shader), int UNUSED(streamflags),
+		CModel** UNUSED(models), size_t UNUSED(numModels)) { }
 };
 
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,11 +19,13 @@
 
 #include "OverlayRenderer.h"
 
+#include <algorithm>
 #include <boost/unordered_map.hpp>
 #include "graphics/LOSTexture.h"
 #include "graphics/Overlay.h"
 #include "graphics/Terrain.h"
 #include "graphics/TextureManager.h"
+#include "lib/bits.h"
 #include "lib/ogl.h"
 #include "maths/MathUtil.h"
 #include "maths/Quaternion.h"
@@ -77,9 +79,45 @@ public:
 	size_t m_NumRenderQuads;
 };
 
+/**
+ * Key used to group textured overlay lines into batches. Lines can only be drawn together when they
+ * share their textures and visibility status (which selects the shader), and their render data was
+ * allocated from the same vertex and index buffers.
+ */
+struct TexturedLineBatchKey
+{
+	TexturedLineBatchKey(const SOverlayTexturedLine& line)
+		: m_TextureBase(line.m_TextureBase), m_TextureMask(line.m_TextureMask),
+		m_Vertices(line.m_RenderData->GetVertices()->m_Owner), m_Indices(line.m_RenderData->GetIndices()->m_Owner),
+		m_AlwaysVisible(line.m_AlwaysVisible)
+	{ }
+
+	bool operator==(const TexturedLineBatchKey& other) const
+	{
+		return (m_TextureBase == other.m_TextureBase && m_TextureMask == other.m_TextureMask &&
+			m_Vertices == other.m_Vertices && m_Indices == other.m_Indices && m_AlwaysVisible == other.m_AlwaysVisible);
+	}
+
+	CTexturePtr m_TextureBase;
+	CTexturePtr m_TextureMask;
+	CVertexBuffer* m_Vertices;
+	CVertexBuffer* m_Indices;
+	bool m_AlwaysVisible;
+};
+
+/**
+ * Holds the ranges of the shared index buffer to draw for a single textured line batch,
+ * as (first index, number of indices) pairs. Must be cleared after each frame.
+ */
+struct TexturedLineBatchData
+{
+	std::vector<std::pair<size_t, size_t> > m_Ranges;
+};
+
 struct OverlayRendererInternals
 {
 	typedef boost::unordered_map<QuadBatchKey, QuadBatchData> QuadBatchMap;
+	typedef boost::unordered_map<TexturedLineBatchKey, TexturedLineBatchData> TexturedLineBatchMap;
 
 	OverlayRendererInternals();
 	~OverlayRendererInternals(){ }
@@ -90,6 +128,7 @@ struct OverlayRendererInternals
 	std::vector<SOverlayQuad*> quads;
 
 	QuadBatchMap quadBatchMap;
+	TexturedLineBatchMap texlineBatchMap;
 
 	// Dedicated vertex/index buffers for rendering all quads (to within the limits set by
 	// MAX_QUAD_OVERLAYS).
@@ -99,6 +138,12 @@ struct OverlayRendererInternals
 	VertexArray::Attribute quadAttributeUV;
 	VertexIndexArray quadIndices;
 
+	// Streamed vertex buffer for the billboarded sprites, which are recomputed every frame.
+	// It grows as needed to fit all the sprites.
+	VertexArray spriteVertices;
+	VertexArray::Attribute spriteAttributePos;
+	VertexArray::Attribute spriteAttributeUV;
+
 	/// Maximum amount of quad overlays we support for rendering. This limit is set to be able to 
 	/// render all quads from a single dedicated VB without having to reallocate it, which is much
 	/// faster in the typical case of rendering only a handful of quads. When modifying this value,
@@ -120,7 +165,7 @@ struct OverlayRendererInternals
 const float OverlayRenderer::OVERLAY_VOFFSET = 0.2f;
 
 OverlayRendererInternals::OverlayRendererInternals()
-	: quadVertices(GL_DYNAMIC_DRAW), quadIndices(GL_DYNAMIC_DRAW)
+	: quadVertices(GL_STREAM_DRAW), quadIndices(GL_DYNAMIC_DRAW), spriteVertices(GL_STREAM_DRAW)
 {
 	quadAttributePos.elems = 3;
 	quadAttributePos.type = GL_FLOAT;
@@ -134,12 +179,18 @@ OverlayRendererInternals::OverlayRendererInternals()
 	quadAttributeUV.type = GL_SHORT; // don't use GL_UNSIGNED_SHORT here, TexCoordPointer won't accept it
 	quadVertices.AddAttribute(&quadAttributeUV);
 
+	spriteAttributePos.elems = 3;
+	spriteAttributePos.type = GL_FLOAT;
+	spriteVertices.AddAttribute(&spriteAttributePos);
+
+	spriteAttributeUV.elems = 2;
+	spriteAttributeUV.type = GL_FLOAT;
+	spriteVertices.AddAttribute(&spriteAttributeUV);
+
 	// Note that we're reusing the textured overlay line shader for the quad overlay rendering. This
-	// is because their code is almost identical; the only difference is that for the quad overlays
-	// we want to use a vertex color stream as opposed to an objectColor uniform. To this end, the
-	// shader has been set up to switch between the two behaviours based on the USE_OBJECTCOLOR define.
-	defsOverlayLineNormal.Add("USE_OBJECTCOLOR", "1");
-	defsOverlayLineAlwaysVisible.Add("USE_OBJECTCOLOR", "1");
+	// is because their code is almost identical. Both textured lines and quads store their colour
+	// in a vertex color stream (rather than the objectColor uniform selected by the USE_OBJECTCOLOR
+	// define), so that overlays with different colours can be drawn in a single batch.
 	defsOverlayLineAlwaysVisible.Add("IGNORE_LOS", "1");
 }
 
@@ -180,6 +231,17 @@ static size_t hash_value(const QuadBatchKey& d)
 	return seed;
 }
 
+static size_t hash_value(const TexturedLineBatchKey& d)
+{
+	size_t seed = 0;
+	boost::hash_combine(seed, d.m_TextureBase);
+	boost::hash_combine(seed, d.m_TextureMask);
+	boost::hash_combine(seed, d.m_Vertices);
+	boost::hash_combine(seed, d.m_Indices);
+	boost::hash_combine(seed, d.m_AlwaysVisible);
+	return seed;
+}
+
 OverlayRenderer::OverlayRenderer()
 {
 	m = new OverlayRendererInternals();
@@ -240,6 +302,9 @@ void OverlayRenderer::EndFrame()
 		quadBatchData.m_NumRenderQuads = 0;
 		quadBatchData.m_IndicesBase = 0;
 	}
+
+	// The line batches' keys refer to vertex buffers, which may be freed, so don't keep them
+	m->texlineBatchMap.clear();
 }
 
 void OverlayRenderer::PrepareForRendering()
@@ -261,6 +326,31 @@ void OverlayRenderer::PrepareForRendering()
 			// call Update again. Also we assume the caller won't change
 			// any of the parameters after first submitting the line.
 		}
+
+		CTexturedLineRData* rdata = line->m_RenderData.get();
+		if (!rdata->GetVertices() || !rdata->GetIndices())
+			continue; // might have failed to allocate
+
+		CVertexBuffer::VBChunk* indices = rdata->GetIndices();
+		m->texlineBatchMap[TexturedLineBatchKey(*line)].m_Ranges.push_back(std::make_pair(indices->m_Index, indices->m_Count));
+	}
+
+	// Merge adjacent index ranges, since lines created at the same time are often allocated
+	// contiguously in the buffer
+	for (OverlayRendererInternals::TexturedLineBatchMap::iterator it = m->texlineBatchMap.begin(); it != m->texlineBatchMap.end(); ++it)
+	{
+		std::vector<std::pair<size_t, size_t> >& ranges = it->second.m_Ranges;
+		std::sort(ranges.begin(), ranges.end());
+
+		size_t n = 0;
+		for (size_t i = 1; i < ranges.size(); ++i)
+		{
+			if (ranges[n].first + ranges[n].second == ranges[i].first)
+				ranges[n].second += ranges[i].second;
+			else
+				ranges[++n] = ranges[i];
+		}
+		ranges.resize(n + 1);
 	}
 
 	// Group quad overlays by their texture/mask combination for efficient rendering
@@ -347,13 +437,13 @@ void OverlayRenderer::RenderOverlaysBeforeWater()
 #if CONFIG2_GLES
 #warning TODO: implement OverlayRenderer::RenderOverlaysBeforeWater for GLES
 #else
-	pglActiveTextureARB(GL_TEXTURE0);
+	ogl_ActiveTexture(GL_TEXTURE0);
 	glDisable(GL_TEXTURE_2D);
-	glEnable(GL_BLEND);
+	ogl_Enable(GL_BLEND);
 
 	// Ignore z so that we draw behind terrain (but don't disable GL_DEPTH_TEST
 	// since we still want to write to the z buffer)
-	glDepthFunc(GL_ALWAYS);
+	ogl_DepthFunc(GL_ALWAYS);
 
 	for (size_t i = 0; i < m->lines.size(); ++i)
 	{
@@ -373,8 +463,8 @@ void OverlayRenderer::RenderOverlaysBeforeWater()
 	glDisableClientState(GL_VERTEX_ARRAY);
 
 	glLineWidth(1.f);
-	glDepthFunc(GL_LEQUAL);
-	glDisable(GL_BLEND);
+	ogl_DepthFunc(GL_LEQUAL);
+	ogl_Disable(GL_BLEND);
 #endif
 }
 
@@ -398,8 +488,8 @@ void OverlayRenderer::RenderTexturedOverlayLines()
 	ogl_WarnIfError();
 
 	glEnable(GL_TEXTURE_2D);
-	glEnable(GL_BLEND);
-	glDepthMask(0);
+	ogl_Enable(GL_BLEND);
+	ogl_DepthMask(0);
 
 	const char* shaderName;
 	if (g_Renderer.GetRenderPath() == CRenderer::RP_SHADER)
@@ -450,22 +540,67 @@ void OverlayRenderer::RenderTexturedOverlayLines()
 
 	CVertexBuffer::Unbind();
 
-	glDepthMask(1);
-	glDisable(GL_BLEND);
+	ogl_DepthMask(1);
+	ogl_Disable(GL_BLEND);
 }
 
 void OverlayRenderer::RenderTexturedOverlayLines(CShaderProgramPtr shader, bool alwaysVisible)
 {
-	for (size_t i = 0; i < m->texlines.size(); ++i)
+	const int streamFlags = shader->GetStreamFlags();
+	const GLsizei stride = sizeof(CTexturedLineRData::SVertex);
+
+	std::vector<GLsizei> counts;
+	std::vector<const GLvoid*> offsets;
+
+	for (OverlayRendererInternals::TexturedLineBatchMap::iterator it = m->texlineBatchMap.begin(); it != m->texlineBatchMap.end(); ++it)
 	{
-		SOverlayTexturedLine* line = m->texlines[i];
+		const TexturedLineBatchKey& key = it->first;
 
 		// render only those lines matching the requested alwaysVisible status
-		if (!line->m_RenderData || line->m_AlwaysVisible != alwaysVisible)
+		if (key.m_AlwaysVisible != alwaysVisible)
 			continue;
 
-		ENSURE(line->m_RenderData);
-		line->m_RenderData->Render(*line, shader);
+		const std::vector<std::pair<size_t, size_t> >& ranges = it->second.m_Ranges;
+
+		shader->BindTexture("baseTex", key.m_TextureBase->GetHandle());
+		shader->BindTexture("maskTex", key.m_TextureMask->GetHandle());
+
+		CTexturedLineRData::SVertex* vertexBase = reinterpret_cast<CTexturedLineRData::SVertex*>(key.m_Vertices->Bind());
+
+		if (streamFlags & STREAM_POS)
+			shader->VertexPointer(3, GL_FLOAT, stride, &vertexBase->m_Position[0]);
+
+		if (streamFlags & STREAM_UV0)
+			shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, stride, &vertexBase->m_UVs[0]);
+
+		if (streamFlags & STREAM_UV1)
+			shader->TexCoordPointer(GL_TEXTURE1, 2, GL_FLOAT, stride, &vertexBase->m_UVs[0]);
+
+		if (streamFlags & STREAM_COLOR)
+			shader->ColorPointer(4, GL_UNSIGNED_BYTE, stride, &vertexBase->m_Color);
+
+		u8* indexBase = key.m_Indices->Bind();
+
+		counts.clear();
+		offsets.clear();
+		size_t numIndices = 0;
+		for (size_t i = 0; i < ranges.size(); ++i)
+		{
+			counts.push_back((GLsizei)ranges[i].second);
+			offsets.push_back(indexBase + sizeof(u16)*ranges[i].first);
+			numIndices += ranges[i].second;
+		}
+
+		shader->AssertPointersBound();
+#if CONFIG2_GLES
+		for (size_t i = 0; i < ranges.size(); ++i)
+			glDrawElements(GL_TRIANGLES, counts[i], GL_UNSIGNED_SHORT, offsets[i]);
+#else
+		pglMultiDrawElementsEXT(GL_TRIANGLES, &counts[0], GL_UNSIGNED_SHORT, &offsets[0], (GLsizei)ranges.size());
+#endif
+
+		g_Renderer.GetStats().m_DrawCalls++;
+		g_Renderer.GetStats().m_OverlayTris += numIndices/3;
 	}
 }
 
@@ -477,8 +612,8 @@ void OverlayRenderer::RenderQuadOverlays()
 	ogl_WarnIfError();
 
 	glEnable(GL_TEXTURE_2D);
-	glEnable(GL_BLEND);
-	glDepthMask(0);
+	ogl_Enable(GL_BLEND);
+	ogl_DepthMask(0);
 
 	const char* shaderName;
 	if (g_Renderer.GetRenderPath() == CRenderer::RP_SHADER)
@@ -551,8 +686,19 @@ void OverlayRenderer::RenderQuadOverlays()
 
 	CVertexBuffer::Unbind();
 
-	glDepthMask(1);
-	glDisable(GL_BLEND);
+	ogl_DepthMask(1);
+	ogl_Disable(GL_BLEND);
+}
+
+namespace
+{
+struct SpriteGroupLess
+{
+	bool operator()(const std::pair<size_t, SOverlaySprite*>& a, const std::pair<size_t, SOverlaySprite*>& b) const
+	{
+		return a.first < b.first;
+	}
+};
 }
 
 void OverlayRenderer::RenderForegroundOverlays(const CCamera& viewCamera)
@@ -563,8 +709,8 @@ void OverlayRenderer::RenderForegroundOverlays(const CCamera& viewCamera)
 #warning TODO: implement OverlayRenderer::RenderForegroundOverlays for GLES
 #else
 	glEnable(GL_TEXTURE_2D);
-	glEnable(GL_BLEND);
-	glDisable(GL_DEPTH_TEST);
+	ogl_Enable(GL_BLEND);
+	ogl_Disable(GL_DEPTH_TEST);
 
 	CVector3D right = -viewCamera.m_Orientation.GetLeft();
 	CVector3D up = viewCamera.m_Orientation.GetUp();
@@ -584,39 +730,85 @@ void OverlayRenderer::RenderForegroundOverlays(const CCamera& viewCamera)
 		shader = tech->GetShader();
 	}
 
-	float uvs[8] = { 0,0, 1,0, 1,1, 0,1 };
-	
-	if (g_Renderer.GetRenderPath() == CRenderer::RP_SHADER)
-		shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, sizeof(float)*2, &uvs[0]);
-	else
-		glTexCoordPointer(2, GL_FLOAT, sizeof(float)*2, &uvs);
-
+	// Group the sprites by texture (keeping the order in which each texture was first
+	// submitted), so all the sprites sharing a texture can be drawn with a single call
+	std::vector<std::pair<size_t, SOverlaySprite*> > sorted;
+	sorted.reserve(m->sprites.size());
+	boost::unordered_map<CTexturePtr, size_t> textureGroups;
 	for (size_t i = 0; i < m->sprites.size(); ++i)
 	{
 		SOverlaySprite* sprite = m->sprites[i];
-		
+		size_t group = textureGroups.insert(std::make_pair(sprite->m_Texture, textureGroups.size())).first->second;
+		sorted.push_back(std::make_pair(group, sprite));
+	}
+	std::stable_sort(sorted.begin(), sorted.end(), SpriteGroupLess());
+
+	if (m->spriteVertices.GetNumVertices() < sorted.size()*4)
+	{
+		m->spriteVertices.SetNumVertices(round_up_to_pow2(sorted.size()*4));
+		m->spriteVertices.Layout();
+	}
+
+	VertexArrayIterator<CVector3D> vertexPos = m->spriteAttributePos.GetIterator<CVector3D>();
+	VertexArrayIterator<float[2]> vertexUV = m->spriteAttributeUV.GetIterator<float[2]>();
+	const float uvs[8] = { 0,0, 1,0, 1,1, 0,1 };
+
+	for (size_t i = 0; i < sorted.size(); ++i)
+	{
+		SOverlaySprite* sprite = sorted[i].second;
+
+		*vertexPos++ = sprite->m_Position + right*sprite->m_X0 + up*sprite->m_Y0;
+		*vertexPos++ = sprite->m_Position + right*sprite->m_X1 + up*sprite->m_Y0;
+		*vertexPos++ = sprite->m_Position + right*sprite->m_X1 + up*sprite->m_Y1;
+		*vertexPos++ = sprite->m_Position + right*sprite->m_X0 + up*sprite->m_Y1;
+
+		for (size_t k = 0; k < 4; ++k)
+		{
+			(*vertexUV)[0] = uvs[k*2];
+			(*vertexUV)[1] = uvs[k*2+1];
+			++vertexUV;
+		}
+	}
+
+	if (!sorted.empty())
+	{
+		m->spriteVertices.Upload(sorted.size()*4);
+		u8* base = m->spriteVertices.Bind();
+		GLsizei stride = (GLsizei)m->spriteVertices.GetStride();
+
 		if (g_Renderer.GetRenderPath() == CRenderer::RP_SHADER)
-			shader->BindTexture("baseTex", sprite->m_Texture);
+		{
+			shader->VertexPointer(3, GL_FLOAT, stride, base + m->spriteAttributePos.offset);
+			shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, stride, base + m->spriteAttributeUV.offset);
+		}
 		else
-			sprite->m_Texture->Bind();
+		{
+			glVertexPointer(3, GL_FLOAT, stride, base + m->spriteAttributePos.offset);
+			glTexCoordPointer(2, GL_FLOAT, stride, base + m->spriteAttributeUV.offset);
+		}
+	}
 
-		CVector3D pos[4] = {
-			sprite->m_Position + right*sprite->m_X0 + up*sprite->m_Y0,
-			sprite->m_Position + right*sprite->m_X1 + up*sprite->m_Y0,
-			sprite->m_Position + right*sprite->m_X1 + up*sprite->m_Y1,
-			sprite->m_Position + right*sprite->m_X0 + up*sprite->m_Y1
-		};
+	for (size_t first = 0; first < sorted.size(); )
+	{
+		size_t last = first + 1;
+		while (last < sorted.size() && sorted[last].first == sorted[first].first)
+			++last;
 
+		const CTexturePtr& texture = sorted[first].second->m_Texture;
 		if (g_Renderer.GetRenderPath() == CRenderer::RP_SHADER)
-			shader->VertexPointer(3, GL_FLOAT, sizeof(float)*3, &pos[0].X);
+			shader->BindTexture("baseTex", texture);
 		else
-			glVertexPointer(3, GL_FLOAT, sizeof(float)*3, &pos[0].X);
-		
-		glDrawArrays(GL_QUADS, 0, (GLsizei)4);
+			texture->Bind();
+
+		glDrawArrays(GL_QUADS, (GLint)(first*4), (GLsizei)((last - first)*4));
 
 		g_Renderer.GetStats().m_DrawCalls++;
-		g_Renderer.GetStats().m_OverlayTris += 2;
+		g_Renderer.GetStats().m_OverlayTris += (last - first)*2;
+
+		first = last;
 	}
+
+	CVertexBuffer::Unbind();
 	
 	if (g_Renderer.GetRenderPath() == CRenderer::RP_SHADER)
 		tech->EndPass();
@@ -624,8 +816,8 @@ void OverlayRenderer::RenderForegroundOverlays(const CCamera& viewCamera)
 	glDisableClientState(GL_VERTEX_ARRAY);
 	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 
-	glEnable(GL_DEPTH_TEST);
-	glDisable(GL_BLEND);
+	ogl_Enable(GL_DEPTH_TEST);
+	ogl_Disable(GL_BLEND);
 	glDisable(GL_TEXTURE_2D);
 #endif
 }
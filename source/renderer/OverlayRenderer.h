@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -118,9 +118,9 @@ private:
 	void RenderTexturedOverlayLines();
 
 	/**
-	 * Helper method; renders those overlay lines currently registered in the internals (i.e.
-	 * in m->texlines) for which the 'always visible' flag equals @p alwaysVisible. Used for
-	 * batch rendering the overlay lines according to their alwaysVisible status, as this
+	 * Helper method; renders the batches of overlay lines prepared in PrepareForRendering
+	 * for which the 'always visible' flag equals @p alwaysVisible, with one draw call per batch.
+	 * Used for batch rendering the overlay lines according to their alwaysVisible status, as this
 	 * requires a separate shader to be used.
 	 */
 	void RenderTexturedOverlayLines(CShaderProgramPtr shader, bool alwaysVisible);
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,6 +23,7 @@
 #include "graphics/ShaderManager.h"
 #include "graphics/TextureManager.h"
 #include "ps/Profile.h"
+#include "ps/ThreadPool.h"
 #include "renderer/Renderer.h"
 
 struct ParticleRendererInternals
@@ -32,6 +33,29 @@ struct ParticleRendererInternals
 	std::vector<CParticleEmitter*> emitters;
 };
 
+/**
+ * Fills in the vertex data of one emitter per item. Each emitter only writes
+ * its own arrays, so they can be processed concurrently.
+ */
+class ParticleArrayDataTask : public CThreadPool::ITask
+{
+public:
+	ParticleArrayDataTask(const std::vector<CParticleEmitter*>& emitters) :
+		m_Emitters(emitters)
+	{
+	}
+
+	virtual void Run(size_t index)
+	{
+		m_Emitters[index]->UpdateArrayData();
+	}
+
+private:
+	const std::vector<CParticleEmitter*>& m_Emitters;
+
+	NONCOPYABLE(ParticleArrayDataTask);
+};
+
 ParticleRenderer::ParticleRenderer()
 {
 	m = new ParticleRendererInternals();
@@ -86,18 +110,28 @@ void ParticleRenderer::PrepareForRendering(const CShaderDefines& context)
 		// RenderParticles will never be called so it's safe to leave the shaders as null
 		if (g_Renderer.GetRenderPath() == CRenderer::RP_SHADER)
 		{
-			m->shader = g_Renderer.GetShaderManager().LoadEffect(CStrIntern("particle"), context, CShaderDefines());
-			m->shaderSolid = g_Renderer.GetShaderManager().LoadEffect(CStrIntern("particle_solid"), context, CShaderDefines());
+			m->shader = g_Renderer.GetShaderManager().LoadEffect(str_particle, context, CShaderDefines());
+			m->shaderSolid = g_Renderer.GetShaderManager().LoadEffect(str_particle_solid, context, CShaderDefines());
 		}
 	}
 
 	{
 		PROFILE("update emitters");
+
+		// Spawning particles uses the particle manager's shared RNG, so it
+		// has to be done serially
 		for (size_t i = 0; i < m->emitters.size(); ++i)
-		{
-			CParticleEmitter* emitter = m->emitters[i];
-			emitter->UpdateArrayData();
-		}
+			m->emitters[i]->UpdateParticles();
+
+		ParticleArrayDataTask task(m->emitters);
+		if (g_ThreadPool)
+			g_ThreadPool->ParallelFor(task, m->emitters.size());
+		else
+			for (size_t i = 0; i < m->emitters.size(); ++i)
+				task.Run(i);
+
+		for (size_t i = 0; i < m->emitters.size(); ++i)
+			m->emitters[i]->UploadArrayData();
 	}
 
 	{
@@ -120,8 +154,8 @@ void ParticleRenderer::RenderParticles(bool solidColor)
 	shader->GetShader()->Uniform("transform", g_Renderer.GetViewCamera().GetViewProjection());
 
 	if (!solidColor)
-		glEnable(GL_BLEND);
-	glDepthMask(0);
+		ogl_Enable(GL_BLEND);
+	ogl_DepthMask(0);
 
 	for (size_t i = 0; i < m->emitters.size(); ++i)
 	{
@@ -134,10 +168,10 @@ void ParticleRenderer::RenderParticles(bool solidColor)
 	CVertexBuffer::Unbind();
 
 	pglBlendEquationEXT(GL_FUNC_ADD);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	ogl_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	glDisable(GL_BLEND);
-	glDepthMask(1);
+	ogl_Disable(GL_BLEND);
+	ogl_DepthMask(1);
 
 	shader->EndPass();
 }
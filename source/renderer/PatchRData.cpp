@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -84,46 +84,16 @@ CPatchRData::~CPatchRData()
 	if (m_VBWaterIndices) g_VBMan.Release(m_VBWaterIndices);
 }
 
-/**
- * Represents a blend for a single tile, texture and shape.
- */
-struct STileBlend
+bool STileBlend::DecreasingPriority::operator()(const STileBlend& a, const STileBlend& b) const
 {
-	CTerrainTextureEntry* m_Texture;
-	int m_Priority;
-	u16 m_TileMask; // bit n set if this blend contains neighbour tile BlendOffsets[n]
-
-	struct DecreasingPriority
-	{
-		bool operator()(const STileBlend& a, const STileBlend& b) const
-		{
-			if (a.m_Priority > b.m_Priority)
-				return true;
-			if (a.m_Priority < b.m_Priority)
-				return false;
-			if (a.m_Texture && b.m_Texture)
-				return a.m_Texture->GetTag() > b.m_Texture->GetTag();
-			return false;
-		}
-	};
-
-	struct CurrentTile
-	{
-		bool operator()(const STileBlend& a) const
-		{
-			return (a.m_TileMask & (1 << 8)) != 0;
-		}
-	};
-};
-
-/**
- * Represents the ordered collection of blends drawn on a particular tile.
- */
-struct STileBlendStack
-{
-	u8 i, j;
-	std::vector<STileBlend> blends; // back of vector is lowest-priority texture
-};
+	if (a.m_Priority > b.m_Priority)
+		return true;
+	if (a.m_Priority < b.m_Priority)
+		return false;
+	if (a.m_Texture && b.m_Texture)
+		return a.m_Texture->GetTag() > b.m_Texture->GetTag();
+	return false;
+}
 
 /**
  * Represents a batched collection of blends using the same texture.
@@ -142,7 +112,7 @@ struct SBlendLayer
 
 void CPatchRData::BuildBlends()
 {
-	PROFILE3("build blends");
+	PROFILE3_COUNTERS("build blends");
 
 	m_BlendSplats.clear();
 
@@ -151,13 +121,27 @@ void CPatchRData::BuildBlends()
 
 	CTerrain* terrain = m_Patch->m_Parent;
 
-	std::vector<STileBlendStack> blendStacks;
-	blendStacks.reserve(PATCH_SIZE*PATCH_SIZE);
+	// Work out which tiles' blend stacks need to be recomputed. (The stacks
+	// depend on the textures of each tile's neighbours, so this is everything
+	// the first time, then only tiles near texture changes; height and lighting
+	// changes just need the vertices rebuilding.)
+	ssize_t di0 = 0, dj0 = 0, di1 = 0, dj1 = 0;
+	bool texturesDirty = m_Patch->GetAndClearDirtyTextures(di0, dj0, di1, dj1);
+	if (m_BlendStacks.empty())
+	{
+		m_BlendStacks.resize(PATCH_SIZE*PATCH_SIZE);
+		di0 = dj0 = 0;
+		di1 = dj1 = PATCH_SIZE;
+	}
+	else if (!texturesDirty)
+	{
+		di0 = dj0 = di1 = dj1 = 0;
+	}
 
-	// For each tile in patch ..
-	for (ssize_t j = 0; j < PATCH_SIZE; ++j)
+	// For each dirty tile in patch ..
+	for (ssize_t j = dj0; j < dj1; ++j)
 	{
-		for (ssize_t i = 0; i < PATCH_SIZE; ++i)
+		for (ssize_t i = di0; i < di1; ++i)
 		{
 			ssize_t gx = m_Patch->m_X * PATCH_SIZE + i;
 			ssize_t gz = m_Patch->m_Z * PATCH_SIZE + j;
@@ -185,9 +169,10 @@ void CPatchRData::BuildBlends()
 			// Sort the blends, highest priority first
 			std::sort(blends.begin(), blends.end(), STileBlend::DecreasingPriority());
 
-			STileBlendStack blendStack;
+			STileBlendStack& blendStack = m_BlendStacks[j*PATCH_SIZE + i];
 			blendStack.i = i;
 			blendStack.j = j;
+			blendStack.blends.clear();
 
 			// Put the blends into the tile's stack, merging any adjacent blends with the same texture
 			for (size_t k = 0; k < blends.size(); ++k)
@@ -204,11 +189,12 @@ void CPatchRData::BuildBlends()
 			blendStack.blends.erase(
 				std::find_if(blendStack.blends.begin(), blendStack.blends.end(), STileBlend::CurrentTile()),
 				blendStack.blends.end());
-
-			blendStacks.push_back(blendStack);
 		}
 	}
 
+	// (The layers are built by taking blends off the stacks, so work on a copy)
+	std::vector<STileBlendStack> blendStacks(m_BlendStacks);
+
 	// Given the blend stack per tile, we want to batch together as many blends as possible.
 	// Group them into a series of layers (each of which has a single texture):
 	// (This is effectively a topological sort / linearisation of the partial order induced
@@ -320,9 +306,8 @@ void CPatchRData::AddBlend(std::vector<SBlendVertex>& blendVertices, std::vector
 	ssize_t gz = m_Patch->m_Z * PATCH_SIZE + j;
 
 	// uses the current neighbour texture
-	BlendShape8 shape8;
-	for (size_t m = 0; m < 8; ++m)
-		shape8[m] = (shape & (1 << m)) ? 0 : 1;
+	// (i.e. the shape has the neighbours that aren't part of this blend)
+	u8 shape8 = (u8)~shape;
 
 	// calculate the required alphamap and the required rotation of the alphamap from blendshape
 	unsigned int alphamapflags;
@@ -427,7 +412,7 @@ void CPatchRData::AddBlend(std::vector<SBlendVertex>& blendVertices, std::vector
 
 void CPatchRData::BuildIndices()
 {
-	PROFILE3("build indices");
+	PROFILE3_COUNTERS("build indices");
 
 	CTerrain* terrain = m_Patch->m_Parent;
 
@@ -521,7 +506,7 @@ void CPatchRData::BuildIndices()
 
 void CPatchRData::BuildVertices()
 {
-	PROFILE3("build vertices");
+	PROFILE3_COUNTERS("build vertices");
 
 	// create both vertices and lighting colors
 
@@ -617,7 +602,7 @@ void CPatchRData::BuildSide(std::vector<SSideVertex>& vertices, CPatchSideFlags
 
 void CPatchRData::BuildSides()
 {
-	PROFILE3("build sides");
+	PROFILE3_COUNTERS("build sides");
 
 	std::vector<SSideVertex> sideVertices;
 
@@ -663,14 +648,26 @@ void CPatchRData::Update(CSimulation2* simulation)
 {
 	m_Simulation = simulation;
 	if (m_UpdateFlags!=0) {
-		// TODO,RC 11/04/04 - need to only rebuild necessary bits of renderdata rather
-		// than everything; it's complicated slightly because the blends are dependent
-		// on both vertex and index data
-		BuildVertices();
-		BuildSides();
-		BuildIndices();
-		BuildBlends();
-		BuildWater();
+		// Only rebuild the parts of the render data that depend on what changed:
+		// the base vertices depend on heights and lighting; the sides and water
+		// on heights (and the water level, which also marks the vertices dirty);
+		// the base indices on textures; and the blends on all of them
+		const int vertexFlags = RENDERDATA_UPDATE_VERTICES | RENDERDATA_UPDATE_COLOR;
+
+		if (m_UpdateFlags & vertexFlags)
+			BuildVertices();
+
+		if (m_UpdateFlags & RENDERDATA_UPDATE_VERTICES)
+			BuildSides();
+
+		if (m_UpdateFlags & RENDERDATA_UPDATE_INDICES)
+			BuildIndices();
+
+		if (m_UpdateFlags & (vertexFlags | RENDERDATA_UPDATE_INDICES))
+			BuildBlends();
+
+		if (m_UpdateFlags & RENDERDATA_UPDATE_VERTICES)
+			BuildWater();
 
 		m_UpdateFlags=0;
 	}
@@ -706,7 +703,26 @@ typename M::mapped_type& PooledPairGet(M& m, const typename M::key_type& k, Allo
 	))).first->second;
 }
 
+// Adds a range of indices to a batch. If it immediately follows the previous
+// range in the index buffer (as is common for neighbouring patches, whose
+// chunks are usually allocated consecutively), that range is extended instead,
+// so they can be drawn with a single call.
+template<typename BatchElements>
+static void AddBatchElement(BatchElements& batch, GLint count, u8* indices)
+{
+	if (!batch.first.empty() && (u8*)batch.second.back() + sizeof(u16)*batch.first.back() == indices)
+	{
+		batch.first.back() += count;
+		return;
+	}
+
+	batch.first.push_back(count);
+	batch.second.push_back(indices);
+}
+
 static const size_t ARENA_SIZE = 4*MiB; // this should be enough for fairly huge maps
+// (The batches are allocated from the renderer's per-frame arena when there's
+// enough space left in it, so this is usually not allocated separately)
 
 // Each multidraw batch has a list of index counts, and a list of pointers-to-first-indexes
 typedef std::pair<std::vector<GLint, ProxyAllocator<GLint, Allocators::Arena<> > >, std::vector<void*, ProxyAllocator<void*, Allocators::Arena<> > > > BatchElements;
@@ -723,7 +739,8 @@ typedef POOLED_BATCH_MAP(CTerrainTextureEntry*, VertexBufferBatches) TextureBatc
 void CPatchRData::RenderBases(const std::vector<CPatchRData*>& patches, const CShaderDefines& context, 
 			      ShadowMap* shadow, bool isDummyShader, const CShaderProgramPtr& dummy)
 {
-	Allocators::Arena<> arena(ARENA_SIZE);
+	CFrameArenaScope arenaScope(ARENA_SIZE);
+	Allocators::Arena<>& arena = arenaScope.Get();
 
 	TextureBatches batches (TextureBatches::key_compare(), (TextureBatches::allocator_type(arena)));
 
@@ -745,10 +762,8 @@ void CPatchRData::RenderBases(const std::vector<CPatchRData*>& patches, const CS
 				patch->m_VBBaseIndices->m_Owner, arena
 			);
 
- 			batch.first.push_back(splat.m_IndexCount);
-
  			u8* indexBase = patch->m_VBBaseIndices->m_Owner->GetBindAddress();
- 			batch.second.push_back(indexBase + sizeof(u16)*(patch->m_VBBaseIndices->m_Index + splat.m_IndexStart));
+ 			AddBatchElement(batch, splat.m_IndexCount, indexBase + sizeof(u16)*(patch->m_VBBaseIndices->m_Index + splat.m_IndexStart));
 		}
  	}
 
@@ -900,7 +915,8 @@ struct SBlendStackItem
 void CPatchRData::RenderBlends(const std::vector<CPatchRData*>& patches, const CShaderDefines& context, 
 			      ShadowMap* shadow, bool isDummyShader, const CShaderProgramPtr& dummy)
 {
-	Allocators::Arena<> arena(ARENA_SIZE);
+	CFrameArenaScope arenaScope(ARENA_SIZE);
+	Allocators::Arena<>& arena = arenaScope.Get();
 
 	typedef std::vector<SBlendBatch, ProxyAllocator<SBlendBatch, Allocators::Arena<> > > BatchesStack;
 	BatchesStack batches((BatchesStack::allocator_type(arena)));
@@ -951,10 +967,9 @@ void CPatchRData::RenderBlends(const std::vector<CPatchRData*>& patches, const C
 					CVertexBuffer::VBChunk* indices = blendStacks[k].indices;
 
 					BatchElements& batch = PooledPairGet(PooledMapGet(batches.back().m_Batches, vertices->m_Owner, arena), indices->m_Owner, arena);
-					batch.first.push_back(splats.back().m_IndexCount);
 
 		 			u8* indexBase = indices->m_Owner->GetBindAddress();
-		 			batch.second.push_back(indexBase + sizeof(u16)*(indices->m_Index + splats.back().m_IndexStart));
+		 			AddBatchElement(batch, splats.back().m_IndexCount, indexBase + sizeof(u16)*(indices->m_Index + splats.back().m_IndexStart));
 
 					splats.pop_back();
 				}
@@ -1009,8 +1024,8 @@ void CPatchRData::RenderBlends(const std::vector<CPatchRData*>& patches, const C
 				techBase->BeginPass(pass);
 				TerrainRenderer::PrepareShader(techBase->GetShader(), shadow);
 				
-				glEnable(GL_BLEND);
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+				ogl_Enable(GL_BLEND);
+				ogl_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 			}
 				
 			const CShaderProgramPtr& shader = isDummyShader ? dummy : techBase->GetShader(pass);
@@ -1090,7 +1105,7 @@ void CPatchRData::RenderBlends(const std::vector<CPatchRData*>& patches, const C
 			
 			if (!isDummyShader)
 			{
-				glDisable(GL_BLEND);
+				ogl_Disable(GL_BLEND);
 				techBase->EndPass();
 			}
 		}
@@ -1130,10 +1145,8 @@ void CPatchRData::RenderStreams(const std::vector<CPatchRData*>& patches, const
  		CPatchRData* patch = patches[i];
 		BatchElements& batch = batches[patch->m_VBBase->m_Owner][patch->m_VBBaseIndices->m_Owner];
 
-		batch.first.push_back(patch->m_VBBaseIndices->m_Count);
-
 		u8* indexBase = patch->m_VBBaseIndices->m_Owner->GetBindAddress();
- 		batch.second.push_back(indexBase + sizeof(u16)*(patch->m_VBBaseIndices->m_Index));
+ 		AddBatchElement(batch, patch->m_VBBaseIndices->m_Count, indexBase + sizeof(u16)*(patch->m_VBBaseIndices->m_Index));
  	}
 
  	PROFILE_END("compute batches");
@@ -1275,7 +1288,7 @@ void CPatchRData::RenderPriorities(CTextRenderer& textRenderer)
 // Build vertex buffer for water vertices over our patch
 void CPatchRData::BuildWater()
 {
-	PROFILE3("build water");
+	PROFILE3_COUNTERS("build water");
 
 	// number of vertices in each direction in each patch
 	ENSURE((PATCH_SIZE % water_cell_size) == 0);
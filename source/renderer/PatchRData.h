@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -31,6 +31,38 @@ class CSimulation2;
 class CTerrainTextureEntry;
 class CTextRenderer;
 
+/**
+ * Represents a blend for a single tile, texture and shape.
+ */
+struct STileBlend
+{
+	CTerrainTextureEntry* m_Texture;
+	int m_Priority;
+	u16 m_TileMask; // bit n set if this blend contains neighbour tile BlendOffsets[n]
+
+	struct DecreasingPriority
+	{
+		bool operator()(const STileBlend& a, const STileBlend& b) const;
+	};
+
+	struct CurrentTile
+	{
+		bool operator()(const STileBlend& a) const
+		{
+			return (a.m_TileMask & (1 << 8)) != 0;
+		}
+	};
+};
+
+/**
+ * Represents the ordered collection of blends drawn on a particular tile.
+ */
+struct STileBlendStack
+{
+	u8 i, j;
+	std::vector<STileBlend> blends; // back of vector is lowest-priority texture
+};
+
 //////////////////////////////////////////////////////////////////////////////////////////////////
 // CPatchRData: class encapsulating logic for rendering terrain patches; holds per
 // patch data, plus some supporting static functions for batching, etc
@@ -149,6 +181,10 @@ private:
 	// splats used in blend pass
 	std::vector<SSplat> m_BlendSplats;
 
+	// blend stack of each tile, indexed by j*PATCH_SIZE+i (empty until the first BuildBlends),
+	// kept so only the tiles whose textures have changed need their stacks recomputing
+	std::vector<STileBlendStack> m_BlendStacks;
+
 	// boundary of water in this patch
 	CBoundingBoxAligned m_WaterBounds;
 
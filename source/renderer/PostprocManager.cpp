@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -38,7 +38,8 @@
 CPostprocManager::CPostprocManager()
 	: m_IsInitialised(false), m_PingFbo(0), m_PongFbo(0), m_PostProcEffect(L"default"), m_ColourTex1(0), m_ColourTex2(0), 
 	  m_DepthTex(0), m_BloomFbo(0), m_BlurTex2a(0), m_BlurTex2b(0), m_BlurTex4a(0), m_BlurTex4b(0),
-	  m_BlurTex8a(0), m_BlurTex8b(0), m_WhichBuffer(true)
+	  m_BlurTex8a(0), m_BlurTex8b(0), m_ScaledFbo(0), m_ScaledTex2a(0), m_ScaledTex2b(0),
+	  m_ScaledTex4a(0), m_ScaledTex4b(0), m_WhichBuffer(true), m_InputTex(0)
 {
 }
 
@@ -62,20 +63,27 @@ void CPostprocManager::Cleanup()
 		if (m_PingFbo) pglDeleteFramebuffersEXT(1, &m_PingFbo);
 		if (m_PongFbo) pglDeleteFramebuffersEXT(1, &m_PongFbo);
 		if (m_BloomFbo) pglDeleteFramebuffersEXT(1, &m_BloomFbo);
-		m_PingFbo = m_PongFbo = m_BloomFbo = 0;
+		if (m_ScaledFbo) pglDeleteFramebuffersEXT(1, &m_ScaledFbo);
+		m_PingFbo = m_PongFbo = m_BloomFbo = m_ScaledFbo = 0;
 		
-		if (m_ColourTex1) glDeleteTextures(1, &m_ColourTex1);
-		if (m_ColourTex2) glDeleteTextures(1, &m_ColourTex2);
-		if (m_DepthTex) glDeleteTextures(1, &m_DepthTex);
+		if (m_ColourTex1) ogl_DeleteTextures(1, &m_ColourTex1);
+		if (m_ColourTex2) ogl_DeleteTextures(1, &m_ColourTex2);
+		if (m_DepthTex) ogl_DeleteTextures(1, &m_DepthTex);
 		m_ColourTex1 = m_ColourTex2 = m_DepthTex = 0;
 		
-		if (m_BlurTex2a) glDeleteTextures(1, &m_BlurTex2a);
-		if (m_BlurTex2b) glDeleteTextures(1, &m_BlurTex2b);
-		if (m_BlurTex4a) glDeleteTextures(1, &m_BlurTex4a);
-		if (m_BlurTex4b) glDeleteTextures(1, &m_BlurTex4b);
-		if (m_BlurTex8a) glDeleteTextures(1, &m_BlurTex8a);
-		if (m_BlurTex8b) glDeleteTextures(1, &m_BlurTex8b);
+		if (m_BlurTex2a) ogl_DeleteTextures(1, &m_BlurTex2a);
+		if (m_BlurTex2b) ogl_DeleteTextures(1, &m_BlurTex2b);
+		if (m_BlurTex4a) ogl_DeleteTextures(1, &m_BlurTex4a);
+		if (m_BlurTex4b) ogl_DeleteTextures(1, &m_BlurTex4b);
+		if (m_BlurTex8a) ogl_DeleteTextures(1, &m_BlurTex8a);
+		if (m_BlurTex8b) ogl_DeleteTextures(1, &m_BlurTex8b);
 		m_BlurTex2a = m_BlurTex2b = m_BlurTex4a = m_BlurTex4b = m_BlurTex8a = m_BlurTex8b = 0;
+		
+		if (m_ScaledTex2a) ogl_DeleteTextures(1, &m_ScaledTex2a);
+		if (m_ScaledTex2b) ogl_DeleteTextures(1, &m_ScaledTex2b);
+		if (m_ScaledTex4a) ogl_DeleteTextures(1, &m_ScaledTex4a);
+		if (m_ScaledTex4b) ogl_DeleteTextures(1, &m_ScaledTex4b);
+		m_ScaledTex2a = m_ScaledTex2b = m_ScaledTex4a = m_ScaledTex4b = 0;
 	}
 }
 
@@ -88,7 +96,7 @@ void CPostprocManager::RecreateBuffers()
 	
 	#define GEN_BUFFER_RGBA(name, w, h) \
 		glGenTextures(1, (GLuint*)&name); \
-		glBindTexture(GL_TEXTURE_2D, name); \
+		ogl_BindTexture(GL_TEXTURE_2D, name); \
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, \
 			GL_UNSIGNED_BYTE, 0); \
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); \
@@ -113,11 +121,18 @@ void CPostprocManager::RecreateBuffers()
 	GEN_BUFFER_RGBA(m_BlurTex8a, m_Width / 8, m_Height / 8);
 	GEN_BUFFER_RGBA(m_BlurTex8b, m_Width / 8, m_Height / 8);
 	
+	// Ping-pong textures for the effect passes that render at reduced size.
+	GEN_BUFFER_RGBA(m_ScaledTex2a, m_Width / 2, m_Height / 2);
+	GEN_BUFFER_RGBA(m_ScaledTex2b, m_Width / 2, m_Height / 2);
+	
+	GEN_BUFFER_RGBA(m_ScaledTex4a, m_Width / 4, m_Height / 4);
+	GEN_BUFFER_RGBA(m_ScaledTex4b, m_Width / 4, m_Height / 4);
+	
 	#undef GEN_BUFFER_RGBA
 	
 	// Allocate the Depth/Stencil texture.
 	glGenTextures(1, (GLuint*)&m_DepthTex);
-	glBindTexture(GL_TEXTURE_2D, m_DepthTex);
+	ogl_BindTexture(GL_TEXTURE_2D, m_DepthTex);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, m_Width, m_Height,
 		      0, GL_DEPTH_STENCIL_EXT, GL_UNSIGNED_INT_24_8, 0);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE,
@@ -127,7 +142,7 @@ void CPostprocManager::RecreateBuffers()
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	
-	glBindTexture(GL_TEXTURE_2D, 0);
+	ogl_BindTexture(GL_TEXTURE_2D, 0);
 
 	// Set up the framebuffers with some initial textures.
 	
@@ -162,54 +177,15 @@ void CPostprocManager::RecreateBuffers()
 	{
 		LOGWARNING(L"Framebuffer object incomplete (B): 0x%04X", status);
 	}*/
+	
+	// The scaled textures are attached to this when they are rendered to.
+	pglGenFramebuffersEXT(1, &m_ScaledFbo);
 
 	pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
 }
 
 
-void CPostprocManager::ApplyBlurDownscale2x(GLuint inTex, GLuint outTex, int inWidth, int inHeight)
-{
-	// Bind inTex to framebuffer for rendering.
-	pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, m_BloomFbo);
-	pglFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, outTex, 0);
-	
-	// Get bloom shader with instructions to simply copy texels.
-	CShaderDefines defines;
-	defines.Add("BLOOM_NOP", "1");
-	CShaderTechniquePtr tech = g_Renderer.GetShaderManager().LoadEffect(CStrIntern("bloom"),
-			g_Renderer.GetSystemShaderDefines(), defines);
-	
-	tech->BeginPass();
-	CShaderProgramPtr shader = tech->GetShader();
-	
-	GLuint renderedTex = inTex;
-	
-	// Cheat by creating high quality mipmaps for inTex, so the copying operation actually
-	// produces good scaling due to hardware filtering.
-	glBindTexture(GL_TEXTURE_2D, renderedTex);
-	pglGenerateMipmapEXT(GL_TEXTURE_2D);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	
-	shader->BindTexture("renderedTex", renderedTex);
-	
-	glPushAttrib(GL_VIEWPORT_BIT); 
-	glViewport(0, 0, inWidth / 2, inHeight / 2);
-	
-	glBegin(GL_QUADS);
-	    glColor4f(1.f, 1.f, 1.f, 1.f);
-	    glTexCoord2f(1.0, 1.0);	glVertex2f(1,1);
-	    glTexCoord2f(0.0, 1.0);	glVertex2f(-1,1);	    
-	    glTexCoord2f(0.0, 0.0);	glVertex2f(-1,-1);
-	    glTexCoord2f(1.0, 0.0);	glVertex2f(1,-1);
-	glEnd();
-	
-	glPopAttrib(); 
-	tech->EndPass();
-}
-
-void CPostprocManager::ApplyBlurGauss(GLuint inOutTex, GLuint tempTex, int inWidth, int inHeight)
+void CPostprocManager::ApplyBlurGauss(GLuint inTex, GLuint tempTex, GLuint outTex, int outWidth, int outHeight)
 {
 	// Set tempTex as our rendering target.
 	pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, m_BloomFbo);
@@ -218,16 +194,20 @@ void CPostprocManager::ApplyBlurGauss(GLuint inOutTex, GLuint tempTex, int inWid
 	// Get bloom shader, for a horizontal Gaussian blur pass.
 	CShaderDefines defines2;
 	defines2.Add("BLOOM_PASS_H", "1");
-	CShaderTechniquePtr tech = g_Renderer.GetShaderManager().LoadEffect(CStrIntern("bloom"),
+	CShaderTechniquePtr tech = g_Renderer.GetShaderManager().LoadEffect(str_bloom,
 			g_Renderer.GetSystemShaderDefines(), defines2);
 	
 	tech->BeginPass();
 	CShaderProgramPtr shader = tech->GetShader();
-	shader->BindTexture("renderedTex", inOutTex);
-	shader->Uniform("texSize", inWidth, inHeight, 0.0f, 0.0f);
+	
+	// The input is twice the size of the output. Each output texel's centre lies
+	// on the corner between 4 texels of inTex, so (as long as inTex isn't mipmapped)
+	// the bilinear samples give the same result as a 2x2 box-filtered copy would.
+	shader->BindTexture("renderedTex", inTex);
+	shader->Uniform("texSize", outWidth, outHeight, 0.0f, 0.0f);
 	
 	glPushAttrib(GL_VIEWPORT_BIT); 
-	glViewport(0, 0, inWidth, inHeight);
+	glViewport(0, 0, outWidth, outHeight);
 	
 	glBegin(GL_QUADS);
 	    glColor4f(1.f, 1.f, 1.f, 1.f);
@@ -242,12 +222,12 @@ void CPostprocManager::ApplyBlurGauss(GLuint inOutTex, GLuint tempTex, int inWid
 	
 	// Set result texture as our render target.
 	pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, m_BloomFbo);
-	pglFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, inOutTex, 0);
+	pglFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, outTex, 0);
 	
 	// Get bloom shader, for a vertical Gaussian blur pass.
 	CShaderDefines defines3;
 	defines3.Add("BLOOM_PASS_V", "1");
-	tech = g_Renderer.GetShaderManager().LoadEffect(CStrIntern("bloom"),
+	tech = g_Renderer.GetShaderManager().LoadEffect(str_bloom,
 			g_Renderer.GetSystemShaderDefines(), defines3);
 	
 	tech->BeginPass();
@@ -255,10 +235,10 @@ void CPostprocManager::ApplyBlurGauss(GLuint inOutTex, GLuint tempTex, int inWid
 	
 	// Our input texture to the shader is the output of the horizontal pass.
 	shader->BindTexture("renderedTex", tempTex);
-	shader->Uniform("texSize", inWidth, inHeight, 0.0f, 0.0f);
+	shader->Uniform("texSize", outWidth, outHeight, 0.0f, 0.0f);
 	
 	glPushAttrib(GL_VIEWPORT_BIT); 
-	glViewport(0, 0, inWidth, inHeight);
+	glViewport(0, 0, outWidth, outHeight);
 	
 	glBegin(GL_QUADS);
 	    glColor4f(1.f, 1.f, 1.f, 1.f);
@@ -272,31 +252,45 @@ void CPostprocManager::ApplyBlurGauss(GLuint inOutTex, GLuint tempTex, int inWid
 	tech->EndPass();
 }
 
-void CPostprocManager::ApplyBlur()
+void CPostprocManager::ApplyBlur(int numLevels)
 {
-	glDisable(GL_BLEND);
+	if (numLevels <= 0)
+		return;
+	
+	ogl_Disable(GL_BLEND);
 	
 	GLint originalFBO;
 	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &originalFBO);
 	
-	int width = m_Width, height = m_Height;
-	
-	#define SCALE_AND_BLUR(tex1, tex2, temptex) \
-		ApplyBlurDownscale2x(tex1, tex2, width, height); \
-		width /= 2; \
-		height /= 2; \
-		ApplyBlurGauss(tex2, temptex, width, height); 
-	
-	// We do the same thing for each scale, incrementally adding more and more blur.
-	SCALE_AND_BLUR(m_WhichBuffer ? m_ColourTex1 : m_ColourTex2, m_BlurTex2a, m_BlurTex2b);
-	SCALE_AND_BLUR(m_BlurTex2a, m_BlurTex4a, m_BlurTex4b);
-	SCALE_AND_BLUR(m_BlurTex4a, m_BlurTex8a, m_BlurTex8b);
-	
-	#undef SCALE_AND_BLUR
+	// We do the same thing for each scale, incrementally adding more and more blur,
+	// starting each level from the previous (smaller) one rather than from the screen.
+	ApplyBlurGauss(m_WhichBuffer ? m_ColourTex1 : m_ColourTex2, m_BlurTex2b, m_BlurTex2a, m_Width / 2, m_Height / 2);
+	if (numLevels >= 2)
+		ApplyBlurGauss(m_BlurTex2a, m_BlurTex4b, m_BlurTex4a, m_Width / 4, m_Height / 4);
+	if (numLevels >= 3)
+		ApplyBlurGauss(m_BlurTex4a, m_BlurTex8b, m_BlurTex8a, m_Width / 8, m_Height / 8);
 	
 	pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, originalFBO);
 }
 
+int CPostprocManager::GetNumBlurLevels()
+{
+	// Effects can be hot-reloaded, so this is checked every frame rather than
+	// when the effect is loaded; it's only a few lookups per pass.
+	int numLevels = 0;
+	for (int pass = 0; pass < m_PostProcTech->GetNumPasses(); ++pass)
+	{
+		const CShaderProgramPtr& shader = m_PostProcTech->GetShader(pass);
+		if (shader->GetTextureBinding("blurTex8").Active())
+			numLevels = std::max(numLevels, 3);
+		else if (shader->GetTextureBinding("blurTex4").Active())
+			numLevels = std::max(numLevels, 2);
+		else if (shader->GetTextureBinding("blurTex2").Active())
+			numLevels = std::max(numLevels, 1);
+	}
+	return numLevels;
+}
+
 
 void CPostprocManager::CaptureRenderOutput()
 {
@@ -351,29 +345,58 @@ void CPostprocManager::LoadEffect(CStrW &name)
 }
 
 
-void CPostprocManager::ApplyEffect(CShaderTechniquePtr &shaderTech1, int pass)
+void CPostprocManager::ApplyEffect(CShaderTechniquePtr &shaderTech1, int pass, int downscale)
 {
-	// select the other FBO for rendering
-	if (!m_WhichBuffer)
-		pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, m_PingFbo);
+	GLuint outputTex;
+	int width = m_Width, height = m_Height;
+	
+	if (downscale == 1)
+	{
+		// select the other FBO for rendering
+		if (!m_WhichBuffer)
+		{
+			pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, m_PingFbo);
+			outputTex = m_ColourTex1;
+		}
+		else
+		{
+			pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, m_PongFbo);
+			outputTex = m_ColourTex2;
+		}
+		
+		m_WhichBuffer = !m_WhichBuffer;
+	}
 	else
-		pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, m_PongFbo);
+	{
+		// render into whichever of the scaled textures isn't our input
+		// (the fullscreen buffers are left as they are)
+		GLuint texA = (downscale == 2 ? m_ScaledTex2a : m_ScaledTex4a);
+		GLuint texB = (downscale == 2 ? m_ScaledTex2b : m_ScaledTex4b);
+		outputTex = (m_InputTex == texA ? texB : texA);
+		
+		pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, m_ScaledFbo);
+		pglFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, outputTex, 0);
+		
+		width /= downscale;
+		height /= downscale;
+	}
+	
+	glPushAttrib(GL_VIEWPORT_BIT); 
+	glViewport(0, 0, width, height);
 	
-	glDisable(GL_DEPTH_TEST);
-	glDepthMask(GL_FALSE);
+	ogl_Disable(GL_DEPTH_TEST);
+	ogl_DepthMask(GL_FALSE);
 
 	shaderTech1->BeginPass(pass);
 	CShaderProgramPtr shader = shaderTech1->GetShader(pass);
 	
 	shader->Bind();
 	
-	// Use the textures from the current FBO as input to the shader.
+	// Use the output of the previous pass as input to the shader (it's sampled
+	// with linear filtering, so it doesn't matter if it's a different size).
 	// We also bind a bunch of other textures and parameters, but since
 	// this only happens once per frame the overhead is negligible.
-	if (m_WhichBuffer)
-		shader->BindTexture("renderedTex", m_ColourTex1);
-	else
-		shader->BindTexture("renderedTex", m_ColourTex2);
+	shader->BindTexture("renderedTex", m_InputTex);
 	
 	shader->BindTexture("depthTex", m_DepthTex);
 	
@@ -381,8 +404,8 @@ void CPostprocManager::ApplyEffect(CShaderTechniquePtr &shaderTech1, int pass)
 	shader->BindTexture("blurTex4", m_BlurTex4a);
 	shader->BindTexture("blurTex8", m_BlurTex8a);
 	
-	shader->Uniform("width", m_Width);
-	shader->Uniform("height", m_Height);
+	shader->Uniform("width", width);
+	shader->Uniform("height", height);
 	shader->Uniform("zNear", g_Game->GetView()->GetNear());
 	shader->Uniform("zFar", g_Game->GetView()->GetFar());
 	
@@ -403,10 +426,12 @@ void CPostprocManager::ApplyEffect(CShaderTechniquePtr &shaderTech1, int pass)
 	
 	shaderTech1->EndPass(pass);	
 		
-	glDepthMask(GL_TRUE);
-	glEnable(GL_DEPTH_TEST);
+	ogl_DepthMask(GL_TRUE);
+	ogl_Enable(GL_DEPTH_TEST);
 	
-	m_WhichBuffer = !m_WhichBuffer;
+	glPopAttrib();
+	
+	m_InputTex = outputTex;
 }
 
 void CPostprocManager::ApplyPostproc()
@@ -438,11 +463,17 @@ void CPostprocManager::ApplyPostproc()
 	
 	// First render blur textures. Note that this only happens ONLY ONCE, before any effects are applied!
 	// (This may need to change depending on future usage, however that will have a fps hit)
-	ApplyBlur(); 
-
-	for (int pass = 0; pass < m_PostProcTech->GetNumPasses(); ++pass)
+	// The blur levels are shared by all passes, and skipped entirely if no pass samples them.
+	ApplyBlur(GetNumBlurLevels());
+	
+	m_InputTex = (m_WhichBuffer ? m_ColourTex1 : m_ColourTex2);
+	
+	const int numPasses = m_PostProcTech->GetNumPasses();
+	for (int pass = 0; pass < numPasses; ++pass)
 	{
-		ApplyEffect(m_PostProcTech, pass);
+		// The final result has to end up in one of the fullscreen buffers
+		int downscale = (pass == numPasses - 1 ? 1 : m_PostProcTech->GetDownscale(pass));
+		ApplyEffect(m_PostProcTech, pass, downscale);
 	}
 	
 	pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, m_PongFbo);
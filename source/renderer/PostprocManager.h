@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -37,9 +37,17 @@ private:
 	// A framebuffer and textures x2 for each blur level we render. 
 	GLuint m_BloomFbo, m_BlurTex2a, m_BlurTex2b, m_BlurTex4a, m_BlurTex4b, m_BlurTex8a, m_BlurTex8b;
 	
+	// A framebuffer and ping-pong textures at half and quarter size, for effect passes
+	// with a downscale factor (see CShaderPass::SetDownscale).
+	GLuint m_ScaledFbo, m_ScaledTex2a, m_ScaledTex2b, m_ScaledTex4a, m_ScaledTex4b;
+	
 	// Indicates which of the ping-pong buffers is used for reading and which for drawing.
 	bool m_WhichBuffer;
 	
+	// The texture holding the output of the previous effect pass (either one of the
+	// fullscreen colour textures or one of the scaled ones).
+	GLuint m_InputTex;
+	
 	// The name and shader technique we are using. "default" name means no technique is used
 	// (i.e. while we do allocate the buffers, no effects are rendered).
 	CStrW m_PostProcEffect;
@@ -51,23 +59,27 @@ private:
 	// Is the postproc manager initialised? Buffers created? Default effect loaded?
 	bool m_IsInitialised;
 	
-	// Creates blur textures at various scales, for bloom, DOF, etc.
-	void ApplyBlur();
-	
-	// High quality GPU image scaling to half size. outTex must have exactly half the size
-	// of inTex. inWidth and inHeight are the dimensions of inTex in texels.
-	void ApplyBlurDownscale2x(GLuint inTex, GLuint outTex, int inWidth, int inHeight);
-	
-	// GPU-based Gaussian blur in two passes. inOutTex contains the input image and will be filled 
-	// with the blurred image. tempTex must have the same size as inOutTex. 
-	// inWidth and inHeight are the dimensions of the images in texels.
-	void ApplyBlurGauss(GLuint inOutTex, GLuint tempTex, int inWidth, int inHeight);
-	
-	// Applies a pass of a given effect to the entire current framebuffer. The shader is 
-	// provided with a number of general-purpose variables, including the rendered screen so far,
-	// the depth buffer, a number of blur textures, the screen size, the zNear/zFar planes and
+	// Creates blur textures at various scales, for bloom, DOF, etc. Each level is
+	// made from the previous one, and only the first numLevels levels (up to 3, i.e.
+	// blurTex2, blurTex4 and blurTex8) are rendered.
+	void ApplyBlur(int numLevels);
+	
+	// GPU-based Gaussian blur in two passes, which also scales inTex to half size:
+	// the horizontal pass reads inTex directly, relying on linear filtering to
+	// average each 2x2 block of texels, so no separate downscaling pass is needed.
+	// tempTex and outTex must have exactly half the size of inTex.
+	// outWidth and outHeight are the dimensions of outTex in texels.
+	void ApplyBlurGauss(GLuint inTex, GLuint tempTex, GLuint outTex, int outWidth, int outHeight);
+	
+	// Returns how many blur levels are used by the current effect's shaders.
+	int GetNumBlurLevels();
+	
+	// Applies a pass of a given effect to the entire current framebuffer, or to a
+	// half/quarter size one if downscale is 2 or 4. The shader is provided with a number
+	// of general-purpose variables, including the rendered screen so far, the depth buffer,
+	// a number of blur textures, the size of the render target, the zNear/zFar planes and
 	// some other parameters used by the optional bloom/HDR pass.
-	void ApplyEffect(CShaderTechniquePtr &shaderTech1, int pass);
+	void ApplyEffect(CShaderTechniquePtr &shaderTech1, int pass, int downscale);
 	
 public:
 	CPostprocManager();
@@ -102,8 +114,9 @@ public:
 	// to our textures instead of directly to the system framebuffer. 
 	void CaptureRenderOutput();
 	
-	// First renders blur textures, then calls ApplyEffect for each effect pass, 
-	// ping-ponging the buffers at each step.
+	// First renders the blur textures the effect needs, then calls ApplyEffect for each
+	// effect pass, ping-ponging the buffers at each step. The last pass is always
+	// rendered at full size.
 	void ApplyPostproc();
 	
 	// Blits the final postprocessed texture to the system framebuffer. The system framebuffer
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -43,6 +43,7 @@
 #include "ps/World.h"
 #include "ps/Loader.h"
 #include "ps/ProfileViewer.h"
+#include "ps/ThreadPool.h"
 #include "graphics/Camera.h"
 #include "graphics/GameView.h"
 #include "graphics/LightEnv.h"
@@ -51,6 +52,7 @@
 #include "graphics/Model.h"
 #include "graphics/ModelDef.h"
 #include "graphics/ParticleManager.h"
+#include "graphics/Patch.h"
 #include "graphics/ShaderManager.h"
 #include "graphics/Terrain.h"
 #include "graphics/Texture.h"
@@ -110,12 +112,20 @@ private:
 		Row_OverlayTris,
 		Row_BlendSplats,
 		Row_Particles,
+		Row_ModelsOccluded,
 		Row_VBReserved,
 		Row_VBAllocated,
+		Row_VBFragmented,
 		Row_ShadersLoaded,
+		Row_TexturesUploaded,
+		Row_TexturesBudget,
+		Row_TexturesReduced,
+		// One row per CRenderer::StatePass for each of these
+		Row_StateChanges,
+		Row_PassDrawCalls = Row_StateChanges + CRenderer::NUM_STATE_PASSES,
 
 		// Must be last to count number of rows
-		NumberRows
+		NumberRows = Row_PassDrawCalls + CRenderer::NUM_STATE_PASSES
 	};
 };
 
@@ -196,6 +206,12 @@ CStr CRendererStatsTable::GetCellText(size_t row, size_t col)
 		sprintf_s(buf, sizeof(buf), "%lu", (unsigned long)Stats.m_Particles);
 		return buf;
 
+	case Row_ModelsOccluded:
+		if (col == 0)
+			return "# models occluded";
+		sprintf_s(buf, sizeof(buf), "%lu", (unsigned long)Stats.m_ModelsOccluded);
+		return buf;
+
 	case Row_VBReserved:
 		if (col == 0)
 			return "VB bytes reserved";
@@ -208,13 +224,61 @@ CStr CRendererStatsTable::GetCellText(size_t row, size_t col)
 		sprintf_s(buf, sizeof(buf), "%lu", (unsigned long)g_VBMan.GetBytesAllocated());
 		return buf;
 
+	case Row_VBFragmented:
+		if (col == 0)
+			return "VB bytes fragmented";
+		sprintf_s(buf, sizeof(buf), "%lu", (unsigned long)g_VBMan.GetBytesFragmented());
+		return buf;
+
 	case Row_ShadersLoaded:
 		if (col == 0)
 			return "shader effects loaded";
 		sprintf_s(buf, sizeof(buf), "%lu", (unsigned long)g_Renderer.GetShaderManager().GetNumEffectsLoaded());
 		return buf;
 
+	case Row_TexturesUploaded:
+		if (col == 0)
+			return "texture bytes uploaded";
+		sprintf_s(buf, sizeof(buf), "%lu", (unsigned long)g_Renderer.GetTextureManager().GetBytesUploaded());
+		return buf;
+
+	case Row_TexturesBudget:
+		if (col == 0)
+			return "texture bytes budget";
+		sprintf_s(buf, sizeof(buf), "%lu", (unsigned long)g_Renderer.GetTextureManager().GetBytesBudget());
+		return buf;
+
+	case Row_TexturesReduced:
+		if (col == 0)
+			return "# textures reduced";
+		sprintf_s(buf, sizeof(buf), "%lu", (unsigned long)g_Renderer.GetTextureManager().GetNumReducedTextures());
+		return buf;
+
 	default:
+		if (row >= Row_StateChanges && row < Row_PassDrawCalls)
+		{
+			const CRenderer::StatePass pass = (CRenderer::StatePass)(row - Row_StateChanges);
+			if (col == 0)
+			{
+				sprintf_s(buf, sizeof(buf), "GL state changes (%s)", CRenderer::GetStatePassName(pass));
+				return buf;
+			}
+			sprintf_s(buf, sizeof(buf), "%lu (%lu skipped)",
+				(unsigned long)Stats.m_StateChanges[pass], (unsigned long)Stats.m_StateChangesFiltered[pass]);
+			return buf;
+		}
+		if (row >= Row_PassDrawCalls && row < NumberRows)
+		{
+			const CRenderer::StatePass pass = (CRenderer::StatePass)(row - Row_PassDrawCalls);
+			if (col == 0)
+			{
+				sprintf_s(buf, sizeof(buf), "# draw calls (%s)", CRenderer::GetStatePassName(pass));
+				return buf;
+			}
+			sprintf_s(buf, sizeof(buf), "%lu (%lu tris)",
+				(unsigned long)Stats.m_PassDrawCalls[pass], (unsigned long)Stats.m_PassTris[pass]);
+			return buf;
+		}
 		return "???";
 	}
 }
@@ -228,6 +292,61 @@ AbstractProfileTable* CRendererStatsTable::GetChild(size_t UNUSED(row))
 ///////////////////////////////////////////////////////////////////////////////////
 // CRenderer implementation
 
+// Size of the per-frame arena (see CRenderer::GetFrameArena)
+static const size_t FRAME_ARENA_SIZE = 16*MiB;
+
+const char* CRenderer::GetStatePassName(StatePass pass)
+{
+	static const char* const passNames[NUM_STATE_PASSES] = {
+		"shadows", "terrain", "terrain blends", "models", "transparent", "water",
+		"reflections", "refractions", "overlays", "particles", "postproc", "gui"
+	};
+	return passNames[pass];
+}
+
+// The innermost active counter (they're only used in the main thread)
+static CRenderPassCounter* g_CurrentPassCounter = NULL;
+
+CRenderPassCounter::CRenderPassCounter(CRenderer::StatePass pass) :
+	m_Pass(pass), m_Parent(g_CurrentPassCounter)
+{
+	if (m_Parent)
+		m_Parent->Stop();
+	g_CurrentPassCounter = this;
+
+	g_Profiler2.RecordGPURegionEnter(CRenderer::GetStatePassName(m_Pass));
+	Start();
+}
+
+CRenderPassCounter::~CRenderPassCounter()
+{
+	Stop();
+	g_Profiler2.RecordGPURegionLeave(CRenderer::GetStatePassName(m_Pass));
+
+	g_CurrentPassCounter = m_Parent;
+	if (m_Parent)
+		m_Parent->Start();
+}
+
+void CRenderPassCounter::Start()
+{
+	const CRenderer::Stats& stats = g_Renderer.GetStats();
+	ogl_GetStateCacheStats(m_Changes, m_Filtered);
+	m_DrawCalls = stats.m_DrawCalls;
+	m_Tris = stats.GetTotalTris();
+}
+
+void CRenderPassCounter::Stop()
+{
+	CRenderer::Stats& stats = g_Renderer.GetStats();
+	size_t changes, filtered;
+	ogl_GetStateCacheStats(changes, filtered);
+	stats.m_StateChanges[m_Pass] += changes - m_Changes;
+	stats.m_StateChangesFiltered[m_Pass] += filtered - m_Filtered;
+	stats.m_PassDrawCalls[m_Pass] += stats.m_DrawCalls - m_DrawCalls;
+	stats.m_PassTris[m_Pass] += stats.GetTotalTris() - m_Tris;
+}
+
 /**
  * Struct CRendererInternals: Truly hide data that is supposed to be hidden
  * in this structure so it won't even appear in header files.
@@ -315,8 +434,34 @@ public:
 
 	CShaderDefines globalContext;
 
+	/// Models (and their bounds) queued by SubmitRecursiveCulled, to be tested
+	/// against culledFrustum all at once
+	std::vector<CModelAbstract*> culledModels;
+	std::vector<CBoundingBoxAligned> culledBounds;
+	const CFrustum* culledFrustum;
+
+	/// Arena for temporary data, reset at the end of each frame
+	Allocators::Arena<> frameArena;
+
+	/// Reflection texture that was last rendered into, and the number of
+	/// consecutive frames it has been reused for (see m_WaterReflectionInterval)
+	GLuint reflectionTexture;
+	int reflectionFramesReused;
+
+	/// Incremented by each RenderSubmissions, to tell how old occlusion query results are
+	u32 frameNumber;
+
+	/// Whether the main view's models have been filtered by occlusion culling
+	/// (with MODELFLAG_FILTERED) this frame
+	bool occlusionFiltered;
+
+	/// Models to issue occlusion queries for this frame
+	std::vector<CModel*> occlusionTested;
+
 	CRendererInternals() :
-		IsOpen(false), ShadersDirty(true), profileTable(g_Renderer.m_Stats), textureManager(g_VFS, false, false)
+		IsOpen(false), ShadersDirty(true), profileTable(g_Renderer.m_Stats), textureManager(g_VFS, false, false),
+		culledFrustum(NULL), frameArena(FRAME_ARENA_SIZE), reflectionTexture(0), reflectionFramesReused(0),
+		frameNumber(0), occlusionFiltered(false)
 	{
 	}
 
@@ -354,6 +499,11 @@ public:
 		{
 			contextSkinned.Add("USE_INSTANCING", "1");
 			contextSkinned.Add("USE_GPU_SKINNING", "1");
+			if (g_Renderer.m_Caps.m_BoneTextures)
+			{
+				contextSkinned.Add("USE_HW_INSTANCING", "1");
+				contextSkinned.Add("USE_BONE_TEXTURE", "1");
+			}
 		}
 		Model.NormalSkinned->Render(Model.ModShader, contextSkinned, flags);
 
@@ -361,6 +511,8 @@ public:
 		{
 			CShaderDefines contextUnskinned = context;
 			contextUnskinned.Add("USE_INSTANCING", "1");
+			if (g_Renderer.m_Caps.m_Instancing)
+				contextUnskinned.Add("USE_HW_INSTANCING", "1");
 			Model.NormalUnskinned->Render(Model.ModShader, contextUnskinned, flags);
 		}
 	}
@@ -375,6 +527,11 @@ public:
 		{
 			contextSkinned.Add("USE_INSTANCING", "1");
 			contextSkinned.Add("USE_GPU_SKINNING", "1");
+			if (g_Renderer.m_Caps.m_BoneTextures)
+			{
+				contextSkinned.Add("USE_HW_INSTANCING", "1");
+				contextSkinned.Add("USE_BONE_TEXTURE", "1");
+			}
 		}
 		Model.TranspSkinned->Render(Model.ModShader, contextSkinned, flags);
 
@@ -382,6 +539,8 @@ public:
 		{
 			CShaderDefines contextUnskinned = context;
 			contextUnskinned.Add("USE_INSTANCING", "1");
+			if (g_Renderer.m_Caps.m_Instancing)
+				contextUnskinned.Add("USE_HW_INSTANCING", "1");
 			Model.TranspUnskinned->Render(Model.ModShader, contextUnskinned, flags);
 		}
 	}
@@ -442,6 +601,11 @@ CRenderer::CRenderer()
 	m_Options.m_SmoothLOS = false;
 	m_Options.m_Postproc = false;
 	m_Options.m_ShowSky = false;
+	m_Options.m_WaterLowRes = false;
+	m_Options.m_WaterReflectionInterval = 1;
+	m_Options.m_ShaderCache = true;
+	m_Options.m_ShaderWarmup = false;
+	m_Options.m_OcclusionCulling = false;
 
 	// TODO: be more consistent in use of the config system
 	CFG_GET_USER_VAL("preferglsl", Bool, m_Options.m_PreferGLSL);
@@ -450,6 +614,11 @@ CRenderer::CRenderer()
 	CFG_GET_USER_VAL("gentangents", Bool, m_Options.m_GenTangents);
 	CFG_GET_USER_VAL("smoothlos", Bool, m_Options.m_SmoothLOS);
 	CFG_GET_USER_VAL("postproc", Bool, m_Options.m_Postproc);
+	CFG_GET_USER_VAL("waterlowres", Bool, m_Options.m_WaterLowRes);
+	CFG_GET_USER_VAL("waterreflectioninterval", Int, m_Options.m_WaterReflectionInterval);
+	CFG_GET_USER_VAL("shadercache", Bool, m_Options.m_ShaderCache);
+	CFG_GET_USER_VAL("shaderwarmup", Bool, m_Options.m_ShaderWarmup);
+	CFG_GET_USER_VAL("occlusionculling", Bool, m_Options.m_OcclusionCulling);
 
 #if CONFIG2_GLES
 	// Override config option since GLES only supports GLSL
@@ -485,6 +654,7 @@ CRenderer::CRenderer()
 	AddLocalProperty(L"waterWaviness", &m->waterManager.m_Waviness, false);
 	AddLocalProperty(L"silhouettes", &m_Options.m_Silhouettes, false);
 	AddLocalProperty(L"showsky", &m_Options.m_ShowSky, false);
+	AddLocalProperty(L"occlusionculling", &m_Options.m_OcclusionCulling, false);
 
 	RegisterFileReloadFunc(ReloadChangedFileCB, this);
 }
@@ -513,6 +683,9 @@ void CRenderer::EnumCaps()
 	m_Caps.m_VertexShader = false;
 	m_Caps.m_FragmentShader = false;
 	m_Caps.m_Shadows = false;
+	m_Caps.m_Instancing = false;
+	m_Caps.m_OcclusionQuery = false;
+	m_Caps.m_BoneTextures = false;
 
 	// now start querying extensions
 	if (!m_Options.m_NoVBO) {
@@ -544,6 +717,21 @@ void CRenderer::EnumCaps()
 		if (ogl_max_tex_units >= 4)
 			m_Caps.m_Shadows = true;
 	}
+
+	if (0 == ogl_HaveExtensions(0, "GL_ARB_draw_instanced", "GL_ARB_instanced_arrays", NULL))
+		m_Caps.m_Instancing = true;
+
+	if (ogl_HaveExtension("GL_ARB_occlusion_query"))
+		m_Caps.m_OcclusionQuery = true;
+
+	// GPU-skinned models are instanced with their bone matrices in a float texture
+	if (m_Caps.m_Instancing && m_Caps.m_VertexShader && m_Caps.m_FragmentShader && ogl_HaveExtension("GL_ARB_texture_float"))
+	{
+		GLint vertexTextureUnits = 0;
+		glGetIntegerv(GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS_ARB, &vertexTextureUnits);
+		if (vertexTextureUnits > 0)
+			m_Caps.m_BoneTextures = true;
+	}
 #endif
 }
 
@@ -626,6 +814,11 @@ bool CRenderer::Open(int width, int height)
 	// on card capabilities.
 	EnumCaps();
 
+	// GPU skinning (which needs GLSL) is the default when there's no limit
+	// on the number of bones, unless the config says otherwise
+	if (!g_ConfigDB.GetValue(CFG_USER, "gpuskinning") && m_Caps.m_BoneTextures && m_Options.m_PreferGLSL && m_Options.m_RenderPath != RP_FIXED)
+		m_Options.m_GPUSkinning = true;
+
 	// Dimensions
 	m_Width = width;
 	m_Height = height;
@@ -635,8 +828,8 @@ bool CRenderer::Open(int width, int height)
 	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
 
 	// setup default state
-	glDepthFunc(GL_LEQUAL);
-	glEnable(GL_DEPTH_TEST);
+	ogl_DepthFunc(GL_LEQUAL);
+	ogl_Enable(GL_DEPTH_TEST);
 	glCullFace(GL_BACK);
 	glFrontFace(GL_CCW);
 	glEnable(GL_CULL_FACE);
@@ -659,6 +852,9 @@ bool CRenderer::Open(int width, int height)
 	if (m_Options.m_Postproc)
 		m->postprocManager.Initialize();
 
+	if (m_Options.m_ShaderWarmup)
+		m->shaderManager.PrecompilePrograms();
+
 	return true;
 }
 
@@ -721,6 +917,9 @@ void CRenderer::SetOptionBool(enum Option opt,bool value)
 		case OPT_SHOWSKY:
 			m_Options.m_ShowSky = value;
 			break;
+		case OPT_OCCLUSIONCULLING:
+			m_Options.m_OcclusionCulling = value;
+			break;
 		default:
 			debug_warn(L"CRenderer::SetOptionBool: unknown option");
 			break;
@@ -758,6 +957,8 @@ bool CRenderer::GetOptionBool(enum Option opt) const
 			return m_Options.m_Silhouettes;
 		case OPT_SHOWSKY:
 			return m_Options.m_ShowSky;
+		case OPT_OCCLUSIONCULLING:
+			return m_Options.m_OcclusionCulling;
 		default:
 			debug_warn(L"CRenderer::GetOptionBool: unknown option");
 			break;
@@ -840,6 +1041,12 @@ void CRenderer::BeginFrame()
 	// zero out all the per-frame stats
 	m_Stats.Reset();
 
+	// in case anything has changed the GL state behind the cache's back
+	ogl_ResetStateCache();
+
+	// keep textures within the memory budget
+	m->textureManager.BeginFrame();
+
 	// choose model renderers for this frame
 
 	if (m->ShadersDirty)
@@ -869,6 +1076,11 @@ void CRenderer::RenderShadowMap(const CShaderDefines& context)
 {
 	PROFILE3_GPU("shadow map");
 
+	// If nothing that's drawn into the shadow map has changed since the last
+	// frame, its contents can be reused
+	if (m->shadow.IsUpToDate())
+		return;
+
 	m->shadow.BeginRender();
 
 	{
@@ -943,7 +1155,7 @@ void CRenderer::RenderPatches(const CShaderDefines& context, const CFrustum* fru
 		glPolygonMode(GL_FRONT_AND_BACK,GL_LINE);
 
 		// setup some renderstate ..
-		pglActiveTextureARB(GL_TEXTURE0);
+		ogl_ActiveTexture(GL_TEXTURE0);
 		glDisable(GL_TEXTURE_2D);
 		glColor3f(0.5f, 0.5f, 1.0f);
 		glLineWidth(2.0f);
@@ -990,6 +1202,10 @@ void CRenderer::RenderModels(const CShaderDefines& context, const CFrustum* frus
 		CModelCuller culler(*frustum);
 		m->FilterModels(culler, flags);
 	}
+	else if (m->occlusionFiltered)
+	{
+		flags = MODELFLAG_FILTERED;
+	}
 
 #if !CONFIG2_GLES
 	if (m_ModelRenderMode == WIREFRAME)
@@ -1031,6 +1247,10 @@ void CRenderer::RenderTransparentModels(const CShaderDefines& context, ETranspar
 		CModelCuller culler(*frustum);
 		m->FilterTranspModels(culler, flags);
 	}
+	else if (m->occlusionFiltered)
+	{
+		flags = MODELFLAG_FILTERED;
+	}
 
 #if !CONFIG2_GLES
 	// switch on wireframe if we need it
@@ -1041,7 +1261,7 @@ void CRenderer::RenderTransparentModels(const CShaderDefines& context, ETranspar
 #endif
 
 	// disable face culling for two-sided models in sub-renders
-	if (flags)
+	if (frustum)
 		glDisable(GL_CULL_FACE);
 
 	CShaderDefines contextOpaque = context;
@@ -1056,7 +1276,7 @@ void CRenderer::RenderTransparentModels(const CShaderDefines& context, ETranspar
 	if (transparentMode == TRANSPARENT || transparentMode == TRANSPARENT_BLEND)
 		m->CallTranspModelRenderers(contextBlend, flags);
 
-	if (flags)
+	if (frustum)
 		glEnable(GL_CULL_FACE);
 
 #if !CONFIG2_GLES
@@ -1081,6 +1301,157 @@ void CRenderer::RenderTransparentModels(const CShaderDefines& context, ETranspar
 }
 
 
+// Models larger than this along any axis (in world space) are the main occluders,
+// and hide too much for culling them to be worthwhile, so they are always drawn
+static const float OCCLUSION_MAX_MODEL_SIZE = 24.f;
+
+// The tested bounds are expanded by this much, so that models moving out from
+// behind an occluder are less likely to be missing for a frame
+static const float OCCLUSION_BOUNDS_MARGIN = 1.f;
+
+// Results of queries issued more than this many frames ago are ignored, since
+// the camera or the model may have moved a long way since then
+static const u32 OCCLUSION_MAX_RESULT_AGE = 3;
+
+/**
+ * Hides models whose bounds were completely hidden when last tested, and
+ * collects the models that should be tested again this frame.
+ * Query results are only read back when they are already available, so
+ * this never stalls waiting for the GPU.
+ */
+class COcclusionCuller : public CModelFilter
+{
+public:
+	COcclusionCuller(const CCamera& camera, u32 frameNumber, std::vector<CModel*>& tested, size_t& numOccluded) :
+		m_CameraPos(camera.GetOrientation().GetTranslation()), m_NearPlane(camera.GetNearPlane()),
+		m_FrameNumber(frameNumber), m_Tested(tested), m_NumOccluded(numOccluded)
+	{
+	}
+
+	bool Filter(CModel* model)
+	{
+#if CONFIG2_GLES
+		UNUSED2(model);
+		return true;
+#else
+		CModel::OcclusionState& state = model->GetOcclusionState();
+
+		if (state.m_Pending)
+		{
+			GLuint available = 0;
+			pglGetQueryObjectuivARB(state.m_Query, GL_QUERY_RESULT_AVAILABLE_ARB, &available);
+			if (available)
+			{
+				GLuint samples = 0;
+				pglGetQueryObjectuivARB(state.m_Query, GL_QUERY_RESULT_ARB, &samples);
+				state.m_Occluded = (samples == 0);
+				state.m_Pending = false;
+			}
+		}
+
+		if (m_FrameNumber - state.m_Frame > OCCLUSION_MAX_RESULT_AGE)
+			state.m_Occluded = false;
+
+		CBoundingBoxAligned bounds = model->GetWorldBoundsRec();
+		const CVector3D size = bounds[1] - bounds[0];
+		if (size.X > OCCLUSION_MAX_MODEL_SIZE || size.Y > OCCLUSION_MAX_MODEL_SIZE || size.Z > OCCLUSION_MAX_MODEL_SIZE)
+		{
+			state.m_Occluded = false;
+			return true;
+		}
+
+		// The box can't be tested reliably if the camera is inside it or
+		// it's clipped by the near plane
+		bounds.Expand(OCCLUSION_BOUNDS_MARGIN + m_NearPlane);
+		if (m_CameraPos.X >= bounds[0].X && m_CameraPos.X <= bounds[1].X &&
+			m_CameraPos.Y >= bounds[0].Y && m_CameraPos.Y <= bounds[1].Y &&
+			m_CameraPos.Z >= bounds[0].Z && m_CameraPos.Z <= bounds[1].Z)
+		{
+			state.m_Occluded = false;
+			return true;
+		}
+
+		m_Tested.push_back(model);
+
+		if (state.m_Occluded)
+		{
+			++m_NumOccluded;
+			return false;
+		}
+		return true;
+#endif
+	}
+
+private:
+	CVector3D m_CameraPos;
+	float m_NearPlane;
+	u32 m_FrameNumber;
+	std::vector<CModel*>& m_Tested;
+	size_t& m_NumOccluded;
+};
+
+bool CRenderer::FilterOccludedModels()
+{
+	if (!m_Options.m_OcclusionCulling || !m_Caps.m_OcclusionQuery)
+		return false;
+
+	PROFILE3("filter occluded models");
+
+	m->occlusionTested.clear();
+	COcclusionCuller culler(m_ViewCamera, m->frameNumber, m->occlusionTested, m_Stats.m_ModelsOccluded);
+	m->FilterModels(culler, MODELFLAG_FILTERED);
+	m->FilterTranspModels(culler, MODELFLAG_FILTERED);
+	return true;
+}
+
+void CRenderer::RenderOcclusionQueries()
+{
+#if !CONFIG2_GLES
+	PROFILE3_GPU("occlusion queries");
+
+	// Draw the bounds of each tested model, without changing the frame buffer,
+	// over the depth of the terrain and the opaque models that were drawn
+	CShaderTechniquePtr shaderTech = m->shaderManager.LoadEffect("gui_solid");
+	shaderTech->BeginPass();
+	CShaderProgramPtr shader = shaderTech->GetShader();
+	shader->Uniform("transform", m_ViewCamera.GetViewProjection());
+	shader->Uniform("color", 1.0f, 1.0f, 1.0f, 1.0f);
+
+	glColorMask(0, 0, 0, 0);
+	ogl_DepthMask(0);
+	glDisable(GL_CULL_FACE);
+
+	for (size_t i = 0; i < m->occlusionTested.size(); ++i)
+	{
+		CModel::OcclusionState& state = m->occlusionTested[i]->GetOcclusionState();
+
+		// Wait for the previous result instead of discarding it
+		if (state.m_Pending)
+			continue;
+
+		if (!state.m_Query)
+			pglGenQueriesARB(1, &state.m_Query);
+
+		CBoundingBoxAligned bounds = m->occlusionTested[i]->GetWorldBoundsRec();
+		bounds.Expand(OCCLUSION_BOUNDS_MARGIN);
+
+		pglBeginQueryARB(GL_SAMPLES_PASSED_ARB, state.m_Query);
+		bounds.Render(shader);
+		pglEndQueryARB(GL_SAMPLES_PASSED_ARB);
+
+		state.m_Pending = true;
+		state.m_Frame = m->frameNumber;
+	}
+
+	glEnable(GL_CULL_FACE);
+	ogl_DepthMask(1);
+	glColorMask(1, 1, 1, 1);
+
+	shaderTech->EndPass();
+#endif
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // SetObliqueFrustumClipping: change the near plane to the given clip plane (in world space)
 // Based on code from Game Programming Gems 5, from http://www.terathon.com/code/oblique.html
@@ -1123,7 +1494,8 @@ void CRenderer::SetObliqueFrustumClipping(const CVector4D& worldPlane)
 // RenderReflections: render the water reflections to the reflection texture
 SScreenRect CRenderer::RenderReflections(const CShaderDefines& context, const CBoundingBoxAligned& scissor)
 {
-	PROFILE3_GPU("water reflections");
+	PROFILE3("water reflections");
+	CRenderPassCounter counter(STATE_PASS_REFLECTIONS);
 
 	WaterManager& wm = m->waterManager;
 
@@ -1156,8 +1528,27 @@ SScreenRect CRenderer::RenderReflections(const CShaderDefines& context, const CB
 	CVector4D camPlane(0, 1, 0, -wm.m_WaterHeight);
 	SetObliqueFrustumClipping(camPlane);
 
+	// If the camera hasn't moved, the previous reflection can optionally
+	// be reused for a few frames (the scene will usually have changed only
+	// slightly, and the distortion of the water hides most of it)
+	CMatrix3D reflectionMatrix = m_ViewCamera.GetViewProjection();
+	bool reuse = false;
+	if (m_Options.m_WaterReflectionInterval > 1 &&
+		m->reflectionTexture == wm.m_ReflectionTexture &&
+		wm.m_ReflectionMatrix == reflectionMatrix &&
+		m->reflectionFramesReused + 1 < m_Options.m_WaterReflectionInterval)
+	{
+		reuse = true;
+		++m->reflectionFramesReused;
+	}
+	else
+	{
+		m->reflectionTexture = wm.m_ReflectionTexture;
+		m->reflectionFramesReused = 0;
+	}
+
 	// Save the model-view-projection matrix so the shaders can use it for projective texturing
-	wm.m_ReflectionMatrix = m_ViewCamera.GetViewProjection();
+	wm.m_ReflectionMatrix = reflectionMatrix;
 
 	SScreenRect screenScissor;
 	screenScissor.x1 = (GLint)floor((scissor[0].X*0.5f+0.5f)*vp.m_Width);
@@ -1165,6 +1556,10 @@ SScreenRect CRenderer::RenderReflections(const CShaderDefines& context, const CB
 	screenScissor.x2 = (GLint)ceil((scissor[1].X*0.5f+0.5f)*vp.m_Width);
 	screenScissor.y2 = (GLint)ceil((scissor[1].Y*0.5f+0.5f)*vp.m_Height);
 
+	// (Nothing is drawn into the frame buffer, so nothing needs clearing)
+	if (reuse)
+		screenScissor.x1 = screenScissor.y1 = screenScissor.x2 = screenScissor.y2 = 0;
+
 	if (screenScissor.x1 < screenScissor.x2 && screenScissor.y1 < screenScissor.y2)
 	{
 		glEnable(GL_SCISSOR_TEST);
@@ -1189,9 +1584,9 @@ SScreenRect CRenderer::RenderReflections(const CShaderDefines& context, const CB
 		glDisable(GL_SCISSOR_TEST);
 
 		// Copy the image to a texture
-		pglActiveTextureARB(GL_TEXTURE0);
+		ogl_ActiveTexture(GL_TEXTURE0);
 		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, wm.m_ReflectionTexture);
+		ogl_BindTexture(GL_TEXTURE_2D, wm.m_ReflectionTexture);
 		glCopyTexSubImage2D(GL_TEXTURE_2D, 0,
 				screenScissor.x1, screenScissor.y1,
 				screenScissor.x1, screenScissor.y1,
@@ -1210,7 +1605,8 @@ SScreenRect CRenderer::RenderReflections(const CShaderDefines& context, const CB
 // RenderRefractions: render the water refractions to the refraction texture
 SScreenRect CRenderer::RenderRefractions(const CShaderDefines& context, const CBoundingBoxAligned &scissor)
 {
-	PROFILE3_GPU("water refractions");
+	PROFILE3("water refractions");
+	CRenderPassCounter counter(STATE_PASS_REFRACTIONS);
 
 	WaterManager& wm = m->waterManager;
 
@@ -1267,9 +1663,9 @@ SScreenRect CRenderer::RenderRefractions(const CShaderDefines& context, const CB
 		glDisable(GL_SCISSOR_TEST);
 
 		// Copy the image to a texture
-		pglActiveTextureARB(GL_TEXTURE0);
+		ogl_ActiveTexture(GL_TEXTURE0);
 		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, wm.m_RefractionTexture);
+		ogl_BindTexture(GL_TEXTURE_2D, wm.m_RefractionTexture);
 		glCopyTexSubImage2D(GL_TEXTURE_2D, 0,
 				screenScissor.x1, screenScissor.y1,
 				screenScissor.x1, screenScissor.y1,
@@ -1335,7 +1731,7 @@ void CRenderer::RenderSilhouettes(const CShaderDefines& context)
 		m->CallTranspModelRenderers(contextOccluder, MODELFLAG_SILHOUETTE_OCCLUDER);
 	}
 
-	glDepthFunc(GL_GEQUAL);
+	ogl_DepthFunc(GL_GEQUAL);
 	glColorMask(1, 1, 1, 1);
 
 	// Render more efficiently if alpha == 1
@@ -1345,14 +1741,14 @@ void CRenderer::RenderSilhouettes(const CShaderDefines& context)
 		// appear on top, but sorting has non-zero cost. So we'll keep the depth
 		// write enabled, to do the opposite - far objects will consistently appear
 		// on top.
-		glDepthMask(0);
+		ogl_DepthMask(0);
 	}
 	else
 	{
 		// Since we can't sort, we'll use the stencil buffer to ensure we only draw
 		// a pixel once (using the colour of whatever model happens to be drawn first).
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+		ogl_Enable(GL_BLEND);
+		ogl_BlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
 		pglBlendColorEXT(0, 0, 0, silhouetteAlpha);
 
 		glEnable(GL_STENCIL_TEST);
@@ -1372,15 +1768,15 @@ void CRenderer::RenderSilhouettes(const CShaderDefines& context)
 	}
 
 	// Restore state
-	glDepthFunc(GL_LEQUAL);
+	ogl_DepthFunc(GL_LEQUAL);
 	if (silhouetteAlpha == 1.f)
 	{
-		glDepthMask(1);
+		ogl_DepthMask(1);
 	}
 	else
 	{
-		glDisable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		ogl_Disable(GL_BLEND);
+		ogl_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		pglBlendColorEXT(0, 0, 0, 0);
 		glDisable(GL_STENCIL_TEST);
 	}
@@ -1426,7 +1822,9 @@ void CRenderer::RenderParticles()
 void CRenderer::RenderSubmissions()
 {
 	PROFILE3("render submissions");
-	
+
+	++m->frameNumber;
+
 	GetScene().GetLOSTexture().InterpolateLOS();
 	
 	if (m_Options.m_Postproc)
@@ -1458,6 +1856,7 @@ void CRenderer::RenderSubmissions()
 
 	if (m_Caps.m_Shadows && m_Options.m_Shadows && GetRenderPath() == RP_SHADER)
 	{
+		CRenderPassCounter counter(STATE_PASS_SHADOWS);
 		RenderShadowMap(context);
 	}
 
@@ -1476,15 +1875,21 @@ void CRenderer::RenderSubmissions()
 		if (waterScissor.GetVolume() > 0 && m_WaterManager->WillRenderFancyWater())
 		{
 			PROFILE3_GPU("water scissor");
+			CRenderPassCounter counter(STATE_PASS_WATER);
 			SScreenRect dirty;
 			if (m_Options.m_WaterRefraction && m_Options.m_WaterReflection)
 			{
 				SScreenRect reflectionScissor = RenderReflections(context, waterScissor);
 				SScreenRect refractionScissor = RenderRefractions(context, waterScissor);
-				dirty.x1 = std::min(reflectionScissor.x1, refractionScissor.x1);
-				dirty.y1 = std::min(reflectionScissor.y1, refractionScissor.y1);
-				dirty.x2 = std::max(reflectionScissor.x2, refractionScissor.x2);
-				dirty.y2 = std::max(reflectionScissor.y2, refractionScissor.y2);
+				if (!(reflectionScissor.x1 < reflectionScissor.x2 && reflectionScissor.y1 < reflectionScissor.y2))
+					dirty = refractionScissor; // (the reflection was reused)
+				else
+				{
+					dirty.x1 = std::min(reflectionScissor.x1, refractionScissor.x1);
+					dirty.y1 = std::min(reflectionScissor.y1, refractionScissor.y1);
+					dirty.x2 = std::max(reflectionScissor.x2, refractionScissor.x2);
+					dirty.y2 = std::max(reflectionScissor.y2, refractionScissor.y2);
+				}
  			}
 			else if (m_Options.m_WaterRefraction)
 			{
@@ -1513,70 +1918,107 @@ void CRenderer::RenderSubmissions()
 		}
 	}
 
-	if (m_Options.m_ShowSky)
 	{
-		m->skyManager.RenderSky();
+		CRenderPassCounter counter(STATE_PASS_TERRAIN);
+
+		if (m_Options.m_ShowSky)
+		{
+			m->skyManager.RenderSky();
+		}
+
+		// render submitted patches and models
+		RenderPatches(context);
+		ogl_WarnIfError();
 	}
 
-	// render submitted patches and models
-	RenderPatches(context);
-	ogl_WarnIfError();
+	{
+		CRenderPassCounter counter(STATE_PASS_OVERLAYS);
 
-	// render debug-related terrain overlays
-	ITerrainOverlay::RenderOverlaysBeforeWater();
-	ogl_WarnIfError();
+		// render debug-related terrain overlays
+		ITerrainOverlay::RenderOverlaysBeforeWater();
+		ogl_WarnIfError();
 
-	// render other debug-related overlays before water (so they can be seen when underwater)
-	m->overlayRenderer.RenderOverlaysBeforeWater();
-	ogl_WarnIfError();
+		// render other debug-related overlays before water (so they can be seen when underwater)
+		m->overlayRenderer.RenderOverlaysBeforeWater();
+		ogl_WarnIfError();
+	}
 
-	RenderModels(context);
-	ogl_WarnIfError();
+	{
+		CRenderPassCounter counter(STATE_PASS_MODELS);
+		m->occlusionFiltered = FilterOccludedModels();
+		RenderModels(context);
+		ogl_WarnIfError();
+
+		// test the models' visibility against the opaque parts of the scene,
+		// for culling them in the following frames
+		if (m->occlusionFiltered)
+		{
+			RenderOcclusionQueries();
+			ogl_WarnIfError();
+		}
+	}
 
 	// render water
 	if (m_WaterManager->m_RenderWater && g_Game && waterScissor.GetVolume() > 0)
 	{
-		// render transparent stuff, but only the solid parts that can occlude block water
-		RenderTransparentModels(context, TRANSPARENT_OPAQUE);
-		ogl_WarnIfError();
+		{
+			CRenderPassCounter counter(STATE_PASS_TRANSPARENT);
+			// render transparent stuff, but only the solid parts that can occlude block water
+			RenderTransparentModels(context, TRANSPARENT_OPAQUE);
+			ogl_WarnIfError();
+		}
 
-		m->terrainRenderer.RenderWater(context, &m->shadow);
-		ogl_WarnIfError();
+		{
+			CRenderPassCounter counter(STATE_PASS_WATER);
+			m->terrainRenderer.RenderWater(context, &m->shadow);
+			ogl_WarnIfError();
+		}
 
-		// render transparent stuff again, but only the blended parts that overlap water
-		RenderTransparentModels(context, TRANSPARENT_BLEND);
-		ogl_WarnIfError();
+		{
+			CRenderPassCounter counter(STATE_PASS_TRANSPARENT);
+			// render transparent stuff again, but only the blended parts that overlap water
+			RenderTransparentModels(context, TRANSPARENT_BLEND);
+			ogl_WarnIfError();
+		}
 	}
 	else
 	{
+		CRenderPassCounter counter(STATE_PASS_TRANSPARENT);
 		// render transparent stuff, so it can overlap models/terrain
 		RenderTransparentModels(context, TRANSPARENT);
 		ogl_WarnIfError();
 	}
 
-	// render debug-related terrain overlays
-	ITerrainOverlay::RenderOverlaysAfterWater();
-	ogl_WarnIfError();
+	{
+		CRenderPassCounter counter(STATE_PASS_OVERLAYS);
 
-	// render some other overlays after water (so they can be displayed on top of water)
-	m->overlayRenderer.RenderOverlaysAfterWater();
-	ogl_WarnIfError();
+		// render debug-related terrain overlays
+		ITerrainOverlay::RenderOverlaysAfterWater();
+		ogl_WarnIfError();
+
+		// render some other overlays after water (so they can be displayed on top of water)
+		m->overlayRenderer.RenderOverlaysAfterWater();
+		ogl_WarnIfError();
+	}
 
 	// particles are transparent so render after water
 	if (m_Options.m_Particles)
 	{
+		CRenderPassCounter counter(STATE_PASS_PARTICLES);
 		RenderParticles();
 		ogl_WarnIfError();
 	}
 	
 	if (m_Options.m_Postproc)
 	{
+		CRenderPassCounter counter(STATE_PASS_POSTPROC);
 		m->postprocManager.ApplyPostproc();
 		m->postprocManager.ReleaseRenderOutput();
 	}
 
 	if (m_Options.m_Silhouettes)
 	{
+		CRenderPassCounter counter(STATE_PASS_MODELS);
 		RenderSilhouettes(context);
 	}
 
@@ -1596,8 +2038,13 @@ void CRenderer::RenderSubmissions()
 	}
 
 	// render overlays that should appear on top of all other objects
-	m->overlayRenderer.RenderForegroundOverlays(m_ViewCamera);
-	ogl_WarnIfError();
+	{
+		CRenderPassCounter counter(STATE_PASS_OVERLAYS);
+		m->overlayRenderer.RenderForegroundOverlays(m_ViewCamera);
+		ogl_WarnIfError();
+	}
+
+	m->occlusionFiltered = false;
 	
 }
 
@@ -1622,6 +2069,8 @@ void CRenderer::EndFrame()
 
 	ogl_tex_bind(0, 0);
 
+	m->frameArena.DeallocateAll();
+
 	{
 		PROFILE3("error check");
 		if (glGetError())
@@ -1641,15 +2090,15 @@ void CRenderer::DisplayFrustum()
 #if CONFIG2_GLES
 #warning TODO: implement CRenderer::DisplayFrustum for GLES
 #else
-	glDepthMask(0);
+	ogl_DepthMask(0);
 	glDisable(GL_CULL_FACE);
 	glDisable(GL_TEXTURE_2D);
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	ogl_Enable(GL_BLEND);
+	ogl_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glColor4ub(255,255,255,64);
 	m_CullCamera.Render(2);
-	glDisable(GL_BLEND);
+	ogl_Disable(GL_BLEND);
 
 	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 	glColor3ub(255,255,255);
@@ -1657,7 +2106,7 @@ void CRenderer::DisplayFrustum()
 	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
 	glEnable(GL_CULL_FACE);
-	glDepthMask(1);
+	ogl_DepthMask(1);
 #endif
 }
 
@@ -1684,6 +2133,8 @@ void CRenderer::SetSceneCamera(const CCamera& viewCamera, const CCamera& cullCam
 
 	if (m_Caps.m_Shadows && m_Options.m_Shadows && GetRenderPath() == RP_SHADER)
 		m->shadow.SetupFrame(m_CullCamera, m_LightEnv->GetSunDir());
+	else
+		m->shadow.InvalidateCache(); // (changes in this frame won't be tracked)
 }
 
 
@@ -1694,6 +2145,8 @@ void CRenderer::SetViewport(const SViewPort &vp)
 
 void CRenderer::Submit(CPatch* patch)
 {
+	m->shadow.AddShadowCaster(patch, !patch->GetRenderData() || patch->GetRenderData()->m_UpdateFlags);
+
 	m->terrainRenderer.Submit(patch);
 }
 
@@ -1732,6 +2185,13 @@ void CRenderer::SubmitNonRecursive(CModel* model)
 	if (model->GetFlags() & MODELFLAG_CASTSHADOWS)
 	{
 		m->shadow.AddShadowedBound(model->GetWorldBounds());
+
+		// The model's shadow might have changed if its render data needs
+		// updating (e.g. because it has moved or is animated), or if its
+		// material uses render queries (e.g. time-dependent vertex animation)
+		CRenderData* rdata = model->GetRenderData();
+		m->shadow.AddShadowCaster(model, !rdata || rdata->m_UpdateFlags ||
+			model->GetMaterial().GetRenderQueries().GetSize() != 0);
 	}
 
 	// Tricky: The call to GetWorldBounds() above can invalidate the position
@@ -1756,6 +2216,79 @@ void CRenderer::SubmitNonRecursive(CModel* model)
 }
 
 
+void CRenderer::SubmitRecursiveCulled(CModelAbstract* model, const CBoundingBoxAligned& bounds, const CFrustum& frustum)
+{
+	// Models are queued so their bounds can be tested together; if a different
+	// frustum is used, the earlier ones must be finished first
+	if (m->culledFrustum != &frustum)
+	{
+		SubmitCulledModels();
+		m->culledFrustum = &frustum;
+	}
+
+	m->culledModels.push_back(model);
+	m->culledBounds.push_back(bounds);
+}
+
+// Number of bounding boxes tested by each item of CullModelsTask, to amortise
+// the cost of distributing the items between threads
+static const size_t CULL_MODELS_CHUNK_SIZE = 1024;
+
+class CullModelsTask : public CThreadPool::ITask
+{
+public:
+	CullModelsTask(const CFrustum& frustum, const std::vector<CBoundingBoxAligned>& bounds, bool* visible) :
+		m_Frustum(frustum), m_Bounds(bounds), m_Visible(visible)
+	{
+	}
+
+	virtual void Run(size_t index)
+	{
+		size_t start = index * CULL_MODELS_CHUNK_SIZE;
+		size_t count = std::min(CULL_MODELS_CHUNK_SIZE, m_Bounds.size() - start);
+		m_Frustum.AreBoxesVisible(&m_Bounds[start], count, m_Visible + start);
+	}
+
+private:
+	const CFrustum& m_Frustum;
+	const std::vector<CBoundingBoxAligned>& m_Bounds;
+	bool* m_Visible;
+
+	NONCOPYABLE(CullModelsTask);
+};
+
+void CRenderer::SubmitCulledModels()
+{
+	if (m->culledModels.empty())
+		return;
+
+	PROFILE3("cull models");
+
+	// Only the frustum tests run in parallel; the visible models are submitted
+	// afterwards on this thread, in the order they were queued, so the render
+	// lists are the same as when they are submitted immediately
+	const size_t count = m->culledModels.size();
+	bool* visible = new bool[count];
+
+	CullModelsTask task(*m->culledFrustum, m->culledBounds, visible);
+	const size_t numChunks = (count + CULL_MODELS_CHUNK_SIZE - 1) / CULL_MODELS_CHUNK_SIZE;
+	if (g_ThreadPool && numChunks > 1)
+		g_ThreadPool->ParallelFor(task, numChunks);
+	else
+		for (size_t i = 0; i < numChunks; ++i)
+			task.Run(i);
+
+	for (size_t i = 0; i < count; ++i)
+		if (visible[i])
+			SubmitRecursive(m->culledModels[i]);
+
+	delete[] visible;
+
+	m->culledModels.clear();
+	m->culledBounds.clear();
+	m->culledFrustum = NULL;
+}
+
 ///////////////////////////////////////////////////////////
 // Render the given scene
 void CRenderer::RenderScene(Scene& scene)
@@ -1768,6 +2301,8 @@ void CRenderer::RenderScene(Scene& scene)
 
 	m->particleManager.RenderSubmit(*this, frustum);
 
+	SubmitCulledModels();
+
 	ogl_WarnIfError();
 
 	RenderSubmissions();
@@ -1785,9 +2320,9 @@ Scene& CRenderer::GetScene()
 // BindTexture: bind a GL texture object to current active unit
 void CRenderer::BindTexture(int unit, GLuint tex)
 {
-	pglActiveTextureARB(GL_TEXTURE0+unit);
+	ogl_ActiveTexture(GL_TEXTURE0+unit);
 
-	glBindTexture(GL_TEXTURE_2D, tex);
+	ogl_BindTexture(GL_TEXTURE_2D, tex);
 #if !CONFIG2_GLES
 	if (tex) {
 		glEnable(GL_TEXTURE_2D);
@@ -2111,6 +2646,26 @@ CTimeManager& CRenderer::GetTimeManager()
 	return m->timeManager;
 }
 
+Allocators::Arena<>& CRenderer::GetFrameArena()
+{
+	return m->frameArena;
+}
+
+CFrameArenaScope::CFrameArenaScope(size_t size) :
+	m_OwnedArena(NULL)
+{
+	Allocators::Arena<>& frameArena = g_Renderer.GetFrameArena();
+	if (frameArena.RemainingBytes() >= size)
+		m_Arena = &frameArena;
+	else
+		m_Arena = m_OwnedArena = new Allocators::Arena<>(size);
+}
+
+CFrameArenaScope::~CFrameArenaScope()
+{
+	delete m_OwnedArena;
+}
+
 CMaterialManager& CRenderer::GetMaterialManager()
 {
 	return m->materialManager;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -26,6 +26,7 @@
 #include "graphics/Camera.h"
 #include "graphics/SColor.h"
 #include "graphics/ShaderProgram.h"
+#include "lib/allocators/arena.h"
 #include "lib/res/handle.h"
 #include "ps/Singleton.h"
 #include "scripting/ScriptableObject.h"
@@ -90,7 +91,8 @@ public:
 		OPT_SHADOWPCF,
 		OPT_PARTICLES,
 		OPT_SILHOUETTES,
-		OPT_SHOWSKY
+		OPT_SHOWSKY,
+		OPT_OCCLUSIONCULLING
 	};
 
 	enum RenderPath {
@@ -105,6 +107,27 @@ public:
 		RP_SHADER
 	};
 
+	// parts of the frame that GL state changes, draw calls, triangles and
+	// GPU time are counted separately for (see CRenderPassCounter)
+	enum StatePass {
+		STATE_PASS_SHADOWS,
+		STATE_PASS_TERRAIN,
+		STATE_PASS_TERRAIN_BLENDS,
+		STATE_PASS_MODELS,
+		STATE_PASS_TRANSPARENT,
+		STATE_PASS_WATER,
+		STATE_PASS_REFLECTIONS,
+		STATE_PASS_REFRACTIONS,
+		STATE_PASS_OVERLAYS,
+		STATE_PASS_PARTICLES,
+		STATE_PASS_POSTPROC,
+		STATE_PASS_GUI,
+		NUM_STATE_PASSES
+	};
+
+	// short name of each StatePass, for the stats table and profiler
+	static const char* GetStatePassName(StatePass pass);
+
 	// stats class - per frame counts of number of draw calls, poly counts etc
 	struct Stats {
 		// set all stats to zero
@@ -123,6 +146,18 @@ public:
 		size_t m_BlendSplats;
 		// number of particles
 		size_t m_Particles;
+		// number of models skipped by occlusion culling
+		size_t m_ModelsOccluded;
+		// number of GL state changes made, and redundant ones skipped
+		// (see ogl_ResetStateCache), in each StatePass
+		size_t m_StateChanges[NUM_STATE_PASSES];
+		size_t m_StateChangesFiltered[NUM_STATE_PASSES];
+		// number of draw calls and triangles in each StatePass
+		size_t m_PassDrawCalls[NUM_STATE_PASSES];
+		size_t m_PassTris[NUM_STATE_PASSES];
+
+		// total number of triangles drawn, of all kinds
+		size_t GetTotalTris() const { return m_TerrainTris + m_WaterTris + m_ModelTris + m_OverlayTris; }
 	};
 
 	// renderer options
@@ -137,6 +172,17 @@ public:
 		bool m_WaterRefraction;
 		bool m_WaterReflection;
 		bool m_WaterShadow;
+		// render reflections and refractions at half the normal resolution
+		bool m_WaterLowRes;
+		// if greater than 1, reflections are only rendered every this many frames
+		// while the camera isn't moving
+		int m_WaterReflectionInterval;
+
+		// save compiled GLSL programs to the cache directory, to load them faster next time
+		bool m_ShaderCache;
+		// load all the shader programs that were used in the previous session
+		// when the renderer starts, instead of when they're first needed
+		bool m_ShaderWarmup;
 
 		RenderPath m_RenderPath;
 		bool m_ShadowAlphaFix;
@@ -151,6 +197,9 @@ public:
 		bool m_SmoothLOS;
 		bool m_ShowSky;
 		bool m_Postproc;
+		// skip models that were hidden behind terrain and other models
+		// in the previous frame (tested with occlusion queries)
+		bool m_OcclusionCulling;
 	} m_Options;
 
 	struct Caps {
@@ -160,6 +209,9 @@ public:
 		bool m_VertexShader;
 		bool m_FragmentShader;
 		bool m_Shadows;
+		bool m_Instancing;
+		bool m_OcclusionQuery;
+		bool m_BoneTextures; // vertex shaders can read float textures (for GPU skinning with any number of bones)
 	};
 
 public:
@@ -310,6 +362,14 @@ public:
 	
 	CPostprocManager& GetPostprocManager();
 
+	/**
+	 * Returns an arena allocator for temporary data that only needs to live
+	 * until the end of the current frame. It is reset by EndFrame, so any
+	 * containers using it must be destroyed before then.
+	 * (Use CFrameArenaScope rather than calling this directly.)
+	 */
+	Allocators::Arena<>& GetFrameArena();
+
 	/**
 	 * GetCapabilities: Return which OpenGL capabilities are available and enabled.
 	 *
@@ -322,6 +382,7 @@ public:
 protected:
 	friend struct CRendererInternals;
 	friend class CVertexBuffer;
+	friend class CStreamBuffer;
 	friend class CPatchRData;
 	friend class CDecalRData;
 	friend class FixedFunctionModelRenderer;
@@ -362,8 +423,12 @@ protected:
 	void Submit(CModelDecal* decal);
 	void Submit(CParticleEmitter* emitter);
 	void SubmitNonRecursive(CModel* model);
+	void SubmitRecursiveCulled(CModelAbstract* model, const CBoundingBoxAligned& bounds, const CFrustum& frustum);
 	//END: Implementation of SceneCollector
 
+	// frustum-test the models queued by SubmitRecursiveCulled, and submit the visible ones
+	void SubmitCulledModels();
+
 	// render any batched objects
 	void RenderSubmissions();
 
@@ -376,6 +441,13 @@ protected:
 
 	void RenderSilhouettes(const CShaderDefines& context);
 
+	// hide models from the main view using earlier occlusion query results, and
+	// choose which to test this frame; returns false if occlusion culling is disabled
+	bool FilterOccludedModels();
+	// test the bounds of the models selected by FilterOccludedModels against the
+	// depth buffer, for use in the next frame
+	void RenderOcclusionQueries();
+
 	void RenderParticles();
 
 	// shadow rendering stuff
@@ -494,5 +566,53 @@ public:
 	bool m_SkipSubmit;
 };
 
+/**
+ * Attributes the GL state changes, draw calls and triangles made during its
+ * lifetime to one of the renderer's StatePasses, and times the pass on the GPU
+ * (with CProfiler2GPU, if enabled).
+ *
+ * Counters may be nested, in which case the work is only counted for the
+ * innermost one (e.g. terrain blends drawn while rendering the water
+ * reflections count as terrain blends).
+ */
+class CRenderPassCounter
+{
+	NONCOPYABLE(CRenderPassCounter);
+public:
+	CRenderPassCounter(CRenderer::StatePass pass);
+	~CRenderPassCounter();
+
+private:
+	void Start();
+	void Stop();
+
+	CRenderer::StatePass m_Pass;
+	CRenderPassCounter* m_Parent;
+	size_t m_Changes;
+	size_t m_Filtered;
+	size_t m_DrawCalls;
+	size_t m_Tris;
+};
+
+/**
+ * Provides an arena allocator for data used during a single rendering call.
+ * This is the renderer's per-frame arena if it has at least the requested
+ * number of bytes left, else a new arena of that size that is freed when
+ * this object is destroyed.
+ */
+class CFrameArenaScope
+{
+	NONCOPYABLE(CFrameArenaScope);
+public:
+	CFrameArenaScope(size_t size);
+	~CFrameArenaScope();
+
+	Allocators::Arena<>& Get() { return *m_Arena; }
+
+private:
+	Allocators::Arena<>* m_Arena;
+	Allocators::Arena<>* m_OwnedArena;
+};
+
 
 #endif
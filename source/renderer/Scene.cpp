@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,6 +27,7 @@
 
 #include "precompiled.h"
 
+#include "graphics/Frustum.h"
 #include "graphics/Model.h"
 #include "graphics/ParticleEmitter.h"
 #include "renderer/Scene.h"
@@ -58,3 +59,9 @@ void SceneCollector::SubmitRecursive(CModelAbstract* model)
 	else
 		debug_warn(L"unknown model type");
 }
+
+void SceneCollector::SubmitRecursiveCulled(CModelAbstract* model, const CBoundingBoxAligned& bounds, const CFrustum& frustum)
+{
+	if (frustum.IsBoxVisible(CVector3D(0, 0, 0), bounds))
+		SubmitRecursive(model);
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -28,6 +28,7 @@
 #ifndef INCLUDED_SCENE
 #define INCLUDED_SCENE
 
+class CBoundingBoxAligned;
 class CFrustum;
 class CModel;
 class CModelAbstract;
@@ -133,6 +134,17 @@ public:
 	 * so you shouldn't have to reimplement it.
 	 */
 	virtual void SubmitRecursive(CModelAbstract* model);
+
+	/**
+	 * Submit a model (including attached sub-models) if its world-space
+	 * @p bounds are visible in @p frustum.
+	 *
+	 * The default implementation tests the bounds immediately. Collectors may
+	 * instead defer the test and do many of them at once (e.g. in parallel),
+	 * so the model and the frustum must stay valid until the collector has
+	 * finished collecting the scene.
+	 */
+	virtual void SubmitRecursiveCulled(CModelAbstract* model, const CBoundingBoxAligned& bounds, const CFrustum& frustum);
 };
 
 
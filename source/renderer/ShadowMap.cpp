@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -87,6 +87,21 @@ struct ShadowMapInternals
 	// Save the caller's FBO so it can be restored
 	GLint SavedViewFBO;
 
+	// whether the shadow matrices have been calculated for this frame
+	bool MatricesValid;
+
+	// signature of the objects added by AddShadowCaster in this frame,
+	// and whether any of them changed
+	size_t SceneSignature;
+	bool SceneChanged;
+
+	// whether the texture contains a completed shadow map, and the signature
+	// and matrices it was rendered with
+	bool CacheValid;
+	size_t CachedSceneSignature;
+	CMatrix3D CachedLightProjection;
+	CMatrix3D CachedLightTransform;
+
 	// Helper functions
 	void CalcShadowMatrices();
 	void CreateTexture();
@@ -114,15 +129,21 @@ ShadowMap::ShadowMap()
 
 	// Avoid using uninitialised values in AddShadowedBound if SetupFrame wasn't called first
 	m->LightTransform.SetIdentity();
+
+	m->MatricesValid = false;
+	m->SceneSignature = 0;
+	m->SceneChanged = false;
+	m->CacheValid = false;
+	m->CachedSceneSignature = 0;
 }
 
 
 ShadowMap::~ShadowMap()
 {
 	if (m->Texture)
-		glDeleteTextures(1, &m->Texture);
+		ogl_DeleteTextures(1, &m->Texture);
 	if (m->DummyTexture)
-		glDeleteTextures(1, &m->DummyTexture);
+		ogl_DeleteTextures(1, &m->DummyTexture);
 	if (m->Framebuffer)
 		pglDeleteFramebuffersEXT(1, &m->Framebuffer);
 
@@ -135,9 +156,9 @@ ShadowMap::~ShadowMap()
 void ShadowMap::RecreateTexture()
 {
 	if (m->Texture)
-		glDeleteTextures(1, &m->Texture);
+		ogl_DeleteTextures(1, &m->Texture);
 	if (m->DummyTexture)
-		glDeleteTextures(1, &m->DummyTexture);
+		ogl_DeleteTextures(1, &m->DummyTexture);
 	if (m->Framebuffer)
 		pglDeleteFramebuffersEXT(1, &m->Framebuffer);
 
@@ -199,6 +220,10 @@ void ShadowMap::SetupFrame(const CCamera& camera, const CVector3D& lightdir)
 
 	m->LightTransform.GetInverse(m->InvLightTransform);
 	m->ShadowBound.SetEmpty();
+	m->MatricesValid = false;
+
+	m->SceneSignature = 0;
+	m->SceneChanged = false;
 
 	//
 	m->LightspaceCamera = camera;
@@ -219,6 +244,44 @@ void ShadowMap::AddShadowedBound(const CBoundingBoxAligned& bounds)
 }
 
 
+//////////////////////////////////////////////////////////////////////////////
+// Record the objects drawn into the shadow map, so we can tell whether the
+// previous frame's map can be reused
+void ShadowMap::AddShadowCaster(const void* object, bool changed)
+{
+	// Combine the objects with a commutative operation, so the signature
+	// doesn't depend on the order they're submitted in
+	size_t hash = (size_t)object;
+	hash ^= hash >> 16;
+	hash *= 0x45d9f3bu;
+	hash ^= hash >> 16;
+	m->SceneSignature += hash;
+
+	if (changed)
+		m->SceneChanged = true;
+}
+
+void ShadowMap::InvalidateCache()
+{
+	m->CacheValid = false;
+}
+
+bool ShadowMap::IsUpToDate()
+{
+	if (!m->MatricesValid)
+	{
+		m->CalcShadowMatrices();
+		m->MatricesValid = true;
+	}
+
+	return m->CacheValid &&
+		!m->SceneChanged &&
+		m->SceneSignature == m->CachedSceneSignature &&
+		m->LightProjection == m->CachedLightProjection &&
+		m->LightTransform == m->CachedLightTransform;
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // CalcShadowMatrices: calculate required matrices for shadow map generation - the light's
 // projection and transformation matrices
@@ -304,15 +367,18 @@ void ShadowMapInternals::CalcShadowMatrices()
 // Create the shadow map
 void ShadowMapInternals::CreateTexture()
 {
+	// The new texture has no contents yet
+	CacheValid = false;
+
 	// Cleanup
 	if (Texture)
 	{
-		glDeleteTextures(1, &Texture);
+		ogl_DeleteTextures(1, &Texture);
 		Texture = 0;
 	}
 	if (DummyTexture)
 	{
-		glDeleteTextures(1, &DummyTexture);
+		ogl_DeleteTextures(1, &DummyTexture);
 		DummyTexture = 0;
 	}
 	if (Framebuffer)
@@ -412,7 +478,7 @@ void ShadowMapInternals::CreateTexture()
 	ogl_WarnIfError();
 
 	// bind to framebuffer object
-	glBindTexture(GL_TEXTURE_2D, 0);
+	ogl_BindTexture(GL_TEXTURE_2D, 0);
 	pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, Framebuffer);
 
 	pglFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_TEXTURE_2D, Texture, 0);
@@ -460,11 +526,15 @@ void ShadowMap::BeginRender()
 	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &m->SavedViewFBO);
 
 	// Calc remaining shadow matrices
-	m->CalcShadowMatrices();
+	if (!m->MatricesValid)
+	{
+		m->CalcShadowMatrices();
+		m->MatricesValid = true;
+	}
 
 	{
 		PROFILE("bind framebuffer");
-		glBindTexture(GL_TEXTURE_2D, 0);
+		ogl_BindTexture(GL_TEXTURE_2D, 0);
 		pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, m->Framebuffer);
 	}
 
@@ -516,6 +586,13 @@ void ShadowMap::EndRender()
 	glViewport(0, 0, g_Renderer.GetWidth(), g_Renderer.GetHeight());
 
 	glColorMask(1,1,1,1);
+
+	// Remember what the texture now contains, so it can be reused if the
+	// next frame is identical
+	m->CacheValid = true;
+	m->CachedSceneSignature = m->SceneSignature;
+	m->CachedLightProjection = m->LightProjection;
+	m->CachedLightTransform = m->LightTransform;
 }
 
 
@@ -545,7 +622,7 @@ void ShadowMap::SetDepthTextureBits(int bits)
 	{
 		if (m->Texture)
 		{
-			glDeleteTextures(1, &m->Texture);
+			ogl_DeleteTextures(1, &m->Texture);
 			m->Texture = 0;
 		}
 		m->Width = m->Height = 0;
@@ -574,17 +651,17 @@ void ShadowMap::RenderDebugBounds()
 	shaderTech->BeginPass();
 	CShaderProgramPtr shader = shaderTech->GetShader();
 
-	glDepthMask(0);
+	ogl_DepthMask(0);
 	glDisable(GL_CULL_FACE);
 
 	// Render shadow bound
 	shader->Uniform("transform", g_Renderer.GetViewCamera().GetViewProjection() * m->InvLightTransform);
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	ogl_Enable(GL_BLEND);
+	ogl_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	shader->Uniform("color", 0.0f, 0.0f, 1.0f, 0.25f);
 	m->ShadowBound.Render(shader);
-	glDisable(GL_BLEND);
+	ogl_Disable(GL_BLEND);
 
 	shader->Uniform("color", 0.0f, 0.0f, 1.0f, 1.0f);
 	m->ShadowBound.RenderOutline(shader);
@@ -618,8 +695,8 @@ void ShadowMap::RenderDebugBounds()
 	glPushMatrix();
 	glMultMatrixf(&InvTexTransform._11);
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	ogl_Enable(GL_BLEND);
+	ogl_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glColor4ub(255,0,0,64);
 	glBegin(GL_QUADS);
 		glVertex3f(0.0, 0.0, 0.0);
@@ -627,7 +704,7 @@ void ShadowMap::RenderDebugBounds()
 		glVertex3f(1.0, 1.0, 0.0);
 		glVertex3f(0.0, 1.0, 0.0);
 	glEnd();
-	glDisable(GL_BLEND);
+	ogl_Disable(GL_BLEND);
 
 	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 	glColor3ub(255,0,0);
@@ -642,14 +719,14 @@ void ShadowMap::RenderDebugBounds()
 #endif
 
 	glEnable(GL_CULL_FACE);
-	glDepthMask(1);
+	ogl_DepthMask(1);
 }
 
 void ShadowMap::RenderDebugTexture()
 {
-	glDepthMask(0);
+	ogl_DepthMask(0);
 
-	glDisable(GL_DEPTH_TEST);
+	ogl_Disable(GL_DEPTH_TEST);
 
 #if !CONFIG2_GLES
 	g_Renderer.BindTexture(0, m->Texture);
@@ -685,6 +762,6 @@ void ShadowMap::RenderDebugTexture()
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_R_TO_TEXTURE);
 #endif
 
-	glEnable(GL_DEPTH_TEST);
-	glDepthMask(1);
+	ogl_Enable(GL_DEPTH_TEST);
+	ogl_DepthMask(1);
 }
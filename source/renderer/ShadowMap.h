@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -96,6 +96,31 @@ public:
 	 */
 	void AddShadowedBound(const CBoundingBoxAligned& bounds);
 
+	/**
+	 * AddShadowCaster: Record an object that will be drawn into the shadow map
+	 * this frame. If the same objects are recorded as in the previous frame,
+	 * with none of them changed, the previous frame's shadow map can be reused
+	 * (see IsUpToDate).
+	 *
+	 * @param object pointer identifying the object
+	 * @param changed whether the object might look different to the previous frame
+	 */
+	void AddShadowCaster(const void* object, bool changed);
+
+	/**
+	 * InvalidateCache: Force the shadow map to be rendered again, e.g. when the
+	 * scene might have changed in frames where it wasn't rendered.
+	 */
+	void InvalidateCache();
+
+	/**
+	 * IsUpToDate: Return whether the shadow map texture still contains the result
+	 * of rendering the same objects with the same light and bounds as in this frame,
+	 * in which case BeginRender, EndRender and the rendering between them can be
+	 * skipped. Must be called after all the objects have been added.
+	 */
+	bool IsUpToDate();
+
 	/**
 	 * BeginRender: Set OpenGL state for rendering into the shadow map texture.
 	 *
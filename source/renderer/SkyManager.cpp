@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -92,7 +92,7 @@ void SkyManager::LoadSkyTextures()
 	// as soon as all the hardcoded GL_TEXTURE_2D references are corrected in the TextureManager/OGL/tex libs.
 	
 	glGenTextures(1, &m_SkyCubeMap);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, m_SkyCubeMap);
+	ogl_BindTexture(GL_TEXTURE_CUBE_MAP, m_SkyCubeMap);
 	
 	int types[] = {
 		GL_TEXTURE_CUBE_MAP_POSITIVE_X,
@@ -123,7 +123,7 @@ void SkyManager::LoadSkyTextures()
 			VfsPath path2 = VfsPath("art/textures/skies") / m_SkySet / (Path::String(images[i])+L".dds.cached.dds");
 			if (g_VFS->LoadFile(path2, file, fileSize) < 0)
 			{
-				glDeleteTextures(1, &m_SkyCubeMap);
+				ogl_DeleteTextures(1, &m_SkyCubeMap);
 				LOGERROR(L"Error creating sky cubemap.");
 				return;
 			}
@@ -169,7 +169,7 @@ void SkyManager::LoadSkyTextures()
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 	
-	glBindTexture(GL_TEXTURE_2D, 0);
+	ogl_BindTexture(GL_TEXTURE_2D, 0);
 	///////////////////////////////////////////////////////////////////////////
 }
 
@@ -183,7 +183,7 @@ void SkyManager::SetSkySet( const CStrW& newSet )
 	
 	if (m_SkyCubeMap)
 	{
-		glDeleteTextures(1, &m_SkyCubeMap);
+		ogl_DeleteTextures(1, &m_SkyCubeMap);
 		m_SkyCubeMap = 0;
 	}
 	
@@ -233,9 +233,9 @@ void SkyManager::RenderSky()
 	if (m_SkySet.empty())
 		return;
 
-	glDepthMask( GL_FALSE );
+	ogl_DepthMask( GL_FALSE );
 	
-	pglActiveTextureARB(GL_TEXTURE0_ARB);
+	ogl_ActiveTexture(GL_TEXTURE0_ARB);
 	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 
 	glMatrixMode(GL_MODELVIEW);
@@ -269,7 +269,7 @@ void SkyManager::RenderSky()
 	{
 		glDisable(GL_TEXTURE_2D);
 		glEnable(GL_TEXTURE_CUBE_MAP);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, m_SkyCubeMap);
+		ogl_BindTexture(GL_TEXTURE_CUBE_MAP, m_SkyCubeMap);
 	}
 
 	// GL_TEXTURE_CUBE_MAP_NEGATIVE_X
@@ -327,14 +327,14 @@ void SkyManager::RenderSky()
 	}
 	else
 	{
-		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+		ogl_BindTexture(GL_TEXTURE_CUBE_MAP, 0);
 		glDisable(GL_TEXTURE_CUBE_MAP);
 		glEnable(GL_TEXTURE_2D);
 	}
 	
 	glPopMatrix();
 
-	glDepthMask( GL_TRUE );
+	ogl_DepthMask( GL_TRUE );
 
 #endif
 }
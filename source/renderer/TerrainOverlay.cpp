@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -137,9 +137,9 @@ void TerrainOverlay::RenderBeforeWater()
 #if CONFIG2_GLES
 #warning TODO: implement TerrainOverlay::RenderOverlays for GLES
 #else
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glDepthMask(GL_FALSE);
+	ogl_Enable(GL_BLEND);
+	ogl_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	ogl_DepthMask(GL_FALSE);
 	// To ensure that outlines are drawn on top of the terrain correctly (and
 	// don't Z-fight and flicker nastily), draw them as QUADS with the LINE
 	// PolygonMode, and use PolygonOffset to pull them towards the camera.
@@ -148,7 +148,7 @@ void TerrainOverlay::RenderBeforeWater()
 	glEnable(GL_POLYGON_OFFSET_LINE);
 	glEnable(GL_POLYGON_OFFSET_FILL);
 
-	pglActiveTextureARB(GL_TEXTURE0);
+	ogl_ActiveTexture(GL_TEXTURE0);
 	glDisable(GL_TEXTURE_2D);
 
 	StartRender();
@@ -171,12 +171,12 @@ void TerrainOverlay::RenderBeforeWater()
 
 	// Clean up state changes
 	glEnable(GL_CULL_FACE);
-	glEnable(GL_DEPTH_TEST);
+	ogl_Enable(GL_DEPTH_TEST);
 	glDisable(GL_POLYGON_OFFSET_LINE);
 	glDisable(GL_POLYGON_OFFSET_FILL);
 	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	glDepthMask(GL_TRUE);
-	glDisable(GL_BLEND);
+	ogl_DepthMask(GL_TRUE);
+	ogl_Disable(GL_BLEND);
 #endif
 }
 
@@ -193,12 +193,12 @@ void TerrainOverlay::RenderTile(const CColor& colour, bool draw_hidden, ssize_t
 
 	if (draw_hidden)
 	{
-		glDisable(GL_DEPTH_TEST);
+		ogl_Disable(GL_DEPTH_TEST);
 		glDisable(GL_CULL_FACE);
 	}
 	else
 	{
-		glEnable(GL_DEPTH_TEST);
+		ogl_Enable(GL_DEPTH_TEST);
 		glEnable(GL_CULL_FACE);
 	}
 	
@@ -245,12 +245,12 @@ void TerrainOverlay::RenderTileOutline(const CColor& colour, int line_width, boo
 {
 	if (draw_hidden)
 	{
-		glDisable(GL_DEPTH_TEST);
+		ogl_Disable(GL_DEPTH_TEST);
 		glDisable(GL_CULL_FACE);
 	}
 	else
 	{
-		glEnable(GL_DEPTH_TEST);
+		ogl_Enable(GL_DEPTH_TEST);
 		glEnable(GL_CULL_FACE);
 	}
 
@@ -288,7 +288,7 @@ TerrainTextureOverlay::TerrainTextureOverlay(float texelsPerTile, int priority)
 
 TerrainTextureOverlay::~TerrainTextureOverlay()
 {
-	glDeleteTextures(1, &m_Texture);
+	ogl_DeleteTextures(1, &m_Texture);
 }
 
 void TerrainTextureOverlay::RenderAfterWater()
@@ -298,7 +298,7 @@ void TerrainTextureOverlay::RenderAfterWater()
 	ssize_t w = (ssize_t)(terrain->GetTilesPerSide() * m_TexelsPerTile);
 	ssize_t h = (ssize_t)(terrain->GetTilesPerSide() * m_TexelsPerTile);
 
-	pglActiveTextureARB(GL_TEXTURE0);
+	ogl_ActiveTexture(GL_TEXTURE0);
 
 	// Recreate the texture with new size if necessary
 	if (round_up_to_pow2(w) != m_TextureW || round_up_to_pow2(h) != m_TextureH)
@@ -306,7 +306,7 @@ void TerrainTextureOverlay::RenderAfterWater()
 		m_TextureW = round_up_to_pow2(w);
 		m_TextureH = round_up_to_pow2(h);
 
-		glBindTexture(GL_TEXTURE_2D, m_Texture);
+		ogl_BindTexture(GL_TEXTURE_2D, m_Texture);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_TextureW, m_TextureH, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -318,7 +318,7 @@ void TerrainTextureOverlay::RenderAfterWater()
 	u8* data = (u8*)calloc(w * h, 4);
 	BuildTextureRGBA(data, w, h);
 
-	glBindTexture(GL_TEXTURE_2D, m_Texture);
+	ogl_BindTexture(GL_TEXTURE_2D, m_Texture);
 	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, data);
 
 	free(data);
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -174,17 +174,19 @@ void TerrainRenderer::EndFrame()
 // Culls patches and decals against a frustum.
 bool TerrainRenderer::CullPatches(const CFrustum* frustum)
 {
+	const CFrustumSoA planes(*frustum);
+
 	m->filteredPatches.clear();
 	for (std::vector<CPatchRData*>::iterator it = m->visiblePatches.begin(); it != m->visiblePatches.end(); ++it)
 	{
-		if (frustum->IsBoxVisible(CVector3D(0, 0, 0), (*it)->GetPatch()->GetWorldBounds()))
+		if (planes.IsBoxVisible((*it)->GetPatch()->GetWorldBounds()))
 			m->filteredPatches.push_back(*it);
 	}
 
 	m->filteredDecals.clear();
 	for (std::vector<CDecalRData*>::iterator it = m->visibleDecals.begin(); it != m->visibleDecals.end(); ++it)
 	{
-		if (frustum->IsBoxVisible(CVector3D(0, 0, 0), (*it)->GetDecal()->GetWorldBounds()))
+		if (planes.IsBoxVisible((*it)->GetDecal()->GetWorldBounds()))
 			m->filteredDecals.push_back(*it);
 	}
 
@@ -222,7 +224,7 @@ void TerrainRenderer::RenderTerrain(bool filtered)
 	
 	// render everything fullbright
 	// set up texture environment for base pass
-	pglActiveTextureARB(GL_TEXTURE0);
+	ogl_ActiveTexture(GL_TEXTURE0);
 	pglClientActiveTextureARB(GL_TEXTURE0);
 	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
 	glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_RGB_ARB, GL_REPLACE);
@@ -249,7 +251,7 @@ void TerrainRenderer::RenderTerrain(bool filtered)
 	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 
 	// setup additional texenv required by blend pass
-	pglActiveTextureARB(GL_TEXTURE1);
+	ogl_ActiveTexture(GL_TEXTURE1);
 	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
 	glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_RGB_ARB, GL_REPLACE);
 	glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE0_RGB_ARB, GL_PREVIOUS);
@@ -259,19 +261,21 @@ void TerrainRenderer::RenderTerrain(bool filtered)
 	glTexEnvi(GL_TEXTURE_ENV, GL_OPERAND0_ALPHA_ARB, GL_ONE_MINUS_SRC_ALPHA);
 
 	// switch on blending
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	ogl_Enable(GL_BLEND);
+	ogl_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	// no need to write to the depth buffer a second time
-	glDepthMask(0);
+	ogl_DepthMask(0);
 	
 	// The decal color array contains lighting data, which we don't want in this non-shader mode
 	glDisableClientState(GL_COLOR_ARRAY);
 
 	// render blend passes for each patch
-	PROFILE_START("render terrain blends");
-	CPatchRData::RenderBlends(visiblePatches, CShaderDefines(), NULL, true, dummyShader);
-	PROFILE_END("render terrain blends");
+	{
+		PROFILE("render terrain blends");
+		CRenderPassCounter counter(CRenderer::STATE_PASS_TERRAIN_BLENDS);
+		CPatchRData::RenderBlends(visiblePatches, CShaderDefines(), NULL, true, dummyShader);
+	}
 
 	// Disable second texcoord array
 	pglClientActiveTextureARB(GL_TEXTURE1);
@@ -281,7 +285,7 @@ void TerrainRenderer::RenderTerrain(bool filtered)
 	// Render terrain decals
 
 	g_Renderer.BindTexture(1, 0);
-	pglActiveTextureARB(GL_TEXTURE0);
+	ogl_ActiveTexture(GL_TEXTURE0);
 	pglClientActiveTextureARB(GL_TEXTURE0);
 	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
 	glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_RGB_ARB, GL_MODULATE);
@@ -309,7 +313,7 @@ void TerrainRenderer::RenderTerrain(bool filtered)
 	// is what previous passes drew onto the framebuffer, and 'lighting' is the
 	// color computed by this pass.
 	// We can do that with blending by getting it to draw dst*src + src*dst:
-	glBlendFunc(GL_DST_COLOR, GL_SRC_COLOR);
+	ogl_BlendFunc(GL_DST_COLOR, GL_SRC_COLOR);
 
 	// Scale the ambient color by 0.5 to match the vertex diffuse colors
 	float terrainAmbientColor[4] = {
@@ -323,7 +327,7 @@ void TerrainRenderer::RenderTerrain(bool filtered)
 
 	int streamflags = STREAM_POS|STREAM_COLOR;
 
-	pglActiveTextureARB(GL_TEXTURE0);
+	ogl_ActiveTexture(GL_TEXTURE0);
 	// We're not going to use a texture here, but we have to have a valid texture
 	// bound else the texture unit will be disabled.
 	// We should still have a bound splat texture from some earlier rendering,
@@ -362,7 +366,7 @@ void TerrainRenderer::RenderTerrain(bool filtered)
 	glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE0_ALPHA_ARB, GL_PREVIOUS);
 	glTexEnvi(GL_TEXTURE_ENV, GL_OPERAND0_ALPHA_ARB, GL_SRC_ALPHA);
 
-	pglActiveTextureARB(GL_TEXTURE0);
+	ogl_ActiveTexture(GL_TEXTURE0);
 	pglClientActiveTextureARB(GL_TEXTURE0);
 
 	PROFILE_START("render terrain streams");
@@ -383,11 +387,11 @@ void TerrainRenderer::RenderTerrain(bool filtered)
 	glMatrixMode(GL_MODELVIEW);
 
 	pglClientActiveTextureARB(GL_TEXTURE0);
-	pglActiveTextureARB(GL_TEXTURE0);
+	ogl_ActiveTexture(GL_TEXTURE0);
 
-	glDepthMask(1);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glDisable(GL_BLEND);
+	ogl_DepthMask(1);
+	ogl_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	ogl_Disable(GL_BLEND);
 	glDisableClientState(GL_COLOR_ARRAY);
 	glDisableClientState(GL_VERTEX_ARRAY);
 	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
@@ -410,9 +414,9 @@ void TerrainRenderer::RenderTerrainOverlayTexture(CMatrix3D& textureMatrix)
 	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 
 	glEnable(GL_TEXTURE_2D);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glDepthMask(0);
+	ogl_Enable(GL_BLEND);
+	ogl_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	ogl_DepthMask(0);
 
 	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 
@@ -451,8 +455,8 @@ void TerrainRenderer::RenderTerrainOverlayTexture(CMatrix3D& textureMatrix)
 	glLoadIdentity();
 	glMatrixMode(GL_MODELVIEW);
 
-	glDepthMask(1);
-	glDisable(GL_BLEND);
+	ogl_DepthMask(1);
+	ogl_Disable(GL_BLEND);
 	glDisableClientState(GL_COLOR_ARRAY);
 	glDisableClientState(GL_VERTEX_ARRAY);
 	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
@@ -521,12 +525,14 @@ void TerrainRenderer::RenderTerrainShader(const CShaderDefines& context, ShadowM
 	PROFILE_END("render terrain base");
 
 	// no need to write to the depth buffer a second time
-	glDepthMask(0);
+	ogl_DepthMask(0);
 
 	// render blend passes for each patch
-	PROFILE_START("render terrain blends");
-	CPatchRData::RenderBlends(visiblePatches, context, shadow, false);
-	PROFILE_END("render terrain blends");
+	{
+		PROFILE("render terrain blends");
+		CRenderPassCounter counter(CRenderer::STATE_PASS_TERRAIN_BLENDS);
+		CPatchRData::RenderBlends(visiblePatches, context, shadow, false);
+	}
 
 	PROFILE_START("render terrain decals");
 	CDecalRData::RenderDecals(visibleDecals, context, shadow, false);
@@ -537,9 +543,9 @@ void TerrainRenderer::RenderTerrainShader(const CShaderDefines& context, ShadowM
 	g_Renderer.BindTexture(2, 0);
 	g_Renderer.BindTexture(3, 0);
 
-	glDepthMask(1);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glDisable(GL_BLEND);
+	ogl_DepthMask(1);
+	ogl_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	ogl_Disable(GL_BLEND);
 }
 
 
@@ -694,7 +700,7 @@ bool TerrainRenderer::RenderFancyWater(const CShaderDefines& context, ShadowMap*
 		{
 			delete[] WaterMgr->m_Heightmap;
 			WaterMgr->m_Heightmap = NULL;
-			glDeleteTextures(1, &WaterMgr->m_HeightmapTexture);
+			ogl_DeleteTextures(1, &WaterMgr->m_HeightmapTexture);
 			WaterMgr->m_NeedsReloading = false;
 			WaterMgr->m_NeedsFullReloading = false;
 			
@@ -716,11 +722,11 @@ bool TerrainRenderer::RenderFancyWater(const CShaderDefines& context, ShadowMap*
 		{
 			glGenTextures(1, (GLuint*)&depthTex);
 			WaterMgr->m_depthTT = depthTex;
-			glBindTexture(GL_TEXTURE_2D, WaterMgr->m_depthTT);
+			ogl_BindTexture(GL_TEXTURE_2D, WaterMgr->m_depthTT);
 			glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, g_Renderer.GetWidth(), g_Renderer.GetHeight(),
 						 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE,NULL);
 		}
-		glBindTexture(GL_TEXTURE_2D, WaterMgr->m_depthTT);
+		ogl_BindTexture(GL_TEXTURE_2D, WaterMgr->m_depthTT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -729,16 +735,16 @@ bool TerrainRenderer::RenderFancyWater(const CShaderDefines& context, ShadowMap*
 		
 		glCopyTexImage2D(GL_TEXTURE_2D,0,GL_DEPTH_COMPONENT, 0, 0, g_Renderer.GetWidth(), g_Renderer.GetHeight(), 0);
 		
-		glBindTexture(GL_TEXTURE_2D, 0);
+		ogl_BindTexture(GL_TEXTURE_2D, 0);
 	}
 	// Calculating the advanced informations about Foam and all if the quality calls for it.
 	if (WaterMgr->m_Heightmap == NULL && (WaterMgr->m_WaterFoam || WaterMgr->m_WaterCoastalWaves))
 		WaterMgr->CreateSuperfancyInfo();
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glEnable(GL_DEPTH_TEST);
-	glDepthFunc(GL_LEQUAL);
+	ogl_Enable(GL_BLEND);
+	ogl_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	ogl_Enable(GL_DEPTH_TEST);
+	ogl_DepthFunc(GL_LEQUAL);
 
 	double time = WaterMgr->m_WaterTexTimer;
 	double period = 8;
@@ -763,14 +769,14 @@ bool TerrainRenderer::RenderFancyWater(const CShaderDefines& context, ShadowMap*
 			glGenTextures(1, &renderedTexture);
 			WaterMgr->m_waveTT = renderedTexture;
 			
-			glBindTexture(GL_TEXTURE_2D, WaterMgr->m_waveTT);
+			ogl_BindTexture(GL_TEXTURE_2D, WaterMgr->m_waveTT);
 			int size = (int)round_up_to_pow2((unsigned)g_Renderer.GetHeight());
 			if(size > g_Renderer.GetHeight()) size /= 2;
 			
 			glTexImage2D(GL_TEXTURE_2D, 0,GL_RGBA, (float)g_Renderer.GetWidth(), (float)g_Renderer.GetHeight(), 0,GL_RGBA, GL_UNSIGNED_BYTE, 0);
 
 		}
-		glBindTexture(GL_TEXTURE_2D, WaterMgr->m_waveTT);
+		ogl_BindTexture(GL_TEXTURE_2D, WaterMgr->m_waveTT);
 		
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -801,7 +807,7 @@ bool TerrainRenderer::RenderFancyWater(const CShaderDefines& context, ShadowMap*
 		
 		// rebind post-processing frambuffer.
 		pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo);
-		glBindTexture(GL_TEXTURE_2D, 0);
+		ogl_BindTexture(GL_TEXTURE_2D, 0);
 		
 	}
 	
@@ -880,10 +886,10 @@ bool TerrainRenderer::RenderFancyWater(const CShaderDefines& context, ShadowMap*
 
 	m->fancyWaterShader->Unbind();
 
-	pglActiveTextureARB(GL_TEXTURE0);
+	ogl_ActiveTexture(GL_TEXTURE0);
 	pglDeleteFramebuffersEXT(1, &FramebufferName);
 
-	glDisable(GL_BLEND);
+	ogl_Disable(GL_BLEND);
 
 	return true;
 }
@@ -896,10 +902,10 @@ void TerrainRenderer::RenderSimpleWater()
 	WaterManager* WaterMgr = g_Renderer.GetWaterManager();
 	CLOSTexture& losTexture = g_Game->GetView()->GetLOSTexture();
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA,GL_ONE_MINUS_SRC_ALPHA);
-	glEnable(GL_DEPTH_TEST);
-	glDepthFunc(GL_LEQUAL);
+	ogl_Enable(GL_BLEND);
+	ogl_BlendFunc(GL_SRC_ALPHA,GL_ONE_MINUS_SRC_ALPHA);
+	ogl_Enable(GL_DEPTH_TEST);
+	ogl_DepthFunc(GL_LEQUAL);
 
 	double time = WaterMgr->m_WaterTexTimer;
 	double period = 1.6f;
@@ -980,14 +986,14 @@ void TerrainRenderer::RenderSimpleWater()
 	glDisable(GL_TEXTURE_GEN_T);
 	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
 
-	pglActiveTextureARB(GL_TEXTURE0_ARB);
+	ogl_ActiveTexture(GL_TEXTURE0_ARB);
 
 	// Clean up the texture matrix and blend mode
 	glDisable(GL_TEXTURE_GEN_S);
 	glDisable(GL_TEXTURE_GEN_T);
 	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
 
-	glDisable(GL_BLEND);
+	ogl_Disable(GL_BLEND);
 	glDisable(GL_TEXTURE_2D);
 #endif
 }
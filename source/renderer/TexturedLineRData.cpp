@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -32,40 +32,6 @@
  * because it allows you to work with variable amounts of vertices and indices more easily. New code should prefer
  * to use VertexArray where possible, though. */
 
-void CTexturedLineRData::Render(const SOverlayTexturedLine& line, const CShaderProgramPtr& shader)
-{
-	if (!m_VB || !m_VBIndices)
-		return; // might have failed to allocate
-
-	// -- render main line quad strip ----------------------
-
-	const int streamFlags = shader->GetStreamFlags();
-
-	shader->BindTexture("baseTex", line.m_TextureBase->GetHandle());
-	shader->BindTexture("maskTex", line.m_TextureMask->GetHandle());
-	shader->Uniform("objectColor", line.m_Color);
-
-	GLsizei stride = sizeof(CTexturedLineRData::SVertex);
-	CTexturedLineRData::SVertex* vertexBase = reinterpret_cast<CTexturedLineRData::SVertex*>(m_VB->m_Owner->Bind());
-
-	if (streamFlags & STREAM_POS)
-		shader->VertexPointer(3, GL_FLOAT, stride, &vertexBase->m_Position[0]);
-
-	if (streamFlags & STREAM_UV0)
-		shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, stride, &vertexBase->m_UVs[0]);
-
-	if (streamFlags & STREAM_UV1)
-		shader->TexCoordPointer(GL_TEXTURE1, 2, GL_FLOAT, stride, &vertexBase->m_UVs[0]);
-
-	u8* indexBase = m_VBIndices->m_Owner->Bind();
-
-	shader->AssertPointersBound();
-	glDrawElements(GL_TRIANGLES, m_VBIndices->m_Count, GL_UNSIGNED_SHORT, indexBase + sizeof(u16)*m_VBIndices->m_Index); 
-
-	g_Renderer.GetStats().m_DrawCalls++;
-	g_Renderer.GetStats().m_OverlayTris += m_VBIndices->m_Count/3; 
-}
-
 void CTexturedLineRData::Update(const SOverlayTexturedLine& line)
 {
 	if (m_VB)
@@ -98,8 +64,12 @@ void CTexturedLineRData::Update(const SOverlayTexturedLine& line)
 	ENSURE(n >= 2); // minimum needed to avoid errors (also minimum value to make sense, can't draw a line between 1 point)
 
 	// In each iteration, p1 is the position of vertex i, p0 is i-1, p2 is i+1.
-	// To avoid slightly expensive terrain computations we cycle these around and
-	// recompute p2 at the end of each iteration.
+	// We cycle these around and compute the new p2 at the end of each iteration,
+	// using terrain heights and normals computed for all the points at once.
+
+	std::vector<float> heights(n);
+	std::vector<CVector3D> normals(n);
+	terrain.GetExactGroundLevels(&line.m_Coords[0], n, &heights[0], &normals[0]);
 
 	CVector3D p0;
 	CVector3D p1(line.m_Coords[0], 0, line.m_Coords[1]);
@@ -122,18 +92,18 @@ void CTexturedLineRData::Update(const SOverlayTexturedLine& line)
 	// TODO: if we ever support more than one water level per map, recompute this per point
 	float w = cmpWaterManager->GetExactWaterLevel(p0.X, p0.Z);
 
-	p0.Y = terrain.GetExactGroundLevel(p0.X, p0.Z);
+	p0.Y = (closed ? heights[n-1] : terrain.GetExactGroundLevel(p0.X, p0.Z));
 	if (p0.Y < w)
 		p0.Y = w;
 
-	p1.Y = terrain.GetExactGroundLevel(p1.X, p1.Z);
+	p1.Y = heights[0];
 	if (p1.Y < w)
 	{
 		p1.Y = w;
 		p1floating = true;
 	}
 
-	p2.Y = terrain.GetExactGroundLevel(p2.X, p2.Z);
+	p2.Y = heights[1 % n];
 	if (p2.Y < w)
 	{
 		p2.Y = w;
@@ -150,7 +120,7 @@ void CTexturedLineRData::Update(const SOverlayTexturedLine& line)
 		if (p1floating)
 			norm = CVector3D(0, 1, 0);
 		else
-			norm = terrain.CalcExactNormal(p1.X, p1.Z);
+			norm = normals[i];
 
 		CVector3D b = ((p1 - p0).Normalized() + (p2 - p1).Normalized()).Cross(norm);
 
@@ -206,12 +176,17 @@ void CTexturedLineRData::Update(const SOverlayTexturedLine& line)
 
 		// if in closed mode, wrap around the coordinate array for p2 -- otherwise, extend linearly
 		if (!closed && i == n-2)
+		{
 			// next iteration is the last point of the line, so create an artificial p2 that extends the p0 -> p1 direction
 			p2 = p1 + (p1 - p0);
+			p2.Y = terrain.GetExactGroundLevel(p2.X, p2.Z);
+		}
 		else
+		{
 			p2 = CVector3D(line.m_Coords[((i+2) % n)*2], 0, line.m_Coords[((i+2) % n)*2+1]);
+			p2.Y = heights[(i+2) % n];
+		}
 
-		p2.Y = terrain.GetExactGroundLevel(p2.X, p2.Z);
 		if (p2.Y < w)
 		{
 			p2.Y = w;
@@ -284,6 +259,14 @@ void CTexturedLineRData::Update(const SOverlayTexturedLine& line)
 
 	ENSURE(indices.size() % 3 == 0); // GL_TRIANGLES indices, so must be multiple of 3
 
+	SColor4ub color;
+	color.R = (u8)clamp((int)(line.m_Color.r * 255.f), 0, 255);
+	color.G = (u8)clamp((int)(line.m_Color.g * 255.f), 0, 255);
+	color.B = (u8)clamp((int)(line.m_Color.b * 255.f), 0, 255);
+	color.A = (u8)clamp((int)(line.m_Color.a * 255.f), 0, 255);
+	for (size_t k = 0; k < vertices.size(); ++k)
+		vertices[k].m_Color = color;
+
 	m_VB = g_VBMan.Allocate(sizeof(SVertex), vertices.size(), GL_STATIC_DRAW, GL_ARRAY_BUFFER);
 	if (m_VB) // allocation might fail (e.g. due to too many vertices)
 	{
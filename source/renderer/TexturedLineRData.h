@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,6 +20,7 @@
 
 #include "graphics/Overlay.h"
 #include "graphics/RenderableObject.h"
+#include "graphics/SColor.h"
 #include "graphics/ShaderProgram.h"
 #include "graphics/TextureManager.h"
 #include "renderer/VertexBufferManager.h"
@@ -55,19 +56,29 @@ public:
 	}
 
 	void Update(const SOverlayTexturedLine& line);
-	void Render(const SOverlayTexturedLine& line, const CShaderProgramPtr& shader);
-
-protected:
 
 	struct SVertex
 	{
 		SVertex(CVector3D pos, float u, float v) : m_Position(pos) { m_UVs[0] = u; m_UVs[1] = v; }
 		CVector3D m_Position;
 		GLfloat m_UVs[2];
-		float _padding[3]; // get a pow2 struct size
+		// The line's colour is stored per vertex, so that lines with different
+		// colours can be drawn in a single batch by OverlayRenderer
+		SColor4ub m_Color;
+		float _padding[2]; // get a pow2 struct size
 	};
 	cassert(sizeof(SVertex) == 32);
 
+	/**
+	 * Returns the vertex and index buffer chunks holding the line's triangles,
+	 * or NULL if they couldn't be allocated. The indices are relative to the
+	 * start of the vertex buffer.
+	 */
+	CVertexBuffer::VBChunk* GetVertices() const { return m_VB; }
+	CVertexBuffer::VBChunk* GetIndices() const { return m_VBIndices; }
+
+protected:
+
 	/**
 	 * Creates a line cap of the specified type @p endCapType at the end of the segment going in direction @p normal, and appends
 	 * the vertices to @p verticesOut in GL_TRIANGLES order.
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -38,6 +38,10 @@ VertexArray::VertexArray(GLenum usage, GLenum target)
 	m_VB = 0;
 	m_BackingStore = 0;
 	m_Stride = 0;
+
+	m_StreamOffset = 0;
+	m_StreamVertices = 0;
+	m_StreamGeneration = 0;
 }
 
 
@@ -57,6 +61,9 @@ void VertexArray::Free()
 		g_VBMan.Release(m_VB);
 		m_VB = 0;
 	}
+
+	m_StreamVertices = 0;
+	m_StreamGeneration = 0;
 }
 
 
@@ -277,8 +284,22 @@ void VertexArray::Layout()
 // (Re-)Upload the attributes.
 // Create the VBO if necessary.
 void VertexArray::Upload()
+{
+	Upload(m_NumVertices);
+}
+
+void VertexArray::Upload(size_t numVertices)
 {
 	ENSURE(m_BackingStore);
+
+	if (IsStreaming())
+	{
+		CStreamBuffer& buffer = g_VBMan.GetStreamBuffer(m_Target);
+		m_StreamOffset = buffer.Append(m_BackingStore, m_Stride * numVertices);
+		m_StreamVertices = numVertices;
+		m_StreamGeneration = buffer.GetGeneration();
+		return;
+	}
 	
 	if (!m_VB)
 		m_VB = g_VBMan.Allocate(m_Stride, m_NumVertices, m_Usage, m_Target);
@@ -286,13 +307,27 @@ void VertexArray::Upload()
 	if (!m_VB) // failed to allocate VBO
 		return;
 
-	m_VB->m_Owner->UpdateChunkVertices(m_VB, m_BackingStore);
+	m_VB->m_Owner->UpdateChunkVertices(m_VB, m_BackingStore, numVertices);
 }
 
 
 // Bind this array, returns the base address for calls to glVertexPointer etc.
 u8* VertexArray::Bind()
 {
+	if (IsStreaming())
+	{
+		if (!m_StreamGeneration)
+			return NULL;
+
+		// If the stream buffer was orphaned since we last uploaded, our data
+		// has been discarded, so upload it again
+		CStreamBuffer& buffer = g_VBMan.GetStreamBuffer(m_Target);
+		if (m_StreamGeneration != buffer.GetGeneration())
+			Upload(m_StreamVertices);
+
+		return buffer.Bind() + m_StreamOffset;
+	}
+
 	if (!m_VB)
 		return NULL;
 
@@ -305,6 +340,10 @@ u8* VertexArray::Bind()
 // Free the backing store to save some memory
 void VertexArray::FreeBackingStore()
 {
+	// Streamed data may need to be uploaded again
+	if (IsStreaming())
+		return;
+
 	rtl_FreeAligned(m_BackingStore);
 	m_BackingStore = 0;
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -129,6 +129,12 @@ private:
 //
 // Note that this class will not allocate any OpenGL resources until one
 // of the Upload functions is called.
+//
+// Arrays with GL_STREAM_DRAW usage don't own a VBO chunk. Each Upload appends
+// the data to a shared CStreamBuffer instead (which avoids stalling when the
+// GPU is still drawing the previous upload), so they should only be used for
+// data that changes about every frame. They keep their backing store, so the
+// data can be uploaded again if the stream buffer has discarded it.
 class VertexArray
 {
 public:
@@ -176,16 +182,21 @@ public:
 	// (Re-)Upload the attributes of the vertex array from the backing store to
 	// the underlying VBO object.
 	void Upload();
+	// Upload only the first numVertices vertices, e.g. when the rest of the
+	// array isn't going to be drawn.
+	void Upload(size_t numVertices);
 	// Bind this array, returns the base address for calls to glVertexPointer etc.
 	u8* Bind();
 
 	// If you know for certain that you'll never have to change the data again,
-	// call this to free some memory.
+	// call this to free some memory. (This does nothing for GL_STREAM_DRAW arrays.)
 	void FreeBackingStore();
 	
 private:
 	void Free();
 
+	bool IsStreaming() const { return m_Usage == GL_STREAM_DRAW; }
+
 	template<typename T>
 	VertexArrayIterator<T> MakeIterator(const Attribute* attr)
 	{
@@ -200,6 +211,11 @@ private:
 
 	CVertexBuffer::VBChunk* m_VB;
 	size_t m_Stride;
+
+	// Location and size of the last upload, for GL_STREAM_DRAW arrays
+	size_t m_StreamOffset;
+	size_t m_StreamVertices;
+	u32 m_StreamGeneration;
 	char* m_BackingStore; // 16-byte aligned, to allow fast SSE access
 };
 
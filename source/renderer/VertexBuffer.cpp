@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,6 +21,7 @@
 
 #include "precompiled.h"
 #include "ps/Errors.h"
+#include "lib/bits.h"
 #include "lib/ogl.h"
 #include "lib/sysdep/cpu.h"
 #include "Renderer.h"
@@ -45,9 +46,9 @@ CVertexBuffer::CVertexBuffer(size_t vertexSize, GLenum usage, GLenum target)
 	if (g_Renderer.m_Caps.m_VBO)
 	{
 		pglGenBuffersARB(1, &m_Handle);
-		pglBindBufferARB(m_Target, m_Handle);
+		ogl_BindBuffer(m_Target, m_Handle);
 		pglBufferDataARB(m_Target, size, 0, m_Usage);
-		pglBindBufferARB(m_Target, 0);
+		ogl_BindBuffer(m_Target, 0);
 	}
 	else
 	{
@@ -62,19 +63,19 @@ CVertexBuffer::CVertexBuffer(size_t vertexSize, GLenum usage, GLenum target)
 	chunk->m_Owner = this;
 	chunk->m_Count = m_FreeVertices;
 	chunk->m_Index = 0;
-	m_FreeList.push_front(chunk);
+	AddFreeChunk(chunk);
 }
 
 CVertexBuffer::~CVertexBuffer()
 {
 	if (m_Handle)
-		pglDeleteBuffersARB(1, &m_Handle);
+		ogl_DeleteBuffers(1, &m_Handle);
 
 	delete[] m_SysMem;
 
-	typedef std::list<VBChunk*>::iterator Iter;
-	for (Iter iter = m_FreeList.begin(); iter != m_FreeList.end(); ++iter)
-		delete *iter;
+	typedef std::map<size_t, VBChunk*>::iterator Iter;
+	for (Iter iter = m_FreeChunks.begin(); iter != m_FreeChunks.end(); ++iter)
+		delete iter->second;
 }
 
 
@@ -86,6 +87,18 @@ bool CVertexBuffer::CompatibleVertexType(size_t vertexSize, GLenum usage, GLenum
 	return true;
 }
 
+void CVertexBuffer::AddFreeChunk(VBChunk* chunk)
+{
+	m_FreeChunks[chunk->m_Index] = chunk;
+	m_FreeSizes.insert(std::make_pair(chunk->m_Count, chunk->m_Index));
+}
+
+void CVertexBuffer::RemoveFreeChunk(VBChunk* chunk)
+{
+	m_FreeChunks.erase(chunk->m_Index);
+	m_FreeSizes.erase(std::make_pair(chunk->m_Count, chunk->m_Index));
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Allocate: try to allocate a buffer of given number of vertices (each of 
 // given size), with the given type, and using the given texture - return null 
@@ -100,25 +113,18 @@ CVertexBuffer::VBChunk* CVertexBuffer::Allocate(size_t vertexSize, size_t numVer
 	if (numVertices > m_FreeVertices)
 		return 0;
 
-	// trawl free list looking for first free chunk with enough space
-	VBChunk* chunk = 0;
-	typedef std::list<VBChunk*>::iterator Iter;
-	for (Iter iter = m_FreeList.begin(); iter != m_FreeList.end(); ++iter) {
-		if (numVertices <= (*iter)->m_Count) {
-			chunk = *iter;
-			// remove this chunk from the free list
-			m_FreeList.erase(iter);
-			m_FreeVertices -= chunk->m_Count;
-			// no need to search further ..
-			break;
-		}
-	}
-
-	if (!chunk) {
+	// find the smallest free chunk with enough space (preferring the lowest
+	// index if there are several), to reduce fragmentation
+	std::set<std::pair<size_t, size_t> >::iterator fit = m_FreeSizes.lower_bound(std::make_pair(numVertices, (size_t)0));
+	if (fit == m_FreeSizes.end()) {
 		// no big enough spare chunk available
 		return 0;
 	}
 
+	VBChunk* chunk = m_FreeChunks[fit->second];
+	RemoveFreeChunk(chunk);
+	m_FreeVertices -= chunk->m_Count;
+
 	// split chunk into two; - allocate a new chunk using all unused vertices in the 
 	// found chunk, and add it to the free list
 	if (chunk->m_Count > numVertices)
@@ -127,7 +133,7 @@ CVertexBuffer::VBChunk* CVertexBuffer::Allocate(size_t vertexSize, size_t numVer
 		newchunk->m_Owner = this;
 		newchunk->m_Count = chunk->m_Count - numVertices;
 		newchunk->m_Index = chunk->m_Index + numVertices;
-		m_FreeList.push_front(newchunk);
+		AddFreeChunk(newchunk);
 		m_FreeVertices += newchunk->m_Count;
 
 		// resize given chunk
@@ -145,48 +151,60 @@ void CVertexBuffer::Release(VBChunk* chunk)
 	// Update total free count before potentially modifying this chunk's count
 	m_FreeVertices += chunk->m_Count;
 
-	typedef std::list<VBChunk*>::iterator Iter;
+	typedef std::map<size_t, VBChunk*>::iterator Iter;
 
-	// Coalesce with any free-list items that are adjacent to this chunk;
-	// merge the found chunk with the new one, and remove the old one
-	// from the list, and repeat until no more are found
-	bool coalesced;
-	do
+	// Coalesce with the free chunks immediately after and before this one, if
+	// there are any (free chunks are always coalesced, so there can't be more)
+	Iter next = m_FreeChunks.find(chunk->m_Index + chunk->m_Count);
+	if (next != m_FreeChunks.end())
 	{
-		coalesced = false;
-		for (Iter iter = m_FreeList.begin(); iter != m_FreeList.end(); ++iter)
+		VBChunk* nextChunk = next->second;
+		RemoveFreeChunk(nextChunk);
+		chunk->m_Count += nextChunk->m_Count;
+		delete nextChunk;
+	}
+
+	Iter prev = m_FreeChunks.lower_bound(chunk->m_Index);
+	if (prev != m_FreeChunks.begin())
+	{
+		--prev;
+		VBChunk* prevChunk = prev->second;
+		if (prevChunk->m_Index + prevChunk->m_Count == chunk->m_Index)
 		{
-			if ((*iter)->m_Index == chunk->m_Index + chunk->m_Count
-			 || (*iter)->m_Index + (*iter)->m_Count == chunk->m_Index)
-			{
-				chunk->m_Index = std::min(chunk->m_Index, (*iter)->m_Index);
-				chunk->m_Count += (*iter)->m_Count;
-				m_FreeList.erase(iter);
-				coalesced = true;
-				break;
-			}
+			RemoveFreeChunk(prevChunk);
+			chunk->m_Index = prevChunk->m_Index;
+			chunk->m_Count += prevChunk->m_Count;
+			delete prevChunk;
 		}
 	}
-	while (coalesced);
 
-	m_FreeList.push_front(chunk);
+	AddFreeChunk(chunk);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // UpdateChunkVertices: update vertex data for given chunk
 void CVertexBuffer::UpdateChunkVertices(VBChunk* chunk, void* data)
 {
+	UpdateChunkVertices(chunk, data, chunk->m_Count);
+}
+
+void CVertexBuffer::UpdateChunkVertices(VBChunk* chunk, void* data, size_t count)
+{
+	ENSURE(count <= chunk->m_Count);
+	if (count == 0)
+		return;
+
 	if (g_Renderer.m_Caps.m_VBO)
 	{
 		ENSURE(m_Handle);
-		pglBindBufferARB(m_Target, m_Handle);
-		pglBufferSubDataARB(m_Target, chunk->m_Index * m_VertexSize, chunk->m_Count * m_VertexSize, data);
-		pglBindBufferARB(m_Target, 0);
+		ogl_BindBuffer(m_Target, m_Handle);
+		pglBufferSubDataARB(m_Target, chunk->m_Index * m_VertexSize, count * m_VertexSize, data);
+		ogl_BindBuffer(m_Target, 0);
 	}
 	else
 	{
 		ENSURE(m_SysMem);
-		memcpy(m_SysMem + chunk->m_Index * m_VertexSize, data, chunk->m_Count * m_VertexSize);
+		memcpy(m_SysMem + chunk->m_Index * m_VertexSize, data, count * m_VertexSize);
 	}
 }
 
@@ -197,7 +215,7 @@ u8* CVertexBuffer::Bind()
 {
 	if (g_Renderer.m_Caps.m_VBO)
 	{
-		pglBindBufferARB(m_Target, m_Handle);
+		ogl_BindBuffer(m_Target, m_Handle);
 		return (u8*)0;
 	}
 	else
@@ -218,8 +236,8 @@ void CVertexBuffer::Unbind()
 {
 	if (g_Renderer.m_Caps.m_VBO)
 	{
-		pglBindBufferARB(GL_ARRAY_BUFFER, 0);
-		pglBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, 0);
+		ogl_BindBuffer(GL_ARRAY_BUFFER, 0);
+		ogl_BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	}
 }
 
@@ -233,16 +251,112 @@ size_t CVertexBuffer::GetBytesAllocated() const
 	return (m_MaxVertices - m_FreeVertices) * m_VertexSize;
 }
 
+size_t CVertexBuffer::GetLargestFreeChunk() const
+{
+	if (m_FreeSizes.empty())
+		return 0;
+	return m_FreeSizes.rbegin()->first;
+}
+
+size_t CVertexBuffer::GetBytesFragmented() const
+{
+	return (m_FreeVertices - GetLargestFreeChunk()) * m_VertexSize;
+}
+
 void CVertexBuffer::DumpStatus()
 {
 	debug_printf(L"freeverts = %d\n", (int)m_FreeVertices);
 
-	size_t maxSize = 0;
-	typedef std::list<VBChunk*>::iterator Iter;
-	for (Iter iter = m_FreeList.begin(); iter != m_FreeList.end(); ++iter)
+	typedef std::map<size_t, VBChunk*>::iterator Iter;
+	for (Iter iter = m_FreeChunks.begin(); iter != m_FreeChunks.end(); ++iter)
+		debug_printf(L"free chunk %p: index=%d size=%d\n", iter->second, (int)iter->first, (int)iter->second->m_Count);
+	debug_printf(L"max size = %d\n", (int)GetLargestFreeChunk());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Generation of the most recently orphaned stream buffer
+static u32 g_LastStreamGeneration = 0;
+
+CStreamBuffer::CStreamBuffer(GLenum target)
+	: m_Target(target), m_Handle(0), m_SysMem(0), m_Size(0), m_Offset(0), m_Generation(0)
+{
+	if (g_Renderer.m_Caps.m_VBO)
+		pglGenBuffersARB(1, &m_Handle);
+
+	Orphan(MAX_VB_SIZE_BYTES);
+}
+
+CStreamBuffer::~CStreamBuffer()
+{
+	if (m_Handle)
+		ogl_DeleteBuffers(1, &m_Handle);
+
+	delete[] m_SysMem;
+}
+
+void CStreamBuffer::Orphan(size_t minSize)
+{
+	bool grow = (minSize > m_Size);
+	m_Size = std::max(m_Size, minSize);
+
+	if (g_Renderer.m_Caps.m_VBO)
+	{
+		// Passing a NULL pointer lets the driver give us new storage while the
+		// old one is still in use, instead of waiting for it
+		ogl_BindBuffer(m_Target, m_Handle);
+		pglBufferDataARB(m_Target, m_Size, 0, GL_STREAM_DRAW);
+		ogl_BindBuffer(m_Target, 0);
+	}
+	else if (grow)
 	{
-		debug_printf(L"free chunk %p: size=%d\n", *iter, (int)((*iter)->m_Count));
-		maxSize = std::max((*iter)->m_Count, maxSize);
+		// (Data in system memory is read during the draw call, so it's always
+		// safe to overwrite and only needs reallocating to make it bigger)
+		delete[] m_SysMem;
+		m_SysMem = new u8[m_Size];
+	}
+
+	m_Offset = 0;
+	m_Generation = ++g_LastStreamGeneration;
+}
+
+size_t CStreamBuffer::Append(const void* data, size_t size)
+{
+	// Keep every upload 16-byte aligned, to be safe for any vertex format
+	size_t offset = round_up(m_Offset, (size_t)16);
+	if (offset + size > m_Size)
+	{
+		Orphan(size);
+		offset = 0;
+	}
+
+	if (size)
+	{
+		if (g_Renderer.m_Caps.m_VBO)
+		{
+			ogl_BindBuffer(m_Target, m_Handle);
+			pglBufferSubDataARB(m_Target, offset, size, data);
+			ogl_BindBuffer(m_Target, 0);
+		}
+		else
+		{
+			memcpy(m_SysMem + offset, data, size);
+		}
+	}
+
+	m_Offset = offset + size;
+	return offset;
+}
+
+u8* CStreamBuffer::Bind()
+{
+	if (g_Renderer.m_Caps.m_VBO)
+	{
+		ogl_BindBuffer(m_Target, m_Handle);
+		return (u8*)0;
+	}
+	else
+	{
+		return m_SysMem;
 	}
-	debug_printf(L"max size = %d\n", (int)maxSize);
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -25,6 +25,8 @@
 #include "lib/res/graphics/ogl_tex.h"
 
 #include <list>
+#include <map>
+#include <set>
 #include <vector>
 
 // Absolute maximum (bytewise) size of each GL vertex buffer object.
@@ -77,10 +79,23 @@ public:
 	/// Update vertex data for given chunk. Transfers the provided data to the actual OpenGL vertex buffer.
 	void UpdateChunkVertices(VBChunk* chunk, void* data);
 
+	/// Update only the first @p count vertices of the given chunk.
+	void UpdateChunkVertices(VBChunk* chunk, void* data, size_t count);
+
 	size_t GetVertexSize() const { return m_VertexSize; }
 	size_t GetBytesReserved() const;
 	size_t GetBytesAllocated() const;
 
+	/// Returns the number of separate free chunks
+	size_t GetNumFreeChunks() const { return m_FreeChunks.size(); }
+
+	/// Returns the size (in vertices) of the largest chunk that could currently be allocated
+	size_t GetLargestFreeChunk() const;
+
+	/// Returns the number of free bytes that are outside the largest free chunk,
+	/// as a measure of how fragmented the buffer is
+	size_t GetBytesFragmented() const;
+
 	/// Returns true if this vertex buffer is compatible with the specified vertex type and intended usage.
 	bool CompatibleVertexType(size_t vertexSize, GLenum usage, GLenum target);
 
@@ -96,13 +111,22 @@ protected:
 	void Release(VBChunk* chunk);
 	
 	
-private:	
+private:
+	/// Add/remove a chunk from both of the free chunk indexes (without
+	/// changing m_FreeVertices)
+	void AddFreeChunk(VBChunk* chunk);
+	void RemoveFreeChunk(VBChunk* chunk);
+
 	/// Vertex size of this vertex buffer
 	size_t m_VertexSize;
 	/// Number of vertices of above size in this buffer
 	size_t m_MaxVertices;
-	/// List of free chunks in this buffer
-	std::list<VBChunk*> m_FreeList;
+	/// Free chunks in this buffer, indexed by their start index (to find
+	/// neighbours when coalescing)
+	std::map<size_t, VBChunk*> m_FreeChunks;
+	/// (count, start index) of every free chunk, to find the best fit for
+	/// an allocation in O(log n) time
+	std::set<std::pair<size_t, size_t> > m_FreeSizes;
 	/// Available free vertices - total of all free vertices in the free list
 	size_t m_FreeVertices;
 	/// Handle to the actual GL vertex buffer object
@@ -115,4 +139,52 @@ private:
 	GLenum m_Target;
 };
 
+/**
+ * CStreamBuffer: a GL buffer for dynamic data that gets re-uploaded every frame
+ * (or more often). Each upload is appended after the previous one, and when the
+ * buffer is full its storage is orphaned (by reallocating it with glBufferData)
+ * and writing starts again from the beginning. That means we never overwrite
+ * data that the GPU might still be reading, which would make the driver stall
+ * until it has finished.
+ *
+ * Orphaning discards all the previously-appended data, so users must check
+ * GetGeneration() before drawing and append their data again if it has changed.
+ */
+class CStreamBuffer
+{
+	NONCOPYABLE(CStreamBuffer);
+public:
+	CStreamBuffer(GLenum target);
+	~CStreamBuffer();
+
+	/// Copies @p size bytes of @p data into the buffer, and returns the byte offset
+	/// it was copied to. This may orphan the buffer, changing its generation.
+	size_t Append(const void* data, size_t size);
+
+	/// Bind to this buffer; return pointer to address required as parameter
+	/// to glVertexPointer ( + etc) calls
+	u8* Bind();
+
+	/// Returns a number that changes whenever the previously-appended data is discarded.
+	/// (This is unique over all stream buffers, so it never matches a deleted buffer.)
+	u32 GetGeneration() const { return m_Generation; }
+
+	size_t GetBytesReserved() const { return m_Size; }
+	size_t GetBytesAllocated() const { return m_Offset; }
+
+private:
+	/// Discard the current storage, and allocate at least @p minSize bytes of new storage
+	void Orphan(size_t minSize);
+
+	GLenum m_Target;
+	/// Handle to the actual GL buffer object
+	GLuint m_Handle;
+	/// Raw system memory for systems not supporting VBOs
+	u8* m_SysMem;
+	size_t m_Size;
+	/// Offset of the end of the most recently appended data
+	size_t m_Offset;
+	u32 m_Generation;
+};
+
 #endif
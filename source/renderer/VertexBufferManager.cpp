@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -30,6 +30,11 @@
 
 CVertexBufferManager g_VBMan;
 
+CVertexBufferManager::CVertexBufferManager()
+{
+	m_StreamBuffers[0] = m_StreamBuffers[1] = NULL;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Explicit shutdown of the vertex buffer subsystem.
 // This avoids the ordering issues that arise when using destructors of
@@ -40,6 +45,9 @@ void CVertexBufferManager::Shutdown()
 	for (Iter iter = m_Buffers.begin(); iter != m_Buffers.end(); ++iter)
 		delete *iter;
 	m_Buffers.clear();
+
+	for (size_t i = 0; i < ARRAY_SIZE(m_StreamBuffers); ++i)
+		SAFE_DELETE(m_StreamBuffers[i]);
 }
 
 
@@ -105,6 +113,16 @@ void CVertexBufferManager::Release(CVertexBuffer::VBChunk* chunk)
 }
 
 
+CStreamBuffer& CVertexBufferManager::GetStreamBuffer(GLenum target)
+{
+	ENSURE(target == GL_ARRAY_BUFFER || target == GL_ELEMENT_ARRAY_BUFFER);
+
+	CStreamBuffer*& buffer = m_StreamBuffers[target == GL_ARRAY_BUFFER ? 0 : 1];
+	if (!buffer)
+		buffer = new CStreamBuffer(target);
+	return *buffer;
+}
+
 size_t CVertexBufferManager::GetBytesReserved()
 {
 	size_t total = 0;
@@ -113,6 +131,10 @@ size_t CVertexBufferManager::GetBytesReserved()
 	for (Iter iter = m_Buffers.begin(); iter != m_Buffers.end(); ++iter)
 		total += (*iter)->GetBytesReserved();
 
+	for (size_t i = 0; i < ARRAY_SIZE(m_StreamBuffers); ++i)
+		if (m_StreamBuffers[i])
+			total += m_StreamBuffers[i]->GetBytesReserved();
+
 	return total;
 }
 
@@ -124,5 +146,20 @@ size_t CVertexBufferManager::GetBytesAllocated()
 	for (Iter iter = m_Buffers.begin(); iter != m_Buffers.end(); ++iter)
 		total += (*iter)->GetBytesAllocated();
 
+	for (size_t i = 0; i < ARRAY_SIZE(m_StreamBuffers); ++i)
+		if (m_StreamBuffers[i])
+			total += m_StreamBuffers[i]->GetBytesAllocated();
+
+	return total;
+}
+
+size_t CVertexBufferManager::GetBytesFragmented()
+{
+	size_t total = 0;
+
+	typedef std::list<CVertexBuffer*>::iterator Iter;
+	for (Iter iter = m_Buffers.begin(); iter != m_Buffers.end(); ++iter)
+		total += (*iter)->GetBytesFragmented();
+
 	return total;
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -30,7 +30,8 @@
 class CVertexBufferManager
 {
 public:
-	
+	CVertexBufferManager();
+
 	/**
 	 * Try to allocate a vertex buffer of the given size and type.
 	 *
@@ -45,12 +46,22 @@ public:
 	/// Returns the given @p chunk to its owning buffer
 	void Release(CVertexBuffer::VBChunk* chunk);
 
+	/**
+	 * Returns the buffer that GL_STREAM_DRAW vertex arrays with the given @p target
+	 * are appended into each time they're uploaded.
+	 */
+	CStreamBuffer& GetStreamBuffer(GLenum target);
+
 	/// Returns a list of all buffers
 	const std::list<CVertexBuffer*>& GetBufferList() const { return m_Buffers; }
 
 	size_t GetBytesReserved();
 	size_t GetBytesAllocated();
 
+	/// Returns the total free space that's not in the largest free chunk of its buffer
+	/// (see CVertexBuffer::GetBytesFragmented)
+	size_t GetBytesFragmented();
+
 	/// Returns the maximum possible size of a single vertex buffer
 	size_t GetMaxBufferSize() const { return MAX_VB_SIZE_BYTES; }
 
@@ -60,6 +71,9 @@ public:
 private:
 	/// List of all known vertex buffers
 	std::list<CVertexBuffer*> m_Buffers;
+
+	/// Stream buffers for GL_ARRAY_BUFFER and GL_ELEMENT_ARRAY_BUFFER (created when first needed)
+	CStreamBuffer* m_StreamBuffers[2];
 };
 
 extern CVertexBufferManager g_VBMan;
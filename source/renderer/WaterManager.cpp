@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -33,6 +33,8 @@
 #include "maths/Vector2D.h"
 
 #include "ps/Game.h"
+#include "ps/Profile.h"
+#include "ps/ThreadPool.h"
 #include "ps/World.h"
 
 #include "renderer/WaterManager.h"
@@ -104,10 +106,10 @@ WaterManager::~WaterManager()
 	// Cleanup if the caller messed up
 	UnloadWaterTextures();
 	delete[] m_Heightmap;
-	glDeleteTextures(1, &m_HeightmapTexture);
-	glDeleteTextures(1, &m_OtherInfoTex);
-	glDeleteTextures(1, &m_depthTT);
-	glDeleteTextures(1, &m_waveTT);
+	ogl_DeleteTextures(1, &m_HeightmapTexture);
+	ogl_DeleteTextures(1, &m_OtherInfoTex);
+	ogl_DeleteTextures(1, &m_depthTT);
+	ogl_DeleteTextures(1, &m_waveTT);
 	
 	if (m_VBWaves) g_VBMan.Release(m_VBWaves);
 	if (m_VBWavesIndices) g_VBMan.Release(m_VBWavesIndices);
@@ -175,12 +177,14 @@ int WaterManager::LoadWaterTextures()
 	// the reflection/refraction textures to be that large?)
 	int size = (int)round_up_to_pow2((unsigned)g_Renderer.GetHeight());
 	if(size > g_Renderer.GetHeight()) size /= 2;
+	// (Optionally use lower resolution textures, which are cheaper to render into)
+	if (g_Renderer.m_Options.m_WaterLowRes && size > 1) size /= 2;
 	m_ReflectionTextureSize = size;
 	m_RefractionTextureSize = size;
 
 	// Create reflection texture
 	glGenTextures(1, &m_ReflectionTexture);
-	glBindTexture(GL_TEXTURE_2D, m_ReflectionTexture);
+	ogl_BindTexture(GL_TEXTURE_2D, m_ReflectionTexture);
 	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB,
 		(GLsizei)m_ReflectionTextureSize, (GLsizei)m_ReflectionTextureSize,
 		0,  GL_RGB, GL_UNSIGNED_BYTE, 0);
@@ -191,7 +195,7 @@ int WaterManager::LoadWaterTextures()
 	
 	// Create refraction texture
 	glGenTextures(1, &m_RefractionTexture);
-	glBindTexture(GL_TEXTURE_2D, m_RefractionTexture);
+	ogl_BindTexture(GL_TEXTURE_2D, m_RefractionTexture);
 	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, 
 		(GLsizei)m_RefractionTextureSize, (GLsizei)m_RefractionTextureSize,
 		0,  GL_RGB, GL_UNSIGNED_BYTE, 0);
@@ -223,49 +227,35 @@ void WaterManager::UnloadWaterTextures()
 	}
 }
 
-///////////////////////////////////////////////////////////////////
-// Create information about the terrain and wave vertices.
-void WaterManager::CreateSuperfancyInfo()
+/**
+ * Computes the data for the superfancy water textures, one row of vertices
+ * per item. This only reads the terrain, so rows can be computed concurrently.
+ */
+class SuperfancyInfoTask : public CThreadPool::ITask
 {
-	ssize_t mapSize = g_Game->GetWorld()->GetTerrain()->GetVerticesPerSide();
-	ssize_t texSize = (GLsizei)round_up_to_pow2((size_t)mapSize);
-	CTerrain* terrain = g_Game->GetWorld()->GetTerrain();
-	
-	u32* newHeightmap = NULL;
-	newHeightmap = new u32[texSize*texSize];
-	
-	u32* otherInfo = NULL;
-	otherInfo = new u32[texSize*texSize];
-	
-	u16* heightmap = terrain->GetHeightMap();
-	
-	// Recovering wave direction at any given point (5x5 blur)
-	// the precision is one vertice, which iirc is 4 per in-game "tile"
-	CVector3D* groundDirection = new CVector3D[(mapSize+1)*(mapSize+1)];
-	for (ssize_t i = 0; i < mapSize; ++i)
+public:
+	SuperfancyInfoTask(const CTerrain& terrain, ssize_t mapSize, ssize_t texSize,
+			float waterHeight, float waviness, u32* heightmapOut, u32* otherInfoOut) :
+		m_Terrain(terrain), m_MapSize(mapSize), m_TexSize(texSize),
+		m_WaterHeight(waterHeight), m_Waviness(waviness),
+		m_HeightmapOut(heightmapOut), m_OtherInfoOut(otherInfoOut)
 	{
-		for (ssize_t j = 0; j < mapSize; ++j)
-		{
-			CVector3D normal;
-			for (int xx = -5; xx <= 5; ++xx)
-			{
-				for (int yy = -5; yy <= 5; ++yy)
-				{
-					normal += terrain->CalcExactNormal((i+xx)*4,(j+yy)*4);
-				}
-			}
-			normal = normal.Normalized();
-			groundDirection[j*mapSize+i] = normal;
-		}
 	}
-	// Recovering wave intensity
-	u8* waveForceHQ = new u8[(mapSize+1)*(mapSize+1)];	// high qual map.
-	u16 waterHeightInu16 = this->m_WaterHeight/HEIGHT_SCALE;
-	
-	for (ssize_t i = 0; i < mapSize; ++i)
+
+	virtual void Run(size_t index)
 	{
-		for (ssize_t j = 0; j < mapSize; ++j)
+		const CTerrain* terrain = &m_Terrain;
+		const u16* heightmap = terrain->GetHeightMap();
+		const ssize_t mapSize = m_MapSize;
+		const ssize_t j = (ssize_t)index;
+
+		u16 waterHeightInu16 = m_WaterHeight/HEIGHT_SCALE;
+
+		// texture "newHeightmap" is [x vector of wave direction, coefficient of "water raise", y vector of waves, distance to shore.]
+		// texture "OtherInfo" stores the intensity of actual waves and of foam.
+		for (ssize_t i = 0; i < mapSize; ++i)
 		{
+			// Recovering wave intensity
 			u8 color = 0;
 			for (int v = 0; v < 20; v++){
 				if (j-v >= 0 && i-v >= 0 && heightmap[(j-v)*mapSize + i-v] > waterHeightInu16)
@@ -276,18 +266,9 @@ void WaterManager::CreateSuperfancyInfo()
 						color++;
 				}
 			}
-			waveForceHQ[j*mapSize + i] = 255 - color * 7;
-		}
-	}
-	// this creates information for waves and stores it in a texture.
-	// texture "newHeightmap" is [x vector of wave direction, coefficient of "water raise", y vector of waves, distance to shore.]
-	// texture "OtherInfo" stores the intensity of actual waves and of foam.
-	for (ssize_t i = 0; i < mapSize; ++i)
-	{
-		for (ssize_t j = 0; j < mapSize; ++j)
-		{
-			
-			float depth = this->m_WaterHeight - heightmap[j*mapSize + i]*HEIGHT_SCALE;
+			u8 waveForce = 255 - color * 7;
+
+			float depth = m_WaterHeight - heightmap[j*mapSize + i]*HEIGHT_SCALE;
 			int distanceToShore = 10000;
 			// calculation of the distance to the shore.
 			// this is pretty exact.
@@ -301,18 +282,32 @@ void WaterManager::CreateSuperfancyInfo()
 						if (i+xx >= 0 && i + xx < mapSize)
 							if (j + yy >= 0 && j + yy < mapSize)
 							{
-								float hereDepth = this->m_WaterHeight - heightmap[(j+yy)*mapSize + (i+xx)]*HEIGHT_SCALE;
+								float hereDepth = m_WaterHeight - heightmap[(j+yy)*mapSize + (i+xx)]*HEIGHT_SCALE;
 								if (hereDepth < 0 && xx*xx + yy*yy < distanceToShore)
 									distanceToShore = xx*xx + yy*yy;
 							}
 					}
 				}
 				// finer check
+				float coords[6*6*2];
+				float heights[6*6];
+				size_t n = 0;
+				for (float xx = -2.5f; xx <= 2.5f; ++xx)
+				{
+					for (float yy = -2.5f; yy <= 2.5f; ++yy)
+					{
+						coords[n*2] = (i+xx)*4;
+						coords[n*2+1] = (j+yy)*4;
+						++n;
+					}
+				}
+				terrain->GetExactGroundLevels(coords, n, heights);
+				n = 0;
 				for (float xx = -2.5f; xx <= 2.5f; ++xx)
 				{
 					for (float yy = -2.5f; yy <= 2.5f; ++yy)
 					{
-						float hereDepth = this->m_WaterHeight - terrain->GetExactGroundLevel( (i+xx)*4, (j+yy)*4 );
+						float hereDepth = m_WaterHeight - heights[n++];
 						if (hereDepth < 0 && xx*xx + yy*yy < distanceToShore)
 							distanceToShore = xx*xx + yy*yy;
 					}
@@ -320,28 +315,54 @@ void WaterManager::CreateSuperfancyInfo()
 			}
 			else
 			{
+				float coords[9*9*2];
+				float heights[9*9];
+				size_t n = 0;
 				for (float xx = -2.0f; xx <= 2.0f; xx+=0.5f)
 				{
 					for (float yy = -2.0f; yy <= 2.0f; yy+=0.5f)
 					{
-						float hereDepth = this->m_WaterHeight - terrain->GetExactGroundLevel( (i+xx)*4, (j+yy)*4 );
-						if (hereDepth > 0)
-							distanceToShore = 0;
+						coords[n*2] = (i+xx)*4;
+						coords[n*2+1] = (j+yy)*4;
+						++n;
 					}
 				}
+				terrain->GetExactGroundLevels(coords, n, heights);
+				for (size_t k = 0; k < n; ++k)
+				{
+					float hereDepth = m_WaterHeight - heights[k];
+					if (hereDepth > 0)
+						distanceToShore = 0;
+				}
 				
 			}
 			distanceToShore = (int)sqrt((float)distanceToShore);
 			// Compute the normals
 			// Also create the waves quad.
 			CVector3D normal;
+
+			float normalCoords[9*9*2];
+			float normalHeights[9*9];
+			CVector3D normals[9*9];
+			size_t numNormals = 0;
+			for (int xx = -4; xx <= 4; ++xx)
+			{
+				for (int yy = -4; yy <= 4; ++yy)
+				{
+					normalCoords[numNormals*2] = ((float)i+xx)*4.0f;
+					normalCoords[numNormals*2+1] = ((float)j+yy)*4.0f;
+					++numNormals;
+				}
+			}
+			terrain->GetExactGroundLevels(normalCoords, numNormals, normalHeights, normals);
+			for (size_t k = 0; k < numNormals; ++k)
+				normal += normals[k];
 			
 			int waterRaise = 0;
 			for (int xx = -4; xx <= 4; ++xx)
 			{
 				for (int yy = -4; yy <= 4; ++yy)
 				{
-					normal += terrain->CalcExactNormal(((float)i+xx)*4.0f,((float)j+yy)*4.0f);
 					if (terrain->GetVertexGroundLevel(i+xx,j+yy) < heightmap[j*mapSize + i]*HEIGHT_SCALE)
 						waterRaise += heightmap[j*mapSize + i]*HEIGHT_SCALE - terrain->GetVertexGroundLevel(i+xx,j+yy);
 				}
@@ -354,42 +375,78 @@ void WaterManager::CreateSuperfancyInfo()
 			u8 r = static_cast<u8>(normal[0]*128 + 127);
 			u8 b = static_cast<u8>(normal[2]*128 + 127);
 			distanceToShore = distanceToShore > 10 ? 10 : distanceToShore;
-			newHeightmap[j*texSize + i] = (r << 24) + (waterRaise << 16) + (b << 8) + (distanceToShore*25 << 0);
+			m_HeightmapOut[j*m_TexSize + i] = (r << 24) + (waterRaise << 16) + (b << 8) + (distanceToShore*25 << 0);
 			
 			depth = clamp(depth,0.0f,10.0f);
 			
-			float wvness = this->m_Waviness;
+			float wvness = m_Waviness;
 			
 			// computing the amount of foam I want
-			float foamAmount = (waterRaise/255.0f) * (1.0f - depth/10.0f) * (waveForceHQ[j*mapSize+i]/255.0f) * (wvness/8.0f);
+			float foamAmount = (waterRaise/255.0f) * (1.0f - depth/10.0f) * (waveForce/255.0f) * (wvness/8.0f);
 			foamAmount += clamp(wvness/2.0f - distanceToShore,0.0f,wvness/2.0f)/(wvness/2.0f) * clamp(wvness/9.0f,0.3f,1.0f);
 			
 			foamAmount = foamAmount > 1.0f ? 1.0f: foamAmount;
 			
-			otherInfo[j*texSize + i] = (waveForceHQ[j*mapSize+i] << 24) + ((u8)(foamAmount*255) << 16) + (0x00 << 8) + (0x00 << 0);
+			m_OtherInfoOut[j*m_TexSize + i] = (waveForce << 24) + ((u8)(foamAmount*255) << 16) + (0x00 << 8) + (0x00 << 0);
 		}
 	}
+
+private:
+	const CTerrain& m_Terrain;
+	ssize_t m_MapSize;
+	ssize_t m_TexSize;
+	float m_WaterHeight;
+	float m_Waviness;
+	u32* m_HeightmapOut;
+	u32* m_OtherInfoOut;
+
+	NONCOPYABLE(SuperfancyInfoTask);
+};
+
+///////////////////////////////////////////////////////////////////
+// Create information about the terrain and wave vertices.
+void WaterManager::CreateSuperfancyInfo()
+{
+	PROFILE3("create superfancy water info");
+
+	ssize_t mapSize = g_Game->GetWorld()->GetTerrain()->GetVerticesPerSide();
+	ssize_t texSize = (GLsizei)round_up_to_pow2((size_t)mapSize);
+	CTerrain* terrain = g_Game->GetWorld()->GetTerrain();
+	
+	// (Zeroed so the padding outside the map is deterministic)
+	u32* newHeightmap = new u32[texSize*texSize]();
+	std::vector<u32> otherInfo(texSize*texSize);
+
+	// Every vertex is independent and computing them is slow (there are many
+	// normal and height samples per vertex), so do the rows in parallel
+	SuperfancyInfoTask task(*terrain, mapSize, texSize, m_WaterHeight, m_Waviness, newHeightmap, &otherInfo[0]);
+	if (g_ThreadPool)
+		g_ThreadPool->ParallelFor(task, mapSize);
+	else
+		for (ssize_t j = 0; j < mapSize; ++j)
+			task.Run(j);
+
 	this->m_TexSize = texSize*4;
 	this->m_Heightmap = newHeightmap;
 	
 	GLuint heightName;
 	glGenTextures(1, &heightName);
-	glBindTexture(GL_TEXTURE_2D, heightName);
+	ogl_BindTexture(GL_TEXTURE_2D, heightName);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, texSize,texSize, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8,newHeightmap);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	this->m_HeightmapTexture = heightName;
-	glBindTexture(GL_TEXTURE_2D, 0);
+	ogl_BindTexture(GL_TEXTURE_2D, 0);
 	
 	GLuint otherInfoId;
 	glGenTextures(1, &otherInfoId);
-	glBindTexture(GL_TEXTURE_2D, otherInfoId);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, texSize,texSize, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8,otherInfo);
+	ogl_BindTexture(GL_TEXTURE_2D, otherInfoId);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, texSize,texSize, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8,&otherInfo[0]);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	this->m_OtherInfoTex = otherInfoId;
 	
-	glBindTexture(GL_TEXTURE_2D, 0);
+	ogl_BindTexture(GL_TEXTURE_2D, 0);
 	
 	if (this->m_WaterCoastalWaves)
 	{
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,6 +27,9 @@
  * Construct this object, push values into it, and they will all be rooted until this
  * object is destroyed.
  * Many of these objects can be used at once, but their lifetimes must be correctly nested.
+ *
+ * This is much cheaper than using a CScriptValRooted (or JS_AddRoot) per value,
+ * since pushing a value is just a vector push_back.
  */
 class AutoGCRooter
 {
@@ -39,6 +42,35 @@ public:
 	void Push(jsval val) { m_Vals.push_back(val); }
 	void Push(JSIdArray* ida) { m_IdArrays.push_back(ida); }
 
+	/**
+	 * Lets an AutoGCRooter be used as a stack of temporary roots: everything
+	 * pushed while a Scope exists is released when the Scope is destroyed.
+	 * Scopes on the same rooter must be correctly nested.
+	 */
+	class Scope
+	{
+		NONCOPYABLE(Scope);
+	public:
+		Scope(AutoGCRooter& rooter) :
+			m_Rooter(rooter), m_NumObjects(rooter.m_Objects.size()),
+			m_NumVals(rooter.m_Vals.size()), m_NumIdArrays(rooter.m_IdArrays.size())
+		{
+		}
+
+		~Scope()
+		{
+			m_Rooter.m_Objects.resize(m_NumObjects);
+			m_Rooter.m_Vals.resize(m_NumVals);
+			m_Rooter.m_IdArrays.resize(m_NumIdArrays);
+		}
+
+	private:
+		AutoGCRooter& m_Rooter;
+		size_t m_NumObjects;
+		size_t m_NumVals;
+		size_t m_NumIdArrays;
+	};
+
 	void Trace(JSTracer* trc);
 private:
 	ScriptInterface& m_ScriptInterface;
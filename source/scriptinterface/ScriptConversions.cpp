@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -292,6 +292,24 @@ template<typename T> static jsval ToJSVal_vector(JSContext* cx, const std::vecto
 	return OBJECT_TO_JSVAL(obj);
 }
 
+// Numbers never need to be allocated on the GC heap, so the elements of a
+// numeric vector can all be converted before constructing the array, which
+// is then filled in a single call instead of one JS_SetElement per element
+template<typename T> static jsval ToJSVal_numvector(JSContext* cx, const std::vector<T>& val)
+{
+	if (val.empty())
+		return ToJSVal_vector(cx, val);
+
+	std::vector<jsval> elements(val.size());
+	for (size_t i = 0; i < val.size(); ++i)
+		elements[i] = ScriptInterface::ToJSVal<T>(cx, val[i]);
+
+	JSObject* obj = JS_NewArrayObject(cx, (jsint)elements.size(), &elements[0]);
+	if (!obj)
+		return JSVAL_VOID;
+	return OBJECT_TO_JSVAL(obj);
+}
+
 template<typename T> static bool FromJSVal_vector(JSContext* cx, jsval v, std::vector<T>& out)
 {
 	JSObject* obj;
@@ -314,6 +332,23 @@ template<typename T> static bool FromJSVal_vector(JSContext* cx, jsval v, std::v
 	return true;
 }
 
+// Typed arrays whose element type is exactly T can be copied in bulk, instead
+// of converting each element separately; anything else is converted normally
+template<typename T> static bool FromJSVal_typedvector(JSContext* cx, jsval v, std::vector<T>& out, int type)
+{
+	if (JSVAL_IS_OBJECT(v) && !JSVAL_IS_NULL(v) && js_IsTypedArray(JSVAL_TO_OBJECT(v)))
+	{
+		js::TypedArray* array = js::TypedArray::fromJSObject(JSVAL_TO_OBJECT(v));
+		if (array->type == type)
+		{
+			const T* data = static_cast<const T*>(array->data);
+			out.insert(out.end(), data, data + array->length);
+			return true;
+		}
+	}
+	return FromJSVal_vector(cx, v, out);
+}
+
 // Instantiate various vector types:
 
 #define VECTOR(T) \
@@ -326,9 +361,21 @@ template<typename T> static bool FromJSVal_vector(JSContext* cx, jsval v, std::v
 		return FromJSVal_vector(cx, v, out); \
 	}
 
-VECTOR(int)
-VECTOR(u32)
-VECTOR(u16)
+#define TYPED_VECTOR(T, type) \
+	template<> jsval ScriptInterface::ToJSVal<std::vector<T> >(JSContext* cx, const std::vector<T>& val) \
+	{ \
+		return ToJSVal_numvector(cx, val); \
+	} \
+	template<> bool ScriptInterface::FromJSVal<std::vector<T> >(JSContext* cx, jsval v, std::vector<T>& out) \
+	{ \
+		return FromJSVal_typedvector(cx, v, out, js::TypedArray::type); \
+	}
+
+TYPED_VECTOR(int, TYPE_INT32)
+TYPED_VECTOR(u32, TYPE_UINT32)
+TYPED_VECTOR(u16, TYPE_UINT16)
+TYPED_VECTOR(u8, TYPE_UINT8)
+TYPED_VECTOR(double, TYPE_FLOAT64)
 VECTOR(std::string)
 VECTOR(std::wstring)
 VECTOR(CScriptValRooted)
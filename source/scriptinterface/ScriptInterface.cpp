@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,8 +24,10 @@
 #include "lib/debug.h"
 #include "lib/utf8.h"
 #include "ps/CLogger.h"
+#include "lib/timer.h"
 #include "ps/Filesystem.h"
 #include "ps/Profile.h"
+#include "ps/Profiler2.h"
 #include "ps/utf16string.h"
 
 #include <cassert>
@@ -56,6 +58,9 @@
 
 ////////////////////////////////////////////////////////////////
 
+// Set by ScriptInterface::SetFunctionProfiling
+static bool g_ScriptFunctionProfiling = false;
+
 /**
  * Abstraction around a SpiderMonkey JSRuntime.
  * Each ScriptRuntime can be used to initialize several ScriptInterface
@@ -69,14 +74,15 @@ class ScriptRuntime
 {
 public:
 	ScriptRuntime(int runtimeSize) :
-		m_rooter(NULL), m_compartmentGlobal(NULL)
+		m_rooter(NULL), m_compartmentGlobal(NULL),
+		m_FunctionProfiling(g_ScriptFunctionProfiling), m_LastFunctionStatsFlush(0.0)
 	{
 		m_rt = JS_NewRuntime(runtimeSize);
 		ENSURE(m_rt); // TODO: error handling
 
 #if ENABLE_SCRIPT_PROFILING
 		// Profiler isn't thread-safe, so only enable this on the main thread
-		if (ThreadUtil::IsMainThread())
+		if (ThreadUtil::IsMainThread() && !m_FunctionProfiling)
 		{
 			if (CProfileManager::IsInitialised())
 			{
@@ -86,12 +92,20 @@ public:
 		}
 #endif
 
+		if (m_FunctionProfiling)
+			JS_SetCallHook(m_rt, jshook_function_stats, this);
+
+		JS_SetGCCallbackRT(m_rt, jshook_gc);
+
 		JS_SetExtraGCRoots(m_rt, jshook_trace, this);
 	}
 
 	~ScriptRuntime()
 	{
 		JS_DestroyRuntime(m_rt);
+
+		if (m_FunctionProfiling)
+			FlushFunctionStats(timer_Time());
 	}
 
 	JSRuntime* m_rt;
@@ -99,8 +113,126 @@ public:
 
 	JSObject* m_compartmentGlobal;
 
+	// Whether jshook_function_stats is used (in which case the JIT must be disabled)
+	bool m_FunctionProfiling;
+
 private:
 
+	// For SetFunctionProfiling, we use a call hook that measures every function
+	// call, and accumulates the statistics per function (identified by its
+	// script). They're periodically passed to CProfiler2, when returning
+	// to native code, so the cost of that is shared over many calls.
+	// (Like the flyweights above, this assumes scripts aren't freed and
+	// replaced by new ones at the same address while profiling.)
+
+	struct FunctionStats
+	{
+		std::string name;
+		// Totals since the last flush
+		u32 calls;
+		double inclusive;
+		double self;
+	};
+
+	struct FunctionCall
+	{
+		size_t function; // index into m_FunctionStats
+		double start;
+		double childTime;
+	};
+
+	std::vector<FunctionStats> m_FunctionStats;
+	std::map<JSScript*, size_t> m_FunctionIndexes; // JSScript* to index into m_FunctionStats
+	std::vector<size_t> m_ChangedFunctions; // indexes of FunctionStats with non-zero calls
+	std::vector<FunctionCall> m_FunctionCallStack;
+	double m_LastFunctionStatsFlush;
+
+	size_t GetFunctionIndex(JSContext* cx, JSStackFrame* fp)
+	{
+		JSScript* script = JS_GetFrameScript(cx, fp);
+
+		std::map<JSScript*, size_t>::iterator it = m_FunctionIndexes.find(script);
+		if (it != m_FunctionIndexes.end())
+			return it->second;
+
+		// Most functions are anonymous (e.g. component methods), so identify
+		// functions by their location, plus their name if they have one
+		std::stringstream ss;
+		JSFunction* fn = JS_GetFrameFunction(cx, fp);
+		JSString* id = fn ? JS_GetFunctionId(fn) : NULL;
+		if (id)
+		{
+			char* chars = JS_EncodeString(cx, id);
+			if (chars)
+			{
+				ss << chars << " ";
+				JS_free(cx, chars);
+			}
+		}
+		if (script)
+		{
+			const char* filename = JS_GetScriptFilename(cx, script);
+			ss << "(" << (filename ? filename : "?") << ":" << JS_GetScriptBaseLineNumber(cx, script) << ")";
+		}
+		else
+		{
+			ss << "(unknown)";
+		}
+
+		FunctionStats stats = { ss.str(), 0, 0.0, 0.0 };
+		m_FunctionStats.push_back(stats);
+		m_FunctionIndexes[script] = m_FunctionStats.size() - 1;
+		return m_FunctionStats.size() - 1;
+	}
+
+	void FlushFunctionStats(double time)
+	{
+		for (size_t i = 0; i < m_ChangedFunctions.size(); ++i)
+		{
+			FunctionStats& stats = m_FunctionStats[m_ChangedFunctions[i]];
+			g_Profiler2.RecordScriptFunction(stats.name, stats.calls, stats.inclusive, stats.self);
+			stats.calls = 0;
+			stats.inclusive = stats.self = 0.0;
+		}
+		m_ChangedFunctions.clear();
+		m_LastFunctionStatsFlush = time;
+	}
+
+	static void* jshook_function_stats(JSContext* cx, JSStackFrame* fp, JSBool before, JSBool* UNUSED(ok), void* closure)
+	{
+		ScriptRuntime* m = static_cast<ScriptRuntime*>(closure);
+		const double time = timer_Time();
+
+		if (before)
+		{
+			FunctionCall call = { m->GetFunctionIndex(cx, fp), time, 0.0 };
+			m->m_FunctionCallStack.push_back(call);
+			return closure;
+		}
+
+		if (m->m_FunctionCallStack.empty())
+			return closure;
+
+		const FunctionCall call = m->m_FunctionCallStack.back();
+		m->m_FunctionCallStack.pop_back();
+
+		// (Recursive calls will be counted more than once in the inclusive time)
+		const double inclusive = time - call.start;
+		FunctionStats& stats = m->m_FunctionStats[call.function];
+		if (stats.calls == 0)
+			m->m_ChangedFunctions.push_back(call.function);
+		++stats.calls;
+		stats.inclusive += inclusive;
+		stats.self += inclusive - call.childTime;
+
+		if (!m->m_FunctionCallStack.empty())
+			m->m_FunctionCallStack.back().childTime += inclusive;
+		else if (time - m->m_LastFunctionStatsFlush > 0.1)
+			m->FlushFunctionStats(time);
+
+		return closure;
+	}
+
 #if ENABLE_SCRIPT_PROFILING
 	static void* jshook_script(JSContext* UNUSED(cx), JSStackFrame* UNUSED(fp), JSBool before, JSBool* UNUSED(ok), void* closure)
 	{
@@ -215,6 +347,27 @@ private:
 	}
 #endif
 
+	// Record every GC in the profiler, since they can take long enough to
+	// cause noticeable pauses
+	static JSBool jshook_gc(JSContext* cx, JSGCStatus status)
+	{
+		if (!g_Profiler2.IsCurrentThreadRegistered())
+			return JS_TRUE;
+
+		if (status == JSGC_BEGIN)
+		{
+			g_Profiler2.RecordRegionEnter("script GC");
+			g_Profiler2.RecordAttribute("heap before: %u", JS_GetGCParameter(JS_GetRuntime(cx), JSGC_BYTES));
+		}
+		else if (status == JSGC_END)
+		{
+			g_Profiler2.RecordAttribute("heap after: %u", JS_GetGCParameter(JS_GetRuntime(cx), JSGC_BYTES));
+			g_Profiler2.RecordRegionLeave("script GC");
+		}
+
+		return JS_TRUE;
+	}
+
 	static void jshook_trace(JSTracer* trc, void* data)
 	{
 		ScriptRuntime* m = static_cast<ScriptRuntime*>(data);
@@ -229,6 +382,11 @@ shared_ptr<ScriptRuntime> ScriptInterface::CreateRuntime(int runtimeSize)
 	return shared_ptr<ScriptRuntime>(new ScriptRuntime(runtimeSize));
 }
 
+void ScriptInterface::SetFunctionProfiling(bool enabled)
+{
+	g_ScriptFunctionProfiling = enabled;
+}
+
 ////////////////////////////////////////////////////////////////
 
 struct ScriptInterface_impl
@@ -497,11 +655,14 @@ ScriptInterface_impl::ScriptInterface_impl(const char* nativeScopeName, const sh
 	// Enable method JIT, unless script profiling is enabled (since profiling
 	// hooks are incompatible with the JIT)
 #if !ENABLE_SCRIPT_PROFILING
-	options |= JSOPTION_METHODJIT;
+	if (!m_runtime->m_FunctionProfiling)
+	{
+		options |= JSOPTION_METHODJIT;
 
-	// Some other JIT flags to experiment with:
-	options |= JSOPTION_JIT;
-	options |= JSOPTION_PROFILING;
+		// Some other JIT flags to experiment with:
+		options |= JSOPTION_JIT;
+		options |= JSOPTION_PROFILING;
+	}
 #endif
 
 	JS_SetOptions(m_cx, options);
@@ -1161,11 +1322,17 @@ void ScriptInterface::MaybeGC()
 	JS_MaybeGC(m->m_cx);
 }
 
+void ScriptInterface::SetGCTriggerFactor(u32 percent)
+{
+	ENSURE(percent >= 100);
+	JS_SetGCParameter(GetRuntime(), JSGC_TRIGGER_FACTOR, percent);
+}
+
 class ValueCloner
 {
 public:
 	ValueCloner(ScriptInterface& from, ScriptInterface& to) :
-		scriptInterfaceFrom(from), cxFrom(from.GetContext()), cxTo(to.GetContext()), m_RooterFrom(from), m_RooterTo(to)
+		scriptInterfaceFrom(from), cxFrom(from.GetContext()), cxTo(to.GetContext()), m_RooterFrom(from), m_RooterTo(to), m_RooterIds(from)
 	{
 	}
 
@@ -1234,8 +1401,9 @@ private:
 		AutoJSIdArray ida (cxFrom, JS_Enumerate(cxFrom, JSVAL_TO_OBJECT(val)));
 		CLONE_REQUIRE(ida.get(), L"JS_Enumerate");
 
-		AutoGCRooter idaRooter(scriptInterfaceFrom);
-		idaRooter.Push(ida.get());
+		// Root the ids until we've finished with them (but not after ida is freed)
+		AutoGCRooter::Scope idaScope(m_RooterIds);
+		m_RooterIds.Push(ida.get());
 
 		for (size_t i = 0; i < ida.length(); ++i)
 		{
@@ -1275,6 +1443,7 @@ private:
 	std::map<void*, jsval> m_Mapping;
 	AutoGCRooter m_RooterFrom;
 	AutoGCRooter m_RooterTo;
+	AutoGCRooter m_RooterIds; // stack of the id arrays being enumerated by Clone
 };
 
 jsval ScriptInterface::CloneValueFromOtherContext(ScriptInterface& otherContext, jsval val)
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -75,6 +75,15 @@ public:
 	 */
 	static shared_ptr<ScriptRuntime> CreateRuntime(int runtimeSize = DEFAULT_RUNTIME_SIZE);
 
+	/**
+	 * Enables or disables recording the call counts and times of every script
+	 * function into CProfiler2, for runtimes created afterwards (in threads
+	 * registered with the profiler). This disables the JIT in those runtimes,
+	 * so it makes scripts much slower.
+	 * Should only be called during initialisation, before creating any runtimes.
+	 */
+	static void SetFunctionProfiling(bool enabled);
+
 	/**
 	 * Constructor.
 	 * @param nativeScopeName Name of global object that functions (via RegisterFunction) will
@@ -305,6 +314,13 @@ public:
 	 */
 	void MaybeGC();
 
+	/**
+	 * Sets how large (as a percentage of the heap size after the last GC, at
+	 * least 100) the heap can grow before this runtime will be garbage
+	 * collected automatically. MaybeGC will collect it somewhat before then.
+	 */
+	void SetGCTriggerFactor(u32 percent);
+
 	/**
 	 * Structured clones are a way to serialize 'simple' JS values into a buffer
 	 * that can safely be passed between contexts and runtimes and threads.
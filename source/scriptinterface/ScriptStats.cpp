@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -54,6 +54,17 @@ void CScriptStatsTable::Remove(const ScriptInterface* scriptInterface)
 	}
 }
 
+void CScriptStatsTable::GetRuntimeBytes(std::vector<std::pair<std::string, size_t> >& out) const
+{
+	std::set<JSRuntime*> runtimes;
+	for (size_t i = 0; i < m_ScriptInterfaces.size(); ++i)
+	{
+		JSRuntime* rt = m_ScriptInterfaces[i].first->GetRuntime();
+		if (runtimes.insert(rt).second)
+			out.push_back(std::make_pair(m_ScriptInterfaces[i].second, (size_t)JS_GetGCParameter(rt, JSGC_BYTES)));
+	}
+}
+
 CStr CScriptStatsTable::GetName()
 {
 	return "script";
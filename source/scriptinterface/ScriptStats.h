@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -31,6 +31,13 @@ public:
 	void Add(const ScriptInterface* scriptInterface, const std::string& title);
 	void Remove(const ScriptInterface* scriptInterface);
 
+	/**
+	 * Returns the number of bytes allocated by each JS runtime, named after the
+	 * first script interface that uses it. (Some runtimes are shared by several
+	 * script interfaces, so they're only counted once.)
+	 */
+	void GetRuntimeBytes(std::vector<std::pair<std::string, size_t> >& out) const;
+
 	virtual CStr GetName();
 	virtual CStr GetTitle();
 	virtual size_t GetNumberRows();
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -152,7 +152,57 @@ public:
 		TS_ASSERT(isnan(f));
 	}
 
-	// TODO: test vectors
+	void test_vectors()
+	{
+		std::vector<u32> v1;
+		roundtrip<std::vector<u32> >(v1, "[]");
+		v1.push_back(1);
+		v1.push_back(2);
+		v1.push_back(3000000000u);
+		roundtrip<std::vector<u32> >(v1, "[1, 2, 3000000000]");
+
+		std::vector<double> v2;
+		v2.push_back(0.5);
+		v2.push_back(-1.0);
+		roundtrip<std::vector<double> >(v2, "[0.5, -1]");
+
+		std::vector<std::string> v3;
+		v3.push_back("a");
+		v3.push_back("b");
+		roundtrip<std::vector<std::string> >(v3, "[\"a\", \"b\"]");
+	}
+
+	void test_typed_arrays()
+	{
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+
+		// Matching typed arrays are copied directly
+		std::vector<u16> v1;
+		TS_ASSERT(script.Eval("new Uint16Array([1, 2, 65535])", v1));
+		TS_ASSERT_EQUALS(v1.size(), (size_t)3);
+		TS_ASSERT_EQUALS(v1[0], 1);
+		TS_ASSERT_EQUALS(v1[2], 65535);
+
+		std::vector<double> v2;
+		TS_ASSERT(script.Eval("new Float64Array([0.5, -1e100])", v2));
+		TS_ASSERT_EQUALS(v2.size(), (size_t)2);
+		TS_ASSERT_EQUALS(v2[0], 0.5);
+		TS_ASSERT_EQUALS(v2[1], -1e100);
+
+		// Other element types are converted element by element, and must give
+		// the same results as plain arrays
+		std::vector<u16> v3, v4;
+		TS_ASSERT(script.Eval("new Int32Array([-1, 7, 65536])", v3));
+		TS_ASSERT(script.Eval("[-1, 7, 65536]", v4));
+		TS_ASSERT_EQUALS(v3, v4);
+		TS_ASSERT_EQUALS(v3[0], 65535);
+		TS_ASSERT_EQUALS(v3[2], 0);
+
+		std::vector<u8> v5;
+		TS_ASSERT(script.Eval("new Uint8Array(1000)", v5));
+		TS_ASSERT_EQUALS(v5.size(), (size_t)1000);
+		TS_ASSERT_EQUALS(v5[999], 0);
+	}
 
 	void test_fixed()
 	{
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,6 +20,7 @@
 #include "scriptinterface/ScriptInterface.h"
 
 #include "ps/CLogger.h"
+#include "ps/Profiler2.h"
 
 #include <boost/random/linear_congruential.hpp>
 
@@ -140,4 +141,34 @@ public:
 		val = script.ParseJSON(stringified);
 		TS_ASSERT_WSTR_EQUALS(script.ToString(val.get()), L"({x:1, z:[2, \"3\\u263A\\uFFFD\"], y:true})");
 	}
+
+	void test_gc_trigger_factor()
+	{
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+		script.SetGCTriggerFactor(400);
+		TS_ASSERT_EQUALS(JS_GetGCParameter(script.GetRuntime(), JSGC_TRIGGER_FACTOR), (uint32)400);
+
+		// Garbage collection must still work
+		TS_ASSERT(script.Eval("var a = []; for (var i = 0; i < 10000; ++i) a.push({x: i}); a = null;"));
+		script.MaybeGC();
+	}
+
+	void test_function_profiling()
+	{
+		ScriptInterface::SetFunctionProfiling(true);
+		{
+			ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+			TS_ASSERT(script.LoadScript(L"test_profiling.js",
+				"function profiledFunction(x) { return x + 1; }\n"
+				"for (var i = 0; i < 3; ++i) profiledFunction(i);"));
+			// (Destroying the runtime passes all its statistics to the profiler)
+		}
+		ScriptInterface::SetFunctionProfiling(false);
+
+		std::stringstream stream;
+		TS_ASSERT(g_Profiler2.ConstructJSONScriptProfile(stream, "main") == NULL);
+		TS_ASSERT(stream.str().find("{\"name\":\"profiledFunction (test_profiling.js:1)\",\"calls\":3,") != std::string::npos);
+
+		TS_ASSERT(g_Profiler2.ConstructJSONScriptProfile(stream, "no such thread") != NULL);
+	}
 };
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -323,9 +323,8 @@ public:
 	std::vector<entity_id_t> added;
 	std::vector<entity_id_t> removed;
 
-	// CCmpRangeManager wants to store a vector of messages and wants to
-	// swap vectors instead of copying (to save on memory allocations),
-	// so add some constructors for it:
+	// CCmpRangeManager wants to swap vectors into messages instead of
+	// copying (to save on memory allocations), so add some constructors for it:
 
 	CMessageRangeUpdate(u32 tag) :
 		tag(tag)
@@ -360,7 +359,7 @@ public:
 	}
 
 	u32 ticket;
-	ICmpPathfinder::Path path;
+	const ICmpPathfinder::Path& path; // (the pathfinder reuses its storage after the message has been handled)
 };
 
 /**
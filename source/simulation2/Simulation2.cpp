@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -26,9 +26,13 @@
 #include "simulation2/components/ICmpAIManager.h"
 #include "simulation2/components/ICmpCommandQueue.h"
 #include "simulation2/components/ICmpTemplateManager.h"
+#include "simulation2/helpers/RenderSnapshot.h"
+#include "simulation2/helpers/SelectionIndex.h"
 
+#include "graphics/Frustum.h"
 #include "graphics/MapReader.h"
 #include "graphics/Terrain.h"
+#include "graphics/UnitManager.h"
 #include "lib/timer.h"
 #include "lib/file/vfs/vfs_util.h"
 #include "maths/MathUtil.h"
@@ -37,6 +41,7 @@
 #include "ps/Loader.h"
 #include "ps/Profile.h"
 #include "ps/Pyrogenesis.h"
+#include "ps/ThreadPool.h"
 #include "ps/XML/Xeromyces.h"
 
 #include <iomanip>
@@ -60,6 +65,7 @@ class CSimulation2Impl
 public:
 	CSimulation2Impl(CUnitManager* unitManager, CTerrain* terrain) :
 		m_SimContext(), m_ComponentManager(m_SimContext),
+		m_RenderSnapshotValid(false), m_TurnsSinceMaybeGC(0),
 		m_EnableOOSLog(false), m_EnableSerializationTest(false)
 	{
 		m_SimContext.m_UnitManager = unitManager;
@@ -75,6 +81,9 @@ public:
 	~CSimulation2Impl()
 	{
 		UnregisterFileReloadFunc(ReloadChangedFileCB, this);
+
+		// The clones were allocated by the component manager's context
+		m_GuiQueryCache.clear();
 	}
 
 	void ResetState(bool skipScriptedComponents, bool skipAI)
@@ -82,6 +91,9 @@ public:
 		m_DeltaTime = 0.0;
 		m_LastFrameOffset = 0.0f;
 		m_TurnNumber = 0;
+		m_TurnsSinceMaybeGC = 0;
+		InvalidateRenderSnapshot();
+		m_GuiQueryCache.clear();
 		ResetComponentState(m_ComponentManager, skipScriptedComponents, skipAI);
 	}
 
@@ -103,6 +115,7 @@ public:
 		componentManager.AddComponent(SYSTEM_ENTITY, CID_SoundManager, noParam);
 		componentManager.AddComponent(SYSTEM_ENTITY, CID_Terrain, noParam);
 		componentManager.AddComponent(SYSTEM_ENTITY, CID_TerritoryManager, noParam);
+		componentManager.AddComponent(SYSTEM_ENTITY, CID_UnitMotionManager, noParam);
 		componentManager.AddComponent(SYSTEM_ENTITY, CID_WaterManager, noParam);
 
 		if (!skipAI)
@@ -145,6 +158,28 @@ public:
 	static void UpdateComponents(CSimContext& simContext, fixed turnLengthFixed, const std::vector<SimulationCommand>& commands);
 	void Interpolate(float simFrameLength, float frameOffset, float realFrameLength);
 
+	void IdleUpdate()
+	{
+		if (m_TurnsSinceMaybeGC == 0)
+			return;
+
+		PROFILE2("sim idle GC");
+		m_ComponentManager.GetScriptInterface().MaybeGC();
+		m_TurnsSinceMaybeGC = 0;
+	}
+
+	/**
+	 * Collects the components' render submissions into m_RenderSnapshot.
+	 */
+	void RecordRenderSnapshot();
+
+	void InvalidateRenderSnapshot()
+	{
+		m_RenderSnapshot.Clear();
+		m_RenderSnapshotValid = false;
+		m_SelectionIndex.Invalidate();
+	}
+
 	void DumpState();
 
 	CSimContext m_SimContext;
@@ -152,6 +187,16 @@ public:
 	double m_DeltaTime;
 	float m_LastFrameOffset;
 
+	// What the components submitted for rendering after the last Interpolate,
+	// if nothing has invalidated it since then
+	CRenderSnapshot m_RenderSnapshot;
+	bool m_RenderSnapshotValid;
+
+	// Built from the same state as the render snapshot, when first needed
+	CSelectionIndex m_SelectionIndex;
+
+	CSimulation2::GuiQueryCache m_GuiQueryCache;
+
 	std::string m_StartupScript;
 	CScriptValRooted m_InitAttributes;
 	CScriptValRooted m_MapSettings;
@@ -160,6 +205,9 @@ public:
 
 	uint32_t m_TurnNumber;
 
+	// Number of turns since the GC was last given a chance to run
+	uint32_t m_TurnsSinceMaybeGC;
+
 	bool m_EnableOOSLog;
 
 
@@ -235,6 +283,8 @@ Status CSimulation2Impl::ReloadChangedFile(const VfsPath& path)
 	if (!VfsFileExists(path))
 		return INFO::OK;
 
+	m_GuiQueryCache.clear();
+
 	LOGMESSAGE(L"Reloading simulation script '%ls'", filename.string().c_str());
 	if (!m_ComponentManager.LoadScript(filename, true))
 		return ERR::FAIL;
@@ -326,9 +376,13 @@ void CSimulation2Impl::ReportSerializationFailure(
 
 void CSimulation2Impl::Update(int turnLength, const std::vector<SimulationCommand>& commands)
 {
-	PROFILE3("sim update");
+	// (With profiler2.counters.enable, this records the turn's allocations)
+	PROFILE3_COUNTERS("sim update");
 	PROFILE2_ATTR("turn %d", (int)m_TurnNumber);
 
+	InvalidateRenderSnapshot();
+	m_GuiQueryCache.clear();
+
 	fixed turnLengthFixed = fixed::FromInt(turnLength) / 1000;
 
 	/*
@@ -339,6 +393,8 @@ void CSimulation2Impl::Update(int turnLength, const std::vector<SimulationComman
 	 * Then we run the update on the secondary context, and check that its new serialized
 	 * state matches the primary context after the update (to check that the simulation doesn't depend
 	 * on anything that's not serialized).
+	 * The secondary context's update runs with the thread pool in serial mode, so this
+	 * also checks that the parallel parts of the update don't depend on the scheduling.
 	 */
 
 	const bool serializationTestDebugDump = false; // set true to save human-readable state dumps before an error is detected, for debugging (but slow)
@@ -397,6 +453,7 @@ void CSimulation2Impl::Update(int turnLength, const std::vector<SimulationComman
 		ENSURE(LDR_NonprogressiveLoad() == INFO::OK);
 
 		ENSURE(secondaryComponentManager.DeserializeState(primaryStateBefore.state));
+		secondaryComponentManager.SetStateHashType(m_ComponentManager.GetStateHashType());
 
 		SerializationTestState secondaryStateBefore;
 		ENSURE(secondaryComponentManager.SerializeState(secondaryStateBefore.state));
@@ -416,9 +473,16 @@ void CSimulation2Impl::Update(int turnLength, const std::vector<SimulationComman
 		if (serializationTestHash)
 			ENSURE(m_ComponentManager.ComputeStateHash(primaryStateAfter.hash, false));
 
+		const bool wasSerial = g_ThreadPool && g_ThreadPool->IsSerial();
+		if (g_ThreadPool)
+			g_ThreadPool->SetSerial(true);
+
 		UpdateComponents(secondaryContext, turnLengthFixed,
 			CloneCommandsFromOtherContext(m_ComponentManager.GetScriptInterface(), secondaryComponentManager.GetScriptInterface(), commands));
 
+		if (g_ThreadPool)
+			g_ThreadPool->SetSerial(wasSerial);
+
 		SerializationTestState secondaryStateAfter;
 		ENSURE(secondaryComponentManager.SerializeState(secondaryStateAfter.state));
 		if (serializationTestHash)
@@ -438,11 +502,15 @@ void CSimulation2Impl::Update(int turnLength, const std::vector<SimulationComman
 //	if (m_TurnNumber == 0)
 //		m_ComponentManager.GetScriptInterface().DumpHeap();
 
-	// Run the GC occasionally
-	// (TODO: we ought to schedule this for a frame where we're not
-	// running the sim update, to spread the load)
-	if (m_TurnNumber % 10 == 0)
+	// Run the GC occasionally. That's normally done by IdleUpdate instead,
+	// in a frame where we're not running the sim update, to spread the load;
+	// but if there aren't any of those frames (e.g. when the game can't keep
+	// up), do it here
+	if (++m_TurnsSinceMaybeGC >= 10)
+	{
 		m_ComponentManager.GetScriptInterface().MaybeGC();
+		m_TurnsSinceMaybeGC = 0;
+	}
 
 	if (m_EnableOOSLog)
 		DumpState();
@@ -524,6 +592,25 @@ void CSimulation2Impl::Interpolate(float simFrameLength, float frameOffset, floa
 
 	// Clean up any entities destroyed during interpolate (e.g. local corpses)
 	m_ComponentManager.FlushDestroyedComponents();
+
+	// The components' render data is now up to date for this frame, so publish it
+	RecordRenderSnapshot();
+}
+
+void CSimulation2Impl::RecordRenderSnapshot()
+{
+	PROFILE3("sim record render snapshot");
+
+	m_RenderSnapshot.Clear();
+	m_SelectionIndex.Invalidate();
+
+	// The snapshot ignores the frustum and records the bounds of culled
+	// objects instead, so they can be tested against the real one when rendering
+	CFrustum frustum;
+	CMessageRenderSubmit msg(m_RenderSnapshot, frustum, true);
+	m_ComponentManager.BroadcastMessage(msg);
+
+	m_RenderSnapshotValid = true;
 }
 
 void CSimulation2Impl::DumpState()
@@ -577,18 +664,34 @@ void CSimulation2::EnableSerializationTest()
 	m->m_EnableSerializationTest = true;
 }
 
+void CSimulation2::EnableMessageStats()
+{
+	m->m_ComponentManager.EnableMessageStats();
+}
+
+void CSimulation2::SetStateHashType(EStateHashType type)
+{
+	m->m_ComponentManager.SetStateHashType(type);
+}
+
 entity_id_t CSimulation2::AddEntity(const std::wstring& templateName)
 {
+	m->m_SelectionIndex.Invalidate();
+	m->m_GuiQueryCache.clear();
 	return m->m_ComponentManager.AddEntity(templateName, m->m_ComponentManager.AllocateNewEntity());
 }
 
 entity_id_t CSimulation2::AddEntity(const std::wstring& templateName, entity_id_t preferredId)
 {
+	m->m_SelectionIndex.Invalidate();
+	m->m_GuiQueryCache.clear();
 	return m->m_ComponentManager.AddEntity(templateName, m->m_ComponentManager.AllocateNewEntity(preferredId));
 }
 
 entity_id_t CSimulation2::AddLocalEntity(const std::wstring& templateName)
 {
+	m->m_SelectionIndex.Invalidate();
+	m->m_GuiQueryCache.clear();
 	return m->m_ComponentManager.AddEntity(templateName, m->m_ComponentManager.AllocateNewLocalEntity());
 }
 
@@ -599,6 +702,8 @@ void CSimulation2::DestroyEntity(entity_id_t ent)
 
 void CSimulation2::FlushDestroyedEntities()
 {
+	m->InvalidateRenderSnapshot();
+	m->m_GuiQueryCache.clear();
 	m->m_ComponentManager.FlushDestroyedComponents();
 }
 
@@ -622,11 +727,27 @@ CSimulation2::InterfaceList CSimulation2::GetEntitiesWithInterface(int iid)
 	return m->m_ComponentManager.GetEntitiesWithInterface(iid);
 }
 
+const CSimulation2::InterfaceList& CSimulation2::GetEntitiesWithInterfaceSorted(int iid)
+{
+	return m->m_ComponentManager.GetEntitiesWithInterfaceSorted(iid);
+}
+
 const CSimulation2::InterfaceListUnordered& CSimulation2::GetEntitiesWithInterfaceUnordered(int iid)
 {
 	return m->m_ComponentManager.GetEntitiesWithInterfaceUnordered(iid);
 }
 
+const CSelectionIndex& CSimulation2::GetSelectionIndex()
+{
+	m->m_SelectionIndex.Update(*this);
+	return m->m_SelectionIndex;
+}
+
+CSimulation2::GuiQueryCache& CSimulation2::GetGuiQueryCache()
+{
+	return m->m_GuiQueryCache;
+}
+
 const CSimContext& CSimulation2::GetSimContext() const
 {
 	return m->m_SimContext;
@@ -645,12 +766,14 @@ void CSimulation2::InitGame(const CScriptVal& data)
 void CSimulation2::Update(int turnLength)
 {
 	std::vector<SimulationCommand> commands;
-	m->Update(turnLength, commands);
+	Update(turnLength, commands);
 }
 
 void CSimulation2::Update(int turnLength, const std::vector<SimulationCommand>& commands)
 {
+	const double startTime = timer_Time();
 	m->Update(turnLength, commands);
+	g_Profiler2.RecordTurnTime(timer_Time() - startTime);
 }
 
 void CSimulation2::Interpolate(float simFrameLength, float frameOffset, float realFrameLength)
@@ -658,12 +781,28 @@ void CSimulation2::Interpolate(float simFrameLength, float frameOffset, float re
 	m->Interpolate(simFrameLength, frameOffset, realFrameLength);
 }
 
+void CSimulation2::IdleUpdate()
+{
+	m->IdleUpdate();
+}
+
 void CSimulation2::RenderSubmit(SceneCollector& collector, const CFrustum& frustum, bool culling)
 {
 	PROFILE3("sim submit");
 
-	CMessageRenderSubmit msg(collector, frustum, culling);
-	m->m_ComponentManager.BroadcastMessage(msg);
+	// Use the snapshot from the last Interpolate if there's one, otherwise (e.g. when
+	// the game is paused, so there's no Interpolate) get the components to submit now.
+	// The snapshot is only used once, so changes made between frames (e.g. selecting
+	// units while paused) are always seen by the next frame.
+	if (!m->m_RenderSnapshotValid)
+		m->RecordRenderSnapshot();
+	m->m_RenderSnapshot.Replay(collector, frustum, culling);
+	m->InvalidateRenderSnapshot();
+
+	// Units drawn by VisualActor components are submitted from the quadtree,
+	// rather than each component culling itself
+	if (m->m_SimContext.HasUnitManager())
+		m->m_SimContext.GetUnitManager().GetQuadtree().RenderSubmit(collector, frustum, culling);
 }
 
 float CSimulation2::GetLastFrameOffset() const
@@ -768,6 +907,8 @@ bool CSimulation2::SerializeState(std::ostream& stream)
 bool CSimulation2::DeserializeState(std::istream& stream)
 {
 	// TODO: need to make sure the required SYSTEM_ENTITY components get constructed
+	m->InvalidateRenderSnapshot();
+	m->m_GuiQueryCache.clear();
 	return m->m_ComponentManager.DeserializeState(stream);
 }
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,6 +21,8 @@
 #include "simulation2/system/CmpPtr.h"
 #include "simulation2/system/Components.h"
 #include "simulation2/helpers/SimulationCommand.h"
+#include "simulation2/serialization/StateHashType.h"
+#include "scriptinterface/ScriptInterface.h"
 #include "scriptinterface/ScriptVal.h"
 
 #include "lib/file/vfs/vfs_path.h"
@@ -34,10 +36,10 @@ class CSimContext;
 class CUnitManager;
 class CTerrain;
 class IComponent;
-class ScriptInterface;
 class CMessage;
 class SceneCollector;
 class CFrustum;
+class CSelectionIndex;
 
 /**
  * Public API for simulation system.
@@ -53,6 +55,13 @@ public:
 
 	void EnableOOSLog();
 	void EnableSerializationTest();
+	void EnableMessageStats();
+
+	/**
+	 * Sets the hash function used by ComputeStateHash.
+	 * In networked games this is chosen by the server (see PS_NETWORK_FLAG_FAST_STATE_HASH).
+	 */
+	void SetStateHashType(EStateHashType type);
 
 	/**
 	 * Load all scripts in the specified directory (non-recursively),
@@ -156,6 +165,13 @@ public:
 	void Update(int turnLength);
 	void Update(int turnLength, const std::vector<SimulationCommand>& commands);
 	void Interpolate(float simFrameLength, float frameOffset, float realFrameLength);
+
+	/**
+	 * Call in frames where no turn is being simulated, to do work that isn't
+	 * part of the simulation state (currently garbage collection) when it
+	 * won't add to the cost of a turn.
+	 */
+	void IdleUpdate();
 	void RenderSubmit(SceneCollector& collector, const CFrustum& frustum, bool culling);
 
 	/**
@@ -200,12 +216,33 @@ public:
 	 */
 	InterfaceList GetEntitiesWithInterface(int iid);
 
+	/**
+	 * Like GetEntitiesWithInterface, but returns a cached list without copying.
+	 * See CComponentManager::GetEntitiesWithInterfaceSorted.
+	 */
+	const InterfaceList& GetEntitiesWithInterfaceSorted(int iid);
+
 	/**
 	 * Returns a list of components implementing the given interface, and their
 	 * associated entities, as an unordered map.
 	 */
 	const InterfaceListUnordered& GetEntitiesWithInterfaceUnordered(int iid);
 
+	/**
+	 * Returns the spatial index of selectable entities used for picking,
+	 * (re)building it if the render data has changed since it was last used.
+	 */
+	const CSelectionIndex& GetSelectionIndex();
+
+	/**
+	 * Results of read-only GuiInterface calls, saved by the GUI (see GuiInterfaceCall
+	 * in gui/scripting/ScriptFunctions.cpp) so it can reuse them until something might
+	 * have changed them. The simulation empties this at every turn, and whenever
+	 * entities are added or destroyed or the whole state is reset, loaded or reloaded.
+	 */
+	typedef std::map<std::string, shared_ptr<ScriptInterface::StructuredClone> > GuiQueryCache;
+	GuiQueryCache& GetGuiQueryCache();
+
 	const CSimContext& GetSimContext() const;
 	ScriptInterface& GetScriptInterface() const;
 
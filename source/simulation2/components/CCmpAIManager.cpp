@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -26,8 +26,11 @@
 #include "lib/timer.h"
 #include "lib/tex/tex.h"
 #include "lib/allocators/shared_ptr.h"
+#include "lib/external_libraries/libsdl.h"
 #include "ps/CLogger.h"
 #include "ps/Filesystem.h"
+#include "ps/Profiler2.h"
+#include "ps/ThreadUtil.h"
 #include "ps/Util.h"
 #include "simulation2/components/ICmpAIInterface.h"
 #include "simulation2/components/ICmpCommandQueue.h"
@@ -47,13 +50,16 @@
  * AI is primarily scripted, and the CCmpAIManager component defined here
  * takes care of managing all the scripts.
  *
- * To avoid slow AI scripts causing jerky rendering, they are run in a background
- * thread (maintained by CAIWorker) so that it's okay if they take a whole simulation
+ * To avoid slow AI scripts causing jerky rendering, they are run in background
+ * threads (each maintaining a CAIWorker) so that it's okay if they take a whole simulation
  * turn before returning their results (though preferably they shouldn't use nearly
- * that much CPU).
+ * that much CPU). Each AI player has its own worker thread and script runtime, so
+ * multiple AI players can run concurrently.
  *
  * CCmpAIManager grabs the world state after each turn (making use of AIInterface.js
  * and AIProxy.js to decide what data to include) then passes it to CAIWorker.
+ * Normally only the changes since the previous turn are passed, and CAIWorker
+ * merges them into its own copy of the state.
  * The AI scripts will then run asynchronously and return a list of commands to execute.
  * Any attempts to read the command list (including indirectly via serialization)
  * will block until it's actually completed, so the rest of the engine should avoid
@@ -61,13 +67,13 @@
  *
  * JS values are passed between the game and AI threads using ScriptInterface::StructuredClone.
  *
- * TODO: actually the thread isn't implemented yet, because performance hasn't been
- * sufficiently problematic to justify the complexity yet, but the CAIWorker interface
- * is designed to hopefully support threading when we want it.
+ * The AI's script runtime is created, used and destroyed entirely within the
+ * worker thread (see CAIWorkerThread), so we don't need JS_SetContextThread.
  */
 
 /**
- * Implements worker thread for CCmpAIManager.
+ * The AI scripts and their state. This must only be used by the AI thread
+ * (or while the AI thread is known to be idle).
  */
 class CAIWorker
 {
@@ -260,18 +266,22 @@ public:
 		std::vector<shared_ptr<ScriptInterface::StructuredClone> > commands;
 	};
 
-	CAIWorker() :
-		// TODO: Passing a 32 MB argument to CreateRuntime() is a temporary fix
-		// to prevent frequent AI out-of-memory crashes. The argument should be
-		// removed as soon as AI data-sharing has been implemented. See #1650.
-		m_ScriptRuntime(ScriptInterface::CreateRuntime(33554432)),
+	/**
+	 * @param runtimeSize maximum size in bytes of the script runtime's heap
+	 * @param gcTriggerFactor heap growth (as a percentage) that triggers a GC,
+	 *   or 0 for SpiderMonkey's default
+	 */
+	CAIWorker(int runtimeSize, int gcTriggerFactor) :
+		m_ScriptRuntime(ScriptInterface::CreateRuntime(runtimeSize)),
 		m_ScriptInterface("Engine", "AI", m_ScriptRuntime),
 		m_TurnNum(0),
-		m_CommandsComputed(true),
 		m_HasLoadedEntityTemplates(false)
 	{
 		m_ScriptInterface.SetCallbackData(static_cast<void*> (this));
 
+		if (gcTriggerFactor)
+			m_ScriptInterface.SetGCTriggerFactor(gcTriggerFactor);
+
 		// TODO: ought to seed the RNG (in a network-synchronised way) before we use it
 		m_ScriptInterface.ReplaceNondeterministicRNG(m_RNG);
 		m_ScriptInterface.LoadGlobalScripts();
@@ -283,7 +293,7 @@ public:
 		m_EntityTemplates = CScriptValRooted();
 		m_PlayerMetadata.clear();
 		m_Players.clear();
-		m_GameState.reset();
+		m_GameState = CScriptValRooted();
 		m_PassabilityMapVal = CScriptValRooted();
 		m_TerritoryMapVal = CScriptValRooted();
 	}
@@ -299,44 +309,35 @@ public:
 		return true;
 	}
 
-	void StartComputation(const shared_ptr<ScriptInterface::StructuredClone>& gameState, const Grid<u16>& passabilityMap, const Grid<u8>& territoryMap, bool territoryMapDirty)
+	/**
+	 * Converts the maps for the AI scripts. They are NULL if they haven't changed
+	 * since the last call. The grids aren't used after this returns.
+	 */
+	void UpdateMaps(const Grid<u16>* passabilityMap, const Grid<u8>* territoryMap)
 	{
-		ENSURE(m_CommandsComputed);
-
-		m_GameState = gameState;
-
-		if (passabilityMap.m_DirtyID != m_PassabilityMap.m_DirtyID)
-		{
-			m_PassabilityMap = passabilityMap;
+		PROFILE2("AI compute read maps");
 
-			JSContext* cx = m_ScriptInterface.GetContext();
-			m_PassabilityMapVal = CScriptValRooted(cx, ScriptInterface::ToJSVal(cx, m_PassabilityMap));
-		}
-
-		if (territoryMapDirty)
-		{
-			m_TerritoryMap = territoryMap;
+		JSContext* cx = m_ScriptInterface.GetContext();
 
-			JSContext* cx = m_ScriptInterface.GetContext();
-			m_TerritoryMapVal = CScriptValRooted(cx, ScriptInterface::ToJSVal(cx, m_TerritoryMap));
-		}
+		if (passabilityMap)
+			m_PassabilityMapVal = CScriptValRooted(cx, ScriptInterface::ToJSVal(cx, *passabilityMap));
 
-		m_CommandsComputed = false;
+		if (territoryMap)
+			m_TerritoryMapVal = CScriptValRooted(cx, ScriptInterface::ToJSVal(cx, *territoryMap));
 	}
 
-	void WaitToFinishComputation()
+	/**
+	 * Runs the AI players on the given game state, replacing their previous commands.
+	 * If isDelta, gameState only contains the changes since the previous call (as returned
+	 * by ICmpAIInterface::GetRepresentation), else it's the full state.
+	 */
+	void Compute(const shared_ptr<ScriptInterface::StructuredClone>& gameState, bool isDelta)
 	{
-		if (!m_CommandsComputed)
-		{
-			PerformComputation();
-			m_CommandsComputed = true;
-		}
+		PerformComputation(gameState, isDelta);
 	}
 
 	void GetCommands(std::vector<SCommandSets>& commands)
 	{
-		WaitToFinishComputation();
-
 		commands.clear();
 		commands.resize(m_Players.size());
 		for (size_t i = 0; i < m_Players.size(); ++i)
@@ -365,8 +366,6 @@ public:
 
 	void Serialize(std::ostream& stream, bool isDebug)
 	{
-		WaitToFinishComputation();
-
 		if (isDebug)
 		{
 			CDebugSerializer serializer(m_ScriptInterface, stream);
@@ -411,8 +410,6 @@ public:
 
 	void Deserialize(std::istream& stream)
 	{
-		ENSURE(m_CommandsComputed); // deserializing while we're still actively computing would be bad
-
 		CStdDeserializer deserializer(m_ScriptInterface, stream);
 
 		m_PlayerMetadata.clear();
@@ -467,39 +464,153 @@ private:
 		return m_PlayerMetadata[path];
 	}
 
-	void PerformComputation()
+	void PerformComputation(const shared_ptr<ScriptInterface::StructuredClone>& gameState, bool isDelta)
 	{
+		// (This runs in the AI thread, so it must use PROFILE2 instead of PROFILE/PROFILE3)
+
 		// Deserialize the game state, to pass to the AI's HandleMessage
 		CScriptVal state;
 		{
-			PROFILE3("AI compute read state");
-			state = m_ScriptInterface.ReadStructuredClone(m_GameState);
-			m_ScriptInterface.SetProperty(state.get(), "passabilityMap", m_PassabilityMapVal, true);
-			m_ScriptInterface.SetProperty(state.get(), "territoryMap", m_TerritoryMapVal, true);
+			PROFILE2("AI compute read state");
+			state = m_ScriptInterface.ReadStructuredClone(gameState);
+			if (isDelta && !m_GameState.uninitialised())
+			{
+				ApplyStateDelta(state.get());
+				state = m_GameState.get();
+			}
+			else
+			{
+				m_GameState = CScriptValRooted(m_ScriptInterface.GetContext(), state);
+			}
+
+			// (These can't be constant, since they're reset on the same object every turn)
+			m_ScriptInterface.SetProperty(state.get(), "passabilityMap", m_PassabilityMapVal, false);
+			m_ScriptInterface.SetProperty(state.get(), "territoryMap", m_TerritoryMapVal, false);
 		}
 
 		// It would be nice to do
 		//   m_ScriptInterface.FreezeObject(state.get(), true);
 		// to prevent AI scripts accidentally modifying the state and
 		// affecting other AI scripts they share it with. But the performance
-		// cost is far too high, so we won't do that.
+		// cost is far too high, so we won't do that. (Since the state is kept
+		// between turns, any changes the scripts do make will persist until the
+		// changed properties are next updated.)
 
 		for (size_t i = 0; i < m_Players.size(); ++i)
 		{
-			PROFILE3("AI script");
+			PROFILE2("AI script");
 			PROFILE2_ATTR("player: %d", m_Players[i]->m_Player);
 			PROFILE2_ATTR("script: %ls", m_Players[i]->m_AIName.c_str());
 			m_Players[i]->Run(state);
 		}
 
-		// Run the GC every so often.
-		// (This isn't particularly necessary, but it makes profiling clearer
-		// since it avoids random GC delays while running other scripts)
-		if (m_TurnNum++ % 25 == 0)
+		// Give the GC a chance to run after every turn's computation, if the
+		// heap is getting close to its trigger, so it's less likely to be
+		// triggered in the middle of the scripts.
+		// (MaybeGC is very cheap when it doesn't need to collect.)
 		{
-			PROFILE3("AI compute GC");
+			PROFILE2("AI compute GC");
 			m_ScriptInterface.MaybeGC();
 		}
+		++m_TurnNum;
+	}
+
+	/**
+	 * Merges the changes from ICmpAIInterface::GetRepresentation into m_GameState.
+	 * Each entity in delta.entities has its properties copied onto the existing
+	 * entity (or is added if it's new, or removed if it's null), and all the other
+	 * properties of delta replace the old ones.
+	 */
+	void ApplyStateDelta(jsval delta)
+	{
+		JSContext* cx = m_ScriptInterface.GetContext();
+
+		if (!JSVAL_IS_OBJECT(delta) || JSVAL_IS_NULL(delta))
+			return;
+		JSObject* deltaObj = JSVAL_TO_OBJECT(delta);
+		JSObject* stateObj = JSVAL_TO_OBJECT(m_GameState.get());
+
+		CScriptVal deltaEntities;
+		m_ScriptInterface.GetProperty(delta, "entities", deltaEntities);
+
+		CScriptVal entities;
+		m_ScriptInterface.GetProperty(m_GameState.get(), "entities", entities);
+
+		if (!JSVAL_IS_OBJECT(entities.get()) || JSVAL_IS_NULL(entities.get())
+			|| !JSVAL_IS_OBJECT(deltaEntities.get()) || JSVAL_IS_NULL(deltaEntities.get()))
+		{
+			// Nothing to merge the entities with, so just copy everything
+			AssignProperties(deltaObj, stateObj);
+			return;
+		}
+
+		JSObject* entitiesObj = JSVAL_TO_OBJECT(entities.get());
+		JSObject* deltaEntitiesObj = JSVAL_TO_OBJECT(deltaEntities.get());
+
+		JSIdArray* ids = JS_Enumerate(cx, deltaEntitiesObj);
+		if (!ids)
+			return;
+
+		for (jsint i = 0; i < ids->length; ++i)
+		{
+			jsval val;
+			if (!JS_GetPropertyById(cx, deltaEntitiesObj, ids->vector[i], &val))
+				continue;
+
+			if (JSVAL_IS_NULL(val))
+			{
+				// The entity was destroyed
+				JS_DeletePropertyById(cx, entitiesObj, ids->vector[i]);
+				continue;
+			}
+
+			jsval oldVal;
+			if (JSVAL_IS_OBJECT(val) && JS_GetPropertyById(cx, entitiesObj, ids->vector[i], &oldVal)
+				&& JSVAL_IS_OBJECT(oldVal) && !JSVAL_IS_NULL(oldVal))
+				AssignProperties(JSVAL_TO_OBJECT(val), JSVAL_TO_OBJECT(oldVal));
+			else
+				JS_SetPropertyById(cx, entitiesObj, ids->vector[i], &val);
+		}
+
+		JS_DestroyIdArray(cx, ids);
+
+		// Copy everything else (events etc) except the entities we've just merged
+		ids = JS_Enumerate(cx, deltaObj);
+		if (!ids)
+			return;
+
+		jsid entitiesId;
+		JS_ValueToId(cx, STRING_TO_JSVAL(JS_InternString(cx, "entities")), &entitiesId);
+
+		for (jsint i = 0; i < ids->length; ++i)
+		{
+			jsval val;
+			if (JSID_BITS(ids->vector[i]) != JSID_BITS(entitiesId) && JS_GetPropertyById(cx, deltaObj, ids->vector[i], &val))
+				JS_SetPropertyById(cx, stateObj, ids->vector[i], &val);
+		}
+
+		JS_DestroyIdArray(cx, ids);
+	}
+
+	/**
+	 * Copies all the enumerable properties of src onto dst.
+	 */
+	void AssignProperties(JSObject* src, JSObject* dst)
+	{
+		JSContext* cx = m_ScriptInterface.GetContext();
+
+		JSIdArray* ids = JS_Enumerate(cx, src);
+		if (!ids)
+			return;
+
+		for (jsint i = 0; i < ids->length; ++i)
+		{
+			jsval val;
+			if (JS_GetPropertyById(cx, src, ids->vector[i], &val))
+				JS_SetPropertyById(cx, dst, ids->vector[i], &val);
+		}
+
+		JS_DestroyIdArray(cx, ids);
 	}
 
 	shared_ptr<ScriptRuntime> m_ScriptRuntime;
@@ -507,19 +618,314 @@ private:
 	boost::rand48 m_RNG;
 	u32 m_TurnNum;
 
+	// The full game state from the previous computation, which the deltas are merged into.
+	// (This isn't serialized; the manager sends the full state again after deserializing)
+	CScriptValRooted m_GameState;
+
 	CScriptValRooted m_EntityTemplates;
 	bool m_HasLoadedEntityTemplates;
 
 	std::map<VfsPath, CScriptValRooted> m_PlayerMetadata;
 	std::vector<shared_ptr<CAIPlayer> > m_Players; // use shared_ptr just to avoid copying
 
-	shared_ptr<ScriptInterface::StructuredClone> m_GameState;
-	Grid<u16> m_PassabilityMap;
 	CScriptValRooted m_PassabilityMapVal;
-	Grid<u8> m_TerritoryMap;
 	CScriptValRooted m_TerritoryMapVal;
+};
+
+/**
+ * Runs a CAIWorker in a background thread, so the AI scripts can compute their
+ * commands for the next turn while the engine renders frames.
+ *
+ * All the methods must be called from the same (simulation) thread. Only one
+ * job is given to the AI thread at a time; each method first waits for the
+ * previous job to finish. StartComputation and LoadEntityTemplates return
+ * without waiting for their job, so the scripts run while the simulation thread
+ * does other work. (AI scripts shouldn't load modules from inside HandleMessage,
+ * since that would access the VFS concurrently with the main thread.)
+ *
+ * The commands only depend on the inputs given to StartComputation,
+ * and are only collected at fixed points (GetCommands), so the simulation
+ * stays deterministic regardless of how long the AI takes.
+ */
+class CAIWorkerThread
+{
+	NONCOPYABLE(CAIWorkerThread);
+public:
+	typedef CAIWorker::SCommandSets SCommandSets;
+
+	CAIWorkerThread(int runtimeSize, int gcTriggerFactor) :
+		m_Worker(NULL), m_Busy(false), m_Job(JOB_INIT), m_JobError(PSRETURN_OK),
+		m_JobRuntimeSize(runtimeSize), m_JobGCTriggerFactor(gcTriggerFactor), m_JobPlayer(0), m_JobCallConstructor(false), m_JobResult(false), m_JobGameStateIsDelta(false),
+		m_PassabilityMapDirtyID(0), m_TerritoryMapVersion(0),
+		m_JobOutStream(NULL), m_JobInStream(NULL), m_JobIsDebug(false)
+	{
+		// Use SDL semaphores since OS X doesn't implement sem_init
+		m_StartSem = SDL_CreateSemaphore(0);
+		ENSURE(m_StartSem);
+		m_DoneSem = SDL_CreateSemaphore(0);
+		ENSURE(m_DoneSem);
+
+		int ret = pthread_create(&m_Thread, NULL, &RunThread, this);
+		ENSURE(ret == 0);
+
+		// (Wait for this since it loads scripts, and the VFS isn't safe to use from
+		// multiple threads at once. AddPlayer also waits for the same reason)
+		RunJob(JOB_INIT);
+	}
+
+	~CAIWorkerThread()
+	{
+		RunJob(JOB_SHUTDOWN);
+
+		pthread_join(m_Thread, NULL);
+
+		SDL_DestroySemaphore(m_DoneSem);
+		SDL_DestroySemaphore(m_StartSem);
+	}
+
+	bool AddPlayer(const std::wstring& aiName, player_id_t player, bool callConstructor)
+	{
+		WaitForJob();
+		m_AIName = aiName;
+		m_JobAIName = aiName;
+		m_JobPlayer = player;
+		m_JobCallConstructor = callConstructor;
+		RunJob(JOB_ADD_PLAYER);
+		return m_JobResult;
+	}
+
+	/**
+	 * Returns the name of the AI player added with AddPlayer or Deserialize.
+	 */
+	const std::wstring& GetAIName() const
+	{
+		return m_AIName;
+	}
+
+	/**
+	 * Starts computing the AI's commands for the given state (which is only the
+	 * changes since the previous call if isDelta; see CAIWorker::Compute).
+	 * The maps are read-only snapshots (which may be NULL), and are only converted for
+	 * the AI if passabilityMap->m_DirtyID or territoryMapVersion differ from the previous
+	 * call. The AI thread releases them as soon as they've been converted.
+	 */
+	void StartComputation(const shared_ptr<ScriptInterface::StructuredClone>& gameState, bool isDelta,
+		const shared_ptr<const Grid<u16> >& passabilityMap, const shared_ptr<const Grid<u8> >& territoryMap, size_t territoryMapVersion)
+	{
+		WaitForJob();
+
+		// (We hold the reference to the game state until the next computation, so that it's
+		// freed by this thread, since it was allocated by the simulation's script context)
+		m_JobGameState = gameState;
+		m_JobGameStateIsDelta = isDelta;
+
+		if (passabilityMap && passabilityMap->m_DirtyID != m_PassabilityMapDirtyID)
+		{
+			m_JobPassabilityMap = passabilityMap;
+			m_PassabilityMapDirtyID = passabilityMap->m_DirtyID;
+		}
+
+		if (territoryMap && territoryMapVersion != m_TerritoryMapVersion)
+		{
+			m_JobTerritoryMap = territoryMap;
+			m_TerritoryMapVersion = territoryMapVersion;
+		}
+
+		StartJob(JOB_COMPUTE);
+	}
+
+	void GetCommands(std::vector<SCommandSets>& commands)
+	{
+		WaitForJob();
+
+		// The AI thread is idle now, so we can read the commands directly.
+		// (The commands are only released by the AI thread, when it next computes,
+		// so the caller must be finished with them before then)
+		m_Worker->GetCommands(commands);
+	}
+
+	void LoadEntityTemplates(const std::vector<std::pair<std::string, const CParamNode*> >& templates)
+	{
+		// (The template nodes won't change, so they can be read from the AI thread)
+		WaitForJob();
+		m_JobTemplates = templates;
+		StartJob(JOB_LOAD_TEMPLATES);
+	}
+
+	void Serialize(std::ostream& stream, bool isDebug)
+	{
+		WaitForJob();
+		m_JobOutStream = &stream;
+		m_JobIsDebug = isDebug;
+		RunJob(JOB_SERIALIZE);
+		m_JobOutStream = NULL;
+	}
+
+	void Deserialize(const std::wstring& aiName, std::istream& stream)
+	{
+		WaitForJob();
+		m_AIName = aiName;
+		m_JobInStream = &stream;
+		RunJob(JOB_DESERIALIZE);
+		m_JobInStream = NULL;
+	}
+
+private:
+	enum EJob
+	{
+		JOB_INIT,
+		JOB_SHUTDOWN,
+		JOB_ADD_PLAYER,
+		JOB_COMPUTE,
+		JOB_LOAD_TEMPLATES,
+		JOB_SERIALIZE,
+		JOB_DESERIALIZE
+	};
+
+	void StartJob(EJob job)
+	{
+		WaitForJob();
+
+		// (The semaphores act as memory barriers, so the AI thread will see the
+		// job fields and we'll see its outputs)
+		m_Job = job;
+		m_Busy = true;
+		SDL_SemPost(m_StartSem);
+	}
+
+	void WaitForJob()
+	{
+		if (!m_Busy)
+			return;
+
+		SDL_SemWait(m_DoneSem);
+		m_Busy = false;
+
+		// Rethrow errors (e.g. from deserialization) in the calling thread
+		if (m_JobError != PSRETURN_OK)
+		{
+			PSRETURN error = m_JobError;
+			m_JobError = PSRETURN_OK;
+			ThrowError(error);
+		}
+	}
+
+	void RunJob(EJob job)
+	{
+		StartJob(job);
+		WaitForJob();
+	}
+
+	static void* RunThread(void* data)
+	{
+		debug_SetThreadName("AI");
+		g_Profiler2.RegisterCurrentThread("AI");
+
+		static_cast<CAIWorkerThread*>(data)->Run();
+
+		return NULL;
+	}
+
+	void Run()
+	{
+		while (true)
+		{
+			SDL_SemWait(m_StartSem);
+
+			EJob job = m_Job;
+			try
+			{
+				PerformJob(job);
+			}
+			catch (PSERROR& e)
+			{
+				m_JobError = e.getCode();
+			}
+
+			SDL_SemPost(m_DoneSem);
+
+			if (job == JOB_SHUTDOWN)
+				break;
+		}
+	}
+
+	void PerformJob(EJob job)
+	{
+		switch (job)
+		{
+		case JOB_INIT:
+			m_Worker = new CAIWorker(m_JobRuntimeSize, m_JobGCTriggerFactor);
+			break;
+
+		case JOB_SHUTDOWN:
+			SAFE_DELETE(m_Worker);
+			break;
+
+		case JOB_ADD_PLAYER:
+			m_JobResult = m_Worker->AddPlayer(m_JobAIName, m_JobPlayer, m_JobCallConstructor);
+			break;
+
+		case JOB_COMPUTE:
+		{
+			PROFILE2("AI compute");
+			m_Worker->UpdateMaps(m_JobPassabilityMap.get(), m_JobTerritoryMap.get());
+
+			// Release the snapshots straight away, so the simulation won't have to copy
+			// its grids if it modifies them while the scripts are running
+			m_JobPassabilityMap.reset();
+			m_JobTerritoryMap.reset();
 
-	bool m_CommandsComputed;
+			m_Worker->Compute(m_JobGameState, m_JobGameStateIsDelta);
+			break;
+		}
+
+		case JOB_LOAD_TEMPLATES:
+			m_Worker->LoadEntityTemplates(m_JobTemplates);
+			break;
+
+		case JOB_SERIALIZE:
+			m_Worker->Serialize(*m_JobOutStream, m_JobIsDebug);
+			break;
+
+		case JOB_DESERIALIZE:
+			m_Worker->Deserialize(*m_JobInStream);
+			break;
+		}
+	}
+
+	CAIWorker* m_Worker; // only created/destroyed by the AI thread
+	std::wstring m_AIName;
+
+	pthread_t m_Thread;
+	SDL_semaphore* m_StartSem; // posted when m_Job is ready to run
+	SDL_semaphore* m_DoneSem; // posted when m_Job has finished
+	bool m_Busy; // whether the AI thread might be running a job (only used by the calling thread)
+
+	// Current job and its parameters and results
+	// (only modified by the calling thread while the AI thread is idle, and vice versa)
+	EJob m_Job;
+	PSRETURN m_JobError;
+
+	int m_JobRuntimeSize;
+	int m_JobGCTriggerFactor;
+
+	std::wstring m_JobAIName;
+	player_id_t m_JobPlayer;
+	bool m_JobCallConstructor;
+	bool m_JobResult;
+
+	shared_ptr<ScriptInterface::StructuredClone> m_JobGameState;
+	bool m_JobGameStateIsDelta;
+	shared_ptr<const Grid<u16> > m_JobPassabilityMap; // NULL if unchanged since the last computation
+	size_t m_PassabilityMapDirtyID;
+	shared_ptr<const Grid<u8> > m_JobTerritoryMap; // NULL if unchanged since the last computation
+	size_t m_TerritoryMapVersion;
+
+	std::vector<std::pair<std::string, const CParamNode*> > m_JobTemplates;
+
+	std::ostream* m_JobOutStream;
+	std::istream* m_JobInStream;
+	bool m_JobIsDebug;
 };
 
 
@@ -544,6 +950,8 @@ public:
 	virtual void Init(const CParamNode& UNUSED(paramNode))
 	{
 		m_TerritoriesDirtyID = 0;
+		m_TerritoryMapVersion = 0;
+		m_SendFullState = true;
 
 		StartLoadEntityTemplates();
 	}
@@ -554,12 +962,17 @@ public:
 
 	virtual void Serialize(ISerializer& serialize)
 	{
-		// Because the AI worker uses its own ScriptInterface, we can't use the
+		// Because the AI workers use their own ScriptInterfaces, we can't use the
 		// ISerializer (which was initialised with the simulation ScriptInterface)
 		// directly. So we'll just grab the ISerializer's stream and write to it
 		// with an independent serializer.
 
-		m_Worker.Serialize(serialize.GetStream(), serialize.IsDebug());
+		serialize.NumberU32_Unbounded("num workers", (u32)m_Workers.size());
+		for (size_t i = 0; i < m_Workers.size(); ++i)
+		{
+			serialize.String("name", m_Workers[i]->GetAIName(), 1, 256);
+			m_Workers[i]->Serialize(serialize.GetStream(), serialize.IsDebug());
+		}
 	}
 
 	virtual void Deserialize(const CParamNode& paramNode, IDeserializer& deserialize)
@@ -568,7 +981,21 @@ public:
 
 		ForceLoadEntityTemplates();
 
-		m_Worker.Deserialize(deserialize.GetStream());
+		u32 numWorkers;
+		deserialize.NumberU32_Unbounded("num workers", numWorkers);
+		for (u32 i = 0; i < numWorkers; ++i)
+		{
+			// (The worker's state includes the name too, but we need it to create the worker)
+			std::wstring name;
+			deserialize.String("name", name, 1, 256);
+
+			int runtimeSize, gcTriggerFactor;
+			GetRuntimeParams(name, runtimeSize, gcTriggerFactor);
+			shared_ptr<CAIWorkerThread> worker(new CAIWorkerThread(runtimeSize, gcTriggerFactor));
+			worker->LoadEntityTemplates(m_Templates);
+			worker->Deserialize(name, deserialize.GetStream());
+			m_Workers.push_back(worker);
+		}
 	}
 
 	virtual void HandleMessage(const CMessage& msg, bool UNUSED(global))
@@ -596,7 +1023,19 @@ public:
 
 	virtual void AddPlayer(std::wstring id, player_id_t player)
 	{
-		m_Worker.AddPlayer(id, player, true);
+		// The AI players need the templates when they're constructed
+		ForceLoadEntityTemplates();
+
+		// Each AI player gets its own thread and runtime, so they can run concurrently
+		int runtimeSize, gcTriggerFactor;
+		GetRuntimeParams(id, runtimeSize, gcTriggerFactor);
+		shared_ptr<CAIWorkerThread> worker(new CAIWorkerThread(runtimeSize, gcTriggerFactor));
+		worker->LoadEntityTemplates(m_Templates);
+		if (worker->AddPlayer(id, player, true))
+		{
+			m_Workers.push_back(worker);
+			m_SendFullState = true; // the new worker doesn't have any state yet
+		}
 
 		// AI players can cheat and see through FoW/SoD, since that greatly simplifies
 		// their implementation.
@@ -617,31 +1056,41 @@ public:
 		CmpPtr<ICmpAIInterface> cmpAIInterface(GetSimContext(), SYSTEM_ENTITY);
 		ENSURE(cmpAIInterface);
 
-		// Get the game state from AIInterface
-		CScriptVal state = cmpAIInterface->GetRepresentation();
+		// Get the game state from AIInterface. Once the workers have had the full state,
+		// they only need the changes since the previous turn
+		bool isDelta = !m_SendFullState;
+		CScriptVal state = isDelta ? cmpAIInterface->GetRepresentation() : cmpAIInterface->GetFullRepresentation();
+		m_SendFullState = false;
 
-		// Get the passability data
-		Grid<u16> dummyGrid;
-		const Grid<u16>* passabilityMap = &dummyGrid;
+		// Get the passability data. (This is a snapshot that the workers share with the
+		// pathfinder, so it's not copied unless the pathfinder changes it before the
+		// workers have finished reading it)
+		shared_ptr<const Grid<u16> > passabilityMap;
 		CmpPtr<ICmpPathfinder> cmpPathfinder(GetSimContext(), SYSTEM_ENTITY);
 		if (cmpPathfinder)
-			passabilityMap = &cmpPathfinder->GetPassabilityGrid();
+			passabilityMap = cmpPathfinder->GetPassabilityGridSnapshot();
 
 		// Get the territory data
 		//	Since getting the territory grid can trigger a recalculation, we check NeedUpdate first
-		bool territoryMapDirty = false;
-		Grid<u8> dummyGrid2;
-		const Grid<u8>* territoryMap = &dummyGrid2;
 		CmpPtr<ICmpTerritoryManager> cmpTerritoryManager(GetSimContext(), SYSTEM_ENTITY);
 		if (cmpTerritoryManager && cmpTerritoryManager->NeedUpdate(&m_TerritoriesDirtyID))
 		{
-			territoryMap = &cmpTerritoryManager->GetTerritoryGrid();
-			territoryMapDirty = true;
+			m_TerritoryMap = cmpTerritoryManager->GetTerritoryGridSnapshot();
+			++m_TerritoryMapVersion;
 		}
 
-		LoadPathfinderClasses(state);
+		// (The classes don't change, so the workers keep them from the full state)
+		if (!isDelta)
+			LoadPathfinderClasses(state);
 
-		m_Worker.StartComputation(scriptInterface.WriteStructuredClone(state.get()), *passabilityMap, *territoryMap, territoryMapDirty);
+		// All the workers read the same copy of the state
+		shared_ptr<ScriptInterface::StructuredClone> stateClone;
+		{
+			PROFILE3("AI clone state");
+			stateClone = scriptInterface.WriteStructuredClone(state.get());
+		}
+		for (size_t i = 0; i < m_Workers.size(); ++i)
+			m_Workers[i]->StartComputation(stateClone, isDelta, passabilityMap, m_TerritoryMap, m_TerritoryMapVersion);
 	}
 
 	virtual void PushCommands()
@@ -649,7 +1098,15 @@ public:
 		ScriptInterface& scriptInterface = GetSimContext().GetScriptInterface();
 
 		std::vector<CAIWorker::SCommandSets> commands;
-		m_Worker.GetCommands(commands);
+		{
+			PROFILE3("AI wait for commands");
+			for (size_t i = 0; i < m_Workers.size(); ++i)
+			{
+				std::vector<CAIWorker::SCommandSets> workerCommands;
+				m_Workers[i]->GetCommands(workerCommands);
+				commands.insert(commands.end(), workerCommands.begin(), workerCommands.end());
+			}
+		}
 
 		CmpPtr<ICmpCommandQueue> cmpCommandQueue(GetSimContext(), SYSTEM_ENTITY);
 		if (!cmpCommandQueue)
@@ -666,11 +1123,68 @@ public:
 	}
 
 private:
+	// Default maximum size of each AI player's script heap.
+	// TODO: This large size is a temporary fix to prevent frequent AI out-of-memory
+	// crashes, and should be reduced as soon as AI data-sharing has been implemented. See #1650.
+	enum { DEFAULT_AI_RUNTIME_SIZE = 32*1024*1024 };
+
 	std::vector<std::string> m_TemplateNames;
 	size_t m_TemplateLoadedIdx;
 	std::vector<std::pair<std::string, const CParamNode*> > m_Templates;
 	size_t m_TerritoriesDirtyID;
 
+	std::vector<shared_ptr<CAIWorkerThread> > m_Workers; // one per AI player; use shared_ptr just to avoid copying
+	bool m_SendFullState; // whether the workers need the full state (instead of the changes) next turn
+
+	// Snapshot of the territory map for workers that haven't had it yet.
+	// (The territory manager never modifies it, so keeping it doesn't cost a copy.
+	// m_TerritoryMapVersion tells the workers when it's changed)
+	shared_ptr<const Grid<u8> > m_TerritoryMap;
+	size_t m_TerritoryMapVersion;
+
+	/**
+	 * Gets the script heap size requested by the AI's data.json (as "runtimeSize",
+	 * in megabytes) and its GC trigger factor (as "gcTriggerFactor", a percentage
+	 * of the heap size after the last GC), or the defaults if it doesn't specify
+	 * them. The default trigger factor is 0, meaning SpiderMonkey's default.
+	 */
+	void GetRuntimeParams(const std::wstring& aiName, int& runtimeSize, int& gcTriggerFactor)
+	{
+		runtimeSize = DEFAULT_AI_RUNTIME_SIZE;
+		gcTriggerFactor = 0;
+
+		// (If the file is missing, the worker will report the error when it tries to load the AI)
+		VfsPath path = L"simulation/ai/" + aiName + L"/data.json";
+		if (!VfsFileExists(path))
+			return;
+
+		ScriptInterface& scriptInterface = GetSimContext().GetScriptInterface();
+
+		CScriptValRooted metadata = scriptInterface.ReadJSONFile(path);
+		if (metadata.uninitialised())
+			return;
+
+		int size = 0;
+		if (scriptInterface.HasProperty(metadata.get(), "runtimeSize")
+			&& scriptInterface.GetProperty(metadata.get(), "runtimeSize", size))
+		{
+			if (size <= 0 || size > 1024)
+				LOGERROR(L"AI %ls: invalid runtimeSize %d", aiName.c_str(), size);
+			else
+				runtimeSize = size*1024*1024;
+		}
+
+		int factor = 0;
+		if (scriptInterface.HasProperty(metadata.get(), "gcTriggerFactor")
+			&& scriptInterface.GetProperty(metadata.get(), "gcTriggerFactor", factor))
+		{
+			if (factor < 100 || factor > 10000)
+				LOGERROR(L"AI %ls: invalid gcTriggerFactor %d", aiName.c_str(), factor);
+			else
+				gcTriggerFactor = factor;
+		}
+	}
+
 	void StartLoadEntityTemplates()
 	{
 		CmpPtr<ICmpTemplateManager> cmpTemplateManager(GetSimContext(), SYSTEM_ENTITY);
@@ -696,9 +1210,11 @@ private:
 
 		m_TemplateLoadedIdx++;
 
-		// If this was the last template, send the data to the worker
+		// If this was the last template, send the data to the workers
+		// (any added later will be given the data when they're created)
 		if (m_TemplateLoadedIdx == m_TemplateNames.size())
-			m_Worker.LoadEntityTemplates(m_Templates);
+			for (size_t i = 0; i < m_Workers.size(); ++i)
+				m_Workers[i]->LoadEntityTemplates(m_Templates);
 
 		return true;
 	}
@@ -727,8 +1243,6 @@ private:
 
 		scriptInterface.SetProperty(state.get(), "passabilityClasses", classesVal, true);
 	}
-
-	CAIWorker m_Worker;
 };
 
 REGISTER_COMPONENT_TYPE(AIManager)
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,10 +20,56 @@
 #include "simulation2/system/Component.h"
 #include "ICmpCommandQueue.h"
 
+#include "simulation2/components/ICmpOwnership.h"
+#include "simulation2/components/ICmpPlayer.h"
+#include "simulation2/components/ICmpPlayerManager.h"
+
 #include "ps/CLogger.h"
 #include "ps/Game.h"
 #include "network/NetTurnManager.h"
 
+/**
+ * Native handler for commands of the form { "type": ..., "entities": [...], ... } which
+ * ProcessCommand only applies to the entities that the player controls.
+ * If it controls none of them, the command is a no-op and doesn't need to go through
+ * the scripts at all. (Players often send orders for units that have just died, or
+ * that they've lost, and AIs are fond of sending orders to stale lists.)
+ * Otherwise the orders are left to ProcessCommand, which handles the grouping
+ * into formations.
+ */
+static bool HandleEntityCommand(const CSimContext& context, player_id_t player, CScriptVal cmd)
+{
+	// Commands from invalid players are ignored
+	CmpPtr<ICmpPlayerManager> cmpPlayerManager(context, SYSTEM_ENTITY);
+	if (!cmpPlayerManager || player < 0)
+		return true;
+	entity_id_t playerEnt = cmpPlayerManager->GetPlayerByID(player);
+	if (playerEnt == INVALID_ENTITY)
+		return true;
+	CmpPtr<ICmpPlayer> cmpPlayer(context, playerEnt);
+	if (!cmpPlayer)
+		return true;
+
+	if (cmpPlayer->CanControlAllUnits())
+		return false;
+
+	ScriptInterface& scriptInterface = context.GetScriptInterface();
+	CScriptVal entitiesVal;
+	std::vector<entity_id_t> entities;
+	if (!scriptInterface.GetProperty(cmd.get(), "entities", entitiesVal) ||
+		!ScriptInterface::FromJSVal(scriptInterface.GetContext(), entitiesVal.get(), entities))
+		return false; // let the script deal with (or report) malformed commands
+
+	for (size_t i = 0; i < entities.size(); ++i)
+	{
+		CmpPtr<ICmpOwnership> cmpOwnership(context, entities[i]);
+		if (cmpOwnership && cmpOwnership->GetOwner() == player)
+			return false;
+	}
+
+	return true;
+}
+
 class CCmpCommandQueue : public ICmpCommandQueue
 {
 public:
@@ -35,6 +81,9 @@ public:
 
 	std::vector<SimulationCommand> m_LocalQueue;
 
+	// Not serialized: the handlers are always registered in the same way by native code
+	std::map<std::string, NativeCommandHandler> m_NativeCommands;
+
 	static std::string GetSchema()
 	{
 		return "<a:component type='system'/><empty/>";
@@ -42,6 +91,11 @@ public:
 
 	virtual void Init(const CParamNode& UNUSED(paramNode))
 	{
+		// The most frequent commands (by far) when many units are selected
+		RegisterNativeCommand("walk", HandleEntityCommand);
+		RegisterNativeCommand("attack-walk", HandleEntityCommand);
+		RegisterNativeCommand("gather", HandleEntityCommand);
+		RegisterNativeCommand("stop", HandleEntityCommand);
 	}
 
 	virtual void Deinit()
@@ -58,8 +112,10 @@ public:
 		}
 	}
 
-	virtual void Deserialize(const CParamNode& UNUSED(paramNode), IDeserializer& deserialize)
+	virtual void Deserialize(const CParamNode& paramNode, IDeserializer& deserialize)
 	{
+		Init(paramNode);
+
 		u32 numCmds;
 		deserialize.NumberU32_Unbounded("num commands", numCmds);
 		for (size_t i = 0; i < numCmds; ++i)
@@ -92,26 +148,44 @@ public:
 		g_Game->GetTurnManager()->PostCommand(CScriptValRooted(cx, cmd));
 	}
 
-	virtual void FlushTurn(const std::vector<SimulationCommand>& commands)
+	virtual void RegisterNativeCommand(const std::string& type, NativeCommandHandler handler)
 	{
-		ScriptInterface& scriptInterface = GetSimContext().GetScriptInterface();
+		m_NativeCommands[type] = handler;
+	}
 
+	virtual void FlushTurn(const std::vector<SimulationCommand>& commands)
+	{
 		std::vector<SimulationCommand> localCommands;
 		m_LocalQueue.swap(localCommands);
 
 		for (size_t i = 0; i < localCommands.size(); ++i)
-		{
-			bool ok = scriptInterface.CallFunctionVoid(scriptInterface.GetGlobalObject(), "ProcessCommand", localCommands[i].player, localCommands[i].data);
-			if (!ok)
-				LOGERROR(L"Failed to call ProcessCommand() global script function");
-		}
+			ExecuteCommand(localCommands[i]);
 
 		for (size_t i = 0; i < commands.size(); ++i)
+			ExecuteCommand(commands[i]);
+	}
+
+	void ExecuteCommand(const SimulationCommand& command)
+	{
+		ScriptInterface& scriptInterface = GetSimContext().GetScriptInterface();
+
+		if (!m_NativeCommands.empty() && JSVAL_IS_OBJECT(command.data.get()) && !JSVAL_IS_NULL(command.data.get()))
 		{
-			bool ok = scriptInterface.CallFunctionVoid(scriptInterface.GetGlobalObject(), "ProcessCommand", commands[i].player, commands[i].data);
-			if (!ok)
-				LOGERROR(L"Failed to call ProcessCommand() global script function");
+			std::string type;
+			CScriptVal typeVal;
+			if (scriptInterface.GetProperty(command.data.get(), "type", typeVal) &&
+				JSVAL_IS_STRING(typeVal.get()) &&
+				ScriptInterface::FromJSVal(scriptInterface.GetContext(), typeVal.get(), type))
+			{
+				std::map<std::string, NativeCommandHandler>::const_iterator it = m_NativeCommands.find(type);
+				if (it != m_NativeCommands.end() && it->second(GetSimContext(), command.player, command.data.get()))
+					return;
+			}
 		}
+
+		bool ok = scriptInterface.CallFunctionVoid(scriptInterface.GetGlobalObject(), "ProcessCommand", command.player, command.data);
+		if (!ok)
+			LOGERROR(L"Failed to call ProcessCommand() global script function");
 	}
 };
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -35,8 +35,10 @@
 #include "ps/CLogger.h"
 
 // Externally, tags are opaque non-zero positive integers.
-// Internally, they are tagged (by shape) indexes into shape lists.
+// Internally, they are tagged (by shape) keys into the SlotMap shape lists.
 // idx must be non-zero.
+// (Shapes used to be stored in std::maps with sequential keys; those keys are
+// still valid SlotMap keys, so tags from older saved games remain compatible.)
 #define TAG_IS_VALID(tag) ((tag).valid())
 #define TAG_IS_UNIT(tag) (((tag).n & 1) == 0)
 #define TAG_IS_STATIC(tag) (((tag).n & 1) == 1)
@@ -44,6 +46,18 @@
 #define STATIC_INDEX_TO_TAG(idx) tag_t(((idx) << 1) | 1)
 #define TAG_TO_INDEX(tag) ((tag).n >> 1)
 
+/**
+ * Size of the cells of the grid that TestLine uses to skip static shapes.
+ */
+static const entity_pos_t STATIC_LINE_CELL_SIZE = entity_pos_t::FromInt(TERRAIN_TILE_SIZE);
+
+/**
+ * Shapes are added to the grid with their bounding box expanded by one cell,
+ * which covers lines of up to this radius. (An expanded rotated square sticks
+ * out of the original bounding box by up to r*sqrt(2).)
+ */
+static const entity_pos_t STATIC_LINE_MAX_RADIUS = STATIC_LINE_CELL_SIZE*2/3;
+
 /**
  * Internal representation of axis-aligned sometimes-square sometimes-circle shapes for moving units
  */
@@ -127,10 +141,18 @@ public:
 	SpatialSubdivision<u32> m_UnitSubdivision;
 	SpatialSubdivision<u32> m_StaticSubdivision;
 
-	// TODO: using std::map is a bit inefficient; is there a better way to store these?
-	std::map<u32, UnitShape> m_UnitShapes;
-	std::map<u32, StaticShape> m_StaticShapes;
-	u32 m_UnitShapeNext; // next allocated id
+	// Reusable buffer for subdivision query results, to avoid allocating
+	// a new vector every time (not serialized)
+	std::vector<u32> m_QueryShapes;
+
+	// Number of static shapes near each STATIC_LINE_CELL_SIZE cell, so
+	// TestLine can skip the exact static shape tests for lines that don't
+	// go near any. NULL if it needs to be rebuilt. (Not serialized.)
+	Grid<u16>* m_StaticLineGrid;
+
+	SlotMap<UnitShape> m_UnitShapes;
+	SlotMap<StaticShape> m_StaticShapes;
+	u32 m_UnitShapeNext; // generation for the next allocated id
 	u32 m_StaticShapeNext;
 
 	bool m_PassabilityCircular;
@@ -154,11 +176,16 @@ public:
 		m_StaticShapeNext = 1;
 
 		m_DirtyID = 1; // init to 1 so default-initialised grids are considered dirty
+		m_DirtyRectID = 0;
+		m_DirtyRectAll = true;
+		m_DirtyRectEmpty = true;
 
 		m_PassabilityCircular = false;
 
 		m_WorldX0 = m_WorldZ0 = m_WorldX1 = m_WorldZ1 = entity_pos_t::Zero();
 
+		m_StaticLineGrid = NULL;
+
 		// Initialise with bogus values (these will get replaced when
 		// SetBounds is called)
 		ResetSubdivisions(entity_pos_t::FromInt(1), entity_pos_t::FromInt(1));
@@ -166,6 +193,7 @@ public:
 
 	virtual void Deinit()
 	{
+		SAFE_DELETE(m_StaticLineGrid);
 	}
 
 	template<typename S>
@@ -174,8 +202,8 @@ public:
 		SerializeSpatialSubdivision<SerializeU32_Unbounded>()(serialize, "unit subdiv", m_UnitSubdivision);
 		SerializeSpatialSubdivision<SerializeU32_Unbounded>()(serialize, "static subdiv", m_StaticSubdivision);
 
-		SerializeMap<SerializeU32_Unbounded, SerializeUnitShape>()(serialize, "unit shapes", m_UnitShapes);
-		SerializeMap<SerializeU32_Unbounded, SerializeStaticShape>()(serialize, "static shapes", m_StaticShapes);
+		SerializeSlotMap<SerializeUnitShape>()(serialize, "unit shapes", m_UnitShapes);
+		SerializeSlotMap<SerializeStaticShape>()(serialize, "static shapes", m_StaticShapes);
 		serialize.NumberU32_Unbounded("unit shape next", m_UnitShapeNext);
 		serialize.NumberU32_Unbounded("static shape next", m_StaticShapeNext);
 
@@ -200,6 +228,8 @@ public:
 		Init(paramNode);
 
 		SerializeCommon(deserialize);
+
+		SAFE_DELETE(m_StaticLineGrid);
 	}
 
 	virtual void HandleMessage(const CMessage& msg, bool UNUSED(global))
@@ -235,14 +265,17 @@ public:
 		m_UnitSubdivision.Reset(x1, z1, entity_pos_t::FromInt(8*TERRAIN_TILE_SIZE));
 		m_StaticSubdivision.Reset(x1, z1, entity_pos_t::FromInt(8*TERRAIN_TILE_SIZE));
 
-		for (std::map<u32, UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
+		// The grid depends on the world size, so build it again when it's next needed
+		SAFE_DELETE(m_StaticLineGrid);
+
+		for (SlotMap<UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
 		{
 			CFixedVector2D center(it->second.x, it->second.z);
 			CFixedVector2D halfSize(it->second.r, it->second.r);
 			m_UnitSubdivision.Add(it->first, center - halfSize, center + halfSize);
 		}
 
-		for (std::map<u32, StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
+		for (SlotMap<StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
 		{
 			CFixedVector2D center(it->second.x, it->second.z);
 			CFixedVector2D bbHalfSize = Geometry::GetHalfBoundingBox(it->second.u, it->second.v, CFixedVector2D(it->second.hw, it->second.hh));
@@ -253,9 +286,8 @@ public:
 	virtual tag_t AddUnitShape(entity_id_t ent, entity_pos_t x, entity_pos_t z, entity_pos_t r, flags_t flags, entity_id_t group)
 	{
 		UnitShape shape = { ent, x, z, r, flags, group };
-		u32 id = m_UnitShapeNext++;
-		m_UnitShapes[id] = shape;
-		MakeDirtyUnit(flags);
+		u32 id = m_UnitShapes.insert(m_UnitShapeNext++, shape);
+		MakeDirtyUnit(flags, shape);
 
 		m_UnitSubdivision.Add(id, CFixedVector2D(x - r, z - r), CFixedVector2D(x + r, z + r));
 
@@ -270,14 +302,15 @@ public:
 		CFixedVector2D v(s, c);
 
 		StaticShape shape = { ent, x, z, u, v, w/2, h/2, flags, group, group2 };
-		u32 id = m_StaticShapeNext++;
-		m_StaticShapes[id] = shape;
-		MakeDirtyStatic(flags);
+		u32 id = m_StaticShapes.insert(m_StaticShapeNext++, shape);
+		MakeDirtyStatic(flags, shape);
 
 		CFixedVector2D center(x, z);
 		CFixedVector2D bbHalfSize = Geometry::GetHalfBoundingBox(u, v, CFixedVector2D(w/2, h/2));
 		m_StaticSubdivision.Add(id, center - bbHalfSize, center + bbHalfSize);
 
+		UpdateStaticLineGrid(shape, 1);
+
 		return STATIC_INDEX_TO_TAG(id);
 	}
 
@@ -306,7 +339,9 @@ public:
 
 		if (TAG_IS_UNIT(tag))
 		{
-			UnitShape& shape = m_UnitShapes[TAG_TO_INDEX(tag)];
+			UnitShape& shape = m_UnitShapes.at(TAG_TO_INDEX(tag));
+
+			MakeDirtyUnit(shape.flags, shape); // dirty the old location
 
 			m_UnitSubdivision.Move(TAG_TO_INDEX(tag),
 				CFixedVector2D(shape.x - shape.r, shape.z - shape.r),
@@ -317,7 +352,7 @@ public:
 			shape.x = x;
 			shape.z = z;
 
-			MakeDirtyUnit(shape.flags);
+			MakeDirtyUnit(shape.flags, shape); // dirty the new location
 		}
 		else
 		{
@@ -326,7 +361,10 @@ public:
 			CFixedVector2D u(c, -s);
 			CFixedVector2D v(s, c);
 
-			StaticShape& shape = m_StaticShapes[TAG_TO_INDEX(tag)];
+			StaticShape& shape = m_StaticShapes.at(TAG_TO_INDEX(tag));
+
+			MakeDirtyStatic(shape.flags, shape); // dirty the old location
+			UpdateStaticLineGrid(shape, -1);
 
 			CFixedVector2D fromBbHalfSize = Geometry::GetHalfBoundingBox(shape.u, shape.v, CFixedVector2D(shape.hw, shape.hh));
 			CFixedVector2D toBbHalfSize = Geometry::GetHalfBoundingBox(u, v, CFixedVector2D(shape.hw, shape.hh));
@@ -341,7 +379,8 @@ public:
 			shape.u = u;
 			shape.v = v;
 
-			MakeDirtyStatic(shape.flags);
+			MakeDirtyStatic(shape.flags, shape); // dirty the new location
+			UpdateStaticLineGrid(shape, 1);
 		}
 	}
 
@@ -351,7 +390,7 @@ public:
 
 		if (TAG_IS_UNIT(tag))
 		{
-			UnitShape& shape = m_UnitShapes[TAG_TO_INDEX(tag)];
+			UnitShape& shape = m_UnitShapes.at(TAG_TO_INDEX(tag));
 			if (moving)
 				shape.flags |= FLAG_MOVING;
 			else
@@ -367,7 +406,7 @@ public:
 
 		if (TAG_IS_UNIT(tag))
 		{
-			UnitShape& shape = m_UnitShapes[TAG_TO_INDEX(tag)];
+			UnitShape& shape = m_UnitShapes.at(TAG_TO_INDEX(tag));
 			shape.group = group;
 		}
 	}
@@ -378,7 +417,7 @@ public:
 
 		if (TAG_IS_STATIC(tag))
 		{
-			StaticShape& shape = m_StaticShapes[TAG_TO_INDEX(tag)];
+			StaticShape& shape = m_StaticShapes.at(TAG_TO_INDEX(tag));
 			shape.group = group;
 			shape.group2 = group2;
 		}
@@ -390,23 +429,24 @@ public:
 
 		if (TAG_IS_UNIT(tag))
 		{
-			UnitShape& shape = m_UnitShapes[TAG_TO_INDEX(tag)];
+			UnitShape& shape = m_UnitShapes.at(TAG_TO_INDEX(tag));
 			m_UnitSubdivision.Remove(TAG_TO_INDEX(tag),
 				CFixedVector2D(shape.x - shape.r, shape.z - shape.r),
 				CFixedVector2D(shape.x + shape.r, shape.z + shape.r));
 
-			MakeDirtyUnit(shape.flags);
+			MakeDirtyUnit(shape.flags, shape);
 			m_UnitShapes.erase(TAG_TO_INDEX(tag));
 		}
 		else
 		{
-			StaticShape& shape = m_StaticShapes[TAG_TO_INDEX(tag)];
+			StaticShape& shape = m_StaticShapes.at(TAG_TO_INDEX(tag));
 
 			CFixedVector2D center(shape.x, shape.z);
 			CFixedVector2D bbHalfSize = Geometry::GetHalfBoundingBox(shape.u, shape.v, CFixedVector2D(shape.hw, shape.hh));
 			m_StaticSubdivision.Remove(TAG_TO_INDEX(tag), center - bbHalfSize, center + bbHalfSize);
 
-			MakeDirtyStatic(shape.flags);
+			MakeDirtyStatic(shape.flags, shape);
+			UpdateStaticLineGrid(shape, -1);
 			m_StaticShapes.erase(TAG_TO_INDEX(tag));
 		}
 	}
@@ -417,7 +457,7 @@ public:
 
 		if (TAG_IS_UNIT(tag))
 		{
-			UnitShape& shape = m_UnitShapes[TAG_TO_INDEX(tag)];
+			UnitShape& shape = m_UnitShapes.at(TAG_TO_INDEX(tag));
 			CFixedVector2D u(entity_pos_t::FromInt(1), entity_pos_t::Zero());
 			CFixedVector2D v(entity_pos_t::Zero(), entity_pos_t::FromInt(1));
 			ObstructionSquare o = { shape.x, shape.z, u, v, shape.r, shape.r };
@@ -425,7 +465,7 @@ public:
 		}
 		else
 		{
-			StaticShape& shape = m_StaticShapes[TAG_TO_INDEX(tag)];
+			StaticShape& shape = m_StaticShapes.at(TAG_TO_INDEX(tag));
 			ObstructionSquare o = { shape.x, shape.z, shape.u, shape.v, shape.hw, shape.hh };
 			return o;
 		}
@@ -435,7 +475,7 @@ public:
 	virtual bool TestStaticShape(const IObstructionTestFilter& filter, entity_pos_t x, entity_pos_t z, entity_pos_t a, entity_pos_t w, entity_pos_t h, std::vector<entity_id_t>* out);
 	virtual bool TestUnitShape(const IObstructionTestFilter& filter, entity_pos_t x, entity_pos_t z, entity_pos_t r, std::vector<entity_id_t>* out);
 
-	virtual bool Rasterise(Grid<u8>& grid);
+	virtual bool Rasterise(Grid<u8>& grid, TileRect& dirtyRect);
 	virtual void GetObstructionsInRange(const IObstructionTestFilter& filter, entity_pos_t x0, entity_pos_t z0, entity_pos_t x1, entity_pos_t z1, std::vector<ObstructionSquare>& squares);
 	virtual bool FindMostImportantObstruction(const IObstructionTestFilter& filter, entity_pos_t x, entity_pos_t z, entity_pos_t r, ObstructionSquare& square);
 
@@ -462,6 +502,17 @@ private:
 
 	size_t m_DirtyID;
 
+	// To let Rasterise update only the modified part of a grid, we also track the
+	// world-space bounds of all the changes since m_DirtyRectID. A grid that was
+	// up-to-date at m_DirtyRectID only needs the tiles in those bounds recomputing;
+	// any other grid needs a full update.
+	// (m_DirtyRectAll means every tile may have changed.)
+	size_t m_DirtyRectID;
+	bool m_DirtyRectAll;
+	bool m_DirtyRectEmpty;
+	CFixedVector2D m_DirtyRectMin;
+	CFixedVector2D m_DirtyRectMax;
+
 	/**
 	 * Mark all previous Rasterise()d grids as dirty, and the debug display.
 	 * Call this when the world bounds have changed.
@@ -469,6 +520,7 @@ private:
 	void MakeDirtyAll()
 	{
 		++m_DirtyID;
+		m_DirtyRectAll = true;
 		m_DebugOverlayDirty = true;
 	}
 
@@ -481,30 +533,112 @@ private:
 		m_DebugOverlayDirty = true;
 	}
 
+	/**
+	 * Mark the given bounding box (in world space) as needing to be re-rasterised.
+	 */
+	void MakeDirtyRect(CFixedVector2D center, CFixedVector2D halfSize)
+	{
+		// Expand by the largest amount that Rasterise expands shapes by (with
+		// some overestimation, which just means a few extra tiles get recomputed)
+		CFixedVector2D expand(entity_pos_t::FromInt(TERRAIN_TILE_SIZE), entity_pos_t::FromInt(TERRAIN_TILE_SIZE));
+		CFixedVector2D rectMin = center - halfSize - expand;
+		CFixedVector2D rectMax = center + halfSize + expand;
+
+		if (m_DirtyRectEmpty)
+		{
+			m_DirtyRectMin = rectMin;
+			m_DirtyRectMax = rectMax;
+			m_DirtyRectEmpty = false;
+		}
+		else
+		{
+			m_DirtyRectMin = CFixedVector2D(std::min(m_DirtyRectMin.X, rectMin.X), std::min(m_DirtyRectMin.Y, rectMin.Y));
+			m_DirtyRectMax = CFixedVector2D(std::max(m_DirtyRectMax.X, rectMax.X), std::max(m_DirtyRectMax.Y, rectMax.Y));
+		}
+	}
+
 	/**
 	 * Mark all previous Rasterise()d grids as dirty, if they depend on this shape.
-	 * Call this when a static shape has changed.
+	 * Call this when a static shape has changed (once with its old state and once
+	 * with its new state, if it has moved).
 	 */
-	void MakeDirtyStatic(flags_t flags)
+	void MakeDirtyStatic(flags_t flags, const StaticShape& shape)
 	{
 		if (flags & (FLAG_BLOCK_PATHFINDING|FLAG_BLOCK_FOUNDATION))
+		{
 			++m_DirtyID;
+			MakeDirtyRect(CFixedVector2D(shape.x, shape.z), Geometry::GetHalfBoundingBox(shape.u, shape.v, CFixedVector2D(shape.hw, shape.hh)));
+		}
 
 		m_DebugOverlayDirty = true;
 	}
 
 	/**
 	 * Mark all previous Rasterise()d grids as dirty, if they depend on this shape.
-	 * Call this when a unit shape has changed.
+	 * Call this when a unit shape has changed (once with its old state and once
+	 * with its new state, if it has moved).
 	 */
-	void MakeDirtyUnit(flags_t flags)
+	void MakeDirtyUnit(flags_t flags, const UnitShape& shape)
 	{
 		if (flags & (FLAG_BLOCK_PATHFINDING|FLAG_BLOCK_FOUNDATION))
+		{
 			++m_DirtyID;
+			MakeDirtyRect(CFixedVector2D(shape.x, shape.z), CFixedVector2D(shape.r, shape.r));
+		}
 
 		m_DebugOverlayDirty = true;
 	}
 
+	/**
+	 * Returns the m_StaticLineGrid cell containing world coordinate @p x,
+	 * clamped to [0, size).
+	 */
+	static int GetStaticLineCell(entity_pos_t x, u16 size)
+	{
+		return clamp((x / STATIC_LINE_CELL_SIZE).ToInt_RoundToNegInfinity(), 0, (int)size - 1);
+	}
+
+	/**
+	 * Add @p delta to the count of every m_StaticLineGrid cell near the shape.
+	 */
+	void UpdateStaticLineGrid(const StaticShape& shape, int delta)
+	{
+		if (!m_StaticLineGrid)
+			return;
+
+		Grid<u16>& grid = *m_StaticLineGrid;
+
+		CFixedVector2D center(shape.x, shape.z);
+		CFixedVector2D halfSize = Geometry::GetHalfBoundingBox(shape.u, shape.v, CFixedVector2D(shape.hw, shape.hh));
+		halfSize += CFixedVector2D(STATIC_LINE_CELL_SIZE, STATIC_LINE_CELL_SIZE);
+
+		int i0 = GetStaticLineCell(center.X - halfSize.X, grid.m_W);
+		int i1 = GetStaticLineCell(center.X + halfSize.X, grid.m_W);
+		int j0 = GetStaticLineCell(center.Y - halfSize.Y, grid.m_H);
+		int j1 = GetStaticLineCell(center.Y + halfSize.Y, grid.m_H);
+		for (int j = j0; j <= j1; ++j)
+			for (int i = i0; i <= i1; ++i)
+				grid.get(i, j) += delta;
+	}
+
+	void RebuildStaticLineGrid()
+	{
+		SAFE_DELETE(m_StaticLineGrid);
+
+		u16 w = (u16)((m_WorldX1 / STATIC_LINE_CELL_SIZE).ToInt_RoundToNegInfinity() + 1);
+		u16 h = (u16)((m_WorldZ1 / STATIC_LINE_CELL_SIZE).ToInt_RoundToNegInfinity() + 1);
+		m_StaticLineGrid = new Grid<u16>(w, h);
+
+		for (SlotMap<StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
+			UpdateStaticLineGrid(it->second, 1);
+	}
+
+	/**
+	 * Returns true if the segment from @p a to @p b only passes through
+	 * m_StaticLineGrid cells that have no static shapes near them.
+	 */
+	bool IsStaticLineGridClear(CFixedVector2D a, CFixedVector2D b);
+
 	/**
 	 * Test whether a Rasterise()d grid is dirty and needs updating
 	 */
@@ -544,10 +678,11 @@ bool CCmpObstructionManager::TestLine(const IObstructionTestFilter& filter, enti
 	CFixedVector2D posMin (std::min(x0, x1) - r, std::min(z0, z1) - r);
 	CFixedVector2D posMax (std::max(x0, x1) + r, std::max(z0, z1) + r);
 
-	std::vector<u32> unitShapes = m_UnitSubdivision.GetInRange(posMin, posMax);
+	std::vector<u32>& unitShapes = m_QueryShapes;
+	m_UnitSubdivision.GetInRange(posMin, posMax, unitShapes);
 	for (size_t i = 0; i < unitShapes.size(); ++i)
 	{
-		std::map<u32, UnitShape>::iterator it = m_UnitShapes.find(unitShapes[i]);
+		SlotMap<UnitShape>::iterator it = m_UnitShapes.find(unitShapes[i]);
 		ENSURE(it != m_UnitShapes.end());
 
 		if (!filter.TestShape(UNIT_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, INVALID_ENTITY))
@@ -559,10 +694,22 @@ bool CCmpObstructionManager::TestLine(const IObstructionTestFilter& filter, enti
 			return true;
 	}
 
-	std::vector<u32> staticShapes = m_StaticSubdivision.GetInRange(posMin, posMax);
+	// Most lines don't go anywhere near a static shape, so check the grid
+	// before doing the exact tests
+	if (r <= STATIC_LINE_MAX_RADIUS)
+	{
+		if (!m_StaticLineGrid)
+			RebuildStaticLineGrid();
+
+		if (IsStaticLineGridClear(CFixedVector2D(x0, z0), CFixedVector2D(x1, z1)))
+			return false;
+	}
+
+	std::vector<u32>& staticShapes = m_QueryShapes;
+	m_StaticSubdivision.GetInRange(posMin, posMax, staticShapes);
 	for (size_t i = 0; i < staticShapes.size(); ++i)
 	{
-		std::map<u32, StaticShape>::iterator it = m_StaticShapes.find(staticShapes[i]);
+		SlotMap<StaticShape>::iterator it = m_StaticShapes.find(staticShapes[i]);
 		ENSURE(it != m_StaticShapes.end());
 
 		if (!filter.TestShape(STATIC_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, it->second.group2))
@@ -577,6 +724,54 @@ bool CCmpObstructionManager::TestLine(const IObstructionTestFilter& filter, enti
 	return false;
 }
 
+bool CCmpObstructionManager::IsStaticLineGridClear(CFixedVector2D a, CFixedVector2D b)
+{
+	const Grid<u16>& grid = *m_StaticLineGrid;
+
+	// Walk over the rows of cells that the segment crosses, and check every
+	// cell in the range of x covered by the segment within that row.
+	// (This is computed with the raw fixed-point values in 64 bits, since
+	// the products can overflow fixed; the range is widened by one unit
+	// on each side to be safe against rounding.)
+
+	if (a.Y > b.Y)
+		std::swap(a, b);
+
+	const i64 ax = a.X.GetInternalValue();
+	const i64 az = a.Y.GetInternalValue();
+	const i64 dx = b.X.GetInternalValue() - ax;
+	const i64 dz = b.Y.GetInternalValue() - az;
+	const entity_pos_t minX = std::min(a.X, b.X);
+	const entity_pos_t maxX = std::max(a.X, b.X);
+
+	const int j0 = GetStaticLineCell(a.Y, grid.m_H);
+	const int j1 = GetStaticLineCell(b.Y, grid.m_H);
+	for (int j = j0; j <= j1; ++j)
+	{
+		entity_pos_t rowX0 = minX;
+		entity_pos_t rowX1 = maxX;
+		if (dz != 0)
+		{
+			const entity_pos_t rowZ0 = std::max(a.Y, STATIC_LINE_CELL_SIZE * j);
+			const entity_pos_t rowZ1 = std::min(b.Y, STATIC_LINE_CELL_SIZE * (j + 1));
+
+			entity_pos_t xa, xb;
+			xa.SetInternalValue((i32)(ax + (rowZ0.GetInternalValue() - az) * dx / dz));
+			xb.SetInternalValue((i32)(ax + (rowZ1.GetInternalValue() - az) * dx / dz));
+			rowX0 = std::max(minX, std::min(xa, xb) - entity_pos_t::Epsilon());
+			rowX1 = std::min(maxX, std::max(xa, xb) + entity_pos_t::Epsilon());
+		}
+
+		const int i0 = GetStaticLineCell(rowX0, grid.m_W);
+		const int i1 = GetStaticLineCell(rowX1, grid.m_W);
+		for (int i = i0; i <= i1; ++i)
+			if (grid.get(i, j))
+				return false;
+	}
+
+	return true;
+}
+
 bool CCmpObstructionManager::TestStaticShape(const IObstructionTestFilter& filter,
 	entity_pos_t x, entity_pos_t z, entity_pos_t a, entity_pos_t w, entity_pos_t h,
 	std::vector<entity_id_t>* out)
@@ -607,7 +802,7 @@ bool CCmpObstructionManager::TestStaticShape(const IObstructionTestFilter& filte
 			return true;
 	}
 
-	for (std::map<u32, UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
+	for (SlotMap<UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
 	{
 		if (!filter.TestShape(UNIT_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, INVALID_ENTITY))
 			continue;
@@ -623,7 +818,7 @@ bool CCmpObstructionManager::TestStaticShape(const IObstructionTestFilter& filte
 		}
 	}
 
-	for (std::map<u32, StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
+	for (SlotMap<StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
 	{
 		if (!filter.TestShape(STATIC_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, it->second.group2))
 			continue;
@@ -664,7 +859,7 @@ bool CCmpObstructionManager::TestUnitShape(const IObstructionTestFilter& filter,
 
 	CFixedVector2D center(x, z);
 
-	for (std::map<u32, UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
+	for (SlotMap<UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
 	{
 		if (!filter.TestShape(UNIT_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, INVALID_ENTITY))
 			continue;
@@ -680,7 +875,7 @@ bool CCmpObstructionManager::TestUnitShape(const IObstructionTestFilter& filter,
 		}
 	}
 
-	for (std::map<u32, StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
+	for (SlotMap<StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
 	{
 		if (!filter.TestShape(STATIC_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, it->second.group2))
 			continue;
@@ -720,20 +915,87 @@ static void TileCenter(u16 i, u16 j, entity_pos_t& x, entity_pos_t& z)
 	z = entity_pos_t::FromInt(j*(int)TERRAIN_TILE_SIZE + (int)TERRAIN_TILE_SIZE/2);
 }
 
-bool CCmpObstructionManager::Rasterise(Grid<u8>& grid)
+/**
+ * Sets @p flag on the tiles within the clip rectangle whose centers are inside the given square
+ */
+static void RasteriseSquare(Grid<u8>& grid, const ICmpObstructionManager::TileRect& clip, u8 flag,
+	CFixedVector2D center, CFixedVector2D u, CFixedVector2D v, CFixedVector2D halfSize)
+{
+	CFixedVector2D halfBound = Geometry::GetHalfBoundingBox(u, v, halfSize);
+
+	u16 i0, j0, i1, j1;
+	NearestTile(center.X - halfBound.X, center.Y - halfBound.Y, i0, j0, grid.m_W, grid.m_H);
+	NearestTile(center.X + halfBound.X, center.Y + halfBound.Y, i1, j1, grid.m_W, grid.m_H);
+	i0 = std::max(i0, clip.i0);
+	j0 = std::max(j0, clip.j0);
+	i1 = std::min(i1, clip.i1);
+	j1 = std::min(j1, clip.j1);
+	for (u16 j = j0; j <= j1; ++j)
+	{
+		for (u16 i = i0; i <= i1; ++i)
+		{
+			entity_pos_t x, z;
+			TileCenter(i, j, x, z);
+			if (Geometry::PointIsInSquare(CFixedVector2D(x, z) - center, u, v, halfSize))
+				grid.set(i, j, grid.get(i, j) | flag);
+		}
+	}
+}
+
+/**
+ * Sets @p flag on the tiles within the clip rectangle that overlap the given axis-aligned square
+ */
+static void RasteriseAASquare(Grid<u8>& grid, const ICmpObstructionManager::TileRect& clip, u8 flag,
+	CFixedVector2D center, entity_pos_t r)
+{
+	u16 i0, j0, i1, j1;
+	NearestTile(center.X - r, center.Y - r, i0, j0, grid.m_W, grid.m_H);
+	NearestTile(center.X + r, center.Y + r, i1, j1, grid.m_W, grid.m_H);
+	i0 = std::max(i0, clip.i0);
+	j0 = std::max(j0, clip.j0);
+	i1 = std::min(i1, clip.i1);
+	j1 = std::min(j1, clip.j1);
+	for (u16 j = j0; j <= j1; ++j)
+		for (u16 i = i0; i <= i1; ++i)
+			grid.set(i, j, grid.get(i, j) | flag);
+}
+
+bool CCmpObstructionManager::Rasterise(Grid<u8>& grid, TileRect& dirtyRect)
 {
 	if (!IsDirty(grid))
 		return false;
 
 	PROFILE("Rasterise");
 
+	// If this grid was up-to-date when the dirty bounds were last reset,
+	// then we only need to recompute the tiles within those bounds,
+	// else we have to recompute everything
+	TileRect clip = { 0, 0, (u16)(grid.m_W-1), (u16)(grid.m_H-1) };
+	bool partial = (!m_DirtyRectAll && grid.m_DirtyID == m_DirtyRectID);
+	if (partial)
+	{
+		if (m_DirtyRectEmpty)
+		{
+			// Nothing that affects the grid has changed
+			grid.m_DirtyID = m_DirtyID;
+			return false;
+		}
+
+		NearestTile(m_DirtyRectMin.X, m_DirtyRectMin.Y, clip.i0, clip.j0, grid.m_W, grid.m_H);
+		NearestTile(m_DirtyRectMax.X, m_DirtyRectMax.Y, clip.i1, clip.j1, grid.m_W, grid.m_H);
+	}
+
 	grid.m_DirtyID = m_DirtyID;
+	dirtyRect = clip;
 
-	// TODO: this is all hopelessly inefficient
-	// What we should perhaps do is have some kind of quadtree storing Shapes so it's
-	// quick to invalidate and update small numbers of tiles
+	// Start tracking changes for the next update of this grid
+	m_DirtyRectID = m_DirtyID;
+	m_DirtyRectAll = false;
+	m_DirtyRectEmpty = true;
 
-	grid.reset();
+	for (u16 j = clip.j0; j <= clip.j1; ++j)
+		for (u16 i = clip.i0; i <= clip.i1; ++i)
+			grid.set(i, j, 0);
 
 	// For tile-based pathfinding:
 	// Since we only count tiles whose centers are inside the square,
@@ -748,94 +1010,71 @@ bool CCmpObstructionManager::Rasterise(Grid<u8>& grid)
 	// For AI building foundation planning, we want to definitely block all
 	// potentially-obstructed tiles (so we don't blindly build on top of an obstruction),
 	// so we need to expand by at least 1/sqrt(2) of a tile
+	// (WARNING: MakeDirtyRect assumes this is no more than one tile)
 	entity_pos_t expandFoundation = (entity_pos_t::FromInt(TERRAIN_TILE_SIZE) * 3) / 4;
 
-	for (std::map<u32, StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
+	// When doing a partial update, use the subdivisions to find the shapes that
+	// might overlap the modified tiles
+	std::vector<u32> staticShapes;
+	std::vector<u32> unitShapes;
+	if (partial)
 	{
-		CFixedVector2D center(it->second.x, it->second.z);
+		CFixedVector2D expand(expandFoundation, expandFoundation);
+		CFixedVector2D posMin = CFixedVector2D(entity_pos_t::FromInt(clip.i0*(int)TERRAIN_TILE_SIZE), entity_pos_t::FromInt(clip.j0*(int)TERRAIN_TILE_SIZE)) - expand;
+		CFixedVector2D posMax = CFixedVector2D(entity_pos_t::FromInt((clip.i1+1)*(int)TERRAIN_TILE_SIZE), entity_pos_t::FromInt((clip.j1+1)*(int)TERRAIN_TILE_SIZE)) + expand;
+		m_StaticSubdivision.GetInRange(posMin, posMax, staticShapes);
+		m_UnitSubdivision.GetInRange(posMin, posMax, unitShapes);
+	}
+	else
+	{
+		for (SlotMap<StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
+			staticShapes.push_back(it->first);
+		for (SlotMap<UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
+			unitShapes.push_back(it->first);
+	}
 
-		if (it->second.flags & FLAG_BLOCK_PATHFINDING)
-		{
-			CFixedVector2D halfSize(it->second.hw + expandPathfinding, it->second.hh + expandPathfinding);
-			CFixedVector2D halfBound = Geometry::GetHalfBoundingBox(it->second.u, it->second.v, halfSize);
+	for (size_t n = 0; n < staticShapes.size(); ++n)
+	{
+		const StaticShape& shape = m_StaticShapes.at(staticShapes[n]);
+		CFixedVector2D center(shape.x, shape.z);
 
-			u16 i0, j0, i1, j1;
-			NearestTile(center.X - halfBound.X, center.Y - halfBound.Y, i0, j0, grid.m_W, grid.m_H);
-			NearestTile(center.X + halfBound.X, center.Y + halfBound.Y, i1, j1, grid.m_W, grid.m_H);
-			for (u16 j = j0; j <= j1; ++j)
-			{
-				for (u16 i = i0; i <= i1; ++i)
-				{
-					entity_pos_t x, z;
-					TileCenter(i, j, x, z);
-					if (Geometry::PointIsInSquare(CFixedVector2D(x, z) - center, it->second.u, it->second.v, halfSize))
-						grid.set(i, j, grid.get(i, j) | TILE_OBSTRUCTED_PATHFINDING);
-				}
-			}
+		if (shape.flags & FLAG_BLOCK_PATHFINDING)
+		{
+			CFixedVector2D halfSize(shape.hw + expandPathfinding, shape.hh + expandPathfinding);
+			RasteriseSquare(grid, clip, TILE_OBSTRUCTED_PATHFINDING, center, shape.u, shape.v, halfSize);
 		}
 
-		if (it->second.flags & FLAG_BLOCK_FOUNDATION)
+		if (shape.flags & FLAG_BLOCK_FOUNDATION)
 		{
-			CFixedVector2D halfSize(it->second.hw + expandFoundation, it->second.hh + expandFoundation);
-			CFixedVector2D halfBound = Geometry::GetHalfBoundingBox(it->second.u, it->second.v, halfSize);
-
-			u16 i0, j0, i1, j1;
-			NearestTile(center.X - halfBound.X, center.Y - halfBound.Y, i0, j0, grid.m_W, grid.m_H);
-			NearestTile(center.X + halfBound.X, center.Y + halfBound.Y, i1, j1, grid.m_W, grid.m_H);
-			for (u16 j = j0; j <= j1; ++j)
-			{
-				for (u16 i = i0; i <= i1; ++i)
-				{
-					entity_pos_t x, z;
-					TileCenter(i, j, x, z);
-					if (Geometry::PointIsInSquare(CFixedVector2D(x, z) - center, it->second.u, it->second.v, halfSize))
-						grid.set(i, j, grid.get(i, j) | TILE_OBSTRUCTED_FOUNDATION);
-				}
-			}
+			CFixedVector2D halfSize(shape.hw + expandFoundation, shape.hh + expandFoundation);
+			RasteriseSquare(grid, clip, TILE_OBSTRUCTED_FOUNDATION, center, shape.u, shape.v, halfSize);
 		}
 	}
 
-	for (std::map<u32, UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
+	for (size_t n = 0; n < unitShapes.size(); ++n)
 	{
-		CFixedVector2D center(it->second.x, it->second.z);
+		const UnitShape& shape = m_UnitShapes.at(unitShapes[n]);
+		CFixedVector2D center(shape.x, shape.z);
 
-		if (it->second.flags & FLAG_BLOCK_PATHFINDING)
-		{
-			entity_pos_t r = it->second.r + expandPathfinding;
-
-			u16 i0, j0, i1, j1;
-			NearestTile(center.X - r, center.Y - r, i0, j0, grid.m_W, grid.m_H);
-			NearestTile(center.X + r, center.Y + r, i1, j1, grid.m_W, grid.m_H);
-			for (u16 j = j0; j <= j1; ++j)
-				for (u16 i = i0; i <= i1; ++i)
-					grid.set(i, j, grid.get(i, j) | TILE_OBSTRUCTED_PATHFINDING);
-		}
+		if (shape.flags & FLAG_BLOCK_PATHFINDING)
+			RasteriseAASquare(grid, clip, TILE_OBSTRUCTED_PATHFINDING, center, shape.r + expandPathfinding);
 
-		if (it->second.flags & FLAG_BLOCK_FOUNDATION)
-		{
-			entity_pos_t r = it->second.r + expandFoundation;
-
-			u16 i0, j0, i1, j1;
-			NearestTile(center.X - r, center.Y - r, i0, j0, grid.m_W, grid.m_H);
-			NearestTile(center.X + r, center.Y + r, i1, j1, grid.m_W, grid.m_H);
-			for (u16 j = j0; j <= j1; ++j)
-				for (u16 i = i0; i <= i1; ++i)
-					grid.set(i, j, grid.get(i, j) | TILE_OBSTRUCTED_FOUNDATION);
-		}
+		if (shape.flags & FLAG_BLOCK_FOUNDATION)
+			RasteriseAASquare(grid, clip, TILE_OBSTRUCTED_FOUNDATION, center, shape.r + expandFoundation);
 	}
 
 	// Any tiles outside or very near the edge of the map are impassable
 
 	// WARNING: CCmpRangeManager::LosIsOffWorld needs to be kept in sync with this
-	const u16 edgeSize = 3; // number of tiles around the edge that will be off-world
+	const int edgeSize = 3; // number of tiles around the edge that will be off-world
 
 	u8 edgeFlags = TILE_OBSTRUCTED_PATHFINDING | TILE_OBSTRUCTED_FOUNDATION | TILE_OUTOFBOUNDS;
 
 	if (m_PassabilityCircular)
 	{
-		for (u16 j = 0; j < grid.m_H; ++j)
+		for (u16 j = clip.j0; j <= clip.j1; ++j)
 		{
-			for (u16 i = 0; i < grid.m_W; ++i)
+			for (u16 i = clip.i0; i <= clip.i1; ++i)
 			{
 				// Based on CCmpRangeManager::LosIsOffWorld
 				// but tweaked since it's tile-based instead.
@@ -857,18 +1096,10 @@ bool CCmpObstructionManager::Rasterise(Grid<u8>& grid)
 		NearestTile(m_WorldX0, m_WorldZ0, i0, j0, grid.m_W, grid.m_H);
 		NearestTile(m_WorldX1, m_WorldZ1, i1, j1, grid.m_W, grid.m_H);
 
-		for (u16 j = 0; j < grid.m_H; ++j)
-			for (u16 i = 0; i < i0+edgeSize; ++i)
-				grid.set(i, j, edgeFlags);
-		for (u16 j = 0; j < grid.m_H; ++j)
-			for (u16 i = (u16)(i1-edgeSize+1); i < grid.m_W; ++i)
-				grid.set(i, j, edgeFlags);
-		for (u16 j = 0; j < j0+edgeSize; ++j)
-			for (u16 i = (u16)(i0+edgeSize); i < i1-edgeSize+1; ++i)
-				grid.set(i, j, edgeFlags);
-		for (u16 j = (u16)(j1-edgeSize+1); j < grid.m_H; ++j)
-			for (u16 i = (u16)(i0+edgeSize); i < i1-edgeSize+1; ++i)
-				grid.set(i, j, edgeFlags);
+		for (u16 j = clip.j0; j <= clip.j1; ++j)
+			for (u16 i = clip.i0; i <= clip.i1; ++i)
+				if (i < i0+edgeSize || i > i1-edgeSize || j < j0+edgeSize || j > j1-edgeSize)
+					grid.set(i, j, edgeFlags);
 	}
 
 	return true;
@@ -880,10 +1111,11 @@ void CCmpObstructionManager::GetObstructionsInRange(const IObstructionTestFilter
 
 	ENSURE(x0 <= x1 && z0 <= z1);
 
-	std::vector<u32> unitShapes = m_UnitSubdivision.GetInRange(CFixedVector2D(x0, z0), CFixedVector2D(x1, z1));
+	std::vector<u32>& unitShapes = m_QueryShapes;
+	m_UnitSubdivision.GetInRange(CFixedVector2D(x0, z0), CFixedVector2D(x1, z1), unitShapes);
 	for (size_t i = 0; i < unitShapes.size(); ++i)
 	{
-		std::map<u32, UnitShape>::iterator it = m_UnitShapes.find(unitShapes[i]);
+		SlotMap<UnitShape>::iterator it = m_UnitShapes.find(unitShapes[i]);
 		ENSURE(it != m_UnitShapes.end());
 
 		if (!filter.TestShape(UNIT_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, INVALID_ENTITY))
@@ -901,10 +1133,11 @@ void CCmpObstructionManager::GetObstructionsInRange(const IObstructionTestFilter
 		squares.push_back(s);
 	}
 
-	std::vector<u32> staticShapes = m_StaticSubdivision.GetInRange(CFixedVector2D(x0, z0), CFixedVector2D(x1, z1));
+	std::vector<u32>& staticShapes = m_QueryShapes;
+	m_StaticSubdivision.GetInRange(CFixedVector2D(x0, z0), CFixedVector2D(x1, z1), staticShapes);
 	for (size_t i = 0; i < staticShapes.size(); ++i)
 	{
-		std::map<u32, StaticShape>::iterator it = m_StaticShapes.find(staticShapes[i]);
+		SlotMap<StaticShape>::iterator it = m_StaticShapes.find(staticShapes[i]);
 		ENSURE(it != m_StaticShapes.end());
 
 		if (!filter.TestShape(STATIC_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, it->second.group2))
@@ -981,14 +1214,14 @@ void CCmpObstructionManager::RenderSubmit(SceneCollector& collector)
 				(m_WorldX1-m_WorldX0).ToFloat(), (m_WorldZ1-m_WorldZ0).ToFloat(),
 				0, m_DebugOverlayLines.back(), true);
 
-		for (std::map<u32, UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
+		for (SlotMap<UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
 		{
 			m_DebugOverlayLines.push_back(SOverlayLine());
 			m_DebugOverlayLines.back().m_Color = ((it->second.flags & FLAG_MOVING) ? movingColour : defaultColour);
 			SimRender::ConstructSquareOnGround(GetSimContext(), it->second.x.ToFloat(), it->second.z.ToFloat(), it->second.r.ToFloat()*2, it->second.r.ToFloat()*2, 0, m_DebugOverlayLines.back(), true);
 		}
 
-		for (std::map<u32, StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
+		for (SlotMap<StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
 		{
 			m_DebugOverlayLines.push_back(SOverlayLine());
 			m_DebugOverlayLines.back().m_Color = defaultColour;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,6 +27,7 @@
 #include "ps/CLogger.h"
 #include "ps/CStr.h"
 #include "ps/Profile.h"
+#include "ps/ThreadPool.h"
 #include "renderer/Scene.h"
 #include "simulation2/MessageTypes.h"
 #include "simulation2/components/ICmpObstruction.h"
@@ -35,6 +36,10 @@
 #include "simulation2/components/ICmpWaterManager.h"
 #include "simulation2/serialization/SerializeTemplates.h"
 
+#if HAVE_SSE2
+# include <emmintrin.h>
+#endif
+
 // Default cost to move a single tile is a fairly arbitrary number, which should be big
 // enough to be precise when multiplied/divided and small enough to never overflow when
 // summing the cost of a whole path.
@@ -45,7 +50,7 @@ REGISTER_COMPONENT_TYPE(Pathfinder)
 void CCmpPathfinder::Init(const CParamNode& UNUSED(paramNode))
 {
 	m_MapSize = 0;
-	m_Grid = NULL;
+	m_Grid.reset();
 	m_ObstructionGrid = NULL;
 	m_TerrainDirty = true;
 	m_NextAsyncTicket = 1;
@@ -152,7 +157,9 @@ void CCmpPathfinder::Deinit()
 	SetDebugOverlay(false); // cleans up memory
 	ResetDebugPath();
 
-	delete m_Grid;
+	m_Hierarchical.Reset(NULL);
+	DeleteSearchGrids();
+	m_Grid.reset();
 	delete m_ObstructionGrid;
 }
 
@@ -304,6 +311,76 @@ const Grid<u16>& CCmpPathfinder::GetPassabilityGrid()
 	return *m_Grid;
 }
 
+shared_ptr<const Grid<u16> > CCmpPathfinder::GetPassabilityGridSnapshot()
+{
+	UpdateGrid();
+	return m_Grid;
+}
+
+void CCmpPathfinder::MakeGridUnique()
+{
+	if (m_Grid.unique())
+		return;
+
+	PROFILE("UpdateGrid copy");
+
+	m_Grid.reset(new Grid<TerrainTile>(*m_Grid));
+
+	// (The copy is identical, so the hierarchy doesn't need recomputing)
+	m_Hierarchical.SetGrid(m_Grid.get());
+}
+
+void PathfinderPassability::AddImpassableMask(const i32* waterdepth, const i32* steepness, const i32* shoredist, size_t n, u16* tiles) const
+{
+	size_t i = 0;
+
+#if HAVE_SSE2
+	// Test 8 tiles at a time. This is all integer arithmetic on the fixed-point
+	// values, so it gives exactly the same results as IsPassable.
+	const __m128i minDepth = _mm_set1_epi32(m_MinDepth.GetInternalValue());
+	const __m128i maxDepth = _mm_set1_epi32(m_MaxDepth.GetInternalValue());
+	const __m128i maxSlope = _mm_set1_epi32(m_MaxSlope.GetInternalValue());
+	const __m128i minShore = _mm_set1_epi32(m_MinShore.GetInternalValue());
+	const __m128i maxShore = _mm_set1_epi32(m_MaxShore.GetInternalValue());
+	const __m128i mask = _mm_set1_epi16((i16)m_Mask);
+
+	for (; i + 8 <= n; i += 8)
+	{
+		__m128i blocked[2];
+		for (size_t k = 0; k < 2; ++k)
+		{
+			__m128i depth = _mm_loadu_si128((const __m128i*)&waterdepth[i + k*4]);
+			__m128i slope = _mm_loadu_si128((const __m128i*)&steepness[i + k*4]);
+			__m128i shore = _mm_loadu_si128((const __m128i*)&shoredist[i + k*4]);
+
+			__m128i outside = _mm_or_si128(
+				_mm_or_si128(_mm_cmplt_epi32(depth, minDepth), _mm_cmpgt_epi32(depth, maxDepth)),
+				_mm_or_si128(_mm_cmplt_epi32(shore, minShore), _mm_cmpgt_epi32(shore, maxShore)));
+
+			// Passable only if slope < maxSlope
+			blocked[k] = _mm_or_si128(outside, _mm_cmpeq_epi32(_mm_cmplt_epi32(slope, maxSlope), _mm_setzero_si128()));
+		}
+
+		// Each lane is 0 or -1, so packing preserves them
+		__m128i blocked16 = _mm_packs_epi32(blocked[0], blocked[1]);
+
+		__m128i t = _mm_loadu_si128((const __m128i*)&tiles[i]);
+		t = _mm_or_si128(t, _mm_and_si128(blocked16, mask));
+		_mm_storeu_si128((__m128i*)&tiles[i], t);
+	}
+#endif
+
+	for (; i < n; ++i)
+	{
+		fixed depth, slope, shore;
+		depth.SetInternalValue(waterdepth[i]);
+		slope.SetInternalValue(steepness[i]);
+		shore.SetInternalValue(shoredist[i]);
+		if (!IsPassable(depth, slope, shore))
+			tiles[i] |= m_Mask;
+	}
+}
+
 void CCmpPathfinder::UpdateGrid()
 {
 	CmpPtr<ICmpTerrain> cmpTerrain(GetSimContext(), SYSTEM_ENTITY);
@@ -313,7 +390,9 @@ void CCmpPathfinder::UpdateGrid()
 	// If the terrain was resized then delete the old grid data
 	if (m_Grid && m_MapSize != cmpTerrain->GetTilesPerSide())
 	{
-		SAFE_DELETE(m_Grid);
+		m_Hierarchical.Reset(NULL);
+		DeleteSearchGrids();
+		m_Grid.reset();
 		SAFE_DELETE(m_ObstructionGrid);
 		m_TerrainDirty = true;
 	}
@@ -322,13 +401,14 @@ void CCmpPathfinder::UpdateGrid()
 	if (!m_Grid)
 	{
 		m_MapSize = cmpTerrain->GetTilesPerSide();
-		m_Grid = new Grid<TerrainTile>(m_MapSize, m_MapSize);
+		m_Grid.reset(new Grid<TerrainTile>(m_MapSize, m_MapSize));
 		m_ObstructionGrid = new Grid<u8>(m_MapSize, m_MapSize);
 	}
 
 	CmpPtr<ICmpObstructionManager> cmpObstructionManager(GetSimContext(), SYSTEM_ENTITY);
 
-	bool obstructionsDirty = cmpObstructionManager->Rasterise(*m_ObstructionGrid);
+	ICmpObstructionManager::TileRect dirtyRect;
+	bool obstructionsDirty = cmpObstructionManager->Rasterise(*m_ObstructionGrid, dirtyRect);
 
 	if (obstructionsDirty && !m_TerrainDirty)
 	{
@@ -336,18 +416,22 @@ void CCmpPathfinder::UpdateGrid()
 
 		// Obstructions changed - we need to recompute passability
 		// Since terrain hasn't changed we only need to update the obstruction bits
-		// and can skip the rest of the data
+		// and can skip the rest of the data, and only for the tiles whose
+		// obstructions might have changed
 
 		// TODO: if ObstructionManager::SetPassabilityCircular was called at runtime
 		// (which should probably never happen, but that's not guaranteed),
 		// then TILE_OUTOFBOUNDS will change and we can't use this fast path, but
 		// currently it'll just set obstructionsDirty and we won't notice
 
-		for (u16 j = 0; j < m_MapSize; ++j)
+		MakeGridUnique();
+
+		for (u16 j = dirtyRect.j0; j <= dirtyRect.j1; ++j)
 		{
-			for (u16 i = 0; i < m_MapSize; ++i)
+			for (u16 i = dirtyRect.i0; i <= dirtyRect.i1; ++i)
 			{
 				TerrainTile& t = m_Grid->get(i, j);
+				TerrainTile old = t;
 
 				u8 obstruct = m_ObstructionGrid->get(i, j);
 
@@ -360,9 +444,15 @@ void CCmpPathfinder::UpdateGrid()
 					t |= 2;
 				else
 					t &= (TerrainTile)~2;
+
+				if ((t ^ old) & 1)
+					m_Hierarchical.MarkTileDirty(i, j);
 			}
 		}
 
+		// Only the chunks containing changed tiles need to be recomputed
+		m_Hierarchical.Update();
+
 		++m_Grid->m_DirtyID;
 	}
 	else if (obstructionsDirty || m_TerrainDirty)
@@ -381,6 +471,8 @@ void CCmpPathfinder::UpdateGrid()
 		const u16 shoreMax = 32767;
 		
 		// First pass - find underwater tiles
+		// (and remember the depths, to avoid recomputing the ground level later)
+		std::vector<i32> depthGrid(m_MapSize*m_MapSize);
 		Grid<bool> waterGrid(m_MapSize, m_MapSize);
 		for (u16 j = 0; j < m_MapSize; ++j)
 		{
@@ -388,8 +480,15 @@ void CCmpPathfinder::UpdateGrid()
 			{
 				fixed x, z;
 				TileCenter(i, j, x, z);
-				
-				bool underWater = cmpWaterManager && (cmpWaterManager->GetWaterLevel(x, z) > terrain.GetExactGroundLevelFixed(x, z));
+
+				fixed water;
+				if (cmpWaterManager)
+					water = cmpWaterManager->GetWaterLevel(x, z);
+
+				fixed depth = water - terrain.GetExactGroundLevelFixed(x, z);
+				depthGrid[j*m_MapSize + i] = depth.GetInternalValue();
+
+				bool underWater = cmpWaterManager && (depth > fixed::Zero());
 				waterGrid.set(i, j, underWater);
 			}
 		}
@@ -479,61 +578,58 @@ void CCmpPathfinder::UpdateGrid()
 			}
 		}
 
-		// Apply passability classes to terrain
+		// Apply passability classes to terrain, one row at a time so that each class
+		// can be tested against a whole row of tiles at once
+		std::vector<i32> slopeRow(m_MapSize);
+		std::vector<i32> shoreRow(m_MapSize);
+		std::vector<TerrainTile> tileRow(m_MapSize);
+
+		MakeGridUnique();
+
+		TerrainTile allMasks = 0;
+		for (size_t n = 0; n < m_PassClasses.size(); ++n)
+			allMasks |= m_PassClasses[n].m_Mask;
+
 		for (u16 j = 0; j < m_MapSize; ++j)
 		{
 			for (u16 i = 0; i < m_MapSize; ++i)
 			{
-				fixed x, z;
-				TileCenter(i, j, x, z);
+				slopeRow[i] = terrain.GetSlopeFixed(i, j).GetInternalValue();
+				shoreRow[i] = fixed::FromInt(shoreGrid.get(i, j)).GetInternalValue();
 
 				TerrainTile t = 0;
 
 				u8 obstruct = m_ObstructionGrid->get(i, j);
 
-				fixed height = terrain.GetExactGroundLevelFixed(x, z);
-
-				fixed water;
-				if (cmpWaterManager)
-					water = cmpWaterManager->GetWaterLevel(x, z);
-
-				fixed depth = water - height;
-
-				fixed slope = terrain.GetSlopeFixed(i, j);
-
-				fixed shoredist = fixed::FromInt(shoreGrid.get(i, j));
-
 				if (obstruct & ICmpObstructionManager::TILE_OBSTRUCTED_PATHFINDING)
 					t |= 1;
 
 				if (obstruct & ICmpObstructionManager::TILE_OBSTRUCTED_FOUNDATION)
 					t |= 2;
 
+				// If out of bounds, nobody is allowed to pass
 				if (obstruct & ICmpObstructionManager::TILE_OUTOFBOUNDS)
-				{
-					// If out of bounds, nobody is allowed to pass
-					for (size_t n = 0; n < m_PassClasses.size(); ++n)
-						t |= m_PassClasses[n].m_Mask;
-				}
-				else
-				{
-					for (size_t n = 0; n < m_PassClasses.size(); ++n)
-					{
-						if (!m_PassClasses[n].IsPassable(depth, slope, shoredist))
-							t |= m_PassClasses[n].m_Mask;
-					}
-				}
+					t |= allMasks;
 
 				std::string moveClass = terrain.GetMovementClass(i, j);
 				if (m_TerrainCostClassTags.find(moveClass) != m_TerrainCostClassTags.end())
 					t |= COST_CLASS_MASK(m_TerrainCostClassTags[moveClass]);
 
-				m_Grid->set(i, j, t);
+				tileRow[i] = t;
 			}
+
+			for (size_t n = 0; n < m_PassClasses.size(); ++n)
+				m_PassClasses[n].AddImpassableMask(&depthGrid[j*m_MapSize], &slopeRow[0], &shoreRow[0], m_MapSize, &tileRow[0]);
+
+			for (u16 i = 0; i < m_MapSize; ++i)
+				m_Grid->set(i, j, tileRow[i]);
 		}
 
 		m_TerrainDirty = false;
 
+		// Passability may have changed anywhere, so rebuild the hierarchy lazily
+		m_Hierarchical.Reset(m_Grid.get());
+
 		++m_Grid->m_DirtyID;
 	}
 }
@@ -558,40 +654,157 @@ u32 CCmpPathfinder::ComputeShortPathAsync(entity_pos_t x0, entity_pos_t z0, enti
 
 void CCmpPathfinder::FinishAsyncRequests()
 {
+	PROFILE2_COUNTERS("finish async path requests");
+
 	// Save the request queue in case it gets modified while iterating
-	std::vector<AsyncLongPathRequest> longRequests;
-	m_AsyncLongPathRequests.swap(longRequests);
+	m_ProcessingLongRequests.clear();
+	m_AsyncLongPathRequests.swap(m_ProcessingLongRequests);
 
-	std::vector<AsyncShortPathRequest> shortRequests;
-	m_AsyncShortPathRequests.swap(shortRequests);
+	m_ProcessingShortRequests.clear();
+	m_AsyncShortPathRequests.swap(m_ProcessingShortRequests);
 
 	// TODO: we should only compute one path per entity per turn
 
 	// TODO: this computation should be done incrementally, spread
 	// across multiple frames (or even multiple turns)
 
-	ProcessLongRequests(longRequests);
-	ProcessShortRequests(shortRequests);
+	ProcessLongRequests(m_ProcessingLongRequests);
+	ProcessShortRequests(m_ProcessingShortRequests);
 }
 
+class CCmpPathfinder::ComputeLongPathsTask : public CThreadPool::ITask
+{
+public:
+	ComputeLongPathsTask(CCmpPathfinder& pathfinder, const std::vector<AsyncLongPathRequest>& requests,
+		const std::vector<std::vector<size_t> >& jobs, std::vector<Path>& paths) :
+		m_Pathfinder(pathfinder), m_Requests(requests), m_Jobs(jobs), m_Paths(paths)
+	{
+	}
+
+	virtual void Run(size_t index)
+	{
+		const std::vector<size_t>& job = m_Jobs[index];
+		PathfindTileGrid* tiles = m_Pathfinder.AcquireSearchGrid();
+		if (job.size() >= MIN_SHARED_GOAL_PATHS)
+		{
+			m_Pathfinder.ComputeSharedGoalPaths(m_Requests, job, m_Paths, *tiles);
+		}
+		else
+		{
+			for (size_t i = 0; i < job.size(); ++i)
+			{
+				const AsyncLongPathRequest& req = m_Requests[job[i]];
+				m_Pathfinder.ComputePathWithGrid(req.x0, req.z0, req.goal, req.passClass, req.costClass, m_Paths[job[i]], *tiles);
+			}
+		}
+		m_Pathfinder.ReleaseSearchGrid(tiles);
+	}
+
+private:
+	CCmpPathfinder& m_Pathfinder;
+	const std::vector<AsyncLongPathRequest>& m_Requests;
+	const std::vector<std::vector<size_t> >& m_Jobs;
+	std::vector<Path>& m_Paths;
+	NONCOPYABLE(ComputeLongPathsTask);
+};
+
 void CCmpPathfinder::ProcessLongRequests(const std::vector<AsyncLongPathRequest>& longRequests)
 {
+	if (longRequests.empty())
+		return;
+
+	// Each path only depends on the (unchanging) grid and its own request,
+	// so they can be computed in parallel. The results are posted afterwards
+	// in request order, so the message order is deterministic.
+
+	UpdateGrid();
+
+	PROFILE3("compute long paths");
+
+	// Large groups of units are often sent to the same place at once (e.g. a
+	// formation or a group selection being ordered to move), so requests with
+	// identical goals and classes are grouped together. Large enough groups
+	// share a single search from the goal; the rest are computed individually.
+	// (The grouping must not depend on the thread pool, since the computed
+	// paths differ slightly.)
+	// (The group, job and path vectors are only cleared, not destroyed,
+	// so their elements keep their memory for the next turn.)
+	std::vector<std::vector<size_t> >& groups = m_PathGroups;
+	size_t numGroups = 0;
 	for (size_t i = 0; i < longRequests.size(); ++i)
 	{
 		const AsyncLongPathRequest& req = longRequests[i];
-		Path path;
-		ComputePath(req.x0, req.z0, req.goal, req.passClass, req.costClass, path);
-		CMessagePathResult msg(req.ticket, path);
-		GetSimContext().GetComponentManager().PostMessage(req.notify, msg);
+		m_Hierarchical.ComputePassClass(req.passClass);
+
+		size_t g = 0;
+		for (; g < numGroups; ++g)
+		{
+			const AsyncLongPathRequest& first = longRequests[groups[g][0]];
+			if (first.passClass == req.passClass && first.costClass == req.costClass && GoalsEqual(first.goal, req.goal))
+				break;
+		}
+		if (g == numGroups)
+		{
+			if (numGroups == groups.size())
+				groups.push_back(std::vector<size_t>());
+			groups[numGroups++].clear();
+		}
+		groups[g].push_back(i);
+	}
+
+	std::vector<std::vector<size_t> >& jobs = m_PathJobs;
+	size_t numJobs = 0;
+	for (size_t g = 0; g < numGroups; ++g)
+	{
+		const size_t jobsNeeded = (groups[g].size() >= MIN_SHARED_GOAL_PATHS ? 1 : groups[g].size());
+		if (jobs.size() < numJobs + jobsNeeded)
+			jobs.resize(numJobs + jobsNeeded);
+
+		if (jobsNeeded == 1)
+		{
+			jobs[numJobs++].assign(groups[g].begin(), groups[g].end());
+		}
+		else
+		{
+			for (size_t i = 0; i < groups[g].size(); ++i)
+				jobs[numJobs++].assign(1, groups[g][i]);
+		}
+	}
+
+	std::vector<Path>& paths = m_PathResults;
+	if (paths.size() < longRequests.size())
+		paths.resize(longRequests.size());
+	for (size_t i = 0; i < longRequests.size(); ++i)
+		paths[i].m_Waypoints.clear();
+
+	ComputeLongPathsTask task(*this, longRequests, jobs, paths);
+	if (g_ThreadPool)
+	{
+		g_ThreadPool->ParallelFor(task, numJobs);
+	}
+	else
+	{
+		for (size_t i = 0; i < numJobs; ++i)
+			task.Run(i);
+	}
+
+	for (size_t i = 0; i < longRequests.size(); ++i)
+	{
+		CMessagePathResult msg(longRequests[i].ticket, paths[i]);
+		GetSimContext().GetComponentManager().PostMessage(longRequests[i].notify, msg);
 	}
 }
 
 void CCmpPathfinder::ProcessShortRequests(const std::vector<AsyncShortPathRequest>& shortRequests)
 {
+	if (m_PathResults.empty())
+		m_PathResults.resize(1);
+	Path& path = m_PathResults[0];
+
 	for (size_t i = 0; i < shortRequests.size(); ++i)
 	{
 		const AsyncShortPathRequest& req = shortRequests[i];
-		Path path;
+		path.m_Waypoints.clear();
 		ControlGroupMovementObstructionFilter filter(req.avoidMovingUnits, req.group);
 		ComputeShortPath(filter, req.x0, req.z0, req.r, req.range, req.goal, req.passClass, path);
 		CMessagePathResult msg(req.ticket, path);
@@ -609,8 +822,9 @@ void CCmpPathfinder::ProcessSameTurnMoves()
 		if (moveCount <= 0)
 			return;
 
-		// Copy the long request elements we are going to process into a new array
-		std::vector<AsyncLongPathRequest> longRequests;
+		// Copy the long request elements we are going to process into a separate array
+		std::vector<AsyncLongPathRequest>& longRequests = m_ProcessingLongRequests;
+		longRequests.clear();
 		if ((i32)m_AsyncLongPathRequests.size() <= moveCount)
 		{
 			m_AsyncLongPathRequests.swap(longRequests);
@@ -618,8 +832,7 @@ void CCmpPathfinder::ProcessSameTurnMoves()
 		}
 		else
 		{
-			longRequests.resize(moveCount);
-			copy(m_AsyncLongPathRequests.begin(), m_AsyncLongPathRequests.begin() + moveCount, longRequests.begin());
+			longRequests.assign(m_AsyncLongPathRequests.begin(), m_AsyncLongPathRequests.begin() + moveCount);
 			m_AsyncLongPathRequests.erase(m_AsyncLongPathRequests.begin(), m_AsyncLongPathRequests.begin() + moveCount);
 		}
 
@@ -636,8 +849,9 @@ void CCmpPathfinder::ProcessSameTurnMoves()
 		if (moveCount <= 0)
 			return;
 
-		// Copy the short request elements we are going to process into a new array
-		std::vector<AsyncShortPathRequest> shortRequests;
+		// Copy the short request elements we are going to process into a separate array
+		std::vector<AsyncShortPathRequest>& shortRequests = m_ProcessingShortRequests;
+		shortRequests.clear();
 		if ((i32)m_AsyncShortPathRequests.size() <= moveCount)
 		{
 			m_AsyncShortPathRequests.swap(shortRequests);
@@ -645,8 +859,7 @@ void CCmpPathfinder::ProcessSameTurnMoves()
 		}
 		else
 		{
-			shortRequests.resize(moveCount);
-			copy(m_AsyncShortPathRequests.begin(), m_AsyncShortPathRequests.begin() + moveCount, shortRequests.begin());
+			shortRequests.assign(m_AsyncShortPathRequests.begin(), m_AsyncShortPathRequests.begin() + moveCount);
 			m_AsyncShortPathRequests.erase(m_AsyncShortPathRequests.begin(), m_AsyncShortPathRequests.begin() + moveCount);
 		}
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -34,12 +34,15 @@
 #include "graphics/Overlay.h"
 #include "graphics/Terrain.h"
 #include "maths/MathUtil.h"
+#include "ps/ThreadUtil.h"
 #include "simulation2/helpers/Geometry.h"
 #include "simulation2/helpers/Grid.h"
+#include "simulation2/helpers/HierarchicalPathfinder.h"
 
 class PathfinderOverlay;
 class SceneCollector;
 struct PathfindTile;
+class PathfindTileGrid;
 
 #ifdef NDEBUG
 #define PATHFIND_DEBUG 0
@@ -109,11 +112,18 @@ public:
 
 	}
 
-	bool IsPassable(fixed waterdepth, fixed steepness, fixed shoredist)
+	bool IsPassable(fixed waterdepth, fixed steepness, fixed shoredist) const
 	{
 		return ((m_MinDepth <= waterdepth && waterdepth <= m_MaxDepth) && (steepness < m_MaxSlope) && (m_MinShore <= shoredist && shoredist <= m_MaxShore));
 	}
 
+	/**
+	 * Equivalent to calling IsPassable on each of @p n tiles (given as arrays of
+	 * the fixed-point values' internal representation), and ORing m_Mask
+	 * into @p tiles for the ones that aren't passable.
+	 */
+	void AddImpassableMask(const i32* waterdepth, const i32* steepness, const i32* shoredist, size_t n, u16* tiles) const;
+
 	ICmpPathfinder::pass_class_t m_Mask;
 private:
 	fixed m_MinDepth;
@@ -136,8 +146,6 @@ const int COST_CLASS_BITS = 16 - (PASS_CLASS_BITS + 2);
 #define GET_COST_CLASS(item) ((item) >> (PASS_CLASS_BITS + 2))
 #define COST_CLASS_MASK(id) ( (TerrainTile) ((id) << (PASS_CLASS_BITS + 2)) )
 
-typedef SparseGrid<PathfindTile> PathfindTileGrid;
-
 struct AsyncLongPathRequest
 {
 	u32 ticket;
@@ -199,17 +207,31 @@ public:
 	// Lazily-constructed dynamic state (not serialized):
 
 	u16 m_MapSize; // tiles per side
-	Grid<TerrainTile>* m_Grid; // terrain/passability information
+	shared_ptr<Grid<TerrainTile> > m_Grid; // terrain/passability information (may be shared with snapshots; see MakeGridUnique)
 	Grid<u8>* m_ObstructionGrid; // cached obstruction information (TODO: we shouldn't bother storing this, it's redundant with LSBs of m_Grid)
 	bool m_TerrainDirty; // indicates if m_Grid has been updated since terrain changed
+	HierarchicalPathfinder m_Hierarchical; // coarse connectivity derived from m_Grid
 	
 	// For responsiveness we will process some moves in the same turn they were generated in
 	
 	u16 m_MaxSameTurnMoves; // max number of moves that can be created and processed in the same turn
 
+	// A* states that aren't currently in use, reused by later ComputePath calls.
+	// (There can be several when paths are computed in parallel.)
+	std::vector<PathfindTileGrid*> m_FreeSearchGrids;
+	CMutex m_SearchGridsMutex;
+
+	// Buffers used while processing async requests, kept between turns so
+	// their memory is reused instead of reallocated every turn
+	std::vector<AsyncLongPathRequest> m_ProcessingLongRequests;
+	std::vector<AsyncShortPathRequest> m_ProcessingShortRequests;
+	std::vector<std::vector<size_t> > m_PathGroups;
+	std::vector<std::vector<size_t> > m_PathJobs;
+	std::vector<Path> m_PathResults;
+
 	// Debugging - output from last pathfind operation:
 
-	PathfindTileGrid* m_DebugGrid;
+	PathfindTileGrid* m_DebugGrid; // one of m_FreeSearchGrids, if it still holds the last path's search
 	u32 m_DebugSteps;
 	Path* m_DebugPath;
 	PathfinderOverlay* m_DebugOverlay;
@@ -240,6 +262,8 @@ public:
 
 	virtual const Grid<u16>& GetPassabilityGrid();
 
+	virtual shared_ptr<const Grid<u16> > GetPassabilityGridSnapshot();
+
 	virtual void ComputePath(entity_pos_t x0, entity_pos_t z0, const Goal& goal, pass_class_t passClass, cost_class_t costClass, Path& ret);
 
 	virtual u32 ComputePathAsync(entity_pos_t x0, entity_pos_t z0, const Goal& goal, pass_class_t passClass, cost_class_t costClass, entity_id_t notify);
@@ -267,6 +291,8 @@ public:
 	virtual void FinishAsyncRequests();
 
 	void ProcessLongRequests(const std::vector<AsyncLongPathRequest>& longRequests);
+
+	class ComputeLongPathsTask;
 	
 	void ProcessShortRequests(const std::vector<AsyncShortPathRequest>& shortRequests);
 
@@ -292,11 +318,68 @@ public:
 
 	static fixed DistanceToGoal(CFixedVector2D pos, const CCmpPathfinder::Goal& goal);
 
+	/**
+	 * Equivalent to ComputePath, using the given A* state. Returns the number of steps taken.
+	 * This can be called from any thread, concurrently with other calls using different
+	 * grids, provided UpdateGrid has been called and m_Hierarchical has computed @p passClass.
+	 */
+	u32 ComputePathWithGrid(entity_pos_t x0, entity_pos_t z0, const Goal& goal, pass_class_t passClass, cost_class_t costClass, Path& ret, PathfindTileGrid& tiles);
+
+	/**
+	 * Minimum number of long path requests with the same goal for
+	 * ComputeSharedGoalPaths to be used.
+	 */
+	enum { MIN_SHARED_GOAL_PATHS = 8 };
+
+	/**
+	 * Computes paths for the requests with indexes @p group, which must all have
+	 * the same goal, pass class and cost class, storing them in the corresponding
+	 * elements of @p paths.
+	 * This does a single search outwards from the goal until it reaches every unit,
+	 * instead of a separate A* search per unit. Units that can't use that search
+	 * (e.g. because they can't reach the goal) fall back to ComputePathWithGrid.
+	 * Thread-safety is the same as ComputePathWithGrid.
+	 */
+	void ComputeSharedGoalPaths(const std::vector<AsyncLongPathRequest>& requests, const std::vector<size_t>& group, std::vector<Path>& paths, PathfindTileGrid& tiles);
+
+	static bool GoalsEqual(const Goal& a, const Goal& b);
+
+	/**
+	 * Returns an A* state for the current map size that isn't in use by any other thread.
+	 * Callers must return it with ReleaseSearchGrid.
+	 */
+	PathfindTileGrid* AcquireSearchGrid();
+	void ReleaseSearchGrid(PathfindTileGrid* grid);
+
+	/**
+	 * Frees the A* states that are kept between ComputePath calls.
+	 * Must not be called while any are in use.
+	 */
+	void DeleteSearchGrids();
+
+	/**
+	 * Computes the range of tiles that might satisfy AtGoal for @p goal.
+	 */
+	void GetGoalTileBounds(const Goal& goal, u16& iMin, u16& jMin, u16& iMax, u16& jMax);
+
+	/**
+	 * If no part of @p goal can be reached from tile (i0, j0), replaces it with a
+	 * point goal on the nearest reachable tile, so that ComputePath doesn't have to
+	 * exhaust the whole reachable area before giving up.
+	 * Returns false if the goal was changed.
+	 */
+	bool MakeGoalReachable(u16 i0, u16 j0, Goal& goal, pass_class_t passClass);
+
 	/**
 	 * Regenerates the grid based on the current obstruction list, if necessary
 	 */
 	void UpdateGrid();
 
+	/**
+	 * Copies m_Grid if it's shared with any snapshots, so that it can be modified
+	 */
+	void MakeGridUnique();
+
 	void RenderSubmit(SceneCollector& collector);
 };
 
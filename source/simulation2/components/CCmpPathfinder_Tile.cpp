@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -91,6 +91,55 @@ private:
 	void SetStep(u32) { }
 #endif
 
+private:
+	u32 generation; // PathfindTileGrid search that last initialised this tile
+	friend class PathfindTileGrid;
+};
+
+/**
+ * A* search state for every tile on the map, kept between ComputePath calls.
+ *
+ * Instead of clearing the whole grid before each search, every tile records
+ * which search last touched it; tiles from an older search are lazily reset
+ * to the unexplored state the first time they're accessed.
+ */
+class PathfindTileGrid
+{
+	NONCOPYABLE(PathfindTileGrid);
+public:
+	PathfindTileGrid(u16 w, u16 h) : m_Tiles(w, h), m_Generation(0)
+	{
+	}
+
+	/**
+	 * Mark every tile as unexplored, ready for a new search.
+	 */
+	void StartSearch()
+	{
+		++m_Generation;
+
+		// If the counter wraps around, old tiles might look current, so clear them properly
+		if (m_Generation == 0)
+		{
+			m_Tiles.reset();
+			m_Generation = 1;
+		}
+	}
+
+	PathfindTile& get(int i, int j)
+	{
+		PathfindTile& t = m_Tiles.get(i, j);
+		if (t.generation != m_Generation)
+		{
+			memset(&t, 0, sizeof(t));
+			t.generation = m_Generation;
+		}
+		return t;
+	}
+
+private:
+	Grid<PathfindTile> m_Tiles;
+	u32 m_Generation;
 };
 
 /**
@@ -164,7 +213,6 @@ void CCmpPathfinder::SetDebugPath(entity_pos_t x0, entity_pos_t z0, const Goal&
 	if (!m_DebugOverlay)
 		return;
 
-	delete m_DebugGrid;
 	m_DebugGrid = NULL;
 	delete m_DebugPath;
 	m_DebugPath = new Path();
@@ -174,13 +222,42 @@ void CCmpPathfinder::SetDebugPath(entity_pos_t x0, entity_pos_t z0, const Goal&
 
 void CCmpPathfinder::ResetDebugPath()
 {
-	delete m_DebugGrid;
 	m_DebugGrid = NULL;
 	delete m_DebugPath;
 	m_DebugPath = NULL;
 }
 
 
+PathfindTileGrid* CCmpPathfinder::AcquireSearchGrid()
+{
+	{
+		CScopeLock lock(m_SearchGridsMutex);
+		if (!m_FreeSearchGrids.empty())
+		{
+			PathfindTileGrid* grid = m_FreeSearchGrids.back();
+			m_FreeSearchGrids.pop_back();
+			return grid;
+		}
+	}
+
+	return new PathfindTileGrid(m_MapSize, m_MapSize);
+}
+
+void CCmpPathfinder::ReleaseSearchGrid(PathfindTileGrid* grid)
+{
+	CScopeLock lock(m_SearchGridsMutex);
+	m_FreeSearchGrids.push_back(grid);
+}
+
+void CCmpPathfinder::DeleteSearchGrids()
+{
+	m_DebugGrid = NULL;
+	for (size_t i = 0; i < m_FreeSearchGrids.size(); ++i)
+		delete m_FreeSearchGrids[i];
+	m_FreeSearchGrids.clear();
+}
+
+
 //////////////////////////////////////////////////////////
 
 
@@ -363,27 +440,99 @@ static void ProcessNeighbour(u16 pi, u16 pj, u16 i, u16 j, u32 pg, PathfinderSta
 #endif
 }
 
+void CCmpPathfinder::GetGoalTileBounds(const Goal& goal, u16& iMin, u16& jMin, u16& iMax, u16& jMax)
+{
+	CFixedVector2D halfSize;
+	switch (goal.type)
+	{
+	case Goal::POINT:
+		break;
+	case Goal::CIRCLE:
+		halfSize = CFixedVector2D(goal.hw, goal.hw);
+		break;
+	case Goal::SQUARE:
+		halfSize = Geometry::GetHalfBoundingBox(goal.u, goal.v, CFixedVector2D(goal.hw, goal.hh));
+		break;
+	}
+
+	// (Allow for the tolerance used by AtGoal)
+	entity_pos_t tolerance = entity_pos_t::FromInt(TERRAIN_TILE_SIZE*3/2);
+	NearestTile(goal.x - halfSize.X - tolerance, goal.z - halfSize.Y - tolerance, iMin, jMin);
+	NearestTile(goal.x + halfSize.X + tolerance, goal.z + halfSize.Y + tolerance, iMax, jMax);
+}
+
+bool CCmpPathfinder::MakeGoalReachable(u16 i0, u16 j0, Goal& goal, pass_class_t passClass)
+{
+	u16 startRegion = m_Hierarchical.GetGlobalRegion(i0, j0, passClass);
+
+	// If we're starting on an impassable tile, ComputePath will ignore impassability
+	// until it escapes, so we can't tell what's reachable
+	if (!startRegion)
+		return true;
+
+	u16 iMin, jMin, iMax, jMax;
+	GetGoalTileBounds(goal, iMin, jMin, iMax, jMax);
+
+	for (u16 j = jMin; j <= jMax; ++j)
+		for (u16 i = iMin; i <= iMax; ++i)
+			if (m_Hierarchical.GetGlobalRegion(i, j, passClass) == startRegion && AtGoal(i, j, goal))
+				return true;
+
+	u16 iGoal, jGoal, iNearest, jNearest;
+	NearestTile(goal.x, goal.z, iGoal, jGoal);
+	if (!m_Hierarchical.FindNearestTileInGlobalRegion(iGoal, jGoal, startRegion, passClass, iNearest, jNearest))
+		return true; // shouldn't happen, since the start tile is in this region
+
+	entity_pos_t x, z;
+	TileCenter(iNearest, jNearest, x, z);
+	goal.type = Goal::POINT;
+	goal.x = x;
+	goal.z = z;
+	return false;
+}
+
 void CCmpPathfinder::ComputePath(entity_pos_t x0, entity_pos_t z0, const Goal& goal, pass_class_t passClass, cost_class_t costClass, Path& path)
 {
 	UpdateGrid();
 
-	PROFILE3("ComputePath");
+	PROFILE("ComputePath");
+
+	PathfindTileGrid* tiles = AcquireSearchGrid();
+	m_DebugSteps = ComputePathWithGrid(x0, z0, goal, passClass, costClass, path, *tiles);
+	ReleaseSearchGrid(tiles);
+
+	// Show this search in the debug display (until the grid gets reused)
+	m_DebugGrid = tiles;
+}
+
+u32 CCmpPathfinder::ComputePathWithGrid(entity_pos_t x0, entity_pos_t z0, const Goal& origGoal, pass_class_t passClass, cost_class_t costClass, Path& path, PathfindTileGrid& tiles)
+{
+	PROFILE2("ComputePath");
 
 	PathfinderState state = { 0 };
 
 	// Convert the start/end coordinates to tile indexes
 	u16 i0, j0;
 	NearestTile(x0, z0, i0, j0);
-	NearestTile(goal.x, goal.z, state.iGoal, state.jGoal);
 
 	// If we're already at the goal tile, then move directly to the exact goal coordinates
-	if (AtGoal(i0, j0, goal))
+	if (AtGoal(i0, j0, origGoal))
 	{
-		Waypoint w = { goal.x, goal.z };
+		Waypoint w = { origGoal.x, origGoal.z };
 		path.m_Waypoints.push_back(w);
-		return;
+		return 0;
+	}
+
+	// If the goal is unreachable, head for the nearest point we can actually reach
+	Goal goal = origGoal;
+	if (!MakeGoalReachable(i0, j0, goal, passClass))
+	{
+		if (AtGoal(i0, j0, goal))
+			return 0; // we're already as close as we can get
 	}
 
+	NearestTile(goal.x, goal.z, state.iGoal, state.jGoal);
+
 	// If the target is a circle, we want to aim for the edge of it (so e.g. if we're inside
 	// a large circle then the heuristics will aim us directly outwards);
 	// otherwise just aim at the center point. (We'll never try moving outwards to a square shape.)
@@ -397,8 +546,9 @@ void CCmpPathfinder::ComputePath(entity_pos_t x0, entity_pos_t z0, const Goal& g
 
 	state.steps = 0;
 
-	state.tiles = new PathfindTileGrid(m_MapSize, m_MapSize);
-	state.terrain = m_Grid;
+	tiles.StartSearch();
+	state.tiles = &tiles;
+	state.terrain = m_Grid.get();
 
 	state.iBest = i0;
 	state.jBest = j0;
@@ -486,11 +636,6 @@ void CCmpPathfinder::ComputePath(entity_pos_t x0, entity_pos_t z0, const Goal& g
 		jp = n.GetPredJ(jp);
 	}
 
-	// Save this grid for debug display
-	delete m_DebugGrid;
-	m_DebugGrid = state.tiles;
-	m_DebugSteps = state.steps;
-
 	PROFILE2_ATTR("from: (%d, %d)", i0, j0);
 	PROFILE2_ATTR("to: (%d, %d)", state.iGoal, state.jGoal);
 	PROFILE2_ATTR("reached: (%d, %d)", state.iBest, state.jBest);
@@ -499,4 +644,178 @@ void CCmpPathfinder::ComputePath(entity_pos_t x0, entity_pos_t z0, const Goal& g
 #if PATHFIND_STATS
 	printf("PATHFINDER: steps=%d avgo=%d proc=%d impc=%d impo=%d addo=%d\n", state.steps, state.sumOpenSize/state.steps, state.numProcessed, state.numImproveClosed, state.numImproveOpen, state.numAddToOpen);
 #endif
+
+	return state.steps;
+}
+
+//////////////////////////////////////////////////////////
+
+bool CCmpPathfinder::GoalsEqual(const Goal& a, const Goal& b)
+{
+	if (a.type != b.type || a.x != b.x || a.z != b.z)
+		return false;
+	if (a.type == Goal::CIRCLE)
+		return a.hw == b.hw;
+	if (a.type == Goal::SQUARE)
+		return a.hw == b.hw && a.hh == b.hh && a.u == b.u && a.v == b.v;
+	return true;
+}
+
+void CCmpPathfinder::ComputeSharedGoalPaths(const std::vector<AsyncLongPathRequest>& requests, const std::vector<size_t>& group, std::vector<Path>& paths, PathfindTileGrid& tiles)
+{
+	PROFILE2("ComputeSharedGoalPaths");
+	PROFILE2_ATTR("paths: %u", (u32)group.size());
+
+	const Goal& goal = requests[group[0]].goal;
+	pass_class_t passClass = requests[group[0]].passClass;
+	const std::vector<u32>& moveCosts = m_MoveCosts.at(requests[group[0]].costClass);
+
+	// Instead of searching from each unit towards the goal, do a single Dijkstra search
+	// outwards from the goal until it has reached every unit's tile. Each tile's
+	// predecessor is then the next step towards the goal, so every unit can follow
+	// the predecessors to get its path.
+	// (Units that can't use this, e.g. because they're on an impassable tile or can't
+	// reach the goal, are handled by the normal A* afterwards.)
+
+	std::vector<size_t> fallbacks;
+
+	tiles.StartSearch();
+	PriorityQueue open;
+
+	// Start from every passable goal tile
+	std::set<u16> goalRegions;
+	u16 iMin, jMin, iMax, jMax;
+	GetGoalTileBounds(goal, iMin, jMin, iMax, jMax);
+	for (u16 j = jMin; j <= jMax; ++j)
+	{
+		for (u16 i = iMin; i <= iMax; ++i)
+		{
+			if (!IS_PASSABLE(m_Grid->get(i, j), passClass) || !AtGoal(i, j, goal))
+				continue;
+
+			PathfindTile& n = tiles.get(i, j);
+			n.SetStatusOpen();
+			n.SetPred(i, j, i, j);
+			n.cost = 0;
+			PriorityQueue::Item t = { std::make_pair(i, j), 0 };
+			open.push(t);
+			goalRegions.insert(m_Hierarchical.GetGlobalRegion(i, j, passClass));
+		}
+	}
+
+	// Find the units the search needs to reach
+	std::vector<u32> targets; // j*m_MapSize+i of each unit's tile, sorted
+	for (size_t n = 0; n < group.size(); ++n)
+	{
+		u16 i0, j0;
+		NearestTile(requests[group[n]].x0, requests[group[n]].z0, i0, j0);
+		if (AtGoal(i0, j0, goal))
+			continue; // ComputePathWithGrid will just head straight for the goal
+
+		if (goalRegions.count(m_Hierarchical.GetGlobalRegion(i0, j0, passClass)))
+			targets.push_back(j0*m_MapSize + i0);
+	}
+	std::sort(targets.begin(), targets.end());
+	targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+
+	size_t remaining = targets.size();
+
+	// Diagonal steps cost sqrt(2) times as much
+	const u32 diagonalMul = 362, diagonalDiv = 256;
+
+	while (!open.empty() && remaining)
+	{
+		PriorityQueue::Item curr = open.pop();
+		u16 i = curr.id.first;
+		u16 j = curr.id.second;
+		PathfindTile& tile = tiles.get(i, j);
+
+		// Skip stale queue entries for tiles that were later reached more cheaply
+		if (tile.IsClosed() || curr.rank != tile.cost)
+			continue;
+		tile.SetStatusClosed();
+
+		if (std::binary_search(targets.begin(), targets.end(), (u32)(j*m_MapSize + i)))
+			--remaining;
+
+		// Moving from a neighbour into this tile costs this tile's movement cost
+		u32 stepCost = moveCosts.at(GET_COST_CLASS(m_Grid->get(i, j)));
+
+		for (int dj = -1; dj <= 1; ++dj)
+		{
+			for (int di = -1; di <= 1; ++di)
+			{
+				if (di == 0 && dj == 0)
+					continue;
+
+				int ni = i + di;
+				int nj = j + dj;
+				if (ni < 0 || nj < 0 || ni >= m_MapSize || nj >= m_MapSize)
+					continue;
+				if (!IS_PASSABLE(m_Grid->get(ni, nj), passClass))
+					continue;
+
+				u32 g = tile.cost + stepCost;
+				if (di != 0 && dj != 0)
+				{
+					// Don't cut corners past impassable tiles
+					if (!IS_PASSABLE(m_Grid->get(ni, j), passClass) || !IS_PASSABLE(m_Grid->get(i, nj), passClass))
+						continue;
+					g = tile.cost + stepCost * diagonalMul / diagonalDiv;
+				}
+
+				PathfindTile& n = tiles.get(ni, nj);
+				if (n.IsClosed() || (n.IsOpen() && g >= n.cost))
+					continue;
+
+				n.SetStatusOpen();
+				n.cost = g;
+				n.SetPred(i, j, (u16)ni, (u16)nj);
+				PriorityQueue::Item t = { std::make_pair((u16)ni, (u16)nj), g };
+				open.push(t);
+			}
+		}
+	}
+
+	// Follow the predecessors from each unit back to the goal
+	for (size_t n = 0; n < group.size(); ++n)
+	{
+		const AsyncLongPathRequest& req = requests[group[n]];
+		Path& path = paths[group[n]];
+
+		u16 i0, j0;
+		NearestTile(req.x0, req.z0, i0, j0);
+		if (AtGoal(i0, j0, goal) || !tiles.get(i0, j0).IsClosed())
+		{
+			fallbacks.push_back(group[n]);
+			continue;
+		}
+
+		u16 i = i0, j = j0;
+		while (true)
+		{
+			PathfindTile& tile = tiles.get(i, j);
+			u16 pi = tile.GetPredI(i);
+			u16 pj = tile.GetPredJ(j);
+			if (pi == i && pj == j)
+				break;
+			i = pi;
+			j = pj;
+
+			entity_pos_t x, z;
+			TileCenter(i, j, x, z);
+			Waypoint w = { x, z };
+			path.m_Waypoints.push_back(w);
+		}
+
+		// Paths are stored in reverse order
+		std::reverse(path.m_Waypoints.begin(), path.m_Waypoints.end());
+	}
+
+	// (This reuses the grid, so it must come after all the flow field lookups)
+	for (size_t n = 0; n < fallbacks.size(); ++n)
+	{
+		const AsyncLongPathRequest& req = requests[fallbacks[n]];
+		ComputePathWithGrid(req.x0, req.z0, req.goal, req.passClass, req.costClass, paths[fallbacks[n]], tiles);
+	}
 }
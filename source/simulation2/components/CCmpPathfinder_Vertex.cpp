@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -124,52 +124,132 @@ struct EdgeAA
 static const entity_pos_t EDGE_EXPAND_DELTA = entity_pos_t::FromInt(1)/4;
 
 /**
- * Check whether a ray from 'a' to 'b' crosses any of the edges.
+ * Check whether a ray from 'a' to 'b' (with abn = (b - a).Perpendicular()) crosses the edge.
  * (Edges are one-sided so it's only considered a cross if going from front to back.)
  */
+inline static bool EdgeBlocksRay(CFixedVector2D a, CFixedVector2D b, CFixedVector2D abn, const Edge& edge)
+{
+	CFixedVector2D p0 = edge.p0;
+	CFixedVector2D p1 = edge.p1;
+
+	CFixedVector2D d = (p1 - p0).Perpendicular();
+
+	// If 'a' is behind the edge, we can't cross
+	fixed q = (a - p0).Dot(d);
+	if (q < fixed::Zero())
+		return false;
+
+	// If 'b' is in front of the edge, we can't cross
+	fixed r = (b - p0).Dot(d);
+	if (r > fixed::Zero())
+		return false;
+
+	// The ray is crossing the infinitely-extended edge from in front to behind.
+	// Check the finite edge is crossing the infinitely-extended ray too.
+	// (Given the previous tests, it can only be crossing in one direction.)
+	fixed s = (p0 - a).Dot(abn);
+	if (s > fixed::Zero())
+		return false;
+
+	fixed t = (p1 - a).Dot(abn);
+	if (t < fixed::Zero())
+		return false;
+
+	return true;
+}
+
+/**
+ * Check whether a ray from 'a' to 'b' crosses any of the edges.
+ */
 inline static bool CheckVisibility(CFixedVector2D a, CFixedVector2D b, const std::vector<Edge>& edges)
 {
 	CFixedVector2D abn = (b - a).Perpendicular();
 
 	// Edges of general non-axis-aligned shapes
 	for (size_t i = 0; i < edges.size(); ++i)
-	{
-		CFixedVector2D p0 = edges[i].p0;
-		CFixedVector2D p1 = edges[i].p1;
+		if (EdgeBlocksRay(a, b, abn, edges[i]))
+			return false;
 
-		CFixedVector2D d = (p1 - p0).Perpendicular();
+	return true;
+}
 
-		// If 'a' is behind the edge, we can't cross
-		fixed q = (a - p0).Dot(d);
-		if (q < fixed::Zero())
-			continue;
+// Handle the axis-aligned shape edges separately (for performance):
+// (These are specialised versions of the general unaligned edge code.
+// They assume the caller has already excluded edges for which 'a' is
+// on the wrong side, and (for the CheckVisibility* versions) rays that
+// are heading away from the edges.)
+
+inline static bool EdgeBlocksRayLeft(CFixedVector2D a, CFixedVector2D b, CFixedVector2D abn, const EdgeAA& edge)
+{
+	if (b.X < edge.p0.X)
+		return false;
+
+	CFixedVector2D p0 (edge.p0.X, edge.c1);
+	fixed s = (p0 - a).Dot(abn);
+	if (s > fixed::Zero())
+		return false;
+
+	CFixedVector2D p1 (edge.p0.X, edge.p0.Y);
+	fixed t = (p1 - a).Dot(abn);
+	if (t < fixed::Zero())
+		return false;
 
-		// If 'b' is in front of the edge, we can't cross
-		fixed r = (b - p0).Dot(d);
-		if (r > fixed::Zero())
-			continue;
+	return true;
+}
 
-		// The ray is crossing the infinitely-extended edge from in front to behind.
-		// Check the finite edge is crossing the infinitely-extended ray too.
-		// (Given the previous tests, it can only be crossing in one direction.)
-		fixed s = (p0 - a).Dot(abn);
-		if (s > fixed::Zero())
-			continue;
+inline static bool EdgeBlocksRayRight(CFixedVector2D a, CFixedVector2D b, CFixedVector2D abn, const EdgeAA& edge)
+{
+	if (b.X > edge.p0.X)
+		return false;
 
-		fixed t = (p1 - a).Dot(abn);
-		if (t < fixed::Zero())
-			continue;
+	CFixedVector2D p0 (edge.p0.X, edge.c1);
+	fixed s = (p0 - a).Dot(abn);
+	if (s > fixed::Zero())
+		return false;
 
+	CFixedVector2D p1 (edge.p0.X, edge.p0.Y);
+	fixed t = (p1 - a).Dot(abn);
+	if (t < fixed::Zero())
 		return false;
-	}
 
 	return true;
 }
 
-// Handle the axis-aligned shape edges separately (for performance):
-// (These are specialised versions of the general unaligned edge code.
-// They assume the caller has already excluded edges for which 'a' is
-// on the wrong side.)
+inline static bool EdgeBlocksRayBottom(CFixedVector2D a, CFixedVector2D b, CFixedVector2D abn, const EdgeAA& edge)
+{
+	if (b.Y < edge.p0.Y)
+		return false;
+
+	CFixedVector2D p0 (edge.p0.X, edge.p0.Y);
+	fixed s = (p0 - a).Dot(abn);
+	if (s > fixed::Zero())
+		return false;
+
+	CFixedVector2D p1 (edge.c1, edge.p0.Y);
+	fixed t = (p1 - a).Dot(abn);
+	if (t < fixed::Zero())
+		return false;
+
+	return true;
+}
+
+inline static bool EdgeBlocksRayTop(CFixedVector2D a, CFixedVector2D b, CFixedVector2D abn, const EdgeAA& edge)
+{
+	if (b.Y > edge.p0.Y)
+		return false;
+
+	CFixedVector2D p0 (edge.p0.X, edge.p0.Y);
+	fixed s = (p0 - a).Dot(abn);
+	if (s > fixed::Zero())
+		return false;
+
+	CFixedVector2D p1 (edge.c1, edge.p0.Y);
+	fixed t = (p1 - a).Dot(abn);
+	if (t < fixed::Zero())
+		return false;
+
+	return true;
+}
 
 inline static bool CheckVisibilityLeft(CFixedVector2D a, CFixedVector2D b, const std::vector<EdgeAA>& edges)
 {
@@ -179,22 +259,8 @@ inline static bool CheckVisibilityLeft(CFixedVector2D a, CFixedVector2D b, const
 	CFixedVector2D abn = (b - a).Perpendicular();
 
 	for (size_t i = 0; i < edges.size(); ++i)
-	{
-		if (b.X < edges[i].p0.X)
-			continue;
-
-		CFixedVector2D p0 (edges[i].p0.X, edges[i].c1);
-		fixed s = (p0 - a).Dot(abn);
-		if (s > fixed::Zero())
-			continue;
-
-		CFixedVector2D p1 (edges[i].p0.X, edges[i].p0.Y);
-		fixed t = (p1 - a).Dot(abn);
-		if (t < fixed::Zero())
-			continue;
-
-		return false;
-	}
+		if (EdgeBlocksRayLeft(a, b, abn, edges[i]))
+			return false;
 
 	return true;
 }
@@ -207,22 +273,8 @@ inline static bool CheckVisibilityRight(CFixedVector2D a, CFixedVector2D b, cons
 	CFixedVector2D abn = (b - a).Perpendicular();
 
 	for (size_t i = 0; i < edges.size(); ++i)
-	{
-		if (b.X > edges[i].p0.X)
-			continue;
-
-		CFixedVector2D p0 (edges[i].p0.X, edges[i].c1);
-		fixed s = (p0 - a).Dot(abn);
-		if (s > fixed::Zero())
-			continue;
-
-		CFixedVector2D p1 (edges[i].p0.X, edges[i].p0.Y);
-		fixed t = (p1 - a).Dot(abn);
-		if (t < fixed::Zero())
-			continue;
-
-		return false;
-	}
+		if (EdgeBlocksRayRight(a, b, abn, edges[i]))
+			return false;
 
 	return true;
 }
@@ -235,22 +287,8 @@ inline static bool CheckVisibilityBottom(CFixedVector2D a, CFixedVector2D b, con
 	CFixedVector2D abn = (b - a).Perpendicular();
 
 	for (size_t i = 0; i < edges.size(); ++i)
-	{
-		if (b.Y < edges[i].p0.Y)
-			continue;
-
-		CFixedVector2D p0 (edges[i].p0.X, edges[i].p0.Y);
-		fixed s = (p0 - a).Dot(abn);
-		if (s > fixed::Zero())
-			continue;
-
-		CFixedVector2D p1 (edges[i].c1, edges[i].p0.Y);
-		fixed t = (p1 - a).Dot(abn);
-		if (t < fixed::Zero())
-			continue;
-
-		return false;
-	}
+		if (EdgeBlocksRayBottom(a, b, abn, edges[i]))
+			return false;
 
 	return true;
 }
@@ -263,25 +301,167 @@ inline static bool CheckVisibilityTop(CFixedVector2D a, CFixedVector2D b, const
 	CFixedVector2D abn = (b - a).Perpendicular();
 
 	for (size_t i = 0; i < edges.size(); ++i)
+		if (EdgeBlocksRayTop(a, b, abn, edges[i]))
+			return false;
+
+	return true;
+}
+
+/**
+ * Check whether a ray from 'a' to 'b' crosses any of the outward-facing sides of
+ * the axis-aligned square 'sq' (whose corners are sq.p0 <= sq.p1).
+ * Equivalent to splitting the square with SplitAAEdges and using the CheckVisibility* functions.
+ */
+inline static bool SquareBlocksRay(CFixedVector2D a, CFixedVector2D b, CFixedVector2D abn, const Edge& sq)
+{
+	if (a.X <= sq.p0.X && a.X < b.X)
+	{
+		EdgeAA e = { sq.p0, sq.p1.Y };
+		if (EdgeBlocksRayLeft(a, b, abn, e))
+			return true;
+	}
+	if (a.X >= sq.p1.X && a.X > b.X)
 	{
-		if (b.Y > edges[i].p0.Y)
-			continue;
+		EdgeAA e = { sq.p1, sq.p0.Y };
+		if (EdgeBlocksRayRight(a, b, abn, e))
+			return true;
+	}
+	if (a.Y <= sq.p0.Y && a.Y < b.Y)
+	{
+		EdgeAA e = { sq.p0, sq.p1.X };
+		if (EdgeBlocksRayBottom(a, b, abn, e))
+			return true;
+	}
+	if (a.Y >= sq.p1.Y && a.Y > b.Y)
+	{
+		EdgeAA e = { sq.p1, sq.p0.X };
+		if (EdgeBlocksRayTop(a, b, abn, e))
+			return true;
+	}
+	return false;
+}
 
-		CFixedVector2D p0 (edges[i].p0.X, edges[i].p0.Y);
-		fixed s = (p0 - a).Dot(abn);
-		if (s > fixed::Zero())
-			continue;
+/**
+ * Uniform grid of the obstruction edges (or squares) used by a single ComputeShortPath
+ * call, so that each visibility check only needs to test the edges near the ray,
+ * instead of every edge in range.
+ *
+ * Items outside the grid's bounds are clamped into the outermost cells (and so are
+ * rays), so lookups are always conservative.
+ */
+class EdgeBuckets
+{
+public:
+	enum { SIZE = 16 }; // number of cells per side
 
-		CFixedVector2D p1 (edges[i].c1, edges[i].p0.Y);
-		fixed t = (p1 - a).Dot(abn);
-		if (t < fixed::Zero())
-			continue;
+	EdgeBuckets(fixed xMin, fixed zMin, fixed xMax, fixed zMax) :
+		m_X0(xMin.GetInternalValue()), m_Z0(zMin.GetInternalValue()), m_Stamp(0)
+	{
+		m_CellSize = std::max((i64)1, std::max((i64)(xMax - xMin).GetInternalValue(), (i64)(zMax - zMin).GetInternalValue()) / SIZE + 1);
+	}
 
-		return false;
+	/**
+	 * Add item @p id, with bounding box from @p p0 to @p p1.
+	 * Must be called in order of increasing id, before Finish.
+	 */
+	void Add(size_t id, CFixedVector2D p0, CFixedVector2D p1)
+	{
+		int i0 = CellX(std::min(p0.X, p1.X).GetInternalValue());
+		int i1 = CellX(std::max(p0.X, p1.X).GetInternalValue());
+		int j0 = CellZ(std::min(p0.Y, p1.Y).GetInternalValue());
+		int j1 = CellZ(std::max(p0.Y, p1.Y).GetInternalValue());
+		for (int j = j0; j <= j1; ++j)
+			for (int i = i0; i <= i1; ++i)
+				m_Entries.push_back(std::make_pair((u16)(j*SIZE + i), (u32)id));
+		m_Stamps.push_back(0);
 	}
 
-	return true;
-}
+	/**
+	 * Build the per-cell lists, after all the items have been added.
+	 */
+	void Finish()
+	{
+		// Sort by cell (and then id, so the lookup order is deterministic)
+		std::sort(m_Entries.begin(), m_Entries.end());
+		m_CellStart.assign(SIZE*SIZE + 1, 0);
+		for (size_t n = 0; n < m_Entries.size(); ++n)
+			++m_CellStart[m_Entries[n].first + 1];
+		for (size_t c = 0; c < SIZE*SIZE; ++c)
+			m_CellStart[c + 1] += m_CellStart[c];
+	}
+
+	/**
+	 * Returns (in @p out) the ids of every item whose cells overlap the segment from @p a to @p b.
+	 */
+	void GetNearRay(CFixedVector2D a, CFixedVector2D b, std::vector<u32>& out)
+	{
+		out.clear();
+		++m_Stamp;
+
+		i64 ax = a.X.GetInternalValue(), az = a.Y.GetInternalValue();
+		i64 bx = b.X.GetInternalValue(), bz = b.Y.GetInternalValue();
+		int j0 = CellZ(std::min(az, bz));
+		int j1 = CellZ(std::max(az, bz));
+
+		for (int j = j0; j <= j1; ++j)
+		{
+			// Find the range of X covered by the segment within this row.
+			// (The outermost rows extend to infinity, since items were clamped into them.)
+			i64 rowMin = (j == 0) ? std::numeric_limits<i64>::min() : m_Z0 + j*m_CellSize;
+			i64 rowMax = (j == SIZE-1) ? std::numeric_limits<i64>::max() : m_Z0 + (j+1)*m_CellSize;
+			i64 xMin, xMax;
+			if (az == bz)
+			{
+				xMin = std::min(ax, bx);
+				xMax = std::max(ax, bx);
+			}
+			else
+			{
+				i64 z0 = clamp(rowMin, std::min(az, bz), std::max(az, bz));
+				i64 z1 = clamp(rowMax, std::min(az, bz), std::max(az, bz));
+				i64 x0 = ax + (z0 - az) * (bx - ax) / (bz - az);
+				i64 x1 = ax + (z1 - az) * (bx - ax) / (bz - az);
+				// Allow for rounding errors in the division
+				xMin = std::min(x0, x1) - 2;
+				xMax = std::max(x0, x1) + 2;
+			}
+
+			int i0 = CellX(xMin);
+			int i1 = CellX(xMax);
+			for (int i = i0; i <= i1; ++i)
+			{
+				size_t c = j*SIZE + i;
+				for (size_t n = m_CellStart[c]; n < m_CellStart[c + 1]; ++n)
+				{
+					u32 id = m_Entries[n].second;
+					if (m_Stamps[id] == m_Stamp)
+						continue;
+					m_Stamps[id] = m_Stamp;
+					out.push_back(id);
+				}
+			}
+		}
+	}
+
+private:
+	int CellX(i64 x) const
+	{
+		return (int)clamp((x - m_X0) / m_CellSize, (i64)0, (i64)SIZE-1);
+	}
+
+	int CellZ(i64 z) const
+	{
+		return (int)clamp((z - m_Z0) / m_CellSize, (i64)0, (i64)SIZE-1);
+	}
+
+	i64 m_X0, m_Z0;
+	i64 m_CellSize;
+
+	std::vector<std::pair<u16, u32> > m_Entries; // (cell, id), sorted by cell after Finish
+	std::vector<size_t> m_CellStart; // index into m_Entries of the first entry of each cell
+	std::vector<u32> m_Stamps; // per-id, to avoid returning duplicates
+	u32 m_Stamp;
+};
 
 
 static CFixedVector2D NearestPointOnGoal(CFixedVector2D pos, const CCmpPathfinder::Goal& goal)
@@ -478,21 +658,6 @@ static void SplitAAEdges(CFixedVector2D a,
 	}
 }
 
-/**
- * Functor for sorting edges by approximate proximity to a fixed point.
- */
-struct EdgeSort
-{
-	CFixedVector2D src;
-	EdgeSort(CFixedVector2D src) : src(src) { }
-	bool operator()(const Edge& a, const Edge& b)
-	{
-		if ((a.p0 - src).CompareLength(b.p0 - src) < 0)
-			return true;
-		return false;
-	}
-};
-
 void CCmpPathfinder::ComputeShortPath(const IObstructionTestFilter& filter,
 	entity_pos_t x0, entity_pos_t z0, entity_pos_t r,
 	entity_pos_t range, const Goal& goal, pass_class_t passClass, Path& path)
@@ -692,6 +857,18 @@ void CCmpPathfinder::ComputeShortPath(const IObstructionTestFilter& filter,
 
 	PROFILE_START("A*");
 
+	// Index the edges spatially, since we'll be testing lots of rays against them.
+	// (The edges stay in their original order, so the search is unaffected.)
+	EdgeBuckets buckets(rangeXMin, rangeZMin, rangeXMax, rangeZMax);
+	for (size_t i = 0; i < edges.size(); ++i)
+		buckets.Add(i, edges[i].p0, edges[i].p1);
+	buckets.Finish();
+	EdgeBuckets bucketsAA(rangeXMin, rangeZMin, rangeXMax, rangeZMax);
+	for (size_t i = 0; i < edgesAA.size(); ++i)
+		bucketsAA.Add(i, edgesAA[i].p0, edgesAA[i].p1);
+	bucketsAA.Finish();
+	std::vector<u32> nearEdges;
+
 	PriorityQueue open;
 	PriorityQueue::Item qiStart = { START_VERTEX_ID, start.h };
 	open.push(qiStart);
@@ -712,16 +889,6 @@ void CCmpPathfinder::ComputeShortPath(const IObstructionTestFilter& filter,
 			break;
 		}
 
-		// Sort the edges so ones nearer this vertex are checked first by CheckVisibility,
-		// since they're more likely to block the rays
-		std::sort(edgesAA.begin(), edgesAA.end(), EdgeSort(vertexes[curr.id].p));
-
-		std::vector<EdgeAA> edgesLeft;
-		std::vector<EdgeAA> edgesRight;
-		std::vector<EdgeAA> edgesBottom;
-		std::vector<EdgeAA> edgesTop;
-		SplitAAEdges(vertexes[curr.id].p, edgesAA, edgesLeft, edgesRight, edgesBottom, edgesTop);
-
 		// Check the lines to every other vertex
 		for (size_t n = 0; n < vertexes.size(); ++n)
 		{
@@ -763,12 +930,33 @@ void CCmpPathfinder::ComputeShortPath(const IObstructionTestFilter& filter,
 				}
 			}
 
-			bool visible =
-				CheckVisibilityLeft(vertexes[curr.id].p, npos, edgesLeft) &&
-				CheckVisibilityRight(vertexes[curr.id].p, npos, edgesRight) &&
-				CheckVisibilityBottom(vertexes[curr.id].p, npos, edgesBottom) &&
-				CheckVisibilityTop(vertexes[curr.id].p, npos, edgesTop) &&
-				CheckVisibility(vertexes[curr.id].p, npos, edges);
+			// Only test the edges near the ray
+			CFixedVector2D a = vertexes[curr.id].p;
+			CFixedVector2D abn = (npos - a).Perpendicular();
+			bool visible = true;
+
+			bucketsAA.GetNearRay(a, npos, nearEdges);
+			for (size_t k = 0; k < nearEdges.size(); ++k)
+			{
+				if (SquareBlocksRay(a, npos, abn, edgesAA[nearEdges[k]]))
+				{
+					visible = false;
+					break;
+				}
+			}
+
+			if (visible)
+			{
+				buckets.GetNearRay(a, npos, nearEdges);
+				for (size_t k = 0; k < nearEdges.size(); ++k)
+				{
+					if (EdgeBlocksRay(a, npos, abn, edges[nearEdges[k]]))
+					{
+						visible = false;
+						break;
+					}
+				}
+			}
 
 			/*
 			// Render the edges that we examine
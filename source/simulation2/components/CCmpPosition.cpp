@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -40,8 +40,13 @@ class CCmpPosition : public ICmpPosition
 public:
 	static void ClassInit(CComponentManager& componentManager)
 	{
-		componentManager.SubscribeToMessageType(MT_TurnStart);
-		componentManager.SubscribeToMessageType(MT_Interpolate);
+		// These handlers only update this component's own state, and there are lots
+		// of positions, so allow them to run in parallel
+		componentManager.SubscribeToMessageTypeParallel(MT_TurnStart);
+		componentManager.SubscribeToMessageTypeParallel(MT_Interpolate);
+
+		// The interpolated transform follows the ground, so needs recomputing when it changes
+		componentManager.SubscribeGloballyToMessageType(MT_TerrainChanged);
 
 		// TODO: if this component turns out to be a performance issue, it should
 		// be optimised by creating a new PositionStatic component that doesn't subscribe
@@ -75,6 +80,14 @@ public:
 	entity_angle_t m_RotX, m_RotY, m_RotZ;
 	float m_InterpolatedRotY; // not serialized
 
+	// Cache of the last interpolated transform, which is only kept while the entity
+	// is stationary (most buildings, trees and idle units) since then the transform
+	// is the same every frame (not serialized)
+	bool m_CachedTransformValid;
+	bool m_CachedForceFloating;
+	float m_CachedWaterLevel; // water level the cached transform used, if it's floating
+	CMatrix3D m_CachedTransform;
+
 	static std::string GetSchema()
 	{
 		return
@@ -123,6 +136,8 @@ public:
 
 		m_RotX = m_RotY = m_RotZ = entity_angle_t::FromInt(0);
 		m_InterpolatedRotY = 0;
+
+		m_CachedTransformValid = false;
 	}
 
 	virtual void Deinit()
@@ -181,6 +196,7 @@ public:
 		// TODO: should there be range checks on all these values?
 
 		m_InterpolatedRotY = m_RotY.ToFloat();
+		m_CachedTransformValid = false;
 	}
 
 	virtual bool IsInWorld()
@@ -191,6 +207,7 @@ public:
 	virtual void MoveOutOfWorld()
 	{
 		m_InWorld = false;
+		m_CachedTransformValid = false;
 
 		AdvertisePositionChanges();
 	}
@@ -199,6 +216,7 @@ public:
 	{
 		m_X = x;
 		m_Z = z;
+		m_CachedTransformValid = false;
 
 		if (!m_InWorld)
 		{
@@ -215,6 +233,7 @@ public:
 		m_LastX = m_PrevX = m_X = x;
 		m_LastZ = m_PrevZ = m_Z = z;
 		m_InWorld = true;
+		m_CachedTransformValid = false;
 
 		AdvertisePositionChanges();
 	}
@@ -223,6 +242,7 @@ public:
 	{
 		m_YOffset = dy;
 		m_RelativeToGround = true;
+		m_CachedTransformValid = false;
 
 		AdvertisePositionChanges();
 	}
@@ -236,6 +256,7 @@ public:
 	{
 		m_YOffset = y;
 		m_RelativeToGround = false;
+		m_CachedTransformValid = false;
 	}
 
 	virtual bool IsFloating()
@@ -328,6 +349,7 @@ public:
 	{
 		m_RotY = y;
 		m_InterpolatedRotY = m_RotY.ToFloat();
+		m_CachedTransformValid = false;
 
 		AdvertisePositionChanges();
 	}
@@ -336,6 +358,7 @@ public:
 	{
 		m_RotX = x;
 		m_RotZ = z;
+		m_CachedTransformValid = false;
 
 		AdvertisePositionChanges();
 	}
@@ -383,6 +406,20 @@ public:
 		float x, z, rotY;
 		GetInterpolatedPosition2D(frameOffset, x, z, rotY);
 
+		// The water level can change without any message, so floating entities
+		// have to check it's still the one their cached transform used
+		const bool floating = m_RelativeToGround && (m_Floating || forceFloating);
+		float waterLevel = 0;
+		if (floating)
+		{
+			CmpPtr<ICmpWaterManager> cmpWaterManager(GetSimContext(), SYSTEM_ENTITY);
+			if (cmpWaterManager)
+				waterLevel = cmpWaterManager->GetExactWaterLevel(x, z);
+		}
+
+		if (m_CachedTransformValid && m_CachedForceFloating == forceFloating && (!floating || m_CachedWaterLevel == waterLevel))
+			return m_CachedTransform;
+
 		float baseY = 0;
 		if (m_RelativeToGround)
 		{
@@ -390,12 +427,8 @@ public:
 			if (cmpTerrain)
 				baseY = cmpTerrain->GetExactGroundLevel(x, z);
 
-			if (m_Floating || forceFloating)
-			{
-				CmpPtr<ICmpWaterManager> cmpWaterManager(GetSimContext(), SYSTEM_ENTITY);
-				if (cmpWaterManager)
-					baseY = std::max(baseY, cmpWaterManager->GetExactWaterLevel(x, z));
-			}
+			if (floating)
+				baseY = std::max(baseY, waterLevel);
 		}
 
 		float y = baseY + m_YOffset.ToFloat();
@@ -420,6 +453,15 @@ public:
 		mXZ = m * mXZ;
 		mXZ.Translate(CVector3D(x, y, z));
 
+		// If it's not moving, the interpolated position is the same for any frameOffset
+		if (m_X == m_LastX && m_Z == m_LastZ)
+		{
+			m_CachedTransformValid = true;
+			m_CachedForceFloating = forceFloating;
+			m_CachedWaterLevel = waterLevel;
+			m_CachedTransform = mXZ;
+		}
+
 		return mXZ;
 	}
 
@@ -431,7 +473,11 @@ public:
 		{
 			const CMessageInterpolate& msgData = static_cast<const CMessageInterpolate&> (msg);
 
+			// Most entities aren't turning, so there's nothing to update
 			float rotY = m_RotY.ToFloat();
+			if (rotY == m_InterpolatedRotY)
+				break;
+
 			float delta = rotY - m_InterpolatedRotY;
 			// Wrap delta to -M_PI..M_PI
 			delta = fmodf(delta + (float)M_PI, 2*(float)M_PI); // range -2PI..2PI
@@ -442,6 +488,7 @@ public:
 			// Calculate new orientation, in a peculiar way in order to make sure the
 			// result gets close to m_orientation (rather than being n*2*M_PI out)
 			m_InterpolatedRotY = rotY + deltaClamped - delta;
+			m_CachedTransformValid = false;
 
 			break;
 		}
@@ -456,6 +503,11 @@ public:
 
 			break;
 		}
+		case MT_TerrainChanged:
+		{
+			m_CachedTransformValid = false;
+			break;
+		}
 		}
 	}
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -38,9 +38,16 @@
 #include "ps/CLogger.h"
 #include "renderer/Scene.h"
 
+#if HAVE_SSE2
+# include <emmintrin.h>
+#endif
+
 // Time (in seconds) before projectiles that stuck in the ground are destroyed
 const static float PROJECTILE_DECAY_TIME = 30.f;
 
+// Maximum number of units kept around for reuse per projectile actor
+const static size_t MAX_POOLED_UNITS = 128;
+
 class CCmpProjectileManager : public ICmpProjectileManager
 {
 public:
@@ -61,6 +68,7 @@ public:
 	{
 		m_ActorSeed = 0;
 		m_NextId = 1;
+		m_NumMoving = 0;
 	}
 
 	virtual void Deinit()
@@ -68,6 +76,14 @@ public:
 		for (size_t i = 0; i < m_Projectiles.size(); ++i)
 			GetSimContext().GetUnitManager().DeleteUnit(m_Projectiles[i].unit);
 		m_Projectiles.clear();
+		for (size_t f = 0; f < NUM_FIELDS; ++f)
+			m_Fields[f].clear();
+		m_NumMoving = 0;
+
+		for (UnitPoolMap::iterator it = m_UnitPool.begin(); it != m_UnitPool.end(); ++it)
+			for (size_t i = 0; i < it->second.size(); ++i)
+				GetSimContext().GetUnitManager().DeleteUnit(it->second[i]);
+		m_UnitPool.clear();
 	}
 
 	virtual void Serialize(ISerializer& serialize)
@@ -115,19 +131,40 @@ public:
 	virtual void RemoveProjectile(uint32_t);
 
 private:
+	typedef std::map<std::wstring, std::vector<CUnit*> > UnitPoolMap;
+
 	struct Projectile
 	{
 		CUnit* unit;
-		CVector3D pos;
-		CVector3D target;
-		float timeLeft;
-		float speedFactor;
-		float gravity;
-		bool stopped;
+		std::vector<CUnit*>* pool; // where to return the unit when the projectile is removed
 		uint32_t id;
 	};
 
+	/**
+	 * The motion state of the projectiles is stored as one array per field (indexed the same as
+	 * m_Projectiles) rather than in Projectile, so it can be advanced several projectiles at a time.
+	 */
+	enum Field
+	{
+		POS_X, POS_Y, POS_Z,
+		TARGET_X, TARGET_Y, TARGET_Z,
+		DELTA_X, DELTA_Y, DELTA_Z, // movement in the latest step, used to orient the model
+		TIME_LEFT,
+		SPEED_FACTOR,
+		GRAVITY,
+		NUM_FIELDS
+	};
+
 	std::vector<Projectile> m_Projectiles;
+	std::vector<float> m_Fields[NUM_FIELDS];
+
+	// Projectiles [0, m_NumMoving) are still moving; the rest have stopped in the ground
+	// and are just waiting to decay
+	size_t m_NumMoving;
+
+	// Units of removed projectiles, by actor name, so volleys of arrows don't have to keep
+	// constructing and destroying units and their models
+	UnitPoolMap m_UnitPool;
 
 	uint32_t m_ActorSeed;
 	
@@ -135,7 +172,19 @@ private:
 
 	uint32_t LaunchProjectile(entity_id_t source, CFixedVector3D targetPoint, fixed speed, fixed gravity);
 
-	void AdvanceProjectile(Projectile& projectile, float dt);
+	/**
+	 * Moves all the moving projectiles along their ballistic curves.
+	 */
+	void AdvanceProjectiles(float dt);
+
+	/**
+	 * Rotates and moves projectile @p i's model to match its position and latest step.
+	 */
+	void UpdateTransform(size_t i);
+
+	void SwapProjectiles(size_t a, size_t b);
+
+	void RemoveProjectileAt(size_t i);
 
 	void Interpolate(float frameTime);
 
@@ -183,8 +232,18 @@ uint32_t CCmpProjectileManager::LaunchProjectile(entity_id_t source, CFixedVecto
     targetVec = CVector3D(targetPoint);
 
 	Projectile projectile;
-	std::set<CStr> selections;
-	projectile.unit = GetSimContext().GetUnitManager().CreateUnit(name, m_ActorSeed++, selections);
+	projectile.pool = &m_UnitPool[name];
+	if (!projectile.pool->empty())
+	{
+		// Reuse the unit of an old projectile with the same actor
+		projectile.unit = projectile.pool->back();
+		projectile.pool->pop_back();
+	}
+	else
+	{
+		std::set<CStr> selections;
+		projectile.unit = GetSimContext().GetUnitManager().CreateUnit(name, m_ActorSeed++, selections);
+	}
 	projectile.id = currentId;
 	if (!projectile.unit)
 	{
@@ -192,73 +251,150 @@ uint32_t CCmpProjectileManager::LaunchProjectile(entity_id_t source, CFixedVecto
 		return 0;
 	}
 
-	projectile.pos = sourceVec;
-	projectile.target = targetVec;
-
-	CVector3D offset = projectile.target - projectile.pos;
+	CVector3D offset = targetVec - sourceVec;
 	float horizDistance = sqrtf(offset.X*offset.X + offset.Z*offset.Z);
 
-	projectile.speedFactor = 1.f;
-	projectile.timeLeft = horizDistance / speed.ToFloat();
-	projectile.stopped = false;
-
-	projectile.gravity = gravity.ToFloat();
-
+	// Add it to the end of the moving projectiles
 	m_Projectiles.push_back(projectile);
+	m_Fields[POS_X].push_back(sourceVec.X);
+	m_Fields[POS_Y].push_back(sourceVec.Y);
+	m_Fields[POS_Z].push_back(sourceVec.Z);
+	m_Fields[TARGET_X].push_back(targetVec.X);
+	m_Fields[TARGET_Y].push_back(targetVec.Y);
+	m_Fields[TARGET_Z].push_back(targetVec.Z);
+	m_Fields[DELTA_X].push_back(0.f);
+	m_Fields[DELTA_Y].push_back(1.f);
+	m_Fields[DELTA_Z].push_back(0.f);
+	m_Fields[TIME_LEFT].push_back(horizDistance / speed.ToFloat());
+	m_Fields[SPEED_FACTOR].push_back(1.f);
+	m_Fields[GRAVITY].push_back(gravity.ToFloat());
+	SwapProjectiles(m_NumMoving, m_Projectiles.size() - 1);
+	++m_NumMoving;
 	
 	return projectile.id;
 }
 
-void CCmpProjectileManager::AdvanceProjectile(Projectile& projectile, float dt)
+void CCmpProjectileManager::SwapProjectiles(size_t a, size_t b)
 {
-	// Do special processing if we've already reached the target
-	if (projectile.timeLeft <= 0)
-	{
-		if (projectile.stopped)
-		{
-			projectile.timeLeft -= dt;
-			return;
-		}
-		// else continue moving the projectile
+	if (a == b)
+		return;
 
-		// To prevent arrows going crazily far after missing the target,
-		// apply a bit of drag to them
-		projectile.speedFactor *= powf(1.0f - 0.4f*projectile.speedFactor, dt);
+	std::swap(m_Projectiles[a], m_Projectiles[b]);
+	for (size_t f = 0; f < NUM_FIELDS; ++f)
+		std::swap(m_Fields[f][a], m_Fields[f][b]);
+}
+
+void CCmpProjectileManager::RemoveProjectileAt(size_t i)
+{
+	// Move it to the end of the list, keeping the moving projectiles before the stopped ones
+	if (i < m_NumMoving)
+	{
+		SwapProjectiles(i, m_NumMoving - 1);
+		i = --m_NumMoving;
 	}
+	SwapProjectiles(i, m_Projectiles.size() - 1);
 
-	CVector3D offset = (projectile.target - projectile.pos) * projectile.speedFactor;
+	Projectile& projectile = m_Projectiles.back();
+	if (projectile.pool->size() < MAX_POOLED_UNITS)
+		projectile.pool->push_back(projectile.unit);
+	else
+		GetSimContext().GetUnitManager().DeleteUnit(projectile.unit);
+
+	m_Projectiles.pop_back();
+	for (size_t f = 0; f < NUM_FIELDS; ++f)
+		m_Fields[f].pop_back();
+}
+
+void CCmpProjectileManager::AdvanceProjectiles(float dt)
+{
+	const size_t n = m_NumMoving;
+	if (n == 0)
+		return;
+
+	float* posX = &m_Fields[POS_X][0];
+	float* posY = &m_Fields[POS_Y][0];
+	float* posZ = &m_Fields[POS_Z][0];
+	const float* targetX = &m_Fields[TARGET_X][0];
+	const float* targetY = &m_Fields[TARGET_Y][0];
+	const float* targetZ = &m_Fields[TARGET_Z][0];
+	float* deltaX = &m_Fields[DELTA_X][0];
+	float* deltaY = &m_Fields[DELTA_Y][0];
+	float* deltaZ = &m_Fields[DELTA_Z][0];
+	float* timeLeft = &m_Fields[TIME_LEFT][0];
+	float* speedFactor = &m_Fields[SPEED_FACTOR][0];
+	const float* gravity = &m_Fields[GRAVITY][0];
+
+	// To prevent arrows going crazily far after missing the target,
+	// apply a bit of drag to the ones that have passed it
+	for (size_t i = 0; i < n; ++i)
+		if (timeLeft[i] <= 0)
+			speedFactor[i] *= powf(1.0f - 0.4f*speedFactor[i], dt);
 
 	// Compute the vertical velocity that's needed so we travel in a ballistic curve and
-	// reach the target after timeLeft.
+	// reach the target after timeLeft, and move an appropriate fraction towards the target.
 	// (This is just a linear approximation to the curve, but it'll converge to hit the target)
-	float vh = (projectile.gravity / 2.f) * projectile.timeLeft + offset.Y / projectile.timeLeft;
-
-	// Move an appropriate fraction towards the target
-	CVector3D delta (offset.X * dt/projectile.timeLeft, vh * dt, offset.Z * dt/projectile.timeLeft);
+	size_t i = 0;
 
-	projectile.pos += delta;
-	projectile.timeLeft -= dt;
+#if HAVE_SSE2
+	const __m128 vdt = _mm_set1_ps(dt);
+	const __m128 vhalf = _mm_set1_ps(0.5f);
+	const __m128 vone = _mm_set1_ps(1.f);
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 t = _mm_loadu_ps(&timeLeft[i]);
+		__m128 sf = _mm_loadu_ps(&speedFactor[i]);
+		__m128 px = _mm_loadu_ps(&posX[i]);
+		__m128 py = _mm_loadu_ps(&posY[i]);
+		__m128 pz = _mm_loadu_ps(&posZ[i]);
+
+		__m128 offX = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&targetX[i]), px), sf);
+		__m128 offY = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&targetY[i]), py), sf);
+		__m128 offZ = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&targetZ[i]), pz), sf);
+
+		__m128 invT = _mm_div_ps(vone, t);
+		__m128 vh = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(&gravity[i]), vhalf), t), _mm_mul_ps(offY, invT));
+
+		__m128 dx = _mm_mul_ps(_mm_mul_ps(offX, vdt), invT);
+		__m128 dy = _mm_mul_ps(vh, vdt);
+		__m128 dz = _mm_mul_ps(_mm_mul_ps(offZ, vdt), invT);
+
+		_mm_storeu_ps(&deltaX[i], dx);
+		_mm_storeu_ps(&deltaY[i], dy);
+		_mm_storeu_ps(&deltaZ[i], dz);
+		_mm_storeu_ps(&posX[i], _mm_add_ps(px, dx));
+		_mm_storeu_ps(&posY[i], _mm_add_ps(py, dy));
+		_mm_storeu_ps(&posZ[i], _mm_add_ps(pz, dz));
+		_mm_storeu_ps(&timeLeft[i], _mm_sub_ps(t, vdt));
+	}
+#endif
 
-	// If we've passed the target position and haven't stopped yet,
-	// carry on until we reach solid land
-	if (projectile.timeLeft <= 0)
+	for (; i < n; ++i)
 	{
-		CmpPtr<ICmpTerrain> cmpTerrain(GetSimContext(), SYSTEM_ENTITY);
-		if (cmpTerrain)
-		{
-			float h = cmpTerrain->GetExactGroundLevel(projectile.pos.X, projectile.pos.Z);
-			if (projectile.pos.Y < h)
-			{
-				projectile.pos.Y = h; // stick precisely to the terrain
-				projectile.stopped = true;
-			}
-		}
+		float t = timeLeft[i];
+		float offX = (targetX[i] - posX[i]) * speedFactor[i];
+		float offY = (targetY[i] - posY[i]) * speedFactor[i];
+		float offZ = (targetZ[i] - posZ[i]) * speedFactor[i];
+
+		float invT = 1.f / t;
+		float vh = (gravity[i] * 0.5f) * t + offY * invT;
+
+		deltaX[i] = offX * dt * invT;
+		deltaY[i] = vh * dt;
+		deltaZ[i] = offZ * dt * invT;
+		posX[i] += deltaX[i];
+		posY[i] += deltaY[i];
+		posZ[i] += deltaZ[i];
+		timeLeft[i] = t - dt;
 	}
+}
 
-	// Construct a rotation matrix so that (0,1,0) is in the direction of 'delta'
+void CCmpProjectileManager::UpdateTransform(size_t i)
+{
+	// Construct a rotation matrix so that (0,1,0) is in the direction of the latest step
 
 	CVector3D up(0, 1, 0);
 
+	CVector3D delta(m_Fields[DELTA_X][i], m_Fields[DELTA_Y][i], m_Fields[DELTA_Z][i]);
 	delta.Normalize();
 	CVector3D axis = up.Cross(delta);
 	if (axis.LengthSquared() < 0.0001f)
@@ -274,17 +410,47 @@ void CCmpProjectileManager::AdvanceProjectile(Projectile& projectile, float dt)
 	quat.ToMatrix(transform);
 
 	// Then apply the translation
-	transform.Translate(projectile.pos);
+	transform.Translate(CVector3D(m_Fields[POS_X][i], m_Fields[POS_Y][i], m_Fields[POS_Z][i]));
 
 	// Move the model
-	projectile.unit->GetModel().SetTransform(transform);
+	m_Projectiles[i].unit->GetModel().SetTransform(transform);
 }
 
 void CCmpProjectileManager::Interpolate(float frameTime)
 {
-	for (size_t i = 0; i < m_Projectiles.size(); ++i)
+	// Stopped projectiles don't move, so they only need their time updated
+	for (size_t i = m_NumMoving; i < m_Projectiles.size(); ++i)
+		m_Fields[TIME_LEFT][i] -= frameTime;
+
+	AdvanceProjectiles(frameTime);
+
+	CmpPtr<ICmpTerrain> cmpTerrain(GetSimContext(), SYSTEM_ENTITY);
+
+	for (size_t i = 0; i < m_NumMoving; )
 	{
-		AdvanceProjectile(m_Projectiles[i], frameTime);
+		// If we've passed the target position and haven't stopped yet,
+		// carry on until we reach solid land
+		bool stopped = false;
+		if (m_Fields[TIME_LEFT][i] <= 0 && cmpTerrain)
+		{
+			float h = cmpTerrain->GetExactGroundLevel(m_Fields[POS_X][i], m_Fields[POS_Z][i]);
+			if (m_Fields[POS_Y][i] < h)
+			{
+				m_Fields[POS_Y][i] = h; // stick precisely to the terrain
+				stopped = true;
+			}
+		}
+
+		UpdateTransform(i);
+
+		if (stopped)
+		{
+			// Move it to the stopped projectiles, which don't need updating any more
+			SwapProjectiles(i, --m_NumMoving);
+			continue; // don't increment i, since it's now a different projectile
+		}
+
+		++i;
 	}
 
 	// Remove the ones that have reached their target
@@ -292,20 +458,10 @@ void CCmpProjectileManager::Interpolate(float frameTime)
 	{
 		// Projectiles hitting targets get removed immediately.
 		// Those hitting the ground stay for a while, because it looks pretty.
-		if (m_Projectiles[i].timeLeft <= 0.f)
+		if (m_Fields[TIME_LEFT][i] <= -PROJECTILE_DECAY_TIME)
 		{
-			if (m_Projectiles[i].timeLeft > -PROJECTILE_DECAY_TIME)
-			{
-				// Keep the projectile until it exceeds the decay time
-			}
-			else
-			{
-				// Delete in-place by swapping with the last in the list
-				std::swap(m_Projectiles[i], m_Projectiles.back());
-				GetSimContext().GetUnitManager().DeleteUnit(m_Projectiles.back().unit);
-				m_Projectiles.pop_back();
-				continue; // don't increment i
-			}
+			RemoveProjectileAt(i);
+			continue; // don't increment i
 		}
 
 		++i;
@@ -319,10 +475,7 @@ void CCmpProjectileManager::RemoveProjectile(uint32_t id)
 	{
 		if (m_Projectiles[i].id == id)
 		{
-			// Delete in-place by swapping with the last in the list
-			std::swap(m_Projectiles[i], m_Projectiles.back());
-			GetSimContext().GetUnitManager().DeleteUnit(m_Projectiles.back().unit);
-			m_Projectiles.pop_back();
+			RemoveProjectileAt(i);
 			return;
 		}
 	}
@@ -338,8 +491,8 @@ void CCmpProjectileManager::RenderSubmit(SceneCollector& collector, const CFrust
 	for (size_t i = 0; i < m_Projectiles.size(); ++i)
 	{
 		// Don't display projectiles outside the visible area
-		ssize_t posi = (ssize_t)(0.5f + m_Projectiles[i].pos.X / TERRAIN_TILE_SIZE);
-		ssize_t posj = (ssize_t)(0.5f + m_Projectiles[i].pos.Z / TERRAIN_TILE_SIZE);
+		ssize_t posi = (ssize_t)(0.5f + m_Fields[POS_X][i] / TERRAIN_TILE_SIZE);
+		ssize_t posj = (ssize_t)(0.5f + m_Fields[POS_Z][i] / TERRAIN_TILE_SIZE);
 		if (!losRevealAll && !los.IsVisible(posi, posj))
 			continue;
 
@@ -347,11 +500,11 @@ void CCmpProjectileManager::RenderSubmit(SceneCollector& collector, const CFrust
 
 		model.ValidatePosition();
 
-		if (culling && !frustum.IsBoxVisible(CVector3D(0, 0, 0), model.GetWorldBoundsRec()))
-			continue;
-
 		// TODO: do something about LOS (copy from CCmpVisualActor)
 
-		collector.SubmitRecursive(&model);
+		if (culling)
+			collector.SubmitRecursiveCulled(&model, model.GetWorldBoundsRec(), frustum);
+		else
+			collector.SubmitRecursive(&model);
 	}
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -65,6 +65,33 @@ struct SVisibilitySegment
 	}
 };
 
+/**
+ * LOS block (see ICmpRangeManager::GetLosBlockRevision) containing some of a path's nodes, and
+ * its revision at the time the path's visibility segments were computed.
+ */
+struct SLosBlockRevision
+{
+	ssize_t m_BlockI;
+	ssize_t m_BlockJ;
+	u32 m_Revision;
+
+	SLosBlockRevision(ssize_t bi, ssize_t bj, u32 revision)
+		: m_BlockI(bi), m_BlockJ(bj), m_Revision(revision)
+	{}
+
+	bool operator<(const SLosBlockRevision& other) const
+	{
+		if (m_BlockJ != other.m_BlockJ)
+			return m_BlockJ < other.m_BlockJ;
+		return m_BlockI < other.m_BlockI;
+	}
+
+	bool operator==(const SLosBlockRevision& other) const
+	{
+		return (m_BlockI == other.m_BlockI && m_BlockJ == other.m_BlockJ);
+	}
+};
+
 class CCmpRallyPointRenderer : public ICmpRallyPointRenderer
 {
 	// import some types for less verbosity
@@ -97,6 +124,10 @@ protected:
 	std::vector<std::vector<CVector2D> > m_Path;
 	/// Visibility segments of the rally point paths; splits the path into SoD/non-SoD segments.
 	std::deque<std::deque<SVisibilitySegment> > m_VisibilitySegments;
+	/// LOS blocks crossed by each path, as seen when its visibility segments were last computed. The segments (and the overlay
+	/// lines built from them) can only have changed if the LOS state of one of these blocks has changed since.
+	std::vector<std::vector<SLosBlockRevision> > m_PathLosBlocks;
+	player_id_t m_LosPlayer; ///< Displayed player whose LOS the visibility segments were last computed for.
 
 	bool m_Displayed; ///< Should we render the rally points and the path lines? (set from JS when e.g. the unit is selected/deselected)
 	bool m_SmoothPath; ///< Smooth the path before rendering?
@@ -381,6 +412,12 @@ private:
 	 */
 	void GetVisibilitySegments(std::deque<SVisibilitySegment>& out, size_t index);
 
+	/**
+	 * Returns whether the LOS state might have changed anywhere along the path m_Path[index] since its visibility segments
+	 * were last computed by GetVisibilitySegments (in which case they need to be computed again).
+	 */
+	bool HasPathLosChanged(size_t index, CmpPtr<ICmpRangeManager>& cmpRangeMgr);
+
 	/**
 	 * Simplifies the path by removing waypoints that lie between two points that are visible from one another. This is primarily 
 	 * intended to reduce some unnecessary curviness of the path; the pathfinder returns a mathematically (near-)optimal path, which
@@ -411,6 +448,7 @@ void CCmpRallyPointRenderer::Init(const CParamNode& paramNode)
 	m_Displayed = false;
 	m_SmoothPath = true;
 	m_LastOwner = INVALID_PLAYER;
+	m_LosPlayer = INVALID_PLAYER;
 	m_LastMarkerCount = 0;
 	m_EnableDebugNodeOverlay = false;
 
@@ -532,6 +570,7 @@ void CCmpRallyPointRenderer::RecomputeAllRallyPointPaths()
 {
 	m_Path.clear();
 	m_VisibilitySegments.clear();
+	m_PathLosBlocks.clear();
 	m_TexturedOverlayLines.clear();
 
 	//// <DEBUG> ///////////////////////////////////////////////
@@ -867,13 +906,23 @@ void CCmpRallyPointRenderer::UpdateOverlayLines()
 	if (!m_Displayed || !IsSet())
 		return;
 
+	CmpPtr<ICmpRangeManager> cmpRangeMgr(GetSimContext(), SYSTEM_ENTITY);
+	player_id_t currentPlayer = GetSimContext().GetCurrentDisplayedPlayer();
+	bool playerChanged = (currentPlayer != m_LosPlayer);
+	m_LosPlayer = currentPlayer;
+
 	// see if there have been any changes to the SoD by grabbing the visibility edge points and comparing them to the previous ones
+	// (only for paths where the LOS state might have changed, since querying every path node on every turn gets expensive with
+	// many rally points displayed)
 	std::deque<std::deque<SVisibilitySegment> > newVisibilitySegments;
 	for (size_t i = 0; i < m_Path.size(); ++i)
 	{
 		std::deque<SVisibilitySegment> tmp;
 		newVisibilitySegments.push_back(tmp);
-		GetVisibilitySegments(newVisibilitySegments[i], i);
+		if (!playerChanged && i < m_VisibilitySegments.size() && !HasPathLosChanged(i, cmpRangeMgr))
+			newVisibilitySegments[i] = m_VisibilitySegments[i];
+		else
+			GetVisibilitySegments(newVisibilitySegments[i], i);
 	}
 
 	// Check if the full path changed, then reconstruct all overlay lines, otherwise check if a segment changed and update that.
@@ -1080,6 +1129,11 @@ void CCmpRallyPointRenderer::GetVisibilitySegments(std::deque<SVisibilitySegment
 {
 	out.clear();
 
+	if (index >= m_PathLosBlocks.size())
+		m_PathLosBlocks.resize(index + 1);
+	std::vector<SLosBlockRevision>& losBlocks = m_PathLosBlocks[index];
+	losBlocks.clear();
+
 	if (m_Path[index].size() < 2)
 		return;
 
@@ -1091,18 +1145,31 @@ void CCmpRallyPointRenderer::GetVisibilitySegments(std::deque<SVisibilitySegment
 	// go through the path node list, comparing each node's visibility with the previous one. If it changes, end the current segment and start
 	// a new one at the next point.
 
-	bool lastVisible = losQuerier.IsExplored(
-		(fixed::FromFloat(m_Path[index][0].X) / (int) TERRAIN_TILE_SIZE).ToInt_RoundToNearest(),
-		(fixed::FromFloat(m_Path[index][0].Y) / (int) TERRAIN_TILE_SIZE).ToInt_RoundToNearest()
-	);
+	int i0 = (fixed::FromFloat(m_Path[index][0].X) / (int) TERRAIN_TILE_SIZE).ToInt_RoundToNearest();
+	int j0 = (fixed::FromFloat(m_Path[index][0].Y) / (int) TERRAIN_TILE_SIZE).ToInt_RoundToNearest();
+	bool lastVisible = losQuerier.IsExplored(i0, j0);
 	size_t curSegmentStartIndex = 0; // starting node index of the current segment
 
+	// remember which LOS blocks the nodes are in (consecutive nodes are mostly in the same block), so we can skip
+	// recomputing the segments on later turns if none of them changed
+	const ssize_t blockSize = ICmpRangeManager::LOS_DIRTY_BLOCK_SIZE;
+	ssize_t lastBlockI = i0 / blockSize;
+	ssize_t lastBlockJ = j0 / blockSize;
+	losBlocks.push_back(SLosBlockRevision(lastBlockI, lastBlockJ, cmpRangeMgr->GetLosBlockRevision(lastBlockI, lastBlockJ)));
+
 	for (size_t k = 1; k < m_Path[index].size(); ++k)
 	{
 		// grab tile indices for this coord
 		int i = (fixed::FromFloat(m_Path[index][k].X) / (int)TERRAIN_TILE_SIZE).ToInt_RoundToNearest();
 		int j = (fixed::FromFloat(m_Path[index][k].Y) / (int)TERRAIN_TILE_SIZE).ToInt_RoundToNearest();
 
+		if (i / blockSize != lastBlockI || j / blockSize != lastBlockJ)
+		{
+			lastBlockI = i / blockSize;
+			lastBlockJ = j / blockSize;
+			losBlocks.push_back(SLosBlockRevision(lastBlockI, lastBlockJ, cmpRangeMgr->GetLosBlockRevision(lastBlockI, lastBlockJ)));
+		}
+
 		bool nodeVisible = losQuerier.IsExplored(i, j);
 		if (nodeVisible != lastVisible)
 		{
@@ -1120,6 +1187,23 @@ void CCmpRallyPointRenderer::GetVisibilitySegments(std::deque<SVisibilitySegment
 	out.push_back(SVisibilitySegment(lastVisible, curSegmentStartIndex, m_Path[index].size() - 1));
 
 	MergeVisibilitySegments(out);
+
+	std::sort(losBlocks.begin(), losBlocks.end());
+	losBlocks.erase(std::unique(losBlocks.begin(), losBlocks.end()), losBlocks.end());
+}
+
+bool CCmpRallyPointRenderer::HasPathLosChanged(size_t index, CmpPtr<ICmpRangeManager>& cmpRangeMgr)
+{
+	if (index >= m_PathLosBlocks.size())
+		return true;
+
+	const std::vector<SLosBlockRevision>& losBlocks = m_PathLosBlocks[index];
+	for (size_t i = 0; i < losBlocks.size(); ++i)
+	{
+		if (cmpRangeMgr->GetLosBlockRevision(losBlocks[i].m_BlockI, losBlocks[i].m_BlockJ) != losBlocks[i].m_Revision)
+			return true;
+	}
+	return false;
 }
 
 void CCmpRallyPointRenderer::MergeVisibilitySegments(std::deque<SVisibilitySegment>& segments)
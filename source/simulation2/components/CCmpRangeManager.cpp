@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,6 +24,7 @@
 #include "simulation2/components/ICmpPosition.h"
 #include "simulation2/components/ICmpTerritoryManager.h"
 #include "simulation2/components/ICmpVision.h"
+#include "simulation2/helpers/EntityMap.h"
 #include "simulation2/helpers/Render.h"
 #include "simulation2/helpers/Spatial.h"
 
@@ -34,15 +35,22 @@
 #include "ps/CLogger.h"
 #include "ps/Overlay.h"
 #include "ps/Profile.h"
+#include "ps/ThreadPool.h"
 #include "renderer/Scene.h"
 
 #define DEBUG_RANGE_MANAGER_BOUNDS 0
 
+// If enabled, queries that are skipped by the incremental update check
+// are re-run anyway and their results compared against the cached ones
+#define DEBUG_RANGE_MANAGER_INCREMENTAL 0
+
 /**
  * Representation of a range query.
  */
 struct Query
 {
+	Query() : lastEvalStamp(0) { }
+
 	bool enabled;
 	entity_id_t source;
 	entity_pos_t minRange;
@@ -51,6 +59,12 @@ struct Query
 	i32 interface;
 	std::vector<entity_id_t> lastMatch;
 	u8 flagsMask;
+
+	// Incremental update state (not serialized):
+	// lastMatch is known to be up-to-date as of lastEvalStamp (or 0 if it must
+	// be recomputed), provided the source is still at lastEvalPos
+	u32 lastEvalStamp;
+	CFixedVector2D lastEvalPos;
 };
 
 /**
@@ -103,6 +117,95 @@ struct EntityData
 
 cassert(sizeof(EntityData) == 16);
 
+/**
+ * LOS count changes of one player that haven't been applied yet.
+ * Each vertex's change is stored as the difference from the previous vertex's
+ * change in the same row, so adding a whole strip of vertexes only touches its
+ * two ends, and the overlapping circles of units moving together mostly cancel
+ * out before anything is applied.
+ */
+struct LosPendingUpdates
+{
+	std::vector<i16> deltas; // indexed like the counts
+	std::vector<i32> rowMin, rowMax; // range of non-zero deltas in each row (empty if min > max)
+	i32 j0, j1; // range of rows with non-zero deltas
+};
+
+/**
+ * Computes the strips of vertexes inside a circle of vision, one row at a time
+ * from the bottom upwards, for LosUpdateHelper and LosUpdateHelperIncremental.
+ *
+ * Each row's strip is found by moving the ends of the previous row's strip
+ * inwards or outwards until it's the widest that still falls within the circle.
+ * This works on the raw fixed-point values with plain integer arithmetic, but
+ * gives exactly the same strips as testing dy.Square() + dx.Square() <= r.Square()
+ * with entity_pos_t.
+ */
+class LosCircleRasterizer
+{
+public:
+	/**
+	 * @param x, y, r centre and radius of the circle, in tile-space coordinates
+	 */
+	LosCircleRasterizer(entity_pos_t x, entity_pos_t y, entity_pos_t r) :
+		m_X(x.GetInternalValue()), m_Y(y.GetInternalValue()), m_R2(Square(r.GetInternalValue()))
+	{
+		// Compute the integers on either side of x
+		m_XFloor = (x - entity_pos_t::Epsilon()).ToInt_RoundToNegInfinity();
+		m_XCeil = (x + entity_pos_t::Epsilon()).ToInt_RoundToInfinity();
+
+		// Initialise the strip to a rough guess
+		m_I0 = m_XFloor;
+		m_I1 = m_XCeil;
+	}
+
+	/**
+	 * Adjust the strip (i0, i1) to be the outermost values in row @p j that don't
+	 * exceed the circle's radius. Rows must be visited in increasing order.
+	 * The strip is empty (i0 > i1) if the row has no vertexes inside the circle.
+	 */
+	void NextRow(i32 j)
+	{
+		// x is inside iff Square(dx) <= m_R2 - Square(dy); since Square rounds down,
+		// that's the same as the exact dx*dx being less than the bound
+		const i64 dy = ((i64)j << FRACT_BITS) - m_Y;
+		const i64 bound = (m_R2 - Square(dy) + 1) * ((i64)1 << FRACT_BITS);
+
+		// When moving the points inwards, clamp them to xceil+1 or xfloor-1
+		// so they don't accidentally shoot off in the wrong direction forever.
+		while (IsInside(m_I0-1, bound))
+			--m_I0;
+		while (m_I0 < m_XCeil && !IsInside(m_I0, bound))
+			++m_I0;
+		while (IsInside(m_I1+1, bound))
+			++m_I1;
+		while (m_I1 > m_XFloor && !IsInside(m_I1, bound))
+			--m_I1;
+	}
+
+	i32 GetI0() const { return m_I0; }
+	i32 GetI1() const { return m_I1; }
+
+private:
+	static const int FRACT_BITS = 16;
+
+	// Same rounding as CFixed::Square, without the range limits
+	static i64 Square(i64 v)
+	{
+		return (v * v) >> FRACT_BITS;
+	}
+
+	bool IsInside(i32 i, i64 bound) const
+	{
+		const i64 dx = ((i64)i << FRACT_BITS) - m_X;
+		return dx * dx < bound;
+	}
+
+	i64 m_X, m_Y, m_R2;
+	i32 m_XFloor, m_XCeil;
+	i32 m_I0, m_I1;
+};
+
 
 /**
  * Serialization helper template for Query
@@ -118,7 +221,7 @@ struct SerializeQuery
 		serialize.NumberFixed_Unbounded("max range", value.maxRange);
 		serialize.NumberU32_Unbounded("owners mask", value.ownersMask);
 		serialize.NumberI32_Unbounded("interface", value.interface);
-		SerializeVector<SerializeU32_Unbounded>()(serialize, "last match", value.lastMatch);
+		SerializeNumberVector()(serialize, "last match", value.lastMatch);
 		serialize.NumberU8_Unbounded("flagsMask", value.flagsMask);
 	}
 };
@@ -149,7 +252,7 @@ struct SerializeEntityData
  */
 struct EntityDistanceOrdering
 {
-	EntityDistanceOrdering(const std::map<entity_id_t, EntityData>& entities, const CFixedVector2D& source) :
+	EntityDistanceOrdering(const EntityMap<EntityData>& entities, const CFixedVector2D& source) :
 		m_EntityData(entities), m_Source(source)
 	{
 	}
@@ -163,7 +266,7 @@ struct EntityDistanceOrdering
 		return (vecA.CompareLength(vecB) < 0);
 	}
 
-	const std::map<entity_id_t, EntityData>& m_EntityData;
+	const EntityMap<EntityData>& m_EntityData;
 	CFixedVector2D m_Source;
 
 private:
@@ -210,9 +313,32 @@ public:
 	// Range query state:
 	tag_t m_QueryNext; // next allocated id
 	std::map<tag_t, Query> m_Queries;
-	std::map<entity_id_t, EntityData> m_EntityData;
+	EntityMap<EntityData> m_EntityData;
 	SpatialSubdivision<entity_id_t> m_Subdivision; // spatial index of m_EntityData
 
+	/**
+	 * Working state for recomputing an active query in ExecuteActiveQueries.
+	 */
+	struct QueryUpdate
+	{
+		tag_t tag;
+		Query* query;
+		CFixedVector2D pos;
+		std::vector<entity_id_t> result;
+		std::vector<entity_id_t> added;
+		std::vector<entity_id_t> removed;
+	};
+	std::vector<QueryUpdate> m_QueryUpdates; // reused across turns to avoid allocations (not serialized)
+	std::vector<std::pair<entity_id_t, size_t> > m_ChangedQueryUpdates; // (source, index into m_QueryUpdates); likewise
+
+	// Don't bother using the thread pool unless there's enough work to share out
+	static const size_t MIN_PARALLEL_QUERY_UPDATES = 32;
+
+	// Incremental query state (not serialized, since it's only used to skip
+	// work that would give the same results):
+	u32 m_QueryStamp; // incremented after every ExecuteActiveQueries
+	u32 m_LatestChangeStamp; // stamp of the most recent change to any entity in the world
+
 	// LOS state:
 
 	std::map<player_id_t, bool> m_LosRevealAll;
@@ -231,13 +357,31 @@ public:
 	std::vector<u32> m_LosState;
 	static const player_id_t MAX_LOS_PLAYER_ID = 16;
 
-	// Special static visibility data for the "reveal whole map" mode
-	// (TODO: this is usually a waste of memory)
+	// Special static visibility data for the "reveal whole map" mode.
+	// Only computed when a querier for a player with reveal-all is first requested,
+	// since it's not needed at all in most games (not serialized).
 	std::vector<u32> m_LosStateRevealed;
 
 	// Shared LOS masks, one per player.
 	std::map<player_id_t, u32> m_SharedLosMasks;
 
+	// Blocks of vertexes whose LOS state might have changed since the last
+	// GetAndClearLosDirtyBlocks (not serialized, since it's only for the renderer)
+	std::vector<u8> m_LosDirtyBlocks;
+	i32 m_LosDirtyBlocksPerSide;
+
+	// Value of m_LosRevision when each block was last marked dirty, for
+	// GetLosBlockRevision (not serialized either)
+	std::vector<u32> m_LosBlockRevisions;
+	u32 m_LosRevision;
+
+	// LOS count changes that haven't been applied yet, per player (starting with player 0),
+	// so that the changes from all the entities that moved at once are applied together.
+	// Always empty when serializing (not serialized).
+	std::vector<LosPendingUpdates> m_LosPending;
+	u32 m_LosPendingStrips; // number of strips added to m_LosPending
+	static const u32 MAX_LOS_PENDING_STRIPS = 16384; // must be below the i16 deltas' range
+
 	static std::string GetSchema()
 	{
 		return "<a:component type='system'/><empty/>";
@@ -247,6 +391,9 @@ public:
 	{
 		m_QueryNext = 1;
 
+		m_QueryStamp = 1;
+		m_LatestChangeStamp = 0;
+
 		m_DebugOverlayEnabled = false;
 		m_DebugOverlayDirty = true;
 
@@ -266,6 +413,9 @@ public:
 
 		m_LosCircular = false;
 		m_TerrainVerticesPerSide = 0;
+		m_LosDirtyBlocksPerSide = 0;
+		m_LosRevision = 0;
+		m_LosPendingStrips = 0;
 
 		m_TerritoriesDirtyID = 0;
 	}
@@ -284,7 +434,7 @@ public:
 
 		serialize.NumberU32_Unbounded("query next", m_QueryNext);
 		SerializeMap<SerializeU32_Unbounded, SerializeQuery>()(serialize, "queries", m_Queries);
-		SerializeMap<SerializeU32_Unbounded, SerializeEntityData>()(serialize, "entity data", m_EntityData);
+		SerializeEntityMap<SerializeEntityData>()(serialize, "entity data", m_EntityData);
 
 		SerializeMap<SerializeI32_Unbounded, SerializeBool>()(serialize, "los reveal all", m_LosRevealAll);
 		serialize.Bool("los circular", m_LosCircular);
@@ -294,13 +444,15 @@ public:
 		// since they can be recomputed from the entity data when deserializing;
 		// m_LosState must be serialized since it depends on the history of exploration
 
-		SerializeVector<SerializeU32_Unbounded>()(serialize, "los state", m_LosState);
+		SerializeNumberVector()(serialize, "los state", m_LosState);
 
 		SerializeMap<SerializeI32_Unbounded, SerializeU32_Unbounded>()(serialize, "shared los masks", m_SharedLosMasks);
 	}
 
 	virtual void Serialize(ISerializer& serialize)
 	{
+		FlushLosUpdates();
+
 		SerializeCommon(serialize);
 	}
 
@@ -355,7 +507,7 @@ public:
 			const CMessagePositionChanged& msgData = static_cast<const CMessagePositionChanged&> (msg);
 			entity_id_t ent = msgData.entity;
 
-			std::map<entity_id_t, EntityData>::iterator it = m_EntityData.find(ent);
+			EntityMap<EntityData>::iterator it = m_EntityData.find(ent);
 
 			// Ignore if we're not already tracking this entity
 			if (it == m_EntityData.end())
@@ -369,12 +521,15 @@ public:
 					CFixedVector2D to(msgData.x, msgData.z);
 					m_Subdivision.Move(ent, from, to);
 					LosMove(it->second.owner, it->second.visionRange, from, to);
+					MarkQueriesDirty(from);
+					MarkQueriesDirty(to);
 				}
 				else
 				{
 					CFixedVector2D to(msgData.x, msgData.z);
 					m_Subdivision.Add(ent, to);
 					LosAdd(it->second.owner, it->second.visionRange, to);
+					MarkQueriesDirty(to);
 				}
 
 				it->second.inWorld = 1;
@@ -388,6 +543,7 @@ public:
 					CFixedVector2D from(it->second.x, it->second.z);
 					m_Subdivision.Remove(ent, from);
 					LosRemove(it->second.owner, it->second.visionRange, from);
+					MarkQueriesDirty(from);
 				}
 
 				it->second.inWorld = 0;
@@ -402,7 +558,7 @@ public:
 			const CMessageOwnershipChanged& msgData = static_cast<const CMessageOwnershipChanged&> (msg);
 			entity_id_t ent = msgData.entity;
 
-			std::map<entity_id_t, EntityData>::iterator it = m_EntityData.find(ent);
+			EntityMap<EntityData>::iterator it = m_EntityData.find(ent);
 
 			// Ignore if we're not already tracking this entity
 			if (it == m_EntityData.end())
@@ -413,6 +569,7 @@ public:
 				CFixedVector2D pos(it->second.x, it->second.z);
 				LosRemove(it->second.owner, it->second.visionRange, pos);
 				LosAdd(msgData.to, it->second.visionRange, pos);
+				MarkQueriesDirty(pos);
 			}
 
 			ENSURE(-128 <= msgData.to && msgData.to <= 127);
@@ -425,14 +582,17 @@ public:
 			const CMessageDestroy& msgData = static_cast<const CMessageDestroy&> (msg);
 			entity_id_t ent = msgData.entity;
 
-			std::map<entity_id_t, EntityData>::iterator it = m_EntityData.find(ent);
+			EntityMap<EntityData>::iterator it = m_EntityData.find(ent);
 
 			// Ignore if we're not already tracking this entity
 			if (it == m_EntityData.end())
 				break;
 
 			if (it->second.inWorld)
+			{
 				m_Subdivision.Remove(ent, CFixedVector2D(it->second.x, it->second.z));
+				MarkQueriesDirty(CFixedVector2D(it->second.x, it->second.z));
+			}
 
 			// This will be called after Ownership's OnDestroy, so ownership will be set
 			// to -1 already and we don't have to do a LosRemove here
@@ -447,7 +607,7 @@ public:
 			const CMessageVisionRangeChanged& msgData = static_cast<const CMessageVisionRangeChanged&> (msg);
 			entity_id_t ent = msgData.entity;
 
-			std::map<entity_id_t, EntityData>::iterator it = m_EntityData.find(ent);
+			EntityMap<EntityData>::iterator it = m_EntityData.find(ent);
 
 			// Ignore if we're not already tracking this entity
 			if (it == m_EntityData.end())
@@ -509,6 +669,8 @@ public:
 		// Check that calling ResetDerivedData (i.e. recomputing all the state from scratch)
 		// does not affect the incrementally-computed state
 
+		FlushLosUpdates();
+
 		std::vector<std::vector<u16> > oldPlayerCounts = m_LosPlayerCounts;
 		std::vector<u32> oldStateRevealed = m_LosStateRevealed;
 		SpatialSubdivision<entity_id_t> oldSubdivision = m_Subdivision;
@@ -533,7 +695,7 @@ public:
 			}
 			debug_warn(L"inconsistent player counts");
 		}
-		if (oldStateRevealed != m_LosStateRevealed)
+		if (!oldStateRevealed.empty() && oldStateRevealed != GetLosStateRevealed())
 			debug_warn(L"inconsistent revealed");
 		if (oldSubdivision != m_Subdivision)
 			debug_warn(L"inconsistent subdivs");
@@ -547,23 +709,28 @@ public:
 
 		m_LosPlayerCounts.clear();
 		m_LosPlayerCounts.resize(MAX_LOS_PLAYER_ID+1);
+		m_LosPending.clear();
+		m_LosPending.resize(MAX_LOS_PLAYER_ID+1);
+		m_LosPendingStrips = 0;
 		if (!skipLosState)
 		{
 			m_LosState.clear();
 			m_LosState.resize(m_TerrainVerticesPerSide*m_TerrainVerticesPerSide);
 		}
 		m_LosStateRevealed.clear();
-		m_LosStateRevealed.resize(m_TerrainVerticesPerSide*m_TerrainVerticesPerSide);
 
-		for (std::map<entity_id_t, EntityData>::const_iterator it = m_EntityData.begin(); it != m_EntityData.end(); ++it)
+		for (EntityMap<EntityData>::const_iterator it = m_EntityData.begin(); it != m_EntityData.end(); ++it)
 		{
 			if (it->second.inWorld)
 				LosAdd(it->second.owner, it->second.visionRange, CFixedVector2D(it->second.x, it->second.z));
 		}
 
-		for (ssize_t j = 0; j < m_TerrainVerticesPerSide; ++j)
-			for (ssize_t i = 0; i < m_TerrainVerticesPerSide; ++i)
-				m_LosStateRevealed[i + j*m_TerrainVerticesPerSide] = LosIsOffWorld(i, j) ? 0 : 0xFFFFFFFFu;
+		m_LosDirtyBlocksPerSide = (i32)((m_TerrainVerticesPerSide + LOS_DIRTY_BLOCK_SIZE-1) / LOS_DIRTY_BLOCK_SIZE);
+		m_LosDirtyBlocks.resize(m_LosDirtyBlocksPerSide*m_LosDirtyBlocksPerSide);
+		m_LosBlockRevisions.resize(m_LosDirtyBlocksPerSide*m_LosDirtyBlocksPerSide);
+		LosMarkAllDirty();
+
+		FlushLosUpdates();
 	}
 
 	void ResetSubdivisions(entity_pos_t x1, entity_pos_t z1)
@@ -572,11 +739,25 @@ public:
 		// (TODO: find the optimal number instead of blindly guessing)
 		m_Subdivision.Reset(x1, z1, entity_pos_t::FromInt(8*TERRAIN_TILE_SIZE));
 
-		for (std::map<entity_id_t, EntityData>::const_iterator it = m_EntityData.begin(); it != m_EntityData.end(); ++it)
+		for (EntityMap<EntityData>::const_iterator it = m_EntityData.begin(); it != m_EntityData.end(); ++it)
 		{
 			if (it->second.inWorld)
 				m_Subdivision.Add(it->first, CFixedVector2D(it->second.x, it->second.z));
 		}
+
+		// The subdivision stamps have been lost, so every query must be recomputed
+		for (std::map<tag_t, Query>::iterator it = m_Queries.begin(); it != m_Queries.end(); ++it)
+			it->second.lastEvalStamp = 0;
+	}
+
+	/**
+	 * Record that an entity at the given position has changed in a way
+	 * that might affect the results of queries covering that position.
+	 */
+	void MarkQueriesDirty(CFixedVector2D pos)
+	{
+		m_Subdivision.Stamp(pos, m_QueryStamp);
+		m_LatestChangeStamp = m_QueryStamp;
 	}
 
 	virtual tag_t CreateActiveQuery(entity_id_t source,
@@ -611,6 +792,7 @@ public:
 
 		Query& q = it->second;
 		q.enabled = true;
+		q.lastEvalStamp = 0; // lastMatch wasn't being updated while disabled
 	}
 
 	virtual void DisableActiveQuery(tag_t tag)
@@ -673,6 +855,7 @@ public:
 		{
 			// If the source doesn't have a position, then the result is just the empty list
 			q.lastMatch = r;
+			q.lastEvalStamp = 0;
 			return r;
 		}
 
@@ -680,6 +863,11 @@ public:
 
 		q.lastMatch = r;
 
+		// Changes that happen later in this turn will have the current stamp,
+		// so use the previous one to make sure they're not missed
+		q.lastEvalStamp = m_QueryStamp - 1;
+		q.lastEvalPos = cmpSourcePosition->GetPosition2D();
+
 		// Return the list sorted by distance from the entity
 		CFixedVector2D pos = cmpSourcePosition->GetPosition2D();
 		std::stable_sort(r.begin(), r.end(), EntityDistanceOrdering(m_EntityData, pos));
@@ -693,7 +881,7 @@ public:
 
 		u32 ownerMask = CalcOwnerMask(player);
 
-		for (std::map<entity_id_t, EntityData>::const_iterator it = m_EntityData.begin(); it != m_EntityData.end(); ++it)
+		for (EntityMap<EntityData>::const_iterator it = m_EntityData.begin(); it != m_EntityData.end(); ++it)
 		{
 			// Check owner and add to list if it matches
 			if (CalcOwnerMask(it->second.owner) & ownerMask)
@@ -716,12 +904,11 @@ public:
 	 */
 	void ExecuteActiveQueries()
 	{
-		PROFILE3("ExecuteActiveQueries");
-
-		// Store a queue of all messages before sending any, so we can assume
-		// no entities will move until we've finished checking all the ranges
-		std::vector<std::pair<entity_id_t, CMessageRangeUpdate> > messages;
+		PROFILE3_COUNTERS("ExecuteActiveQueries");
 
+		// Find all the queries that might have changed. (Components are only
+		// accessed here, so the rest of the work can be done on other threads)
+		size_t numUpdates = 0;
 		for (std::map<tag_t, Query>::iterator it = m_Queries.begin(); it != m_Queries.end(); ++it)
 		{
 			Query& q = it->second;
@@ -731,36 +918,141 @@ public:
 
 			CmpPtr<ICmpPosition> cmpSourcePosition(GetSimContext(), q.source);
 			if (!cmpSourcePosition || !cmpSourcePosition->IsInWorld())
+			{
+				q.lastEvalStamp = 0;
 				continue;
+			}
 
-			std::vector<entity_id_t> r;
-			r.reserve(q.lastMatch.size());
+			CFixedVector2D pos = cmpSourcePosition->GetPosition2D();
 
-			PerformQuery(q, r);
+			// Skip the query if nothing it could match has changed since it
+			// was last evaluated, since then the results must be the same
+			if (!QueryNeedsUpdate(q, pos))
+			{
+#if DEBUG_RANGE_MANAGER_INCREMENTAL
+				std::vector<entity_id_t> check;
+				PerformQuery(q, check);
+				ENSURE(check == q.lastMatch);
+#endif
+				continue;
+			}
+
+			q.lastEvalStamp = m_QueryStamp;
+			q.lastEvalPos = pos;
+
+			// (Reuse the elements from previous turns, to keep their allocated memory)
+			if (numUpdates == m_QueryUpdates.size())
+				m_QueryUpdates.push_back(QueryUpdate());
+			QueryUpdate& update = m_QueryUpdates[numUpdates++];
+			update.tag = it->first;
+			update.query = &q;
+			update.pos = pos;
+		}
 
-			// Compute the changes vs the last match
-			std::vector<entity_id_t> added;
-			std::vector<entity_id_t> removed;
-			std::set_difference(r.begin(), r.end(), q.lastMatch.begin(), q.lastMatch.end(), std::back_inserter(added));
-			std::set_difference(q.lastMatch.begin(), q.lastMatch.end(), r.begin(), r.end(), std::back_inserter(removed));
+		// Compute the new results. Each query only reads the shared entity data
+		// and writes to its own QueryUpdate, so they can be done in parallel
+		{
+			PROFILE3("update queries");
+
+			UpdateQueriesTask task(*this);
+			if (g_ThreadPool && numUpdates >= MIN_PARALLEL_QUERY_UPDATES)
+				g_ThreadPool->ParallelFor(task, numUpdates);
+			else
+				for (size_t i = 0; i < numUpdates; ++i)
+					task.Run(i);
+		}
+
+		// Store a queue of all messages before sending any, so we can assume
+		// no entities will move until we've finished checking all the ranges.
+		// These are in tag order regardless of how the updates were scheduled,
+		// so the results are deterministic.
+		// (The sources are saved now since handlers may destroy the queries.)
+		m_ChangedQueryUpdates.clear();
 
-			if (added.empty() && removed.empty())
+		for (size_t i = 0; i < numUpdates; ++i)
+		{
+			QueryUpdate& update = m_QueryUpdates[i];
+
+			if (update.added.empty() && update.removed.empty())
 				continue;
 
-			// Return the 'added' list sorted by distance from the entity
-			// (Don't bother sorting 'removed' because they might not even have positions or exist any more)
-			CFixedVector2D pos = cmpSourcePosition->GetPosition2D();
-			std::stable_sort(added.begin(), added.end(), EntityDistanceOrdering(m_EntityData, pos));
+			m_ChangedQueryUpdates.push_back(std::make_pair(update.query->source, i));
 
-			messages.push_back(std::make_pair(q.source, CMessageRangeUpdate(it->first)));
-			messages.back().second.added.swap(added);
-			messages.back().second.removed.swap(removed);
+			update.query->lastMatch.swap(update.result);
+		}
+
+		// Any changes from now on (in particular when the messages are handled)
+		// must be seen by the next update
+		++m_QueryStamp;
 
-			it->second.lastMatch.swap(r);
+		for (size_t i = 0; i < m_ChangedQueryUpdates.size(); ++i)
+		{
+			QueryUpdate& update = m_QueryUpdates[m_ChangedQueryUpdates[i].second];
+
+			// Lend the lists to the message, and take them back afterwards so
+			// their memory gets reused by the next turn's updates
+			CMessageRangeUpdate msg(update.tag);
+			msg.added.swap(update.added);
+			msg.removed.swap(update.removed);
+			GetSimContext().GetComponentManager().PostMessage(m_ChangedQueryUpdates[i].first, msg);
+			msg.added.swap(update.added);
+			msg.removed.swap(update.removed);
 		}
+	}
+
+	/**
+	 * Recomputes the results of a query, and the differences from its
+	 * previous results. Safe to call from any thread.
+	 */
+	void UpdateQuery(QueryUpdate& update)
+	{
+		const Query& q = *update.query;
+
+		update.result.clear();
+		update.result.reserve(q.lastMatch.size());
+		update.added.clear();
+		update.removed.clear();
 
-		for (size_t i = 0; i < messages.size(); ++i)
-			GetSimContext().GetComponentManager().PostMessage(messages[i].first, messages[i].second);
+		PerformQuery(q, update.pos, update.result);
+
+		// Compute the changes vs the last match
+		std::set_difference(update.result.begin(), update.result.end(), q.lastMatch.begin(), q.lastMatch.end(), std::back_inserter(update.added));
+		std::set_difference(q.lastMatch.begin(), q.lastMatch.end(), update.result.begin(), update.result.end(), std::back_inserter(update.removed));
+
+		// Return the 'added' list sorted by distance from the entity
+		// (Don't bother sorting 'removed' because they might not even have positions or exist any more)
+		std::stable_sort(update.added.begin(), update.added.end(), EntityDistanceOrdering(m_EntityData, update.pos));
+	}
+
+	class UpdateQueriesTask : public CThreadPool::ITask
+	{
+	public:
+		UpdateQueriesTask(CCmpRangeManager& rangeManager) : m_RangeManager(rangeManager) { }
+
+		virtual void Run(size_t index)
+		{
+			m_RangeManager.UpdateQuery(m_RangeManager.m_QueryUpdates[index]);
+		}
+
+	private:
+		CCmpRangeManager& m_RangeManager;
+		NONCOPYABLE(UpdateQueriesTask);
+	};
+
+	/**
+	 * Returns whether the results of an enabled query might have changed since it
+	 * was last evaluated, given the current position of its source.
+	 */
+	bool QueryNeedsUpdate(const Query& q, CFixedVector2D pos)
+	{
+		if (q.lastEvalStamp == 0 || pos != q.lastEvalPos)
+			return true;
+
+		// Queries ignoring distance can be affected by changes anywhere
+		if (q.maxRange == entity_pos_t::FromInt(-1))
+			return m_LatestChangeStamp > q.lastEvalStamp;
+
+		return m_Subdivision.GetLatestStampNear(pos, q.maxRange) > q.lastEvalStamp;
 	}
 
 	/**
@@ -793,18 +1085,30 @@ public:
 
 	/**
 	 * Returns a list of distinct entity IDs that match the given query, sorted by ID.
+	 * 'r' must be empty (but may have reserved capacity, which will be reused).
 	 */
 	void PerformQuery(const Query& q, std::vector<entity_id_t>& r)
 	{
 		CmpPtr<ICmpPosition> cmpSourcePosition(GetSimContext(), q.source);
 		if (!cmpSourcePosition || !cmpSourcePosition->IsInWorld())
 			return;
-		CFixedVector2D pos = cmpSourcePosition->GetPosition2D();
+
+		PerformQuery(q, cmpSourcePosition->GetPosition2D(), r);
+	}
+
+	/**
+	 * Equivalent to PerformQuery(q, r), with the given source position.
+	 * This only reads the range manager's state (and the component manager's
+	 * interface tables), so it can safely be run on several threads at once.
+	 */
+	void PerformQuery(const Query& q, CFixedVector2D pos, std::vector<entity_id_t>& r)
+	{
+		ENSURE(r.empty());
 
 		// Special case: range -1.0 means check all entities ignoring distance
 		if (q.maxRange == entity_pos_t::FromInt(-1))
 		{
-			for (std::map<entity_id_t, EntityData>::const_iterator it = m_EntityData.begin(); it != m_EntityData.end(); ++it)
+			for (EntityMap<EntityData>::const_iterator it = m_EntityData.begin(); it != m_EntityData.end(); ++it)
 			{
 				if (!TestEntityQuery(q, it->first, it->second))
 					continue;
@@ -814,31 +1118,54 @@ public:
 		}
 		else
 		{
-			// Get a quick list of entities that are potentially in range
-			std::vector<entity_id_t> ents = m_Subdivision.GetNear(pos, q.maxRange);
-
-			for (size_t i = 0; i < ents.size(); ++i)
+			// Get a quick list of entities that are potentially in range,
+			// then filter it in-place (to avoid allocating a separate list)
+			m_Subdivision.GetNear(pos, q.maxRange, r);
+
+			// The precise distance checks are done in batches (on the stack),
+			// so they can use the SIMD CompareLengths
+			const size_t BATCH_SIZE = 64;
+			entity_id_t ids[BATCH_SIZE];
+			CFixedVector2D offsets[BATCH_SIZE];
+			int distVsMax[BATCH_SIZE];
+			int distVsMin[BATCH_SIZE];
+
+			size_t numMatches = 0;
+			size_t i = 0;
+			while (i < r.size())
 			{
-				std::map<entity_id_t, EntityData>::const_iterator it = m_EntityData.find(ents[i]);
-				ENSURE(it != m_EntityData.end());
+				size_t n = 0;
+				for (; i < r.size() && n < BATCH_SIZE; ++i)
+				{
+					EntityMap<EntityData>::const_iterator it = m_EntityData.find(r[i]);
+					ENSURE(it != m_EntityData.end());
 
-				if (!TestEntityQuery(q, it->first, it->second))
-					continue;
+					if (!TestEntityQuery(q, it->first, it->second))
+						continue;
 
-				// Restrict based on precise distance
-				int distVsMax = (CFixedVector2D(it->second.x, it->second.z) - pos).CompareLength(q.maxRange);
-				if (distVsMax > 0)
-					continue;
+					ids[n] = it->first;
+					offsets[n] = CFixedVector2D(it->second.x, it->second.z) - pos;
+					++n;
+				}
 
+				// Restrict based on precise distance
+				CFixedVector2D::CompareLengths(offsets, n, q.maxRange, distVsMax);
 				if (!q.minRange.IsZero())
+					CFixedVector2D::CompareLengths(offsets, n, q.minRange, distVsMin);
+
+				for (size_t j = 0; j < n; ++j)
 				{
-					int distVsMin = (CFixedVector2D(it->second.x, it->second.z) - pos).CompareLength(q.minRange);
-					if (distVsMin < 0)
+					if (distVsMax[j] > 0)
 						continue;
-				}
 
-				r.push_back(it->first);
+					if (!q.minRange.IsZero() && distVsMin[j] < 0)
+						continue;
+
+					// (numMatches <= i, so this never overwrites an unread entity)
+					r[numMatches++] = ids[j];
+				}
 			}
+			r.resize(numMatches);
 		}
 	}
 
@@ -945,7 +1272,7 @@ public:
 	
 	virtual void SetEntityFlag(entity_id_t ent, std::string identifier, bool value)
 	{
-		std::map<entity_id_t, EntityData>::iterator it = m_EntityData.find(ent);
+		EntityMap<EntityData>::iterator it = m_EntityData.find(ent);
 
 		// We don't have this entity
 		if (it == m_EntityData.end())
@@ -964,6 +1291,9 @@ public:
 			it->second.flags |= flag;
 		else
 			it->second.flags &= ~flag;
+
+		if (it->second.inWorld)
+			MarkQueriesDirty(CFixedVector2D(it->second.x, it->second.z));
 	}
 
 	// ****************************************************************
@@ -972,12 +1302,29 @@ public:
 
 	virtual CLosQuerier GetLosQuerier(player_id_t player)
 	{
+		FlushLosUpdates();
+
 		if (GetLosRevealAll(player))
-			return CLosQuerier(0xFFFFFFFFu, m_LosStateRevealed, m_TerrainVerticesPerSide);
+			return CLosQuerier(0xFFFFFFFFu, GetLosStateRevealed(), m_TerrainVerticesPerSide);
 		else
 			return CLosQuerier(GetSharedLosMask(player), m_LosState, m_TerrainVerticesPerSide);
 	}
 
+	/**
+	 * Returns the LOS state for the "reveal whole map" mode, computing it if necessary.
+	 */
+	const std::vector<u32>& GetLosStateRevealed()
+	{
+		if (m_LosStateRevealed.empty())
+		{
+			m_LosStateRevealed.resize(m_TerrainVerticesPerSide*m_TerrainVerticesPerSide);
+			for (ssize_t j = 0; j < m_TerrainVerticesPerSide; ++j)
+				for (ssize_t i = 0; i < m_TerrainVerticesPerSide; ++i)
+					m_LosStateRevealed[i + j*m_TerrainVerticesPerSide] = LosIsOffWorld(i, j) ? 0 : 0xFFFFFFFFu;
+		}
+		return m_LosStateRevealed;
+	}
+
 	virtual ELosVisibility GetLosVisibility(entity_id_t ent, player_id_t player, bool forceRetainInFog)
 	{
 		// (We can't use m_EntityData since this needs to handle LOCAL entities too)
@@ -1002,6 +1349,7 @@ public:
 		}
 
 		// Visible if within a visible region
+		FlushLosUpdates();
 		CLosQuerier los(GetSharedLosMask(player), m_LosState, m_TerrainVerticesPerSide);
 
 		if (los.IsVisible(i, j))
@@ -1022,6 +1370,7 @@ public:
 	virtual void SetLosRevealAll(player_id_t player, bool enabled)
 	{
 		m_LosRevealAll[player] = enabled;
+		LosMarkAllDirty();
 	}
 
 	virtual bool GetLosRevealAll(player_id_t player)
@@ -1056,6 +1405,7 @@ public:
 	virtual void SetSharedLos(player_id_t player, std::vector<player_id_t> players)
 	{
 		m_SharedLosMasks[player] = CalcSharedLosMask(players);
+		LosMarkAllDirty();
 	}
 
 	virtual u32 GetSharedLosMask(player_id_t player)
@@ -1092,6 +1442,53 @@ public:
 				}
 			}
 		}
+
+		LosMarkAllDirty();
+	}
+
+	/**
+	 * Record that the LOS state of the vertexes in the given range (inclusive) might
+	 * have changed.
+	 */
+	void LosMarkDirty(i32 i0, i32 j0, i32 i1, i32 j1)
+	{
+		if (m_LosDirtyBlocks.empty())
+			return;
+
+		const i32 blockSize = (i32)LOS_DIRTY_BLOCK_SIZE;
+		i32 bi0 = std::max(i0, 0) / blockSize;
+		i32 bj0 = std::max(j0, 0) / blockSize;
+		i32 bi1 = std::min(i1 / blockSize, m_LosDirtyBlocksPerSide-1);
+		i32 bj1 = std::min(j1 / blockSize, m_LosDirtyBlocksPerSide-1);
+		++m_LosRevision;
+		for (i32 bj = bj0; bj <= bj1; ++bj)
+		{
+			for (i32 bi = bi0; bi <= bi1; ++bi)
+			{
+				m_LosDirtyBlocks[bi + bj*m_LosDirtyBlocksPerSide] = 1;
+				m_LosBlockRevisions[bi + bj*m_LosDirtyBlocksPerSide] = m_LosRevision;
+			}
+		}
+	}
+
+	void LosMarkAllDirty()
+	{
+		std::fill(m_LosDirtyBlocks.begin(), m_LosDirtyBlocks.end(), 1);
+		++m_LosRevision;
+		std::fill(m_LosBlockRevisions.begin(), m_LosBlockRevisions.end(), m_LosRevision);
+	}
+
+	virtual u32 GetLosBlockRevision(ssize_t bi, ssize_t bj)
+	{
+		if (bi < 0 || bj < 0 || bi >= m_LosDirtyBlocksPerSide || bj >= m_LosDirtyBlocksPerSide)
+			return 0;
+		return m_LosBlockRevisions[bi + bj*m_LosDirtyBlocksPerSide];
+	}
+
+	virtual void GetAndClearLosDirtyBlocks(std::vector<u8>& blocks)
+	{
+		blocks = m_LosDirtyBlocks;
+		std::fill(m_LosDirtyBlocks.begin(), m_LosDirtyBlocks.end(), 0);
 	}
 
 	/**
@@ -1126,53 +1523,115 @@ public:
 	}
 
 	/**
-	 * Update the LOS state of tiles within a given horizontal strip (i0,j) to (i1,j) (inclusive).
+	 * Returns the pending LOS changes of the given player, initialising them if necessary.
 	 */
-	inline void LosAddStripHelper(u8 owner, i32 i0, i32 i1, i32 j, u16* counts)
+	LosPendingUpdates& GetLosPending(u8 owner)
+	{
+		LosPendingUpdates& pending = m_LosPending.at(owner);
+		if (pending.deltas.empty())
+		{
+			pending.deltas.resize(m_TerrainVerticesPerSide*m_TerrainVerticesPerSide);
+			pending.rowMin.resize(m_TerrainVerticesPerSide, m_TerrainVerticesPerSide);
+			pending.rowMax.resize(m_TerrainVerticesPerSide, -1);
+			pending.j0 = m_TerrainVerticesPerSide;
+			pending.j1 = -1;
+		}
+		return pending;
+	}
+
+	/**
+	 * Add @p n (+1 or -1) to the pending LOS counts of the vertexes in
+	 * the horizontal strip (i0,j) to (i1,j) (inclusive).
+	 */
+	inline void LosQueueStrip(LosPendingUpdates& pending, i32 i0, i32 i1, i32 j, i16 n)
 	{
 		if (i1 < i0)
 			return;
 
-		i32 idx0 = j*m_TerrainVerticesPerSide + i0;
-		i32 idx1 = j*m_TerrainVerticesPerSide + i1;
+		// (This never goes past the end of the row since the strips exclude the map's border)
+		i32 idx = j*m_TerrainVerticesPerSide;
+		pending.deltas[idx + i0] += n;
+		pending.deltas[idx + i1 + 1] -= n;
 
-		for (i32 idx = idx0; idx <= idx1; ++idx)
-		{
-			// Increasing from zero to non-zero - move from unexplored/explored to visible+explored
-			if (counts[idx] == 0)
-			{
-				i32 i = i0 + idx - idx0;
-				if (!LosIsOffWorld(i, j))
-					m_LosState[idx] |= ((LOS_VISIBLE | LOS_EXPLORED) << (2*(owner-1)));
-			}
+		pending.rowMin[j] = std::min(pending.rowMin[j], i0);
+		pending.rowMax[j] = std::max(pending.rowMax[j], i1 + 1);
+		pending.j0 = std::min(pending.j0, j);
+		pending.j1 = std::max(pending.j1, j);
 
-			ASSERT(counts[idx] < 65535);
-			counts[idx] = (u16)(counts[idx] + 1); // ignore overflow; the player should never have 64K units
-		}
+		// Each strip changes a delta by at most 1, so apply them before they might overflow
+		if (++m_LosPendingStrips >= MAX_LOS_PENDING_STRIPS)
+			FlushLosUpdates();
 	}
 
 	/**
-	 * Update the LOS state of tiles within a given horizontal strip (i0,j) to (i1,j) (inclusive).
+	 * Apply all the pending LOS changes to the counts, updating the state of vertexes
+	 * that become visible or stop being visible. This must be called before reading
+	 * the LOS state.
 	 */
-	inline void LosRemoveStripHelper(u8 owner, i32 i0, i32 i1, i32 j, u16* counts)
+	void FlushLosUpdates()
 	{
-		if (i1 < i0)
+		if (m_LosPendingStrips == 0)
 			return;
+		m_LosPendingStrips = 0;
 
-		i32 idx0 = j*m_TerrainVerticesPerSide + i0;
-		i32 idx1 = j*m_TerrainVerticesPerSide + i1;
+		PROFILE("FlushLosUpdates");
 
-		for (i32 idx = idx0; idx <= idx1; ++idx)
+		for (u8 owner = 1; owner <= MAX_LOS_PLAYER_ID; ++owner)
 		{
-			ASSERT(counts[idx] > 0);
-			counts[idx] = (u16)(counts[idx] - 1);
+			LosPendingUpdates& pending = m_LosPending[owner];
+			if (pending.j0 > pending.j1)
+				continue;
+
+			std::vector<u16>& counts = m_LosPlayerCounts.at(owner);
+
+			// Lazy initialisation of counts:
+			if (counts.empty())
+				counts.resize(m_TerrainVerticesPerSide*m_TerrainVerticesPerSide);
+
+			u16* countsData = &counts[0];
+			i16* deltasData = &pending.deltas[0];
+			const u32 visibleMask = ((LOS_VISIBLE | LOS_EXPLORED) << (2*(owner-1)));
+			const u32 hiddenMask = ~(LOS_VISIBLE << (2*(owner-1)));
 
-			// Decreasing from non-zero to zero - move from visible+explored to explored
-			if (counts[idx] == 0)
+			for (i32 j = pending.j0; j <= pending.j1; ++j)
 			{
-				// (If LosIsOffWorld then this is a no-op, so don't bother doing the check)
-				m_LosState[idx] &= ~(LOS_VISIBLE << (2*(owner-1)));
+				const i32 i0 = pending.rowMin[j];
+				const i32 i1 = pending.rowMax[j];
+				pending.rowMin[j] = m_TerrainVerticesPerSide;
+				pending.rowMax[j] = -1;
+
+				// Accumulate the deltas along the row to get each vertex's change
+				i32 change = 0;
+				for (i32 i = i0; i <= i1; ++i)
+				{
+					const i32 idx = j*m_TerrainVerticesPerSide + i;
+					change += deltasData[idx];
+					deltasData[idx] = 0;
+					if (change == 0)
+						continue;
+
+					const i32 count = countsData[idx] + change;
+					ASSERT(count >= 0 && count <= 65535);
+
+					// Increasing from zero to non-zero - move from unexplored/explored to visible+explored
+					if (countsData[idx] == 0)
+					{
+						if (!LosIsOffWorld(i, j))
+							m_LosState[idx] |= visibleMask;
+					}
+					// Decreasing from non-zero to zero - move from visible+explored to explored
+					// (If LosIsOffWorld then this is a no-op, so don't bother doing the check)
+					else if (count == 0)
+					{
+						m_LosState[idx] &= hiddenMask;
+					}
+
+					countsData[idx] = (u16)count; // ignore overflow; the player should never have 64K units
+				}
 			}
+
+			pending.j0 = m_TerrainVerticesPerSide;
+			pending.j1 = -1;
 		}
 	}
 
@@ -1189,13 +1648,7 @@ public:
 
 		PROFILE("LosUpdateHelper");
 
-		std::vector<u16>& counts = m_LosPlayerCounts.at(owner);
-
-		// Lazy initialisation of counts:
-		if (counts.empty())
-			counts.resize(m_TerrainVerticesPerSide*m_TerrainVerticesPerSide);
-
-		u16* countsData = &counts[0];
+		LosPendingUpdates& pending = GetLosPending(owner);
 
 		// Compute the circular region as a series of strips.
 		// Rather than quantise pos to vertexes, we do more precise sub-tile computations
@@ -1203,8 +1656,7 @@ public:
 		// at once.
 		// To avoid the cost of sqrt when computing the outline of the circle,
 		// we loop from the bottom to the top and estimate the width of the current
-		// strip based on the previous strip, then adjust each end of the strip
-		// inwards or outwards until it's the widest that still falls within the circle.
+		// strip based on the previous strip (see LosCircleRasterizer).
 
 		// Compute top/bottom coordinates, and clamp to exclude the 1-tile border around the map
 		// (so that we never render the sharp edge of the map)
@@ -1213,39 +1665,24 @@ public:
 		i32 j0clamp = std::max(j0, 1);
 		i32 j1clamp = std::min(j1, m_TerrainVerticesPerSide-2);
 
+		LosMarkDirty(((pos.X - visionRange)/(int)TERRAIN_TILE_SIZE).ToInt_RoundToNegInfinity(), j0clamp,
+			((pos.X + visionRange)/(int)TERRAIN_TILE_SIZE).ToInt_RoundToInfinity(), j1clamp);
+
 		// Translate world coordinates into fractional tile-space coordinates
 		entity_pos_t x = pos.X / (int)TERRAIN_TILE_SIZE;
 		entity_pos_t y = pos.Y / (int)TERRAIN_TILE_SIZE;
 		entity_pos_t r = visionRange / (int)TERRAIN_TILE_SIZE;
-		entity_pos_t r2 = r.Square();
-
-		// Compute the integers on either side of x
-		i32 xfloor = (x - entity_pos_t::Epsilon()).ToInt_RoundToNegInfinity();
-		i32 xceil = (x + entity_pos_t::Epsilon()).ToInt_RoundToInfinity();
-
-		// Initialise the strip (i0, i1) to a rough guess
-		i32 i0 = xfloor;
-		i32 i1 = xceil;
+		LosCircleRasterizer circle(x, y, r);
 
 		for (i32 j = j0clamp; j <= j1clamp; ++j)
 		{
-			// Adjust i0 and i1 to be the outermost values that don't exceed
-			// the circle's radius (i.e. require dy^2 + dx^2 <= r^2).
-			// When moving the points inwards, clamp them to xceil+1 or xfloor-1
-			// so they don't accidentally shoot off in the wrong direction forever.
-
-			entity_pos_t dy = entity_pos_t::FromInt(j) - y;
-			entity_pos_t dy2 = dy.Square();
-			while (dy2 + (entity_pos_t::FromInt(i0-1) - x).Square() <= r2)
-				--i0;
-			while (i0 < xceil && dy2 + (entity_pos_t::FromInt(i0) - x).Square() > r2)
-				++i0;
-			while (dy2 + (entity_pos_t::FromInt(i1+1) - x).Square() <= r2)
-				++i1;
-			while (i1 > xfloor && dy2 + (entity_pos_t::FromInt(i1) - x).Square() > r2)
-				--i1;
+			circle.NextRow(j);
+			i32 i0 = circle.GetI0();
+			i32 i1 = circle.GetI1();
 
 #if DEBUG_RANGE_MANAGER_BOUNDS
+			entity_pos_t r2 = r.Square();
+			entity_pos_t dy2 = (entity_pos_t::FromInt(j) - y).Square();
 			if (i0 <= i1)
 			{
 				ENSURE(dy2 + (entity_pos_t::FromInt(i0) - x).Square() <= r2);
@@ -1259,10 +1696,7 @@ public:
 			// then add or remove the strip as requested
 			i32 i0clamp = std::max(i0, 1);
 			i32 i1clamp = std::min(i1, m_TerrainVerticesPerSide-2);
-			if (adding)
-				LosAddStripHelper(owner, i0clamp, i1clamp, j, countsData);
-			else
-				LosRemoveStripHelper(owner, i0clamp, i1clamp, j, countsData);
+			LosQueueStrip(pending, i0clamp, i1clamp, j, adding ? 1 : -1);
 		}
 	}
 
@@ -1278,20 +1712,13 @@ public:
 
 		PROFILE("LosUpdateHelperIncremental");
 
-		std::vector<u16>& counts = m_LosPlayerCounts.at(owner);
-
-		// Lazy initialisation of counts:
-		if (counts.empty())
-			counts.resize(m_TerrainVerticesPerSide*m_TerrainVerticesPerSide);
-
-		u16* countsData = &counts[0];
+		LosPendingUpdates& pending = GetLosPending(owner);
 
 		// See comments in LosUpdateHelper.
 		// This does exactly the same, except computing the strips for
 		// both circles simultaneously.
 		// (The idea is that the circles will be heavily overlapping,
-		// so we can compute the difference between the removed/added strips
-		// and only have to touch tiles that have a net change.)
+		// so most strips won't change at all and can be skipped.)
 
 		i32 j0_from = ((from.Y - visionRange)/(int)TERRAIN_TILE_SIZE).ToInt_RoundToInfinity();
 		i32 j1_from = ((from.Y + visionRange)/(int)TERRAIN_TILE_SIZE).ToInt_RoundToNegInfinity();
@@ -1300,48 +1727,30 @@ public:
 		i32 j0clamp = std::max(std::min(j0_from, j0_to), 1);
 		i32 j1clamp = std::min(std::max(j1_from, j1_to), m_TerrainVerticesPerSide-2);
 
+		LosMarkDirty(((std::min(from.X, to.X) - visionRange)/(int)TERRAIN_TILE_SIZE).ToInt_RoundToNegInfinity(), j0clamp,
+			((std::max(from.X, to.X) + visionRange)/(int)TERRAIN_TILE_SIZE).ToInt_RoundToInfinity(), j1clamp);
+
 		entity_pos_t x_from = from.X / (int)TERRAIN_TILE_SIZE;
 		entity_pos_t y_from = from.Y / (int)TERRAIN_TILE_SIZE;
 		entity_pos_t x_to = to.X / (int)TERRAIN_TILE_SIZE;
 		entity_pos_t y_to = to.Y / (int)TERRAIN_TILE_SIZE;
 		entity_pos_t r = visionRange / (int)TERRAIN_TILE_SIZE;
-		entity_pos_t r2 = r.Square();
-
-		i32 xfloor_from = (x_from - entity_pos_t::Epsilon()).ToInt_RoundToNegInfinity();
-		i32 xceil_from = (x_from + entity_pos_t::Epsilon()).ToInt_RoundToInfinity();
-		i32 xfloor_to = (x_to - entity_pos_t::Epsilon()).ToInt_RoundToNegInfinity();
-		i32 xceil_to = (x_to + entity_pos_t::Epsilon()).ToInt_RoundToInfinity();
-
-		i32 i0_from = xfloor_from;
-		i32 i1_from = xceil_from;
-		i32 i0_to = xfloor_to;
-		i32 i1_to = xceil_to;
+		LosCircleRasterizer circle_from(x_from, y_from, r);
+		LosCircleRasterizer circle_to(x_to, y_to, r);
 
 		for (i32 j = j0clamp; j <= j1clamp; ++j)
 		{
-			entity_pos_t dy_from = entity_pos_t::FromInt(j) - y_from;
-			entity_pos_t dy2_from = dy_from.Square();
-			while (dy2_from + (entity_pos_t::FromInt(i0_from-1) - x_from).Square() <= r2)
-				--i0_from;
-			while (i0_from < xceil_from && dy2_from + (entity_pos_t::FromInt(i0_from) - x_from).Square() > r2)
-				++i0_from;
-			while (dy2_from + (entity_pos_t::FromInt(i1_from+1) - x_from).Square() <= r2)
-				++i1_from;
-			while (i1_from > xfloor_from && dy2_from + (entity_pos_t::FromInt(i1_from) - x_from).Square() > r2)
-				--i1_from;
-
-			entity_pos_t dy_to = entity_pos_t::FromInt(j) - y_to;
-			entity_pos_t dy2_to = dy_to.Square();
-			while (dy2_to + (entity_pos_t::FromInt(i0_to-1) - x_to).Square() <= r2)
-				--i0_to;
-			while (i0_to < xceil_to && dy2_to + (entity_pos_t::FromInt(i0_to) - x_to).Square() > r2)
-				++i0_to;
-			while (dy2_to + (entity_pos_t::FromInt(i1_to+1) - x_to).Square() <= r2)
-				++i1_to;
-			while (i1_to > xfloor_to && dy2_to + (entity_pos_t::FromInt(i1_to) - x_to).Square() > r2)
-				--i1_to;
+			circle_from.NextRow(j);
+			circle_to.NextRow(j);
+			i32 i0_from = circle_from.GetI0();
+			i32 i1_from = circle_from.GetI1();
+			i32 i0_to = circle_to.GetI0();
+			i32 i1_to = circle_to.GetI1();
 
 #if DEBUG_RANGE_MANAGER_BOUNDS
+			entity_pos_t r2 = r.Square();
+			entity_pos_t dy2_from = (entity_pos_t::FromInt(j) - y_from).Square();
+			entity_pos_t dy2_to = (entity_pos_t::FromInt(j) - y_to).Square();
 			if (i0_from <= i1_from)
 			{
 				ENSURE(dy2_from + (entity_pos_t::FromInt(i0_from) - x_from).Square() <= r2);
@@ -1366,32 +1775,10 @@ public:
 				i32 i0clamp_to = std::max(i0_to, 1);
 				i32 i1clamp_to = std::min(i1_to, m_TerrainVerticesPerSide-2);
 
-				// Check whether one strip is negative width,
-				// and we can just add/remove the entire other strip
-				if (i1clamp_from < i0clamp_from)
-				{
-					LosAddStripHelper(owner, i0clamp_to, i1clamp_to, j, countsData);
-				}
-				else if (i1clamp_to < i0clamp_to)
-				{
-					LosRemoveStripHelper(owner, i0clamp_from, i1clamp_from, j, countsData);
-				}
-				else
-				{
-					// There are four possible regions of overlap between the two strips
-					// (remove before add, remove after add, add before remove, add after remove).
-					// Process each of the regions as its own strip.
-					// (If this produces negative-width strips then they'll just get ignored
-					// which is fine.)
-					// (If the strips don't actually overlap (which is very rare with normal unit
-					// movement speeds), the region between them will be both added and removed,
-					// so we have to do the add first to avoid overflowing to -1 and triggering
-					// assertion failures.)
-					LosAddStripHelper(owner, i0clamp_to, i0clamp_from-1, j, countsData);
-					LosAddStripHelper(owner, i1clamp_from+1, i1clamp_to, j, countsData);
-					LosRemoveStripHelper(owner, i0clamp_from, i0clamp_to-1, j, countsData);
-					LosRemoveStripHelper(owner, i1clamp_to+1, i1clamp_from, j, countsData);
-				}
+				// The overlapping part of the strips cancels out when the
+				// changes are applied, so only the difference gets touched
+				LosQueueStrip(pending, i0clamp_to, i1clamp_to, j, 1);
+				LosQueueStrip(pending, i0clamp_from, i1clamp_from, j, -1);
 			}
 		}
 	}
@@ -1436,6 +1823,7 @@ public:
 	{
 		i32 exploredVertices = 0;
 		i32 overallVisibleVertices = 0;
+		FlushLosUpdates();
 		CLosQuerier los(CalcPlayerLosMask(player), m_LosState, m_TerrainVerticesPerSide);
 
 		for (i32 j = 0; j < m_TerrainVerticesPerSide; j++)
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,14 +23,23 @@
 #include "simulation2/MessageTypes.h"
 
 #include "lib/utf8.h"
+#include "lib/allocators/shared_ptr.h"
+#include "maths/MD5.h"
+#include "ps/CacheLoader.h"
 #include "ps/CLogger.h"
 #include "ps/Filesystem.h"
 #include "ps/XML/RelaxNG.h"
 #include "ps/XML/Xeromyces.h"
+#include "simulation2/serialization/StdDeserializer.h"
+#include "simulation2/serialization/StdSerializer.h"
 
 static const wchar_t TEMPLATE_ROOT[] = L"simulation/templates/";
 static const wchar_t ACTOR_ROOT[] = L"art/actors/";
 
+// Arbitrary version number - change this if we update the code and
+// need to invalidate old users' template caches
+static const u32 TEMPLATE_CACHE_VERSION = 1;
+
 class CCmpTemplateManager : public ICmpTemplateManager
 {
 public:
@@ -50,7 +59,10 @@ public:
 	{
 		m_DisableValidation = false;
 
-		m_Validator.LoadGrammar(GetSimContext().GetComponentManager().GenerateSchema());
+		std::string schema = GetSimContext().GetComponentManager().GenerateSchema();
+		m_Validator.LoadGrammar(schema);
+		m_SchemaHash = MD5();
+		m_SchemaHash.Update((const u8*)schema.c_str(), schema.length());
 		// TODO: handle errors loading the grammar here?
 		// TODO: support hotloading changes to the grammar
 	}
@@ -153,6 +165,15 @@ private:
 	// them and use them; we only reject invalid templates that were requested directly by GetTemplate/etc)
 	std::map<std::string, bool> m_TemplateSchemaValidity;
 
+	// Hash of the schema, so cached templates (and their cached validity) are
+	// discarded when the schema changes
+	MD5 m_SchemaHash;
+
+	// For templates loaded from XML files: the path of each one's cache file, and
+	// the list of files it was constructed from (itself plus all its parents)
+	std::map<std::string, VfsPath> m_TemplateCachePaths;
+	std::map<std::string, std::vector<VfsPath> > m_TemplateDependencies;
+
 	// Remember the template used by each entity, so we can return them
 	// again for deserialization.
 	// TODO: should store player ID etc.
@@ -164,6 +185,13 @@ private:
 	// @param templateName XML filename to load (not a |-separated string)
 	bool LoadTemplateFile(const std::string& templateName, int depth);
 
+	// Loads the fully-inherited template data (and whether it's known to be valid) from the
+	// cache file, if it's still consistent with the template and all its parents.
+	bool LoadCachedTemplateFile(const std::string& templateName, const VfsPath& cachePath);
+
+	// Saves the currently loaded data for the template to its cache file.
+	void SaveCachedTemplateFile(const std::string& templateName);
+
 	// Constructs a standard static-decorative-object template for the given actor
 	void ConstructTemplateActor(const std::string& actorName, CParamNode& out);
 
@@ -204,6 +232,10 @@ const CParamNode* CCmpTemplateManager::GetTemplate(std::string templateName)
 		return NULL;
 	}
 
+	// Entity creation queries the template heavily, so make sure it's been
+	// converted into its faster form (this only does any work the first time)
+	m_TemplateFileData[templateName].Compile();
+
 	if (!m_DisableValidation)
 	{
 		// Compute validity, if it's not computed before
@@ -214,6 +246,9 @@ const CParamNode* CCmpTemplateManager::GetTemplate(std::string templateName)
 			// Show error on the first failure to validate the template
 			if (!m_TemplateSchemaValidity[templateName])
 				LOGERROR(L"Failed to validate entity template '%hs'", templateName.c_str());
+
+			// Remember the result, so we don't need to validate again next time
+			SaveCachedTemplateFile(templateName);
 		}
 		// Refuse to return invalid templates
 		if (!m_TemplateSchemaValidity[templateName])
@@ -240,6 +275,8 @@ const CParamNode* CCmpTemplateManager::GetTemplateWithoutValidation(std::string
 		return NULL;
 	}
 
+	m_TemplateFileData[templateName].Compile(); // (see GetTemplate)
+
 	const CParamNode& templateRoot = m_TemplateFileData[templateName].GetChild("Entity");
 	if (!templateRoot.IsOk())
 		return NULL;
@@ -346,11 +383,23 @@ bool CCmpTemplateManager::LoadTemplateFile(const std::string& templateName, int
 	// Normal case: templateName is an XML file:
 
 	VfsPath path = VfsPath(TEMPLATE_ROOT) / wstring_from_utf8(templateName + ".xml");
+
+	// Resolving the inheritance chain (and validating the result) is fairly slow,
+	// so try to use the result from a previous run
+	VfsPath cachePath;
+	CCacheLoader cacheLoader(g_VFS, L".tmpl");
+	Status cacheRet = cacheLoader.TryLoadingCached(path, m_SchemaHash, TEMPLATE_CACHE_VERSION, cachePath);
+	if (cacheRet == INFO::OK && LoadCachedTemplateFile(templateName, cachePath))
+		return true;
+
 	CXeromyces xero;
 	PSRETURN ok = xero.Load(g_VFS, path);
 	if (ok != PSRETURN_OK)
 		return false; // (Xeromyces already logged an error with the full filename)
 
+	std::vector<VfsPath> dependencies;
+	dependencies.push_back(path);
+
 	int attr_parent = xero.GetAttributeID("parent");
 	CStr parentName = xero.GetRoot().GetAttributes().GetNamedItem(attr_parent);
 	if (!parentName.empty())
@@ -373,14 +422,119 @@ bool CCmpTemplateManager::LoadTemplateFile(const std::string& templateName, int
 
 		// Initialise this template with its parent
 		m_TemplateFileData[templateName] = parentData;
+
+		const std::vector<VfsPath>& parentDependencies = m_TemplateDependencies[parentName];
+		dependencies.insert(dependencies.end(), parentDependencies.begin(), parentDependencies.end());
 	}
 
 	// Load the new file into the template data (overriding parent values)
 	CParamNode::LoadXML(m_TemplateFileData[templateName], xero, wstring_from_utf8(templateName).c_str());
 
+	m_TemplateDependencies[templateName].swap(dependencies);
+	if (cacheRet >= 0)
+	{
+		m_TemplateCachePaths[templateName] = cachePath;
+		SaveCachedTemplateFile(templateName);
+	}
+
+	return true;
+}
+
+bool CCmpTemplateManager::LoadCachedTemplateFile(const std::string& templateName, const VfsPath& cachePath)
+{
+	shared_ptr<u8> data;
+	size_t size;
+	if (g_VFS->LoadFile(cachePath, data, size) < 0 || size == 0)
+		return false;
+
+	std::stringstream stream(std::string((const char*)data.get(), size));
+
+	std::vector<VfsPath> dependencies;
+	bool valid;
+	try
+	{
+		CStdDeserializer deserializer(GetSimContext().GetScriptInterface(), stream);
+
+		// The cache filename only depends on the template file itself, so check
+		// that none of its parents have changed either
+		u32 numDependencies;
+		deserializer.NumberU32_Unbounded("num dependencies", numDependencies);
+		for (u32 i = 0; i < numDependencies; ++i)
+		{
+			std::wstring dependency;
+			double mtime;
+			u32 fileSize;
+			deserializer.String("path", dependency, 0, UINT32_MAX);
+			deserializer.NumberDouble_Unbounded("mtime", mtime);
+			deserializer.NumberU32_Unbounded("size", fileSize);
+
+			FileInfo fileInfo;
+			if (g_VFS->GetFileInfo(dependency, &fileInfo) < 0 ||
+				(double)((u64)fileInfo.MTime() & ~1) != mtime || (u32)fileInfo.Size() != fileSize)
+				return false;
+
+			dependencies.push_back(dependency);
+		}
+
+		deserializer.Bool("valid", valid);
+		CParamNode::Deserialize(m_TemplateFileData[templateName], deserializer);
+	}
+	catch (PSERROR_Deserialize&)
+	{
+		// Probably a partially-written file - we'll just load the template normally
+		m_TemplateFileData.erase(templateName);
+		return false;
+	}
+
+	m_TemplateDependencies[templateName].swap(dependencies);
+	m_TemplateCachePaths[templateName] = cachePath;
+	if (valid)
+		m_TemplateSchemaValidity[templateName] = true;
+
 	return true;
 }
 
+void CCmpTemplateManager::SaveCachedTemplateFile(const std::string& templateName)
+{
+	std::map<std::string, VfsPath>::const_iterator cachePath = m_TemplateCachePaths.find(templateName);
+	if (cachePath == m_TemplateCachePaths.end())
+		return;
+
+	std::stringstream stream;
+	try
+	{
+		CStdSerializer serializer(GetSimContext().GetScriptInterface(), stream);
+
+		const std::vector<VfsPath>& dependencies = m_TemplateDependencies[templateName];
+		serializer.NumberU32_Unbounded("num dependencies", (u32)dependencies.size());
+		for (size_t i = 0; i < dependencies.size(); ++i)
+		{
+			FileInfo fileInfo;
+			if (g_VFS->GetFileInfo(dependencies[i], &fileInfo) < 0)
+				return;
+			serializer.String("path", dependencies[i].string(), 0, UINT32_MAX);
+			serializer.NumberDouble_Unbounded("mtime", (double)((u64)fileInfo.MTime() & ~1));
+			serializer.NumberU32_Unbounded("size", (u32)fileInfo.Size());
+		}
+
+		// Only successful validations are remembered, so that errors are reported
+		// every time an invalid template is used
+		std::map<std::string, bool>::const_iterator it = m_TemplateSchemaValidity.find(templateName);
+		serializer.Bool("valid", it != m_TemplateSchemaValidity.end() && it->second);
+
+		m_TemplateFileData[templateName].Serialize(serializer);
+	}
+	catch (PSERROR_Serialize&)
+	{
+		return;
+	}
+
+	std::string str = stream.str();
+	shared_ptr<u8> buf(new u8[str.size()], ArrayDeleter());
+	memcpy(buf.get(), str.data(), str.size());
+	g_VFS->CreateFile(cachePath->second, buf, str.size());
+}
+
 void CCmpTemplateManager::ConstructTemplateActor(const std::string& actorName, CParamNode& out)
 {
 	// Load the base actor template if necessary
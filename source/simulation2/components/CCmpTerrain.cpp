@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -84,6 +84,11 @@ public:
 		return m_Terrain->GetExactGroundLevel(x, z);
 	}
 
+	virtual void GetExactGroundLevels(const float* coords, size_t n, float* heights)
+	{
+		m_Terrain->GetExactGroundLevels(coords, n, heights);
+	}
+
 	virtual u16 GetTilesPerSide()
 	{
 		ssize_t tiles = m_Terrain->GetTilesPerSide();
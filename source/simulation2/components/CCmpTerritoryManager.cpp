@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,6 +27,7 @@
 #include "maths/MathUtil.h"
 #include "maths/Vector2D.h"
 #include "ps/Overlay.h"
+#include "ps/ThreadPool.h"
 #include "renderer/Renderer.h"
 #include "renderer/Scene.h"
 #include "renderer/TerrainOverlay.h"
@@ -43,7 +44,6 @@
 #include "simulation2/components/ICmpTerritoryInfluence.h"
 #include "simulation2/helpers/Geometry.h"
 #include "simulation2/helpers/Grid.h"
-#include "simulation2/helpers/PriorityQueue.h"
 #include "simulation2/helpers/Render.h"
 
 class CCmpTerritoryManager;
@@ -87,7 +87,8 @@ public:
 	// Player ID in bits 0-5 (TERRITORY_PLAYER_MASK);
 	// connected flag in bit 6 (TERRITORY_CONNECTED_MASK);
 	// processed flag in bit 7 (TERRITORY_PROCESSED_MASK)
-	Grid<u8>* m_Territories;
+	// (This is never modified once it's been computed, so it can be shared with snapshots)
+	shared_ptr<Grid<u8> > m_Territories;
 
 	// Set to true when territories change; will send a TerritoriesChanged message
 	// during the Update phase
@@ -96,10 +97,41 @@ public:
 	struct SBoundaryLine
 	{
 		bool connected;
+		player_id_t owner;
 		CColor color;
+		std::vector<CVector2D> boundaryPoints; // unsmoothed points the overlay was computed from
 		SOverlayTexturedLine overlay;
 	};
 
+	/**
+	 * Influence of a single entity, covering the box of tiles it can reach.
+	 * These are kept between calls to CalculateTerritories, and only recomputed
+	 * for entities whose properties or surrounding costs have changed.
+	 */
+	struct SEntityInfluence
+	{
+		player_id_t owner;
+		u16 i, j; // tile containing the entity
+		u32 weight;
+		u32 falloff;
+		u16 i0, j0, w, h; // area of the map covered by grid
+		shared_ptr<Grid<u32> > grid;
+	};
+
+	std::map<entity_id_t, SEntityInfluence> m_EntityInfluences;
+
+	// Cost grid that m_EntityInfluences were computed with
+	shared_ptr<Grid<u8> > m_InfluenceCosts;
+
+	// Sums of m_EntityInfluences for each player in m_WeightPlayerIDs on each tile.
+	// The sums are interleaved (all players' sums for one tile are adjacent),
+	// so finding the highest is a single pass through memory
+	std::vector<player_id_t> m_WeightPlayerIDs;
+	std::vector<u32> m_PlayerWeights;
+
+	// Player with the highest sum on each tile (without any flags)
+	Grid<u8> m_TerritoryOwners;
+
 	std::vector<SBoundaryLine> m_BoundaryLines;
 	bool m_BoundaryLinesDirty;
 
@@ -112,7 +144,12 @@ public:
 
 	virtual void Init(const CParamNode& UNUSED(paramNode))
 	{
-		m_Territories = NULL;
+		m_Territories.reset();
+		m_EntityInfluences.clear();
+		m_InfluenceCosts.reset();
+		m_WeightPlayerIDs.clear();
+		m_PlayerWeights.clear();
+		m_TerritoryOwners = Grid<u8>();
 		m_DebugOverlay = NULL;
 //		m_DebugOverlay = new TerritoryOverlay(*this);
 		m_BoundaryLinesDirty = true;
@@ -134,7 +171,12 @@ public:
 
 	virtual void Deinit()
 	{
-		SAFE_DELETE(m_Territories);
+		m_Territories.reset();
+		m_EntityInfluences.clear();
+		m_InfluenceCosts.reset();
+		m_WeightPlayerIDs.clear();
+		m_PlayerWeights.clear();
+		m_TerritoryOwners = Grid<u8>();
 		SAFE_DELETE(m_DebugOverlay);
 	}
 
@@ -175,6 +217,8 @@ public:
 		case MT_TerrainChanged:
 		{
 			MakeDirty();
+			// The lines' render data follows the terrain, so it can't be reused
+			m_BoundaryLines.clear();
 			break;
 		}
 		case MT_Update:
@@ -222,6 +266,13 @@ public:
 		return *m_Territories;
 	}
 
+	virtual shared_ptr<const Grid<u8> > GetTerritoryGridSnapshot()
+	{
+		CalculateTerritories();
+		ENSURE(m_Territories);
+		return m_Territories;
+	}
+
 	virtual player_id_t GetOwner(entity_pos_t x, entity_pos_t z);
 	virtual bool IsConnected(entity_pos_t x, entity_pos_t z);
 
@@ -233,7 +284,7 @@ public:
 
 	void MakeDirty()
 	{
-		SAFE_DELETE(m_Territories);
+		m_Territories.reset();
 		++m_DirtyID;
 		m_BoundaryLinesDirty = true;
 		m_TriggerEvent = true;
@@ -256,7 +307,7 @@ public:
 	 * a TerritoryInfluence component. Grid cells are 0 if no influence,
 	 * or 1+c if the influence have cost c (assumed between 0 and 254).
 	 */
-	void RasteriseInfluences(CComponentManager::InterfaceList& infls, Grid<u8>& grid);
+	void RasteriseInfluences(const CComponentManager::InterfaceList& infls, Grid<u8>& grid);
 
 	std::vector<STerritoryBoundary> ComputeBoundaries();
 
@@ -275,14 +326,27 @@ storing an 'open' list of tiles that have not yet been processed,
 then taking the highest-weight tile (closest to origin) and updating the weight
 of extending to each neighbour (based on radius-determining 'falloff' value,
 adjusted by terrain movement cost), and repeating until all tiles are processed.
+
+The open list is a bucket queue rather than a heap: each bucket holds the tiles
+whose weight is within one falloff step, and every step costs at least the falloff,
+so a tile can never be improved by another tile in the same bucket. Processing the
+buckets from the highest down therefore handles each tile once, with its final weight
+(giving the same result as processing strictly in order of weight). (Zero-cost tiles
+can be improved within a bucket, in which case they're just added and processed again.)
 */
 
-typedef PriorityQueueHeap<std::pair<u16, u16>, u32, std::greater<u32> > OpenQueue;
+struct OpenTile
+{
+	u16 i, j;
+	u32 g;
+};
+
+typedef std::vector<std::vector<OpenTile> > OpenBuckets;
 
 static void ProcessNeighbour(u32 falloff, u16 i, u16 j, u32 pg, bool diagonal,
-		Grid<u32>& grid, OpenQueue& queue, const Grid<u8>& costGrid)
+		Grid<u32>& grid, OpenBuckets& buckets, u32 bucketSize, const Grid<u8>& costGrid, u16 i0, u16 j0)
 {
-	u32 dg = falloff * costGrid.get(i, j);
+	u32 dg = falloff * costGrid.get(i0 + i, j0 + j);
 	if (diagonal)
 		dg = (dg * 362) / 256;
 
@@ -294,38 +358,129 @@ static void ProcessNeighbour(u32 falloff, u16 i, u16 j, u32 pg, bool diagonal,
 	u32 g = pg - dg; // cost to this tile = cost to predecessor - falloff from predecessor
 
 	grid.set(i, j, g);
-	OpenQueue::Item tile = { std::make_pair(i, j), g };
-	queue.push(tile);
+	OpenTile tile = { i, j, g };
+	buckets[g / bucketSize].push_back(tile);
 }
 
-static void FloodFill(Grid<u32>& grid, Grid<u8>& costGrid, OpenQueue& openTiles, u32 falloff)
+/**
+ * Expands an influence of the given weight from tile (i, j) over @p grid,
+ * which covers the area of @p costGrid starting at tile (i0, j0).
+ */
+static void FloodFill(Grid<u32>& grid, const Grid<u8>& costGrid, u16 i0, u16 j0, u16 i, u16 j, u32 weight, u32 falloff)
 {
 	u16 tilesW = grid.m_W;
 	u16 tilesH = grid.m_H;
 
-	while (!openTiles.empty())
-	{
-		OpenQueue::Item tile = openTiles.pop();
-
-		// Process neighbours (if they're not off the edge of the map)
-		u16 x = tile.id.first;
-		u16 z = tile.id.second;
-		if (x > 0)
-			ProcessNeighbour(falloff, (u16)(x-1), z, tile.rank, false, grid, openTiles, costGrid);
-		if (x < tilesW-1)
-			ProcessNeighbour(falloff, (u16)(x+1), z, tile.rank, false, grid, openTiles, costGrid);
-		if (z > 0)
-			ProcessNeighbour(falloff, x, (u16)(z-1), tile.rank, false, grid, openTiles, costGrid);
-		if (z < tilesH-1)
-			ProcessNeighbour(falloff, x, (u16)(z+1), tile.rank, false, grid, openTiles, costGrid);
-		if (x > 0 && z > 0)
-			ProcessNeighbour(falloff, (u16)(x-1), (u16)(z-1), tile.rank, true, grid, openTiles, costGrid);
-		if (x > 0 && z < tilesH-1)
-			ProcessNeighbour(falloff, (u16)(x-1), (u16)(z+1), tile.rank, true, grid, openTiles, costGrid);
-		if (x < tilesW-1 && z > 0)
-			ProcessNeighbour(falloff, (u16)(x+1), (u16)(z-1), tile.rank, true, grid, openTiles, costGrid);
-		if (x < tilesW-1 && z < tilesH-1)
-			ProcessNeighbour(falloff, (u16)(x+1), (u16)(z+1), tile.rank, true, grid, openTiles, costGrid);
+	// (If the falloff is 0 the whole area has the same weight, and every tile
+	// will just be added once to the single bucket)
+	u32 bucketSize = std::max(falloff, (u32)1);
+	OpenBuckets buckets(weight / bucketSize + 1);
+
+	// Initialise the tile under the entity
+	grid.set(i, j, weight);
+	OpenTile start = { i, j, weight };
+	buckets.back().push_back(start);
+
+	for (size_t b = buckets.size(); b > 0; --b)
+	{
+		std::vector<OpenTile>& bucket = buckets[b-1];
+		while (!bucket.empty())
+		{
+			OpenTile tile = bucket.back();
+			bucket.pop_back();
+
+			// Skip if the tile was improved after being added to this bucket
+			if (grid.get(tile.i, tile.j) != tile.g)
+				continue;
+
+			// Process neighbours (if they're not off the edge of the map)
+			u16 x = tile.i;
+			u16 z = tile.j;
+			if (x > 0)
+				ProcessNeighbour(falloff, (u16)(x-1), z, tile.g, false, grid, buckets, bucketSize, costGrid, i0, j0);
+			if (x < tilesW-1)
+				ProcessNeighbour(falloff, (u16)(x+1), z, tile.g, false, grid, buckets, bucketSize, costGrid, i0, j0);
+			if (z > 0)
+				ProcessNeighbour(falloff, x, (u16)(z-1), tile.g, false, grid, buckets, bucketSize, costGrid, i0, j0);
+			if (z < tilesH-1)
+				ProcessNeighbour(falloff, x, (u16)(z+1), tile.g, false, grid, buckets, bucketSize, costGrid, i0, j0);
+			if (x > 0 && z > 0)
+				ProcessNeighbour(falloff, (u16)(x-1), (u16)(z-1), tile.g, true, grid, buckets, bucketSize, costGrid, i0, j0);
+			if (x > 0 && z < tilesH-1)
+				ProcessNeighbour(falloff, (u16)(x-1), (u16)(z+1), tile.g, true, grid, buckets, bucketSize, costGrid, i0, j0);
+			if (x < tilesW-1 && z > 0)
+				ProcessNeighbour(falloff, (u16)(x+1), (u16)(z-1), tile.g, true, grid, buckets, bucketSize, costGrid, i0, j0);
+			if (x < tilesW-1 && z < tilesH-1)
+				ProcessNeighbour(falloff, (u16)(x+1), (u16)(z+1), tile.g, true, grid, buckets, bucketSize, costGrid, i0, j0);
+		}
+	}
+}
+
+/**
+ * Computes infl.grid from the influence parameters and the cost grid.
+ */
+static void ComputeEntityInfluence(CCmpTerritoryManager::SEntityInfluence& infl, const Grid<u8>& costGrid)
+{
+	infl.grid.reset(new Grid<u32>(infl.w, infl.h));
+	FloodFill(*infl.grid, costGrid, infl.i0, infl.j0, (u16)(infl.i - infl.i0), (u16)(infl.j - infl.j0), infl.weight, infl.falloff);
+}
+
+/**
+ * Each entity's influence only depends on its own parameters and the (unchanging)
+ * cost grid, so they can be computed in parallel.
+ */
+class ComputeEntityInfluencesTask : public CThreadPool::ITask
+{
+public:
+	ComputeEntityInfluencesTask(const std::vector<CCmpTerritoryManager::SEntityInfluence*>& influences, const Grid<u8>& costGrid) :
+		m_Influences(influences), m_CostGrid(costGrid)
+	{
+	}
+
+	virtual void Run(size_t index)
+	{
+		ComputeEntityInfluence(*m_Influences[index], m_CostGrid);
+	}
+
+private:
+	const std::vector<CCmpTerritoryManager::SEntityInfluence*>& m_Influences;
+	const Grid<u8>& m_CostGrid;
+	NONCOPYABLE(ComputeEntityInfluencesTask);
+};
+
+/**
+ * Returns whether the w*h area of the two grids starting at tile (i0, j0) is identical.
+ */
+static bool CostsEqual(const Grid<u8>& a, const Grid<u8>& b, u16 i0, u16 j0, u16 w, u16 h)
+{
+	for (u16 j = j0; j < j0 + h; ++j)
+		if (memcmp(&a.m_Data[j*a.m_W + i0], &b.m_Data[j*b.m_W + i0], w) != 0)
+			return false;
+	return true;
+}
+
+/**
+ * Adds an entity's influence to (or subtracts it from) the sums of player
+ * number @p k out of @p numPlayers, interleaved as in m_PlayerWeights.
+ */
+static void AccumulateInfluence(std::vector<u32>& playerWeights, u16 tilesW, size_t k, size_t numPlayers,
+	const CCmpTerritoryManager::SEntityInfluence& infl, bool subtract)
+{
+	const Grid<u32>& entityGrid = *infl.grid;
+	for (u16 j = 0; j < entityGrid.m_H; ++j)
+	{
+		const u32* src = &entityGrid.m_Data[j * entityGrid.m_W];
+		u32* dst = &playerWeights[((infl.j0 + j) * tilesW + infl.i0) * numPlayers + k];
+		if (subtract)
+		{
+			for (u16 i = 0; i < entityGrid.m_W; ++i)
+				dst[i * numPlayers] -= src[i];
+		}
+		else
+		{
+			for (u16 i = 0; i < entityGrid.m_W; ++i)
+				dst[i * numPlayers] += src[i];
+		}
 	}
 }
 
@@ -346,10 +501,9 @@ void CCmpTerritoryManager::CalculateTerritories()
 	u16 tilesW = cmpTerrain->GetTilesPerSide();
 	u16 tilesH = cmpTerrain->GetTilesPerSide();
 
-	m_Territories = new Grid<u8>(tilesW, tilesH);
-
 	// Compute terrain-passability-dependent costs per tile
-	Grid<u8> influenceGrid(tilesW, tilesH);
+	shared_ptr<Grid<u8> > influenceGridPtr(new Grid<u8>(tilesW, tilesH));
+	Grid<u8>& influenceGrid = *influenceGridPtr;
 
 	CmpPtr<ICmpPathfinder> cmpPathfinder(GetSimContext(), SYSTEM_ENTITY);
 	ICmpPathfinder::pass_class_t passClassDefault = cmpPathfinder->GetPassabilityClass("default");
@@ -373,15 +527,16 @@ void CCmpTerritoryManager::CalculateTerritories()
 	}
 
 	// Find all territory influence entities
-	CComponentManager::InterfaceList influences = GetSimContext().GetComponentManager().GetEntitiesWithInterface(IID_TerritoryInfluence);
+	const CComponentManager::InterfaceList& influences = GetSimContext().GetComponentManager().GetEntitiesWithInterfaceSorted(IID_TerritoryInfluence);
 
 	// Allow influence entities to override the terrain costs
 	RasteriseInfluences(influences, influenceGrid);
 
 	// Split influence entities into per-player lists, ignoring any with invalid properties
 	std::map<player_id_t, std::vector<entity_id_t> > influenceEntities;
+	std::map<entity_id_t, SEntityInfluence> entityInfluences;
 	std::vector<entity_id_t> rootInfluenceEntities;
-	for (CComponentManager::InterfaceList::iterator it = influences.begin(); it != influences.end(); ++it)
+	for (CComponentManager::InterfaceList::const_iterator it = influences.begin(); it != influences.end(); ++it)
 	{
 		// Ignore any with no weight or radius (to avoid divide-by-zero later)
 		ICmpTerritoryInfluence* cmpTerritoryInfluence = static_cast<ICmpTerritoryInfluence*>(it->second);
@@ -406,78 +561,157 @@ void CCmpTerritoryManager::CalculateTerritories()
 		if (!cmpPosition || !cmpPosition->IsInWorld())
 			continue;
 
+		CFixedVector2D pos = cmpPosition->GetPosition2D();
+		u16 i = (u16)clamp((pos.X / (int)TERRAIN_TILE_SIZE).ToInt_RoundToNegInfinity(), 0, tilesW-1);
+		u16 j = (u16)clamp((pos.Y / (int)TERRAIN_TILE_SIZE).ToInt_RoundToNegInfinity(), 0, tilesH-1);
+
+		SEntityInfluence infl;
+		infl.owner = owner;
+		infl.i = i;
+		infl.j = j;
+		infl.weight = cmpTerritoryInfluence->GetWeight();
+		u32 radius = cmpTerritoryInfluence->GetRadius() / TERRAIN_TILE_SIZE;
+		infl.falloff = infl.weight / radius; // earlier check for GetRadius() == 0 prevents divide-by-zero
+
+		// TODO: we should have some maximum value on weight, to avoid overflow
+		// when doing all the sums
+
+		// Every step of the flood fill reduces the weight by at least the falloff,
+		// so the influence can't reach further than this many tiles
+		u32 reach = infl.falloff ? (infl.weight - 1) / infl.falloff : (u32)std::max(tilesW, tilesH);
+		infl.i0 = (u16)(i - std::min(reach, (u32)i));
+		infl.j0 = (u16)(j - std::min(reach, (u32)j));
+		infl.w = (u16)(std::min(i + reach, (u32)tilesW - 1) - infl.i0 + 1);
+		infl.h = (u16)(std::min(j + reach, (u32)tilesH - 1) - infl.j0 + 1);
+
+		entityInfluences[it->first] = infl;
 		influenceEntities[owner].push_back(it->first);
 
 		if (cmpTerritoryInfluence->IsRoot())
 			rootInfluenceEntities.push_back(it->first);
 	}
 
-	// For each player, store the sum of influences on each tile
-	std::vector<std::pair<player_id_t, Grid<u32> > > playerGrids;
-	// TODO: this is a large waste of memory; we don't really need to store
-	// all the intermediate grids
+	// Reuse the previously computed influences of entities that haven't changed
+	// (and whose area of the cost grid hasn't changed), and recompute the rest
+	if (!m_InfluenceCosts || m_InfluenceCosts->m_W != tilesW || m_InfluenceCosts->m_H != tilesH)
+		m_EntityInfluences.clear();
 
-	for (std::map<player_id_t, std::vector<entity_id_t> >::iterator it = influenceEntities.begin(); it != influenceEntities.end(); ++it)
+	std::vector<SEntityInfluence*> dirtyInfluences;
+	for (std::map<entity_id_t, SEntityInfluence>::iterator it = entityInfluences.begin(); it != entityInfluences.end(); ++it)
 	{
-		Grid<u32> playerGrid(tilesW, tilesH);
-
-		std::vector<entity_id_t>& ents = it->second;
-		for (std::vector<entity_id_t>::iterator eit = ents.begin(); eit != ents.end(); ++eit)
+		SEntityInfluence& infl = it->second;
+		std::map<entity_id_t, SEntityInfluence>::iterator old = m_EntityInfluences.find(it->first);
+		if (old != m_EntityInfluences.end() &&
+			old->second.owner == infl.owner && old->second.i == infl.i && old->second.j == infl.j &&
+			old->second.weight == infl.weight && old->second.falloff == infl.falloff &&
+			CostsEqual(*m_InfluenceCosts, influenceGrid, infl.i0, infl.j0, infl.w, infl.h))
 		{
-			// Compute the influence map of the current entity, then add it to the player grid
-
-			Grid<u32> entityGrid(tilesW, tilesH);
-
-			CmpPtr<ICmpPosition> cmpPosition(GetSimContext(), *eit);
-			CFixedVector2D pos = cmpPosition->GetPosition2D();
-			u16 i = (u16)clamp((pos.X / (int)TERRAIN_TILE_SIZE).ToInt_RoundToNegInfinity(), 0, tilesW-1);
-			u16 j = (u16)clamp((pos.Y / (int)TERRAIN_TILE_SIZE).ToInt_RoundToNegInfinity(), 0, tilesH-1);
+			infl.grid = old->second.grid;
+		}
+		else
+		{
+			dirtyInfluences.push_back(&infl);
+		}
+	}
 
-			CmpPtr<ICmpTerritoryInfluence> cmpTerritoryInfluence(GetSimContext(), *eit);
-			u32 weight = cmpTerritoryInfluence->GetWeight();
-			u32 radius = cmpTerritoryInfluence->GetRadius() / TERRAIN_TILE_SIZE;
-			u32 falloff = weight / radius; // earlier check for GetRadius() == 0 prevents divide-by-zero
+	ComputeEntityInfluencesTask task(dirtyInfluences, influenceGrid);
+	if (g_ThreadPool && dirtyInfluences.size() > 1)
+	{
+		g_ThreadPool->ParallelFor(task, dirtyInfluences.size());
+	}
+	else
+	{
+		for (size_t i = 0; i < dirtyInfluences.size(); ++i)
+			task.Run(i);
+	}
 
-			// TODO: we should have some maximum value on weight, to avoid overflow
-			// when doing all the sums
+	// Update the sums of the influences of each player on each tile.
+	// If the set of players hasn't changed, only the influences that were added,
+	// removed or recomputed are added to or subtracted from the previous sums,
+	// and only the area they cover needs its owners to be recomputed
+	std::vector<player_id_t> playerIDs;
+	for (std::map<player_id_t, std::vector<entity_id_t> >::iterator it = influenceEntities.begin(); it != influenceEntities.end(); ++it)
+		playerIDs.push_back(it->first);
+	const size_t numPlayers = playerIDs.size();
 
-			// Initialise the tile under the entity
-			entityGrid.set(i, j, weight);
-			OpenQueue openTiles;
-			OpenQueue::Item tile = { std::make_pair((u16)i, (i16)j), weight };
-			openTiles.push(tile);
+	i32 dirtyI0 = tilesW, dirtyJ0 = tilesH, dirtyI1 = -1, dirtyJ1 = -1;
+	if (playerIDs != m_WeightPlayerIDs || m_TerritoryOwners.m_W != tilesW || m_TerritoryOwners.m_H != tilesH)
+	{
+		m_WeightPlayerIDs = playerIDs;
+		m_PlayerWeights.assign(tilesW * tilesH * numPlayers, 0);
+		m_TerritoryOwners = Grid<u8>(tilesW, tilesH);
 
-			// Expand influences outwards
-			FloodFill(entityGrid, influenceGrid, openTiles, falloff);
+		for (std::map<entity_id_t, SEntityInfluence>::iterator it = entityInfluences.begin(); it != entityInfluences.end(); ++it)
+		{
+			size_t k = std::lower_bound(playerIDs.begin(), playerIDs.end(), it->second.owner) - playerIDs.begin();
+			AccumulateInfluence(m_PlayerWeights, tilesW, k, numPlayers, it->second, false);
+		}
 
-			// TODO: we should do a sparse grid and only add the non-zero regions, for performance
-			for (u16 j = 0; j < entityGrid.m_H; ++j)
-				for (u16 i = 0; i < entityGrid.m_W; ++i)
-					playerGrid.set(i, j, playerGrid.get(i, j) + entityGrid.get(i, j));
+		dirtyI0 = 0;
+		dirtyJ0 = 0;
+		dirtyI1 = tilesW - 1;
+		dirtyJ1 = tilesH - 1;
+	}
+	else
+	{
+		// (Influences that were reused from the previous computation share the same grid)
+		std::vector<const SEntityInfluence*> removed, added;
+		for (std::map<entity_id_t, SEntityInfluence>::iterator it = m_EntityInfluences.begin(); it != m_EntityInfluences.end(); ++it)
+		{
+			std::map<entity_id_t, SEntityInfluence>::iterator current = entityInfluences.find(it->first);
+			if (current == entityInfluences.end() || current->second.grid != it->second.grid)
+				removed.push_back(&it->second);
+		}
+		for (std::map<entity_id_t, SEntityInfluence>::iterator it = entityInfluences.begin(); it != entityInfluences.end(); ++it)
+		{
+			std::map<entity_id_t, SEntityInfluence>::iterator old = m_EntityInfluences.find(it->first);
+			if (old == m_EntityInfluences.end() || old->second.grid != it->second.grid)
+				added.push_back(&it->second);
 		}
 
-		playerGrids.push_back(std::make_pair(it->first, playerGrid));
+		for (size_t n = 0; n < removed.size() + added.size(); ++n)
+		{
+			bool subtract = (n < removed.size());
+			const SEntityInfluence& infl = subtract ? *removed[n] : *added[n - removed.size()];
+			size_t k = std::lower_bound(playerIDs.begin(), playerIDs.end(), infl.owner) - playerIDs.begin();
+			AccumulateInfluence(m_PlayerWeights, tilesW, k, numPlayers, infl, subtract);
+
+			dirtyI0 = std::min(dirtyI0, (i32)infl.i0);
+			dirtyJ0 = std::min(dirtyJ0, (i32)infl.j0);
+			dirtyI1 = std::max(dirtyI1, (i32)infl.i0 + infl.grid->m_W - 1);
+			dirtyJ1 = std::max(dirtyJ1, (i32)infl.j0 + infl.grid->m_H - 1);
+		}
 	}
 
-	// Set m_Territories to the player ID with the highest influence for each tile
-	for (u16 j = 0; j < tilesH; ++j)
+	m_EntityInfluences.swap(entityInfluences);
+	m_InfluenceCosts = influenceGridPtr;
+
+	// Set the owner of each changed tile to the player ID with the highest influence
+	// (ties go to the lowest player ID)
+	if (numPlayers)
 	{
-		for (u16 i = 0; i < tilesW; ++i)
+		for (i32 j = dirtyJ0; j <= dirtyJ1; ++j)
 		{
-			u32 bestWeight = 0;
-			for (size_t k = 0; k < playerGrids.size(); ++k)
+			const u32* weights = &m_PlayerWeights[(j * tilesW + dirtyI0) * numPlayers];
+			for (i32 i = dirtyI0; i <= dirtyI1; ++i, weights += numPlayers)
 			{
-				u32 w = playerGrids[k].second.get(i, j);
-				if (w > bestWeight)
+				u8 owner = 0;
+				u32 bestWeight = 0;
+				for (size_t k = 0; k < numPlayers; ++k)
 				{
-					player_id_t id = playerGrids[k].first;
-					m_Territories->set(i, j, (u8)id);
-					bestWeight = w;
+					if (weights[k] > bestWeight)
+					{
+						owner = (u8)playerIDs[k];
+						bestWeight = weights[k];
+					}
 				}
+				m_TerritoryOwners.set((int)i, (int)j, owner);
 			}
 		}
 	}
 
+	m_Territories.reset(new Grid<u8>(m_TerritoryOwners));
+
 	// Detect territories connected to a 'root' influence (typically a civ center)
 	// belonging to their player, and mark them with the connected flag
 	for (std::vector<entity_id_t>::iterator it = rootInfluenceEntities.begin(); it != rootInfluenceEntities.end(); ++it)
@@ -558,9 +792,9 @@ static void TileCenter(u16 i, u16 j, entity_pos_t& x, entity_pos_t& z)
 // TODO: would be nice not to duplicate those two functions from CCmpObstructionManager.cpp
 
 
-void CCmpTerritoryManager::RasteriseInfluences(CComponentManager::InterfaceList& infls, Grid<u8>& grid)
+void CCmpTerritoryManager::RasteriseInfluences(const CComponentManager::InterfaceList& infls, Grid<u8>& grid)
 {
-	for (CComponentManager::InterfaceList::iterator it = infls.begin(); it != infls.end(); ++it)
+	for (CComponentManager::InterfaceList::const_iterator it = infls.begin(); it != infls.end(); ++it)
 	{
 		ICmpTerritoryInfluence* cmpTerritoryInfluence = static_cast<ICmpTerritoryInfluence*>(it->second);
 
@@ -603,14 +837,34 @@ std::vector<STerritoryBoundary> CCmpTerritoryManager::ComputeBoundaries()
 	CalculateTerritories();
 	ENSURE(m_Territories);
 
-	return CTerritoryBoundaryCalculator::ComputeBoundaries(m_Territories);
+	return CTerritoryBoundaryCalculator::ComputeBoundaries(m_Territories.get());
+}
+
+/**
+ * Returns whether the boundary line was computed from the given boundary, with the given color.
+ */
+static bool BoundaryLineMatches(const CCmpTerritoryManager::SBoundaryLine& line, const STerritoryBoundary& boundary, const CColor& color)
+{
+	if (line.connected != boundary.connected || line.owner != boundary.owner ||
+		line.color.r != color.r || line.color.g != color.g || line.color.b != color.b || line.color.a != color.a ||
+		line.boundaryPoints.size() != boundary.points.size())
+		return false;
+
+	for (size_t i = 0; i < boundary.points.size(); ++i)
+		if (line.boundaryPoints[i].X != boundary.points[i].X || line.boundaryPoints[i].Y != boundary.points[i].Y)
+			return false;
+
+	return true;
 }
 
 void CCmpTerritoryManager::UpdateBoundaryLines()
 {
 	PROFILE("update boundary lines");
 
-	m_BoundaryLines.clear();
+	// Most territory changes only affect a few of the boundaries, so the lines
+	// (and their render data) of the boundaries that haven't changed are reused
+	std::vector<SBoundaryLine> oldBoundaryLines;
+	oldBoundaryLines.swap(m_BoundaryLines);
 	m_DebugBoundaryLineNodes.clear();
 
 	if (!CRenderer::IsInitialised())
@@ -642,9 +896,27 @@ void CCmpTerritoryManager::UpdateBoundaryLines()
 		if (cmpPlayer)
 			color = cmpPlayer->GetColour();
 
+		// (The debug overlays are always recomputed, so don't bother reusing lines with them)
+		bool reused = false;
+		for (size_t k = 0; k < oldBoundaryLines.size() && !m_EnableLineDebugOverlays; ++k)
+		{
+			if (BoundaryLineMatches(oldBoundaryLines[k], boundaries[i], color))
+			{
+				m_BoundaryLines.push_back(oldBoundaryLines[k]);
+				oldBoundaryLines[k] = oldBoundaryLines.back();
+				oldBoundaryLines.pop_back();
+				reused = true;
+				break;
+			}
+		}
+		if (reused)
+			continue;
+
 		m_BoundaryLines.push_back(SBoundaryLine());
 		m_BoundaryLines.back().connected = boundaries[i].connected;
+		m_BoundaryLines.back().owner = boundaries[i].owner;
 		m_BoundaryLines.back().color = color;
+		m_BoundaryLines.back().boundaryPoints = boundaries[i].points;
 		m_BoundaryLines.back().overlay.m_SimContext = &GetSimContext();
 		m_BoundaryLines.back().overlay.m_TextureBase = textureBase;
 		m_BoundaryLines.back().overlay.m_TextureMask = textureMask;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -153,7 +153,7 @@ class CCmpTest2A : public ICmpTest2
 public:
 	static void ClassInit(CComponentManager& componentManager)
 	{
-		componentManager.SubscribeToMessageType(MT_TurnStart);
+		componentManager.SubscribeToMessageTypeParallel(MT_TurnStart);
 		componentManager.SubscribeToMessageType(MT_Update);
 	}
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -26,6 +26,7 @@
 #include "simulation2/components/ICmpPosition.h"
 #include "simulation2/components/ICmpPathfinder.h"
 #include "simulation2/components/ICmpRangeManager.h"
+#include "simulation2/components/ICmpUnitMotionManager.h"
 #include "simulation2/helpers/Geometry.h"
 #include "simulation2/helpers/Render.h"
 #include "simulation2/MessageTypes.h"
@@ -88,6 +89,11 @@ static const entity_pos_t CHECK_TARGET_MOVEMENT_MIN_DELTA = entity_pos_t::FromIn
  */
 static const entity_pos_t CHECK_TARGET_MOVEMENT_MIN_DELTA_FORMATION = entity_pos_t::FromInt(TERRAIN_TILE_SIZE*1);
 
+/**
+ * Units using local steering avoid at most this many of the nearest moving units.
+ */
+static const size_t STEERING_MAX_NEIGHBOURS = 12;
+
 /**
  * If we're following something but it's more than this distance away along
  * our path, then don't bother trying to repath regardless of how much it has
@@ -122,6 +128,7 @@ public:
 	bool m_FormationController;
 	fixed m_WalkSpeed; // in metres per second
 	fixed m_RunSpeed;
+	bool m_LocalSteering;
 	ICmpPathfinder::pass_class_t m_PassClass;
 	ICmpPathfinder::cost_class_t m_CostClass;
 
@@ -261,6 +268,11 @@ public:
 					"</interleave>"
 				"</element>"
 			"</optional>"
+			"<optional>"
+				"<element name='LocalSteering' a:help='If true, the unit steers around other moving units as it goes, instead of computing short paths around them'>"
+					"<data type='boolean'/>"
+				"</element>"
+			"</optional>"
 			"<element name='PassabilityClass' a:help='Identifies the terrain passability class (values are defined in special/pathfinder.xml)'>"
 				"<text/>"
 			"</element>"
@@ -290,6 +302,8 @@ public:
 			m_RunSpeed = m_WalkSpeed;
 		}
 
+		m_LocalSteering = paramNode.GetChild("LocalSteering").ToBool();
+
 		CmpPtr<ICmpPathfinder> cmpPathfinder(GetSimContext(), SYSTEM_ENTITY);
 		if (cmpPathfinder)
 		{
@@ -447,7 +461,8 @@ public:
 private:
 	bool ShouldAvoidMovingUnits()
 	{
-		return !m_FormationController;
+		// Units with local steering deal with moving units in Move instead
+		return !m_FormationController && !m_LocalSteering;
 	}
 
 	bool IsFormationMember()
@@ -508,6 +523,18 @@ private:
 	 */
 	void Move(fixed dt);
 
+	/**
+	 * Returns the velocity to move at this turn, given that we'd like to move
+	 * at @p preferred, after steering around nearby moving units.
+	 */
+	CFixedVector2D ComputeSteeringVelocity(CFixedVector2D pos, CFixedVector2D preferred);
+
+	/**
+	 * Tell the UnitMotionManager where we are at the end of this turn, so
+	 * units with local steering can avoid us next turn.
+	 */
+	void AddToMovingUnits(CFixedVector2D pos, CFixedVector2D velocity);
+
 	/**
 	 * Decide whether to approximate the given range from a square target as a circle,
 	 * rather than as a square.
@@ -766,6 +793,11 @@ void CCmpUnitMotion::Move(fixed dt)
 	case PATHSTATE_WAITING_REQUESTING_SHORT:
 	{
 		// If we're waiting for a path and don't have one yet, do nothing
+		// (but make sure steering units still avoid us, since we're not
+		// treated as an obstruction while we're waiting to move)
+		CmpPtr<ICmpPosition> cmpPosition(GetSimContext(), GetEntityId());
+		if (cmpPosition && cmpPosition->IsInWorld())
+			AddToMovingUnits(cmpPosition->GetPosition2D(), CFixedVector2D());
 		return;
 	}
 
@@ -819,6 +851,36 @@ void CCmpUnitMotion::Move(fixed dt)
 
 		fixed timeLeft = dt;
 
+		// With local steering, head towards the next waypoint unless that would
+		// run into another moving unit, in which case take one step in whatever
+		// direction avoids it best and carry on along the path next turn
+		if (m_LocalSteering && !m_ShortPath.m_Waypoints.empty() && dt > fixed::Zero())
+		{
+			CFixedVector2D target(m_ShortPath.m_Waypoints.back().x, m_ShortPath.m_Waypoints.back().z);
+			CFixedVector2D preferred = target - pos;
+			if (preferred.CompareLength(maxSpeed.Multiply(dt)) > 0)
+				preferred.Normalize(maxSpeed);
+			else
+				preferred = CFixedVector2D(preferred.X / dt, preferred.Y / dt);
+
+			CFixedVector2D velocity = ComputeSteeringVelocity(pos, preferred);
+			if (velocity != preferred)
+			{
+				timeLeft = fixed::Zero();
+
+				if (!velocity.IsZero())
+				{
+					cmpPosition->TurnTo(atan2_approx(velocity.X, velocity.Y));
+
+					target = pos + velocity.Multiply(dt);
+					if (cmpPathfinder->CheckMovement(GetObstructionFilter(), pos.X, pos.Y, target.X, target.Y, m_Radius, m_PassClass))
+						pos = target;
+					else
+						wasObstructed = true;
+				}
+			}
+		}
+
 		while (timeLeft > fixed::Zero())
 		{
 			// If we ran out of short path, we have to stop
@@ -883,6 +945,11 @@ void CCmpUnitMotion::Move(fixed dt)
 		if (pos != initialPos)
 			cmpPosition->MoveTo(pos.X, pos.Y);
 
+		if (dt > fixed::Zero())
+			AddToMovingUnits(pos, CFixedVector2D((pos.X - initialPos.X) / dt, (pos.Y - initialPos.Y) / dt));
+		else
+			AddToMovingUnits(pos, CFixedVector2D());
+
 		if (wasObstructed)
 		{
 			// Oops, we hit something (very likely another unit).
@@ -968,6 +1035,33 @@ void CCmpUnitMotion::Move(fixed dt)
 	}
 }
 
+CFixedVector2D CCmpUnitMotion::ComputeSteeringVelocity(CFixedVector2D pos, CFixedVector2D preferred)
+{
+	CmpPtr<ICmpUnitMotionManager> cmpUnitMotionManager(GetSimContext(), SYSTEM_ENTITY);
+	if (!cmpUnitMotionManager)
+		return preferred;
+
+	// Look far enough to catch units that could reach us within the horizon
+	// if they're moving about as fast as us
+	entity_pos_t range = m_Radius*2 + preferred.Length().Multiply(Steering::HORIZON)*2;
+
+	std::vector<Steering::Neighbour> neighbours;
+	cmpUnitMotionManager->GetMovingUnitsInRange(GetEntityId(), pos, range, STEERING_MAX_NEIGHBOURS, neighbours);
+
+	return Steering::ComputeVelocity(pos, m_Radius, preferred, neighbours);
+}
+
+void CCmpUnitMotion::AddToMovingUnits(CFixedVector2D pos, CFixedVector2D velocity)
+{
+	// Formation controllers don't physically exist, so nothing should avoid them
+	if (m_FormationController)
+		return;
+
+	CmpPtr<ICmpUnitMotionManager> cmpUnitMotionManager(GetSimContext(), SYSTEM_ENTITY);
+	if (cmpUnitMotionManager)
+		cmpUnitMotionManager->AddMovingUnit(GetEntityId(), pos, velocity, m_Radius);
+}
+
 bool CCmpUnitMotion::ComputeTargetPosition(CFixedVector2D& out)
 {
 	if (m_TargetEntity == INVALID_ENTITY)
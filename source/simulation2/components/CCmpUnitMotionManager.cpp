@@ -0,0 +1,200 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "simulation2/system/Component.h"
+#include "ICmpUnitMotionManager.h"
+
+#include "simulation2/MessageTypes.h"
+#include "simulation2/serialization/SerializeTemplates.h"
+
+#include <algorithm>
+
+/**
+ * Size of the cells of the spatial hash. Units are only ever queried over
+ * short distances, so this is roughly the range of a typical query.
+ */
+static const entity_pos_t CELL_SIZE = entity_pos_t::FromInt(8);
+
+/**
+ * Queries are clamped to this range, which keeps the fixed-point distance
+ * computations from overflowing.
+ */
+static const entity_pos_t MAX_RANGE = entity_pos_t::FromInt(32);
+
+struct SMovingUnit
+{
+	entity_id_t ent;
+	CFixedVector2D pos;
+	CFixedVector2D velocity;
+	entity_pos_t radius;
+};
+
+struct SerializeMovingUnit
+{
+	template<typename S>
+	void operator()(S& serialize, const char* UNUSED(name), SMovingUnit& value)
+	{
+		serialize.NumberU32_Unbounded("entity", value.ent);
+		serialize.NumberFixed_Unbounded("x", value.pos.X);
+		serialize.NumberFixed_Unbounded("z", value.pos.Y);
+		serialize.NumberFixed_Unbounded("vx", value.velocity.X);
+		serialize.NumberFixed_Unbounded("vz", value.velocity.Y);
+		serialize.NumberFixed_Unbounded("radius", value.radius);
+	}
+};
+
+class CCmpUnitMotionManager : public ICmpUnitMotionManager
+{
+public:
+	static void ClassInit(CComponentManager& componentManager)
+	{
+		componentManager.SubscribeToMessageType(MT_TurnStart);
+	}
+
+	DEFAULT_COMPONENT_ALLOCATOR(UnitMotionManager)
+
+	// Units as they were at the end of the previous turn (used by queries)
+	std::vector<SMovingUnit> m_Units;
+
+	// Units that have moved so far this turn
+	std::vector<SMovingUnit> m_NextUnits;
+
+	// Spatial hash of m_Units: (cell key, index into m_Units), sorted
+	std::vector<std::pair<u32, u32> > m_Cells;
+
+	static std::string GetSchema()
+	{
+		return "<a:component type='system'/><empty/>";
+	}
+
+	virtual void Init(const CParamNode& UNUSED(paramNode))
+	{
+	}
+
+	virtual void Deinit()
+	{
+	}
+
+	// m_Units and m_Cells are only used within a turn, so only the
+	// units recorded for the next turn need to be saved
+
+	virtual void Serialize(ISerializer& serialize)
+	{
+		SerializeVector<SerializeMovingUnit>()(serialize, "units", m_NextUnits);
+	}
+
+	virtual void Deserialize(const CParamNode& paramNode, IDeserializer& deserialize)
+	{
+		Init(paramNode);
+
+		SerializeVector<SerializeMovingUnit>()(deserialize, "units", m_NextUnits);
+	}
+
+	virtual void HandleMessage(const CMessage& msg, bool UNUSED(global))
+	{
+		switch (msg.GetType())
+		{
+		case MT_TurnStart:
+		{
+			m_Units.swap(m_NextUnits);
+			m_NextUnits.clear();
+			RebuildCells();
+			break;
+		}
+		}
+	}
+
+	virtual void AddMovingUnit(entity_id_t ent, CFixedVector2D pos, CFixedVector2D velocity, entity_pos_t radius)
+	{
+		SMovingUnit unit = { ent, pos, velocity, radius };
+		m_NextUnits.push_back(unit);
+	}
+
+	virtual void GetMovingUnitsInRange(entity_id_t ent, CFixedVector2D pos, entity_pos_t range, size_t maxCount, std::vector<Steering::Neighbour>& out)
+	{
+		out.clear();
+
+		range = std::min(range, MAX_RANGE);
+
+		std::vector<std::pair<fixed, u32> > found; // (squared distance, index into m_Units)
+
+		const i32 x0 = GetCell(pos.X - range);
+		const i32 x1 = GetCell(pos.X + range);
+		const i32 z0 = GetCell(pos.Y - range);
+		const i32 z1 = GetCell(pos.Y + range);
+		for (i32 cz = z0; cz <= z1; ++cz)
+		{
+			for (i32 cx = x0; cx <= x1; ++cx)
+			{
+				std::vector<std::pair<u32, u32> >::const_iterator it =
+					std::lower_bound(m_Cells.begin(), m_Cells.end(), std::make_pair(GetCellKey(cx, cz), (u32)0));
+				for (; it != m_Cells.end() && it->first == GetCellKey(cx, cz); ++it)
+				{
+					const SMovingUnit& unit = m_Units[it->second];
+					if (unit.ent == ent)
+						continue;
+
+					CFixedVector2D offset = unit.pos - pos;
+					if (offset.X.Absolute() > range || offset.Y.Absolute() > range || offset.CompareLength(range) > 0)
+						continue;
+
+					found.push_back(std::make_pair(offset.Dot(offset), it->second));
+				}
+			}
+		}
+
+		// Keep the nearest units (indexes are unique and in a deterministic
+		// order, so ties are broken consistently)
+		if (found.size() > maxCount)
+		{
+			std::partial_sort(found.begin(), found.begin() + maxCount, found.end());
+			found.resize(maxCount);
+		}
+
+		out.reserve(found.size());
+		for (size_t i = 0; i < found.size(); ++i)
+		{
+			const SMovingUnit& unit = m_Units[found[i].second];
+			Steering::Neighbour neighbour = { unit.pos, unit.velocity, unit.radius };
+			out.push_back(neighbour);
+		}
+	}
+
+private:
+	static i32 GetCell(entity_pos_t x)
+	{
+		return (x / CELL_SIZE).ToInt_RoundToNegInfinity();
+	}
+
+	static u32 GetCellKey(i32 cx, i32 cz)
+	{
+		return ((u32)(cx & 0xFFFF) << 16) | (u32)(cz & 0xFFFF);
+	}
+
+	void RebuildCells()
+	{
+		m_Cells.clear();
+		m_Cells.reserve(m_Units.size());
+		for (size_t i = 0; i < m_Units.size(); ++i)
+			m_Cells.push_back(std::make_pair(GetCellKey(GetCell(m_Units[i].pos.X), GetCell(m_Units[i].pos.Y)), (u32)i));
+		std::sort(m_Cells.begin(), m_Cells.end());
+	}
+};
+
+REGISTER_COMPONENT_TYPE(UnitMotionManager)
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,8 +27,8 @@
 #include "simulation2/MessageTypes.h"
 #include "simulation2/components/ICmpFootprint.h"
 #include "simulation2/components/ICmpSelectable.h"
+#include "simulation2/components/ICmpUnitMotion.h"
 
-#include "graphics/Frustum.h"
 #include "graphics/Model.h"
 #include "graphics/ObjectBase.h"
 #include "graphics/ObjectEntry.h"
@@ -38,7 +38,16 @@
 #include "maths/Matrix3D.h"
 #include "maths/Vector3D.h"
 #include "ps/CLogger.h"
-#include "renderer/Scene.h"
+
+#include <map>
+
+/**
+ * How long (in seconds of simulation time) a unit must stay out of sight
+ * before its actor is released. Lots of actors (e.g. the trees of a whole
+ * forest) can become hidden at once when the displayed player changes,
+ * so this shouldn't be so short that they get recreated immediately.
+ */
+static const float UNIT_RELEASE_DELAY = 10.f;
 
 class CCmpVisualActor : public ICmpVisual
 {
@@ -47,15 +56,37 @@ public:
 	{
 		componentManager.SubscribeToMessageType(MT_Update_Final);
 		componentManager.SubscribeToMessageType(MT_Interpolate);
-		componentManager.SubscribeToMessageType(MT_RenderSubmit);
 		componentManager.SubscribeToMessageType(MT_OwnershipChanged);
+		componentManager.SubscribeToMessageType(MT_PositionChanged);
 		componentManager.SubscribeGloballyToMessageType(MT_TerrainChanged);
 	}
 
 	DEFAULT_COMPONENT_ALLOCATOR(VisualActor)
 
 	std::wstring m_ActorName;
+
+	// The actor is only instantiated when the entity might be seen (i.e. it's in
+	// the world and not hidden by LOS), since there can be far more entities than
+	// are ever visible at once. m_Unit is NULL until then, after being out of sight
+	// for UNIT_RELEASE_DELAY, and also when graphics are disabled
 	CUnit* m_Unit;
+	bool m_UnitLoadFailed; // whether the actor couldn't be loaded, so we shouldn't try again
+	float m_HiddenTime; // how long m_Unit has been out of sight
+
+	// Whether the unit is visible but neither moving nor animated, and can't start
+	// by itself (like most trees, rocks and buildings), so Interpolate has nothing
+	// to update until something else changes it
+	bool m_Static;
+
+	// Template data needed to instantiate the actor
+	u32 m_ModelFlags;
+	bool m_HasSelectionShape;
+	CModelAbstract::CustomSelectionShape m_SelectionShape;
+
+	// State that's kept in the unit while it exists, which has to be restored
+	// when it's recreated
+	CStr m_EntitySelection; // selection set by SetUnitEntitySelection, if any
+	std::map<std::string, float> m_Variables;
 
 	fixed m_R, m_G, m_B; // shading colour
 
@@ -137,6 +168,11 @@ public:
 	{
 		m_PreviouslyRendered = false;
 		m_Unit = NULL;
+		m_UnitLoadFailed = false;
+		m_HiddenTime = 0.f;
+		m_Static = false;
+		m_ModelFlags = 0;
+		m_HasSelectionShape = false;
 		m_Visibility = ICmpRangeManager::VIS_HIDDEN;
 
 		m_R = m_G = m_B = fixed::FromInt(1);
@@ -151,48 +187,25 @@ public:
 		else
 			m_ActorName = paramNode.GetChild("Actor").ToString();
 
-		std::set<CStr> selections;
-		m_Unit = GetSimContext().GetUnitManager().CreateUnit(m_ActorName, GetActorSeed(), selections);
-		if (m_Unit)
-		{
-			CModelAbstract& model = m_Unit->GetModel();
-			if (model.ToCModel())
-			{
-				u32 modelFlags = 0;
-
-				if (paramNode.GetChild("SilhouetteDisplay").ToBool())
-					modelFlags |= MODELFLAG_SILHOUETTE_DISPLAY;
-
-				if (paramNode.GetChild("SilhouetteOccluder").ToBool())
-					modelFlags |= MODELFLAG_SILHOUETTE_OCCLUDER;
-
-				CmpPtr<ICmpVision> cmpVision(GetSimContext(), GetEntityId());
-				if (cmpVision && cmpVision->GetAlwaysVisible())
-					modelFlags |= MODELFLAG_IGNORE_LOS;
-
-				model.ToCModel()->AddFlagsRec(modelFlags);
-			}
+		if (paramNode.GetChild("SilhouetteDisplay").ToBool())
+			m_ModelFlags |= MODELFLAG_SILHOUETTE_DISPLAY;
 
-			// Initialize the model's selection shape descriptor. This currently relies on the component initialization order; the 
-			// Footprint component must be initialized before this component (VisualActor) to support the ability to use the footprint
-			// shape for the selection box (instead of the default recursive bounding box). See TypeList.h for the order in
-			// which components are initialized; if for whatever reason you need to get rid of this dependency, you can always just
-			// initialize the selection shape descriptor on-demand.
-			InitSelectionShapeDescriptor(model, paramNode);
+		if (paramNode.GetChild("SilhouetteOccluder").ToBool())
+			m_ModelFlags |= MODELFLAG_SILHOUETTE_OCCLUDER;
 
-			m_Unit->SetID(GetEntityId());
-		}
+		// Initialize the selection shape descriptor. This currently relies on the component initialization order; the 
+		// Footprint component must be initialized before this component (VisualActor) to support the ability to use the footprint
+		// shape for the selection box (instead of the default recursive bounding box). See TypeList.h for the order in
+		// which components are initialized; if for whatever reason you need to get rid of this dependency, you can always just
+		// initialize the selection shape descriptor on-demand.
+		InitSelectionShapeDescriptor(paramNode);
 
 		SelectAnimation("idle", false, fixed::FromInt(1), L"");
 	}
 
 	virtual void Deinit()
 	{
-		if (m_Unit)
-		{
-			GetSimContext().GetUnitManager().DeleteUnit(m_Unit);
-			m_Unit = NULL;
-		}
+		ReleaseUnit();
 	}
 
 	template<typename S>
@@ -246,19 +259,12 @@ public:
 			SelectMovementAnimation(m_AnimRunThreshold);
 
 		SetAnimationSyncRepeat(repeattime);
-
-		if (m_Unit)
-		{
-			CmpPtr<ICmpOwnership> cmpOwnership(GetSimContext(), GetEntityId());
-			if (cmpOwnership)
-				m_Unit->GetModel().SetPlayerID(cmpOwnership->GetOwner());
-		}
 	}
 
 	virtual void HandleMessage(const CMessage& msg, bool UNUSED(global))
 	{
 		// Quick exit for running in non-graphical mode
-		if (m_Unit == NULL)
+		if (!GetSimContext().HasUnitManager())
 			return;
 
 		switch (msg.GetType())
@@ -275,27 +281,34 @@ public:
 			Interpolate(msgData.deltaSimTime, msgData.offset);
 			break;
 		}
-		case MT_RenderSubmit:
+		case MT_OwnershipChanged:
 		{
-			const CMessageRenderSubmit& msgData = static_cast<const CMessageRenderSubmit&> (msg);
-			RenderSubmit(msgData.collector, msgData.frustum, msgData.culling);
+			const CMessageOwnershipChanged& msgData = static_cast<const CMessageOwnershipChanged&> (msg);
+			if (m_Unit)
+				m_Unit->GetModel().SetPlayerID(msgData.to);
+			m_Static = false;
 			break;
 		}
-		case MT_OwnershipChanged:
+		case MT_PositionChanged:
 		{
-			const CMessageOwnershipChanged& msgData = static_cast<const CMessageOwnershipChanged&> (msg);
-			m_Unit->GetModel().SetPlayerID(msgData.to);
+			m_Static = false;
 			break;
 		}
 		case MT_TerrainChanged:
 		{
 			const CMessageTerrainChanged& msgData = static_cast<const CMessageTerrainChanged&> (msg);
-			m_Unit->GetModel().SetTerrainDirty(msgData.i0, msgData.j0, msgData.i1, msgData.j1);
+			if (m_Unit)
+				m_Unit->GetModel().SetTerrainDirty(msgData.i0, msgData.j0, msgData.i1, msgData.j1);
+			m_Static = false;
 			break;
 		}
 		}
 	}
 
+	// The bounds, selection box and position are only wanted for entities that
+	// can be seen, so they don't instantiate the actor but just return nothing
+	// if it doesn't currently exist
+
 	virtual CBoundingBoxAligned GetBounds()
 	{
 		if (!m_Unit)
@@ -305,6 +318,9 @@ public:
 
 	virtual CUnit* GetUnit()
 	{
+		// The caller might change the unit, so it has to be updated again
+		m_Static = false;
+		InstantiateUnit();
 		return m_Unit;
 	}
 
@@ -324,21 +340,21 @@ public:
 
 	virtual std::wstring GetActorShortName()
 	{
-		if (!m_Unit)
+		if (!InstantiateUnit())
 			return L"";
 		return m_Unit->GetObject().m_Base->m_ShortName;
 	}
 
 	virtual std::wstring GetProjectileActor()
 	{
-		if (!m_Unit)
+		if (!InstantiateUnit())
 			return L"";
 		return m_Unit->GetObject().m_ProjectileModelName;
 	}
 
 	virtual CVector3D GetProjectileLaunchPoint()
 	{
-		if (!m_Unit)
+		if (!InstantiateUnit())
 			return CVector3D();
 
 		if (m_Unit->GetModel().ToCModel())
@@ -363,6 +379,8 @@ public:
 		m_SoundGroup = soundgroup;
 		m_AnimDesync = fixed::FromInt(1)/20; // TODO: make this an argument
 		m_AnimSyncRepeatTime = fixed::Zero();
+		m_EntitySelection.clear(); // replaced by the animation's selection
+		m_Static = false;
 
 		if (m_Unit)
 		{
@@ -374,6 +392,9 @@ public:
 
 	virtual void SetUnitEntitySelection(const CStr& selection)
 	{
+		m_EntitySelection = selection;
+		m_Static = false;
+
 		if (m_Unit)
 		{
 			m_Unit->SetEntitySelection(selection);
@@ -383,6 +404,8 @@ public:
 	virtual void SelectMovementAnimation(fixed runThreshold)
 	{
 		m_AnimRunThreshold = runThreshold;
+		m_EntitySelection.clear();
+		m_Static = false;
 
 		if (m_Unit)
 		{
@@ -418,10 +441,14 @@ public:
 		m_G = g;
 		m_B = b;
 		UNUSED2(a); // TODO: why is this even an argument?
+		m_Static = false;
 	}
 
 	virtual void SetVariable(std::string name, float value)
 	{
+		m_Variables[name] = value;
+		m_Static = false;
+
 		if (m_Unit)
 		{
 			m_Unit->GetModel().SetEntityVariable(name, value);
@@ -430,42 +457,19 @@ public:
 
 	virtual void Hotload(const VfsPath& name)
 	{
-		if (!m_Unit)
-			return;
-
 		if (name != m_ActorName)
 			return;
 
-		std::set<CStr> selections;
-		CUnit* newUnit = GetSimContext().GetUnitManager().CreateUnit(m_ActorName, GetActorSeed(), selections);
+		// Try loading the changed actor, even if the old one failed
+		m_UnitLoadFailed = false;
 
-		if (!newUnit)
+		// If there's no unit, the new actor will be used when it's next needed
+		if (!m_Unit)
 			return;
 
-		// Save some data from the old unit
-		CColor shading = m_Unit->GetModel().GetShadingColor();
-		player_id_t playerID = m_Unit->GetModel().GetPlayerID();
-
-		// Replace with the new unit
-		GetSimContext().GetUnitManager().DeleteUnit(m_Unit);
-		m_Unit = newUnit;
-
-		m_Unit->SetID(GetEntityId());
-
-		m_Unit->SetEntitySelection(m_AnimName);
-		if (m_Unit->GetAnimation())
-			m_Unit->GetAnimation()->SetAnimationState(m_AnimName, m_AnimOnce, m_AnimSpeed.ToFloat(), m_AnimDesync.ToFloat(), m_SoundGroup.c_str());
-
-		// We'll lose the exact synchronisation but we should at least make sure it's going at the correct rate
-		if (!m_AnimSyncRepeatTime.IsZero())
-			if (m_Unit->GetAnimation())
-				m_Unit->GetAnimation()->SetAnimationSyncRepeat(m_AnimSyncRepeatTime.ToFloat());
-
-		m_Unit->GetModel().SetShadingColor(shading);
-
-		m_Unit->GetModel().SetPlayerID(playerID);
-
-		// TODO: should copy/reset silhouette flags
+		// Replace with the new unit. The transform will be set by the next Interpolate
+		ReleaseUnit();
+		InstantiateUnit();
 	}
 
 private:
@@ -479,27 +483,34 @@ private:
 		return GetEntityId();
 	}
 
-	/// Helper method; initializes the model selection shape descriptor from XML. Factored out for readability of @ref Init.
-	/// The @p model argument is technically not really necessary since naturally this method is intended to initialize this
-	/// visual actor's model (I wouldn't know which other one you'd pass), but it's included here to enforce that the
-	/// component's model must have been created before using this method (i.e. to prevent accidentally calls to this method
-	/// before the model was constructed).
-	void InitSelectionShapeDescriptor(CModelAbstract& model, const CParamNode& paramNode);
+	/// Helper method; initializes the selection shape descriptor from XML, to be given to the model whenever it's
+	/// instantiated. Factored out for readability of @ref Init.
+	void InitSelectionShapeDescriptor(const CParamNode& paramNode);
+
+	/// Creates m_Unit if it doesn't exist yet, and sets it up with the component's current state.
+	/// Returns false if there's no unit (e.g. graphics are disabled, or the actor couldn't be loaded).
+	bool InstantiateUnit();
+
+	/// Deletes m_Unit, if it exists.
+	void ReleaseUnit();
+
+	/// Returns whether the unit can only change when something else changes it, i.e. the entity
+	/// can't move by itself and none of the unit's models are animated or emit particles.
+	bool CanBeStatic();
 
 	void Update(fixed turnLength);
 	void UpdateVisibility();
 	void Interpolate(float frameTime, float frameOffset);
-	void RenderSubmit(SceneCollector& collector, const CFrustum& frustum, bool culling);
 };
 
 REGISTER_COMPONENT_TYPE(VisualActor)
 
 // ------------------------------------------------------------------------------------------------------------------
 
-void CCmpVisualActor::InitSelectionShapeDescriptor(CModelAbstract& model, const CParamNode& paramNode)
+void CCmpVisualActor::InitSelectionShapeDescriptor(const CParamNode& paramNode)
 {
 	// by default, we don't need a custom selection shape and we can just keep the default behaviour
-	CModelAbstract::CustomSelectionShape* shapeDescriptor = NULL;
+	m_HasSelectionShape = false;
 
 	const CParamNode& shapeNode = paramNode.GetChild("SelectionShape");
 	if (shapeNode.IsOk())
@@ -531,11 +542,11 @@ void CCmpVisualActor::InitSelectionShapeDescriptor(CModelAbstract& model, const
 					size1 *= 2;
 				}
 
-				shapeDescriptor = new CModelAbstract::CustomSelectionShape;
-				shapeDescriptor->m_Type = CModelAbstract::CustomSelectionShape::BOX;
-				shapeDescriptor->m_Size0 = size0;
-				shapeDescriptor->m_Size1 = size1;
-				shapeDescriptor->m_Height = fpHeight.ToFloat();
+				m_HasSelectionShape = true;
+				m_SelectionShape.m_Type = CModelAbstract::CustomSelectionShape::BOX;
+				m_SelectionShape.m_Size0 = size0;
+				m_SelectionShape.m_Size1 = size1;
+				m_SelectionShape.m_Height = fpHeight.ToFloat();
 			}
 			else
 			{
@@ -545,11 +556,11 @@ void CCmpVisualActor::InitSelectionShapeDescriptor(CModelAbstract& model, const
 		else if (shapeNode.GetChild("Box").IsOk())
 		{
 			// TODO: we might need to support the ability to specify a different box center in the future
-			shapeDescriptor = new CModelAbstract::CustomSelectionShape;
-			shapeDescriptor->m_Type = CModelAbstract::CustomSelectionShape::BOX;
-			shapeDescriptor->m_Size0 = shapeNode.GetChild("Box").GetChild("@width").ToFixed().ToFloat();
-			shapeDescriptor->m_Size1 = shapeNode.GetChild("Box").GetChild("@depth").ToFixed().ToFloat();
-			shapeDescriptor->m_Height = shapeNode.GetChild("Box").GetChild("@height").ToFixed().ToFloat();
+			m_HasSelectionShape = true;
+			m_SelectionShape.m_Type = CModelAbstract::CustomSelectionShape::BOX;
+			m_SelectionShape.m_Size0 = shapeNode.GetChild("Box").GetChild("@width").ToFixed().ToFloat();
+			m_SelectionShape.m_Size1 = shapeNode.GetChild("Box").GetChild("@depth").ToFixed().ToFloat();
+			m_SelectionShape.m_Height = shapeNode.GetChild("Box").GetChild("@height").ToFixed().ToFloat();
 		}
 		else if (shapeNode.GetChild("Cylinder").IsOk())
 		{
@@ -561,18 +572,138 @@ void CCmpVisualActor::InitSelectionShapeDescriptor(CModelAbstract& model, const
 			LOGERROR(L"[VisualActor] No selection shape specified");
 		}
 	}
+}
+
+bool CCmpVisualActor::InstantiateUnit()
+{
+	if (m_Unit)
+		return true;
+
+	if (m_UnitLoadFailed || !GetSimContext().HasUnitManager())
+		return false;
+
+	std::set<CStr> selections;
+	m_Unit = GetSimContext().GetUnitManager().CreateUnit(m_ActorName, GetActorSeed(), selections);
+	if (!m_Unit)
+	{
+		m_UnitLoadFailed = true;
+		return false;
+	}
+
+	m_HiddenTime = 0.f;
+	m_Static = false;
+
+	CModelAbstract& model = m_Unit->GetModel();
+	if (model.ToCModel())
+	{
+		u32 modelFlags = m_ModelFlags;
+
+		CmpPtr<ICmpVision> cmpVision(GetSimContext(), GetEntityId());
+		if (cmpVision && cmpVision->GetAlwaysVisible())
+			modelFlags |= MODELFLAG_IGNORE_LOS;
+
+		model.ToCModel()->AddFlagsRec(modelFlags);
+	}
+
+	// the model is responsible for cleaning up the descriptor
+	if (m_HasSelectionShape)
+		model.SetCustomSelectionShape(new CModelAbstract::CustomSelectionShape(m_SelectionShape));
+
+	m_Unit->SetID(GetEntityId());
+
+	CmpPtr<ICmpOwnership> cmpOwnership(GetSimContext(), GetEntityId());
+	if (cmpOwnership)
+		model.SetPlayerID(cmpOwnership->GetOwner());
+
+	model.SetShadingColor(CColor(m_R.ToFloat(), m_G.ToFloat(), m_B.ToFloat(), 1.0f));
+
+	// Restore the animation. We'll lose the exact synchronisation (and the movement animation
+	// will be corrected by the next Update) but it should at least be going at the correct rate
+	if (m_AnimRunThreshold.IsZero())
+	{
+		m_Unit->SetEntitySelection(m_AnimName);
+		if (m_Unit->GetAnimation())
+			m_Unit->GetAnimation()->SetAnimationState(m_AnimName, m_AnimOnce, m_AnimSpeed.ToFloat(), m_AnimDesync.ToFloat(), m_SoundGroup.c_str());
+	}
+	else
+	{
+		m_Unit->SetEntitySelection("walk");
+		if (m_Unit->GetAnimation())
+			m_Unit->GetAnimation()->SetAnimationState("walk", false, 1.f, 0.f, L"");
+	}
+
+	if (!m_AnimSyncRepeatTime.IsZero())
+		if (m_Unit->GetAnimation())
+			m_Unit->GetAnimation()->SetAnimationSyncRepeat(m_AnimSyncRepeatTime.ToFloat());
+
+	if (!m_EntitySelection.empty())
+		m_Unit->SetEntitySelection(m_EntitySelection);
+
+	for (std::map<std::string, float>::const_iterator it = m_Variables.begin(); it != m_Variables.end(); ++it)
+		model.SetEntityVariable(it->first, it->second);
+
+	// Put it in the right place straight away, in case it's needed before the next Interpolate
+	CmpPtr<ICmpPosition> cmpPosition(GetSimContext(), GetEntityId());
+	if (cmpPosition && cmpPosition->IsInWorld())
+	{
+		bool floating = m_Unit->GetObject().m_Base->m_Properties.m_FloatOnWater;
+		model.SetTransform(cmpPosition->GetInterpolatedTransform(0.f, floating));
+	}
+
+	return true;
+}
+
+void CCmpVisualActor::ReleaseUnit()
+{
+	if (m_Unit)
+	{
+		GetSimContext().GetUnitManager().DeleteUnit(m_Unit);
+		m_Unit = NULL;
+	}
+	m_Static = false;
+}
+
+// Returns whether the model or any of its props emit particles
+static bool HasParticleEmitters(CModelAbstract& model)
+{
+	if (model.ToCModelParticleEmitter())
+		return true;
+
+	CModel* cmodel = model.ToCModel();
+	if (cmodel)
+	{
+		const std::vector<CModel::Prop>& props = cmodel->GetProps();
+		for (size_t i = 0; i < props.size(); ++i)
+			if (HasParticleEmitters(*props[i].m_Model))
+				return true;
+	}
+
+	return false;
+}
+
+bool CCmpVisualActor::CanBeStatic()
+{
+	if (!m_AnimRunThreshold.IsZero())
+		return false;
+
+	if (m_Unit->GetAnimation() && !m_Unit->GetAnimation()->IsStatic())
+		return false;
 
-	// the model is now responsible for cleaning up the descriptor
-	model.SetCustomSelectionShape(shapeDescriptor);
+	CmpPtr<ICmpUnitMotion> cmpUnitMotion(GetSimContext(), GetEntityId());
+	if (cmpUnitMotion)
+		return false;
+
+	return !HasParticleEmitters(m_Unit->GetModel());
 }
 
 void CCmpVisualActor::Update(fixed turnLength)
 {
+	// Even without a unit, keep track of the visibility so we know when it's needed
+	UpdateVisibility();
+
 	if (m_Unit == NULL)
 		return;
 
-	UpdateVisibility();
-
 	// If we're in the special movement mode, select an appropriate animation
 	if (!m_AnimRunThreshold.IsZero())
 	{
@@ -631,6 +762,8 @@ void CCmpVisualActor::UpdateVisibility()
 
 	if (m_Visibility != oldVisibility)
 	{
+		m_Static = false;
+
 		// Change the visibility of the visual actor's selectable if it has one.
 		CmpPtr<ICmpSelectable> cmpSelectable(GetSimContext(), GetEntityId());
 		if (cmpSelectable)
@@ -640,19 +773,47 @@ void CCmpVisualActor::UpdateVisibility()
 
 void CCmpVisualActor::Interpolate(float frameTime, float frameOffset)
 {
-	if (m_Unit == NULL)
+	// There's nothing to update for static units until they're changed, which
+	// makes large forests nearly free
+	if (m_Static)
 		return;
 
-	// Disable rendering of the unit if it has no position
 	CmpPtr<ICmpPosition> cmpPosition(GetSimContext(), GetEntityId());
-	if (!cmpPosition || !cmpPosition->IsInWorld())
-		return;
-	else if (!m_PreviouslyRendered)
+	const bool inWorld = (cmpPosition && cmpPosition->IsInWorld());
+	if (inWorld && !m_PreviouslyRendered)
 	{
 		UpdateVisibility();
 		m_PreviouslyRendered = true;
 	}
 
+	// Only keep the unit while it might be seen, with some delay
+	// so it's not recreated every time something walks in and out of the fog
+	if (!inWorld || m_Visibility == ICmpRangeManager::VIS_HIDDEN)
+	{
+		if (m_Unit == NULL)
+			return;
+
+		m_HiddenTime += frameTime;
+		if (m_HiddenTime >= UNIT_RELEASE_DELAY)
+		{
+			ReleaseUnit();
+			return;
+		}
+	}
+	else
+	{
+		m_HiddenTime = 0.f;
+		if (!InstantiateUnit())
+			return;
+	}
+
+	// Disable rendering of the unit if it has no position
+	if (!inWorld)
+	{
+		GetSimContext().GetUnitManager().GetQuadtree().Remove(m_Unit);
+		return;
+	}
+
 	// Even if HIDDEN due to LOS, we need to set up the transforms
 	// so that projectiles will be launched from the right place
 
@@ -662,29 +823,26 @@ void CCmpVisualActor::Interpolate(float frameTime, float frameOffset)
 
 	CModelAbstract& model = m_Unit->GetModel();
 
+	// If the unit stays where it was while time passes, it might have stopped for good
+	const bool unchanged = (frameTime > 0.f && transform == model.GetTransform());
+
 	model.SetTransform(transform);
 	m_Unit->UpdateModel(frameTime);
 
-	// If not hidden, then we need to set up some extra state for rendering
+	// If not hidden, then we need to set up some extra state for rendering,
+	// and put the unit in the quadtree so it will be submitted for rendering
+	// (if it's inside the frustum)
 	if (m_Visibility != ICmpRangeManager::VIS_HIDDEN)
 	{
 		model.ValidatePosition();
 		model.SetShadingColor(CColor(m_R.ToFloat(), m_G.ToFloat(), m_B.ToFloat(), 1.0f));
-	}
-}
+		GetSimContext().GetUnitManager().GetQuadtree().Update(m_Unit, model.GetWorldBoundsRec());
 
-void CCmpVisualActor::RenderSubmit(SceneCollector& collector, const CFrustum& frustum, bool culling)
-{
-	if (m_Unit == NULL)
-		return;
-
-	if (m_Visibility == ICmpRangeManager::VIS_HIDDEN)
-		return;
-
-	CModelAbstract& model = m_Unit->GetModel();
-
-	if (culling && !frustum.IsBoxVisible(CVector3D(0, 0, 0), model.GetWorldBoundsRec()))
-		return;
-
-	collector.SubmitRecursive(&model);
+		if (unchanged)
+			m_Static = CanBeStatic();
+	}
+	else
+	{
+		GetSimContext().GetUnitManager().GetQuadtree().Remove(m_Unit);
+	}
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,11 +24,21 @@ class ICmpAIInterface : public IComponent
 {
 public:
 	/**
-	 * Returns a script object that represents the current world state,
-	 * to be passed to AI scripts.
+	 * Returns a script object that represents the changes to the world state since
+	 * the previous call to GetRepresentation or GetFullRepresentation, to be passed
+	 * to AI scripts.
+	 * Its "entities" property only contains the entities that have changed, each with
+	 * only its changed properties; destroyed entities are null. Its other properties
+	 * (e.g. "events") replace the previous ones.
 	 */
 	virtual CScriptVal GetRepresentation() = 0;
 
+	/**
+	 * Returns a script object that represents the complete current world state,
+	 * to be passed to AI scripts (e.g. when they start, or after deserialization).
+	 */
+	virtual CScriptVal GetFullRepresentation() = 0;
+
 	DECLARE_INTERFACE_TYPE(AIInterface)
 };
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -33,10 +33,27 @@
  * Alternatively, commands can be sent to the networking system, and they will be executed
  * at the start of some later turn by all players simultaneously. (This will typically be
  * used for user inputs.)
+ *
+ * Commands are normally executed by the ProcessCommand script function, but native handlers
+ * can be registered for particular command types (see RegisterNativeCommand).
  */
 class ICmpCommandQueue : public IComponent
 {
 public:
+	/**
+	 * Native command handler. Returns true if it has fully executed @p cmd, or false if
+	 * ProcessCommand must still be called for it. Commands it handles must end up with
+	 * exactly the same effect as ProcessCommand would have had (else e.g. old replays
+	 * would go out of sync); it's just a faster way of getting there.
+	 */
+	typedef bool (*NativeCommandHandler)(const CSimContext& context, player_id_t player, CScriptVal cmd);
+
+	/**
+	 * Registers a native handler for commands with the given "type", which is
+	 * tried before ProcessCommand. Replaces any previous handler for that type.
+	 */
+	virtual void RegisterNativeCommand(const std::string& type, NativeCommandHandler handler) = 0;
+
 	/**
 	 * Pushes a new command onto the local queue. @p cmd does not need to be rooted.
 	 */
@@ -48,8 +65,9 @@ public:
 	virtual void PostNetworkCommand(CScriptVal cmd) = 0;
 
 	/**
-	 * Calls the ProcessCommand(player, cmd) global script function for each command in the
-	 * local queue and in @p commands, and empties the local queue.
+	 * Executes each command in the local queue and in @p commands (with the native handler for
+	 * its type, else the ProcessCommand(player, cmd) global script function), and empties the
+	 * local queue.
 	 */
 	virtual void FlushTurn(const std::vector<SimulationCommand>& commands) = 0;
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -214,6 +214,14 @@ public:
 		TILE_OUTOFBOUNDS = (1 << 2) // set if this tile is outside the world boundaries
 	};
 
+	/**
+	 * Inclusive range of tiles [i0, i1] x [j0, j1].
+	 */
+	struct TileRect
+	{
+		u16 i0, j0, i1, j1;
+	};
+
 	/**
 	 * Convert the current set of shapes onto a grid.
 	 * Tiles that are intersected by a pathfind-blocking shape will have TILE_OBSTRUCTED_PATHFINDING set;
@@ -221,10 +229,13 @@ public:
 	 * tiles that are outside the world bounds will also have TILE_OUTOFBOUNDS;
 	 * others will be set to 0.
 	 * This is very cheap if the grid has been rasterised before and the set of shapes has not changed.
+	 * If only a few shapes have changed since the grid was last rasterised, only the tiles
+	 * near them will be recomputed.
 	 * @param grid the grid to be updated
+	 * @param dirtyRect if this returns true, set to the range of tiles that may have changed
 	 * @return true if any changes were made to the grid, false if it was already up-to-date
 	 */
-	virtual bool Rasterise(Grid<u8>& grid) = 0;
+	virtual bool Rasterise(Grid<u8>& grid, TileRect& dirtyRect) = 0;
 
 	/**
 	 * Standard representation for all types of shapes, for use with geometry processing code.
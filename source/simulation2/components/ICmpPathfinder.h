@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -95,6 +95,16 @@ public:
 
 	virtual const Grid<u16>& GetPassabilityGrid() = 0;
 
+	/**
+	 * Returns a read-only snapshot of the current passability grid, which stays valid
+	 * (and unchanged) for as long as the caller holds a reference to it, and can be
+	 * read from other threads.
+	 * This doesn't copy the grid; instead the pathfinder copies its own grid before it
+	 * next modifies it, if any snapshots are still alive, so callers should release
+	 * them as soon as possible.
+	 */
+	virtual shared_ptr<const Grid<u16> > GetPassabilityGridSnapshot() = 0;
+
 	/**
 	 * Compute a tile-based path from the given point to the goal, and return the set of waypoints.
 	 * The waypoints correspond to the centers of horizontally/vertically adjacent tiles
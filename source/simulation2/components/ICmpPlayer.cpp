@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -57,6 +57,11 @@ public:
 	{
 		return m_Script.Call<bool>("HasStartingCamera");
 	}
+
+	virtual bool CanControlAllUnits()
+	{
+		return m_Script.Call<bool>("CanControlAllUnits");
+	}
 };
 
 REGISTER_COMPONENT_SCRIPT_WRAPPER(PlayerScripted)
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -26,7 +26,8 @@ class CFixedVector3D;
 /**
  * Player data.
  * (This interface only includes the functions needed by native code for loading maps,
- * and for minimap rendering; most player interaction is handled by scripts instead.)
+ * minimap rendering and native command handlers; most player interaction is handled
+ * by scripts instead.)
  */
 class ICmpPlayer : public IComponent
 {
@@ -38,6 +39,8 @@ public:
 
 	virtual bool HasStartingCamera() = 0;
 
+	virtual bool CanControlAllUnits() = 0;
+
 	DECLARE_INTERFACE_TYPE(Player)
 };
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -183,6 +183,7 @@ public:
 	{
 	private:
 		friend class CCmpRangeManager;
+		friend class CLOSTexture;
 		friend class TestLOSTexture;
 
 		CLosQuerier(u32 playerMask, const std::vector<u32>& data, ssize_t verticesPerSide) :
@@ -319,6 +320,31 @@ public:
 	 */
 	virtual i32 GetPercentMapExplored(player_id_t player) = 0;
 
+	/**
+	 * Size (in vertexes per side) of the blocks used by GetAndClearLosDirtyBlocks.
+	 */
+	static const ssize_t LOS_DIRTY_BLOCK_SIZE = 16;
+
+	/**
+	 * Sets @p blocks to a grid of LOS_DIRTY_BLOCK_SIZE*LOS_DIRTY_BLOCK_SIZE vertex
+	 * blocks (row-major, rounding up the number of blocks per side), with a
+	 * non-zero value for each block whose LOS state might have changed (for any
+	 * player) since the last call, and then resets it.
+	 * This is for the renderer to only update the changed parts of the LOS texture;
+	 * it is not serialized and has no effect on the simulation.
+	 */
+	virtual void GetAndClearLosDirtyBlocks(std::vector<u8>& blocks) = 0;
+
+	/**
+	 * Returns a number that changes whenever the LOS state of the vertexes in block
+	 * (@p bi, @p bj) (of LOS_DIRTY_BLOCK_SIZE*LOS_DIRTY_BLOCK_SIZE vertexes, as in
+	 * GetAndClearLosDirtyBlocks) might have changed for any player. Unlike the dirty
+	 * blocks this is never reset, so any number of renderer-side components can use it
+	 * to tell whether data they derived from the LOS state is still valid.
+	 * It is not serialized and has no effect on the simulation.
+	 */
+	virtual u32 GetLosBlockRevision(ssize_t bi, ssize_t bj) = 0;
+
 
 	/**
 	 * Perform some internal consistency checks for testing/debugging.
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -37,6 +37,12 @@ public:
 
 	virtual float GetExactGroundLevel(float x, float z) = 0;
 
+	/**
+	 * Sets @p heights to GetExactGroundLevel of each of the @p n points given as
+	 * consecutive (x, z) pairs in @p coords. Faster than calling it for each point.
+	 */
+	virtual void GetExactGroundLevels(const float* coords, size_t n, float* heights) = 0;
+
 	/**
 	 * Returns number of tiles per side on the terrain.
 	 * Return value is always non-zero.
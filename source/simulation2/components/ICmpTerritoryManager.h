@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -40,6 +40,14 @@ public:
 	 */
 	virtual const Grid<u8>& GetTerritoryGrid() = 0;
 
+	/**
+	 * Returns the same grid as GetTerritoryGrid, as a read-only snapshot that stays
+	 * valid for as long as the caller holds a reference to it (and can be read from
+	 * other threads). The grid is never modified once computed; when the territories
+	 * change, a new grid is computed instead.
+	 */
+	virtual shared_ptr<const Grid<u8> > GetTerritoryGridSnapshot() = 0;
+
 	/**
 	 * Get owner of territory at given position.
 	 * @return player ID of owner; 0 if neutral territory
@@ -0,0 +1,52 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_ICMPUNITMOTIONMANAGER
+#define INCLUDED_ICMPUNITMOTIONMANAGER
+
+#include "simulation2/system/Interface.h"
+
+#include "simulation2/helpers/Steering.h"
+
+/**
+ * Keeps track of where moving units are and how fast they're going, so that
+ * UnitMotion can steer units around each other locally instead of treating
+ * every nearby unit as an obstruction in short path computations.
+ *
+ * Units add themselves each turn after they've moved; queries during a turn
+ * see the units as they were at the end of the previous turn, so the result
+ * doesn't depend on the order the units are updated in.
+ */
+class ICmpUnitMotionManager : public IComponent
+{
+public:
+	/**
+	 * Records that unit @p ent ended this turn at @p pos, moving at @p velocity
+	 * (in metres per second). It will be visible to queries during the next turn.
+	 */
+	virtual void AddMovingUnit(entity_id_t ent, CFixedVector2D pos, CFixedVector2D velocity, entity_pos_t radius) = 0;
+
+	/**
+	 * Returns the (at most @p maxCount nearest) units, other than @p ent, whose
+	 * centres were within @p range of @p pos at the end of the previous turn.
+	 */
+	virtual void GetMovingUnitsInRange(entity_id_t ent, CFixedVector2D pos, entity_pos_t range, size_t maxCount, std::vector<Steering::Neighbour>& out) = 0;
+
+	DECLARE_INTERFACE_TYPE(UnitMotionManager)
+};
+
+#endif // INCLUDED_ICMPUNITMOTIONMANAGER
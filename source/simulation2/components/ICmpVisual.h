@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -30,6 +30,10 @@ class CUnit;
 
 /**
  * The visual representation of an entity (typically an actor).
+ *
+ * The representation may only exist while the entity might be seen (e.g. it's not
+ * hidden by LOS). The bounds, selection box and position are empty while it doesn't
+ * exist, and the other getters create it when they're called.
  */
 class ICmpVisual : public IComponent
 {
@@ -73,8 +77,8 @@ public:
 	virtual CVector3D GetProjectileLaunchPoint() = 0;
 
 	/**
-	 * Returns the underlying unit of this visual actor. May return NULL to indicate that no unit exists (e.g. may happen if the
-	 * game is started without graphics rendering).
+	 * Returns the underlying unit of this visual actor, creating it if necessary. May return NULL to indicate that no unit
+	 * exists (e.g. may happen if the game is started without graphics rendering).
 	 * Originally intended for introspection purposes in Atlas; for other purposes, consider using a specialized getter first.
 	 */
 	virtual CUnit* GetUnit() = 0;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,6 +18,49 @@
 #include "simulation2/system/ComponentTest.h"
 
 #include "simulation2/components/ICmpCommandQueue.h"
+#include "simulation2/components/ICmpOwnership.h"
+#include "simulation2/components/ICmpPlayer.h"
+#include "simulation2/components/ICmpPlayerManager.h"
+
+#include "ps/Overlay.h"
+#include "maths/FixedVector3D.h"
+
+class MockPlayerManager : public ICmpPlayerManager
+{
+public:
+	DEFAULT_MOCK_COMPONENT()
+
+	virtual void AddPlayer(entity_id_t UNUSED(ent)) { }
+	virtual int32_t GetNumPlayers() { return 2; }
+	virtual entity_id_t GetPlayerByID(int32_t id) { return id < 2 ? 100 + id : INVALID_ENTITY; }
+};
+
+class MockPlayer : public ICmpPlayer
+{
+public:
+	DEFAULT_MOCK_COMPONENT()
+
+	virtual CColor GetColour() { return CColor(); }
+	virtual std::wstring GetCiv() { return L""; }
+	virtual CFixedVector3D GetStartingCameraPos() { return CFixedVector3D(); }
+	virtual CFixedVector3D GetStartingCameraRot() { return CFixedVector3D(); }
+	virtual bool HasStartingCamera() { return false; }
+	virtual bool CanControlAllUnits() { return false; }
+};
+
+class MockOwnership : public ICmpOwnership
+{
+public:
+	DEFAULT_MOCK_COMPONENT()
+
+	MockOwnership(player_id_t owner) : m_Owner(owner) { }
+
+	virtual player_id_t GetOwner() { return m_Owner; }
+	virtual void SetOwner(player_id_t playerID) { m_Owner = playerID; }
+	virtual void SetOwnerQuiet(player_id_t playerID) { m_Owner = playerID; }
+
+	player_id_t m_Owner;
+};
 
 class TestCmpCommandQueue : public CxxTest::TestSuite
 {
@@ -70,4 +113,51 @@ public:
 		TS_ASSERT(test.GetScriptInterface().Eval("uneval(cmds)", output));
 		TS_ASSERT_STR_EQUALS(output, "[[1, [1, 2, 3]], [-1, {x:4}], [10, {y:5}]]");
 	}
+
+	void test_native()
+	{
+		ComponentTestHelper test;
+
+		MockPlayerManager playerManager;
+		test.AddMock(SYSTEM_ENTITY, IID_PlayerManager, playerManager);
+		MockPlayer player0, player1;
+		test.AddMock(100, IID_Player, player0);
+		test.AddMock(101, IID_Player, player1);
+		MockOwnership ownership1(1), ownership2(0);
+		test.AddMock(1, IID_Ownership, ownership1);
+		test.AddMock(2, IID_Ownership, ownership2);
+
+		ICmpCommandQueue* cmp = test.Add<ICmpCommandQueue>(CID_CommandQueue, "");
+
+		TS_ASSERT(test.GetScriptInterface().Eval("var cmds = []; function ProcessCommand(player, cmd) { cmds.push([player, cmd.n]); }"));
+
+		const char* cmds[] = {
+			"({n:1, type:'walk', entities:[1]})", // owned
+			"({n:2, type:'walk', entities:[2, 1]})", // partially owned
+			"({n:3, type:'walk', entities:[2, 3]})", // not owned: skipped
+			"({n:4, type:'stop', entities:[]})", // skipped
+			"({n:5, type:'train', entities:[2]})", // no native handler
+			"({n:6, type:'walk'})", // malformed: left to the script
+		};
+		for (size_t i = 0; i < ARRAY_SIZE(cmds); ++i)
+		{
+			CScriptVal cmd;
+			TS_ASSERT(test.GetScriptInterface().Eval(cmds[i], cmd));
+			cmp->PushLocalCommand(1, cmd);
+		}
+
+		// Invalid player: skipped
+		CScriptVal cmd;
+		TS_ASSERT(test.GetScriptInterface().Eval("({n:7, type:'walk', entities:[1]})", cmd));
+		cmp->PushLocalCommand(2, cmd);
+
+		test.Roundtrip();
+
+		std::vector<SimulationCommand> empty;
+		cmp->FlushTurn(empty);
+
+		std::string output;
+		TS_ASSERT(test.GetScriptInterface().Eval("uneval(cmds)", output));
+		TS_ASSERT_STR_EQUALS(output, "[[1, 1], [1, 2], [1, 5], [1, 6]]");
+	}
 };
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,6 +18,9 @@
 #include "simulation2/system/ComponentTest.h"
 
 #include "simulation2/components/ICmpObstructionManager.h"
+#include "simulation2/helpers/Geometry.h"
+
+#include <boost/random/linear_congruential.hpp>
 
 class TestCmpObstructionManager : public CxxTest::TestSuite
 {
@@ -474,4 +477,104 @@ public:
 		TS_ASSERT_EQUALS(obSquare3.u, CFixedVector2D(fixed::FromInt(1), fixed::FromInt(0)));
 		TS_ASSERT_EQUALS(obSquare3.v, CFixedVector2D(fixed::FromInt(0), fixed::FromInt(1)));
 	}
+
+	/**
+	 * Verifies that rasterising only the tiles affected by changed shapes gives the
+	 * same result as rasterising the whole grid.
+	 */
+	void test_rasterise_partial()
+	{
+		Grid<u8> grid(250, 250);
+		ICmpObstructionManager::TileRect dirtyRect;
+		TS_ASSERT(cmp->Rasterise(grid, dirtyRect));
+		TS_ASSERT_EQUALS(dirtyRect.i1, 249);
+		TS_ASSERT(!cmp->Rasterise(grid, dirtyRect));
+
+		cmp->MoveShape(shape3, fixed::FromInt(100), fixed::FromInt(120), fixed::Zero());
+		cmp->AddStaticShape(4, fixed::FromInt(130), fixed::FromInt(110), fixed::FromFloat(0.7f), fixed::FromInt(20), fixed::FromInt(8),
+			ICmpObstructionManager::FLAG_BLOCK_PATHFINDING | ICmpObstructionManager::FLAG_BLOCK_FOUNDATION, 4);
+		cmp->RemoveShape(shape2);
+
+		TS_ASSERT(cmp->Rasterise(grid, dirtyRect));
+		TS_ASSERT_LESS_THAN(dirtyRect.i1 - dirtyRect.i0, 60);
+		TS_ASSERT_LESS_THAN(dirtyRect.j1 - dirtyRect.j0, 60);
+
+		Grid<u8> fullGrid(250, 250);
+		TS_ASSERT(cmp->Rasterise(fullGrid, dirtyRect));
+		TS_ASSERT_EQUALS(dirtyRect.i0, 0);
+		TS_ASSERT_EQUALS(dirtyRect.j1, 249);
+
+		for (u16 j = 0; j < 250; ++j)
+			for (u16 i = 0; i < 250; ++i)
+				TS_ASSERT_EQUALS(grid.get(i, j), fullGrid.get(i, j));
+	}
+
+	/**
+	 * Verifies that TestLine gives the same results as testing the line against every shape, using lots of
+	 * random static shapes (some of which get moved and removed) so that its internal cell grid gets exercised.
+	 */
+	void test_testline_random()
+	{
+		boost::rand48 rng(1234);
+		NullObstructionFilter nullFilter;
+
+		std::vector<tag_t> staticShapes;
+		staticShapes.push_back(shape1);
+		for (int i = 0; i < 200; ++i)
+		{
+			fixed x = fixed::FromInt(rng() % 200);
+			fixed z = fixed::FromInt(rng() % 200);
+			fixed a = fixed::FromInt(rng() % 628) / 100;
+			fixed w = fixed::FromInt(1 + rng() % 12);
+			fixed h = fixed::FromInt(1 + rng() % 12);
+			staticShapes.push_back(cmp->AddStaticShape(100 + i, x, z, a, w, h, ICmpObstructionManager::FLAG_BLOCK_MOVEMENT, 100 + i));
+
+			// Test a line now and then, so updates are made both before and after
+			// the grid is built
+			if (i == 50)
+				cmp->TestLine(nullFilter, fixed::FromInt(5), fixed::FromInt(5), fixed::FromInt(6), fixed::FromInt(6), fixed::Zero());
+		}
+
+		for (int i = 0; i < 20; ++i)
+		{
+			size_t n = rng() % staticShapes.size();
+			cmp->MoveShape(staticShapes[n], fixed::FromInt(rng() % 200), fixed::FromInt(rng() % 200), fixed::FromInt(rng() % 628) / 100);
+			n = rng() % staticShapes.size();
+			cmp->RemoveShape(staticShapes[n]);
+			staticShapes.erase(staticShapes.begin() + n);
+		}
+
+		std::vector<tag_t> unitShapes;
+		unitShapes.push_back(shape2);
+		unitShapes.push_back(shape3);
+
+		for (int i = 0; i < 2000; ++i)
+		{
+			fixed r = fixed::FromInt(rng() % 4) / 2;
+			CFixedVector2D a(fixed::FromInt(3 + rng() % 1950) / 10, fixed::FromInt(3 + rng() % 1950) / 10);
+			CFixedVector2D b = a;
+			if (i % 4 != 0)
+				b = CFixedVector2D(fixed::FromInt(3 + rng() % 1950) / 10, fixed::FromInt(3 + rng() % 1950) / 10);
+			if (i % 8 == 1)
+				b.X = a.X;
+			if (i % 8 == 2)
+				b.Y = a.Y;
+
+			bool expected = false;
+			for (size_t j = 0; j < staticShapes.size() && !expected; ++j)
+			{
+				ObstructionSquare sq = cmp->GetObstruction(staticShapes[j]);
+				CFixedVector2D center(sq.x, sq.z);
+				expected = Geometry::TestRaySquare(a - center, b - center, sq.u, sq.v, CFixedVector2D(sq.hw + r, sq.hh + r));
+			}
+			for (size_t j = 0; j < unitShapes.size() && !expected; ++j)
+			{
+				ObstructionSquare sq = cmp->GetObstruction(unitShapes[j]);
+				CFixedVector2D center(sq.x, sq.z);
+				expected = Geometry::TestRayAASquare(a - center, b - center, CFixedVector2D(sq.hw + r, sq.hh + r));
+			}
+
+			TS_ASSERT_EQUALS(cmp->TestLine(nullFilter, a.X, a.Y, b.X, b.Y, r), expected);
+		}
+	}
 };
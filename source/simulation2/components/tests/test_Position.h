@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,6 +18,45 @@
 #include "simulation2/system/ComponentTest.h"
 
 #include "simulation2/components/ICmpPosition.h"
+#include "simulation2/components/ICmpWaterManager.h"
+
+class MockTerrainVariable : public MockTerrain
+{
+public:
+	MockTerrainVariable() : m_Height(50.f) { }
+
+	virtual float GetExactGroundLevel(float UNUSED(x), float UNUSED(z))
+	{
+		return m_Height;
+	}
+
+	float m_Height;
+};
+
+class MockWaterManager : public ICmpWaterManager
+{
+public:
+	DEFAULT_MOCK_COMPONENT()
+
+	MockWaterManager() : m_Level(entity_pos_t::FromInt(0)) { }
+
+	virtual void SetWaterLevel(entity_pos_t h)
+	{
+		m_Level = h;
+	}
+
+	virtual entity_pos_t GetWaterLevel(entity_pos_t UNUSED(x), entity_pos_t UNUSED(z))
+	{
+		return m_Level;
+	}
+
+	virtual float GetExactWaterLevel(float UNUSED(x), float UNUSED(z))
+	{
+		return m_Level.ToFloat();
+	}
+
+	entity_pos_t m_Level;
+};
 
 class TestCmpPosition : public CxxTest::TestSuite
 {
@@ -109,6 +148,46 @@ public:
 		// TODO: Test the rotation methods
 	}
 
+	void test_stationary_transform()
+	{
+		ComponentTestHelper test;
+
+		MockTerrainVariable terrain;
+		test.AddMock(SYSTEM_ENTITY, IID_Terrain, terrain);
+
+		MockWaterManager water;
+		test.AddMock(SYSTEM_ENTITY, IID_WaterManager, water);
+
+		ICmpPosition* cmp = test.Add<ICmpPosition>(CID_Position, "<Anchor>upright</Anchor><Altitude>10</Altitude><Floating>false</Floating><TurnRate>6.0</TurnRate>");
+
+		cmp->JumpTo(entity_pos_t::FromInt(100), entity_pos_t::FromInt(200));
+		TS_ASSERT_EQUALS(cmp->GetInterpolatedTransform(0.5f, false).GetTranslation(), CVector3D(100, 60, 200));
+
+		// Stationary transforms must still follow changes to the entity
+		cmp->SetHeightOffset(entity_pos_t::FromInt(20));
+		TS_ASSERT_EQUALS(cmp->GetInterpolatedTransform(0.5f, false).GetTranslation(), CVector3D(100, 70, 200));
+
+		// and to the terrain
+		terrain.m_Height = 30.f;
+		CMessageTerrainChanged terrainMsg(0, 0, 16, 16);
+		test.HandleMessage(cmp, terrainMsg, true);
+		TS_ASSERT_EQUALS(cmp->GetInterpolatedTransform(0.5f, false).GetTranslation(), CVector3D(100, 50, 200));
+
+		// and to the water, which has no message
+		TS_ASSERT_EQUALS(cmp->GetInterpolatedTransform(0.5f, true).GetTranslation(), CVector3D(100, 50, 200));
+		water.SetWaterLevel(entity_pos_t::FromInt(40));
+		TS_ASSERT_EQUALS(cmp->GetInterpolatedTransform(0.5f, true).GetTranslation(), CVector3D(100, 60, 200));
+		TS_ASSERT_EQUALS(cmp->GetInterpolatedTransform(0.5f, false).GetTranslation(), CVector3D(100, 50, 200));
+
+		// and to its rotation
+		CMatrix3D before = cmp->GetInterpolatedTransform(0.5f, false);
+		cmp->TurnTo(entity_angle_t::FromInt(1));
+		TS_ASSERT_EQUALS(cmp->GetInterpolatedTransform(0.5f, false), before);
+		CMessageInterpolate interpolateMsg(0.1f, 0.5f, 0.1f);
+		test.HandleMessage(cmp, interpolateMsg, false);
+		TS_ASSERT_DIFFERS(cmp->GetInterpolatedTransform(0.5f, false), before);
+	}
+
 	void test_serialize()
 	{
 		ComponentTestHelper test;
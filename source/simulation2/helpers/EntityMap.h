@@ -0,0 +1,203 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_ENTITYMAP
+#define INCLUDED_ENTITYMAP
+
+#include "simulation2/system/Entity.h"
+
+/**
+ * A fast replacement for std::map<entity_id_t, T>, for the common case where
+ * the keys are IDs of normal (non-local) entities.
+ *
+ * Normal entity IDs are allocated sequentially and never reused, so the values
+ * can be stored in a flat array indexed directly by ID. Lookups are O(1), and
+ * looking up a sorted list of IDs (as returned by SpatialSubdivision) is a
+ * forward scan through contiguous memory.
+ *
+ * Iteration visits entries in increasing ID order, exactly like std::map,
+ * so anything serialized by iterating over this container is unchanged.
+ *
+ * Empty slots are marked by having INVALID_ENTITY as their key.
+ * Memory usage is proportional to the largest ID inserted, so local entities
+ * (which have a very high tag bit) must not be stored here.
+ */
+template<typename T>
+class EntityMap
+{
+public:
+	typedef entity_id_t key_type;
+	typedef T mapped_type;
+	typedef std::pair<entity_id_t, T> value_type;
+
+	template<typename V>
+	class iterator_base
+	{
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef V value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef V* pointer;
+		typedef V& reference;
+
+		iterator_base() : m_Ptr(NULL), m_End(NULL) { }
+		iterator_base(V* ptr, V* end) : m_Ptr(ptr), m_End(end) { }
+
+		// Allow conversion from iterator to const_iterator
+		template<typename U>
+		iterator_base(const iterator_base<U>& other) : m_Ptr(other.m_Ptr), m_End(other.m_End) { }
+
+		V& operator*() const { return *m_Ptr; }
+		V* operator->() const { return m_Ptr; }
+
+		iterator_base& operator++()
+		{
+			do
+				++m_Ptr;
+			while (m_Ptr != m_End && m_Ptr->first == INVALID_ENTITY);
+			return *this;
+		}
+
+		template<typename U>
+		bool operator==(const iterator_base<U>& rhs) const { return m_Ptr == rhs.m_Ptr; }
+		template<typename U>
+		bool operator!=(const iterator_base<U>& rhs) const { return m_Ptr != rhs.m_Ptr; }
+
+	private:
+		V* m_Ptr;
+		V* m_End;
+
+		template<typename U> friend class iterator_base;
+	};
+
+	typedef iterator_base<value_type> iterator;
+	typedef iterator_base<const value_type> const_iterator;
+
+	EntityMap() : m_Count(0)
+	{
+	}
+
+	iterator begin()
+	{
+		iterator it(DataBegin(), DataEnd());
+		if (!m_Data.empty() && m_Data[0].first == INVALID_ENTITY)
+			++it;
+		return it;
+	}
+
+	iterator end()
+	{
+		return iterator(DataEnd(), DataEnd());
+	}
+
+	const_iterator begin() const
+	{
+		const_iterator it(DataBegin(), DataEnd());
+		if (!m_Data.empty() && m_Data[0].first == INVALID_ENTITY)
+			++it;
+		return it;
+	}
+
+	const_iterator end() const
+	{
+		return const_iterator(DataEnd(), DataEnd());
+	}
+
+	size_t size() const
+	{
+		return m_Count;
+	}
+
+	bool empty() const
+	{
+		return m_Count == 0;
+	}
+
+	void clear()
+	{
+		m_Data.clear();
+		m_Count = 0;
+	}
+
+	iterator find(entity_id_t ent)
+	{
+		if (ent >= m_Data.size() || m_Data[ent].first == INVALID_ENTITY)
+			return end();
+		return iterator(DataBegin() + ent, DataEnd());
+	}
+
+	const_iterator find(entity_id_t ent) const
+	{
+		if (ent >= m_Data.size() || m_Data[ent].first == INVALID_ENTITY)
+			return end();
+		return const_iterator(DataBegin() + ent, DataEnd());
+	}
+
+	/**
+	 * Inserts the value if there is no existing entry for the entity.
+	 * Returns an iterator to the (new or existing) entry, and whether it was inserted.
+	 */
+	std::pair<iterator, bool> insert(const value_type& value)
+	{
+		entity_id_t ent = value.first;
+		ENSURE(ent != INVALID_ENTITY && ENTITY_IS_NORMAL(ent));
+
+		if (ent >= m_Data.size())
+			m_Data.resize(ent + 1, value_type(INVALID_ENTITY, T()));
+
+		if (m_Data[ent].first != INVALID_ENTITY)
+			return std::make_pair(iterator(DataBegin() + ent, DataEnd()), false);
+
+		m_Data[ent] = value;
+		++m_Count;
+		return std::make_pair(iterator(DataBegin() + ent, DataEnd()), true);
+	}
+
+	void erase(iterator it)
+	{
+		value_type& slot = *it;
+		ENSURE(slot.first != INVALID_ENTITY);
+		slot.first = INVALID_ENTITY;
+		slot.second = T();
+		--m_Count;
+
+		// Trim the unused tail, so that iteration doesn't run over lots of empty slots
+		// after the highest-ID entities are destroyed
+		while (!m_Data.empty() && m_Data.back().first == INVALID_ENTITY)
+			m_Data.pop_back();
+	}
+
+	size_t erase(entity_id_t ent)
+	{
+		iterator it = find(ent);
+		if (it == end())
+			return 0;
+		erase(it);
+		return 1;
+	}
+
+private:
+	value_type* DataBegin() { return m_Data.empty() ? NULL : &m_Data[0]; }
+	value_type* DataEnd() { return DataBegin() + m_Data.size(); }
+	const value_type* DataBegin() const { return m_Data.empty() ? NULL : &m_Data[0]; }
+	const value_type* DataEnd() const { return DataBegin() + m_Data.size(); }
+
+	std::vector<value_type> m_Data;
+	size_t m_Count;
+};
+
+#endif // INCLUDED_ENTITYMAP
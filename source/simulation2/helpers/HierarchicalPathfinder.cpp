@@ -0,0 +1,372 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "HierarchicalPathfinder.h"
+
+#include "ps/Profile.h"
+#include "simulation2/components/CCmpPathfinder_Common.h"
+
+HierarchicalPathfinder::HierarchicalPathfinder() :
+	m_Grid(NULL), m_W(0), m_H(0), m_ChunksW(0), m_ChunksH(0)
+{
+}
+
+HierarchicalPathfinder::~HierarchicalPathfinder()
+{
+	Reset(NULL);
+}
+
+void HierarchicalPathfinder::Reset(const Grid<u16>* grid)
+{
+	for (std::map<pass_class_t, PassClassData>::iterator it = m_PassClassData.begin(); it != m_PassClassData.end(); ++it)
+		for (size_t i = 0; i < it->second.m_Chunks.size(); ++i)
+			delete it->second.m_Chunks[i];
+	m_PassClassData.clear();
+
+	m_Grid = grid;
+	if (m_Grid)
+	{
+		m_W = m_Grid->m_W;
+		m_H = m_Grid->m_H;
+		ENSURE((m_W + CHUNK_SIZE-1) / CHUNK_SIZE <= 255 && (m_H + CHUNK_SIZE-1) / CHUNK_SIZE <= 255);
+		m_ChunksW = (u8)((m_W + CHUNK_SIZE-1) / CHUNK_SIZE);
+		m_ChunksH = (u8)((m_H + CHUNK_SIZE-1) / CHUNK_SIZE);
+	}
+	else
+	{
+		m_W = m_H = 0;
+		m_ChunksW = m_ChunksH = 0;
+	}
+}
+
+void HierarchicalPathfinder::MarkTileDirty(u16 i, u16 j)
+{
+	size_t c = (j / CHUNK_SIZE) * m_ChunksW + (i / CHUNK_SIZE);
+	for (std::map<pass_class_t, PassClassData>::iterator it = m_PassClassData.begin(); it != m_PassClassData.end(); ++it)
+	{
+		it->second.m_DirtyChunks[c] = true;
+		it->second.m_Dirty = true;
+	}
+}
+
+void HierarchicalPathfinder::Update()
+{
+	for (std::map<pass_class_t, PassClassData>::iterator it = m_PassClassData.begin(); it != m_PassClassData.end(); ++it)
+		if (it->second.m_Dirty)
+			UpdatePassClass(it->second, it->first);
+}
+
+HierarchicalPathfinder::PassClassData& HierarchicalPathfinder::GetPassClassData(pass_class_t passClass)
+{
+	std::map<pass_class_t, PassClassData>::iterator it = m_PassClassData.find(passClass);
+	if (it != m_PassClassData.end())
+		return it->second;
+
+	// Compute everything for this passability class on first use
+
+	PassClassData& data = m_PassClassData[passClass];
+	data.m_Chunks.resize(m_ChunksW * m_ChunksH);
+	data.m_DirtyChunks.resize(m_ChunksW * m_ChunksH, true);
+	data.m_Dirty = true;
+
+	for (u8 cj = 0; cj < m_ChunksH; ++cj)
+	{
+		for (u8 ci = 0; ci < m_ChunksW; ++ci)
+		{
+			Chunk* chunk = new Chunk;
+			chunk->m_ChunkI = ci;
+			chunk->m_ChunkJ = cj;
+			chunk->m_NumRegions = 0;
+			data.m_Chunks[cj*m_ChunksW + ci] = chunk;
+		}
+	}
+
+	UpdatePassClass(data, passClass);
+	return data;
+}
+
+void HierarchicalPathfinder::ComputeChunkRegions(Chunk& chunk, pass_class_t passClass)
+{
+	memset(chunk.m_Regions, 0, sizeof(chunk.m_Regions));
+	chunk.m_NumRegions = 0;
+
+	int i0 = chunk.m_ChunkI * CHUNK_SIZE;
+	int j0 = chunk.m_ChunkJ * CHUNK_SIZE;
+	int w = std::min((int)CHUNK_SIZE, m_W - i0);
+	int h = std::min((int)CHUNK_SIZE, m_H - j0);
+
+	// Flood-fill each unassigned passable tile into a new region
+
+	std::vector<std::pair<int, int> > stack;
+	for (int sj = 0; sj < h; ++sj)
+	{
+		for (int si = 0; si < w; ++si)
+		{
+			if (chunk.m_Regions[sj][si] || !IS_PASSABLE(m_Grid->get(i0+si, j0+sj), passClass))
+				continue;
+
+			ENSURE(chunk.m_NumRegions < 65535);
+			u16 r = ++chunk.m_NumRegions;
+			chunk.m_Regions[sj][si] = r;
+			stack.push_back(std::make_pair(si, sj));
+
+			while (!stack.empty())
+			{
+				int i = stack.back().first;
+				int j = stack.back().second;
+				stack.pop_back();
+
+				static const int offsets[4][2] = { {-1, 0}, {1, 0}, {0, -1}, {0, 1} };
+				for (size_t n = 0; n < 4; ++n)
+				{
+					int ni = i + offsets[n][0];
+					int nj = j + offsets[n][1];
+					if (ni < 0 || nj < 0 || ni >= w || nj >= h)
+						continue;
+					if (chunk.m_Regions[nj][ni] || !IS_PASSABLE(m_Grid->get(i0+ni, j0+nj), passClass))
+						continue;
+					chunk.m_Regions[nj][ni] = r;
+					stack.push_back(std::make_pair(ni, nj));
+				}
+			}
+		}
+	}
+
+	chunk.m_GlobalRegions.assign(chunk.m_NumRegions, 0);
+}
+
+void HierarchicalPathfinder::RemoveChunkEdges(PassClassData& data, u8 ci, u8 cj)
+{
+	const Chunk& chunk = *data.m_Chunks[cj*m_ChunksW + ci];
+	for (u16 r = 1; r <= chunk.m_NumRegions; ++r)
+	{
+		EdgesMap::iterator it = data.m_Edges.find(RegionID(ci, cj, r));
+		if (it == data.m_Edges.end())
+			continue;
+
+		for (std::set<RegionID>::const_iterator nit = it->second.begin(); nit != it->second.end(); ++nit)
+			data.m_Edges[*nit].erase(it->first);
+
+		data.m_Edges.erase(it);
+	}
+}
+
+void HierarchicalPathfinder::AddChunkEdges(PassClassData& data, u8 ci, u8 cj)
+{
+	const Chunk& chunk = *data.m_Chunks[cj*m_ChunksW + ci];
+	int w = std::min((int)CHUNK_SIZE, m_W - ci*CHUNK_SIZE);
+	int h = std::min((int)CHUNK_SIZE, m_H - cj*CHUNK_SIZE);
+
+	// Link regions that touch across each edge of this chunk.
+	// (Neighbouring chunks are always full-size on the sides that touch us,
+	// since only the last row/column of chunks can be partial.)
+
+	if (ci > 0)
+	{
+		const Chunk& left = *data.m_Chunks[cj*m_ChunksW + ci-1];
+		for (int j = 0; j < h; ++j)
+		{
+			u16 ra = chunk.m_Regions[j][0];
+			u16 rb = left.m_Regions[j][CHUNK_SIZE-1];
+			if (ra && rb)
+			{
+				data.m_Edges[RegionID(ci, cj, ra)].insert(RegionID(ci-1, cj, rb));
+				data.m_Edges[RegionID(ci-1, cj, rb)].insert(RegionID(ci, cj, ra));
+			}
+		}
+	}
+
+	if (ci < m_ChunksW-1)
+	{
+		const Chunk& right = *data.m_Chunks[cj*m_ChunksW + ci+1];
+		for (int j = 0; j < h; ++j)
+		{
+			u16 ra = chunk.m_Regions[j][CHUNK_SIZE-1];
+			u16 rb = right.m_Regions[j][0];
+			if (ra && rb)
+			{
+				data.m_Edges[RegionID(ci, cj, ra)].insert(RegionID(ci+1, cj, rb));
+				data.m_Edges[RegionID(ci+1, cj, rb)].insert(RegionID(ci, cj, ra));
+			}
+		}
+	}
+
+	if (cj > 0)
+	{
+		const Chunk& bottom = *data.m_Chunks[(cj-1)*m_ChunksW + ci];
+		for (int i = 0; i < w; ++i)
+		{
+			u16 ra = chunk.m_Regions[0][i];
+			u16 rb = bottom.m_Regions[CHUNK_SIZE-1][i];
+			if (ra && rb)
+			{
+				data.m_Edges[RegionID(ci, cj, ra)].insert(RegionID(ci, cj-1, rb));
+				data.m_Edges[RegionID(ci, cj-1, rb)].insert(RegionID(ci, cj, ra));
+			}
+		}
+	}
+
+	if (cj < m_ChunksH-1)
+	{
+		const Chunk& top = *data.m_Chunks[(cj+1)*m_ChunksW + ci];
+		for (int i = 0; i < w; ++i)
+		{
+			u16 ra = chunk.m_Regions[CHUNK_SIZE-1][i];
+			u16 rb = top.m_Regions[0][i];
+			if (ra && rb)
+			{
+				data.m_Edges[RegionID(ci, cj, ra)].insert(RegionID(ci, cj+1, rb));
+				data.m_Edges[RegionID(ci, cj+1, rb)].insert(RegionID(ci, cj, ra));
+			}
+		}
+	}
+}
+
+void HierarchicalPathfinder::UpdatePassClass(PassClassData& data, pass_class_t passClass)
+{
+	PROFILE3("Hierarchical update");
+
+	// Drop the old edges of every dirty chunk before recomputing any of them,
+	// since the region IDs used by the edges are about to change
+	for (u8 cj = 0; cj < m_ChunksH; ++cj)
+		for (u8 ci = 0; ci < m_ChunksW; ++ci)
+			if (data.m_DirtyChunks[cj*m_ChunksW + ci])
+				RemoveChunkEdges(data, ci, cj);
+
+	for (size_t c = 0; c < data.m_Chunks.size(); ++c)
+		if (data.m_DirtyChunks[c])
+			ComputeChunkRegions(*data.m_Chunks[c], passClass);
+
+	for (u8 cj = 0; cj < m_ChunksH; ++cj)
+		for (u8 ci = 0; ci < m_ChunksW; ++ci)
+			if (data.m_DirtyChunks[cj*m_ChunksW + ci])
+				AddChunkEdges(data, ci, cj);
+
+	data.m_DirtyChunks.assign(data.m_DirtyChunks.size(), false);
+	data.m_Dirty = false;
+
+	// Connectivity of distant chunks may have changed, so recompute all the components
+	ComputeGlobalRegions(data);
+}
+
+void HierarchicalPathfinder::ComputeGlobalRegions(PassClassData& data)
+{
+	for (size_t c = 0; c < data.m_Chunks.size(); ++c)
+		data.m_Chunks[c]->m_GlobalRegions.assign(data.m_Chunks[c]->m_NumRegions, 0);
+
+	// Flood-fill over the region graph
+	u16 nextGlobal = 1;
+	std::vector<RegionID> stack;
+	for (size_t c = 0; c < data.m_Chunks.size(); ++c)
+	{
+		Chunk& chunk = *data.m_Chunks[c];
+		for (u16 r = 1; r <= chunk.m_NumRegions; ++r)
+		{
+			if (chunk.m_GlobalRegions[r-1])
+				continue;
+
+			ENSURE(nextGlobal < 65535);
+			u16 g = nextGlobal++;
+			chunk.m_GlobalRegions[r-1] = g;
+			stack.push_back(RegionID(chunk.m_ChunkI, chunk.m_ChunkJ, r));
+
+			while (!stack.empty())
+			{
+				RegionID curr = stack.back();
+				stack.pop_back();
+
+				EdgesMap::const_iterator it = data.m_Edges.find(curr);
+				if (it == data.m_Edges.end())
+					continue;
+
+				for (std::set<RegionID>::const_iterator nit = it->second.begin(); nit != it->second.end(); ++nit)
+				{
+					Chunk& neighbour = *data.m_Chunks[nit->cj*m_ChunksW + nit->ci];
+					if (neighbour.m_GlobalRegions[nit->r-1])
+						continue;
+					neighbour.m_GlobalRegions[nit->r-1] = g;
+					stack.push_back(*nit);
+				}
+			}
+		}
+	}
+}
+
+u16 HierarchicalPathfinder::GetGlobalRegion(u16 i, u16 j, pass_class_t passClass)
+{
+	PassClassData& data = GetPassClassData(passClass);
+	ENSURE(!data.m_Dirty);
+
+	const Chunk& chunk = *data.m_Chunks[(j / CHUNK_SIZE)*m_ChunksW + (i / CHUNK_SIZE)];
+	u16 r = chunk.m_Regions[j % CHUNK_SIZE][i % CHUNK_SIZE];
+	if (!r)
+		return 0;
+	return chunk.m_GlobalRegions[r-1];
+}
+
+bool HierarchicalPathfinder::FindNearestTileInGlobalRegion(u16 iGoal, u16 jGoal, u16 globalRegion, pass_class_t passClass, u16& iOut, u16& jOut)
+{
+	PassClassData& data = GetPassClassData(passClass);
+	ENSURE(!data.m_Dirty);
+
+	// Search outwards in square rings around the goal. Every tile in ring r is at
+	// least distance r from the goal, so we can stop once r*r exceeds the best
+	// squared distance found so far.
+
+	bool found = false;
+	int bestDist2 = 0;
+	int maxR = std::max(m_W, m_H);
+	for (int r = 0; r <= maxR; ++r)
+	{
+		if (found && r*r > bestDist2)
+			break;
+
+		for (int dj = -r; dj <= r; ++dj)
+		{
+			int j = jGoal + dj;
+			if (j < 0 || j >= m_H)
+				continue;
+
+			// Interior rows only have tiles at the two ends of the ring
+			int step = (dj == -r || dj == r) ? 1 : std::max(2*r, 1);
+			for (int di = -r; di <= r; di += step)
+			{
+				int i = iGoal + di;
+				if (i < 0 || i >= m_W)
+					continue;
+
+				int dist2 = di*di + dj*dj;
+				if (found && dist2 >= bestDist2)
+					continue;
+
+				const Chunk& chunk = *data.m_Chunks[(j / CHUNK_SIZE)*m_ChunksW + (i / CHUNK_SIZE)];
+				u16 region = chunk.m_Regions[j % CHUNK_SIZE][i % CHUNK_SIZE];
+				if (region && chunk.m_GlobalRegions[region-1] == globalRegion)
+				{
+					found = true;
+					bestDist2 = dist2;
+					iOut = (u16)i;
+					jOut = (u16)j;
+				}
+			}
+		}
+	}
+
+	return found;
+}
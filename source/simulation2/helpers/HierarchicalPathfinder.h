@@ -0,0 +1,153 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_HIERARCHICALPATHFINDER
+#define INCLUDED_HIERARCHICALPATHFINDER
+
+#include "simulation2/components/ICmpPathfinder.h"
+#include "simulation2/helpers/Grid.h"
+
+#include <set>
+
+/**
+ * Coarse connectivity information for the tile pathfinder.
+ *
+ * The map is split into square chunks of CHUNK_SIZE*CHUNK_SIZE tiles. Within each
+ * chunk, the passable tiles (for a given passability class) are flood-filled into
+ * 4-connected regions, and regions in adjacent chunks are linked by edges where
+ * they touch. The regions are then grouped into globally connected components,
+ * so we can tell in constant time whether one tile can be reached from another,
+ * and find the nearest reachable tile to an unreachable goal without running
+ * a full A* search that exhausts the whole reachable area.
+ *
+ * Regions are computed lazily per passability class, and when the passability
+ * grid changes only the chunks containing modified tiles need to be recomputed.
+ *
+ * This is derived entirely from the passability grid, so it is not serialized.
+ */
+class HierarchicalPathfinder
+{
+	NONCOPYABLE(HierarchicalPathfinder);
+
+public:
+	typedef ICmpPathfinder::pass_class_t pass_class_t;
+
+	enum { CHUNK_SIZE = 64 };
+
+	HierarchicalPathfinder();
+	~HierarchicalPathfinder();
+
+	/**
+	 * Discard all data, e.g. after the terrain has changed. Everything will be
+	 * recomputed from @p grid when next needed.
+	 * The grid must stay valid until the next call to Reset.
+	 */
+	void Reset(const Grid<u16>* grid);
+
+	/**
+	 * Replace the grid with an identical copy (e.g. when the old one is still
+	 * being read elsewhere), without discarding any data.
+	 */
+	void SetGrid(const Grid<u16>* grid)
+	{
+		m_Grid = grid;
+	}
+
+	/**
+	 * Record that the passability of tile (i, j) has changed.
+	 * Call Update once all the changes have been recorded.
+	 */
+	void MarkTileDirty(u16 i, u16 j);
+
+	/**
+	 * Recompute the regions of any chunks containing dirty tiles.
+	 */
+	void Update();
+
+	/**
+	 * Computes the data for @p passClass now, if it hasn't been already.
+	 * After this (and until the next MarkTileDirty or Reset), queries for
+	 * @p passClass only read shared data, so they can run concurrently.
+	 */
+	void ComputePassClass(pass_class_t passClass)
+	{
+		GetPassClassData(passClass);
+	}
+
+	/**
+	 * Returns an ID for the globally connected component containing tile (i, j),
+	 * or 0 if the tile is impassable.
+	 * Tiles with the same non-zero ID can reach each other with 4-connected moves
+	 * over tiles that are passable for @p passClass.
+	 */
+	u16 GetGlobalRegion(u16 i, u16 j, pass_class_t passClass);
+
+	/**
+	 * Finds the tile in component @p globalRegion that is closest (by Euclidean
+	 * distance) to tile (iGoal, jGoal). Returns false if there is no such tile.
+	 */
+	bool FindNearestTileInGlobalRegion(u16 iGoal, u16 jGoal, u16 globalRegion, pass_class_t passClass, u16& iOut, u16& jOut);
+
+private:
+	struct Chunk
+	{
+		u8 m_ChunkI, m_ChunkJ;
+		u16 m_NumRegions;
+		u16 m_Regions[CHUNK_SIZE][CHUNK_SIZE]; // region of each tile, indexed by [j][i]; 0 = impassable
+		std::vector<u16> m_GlobalRegions; // global component of each region, indexed by region-1
+	};
+
+	struct RegionID
+	{
+		u8 ci, cj; // chunk
+		u16 r; // region within chunk
+
+		RegionID(u8 ci, u8 cj, u16 r) : ci(ci), cj(cj), r(r) { }
+
+		bool operator<(const RegionID& b) const
+		{
+			if (cj != b.cj) return cj < b.cj;
+			if (ci != b.ci) return ci < b.ci;
+			return r < b.r;
+		}
+	};
+
+	typedef std::map<RegionID, std::set<RegionID> > EdgesMap;
+
+	struct PassClassData
+	{
+		std::vector<Chunk*> m_Chunks; // indexed by cj*m_ChunksW + ci
+		EdgesMap m_Edges;
+		std::vector<bool> m_DirtyChunks;
+		bool m_Dirty; // whether any chunk is dirty
+	};
+
+	PassClassData& GetPassClassData(pass_class_t passClass);
+	void ComputeChunkRegions(Chunk& chunk, pass_class_t passClass);
+	void RemoveChunkEdges(PassClassData& data, u8 ci, u8 cj);
+	void AddChunkEdges(PassClassData& data, u8 ci, u8 cj);
+	void UpdatePassClass(PassClassData& data, pass_class_t passClass);
+	void ComputeGlobalRegions(PassClassData& data);
+
+	const Grid<u16>* m_Grid;
+	u16 m_W, m_H; // in tiles
+	u8 m_ChunksW, m_ChunksH;
+
+	std::map<pass_class_t, PassClassData> m_PassClassData;
+};
+
+#endif // INCLUDED_HIERARCHICALPATHFINDER
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -56,14 +56,14 @@ void SimRender::ConstructLineOnGround(const CSimContext& context, const std::vec
 
 	overlay.m_Coords.reserve(xz.size()/2 * 3);
 
-	for (size_t i = 0; i < xz.size(); i += 2)
+	std::vector<float> heights(xz.size()/2);
+	cmpTerrain->GetExactGroundLevels(&xz[0], heights.size(), &heights[0]);
+
+	for (size_t i = 0; i < heights.size(); ++i)
 	{
-		float px = xz[i];
-		float pz = xz[i+1];
-		float py = std::max(water, cmpTerrain->GetExactGroundLevel(px, pz)) + heightOffset;
-		overlay.m_Coords.push_back(px);
-		overlay.m_Coords.push_back(py);
-		overlay.m_Coords.push_back(pz);
+		overlay.m_Coords.push_back(xz[i*2]);
+		overlay.m_Coords.push_back(std::max(water, heights[i]) + heightOffset);
+		overlay.m_Coords.push_back(xz[i*2+1]);
 	}
 }
 
@@ -89,15 +89,23 @@ void SimRender::ConstructCircleOnGround(const CSimContext& context, float x, flo
 
 	overlay.m_Coords.reserve((numPoints + 1) * 3);
 
+	std::vector<float> xz;
+	xz.reserve((numPoints + 1) * 2);
 	for (size_t i = 0; i <= numPoints; ++i) // use '<=' so it's a closed loop
 	{
 		float a = (float)i * 2 * (float)M_PI / (float)numPoints;
-		float px = x + radius * sinf(a);
-		float pz = z + radius * cosf(a);
-		float py = std::max(water, cmpTerrain->GetExactGroundLevel(px, pz)) + heightOffset;
-		overlay.m_Coords.push_back(px);
-		overlay.m_Coords.push_back(py);
-		overlay.m_Coords.push_back(pz);
+		xz.push_back(x + radius * sinf(a));
+		xz.push_back(z + radius * cosf(a));
+	}
+
+	std::vector<float> heights(numPoints + 1);
+	cmpTerrain->GetExactGroundLevels(&xz[0], heights.size(), &heights[0]);
+
+	for (size_t i = 0; i <= numPoints; ++i)
+	{
+		overlay.m_Coords.push_back(xz[i*2]);
+		overlay.m_Coords.push_back(std::max(water, heights[i]) + heightOffset);
+		overlay.m_Coords.push_back(xz[i*2+1]);
 	}
 }
 
@@ -152,14 +160,22 @@ void SimRender::ConstructSquareOnGround(const CSimContext& context, float x, flo
 
 	overlay.m_Coords.reserve(coords.size() * 3);
 
+	std::vector<float> xz;
+	xz.reserve(coords.size() * 2);
+	for (size_t i = 0; i < coords.size(); ++i)
+	{
+		xz.push_back(coords[i].first);
+		xz.push_back(coords[i].second);
+	}
+
+	std::vector<float> heights(coords.size());
+	cmpTerrain->GetExactGroundLevels(&xz[0], heights.size(), &heights[0]);
+
 	for (size_t i = 0; i < coords.size(); ++i)
 	{
-		float px = coords[i].first;
-		float pz = coords[i].second;
-		float py = std::max(water, cmpTerrain->GetExactGroundLevel(px, pz)) + heightOffset;
-		overlay.m_Coords.push_back(px);
-		overlay.m_Coords.push_back(py);
-		overlay.m_Coords.push_back(pz);
+		overlay.m_Coords.push_back(coords[i].first);
+		overlay.m_Coords.push_back(std::max(water, heights[i]) + heightOffset);
+		overlay.m_Coords.push_back(coords[i].second);
 	}
 }
 
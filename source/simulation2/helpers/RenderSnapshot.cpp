@@ -0,0 +1,117 @@
+/* Copyright (C) 2012 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "RenderSnapshot.h"
+
+#include "graphics/Frustum.h"
+
+void CRenderSnapshot::Clear()
+{
+	m_Patches.clear();
+	m_OverlayLines.clear();
+	m_TexturedOverlayLines.clear();
+	m_OverlaySprites.clear();
+	m_OverlayQuads.clear();
+	m_Decals.clear();
+	m_Emitters.clear();
+	m_NonRecursiveModels.clear();
+	m_Models.clear();
+	m_CulledModels.clear();
+}
+
+void CRenderSnapshot::Replay(SceneCollector& collector, const CFrustum& frustum, bool culling) const
+{
+	for (size_t i = 0; i < m_Patches.size(); ++i)
+		collector.Submit(m_Patches[i]);
+	for (size_t i = 0; i < m_OverlayLines.size(); ++i)
+		collector.Submit(m_OverlayLines[i]);
+	for (size_t i = 0; i < m_TexturedOverlayLines.size(); ++i)
+		collector.Submit(m_TexturedOverlayLines[i]);
+	for (size_t i = 0; i < m_OverlaySprites.size(); ++i)
+		collector.Submit(m_OverlaySprites[i]);
+	for (size_t i = 0; i < m_OverlayQuads.size(); ++i)
+		collector.Submit(m_OverlayQuads[i]);
+	for (size_t i = 0; i < m_Decals.size(); ++i)
+		collector.Submit(m_Decals[i]);
+	for (size_t i = 0; i < m_Emitters.size(); ++i)
+		collector.Submit(m_Emitters[i]);
+	for (size_t i = 0; i < m_NonRecursiveModels.size(); ++i)
+		collector.SubmitNonRecursive(m_NonRecursiveModels[i]);
+	for (size_t i = 0; i < m_Models.size(); ++i)
+		collector.SubmitRecursive(m_Models[i]);
+
+	for (size_t i = 0; i < m_CulledModels.size(); ++i)
+	{
+		if (culling)
+			collector.SubmitRecursiveCulled(m_CulledModels[i].model, m_CulledModels[i].bounds, frustum);
+		else
+			collector.SubmitRecursive(m_CulledModels[i].model);
+	}
+}
+
+void CRenderSnapshot::Submit(CPatch* patch)
+{
+	m_Patches.push_back(patch);
+}
+
+void CRenderSnapshot::Submit(SOverlayLine* overlay)
+{
+	m_OverlayLines.push_back(overlay);
+}
+
+void CRenderSnapshot::Submit(SOverlayTexturedLine* overlay)
+{
+	m_TexturedOverlayLines.push_back(overlay);
+}
+
+void CRenderSnapshot::Submit(SOverlaySprite* overlay)
+{
+	m_OverlaySprites.push_back(overlay);
+}
+
+void CRenderSnapshot::Submit(SOverlayQuad* overlay)
+{
+	m_OverlayQuads.push_back(overlay);
+}
+
+void CRenderSnapshot::Submit(CModelDecal* decal)
+{
+	m_Decals.push_back(decal);
+}
+
+void CRenderSnapshot::Submit(CParticleEmitter* emitter)
+{
+	m_Emitters.push_back(emitter);
+}
+
+void CRenderSnapshot::SubmitNonRecursive(CModel* model)
+{
+	m_NonRecursiveModels.push_back(model);
+}
+
+void CRenderSnapshot::SubmitRecursive(CModelAbstract* model)
+{
+	m_Models.push_back(model);
+}
+
+void CRenderSnapshot::SubmitRecursiveCulled(CModelAbstract* model, const CBoundingBoxAligned& bounds, const CFrustum& UNUSED(frustum))
+{
+	SCulledModel culled = { model, bounds };
+	m_CulledModels.push_back(culled);
+}
@@ -0,0 +1,85 @@
+/* Copyright (C) 2012 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_RENDERSNAPSHOT
+#define INCLUDED_RENDERSNAPSHOT
+
+#include "maths/BoundingBoxAligned.h"
+#include "renderer/Scene.h"
+
+#include <vector>
+
+/**
+ * Records the objects that simulation components submit for rendering, so the
+ * renderer can consume them later without sending MT_RenderSubmit to the components.
+ *
+ * CSimulation2 fills this in at the end of each Interpolate, when the components'
+ * render data (models, overlays, visibility) has just been updated for the frame,
+ * and replays it into the renderer's collector. Rendering therefore only reads
+ * the snapshot and the graphics objects it points to, not the component state.
+ *
+ * The recorded objects are owned by the components, so the snapshot must be
+ * discarded whenever components may have been destroyed or changed their render
+ * data (e.g. after a simulation turn).
+ *
+ * Culled submissions are recorded with their bounds and tested against the
+ * frustum when replayed, so the snapshot doesn't depend on the camera.
+ */
+class CRenderSnapshot : public SceneCollector
+{
+public:
+	void Clear();
+
+	/**
+	 * Submit all the recorded objects to @p collector. Objects that were submitted
+	 * with culling are only passed on if they're visible in @p frustum (or always,
+	 * if @p culling is false).
+	 */
+	void Replay(SceneCollector& collector, const CFrustum& frustum, bool culling) const;
+
+	virtual void Submit(CPatch* patch);
+	virtual void Submit(SOverlayLine* overlay);
+	virtual void Submit(SOverlayTexturedLine* overlay);
+	virtual void Submit(SOverlaySprite* overlay);
+	virtual void Submit(SOverlayQuad* overlay);
+	virtual void Submit(CModelDecal* decal);
+	virtual void Submit(CParticleEmitter* emitter);
+	virtual void SubmitNonRecursive(CModel* model);
+	virtual void SubmitRecursive(CModelAbstract* model);
+	virtual void SubmitRecursiveCulled(CModelAbstract* model, const CBoundingBoxAligned& bounds, const CFrustum& frustum);
+
+private:
+	struct SCulledModel
+	{
+		CModelAbstract* model;
+		CBoundingBoxAligned bounds;
+	};
+
+	std::vector<CPatch*> m_Patches;
+	std::vector<SOverlayLine*> m_OverlayLines;
+	std::vector<SOverlayTexturedLine*> m_TexturedOverlayLines;
+	std::vector<SOverlaySprite*> m_OverlaySprites;
+	std::vector<SOverlayQuad*> m_OverlayQuads;
+	std::vector<CModelDecal*> m_Decals;
+	std::vector<CParticleEmitter*> m_Emitters;
+	std::vector<CModel*> m_NonRecursiveModels;
+	// (props are traversed when replaying, so hidden props aren't submitted)
+	std::vector<CModelAbstract*> m_Models;
+	std::vector<SCulledModel> m_CulledModels;
+};
+
+#endif // INCLUDED_RENDERSNAPSHOT
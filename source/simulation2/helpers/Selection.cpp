@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,15 +20,35 @@
 #include "Selection.h"
 
 #include "graphics/Camera.h"
+#include "renderer/Renderer.h"
 #include "simulation2/Simulation2.h"
 #include "simulation2/components/ICmpIdentity.h"
 #include "simulation2/components/ICmpOwnership.h"
 #include "simulation2/components/ICmpRangeManager.h"
 #include "simulation2/components/ICmpTemplateManager.h"
-#include "simulation2/components/ICmpSelectable.h"
-#include "simulation2/components/ICmpVisual.h"
+#include "simulation2/helpers/SelectionIndex.h"
 #include "ps/CLogger.h"
 
+// Finds the indexes in the selection index of the entities that might be
+// within the screen rectangle, or all of them if that can't be determined
+static void GetEntriesInRect(const CSelectionIndex& index, const CCamera& camera, int sx0, int sy0, int sx1, int sy1, std::vector<size_t>& out)
+{
+	// Use rays through the corners of the rectangle, expanded slightly
+	// since screen coordinates are rounded towards zero when tested
+	CVector3D origin, dirs[4];
+	camera.BuildCameraRay(sx0 - 1, sy0 - 1, origin, dirs[0]);
+	camera.BuildCameraRay(sx1 + 1, sy0 - 1, origin, dirs[1]);
+	camera.BuildCameraRay(sx0 - 1, sy1 + 1, origin, dirs[2]);
+	camera.BuildCameraRay(sx1 + 1, sy1 + 1, origin, dirs[3]);
+
+	if (!index.GetCandidates(origin, dirs, ARRAY_SIZE(dirs), out))
+	{
+		out.resize(index.GetEntries().size());
+		for (size_t i = 0; i < out.size(); ++i)
+			out[i] = i;
+	}
+}
+
 std::vector<entity_id_t> EntitySelection::PickEntitiesAtPoint(CSimulation2& simulation, const CCamera& camera, int screenX, int screenY, player_id_t player, bool allowEditorSelectables)
 {
 	CVector3D origin, dir;
@@ -39,27 +59,33 @@ std::vector<entity_id_t> EntitySelection::PickEntitiesAtPoint(CSimulation2& simu
 
 	std::vector<std::pair<float, entity_id_t> > hits; // (dist^2, entity) pairs
 
-	const CSimulation2::InterfaceListUnordered& ents = simulation.GetEntitiesWithInterfaceUnordered(IID_Selectable);
-	for (CSimulation2::InterfaceListUnordered::const_iterator it = ents.begin(); it != ents.end(); ++it)
+	// Only test the entities whose selection boxes are near the ray
+	const CSelectionIndex& index = simulation.GetSelectionIndex();
+	const std::vector<CSelectionIndex::SEntry>& entries = index.GetEntries();
+	std::vector<size_t> candidates;
+	const bool bounded = index.GetCandidates(origin, &dir, 1, candidates);
+	const size_t numCandidates = bounded ? candidates.size() : entries.size();
+
+	for (size_t c = 0; c < numCandidates; ++c)
 	{
-		entity_id_t ent = it->first;
+		const CSelectionIndex::SEntry& entry = entries[bounded ? candidates[c] : c];
+		entity_id_t ent = entry.ent;
 
 		// Check if this entity is only selectable in Atlas
-		if (!allowEditorSelectables && static_cast<ICmpSelectable*>(it->second)->IsEditorOnly())
+		if (!allowEditorSelectables && entry.editorOnly)
 			continue;
 
 		// Ignore entities hidden by LOS (or otherwise hidden, e.g. when not IsInWorld)
 		if (cmpRangeManager->GetLosVisibility(ent, player) == ICmpRangeManager::VIS_HIDDEN)
 			continue;
 
-		CmpPtr<ICmpVisual> cmpVisual(simulation.GetSimContext(), ent);
-		if (!cmpVisual)
+		if (!entry.hasVisual)
 			continue;
 
 		CVector3D center;
 		float tmin, tmax;
 
-		CBoundingBoxOriented selectionBox = cmpVisual->GetSelectionBox();
+		const CBoundingBoxOriented& selectionBox = entry.selectionBox;
 		if (selectionBox.IsEmpty())
 		{
 			if (!allowEditorSelectables)
@@ -67,7 +93,7 @@ std::vector<entity_id_t> EntitySelection::PickEntitiesAtPoint(CSimulation2& simu
 
 			// Fall back to using old AABB selection method for decals
 			//	see: http://trac.wildfiregames.com/ticket/1032
-			CBoundingBoxAligned aABBox = cmpVisual->GetBounds();
+			const CBoundingBoxAligned& aABBox = entry.bounds;
 			if (aABBox.IsEmpty())
 				continue;
 
@@ -117,13 +143,19 @@ std::vector<entity_id_t> EntitySelection::PickEntitiesInRect(CSimulation2& simul
 
 	std::vector<entity_id_t> hitEnts;
 
-	const CSimulation2::InterfaceListUnordered& ents = simulation.GetEntitiesWithInterfaceUnordered(IID_Selectable);
-	for (CSimulation2::InterfaceListUnordered::const_iterator it = ents.begin(); it != ents.end(); ++it)
+	// Only test the entities that might be inside the rectangle
+	const CSelectionIndex& index = simulation.GetSelectionIndex();
+	const std::vector<CSelectionIndex::SEntry>& entries = index.GetEntries();
+	std::vector<size_t> candidates;
+	GetEntriesInRect(index, camera, sx0, sy0, sx1, sy1, candidates);
+
+	for (size_t c = 0; c < candidates.size(); ++c)
 	{
-		entity_id_t ent = it->first;
+		const CSelectionIndex::SEntry& entry = entries[candidates[c]];
+		entity_id_t ent = entry.ent;
 
 		// Check if this entity is only selectable in Atlas
-		if (static_cast<ICmpSelectable*>(it->second)->IsEditorOnly() && !allowEditorSelectables)
+		if (entry.editorOnly && !allowEditorSelectables)
 			continue;
 
 		// Ignore entities hidden by LOS (or otherwise hidden, e.g. when not IsInWorld)
@@ -135,15 +167,14 @@ std::vector<entity_id_t> EntitySelection::PickEntitiesInRect(CSimulation2& simul
 		if (owner != INVALID_PLAYER && (!cmpOwnership || cmpOwnership->GetOwner() != owner))
 			continue;
 
-		// Find the current interpolated model position.
+		// Use the current interpolated model position.
 		// (We just use the centre position and not the whole bounding box, because maybe
 		// that's better for users trying to select objects in busy areas)
 
-		CmpPtr<ICmpVisual> cmpVisual(simulation.GetSimContext(), ent);
-		if (!cmpVisual)
+		if (!entry.hasVisual)
 			continue;
 
-		CVector3D position = cmpVisual->GetPosition();
+		const CVector3D& position = entry.position;
 
 		// Reject if it's not on-screen (e.g. it's behind the camera)
 
@@ -171,13 +202,29 @@ std::vector<entity_id_t> EntitySelection::PickSimilarEntities(CSimulation2& simu
 
 	std::vector<entity_id_t> hitEnts;
 
- 	const CSimulation2::InterfaceListUnordered& ents = simulation.GetEntitiesWithInterfaceUnordered(IID_Selectable);
-	for (CSimulation2::InterfaceListUnordered::const_iterator it = ents.begin(); it != ents.end(); ++it)
+	const CSelectionIndex& index = simulation.GetSelectionIndex();
+	const std::vector<CSelectionIndex::SEntry>& entries = index.GetEntries();
+
+	// Unless off-screen entities are wanted, only test the ones that might be on-screen
+	std::vector<size_t> candidates;
+	if (includeOffScreen)
+	{
+		candidates.resize(entries.size());
+		for (size_t i = 0; i < candidates.size(); ++i)
+			candidates[i] = i;
+	}
+	else
+	{
+		GetEntriesInRect(index, camera, 0, 0, g_Renderer.GetWidth(), g_Renderer.GetHeight(), candidates);
+	}
+
+	for (size_t c = 0; c < candidates.size(); ++c)
 	{
- 		entity_id_t ent = it->first;
+		const CSelectionIndex::SEntry& entry = entries[candidates[c]];
+		entity_id_t ent = entry.ent;
 
 		// Check if this entity is only selectable in Atlas
-		if (static_cast<ICmpSelectable*>(it->second)->IsEditorOnly() && !allowEditorSelectables)
+		if (entry.editorOnly && !allowEditorSelectables)
 			continue;
 
 		if (matchRank)
@@ -203,14 +250,12 @@ std::vector<entity_id_t> EntitySelection::PickSimilarEntities(CSimulation2& simu
 		// Ignore off screen entities
 		if (!includeOffScreen)
 		{
- 			// Find the current interpolated model position.
-			CmpPtr<ICmpVisual> cmpVisual(simulation.GetSimContext(), ent);
-			if (!cmpVisual)
+			// Use the current interpolated model position.
+			if (!entry.hasVisual)
 				continue;
-			CVector3D position = cmpVisual->GetPosition();
 
 			// Reject if it's not on-screen (e.g. it's behind the camera)
-			if (!camera.GetFrustum().IsPointVisible(position))
+			if (!camera.GetFrustum().IsPointVisible(entry.position))
 				continue;
 		}
 
@@ -0,0 +1,220 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "SelectionIndex.h"
+
+#include "maths/MathUtil.h"
+#include "ps/Profile.h"
+#include "simulation2/Simulation2.h"
+#include "simulation2/components/ICmpSelectable.h"
+#include "simulation2/components/ICmpVisual.h"
+
+#include <float.h>
+
+// Cells are at least this size (in world units), and there are at most
+// MAX_CELLS_PER_SIDE^2 of them
+static const float MIN_CELL_SIZE = 16.f;
+static const size_t MAX_CELLS_PER_SIDE = 256;
+
+CSelectionIndex::CSelectionIndex() :
+	m_Valid(false), m_MinY(0.f), m_MaxY(0.f), m_GridX0(0.f), m_GridZ0(0.f), m_CellSize(MIN_CELL_SIZE), m_CellsPerSide(0)
+{
+}
+
+void CSelectionIndex::Update(CSimulation2& simulation)
+{
+	if (m_Valid)
+		return;
+
+	PROFILE3("build selection index");
+
+	m_Entries.clear();
+	m_Extents.clear();
+
+	CBoundingBoxAligned total;
+
+	const CSimulation2::InterfaceListUnordered& ents = simulation.GetEntitiesWithInterfaceUnordered(IID_Selectable);
+	for (CSimulation2::InterfaceListUnordered::const_iterator it = ents.begin(); it != ents.end(); ++it)
+	{
+		SEntry entry;
+		entry.ent = it->first;
+		entry.editorOnly = static_cast<ICmpSelectable*>(it->second)->IsEditorOnly();
+
+		CBoundingBoxAligned extent;
+
+		CmpPtr<ICmpVisual> cmpVisual(simulation.GetSimContext(), entry.ent);
+		entry.hasVisual = cmpVisual ? true : false;
+		if (cmpVisual)
+		{
+			entry.position = cmpVisual->GetPosition();
+			entry.selectionBox = cmpVisual->GetSelectionBox();
+			extent += entry.position;
+
+			if (!entry.selectionBox.IsEmpty())
+			{
+				const CBoundingBoxOriented& obb = entry.selectionBox;
+				for (int u = -1; u <= 1; u += 2)
+					for (int v = -1; v <= 1; v += 2)
+						for (int w = -1; w <= 1; w += 2)
+						{
+							CVector3D corner;
+							obb.GetCorner(u, v, w, corner);
+							extent += corner;
+						}
+			}
+			else
+			{
+				// (Only used as a fallback by PickEntitiesAtPoint)
+				entry.bounds = cmpVisual->GetBounds();
+				if (!entry.bounds.IsEmpty())
+					extent += entry.bounds;
+			}
+
+			total += extent;
+		}
+
+		m_Entries.push_back(entry);
+		m_Extents.push_back(extent);
+	}
+
+	if (total.IsEmpty())
+	{
+		m_CellsPerSide = 0;
+		m_CellStart.clear();
+		m_CellItems.clear();
+		m_Valid = true;
+		return;
+	}
+
+	m_MinY = total[0].Y;
+	m_MaxY = total[1].Y;
+	m_GridX0 = total[0].X;
+	m_GridZ0 = total[0].Z;
+	const float size = std::max(total[1].X - total[0].X, total[1].Z - total[0].Z);
+	m_CellSize = std::max(MIN_CELL_SIZE, size / MAX_CELLS_PER_SIDE);
+	m_CellsPerSide = std::min((size_t)(size / m_CellSize) + 1, MAX_CELLS_PER_SIDE);
+
+	// Count the entries in each cell, then store them (so each cell's items
+	// are contiguous, without allocating anything per cell)
+	m_CellStart.assign(m_CellsPerSide*m_CellsPerSide + 1, 0);
+	for (size_t i = 0; i < m_Entries.size(); ++i)
+		AddToCells(i, false);
+
+	for (size_t c = 1; c < m_CellStart.size(); ++c)
+		m_CellStart[c] += m_CellStart[c-1];
+	m_CellItems.resize(m_CellStart.back());
+
+	// (Each cell's start is moved forward as it's filled, so afterwards it's
+	// the start of the next cell and has to be moved back)
+	for (size_t i = 0; i < m_Entries.size(); ++i)
+		AddToCells(i, true);
+	for (size_t c = m_CellStart.size() - 2; c > 0; --c)
+		m_CellStart[c] = m_CellStart[c-1];
+	m_CellStart[0] = 0;
+
+	m_Valid = true;
+}
+
+void CSelectionIndex::AddToCells(size_t i, bool store)
+{
+	const CBoundingBoxAligned& extent = m_Extents[i];
+	if (extent.IsEmpty())
+		return;
+
+	const size_t maxCell = m_CellsPerSide - 1;
+	const size_t x0 = std::min((size_t)((extent[0].X - m_GridX0) / m_CellSize), maxCell);
+	const size_t x1 = std::min((size_t)((extent[1].X - m_GridX0) / m_CellSize), maxCell);
+	const size_t z0 = std::min((size_t)((extent[0].Z - m_GridZ0) / m_CellSize), maxCell);
+	const size_t z1 = std::min((size_t)((extent[1].Z - m_GridZ0) / m_CellSize), maxCell);
+
+	for (size_t z = z0; z <= z1; ++z)
+	{
+		for (size_t x = x0; x <= x1; ++x)
+		{
+			const size_t c = z*m_CellsPerSide + x;
+			if (store)
+				m_CellItems[m_CellStart[c]++] = i;
+			else
+				++m_CellStart[c+1];
+		}
+	}
+}
+
+bool CSelectionIndex::GetCandidates(const CVector3D& origin, const CVector3D* dirs, size_t numDirs, std::vector<size_t>& out) const
+{
+	if (m_CellsPerSide == 0)
+	{
+		out.clear();
+		return true;
+	}
+
+	// The region can only be bounded if the rays all go downwards from above
+	// the lowest entry; then its XZ extent is covered by the points where they
+	// pass through the top and bottom of the entries' vertical range (or the
+	// origin, if it's within that range)
+	if (origin.Y < m_MinY)
+		return false;
+
+	float minX = FLT_MAX, maxX = -FLT_MAX, minZ = FLT_MAX, maxZ = -FLT_MAX;
+	for (size_t i = 0; i < numDirs; ++i)
+	{
+		const CVector3D& dir = dirs[i];
+		if (!(dir.Y < 0.f))
+			return false;
+
+		const float tTop = std::max((m_MaxY - origin.Y) / dir.Y, 0.f);
+		const float tBottom = (m_MinY - origin.Y) / dir.Y;
+		const CVector3D top = origin + dir * tTop;
+		const CVector3D bottom = origin + dir * tBottom;
+
+		minX = std::min(minX, std::min(top.X, bottom.X));
+		maxX = std::max(maxX, std::max(top.X, bottom.X));
+		minZ = std::min(minZ, std::min(top.Z, bottom.Z));
+		maxZ = std::max(maxZ, std::max(top.Z, bottom.Z));
+	}
+
+	out.clear();
+
+	// Convert to cells, allowing for a little rounding error
+	const float margin = 0.01f * m_CellSize;
+	const float gridSize = m_CellsPerSide * m_CellSize;
+	if (maxX < m_GridX0 - margin || maxZ < m_GridZ0 - margin ||
+		minX > m_GridX0 + gridSize + margin || minZ > m_GridZ0 + gridSize + margin)
+		return true;
+
+	const size_t maxCell = m_CellsPerSide - 1;
+	const size_t x0 = (size_t)clamp((minX - margin - m_GridX0) / m_CellSize, 0.f, (float)maxCell);
+	const size_t x1 = (size_t)clamp((maxX + margin - m_GridX0) / m_CellSize, 0.f, (float)maxCell);
+	const size_t z0 = (size_t)clamp((minZ - margin - m_GridZ0) / m_CellSize, 0.f, (float)maxCell);
+	const size_t z1 = (size_t)clamp((maxZ + margin - m_GridZ0) / m_CellSize, 0.f, (float)maxCell);
+
+	for (size_t z = z0; z <= z1; ++z)
+	{
+		for (size_t x = x0; x <= x1; ++x)
+		{
+			const size_t c = z*m_CellsPerSide + x;
+			out.insert(out.end(), m_CellItems.begin() + m_CellStart[c], m_CellItems.begin() + m_CellStart[c+1]);
+		}
+	}
+
+	// Entries in several cells will have been found several times
+	std::sort(out.begin(), out.end());
+	out.erase(std::unique(out.begin(), out.end()), out.end());
+	return true;
+}
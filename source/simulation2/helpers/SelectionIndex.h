@@ -0,0 +1,109 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_SELECTIONINDEX
+#define INCLUDED_SELECTIONINDEX
+
+#include "maths/BoundingBoxAligned.h"
+#include "maths/BoundingBoxOriented.h"
+#include "simulation2/system/Entity.h"
+
+#include <vector>
+
+class CSimulation2;
+
+/**
+ * Spatial index of the selectable entities' visual positions and selection
+ * boxes, used by the EntitySelection picking functions so they don't have to
+ * query and test every entity each time (which happens several times per
+ * frame while the mouse is moving).
+ *
+ * It's built on the first use after the render data changes (i.e. at most
+ * once per frame), from the same interpolated state that was submitted for
+ * rendering; CSimulation2 invalidates it whenever it invalidates its render
+ * snapshot. Since it's in world space, it doesn't depend on the camera.
+ *
+ * The entries are stored in a grid of cells on the XZ plane, and each entry is
+ * added to every cell its extent overlaps.
+ */
+class CSelectionIndex
+{
+	NONCOPYABLE(CSelectionIndex);
+public:
+	struct SEntry
+	{
+		entity_id_t ent;
+		bool editorOnly;
+		bool hasVisual; // if false, the spatial data is not set
+		CVector3D position; // ICmpVisual::GetPosition
+		CBoundingBoxOriented selectionBox; // ICmpVisual::GetSelectionBox
+		CBoundingBoxAligned bounds; // ICmpVisual::GetBounds, only set if selectionBox is empty
+	};
+
+	CSelectionIndex();
+
+	void Invalidate() { m_Valid = false; }
+
+	/**
+	 * Rebuilds the index from the current state of @p simulation, if it has
+	 * been invalidated since it was last built.
+	 */
+	void Update(CSimulation2& simulation);
+
+	/**
+	 * All the selectable entities (including those with no ICmpVisual).
+	 */
+	const std::vector<SEntry>& GetEntries() const { return m_Entries; }
+
+	/**
+	 * Finds the entries (with visuals) whose position, selection box or bounds
+	 * might be inside the region covered by rays starting at @p origin with
+	 * directions @p dirs (i.e. a single ray, or the convex cone between several),
+	 * and writes their indexes in GetEntries() to @p out, in ascending order.
+	 *
+	 * @return false if the region couldn't be bounded (e.g. some ray points
+	 *	upwards), in which case @p out is not changed and every entry must
+	 *	be tested instead.
+	 */
+	bool GetCandidates(const CVector3D& origin, const CVector3D* dirs, size_t numDirs, std::vector<size_t>& out) const;
+
+private:
+	// Adds the entry with index @p i to the cells (or counts it, if !store)
+	void AddToCells(size_t i, bool store);
+
+	bool m_Valid;
+
+	std::vector<SEntry> m_Entries;
+
+	// XZ extent and vertical range of each entry (parallel to m_Entries)
+	std::vector<CBoundingBoxAligned> m_Extents;
+
+	// Vertical range of all the entries
+	float m_MinY, m_MaxY;
+
+	// Grid covering the XZ extent of all the entries
+	float m_GridX0, m_GridZ0;
+	float m_CellSize;
+	size_t m_CellsPerSide;
+
+	// The entry indexes in each cell are m_CellItems[m_CellStart[c]] until
+	// m_CellItems[m_CellStart[c+1]], for cell c = cz*m_CellsPerSide + cx
+	std::vector<size_t> m_CellStart;
+	std::vector<size_t> m_CellItems;
+};
+
+#endif // INCLUDED_SELECTIONINDEX
@@ -0,0 +1,261 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_SLOTMAP
+#define INCLUDED_SLOTMAP
+
+#include <functional>
+#include <queue>
+
+/**
+ * A replacement for std::map<u32, T> where the container allocates the keys itself,
+ * storing the values in a flat array of reusable slots.
+ *
+ * Each key is (generation << SLOT_BITS) | slot. The generation is chosen by
+ * the caller (typically from an incrementing counter), so that a stale key for
+ * a slot that has since been reused won't be found. Lookups are O(1), and
+ * iteration is a linear scan in slot order.
+ *
+ * Key 0 is never allocated (slot 0 is always empty), so callers can use it as
+ * an invalid key.
+ *
+ * Freed slots are reused lowest first. Since that depends only on which slots
+ * are in use, a container that was serialized and deserialized will allocate
+ * exactly the same keys as the original.
+ */
+template<typename T>
+class SlotMap
+{
+public:
+	enum
+	{
+		SLOT_BITS = 20,
+		SLOT_MASK = (1 << SLOT_BITS) - 1,
+		GENERATION_MASK = 0x7FF // remaining bits of a 31-bit key
+	};
+
+	typedef u32 key_type;
+	typedef T mapped_type;
+	typedef std::pair<u32, T> value_type;
+
+	template<typename V>
+	class iterator_base
+	{
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef V value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef V* pointer;
+		typedef V& reference;
+
+		iterator_base() : m_Ptr(NULL), m_End(NULL) { }
+		iterator_base(V* ptr, V* end) : m_Ptr(ptr), m_End(end) { }
+
+		// Allow conversion from iterator to const_iterator
+		template<typename U>
+		iterator_base(const iterator_base<U>& other) : m_Ptr(other.m_Ptr), m_End(other.m_End) { }
+
+		V& operator*() const { return *m_Ptr; }
+		V* operator->() const { return m_Ptr; }
+
+		iterator_base& operator++()
+		{
+			do
+				++m_Ptr;
+			while (m_Ptr != m_End && m_Ptr->first == 0);
+			return *this;
+		}
+
+		template<typename U>
+		bool operator==(const iterator_base<U>& rhs) const { return m_Ptr == rhs.m_Ptr; }
+		template<typename U>
+		bool operator!=(const iterator_base<U>& rhs) const { return m_Ptr != rhs.m_Ptr; }
+
+	private:
+		V* m_Ptr;
+		V* m_End;
+
+		template<typename U> friend class iterator_base;
+	};
+
+	typedef iterator_base<value_type> iterator;
+	typedef iterator_base<const value_type> const_iterator;
+
+	SlotMap() : m_Count(0)
+	{
+	}
+
+	iterator begin()
+	{
+		iterator it(DataBegin(), DataEnd());
+		if (!m_Data.empty())
+			++it; // skip the reserved slot 0
+		return it;
+	}
+
+	iterator end()
+	{
+		return iterator(DataEnd(), DataEnd());
+	}
+
+	const_iterator begin() const
+	{
+		const_iterator it(DataBegin(), DataEnd());
+		if (!m_Data.empty())
+			++it;
+		return it;
+	}
+
+	const_iterator end() const
+	{
+		return const_iterator(DataEnd(), DataEnd());
+	}
+
+	size_t size() const
+	{
+		return m_Count;
+	}
+
+	bool empty() const
+	{
+		return m_Count == 0;
+	}
+
+	void clear()
+	{
+		m_Data.clear();
+		m_FreeSlots = FreeSlots();
+		m_Count = 0;
+	}
+
+	iterator find(u32 key)
+	{
+		u32 slot = key & SLOT_MASK;
+		if (key == 0 || slot >= m_Data.size() || m_Data[slot].first != key)
+			return end();
+		return iterator(DataBegin() + slot, DataEnd());
+	}
+
+	const_iterator find(u32 key) const
+	{
+		u32 slot = key & SLOT_MASK;
+		if (key == 0 || slot >= m_Data.size() || m_Data[slot].first != key)
+			return end();
+		return const_iterator(DataBegin() + slot, DataEnd());
+	}
+
+	/**
+	 * Returns the value for @p key, which must be in the map.
+	 */
+	T& at(u32 key)
+	{
+		iterator it = find(key);
+		ENSURE(it != end());
+		return it->second;
+	}
+
+	/**
+	 * Stores @p value in a free slot, and returns its newly allocated key.
+	 * The key's generation bits are taken from @p generation.
+	 */
+	u32 insert(u32 generation, const T& value)
+	{
+		u32 slot = 0;
+		while (!m_FreeSlots.empty())
+		{
+			u32 s = m_FreeSlots.top();
+			m_FreeSlots.pop();
+			// (Skip slots that were filled by a keyed insert after being freed)
+			if (m_Data[s].first == 0)
+			{
+				slot = s;
+				break;
+			}
+		}
+
+		if (slot == 0)
+		{
+			if (m_Data.empty())
+				m_Data.push_back(value_type(0, T()));
+			slot = (u32)m_Data.size();
+			ENSURE(slot <= SLOT_MASK);
+			m_Data.push_back(value_type(0, T()));
+		}
+
+		u32 key = ((generation & GENERATION_MASK) << SLOT_BITS) | slot;
+		m_Data[slot] = value_type(key, value);
+		++m_Count;
+		return key;
+	}
+
+	/**
+	 * Inserts the value with the given key (e.g. when deserializing).
+	 * The key's slot must not already be in use.
+	 */
+	void insert(const value_type& value)
+	{
+		u32 key = value.first;
+		u32 slot = key & SLOT_MASK;
+		ENSURE(slot != 0 && (key >> SLOT_BITS) <= GENERATION_MASK);
+
+		if (m_Data.empty())
+			m_Data.push_back(value_type(0, T()));
+		while (slot >= m_Data.size())
+		{
+			m_FreeSlots.push((u32)m_Data.size());
+			m_Data.push_back(value_type(0, T()));
+		}
+
+		ENSURE(m_Data[slot].first == 0);
+		m_Data[slot] = value;
+		++m_Count;
+	}
+
+	void erase(iterator it)
+	{
+		value_type& v = *it;
+		ENSURE(v.first != 0);
+		u32 slot = v.first & SLOT_MASK;
+		v.first = 0;
+		v.second = T();
+		m_FreeSlots.push(slot);
+		--m_Count;
+	}
+
+	size_t erase(u32 key)
+	{
+		iterator it = find(key);
+		if (it == end())
+			return 0;
+		erase(it);
+		return 1;
+	}
+
+private:
+	typedef std::priority_queue<u32, std::vector<u32>, std::greater<u32> > FreeSlots;
+
+	value_type* DataBegin() { return m_Data.empty() ? NULL : &m_Data[0]; }
+	value_type* DataEnd() { return DataBegin() + m_Data.size(); }
+	const value_type* DataBegin() const { return m_Data.empty() ? NULL : &m_Data[0]; }
+	const value_type* DataEnd() const { return DataBegin() + m_Data.size(); }
+
+	std::vector<value_type> m_Data;
+	FreeSlots m_FreeSlots; // may also contain slots that have been refilled by keyed inserts
+	size_t m_Count;
+};
+
+#endif // INCLUDED_SLOTMAP
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,6 +20,72 @@
 
 #include "simulation2/serialization/SerializeTemplates.h"
 
+/**
+ * Storage for the items in a single division of a SpatialSubdivision.
+ * Most divisions only contain a few items, so the first N are stored inline -
+ * the divisions are then all in one contiguous array, with no per-division heap
+ * allocations - and only the rare excess is stored in a separate std::vector.
+ * Items have the same order as if they were all in a single std::vector.
+ */
+template<typename T, size_t N>
+class SubdivisionSmallVector
+{
+public:
+	SubdivisionSmallVector() : m_Size(0)
+	{
+	}
+
+	size_t size() const
+	{
+		return m_Size;
+	}
+
+	T& operator[](size_t n)
+	{
+		return n < N ? m_Items[n] : m_Overflow[n - N];
+	}
+
+	const T& operator[](size_t n) const
+	{
+		return n < N ? m_Items[n] : m_Overflow[n - N];
+	}
+
+	T& back()
+	{
+		return (*this)[m_Size - 1];
+	}
+
+	void push_back(const T& item)
+	{
+		if (m_Size < N)
+			m_Items[m_Size] = item;
+		else
+			m_Overflow.push_back(item);
+		++m_Size;
+	}
+
+	void pop_back()
+	{
+		--m_Size;
+		if (m_Size >= N)
+			m_Overflow.pop_back();
+	}
+
+	/**
+	 * Append all items onto the end of the given vector.
+	 */
+	void AppendTo(std::vector<T>& out) const
+	{
+		out.insert(out.end(), m_Items, m_Items + std::min((size_t)m_Size, N));
+		out.insert(out.end(), m_Overflow.begin(), m_Overflow.end());
+	}
+
+private:
+	u32 m_Size;
+	T m_Items[N];
+	std::vector<T> m_Overflow;
+};
+
 /**
  * A very basic subdivision scheme for finding items in ranges.
  * Items are stored in lists in fixed-size divisions.
@@ -37,6 +103,10 @@
 template<typename T>
 class SpatialSubdivision
 {
+	// Number of items per division that can be stored without allocating
+	// (8 u32s plus the overhead fits in a 64-byte cache line)
+	typedef SubdivisionSmallVector<T, 8> Division;
+
 public:
 	SpatialSubdivision() :
 		m_DivisionsW(0), m_DivisionsH(0)
@@ -55,8 +125,9 @@ public:
 		{
 			for (u32 i = 0; i < m_DivisionsW; ++i)
 			{
-				std::vector<T> div1 = m_Divisions.at(i + j*m_DivisionsW);
-				std::vector<T> div2 = rhs.m_Divisions.at(i + j*m_DivisionsW);
+				std::vector<T> div1, div2;
+				m_Divisions.at(i + j*m_DivisionsW).AppendTo(div1);
+				rhs.m_Divisions.at(i + j*m_DivisionsW).AppendTo(div2);
 				std::sort(div1.begin(), div1.end());
 				std::sort(div2.begin(), div2.end());
 				if (div1 != div2)
@@ -79,6 +150,8 @@ public:
 		m_DivisionsH = (maxZ / m_DivisionSize).ToInt_RoundToInfinity();
 		m_Divisions.clear();
 		m_Divisions.resize(m_DivisionsW * m_DivisionsH);
+		m_DivisionStamps.clear();
+		m_DivisionStamps.resize(m_DivisionsW * m_DivisionsH);
 	}
 
 	/**
@@ -97,7 +170,7 @@ public:
 		{
 			for (u32 i = i0; i <= i1; ++i)
 			{
-				std::vector<T>& div = m_Divisions.at(i + j*m_DivisionsW);
+				Division& div = m_Divisions.at(i + j*m_DivisionsW);
 				div.push_back(item);
 			}
 		}
@@ -120,7 +193,7 @@ public:
 		{
 			for (u32 i = i0; i <= i1; ++i)
 			{
-				std::vector<T>& div = m_Divisions.at(i + j*m_DivisionsW);
+				Division& div = m_Divisions.at(i + j*m_DivisionsW);
 
 				for (u32 n = 0; n < div.size(); ++n)
 				{
@@ -175,12 +248,14 @@ public:
 	}
 
 	/**
-	 * Returns a sorted list of unique items that includes all items
-	 * within the given axis-aligned square range.
+	 * Replaces the contents of 'out' with a sorted list of unique items that
+	 * includes all items within the given axis-aligned square range.
+	 * Callers that query frequently should reuse the same 'out' vector,
+	 * so that no memory is allocated once it has grown large enough.
 	 */
-	std::vector<T> GetInRange(CFixedVector2D posMin, CFixedVector2D posMax)
+	void GetInRange(CFixedVector2D posMin, CFixedVector2D posMax, std::vector<T>& out)
 	{
-		std::vector<T> ret;
+		out.clear();
 
 		ENSURE(posMin.X <= posMax.X && posMin.Y <= posMax.Y);
 
@@ -191,16 +266,34 @@ public:
 		for (u32 j = j0; j <= j1; ++j)
 		{
 			for (u32 i = i0; i <= i1; ++i)
-			{
-				std::vector<T>& div = m_Divisions.at(i + j*m_DivisionsW);
-				ret.insert(ret.end(), div.begin(), div.end());
-			}
+				m_Divisions.at(i + j*m_DivisionsW).AppendTo(out);
 		}
 
-		// Remove duplicates
-		std::sort(ret.begin(), ret.end());
-		ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+		// Remove duplicates (from items that span multiple divisions)
+		std::sort(out.begin(), out.end());
+		out.erase(std::unique(out.begin(), out.end()), out.end());
+	}
+
+	/**
+	 * Replaces the contents of 'out' with a sorted list of unique items that
+	 * includes all items within the given circular distance of the given point.
+	 */
+	void GetNear(CFixedVector2D pos, entity_pos_t range, std::vector<T>& out)
+	{
+		// TODO: be cleverer and return a circular pattern of divisions,
+		// not this square over-approximation
+
+		GetInRange(pos - CFixedVector2D(range, range), pos + CFixedVector2D(range, range), out);
+	}
 
+	/**
+	 * Returns a sorted list of unique items that includes all items
+	 * within the given axis-aligned square range.
+	 */
+	std::vector<T> GetInRange(CFixedVector2D posMin, CFixedVector2D posMax)
+	{
+		std::vector<T> ret;
+		GetInRange(posMin, posMax, ret);
 		return ret;
 	}
 
@@ -210,10 +303,55 @@ public:
 	 */
 	std::vector<T> GetNear(CFixedVector2D pos, entity_pos_t range)
 	{
-		// TODO: be cleverer and return a circular pattern of divisions,
-		// not this square over-approximation
+		std::vector<T> ret;
+		GetNear(pos, range, ret);
+		return ret;
+	}
+
+	/**
+	 * Records that the items in the divisions containing the given point
+	 * have changed in some way (e.g. moved, or changed owner) at the given time.
+	 * This lets callers cache results computed from a region and only recompute
+	 * them when GetLatestStamp reports something has changed since.
+	 * Stamps are not serialized, and are reset to 0 by Reset.
+	 */
+	void Stamp(CFixedVector2D pos, u32 stamp)
+	{
+		u32 i0 = GetI0(pos.X);
+		u32 j0 = GetJ0(pos.Y);
+		u32 i1 = GetI1(pos.X);
+		u32 j1 = GetJ1(pos.Y);
+		for (u32 j = j0; j <= j1; ++j)
+			for (u32 i = i0; i <= i1; ++i)
+				m_DivisionStamps.at(i + j*m_DivisionsW) = std::max(m_DivisionStamps.at(i + j*m_DivisionsW), stamp);
+	}
+
+	/**
+	 * Returns the most recent Stamp of all the divisions that GetInRange
+	 * would look at for the given range.
+	 */
+	u32 GetLatestStamp(CFixedVector2D posMin, CFixedVector2D posMax)
+	{
+		ENSURE(posMin.X <= posMax.X && posMin.Y <= posMax.Y);
+
+		u32 latest = 0;
+		u32 i0 = GetI0(posMin.X);
+		u32 j0 = GetJ0(posMin.Y);
+		u32 i1 = GetI1(posMax.X);
+		u32 j1 = GetJ1(posMax.Y);
+		for (u32 j = j0; j <= j1; ++j)
+			for (u32 i = i0; i <= i1; ++i)
+				latest = std::max(latest, m_DivisionStamps.at(i + j*m_DivisionsW));
+		return latest;
+	}
 
-		return GetInRange(pos - CFixedVector2D(range, range), pos + CFixedVector2D(range, range));
+	/**
+	 * Returns the most recent Stamp of all the divisions that GetNear
+	 * would look at for the given range.
+	 */
+	u32 GetLatestStampNear(CFixedVector2D pos, entity_pos_t range)
+	{
+		return GetLatestStamp(pos - CFixedVector2D(range, range), pos + CFixedVector2D(range, range));
 	}
 
 private:
@@ -252,7 +390,8 @@ private:
 	}
 
 	entity_pos_t m_DivisionSize;
-	std::vector<std::vector<T> > m_Divisions;
+	std::vector<Division> m_Divisions;
+	std::vector<u32> m_DivisionStamps;
 	u32 m_DivisionsW;
 	u32 m_DivisionsH;
 
@@ -265,11 +404,22 @@ private:
 template<typename ELEM>
 struct SerializeSpatialSubdivision
 {
+	// (The divisions are serialized in the same format as SerializeVector<SerializeVector<ELEM> >)
+
 	template<typename T>
 	void operator()(ISerializer& serialize, const char* UNUSED(name), SpatialSubdivision<T>& value)
 	{
 		serialize.NumberFixed_Unbounded("div size", value.m_DivisionSize);
-		SerializeVector<SerializeVector<ELEM> >()(serialize, "divs", value.m_Divisions);
+
+		serialize.NumberU32_Unbounded("length", (u32)value.m_Divisions.size());
+		for (size_t i = 0; i < value.m_Divisions.size(); ++i)
+		{
+			typename SpatialSubdivision<T>::Division& div = value.m_Divisions[i];
+			serialize.NumberU32_Unbounded("length", (u32)div.size());
+			for (size_t n = 0; n < div.size(); ++n)
+				ELEM()(serialize, "divs", div[n]);
+		}
+
 		serialize.NumberU32_Unbounded("divs w", value.m_DivisionsW);
 		serialize.NumberU32_Unbounded("divs h", value.m_DivisionsH);
 	}
@@ -278,13 +428,32 @@ struct SerializeSpatialSubdivision
 	void operator()(IDeserializer& serialize, const char* UNUSED(name), SpatialSubdivision<T>& value)
 	{
 		serialize.NumberFixed_Unbounded("div size", value.m_DivisionSize);
-		SerializeVector<SerializeVector<ELEM> >()(serialize, "divs", value.m_Divisions);
+
+		u32 numDivs;
+		serialize.NumberU32_Unbounded("length", numDivs);
+		value.m_Divisions.clear();
+		value.m_Divisions.resize(numDivs);
+		for (size_t i = 0; i < numDivs; ++i)
+		{
+			typename SpatialSubdivision<T>::Division& div = value.m_Divisions[i];
+			u32 len;
+			serialize.NumberU32_Unbounded("length", len);
+			for (size_t n = 0; n < len; ++n)
+			{
+				T item;
+				ELEM()(serialize, "divs", item);
+				div.push_back(item);
+			}
+		}
 
 		u32 w, h;
 		serialize.NumberU32_Unbounded("divs w", w);
 		serialize.NumberU32_Unbounded("divs h", h);
 		value.m_DivisionsW = w;
 		value.m_DivisionsH = h;
+
+		value.m_DivisionStamps.clear();
+		value.m_DivisionStamps.resize(w * h);
 	}
 };
 
@@ -0,0 +1,129 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "Steering.h"
+
+const fixed Steering::HORIZON = fixed::FromInt(2);
+
+/**
+ * Cost of a collision that would happen right now, relative to the cost of
+ * the deviation from the preferred velocity (which is measured as a fraction
+ * of the preferred speed). Collisions further ahead cost proportionally less.
+ */
+static const fixed COLLISION_WEIGHT = fixed::FromInt(4);
+
+/**
+ * Collisions sooner than this are all treated as equally bad
+ * (to avoid dividing by zero).
+ */
+static const fixed MIN_COLLISION_TIME = fixed::FromInt(1)/8;
+
+/**
+ * Candidate directions, as angles relative to the preferred velocity.
+ * Turning clockwise is tried first, so that units approaching each other
+ * head-on both dodge to the same side.
+ */
+static const fixed CANDIDATE_ANGLES[] = {
+	fixed::Zero(),
+	-fixed::Pi()/8, fixed::Pi()/8,
+	-fixed::Pi()/4, fixed::Pi()/4,
+	-fixed::Pi()*3/8, fixed::Pi()*3/8,
+	-fixed::Pi()/2, fixed::Pi()/2,
+};
+
+fixed Steering::ComputePenalty(CFixedVector2D pos, entity_pos_t radius, CFixedVector2D preferred, CFixedVector2D v, const std::vector<Neighbour>& neighbours)
+{
+	fixed penalty;
+	fixed preferredSpeed = preferred.Length();
+	if (!preferredSpeed.IsZero())
+		penalty = (v - preferred).Length() / preferredSpeed;
+
+	for (size_t i = 0; i < neighbours.size(); ++i)
+	{
+		const Neighbour& n = neighbours[i];
+		CFixedVector2D p = n.pos - pos;
+		CFixedVector2D w = v - n.velocity;
+		entity_pos_t r = radius + n.radius;
+
+		fixed b = p.Dot(w);
+
+		// Moving apart (or not moving relative to each other) can never collide
+		if (b <= fixed::Zero())
+			continue;
+
+		// If we're already overlapping, any velocity that brings us closer
+		// counts as colliding immediately
+		if (p.CompareLength(r) < 0)
+		{
+			penalty += COLLISION_WEIGHT;
+			continue;
+		}
+
+		// Find the time of closest approach within the horizon
+		fixed a = w.Dot(w);
+		fixed t = std::min(b / a, HORIZON);
+		CFixedVector2D closest = p - w.Multiply(t);
+		if (closest.CompareLength(r) >= 0)
+			continue;
+
+		// Back up from the closest approach to the time of first contact
+		fixed depth = (r.Square() - closest.Dot(closest)).Sqrt();
+		t -= depth / a.Sqrt();
+		if (t < MIN_COLLISION_TIME)
+			t = MIN_COLLISION_TIME;
+
+		penalty += COLLISION_WEIGHT.Multiply(MIN_COLLISION_TIME) / t;
+	}
+
+	return penalty;
+}
+
+CFixedVector2D Steering::ComputeVelocity(CFixedVector2D pos, entity_pos_t radius, CFixedVector2D preferred, const std::vector<Neighbour>& neighbours)
+{
+	fixed bestPenalty = ComputePenalty(pos, radius, preferred, preferred, neighbours);
+	if (bestPenalty.IsZero() || preferred.IsZero())
+		return preferred;
+
+	CFixedVector2D best = preferred;
+
+	// Try each direction at full and half speed, then stopping
+	for (size_t speed = 0; speed < 2; ++speed)
+	{
+		CFixedVector2D base = (speed == 0 ? preferred : CFixedVector2D(preferred.X / 2, preferred.Y / 2));
+		for (size_t i = 0; i < ARRAY_SIZE(CANDIDATE_ANGLES); ++i)
+		{
+			if (speed == 0 && i == 0)
+				continue; // already tried the preferred velocity
+
+			CFixedVector2D v = base.Rotate(CANDIDATE_ANGLES[i]);
+			fixed penalty = ComputePenalty(pos, radius, preferred, v, neighbours);
+			if (penalty < bestPenalty)
+			{
+				best = v;
+				bestPenalty = penalty;
+			}
+		}
+	}
+
+	CFixedVector2D stop;
+	if (ComputePenalty(pos, radius, preferred, stop, neighbours) < bestPenalty)
+		best = stop;
+
+	return best;
+}
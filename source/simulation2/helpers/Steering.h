@@ -0,0 +1,73 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_HELPER_STEERING
+#define INCLUDED_HELPER_STEERING
+
+/**
+ * @file
+ * Local collision avoidance between moving units, based on velocity obstacles.
+ *
+ * Each unit picks, from a fixed set of candidate velocities around its preferred
+ * velocity, the one that best trades off deviating from the preferred velocity
+ * against how soon it would collide with its neighbours (assuming they keep
+ * their current velocities). Everything uses fixed-point maths and visits the
+ * candidates and neighbours in a fixed order, so the result is deterministic.
+ */
+
+#include "maths/FixedVector2D.h"
+#include "simulation2/helpers/Position.h"
+
+#include <vector>
+
+namespace Steering
+{
+
+/**
+ * A moving circle that a unit should avoid.
+ */
+struct Neighbour
+{
+	CFixedVector2D pos;
+	CFixedVector2D velocity; // in metres per second
+	entity_pos_t radius;
+};
+
+/**
+ * How far ahead (in seconds) collisions are predicted.
+ */
+extern const fixed HORIZON;
+
+/**
+ * Returns the velocity a unit at @p pos with radius @p radius should move at,
+ * given that it wants to move at @p preferred and has to avoid @p neighbours.
+ * Returns exactly @p preferred if that won't collide with anything within
+ * the horizon.
+ */
+CFixedVector2D ComputeVelocity(CFixedVector2D pos, entity_pos_t radius, CFixedVector2D preferred, const std::vector<Neighbour>& neighbours);
+
+/**
+ * Returns the penalty of moving at velocity @p v: its deviation from
+ * @p preferred (as a fraction of the preferred speed) plus a cost for each
+ * neighbour it would collide with, which is larger the sooner the collision
+ * happens.
+ */
+fixed ComputePenalty(CFixedVector2D pos, entity_pos_t radius, CFixedVector2D preferred, CFixedVector2D v, const std::vector<Neighbour>& neighbours);
+
+}
+
+#endif // INCLUDED_HELPER_STEERING
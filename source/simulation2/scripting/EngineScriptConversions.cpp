@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -167,13 +167,13 @@ template<> jsval ScriptInterface::ToJSVal<CFixedVector3D>(JSContext* cx, const C
 	if (!obj)
 		return JSVAL_VOID;
 
-	jsval x = ToJSVal(cx, val.X);
-	jsval y = ToJSVal(cx, val.Y);
-	jsval z = ToJSVal(cx, val.Z);
-
-	JS_SetProperty(cx, obj, "x", &x);
-	JS_SetProperty(cx, obj, "y", &y);
-	JS_SetProperty(cx, obj, "z", &z);
+	// These are converted very frequently (e.g. positions for the GUI and AI),
+	// so define the properties directly instead of going through the more
+	// general (and slower) JS_SetProperty. The properties are always added in
+	// the same order, so all the objects share the same shape.
+	JS_DefineProperty(cx, obj, "x", ToJSVal(cx, val.X), NULL, NULL, JSPROP_ENUMERATE);
+	JS_DefineProperty(cx, obj, "y", ToJSVal(cx, val.Y), NULL, NULL, JSPROP_ENUMERATE);
+	JS_DefineProperty(cx, obj, "z", ToJSVal(cx, val.Z), NULL, NULL, JSPROP_ENUMERATE);
 
 	return OBJECT_TO_JSVAL(obj);
 }
@@ -201,11 +201,9 @@ template<> jsval ScriptInterface::ToJSVal<CFixedVector2D>(JSContext* cx, const C
 	if (!obj)
 		return JSVAL_VOID;
 
-	jsval x = ToJSVal(cx, val.X);
-	jsval y = ToJSVal(cx, val.Y);
-
-	JS_SetProperty(cx, obj, "x", &x);
-	JS_SetProperty(cx, obj, "y", &y);
+	// (See the CFixedVector3D conversion)
+	JS_DefineProperty(cx, obj, "x", ToJSVal(cx, val.X), NULL, NULL, JSPROP_ENUMERATE);
+	JS_DefineProperty(cx, obj, "y", ToJSVal(cx, val.Y), NULL, NULL, JSPROP_ENUMERATE);
 
 	return OBJECT_TO_JSVAL(obj);
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -51,8 +51,15 @@
 jsval CMessage::ToJSValCached(ScriptInterface& scriptInterface) const
 {
 	if (m_Cached.uninitialised())
+	{
 		m_Cached = CScriptValRooted(scriptInterface.GetContext(), ToJSVal(scriptInterface));
 
+		// The same object is passed to every script component that receives this
+		// message, so stop them modifying it and affecting the others
+		if (JSVAL_IS_OBJECT(m_Cached.get()) && !JSVAL_IS_NULL(m_Cached.get()))
+			scriptInterface.FreezeObject(m_Cached.get(), true);
+	}
+
 	return m_Cached.get();
 }
 
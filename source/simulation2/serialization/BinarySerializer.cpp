@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -29,8 +29,10 @@
 
 CBinarySerializerScriptImpl::CBinarySerializerScriptImpl(ScriptInterface& scriptInterface, ISerializer& serializer) :
 	m_ScriptInterface(scriptInterface), m_Serializer(serializer), m_Rooter(m_ScriptInterface),
-	m_ScriptBackrefsArena(8*MiB), m_ScriptBackrefs(backrefs_t::key_compare(), ScriptBackrefsAlloc(m_ScriptBackrefsArena)), m_ScriptBackrefsNext(1)
+	m_ScriptBackrefsNext(1)
 {
+	ScriptBackref empty = { NULL, 0 };
+	m_ScriptBackrefs.resize(1024, empty);
 }
 
 void CBinarySerializerScriptImpl::HandleScriptVal(jsval val)
@@ -109,16 +111,9 @@ void CBinarySerializerScriptImpl::HandleScriptVal(jsval val)
 		{
 			jsid id = ida[i];
 
-			jsval idval, propval;
+			jsval propval;
 
-			// Get the property name as a string
-			if (!JS_IdToValue(cx, id, &idval))
-				throw PSERROR_Serialize_ScriptError("JS_IdToValue failed");
-			JSString* idstr = JS_ValueToString(cx, idval);
-			if (!idstr)
-				throw PSERROR_Serialize_ScriptError("JS_ValueToString failed");
-
-			ScriptString("prop name", idstr);
+			ScriptPropertyName(id);
 
 			// Use LookupProperty instead of GetProperty to avoid the danger of getters
 			// (they might delete values and trigger GC)
@@ -223,6 +218,45 @@ void CBinarySerializerScriptImpl::ScriptString(const char* name, JSString* strin
 	m_Serializer.RawBytes(name, (const u8*)chars, length*2);
 }
 
+void CBinarySerializerScriptImpl::ScriptPropertyName(jsid id)
+{
+	// Array elements have integer IDs - write their decimal names directly,
+	// rather than allocating a new JS string for every element
+	if (JSID_IS_INT(id))
+	{
+		int32_t n = JSID_TO_INT(id);
+		u32 mag = (n < 0 ? (u32)-(i64)n : (u32)n);
+
+		jschar chars[16];
+		jschar* end = chars + ARRAY_SIZE(chars);
+		jschar* p = end;
+		do
+		{
+			*--p = (jschar)('0' + mag % 10);
+			mag /= 10;
+		} while (mag);
+		if (n < 0)
+			*--p = '-';
+
+		// Same format as ScriptString
+		m_Serializer.NumberU32_Unbounded("string length", (uint32_t)(end - p));
+		m_Serializer.RawBytes("prop name", (const u8*)p, (end - p)*2);
+		return;
+	}
+
+	JSContext* cx = m_ScriptInterface.GetContext();
+
+	// Get the property name as a string
+	jsval idval;
+	if (!JS_IdToValue(cx, id, &idval))
+		throw PSERROR_Serialize_ScriptError("JS_IdToValue failed");
+	JSString* idstr = JS_ValueToString(cx, idval);
+	if (!idstr)
+		throw PSERROR_Serialize_ScriptError("JS_ValueToString failed");
+
+	ScriptString("prop name", idstr);
+}
+
 u32 CBinarySerializerScriptImpl::GetScriptBackrefTag(JSObject* obj)
 {
 	// To support non-tree structures (e.g. "var x = []; var y = [x, x];"), we need a way
@@ -230,19 +264,47 @@ u32 CBinarySerializerScriptImpl::GetScriptBackrefTag(JSObject* obj)
 	// new object, we give it a new non-zero tag; when we serialize it a second time we just
 	// refer to that tag.
 	//
-	// The tags are stored in a map. Maybe it'd be more efficient to store it inline in the object
-	// somehow? but this works okay for now
+	// This is called for every object we serialize, so the tags are stored in a
+	// hash table keyed on the object pointer.
 
-	std::pair<backrefs_t::iterator, bool> it = m_ScriptBackrefs.insert(std::make_pair(obj, m_ScriptBackrefsNext));
+	const size_t mask = m_ScriptBackrefs.size() - 1;
+	size_t i = HashScriptBackref(obj, mask);
+	while (m_ScriptBackrefs[i].obj)
+	{
+		// If it was already there, return the tag
+		if (m_ScriptBackrefs[i].obj == obj)
+			return m_ScriptBackrefs[i].tag;
+		i = (i + 1) & mask;
+	}
 
-	// If it was already there, return the tag
-	if (!it.second)
-		return it.first->second;
+	m_ScriptBackrefs[i].obj = obj;
+	m_ScriptBackrefs[i].tag = m_ScriptBackrefsNext;
 
-	// If it was newly inserted, we need to make sure it gets rooted
-	// for the duration that it's in m_ScriptBackrefs
-	m_Rooter.Push(it.first->first);
+	// We need to make sure it gets rooted for the duration that it's in m_ScriptBackrefs
+	m_Rooter.Push(obj);
 	m_ScriptBackrefsNext++;
+
+	if ((m_ScriptBackrefsNext - 1) * 2 > m_ScriptBackrefs.size())
+		GrowScriptBackrefs();
+
 	// Return a non-tag number so callers know they need to serialize the object
 	return 0;
 }
+
+void CBinarySerializerScriptImpl::GrowScriptBackrefs()
+{
+	ScriptBackref empty = { NULL, 0 };
+	std::vector<ScriptBackref> old(m_ScriptBackrefs.size() * 2, empty);
+	old.swap(m_ScriptBackrefs);
+
+	const size_t mask = m_ScriptBackrefs.size() - 1;
+	for (size_t j = 0; j < old.size(); ++j)
+	{
+		if (!old[j].obj)
+			continue;
+		size_t i = HashScriptBackref(old[j].obj, mask);
+		while (m_ScriptBackrefs[i].obj)
+			i = (i + 1) & mask;
+		m_ScriptBackrefs[i] = old[j];
+	}
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,9 +23,8 @@
 #include "scriptinterface/AutoRooters.h"
 
 #include "lib/byte_order.h"
-#include "lib/allocators/arena.h"
 
-#include <map>
+#include <vector>
 
 /**
  * Wrapper for redirecting ostream writes to CBinarySerializer's impl
@@ -60,17 +59,33 @@ public:
 	void ScriptString(const char* name, JSString* string);
 	void HandleScriptVal(jsval val);
 private:
+	// Writes the property name for @p id, in the same format as ScriptString
+	void ScriptPropertyName(jsid id);
+
 	ScriptInterface& m_ScriptInterface;
 	ISerializer& m_Serializer;
 
-	// Pooling helps since we do a lot of short-lived allocations
-	typedef ProxyAllocator<std::pair<JSObject* const, u32>, Allocators::Arena<> > ScriptBackrefsAlloc;
-	typedef std::map<JSObject*, u32, std::less<JSObject*>, ScriptBackrefsAlloc> backrefs_t;
-
-	Allocators::Arena<> m_ScriptBackrefsArena;
-	backrefs_t m_ScriptBackrefs;
+	// Open-addressed hash table (with linear probing) from objects to their
+	// backref tags. Entries are never removed, so there's no need for tombstones.
+	// The size is always a power of two, and at most half the slots are used.
+	struct ScriptBackref
+	{
+		JSObject* obj;
+		u32 tag;
+	};
+	std::vector<ScriptBackref> m_ScriptBackrefs;
 	u32 m_ScriptBackrefsNext;
 	u32 GetScriptBackrefTag(JSObject* obj);
+	void GrowScriptBackrefs();
+
+	static size_t HashScriptBackref(JSObject* obj, size_t mask)
+	{
+		// Objects are at least 8-byte aligned, so discard the low bits, then
+		// mix with a Fibonacci hash (folding the well-mixed high bits down)
+		size_t h = (size_t)((uintptr_t)obj >> 3) * (size_t)0x9E3779B97F4A7C15ull;
+		h ^= h >> (sizeof(size_t)*4);
+		return h & mask;
+	}
 
 	AutoGCRooter m_Rooter;
 };
@@ -184,6 +199,31 @@ protected:
 		m_Impl.Put(name, data, len);
 	}
 
+	// The arrays are written in one go, with the same bytes as the individual elements would be
+
+	virtual void PutNumberArray(const char* name, const uint8_t* values, size_t n)
+	{
+		m_Impl.Put(name, values, n);
+	}
+
+	virtual void PutNumberArray(const char* name, const uint16_t* values, size_t n)
+	{
+#if BYTE_ORDER == BIG_ENDIAN
+		ISerializer::PutNumberArray(name, values, n);
+#else
+		m_Impl.Put(name, (const u8*)values, n*sizeof(uint16_t));
+#endif
+	}
+
+	virtual void PutNumberArray(const char* name, const uint32_t* values, size_t n)
+	{
+#if BYTE_ORDER == BIG_ENDIAN
+		ISerializer::PutNumberArray(name, values, n);
+#else
+		m_Impl.Put(name, (const u8*)values, n*sizeof(uint32_t));
+#endif
+	}
+
 	virtual std::ostream& GetStream()
 	{
 		return m_RawStream;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -168,6 +168,30 @@ void CDebugSerializer::PutRaw(const char* name, const u8* data, size_t len)
 	m_Stream << "\n";
 }
 
+// (The arrays are output the same as their individual elements, so that
+// dumps can be diffed against older ones)
+
+void CDebugSerializer::PutNumberArray(const char* name, const uint8_t* values, size_t n)
+{
+	std::string prefix = INDENT + name + ": ";
+	for (size_t i = 0; i < n; ++i)
+		m_Stream << prefix << (int)values[i] << "\n";
+}
+
+void CDebugSerializer::PutNumberArray(const char* name, const uint16_t* values, size_t n)
+{
+	std::string prefix = INDENT + name + ": ";
+	for (size_t i = 0; i < n; ++i)
+		m_Stream << prefix << values[i] << "\n";
+}
+
+void CDebugSerializer::PutNumberArray(const char* name, const uint32_t* values, size_t n)
+{
+	std::string prefix = INDENT + name + ": ";
+	for (size_t i = 0; i < n; ++i)
+		m_Stream << prefix << values[i] << "\n";
+}
+
 bool CDebugSerializer::IsDebug() const
 {
 	return m_IsDebug;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -56,6 +56,9 @@ protected:
 	virtual void PutString(const char* name, const std::string& value);
 	virtual void PutScriptVal(const char* name, jsval value);
 	virtual void PutRaw(const char* name, const u8* data, size_t len);
+	virtual void PutNumberArray(const char* name, const uint8_t* values, size_t n);
+	virtual void PutNumberArray(const char* name, const uint16_t* values, size_t n);
+	virtual void PutNumberArray(const char* name, const uint32_t* values, size_t n);
 
 private:
 	ScriptInterface& m_ScriptInterface;
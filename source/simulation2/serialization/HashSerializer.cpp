@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,8 +19,8 @@
 
 #include "HashSerializer.h"
 
-CHashSerializer::CHashSerializer(ScriptInterface& scriptInterface) :
-	CBinarySerializer<CHashSerializerImpl>(scriptInterface)
+CHashSerializer::CHashSerializer(ScriptInterface& scriptInterface, EStateHashType type) :
+	CBinarySerializer<CHashSerializerImpl>(scriptInterface, type)
 {
 }
 
@@ -36,11 +36,14 @@ const u8* CHashSerializer::ComputeHash()
 
 size_t CHashSerializerImpl::GetHashLength()
 {
-	return HashFunc::DIGESTSIZE;
+	return sizeof(m_HashData);
 }
 
 const u8* CHashSerializerImpl::ComputeHash()
 {
-	m_Hash.Final(m_HashData);
+	if (m_Type == STATE_HASH_MURMUR3)
+		m_Murmur.Final(m_HashData);
+	else
+		m_MD5.Final(m_HashData);
 	return m_HashData;
 }
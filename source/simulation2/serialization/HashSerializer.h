@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,32 +20,41 @@
 
 #include "BinarySerializer.h"
 
+#include "StateHashType.h"
+
 #include "maths/MD5.h"
+#include "maths/MurmurHash3.h"
 
 class CHashSerializerImpl
 {
-	// We don't care about cryptographic strength, just about detection of
-	// unintended changes and about performance, so MD5 is an adequate choice
-	typedef MD5 HashFunc;
-
 public:
+	CHashSerializerImpl(EStateHashType type) : m_Type(type)
+	{
+	}
+
 	size_t GetHashLength();
 	const u8* ComputeHash();
 
 	void Put(const char* UNUSED(name), const u8* data, size_t len)
 	{
-		m_Hash.Update(data, len);
+		if (m_Type == STATE_HASH_MURMUR3)
+			m_Murmur.Update(data, len);
+		else
+			m_MD5.Update(data, len);
 	}
 
 private:
-	HashFunc m_Hash;
-	u8 m_HashData[HashFunc::DIGESTSIZE];
+	EStateHashType m_Type;
+	MD5 m_MD5;
+	MurmurHash3 m_Murmur;
+	cassert(MD5::DIGESTSIZE == MurmurHash3::DIGESTSIZE);
+	u8 m_HashData[MD5::DIGESTSIZE];
 };
 
 class CHashSerializer : public CBinarySerializer<CHashSerializerImpl>
 {
 public:
-	CHashSerializer(ScriptInterface& scriptInterface);
+	CHashSerializer(ScriptInterface& scriptInterface, EStateHashType type = STATE_HASH_MD5);
 
 	size_t GetHashLength();
 	const u8* ComputeHash();
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -197,6 +197,32 @@ void IDeserializer::RawBytes(const char* name, u8* data, size_t len)
 	Get(name, data, len);
 }
 
+void IDeserializer::NumberArrayU8_Unbounded(const char* name, uint8_t* values, size_t n)
+{
+	RequireBytesInStream(n);
+	Get(name, values, n);
+}
+
+void IDeserializer::NumberArrayU16_Unbounded(const char* name, uint16_t* values, size_t n)
+{
+	RequireBytesInStream(n*sizeof(uint16_t));
+	Get(name, (u8*)values, n*sizeof(uint16_t));
+#if BYTE_ORDER == BIG_ENDIAN
+	for (size_t i = 0; i < n; ++i)
+		values[i] = to_le16(values[i]);
+#endif
+}
+
+void IDeserializer::NumberArrayU32_Unbounded(const char* name, uint32_t* values, size_t n)
+{
+	RequireBytesInStream(n*sizeof(uint32_t));
+	Get(name, (u8*)values, n*sizeof(uint32_t));
+#if BYTE_ORDER == BIG_ENDIAN
+	for (size_t i = 0; i < n; ++i)
+		values[i] = to_le32(values[i]);
+#endif
+}
+
 int IDeserializer::GetVersion() const
 {
 	debug_warn(L"GetVersion() not implemented in this subclass");
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -68,6 +68,14 @@ public:
 
 	virtual void RawBytes(const char* name, u8* data, size_t len);
 
+	/**
+	 * Deserialize an array of @p n numbers, as serialized by ISerializer::NumberArrayU8_Unbounded
+	 * etc (or by calling NumberU8_Unbounded etc on each element).
+	 */
+	virtual void NumberArrayU8_Unbounded(const char* name, uint8_t* values, size_t n);
+	virtual void NumberArrayU16_Unbounded(const char* name, uint16_t* values, size_t n);
+	virtual void NumberArrayU32_Unbounded(const char* name, uint32_t* values, size_t n);
+
 	// Features for simulation-state serialisation:
 	virtual int GetVersion() const;
 
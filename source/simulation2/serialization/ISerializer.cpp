@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -112,6 +112,24 @@ void ISerializer::RawBytes(const char* name, const u8* data, size_t len)
 	PutRaw(name, data, len);
 }
 
+void ISerializer::PutNumberArray(const char* name, const uint8_t* values, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		PutNumber(name, values[i]);
+}
+
+void ISerializer::PutNumberArray(const char* name, const uint16_t* values, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		PutNumber(name, values[i]);
+}
+
+void ISerializer::PutNumberArray(const char* name, const uint32_t* values, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		PutNumber(name, values[i]);
+}
+
 bool ISerializer::IsDebug() const
 {
 	return false;
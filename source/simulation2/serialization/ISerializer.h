@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -242,6 +242,29 @@ public:
 	 */
 	void RawBytes(const char* name, const u8* data, size_t len);
 
+	/**
+	 * Serialize an array of numbers.
+	 * This gives the same output as calling NumberU8_Unbounded etc on each element
+	 * in turn, but is much faster for large arrays (e.g. grids).
+	 * @param name informative name for debug output
+	 * @param values array of @p n values to serialize
+	 * @param n number of values
+	 */
+	void NumberArrayU8_Unbounded(const char* name, const uint8_t* values, size_t n)
+	{
+		PutNumberArray(name, values, n);
+	}
+
+	void NumberArrayU16_Unbounded(const char* name, const uint16_t* values, size_t n) ///@copydoc NumberArrayU8_Unbounded()
+	{
+		PutNumberArray(name, values, n);
+	}
+
+	void NumberArrayU32_Unbounded(const char* name, const uint32_t* values, size_t n) ///@copydoc NumberArrayU8_Unbounded()
+	{
+		PutNumberArray(name, values, n);
+	}
+
 	/**
 	 * Returns true if the serializer is being used in debug mode.
 	 * Components should serialize non-critical data (e.g. data that is unchanged
@@ -271,6 +294,12 @@ protected:
 	virtual void PutString(const char* name, const std::string& value) = 0;
 	virtual void PutScriptVal(const char* name, jsval value) = 0;
 	virtual void PutRaw(const char* name, const u8* data, size_t len) = 0;
+
+	// These call PutNumber for each element by default; subclasses should override them
+	// with something more efficient
+	virtual void PutNumberArray(const char* name, const uint8_t* values, size_t n);
+	virtual void PutNumberArray(const char* name, const uint16_t* values, size_t n);
+	virtual void PutNumberArray(const char* name, const uint32_t* values, size_t n);
 };
 
 #endif // INCLUDED_ISERIALIZER
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,6 +24,8 @@
  */
 
 #include "simulation2/components/ICmpPathfinder.h"
+#include "simulation2/helpers/EntityMap.h"
+#include "simulation2/helpers/SlotMap.h"
 
 template<typename ELEM>
 struct SerializeVector
@@ -53,6 +55,64 @@ struct SerializeVector
 	}
 };
 
+/**
+ * Serializes vectors of u8/u16/u32 in bulk, giving the same output as
+ * SerializeVector<SerializeU8_Unbounded> etc but much faster for large vectors.
+ */
+struct SerializeNumberVector
+{
+	void operator()(ISerializer& serialize, const char* name, std::vector<u8>& value)
+	{
+		serialize.NumberU32_Unbounded("length", (u32)value.size());
+		if (!value.empty())
+			serialize.NumberArrayU8_Unbounded(name, &value[0], value.size());
+	}
+
+	void operator()(ISerializer& serialize, const char* name, std::vector<u16>& value)
+	{
+		serialize.NumberU32_Unbounded("length", (u32)value.size());
+		if (!value.empty())
+			serialize.NumberArrayU16_Unbounded(name, &value[0], value.size());
+	}
+
+	void operator()(ISerializer& serialize, const char* name, std::vector<u32>& value)
+	{
+		serialize.NumberU32_Unbounded("length", (u32)value.size());
+		if (!value.empty())
+			serialize.NumberArrayU32_Unbounded(name, &value[0], value.size());
+	}
+
+	void operator()(IDeserializer& deserialize, const char* name, std::vector<u8>& value)
+	{
+		u32 len;
+		deserialize.NumberU32_Unbounded("length", len);
+		deserialize.RequireBytesInStream(len);
+		value.resize(len);
+		if (len)
+			deserialize.NumberArrayU8_Unbounded(name, &value[0], len);
+	}
+
+	void operator()(IDeserializer& deserialize, const char* name, std::vector<u16>& value)
+	{
+		u32 len;
+		deserialize.NumberU32_Unbounded("length", len);
+		deserialize.RequireBytesInStream(len*sizeof(u16));
+		value.resize(len);
+		if (len)
+			deserialize.NumberArrayU16_Unbounded(name, &value[0], len);
+	}
+
+	void operator()(IDeserializer& deserialize, const char* name, std::vector<u32>& value)
+	{
+		u32 len;
+		deserialize.NumberU32_Unbounded("length", len);
+		deserialize.RequireBytesInStream(len*sizeof(u32));
+		value.resize(len);
+		if (len)
+			deserialize.NumberArrayU32_Unbounded(name, &value[0], len);
+	}
+};
+
 template<typename KS, typename VS>
 struct SerializeMap
 {
@@ -85,6 +145,78 @@ struct SerializeMap
 	}
 };
 
+/**
+ * Serializes an EntityMap in exactly the same format as SerializeMap
+ * with SerializeU32_Unbounded keys, so the two are interchangeable.
+ */
+template<typename VS>
+struct SerializeEntityMap
+{
+	template<typename V>
+	void operator()(ISerializer& serialize, const char* UNUSED(name), EntityMap<V>& value)
+	{
+		size_t len = value.size();
+		serialize.NumberU32_Unbounded("length", (u32)len);
+		for (typename EntityMap<V>::iterator it = value.begin(); it != value.end(); ++it)
+		{
+			serialize.NumberU32_Unbounded("key", it->first);
+			VS()(serialize, "value", it->second);
+		}
+	}
+
+	template<typename V>
+	void operator()(IDeserializer& deserialize, const char* UNUSED(name), EntityMap<V>& value)
+	{
+		value.clear();
+		u32 len;
+		deserialize.NumberU32_Unbounded("length", len);
+		for (size_t i = 0; i < len; ++i)
+		{
+			entity_id_t k;
+			V v;
+			deserialize.NumberU32_Unbounded("key", k);
+			VS()(deserialize, "value", v);
+			value.insert(std::make_pair(k, v));
+		}
+	}
+};
+
+/**
+ * Serializes a SlotMap in exactly the same format as SerializeMap
+ * with SerializeU32_Unbounded keys, so the two are interchangeable.
+ */
+template<typename VS>
+struct SerializeSlotMap
+{
+	template<typename V>
+	void operator()(ISerializer& serialize, const char* UNUSED(name), SlotMap<V>& value)
+	{
+		size_t len = value.size();
+		serialize.NumberU32_Unbounded("length", (u32)len);
+		for (typename SlotMap<V>::iterator it = value.begin(); it != value.end(); ++it)
+		{
+			serialize.NumberU32_Unbounded("key", it->first);
+			VS()(serialize, "value", it->second);
+		}
+	}
+
+	template<typename V>
+	void operator()(IDeserializer& deserialize, const char* UNUSED(name), SlotMap<V>& value)
+	{
+		value.clear();
+		u32 len;
+		deserialize.NumberU32_Unbounded("length", len);
+		for (size_t i = 0; i < len; ++i)
+		{
+			u32 k;
+			V v;
+			deserialize.NumberU32_Unbounded("key", k);
+			VS()(deserialize, "value", v);
+			value.insert(std::make_pair(k, v));
+		}
+	}
+};
+
 template<typename T, T max>
 struct SerializeU8_Enum
 {
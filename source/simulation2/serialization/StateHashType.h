@@ -0,0 +1,33 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_STATEHASHTYPE
+#define INCLUDED_STATEHASHTYPE
+
+/**
+ * The hash functions that CHashSerializer can use. We don't care about
+ * cryptographic strength, just about detection of unintended changes and about
+ * performance. MD5 is the default; MurmurHash3 is several times faster.
+ * (All the players in a networked game must use the same one.)
+ */
+enum EStateHashType
+{
+	STATE_HASH_MD5,
+	STATE_HASH_MURMUR3
+};
+
+#endif // INCLUDED_STATEHASHTYPE
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -30,13 +30,12 @@
 
 
 CStdDeserializer::CStdDeserializer(ScriptInterface& scriptInterface, std::istream& stream) :
-	m_ScriptInterface(scriptInterface), m_Stream(stream)
+	m_ScriptInterface(scriptInterface), m_BackrefsRooter(scriptInterface), m_TempRooter(scriptInterface), m_Stream(stream)
 {
 }
 
 CStdDeserializer::~CStdDeserializer()
 {
-	FreeScriptBackrefs();
 }
 
 void CStdDeserializer::Get(const char* name, u8* data, size_t len)
@@ -83,29 +82,15 @@ void CStdDeserializer::RequireBytesInStream(size_t numBytes)
 
 void CStdDeserializer::AddScriptBackref(JSObject* obj)
 {
-	std::pair<std::map<u32, JSObject*>::iterator, bool> it = m_ScriptBackrefs.insert(std::make_pair((u32)m_ScriptBackrefs.size()+1, obj));
-	ENSURE(it.second);
-	if (!JS_AddObjectRoot(m_ScriptInterface.GetContext(), &it.first->second))
-		throw PSERROR_Deserialize_ScriptError("JS_AddRoot failed");
+	m_ScriptBackrefs.push_back(obj);
+	m_BackrefsRooter.Push(obj);
 }
 
 JSObject* CStdDeserializer::GetScriptBackref(u32 tag)
 {
-	std::map<u32, JSObject*>::const_iterator it = m_ScriptBackrefs.find(tag);
-	if (it == m_ScriptBackrefs.end())
+	if (tag == 0 || tag > m_ScriptBackrefs.size())
 		return NULL;
-	return it->second;
-}
-
-void CStdDeserializer::FreeScriptBackrefs()
-{
-	std::map<u32, JSObject*>::iterator it = m_ScriptBackrefs.begin();
-	for (; it != m_ScriptBackrefs.end(); ++it)
-	{
-		if (!JS_RemoveObjectRoot(m_ScriptInterface.GetContext(), &it->second))
-			throw PSERROR_Deserialize_ScriptError("JS_RemoveRoot failed");
-	}
-	m_ScriptBackrefs.clear();
+	return m_ScriptBackrefs[tag-1];
 }
 
 ////////////////////////////////////////////////////////////////
@@ -145,8 +130,8 @@ jsval CStdDeserializer::ReadScriptVal(const char* UNUSED(name), JSObject* append
 
 		if (!obj)
 			throw PSERROR_Deserialize_ScriptError();
-		CScriptValRooted objRoot(cx, OBJECT_TO_JSVAL(obj));
 
+		// (This roots obj for the rest of the deserialization)
 		AddScriptBackref(obj);
 
 		uint32_t numProps;
@@ -157,8 +142,9 @@ jsval CStdDeserializer::ReadScriptVal(const char* UNUSED(name), JSObject* append
 			utf16string propname;
 			ReadStringUTF16("prop name", propname);
 
+			AutoGCRooter::Scope propvalScope(m_TempRooter);
 			jsval propval = ReadScriptVal("prop value", NULL);
-			CScriptValRooted propvalRoot(cx, propval);
+			m_TempRooter.Push(propval);
 
 			if (!JS_SetUCProperty(cx, obj, (const jschar*)propname.data(), propname.length(), &propval))
 				throw PSERROR_Deserialize_ScriptError();
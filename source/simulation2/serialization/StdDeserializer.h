@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,8 +21,7 @@
 #include "IDeserializer.h"
 
 #include "ps/utf16string.h"
-
-#include <map>
+#include "scriptinterface/AutoRooters.h"
 
 class CStdDeserializer : public IDeserializer
 {
@@ -49,10 +48,12 @@ private:
 
 	virtual void AddScriptBackref(JSObject* obj);
 	virtual JSObject* GetScriptBackref(u32 tag);
-	void FreeScriptBackrefs();
-	std::map<u32, JSObject*> m_ScriptBackrefs; // vector would be nice but maintaining JS roots would be harder
+	std::vector<JSObject*> m_ScriptBackrefs; // indexed by tag-1
 	ScriptInterface& m_ScriptInterface;
 
+	AutoGCRooter m_BackrefsRooter; // roots m_ScriptBackrefs
+	AutoGCRooter m_TempRooter; // stack of values that have been read but not yet stored anywhere rooted
+
 	std::istream& m_Stream;
 };
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,6 +19,7 @@
 #define INCLUDED_COMPONENT
 
 #include "simulation2/system/CmpPtr.h"
+#include "simulation2/system/ComponentPool.h"
 #include "simulation2/system/Components.h"
 #include "simulation2/system/ComponentManager.h"
 #include "simulation2/system/IComponent.h"
@@ -42,8 +43,8 @@
 	}
 
 #define DEFAULT_COMPONENT_ALLOCATOR(cname) \
-	static IComponent* Allocate(ScriptInterface&, jsval) { return new CCmp##cname(); } \
-	static void Deallocate(IComponent* cmp) { delete static_cast<CCmp##cname*> (cmp); } \
+	static IComponent* Allocate(ScriptInterface&, jsval) { return ComponentPool<CCmp##cname>::Construct(); } \
+	static void Deallocate(IComponent* cmp) { ComponentPool<CCmp##cname>::Destroy(static_cast<CCmp##cname*> (cmp)); } \
 
 #define DEFAULT_SCRIPT_WRAPPER(cname) \
 	static void ClassInit(CComponentManager& UNUSED(componentManager)) { } \
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -26,9 +26,13 @@
 #include "simulation2/MessageTypes.h"
 #include "simulation2/components/ICmpTemplateManager.h"
 
+#include "lib/timer.h"
 #include "lib/utf8.h"
 #include "ps/CLogger.h"
 #include "ps/Filesystem.h"
+#include "ps/ProfileViewer.h"
+#include "ps/Profiler2.h"
+#include "ps/ThreadPool.h"
 
 /**
  * Used for script-only message types.
@@ -40,6 +44,9 @@ public:
 	virtual const char* GetScriptHandlerName() const { return handlerName.c_str(); }
 	virtual const char* GetScriptGlobalHandlerName() const { return globalHandlerName.c_str(); }
 	virtual jsval ToJSVal(ScriptInterface& UNUSED(scriptInterface)) const { return msg.get(); }
+	// (The data is already a rooted script value, so there's nothing to cache, and it
+	// belongs to the script that sent the message so we shouldn't freeze it)
+	virtual jsval ToJSValCached(ScriptInterface& UNUSED(scriptInterface)) const { return msg.get(); }
 
 	CMessageScripted(int mtid, const std::string& name, const CScriptValRooted& msg) :
 		mtid(mtid), handlerName("On" + name), globalHandlerName("OnGlobal" + name), msg(msg)
@@ -52,10 +59,101 @@ public:
 	CScriptValRooted msg;
 };
 
+/**
+ * Profile viewer table listing the message handlers that have taken the most time,
+ * when CComponentManager::EnableMessageStats has been called.
+ */
+class CMessageStatsTable : public AbstractProfileTable
+{
+	NONCOPYABLE(CMessageStatsTable);
+public:
+	CMessageStatsTable(const CComponentManager& componentManager) :
+		m_ComponentManager(componentManager)
+	{
+	}
+
+	virtual CStr GetName()
+	{
+		return "messages";
+	}
+
+	virtual CStr GetTitle()
+	{
+		return "Simulation message handlers";
+	}
+
+	virtual size_t GetNumberRows()
+	{
+		// This is called before the cells are drawn, so take a sorted snapshot of the stats here
+		const CComponentManager::MessageStatsMap& stats = m_ComponentManager.GetMessageStats();
+		m_Rows.assign(stats.begin(), stats.end());
+		std::sort(m_Rows.begin(), m_Rows.end(), SortBySeconds);
+		return m_Rows.size();
+	}
+
+	virtual const std::vector<ProfileColumn>& GetColumns()
+	{
+		if (m_ColumnDescriptions.empty())
+		{
+			m_ColumnDescriptions.push_back(ProfileColumn("Component", 200));
+			m_ColumnDescriptions.push_back(ProfileColumn("Message", 160));
+			m_ColumnDescriptions.push_back(ProfileColumn("calls", 80));
+			m_ColumnDescriptions.push_back(ProfileColumn("total msec", 80));
+			m_ColumnDescriptions.push_back(ProfileColumn("usec/call", 80));
+		}
+		return m_ColumnDescriptions;
+	}
+
+	virtual CStr GetCellText(size_t row, size_t col)
+	{
+		if (row >= m_Rows.size())
+			return "???";
+
+		const CComponentManager::MessageStats& stats = m_Rows[row].second;
+		char buf[256];
+		switch (col)
+		{
+		case 0:
+			return m_ComponentManager.LookupComponentTypeName(m_Rows[row].first.second);
+		case 1:
+			return m_ComponentManager.LookupMessageTypeName(m_Rows[row].first.first);
+		case 2:
+			return CStr::FromUInt(stats.calls);
+		case 3:
+			sprintf_s(buf, ARRAY_SIZE(buf), "%.3f", stats.seconds * 1000.0);
+			return CStr(buf);
+		case 4:
+			sprintf_s(buf, ARRAY_SIZE(buf), "%.3f", stats.calls ? stats.seconds * 1000000.0 / stats.calls : 0.0);
+			return CStr(buf);
+		default:
+			return "???";
+		}
+	}
+
+	virtual AbstractProfileTable* GetChild(size_t UNUSED(row))
+	{
+		return 0;
+	}
+
+private:
+	typedef std::pair<std::pair<CComponentManager::MessageTypeId, CComponentManager::ComponentTypeId>, CComponentManager::MessageStats> Row;
+
+	static bool SortBySeconds(const Row& a, const Row& b)
+	{
+		return a.second.seconds > b.second.seconds;
+	}
+
+	const CComponentManager& m_ComponentManager;
+	std::vector<Row> m_Rows;
+	std::vector<ProfileColumn> m_ColumnDescriptions;
+};
+
 CComponentManager::CComponentManager(CSimContext& context, bool skipScriptFunctions) :
 	m_NextScriptComponentTypeId(CID__LastNative),
 	m_ScriptInterface("Engine", "Simulation", ScriptInterface::CreateRuntime()),
-	m_SimContext(context), m_CurrentlyHotloading(false)
+	m_SimContext(context), m_CurrentlyHotloading(false),
+	m_InParallelMessage(false), m_MessageStatsEnabled(false), m_MessageStatsTable(NULL),
+	m_StateHashType(STATE_HASH_MD5)
 {
 	context.SetComponentManager(this);
 
@@ -101,6 +199,9 @@ CComponentManager::CComponentManager(CSimContext& context, bool skipScriptFuncti
 	m_ScriptInterface.SetGlobal("SYSTEM_ENTITY", (int)SYSTEM_ENTITY);
 
 	m_ComponentsByInterface.resize(IID__LastNative);
+	m_ComponentPagesByInterface.resize(IID__LastNative);
+	m_SortedComponentsByInterface.resize(IID__LastNative);
+	m_SortedComponentsDirty.resize(IID__LastNative, 1);
 
 	ResetState();
 }
@@ -108,6 +209,9 @@ CComponentManager::CComponentManager(CSimContext& context, bool skipScriptFuncti
 CComponentManager::~CComponentManager()
 {
 	ResetState();
+
+	// (This automatically removes it from the profile viewer)
+	delete m_MessageStatsTable;
 }
 
 void CComponentManager::LoadComponentTypes()
@@ -283,8 +387,8 @@ void CComponentManager::Script_RegisterComponentType(void* cbdata, int iid, std:
 	{
 		// For every script component with this cid, we need to switch its
 		// prototype from the old constructor's prototype property to the new one's
-		const std::map<entity_id_t, IComponent*>& comps = componentManager->m_ComponentsByTypeId[cid];
-		std::map<entity_id_t, IComponent*>::const_iterator eit = comps.begin();
+		const ComponentList& comps = componentManager->m_ComponentsByTypeId[cid];
+		ComponentList::const_iterator eit = comps.begin();
 		for (; eit != comps.end(); ++eit)
 		{
 			jsval instance = eit->second->GetJSInstance();
@@ -312,6 +416,9 @@ void CComponentManager::Script_RegisterInterface(void* cbdata, std::string name)
 	size_t id = componentManager->m_InterfaceIdsByName.size() + 1;
 	componentManager->m_InterfaceIdsByName[name] = (InterfaceId)id;
 	componentManager->m_ComponentsByInterface.resize(id+1); // add one so we can index by InterfaceId
+	componentManager->m_ComponentPagesByInterface.resize(id+1);
+	componentManager->m_SortedComponentsByInterface.resize(id+1);
+	componentManager->m_SortedComponentsDirty.resize(id+1, 1);
 	componentManager->m_ScriptInterface.SetGlobal(("IID_" + name).c_str(), (int)id);
 }
 
@@ -356,10 +463,10 @@ std::vector<int> CComponentManager::Script_GetEntitiesWithInterface(void* cbdata
 	CComponentManager* componentManager = static_cast<CComponentManager*> (cbdata);
 
 	std::vector<int> ret;
-	const InterfaceListUnordered& ents = componentManager->GetEntitiesWithInterfaceUnordered(iid);
-	for (InterfaceListUnordered::const_iterator it = ents.begin(); it != ents.end(); ++it)
+	const InterfaceList& ents = componentManager->GetEntitiesWithInterfaceSorted(iid);
+	ret.reserve(ents.size());
+	for (InterfaceList::const_iterator it = ents.begin(); it != ents.end(); ++it)
 		ret.push_back(it->first); // TODO: maybe we should exclude local entities
-	std::sort(ret.begin(), ret.end());
 	return ret;
 }
 
@@ -368,9 +475,13 @@ std::vector<IComponent*> CComponentManager::Script_GetComponentsWithInterface(vo
 	CComponentManager* componentManager = static_cast<CComponentManager*> (cbdata);
 
 	std::vector<IComponent*> ret;
-	InterfaceList ents = componentManager->GetEntitiesWithInterface(iid);
+	const InterfaceList& ents = componentManager->GetEntitiesWithInterfaceSorted(iid);
+	ret.reserve(ents.size());
 	for (InterfaceList::const_iterator it = ents.begin(); it != ents.end(); ++it)
+	{
+		it->second->MarkStateHashDirty(); // (the script might modify any of them)
 		ret.push_back(it->second); // TODO: maybe we should exclude local entities
+	}
 	return ret;
 }
 
@@ -450,10 +561,10 @@ void CComponentManager::Script_DestroyEntity(void* cbdata, int ent)
 void CComponentManager::ResetState()
 {
 	// Delete all IComponents
-	std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::iterator iit = m_ComponentsByTypeId.begin();
+	std::map<ComponentTypeId, ComponentList>::iterator iit = m_ComponentsByTypeId.begin();
 	for (; iit != m_ComponentsByTypeId.end(); ++iit)
 	{
-		std::map<entity_id_t, IComponent*>::iterator eit = iit->second.begin();
+		ComponentList::iterator eit = iit->second.begin();
 		for (; eit != iit->second.end(); ++eit)
 		{
 			eit->second->Deinit();
@@ -465,7 +576,17 @@ void CComponentManager::ResetState()
 	for (; ifcit != m_ComponentsByInterface.end(); ++ifcit)
 		ifcit->clear();
 
+	for (size_t i = 0; i < m_ComponentPagesByInterface.size(); ++i)
+		m_ComponentPagesByInterface[i].clear();
+
+	for (size_t i = 0; i < m_SortedComponentsByInterface.size(); ++i)
+	{
+		m_SortedComponentsByInterface[i].clear();
+		m_SortedComponentsDirty[i] = 1;
+	}
+
 	m_ComponentsByTypeId.clear();
+	m_ComponentsByEntity.clear();
 
 	m_DestructionQueue.clear();
 
@@ -515,6 +636,12 @@ void CComponentManager::SubscribeGloballyToMessageType(MessageTypeId mtid)
 	std::sort(types.begin(), types.end()); // TODO: just sort once at the end of LoadComponents
 }
 
+void CComponentManager::SubscribeToMessageTypeParallel(MessageTypeId mtid)
+{
+	SubscribeToMessageType(mtid);
+	m_ParallelMessageSubscriptions.insert(std::make_pair(mtid, m_CurrentComponent));
+}
+
 CComponentManager::ComponentTypeId CComponentManager::LookupCID(const std::string& cname) const
 {
 	std::map<std::string, ComponentTypeId>::const_iterator it = m_ComponentTypeIdsByName.find(cname);
@@ -531,6 +658,14 @@ std::string CComponentManager::LookupComponentTypeName(ComponentTypeId cid) cons
 	return it->second.name;
 }
 
+std::string CComponentManager::LookupMessageTypeName(MessageTypeId mtid) const
+{
+	std::map<MessageTypeId, std::string>::const_iterator it = m_MessageTypeNamesById.find(mtid);
+	if (it == m_MessageTypeNamesById.end())
+		return "";
+	return it->second;
+}
+
 CComponentManager::ComponentTypeId CComponentManager::GetScriptWrapper(InterfaceId iid)
 {
 	if (iid >= IID__LastNative && iid <= (int)m_InterfaceIdsByName.size()) // use <= since IDs start at 1
@@ -584,6 +719,8 @@ bool CComponentManager::AddComponent(entity_id_t ent, ComponentTypeId cid, const
 
 IComponent* CComponentManager::ConstructComponent(entity_id_t ent, ComponentTypeId cid)
 {
+	ENSURE(!m_InParallelMessage);
+
 	std::map<ComponentTypeId, ComponentType>::const_iterator it = m_ComponentTypesById.find(cid);
 	if (it == m_ComponentTypesById.end())
 	{
@@ -602,7 +739,7 @@ IComponent* CComponentManager::ConstructComponent(entity_id_t ent, ComponentType
 		return NULL;
 	}
 
-	std::map<entity_id_t, IComponent*>& emap2 = m_ComponentsByTypeId[cid];
+	ComponentList& emap2 = m_ComponentsByTypeId[cid];
 
 	// If this is a scripted component, construct the appropriate JS object first
 	jsval obj = JSVAL_NULL;
@@ -625,16 +762,33 @@ IComponent* CComponentManager::ConstructComponent(entity_id_t ent, ComponentType
 
 	// Store a reference to the new component
 	emap1.insert(std::make_pair(ent, component));
+	if (ENTITY_IS_NORMAL(ent))
+		m_ComponentPagesByInterface[ct.iid].Set(ent, component);
+	m_SortedComponentsDirty[ct.iid] = 1;
 	emap2.insert(std::make_pair(ent, component));
-	// TODO: We need to more careful about this - if an entity is constructed by a component
-	// while we're iterating over all components, this will invalidate the iterators and everything
-	// will break.
-	// We probably need some kind of delayed addition, so they get pushed onto a queue and then
-	// inserted into the world later on. (Be careful about immediation deletion in that case, too.)
+	// (If an entity is constructed by a component while we're broadcasting a message,
+	// this may reallocate emap2, so SendMessageToAll must cope with that)
+	AddEntityComponent(ent, cid, ct.iid, component);
 
 	return component;
 }
 
+void CComponentManager::AddEntityComponent(entity_id_t ent, ComponentTypeId cid, InterfaceId iid, IComponent* component)
+{
+	EntityComponent entry = { cid, iid, component };
+	EntityComponentList& comps = m_ComponentsByEntity[ent];
+	comps.insert(std::upper_bound(comps.begin(), comps.end(), entry), entry);
+}
+
+IComponent* CComponentManager::FindEntityComponent(const EntityComponentList& comps, ComponentTypeId cid)
+{
+	EntityComponent key = { cid, IID__Invalid, NULL };
+	EntityComponentList::const_iterator it = std::lower_bound(comps.begin(), comps.end(), key);
+	if (it == comps.end() || it->cid != cid)
+		return NULL;
+	return it->component;
+}
+
 void CComponentManager::AddMockComponent(entity_id_t ent, InterfaceId iid, IComponent& component)
 {
 	// Just add it into the by-interface map, not the by-component-type map,
@@ -643,7 +797,13 @@ void CComponentManager::AddMockComponent(entity_id_t ent, InterfaceId iid, IComp
 	boost::unordered_map<entity_id_t, IComponent*>& emap1 = m_ComponentsByInterface.at(iid);
 	if (emap1.find(ent) != emap1.end())
 		debug_warn(L"Multiple components for interface");
-	emap1.insert(std::make_pair(ent, &component));
+	if (emap1.insert(std::make_pair(ent, &component)).second)
+	{
+		if (ENTITY_IS_NORMAL(ent))
+			m_ComponentPagesByInterface[iid].Set(ent, &component);
+		m_SortedComponentsDirty[iid] = 1;
+	}
+	AddEntityComponent(ent, CID__Invalid, iid, &component);
 }
 
 entity_id_t CComponentManager::AddEntity(const std::wstring& templateName, entity_id_t ent)
@@ -693,6 +853,7 @@ entity_id_t CComponentManager::AddEntity(const std::wstring& templateName, entit
 
 void CComponentManager::DestroyComponentsSoon(entity_id_t ent)
 {
+	ENSURE(!m_InParallelMessage);
 	m_DestructionQueue.push_back(ent);
 }
 
@@ -703,6 +864,9 @@ void CComponentManager::FlushDestroyedComponents()
 	std::vector<entity_id_t> queue;
 	queue.swap(m_DestructionQueue);
 
+	// Types whose component lists contain destroyed (NULL) entries
+	std::set<ComponentTypeId> modifiedTypes;
+
 	for (std::vector<entity_id_t>::iterator it = queue.begin(); it != queue.end(); ++it)
 	{
 		entity_id_t ent = *it;
@@ -710,26 +874,47 @@ void CComponentManager::FlushDestroyedComponents()
 		CMessageDestroy msg(ent);
 		PostMessage(ent, msg);
 
-		// Destroy the components, and remove from m_ComponentsByTypeId:
-		std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::iterator iit = m_ComponentsByTypeId.begin();
-		for (; iit != m_ComponentsByTypeId.end(); ++iit)
+		boost::unordered_map<entity_id_t, EntityComponentList>::iterator cit = m_ComponentsByEntity.find(ent);
+		if (cit == m_ComponentsByEntity.end())
+			continue; // already destroyed, or never had any components
+
+		// (Swap the list out first, in case the Deinit functions do anything that
+		// modifies m_ComponentsByEntity)
+		EntityComponentList comps;
+		comps.swap(cit->second);
+		m_ComponentsByEntity.erase(cit);
+
+		// Destroy the components, and mark them as removed from m_ComponentsByTypeId
+		// (they're all erased at the end, so that destroying lots of entities
+		// doesn't repeatedly shift the lists' contents)
+		for (EntityComponentList::iterator eit = comps.begin(); eit != comps.end(); ++eit)
 		{
-			std::map<entity_id_t, IComponent*>::iterator eit = iit->second.find(ent);
-			if (eit != iit->second.end())
-			{
-				eit->second->Deinit();
-				m_ComponentTypesById[iit->first].dealloc(eit->second);
-				iit->second.erase(ent);
-			}
+			// Mock components aren't owned by us
+			if (eit->cid == CID__Invalid)
+				continue;
+
+			eit->component->Deinit();
+			m_ComponentTypesById[eit->cid].dealloc(eit->component);
+
+			ComponentList& list = m_ComponentsByTypeId[eit->cid];
+			ComponentList::iterator lit = list.find(ent);
+			ENSURE(lit != list.end() && lit->second == eit->component);
+			lit->second = NULL;
+			modifiedTypes.insert(eit->cid);
 		}
 
 		// Remove from m_ComponentsByInterface
-		std::vector<boost::unordered_map<entity_id_t, IComponent*> >::iterator ifcit = m_ComponentsByInterface.begin();
-		for (; ifcit != m_ComponentsByInterface.end(); ++ifcit)
+		for (EntityComponentList::iterator eit = comps.begin(); eit != comps.end(); ++eit)
 		{
-			ifcit->erase(ent);
+			m_ComponentsByInterface[eit->iid].erase(ent);
+			if (ENTITY_IS_NORMAL(ent))
+				m_ComponentPagesByInterface[eit->iid].Set(ent, NULL);
+			m_SortedComponentsDirty[eit->iid] = 1;
 		}
 	}
+
+	for (std::set<ComponentTypeId>::iterator it = modifiedTypes.begin(); it != modifiedTypes.end(); ++it)
+		m_ComponentsByTypeId[*it].RemoveNull();
 }
 
 IComponent* CComponentManager::QueryInterface(entity_id_t ent, InterfaceId iid) const
@@ -740,35 +925,112 @@ IComponent* CComponentManager::QueryInterface(entity_id_t ent, InterfaceId iid)
 		return NULL;
 	}
 
-	boost::unordered_map<entity_id_t, IComponent*>::const_iterator eit = m_ComponentsByInterface[iid].find(ent);
-	if (eit == m_ComponentsByInterface[iid].end())
+	IComponent* component;
+	if (ENTITY_IS_NORMAL(ent))
+	{
+		component = m_ComponentPagesByInterface[iid].Get(ent);
+	}
+	else
+	{
+		boost::unordered_map<entity_id_t, IComponent*>::const_iterator eit = m_ComponentsByInterface[iid].find(ent);
+		component = (eit == m_ComponentsByInterface[iid].end() ? NULL : eit->second);
+	}
+
+	if (!component)
 	{
 		// This entity doesn't implement this interface
 		return NULL;
 	}
 
-	return eit->second;
+	// The caller might modify the component
+	component->MarkStateHashDirty();
+
+	return component;
+}
+
+void CComponentManager::InterfacePages::Set(entity_id_t ent, IComponent* component)
+{
+	size_t page = ent >> PAGE_BITS;
+	if (page >= m_Pages.size())
+	{
+		if (!component)
+			return;
+		m_Pages.resize(page + 1);
+		m_Counts.resize(page + 1, 0);
+	}
+
+	std::vector<IComponent*>& entries = m_Pages[page];
+	if (entries.empty())
+	{
+		if (!component)
+			return;
+		entries.resize(PAGE_SIZE, NULL);
+	}
+
+	IComponent*& entry = entries[ent & (PAGE_SIZE-1)];
+	if (entry && !component)
+		--m_Counts[page];
+	else if (!entry && component)
+		++m_Counts[page];
+	entry = component;
+
+	// Free pages once they're empty (which is common, since entity IDs are
+	// never reused)
+	if (m_Counts[page] == 0)
+		std::vector<IComponent*>().swap(entries);
+}
+
+void CComponentManager::InterfacePages::AppendTo(InterfaceList& list) const
+{
+	for (size_t page = 0; page < m_Pages.size(); ++page)
+	{
+		const std::vector<IComponent*>& entries = m_Pages[page];
+		for (size_t i = 0; i < entries.size(); ++i)
+			if (entries[i])
+				list.push_back(std::make_pair((entity_id_t)((page << PAGE_BITS) + i), entries[i]));
+	}
 }
 
 CComponentManager::InterfaceList CComponentManager::GetEntitiesWithInterface(InterfaceId iid) const
 {
-	std::vector<std::pair<entity_id_t, IComponent*> > ret;
+	InterfaceList ret = GetEntitiesWithInterfaceSorted(iid);
+
+	for (InterfaceList::iterator it = ret.begin(); it != ret.end(); ++it)
+		it->second->MarkStateHashDirty(); // (the caller might modify any of them)
+
+	return ret;
+}
 
+static CComponentManager::InterfaceList g_EmptyInterfaceList;
+const CComponentManager::InterfaceList& CComponentManager::GetEntitiesWithInterfaceSorted(InterfaceId iid) const
+{
 	if ((size_t)iid >= m_ComponentsByInterface.size())
 	{
 		// Invalid iid
-		return ret;
+		return g_EmptyInterfaceList;
 	}
 
-	ret.reserve(m_ComponentsByInterface[iid].size());
+	InterfaceList& list = m_SortedComponentsByInterface[iid];
+	if (m_SortedComponentsDirty[iid])
+	{
+		const InterfaceListUnordered& components = m_ComponentsByInterface[iid];
+		list.clear();
+		list.reserve(components.size());
 
-	boost::unordered_map<entity_id_t, IComponent*>::const_iterator it = m_ComponentsByInterface[iid].begin();
-	for (; it != m_ComponentsByInterface[iid].end(); ++it)
-		ret.push_back(*it);
+		// The normal entities can be read out of the pages in order
+		m_ComponentPagesByInterface[iid].AppendTo(list);
 
-	std::sort(ret.begin(), ret.end()); // lexicographic pair comparison means this'll sort by entity ID
+		// Local entities all have higher IDs than normal ones, so add them at the end
+		size_t numNormal = list.size();
+		for (InterfaceListUnordered::const_iterator it = components.begin(); it != components.end(); ++it)
+			if (!ENTITY_IS_NORMAL(it->first))
+				list.push_back(*it);
+		std::sort(list.begin() + numNormal, list.end());
 
-	return ret;
+		m_SortedComponentsDirty[iid] = 0;
+	}
+
+	return list;
 }
 
 static CComponentManager::InterfaceListUnordered g_EmptyEntityMap;
@@ -785,6 +1047,8 @@ const CComponentManager::InterfaceListUnordered& CComponentManager::GetEntitiesW
 
 void CComponentManager::PostMessage(entity_id_t ent, const CMessage& msg) const
 {
+	ENSURE(!m_InParallelMessage);
+
 	// Send the message to components of ent, that subscribed locally to this message
 	std::map<MessageTypeId, std::vector<ComponentTypeId> >::const_iterator it;
 	it = m_LocalMessageSubscriptions.find(msg.GetType());
@@ -793,15 +1057,20 @@ void CComponentManager::PostMessage(entity_id_t ent, const CMessage& msg) const
 		std::vector<ComponentTypeId>::const_iterator ctit = it->second.begin();
 		for (; ctit != it->second.end(); ++ctit)
 		{
-			// Find the component instances of this type (if any)
-			std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::const_iterator emap = m_ComponentsByTypeId.find(*ctit);
-			if (emap == m_ComponentsByTypeId.end())
-				continue;
-
-			// Send the message to all of them
-			std::map<entity_id_t, IComponent*>::const_iterator eit = emap->second.find(ent);
-			if (eit != emap->second.end())
-				eit->second->HandleMessage(msg, false);
+			// Find the entity's component of this type (if any).
+			// (The handlers might add components, so look the entity up again each time)
+			boost::unordered_map<entity_id_t, EntityComponentList>::const_iterator cit = m_ComponentsByEntity.find(ent);
+			if (cit == m_ComponentsByEntity.end())
+				break;
+
+			IComponent* component = FindEntityComponent(cit->second, *ctit);
+			if (component)
+			{
+				MessageStatsTimer timer(*this, msg.GetType(), *ctit);
+				timer.AddCall();
+				component->MarkStateHashDirty();
+				component->HandleMessage(msg, false);
+			}
 		}
 	}
 
@@ -810,6 +1079,8 @@ void CComponentManager::PostMessage(entity_id_t ent, const CMessage& msg) const
 
 void CComponentManager::BroadcastMessage(const CMessage& msg) const
 {
+	ENSURE(!m_InParallelMessage);
+
 	// Send the message to components of all entities that subscribed locally to this message
 	std::map<MessageTypeId, std::vector<ComponentTypeId> >::const_iterator it;
 	it = m_LocalMessageSubscriptions.find(msg.GetType());
@@ -819,14 +1090,22 @@ void CComponentManager::BroadcastMessage(const CMessage& msg) const
 		for (; ctit != it->second.end(); ++ctit)
 		{
 			// Find the component instances of this type (if any)
-			std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::const_iterator emap = m_ComponentsByTypeId.find(*ctit);
+			std::map<ComponentTypeId, ComponentList>::const_iterator emap = m_ComponentsByTypeId.find(*ctit);
 			if (emap == m_ComponentsByTypeId.end())
 				continue;
 
 			// Send the message to all of them
-			std::map<entity_id_t, IComponent*>::const_iterator eit = emap->second.begin();
-			for (; eit != emap->second.end(); ++eit)
-				eit->second->HandleMessage(msg, false);
+			if (g_ThreadPool && emap->second.size() >= 2*MIN_PARALLEL_MESSAGE_COMPONENTS &&
+				m_ParallelMessageSubscriptions.count(std::make_pair(msg.GetType(), *ctit)))
+			{
+				MessageStatsTimer timer(*this, msg.GetType(), *ctit);
+				timer.AddCalls(emap->second.size());
+				SendMessageToAllParallel(emap->second, msg);
+			}
+			else
+			{
+				SendMessageToAll(*ctit, emap->second, msg, false);
+			}
 		}
 	}
 
@@ -856,18 +1135,124 @@ void CComponentManager::SendGlobalMessage(entity_id_t ent, const CMessage& msg)
 			}
 
 			// Find the component instances of this type (if any)
-			std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::const_iterator emap = m_ComponentsByTypeId.find(*ctit);
+			std::map<ComponentTypeId, ComponentList>::const_iterator emap = m_ComponentsByTypeId.find(*ctit);
 			if (emap == m_ComponentsByTypeId.end())
 				continue;
 
 			// Send the message to all of them
-			std::map<entity_id_t, IComponent*>::const_iterator eit = emap->second.begin();
-			for (; eit != emap->second.end(); ++eit)
-				eit->second->HandleMessage(msg, true);
+			SendMessageToAll(*ctit, emap->second, msg, true);
 		}
 	}
 }
 
+void CComponentManager::SendMessageToAll(ComponentTypeId cid, const ComponentList& comps, const CMessage& msg, bool global) const
+{
+	if (comps.empty())
+		return;
+
+	MessageStatsTimer timer(*this, msg.GetType(), cid);
+
+	// Message handlers might create new entities, which inserts into the list and
+	// may reallocate it, so iterate by index and re-find our position after
+	// each call (new entities with IDs greater than the current one will get
+	// the message, the same as when the list was a std::map)
+	for (size_t i = 0; i < comps.size(); ++i)
+	{
+		entity_id_t ent = comps[i].first;
+		IComponent* cmp = comps[i].second;
+		if (!cmp)
+			continue; // destroyed but not yet removed
+
+		cmp->MarkStateHashDirty();
+		cmp->HandleMessage(msg, global);
+		timer.AddCall();
+
+		if (i >= comps.size() || comps[i].first != ent)
+			i = comps.LowerBound(ent);
+	}
+}
+
+class CComponentManager::ParallelMessageTask : public CThreadPool::ITask
+{
+public:
+	ParallelMessageTask(const ComponentList& comps, const CMessage& msg, size_t count) :
+		m_Comps(comps), m_Msg(msg), m_Count(count)
+	{
+	}
+
+	virtual void Run(size_t index)
+	{
+		// Each task handles a contiguous range of entities
+		size_t begin = m_Comps.size() * index / m_Count;
+		size_t end = m_Comps.size() * (index + 1) / m_Count;
+		for (size_t i = begin; i < end; ++i)
+		{
+			IComponent* cmp = m_Comps[i].second;
+			if (cmp)
+			{
+				cmp->MarkStateHashDirty();
+				cmp->HandleMessage(m_Msg, false);
+			}
+		}
+	}
+
+private:
+	const ComponentList& m_Comps;
+	const CMessage& m_Msg;
+	size_t m_Count;
+	NONCOPYABLE(ParallelMessageTask);
+};
+
+void CComponentManager::SendMessageToAllParallel(const ComponentList& comps, const CMessage& msg) const
+{
+	// The handlers can't add or remove entities (nor send any messages, so there are no
+	// side-effects whose order would depend on the threads), so the list won't change
+	// while they're running
+	size_t count = std::min(comps.size() / MIN_PARALLEL_MESSAGE_COMPONENTS, (g_ThreadPool->GetNumWorkers() + 1) * 4);
+
+	m_InParallelMessage = true;
+	ParallelMessageTask task(comps, msg, count);
+	g_ThreadPool->ParallelFor(task, count);
+	m_InParallelMessage = false;
+}
+
+void CComponentManager::EnableMessageStats()
+{
+	m_MessageStatsEnabled = true;
+
+	if (!m_MessageStatsTable && CProfileViewer::IsInitialised())
+	{
+		m_MessageStatsTable = new CMessageStatsTable(*this);
+		g_ProfileViewer.AddRootTable(m_MessageStatsTable);
+	}
+}
+
+CComponentManager::MessageStatsTimer::MessageStatsTimer(const CComponentManager& componentManager, MessageTypeId mtid, ComponentTypeId cid) :
+	m_Stats(NULL), m_StartTime(0.0), m_Calls(0)
+{
+	if (!componentManager.m_MessageStatsEnabled)
+		return;
+
+	m_Stats = &componentManager.m_MessageStats[std::make_pair(mtid, cid)];
+
+	// The profiler only stores pointers to region names, and script-defined message and
+	// component type names might not outlive it, so use a fixed name plus an attribute
+	g_Profiler2.RecordRegionEnter("HandleMessage");
+	g_Profiler2.RecordAttribute("%s %s", componentManager.LookupComponentTypeName(cid).c_str(), componentManager.LookupMessageTypeName(mtid).c_str());
+
+	m_StartTime = timer_Time();
+}
+
+CComponentManager::MessageStatsTimer::~MessageStatsTimer()
+{
+	if (!m_Stats)
+		return;
+
+	m_Stats->seconds += timer_Time() - m_StartTime;
+	m_Stats->calls += m_Calls;
+
+	g_Profiler2.RecordRegionLeave("HandleMessage");
+}
 
 std::string CComponentManager::GenerateSchema()
 {
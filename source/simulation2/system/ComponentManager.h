@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -22,17 +22,21 @@
 #include "Components.h"
 #include "scriptinterface/ScriptInterface.h"
 #include "simulation2/helpers/Player.h"
+#include "simulation2/serialization/StateHashType.h"
 #include "ps/Filesystem.h"
 
 #include <boost/random/linear_congruential.hpp>
 #include <boost/unordered_map.hpp>
 
+#include <algorithm>
 #include <map>
+#include <set>
 
 class IComponent;
 class CParamNode;
 class CMessage;
 class CSimContext;
+class CMessageStatsTable;
 
 class CComponentManager
 {
@@ -112,6 +116,17 @@ public:
 	 */
 	void SubscribeGloballyToMessageType(MessageTypeId mtid);
 
+	/**
+	 * Like SubscribeToMessageType, but also declares that the current component type's handler
+	 * for this message only modifies the component itself, and only reads state that no other
+	 * component's handler for this message modifies. A BroadcastMessage of this type can then
+	 * run the handlers of many entities in parallel (if g_ThreadPool exists).
+	 * Such handlers must not send messages, create or destroy entities, or use scripts or the
+	 * legacy profiler (which are enforced where possible).
+	 * Must only be called by a component type's ClassInit.
+	 */
+	void SubscribeToMessageTypeParallel(MessageTypeId mtid);
+
 	/**
 	 * @param cname Requested component type name (not including any "CID" or "CCmp" prefix)
 	 * @return The component type id, or CID__Invalid if not found
@@ -191,6 +206,25 @@ public:
 	typedef boost::unordered_map<entity_id_t, IComponent*> InterfaceListUnordered;
 
 	InterfaceList GetEntitiesWithInterface(InterfaceId iid) const;
+
+	/**
+	 * Returns the components implementing the given interface, and their entities,
+	 * sorted by entity ID (like GetEntitiesWithInterface) but without copying.
+	 * The list is cached, and only rebuilt by the first call after components with
+	 * this interface have been added or removed, so it's cheap to call every turn.
+	 * The returned reference remains valid until the next call with the same @p iid
+	 * (so callers that might cause that while iterating must take a copy).
+	 * Like GetEntitiesWithInterfaceUnordered, this doesn't mark the components as
+	 * modified for incremental state hashing.
+	 */
+	const InterfaceList& GetEntitiesWithInterfaceSorted(InterfaceId iid) const;
+
+	/**
+	 * Returns the components implementing the given interface.
+	 * Unlike QueryInterface and GetEntitiesWithInterface, this doesn't mark them as
+	 * modified for incremental state hashing, so callers that modify them must call
+	 * IComponent::MarkStateHashDirty.
+	 */
 	const InterfaceListUnordered& GetEntitiesWithInterfaceUnordered(InterfaceId iid) const;
 
 	/**
@@ -212,7 +246,22 @@ public:
 	 */
 	void ResetState();
 
+	/**
+	 * Sets the hash function used by ComputeStateHash (MD5 by default).
+	 */
+	void SetStateHashType(EStateHashType type) { m_StateHashType = type; }
+	EStateHashType GetStateHashType() const { return m_StateHashType; }
+
 	// Various state serialization functions:
+
+	/**
+	 * Computes a hash of the simulation state, for detecting out-of-sync errors.
+	 * If @p quick is false, every component is serialized. If @p quick is true, this
+	 * combines hashes cached in each component, and only re-serializes components
+	 * that might have been modified since they were last hashed (see
+	 * IComponent::MarkStateHashDirty), so it is cheap enough to run every turn.
+	 * The two modes give different hashes for the same state.
+	 */
 	bool ComputeStateHash(std::string& outHash, bool quick);
 	bool DumpDebugState(std::ostream& stream, bool includeDebugInfo);
 	// FlushDestroyedComponents must be called before SerializeState (since the destruction queue
@@ -224,6 +273,35 @@ public:
 
 	ScriptInterface& GetScriptInterface() { return m_ScriptInterface; }
 
+	/**
+	 * Start recording the number of calls and the time spent in HandleMessage, for each
+	 * combination of message type and component type, and add a table displaying them
+	 * to the profile viewer (if it is initialised). Each component type's handlers are
+	 * also recorded as a Profiler2 region.
+	 * Times include any nested messages sent by the handlers.
+	 * This isn't needed for normal gameplay, since it adds some overhead to every message.
+	 */
+	void EnableMessageStats();
+
+	struct MessageStats
+	{
+		MessageStats() : calls(0), seconds(0.0) { }
+		u32 calls;
+		double seconds;
+	};
+
+	typedef std::map<std::pair<MessageTypeId, ComponentTypeId>, MessageStats> MessageStatsMap;
+
+	/**
+	 * @return The statistics collected since EnableMessageStats, indexed by (message type, component type).
+	 */
+	const MessageStatsMap& GetMessageStats() const { return m_MessageStats; }
+
+	/**
+	 * @return The name of the given message type, or "" if not found
+	 */
+	std::string LookupMessageTypeName(MessageTypeId mtid) const;
+
 private:
 	// Implementations of functions exposed to scripts
 	static void Script_RegisterComponentType(void* cbdata, int iid, std::string cname, CScriptVal ctor);
@@ -258,18 +336,198 @@ private:
 	ComponentTypeId m_CurrentComponent; // used when loading component types
 	bool m_CurrentlyHotloading;
 
+	/**
+	 * The components of a single type, as a vector sorted by entity ID, so that
+	 * messages can be broadcast to them in a deterministic order with a linear scan.
+	 *
+	 * While entities are being destroyed, an entry's component may temporarily be
+	 * NULL (see FlushDestroyedComponents); find() skips those entries, but code
+	 * iterating over the list must check for them.
+	 */
+	class ComponentList
+	{
+	public:
+		typedef std::pair<entity_id_t, IComponent*> value_type;
+		typedef std::vector<value_type>::iterator iterator;
+		typedef std::vector<value_type>::const_iterator const_iterator;
+
+		iterator begin() { return m_Data.begin(); }
+		iterator end() { return m_Data.end(); }
+		const_iterator begin() const { return m_Data.begin(); }
+		const_iterator end() const { return m_Data.end(); }
+		size_t size() const { return m_Data.size(); }
+		bool empty() const { return m_Data.empty(); }
+		const value_type& operator[](size_t i) const { return m_Data[i]; }
+
+		/**
+		 * Returns the index of the first entry whose entity ID is not less than @p ent.
+		 */
+		size_t LowerBound(entity_id_t ent) const
+		{
+			return std::lower_bound(m_Data.begin(), m_Data.end(), value_type(ent, (IComponent*)NULL)) - m_Data.begin();
+		}
+
+		iterator find(entity_id_t ent)
+		{
+			iterator it = m_Data.begin() + LowerBound(ent);
+			if (it == m_Data.end() || it->first != ent || !it->second)
+				return m_Data.end();
+			return it;
+		}
+
+		const_iterator find(entity_id_t ent) const
+		{
+			const_iterator it = m_Data.begin() + LowerBound(ent);
+			if (it == m_Data.end() || it->first != ent || !it->second)
+				return m_Data.end();
+			return it;
+		}
+
+		void insert(const value_type& value)
+		{
+			// New entities usually have the highest IDs, so this is normally an append
+			if (m_Data.empty() || m_Data.back().first < value.first)
+				m_Data.push_back(value);
+			else
+				m_Data.insert(m_Data.begin() + LowerBound(value.first), value);
+		}
+
+		/**
+		 * Removes all the entries whose component is NULL.
+		 */
+		void RemoveNull()
+		{
+			std::vector<value_type>::iterator out = m_Data.begin();
+			for (std::vector<value_type>::iterator it = m_Data.begin(); it != m_Data.end(); ++it)
+				if (it->second)
+					*out++ = *it;
+			m_Data.erase(out, m_Data.end());
+		}
+
+	private:
+		std::vector<value_type> m_Data;
+	};
+
+	/**
+	 * The components implementing a single interface, for normal (non-local)
+	 * entities, indexed directly by entity ID so that QueryInterface is just
+	 * a couple of array loads.
+	 * The IDs are split into fixed-size pages, which are only allocated while
+	 * they contain at least one component, so rarely-used interfaces cost
+	 * little memory.
+	 */
+	class InterfacePages
+	{
+	public:
+		IComponent* Get(entity_id_t ent) const
+		{
+			size_t page = ent >> PAGE_BITS;
+			if (page >= m_Pages.size() || m_Pages[page].empty())
+				return NULL;
+			return m_Pages[page][ent & (PAGE_SIZE-1)];
+		}
+
+		/**
+		 * Sets (or with NULL, removes) the entity's component.
+		 */
+		void Set(entity_id_t ent, IComponent* component);
+
+		void clear()
+		{
+			m_Pages.clear();
+			m_Counts.clear();
+		}
+
+		/**
+		 * Appends all the entries to @p list, in increasing entity ID order.
+		 */
+		void AppendTo(InterfaceList& list) const;
+
+	private:
+		enum { PAGE_BITS = 8, PAGE_SIZE = 1 << PAGE_BITS };
+
+		std::vector<std::vector<IComponent*> > m_Pages; // each either empty or PAGE_SIZE entries
+		std::vector<u16> m_Counts; // number of non-NULL entries in each page
+	};
+
+	/**
+	 * One of an entity's components. Mock components (see AddMockComponent)
+	 * have cid == CID__Invalid.
+	 */
+	struct EntityComponent
+	{
+		ComponentTypeId cid;
+		InterfaceId iid;
+		IComponent* component;
+
+		bool operator<(const EntityComponent& other) const { return cid < other.cid; }
+	};
+
+	/**
+	 * All the components of a single entity, sorted by component type ID, so
+	 * that destroying an entity or posting a message to it only has to look at
+	 * the types of component it actually has.
+	 */
+	typedef std::vector<EntityComponent> EntityComponentList;
+
+	void AddEntityComponent(entity_id_t ent, ComponentTypeId cid, InterfaceId iid, IComponent* component);
+
+	/**
+	 * Returns the entity's component of type @p cid, or NULL if it doesn't have one.
+	 */
+	static IComponent* FindEntityComponent(const EntityComponentList& comps, ComponentTypeId cid);
+
+	void SendMessageToAll(ComponentTypeId cid, const ComponentList& comps, const CMessage& msg, bool global) const;
+	void SendMessageToAllParallel(const ComponentList& comps, const CMessage& msg) const;
+
+	class ParallelMessageTask;
+
+	// Minimum number of components per parallel task, to keep the overhead small
+	// compared to the (typically trivial) handlers
+	enum { MIN_PARALLEL_MESSAGE_COMPONENTS = 256 };
+
+	/**
+	 * Records the time spent in one component type's message handlers, while in scope.
+	 * Does nothing unless message stats are enabled.
+	 */
+	class MessageStatsTimer
+	{
+		NONCOPYABLE(MessageStatsTimer);
+	public:
+		MessageStatsTimer(const CComponentManager& componentManager, MessageTypeId mtid, ComponentTypeId cid);
+		~MessageStatsTimer();
+		void AddCall() { ++m_Calls; }
+		void AddCalls(size_t n) { m_Calls += (u32)n; }
+	private:
+		MessageStats* m_Stats;
+		double m_StartTime;
+		u32 m_Calls;
+	};
+
 	// TODO: some of these should be vectors
 	std::map<ComponentTypeId, ComponentType> m_ComponentTypesById;
 	std::vector<boost::unordered_map<entity_id_t, IComponent*> > m_ComponentsByInterface; // indexed by InterfaceId
-	std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> > m_ComponentsByTypeId;
+	std::vector<InterfacePages> m_ComponentPagesByInterface; // indexed by InterfaceId; only normal entities (a faster copy of m_ComponentsByInterface)
+	mutable std::vector<InterfaceList> m_SortedComponentsByInterface; // indexed by InterfaceId; cache for GetEntitiesWithInterfaceSorted
+	mutable std::vector<u8> m_SortedComponentsDirty; // indexed by InterfaceId; whether m_SortedComponentsByInterface needs to be rebuilt
+	std::map<ComponentTypeId, ComponentList> m_ComponentsByTypeId;
+	boost::unordered_map<entity_id_t, EntityComponentList> m_ComponentsByEntity;
 	std::map<MessageTypeId, std::vector<ComponentTypeId> > m_LocalMessageSubscriptions;
 	std::map<MessageTypeId, std::vector<ComponentTypeId> > m_GlobalMessageSubscriptions;
+	std::set<std::pair<MessageTypeId, ComponentTypeId> > m_ParallelMessageSubscriptions;
+	mutable bool m_InParallelMessage; // true while handlers may be running on other threads
 	std::map<std::string, ComponentTypeId> m_ComponentTypeIdsByName;
 	std::map<std::string, MessageTypeId> m_MessageTypeIdsByName;
 	std::map<MessageTypeId, std::string> m_MessageTypeNamesById;
 	std::map<std::string, InterfaceId> m_InterfaceIdsByName;
 
-	// TODO: maintaining both ComponentsBy* is nasty; can we get rid of one,
+	bool m_MessageStatsEnabled;
+	mutable MessageStatsMap m_MessageStats;
+	CMessageStatsTable* m_MessageStatsTable;
+
+	EStateHashType m_StateHashType;
+
+	// TODO: maintaining all the ComponentsBy* is nasty; can we get rid of some,
 	// while keeping QueryInterface and PostMessage sufficiently efficient?
 
 	std::vector<entity_id_t> m_DestructionQueue;
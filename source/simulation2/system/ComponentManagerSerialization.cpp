@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -63,10 +63,10 @@ bool CComponentManager::DumpDebugState(std::ostream& stream, bool includeDebugIn
 	std::map<entity_id_t, std::map<ComponentTypeId, IComponent*> > components;
 	std::map<ComponentTypeId, std::string> names;
 
-	std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::const_iterator ctit = m_ComponentsByTypeId.begin();
+	std::map<ComponentTypeId, ComponentList>::const_iterator ctit = m_ComponentsByTypeId.begin();
 	for (; ctit != m_ComponentsByTypeId.end(); ++ctit)
 	{
-		std::map<entity_id_t, IComponent*>::const_iterator eit = ctit->second.begin();
+		ComponentList::const_iterator eit = ctit->second.begin();
 		for (; eit != ctit->second.end(); ++eit)
 		{
 			components[eit->first][ctit->first] = eit->second;
@@ -105,24 +105,21 @@ bool CComponentManager::ComputeStateHash(std::string& outHash, bool quick)
 	// Hash serialization: this includes the minimal data necessary to detect
 	// differences in the state, and ignores things like counts and names
 
-	// If 'quick' is set, this checks even fewer things, so that it will
-	// be fast enough to run every turn but will typically detect any
-	// out-of-syncs fairly soon
+	// If 'quick' is set, this uses each component's cached hash unless it
+	// might have changed since it was computed, so that it will be fast enough
+	// to run every turn. (It relies on the dirty flags being set for every
+	// modification, so the full hash is still computed periodically.)
 
-	CHashSerializer serializer(m_ScriptInterface);
+	CHashSerializer serializer(m_ScriptInterface, m_StateHashType);
 
 	serializer.StringASCII("rng", SerializeRNG(m_RNG), 0, 32);
 
-	std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::const_iterator cit = m_ComponentsByTypeId.begin();
+	std::map<ComponentTypeId, ComponentList>::const_iterator cit = m_ComponentsByTypeId.begin();
 	for (; cit != m_ComponentsByTypeId.end(); ++cit)
 	{
-		// In quick mode, only check unit positions
-		if (quick && !(cit->first == CID_Position))
-			continue;
-
 		// Only emit component types if they have a component that will be serialized
 		bool needsSerialization = false;
-		for (std::map<entity_id_t, IComponent*>::const_iterator eit = cit->second.begin(); eit != cit->second.end(); ++eit)
+		for (ComponentList::const_iterator eit = cit->second.begin(); eit != cit->second.end(); ++eit)
 		{
 			// Don't serialize local entities
 			if (ENTITY_IS_LOCAL(eit->first))
@@ -137,14 +134,27 @@ bool CComponentManager::ComputeStateHash(std::string& outHash, bool quick)
 
 		serializer.NumberI32_Unbounded("component type id", cit->first);
 
-		for (std::map<entity_id_t, IComponent*>::const_iterator eit = cit->second.begin(); eit != cit->second.end(); ++eit)
+		for (ComponentList::const_iterator eit = cit->second.begin(); eit != cit->second.end(); ++eit)
 		{
 			// Don't serialize local entities
 			if (ENTITY_IS_LOCAL(eit->first))
 				continue;
 
 			serializer.NumberU32_Unbounded("entity id", eit->first);
-			eit->second->Serialize(serializer);
+
+			if (!quick)
+			{
+				eit->second->Serialize(serializer);
+				continue;
+			}
+
+			if (eit->second->IsStateHashDirty())
+			{
+				CHashSerializer componentSerializer(m_ScriptInterface, m_StateHashType);
+				eit->second->Serialize(componentSerializer);
+				eit->second->SetCachedStateHash(componentSerializer.ComputeHash());
+			}
+			serializer.RawBytes("component hash", eit->second->GetCachedStateHash(), IComponent::CACHED_STATE_HASH_LENGTH);
 		}
 	}
 
@@ -187,7 +197,7 @@ bool CComponentManager::SerializeState(std::ostream& stream)
 	serializer.StringASCII("rng", SerializeRNG(m_RNG), 0, 32);
 	serializer.NumberU32_Unbounded("next entity id", m_NextEntityId);
 
-	std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::const_iterator cit;
+	std::map<ComponentTypeId, ComponentList>::const_iterator cit;
 	
 	uint32_t numComponentTypes = 0;
 	std::set<ComponentTypeId> serializedComponentTypes;
@@ -196,7 +206,7 @@ bool CComponentManager::SerializeState(std::ostream& stream)
 	{
 		// Only emit component types if they have a component that will be serialized
 		bool needsSerialization = false;
-		for (std::map<entity_id_t, IComponent*>::const_iterator eit = cit->second.begin(); eit != cit->second.end(); ++eit)
+		for (ComponentList::const_iterator eit = cit->second.begin(); eit != cit->second.end(); ++eit)
 		{
 			// Don't serialize local entities
 			if (ENTITY_IS_LOCAL(eit->first))
@@ -231,7 +241,7 @@ bool CComponentManager::SerializeState(std::ostream& stream)
 
 		// Count the components before serializing any of them
 		uint32_t numComponents = 0;
-		for (std::map<entity_id_t, IComponent*>::const_iterator eit = cit->second.begin(); eit != cit->second.end(); ++eit)
+		for (ComponentList::const_iterator eit = cit->second.begin(); eit != cit->second.end(); ++eit)
 		{
 			// Don't serialize local entities
 			if (ENTITY_IS_LOCAL(eit->first))
@@ -244,7 +254,7 @@ bool CComponentManager::SerializeState(std::ostream& stream)
 		serializer.NumberU32_Unbounded("num components", numComponents);
 
 		// Serialize the components now
-		for (std::map<entity_id_t, IComponent*>::const_iterator eit = cit->second.begin(); eit != cit->second.end(); ++eit)
+		for (ComponentList::const_iterator eit = cit->second.begin(); eit != cit->second.end(); ++eit)
 		{
 			// Don't serialize local entities
 			if (ENTITY_IS_LOCAL(eit->first))
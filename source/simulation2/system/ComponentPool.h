@@ -0,0 +1,129 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_COMPONENTPOOL
+#define INCLUDED_COMPONENTPOOL
+
+#include <new>
+
+/**
+ * Total size of the chunks allocated by all ComponentPools (for memory statistics).
+ */
+inline size_t& ComponentPoolTotalBytes()
+{
+	static size_t bytes = 0;
+	return bytes;
+}
+
+/**
+ * Pool allocator for native components, used by DEFAULT_COMPONENT_ALLOCATOR.
+ *
+ * Each component type has its own pool, which allocates objects in chunks of
+ * increasing size, so components of the same type end up close together in
+ * memory (which helps when broadcasting messages to all of them). Freed
+ * objects are reused before allocating new chunks. Memory is only returned to
+ * the system when the program exits.
+ *
+ * This is not thread-safe: components must only be created and destroyed
+ * on the simulation's thread.
+ */
+template<typename T>
+class ComponentPool
+{
+	NONCOPYABLE(ComponentPool);
+
+public:
+	static T* Construct()
+	{
+		return new (GetPool().Allocate()) T();
+	}
+
+	static void Destroy(T* p)
+	{
+		p->~T();
+		GetPool().Deallocate(p);
+	}
+
+private:
+	union Slot
+	{
+		Slot* next; // when in the free list
+		char data[sizeof(T)];
+		// (make sure the data is suitably aligned for any member type)
+		double alignDouble;
+		u64 alignU64;
+		void* alignPointer;
+	};
+
+	enum
+	{
+		MIN_CHUNK_SLOTS = 1, // (don't waste memory on types with only one instance)
+		MAX_CHUNK_SLOTS = 1024
+	};
+
+	ComponentPool() : m_FreeList(NULL), m_NextChunkSlots(MIN_CHUNK_SLOTS)
+	{
+	}
+
+	~ComponentPool()
+	{
+		for (size_t i = 0; i < m_Chunks.size(); ++i)
+			delete[] m_Chunks[i];
+	}
+
+	static ComponentPool& GetPool()
+	{
+		static ComponentPool pool;
+		return pool;
+	}
+
+	void* Allocate()
+	{
+		if (!m_FreeList)
+		{
+			Slot* chunk = new Slot[m_NextChunkSlots];
+			m_Chunks.push_back(chunk);
+			ComponentPoolTotalBytes() += m_NextChunkSlots * sizeof(Slot);
+
+			// Push in reverse so the slots are handed out in address order
+			for (size_t i = m_NextChunkSlots; i > 0; --i)
+			{
+				chunk[i-1].next = m_FreeList;
+				m_FreeList = &chunk[i-1];
+			}
+
+			m_NextChunkSlots = std::min(m_NextChunkSlots * 2, (size_t)MAX_CHUNK_SLOTS);
+		}
+
+		Slot* slot = m_FreeList;
+		m_FreeList = slot->next;
+		return slot;
+	}
+
+	void Deallocate(void* p)
+	{
+		Slot* slot = static_cast<Slot*>(p);
+		slot->next = m_FreeList;
+		m_FreeList = slot;
+	}
+
+	std::vector<Slot*> m_Chunks;
+	Slot* m_FreeList;
+	size_t m_NextChunkSlots;
+};
+
+#endif // INCLUDED_COMPONENTPOOL
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -182,6 +182,11 @@ public:
 		return 50.f;
 	}
 
+	virtual void GetExactGroundLevels(const float* UNUSED(coords), size_t n, float* heights)
+	{
+		std::fill(heights, heights + n, 50.f);
+	}
+
 	virtual u16 GetTilesPerSide()
 	{
 		return 16;
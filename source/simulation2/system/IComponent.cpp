@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,6 +19,12 @@
 
 #include "IComponent.h"
 
+IComponent::IComponent() :
+	m_EntityId(INVALID_ENTITY), m_SimContext(NULL), m_StateHashDirty(true)
+{
+	memset(m_CachedStateHash, 0, sizeof(m_CachedStateHash));
+}
+
 IComponent::~IComponent()
 {
 }
@@ -42,3 +48,9 @@ jsval IComponent::GetJSInstance() const
 {
 	return JSVAL_NULL;
 }
+
+void IComponent::SetCachedStateHash(const u8* hash)
+{
+	memcpy(m_CachedStateHash, hash, sizeof(m_CachedStateHash));
+	m_StateHashDirty = false;
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -33,6 +33,7 @@ class IDeserializer;
 class IComponent
 {
 public:
+	IComponent();
 	virtual ~IComponent();
 
 	static std::string GetSchema();
@@ -55,9 +56,31 @@ public:
 	virtual JSClass* GetJSClass() const;
 	virtual jsval GetJSInstance() const;
 
+	/**
+	 * Marks the component as possibly modified since its state was last hashed, so that
+	 * the quick CComponentManager::ComputeStateHash will re-serialize it.
+	 * The component manager does this automatically whenever the component is sent a message
+	 * or returned by QueryInterface; code that modifies components through some other route
+	 * (e.g. GetEntitiesWithInterfaceUnordered) must call this itself.
+	 */
+	void MarkStateHashDirty() const { m_StateHashDirty = true; }
+	bool IsStateHashDirty() const { return m_StateHashDirty; }
+
+	enum { CACHED_STATE_HASH_LENGTH = 8 };
+	const u8* GetCachedStateHash() const { return m_CachedStateHash; }
+
+	/**
+	 * Stores the (first CACHED_STATE_HASH_LENGTH bytes of the) hash of the current state,
+	 * and clears the dirty flag.
+	 */
+	void SetCachedStateHash(const u8* hash);
+
 private:
 	entity_id_t m_EntityId;
 	const CSimContext* m_SimContext;
+
+	mutable bool m_StateHashDirty;
+	u8 m_CachedStateHash[CACHED_STATE_HASH_LENGTH];
 };
 
 #endif // INCLUDED_ICOMPONENT
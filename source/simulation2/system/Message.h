@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -32,7 +32,13 @@ public:
 	virtual const char* GetScriptHandlerName() const = 0;
 	virtual const char* GetScriptGlobalHandlerName() const = 0;
 	virtual jsval ToJSVal(ScriptInterface&) const = 0;
-	jsval ToJSValCached(ScriptInterface&) const;
+
+	/**
+	 * Returns the message converted by ToJSVal, creating it only on the first call,
+	 * so the conversion isn't repeated for every script component that receives the
+	 * message. The returned object is frozen since it's shared between all of them.
+	 */
+	virtual jsval ToJSValCached(ScriptInterface&) const;
 private:
 	mutable CScriptValRooted m_Cached;
 };
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,6 +24,8 @@
 #include "ps/CStr.h"
 #include "ps/Filesystem.h"
 #include "ps/XML/Xeromyces.h"
+#include "simulation2/serialization/IDeserializer.h"
+#include "simulation2/serialization/ISerializer.h"
 
 #include "js/jsapi.h"
 
@@ -71,9 +73,39 @@ PSRETURN CParamNode::LoadXMLString(CParamNode& ret, const char* xml, const wchar
 	return PSRETURN_OK;
 }
 
+void CParamNode::Serialize(ISerializer& serialize) const
+{
+	serialize.String("value", m_Value, 0, UINT32_MAX);
+	serialize.NumberU32_Unbounded("num children", (u32)m_Childs.size());
+	for (ChildrenMap::const_iterator it = m_Childs.begin(); it != m_Childs.end(); ++it)
+	{
+		serialize.String("name", wstring_from_utf8(it->first), 0, UINT32_MAX);
+		it->second.Serialize(serialize);
+	}
+}
+
+void CParamNode::Deserialize(CParamNode& ret, IDeserializer& deserialize)
+{
+	ret.ResetScriptVal();
+	ret.m_Compiled.Reset();
+	ret.m_Childs.clear();
+	ret.m_IsOk = true;
+
+	deserialize.String("value", ret.m_Value, 0, UINT32_MAX);
+	u32 numChildren;
+	deserialize.NumberU32_Unbounded("num children", numChildren);
+	for (u32 i = 0; i < numChildren; ++i)
+	{
+		std::wstring name;
+		deserialize.String("name", name, 0, UINT32_MAX);
+		Deserialize(ret.m_Childs[utf8_from_wstring(name)], deserialize);
+	}
+}
+
 void CParamNode::ApplyLayer(const XMBFile& xmb, const XMBElement& element, const wchar_t* sourceIdentifier /*= NULL*/)
 {
 	ResetScriptVal();
+	m_Compiled.Reset();
 
 	std::string name = xmb.GetElementString(element.GetNodeName()); // TODO: is GetElementString inefficient?
 	CStrW value = element.GetText().FromUTF8();
@@ -106,6 +138,7 @@ void CParamNode::ApplyLayer(const XMBFile& xmb, const XMBElement& element, const
 			if (attr.Name == at_datatype && std::wstring(attr.Value.begin(), attr.Value.end()) == L"tokens")
 			{
 				CParamNode& node = m_Childs[name];
+				node.m_Compiled.Reset();
 
 				// Split into tokens
 				std::vector<std::wstring> oldTokens;
@@ -147,6 +180,7 @@ void CParamNode::ApplyLayer(const XMBFile& xmb, const XMBElement& element, const
 
 	// Add this element as a child node
 	CParamNode& node = m_Childs[name];
+	node.m_Compiled.Reset();
 	if (!hasSetValue)
 		node.m_Value = value;
 
@@ -163,27 +197,76 @@ void CParamNode::ApplyLayer(const XMBFile& xmb, const XMBElement& element, const
 		if (attr.Name == at_replace) continue;
 		// Add any others
 		std::string attrName = xmb.GetAttributeString(attr.Name);
-		node.m_Childs["@" + attrName].m_Value = attr.Value.FromUTF8();
+		CParamNode& attrNode = node.m_Childs["@" + attrName];
+		attrNode.m_Compiled.Reset();
+		attrNode.m_Value = attr.Value.FromUTF8();
 	}
 }
 
 void CParamNode::CopyFilteredChildrenOfChild(const CParamNode& src, const char* name, const std::set<std::string>& permitted)
 {
 	ResetScriptVal();
+	m_Compiled.Reset();
 
 	ChildrenMap::iterator dstChild = m_Childs.find(name);
 	ChildrenMap::const_iterator srcChild = src.m_Childs.find(name);
 	if (dstChild == m_Childs.end() || srcChild == src.m_Childs.end())
 		return; // error
 
+	dstChild->second.m_Compiled.Reset();
+
 	ChildrenMap::const_iterator it = srcChild->second.m_Childs.begin();
 	for (; it != srcChild->second.m_Childs.end(); ++it)
 		if (permitted.count(it->first))
 			dstChild->second.m_Childs[it->first] = it->second;
 }
 
+void CParamNode::Compile()
+{
+	if (m_Compiled.m_Valid)
+		return;
+
+	m_Compiled.m_Childs.clear();
+	m_Compiled.m_Childs.reserve(m_Childs.size());
+	for (ChildrenMap::iterator it = m_Childs.begin(); it != m_Childs.end(); ++it)
+	{
+		it->second.Compile();
+
+		SCompiled::SChild child;
+		child.m_Name = it->first.c_str();
+		child.m_Node = &it->second;
+		m_Compiled.m_Childs.push_back(child);
+	}
+
+	m_Compiled.m_Int = ParseInt();
+	m_Compiled.m_Fixed = fixed::FromString(CStrW(m_Value));
+	m_Compiled.m_Float = ParseFloat();
+	m_Compiled.m_Bool = (m_Value == L"true");
+	m_Compiled.m_Valid = true;
+}
+
 const CParamNode& CParamNode::GetChild(const char* name) const
 {
+	if (m_Compiled.m_Valid)
+	{
+		// Binary search of the flattened children (which are sorted by std::string's
+		// comparison, i.e. the same order as strcmp)
+		size_t lo = 0;
+		size_t hi = m_Compiled.m_Childs.size();
+		while (lo < hi)
+		{
+			size_t mid = (lo + hi) / 2;
+			int cmp = strcmp(m_Compiled.m_Childs[mid].m_Name, name);
+			if (cmp == 0)
+				return *m_Compiled.m_Childs[mid].m_Node;
+			if (cmp < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return g_NullNode;
+	}
+
 	ChildrenMap::const_iterator it = m_Childs.find(name);
 	if (it == m_Childs.end())
 		return g_NullNode;
@@ -211,6 +294,13 @@ const CStrIntern CParamNode::ToUTF8Intern() const
 }
 
 int CParamNode::ToInt() const
+{
+	if (m_Compiled.m_Valid)
+		return m_Compiled.m_Int;
+	return ParseInt();
+}
+
+int CParamNode::ParseInt() const
 {
 	int ret = 0;
 	std::wstringstream strm;
@@ -221,10 +311,19 @@ int CParamNode::ToInt() const
 
 fixed CParamNode::ToFixed() const
 {
+	if (m_Compiled.m_Valid)
+		return m_Compiled.m_Fixed;
 	return fixed::FromString(CStrW(m_Value));
 }
 
-float CParamNode::ToFloat() const 
+float CParamNode::ToFloat() const
+{
+	if (m_Compiled.m_Valid)
+		return m_Compiled.m_Float;
+	return ParseFloat();
+}
+
+float CParamNode::ParseFloat() const
 {
 	float ret = 0;
 	std::wstringstream strm;
@@ -235,6 +334,8 @@ float CParamNode::ToFloat() const
 
 bool CParamNode::ToBool() const
 {
+	if (m_Compiled.m_Valid)
+		return m_Compiled.m_Bool;
 	if (m_Value == L"true")
 		return true;
 	else
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -26,9 +26,12 @@
 
 #include <map>
 #include <set>
+#include <vector>
 
 class XMBFile;
 class XMBElement;
+class ISerializer;
+class IDeserializer;
 
 /**
  * An entity initialisation parameter node.
@@ -108,6 +111,13 @@ class XMBElement;
  * }
  * @endcode
  * (Note the special @c _string for the hopefully-rare cases where a node contains both child nodes and text.)
+ *
+ * Once a tree has been fully loaded, it can be compiled (see Compile) into a form that
+ * is faster to query: each node gets a flat sorted array of its children, so GetChild
+ * doesn't need to construct a temporary std::string or walk the map, and the numeric
+ * values are parsed once instead of on every ToInt/ToFixed/ToFloat/ToBool call.
+ * This matters for entity templates, whose nodes are queried many times by every
+ * component of every entity that is created.
  */
 class CParamNode
 {
@@ -145,6 +155,19 @@ public:
 	 */
 	static PSRETURN LoadXMLString(CParamNode& ret, const char* xml, const wchar_t* sourceIdentifier = NULL);
 
+	/**
+	 * Writes this node and all its descendants in a compact binary form, which can
+	 * be loaded much faster than the original XML. (Used for caching fully-inherited
+	 * entity templates.)
+	 */
+	void Serialize(ISerializer& serialize) const;
+
+	/**
+	 * Replaces the contents of @a ret with data written by Serialize.
+	 * Throws PSERROR_Deserialize if the data is invalid.
+	 */
+	static void Deserialize(CParamNode& ret, IDeserializer& deserialize);
+
 	/**
 	 * Finds the childs named @a name from @a src and from @a this, and copies the source child's children
 	 * which are in the @a permitted set into this node's child.
@@ -153,6 +176,17 @@ public:
 	 */
 	void CopyFilteredChildrenOfChild(const CParamNode& src, const char* name, const std::set<std::string>& permitted);
 
+	/**
+	 * Precomputes the lookup tables and parsed values of this node and all its
+	 * descendants, if this node hasn't already been compiled.
+	 * The queries behave identically before and after compiling; they're just faster.
+	 * Modifying a node (e.g. with LoadXML) discards its compiled data, but the tree
+	 * should not be modified after compiling since the descendants of an already
+	 * compiled node won't be recompiled.
+	 * Copies of a node are not compiled.
+	 */
+	void Compile();
+
 	/**
 	 * Returns the (unique) child node with the given name, or a node with IsOk() == false if there is none.
 	 */
@@ -249,10 +283,45 @@ private:
 
 	jsval ConstructJSVal(JSContext* cx) const;
 
+	/**
+	 * Data computed by Compile. This is not copied along with the node, since the
+	 * child pointers refer to the original node's children.
+	 */
+	struct SCompiled
+	{
+		struct SChild
+		{
+			const char* m_Name; // points into the key of the ChildrenMap entry
+			const CParamNode* m_Node;
+		};
+
+		SCompiled() : m_Valid(false) { }
+		SCompiled(const SCompiled&) : m_Valid(false) { }
+		SCompiled& operator=(const SCompiled&) { Reset(); return *this; }
+
+		void Reset()
+		{
+			m_Valid = false;
+			m_Childs.clear();
+		}
+
+		bool m_Valid;
+		std::vector<SChild> m_Childs; // sorted by name, in the same order as the ChildrenMap
+		int m_Int;
+		fixed m_Fixed;
+		float m_Float;
+		bool m_Bool;
+	};
+
+	int ParseInt() const;
+	float ParseFloat() const;
+
 	std::wstring m_Value;
 	ChildrenMap m_Childs;
 	bool m_IsOk;
 
+	SCompiled m_Compiled;
+
 	/**
 	 * Caches the ToJSVal script representation of this node.
 	 */
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -147,6 +147,38 @@ public:
 		TS_ASSERT_WSTR_EQUALS(man.GetScriptInterface().ToString(val.get()), L"({Actor:\"example1\", Foundation:(void 0), SilhouetteDisplay:\"false\", SilhouetteOccluder:\"false\"})");
 	}
 
+	void test_LoadTemplate_cached()
+	{
+		for (size_t i = 0; i < 2; ++i)
+		{
+			// The second iteration should load the templates from the cache
+			// created by the first
+			CSimContext context;
+			CComponentManager man(context);
+			man.LoadComponentTypes();
+
+			entity_id_t ent1 = 1, ent2 = 2;
+			CParamNode noParam;
+
+			TS_ASSERT(man.AddComponent(ent1, CID_TemplateManager, noParam));
+
+			ICmpTemplateManager* tempMan = static_cast<ICmpTemplateManager*> (man.QueryInterface(ent1, IID_TemplateManager));
+			TS_ASSERT(tempMan != NULL);
+
+			const CParamNode* inherit2 = tempMan->LoadTemplate(ent2, "inherit2", -1);
+			TS_ASSERT(inherit2 != NULL);
+			TS_ASSERT_WSTR_EQUALS(inherit2->ToXML(), L"<Test1A a=\"a2\" b=\"b1\" c=\"c1\"><d>d2</d><e>e1</e><f>f1</f><g>g2</g></Test1A>");
+
+			const CParamNode* inherit1 = tempMan->LoadTemplate(ent2, "inherit1", -1);
+			TS_ASSERT(inherit1 != NULL);
+			TS_ASSERT_WSTR_EQUALS(inherit1->ToXML(), L"<Test1A a=\"a1\" b=\"b1\" c=\"c1\"><d>d1</d><e>e1</e><f>f1</f></Test1A>");
+
+			VfsPaths paths;
+			TS_ASSERT_OK(vfs::GetPathnames(g_VFS, L"cache/simulation/templates/", L"inherit2.xml.*.tmpl", paths));
+			TS_ASSERT_EQUALS(paths.size(), (size_t)1);
+		}
+	}
+
 	void test_LoadTemplate_errors()
 	{
 		CSimContext context;
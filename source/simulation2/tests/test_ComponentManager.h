@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -28,6 +28,7 @@
 
 #include "ps/CLogger.h"
 #include "ps/Filesystem.h"
+#include "ps/ThreadPool.h"
 #include "ps/XML/Xeromyces.h"
 
 #define TS_ASSERT_STREAM(stream, len, buffer) \
@@ -139,6 +140,96 @@ public:
 		man.AddComponent(ent2, CID_Test2A, noParam);
 		TS_ASSERT(man.QueryInterface(ent2, IID_Test1) != NULL);
 		TS_ASSERT(man.QueryInterface(ent2, IID_Test2) != NULL);
+
+		// Entities with very different IDs (and local entities)
+		entity_id_t ent3 = 100000, ent4 = FIRST_LOCAL_ENTITY + 1;
+		man.AddComponent(ent3, CID_Test1A, noParam);
+		man.AddComponent(ent4, CID_Test2A, noParam);
+		TS_ASSERT(man.QueryInterface(ent3, IID_Test1) != NULL);
+		TS_ASSERT(man.QueryInterface(ent3, IID_Test2) == NULL);
+		TS_ASSERT(man.QueryInterface(ent3 + 1, IID_Test1) == NULL);
+		TS_ASSERT(man.QueryInterface(ent4, IID_Test1) == NULL);
+		TS_ASSERT(man.QueryInterface(ent4, IID_Test2) != NULL);
+		TS_ASSERT(man.QueryInterface(ent1, IID_Test1) != man.QueryInterface(ent3, IID_Test1));
+	}
+
+	void test_DestroyComponentsSoon()
+	{
+		CSimContext context;
+		CComponentManager man(context);
+		man.LoadComponentTypes();
+
+		entity_id_t ent1 = 1, ent2 = 2, ent3 = 3;
+		CParamNode noParam;
+
+		man.AddComponent(ent1, CID_Test1A, noParam);
+		man.AddComponent(ent2, CID_Test1B, noParam);
+		man.AddComponent(ent2, CID_Test2A, noParam);
+		man.AddComponent(ent3, CID_Test2A, noParam);
+
+		man.DestroyComponentsSoon(ent2);
+		TS_ASSERT(man.QueryInterface(ent2, IID_Test1) != NULL);
+		man.FlushDestroyedComponents();
+
+		TS_ASSERT(man.QueryInterface(ent1, IID_Test1) != NULL);
+		TS_ASSERT(man.QueryInterface(ent2, IID_Test1) == NULL);
+		TS_ASSERT(man.QueryInterface(ent2, IID_Test2) == NULL);
+		TS_ASSERT(man.QueryInterface(ent3, IID_Test2) != NULL);
+		TS_ASSERT_EQUALS(man.GetEntitiesWithInterface(IID_Test1).size(), (size_t)1);
+		TS_ASSERT_EQUALS(man.GetEntitiesWithInterface(IID_Test2).size(), (size_t)1);
+
+		// Destroying an entity twice, or one that doesn't exist, does nothing
+		man.DestroyComponentsSoon(ent2);
+		man.DestroyComponentsSoon(ent3);
+		man.DestroyComponentsSoon(ent3);
+		man.DestroyComponentsSoon(100);
+		man.FlushDestroyedComponents();
+		TS_ASSERT(man.QueryInterface(ent1, IID_Test1) != NULL);
+		TS_ASSERT(man.QueryInterface(ent3, IID_Test2) == NULL);
+
+		// Messages still reach the remaining components
+		CMessageTurnStart msg;
+		man.PostMessage(ent1, msg);
+		TS_ASSERT_EQUALS(static_cast<ICmpTest1*> (man.QueryInterface(ent1, IID_Test1))->GetX(), 11001);
+
+		// The destroyed entity's ID can be given components again
+		man.AddComponent(ent2, CID_Test2A, noParam);
+		TS_ASSERT(man.QueryInterface(ent2, IID_Test2) != NULL);
+	}
+
+	void test_GetEntitiesWithInterfaceSorted()
+	{
+		CSimContext context;
+		CComponentManager man(context);
+		man.LoadComponentTypes();
+
+		CParamNode noParam;
+		entity_id_t local = FIRST_LOCAL_ENTITY + 5;
+		man.AddComponent(local, CID_Test1A, noParam);
+		man.AddComponent(1000, CID_Test1A, noParam);
+		man.AddComponent(3, CID_Test1B, noParam);
+		man.AddComponent(3, CID_Test2A, noParam);
+
+		TS_ASSERT_EQUALS(man.GetEntitiesWithInterfaceSorted(IID_Test1).size(), (size_t)3);
+		TS_ASSERT_EQUALS(man.GetEntitiesWithInterfaceSorted(IID_Test1)[0].first, (entity_id_t)3);
+		TS_ASSERT_EQUALS(man.GetEntitiesWithInterfaceSorted(IID_Test1)[1].first, (entity_id_t)1000);
+		TS_ASSERT_EQUALS(man.GetEntitiesWithInterfaceSorted(IID_Test1)[2].first, local);
+		TS_ASSERT_EQUALS(man.GetEntitiesWithInterfaceSorted(IID_Test1)[0].second, man.QueryInterface(3, IID_Test1));
+		TS_ASSERT(man.GetEntitiesWithInterfaceSorted(IID_Test1) == man.GetEntitiesWithInterface(IID_Test1));
+
+		// The cached list is updated when components are added or removed
+		man.AddComponent(2, CID_Test1A, noParam);
+		TS_ASSERT_EQUALS(man.GetEntitiesWithInterfaceSorted(IID_Test1).size(), (size_t)4);
+		TS_ASSERT_EQUALS(man.GetEntitiesWithInterfaceSorted(IID_Test1)[0].first, (entity_id_t)2);
+
+		man.DestroyComponentsSoon(1000);
+		man.FlushDestroyedComponents();
+		TS_ASSERT_EQUALS(man.GetEntitiesWithInterfaceSorted(IID_Test1).size(), (size_t)3);
+		TS_ASSERT_EQUALS(man.GetEntitiesWithInterfaceSorted(IID_Test1)[2].first, local);
+		TS_ASSERT_EQUALS(man.GetEntitiesWithInterfaceSorted(IID_Test2).size(), (size_t)1);
+
+		man.ResetState();
+		TS_ASSERT(man.GetEntitiesWithInterfaceSorted(IID_Test1).empty());
 	}
 
 	void test_SendMessage()
@@ -211,6 +302,68 @@ public:
 		TS_ASSERT_EQUALS(static_cast<ICmpTest2*> (man.QueryInterface(ent4, IID_Test2))->GetX(), 21150);
 	}
 
+	void test_SendMessage_parallel()
+	{
+		CSimContext context;
+		CComponentManager man(context);
+		man.LoadComponentTypes();
+
+		// Test_2A handles TurnStart in parallel, Test_1A doesn't
+		const entity_id_t numEnts = 2000;
+		CParamNode noParam;
+		for (entity_id_t ent = 1; ent <= numEnts; ++ent)
+		{
+			man.AddComponent(ent, CID_Test1A, noParam);
+			man.AddComponent(ent, CID_Test2A, noParam);
+		}
+
+		g_ThreadPool = new CThreadPool(3);
+
+		CMessageTurnStart msg1;
+		man.BroadcastMessage(msg1);
+		man.BroadcastMessage(msg1);
+
+		SAFE_DELETE(g_ThreadPool);
+
+		for (entity_id_t ent = 1; ent <= numEnts; ++ent)
+		{
+			TS_ASSERT_EQUALS(static_cast<ICmpTest1*> (man.QueryInterface(ent, IID_Test1))->GetX(), 11002);
+			TS_ASSERT_EQUALS(static_cast<ICmpTest2*> (man.QueryInterface(ent, IID_Test2))->GetX(), 21100);
+		}
+	}
+
+	void test_message_stats()
+	{
+		CSimContext context;
+		CComponentManager man(context);
+		man.LoadComponentTypes();
+		man.EnableMessageStats();
+
+		CParamNode noParam;
+		man.AddComponent(1, CID_Test1A, noParam);
+		man.AddComponent(2, CID_Test1A, noParam);
+		man.AddComponent(3, CID_Test2A, noParam);
+
+		CMessageTurnStart msg1;
+		man.BroadcastMessage(msg1);
+		man.PostMessage(1, msg1);
+
+		const CComponentManager::MessageStatsMap& stats = man.GetMessageStats();
+		CComponentManager::MessageStatsMap::const_iterator it;
+
+		it = stats.find(std::make_pair((int)MT_TurnStart, (int)CID_Test1A));
+		TS_ASSERT(it != stats.end());
+		if (it != stats.end())
+			TS_ASSERT_EQUALS(it->second.calls, (u32)3);
+
+		it = stats.find(std::make_pair((int)MT_TurnStart, (int)CID_Test2A));
+		TS_ASSERT(it != stats.end());
+		if (it != stats.end())
+			TS_ASSERT_EQUALS(it->second.calls, (u32)1);
+
+		TS_ASSERT_EQUALS(man.LookupMessageTypeName(MT_TurnStart), "TurnStart");
+	}
+
 	void test_ParamNode()
 	{
 		CSimContext context;
@@ -642,6 +795,66 @@ public:
 		TS_ASSERT(man2.QueryInterface(ent3, IID_Test2) == NULL);
 	}
 
+	void test_quick_hash()
+	{
+		CSimContext context;
+		CComponentManager man(context);
+		man.LoadComponentTypes();
+
+		CSimContext context2;
+		CComponentManager man2(context2);
+		man2.LoadComponentTypes();
+
+		entity_id_t ent1 = 1, ent2 = 2;
+		CParamNode noParam;
+
+		man.AddComponent(ent1, CID_Test1A, noParam);
+		man.AddComponent(ent2, CID_Test2A, noParam);
+		man2.AddComponent(ent1, CID_Test1A, noParam);
+		man2.AddComponent(ent2, CID_Test2A, noParam);
+
+		std::string hash1, hash2;
+		TS_ASSERT(man.ComputeStateHash(hash1, true));
+		TS_ASSERT(man2.ComputeStateHash(hash2, true));
+		TS_ASSERT_EQUALS(hash1, hash2);
+
+		// Hashing clears the dirty flags, and QueryInterface sets them
+		IComponent* cmp = man.GetEntitiesWithInterfaceUnordered(IID_Test1).find(ent1)->second;
+		TS_ASSERT(!cmp->IsStateHashDirty());
+		TS_ASSERT_EQUALS(man.QueryInterface(ent1, IID_Test1), cmp);
+		TS_ASSERT(cmp->IsStateHashDirty());
+		TS_ASSERT(man.ComputeStateHash(hash1, true));
+		TS_ASSERT(!cmp->IsStateHashDirty());
+
+		// Modify the state of ent1 in man (which has cached hashes) and
+		// compare against a manager that has to rehash everything
+		CMessageTurnStart msg;
+		man.PostMessage(ent1, msg);
+		man2.PostMessage(ent1, msg);
+
+		std::string hashBefore = hash1;
+		TS_ASSERT(man.ComputeStateHash(hash1, true));
+		TS_ASSERT_DIFFERS(hash1, hashBefore);
+
+		CSimContext context3;
+		CComponentManager man3(context3);
+		man3.LoadComponentTypes();
+		man3.AddComponent(ent1, CID_Test1A, noParam);
+		man3.AddComponent(ent2, CID_Test2A, noParam);
+		man3.PostMessage(ent1, msg);
+		std::string hash3;
+		TS_ASSERT(man3.ComputeStateHash(hash3, true));
+		TS_ASSERT_EQUALS(hash1, hash3);
+
+		// Unmodified state gives the same hash
+		TS_ASSERT(man.ComputeStateHash(hash2, true));
+		TS_ASSERT_EQUALS(hash1, hash2);
+
+		// The quick hash differs from the full one
+		TS_ASSERT(man.ComputeStateHash(hash2, false));
+		TS_ASSERT_DIFFERS(hash1, hash2);
+	}
+
 	void test_script_serialization()
 	{
 		CSimContext context;
@@ -0,0 +1,81 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "simulation2/helpers/HierarchicalPathfinder.h"
+
+class TestHierarchicalPathfinder : public CxxTest::TestSuite
+{
+	enum { PASS_CLASS = 4 };
+
+	// Impassable wall along column i, with optional gap at row gap
+	static void BuildWall(Grid<u16>& grid, u16 i, int gap)
+	{
+		for (u16 j = 0; j < grid.m_H; ++j)
+			grid.set(i, j, (j == gap) ? 0 : PASS_CLASS);
+	}
+
+public:
+	void test_regions()
+	{
+		Grid<u16> grid(150, 150);
+		BuildWall(grid, 100, -1);
+
+		HierarchicalPathfinder hier;
+		hier.Reset(&grid);
+
+		u16 a = hier.GetGlobalRegion(10, 10, PASS_CLASS);
+		u16 b = hier.GetGlobalRegion(140, 140, PASS_CLASS);
+		TS_ASSERT_DIFFERS(a, 0);
+		TS_ASSERT_DIFFERS(b, 0);
+		TS_ASSERT_DIFFERS(a, b);
+		TS_ASSERT_EQUALS(hier.GetGlobalRegion(100, 50, PASS_CLASS), 0);
+		TS_ASSERT_EQUALS(hier.GetGlobalRegion(99, 149, PASS_CLASS), a);
+		TS_ASSERT_EQUALS(hier.GetGlobalRegion(101, 0, PASS_CLASS), b);
+
+		// Other passability classes aren't blocked by the wall
+		TS_ASSERT_EQUALS(hier.GetGlobalRegion(10, 10, 8), hier.GetGlobalRegion(140, 140, 8));
+
+		u16 i, j;
+		TS_ASSERT(hier.FindNearestTileInGlobalRegion(130, 20, a, PASS_CLASS, i, j));
+		TS_ASSERT_EQUALS(i, 99);
+		TS_ASSERT_EQUALS(j, 20);
+	}
+
+	void test_update()
+	{
+		Grid<u16> grid(150, 150);
+		BuildWall(grid, 100, 70);
+
+		HierarchicalPathfinder hier;
+		hier.Reset(&grid);
+		TS_ASSERT_EQUALS(hier.GetGlobalRegion(10, 10, PASS_CLASS), hier.GetGlobalRegion(140, 140, PASS_CLASS));
+
+		// Close the gap
+		grid.set(100, 70, PASS_CLASS);
+		hier.MarkTileDirty(100, 70);
+		hier.Update();
+		TS_ASSERT_DIFFERS(hier.GetGlobalRegion(10, 10, PASS_CLASS), hier.GetGlobalRegion(140, 140, PASS_CLASS));
+
+		// Open a different gap, on a chunk boundary
+		grid.set(100, 128, 0);
+		hier.MarkTileDirty(100, 128);
+		hier.Update();
+		TS_ASSERT_EQUALS(hier.GetGlobalRegion(10, 10, PASS_CLASS), hier.GetGlobalRegion(140, 140, PASS_CLASS));
+	}
+};
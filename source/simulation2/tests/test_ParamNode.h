@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -148,6 +148,40 @@ public:
 		TS_ASSERT_EQUALS(node.GetChild("test").GetChild("t").ToBool(), true);
 	}
 
+	void test_compile()
+	{
+		CParamNode node;
+		TS_ASSERT_EQUALS(CParamNode::LoadXMLString(node, "<test a='1'><n>+010.75</n><t>true</t><b><c>3</c></b><z/></test>"), PSRETURN_OK);
+		node.Compile();
+		const CParamNode& test = node.GetChild("test");
+		TS_ASSERT(test.IsOk());
+		TS_ASSERT(!node.GetChild("Test").IsOk());
+		TS_ASSERT(!test.GetChild("").IsOk());
+		TS_ASSERT(!test.GetChild("nn").IsOk());
+		TS_ASSERT_EQUALS(test.GetChild("@a").ToInt(), 1);
+		TS_ASSERT_EQUALS(test.GetChild("n").ToInt(), 10);
+		TS_ASSERT_EQUALS(test.GetChild("n").ToFixed().ToDouble(), 10.75);
+		TS_ASSERT_EQUALS(test.GetChild("n").ToFloat(), 10.75f);
+		TS_ASSERT_EQUALS(test.GetChild("n").ToBool(), false);
+		TS_ASSERT_EQUALS(test.GetChild("t").ToBool(), true);
+		TS_ASSERT_EQUALS(test.GetChild("b").GetChild("c").ToInt(), 3);
+		TS_ASSERT(test.GetChild("z").IsOk());
+		TS_ASSERT(!test.GetChild("z").GetChild("c").IsOk());
+
+		// Copies are independent of the original's compiled data
+		CParamNode copy = node;
+		TS_ASSERT_EQUALS(CParamNode::LoadXMLString(copy, "<test><n>5</n><d>4</d></test>"), PSRETURN_OK);
+		TS_ASSERT_EQUALS(copy.GetChild("test").GetChild("n").ToInt(), 5);
+		TS_ASSERT_EQUALS(copy.GetChild("test").GetChild("d").ToInt(), 4);
+		TS_ASSERT_EQUALS(copy.GetChild("test").GetChild("b").GetChild("c").ToInt(), 3);
+		TS_ASSERT_EQUALS(node.GetChild("test").GetChild("n").ToInt(), 10);
+		TS_ASSERT(!node.GetChild("test").GetChild("d").IsOk());
+
+		copy.Compile();
+		TS_ASSERT_EQUALS(copy.GetChild("test").GetChild("n").ToInt(), 5);
+		TS_ASSERT_EQUALS(copy.GetChild("test").GetChild("d").ToInt(), 4);
+	}
+
 	void test_escape()
 	{
 		TS_ASSERT_WSTR_EQUALS(CParamNode::EscapeXMLString(L"test"), L"test");
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -170,6 +170,51 @@ public:
 		TS_ASSERT_EQUALS(stream.peek(), EOF);
 	}
 
+	void test_Std_arrays()
+	{
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+		const u8 a8[] = { 1, 2, 255 };
+		const u16 a16[] = { 0x1234, 0xfedc };
+		const u32 a32[] = { 0x12345678, 0xfedcba98 };
+
+		// Arrays must give the same output as their individual elements
+		std::stringstream streamArray, streamElements;
+		CStdSerializer serializeArray(script, streamArray);
+		CStdSerializer serializeElements(script, streamElements);
+		serializeArray.NumberArrayU8_Unbounded("a", a8, 3);
+		serializeArray.NumberArrayU16_Unbounded("a", a16, 2);
+		serializeArray.NumberArrayU32_Unbounded("a", a32, 2);
+		for (size_t i = 0; i < 3; ++i)
+			serializeElements.NumberU8_Unbounded("a", a8[i]);
+		for (size_t i = 0; i < 2; ++i)
+			serializeElements.NumberU16_Unbounded("a", a16[i]);
+		for (size_t i = 0; i < 2; ++i)
+			serializeElements.NumberU32_Unbounded("a", a32[i]);
+
+		TS_ASSERT_STREAM(streamArray, 15, "\x01\x02\xff" "\x34\x12\xdc\xfe" "\x78\x56\x34\x12\x98\xba\xdc\xfe");
+		TS_ASSERT_STREAM(streamElements, 15, "\x01\x02\xff" "\x34\x12\xdc\xfe" "\x78\x56\x34\x12\x98\xba\xdc\xfe");
+
+		CStdDeserializer deserialize(script, streamArray);
+		u8 b8[3];
+		u16 b16[2];
+		u32 b32[2];
+		deserialize.NumberArrayU8_Unbounded("a", b8, 3);
+		deserialize.NumberArrayU16_Unbounded("a", b16, 2);
+		deserialize.NumberArrayU32_Unbounded("a", b32, 2);
+		TS_ASSERT_SAME_DATA(b8, a8, sizeof(a8));
+		TS_ASSERT_SAME_DATA(b16, a16, sizeof(a16));
+		TS_ASSERT_SAME_DATA(b32, a32, sizeof(a32));
+
+		TS_ASSERT(streamArray.good());
+		TS_ASSERT_EQUALS(streamArray.peek(), EOF);
+
+		std::stringstream streamDebug;
+		CDebugSerializer serializeDebug(script, streamDebug);
+		serializeDebug.NumberArrayU8_Unbounded("a", a8, 3);
+		serializeDebug.NumberArrayU16_Unbounded("b", a16, 1);
+		TS_ASSERT_STR_EQUALS(streamDebug.str(), "a: 1\na: 2\na: 255\nb: 4660\n");
+	}
+
 	void test_Std_types()
 	{
 		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
@@ -250,6 +295,19 @@ public:
 		// echo -en "\x85\xff\xff\xff\xd2\x04\x00\x00\x39\x30\x00\x00" | openssl md5 | perl -pe 's/(..)/\\x$1/g'
 	}
 
+	void test_Hash_murmur3()
+	{
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+		CHashSerializer serialize(script, STATE_HASH_MURMUR3);
+
+		serialize.NumberI32_Unbounded("x", -123);
+		serialize.NumberU32_Unbounded("y", 1234);
+		serialize.NumberI32("z", 12345, 0, 65535);
+
+		TS_ASSERT_EQUALS(serialize.GetHashLength(), (size_t)16);
+		TS_ASSERT_SAME_DATA(serialize.ComputeHash(), "\xf0\x81\x76\x54\x39\x76\x7b\x42\x7d\x26\xdd\xba\x72\x68\x3d\x29", 16);
+	}
+
 	void test_bounds()
 	{
 		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
@@ -401,6 +459,35 @@ public:
 		helper_script_roundtrip("prop order 2", "var x={}; x.d=3; x.a=1; x.f=2; x.b=7; x", "({d:3, a:1, f:2, b:7})");
 	}
 
+	void test_script_numeric_props()
+	{
+		helper_script_roundtrip("numeric props", "({a:1, 10:2, 1234567:3})", "({a:1, 10:2, 1234567:3})");
+		helper_script_roundtrip("numeric props array", "[0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11]", "[0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11]");
+	}
+
+	void test_script_backrefs_many()
+	{
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+		CScriptVal obj;
+		// Enough objects to make the serializer's backref table grow several times
+		TS_ASSERT(script.Eval("var a = []; for (var i = 0; i < 5000; ++i) a.push({n: i}); [a, a.slice().reverse()]", obj));
+
+		std::stringstream stream;
+		CStdSerializer serialize(script, stream);
+		serialize.ScriptVal("script", obj);
+
+		CStdDeserializer deserialize(script, stream);
+		jsval newobj;
+		deserialize.ScriptVal("script", newobj);
+		TS_ASSERT(stream.good());
+		TS_ASSERT_EQUALS(stream.peek(), EOF);
+
+		TS_ASSERT(script.SetGlobal("b", CScriptVal(newobj)));
+		bool ok = false;
+		TS_ASSERT(script.Eval("b[0].length == 5000 && b[0].every(function(x, i) { return x.n == i && b[1][4999 - i] === x; })", ok));
+		TS_ASSERT(ok);
+	}
+
 	void test_script_array_sparse()
 	{
 		helper_script_roundtrip("array_sparse", "[,1,2,,4,,]", "[, 1, 2, , 4, ,]");
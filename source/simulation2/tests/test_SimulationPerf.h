@@ -0,0 +1,329 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "lib/self_test.h"
+
+#include "simulation2/Simulation2.h"
+#include "simulation2/components/ICmpOwnership.h"
+#include "simulation2/components/ICmpPosition.h"
+#include "simulation2/components/ICmpRangeManager.h"
+
+#include "graphics/MapReader.h"
+#include "graphics/Terrain.h"
+#include "graphics/TerrainTextureManager.h"
+#include "lib/tex/tex.h"
+#include "lib/timer.h"
+#include "ps/Filesystem.h"
+#include "ps/Loader.h"
+#include "ps/XML/Xeromyces.h"
+
+#include <fstream>
+#include <iomanip>
+
+/**
+ * Benchmarks of the simulation on its own (with no graphics), in a few
+ * canned scenarios set up on a standard map: a big battle, a big group
+ * moving across the map, a big city with territories, and LOS with and
+ * without reveal-all.
+ *
+ * Each scenario times the turn updates, serialization and state hashing,
+ * and compares them against the baseline file in the data directory
+ * (simulation_perf_baseline.txt), failing if a result is more than
+ * ALLOWED_VARIANCE_PERCENT slower. Results that aren't in the baseline yet
+ * are added to it, so delete the file to make a new baseline (e.g. on a
+ * different machine).
+ */
+class TestSimulationPerf : public CxxTest::TestSuite
+{
+	static const int ALLOWED_VARIANCE_PERCENT = 20;
+
+	static const int TURN_LENGTH = 200;
+
+	CTerrain* m_Terrain;
+	CSimulation2* m_Sim;
+
+	std::map<std::string, double> m_Baseline;
+	bool m_BaselineChanged;
+
+	OsPath GetBaselinePath()
+	{
+		return DataDir()/"simulation_perf_baseline.txt";
+	}
+
+	void LoadBaseline()
+	{
+		m_Baseline.clear();
+		m_BaselineChanged = false;
+
+		std::ifstream file(OsString(GetBaselinePath()).c_str());
+		std::string name;
+		double value;
+		while (file >> name >> value)
+			m_Baseline[name] = value;
+	}
+
+	void SaveBaseline()
+	{
+		if (!m_BaselineChanged)
+			return;
+
+		std::ofstream file(OsString(GetBaselinePath()).c_str(), std::ofstream::trunc);
+		for (std::map<std::string, double>::iterator it = m_Baseline.begin(); it != m_Baseline.end(); ++it)
+			file << it->first << " " << std::setprecision(9) << it->second << "\n";
+	}
+
+	/**
+	 * Prints a result (in seconds), and compares it against the baseline.
+	 */
+	void Report(const std::string& name, double value)
+	{
+		std::map<std::string, double>::iterator it = m_Baseline.find(name);
+		if (it == m_Baseline.end())
+		{
+			printf("\n  %-32s %10.3f msec (new baseline)", name.c_str(), value*1000.0);
+			m_Baseline[name] = value;
+			m_BaselineChanged = true;
+			return;
+		}
+
+		double change = (value - it->second) * 100.0 / it->second;
+		printf("\n  %-32s %10.3f msec (baseline %.3f, %+.1f%%)", name.c_str(), value*1000.0, it->second*1000.0, change);
+		if (change > ALLOWED_VARIANCE_PERCENT)
+			TS_FAIL(("Performance regression in " + name).c_str());
+	}
+
+	void LoadScenarioMap()
+	{
+		m_Terrain = new CTerrain();
+		m_Sim = new CSimulation2(NULL, m_Terrain);
+		m_Sim->LoadDefaultScripts();
+		m_Sim->ResetState();
+
+		CMapReader* mapReader = new CMapReader(); // it'll call "delete this" itself
+
+		LDR_BeginRegistering();
+		mapReader->LoadMap(L"maps/scenarios/Median Oasis.pmp", m_Terrain, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+			m_Sim, &m_Sim->GetSimContext(), -1, false);
+		LDR_EndRegistering();
+		TS_ASSERT_OK(LDR_NonprogressiveLoad());
+
+		m_Sim->Update(0);
+	}
+
+	float GetMapSize()
+	{
+		return (float)(m_Terrain->GetTilesPerSide() * TERRAIN_TILE_SIZE);
+	}
+
+	/**
+	 * Adds @p count entities in a square grid centred on (x, z).
+	 */
+	std::vector<entity_id_t> AddEntities(const std::wstring& templateName, player_id_t player, size_t count, float x, float z, float spacing)
+	{
+		std::vector<entity_id_t> ents;
+		size_t side = (size_t)ceil(sqrt((double)count));
+		for (size_t i = 0; i < count; ++i)
+		{
+			entity_id_t ent = m_Sim->AddEntity(templateName);
+			TS_ASSERT(ent != INVALID_ENTITY);
+
+			CmpPtr<ICmpPosition> cmpPosition(*m_Sim, ent);
+			if (cmpPosition)
+				cmpPosition->JumpTo(
+					entity_pos_t::FromFloat(x + ((float)(i % side) - side/2.f) * spacing),
+					entity_pos_t::FromFloat(z + ((float)(i / side) - side/2.f) * spacing));
+
+			CmpPtr<ICmpOwnership> cmpOwnership(*m_Sim, ent);
+			if (cmpOwnership)
+				cmpOwnership->SetOwner(player);
+
+			ents.push_back(ent);
+		}
+		return ents;
+	}
+
+	SimulationCommand WalkCommand(player_id_t player, const std::vector<entity_id_t>& ents, float x, float z)
+	{
+		std::stringstream json;
+		json << "{\"type\":\"walk\",\"entities\":[";
+		for (size_t i = 0; i < ents.size(); ++i)
+			json << (i ? "," : "") << ents[i];
+		json << "],\"x\":" << x << ",\"z\":" << z << ",\"queued\":false}";
+
+		SimulationCommand cmd;
+		cmd.player = player;
+		cmd.data = m_Sim->GetScriptInterface().ParseJSON(json.str());
+		return cmd;
+	}
+
+	/**
+	 * Runs @p turns turns (the first with @p commands), reporting the mean
+	 * and maximum turn times, then times serialization and hashing.
+	 */
+	void RunScenario(const std::string& name, size_t turns, const std::vector<SimulationCommand>& commands)
+	{
+		double total = 0.0;
+		double max = 0.0;
+		for (size_t i = 0; i < turns; ++i)
+		{
+			double t = timer_Time();
+			if (i == 0)
+				m_Sim->Update(TURN_LENGTH, commands);
+			else
+				m_Sim->Update(TURN_LENGTH);
+			t = timer_Time() - t;
+
+			if (i == 0)
+				Report(name + ".first_turn", t);
+			total += t;
+			max = std::max(max, t);
+		}
+		Report(name + ".turn_mean", total / turns);
+		Report(name + ".turn_max", max);
+
+		const size_t reps = 8;
+
+		double t = timer_Time();
+		for (size_t i = 0; i < reps; ++i)
+		{
+			std::stringstream stream;
+			TS_ASSERT(m_Sim->SerializeState(stream));
+		}
+		Report(name + ".serialize", (timer_Time() - t) / reps);
+
+		t = timer_Time();
+		for (size_t i = 0; i < reps; ++i)
+		{
+			std::string hash;
+			TS_ASSERT(m_Sim->ComputeStateHash(hash, false));
+		}
+		Report(name + ".hash", (timer_Time() - t) / reps);
+
+		t = timer_Time();
+		for (size_t i = 0; i < reps; ++i)
+		{
+			std::string hash;
+			TS_ASSERT(m_Sim->ComputeStateHash(hash, true));
+		}
+		Report(name + ".hash_quick", (timer_Time() - t) / reps);
+	}
+
+public:
+	void setUp()
+	{
+		CXeromyces::Startup();
+
+		g_VFS = CreateVfs(20 * MiB);
+		TS_ASSERT_OK(g_VFS->Mount(L"", DataDir()/"mods"/"public", VFS_MOUNT_MUST_EXIST));
+		TS_ASSERT_OK(g_VFS->Mount(L"cache/", DataDir()/"cache"));
+
+		// Need some stuff for terrain movement costs:
+		// (TODO: this ought to be independent of any graphics code)
+		tex_codec_register_all();
+		new CTerrainTextureManager;
+		g_TexMan.LoadTerrainTextures();
+
+		LoadBaseline();
+
+		m_Terrain = NULL;
+		m_Sim = NULL;
+	}
+
+	void tearDown()
+	{
+		SaveBaseline();
+
+		delete m_Sim;
+		delete m_Terrain;
+
+		delete &g_TexMan;
+		tex_codec_unregister_all();
+
+		g_VFS.reset();
+
+		CXeromyces::Terminate();
+	}
+
+	// disabled by default; run tests with the "-test TestSimulationPerf" flag to enable
+
+	void test_battle_DISABLED()
+	{
+		LoadScenarioMap();
+		float mid = GetMapSize() / 2.f;
+
+		// Two armies of 1000 which will fight once they've walked into range
+		std::vector<entity_id_t> army1 = AddEntities(L"units/athen_infantry_spearman_b", 1, 1000, mid - 60.f, mid, 2.f);
+		std::vector<entity_id_t> army2 = AddEntities(L"units/spart_infantry_spearman_b", 2, 1000, mid + 60.f, mid, 2.f);
+
+		std::vector<SimulationCommand> commands;
+		commands.push_back(WalkCommand(1, army1, mid, mid));
+		commands.push_back(WalkCommand(2, army2, mid, mid));
+		RunScenario("battle", 150, commands);
+	}
+
+	void test_move_DISABLED()
+	{
+		LoadScenarioMap();
+		float size = GetMapSize();
+
+		// 500 units walking from one corner of the map to the opposite one
+		std::vector<entity_id_t> group = AddEntities(L"units/athen_infantry_spearman_b", 1, 500, size * 0.15f, size * 0.15f, 2.f);
+
+		std::vector<SimulationCommand> commands;
+		commands.push_back(WalkCommand(1, group, size * 0.85f, size * 0.85f));
+		RunScenario("move", 150, commands);
+	}
+
+	void test_city_DISABLED()
+	{
+		LoadScenarioMap();
+		float size = GetMapSize();
+
+		// Two cities of 500 buildings each, with civil centres so they have territories
+		AddEntities(L"structures/athen_civil_centre", 1, 1, size * 0.3f, size * 0.5f, 0.f);
+		AddEntities(L"structures/spart_civil_centre", 2, 1, size * 0.7f, size * 0.5f, 0.f);
+		AddEntities(L"structures/athen_house", 1, 499, size * 0.3f, size * 0.5f, 12.f);
+		AddEntities(L"structures/spart_house", 2, 499, size * 0.7f, size * 0.5f, 12.f);
+
+		RunScenario("city", 50, std::vector<SimulationCommand>());
+	}
+
+	void test_los_DISABLED()
+	{
+		LoadScenarioMap();
+		float size = GetMapSize();
+
+		// Units spread over the whole map, which all need LOS updates as they move
+		std::vector<entity_id_t> group1 = AddEntities(L"units/athen_infantry_spearman_b", 1, 500, size * 0.5f, size * 0.5f, size / 30.f);
+		std::vector<entity_id_t> group2 = AddEntities(L"units/spart_infantry_spearman_b", 2, 500, size * 0.5f, size * 0.5f, size / 30.f);
+
+		std::vector<SimulationCommand> commands;
+		commands.push_back(WalkCommand(1, group1, size * 0.2f, size * 0.8f));
+		commands.push_back(WalkCommand(2, group2, size * 0.8f, size * 0.2f));
+		RunScenario("los_per_player", 50, commands);
+
+		CmpPtr<ICmpRangeManager> cmpRangeManager(*m_Sim, SYSTEM_ENTITY);
+		TS_ASSERT(cmpRangeManager);
+		cmpRangeManager->SetLosRevealAll(-1, true);
+
+		commands.clear();
+		commands.push_back(WalkCommand(1, group1, size * 0.8f, size * 0.2f));
+		commands.push_back(WalkCommand(2, group2, size * 0.2f, size * 0.8f));
+		RunScenario("los_reveal_all", 50, commands);
+	}
+};
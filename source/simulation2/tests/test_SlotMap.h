@@ -0,0 +1,96 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "simulation2/helpers/SlotMap.h"
+
+class TestSlotMap : public CxxTest::TestSuite
+{
+public:
+	void test_basic()
+	{
+		SlotMap<int> map;
+		TS_ASSERT(map.empty());
+		TS_ASSERT(map.begin() == map.end());
+		TS_ASSERT(map.find(0) == map.end());
+		TS_ASSERT(map.find(1) == map.end());
+
+		u32 a = map.insert(1, 10);
+		u32 b = map.insert(2, 20);
+		TS_ASSERT_DIFFERS(a, (u32)0);
+		TS_ASSERT_DIFFERS(a, b);
+		TS_ASSERT_EQUALS(map.size(), (size_t)2);
+		TS_ASSERT_EQUALS(map.at(a), 10);
+		TS_ASSERT_EQUALS(map.find(b)->second, 20);
+
+		map.at(a) = 11;
+		TS_ASSERT_EQUALS(map.find(a)->second, 11);
+	}
+
+	void test_reuse()
+	{
+		SlotMap<int> map;
+		u32 a = map.insert(1, 10);
+		u32 b = map.insert(2, 20);
+		u32 c = map.insert(3, 30);
+
+		TS_ASSERT_EQUALS(map.erase(b), (size_t)1);
+		TS_ASSERT_EQUALS(map.erase(b), (size_t)0);
+		map.erase(map.find(a));
+		TS_ASSERT_EQUALS(map.size(), (size_t)1);
+
+		// The lowest free slot is reused, with a new generation
+		u32 d = map.insert(4, 40);
+		TS_ASSERT_EQUALS(d & SlotMap<int>::SLOT_MASK, a & SlotMap<int>::SLOT_MASK);
+		TS_ASSERT_DIFFERS(d, a);
+		TS_ASSERT(map.find(a) == map.end());
+		TS_ASSERT_EQUALS(map.at(d), 40);
+		TS_ASSERT_EQUALS(map.at(c), 30);
+
+		std::vector<u32> keys;
+		for (SlotMap<int>::const_iterator it = map.begin(); it != map.end(); ++it)
+			keys.push_back(it->first);
+		TS_ASSERT_EQUALS(keys.size(), (size_t)2);
+		TS_ASSERT_EQUALS(keys[0], d);
+		TS_ASSERT_EQUALS(keys[1], c);
+	}
+
+	void test_keyed_insert()
+	{
+		SlotMap<int> map;
+		u32 a = map.insert(1, 10);
+		u32 b = map.insert(2, 20);
+		u32 c = map.insert(3, 30);
+		u32 d = map.insert(4, 40);
+		map.erase(b);
+		map.erase(d);
+
+		// Rebuilding from the remaining keys (in any order, as when deserializing
+		// old-format data) must allocate the same keys afterwards
+		SlotMap<int> copy;
+		copy.insert(std::make_pair(c, 30));
+		copy.insert(std::make_pair(a, 10));
+		TS_ASSERT_EQUALS(copy.size(), (size_t)2);
+		TS_ASSERT_EQUALS(copy.at(a), 10);
+		TS_ASSERT_EQUALS(copy.at(c), 30);
+
+		TS_ASSERT_EQUALS(copy.insert(5, 50), map.insert(5, 50));
+		TS_ASSERT_EQUALS(copy.insert(6, 60), map.insert(6, 60));
+		TS_ASSERT_EQUALS(copy.insert(7, 70), map.insert(7, 70));
+	}
+};
@@ -0,0 +1,96 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "simulation2/serialization/ISerializer.h"
+#include "simulation2/serialization/IDeserializer.h"
+#include "simulation2/helpers/Spatial.h"
+
+class TestSpatialSubdivision : public CxxTest::TestSuite
+{
+public:
+	void test_points()
+	{
+		SpatialSubdivision<u32> subdiv;
+		subdiv.Reset(fixed::FromInt(1000), fixed::FromInt(1000), fixed::FromInt(20));
+
+		subdiv.Add(100, CFixedVector2D(fixed::FromInt(50), fixed::FromInt(50)));
+		subdiv.Add(101, CFixedVector2D(fixed::FromInt(60), fixed::FromInt(50)));
+		subdiv.Add(102, CFixedVector2D(fixed::FromInt(500), fixed::FromInt(500)));
+
+		std::vector<u32> items;
+		subdiv.GetNear(CFixedVector2D(fixed::FromInt(55), fixed::FromInt(55)), fixed::FromInt(10), items);
+		TS_ASSERT_EQUALS(items.size(), (size_t)2);
+		TS_ASSERT_EQUALS(items[0], (u32)100);
+		TS_ASSERT_EQUALS(items[1], (u32)101);
+
+		// The output buffer is replaced, not appended to
+		subdiv.GetNear(CFixedVector2D(fixed::FromInt(500), fixed::FromInt(500)), fixed::FromInt(10), items);
+		TS_ASSERT_EQUALS(items.size(), (size_t)1);
+		TS_ASSERT_EQUALS(items[0], (u32)102);
+
+		subdiv.Move(101, CFixedVector2D(fixed::FromInt(60), fixed::FromInt(50)), CFixedVector2D(fixed::FromInt(510), fixed::FromInt(500)));
+		subdiv.GetNear(CFixedVector2D(fixed::FromInt(500), fixed::FromInt(500)), fixed::FromInt(10), items);
+		TS_ASSERT_EQUALS(items.size(), (size_t)2);
+		TS_ASSERT_EQUALS(items[0], (u32)101);
+		TS_ASSERT_EQUALS(items[1], (u32)102);
+
+		subdiv.Remove(102, CFixedVector2D(fixed::FromInt(500), fixed::FromInt(500)));
+		TS_ASSERT_EQUALS(subdiv.GetNear(CFixedVector2D(fixed::FromInt(500), fixed::FromInt(500)), fixed::FromInt(10)).size(), (size_t)1);
+	}
+
+	void test_overflow()
+	{
+		// Put lots of items into a single division, so they don't all fit in the inline storage
+		SpatialSubdivision<u32> subdiv;
+		subdiv.Reset(fixed::FromInt(1000), fixed::FromInt(1000), fixed::FromInt(100));
+
+		CFixedVector2D pos(fixed::FromInt(150), fixed::FromInt(150));
+		for (u32 i = 0; i < 50; ++i)
+			subdiv.Add(i, pos);
+
+		for (u32 i = 0; i < 50; i += 3)
+			subdiv.Remove(i, pos);
+
+		std::vector<u32> items;
+		subdiv.GetNear(pos, fixed::FromInt(1), items);
+		TS_ASSERT_EQUALS(items.size(), (size_t)33);
+		for (size_t i = 0; i < items.size(); ++i)
+			TS_ASSERT(items[i] % 3 != 0);
+	}
+
+	void test_regions()
+	{
+		// Items with a size should be found from any division they overlap,
+		// but only returned once
+		SpatialSubdivision<u32> subdiv;
+		subdiv.Reset(fixed::FromInt(1000), fixed::FromInt(1000), fixed::FromInt(10));
+
+		subdiv.Add(1, CFixedVector2D(fixed::FromInt(5), fixed::FromInt(5)), CFixedVector2D(fixed::FromInt(95), fixed::FromInt(95)));
+
+		std::vector<u32> items;
+		subdiv.GetInRange(CFixedVector2D(fixed::FromInt(0), fixed::FromInt(0)), CFixedVector2D(fixed::FromInt(200), fixed::FromInt(200)), items);
+		TS_ASSERT_EQUALS(items.size(), (size_t)1);
+
+		subdiv.GetNear(CFixedVector2D(fixed::FromInt(90), fixed::FromInt(90)), fixed::FromInt(1), items);
+		TS_ASSERT_EQUALS(items.size(), (size_t)1);
+
+		subdiv.GetNear(CFixedVector2D(fixed::FromInt(500), fixed::FromInt(500)), fixed::FromInt(1), items);
+		TS_ASSERT_EQUALS(items.size(), (size_t)0);
+	}
+};
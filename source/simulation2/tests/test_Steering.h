@@ -0,0 +1,100 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "simulation2/helpers/Steering.h"
+
+class TestSteering : public CxxTest::TestSuite
+{
+	Steering::Neighbour MakeNeighbour(int x, int z, int vx, int vz)
+	{
+		Steering::Neighbour n = {
+			CFixedVector2D(fixed::FromInt(x), fixed::FromInt(z)),
+			CFixedVector2D(fixed::FromInt(vx), fixed::FromInt(vz)),
+			fixed::FromInt(1)
+		};
+		return n;
+	}
+
+public:
+	void test_no_conflict()
+	{
+		CFixedVector2D pos(fixed::FromInt(10), fixed::FromInt(10));
+		CFixedVector2D preferred(fixed::FromInt(9), fixed::Zero());
+		std::vector<Steering::Neighbour> neighbours;
+
+		TS_ASSERT_EQUALS(Steering::ComputeVelocity(pos, fixed::FromInt(1), preferred, neighbours), preferred);
+
+		// Units behind us, far to the side, or moving away faster than us are ignored
+		neighbours.push_back(MakeNeighbour(5, 10, 0, 0));
+		neighbours.push_back(MakeNeighbour(15, 20, 0, 0));
+		neighbours.push_back(MakeNeighbour(13, 10, 12, 0));
+		TS_ASSERT_EQUALS(Steering::ComputeVelocity(pos, fixed::FromInt(1), preferred, neighbours), preferred);
+		TS_ASSERT_EQUALS(Steering::ComputePenalty(pos, fixed::FromInt(1), preferred, preferred, neighbours), fixed::Zero());
+
+		// Moving away from a unit we're already overlapping is fine
+		neighbours.clear();
+		neighbours.push_back(MakeNeighbour(11, 10, 0, 0));
+		CFixedVector2D backwards(fixed::FromInt(-9), fixed::Zero());
+		TS_ASSERT_EQUALS(Steering::ComputeVelocity(pos, fixed::FromInt(1), backwards, neighbours), backwards);
+	}
+
+	void test_head_on()
+	{
+		CFixedVector2D posA(fixed::FromInt(10), fixed::FromInt(10));
+		CFixedVector2D posB(fixed::FromInt(16), fixed::FromInt(10));
+		CFixedVector2D prefA(fixed::FromInt(9), fixed::Zero());
+		CFixedVector2D prefB(fixed::FromInt(-9), fixed::Zero());
+
+		std::vector<Steering::Neighbour> neighboursA(1, MakeNeighbour(16, 10, -9, 0));
+		std::vector<Steering::Neighbour> neighboursB(1, MakeNeighbour(10, 10, 9, 0));
+
+		CFixedVector2D velA = Steering::ComputeVelocity(posA, fixed::FromInt(1), prefA, neighboursA);
+		CFixedVector2D velB = Steering::ComputeVelocity(posB, fixed::FromInt(1), prefB, neighboursB);
+
+		// Both should dodge, and the new velocities should be better than going straight
+		TS_ASSERT_DIFFERS(velA, prefA);
+		TS_ASSERT_DIFFERS(velB, prefB);
+		TS_ASSERT_LESS_THAN(Steering::ComputePenalty(posA, fixed::FromInt(1), prefA, velA, neighboursA),
+			Steering::ComputePenalty(posA, fixed::FromInt(1), prefA, prefA, neighboursA));
+
+		// They should keep going forwards, and dodge to opposite sides of the
+		// line between them (i.e. the same side relative to their own direction)
+		TS_ASSERT_LESS_THAN(fixed::Zero(), velA.X);
+		TS_ASSERT_LESS_THAN(velB.X, fixed::Zero());
+		TS_ASSERT(velA.Y != fixed::Zero());
+		TS_ASSERT_EQUALS(velA.Y > fixed::Zero(), velB.Y < fixed::Zero());
+	}
+
+	void test_deterministic()
+	{
+		CFixedVector2D pos(fixed::FromInt(50), fixed::FromInt(50));
+		CFixedVector2D preferred(fixed::FromInt(7), fixed::FromInt(3));
+		std::vector<Steering::Neighbour> neighbours;
+		neighbours.push_back(MakeNeighbour(53, 51, -2, 0));
+		neighbours.push_back(MakeNeighbour(52, 54, 0, -5));
+		neighbours.push_back(MakeNeighbour(55, 50, -6, 1));
+
+		CFixedVector2D v1 = Steering::ComputeVelocity(pos, fixed::FromInt(1), preferred, neighbours);
+		CFixedVector2D v2 = Steering::ComputeVelocity(pos, fixed::FromInt(1), preferred, neighbours);
+		TS_ASSERT_EQUALS(v1, v2);
+
+		// Never faster than the preferred speed
+		TS_ASSERT(v1.CompareLength(preferred.Length() + fixed::FromInt(1)/64) <= 0);
+	}
+};
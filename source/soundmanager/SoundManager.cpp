@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -33,6 +33,10 @@
 
 CSoundManager* g_SoundManager = NULL;
 
+// Maximum number of unused OpenAL buffers and PCM buffers to keep for reuse
+static const size_t MAX_POOLED_AL_BUFFERS = 256;
+static const size_t MAX_POOLED_PCM_BUFFERS = 4;
+
 
 class CSoundManagerWorker
 {
@@ -281,6 +285,18 @@ CSoundManager::~CSoundManager()
 	m_Worker->Shutdown();
 	m_Worker = 0L;
 
+	CSoundData::ReleaseCachedSoundData();
+
+	{
+		CScopeLock lock(m_PoolMutex);
+		if (!m_FreeALBuffers.empty())
+			alDeleteBuffers((ALsizei)m_FreeALBuffers.size(), &m_FreeALBuffers[0]);
+		m_FreeALBuffers.clear();
+		for (size_t i = 0; i < m_FreePCMBuffers.size(); ++i)
+			delete[] m_FreePCMBuffers[i];
+		m_FreePCMBuffers.clear();
+	}
+
 	alcDestroyContext(m_Context);
 	alcCloseDevice(m_Device);
 
@@ -326,8 +342,14 @@ Status CSoundManager::AlcInit()
 }
 void CSoundManager::SetMemoryUsage(long bufferSize, int bufferCount)
 {
+	CScopeLock lock(m_PoolMutex);
 	m_BufferCount = bufferCount;
 	m_BufferSize = bufferSize;
+
+	// The pooled PCM buffers are the wrong size now
+	for (size_t i = 0; i < m_FreePCMBuffers.size(); ++i)
+		delete[] m_FreePCMBuffers[i];
+	m_FreePCMBuffers.clear();
 }
 long CSoundManager::GetBufferCount()
 {
@@ -338,6 +360,74 @@ long CSoundManager::GetBufferSize()
 	return m_BufferSize;
 }
 
+bool CSoundManager::GenBuffers(ALsizei count, ALuint* buffers)
+{
+	CScopeLock lock(m_PoolMutex);
+
+	ALsizei reused = std::min(count, (ALsizei)m_FreeALBuffers.size());
+	for (ALsizei i = 0; i < reused; ++i)
+	{
+		buffers[i] = m_FreeALBuffers.back();
+		m_FreeALBuffers.pop_back();
+	}
+
+	if (reused < count)
+	{
+		alGenBuffers(count - reused, buffers + reused);
+		if (alGetError() != AL_NO_ERROR)
+		{
+			// Put the reused ones back for next time
+			m_FreeALBuffers.insert(m_FreeALBuffers.end(), buffers, buffers + reused);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void CSoundManager::DeleteBuffers(ALsizei count, const ALuint* buffers)
+{
+	CScopeLock lock(m_PoolMutex);
+
+	ALsizei kept = std::min(count, (ALsizei)(MAX_POOLED_AL_BUFFERS - m_FreeALBuffers.size()));
+	m_FreeALBuffers.insert(m_FreeALBuffers.end(), buffers, buffers + kept);
+
+	if (kept < count)
+		alDeleteBuffers(count - kept, buffers + kept);
+	AL_CHECK
+}
+
+u8* CSoundManager::AcquirePCMBuffer()
+{
+	CScopeLock lock(m_PoolMutex);
+
+	if (m_FreePCMBuffers.empty())
+		return new u8[m_BufferSize];
+
+	u8* buffer = m_FreePCMBuffers.back();
+	m_FreePCMBuffers.pop_back();
+	return buffer;
+}
+
+void CSoundManager::ReleasePCMBuffer(u8* buffer, long size)
+{
+	CScopeLock lock(m_PoolMutex);
+
+	if (size == m_BufferSize && m_FreePCMBuffers.size() < MAX_POOLED_PCM_BUFFERS)
+		m_FreePCMBuffers.push_back(buffer);
+	else
+		delete[] buffer;
+}
+
+size_t CSoundManager::GetMemoryUsage()
+{
+	size_t bytes = CSoundData::GetTotalMemoryUsage();
+
+	CScopeLock lock(m_PoolMutex);
+	bytes += m_FreePCMBuffers.size() * m_BufferSize;
+	return bytes;
+}
+
 void CSoundManager::SetMasterGain(float gain)
 {
 	m_Gain = gain;
@@ -434,14 +524,64 @@ void CSoundManager::PlayActionItem(ISoundItem* anItem)
 		}
 	}
 }
-void CSoundManager::PlayGroupItem(ISoundItem* anItem, ALfloat groupGain)
+// Maximum number of sound group items playing at once
+static const size_t MAX_GROUP_VOICES = 32;
+
+// Group sounds quieter than this are never started
+static const ALfloat MIN_AUDIBLE_GAIN = 0.01f;
+
+void CSoundManager::PlayGroupItem(ISoundItem* anItem, ALfloat groupGain, float priority)
 {
-	if (anItem)
+	if (!anItem || !m_Enabled || m_ActionGain <= 0)
+		return;
+
+	ALfloat gain = m_ActionGain * groupGain;
+	if (gain * m_Gain < MIN_AUDIBLE_GAIN)
+		return;
+
+	// Forget the voices that have finished. If this item is still playing it
+	// will be restarted on the same source, so it doesn't count either.
+	size_t leastImportant = 0;
+	for (size_t i = 0; i < m_GroupVoices.size(); )
 	{
-		if (m_Enabled && (m_ActionGain > 0)) {
-			anItem->SetGain(m_ActionGain * groupGain);
-			anItem->Play();
-			AL_CHECK
+		if (m_GroupVoices[i].item == anItem || !m_GroupVoices[i].item->IsPlaying())
+		{
+			m_GroupVoices[i] = m_GroupVoices.back();
+			m_GroupVoices.pop_back();
+			continue;
+		}
+		if (m_GroupVoices[i].priority < m_GroupVoices[leastImportant].priority)
+			leastImportant = i;
+		++i;
+	}
+
+	if (m_GroupVoices.size() >= MAX_GROUP_VOICES)
+	{
+		if (m_GroupVoices[leastImportant].priority >= priority)
+			return;
+
+		m_GroupVoices[leastImportant].item->Stop();
+		m_GroupVoices[leastImportant] = m_GroupVoices.back();
+		m_GroupVoices.pop_back();
+	}
+
+	anItem->SetGain(gain);
+	anItem->Play();
+	AL_CHECK
+
+	SGroupVoice voice = { anItem, priority };
+	m_GroupVoices.push_back(voice);
+}
+
+void CSoundManager::RemoveGroupItem(ISoundItem* anItem)
+{
+	for (size_t i = 0; i < m_GroupVoices.size(); ++i)
+	{
+		if (m_GroupVoices[i].item == anItem)
+		{
+			m_GroupVoices[i] = m_GroupVoices.back();
+			m_GroupVoices.pop_back();
+			return;
 		}
 	}
 }
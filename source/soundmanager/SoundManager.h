@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,6 +23,7 @@
 #if CONFIG2_AUDIO
 
 #include "lib/file/vfs/vfs_path.h"
+#include "ps/ThreadUtil.h"
 #include "soundmanager/items/ISoundItem.h"
 
 #include <vector>
@@ -54,6 +55,22 @@ protected:
 	bool m_MusicEnabled;
 	bool m_SoundEnabled;
 
+	// Recycled OpenAL buffer names and PCM decoding buffers (of m_BufferSize bytes),
+	// shared by the main thread and the worker thread; protected by m_PoolMutex
+	CMutex m_PoolMutex;
+	std::vector<ALuint> m_FreeALBuffers;
+	std::vector<u8*> m_FreePCMBuffers;
+
+	// Sound group items started by PlayGroupItem that may still be playing,
+	// so the number of simultaneous group voices can be limited.
+	// Only used by the main thread.
+	struct SGroupVoice
+	{
+		ISoundItem* item;
+		float priority;
+	};
+	std::vector<SGroupVoice> m_GroupVoices;
+
 public:
 	CSoundManager();
 	virtual ~CSoundManager();
@@ -82,10 +99,56 @@ public:
 	long GetBufferCount();
 	long GetBufferSize();
 
+	/**
+	 * Get @p count OpenAL buffers, reusing previously deleted ones where possible.
+	 * Can be called from any thread.
+	 * @return false on failure
+	 */
+	bool GenBuffers(ALsizei count, ALuint* buffers);
+
+	/**
+	 * Give back OpenAL buffers from GenBuffers (which mustn't be attached to
+	 * any sources any more), to be reused. Can be called from any thread.
+	 */
+	void DeleteBuffers(ALsizei count, const ALuint* buffers);
+
+	/**
+	 * Get a temporary buffer of GetBufferSize() bytes to decode into.
+	 * Can be called from any thread.
+	 */
+	u8* AcquirePCMBuffer();
+
+	/**
+	 * Give back a buffer from AcquirePCMBuffer (with the size it had then).
+	 * Can be called from any thread.
+	 */
+	void ReleasePCMBuffer(u8* buffer, long size);
+
+	/**
+	 * @return approximate number of bytes of memory used by the decoded
+	 * one-shot sounds and the pooled decoding buffers (not including whatever
+	 * the OpenAL implementation keeps)
+	 */
+	size_t GetMemoryUsage();
+
 	void SetMusicItem(ISoundItem* anItem);
 	void SetAmbientItem(ISoundItem* anItem);
 	void PlayActionItem(ISoundItem* anItem);
-	void PlayGroupItem(ISoundItem* anItem, ALfloat groupGain);
+
+	/**
+	 * Play a sound group's item, unless it's too quiet to be heard or too many
+	 * group sounds are already playing. When MAX_GROUP_VOICES are playing,
+	 * the least important one is stopped if it has a lower @p priority than
+	 * this one, else this one is dropped.
+	 * @param priority importance of the sound (the group's priority scaled by
+	 *   how audible it is)
+	 */
+	void PlayGroupItem(ISoundItem* anItem, ALfloat groupGain, float priority);
+
+	/**
+	 * Forget about a group item that's about to be deleted.
+	 */
+	void RemoveGroupItem(ISoundItem* anItem);
 
 	void SetMasterGain(float gain);
 	void SetMusicGain(float gain);
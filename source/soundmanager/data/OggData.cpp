@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,14 +27,22 @@
 #include "soundmanager/SoundManager.h"
 #include "ps/CLogger.h"
 
+// Number of buffers a streamed sound decodes when it's loaded (by the main
+// thread); the rest are decoded by the sound manager's worker thread as
+// the sound plays
+static const int STREAM_START_BUFFERS = 8;
+
 COggData::COggData()
 {
 	m_OneShot = false;
+	m_BuffersUsed = 0;
+	m_BytesDecoded = 0;
 }
 
 COggData::~COggData()
 {
-	alDeleteBuffers(m_BuffersUsed, m_Buffer);
+	if (m_BuffersUsed > 0)
+		g_SoundManager->DeleteBuffers(m_BuffersUsed, m_Buffer);
 }
 
 void COggData::SetFormatAndFreq(int form, ALsizei freq)
@@ -45,7 +53,9 @@ void COggData::SetFormatAndFreq(int form, ALsizei freq)
 
 bool COggData::InitOggFile(const VfsPath& itemPath)
 {
-	int buffersToStart = g_SoundManager->GetBufferCount();	
+	int maxBuffers = std::min((int)g_SoundManager->GetBufferCount(), (int)ARRAY_SIZE(m_Buffer));
+	long bufferSize = g_SoundManager->GetBufferSize();
+
 	if ( OpenOggNonstream( g_VFS, itemPath, ogg) == INFO::OK )
 	{
 		m_FileFinished = false;
@@ -54,10 +64,18 @@ bool COggData::InitOggFile(const VfsPath& itemPath)
 		SetFileName( itemPath );
 	
 		AL_CHECK
-		
-		alGenBuffers(buffersToStart, m_Buffer);
-		
-		if(alGetError() != AL_NO_ERROR) 
+
+		// Sounds that fit in the buffers are decoded completely now, and can
+		// be shared by every item that plays them. Longer ones are streamed,
+		// so only decode enough to start playing
+		int buffersToStart = maxBuffers;
+		u64 pcmSize = ogg->GetPCMSize();
+		if (pcmSize > (u64)bufferSize * maxBuffers)
+			buffersToStart = std::min(STREAM_START_BUFFERS, maxBuffers);
+		else if (pcmSize > 0)
+			buffersToStart = std::max((int)((pcmSize + bufferSize - 1) / bufferSize), 1);
+
+		if (!g_SoundManager->GenBuffers(buffersToStart, m_Buffer))
 		{
 			LOGERROR( L"- Error creating initial buffer !!\n");
 			return false;
@@ -66,13 +84,9 @@ bool COggData::InitOggFile(const VfsPath& itemPath)
 		{
 			m_BuffersUsed = FetchDataIntoBuffer(buffersToStart, m_Buffer);
 			if (m_FileFinished)
-			{
 				m_OneShot = true;
-				if (m_BuffersUsed < buffersToStart)
-				{
-					alDeleteBuffers(buffersToStart - m_BuffersUsed, &m_Buffer[m_BuffersUsed]);
-				}
-			}
+			if (m_BuffersUsed < buffersToStart)
+				g_SoundManager->DeleteBuffers(buffersToStart - m_BuffersUsed, &m_Buffer[m_BuffersUsed]);
 			AL_CHECK
 		}
 		return true;
@@ -101,25 +115,30 @@ bool COggData::IsOneShot()
 	return m_OneShot;
 }
 
+size_t COggData::GetMemoryUsage()
+{
+	return m_BytesDecoded;
+}
+
 int COggData::FetchDataIntoBuffer(int count, ALuint* buffers)
 {
 	long bufferSize = g_SoundManager->GetBufferSize();
 	
-	u8* pcmout = new u8[bufferSize + 5000];
+	u8* pcmout = g_SoundManager->AcquirePCMBuffer();
 	int buffersWritten = 0;
 	
 	for (int i = 0; (i < count) && !m_FileFinished; i++)
 	{
-		memset( pcmout, 0, bufferSize + 5000 );
 		Status totalRet = ogg->GetNextChunk( pcmout, bufferSize);
 		m_FileFinished = ogg->atFileEOF();
 		if (totalRet > 0)
 		{
+			alBufferData(buffers[buffersWritten], m_Format, pcmout, (ALsizei)totalRet, (int)m_Frequency);
 			buffersWritten++;
-			alBufferData(buffers[i], m_Format, pcmout, (ALsizei)totalRet, (int)m_Frequency);
+			m_BytesDecoded += (size_t)totalRet;
 		}
 	}
-	delete[] pcmout;
+	g_SoundManager->ReleasePCMBuffer(pcmout, bufferSize);
 	return buffersWritten;
 }
 
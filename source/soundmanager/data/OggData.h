@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -44,6 +44,8 @@ public:
 	virtual int FetchDataIntoBuffer(int count, ALuint* buffers);
 	virtual void ResetFile();
 
+	virtual size_t GetMemoryUsage();
+
 protected:
 	OggStreamPtr  ogg;
 //	int m_current_section;
@@ -51,6 +53,7 @@ protected:
 	bool m_OneShot;
 	ALuint m_Buffer[100];
 	int m_BuffersUsed;
+	size_t m_BytesDecoded;
 
 	bool AddDataBuffer(char* data, long length);
 	void SetFormatAndFreq(int form, ALsizei freq);
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,6 +27,13 @@
 #include <iostream>
 
 DataMap* CSoundData::sSoundData = NULL;
+std::list<CSoundData*>* CSoundData::sUnusedSoundData = NULL;
+size_t CSoundData::sUnusedMemoryUsage = 0;
+
+// Maximum total size of the decoded one-shot sounds to keep when they're not
+// being played, so that sounds played repeatedly (e.g. when ordering a large
+// group of units) don't have to be decoded again every time
+static const size_t UNUSED_SOUND_DATA_BUDGET = 16*MiB;
 
 CSoundData::CSoundData()
 {
@@ -53,14 +60,53 @@ void CSoundData::ReleaseSoundData(CSoundData* theData)
 
 	if (theData->DecrementCount())
 	{
-		if ((itemFind = CSoundData::sSoundData->find( *theData->GetFileName() )) != sSoundData->end())
+		if ((itemFind = CSoundData::sSoundData->find( *theData->GetFileName() )) != sSoundData->end()
+			&& itemFind->second == theData)
 		{
-			CSoundData::sSoundData->erase(itemFind);
+			// Keep cached sounds around for a while
+			if (CSoundData::sUnusedSoundData == NULL)
+				CSoundData::sUnusedSoundData = new std::list<CSoundData*>;
+			sUnusedSoundData->push_back(theData);
+			sUnusedMemoryUsage += theData->GetMemoryUsage();
+			TrimUnusedSoundData(UNUSED_SOUND_DATA_BUDGET);
+			return;
 		}
 		delete theData;
 	}
 }
 
+void CSoundData::ReleaseCachedSoundData()
+{
+	TrimUnusedSoundData(0);
+}
+
+size_t CSoundData::GetTotalMemoryUsage()
+{
+	if (sSoundData == NULL)
+		return 0;
+
+	size_t bytes = 0;
+	for (DataMap::iterator it = sSoundData->begin(); it != sSoundData->end(); ++it)
+		bytes += it->second->GetMemoryUsage();
+	return bytes;
+}
+
+void CSoundData::TrimUnusedSoundData(size_t budget)
+{
+	if (sUnusedSoundData == NULL)
+		return;
+
+	while (sUnusedMemoryUsage > budget || (budget == 0 && !sUnusedSoundData->empty()))
+	{
+		CSoundData* data = sUnusedSoundData->front();
+		sUnusedSoundData->pop_front();
+		sUnusedMemoryUsage -= data->GetMemoryUsage();
+
+		sSoundData->erase(*data->GetFileName());
+		delete data;
+	}
+}
+
 CSoundData* CSoundData::SoundDataFromFile(const VfsPath& itemPath)
 {
 	if (CSoundData::sSoundData == NULL)
@@ -74,6 +120,17 @@ CSoundData* CSoundData::SoundDataFromFile(const VfsPath& itemPath)
 	if ((itemFind = CSoundData::sSoundData->find(itemPath.string())) != sSoundData->end())
 	{
 		answer = itemFind->second;
+
+		// It's about to be used again, so it can't be evicted from the cache
+		if (answer->m_RetentionCount <= 0 && sUnusedSoundData)
+		{
+			std::list<CSoundData*>::iterator it = std::find(sUnusedSoundData->begin(), sUnusedSoundData->end(), answer);
+			if (it != sUnusedSoundData->end())
+			{
+				sUnusedSoundData->erase(it);
+				sUnusedMemoryUsage -= answer->GetMemoryUsage();
+			}
+		}
 	}
 	else
 	{
@@ -119,6 +176,11 @@ ALsizei CSoundData::GetBufferCount()
 	return 1;
 }
 
+size_t CSoundData::GetMemoryUsage()
+{
+	return 0;
+}
+
 CStrW* CSoundData::GetFileName()
 {
 	return m_FileName;
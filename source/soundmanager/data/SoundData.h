@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -26,6 +26,7 @@
 #include "lib/file/vfs/vfs_path.h"
 #include "ps/CStr.h"
 
+#include <list>
 #include <map>
 
 class CSoundData;
@@ -40,6 +41,17 @@ public:
 
 	static void ReleaseSoundData(CSoundData* theData);
 
+	/**
+	 * Delete all the cached one-shot sounds that aren't being used.
+	 */
+	static void ReleaseCachedSoundData();
+
+	/**
+	 * @return total memory usage of the one-shot sounds that are loaded
+	 * (playing or cached)
+	 */
+	static size_t GetTotalMemoryUsage();
+
 	CSoundData();
 	CSoundData(ALuint dataSource);
 	virtual ~CSoundData();
@@ -57,9 +69,22 @@ public:
 
 	virtual ALuint* GetBufferPtr();
 
+	/**
+	 * @return number of bytes of decoded audio kept by this data
+	 */
+	virtual size_t GetMemoryUsage();
+
 protected:
 	static DataMap* sSoundData;
 
+	// One-shot sounds that were in sSoundData but aren't used by any items now,
+	// kept (least recently used first) in case they're played again soon
+	static std::list<CSoundData*>* sUnusedSoundData;
+	static size_t sUnusedMemoryUsage;
+
+	// Delete unused sounds until they fit in the cache's budget
+	static void TrimUnusedSoundData(size_t budget);
+
 	ALuint m_ALBuffer;
 	int m_RetentionCount;
 	CStrW* m_FileName;
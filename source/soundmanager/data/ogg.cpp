@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -259,6 +259,15 @@ public:
 		return INFO::OK;
 	}
 
+	virtual u64 GetPCMSize()
+	{
+		const int link = -1;	// all bitstreams
+		ogg_int64_t samples = ov_pcm_total(&vf, link);
+		if(samples < 0)
+			return 0;
+		return (u64)samples * info->channels * sizeof(i16);
+	}
+
 	virtual Status GetNextChunk(u8* buffer, size_t size)
 	{
 		// we may have to call ov_read multiple times because it
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -33,6 +33,11 @@ public:
 	virtual bool atFileEOF() = 0;
 	virtual Status ResetFile() = 0;
 
+	/**
+	 * @return total size of the decoded PCM data in bytes, or 0 if unknown
+	 **/
+	virtual u64 GetPCMSize() = 0;
+
 	/**
 	 * @return bytes read (<= size) or a (negative) Status
 	 **/
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -47,8 +47,8 @@ extern CGame *g_Game;
 
 #define PI 3.14126f
 
-
-static const bool DISABLE_INTENSITY = true; // disable for now since it's broken
+// Sounds at the edges of the screen are less important than the ones in the middle
+static const float OFFSCREEN_PRIORITY_SCALE = 0.5f;
 
 void CSoundGroup::SetGain(float gain)
 {
@@ -60,7 +60,6 @@ void CSoundGroup::SetDefaultValues()
 {
 	m_index = 0;
 	m_Flags = 0;
-	m_Intensity = 0;
 	m_CurTime = 0.0f;
 
 	// sane defaults; will probably be replaced by the values read during LoadSoundGroup.
@@ -74,9 +73,8 @@ void CSoundGroup::SetDefaultValues()
 	m_ConeOuterGain = 0.0f;
 	m_ConeInnerAngle = 360.0f;
 	m_ConeOuterAngle = 360.0f;
-	m_Decay = 3.0f;
-	m_IntensityThreshold = 3;
-	// WARNING: m_TimeWindow is currently unused and uninitialized
+	m_Decay = 1.0f;
+	m_IntensityThreshold = 6;
 }
 
 CSoundGroup::CSoundGroup()
@@ -200,7 +198,11 @@ void CSoundGroup::UploadPropertiesAndPlay(int theIndex, const CVector3D& positio
 
 					hSound->SetCone(m_ConeInnerAngle, m_ConeOuterAngle, m_ConeOuterGain);
 
-					g_SoundManager->PlayGroupItem(hSound, theGain);
+					float priority = m_Priority * theGain;
+					if (itemRollOff > initialRolllOff)
+						priority *= OFFSCREEN_PRIORITY_SCALE;
+
+					g_SoundManager->PlayGroupItem(hSound, theGain, priority);
 				}
 			}
 		}
@@ -224,7 +226,15 @@ void CSoundGroup::PlayNext(const CVector3D& position)
 	// if no sounds, return
 	if (filenames.size() == 0)
 		return;
-	
+
+	// Drop the sound if too many of this group have been started recently
+	// (e.g. in a battle, where dozens of units hit each other at once)
+	while (!m_PlayTimes.empty() && m_PlayTimes.front() <= m_CurTime - m_Decay)
+		m_PlayTimes.pop_front();
+	if (m_PlayTimes.size() >= m_IntensityThreshold)
+		return;
+	m_PlayTimes.push_back(m_CurTime);
+
 	m_index = (size_t)rand(0, (size_t)filenames.size());
 	UploadPropertiesAndPlay(m_index, position);
 }
@@ -259,14 +269,17 @@ void CSoundGroup::ReleaseGroup()
 #if CONFIG2_AUDIO
 	for (size_t i = 0; i < snd_group.size(); i++)
 	{
+		if (g_SoundManager)
+			g_SoundManager->RemoveGroupItem(snd_group[i]);
 		snd_group[i]->FadeAndDelete(0.2);
 	}
 	snd_group.clear();
 #endif // CONFIG2_AUDIO
 }
 
-void CSoundGroup::Update(float UNUSED(TimeSinceLastFrame))
+void CSoundGroup::Update(float TimeSinceLastFrame)
 {
+	m_CurTime += TimeSinceLastFrame;
 }
 
 bool CSoundGroup::LoadSoundGroup(const VfsPath& pathnameXML)
@@ -397,7 +410,7 @@ bool CSoundGroup::LoadSoundGroup(const VfsPath& pathnameXML)
 		}
 		else if(child_name == el_threshold)
 		{
-			m_IntensityThreshold = child.GetText().ToFloat();
+			m_IntensityThreshold = child.GetText().ToInt();
 		}
 		else if(child_name == el_decay)
 		{
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -41,6 +41,8 @@ Example SoundGroup.xml
 		<ConeGain>1.0</ConeGain>
 		<ConeInner>360</ConeInner>
 		<ConeOuter>360</ConeOuter>
+		<Threshold>6</Threshold>
+		<Decay>1.0</Decay>
 		<Sound>audio/voice/hellenes/soldier/Attack_Attackx.ogg</Sound>
 		<Sound>audio/voice/hellenes/soldier/Attack_Chargex.ogg</Sound>
 		<Sound>audio/voice/hellenes/soldier/Attack_Engagex.ogg</Sound>
@@ -55,6 +57,7 @@ Example SoundGroup.xml
 #include "lib/config2.h"
 #include "lib/file/vfs/vfs_path.h"
 
+#include <deque>
 #include <vector>
 
 class CVector3D;
@@ -94,7 +97,7 @@ public:
 	// Release all remaining loaded handles
 	void ReleaseGroup();
 
-	// Update SoundGroup, remove dead sounds from intensity count
+	// Update SoundGroup, remove old sounds from intensity count
 	void Update(float TimeSinceLastFrame);
 
 	// Set a flag using a value from eSndGrpFlags
@@ -118,10 +121,9 @@ private:
 	VfsPath m_filepath; // the file path for the list of sound file resources
 
 	float m_CurTime; // Time elapsed since soundgroup was created
-	float m_TimeWindow; // The Intensity Threshold Window
-	size_t m_IntensityThreshold; // the allowable intensity before a sound switch	
-	size_t m_Intensity;  // our current intensity(number of sounds played since m_CurTime - m_TimeWindow) 
-	float m_Decay; // 
+	size_t m_IntensityThreshold; // the maximum number of sounds started within m_Decay seconds
+	std::deque<float> m_PlayTimes; // values of m_CurTime when each of the recently started sounds was played
+	float m_Decay; // the length of the intensity window, in seconds
 	unsigned char m_Flags; // up to eight individual parameters, use with eSndGrpFlags.
 	
 	float m_Gain;  
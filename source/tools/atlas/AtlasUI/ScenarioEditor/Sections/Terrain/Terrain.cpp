@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -113,11 +113,10 @@ public:
 			wxStaticText* label = new wxStaticText(this, wxID_ANY, FormatTextureName(*qry.preview->name), wxDefaultPosition, wxDefaultSize, wxALIGN_CENTER);
 			label->Wrap(m_Sizer->GetSize().GetX());
 
-			unsigned char* buf = (unsigned char*)(malloc(preview.imageData.GetSize()));
-			// imagedata.GetBuffer() gives a Shareable<unsigned char>*, which
-			// is stored the same as a unsigned char*, so we can just copy it.
-			memcpy(buf, preview.imageData.GetBuffer(), preview.imageData.GetSize());
-			wxImage img(qry.preview->imageWidth, qry.preview->imageHeight, buf);
+			// The bitmap is created before the preview (and its shared image
+			// data) is destroyed, so the image can use that data directly
+			// instead of copying it; it won't be modified
+			wxImage img(qry.preview->imageWidth, qry.preview->imageHeight, const_cast<unsigned char*>(preview.imageData->GetData()), true);
 
 			wxStaticBitmap* bitmap = new wxStaticBitmap(this, wxID_ANY, wxBitmap(img), wxDefaultPosition, wxSize(qry.preview->imageWidth, qry.preview->imageHeight), wxBORDER_SIMPLE);
 			m_Sizer->Add(bitmap, wxSizerFlags(1).Align(wxALIGN_CENTRE));
@@ -376,11 +375,8 @@ public:
 			wxStaticText* label = new wxStaticText(m_ScrolledPanel, wxID_ANY, FormatTextureName(name), wxDefaultPosition, wxDefaultSize, wxALIGN_CENTER);
 			label->Wrap(imageWidth);
 
-			unsigned char* buf = (unsigned char*)(malloc(previews[i].imageData.GetSize()));
-			// imagedata.GetBuffer() gives a Shareable<unsigned char>*, which
-			// is stored the same as a unsigned char*, so we can just copy it.
-			memcpy(buf, previews[i].imageData.GetBuffer(), previews[i].imageData.GetSize());
-			wxImage img (imageWidth, imageHeight, buf);
+			// (See the comment in TexturePreviewPanel about sharing the image data)
+			wxImage img (imageWidth, imageHeight, const_cast<unsigned char*>(previews[i].imageData->GetData()), true);
 
 			wxButton* button = new wxBitmapButton(m_ScrolledPanel, wxID_ANY, wxBitmap(img));
 			// Store the texture name in the clientdata slot
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -510,10 +510,10 @@ void ActorViewer::Render()
 
 	g_Renderer.RenderScene(m);
 
-	glDisable(GL_DEPTH_TEST);
+	ogl_Disable(GL_DEPTH_TEST);
 	g_Logger->Render();
 	g_ProfileViewer.RenderProfile();
-	glEnable(GL_DEPTH_TEST);
+	ogl_Enable(GL_DEPTH_TEST);
 
 	g_Renderer.EndFrame();
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,9 +24,11 @@
 #include "ps/World.h"
 #include "graphics/Terrain.h"
 #include "lib/ogl.h"
+#include "lib/timer.h"
 #include "maths/MathUtil.h"
 #include "renderer/TerrainOverlay.h"
 #include "simulation2/Simulation2.h"
+#include "simulation2/components/ICmpTerrain.h"
 #include "simulation2/system/SimContext.h"
 
 using namespace AtlasMessage;
@@ -129,3 +131,50 @@ void Brush::SetRenderEnabled(bool enabled)
 }
 
 Brush AtlasMessage::g_CurrentBrush;
+
+//////////////////////////////////////////////////////////////////////////
+
+// How long the terrain must be left alone before a stroke counts as finished
+static const double TERRAIN_CHANGE_SETTLE_TIME = 0.25; // seconds
+
+static bool g_TerrainChangePending = false;
+static ssize_t g_TerrainChangeI0, g_TerrainChangeJ0, g_TerrainChangeI1, g_TerrainChangeJ1;
+static double g_TerrainChangeTime;
+
+void AtlasMessage::DeferTerrainChange(ssize_t i0, ssize_t j0, ssize_t i1, ssize_t j1)
+{
+	if (!g_TerrainChangePending)
+	{
+		g_TerrainChangeI0 = i0;
+		g_TerrainChangeJ0 = j0;
+		g_TerrainChangeI1 = i1;
+		g_TerrainChangeJ1 = j1;
+		g_TerrainChangePending = true;
+	}
+	else
+	{
+		g_TerrainChangeI0 = std::min(g_TerrainChangeI0, i0);
+		g_TerrainChangeJ0 = std::min(g_TerrainChangeJ0, j0);
+		g_TerrainChangeI1 = std::max(g_TerrainChangeI1, i1);
+		g_TerrainChangeJ1 = std::max(g_TerrainChangeJ1, j1);
+	}
+	g_TerrainChangeTime = timer_Time();
+}
+
+void AtlasMessage::FlushDeferredTerrainChanges(bool force)
+{
+	if (!g_TerrainChangePending)
+		return;
+
+	if (!force && timer_Time() - g_TerrainChangeTime < TERRAIN_CHANGE_SETTLE_TIME)
+		return;
+
+	g_TerrainChangePending = false;
+
+	if (!g_Game)
+		return;
+
+	CmpPtr<ICmpTerrain> cmpTerrain(*g_Game->GetSimulation2(), SYSTEM_ENTITY);
+	if (cmpTerrain)
+		cmpTerrain->MakeDirty(g_TerrainChangeI0, g_TerrainChangeJ0, g_TerrainChangeI1, g_TerrainChangeJ1);
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -54,6 +54,26 @@ private:
 
 extern Brush g_CurrentBrush;
 
+/**
+ * Brush strokes change the terrain every frame while the mouse button is held.
+ * Telling the simulation about every change makes the pathfinder, water and
+ * territories recompute themselves every frame, which is very slow on large
+ * maps; so instead the changed tiles are accumulated here, and the simulation
+ * is told about them all at once when the stroke has finished.
+ * (The renderer should still be told about changes immediately, with
+ * CTerrain::MakeDirty, since it already only updates once per frame.)
+ *
+ * Tiles are in the same form as ICmpTerrain::MakeDirty.
+ */
+void DeferTerrainChange(ssize_t i0, ssize_t j0, ssize_t i1, ssize_t j1);
+
+/**
+ * Sends the accumulated changes to the simulation, if there are any and
+ * either @p force is set or there haven't been any more changes for a
+ * short while (i.e. the stroke has ended). Called once per frame.
+ */
+void FlushDeferredTerrainChanges(bool force);
+
 }
 
 #endif // INCLUDED_BRUSHES
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -49,6 +49,7 @@ namespace AtlasMessage {
 
 
 CommandProc::CommandProc()
+	: m_MemoryBudget(256*MiB)
 {
 	// Start the list with a NULL, so m_CurrentCommand can point at
 	// something even when the command stack is empty
@@ -81,6 +82,8 @@ void CommandProc::Submit(Command* cmd)
 	m_CurrentCommand = m_Commands.insert(next_it(m_CurrentCommand), cmd);
 
 	(*m_CurrentCommand)->Do();
+
+	TrimHistory();
 }
 
 void CommandProc::Undo()
@@ -139,4 +142,32 @@ void CommandProc::Merge()
 	m_Commands.erase(m_CurrentCommand);
 
 	m_CurrentCommand = prev;
+
+	TrimHistory();
+}
+
+void CommandProc::SetMemoryBudget(size_t bytes)
+{
+	m_MemoryBudget = bytes;
+	TrimHistory();
+}
+
+void CommandProc::TrimHistory()
+{
+	if (m_Commands.empty())
+		return;
+
+	size_t total = 0;
+	for (cmdIt it = next_it(m_Commands.begin()); it != m_Commands.end(); ++it)
+		total += (*it)->GetMemoryUsage();
+
+	// Never delete the current command, so the most recent change can
+	// always be undone
+	while (total > m_MemoryBudget && m_CurrentCommand != m_Commands.begin() && next_it(m_Commands.begin()) != m_CurrentCommand)
+	{
+		cmdIt oldest = next_it(m_Commands.begin());
+		total -= (*oldest)->GetMemoryUsage();
+		delete *oldest;
+		m_Commands.erase(oldest);
+	}
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -35,6 +35,9 @@ struct Command
 	virtual void Redo() = 0;
 	virtual void Merge(Command* prev) = 0;
 	virtual const char* GetType() const = 0;
+
+	// Returns the (approximate) number of bytes used by the command's undo data
+	virtual size_t GetMemoryUsage() const { return 0; }
 };
 
 class CommandProc
@@ -53,7 +56,16 @@ public:
 	void Redo();
 	void Merge();
 
+	// Sets the maximum amount of memory that the undo history may use;
+	// once it's exceeded, the oldest commands are forgotten
+	void SetMemoryBudget(size_t bytes);
+
 private:
+	// Deletes the oldest executed commands until the history fits in the budget
+	void TrimHistory();
+
+	size_t m_MemoryBudget;
+
 	std::list<Command*> m_Commands;
 	typedef std::list<Command*>::iterator cmdIt;
 	// The 'current' command is the latest one which has been executed
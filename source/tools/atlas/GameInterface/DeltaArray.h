@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,9 +18,18 @@
 #ifndef INCLUDED_DELTAARRAY
 #define INCLUDED_DELTAARRAY
 
+/**
+ * Records the old and new values of the cells of a 2D array that have been
+ * changed, so the changes can be undone and redone.
+ *
+ * Brushes change compact areas, so the changes are stored in square chunks
+ * of cells: each chunk has a table mapping its cells onto a list of the
+ * changed ones, which costs far less than a hash map node per cell.
+ */
 template<typename T> class DeltaArray2D
 {
 public:
+	DeltaArray2D() : m_NumCells(0) {}
 	virtual ~DeltaArray2D() {}
 
 	T get(ssize_t x, ssize_t y);
@@ -30,22 +39,46 @@ public:
 	void Undo();
 	void Redo();
 
+	/**
+	 * Returns the (approximate) number of bytes used to store the changes.
+	 */
+	size_t GetMemoryUsage() const;
+
 protected:
 	virtual T getOld(ssize_t x, ssize_t y) = 0;
 	virtual void setNew(ssize_t x, ssize_t y, const T& val) = 0;
 
 private:
-	std::size_t hash_value(const std::pair<ssize_t, ssize_t>& p)
+	static const ssize_t CHUNK_SHIFT = 4;
+	static const ssize_t CHUNK_SIZE = 1 << CHUNK_SHIFT;
+	static const u16 NO_CELL = 0xFFFF;
+
+	struct Chunk
 	{
-		std::size_t seed = 0;
-		boost::hash_combine(seed, p.first << 16);
-		boost::hash_combine(seed, p.second);
-		return seed;
-	}
+		Chunk() { std::fill(index, index + CHUNK_SIZE*CHUNK_SIZE, (u16)NO_CELL); }
 
-	// TODO: more efficient representation
-	typedef boost::unordered_map<std::pair<ssize_t, ssize_t>, std::pair<T, T> > Data; // map of <x,y> -> <old_val, new_val>
+		// index[j*CHUNK_SIZE + i] is the position of cell (i,j) in 'cells', or NO_CELL
+		u16 index[CHUNK_SIZE*CHUNK_SIZE];
+		std::vector<std::pair<T, T> > cells; // <old_val, new_val>
+	};
+
+	typedef boost::unordered_map<std::pair<ssize_t, ssize_t>, Chunk> Data; // map of chunk <x,y> -> chunk
 	Data m_Data;
+	size_t m_NumCells;
+
+	static std::pair<ssize_t, ssize_t> ChunkKey(ssize_t x, ssize_t y)
+	{
+		// (Arithmetic shifts, so negative coordinates go to the right chunks)
+		return std::make_pair(x >> CHUNK_SHIFT, y >> CHUNK_SHIFT);
+	}
+
+	static size_t CellIndex(ssize_t x, ssize_t y)
+	{
+		return (y & (CHUNK_SIZE-1))*CHUNK_SIZE + (x & (CHUNK_SIZE-1));
+	}
+
+	// Calls setNew with either the old or the new value of every changed cell
+	void Apply(bool useNew);
 };
 
 //////////////////////////////////////////////////////////////////////////
@@ -53,21 +86,29 @@ private:
 template<typename T>
 T DeltaArray2D<T>::get(ssize_t x, ssize_t y)
 {
-	typename Data::iterator it = m_Data.find(std::make_pair(x, y));
-	if (it == m_Data.end())
-		return getOld(x, y);
-	else
-		return it->second.second;
+	typename Data::iterator it = m_Data.find(ChunkKey(x, y));
+	if (it != m_Data.end())
+	{
+		u16 idx = it->second.index[CellIndex(x, y)];
+		if (idx != NO_CELL)
+			return it->second.cells[idx].second;
+	}
+	return getOld(x, y);
 }
 
 template<typename T>
 void DeltaArray2D<T>::set(ssize_t x, ssize_t y, const T& val)
 {
-	typename Data::iterator it = m_Data.find(std::make_pair(x, y));
-	if (it == m_Data.end())
-		m_Data.insert(std::make_pair(std::make_pair(x, y), std::make_pair(getOld(x, y), val)));
+	Chunk& chunk = m_Data[ChunkKey(x, y)];
+	u16& idx = chunk.index[CellIndex(x, y)];
+	if (idx == NO_CELL)
+	{
+		idx = (u16)chunk.cells.size();
+		chunk.cells.push_back(std::make_pair(getOld(x, y), val));
+		++m_NumCells;
+	}
 	else
-		it->second.second = val;
+		chunk.cells[idx].second = val;
 	setNew(x, y, val);
 }
 
@@ -76,30 +117,67 @@ void DeltaArray2D<T>::OverlayWith(const DeltaArray2D<T>& overlayer)
 {
 	for (typename Data::const_iterator it = overlayer.m_Data.begin(); it != overlayer.m_Data.end(); ++it)
 	{
-		typename Data::iterator it2 = m_Data.find(it->first);
-		if (it2 == m_Data.end())
-			m_Data.insert(*it);
-		else
+		const Chunk& src = it->second;
+		Chunk& dst = m_Data[it->first];
+		for (size_t i = 0; i < (size_t)(CHUNK_SIZE*CHUNK_SIZE); ++i)
 		{
-			//ENSURE(it2->second.second == it->second.first);
-			it2->second.second = it->second.second;
+			if (src.index[i] == NO_CELL)
+				continue;
+
+			const std::pair<T, T>& cell = src.cells[src.index[i]];
+			if (dst.index[i] == NO_CELL)
+			{
+				dst.index[i] = (u16)dst.cells.size();
+				dst.cells.push_back(cell);
+				++m_NumCells;
+			}
+			else
+			{
+				//ENSURE(dst.cells[dst.index[i]].second == cell.first);
+				dst.cells[dst.index[i]].second = cell.second;
+			}
 		}
 	}
+}
 
+template <typename T>
+void DeltaArray2D<T>::Apply(bool useNew)
+{
+	for (typename Data::iterator it = m_Data.begin(); it != m_Data.end(); ++it)
+	{
+		const Chunk& chunk = it->second;
+		const ssize_t x0 = it->first.first << CHUNK_SHIFT;
+		const ssize_t y0 = it->first.second << CHUNK_SHIFT;
+		for (ssize_t j = 0; j < CHUNK_SIZE; ++j)
+		{
+			for (ssize_t i = 0; i < CHUNK_SIZE; ++i)
+			{
+				u16 idx = chunk.index[j*CHUNK_SIZE + i];
+				if (idx != NO_CELL)
+					setNew(x0 + i, y0 + j, useNew ? chunk.cells[idx].second : chunk.cells[idx].first);
+			}
+		}
+	}
 }
 
 template <typename T>
 void DeltaArray2D<T>::Undo()
 {
-	for (typename Data::iterator it = m_Data.begin(); it != m_Data.end(); ++it)
-		setNew(it->first.first, it->first.second, it->second.first);
+	Apply(false);
 }
 
 template <typename T>
 void DeltaArray2D<T>::Redo()
 {
-	for (typename Data::iterator it = m_Data.begin(); it != m_Data.end(); ++it)
-		setNew(it->first.first, it->first.second, it->second.second);
+	Apply(true);
+}
+
+template <typename T>
+size_t DeltaArray2D<T>::GetMemoryUsage() const
+{
+	// Count each chunk plus roughly the hash map's per-node overhead
+	const size_t perChunk = sizeof(typename Data::value_type) + 2*sizeof(void*);
+	return m_Data.size() * perChunk + m_NumCells * sizeof(std::pair<T, T>);
 }
 
 #endif // INCLUDED_DELTAARRAY
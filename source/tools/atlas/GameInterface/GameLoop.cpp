@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,6 +24,7 @@
 #include "SharedMemory.h"
 #include "Handlers/MessageHandler.h"
 #include "ActorViewer.h"
+#include "Brushes.h"
 #include "View.h"
 
 #include "InputProcessor.h"
@@ -212,6 +213,8 @@ static void* RunEngine(void* data)
 
 		ReloadChangedFiles();
 
+		FlushDeferredTerrainChanges(false);
+
 		RendererIncrementalLoad();
 
 		// Pump SDL events (e.g. hotkeys)
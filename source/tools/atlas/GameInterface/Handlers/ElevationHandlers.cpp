@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -28,7 +28,6 @@
 #include "maths/MathUtil.h"
 #include "graphics/RenderableObject.h"
 #include "simulation2/Simulation2.h"
-#include "simulation2/components/ICmpTerrain.h"
 
 #include "../Brushes.h"
 #include "../DeltaArray.h"
@@ -111,9 +110,7 @@ BEGIN_COMMAND(AlterElevation)
 	void MakeDirty()
 	{
 		g_Game->GetWorld()->GetTerrain()->MakeDirty(m_i0, m_j0, m_i1, m_j1, RENDERDATA_UPDATE_VERTICES);
-		CmpPtr<ICmpTerrain> cmpTerrain(*g_Game->GetSimulation2(), SYSTEM_ENTITY);
-		if (cmpTerrain)
-			cmpTerrain->MakeDirty(m_i0, m_j0, m_i1, m_j1);
+		DeferTerrainChange(m_i0, m_j0, m_i1, m_j1);
 	}
 
 	void Do()
@@ -167,6 +164,11 @@ BEGIN_COMMAND(AlterElevation)
 		MakeDirty();
 	}
 
+	size_t GetMemoryUsage() const
+	{
+		return m_TerrainDelta.GetMemoryUsage();
+	}
+
 	void MergeIntoPrevious(cAlterElevation* prev)
 	{
 		prev->m_TerrainDelta.OverlayWith(m_TerrainDelta);
@@ -193,9 +195,7 @@ BEGIN_COMMAND(SmoothElevation)
 	void MakeDirty()
 	{
 		g_Game->GetWorld()->GetTerrain()->MakeDirty(m_i0, m_j0, m_i1, m_j1, RENDERDATA_UPDATE_VERTICES);
-		CmpPtr<ICmpTerrain> cmpTerrain(*g_Game->GetSimulation2(), SYSTEM_ENTITY);
-		if (cmpTerrain)
-			cmpTerrain->MakeDirty(m_i0, m_j0, m_i1, m_j1);
+		DeferTerrainChange(m_i0, m_j0, m_i1, m_j1);
 	}
 
 	void Do()
@@ -279,6 +279,11 @@ BEGIN_COMMAND(SmoothElevation)
 		MakeDirty();
 	}
 
+	size_t GetMemoryUsage() const
+	{
+		return m_TerrainDelta.GetMemoryUsage();
+	}
+
 	void MergeIntoPrevious(cSmoothElevation* prev)
 	{
 		prev->m_TerrainDelta.OverlayWith(m_TerrainDelta);
@@ -305,9 +310,7 @@ BEGIN_COMMAND(FlattenElevation)
 	void MakeDirty()
 	{
 		g_Game->GetWorld()->GetTerrain()->MakeDirty(m_i0, m_j0, m_i1, m_j1, RENDERDATA_UPDATE_VERTICES);
-		CmpPtr<ICmpTerrain> cmpTerrain(*g_Game->GetSimulation2(), SYSTEM_ENTITY);
-		if (cmpTerrain)
-			cmpTerrain->MakeDirty(m_i0, m_j0, m_i1, m_j1);
+		DeferTerrainChange(m_i0, m_j0, m_i1, m_j1);
 	}
 
 	void Do()
@@ -354,6 +357,11 @@ BEGIN_COMMAND(FlattenElevation)
 		MakeDirty();
 	}
 
+	size_t GetMemoryUsage() const
+	{
+		return m_TerrainDelta.GetMemoryUsage();
+	}
+
 	void MergeIntoPrevious(cFlattenElevation* prev)
 	{
 		prev->m_TerrainDelta.OverlayWith(m_TerrainDelta);
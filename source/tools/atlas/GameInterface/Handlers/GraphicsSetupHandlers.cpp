@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -29,6 +29,7 @@
 #include "lib/external_libraries/libsdl.h"
 #include "maths/MathUtil.h"
 #include "ps/CConsole.h"
+#include "ps/ConfigDB.h"
 #include "ps/Game.h"
 #include "ps/VideoMode.h"
 #include "ps/GameSetup/Config.h"
@@ -51,6 +52,11 @@ MESSAGEHANDLER(Init)
 	// (This must be done after Init loads the config DB,
 	// but before the UI constructs its GL canvases.)
 	g_VideoMode.InitNonSDL();
+
+	int undoMemory = 256; // MiB
+	CFG_GET_SYS_VAL("atlas.undomemory", Int, undoMemory);
+	if (undoMemory > 0)
+		GetCommandProc().SetMemoryBudget((size_t)undoMemory * MiB);
 }
 
 MESSAGEHANDLER(InitGraphics)
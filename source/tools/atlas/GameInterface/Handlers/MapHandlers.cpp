@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,6 +18,7 @@
 #include "precompiled.h"
 
 #include "MessageHandler.h"
+#include "../Brushes.h"
 #include "../GameLoop.h"
 #include "../CommandProc.h"
 
@@ -125,6 +126,9 @@ QUERYHANDLER(GenerateMap)
 
 MESSAGEHANDLER(LoadMap)
 {
+	// (Don't let the old map's changes get sent to the new map)
+	FlushDeferredTerrainChanges(true);
+
 	InitGame();
 
 	// Scenario
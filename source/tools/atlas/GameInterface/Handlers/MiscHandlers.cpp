@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,6 +20,7 @@
 #include "MessageHandler.h"
 #include "../MessagePasserImpl.h"
 
+#include "../Brushes.h"
 #include "../GameLoop.h"
 #include "../View.h"
 #include "graphics/CinemaTrack.h"
@@ -142,6 +143,10 @@ QUERYHANDLER(SimStateDebugDump)
 
 MESSAGEHANDLER(SimPlay)
 {
+	// Make sure the simulation knows about the whole of the terrain
+	// before it starts moving units over it
+	FlushDeferredTerrainChanges(true);
+
 	AtlasView::GetView_Game()->SetSpeedMultiplier(msg->speed);
 }
 
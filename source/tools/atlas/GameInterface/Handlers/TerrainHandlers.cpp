@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -31,7 +31,6 @@
 #include "lib/res/graphics/ogl_tex.h"
 #include "simulation2/Simulation2.h"
 #include "simulation2/components/ICmpPathfinder.h"
-#include "simulation2/components/ICmpTerrain.h"
 #include "simulation2/helpers/Grid.h"
 
 #include "../Brushes.h"
@@ -61,7 +60,10 @@ static sTerrainTexturePreview GetPreview(CTerrainTextureEntry* tex, int width, i
 	sTerrainTexturePreview preview;
 	preview.name = tex->GetTag().FromUTF8();
 
-	std::vector<unsigned char> buf (width*height*3);
+	// Write straight into the shared buffer, so the image is never copied
+	// on its way to the UI
+	SharedBuffer buf (width*height*3);
+	unsigned char* data = buf.GetWritableData();
 
 #if !CONFIG2_GLES
 	// It's not good to shrink the entire texture to fit the small preview
@@ -85,7 +87,7 @@ static sTerrainTexturePreview GetPreview(CTerrainTextureEntry* tex, int width, i
 		// Extract the middle section (as a representative preview),
 		// and copy into buf
 		unsigned char* texdata_ptr = texdata + (w*(h - height)/2 + (w - width)/2) * 3;
-		unsigned char* buf_ptr = &buf[0];
+		unsigned char* buf_ptr = data;
 		for (ssize_t y = 0; y < height; ++y)
 		{
 			memcpy(buf_ptr, texdata_ptr, width*3);
@@ -103,9 +105,9 @@ static sTerrainTexturePreview GetPreview(CTerrainTextureEntry* tex, int width, i
 		u32 c = tex->GetBaseColor();
 		for (ssize_t i = 0; i < width*height; ++i)
 		{
-			buf[i*3+0] = (c>>16) & 0xff;
-			buf[i*3+1] = (c>>8) & 0xff;
-			buf[i*3+2] = (c>>0) & 0xff;
+			data[i*3+0] = (c>>16) & 0xff;
+			data[i*3+1] = (c>>8) & 0xff;
+			data[i*3+2] = (c>>0) & 0xff;
 		}
 	}
 
@@ -280,9 +282,7 @@ BEGIN_COMMAND(PaintTerrain)
 	void MakeDirty()
 	{
 		g_Game->GetWorld()->GetTerrain()->MakeDirty(m_i0, m_j0, m_i1, m_j1, RENDERDATA_UPDATE_INDICES);
-		CmpPtr<ICmpTerrain> cmpTerrain(*g_Game->GetSimulation2(), SYSTEM_ENTITY);
-		if (cmpTerrain)
-			cmpTerrain->MakeDirty(m_i0, m_j0, m_i1, m_j1);
+		DeferTerrainChange(m_i0, m_j0, m_i1, m_j1);
 	}
 
 	void Do()
@@ -343,6 +343,11 @@ BEGIN_COMMAND(PaintTerrain)
 		MakeDirty();
 	}
 
+	size_t GetMemoryUsage() const
+	{
+		return m_TerrainDelta.GetMemoryUsage();
+	}
+
 	void MergeIntoPrevious(cPaintTerrain* prev)
 	{
 		prev->m_TerrainDelta.OverlayWith(m_TerrainDelta);
@@ -369,9 +374,7 @@ BEGIN_COMMAND(ReplaceTerrain)
 	void MakeDirty()
 	{
 		g_Game->GetWorld()->GetTerrain()->MakeDirty(m_i0, m_j0, m_i1, m_j1, RENDERDATA_UPDATE_INDICES);
-		CmpPtr<ICmpTerrain> cmpTerrain(*g_Game->GetSimulation2(), SYSTEM_ENTITY);
-		if (cmpTerrain)
-			cmpTerrain->MakeDirty(m_i0, m_j0, m_i1, m_j1);
+		DeferTerrainChange(m_i0, m_j0, m_i1, m_j1);
 	}
 
 	void Do()
@@ -430,6 +433,11 @@ BEGIN_COMMAND(ReplaceTerrain)
 		m_TerrainDelta.Redo();
 		MakeDirty();
 	}
+
+	size_t GetMemoryUsage() const
+	{
+		return m_TerrainDelta.GetMemoryUsage();
+	}
 };
 END_COMMAND(ReplaceTerrain)
 
@@ -448,9 +456,7 @@ BEGIN_COMMAND(FillTerrain)
 	void MakeDirty()
 	{
 		g_Game->GetWorld()->GetTerrain()->MakeDirty(m_i0, m_j0, m_i1, m_j1, RENDERDATA_UPDATE_INDICES);
-		CmpPtr<ICmpTerrain> cmpTerrain(*g_Game->GetSimulation2(), SYSTEM_ENTITY);
-		if (cmpTerrain)
-			cmpTerrain->MakeDirty(m_i0, m_j0, m_i1, m_j1);
+		DeferTerrainChange(m_i0, m_j0, m_i1, m_j1);
 	}
 
 	void Do()
@@ -544,6 +550,11 @@ BEGIN_COMMAND(FillTerrain)
 		m_TerrainDelta.Redo();
 		MakeDirty();
 	}
+
+	size_t GetMemoryUsage() const
+	{
+		return m_TerrainDelta.GetMemoryUsage();
+	}
 };
 END_COMMAND(FillTerrain)
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -270,7 +270,7 @@ struct sTerrainTexturePreview
 	Shareable<bool> loaded;
 	Shareable<int> imageWidth;
 	Shareable<int> imageHeight;
-	Shareable<std::vector<unsigned char> > imageData; // RGB*width*height
+	Shareable<SharedBuffer> imageData; // RGB*width*height
 };
 SHAREABLE_STRUCT(sTerrainTexturePreview);
 #endif
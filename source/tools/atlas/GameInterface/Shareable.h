@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -49,6 +49,11 @@ an STL object (e.g. "std::string s = *msg->sharedstring").
 Shareable<string>.c_str() and Shareable<vector>.GetBuffer/GetSize() can be used
 if that's all you need.)
 
+Large blocks of bytes (like images) should be passed as SharedBuffer instead
+of std::vector<unsigned char>. That stores the data once, in the shared heap,
+and copying it (when it's put into a message, returned by a query, unwrapped,
+etc) only copies a reference to the same data.
+
 The supported list of primitive types is below (SHAREABLE_PRIMITIVE).
 Structs are made shareable by manually ensuring that all their members are
 shareable (i.e. primitives and Shareable<T>s) and writing
@@ -288,6 +293,86 @@ public:
 };
 
 
+// Shareable bulk data:
+// A reference-counted block of bytes allocated from the shared heap.
+// The data is written once by whoever creates the buffer (using GetWritableData),
+// then treated as read-only by everyone it's passed to.
+// The reference count isn't thread-safe. That's fine as long as a buffer is
+// only passed between the game and the UI inside messages, since a message's
+// data is never used by both threads at once.
+class SharedBuffer
+{
+	struct Header
+	{
+		size_t refs;
+		size_t size;
+	};
+
+	Header* block; // followed by the data; NULL if empty
+
+	void Release()
+	{
+		if (block && --block->refs == 0)
+			ShareableFreeFptr(block);
+		block = NULL;
+	}
+
+public:
+	SharedBuffer() : block(NULL) {}
+
+	/**
+	 * Allocates an uninitialised buffer of @p size bytes.
+	 */
+	explicit SharedBuffer(size_t size) : block(NULL)
+	{
+		if (size == 0)
+			return;
+		block = static_cast<Header*> (ShareableMallocFptr(sizeof(Header) + size));
+		block->refs = 1;
+		block->size = size;
+	}
+
+	SharedBuffer(const SharedBuffer& rhs) : block(rhs.block)
+	{
+		if (block)
+			++block->refs;
+	}
+
+	SharedBuffer& operator=(const SharedBuffer& rhs)
+	{
+		Header* newBlock = rhs.block; // (rhs might be *this)
+		if (newBlock)
+			++newBlock->refs;
+		Release();
+		block = newBlock;
+		return *this;
+	}
+
+	~SharedBuffer()
+	{
+		Release();
+	}
+
+	size_t GetSize() const
+	{
+		return block ? block->size : 0;
+	}
+
+	const unsigned char* GetData() const
+	{
+		return block ? reinterpret_cast<const unsigned char*>(block + 1) : NULL;
+	}
+
+	// Only valid before the buffer has been shared with anyone else
+	unsigned char* GetWritableData()
+	{
+		return block ? reinterpret_cast<unsigned char*>(block + 1) : NULL;
+	}
+};
+
+SHAREABLE_STRUCT(SharedBuffer);
+
+
 // Shareable callbacks:
 // (TODO - this is probably not really safely shareable, due to unspecified calling conventions)
 template<typename T> struct Callback